@@ -324,6 +324,9 @@ class ProtoFieldParser:
         name   = self.name.group(0)
         if self.category == 'repeated':
             w.Write('%s_.clear();' % name)
+        elif self.type.IsBytesType():
+            w.Write('has_%s_ = false;' % name)
+            w.Write('%s_.clear();' % name)
         else:
             w.Write('has_%s_ = false;' % name)
             w.Write('%s_ = {};' % name)
@@ -445,7 +448,10 @@ class ProtoFieldParser:
                         (var_cpp_type, class_name, name))
                 w.Indent()
                 w.Write('has_%s_ = true;' % (name))
-                w.Write('return &%s_;' % name)
+                if self.type.IsBytesType():
+                    w.Write('return %s_.mutable_string();' % name)
+                else:
+                    w.Write('return &%s_;' % name)
                 w.Unindent()
                 w.Write("}")
             if not self.type.IsMessage():
@@ -465,6 +471,8 @@ class ProtoFieldParser:
         if self.category == 'repeated':
             w.Write("std::vector<%s> %s_;" % (cpp_type, name))
         else:
+            if self.type.IsBytesType():
+                cpp_type = 'lczero::ProtoBytes'
             w.Write("bool has_%s_{};" % (name))
             w.Write("%s %s_{};" % (cpp_type, name))
         return
@@ -30,10 +30,10 @@ from pybind.writer import Writer
 from pybind import Module, Class
 from pybind.parameters import (StringParameter, ClassParameter,
                                NumericParameter, ArgvObjects, IntegralArgv,
-                               ListOfStringsParameter)
+                               ListOfStringsParameter, BufferParameter)
 from pybind.retval import (StringViewRetVal, StringRetVal, ListOfStringsRetVal,
                            NumericRetVal, ObjCopyRetval, ObjOwnerRetval,
-                           ObjTupleRetVal, IntegralTupleRetVal)
+                           ObjTupleRetVal, IntegralTupleRetVal, BoolRetVal)
 from pybind.exceptions import CppException
 
 # Module
@@ -92,6 +92,15 @@ backend_caps = mod.AddClass(
 backend_caps.AddMethod('input_format').AddRetVal(NumericRetVal('i'))
 backend_caps.AddMethod('moves_left_format').AddRetVal(NumericRetVal('i'))
 
+# Pending evaluation class
+pending = mod.AddClass(
+    Class('PendingEvaluation',
+          cpp_name='lczero::python::PendingEvaluation',
+          disable_constructor=True))
+pending.AddMethod('done').AddRetVal(BoolRetVal())
+pending.AddMethod('wait').AddRetVal(
+    ObjTupleRetVal(output)).ReleaseGil().AddEx(ex)
+
 # Backend class
 backend = mod.AddClass(Class('Backend', cpp_name='lczero::python::Backend'))
 backend.AddStaticMethod('available_backends').AddRetVal(ListOfStringsRetVal())
@@ -100,7 +109,17 @@ backend.constructor.AddParameter(
     StringParameter('backend', optional=True, can_be_none=True),
     StringParameter('options', optional=True, can_be_none=True)).AddEx(ex)
 backend.AddMethod('evaluate').AddParameter(ArgvObjects(
-    'inputs', input)).AddRetVal(ObjTupleRetVal(output)).AddEx(ex)
+    'inputs', input)).AddRetVal(
+        ObjTupleRetVal(output)).ReleaseGil().AddEx(ex)
+backend.AddMethod('evaluate_async').AddParameter(
+    ArgvObjects('inputs', input)).AddRetVal(ObjOwnerRetval(pending)).AddEx(ex)
+backend.AddMethod('evaluate_batch').AddParameter(
+    BufferParameter('masks', type='u64'),
+    BufferParameter('values', type='f32'),
+    BufferParameter('policy', type='f32', writable=True),
+    BufferParameter('wdl', type='f32', writable=True),
+    BufferParameter('moves_left', type='f32', writable=True,
+                    optional=True)).ReleaseGil().AddEx(ex)
 backend.AddMethod('capabilities').AddRetVal(ObjCopyRetval(backend_caps))
 
 # PositionHistory class
@@ -117,6 +136,28 @@ game_state.AddMethod('moves').AddRetVal(ListOfStringsRetVal())
 game_state.AddMethod('policy_indices').AddRetVal(IntegralTupleRetVal('i'))
 game_state.AddMethod('as_string').AddRetVal(StringRetVal())
 
+# Evaluation class
+evaluation = mod.AddClass(
+    Class('Evaluation',
+          cpp_name='lczero::python::Evaluation',
+          disable_constructor=True))
+evaluation.AddMethod('q').AddRetVal(NumericRetVal('f32'))
+evaluation.AddMethod('d').AddRetVal(NumericRetVal('f32'))
+evaluation.AddMethod('m').AddRetVal(NumericRetVal('f32'))
+evaluation.AddMethod('p').AddRetVal(IntegralTupleRetVal('f32'))
+
+# Evaluator class
+evaluator = mod.AddClass(
+    Class('Evaluator', cpp_name='lczero::python::Evaluator'))
+evaluator.constructor.AddParameter(
+    StringParameter('weights', optional=True, can_be_none=True),
+    StringParameter('backend', optional=True, can_be_none=True),
+    StringParameter('options', optional=True, can_be_none=True),
+    NumericParameter('cache_size', optional=True)).AddEx(ex)
+evaluator.AddMethod('evaluate').AddParameter(ArgvObjects(
+    'states', game_state)).AddRetVal(
+        ObjTupleRetVal(evaluation)).ReleaseGil().AddEx(ex)
+
 with open(sys.argv[1], 'wt') as f:
     writer = Writer(f)
-    mod.Generate(writer)
\ No newline at end of file
+    mod.Generate(writer)
@@ -188,6 +188,7 @@ class Module(FunctionContainer):
             w.Write(f'#include "{x}"')
 
         w.Write('\nnamespace {')
+        self._generate_gil_releaser(w)
         for cls in self.exceptions:
             cls.Generate(w)
         for cls in self.classes:
@@ -200,6 +201,22 @@ class Module(FunctionContainer):
 
         self._generate_main_func(w)
 
+    def _generate_gil_releaser(self, w):
+        w.Write('// Releases the GIL for the lifetime of the object.')
+        w.Open('class GilReleaser {')
+        w.Unindent()
+        w.Write(' public:')
+        w.Indent()
+        w.Write('GilReleaser() : state_(PyEval_SaveThread()) {}')
+        w.Write('~GilReleaser() { PyEval_RestoreThread(state_); }')
+        w.Write('GilReleaser(const GilReleaser&) = delete;')
+        w.Write('GilReleaser& operator=(const GilReleaser&) = delete;\n')
+        w.Unindent()
+        w.Write(' private:')
+        w.Indent()
+        w.Write('PyThreadState* state_;')
+        w.Close('};\n')
+
     def struct_name(self):
         return f'T{self.name}Module'
 
@@ -52,6 +52,7 @@ class Function(PyObject):
         self.self_type = self_type
         self.param_typ = param_type
         self.retval = NoneRetVal()
+        self.release_gil = False
 
     def AddParameter(self, *params):
         for param in params:
@@ -70,6 +71,29 @@ class Function(PyObject):
         self.exceptions.append(ex)
         return self
 
+    def ReleaseGil(self):
+        '''Lets other Python threads run while the C++ function runs.'''
+        self.release_gil = True
+        return self
+
+    def _generate_cpp_call(self, w, call):
+        if not self.release_gil:
+            if isinstance(self.retval, NoneRetVal):
+                w.Write(f'{call};')
+            else:
+                w.Write(f'{self.retval.cpp_type()} '
+                        f'{self.retval.cpp_val()} = {call};')
+            return
+        # The lambda restores the GIL also when the call throws.
+        if isinstance(self.retval, NoneRetVal):
+            w.Open('[&]() {')
+        else:
+            w.Open(f'{self.retval.cpp_type()} '
+                   f'{self.retval.cpp_val()} = [&]() {{')
+        w.Write('GilReleaser gil_releaser;')
+        w.Write(f'return {call};')
+        w.Close('}();')
+
     def Generate(self, w):
         w.Open(f'{self._return_cpp_type()} '
                f'{self.gen_function_name}({self._generate_params()}) {{')
@@ -213,13 +237,8 @@ class MemberFunction(Function):
         super().__init__(name, *args, **kwargs)
 
     def _generate_call(self, w):
-        if isinstance(self.retval, NoneRetVal):
-            w.Write(
-                f'self->value->{self.cpp_name}({self._list_caller_params()});')
-        else:
-            w.Write(f'{self.retval.cpp_type()} '
-                    f'{self.retval.cpp_val()} = self->value->'
-                    f'{self.cpp_name}({self._list_caller_params()});')
+        self._generate_cpp_call(
+            w, f'self->value->{self.cpp_name}({self._list_caller_params()})')
 
 
 class StaticFunction(Function):
@@ -232,14 +251,9 @@ class StaticFunction(Function):
         return super().function_meth_flags() + '| METH_STATIC'
 
     def _generate_call(self, w):
-        if isinstance(self.retval, NoneRetVal):
-            w.Write(f'{self.cpp_type_name}::{self.cpp_name}'
-                    f'({self._list_caller_params()});')
-        else:
-            w.Write(f'{self.retval.cpp_type()} '
-                    f'{self.retval.cpp_val()} = '
-                    f'{self.cpp_type_name}::'
-                    f'{self.cpp_name}({self._list_caller_params()});')
+        self._generate_cpp_call(
+            w, f'{self.cpp_type_name}::'
+            f'{self.cpp_name}({self._list_caller_params()})')
 
 
 class Constructor(Function):
@@ -153,6 +153,52 @@ class NumericParameter(Parameter):
         pass
 
 
+class BufferParameter(Parameter):
+    """Contiguous buffer of numbers (e.g. numpy array), passed as std::span."""
+    def __init__(self, *args, type='f32', writable=False, **kwargs):
+        self.type = type
+        self.writable = writable
+        super().__init__(*args, **kwargs)
+
+    def GenerateParseTupleSinkDeclaration(self, w):
+        w.Write(f'Py_buffer {self.name} = {{}};')
+
+    def item_cpp_type(self):
+        return {
+            'u64': 'uint64_t',
+            'f32': 'float',
+        }[self.type]
+
+    def span_item_type(self):
+        const = '' if self.writable else 'const '
+        return f'{const}{self.item_cpp_type()}'
+
+    def parse_tuple_sink_list(self):
+        return [f'&{self.name}']
+
+    def parse_tuple_format(self):
+        return 'w*' if self.writable else 'y*'
+
+    def GenerateCppParamInitialization(self, w, func):
+        item = self.item_cpp_type()
+        w.Write(f'std::unique_ptr<Py_buffer, decltype(&PyBuffer_Release)> '
+                f'{self.name}_guard(&{self.name}, PyBuffer_Release);')
+        w.Open(f'if ({self.name}.len % sizeof({item}) != 0 || '
+               f'reinterpret_cast<uintptr_t>({self.name}.buf) % '
+               f'alignof({item}) != 0) {{')
+        w.Write('PyErr_SetString(PyExc_ValueError, '
+                f'"Buffer {self.name} must be an aligned array of '
+                f'{item}.");')
+        w.Write(f'return {func._failure()};')
+        w.Close('}')
+        w.Write(f'std::span<{self.span_item_type()}> {self.name_at_caller()}('
+                f'static_cast<{self.span_item_type()}*>({self.name}.buf), '
+                f'{self.name}.len / sizeof({item}));')
+
+    def name_at_caller(self):
+        return f'{self.cpp_name}_cpp'
+
+
 class ArgvParameter(Parameter):
     def __init__(self, name, type, *argv, **kwargs):
         self.type = type
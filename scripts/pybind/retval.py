@@ -112,6 +112,14 @@ class NumericRetVal(RetVal):
                 f'"{self.parse_tuple_format()}", {self.cpp_val()});')
 
 
+class BoolRetVal(RetVal):
+    def cpp_type(self):
+        return 'bool'
+
+    def GenerateConversion(self, w):
+        w.Write(f'{self.py_val()} = PyBool_FromLong({self.cpp_val()});')
+
+
 class ObjCopyRetval(RetVal):
     def __init__(self, type):
         self.type = type
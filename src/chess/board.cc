@@ -37,13 +37,59 @@
 
 #include "utils/exception.h"
 
-#if not defined(NO_PEXT)
-// Include header for pext instruction.
+// Unless NO_PEXT is defined, x86-64 builds choose at runtime between pext and
+// magic multiplication for the slider attacks.
+#if !defined(NO_PEXT) && (defined(__x86_64__) || defined(_M_X64))
+#define LC0_PEXT_DISPATCH
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#if defined(__BMI2__) || defined(_MSC_VER)
 #include <immintrin.h>
 #endif
+#endif
 
 namespace lczero {
 
+namespace {
+// Zobrist keys. Pieces and en passant flags are keyed by absolute square, so
+// that Mirror() doesn't have to touch them.
+struct ZobristKeys {
+  // [is_black][piece type][square], with kKing stored at index 5.
+  uint64_t pieces[2][6][64];
+  uint64_t en_passant[64];
+  uint64_t castlings[16];
+  uint64_t black_to_move;
+};
+
+constexpr ZobristKeys MakeZobristKeys() {
+  ZobristKeys keys{};
+  uint64_t state = 0x4c6330a1e5e5d2b7ULL;
+  auto next = [&state]() {
+    // splitmix64.
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  };
+  for (auto& color : keys.pieces) {
+    for (auto& piece : color) {
+      for (auto& key : piece) key = next();
+    }
+  }
+  for (auto& key : keys.en_passant) key = next();
+  // No castling rights hash to zero, like an empty square.
+  for (int i = 1; i < 16; ++i) keys.castlings[i] = next();
+  keys.black_to_move = next();
+  return keys;
+}
+
+constexpr ZobristKeys kZobrist = MakeZobristKeys();
+constexpr int kZobristKingIdx = 5;
+}  // namespace
+
 const char* ChessBoard::kStartposFen =
     "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 
@@ -53,7 +99,46 @@ const BitBoard ChessBoard::kPawnMask = 0x00FFFFFFFFFFFF00ULL;
 
 void ChessBoard::Clear() { *this = ChessBoard(); }
 
+uint64_t ChessBoard::PiecesHash(BitBoard squares) const {
+  uint64_t hash = 0;
+  for (Square square : squares & (our_pieces_ | their_pieces_)) {
+    int piece = kKnight.idx;
+    if (square == our_king_ || square == their_king_) {
+      piece = kZobristKingIdx;
+    } else if (pawns().get(square)) {
+      piece = kPawn.idx;
+    } else if (queens().get(square)) {
+      piece = kQueen.idx;
+    } else if (rooks().get(square)) {
+      piece = kRook.idx;
+    } else if (bishops().get(square)) {
+      piece = kBishop.idx;
+    }
+    // Back to absolute colors and squares.
+    const bool is_black = their_pieces_.get(square) != flipped_;
+    if (flipped_) square.Flip();
+    hash ^= kZobrist.pieces[is_black][piece][square.as_idx()];
+  }
+  return hash;
+}
+
+uint64_t ChessBoard::FlagsHash() const {
+  uint64_t hash = kZobrist.castlings[castlings_.as_int()];
+  for (Square square : en_passant()) {
+    if (flipped_) square.Flip();
+    hash ^= kZobrist.en_passant[square.as_idx()];
+  }
+  return hash;
+}
+
+uint64_t ChessBoard::ComputeHash() const {
+  uint64_t hash = PiecesHash(our_pieces_ | their_pieces_) ^ FlagsHash();
+  if (flipped_) hash ^= kZobrist.black_to_move;
+  return hash;
+}
+
 void ChessBoard::Mirror() {
+  hash_ ^= kZobrist.black_to_move ^ kZobrist.castlings[castlings_.as_int()];
   our_pieces_.Mirror();
   their_pieces_.Mirror();
   std::swap(our_pieces_, their_pieces_);
@@ -65,6 +150,7 @@ void ChessBoard::Mirror() {
   std::swap(our_king_, their_king_);
   castlings_.Mirror();
   flipped_ = !flipped_;
+  hash_ ^= kZobrist.castlings[castlings_.as_int()];
 }
 
 namespace {
@@ -185,15 +271,12 @@ struct MagicParams {
   uint64_t mask_;
   // Pointer to lookup table.
   BitBoard* attacks_table_;
-#if defined(NO_PEXT)
   // Magic number.
   uint64_t magic_number_;
   // Number of bits to shift.
   uint8_t shift_bits_;
-#endif
 };
 
-#if defined(NO_PEXT)
 // Magic numbers determined via trial and error with random number generator
 // such that the number of relevant occupancy bits suffice to index the attacks
 // tables with only constructive collisions.
@@ -243,12 +326,63 @@ static const BitBoard kBishopMagicNumbers[] = {
     0x11840044440C2080ULL, 0x2802A02104030440ULL, 0x6100000900840401ULL,
     0x1C20A15A90420200ULL, 0x0088414004480280ULL, 0x0000204242881100ULL,
     0x0240080802809010ULL};
-#endif
 
 // Magic parameters for rooks/bishops.
 static MagicParams rook_magic_params[64];
 static MagicParams bishop_magic_params[64];
 
+#if defined(LC0_PEXT_DISPATCH)
+// Set by InitializeMagicBitboards(), the attacks tables are laid out for the
+// chosen indexing.
+static bool use_pext = false;
+
+// The pext instruction, without needing the compiler flags for it.
+static inline uint64_t Pext(uint64_t value, uint64_t mask) {
+#if defined(__BMI2__) || defined(_MSC_VER)
+  return _pext_u64(value, mask);
+#else
+  uint64_t result;
+  asm("pextq %2, %1, %0" : "=r"(result) : "r"(value), "r"(mask));
+  return result;
+#endif
+}
+
+// Returns whether the CPU has a fast pext. AMD before Zen 3 implements it in
+// microcode, many times slower than the magic multiplication.
+static bool CpuHasFastPext() {
+  unsigned int regs[4];
+  const auto cpuid = [&](unsigned int leaf) {
+#ifdef _MSC_VER
+    __cpuidex(reinterpret_cast<int*>(regs), leaf, 0);
+#else
+    __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+  };
+  cpuid(0);
+  const unsigned int max_leaf = regs[0];
+  // "AuthenticAMD".
+  const bool amd = regs[1] == 0x68747541;
+  if (max_leaf < 7) return false;
+  cpuid(7);
+  const bool bmi2 = regs[1] & (1 << 8);
+  if (!bmi2) return false;
+  cpuid(1);
+  unsigned int family = (regs[0] >> 8) & 0xf;
+  if (family == 0xf) family += (regs[0] >> 20) & 0xff;
+  return !amd || family >= 0x19;
+}
+#endif
+
+// Returns the index into the attacks table of @params for @occupancy.
+static inline uint64_t AttacksIndex(const MagicParams& params,
+                                    uint64_t occupancy) {
+#if defined(LC0_PEXT_DISPATCH)
+  if (use_pext) return Pext(occupancy, params.mask_);
+#endif
+  return ((occupancy & params.mask_) * params.magic_number_) >>
+         params.shift_bits_;
+}
+
 // Precomputed attacks bitboard tables.
 static BitBoard rook_attacks_table[102400];
 static BitBoard bishop_attacks_table[5248];
@@ -299,11 +433,9 @@ static void BuildAttacksTable(MagicParams* magic_params,
       occupancy_squares.emplace_back(occ_sq);
     }
 
-#if defined(NO_PEXT)
     // Set number of shifted bits. The magic numbers have been chosen such that
     // the number of relevant occupancy bits suffice to index the attacks table.
     magic_params[square].shift_bits_ = 64 - occupancy_squares.size();
-#endif
 
     // Set pointer to lookup table.
     magic_params[square].attacks_table_ = &attacks_table[table_offset];
@@ -340,11 +472,9 @@ static void BuildAttacksTable(MagicParams* magic_params,
         }
       }
 
-#if defined(NO_PEXT)
       // Calculate magic index.
-      uint64_t index = occupancy.as_int();
-      index *= magic_params[square].magic_number_;
-      index >>= magic_params[square].shift_bits_;
+      const uint64_t index =
+          AttacksIndex(magic_params[square], occupancy.as_int());
 
       // Sanity check. The magic numbers have been chosen such that
       // the number of relevant occupancy bits suffice to index the attacks
@@ -354,10 +484,6 @@ static void BuildAttacksTable(MagicParams* magic_params,
           attacks_table[table_offset + index] != attacks) {
         throw Exception("Invalid magic number!");
       }
-#else
-      uint64_t index =
-          _pext_u64(occupancy.as_int(), magic_params[square].mask_);
-#endif
 
       // Update table.
       attacks_table[table_offset + index] = attacks;
@@ -374,14 +500,8 @@ static inline BitBoard GetRookAttacks(const Square rook_square,
                                       const BitBoard pieces) {
   // Calculate magic index.
   const uint8_t square = rook_square.as_idx();
-
-#if defined(NO_PEXT)
-  uint64_t index = pieces.as_int() & rook_magic_params[square].mask_;
-  index *= rook_magic_params[square].magic_number_;
-  index >>= rook_magic_params[square].shift_bits_;
-#else
-  uint64_t index = _pext_u64(pieces.as_int(), rook_magic_params[square].mask_);
-#endif
+  const uint64_t index =
+      AttacksIndex(rook_magic_params[square], pieces.as_int());
 
   // Return attacks bitboard.
   return rook_magic_params[square].attacks_table_[index];
@@ -393,15 +513,8 @@ static inline BitBoard GetBishopAttacks(const Square bishop_square,
                                         const BitBoard pieces) {
   // Calculate magic index.
   const uint8_t square = bishop_square.as_idx();
-
-#if defined(NO_PEXT)
-  uint64_t index = pieces.as_int() & bishop_magic_params[square].mask_;
-  index *= bishop_magic_params[square].magic_number_;
-  index >>= bishop_magic_params[square].shift_bits_;
-#else
-  uint64_t index =
-      _pext_u64(pieces.as_int(), bishop_magic_params[square].mask_);
-#endif
+  const uint64_t index =
+      AttacksIndex(bishop_magic_params[square], pieces.as_int());
 
   // Return attacks bitboard.
   return bishop_magic_params[square].attacks_table_[index];
@@ -410,7 +523,9 @@ static inline BitBoard GetBishopAttacks(const Square bishop_square,
 }  // namespace
 
 void InitializeMagicBitboards() {
-#if defined(NO_PEXT)
+#if defined(LC0_PEXT_DISPATCH)
+  use_pext = CpuHasFastPext();
+#endif
   // Set magic numbers for all board squares.
   for (unsigned square = 0; square < 64; square++) {
     rook_magic_params[square].magic_number_ =
@@ -418,7 +533,6 @@ void InitializeMagicBitboards() {
     bishop_magic_params[square].magic_number_ =
         kBishopMagicNumbers[square].as_int();
   }
-#endif
 
   // Build attacks tables.
   BuildAttacksTable(rook_magic_params, rook_attacks_table, kRookDirections);
@@ -574,6 +688,23 @@ MoveList ChessBoard::GeneratePseudolegalMoves() const {
 }  // namespace lczero
 
 bool ChessBoard::ApplyMove(Move move) {
+  // Pieces only change on the squares the move touches, so only those, the
+  // castling rights and en passant flags have to be rehashed.
+  BitBoard touched = BitBoard::FromSquare(move.from());
+  touched.set(move.to());
+  if (move.is_castling()) {
+    const bool kingside = move.to().file() > move.from().file();
+    touched.set(Square(kingside ? kFileG : kFileC, kRank1));
+    touched.set(Square(kingside ? kFileF : kFileD, kRank1));
+  }
+  if (move.is_en_passant()) touched.set(Square(move.to().file(), kRank5));
+  hash_ ^= PiecesHash(touched) ^ FlagsHash();
+  const bool reset_50_moves = ApplyMoveUnhashed(move);
+  hash_ ^= PiecesHash(touched) ^ FlagsHash();
+  return reset_50_moves;
+}
+
+bool ChessBoard::ApplyMoveUnhashed(Move move) {
   assert(our_pieces_.intersects(BitBoard::FromSquare(move.from())));
   const Square& from = move.from();
   const Square& to = move.to();
@@ -697,6 +828,10 @@ bool ChessBoard::ApplyMove(Move move) {
 }
 
 bool ChessBoard::IsUnderAttack(Square square) const {
+  return IsUnderAttack(square, our_pieces_ | their_pieces_);
+}
+
+bool ChessBoard::IsUnderAttack(Square square, BitBoard occupied) const {
   const Rank rank = square.rank();
   const File file = square.file();
   // Check king.
@@ -706,12 +841,11 @@ bool ChessBoard::IsUnderAttack(Square square) const {
     if (std::abs(krank - rank) <= 1 && std::abs(kfile - file) <= 1) return true;
   }
   // Check rooks (and queens).
-  if (GetRookAttacks(square, our_pieces_ | their_pieces_)
-          .intersects(their_pieces_ & rooks_)) {
+  if (GetRookAttacks(square, occupied).intersects(their_pieces_ & rooks_)) {
     return true;
   }
   // Check bishops.
-  if (GetBishopAttacks(square, our_pieces_ | their_pieces_)
+  if (GetBishopAttacks(square, occupied)
           .intersects(their_pieces_ & bishops_)) {
     return true;
   }
@@ -736,96 +870,40 @@ KingAttackInfo ChessBoard::GenerateKingAttackInfo() const {
   // Number of attackers that give check (used for double check detection).
   unsigned num_king_attackers = 0;
 
-  const int row = our_king_.rank().idx;
-  const int col = our_king_.file().idx;
+  const BitBoard occupied = our_pieces_ | their_pieces_;
+  const BitBoard king_board = BitBoard::FromSquare(our_king_);
+  // Sliders that see our king through our own pieces either give check (no
+  // piece in between) or pin the single piece of ours that stands in between.
+  // Their own pieces block them in both cases.
+  auto process_snipers = [&](BitBoard snipers, auto get_attacks) {
+    for (const auto& sniper : snipers) {
+      const BitBoard between =
+          get_attacks(our_king_, BitBoard::FromSquare(sniper)) &
+          get_attacks(sniper, king_board);
+      const BitBoard blockers = between & occupied;
+      if (blockers.empty()) {
+        king_attack_info.attack_lines_ =
+            king_attack_info.attack_lines_ | between;
+        king_attack_info.attack_lines_.set(sniper);
+        num_king_attackers++;
+      } else if (blockers.count_few() == 1) {
+        king_attack_info.pinned_pieces_ =
+            king_attack_info.pinned_pieces_ | blockers;
+      }
+    }
+  };
   // King checks are unnecessary, as kings cannot give check.
   // Check rooks (and queens).
   if (kRookAttacks[our_king_.as_idx()].intersects(their_pieces_ & rooks_)) {
-    for (const auto& direction : kRookDirections) {
-      auto dst_row = row;
-      auto dst_col = col;
-      BitBoard attack_line(0);
-      bool possible_pinned_piece_found = false;
-      Square possible_pinned_piece;
-      while (true) {
-        dst_row += direction.first;
-        dst_col += direction.second;
-        if (!IsOnBoard(dst_row, dst_col)) break;
-        const Square destination(File::FromIdx(dst_col),
-                                 Rank::FromIdx(dst_row));
-        if (our_pieces_.get(destination)) {
-          if (possible_pinned_piece_found) {
-            // No pieces pinned.
-            break;
-          } else {
-            // This is a possible pinned piece.
-            possible_pinned_piece_found = true;
-            possible_pinned_piece = destination;
-          }
-        }
-        if (!possible_pinned_piece_found) {
-          attack_line.set(destination);
-        }
-        if (their_pieces_.get(destination)) {
-          if (rooks_.get(destination)) {
-            if (possible_pinned_piece_found) {
-              // Store the pinned piece.
-              king_attack_info.pinned_pieces_.set(possible_pinned_piece);
-            } else {
-              // Update attack lines.
-              king_attack_info.attack_lines_ =
-                  king_attack_info.attack_lines_ | attack_line;
-              num_king_attackers++;
-            }
-          }
-          break;
-        }
-      }
-    }
+    process_snipers(GetRookAttacks(our_king_, their_pieces_) & their_pieces_ &
+                        rooks_,
+                    GetRookAttacks);
   }
   // Check bishops.
   if (kBishopAttacks[our_king_.as_idx()].intersects(their_pieces_ & bishops_)) {
-    for (const auto& direction : kBishopDirections) {
-      auto dst_row = row;
-      auto dst_col = col;
-      BitBoard attack_line(0);
-      bool possible_pinned_piece_found = false;
-      Square possible_pinned_piece;
-      while (true) {
-        dst_row += direction.first;
-        dst_col += direction.second;
-        if (!IsOnBoard(dst_row, dst_col)) break;
-        const Square destination(File::FromIdx(dst_col),
-                                 Rank::FromIdx(dst_row));
-        if (our_pieces_.get(destination)) {
-          if (possible_pinned_piece_found) {
-            // No pieces pinned.
-            break;
-          } else {
-            // This is a possible pinned piece.
-            possible_pinned_piece_found = true;
-            possible_pinned_piece = destination;
-          }
-        }
-        if (!possible_pinned_piece_found) {
-          attack_line.set(destination);
-        }
-        if (their_pieces_.get(destination)) {
-          if (bishops_.get(destination)) {
-            if (possible_pinned_piece_found) {
-              // Store the pinned piece.
-              king_attack_info.pinned_pieces_.set(possible_pinned_piece);
-            } else {
-              // Update attack lines.
-              king_attack_info.attack_lines_ =
-                  king_attack_info.attack_lines_ | attack_line;
-              num_king_attackers++;
-            }
-          }
-          break;
-        }
-      }
-    }
+    process_snipers(GetBishopAttacks(our_king_, their_pieces_) &
+                        their_pieces_ & bishops_,
+                    GetBishopAttacks);
   }
   // Check pawns.
   const BitBoard attacking_pawns =
@@ -927,13 +1005,186 @@ bool ChessBoard::IsLegalMove(Move move,
   }
 }
 
-MoveList ChessBoard::GenerateLegalMoves() const {
+MoveList ChessBoard::GenerateLegalMoves(
+    KingAttackInfo* king_attack_info_out) const {
+  // Same traversal and move order as GeneratePseudolegalMoves(), but pinned
+  // pieces and check evasions are handled with masks computed up front, so
+  // that only castlings and en passant captures need to be tried on a copy of
+  // the board.
   const KingAttackInfo king_attack_info = GenerateKingAttackInfo();
-  MoveList result = GeneratePseudolegalMoves();
-  result.erase(
-      std::remove_if(result.begin(), result.end(),
-                     [&](Move m) { return !IsLegalMove(m, king_attack_info); }),
-      result.end());
+  *king_attack_info_out = king_attack_info;
+  const BitBoard occupied = our_pieces_ | their_pieces_;
+  // Squares where pieces other than king may go.
+  const BitBoard targets = king_attack_info.in_check()
+                               ? king_attack_info.attack_lines_
+                               : BitBoard(~0ULL);
+  auto is_legal_on_copy = [this](Move move) {
+    ChessBoard board(*this);
+    board.ApplyMove(move);
+    return !board.IsUnderCheck();
+  };
+  MoveList result;
+  result.reserve(60);
+  for (auto source : our_pieces_) {
+    // King
+    if (source == our_king_) {
+      for (const auto& delta : kKingMoves) {
+        const Rank dst_rank = source.rank() + delta.first;
+        if (!dst_rank.IsValid()) continue;
+        const File dst_file = source.file() + delta.second;
+        if (!dst_file.IsValid()) continue;
+        const Square destination(dst_file, dst_rank);
+        if (our_pieces_.get(destination)) continue;
+        // The king itself must not block the slider that checks it.
+        if (IsUnderAttack(destination, occupied - our_king_)) continue;
+        result.emplace_back(Move::White(source, destination));
+      }
+      if (king_attack_info.in_check()) continue;
+      // Castlings.
+      auto walk_free = [this](File from, File to, File rook, File king) {
+        for (File i = from; i <= to; ++i) {
+          if (i == rook || i == king) continue;
+          if (our_pieces_.get({i, kRank1}) || their_pieces_.get({i, kRank1})) {
+            return false;
+          }
+        }
+        return true;
+      };
+      // @From may be less or greater than @to. @To is not included in check
+      // unless it is the same with @from.
+      auto range_attacked = [this](File from, File to) {
+        if (from == to) return IsUnderAttack(Square(from, kRank1));
+        const int increment = from < to ? 1 : -1;
+        while (from != to) {
+          if (IsUnderAttack(Square(from, kRank1))) return true;
+          from += increment;
+        }
+        return false;
+      };
+      const File king = source.file();
+      if (castlings_.we_can_000()) {
+        const File qrook = castlings_.our_queenside_rook;
+        const Move move = Move::WhiteCastling(king, qrook);
+        if (walk_free(std::min(kFileC, qrook), std::max(kFileD, king), qrook,
+                      king) &&
+            !range_attacked(king, kFileC) && is_legal_on_copy(move)) {
+          result.emplace_back(move);
+        }
+      }
+      if (castlings_.we_can_00()) {
+        const File krook = castlings_.our_kingside_rook;
+        const Move move = Move::WhiteCastling(king, krook);
+        if (walk_free(std::min(kFileF, king), std::max(kFileG, krook), krook,
+                      king) &&
+            !range_attacked(king, kFileG) && is_legal_on_copy(move)) {
+          result.emplace_back(move);
+        }
+      }
+      continue;
+    }
+    // Only the king can escape a double check, and a pinned piece is never
+    // able to resolve a check.
+    if (king_attack_info.in_double_check()) continue;
+    BitBoard allowed = targets;
+    if (king_attack_info.is_pinned(source)) {
+      if (king_attack_info.in_check()) continue;
+      // A pinned piece may only move along the line through the king.
+      allowed = source.rank() == our_king_.rank() ||
+                        source.file() == our_king_.file()
+                    ? kRookAttacks[our_king_.as_idx()] &
+                          kRookAttacks[source.as_idx()]
+                    : kBishopAttacks[our_king_.as_idx()] &
+                          kBishopAttacks[source.as_idx()];
+    }
+    bool processed_piece = false;
+    // Rook (and queen)
+    if (rooks_.get(source)) {
+      processed_piece = true;
+      BitBoard attacked =
+          (GetRookAttacks(source, occupied) - our_pieces_) & allowed;
+
+      for (const auto& destination : attacked) {
+        result.emplace_back(Move::White(source, destination));
+      }
+    }
+    // Bishop (and queen)
+    if (bishops_.get(source)) {
+      processed_piece = true;
+      BitBoard attacked =
+          (GetBishopAttacks(source, occupied) - our_pieces_) & allowed;
+
+      for (const auto& destination : attacked) {
+        result.emplace_back(Move::White(source, destination));
+      }
+    }
+    if (processed_piece) continue;
+    // Pawns.
+    if ((pawns_ & kPawnMask).get(source)) {
+      // Moves forward.
+      {
+        const Rank dst_rank = source.rank() + 1;
+        const File dst_file = source.file();
+        const Square destination(dst_file, dst_rank);
+
+        if (!occupied.get(destination)) {
+          if (dst_rank != kRank8) {
+            if (allowed.get(destination)) {
+              result.emplace_back(Move::White(source, destination));
+            }
+            if (dst_rank == kRank3) {
+              // Maybe it'll be possible to move two squares.
+              const Square jump_dst(dst_file, kRank4);
+              if (!occupied.get(jump_dst) && allowed.get(jump_dst)) {
+                result.emplace_back(Move::White(source, jump_dst));
+              }
+            }
+          } else if (allowed.get(destination)) {
+            // Promotions
+            for (auto promotion : kPromotions) {
+              result.emplace_back(
+                  Move::WhitePromotion(source, destination, promotion));
+            }
+          }
+        }
+      }
+      // Captures.
+      {
+        for (auto direction : {-1, 1}) {
+          const auto dst_rank = source.rank() + 1;
+          const auto dst_file = source.file() + direction;
+          if (!dst_file.IsValid()) continue;
+          const Square destination(dst_file, dst_rank);
+          if (their_pieces_.get(destination)) {
+            if (!allowed.get(destination)) continue;
+            if (dst_rank == kRank8) {
+              // Promotion.
+              for (auto promotion : kPromotions) {
+                result.emplace_back(
+                    Move::WhitePromotion(source, destination, promotion));
+              }
+            } else {
+              // Ordinary capture.
+              result.emplace_back(Move::White(source, destination));
+            }
+          } else if (dst_rank == kRank6 &&
+                     pawns_.get(Square(dst_file, kRank8))) {
+            // En passant. Complex but rare, the captured pawn may be the one
+            // giving check or may uncover a check along the rank.
+            const Move move = Move::WhiteEnPassant(source, destination);
+            if (is_legal_on_copy(move)) result.emplace_back(move);
+          }
+        }
+      }
+      continue;
+    }
+    // Knight.
+    {
+      for (const auto destination :
+           (kKnightAttacks[source.as_idx()] - our_pieces_) & allowed) {
+        result.emplace_back(Move::White(source, destination));
+      }
+    }
+  }
   return result;
 }
 
@@ -946,6 +1197,33 @@ void ChessBoard::PutPiece(Square square, PieceType piece, bool is_theirs) {
 }
 
 void ChessBoard::SetFromFen(std::string_view fen, int* rule50_ply, int* moves) {
+  ParseFen(fen, rule50_ply, moves);
+  hash_ = ComputeHash();
+}
+
+void ChessBoard::SetFromPieces(const std::array<BitBoard, 6>& ours,
+                               const std::array<BitBoard, 6>& theirs,
+                               const Castlings& castlings, BitBoard en_passant,
+                               bool flipped) {
+  Clear();
+  for (int i = 0; i < 6; ++i) {
+    our_pieces_ = our_pieces_ | ours[i];
+    their_pieces_ = their_pieces_ | theirs[i];
+  }
+  pawns_ = ours[0] | theirs[0];
+  bishops_ = ours[2] | theirs[2] | ours[4] | theirs[4];
+  rooks_ = ours[3] | theirs[3] | ours[4] | theirs[4];
+  for (auto sq : ours[5]) our_king_ = sq;
+  for (auto sq : theirs[5]) their_king_ = sq;
+  // The en passant flag is a fake pawn on the last rank.
+  pawns_ = pawns_ |
+           BitBoard((en_passant.as_int() & 0x0000FF0000000000ULL) << 16);
+  castlings_ = castlings;
+  flipped_ = flipped;
+  hash_ = ComputeHash();
+}
+
+void ChessBoard::ParseFen(std::string_view fen, int* rule50_ply, int* moves) {
   Clear();
   if (rule50_ply) *rule50_ply = 0;
   if (moves) *moves = 1;
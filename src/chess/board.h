@@ -27,6 +27,7 @@
 
 #pragma once
 
+#include <array>
 #include <cassert>
 #include <string>
 
@@ -91,6 +92,9 @@ class ChessBoard {
   bool ApplyMove(Move move);
   // Checks if the square is under attack from "theirs" (black).
   bool IsUnderAttack(Square square) const;
+  // Same, but sliders are blocked by @occupied instead of by the pieces on the
+  // board.
+  bool IsUnderAttack(Square square, BitBoard occupied) const;
   // Generates the king attack info used for legal move detection.
   KingAttackInfo GenerateKingAttackInfo() const;
   // Checks if "our" (white) king is under check.
@@ -99,7 +103,13 @@ class ChessBoard {
   // Checks whether at least one of the sides has mating material.
   bool HasMatingMaterial() const;
   // Generates legal moves.
-  MoveList GenerateLegalMoves() const;
+  MoveList GenerateLegalMoves() const {
+    KingAttackInfo king_attack_info;
+    return GenerateLegalMoves(&king_attack_info);
+  }
+  // Same, and also returns the king attack info computed on the way, so that
+  // the caller can tell check from it instead of recomputing the attacks.
+  MoveList GenerateLegalMoves(KingAttackInfo* king_attack_info) const;
   // Check whether pseudolegal move is legal.
   bool IsLegalMove(Move move, const KingAttackInfo& king_attack_info) const;
 
@@ -111,14 +121,9 @@ class ChessBoard {
   // soon.
   Move ParseMove(std::string_view move_str) const;
 
-  uint64_t Hash() const {
-    return HashCat({our_pieces_.as_int(), their_pieces_.as_int(),
-                    rooks_.as_int(), bishops_.as_int(), pawns_.as_int(),
-                    (static_cast<uint32_t>(our_king_.as_idx()) << 24) |
-                        (static_cast<uint32_t>(their_king_.as_idx()) << 16) |
-                        (static_cast<uint32_t>(castlings_.as_int()) << 8) |
-                        static_cast<uint32_t>(flipped_)});
-  }
+  // Zobrist hash of the position, kept up to date by ApplyMove() and
+  // Mirror().
+  uint64_t Hash() const { return hash_; }
 
   class Castlings {
    public:
@@ -206,6 +211,17 @@ class ChessBoard {
     uint8_t data_;
   };
 
+  // Sets position from piece bitboards directly, e.g. from the input planes of
+  // a network. Everything is from the side to move's point of view, so "ours"
+  // move up the board. @ours and @theirs are pawns, knights, bishops, rooks,
+  // queens and king, in this order. @en_passant is the square their pawn has
+  // skipped and empty when there is none. @flipped is true when black is to
+  // move.
+  void SetFromPieces(const std::array<BitBoard, 6>& ours,
+                     const std::array<BitBoard, 6>& theirs,
+                     const Castlings& castlings, BitBoard en_passant,
+                     bool flipped);
+
   std::string DebugString() const;
 
   BitBoard ours() const { return our_pieces_; }
@@ -231,7 +247,19 @@ class ChessBoard {
  private:
   // Sets the piece on the square.
   void PutPiece(Square square, PieceType piece, bool is_theirs);
-
+  // SetFromFen() without computing the hash.
+  void ParseFen(std::string_view fen, int* rule50_ply, int* moves);
+  // ApplyMove() without updating the hash.
+  bool ApplyMoveUnhashed(Move move);
+  // Computes the hash from scratch.
+  uint64_t ComputeHash() const;
+  // Part of the hash for the pieces on @squares.
+  uint64_t PiecesHash(BitBoard squares) const;
+  // Part of the hash for castling rights and en passant flags.
+  uint64_t FlagsHash() const;
+
+  // Goes first so that comparison of different boards usually stops at it.
+  uint64_t hash_ = 0;
   // All white pieces.
   BitBoard our_pieces_;
   // All black pieces.
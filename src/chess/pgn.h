@@ -32,8 +32,13 @@
 #include <algorithm>
 #include <cctype>
 #include <cerrno>
+#include <exception>
 #include <fstream>
 #include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 #include "chess/bitboard.h"
 #include "chess/board.h"
@@ -63,113 +68,194 @@ inline bool GzGetLine(gzFile file, std::string& line) {
   return flag;
 }
 
-class PgnReader {
+// Reads games from a (possibly gzipped) PGN file in large blocks. The file is
+// split into games on the calling thread, while moves are parsed by worker
+// threads a batch at a time, so memory use is bounded whatever the file size.
+class PgnStream {
  public:
-  void AddPgnFile(const std::string& filepath) {
-    const gzFile file = gzopen(filepath.c_str(), "r");
-    if (!file) {
+  // Uses hardware concurrency when @threads is 0.
+  explicit PgnStream(const std::string& filepath, int threads = 0)
+      : threads_(threads > 0
+                     ? threads
+                     : std::max(1U, std::thread::hardware_concurrency())) {
+    file_ = gzopen(filepath.c_str(), "r");
+    if (!file_) {
       throw Exception(errno == ENOENT ? "Opening book file not found."
                                       : "Error opening opening book file.");
     }
+    gzbuffer(file_, kBlockSize);
+  }
+  ~PgnStream() { gzclose(file_); }
+  PgnStream(const PgnStream&) = delete;
+  PgnStream& operator=(const PgnStream&) = delete;
 
-    std::string line;
-    bool in_comment = false;
-    bool started = false;
-    while (GzGetLine(file, line)) {
-      // Check if we have a UTF-8 BOM. If so, just ignore it.
-      // Only supposed to exist in the first line, but should not matter.
-      if (line.substr(0, 3) == "\xEF\xBB\xBF") line = line.substr(3);
-      if (!line.empty() && line.back() == '\r') line.pop_back();
-      // TODO: support line breaks in tags to ensure they are properly ignored.
-      if (line.empty() || line[0] == '[') {
-        if (started) {
-          Flush();
-          started = false;
-        }
-        auto uc_line = line;
-        std::transform(
-            uc_line.begin(), uc_line.end(), uc_line.begin(),
-            [](unsigned char c) { return std::toupper(c); }  // correct
-        );
-        if (uc_line.find("[FEN \"", 0) == 0) {
-          auto start_trimmed = line.substr(6);
-          cur_startpos_ = start_trimmed.substr(0, start_trimmed.find('"'));
-          cur_board_.SetFromFen(cur_startpos_);
-        }
-        continue;
+  // Returns the next game in file order, or nullopt when the file is done.
+  std::optional<Opening> Next() {
+    if (next_ == games_.size()) {
+      FillBatch();
+      if (games_.empty()) return std::nullopt;
+    }
+    return std::move(games_[next_++]);
+  }
+
+ private:
+  static constexpr size_t kBlockSize = 1 << 20;
+  static constexpr size_t kGamesPerThread = 1024;
+
+  // Tag and comment free text of a game, as split by the reading thread.
+  struct RawGame {
+    std::string start_fen = ChessBoard::kStartposFen;
+    std::string movetext;
+  };
+
+  // Reads the next line from the block buffer, without the trailing '\n'.
+  bool ReadLine(std::string* line) {
+    while (true) {
+      const auto end = buffer_.find('\n', pos_);
+      if (end != std::string::npos) {
+        line->assign(buffer_, pos_, end - pos_);
+        pos_ = end + 1;
+        return true;
       }
-      // Must have at least one non-tag non-empty line in order to be considered
-      // a game.
-      started = true;
-      // Handle braced comments.
-      int cur_offset = 0;
-      while ((in_comment && line.find('}', cur_offset) != std::string::npos) ||
-             (!in_comment && line.find('{', cur_offset) != std::string::npos)) {
-        if (in_comment && line.find('}', cur_offset) != std::string::npos) {
-          line = line.substr(0, cur_offset) +
-                 line.substr(line.find('}', cur_offset) + 1);
-          in_comment = false;
-        } else {
-          cur_offset = line.find('{', cur_offset);
-          in_comment = true;
-        }
+      buffer_.erase(0, pos_);
+      pos_ = 0;
+      if (!eof_) {
+        const size_t size = buffer_.size();
+        buffer_.resize(size + kBlockSize);
+        const int read = gzread(file_, buffer_.data() + size, kBlockSize);
+        if (read < 0) throw Exception("Error reading opening book file.");
+        buffer_.resize(size + read);
+        if (read > 0) continue;
+        eof_ = true;
       }
-      if (in_comment) {
-        line = line.substr(0, cur_offset);
+      if (buffer_.empty()) return false;
+      line->swap(buffer_);
+      buffer_.clear();
+      return true;
+    }
+  }
+
+  void ProcessLine(std::string& line) {
+    // Check if we have a UTF-8 BOM. If so, just ignore it.
+    // Only supposed to exist in the first line, but should not matter.
+    if (line.starts_with("\xEF\xBB\xBF")) line.erase(0, 3);
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    // TODO: support line breaks in tags to ensure they are properly ignored.
+    if (line.empty() || line[0] == '[') {
+      if (started_) {
+        raw_games_.push_back(std::move(cur_game_));
+        cur_game_ = RawGame();
+        started_ = false;
       }
-      // Trim trailing comment.
-      if (line.find(';') != std::string::npos) {
-        line = line.substr(0, line.find(';'));
+      constexpr std::string_view kFenTag = "[FEN \"";
+      if (line.size() >= kFenTag.size() &&
+          std::equal(kFenTag.begin(), kFenTag.end(), line.begin(),
+                     [](char tag, unsigned char c) {
+                       return tag == std::toupper(c);
+                     })) {
+        cur_game_.start_fen =
+            line.substr(kFenTag.size(), line.find('"', kFenTag.size()) -
+                                            kFenTag.size());
       }
-      if (line.empty()) continue;
-      std::istringstream iss(line);
-      std::string word;
-      while (!iss.eof()) {
-        word.clear();
-        iss >> word;
-        if (word.size() < 2) continue;
-        // Trim move numbers from front.
-        const auto idx = word.find('.');
-        if (idx != std::string::npos) {
-          bool all_nums = true;
-          for (size_t i = 0; i < idx; i++) {
-            if (word[i] < '0' || word[i] > '9') {
-              all_nums = false;
-              break;
-            }
-          }
-          if (all_nums) {
-            word = word.substr(idx + 1);
-          }
-        }
-        // Pure move numbers can be skipped.
-        if (word.size() < 2) continue;
-        // Ignore score line.
-        if (word == "1/2-1/2" || word == "1-0" || word == "0-1" || word == "*")
-          continue;
-        cur_game_.push_back(SanToMove(word, cur_board_));
-        cur_board_.ApplyMove(cur_game_.back());
-        // Board ApplyMove wants mirrored for black, but outside code wants
-        // normal, so mirror it back again.
-        // Check equal to 0 since we've already added the position.
-        if ((cur_game_.size() % 2) == 0) cur_game_.back().Flip();
-        cur_board_.Mirror();
+      return;
+    }
+    // Must have at least one non-tag non-empty line in order to be considered
+    // a game.
+    started_ = true;
+    // Handle braced comments.
+    size_t cur_offset = 0;
+    while (true) {
+      if (in_comment_) {
+        const auto close = line.find('}', cur_offset);
+        if (close == std::string::npos) break;
+        line.erase(cur_offset, close + 1 - cur_offset);
+        in_comment_ = false;
+      } else {
+        const auto open = line.find('{', cur_offset);
+        if (open == std::string::npos) break;
+        cur_offset = open;
+        in_comment_ = true;
       }
     }
-    if (started) {
-      Flush();
+    if (in_comment_) line.resize(cur_offset);
+    // Trim trailing comment.
+    const auto semicolon = line.find(';');
+    if (semicolon != std::string::npos) line.resize(semicolon);
+    if (line.empty()) return;
+    cur_game_.movetext += line;
+    cur_game_.movetext += ' ';
+  }
+
+  // Splits the next batch of games and parses them in parallel.
+  void FillBatch() {
+    games_.clear();
+    next_ = 0;
+    raw_games_.clear();
+    const size_t batch_size = kGamesPerThread * threads_;
+    while (raw_games_.size() < batch_size && ReadLine(&line_)) {
+      ProcessLine(line_);
+    }
+    if (raw_games_.size() < batch_size && started_) {
+      raw_games_.push_back(std::move(cur_game_));
+      cur_game_ = RawGame();
+      started_ = false;
+    }
+    games_.resize(raw_games_.size());
+    const size_t workers =
+        std::min<size_t>(threads_, raw_games_.size() / kGamesPerThread + 1);
+    std::vector<std::exception_ptr> errors(workers);
+    auto parse = [&](size_t worker) {
+      try {
+        for (size_t i = worker; i < raw_games_.size(); i += workers) {
+          games_[i] = ParseGame(raw_games_[i]);
+        }
+      } catch (...) {
+        errors[worker] = std::current_exception();
+      }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers; ++i) threads.emplace_back(parse, i);
+    parse(0);
+    for (auto& thread : threads) thread.join();
+    for (auto& error : errors) {
+      if (error) std::rethrow_exception(error);
     }
-    gzclose(file);
   }
-  std::vector<Opening> GetGames() const { return games_; }
-  std::vector<Opening>&& ReleaseGames() { return std::move(games_); }
 
- private:
-  void Flush() {
-    games_.push_back({cur_startpos_, cur_game_});
-    cur_game_.clear();
-    cur_board_.SetFromFen(ChessBoard::kStartposFen);
-    cur_startpos_ = ChessBoard::kStartposFen;
+  static Opening ParseGame(const RawGame& raw) {
+    Opening game{raw.start_fen, {}};
+    ChessBoard board(raw.start_fen);
+    const std::string& text = raw.movetext;
+    size_t end = 0;
+    while (true) {
+      const size_t begin = text.find_first_not_of(" \t\n\v\f\r", end);
+      if (begin == std::string::npos) break;
+      end = text.find_first_of(" \t\n\v\f\r", begin);
+      std::string_view word(text.data() + begin,
+                            std::min(end, text.size()) - begin);
+      if (word.size() < 2) continue;
+      // Trim move numbers from front.
+      const auto idx = word.find('.');
+      if (idx != std::string::npos &&
+          std::all_of(word.begin(), word.begin() + idx,
+                      [](char c) { return c >= '0' && c <= '9'; })) {
+        word.remove_prefix(idx + 1);
+      }
+      // Pure move numbers can be skipped.
+      if (word.size() < 2) continue;
+      // Ignore score line.
+      if (word == "1/2-1/2" || word == "1-0" || word == "0-1" || word == "*") {
+        continue;
+      }
+      game.moves.push_back(SanToMove(std::string(word), board));
+      board.ApplyMove(game.moves.back());
+      // Board ApplyMove wants mirrored for black, but outside code wants
+      // normal, so mirror it back again.
+      // Check equal to 0 since we've already added the position.
+      if ((game.moves.size() % 2) == 0) game.moves.back().Flip();
+      board.Mirror();
+    }
+    return game;
   }
 
   static std::optional<PieceType> PieceToPieceType(int p) {
@@ -192,7 +278,7 @@ class PgnReader {
     }
   }
 
-  Move SanToMove(const std::string& san, const ChessBoard& board) {
+  static Move SanToMove(const std::string& san, const ChessBoard& board) {
     int p = 0;
     size_t idx = 0;
     if (san[0] == 'K') {
@@ -330,9 +416,30 @@ class PgnReader {
     return m;
   }
 
-  ChessBoard cur_board_{ChessBoard::kStartposFen};
-  MoveList cur_game_;
-  std::string cur_startpos_ = ChessBoard::kStartposFen;
+  const size_t threads_;
+  gzFile file_;
+  std::string buffer_;
+  size_t pos_ = 0;
+  bool eof_ = false;
+  std::string line_;
+  bool in_comment_ = false;
+  bool started_ = false;
+  RawGame cur_game_;
+  std::vector<RawGame> raw_games_;
+  std::vector<Opening> games_;
+  size_t next_ = 0;
+};
+
+class PgnReader {
+ public:
+  void AddPgnFile(const std::string& filepath) {
+    PgnStream stream(filepath);
+    while (auto game = stream.Next()) games_.push_back(std::move(*game));
+  }
+  std::vector<Opening> GetGames() const { return games_; }
+  std::vector<Opening>&& ReleaseGames() { return std::move(games_); }
+
+ private:
   std::vector<Opening> games_;
 };
 
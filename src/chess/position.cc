@@ -27,6 +27,7 @@
 
 #include "chess/position.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cctype>
 #include <cstdlib>
@@ -64,22 +65,25 @@ char GetPieceAt(const lczero::ChessBoard& board, int row, int col) {
 }  // namespace
 
 Position::Position(const Position& parent, Move m)
-    : rule50_ply_(parent.rule50_ply_ + 1), ply_count_(parent.ply_count_ + 1) {
-  us_board_ = parent.us_board_;
+    : us_board_(parent.us_board_),
+      rule50_ply_(std::min(parent.rule50_ply_ + 1, kMaxRule50Ply)),
+      ply_count_(std::min<int>(parent.ply_count_ + 1, kMaxGamePly)) {
   const bool is_zeroing = us_board_.ApplyMove(m);
   us_board_.Mirror();
   if (is_zeroing) rule50_ply_ = 0;
 }
 
 Position::Position(const ChessBoard& board, int rule50_ply, int game_ply)
-    : rule50_ply_(rule50_ply), repetitions_(0), ply_count_(game_ply) {
-  us_board_ = board;
-}
+    : us_board_(board),
+      rule50_ply_(std::clamp(rule50_ply, 0, kMaxRule50Ply)),
+      ply_count_(std::clamp(game_ply, 0, kMaxGamePly)) {}
 
 Position Position::FromFen(std::string_view fen) {
-  Position pos;
-  pos.us_board_.SetFromFen(std::string(fen), &pos.rule50_ply_, &pos.ply_count_);
-  return pos;
+  ChessBoard board;
+  int rule50_ply;
+  int game_ply;
+  board.SetFromFen(std::string(fen), &rule50_ply, &game_ply);
+  return Position(board, rule50_ply, game_ply);
 }
 
 uint64_t Position::Hash() const {
@@ -96,9 +100,10 @@ GameResult operator-(const GameResult& res) {
 
 GameResult PositionHistory::ComputeGameResult() const {
   const auto& board = Last().GetBoard();
-  auto legal_moves = board.GenerateLegalMoves();
+  KingAttackInfo king_attack_info;
+  auto legal_moves = board.GenerateLegalMoves(&king_attack_info);
   if (legal_moves.empty()) {
-    if (board.IsUnderCheck()) {
+    if (king_attack_info.in_check()) {
       // Checkmate.
       return IsBlackToMove() ? GameResult::WHITE_WON : GameResult::BLACK_WON;
     }
@@ -113,15 +118,43 @@ GameResult PositionHistory::ComputeGameResult() const {
   return GameResult::UNDECIDED;
 }
 
+PositionHistory::PositionHistory(std::span<const Position> positions)
+    : positions_(positions.begin(), positions.end()) {
+  bucket_prev_.reserve(positions_.size());
+  for (const Position& pos : positions_) {
+    const int bucket = BucketOf(pos);
+    bucket_prev_.push_back(bucket_head_[bucket]);
+    bucket_head_[bucket] = bucket_prev_.size();
+  }
+}
+
 void PositionHistory::Reset(const ChessBoard& board, int rule50_ply,
                             int game_ply) {
   positions_.clear();
+  bucket_prev_.clear();
+  bucket_head_.fill(0);
   positions_.emplace_back(board, rule50_ply, game_ply);
+  IndexLast();
 }
 
 void PositionHistory::Reset(const Position& pos) {
   positions_.clear();
+  bucket_prev_.clear();
+  bucket_head_.fill(0);
   positions_.push_back(pos);
+  IndexLast();
+}
+
+void PositionHistory::Pop() {
+  bucket_head_[BucketOf(positions_.back())] = bucket_prev_.back();
+  bucket_prev_.pop_back();
+  positions_.pop_back();
+}
+
+void PositionHistory::IndexLast() {
+  const int bucket = BucketOf(positions_.back());
+  bucket_prev_.push_back(bucket_head_[bucket]);
+  bucket_head_[bucket] = positions_.size();
 }
 
 void PositionHistory::Append(Move m) {
@@ -129,6 +162,7 @@ void PositionHistory::Append(Move m) {
   //                has a bug in implementation of emplace_back, when
   //                reallocation happens. (it also reallocates Last())
   positions_.push_back(Position(Last(), m));
+  IndexLast();
   int cycle_length;
   int repetitions = ComputeLastMoveRepetitions(&cycle_length);
   positions_.back().SetRepetitions(repetitions, cycle_length);
@@ -137,16 +171,21 @@ void PositionHistory::Append(Move m) {
 int PositionHistory::ComputeLastMoveRepetitions(int* cycle_length) const {
   *cycle_length = 0;
   const auto& last = positions_.back();
-  // TODO(crem) implement hash/cache based solution.
   if (last.GetRule50Ply() < 4) return 0;
 
-  for (int idx = positions_.size() - 5; idx >= 0; idx -= 2) {
+  // Only positions since the last zeroing move can repeat, walk those sharing
+  // the hash bucket with the last position, latest first.
+  const int last_idx = positions_.size() - 1;
+  const int first_idx = std::max(0, last_idx - last.GetRule50Ply());
+  for (int idx = bucket_prev_[last_idx] - 1; idx >= first_idx;
+       idx = bucket_prev_[idx] - 1) {
     const auto& pos = positions_[idx];
-    if (pos.GetBoard() == last.GetBoard()) {
-      *cycle_length = positions_.size() - 1 - idx;
+    if (idx <= last_idx - 4 &&
+        pos.GetBoard().Hash() == last.GetBoard().Hash() &&
+        pos.GetBoard() == last.GetBoard()) {
+      *cycle_length = last_idx - idx;
       return 1 + pos.GetRepetitions();
     }
-    if (pos.GetRule50Ply() < 2) return 0;
   }
   return 0;
 }
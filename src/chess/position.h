@@ -27,6 +27,9 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <span>
 #include <string>
 #include <string_view>
@@ -60,8 +63,8 @@ class Position {
   // Someone outside that class knows better about repetitions, so they can
   // set it.
   void SetRepetitions(int repetitions, int cycle_length) {
-    repetitions_ = repetitions;
-    cycle_length_ = cycle_length;
+    repetitions_ = std::min(repetitions, kMaxRepetitions);
+    cycle_length_ = std::min(cycle_length, kMaxCycleLength);
   }
 
   // Number of ply with no captures and pawn moves.
@@ -76,19 +79,28 @@ class Position {
   std::string DebugString() const;
 
  private:
+  // Counters are packed so that a Position fits into a cache line, values out
+  // of range saturate.
+  static constexpr int kMaxRule50Ply = 0xffff;
+  static constexpr int kMaxCycleLength = 0xffff;
+  static constexpr int kMaxGamePly = 0xffffff;
+  static constexpr int kMaxRepetitions = 0xff;
+
   // The board from the point of view of the player to move.
   ChessBoard us_board_;
 
   // How many half-moves without capture or pawn move was there.
-  int rule50_ply_ = 0;
-  // How many repetitions this position had before. For new positions it's 0.
-  int repetitions_ = 0;
+  uint16_t rule50_ply_ = 0;
   // How many half-moves since the position was repeated or 0.
-  int cycle_length_ = 0;
+  uint16_t cycle_length_ = 0;
   // number of half-moves since beginning of the game.
-  int ply_count_ = 0;
+  uint32_t ply_count_ : 24 = 0;
+  // How many repetitions this position had before. For new positions it's 0.
+  uint32_t repetitions_ : 8 = 0;
 };
 
+static_assert(sizeof(Position) <= 64, "Position doesn't fit a cache line");
+
 // GetFen returns a FEN notation for the position.
 std::string GetFen(const Position& pos);
 
@@ -101,8 +113,7 @@ class PositionHistory {
   PositionHistory() = default;
   PositionHistory(const PositionHistory& other) = default;
   PositionHistory(PositionHistory&& other) = default;
-  PositionHistory(std::span<const Position> positions)
-      : positions_(positions.begin(), positions.end()) {}
+  PositionHistory(std::span<const Position> positions);
 
   PositionHistory& operator=(const PositionHistory& other) = default;
   PositionHistory& operator=(PositionHistory&& other) = default;
@@ -118,12 +129,15 @@ class PositionHistory {
 
   // Trims position to a given size.
   void Trim(int size) {
-    positions_.erase(positions_.begin() + size, positions_.end());
+    while (GetLength() > size) Pop();
   }
 
   // Can be used to reduce allocation cost while performing a sequence of moves
   // in succession.
-  void Reserve(int size) { positions_.reserve(size); }
+  void Reserve(int size) {
+    positions_.reserve(size);
+    bucket_prev_.reserve(size);
+  }
 
   // Number of positions in history.
   int GetLength() const { return positions_.size(); }
@@ -136,7 +150,7 @@ class PositionHistory {
   void Append(Move m);
 
   // Pops last move from history.
-  void Pop() { positions_.pop_back(); }
+  void Pop();
 
   // Finds the endgame state (win/lose/draw/nothing) for the last position.
   GameResult ComputeGameResult() const;
@@ -154,8 +168,21 @@ class PositionHistory {
 
  private:
   int ComputeLastMoveRepetitions(int* cycle_length) const;
+  // Adds the last position to the repetition lookup table.
+  void IndexLast();
+
+  static constexpr int kRepetitionBuckets = 256;
+  static int BucketOf(const Position& pos) {
+    return pos.GetBoard().Hash() % kRepetitionBuckets;
+  }
 
   std::vector<Position> positions_;
+  // Repetition lookup table: positions are chained by the low bits of their
+  // board hash. Indices are 1-based, 0 terminates a chain.
+  // The latest position in every bucket.
+  std::array<int, kRepetitionBuckets> bucket_head_ = {};
+  // For every position, the previous one in the same bucket.
+  std::vector<int> bucket_prev_;
 };
 
 }  // namespace lczero
@@ -56,6 +56,33 @@ TEST(Position, SetFenGetFen) {
   }
 }
 
+// Hash is updated incrementally by moves, it has to match the one computed
+// from scratch for the same position.
+TEST(Position, IncrementalHashMatchesFen) {
+  const std::vector<std::string> start_fens = {
+      ChessBoard::kStartposFen,
+      "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+      "bqnb1rkr/pp3ppp/3ppn2/2p5/5P2/P2P4/NPP1P1PP/BQ1BNRKR w HFhf - 2 9",
+      "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1"};
+  uint64_t seed = 1;
+  for (const auto& fen : start_fens) {
+    for (int game = 0; game < 50; ++game) {
+      PositionHistory history;
+      history.Reset(Position::FromFen(fen));
+      for (int ply = 0; ply < 150; ++ply) {
+        const auto moves = history.Last().GetBoard().GenerateLegalMoves();
+        if (moves.empty()) break;
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        history.Append(moves[(seed >> 33) % moves.size()]);
+        const Position& pos = history.Last();
+        ASSERT_EQ(pos.GetBoard().Hash(),
+                  Position::FromFen(GetFen(pos)).GetBoard().Hash())
+            << GetFen(pos);
+      }
+    }
+  }
+}
+
 // https://github.com/LeelaChessZero/lc0/issues/209
 TEST(PositionHistory, ComputeLastMoveRepetitionsWithoutLegalEnPassant) {
   ChessBoard board;
@@ -89,6 +116,43 @@ TEST(PositionHistory, ComputeLastMoveRepetitionsWithLegalEnPassant) {
   EXPECT_EQ(repeated_position.GetRepetitions(), 0);
 }
 
+// Repetitions found through the hash lookup must match a full scan, also
+// after moves are popped and the history is copied.
+TEST(PositionHistory, RepetitionsMatchFullScan) {
+  auto full_scan = [](std::span<const Position> positions) {
+    const int last = positions.size() - 1;
+    for (int idx = last - 4; idx >= 0; idx -= 2) {
+      if (positions[idx].GetBoard() == positions[last].GetBoard()) {
+        return std::make_pair(1 + positions[idx].GetRepetitions(), last - idx);
+      }
+      if (positions[idx].GetRule50Ply() < 2) break;
+    }
+    return std::make_pair(0, 0);
+  };
+  uint64_t seed = 1;
+  for (int game = 0; game < 20; ++game) {
+    PositionHistory history;
+    history.Reset(Position::FromFen("4k3/8/8/8/8/8/8/R3K2R w KQ - 0 1"));
+    for (int ply = 0; ply < 400; ++ply) {
+      seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+      if ((seed >> 60) == 0 && history.GetLength() > 1) {
+        const int pops =
+            1 + (seed >> 33) % std::min(3, history.GetLength() - 1);
+        history.Trim(history.GetLength() - pops);
+        history = PositionHistory(history.GetPositions());
+        continue;
+      }
+      const auto moves = history.Last().GetBoard().GenerateLegalMoves();
+      if (moves.empty() || history.Last().GetRule50Ply() >= 100) break;
+      history.Append(moves[(seed >> 33) % moves.size()]);
+      const Position& pos = history.Last();
+      const auto expected = full_scan(history.GetPositions());
+      ASSERT_EQ(pos.GetRepetitions(), expected.first) << GetFen(pos);
+      ASSERT_EQ(pos.GetPliesSincePrevRepetition(), expected.second);
+    }
+  }
+}
+
 TEST(PositionHistory, DidRepeatSinceLastZeroingMoveCurent) {
   ChessBoard board;
   PositionHistory history;
@@ -153,6 +153,8 @@ class Move {
   static constexpr Move WhiteEnPassant(Square from, Square to) {
     return Move((from.as_idx() << 6) | to.as_idx() | kEnPassant);
   }
+  // Restores a move from its raw_data().
+  static constexpr Move FromRaw(uint16_t data) { return Move(data); }
 
   bool operator==(const Move& other) const = default;
   bool operator!=(const Move& other) const = default;
@@ -28,13 +28,14 @@
 #include "uciloop.h"
 
 #include <algorithm>
-#include <iomanip>
+#include <array>
+#include <charconv>
 #include <iostream>
+#include <iterator>
 #include <mutex>
-#include <sstream>
 #include <string>
-#include <unordered_map>
-#include <unordered_set>
+#include <string_view>
+#include <system_error>
 #include <utility>
 
 #include "utils/exception.h"
@@ -53,88 +54,109 @@ const OptionId kShowWDL{"show-wdl", "UCI_ShowWDL",
 const OptionId kShowMovesleft{"show-movesleft", "UCI_ShowMovesLeft",
                               "Show estimated moves left."};
 
-const std::unordered_map<std::string, std::unordered_set<std::string>>
-    kKnownCommands = {
-        {{"uci"}, {}},
-        {{"isready"}, {}},
-        {{"setoption"}, {"context", "name", "value"}},
-        {{"ucinewgame"}, {}},
-        {{"position"}, {"fen", "startpos", "moves"}},
-        {{"go"},
-         {"infinite", "wtime", "btime", "winc", "binc", "movestogo", "depth",
-          "mate", "nodes", "movetime", "searchmoves", "ponder"}},
-        {{"stop"}, {}},
-        {{"ponderhit"}, {}},
-        {{"quit"}, {}},
-        {{"xyzzy"}, {}},
-        {{"fen"}, {}},
+struct KnownCommand {
+  std::string_view name;
+  std::array<std::string_view, UciCommand::kMaxParams> keys;
 };
 
-std::pair<std::string, std::unordered_map<std::string, std::string>>
-ParseCommand(const std::string& line) {
-  std::unordered_map<std::string, std::string> params;
-  std::string* value = nullptr;
+constexpr KnownCommand kKnownCommands[] = {
+    {"uci", {}},
+    {"isready", {}},
+    {"setoption", {"context", "name", "value"}},
+    {"ucinewgame", {}},
+    {"position", {"fen", "startpos", "moves"}},
+    {"go",
+     {"infinite", "wtime", "btime", "winc", "binc", "movestogo", "depth",
+      "mate", "nodes", "movetime", "searchmoves", "ponder"}},
+    {"stop", {}},
+    {"ponderhit", {}},
+    {"quit", {}},
+    {"xyzzy", {}},
+    {"fen", {}},
+};
 
-  std::istringstream iss(line);
-  std::string token;
-  iss >> token >> std::ws;
+// Parses @line without copying it, the command refers to the line's storage.
+UciCommand ParseCommand(std::string_view line) {
+  UciCommand result;
+  std::string_view rest = line;
+  const std::string_view token = StrNextToken(&rest);
 
   // If empty line, return empty command.
-  if (token.empty()) return {};
+  if (token.empty()) return result;
 
-  const auto command = kKnownCommands.find(token);
-  if (command == kKnownCommands.end()) {
-    throw Exception("Unknown command: " + line);
+  const auto command = std::find_if(
+      std::begin(kKnownCommands), std::end(kKnownCommands),
+      [&](const KnownCommand& known) { return known.name == token; });
+  if (command == std::end(kKnownCommands)) {
+    throw Exception("Unknown command: " + std::string(line));
   }
-
-  std::string whitespace;
-  while (iss >> token) {
-    auto iter = command->second.find(token);
-    if (iter == command->second.end()) {
-      if (!value) throw Exception("Unexpected token: " + token);
-      *value += whitespace + token;
-      whitespace = " ";
-    } else {
-      value = &params[token];
-      iss >> std::ws;
-      whitespace = "";
+  result.name = command->name;
+
+  std::string_view* value = nullptr;
+  for (auto token = StrNextToken(&rest); !token.empty();
+       token = StrNextToken(&rest)) {
+    const auto key = std::find(command->keys.begin(), command->keys.end(),
+                               token);
+    if (key == command->keys.end() || key->empty()) {
+      if (!value) throw Exception("Unexpected token: " + std::string(token));
+      // Extend the value up to the end of this token.
+      *value = value->empty() ? token
+                              : std::string_view(value->data(),
+                                                 token.data() + token.size() -
+                                                     value->data());
+      continue;
+    }
+    auto iter = std::find_if(
+        result.params.begin(), result.params.begin() + result.num_params,
+        [&](const auto& param) { return param.first == *key; });
+    if (iter == result.params.begin() + result.num_params) {
+      ++result.num_params;
     }
+    // A repeated key starts its value over, as it always did.
+    *iter = {*key, {}};
+    value = &iter->second;
   }
-  return {command->first, params};
+  return result;
 }
 
-std::string GetOrEmpty(
-    const std::unordered_map<std::string, std::string>& params,
-    const std::string& key) {
-  const auto iter = params.find(key);
-  if (iter == params.end()) return {};
-  return iter->second;
+// Appends @prefix and @value to @str without temporary strings.
+template <typename T>
+void AppendNumber(std::string* str, std::string_view prefix, T value) {
+  char buf[24];
+  const auto result = std::to_chars(std::begin(buf), std::end(buf), value);
+  str->append(prefix);
+  str->append(buf, result.ptr);
 }
 
-int GetNumeric(const std::unordered_map<std::string, std::string>& params,
-               const std::string& key) {
-  const auto iter = params.find(key);
-  if (iter == params.end()) {
-    throw Exception("Unexpected error");
+int GetNumeric(const UciCommand& command, std::string_view key) {
+  const std::string_view str = command.Get(key);
+  if (str.empty()) {
+    throw Exception("expected value after " + std::string(key));
   }
-  const std::string& str = iter->second;
-  try {
-    if (str.empty()) {
-      throw Exception("expected value after " + key);
-    }
-    return std::stoi(str);
-  } catch (std::invalid_argument&) {
-    throw Exception("invalid value " + str);
-  } catch (const std::out_of_range&) {
-    throw Exception("out of range value " + str);
+  int value = 0;
+  const auto [ptr, ec] =
+      std::from_chars(str.data(), str.data() + str.size(), value);
+  if (ec == std::errc::invalid_argument) {
+    throw Exception("invalid value " + std::string(str));
+  }
+  if (ec == std::errc::result_out_of_range) {
+    throw Exception("out of range value " + std::string(str));
   }
+  return value;
 }
+}  // namespace
 
-bool ContainsKey(const std::unordered_map<std::string, std::string>& params,
-                 const std::string& key) {
-  return params.find(key) != params.end();
+bool UciCommand::Contains(std::string_view key) const {
+  return std::any_of(params.begin(), params.begin() + num_params,
+                     [&](const auto& param) { return param.first == key; });
+}
+
+std::string_view UciCommand::Get(std::string_view key) const {
+  for (size_t i = 0; i < num_params; ++i) {
+    if (params[i].first == key) return params[i].second;
+  }
+  return {};
 }
-}  // namespace
 
 UciLoop::UciLoop(StringUciResponder* uci_responder, OptionsParser* options,
                  EngineControllerBase* engine)
@@ -144,9 +166,8 @@ UciLoop::UciLoop(StringUciResponder* uci_responder, OptionsParser* options,
 
 UciLoop::~UciLoop() { engine_->UnregisterUciResponder(uci_responder_); }
 
-bool UciLoop::DispatchCommand(
-    const std::string& command,
-    const std::unordered_map<std::string, std::string>& params) {
+bool UciLoop::DispatchCommand(const UciCommand& params) {
+  const std::string_view command = params.name;
   if (command == "uci") {
     uci_responder_->SendId();
     for (const auto& option : options_->ListOptionsUci()) {
@@ -157,39 +178,45 @@ bool UciLoop::DispatchCommand(
     engine_->EnsureReady();
     uci_responder_->SendRawResponse("readyok");
   } else if (command == "setoption") {
-    options_->SetUciOption(GetOrEmpty(params, "name"),
-                           GetOrEmpty(params, "value"),
-                           GetOrEmpty(params, "context"));
+    engine_->BeforeOptionsChange();
+    options_->SetUciOption(std::string(params.Get("name")),
+                           std::string(params.Get("value")),
+                           std::string(params.Get("context")));
   } else if (command == "ucinewgame") {
     engine_->NewGame();
   } else if (command == "position") {
-    if (ContainsKey(params, "fen") == ContainsKey(params, "startpos")) {
+    if (params.Contains("fen") == params.Contains("startpos")) {
       throw Exception("Position requires either fen or startpos");
     }
-    const std::vector<std::string> moves =
-        StrSplitAtWhitespace(GetOrEmpty(params, "moves"));
-    const std::string fen = GetOrEmpty(params, "fen");
-    engine_->SetPosition(fen.empty() ? ChessBoard::kStartposFen : fen, moves);
+    StrSplitAtWhitespace(params.Get("moves"), &moves_buffer_);
+    const std::string_view fen = params.Get("fen");
+    if (fen.empty()) {
+      fen_buffer_ = ChessBoard::kStartposFen;
+    } else {
+      fen_buffer_.assign(fen);
+    }
+    engine_->SetPosition(fen_buffer_, moves_buffer_);
   } else if (command == "go") {
     GoParams go_params;
-    if (ContainsKey(params, "infinite")) {
-      if (!GetOrEmpty(params, "infinite").empty()) {
-        throw Exception("Unexpected token " + GetOrEmpty(params, "infinite"));
+    if (params.Contains("infinite")) {
+      if (!params.Get("infinite").empty()) {
+        throw Exception("Unexpected token " +
+                        std::string(params.Get("infinite")));
       }
       go_params.infinite = true;
     }
-    if (ContainsKey(params, "searchmoves")) {
-      go_params.searchmoves =
-          StrSplitAtWhitespace(GetOrEmpty(params, "searchmoves"));
+    if (params.Contains("searchmoves")) {
+      StrSplitAtWhitespace(params.Get("searchmoves"), &go_params.searchmoves);
     }
-    if (ContainsKey(params, "ponder")) {
-      if (!GetOrEmpty(params, "ponder").empty()) {
-        throw Exception("Unexpected token " + GetOrEmpty(params, "ponder"));
+    if (params.Contains("ponder")) {
+      if (!params.Get("ponder").empty()) {
+        throw Exception("Unexpected token " +
+                        std::string(params.Get("ponder")));
       }
       go_params.ponder = true;
     }
 #define UCIGOOPTION(x)                    \
-  if (ContainsKey(params, #x)) {          \
+  if (params.Contains(#x)) {              \
     go_params.x = GetNumeric(params, #x); \
   }
     UCIGOOPTION(wtime);
@@ -212,16 +239,16 @@ bool UciLoop::DispatchCommand(
   } else if (command == "quit") {
     return false;
   } else {
-    throw Exception("Unknown command: " + command);
+    throw Exception("Unknown command: " + std::string(command));
   }
   return true;
 }
 
 bool UciLoop::ProcessLine(const std::string& line) {
-  auto command = ParseCommand(line);
+  const UciCommand command = ParseCommand(line);
   // Ignore empty line.
-  if (command.first.empty()) return true;
-  return DispatchCommand(command.first, command.second);
+  if (command.name.empty()) return true;
+  return DispatchCommand(command);
 }
 
 void StringUciResponder::PopulateParams(OptionsParser* options) {
@@ -256,39 +283,48 @@ void StringUciResponder::OutputBestMove(BestMoveInfo* info) {
 }
 
 void StringUciResponder::OutputThinkingInfo(std::vector<ThinkingInfo>* infos) {
-  std::vector<std::string> reses;
+  // Lines keep their capacity between calls, so that steady state output
+  // doesn't allocate.
+  thread_local std::vector<std::string> reses;
+  reses.resize(infos->size());
   const bool c960 = IsChess960();
-  for (const auto& info : *infos) {
-    std::string res = "info";
-    if (info.player != -1) res += " player " + std::to_string(info.player);
-    if (info.game_id != -1) res += " gameid " + std::to_string(info.game_id);
-    if (info.is_black)
-      res += " side " + std::string(*info.is_black ? "black" : "white");
-    if (info.depth >= 0)
-      res += " depth " + std::to_string(std::max(info.depth, 1));
-    if (info.seldepth >= 0) res += " seldepth " + std::to_string(info.seldepth);
-    if (info.time >= 0) res += " time " + std::to_string(info.time);
-    if (info.nodes >= 0) res += " nodes " + std::to_string(info.nodes);
-    if (info.mate) res += " score mate " + std::to_string(*info.mate);
-    if (info.score) res += " score cp " + std::to_string(*info.score);
+  for (size_t i = 0; i < infos->size(); ++i) {
+    const auto& info = (*infos)[i];
+    std::string& res = reses[i];
+    res = "info";
+    if (info.player != -1) AppendNumber(&res, " player ", info.player);
+    if (info.game_id != -1) AppendNumber(&res, " gameid ", info.game_id);
+    if (info.is_black) res += *info.is_black ? " side black" : " side white";
+    if (info.depth >= 0) AppendNumber(&res, " depth ", std::max(info.depth, 1));
+    if (info.seldepth >= 0) AppendNumber(&res, " seldepth ", info.seldepth);
+    if (info.time >= 0) AppendNumber(&res, " time ", info.time);
+    if (info.nodes >= 0) AppendNumber(&res, " nodes ", info.nodes);
+    if (info.mate) AppendNumber(&res, " score mate ", *info.mate);
+    if (info.score) AppendNumber(&res, " score cp ", *info.score);
     if (info.wdl && options_ && options_->Get<bool>(kShowWDL)) {
-      res += " wdl " + std::to_string(info.wdl->w) + " " +
-             std::to_string(info.wdl->d) + " " + std::to_string(info.wdl->l);
+      AppendNumber(&res, " wdl ", info.wdl->w);
+      AppendNumber(&res, " ", info.wdl->d);
+      AppendNumber(&res, " ", info.wdl->l);
     }
     if (info.moves_left && options_ && options_->Get<bool>(kShowMovesleft)) {
-      res += " movesleft " + std::to_string(*info.moves_left);
+      AppendNumber(&res, " movesleft ", *info.moves_left);
     }
-    if (info.hashfull >= 0) res += " hashfull " + std::to_string(info.hashfull);
-    if (info.nps >= 0) res += " nps " + std::to_string(info.nps);
-    if (info.tb_hits >= 0) res += " tbhits " + std::to_string(info.tb_hits);
-    if (info.multipv >= 0) res += " multipv " + std::to_string(info.multipv);
+    if (info.hashfull >= 0) AppendNumber(&res, " hashfull ", info.hashfull);
+    if (info.nps >= 0) AppendNumber(&res, " nps ", info.nps);
+    if (info.tb_hits >= 0) AppendNumber(&res, " tbhits ", info.tb_hits);
+    if (info.multipv >= 0) AppendNumber(&res, " multipv ", info.multipv);
 
     if (!info.pv.empty()) {
       res += " pv";
-      for (const auto& move : info.pv) res += " " + move.ToString(c960);
+      for (const auto& move : info.pv) {
+        res += ' ';
+        res += move.ToString(c960);
+      }
+    }
+    if (!info.comment.empty()) {
+      res += " string ";
+      res += info.comment;
     }
-    if (!info.comment.empty()) res += " string " + info.comment;
-    reses.push_back(std::move(res));
   }
   SendRawResponses(reses);
 }
@@ -27,10 +27,12 @@
 
 #pragma once
 
+#include <array>
 #include <fstream>
 #include <optional>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 #include "chess/callbacks.h"
@@ -80,6 +82,10 @@ class EngineControllerBase {
   // Blocks.
   virtual void EnsureReady() = 0;
 
+  // Called before the UCI options change. Blocks until the work that the
+  // engine started in the background and that reads the options is done.
+  virtual void BeforeOptionsChange() {}
+
   // Must not block.
   virtual void NewGame() = 0;
 
@@ -98,6 +104,24 @@ class EngineControllerBase {
   virtual void UnregisterUciResponder(UciResponder*) = 0;
 };
 
+// A parsed UCI command line. Views point into the parsed line, so it must
+// outlive the command.
+struct UciCommand {
+  static constexpr size_t kMaxParams = 12;
+
+  // Returns whether @key is present.
+  bool Contains(std::string_view key) const;
+  // Returns the value of @key, or an empty view if it's absent.
+  std::string_view Get(std::string_view key) const;
+
+  std::string_view name;
+  // Keys and their values, with the value spanning verbatim from its first to
+  // its last token.
+  std::array<std::pair<std::string_view, std::string_view>, kMaxParams>
+      params;
+  size_t num_params = 0;
+};
+
 class UciLoop {
  public:
   UciLoop(StringUciResponder* uci_responder, OptionsParser* options,
@@ -108,13 +132,16 @@ class UciLoop {
   bool ProcessLine(const std::string& line);
 
  protected:
-  bool DispatchCommand(
-      const std::string& command,
-      const std::unordered_map<std::string, std::string>& params);
+  bool DispatchCommand(const UciCommand& command);
 
   StringUciResponder* uci_responder_;  // absl_nonnull
   OptionsParser* options_;             // absl_notnull
   EngineControllerBase* engine_;       // absl_notnull
+
+ private:
+  // Reused between "position" commands to avoid allocating on every move.
+  std::string fen_buffer_;
+  std::vector<std::string> moves_buffer_;
 };
 
 class StdoutUciResponder : public StringUciResponder {
@@ -28,10 +28,14 @@
 #include "engine.h"
 
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <span>
 
 #include "chess/gamestate.h"
 #include "chess/position.h"
 #include "neural/backend.h"
+#include "neural/diskcache.h"
 #include "neural/memcache.h"
 #include "neural/register.h"
 #include "neural/shared_params.h"
@@ -44,47 +48,145 @@ const OptionId kSyzygyTablebaseId{
     "List of Syzygy tablebase directories, list entries separated by system "
     "separator (\";\" for Windows, \":\" for Linux).",
     's'};
+const OptionId kSyzygyPreloadId{
+    "syzygy-preload", "SyzygyPreload",
+    "Bring WDL tablebase files into memory when loading them: 'willneed' "
+    "starts reading them in the background, 'lock' also keeps them in "
+    "memory."};
+const OptionId kSyzygyPreloadPiecesId{
+    "syzygy-preload-pieces", "SyzygyPreloadPieces",
+    "Preload WDL tablebase files with up to this many pieces."};
 const OptionId kPreload{"preload", "",
                         "Initialize backend and load net on engine startup."};
+const OptionId kNewGameWarmupId{
+    "newgame-warmup", "NewGameWarmup",
+    "On ucinewgame, evaluate the start position and the replies to it in the "
+    "background, so that the first search doesn't start with a cold NN "
+    "cache."};
+
+SyzygyPreload GetSyzygyPreload(const OptionsDict& options) {
+  const std::string preload = options.Get<std::string>(kSyzygyPreloadId);
+  if (preload == "willneed") return SyzygyPreload::kWillNeed;
+  if (preload == "lock") return SyzygyPreload::kLock;
+  return SyzygyPreload::kNone;
+}
+
+int MillisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
 }  // namespace
 
 void Engine::PopulateOptions(OptionsParser* options) {
   options->Add<StringOption>(kSyzygyTablebaseId);
+  options->Add<ChoiceOption>(kSyzygyPreloadId,
+                             std::vector<std::string>{"none", "willneed",
+                                                      "lock"}) = "none";
+  options->Add<IntOption>(kSyzygyPreloadPiecesId, 3, 7) = 5;
   options->Add<BoolOption>(kPreload) = false;
+  options->Add<BoolOption>(kNewGameWarmupId) = true;
 }
 
-Engine::Engine(const SearchFactory& factory, const OptionsDict& opts)
+Engine::Engine(const SearchFactory& factory, const OptionsDict& opts,
+               CachingBackend* shared_backend)
     : options_(opts),
-      search_(factory.CreateSearch(&uci_forwarder_, &options_)) {
-  if (options_.Get<bool>(kPreload)) {
-    UpdateBackendConfig();
-    // EnsureSyzygyTablebasesLoaded();
+      search_(factory.CreateSearch(&uci_forwarder_, &options_)),
+      shared_backend_(shared_backend) {
+  if (shared_backend_) {
+    search_->SetBackend(shared_backend_);
+  } else if (options_.Get<bool>(kPreload)) {
+    // The UCI loop answers "uci" while this runs, "isready" waits for it.
+    preload_ = std::async(std::launch::async,
+                          [this]() { UpdateBackendAndTablebases(); });
   }
 }
 
-namespace {
-GameState MakeGameState(const std::string& fen,
-                        const std::vector<std::string>& moves) {
-  GameState state;
-  state.startpos = Position::FromFen(fen);
-  ChessBoard cur_board = state.startpos.GetBoard();
-  state.moves.reserve(moves.size());
-  for (const auto& move : moves) {
-    Move m = cur_board.ParseMove(move);
-    state.moves.push_back(m);
-    cur_board.ApplyMove(m);
-    cur_board.Mirror();
+void Engine::WaitForPreload() {
+  if (preload_.valid()) preload_.get();
+}
+
+void Engine::StartWarmup() {
+  CachingBackend* const backend =
+      shared_backend_ ? shared_backend_ : backend_.get();
+  if (!backend || !options_.Get<bool>(kNewGameWarmupId)) return;
+  const int max_batch_size = backend->GetAttributes().maximum_batch_size;
+  if (max_batch_size <= 0) return;
+  warmup_ = std::async(std::launch::async, [backend, max_batch_size]() {
+    const Position startpos = Position::FromFen(ChessBoard::kStartposFen);
+    const MoveList root_moves = startpos.GetBoard().GenerateLegalMoves();
+    std::vector<std::array<Position, 2>> histories;
+    std::vector<MoveList> legal_moves;
+    histories.reserve(root_moves.size());
+    legal_moves.reserve(root_moves.size());
+    for (const Move m : root_moves) {
+      histories.push_back({startpos, Position(startpos, m)});
+      legal_moves.push_back(
+          histories.back()[1].GetBoard().GenerateLegalMoves());
+    }
+    std::vector<EvalPosition> positions;
+    positions.push_back({std::span(&startpos, 1), root_moves});
+    for (size_t i = 0; i < histories.size(); ++i) {
+      positions.push_back({histories[i], legal_moves[i]});
+    }
+    const size_t batch_size = max_batch_size;
+    try {
+      for (size_t i = 0; i < positions.size(); i += batch_size) {
+        backend->EvaluateBatch(std::span(positions).subspan(
+            i, std::min(batch_size, positions.size() - i)));
+      }
+    } catch (const Exception& e) {
+      // The search reports the problem if it persists.
+      CERR << "New game warm-up failed: " << e.what();
+    }
+  });
+}
+
+void Engine::WaitForWarmup() {
+  if (warmup_.valid()) warmup_.get();
+}
+
+void Engine::EnsureReady() { WaitForPreload(); }
+
+void Engine::BeforeOptionsChange() { WaitForPreload(); }
+
+void Engine::UpdateGameState(const std::string& fen,
+                             const std::vector<std::string>& moves) {
+  const bool extends =
+      fen == game_fen_ && moves.size() >= game_moves_.size() &&
+      std::equal(game_moves_.begin(), game_moves_.end(), moves.begin());
+  if (!extends) {
+    game_fen_.clear();
+    game_moves_.clear();
+    game_state_.startpos = Position::FromFen(fen);
+    game_state_.moves.clear();
+    game_board_ = game_state_.startpos.GetBoard();
+    game_fen_ = fen;
+  }
+  for (size_t i = game_moves_.size(); i < moves.size(); ++i) {
+    Move m;
+    try {
+      m = game_board_.ParseMove(moves[i]);
+    } catch (...) {
+      // Don't keep a partially applied move list.
+      game_fen_.clear();
+      game_moves_.clear();
+      throw;
+    }
+    game_state_.moves.push_back(m);
+    game_moves_.push_back(moves[i]);
+    game_board_.ApplyMove(m);
+    game_board_.Mirror();
   }
-  return state;
 }
-}  // namespace
 
 void Engine::EnsureSearchStopped() {
   search_->AbortSearch();
   search_->WaitSearch();
 }
 
-void Engine::UpdateBackendConfig() {
+bool Engine::UpdateBackendConfig() {
+  if (shared_backend_) return false;
   const std::string backend_name =
       options_.Get<std::string>(SharedBackendParams::kBackendId);
   const size_t cache_size =
@@ -92,17 +194,20 @@ void Engine::UpdateBackendConfig() {
   if (!backend_ || backend_name != backend_name_ ||
       backend_->UpdateConfiguration(options_) == Backend::NEED_RESTART) {
     backend_name_ = backend_name;
-    backend_ = CreateMemCache(BackendManager::Get()->CreateFromParams(options_),
-                              cache_size);
+    backend_ = CreateMemCache(
+        MaybeCreateDiskCache(BackendManager::Get()->CreateFromParams(options_),
+                             options_),
+        options_);
     search_->SetBackend(backend_.get());
-  } else {
-    backend_->SetCacheSize(cache_size);
+    return true;
   }
+  backend_->SetCacheSize(cache_size);
+  return false;
 }
 
-void Engine::EnsureSyzygyTablebasesLoaded() {
+bool Engine::EnsureSyzygyTablebasesLoaded() {
   const std::string tb_paths = options_.Get<std::string>(kSyzygyTablebaseId);
-  if (tb_paths == previous_tb_paths_) return;
+  if (tb_paths == previous_tb_paths_) return false;
   previous_tb_paths_ = tb_paths;
 
   if (tb_paths.empty()) {
@@ -110,34 +215,73 @@ void Engine::EnsureSyzygyTablebasesLoaded() {
   } else {
     syzygy_tb_ = std::make_unique<SyzygyTablebase>();
     CERR << "Loading Syzygy tablebases from " << tb_paths;
-    if (!syzygy_tb_->init(tb_paths)) {
+    if (!syzygy_tb_->init(tb_paths, GetSyzygyPreload(options_),
+                          options_.Get<int>(kSyzygyPreloadPiecesId))) {
       CERR << "Failed to load Syzygy tablebases!";
       syzygy_tb_.reset();
     }
   }
 
-  search_->SetSyzygyTablebase(syzygy_tb_.get());
+  return true;
+}
+
+void Engine::UpdateBackendAndTablebases() {
+  // The backend may be recreated.
+  WaitForWarmup();
+  const auto start = std::chrono::steady_clock::now();
+  int tb_ms = -1;
+  // Only spawn a thread when the tablebases are actually to be (re)loaded.
+  std::future<void> tb_loading;
+  if (options_.Get<std::string>(kSyzygyTablebaseId) != previous_tb_paths_) {
+    tb_loading = std::async(std::launch::async, [&]() {
+      if (EnsureSyzygyTablebasesLoaded()) tb_ms = MillisecondsSince(start);
+    });
+  }
+  const int backend_ms = UpdateBackendConfig() ? MillisecondsSince(start) : -1;
+  if (tb_loading.valid()) tb_loading.get();
+  if (tb_ms >= 0) search_->SetSyzygyTablebase(syzygy_tb_.get());
+
+  if (backend_ms < 0 && tb_ms < 0) return;
+  std::string report =
+      "Loaded in " + std::to_string(MillisecondsSince(start)) + "ms:";
+  if (backend_ms >= 0) {
+    report += " backend " + std::to_string(backend_ms) + "ms";
+  }
+  if (tb_ms >= 0) report += " tablebases " + std::to_string(tb_ms) + "ms";
+  CERR << report;
 }
 
 void Engine::SetPosition(const std::string& fen,
                          const std::vector<std::string>& moves) {
-  UpdateBackendConfig();
+  WaitForPreload();
   EnsureSearchStopped();
-  EnsureSyzygyTablebasesLoaded();
-  search_->SetPosition(MakeGameState(fen, moves));
+  UpdateBackendAndTablebases();
+  UpdateGameState(fen, moves);
+  search_->SetPosition(game_state_);
   search_initialized_ = true;
 }
 
 void Engine::NewGame() {
+  WaitForPreload();
   search_->NewGame();
   SetPosition(ChessBoard::kStartposFen, {});
+  StartWarmup();
 }
 
 void Engine::Go(const GoParams& params) {
+  WaitForPreload();
   if (!search_initialized_) NewGame();
+  search_->StartClock();
   search_->StartSearch(params);
 }
 
+void Engine::PonderHit() {
+  // The search already runs on the predicted position, it only has to start
+  // counting its own time.
+  search_->StartClock();
+  search_->PonderHit();
+}
+
 void Engine::Stop() { search_->StopSearch(); }
 
 void Engine::RegisterUciResponder(UciResponder* responder) {
@@ -27,8 +27,12 @@
 
 #pragma once
 
+#include <future>
+#include <string>
 #include <vector>
 
+#include "chess/board.h"
+#include "chess/gamestate.h"
 #include "engine_loop.h"
 #include "neural/memcache.h"
 #include "search/search.h"
@@ -38,37 +42,72 @@ namespace lczero {
 
 class Engine : public EngineControllerBase {
  public:
-  Engine(const SearchFactory&, const OptionsDict&);
+  // With @shared_backend, the engine uses that backend (e.g. one shared by
+  // many engines) instead of creating its own from the options.
+  Engine(const SearchFactory&, const OptionsDict&,
+         CachingBackend* shared_backend = nullptr);
 
   static void PopulateOptions(OptionsParser*);
 
-  void EnsureReady() override {};
+  void EnsureReady() override;
+  void BeforeOptionsChange() override;
   void NewGame() override;
   void SetPosition(const std::string& fen,
                    const std::vector<std::string>& moves) override;
   void Go(const GoParams& params) override;
-  void PonderHit() override {}
+  void PonderHit() override;
   void Stop() override;
 
   void RegisterUciResponder(UciResponder*) override;
   void UnregisterUciResponder(UciResponder*) override;
 
  private:
-  void UpdateBackendConfig();
+  // Returns whether the backend was (re)created.
+  bool UpdateBackendConfig();
   void EnsureSearchStopped();
-  void EnsureSyzygyTablebasesLoaded();
+  // Returns whether the tablebases were (re)loaded, the caller passes them to
+  // the search then.
+  bool EnsureSyzygyTablebasesLoaded();
+  // Brings backend and tablebases up to date with the options, loading both
+  // at the same time.
+  void UpdateBackendAndTablebases();
+  // Waits for the preload started by the constructor, rethrowing its error.
+  void WaitForPreload();
+  // Evaluates the start position and the positions after each first move in
+  // the background, so that the first search of a game finds them in the NN
+  // cache, and backends that initialize lazily have done so by then.
+  void StartWarmup();
+  void WaitForWarmup();
+  // Updates game_state_ to @fen and @moves. When they extend the previous
+  // position, only the new moves are parsed.
+  void UpdateGameState(const std::string& fen,
+                       const std::vector<std::string>& moves);
 
   UciResponderForwarder uci_forwarder_;
   const OptionsDict& options_;
   std::unique_ptr<SearchBase> search_;  // absl_notnull
   std::string backend_name_;
   std::unique_ptr<CachingBackend> backend_;  // absl_nullable
+  CachingBackend* const shared_backend_;     // absl_nullable
 
   // Remember previous tablebase paths to detect when to reload them.
   std::string previous_tb_paths_;
   std::unique_ptr<SyzygyTablebase> syzygy_tb_;  // absl_nullable
 
+  // The last position set, kept to parse only new moves of the next one.
+  std::string game_fen_;
+  std::vector<std::string> game_moves_;
+  GameState game_state_;
+  ChessBoard game_board_;
+
   bool search_initialized_ = false;
+
+  // Destroyed before the backend it uses.
+  std::future<void> warmup_;
+
+  // Loads the backend and tablebases on startup without holding up the UCI
+  // loop. Last member, so that it is waited for before the rest is destroyed.
+  std::future<void> preload_;
 };
 
 }  // namespace lczero
\ No newline at end of file
@@ -28,15 +28,19 @@
 #include "engine_classic.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <functional>
 
+#include "neural/diskcache.h"
 #include "neural/shared_params.h"
 #include "search/classic/search.h"
+#include "search/classic/stoppers/common.h"
 #include "search/classic/stoppers/factory.h"
 #include "utils/commandline.h"
 #include "utils/configfile.h"
 #include "utils/logging.h"
+#include "utils/memory_accountant.h"
 
 namespace lczero {
 namespace {
@@ -48,6 +52,14 @@ const OptionId kSyzygyTablebaseId{
     "List of Syzygy tablebase directories, list entries separated by system "
     "separator (\";\" for Windows, \":\" for Linux).",
     's'};
+const OptionId kSyzygyPreloadId{
+    "syzygy-preload", "SyzygyPreload",
+    "Bring WDL tablebase files into memory when loading them: 'willneed' "
+    "starts reading them in the background, 'lock' also keeps them in "
+    "memory."};
+const OptionId kSyzygyPreloadPiecesId{
+    "syzygy-preload-pieces", "SyzygyPreloadPieces",
+    "Preload WDL tablebase files with up to this many pieces."};
 const OptionId kPonderId{"", "Ponder",
                          "This option is ignored. Here to please chess GUIs."};
 const OptionId kStrictUciTiming{"strict-uci-timing", "StrictTiming",
@@ -56,6 +68,10 @@ const OptionId kStrictUciTiming{"strict-uci-timing", "StrictTiming",
                                 "only then starts timing."};
 const OptionId kClearTree{"", "ClearTree",
                           "Clear the tree before the next search."};
+const OptionId kGcMaxPendingMbId{
+    "gc-max-pending-mb", "GCMaxPendingMB",
+    "Before starting a search, wait until the tree garbage collector has less "
+    "than this many megabytes left to release. 0 to never wait."};
 const OptionId kPreload{"preload", "",
                         "Initialize backend and load net on engine startup."};
 
@@ -75,13 +91,37 @@ MoveList StringsToMovelist(const std::vector<std::string>& moves,
   return result;
 }
 
+SyzygyPreload GetSyzygyPreload(const OptionsDict& options) {
+  const std::string preload = options.Get<std::string>(kSyzygyPreloadId);
+  if (preload == "willneed") return SyzygyPreload::kWillNeed;
+  if (preload == "lock") return SyzygyPreload::kLock;
+  return SyzygyPreload::kNone;
+}
+
+int MillisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
 }  // namespace
 
 EngineClassic::EngineClassic(const OptionsDict& options)
     : options_(options), current_position_{ChessBoard::kStartposFen, {}} {
-  if (options_.Get<bool>(kPreload)) UpdateFromUciOptions();
+  // The UCI loop answers "uci" while this runs, "isready" waits for it.
+  if (options_.Get<bool>(kPreload)) {
+    preload_ = std::async(std::launch::async, [this]() {
+      UpdateFromUciOptions();
+    });
+  }
 }
 
+void EngineClassic::WaitForPreload() {
+  if (preload_.valid()) preload_.get();
+}
+
+void EngineClassic::BeforeOptionsChange() { WaitForPreload(); }
+
 void EngineClassic::PopulateOptions(OptionsParser* options) {
   using namespace std::placeholders;
   const bool is_simple =
@@ -97,6 +137,10 @@ void EngineClassic::PopulateOptions(OptionsParser* options) {
     options->UnhideOption(classic::SearchParams::kMultiPvId);
   }
   options->Add<StringOption>(kSyzygyTablebaseId);
+  options->Add<ChoiceOption>(kSyzygyPreloadId,
+                             std::vector<std::string>{"none", "willneed",
+                                                      "lock"}) = "none";
+  options->Add<IntOption>(kSyzygyPreloadPiecesId, 3, 7) = 5;
   // Add "Ponder" option to signal to GUIs that we support pondering.
   // This option is currently not used by lc0 in any way.
   options->Add<BoolOption>(kPonderId) = true;
@@ -111,6 +155,9 @@ void EngineClassic::PopulateOptions(OptionsParser* options) {
   options->Add<ButtonOption>(kClearTree);
   options->HideOption(kClearTree);
 
+  options->Add<IntOption>(kGcMaxPendingMbId, 0, 1000000) = 0;
+  options->HideOption(kGcMaxPendingMbId);
+
   options->Add<BoolOption>(kPreload) = false;
 }
 
@@ -122,16 +169,26 @@ void EngineClassic::ResetMoveTimer() {
 void EngineClassic::UpdateFromUciOptions() {
   SharedLock lock(busy_mutex_);
 
-  // Syzygy tablebases.
+  const auto start = std::chrono::steady_clock::now();
+  int tb_ms = -1;
+  int network_ms = -1;
+
+  // Syzygy tablebases. They are independent of the network, so load them on
+  // another thread at the same time.
+  std::future<void> tb_loading;
   std::string tb_paths = options_.Get<std::string>(kSyzygyTablebaseId);
   if (!tb_paths.empty() && tb_paths != tb_paths_) {
-    syzygy_tb_ = std::make_unique<SyzygyTablebase>();
-    CERR << "Loading Syzygy tablebases from " << tb_paths;
-    if (!syzygy_tb_->init(tb_paths)) {
-      CERR << "Failed to load Syzygy tablebases!";
-      syzygy_tb_ = nullptr;
-    }
-    tb_paths_ = tb_paths;
+    tb_loading = std::async(std::launch::async, [&, start]() {
+      syzygy_tb_ = std::make_unique<SyzygyTablebase>();
+      CERR << "Loading Syzygy tablebases from " << tb_paths;
+      if (!syzygy_tb_->init(tb_paths, GetSyzygyPreload(options_),
+                            options_.Get<int>(kSyzygyPreloadPiecesId))) {
+        CERR << "Failed to load Syzygy tablebases!";
+        syzygy_tb_ = nullptr;
+      }
+      tb_paths_ = tb_paths;
+      tb_ms = MillisecondsSince(start);
+    });
   } else if (tb_paths.empty()) {
     syzygy_tb_ = nullptr;
     tb_paths_.clear();
@@ -140,11 +197,28 @@ void EngineClassic::UpdateFromUciOptions() {
   // Network.
   const auto network_configuration =
       NetworkFactory::BackendConfiguration(options_);
-  if (network_configuration_ != network_configuration) {
-    backend_ =
-        CreateMemCache(BackendManager::Get()->CreateFromParams(options_),
-                       options_.Get<int>(SharedBackendParams::kNNCacheSizeId));
+  const auto disk_cache_file =
+      options_.Get<std::string>(SharedBackendParams::kDiskCacheFileId);
+  if (network_configuration_ != network_configuration ||
+      disk_cache_file_ != disk_cache_file) {
+    backend_ = CreateMemCache(
+        MaybeCreateDiskCache(BackendManager::Get()->CreateFromParams(options_),
+                             options_),
+        options_);
     network_configuration_ = network_configuration;
+    disk_cache_file_ = disk_cache_file;
+    network_ms = MillisecondsSince(start);
+  }
+  if (tb_loading.valid()) tb_loading.get();
+
+  if (network_ms >= 0 || tb_ms >= 0) {
+    std::string report = "Loaded in " +
+                         std::to_string(MillisecondsSince(start)) + "ms:";
+    if (network_ms >= 0) {
+      report += " network " + std::to_string(network_ms) + "ms";
+    }
+    if (tb_ms >= 0) report += " tablebases " + std::to_string(tb_ms) + "ms";
+    CERR << report;
   }
 
   // Check whether we can update the move timer in "Go".
@@ -152,6 +226,7 @@ void EngineClassic::UpdateFromUciOptions() {
 }
 
 void EngineClassic::EnsureReady() {
+  WaitForPreload();
   std::unique_lock<RpSharedMutex> lock(busy_mutex_);
   // If a UCI host is waiting for our ready response, we can consider the move
   // not started until we're done ensuring ready.
@@ -159,15 +234,23 @@ void EngineClassic::EnsureReady() {
 }
 
 void EngineClassic::NewGame() {
+  WaitForPreload();
   // In case anything relies upon defaulting to default position and just calls
   // newgame and goes straight into go.
   ResetMoveTimer();
   SharedLock lock(busy_mutex_);
   search_.reset();
   tree_.reset();
+  speculative_log_.Reset();
   CreateFreshTimeManager();
   current_position_ = {ChessBoard::kStartposFen, {}};
   UpdateFromUciOptions();
+  if (cache_shrunk_) {
+    backend_->SetCacheSize(
+        options_.Get<int>(SharedBackendParams::kNNCacheSizeId));
+    cache_shrunk_ = false;
+  }
+  // Doesn't block, the entries are only dropped as their slots are reused.
   backend_->ClearCache();
 }
 
@@ -236,6 +319,7 @@ class PonderResponseTransformer : public TransformingUciResponder {
 }  // namespace
 
 void EngineClassic::Go(const GoParams& params) {
+  WaitForPreload();
   // TODO: should consecutive calls to go be considered to be a continuation and
   // hence have the same start time like this behaves, or should we check start
   // time hasn't changed since last call to go and capture the new start time
@@ -265,18 +349,53 @@ void EngineClassic::Go(const GoParams& params) {
     tree_->TrimTreeAtHead();
   }
 
+  const int gc_max_pending_mb = options_.Get<int>(kGcMaxPendingMbId);
+  if (gc_max_pending_mb > 0) {
+    classic::WaitForNodeGc(static_cast<size_t>(gc_max_pending_mb) << 20);
+  }
+  const auto gc_stats = classic::GetNodeGcStats();
+  LOGFILE << "Node GC: " << (gc_stats.pending_bytes >> 20)
+          << "MB pending, oldest " << gc_stats.oldest_pending_ms
+          << "ms, max latency " << gc_stats.max_latency_ms << "ms.";
+  const size_t memory_budget = classic::GetMemoryBudgetBytes(options_);
+  if (memory_budget > 0) EnforceMemoryBudget(memory_budget);
+
   auto stopper = time_manager_->GetStopper(params, *tree_.get());
   search_ = std::make_unique<classic::Search>(
       *tree_, backend_.get(), std::move(responder),
       StringsToMovelist(params.searchmoves, tree_->HeadPosition().GetBoard()),
       *move_start_time_, std::move(stopper), params.infinite, params.ponder,
-      options_, syzygy_tb_.get());
+      options_, syzygy_tb_.get(), &speculative_log_);
 
   LOGFILE << "Timer started at "
           << FormatTime(SteadyClockToSystemClock(*move_start_time_));
   search_->StartThreads(options_.Get<int>(kThreadsOptionId));
 }
 
+void EngineClassic::EnforceMemoryBudget(size_t budget) {
+  // A large backlog is memory the new search can't use yet, so wait for the
+  // garbage collector to catch up first.
+  classic::WaitForNodeGc(budget / 16);
+  auto usage = MemoryAccountant::Get().GetUsage();
+  // The cache is only shrunk when it leaves less than a quarter of the budget
+  // for the tree to grow. Resizing drops all cached evaluations.
+  const size_t tree_bytes =
+      usage[MemoryKind::kTree] + usage[MemoryKind::kGcBacklog];
+  const size_t reserve = budget / 4;
+  if (usage.Total() + reserve > budget && usage[MemoryKind::kCache] > 0) {
+    const size_t cache_bytes =
+        budget > tree_bytes + reserve ? budget - tree_bytes - reserve : 0;
+    backend_->SetCacheSize(cache_bytes / GetMemCacheItemSize());
+    cache_shrunk_ = true;
+    usage = MemoryAccountant::Get().GetUsage();
+  }
+  std::vector<ThinkingInfo> infos(1);
+  infos[0].comment = "Memory: " + usage.ToString() + ", budget " +
+                     std::to_string(budget >> 20) + "MB";
+  LOGFILE << infos[0].comment;
+  uci_forwarder_.OutputThinkingInfo(&infos);
+}
+
 void EngineClassic::PonderHit() {
   ResetMoveTimer();
   go_params_.ponder = false;
@@ -27,10 +27,10 @@
 
 #pragma once
 
+#include <future>
 #include <optional>
 
 #include "engine_loop.h"
-#include "neural/cache.h"
 #include "neural/factory.h"
 #include "neural/memcache.h"
 #include "search/classic/search.h"
@@ -58,6 +58,7 @@ class EngineClassic : public EngineControllerBase {
 
   // Blocks.
   void EnsureReady() override;
+  void BeforeOptionsChange() override;
 
   // Must not block.
   void NewGame() override;
@@ -77,11 +78,15 @@ class EngineClassic : public EngineControllerBase {
 
  private:
   void UpdateFromUciOptions();
+  // Waits for the preload started by the constructor, rethrowing its error.
+  void WaitForPreload();
 
   void SetupPosition(const std::string& fen,
                      const std::vector<std::string>& moves);
   void ResetMoveTimer();
   void CreateFreshTimeManager();
+  // Shrinks the NN cache when it doesn't leave the tree enough of @budget.
+  void EnforceMemoryBudget(size_t budget);
 
   const OptionsDict& options_;
 
@@ -94,6 +99,8 @@ class EngineClassic : public EngineControllerBase {
   std::unique_ptr<classic::TimeManager> time_manager_;
   std::unique_ptr<classic::Search> search_;
   std::unique_ptr<classic::NodeTree> tree_;
+  // Outlives the searches, which use it to measure the speculative prefetch.
+  classic::SpeculativePrefetchLog speculative_log_;
   std::unique_ptr<SyzygyTablebase> syzygy_tb_;
   std::unique_ptr<CachingBackend> backend_;
 
@@ -101,6 +108,10 @@ class EngineClassic : public EngineControllerBase {
   // they are reloaded.
   std::string tb_paths_;
   NetworkFactory::BackendConfiguration network_configuration_;
+  std::string disk_cache_file_;
+  // Set when the NN cache was shrunk to fit the memory budget, to restore its
+  // configured size for the next game.
+  bool cache_shrunk_ = false;
 
   // The current position as given with SetPosition. For normal (ie. non-ponder)
   // search, the tree is set up with this position, however, during ponder we
@@ -112,6 +123,10 @@ class EngineClassic : public EngineControllerBase {
 
   // If true we can reset move_start_time_ in "Go".
   bool strict_uci_timing_;
+
+  // Loads the network and tablebases on startup without holding up the UCI
+  // loop. Last member, so that it is waited for before the rest is destroyed.
+  std::future<void> preload_;
 };
 
 }  // namespace lczero
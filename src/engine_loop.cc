@@ -31,8 +31,12 @@
 
 #include "engine.h"
 #include "engine_classic.h"
+#include "engine_server.h"
+#include "neural/remote_server.h"
 #include "neural/shared_params.h"
 #include "utils/configfile.h"
+#include "utils/metrics.h"
+#include "utils/trace.h"
 
 namespace lczero {
 namespace {
@@ -40,6 +44,12 @@ const OptionId kLogFileId{"logfile", "LogFile",
                           "Write log to that file. Special value <stderr> to "
                           "output the log to the console.",
                           'l'};
+const OptionId kTraceFileId{
+    "trace-file", "TraceFile",
+    "Record a timeline of search phases, backend computations and cache "
+    "lookups, and write it to that file in Chrome trace format when the "
+    "engine exits or the file name changes. Open it in chrome://tracing or "
+    "ui.perfetto.dev."};
 
 template <typename EngineType>
 void RunEngineInternal(SearchFactory* factory) {
@@ -48,6 +58,8 @@ void RunEngineInternal(SearchFactory* factory) {
   // Populate options from various sources.
   OptionsParser options_parser;
   options_parser.Add<StringOption>(kLogFileId);
+  options_parser.Add<StringOption>(kTraceFileId);
+  Metrics::PopulateOptions(&options_parser);
   ConfigFile::PopulateOptions(&options_parser);
   EngineType::PopulateOptions(&options_parser);
   if (factory) factory->PopulateParams(&options_parser);  // Search params.
@@ -58,6 +70,8 @@ void RunEngineInternal(SearchFactory* factory) {
   if (!ConfigFile::Init() || !options_parser.ProcessAllFlags()) return;
   const auto options = options_parser.GetOptionsDict();
   Logging::Get().SetFilename(options.Get<std::string>(kLogFileId));
+  Tracer::Get().SetFilename(options.Get<std::string>(kTraceFileId));
+  Metrics::Get().ApplyOptions(options);
 
   // Create engine.
   EngineType engine = [&]() {
@@ -78,14 +92,63 @@ void RunEngineInternal(SearchFactory* factory) {
       if (!loop.ProcessLine(line)) break;
       // Set the log filename for the case it was set in UCI option.
       Logging::Get().SetFilename(options.Get<std::string>(kLogFileId));
+      Tracer::Get().SetFilename(options.Get<std::string>(kTraceFileId));
+      Metrics::Get().ApplyOptions(options);
     } catch (Exception& ex) {
       uci_responder.SendRawResponse(std::string("error ") + ex.what());
     }
   }
+  Tracer::Get().SetFilename("");
+  Metrics::Get().Stop();
 }
 }  // namespace
 
 void RunEngine(SearchFactory* factory) { RunEngineInternal<Engine>(factory); }
 void RunEngineClassic() { RunEngineInternal<EngineClassic>(nullptr); }
 
+void RunEngineServer(SearchFactory* factory) {
+  // The same options are known to the server and to every session, so that
+  // sessions can be set up from the server's command line.
+  auto populate_options = [factory](OptionsParser* parser) {
+    parser->Add<StringOption>(kLogFileId);
+    parser->Add<StringOption>(kTraceFileId);
+    Metrics::PopulateOptions(parser);
+    ConfigFile::PopulateOptions(parser);
+    EngineServer::PopulateOptions(parser);
+    Engine::PopulateOptions(parser);
+    factory->PopulateParams(parser);
+    SharedBackendParams::Populate(parser);
+  };
+  OptionsParser options_parser;
+  populate_options(&options_parser);
+  StdoutUciResponder uci_responder;
+  uci_responder.PopulateParams(&options_parser);
+
+  if (!ConfigFile::Init() || !options_parser.ProcessAllFlags()) return;
+  const auto options = options_parser.GetOptionsDict();
+  Logging::Get().SetFilename(options.Get<std::string>(kLogFileId));
+  Tracer::Get().SetFilename(options.Get<std::string>(kTraceFileId));
+  Metrics::Get().ApplyOptions(options);
+
+  EngineServer server(*factory, options, populate_options);
+  server.Run();
+}
+
+void RunBackendServer() {
+  OptionsParser options_parser;
+  options_parser.Add<StringOption>(kLogFileId);
+  Metrics::PopulateOptions(&options_parser);
+  ConfigFile::PopulateOptions(&options_parser);
+  BackendServer::PopulateOptions(&options_parser);
+  SharedBackendParams::Populate(&options_parser);
+
+  if (!ConfigFile::Init() || !options_parser.ProcessAllFlags()) return;
+  const auto options = options_parser.GetOptionsDict();
+  Logging::Get().SetFilename(options.Get<std::string>(kLogFileId));
+  Metrics::Get().ApplyOptions(options);
+
+  BackendServer server(options);
+  server.Run();
+}
+
 }  // namespace lczero
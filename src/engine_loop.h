@@ -42,4 +42,10 @@ void RunEngine(SearchFactory* factory);
 // The same but through classic interface. To be gone soon.
 void RunEngineClassic();
 
+// Serves many UCI sessions over TCP, sharing one backend. See EngineServer.
+void RunEngineServer(SearchFactory* factory);
+
+// Serves the backend to "remote" backends of other hosts. See BackendServer.
+void RunBackendServer();
+
 }  // namespace lczero
\ No newline at end of file
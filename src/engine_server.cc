@@ -0,0 +1,310 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "engine_server.h"
+
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "chess/uciloop.h"
+#include "engine.h"
+#include "neural/diskcache.h"
+#include "neural/register.h"
+#include "utils/exception.h"
+#include "utils/logging.h"
+#include "utils/mutex.h"
+#include "utils/string.h"
+
+namespace lczero {
+namespace {
+const OptionId kServerAddressId{
+    "server-address", "",
+    "Address to listen on in server mode. The default only accepts local "
+    "connections, use 0.0.0.0 to accept connections from anywhere."};
+const OptionId kServerPortId{"server-port", "",
+                             "TCP port to listen on in server mode."};
+const OptionId kServerMaxSessionsId{
+    "server-max-sessions", "",
+    "Maximum number of concurrent sessions in server mode, over all "
+    "connections."};
+}  // namespace
+
+void EngineServer::PopulateOptions(OptionsParser* options) {
+  options->Add<StringOption>(kServerAddressId) = "127.0.0.1";
+  options->Add<IntOption>(kServerPortId, 1, 65535) = 5555;
+  options->Add<IntOption>(kServerMaxSessionsId, 1, 10000) = 64;
+}
+
+EngineServer::EngineServer(const SearchFactory& factory,
+                           const OptionsDict& options,
+                           PopulateOptionsFunc populate_options)
+    : factory_(factory),
+      options_(options),
+      populate_options_(std::move(populate_options)) {
+  backend_ = CreateMemCache(
+      MaybeCreateDiskCache(BackendManager::Get()->CreateFromParams(options_),
+                           options_),
+      options_);
+}
+
+#ifdef _WIN32
+
+void EngineServer::Run() {
+  throw Exception("Server mode is not supported on Windows.");
+}
+
+void EngineServer::ServeConnection(int) {}
+
+#else
+
+// A client connection. Lines are read by one thread, and written by the
+// sessions' engines from their own threads.
+class EngineServer::Connection {
+ public:
+  explicit Connection(int fd) : fd_(fd) {}
+  ~Connection() { close(fd_); }
+
+  // Returns false when the connection is closed.
+  bool ReadLine(std::string* line) {
+    while (true) {
+      const size_t end = buffer_.find('\n');
+      if (end != std::string::npos) {
+        *line = buffer_.substr(0, end);
+        buffer_.erase(0, end + 1);
+        if (!line->empty() && line->back() == '\r') line->pop_back();
+        return true;
+      }
+      char chunk[4096];
+      const ssize_t size = recv(fd_, chunk, sizeof(chunk), 0);
+      if (size <= 0) return false;
+      buffer_.append(chunk, size);
+    }
+  }
+
+  // Writes the lines in one go, so responses of sessions don't interleave.
+  void Send(const std::vector<std::string>& lines) {
+    std::string data;
+    for (const auto& line : lines) data += line + '\n';
+    Mutex::Lock lock(mutex_);
+    for (size_t sent = 0; sent < data.size();) {
+      const ssize_t size =
+          send(fd_, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+      // The client went away, the reading thread closes the sessions.
+      if (size <= 0) return;
+      sent += size;
+    }
+  }
+
+ private:
+  const int fd_;
+  std::string buffer_;
+  Mutex mutex_;
+};
+
+namespace {
+class SessionUciResponder : public StringUciResponder {
+ public:
+  SessionUciResponder(std::function<void(const std::vector<std::string>&)> send)
+      : send_(std::move(send)) {}
+  void SendRawResponses(const std::vector<std::string>& responses) override {
+    send_(responses);
+  }
+
+ private:
+  const std::function<void(const std::vector<std::string>&)> send_;
+};
+}  // namespace
+
+// One UCI session with its own engine. Commands are run on a thread of the
+// session, so that blocking ones don't hold up the other sessions of the
+// connection.
+class EngineServer::Session {
+ public:
+  Session(const std::string& id, Connection* connection, EngineServer* server)
+      : id_(id),
+        server_(server),
+        responder_([this, connection](const std::vector<std::string>& lines) {
+          std::vector<std::string> prefixed;
+          prefixed.reserve(lines.size());
+          for (const auto& line : lines) prefixed.push_back(id_ + " " + line);
+          connection->Send(prefixed);
+        }) {
+    server_->populate_options_(&options_parser_);
+    responder_.PopulateParams(&options_parser_);
+    // Sessions start with the options of the server's command line.
+    if (!options_parser_.ProcessAllFlags()) {
+      throw Exception("Unable to parse the command line for a session.");
+    }
+    engine_ = std::make_unique<Engine>(server_->factory_,
+                                       options_parser_.GetOptionsDict(),
+                                       server_->backend_.get());
+    loop_ = std::make_unique<UciLoop>(&responder_, &options_parser_,
+                                      engine_.get());
+    ++server_->session_count_;
+    LOGFILE << "Session " << id_ << " opened.";
+    thread_ = std::thread([this]() { Worker(); });
+  }
+
+  ~Session() {
+    {
+      Mutex::Lock lock(mutex_);
+      closing_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+    loop_.reset();
+    engine_.reset();
+    --server_->session_count_;
+    LOGFILE << "Session " << id_ << " closed.";
+  }
+
+  void Post(const std::string& command) {
+    {
+      Mutex::Lock lock(mutex_);
+      commands_.push_back(command);
+    }
+    cv_.notify_one();
+  }
+
+ private:
+  void Worker() {
+    while (true) {
+      std::string command;
+      {
+        Mutex::Lock lock(mutex_);
+        cv_.wait(lock.get_raw(),
+                 [&]() { return closing_ || !commands_.empty(); });
+        if (commands_.empty()) return;
+        command = std::move(commands_.front());
+        commands_.pop_front();
+      }
+      LOGFILE << id_ << " >> " << command;
+      try {
+        loop_->ProcessLine(command);
+      } catch (Exception& ex) {
+        responder_.SendRawResponse(std::string("error ") + ex.what());
+      }
+    }
+  }
+
+  const std::string id_;
+  EngineServer* const server_;
+  SessionUciResponder responder_;
+  OptionsParser options_parser_;
+  std::unique_ptr<Engine> engine_;
+  std::unique_ptr<UciLoop> loop_;
+
+  Mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::string> commands_ GUARDED_BY(mutex_);
+  bool closing_ GUARDED_BY(mutex_) = false;
+  std::thread thread_;
+};
+
+void EngineServer::Run() {
+  const int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd < 0) throw Exception("Unable to create a socket.");
+  const int reuse = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(options_.Get<int>(kServerPortId));
+  const std::string host = options_.Get<std::string>(kServerAddressId);
+  if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1) {
+    close(listen_fd);
+    throw Exception("Invalid server address: " + host);
+  }
+  if (bind(listen_fd, reinterpret_cast<sockaddr*>(&address),
+           sizeof(address)) != 0 ||
+      listen(listen_fd, 16) != 0) {
+    close(listen_fd);
+    throw Exception("Unable to listen on " + host + ":" +
+                    std::to_string(options_.Get<int>(kServerPortId)));
+  }
+  CERR << "Listening on " << host << ":" << options_.Get<int>(kServerPortId)
+       << ".";
+
+  while (true) {
+    const int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) continue;
+    // Connections live as long as the client keeps them open, and the server
+    // runs until the process is terminated.
+    std::thread([this, fd]() { ServeConnection(fd); }).detach();
+  }
+}
+
+void EngineServer::ServeConnection(int fd) {
+  LOGFILE << "Connection opened.";
+  Connection connection(fd);
+  // Declared after the connection, which the sessions write to.
+  std::unordered_map<std::string, std::unique_ptr<Session>> sessions;
+  const int max_sessions = options_.Get<int>(kServerMaxSessionsId);
+  std::string line;
+  while (connection.ReadLine(&line)) {
+    line = Trim(line);
+    const size_t space = line.find_first_of(" \t");
+    const std::string id = line.substr(0, space);
+    const std::string command =
+        space == std::string::npos ? "" : Trim(line.substr(space));
+    if (id.empty() || command.empty()) continue;
+    auto iter = sessions.find(id);
+    if (command == "quit") {
+      if (iter != sessions.end()) sessions.erase(iter);
+      continue;
+    }
+    if (iter == sessions.end()) {
+      if (session_count_ >= max_sessions) {
+        connection.Send({id + " error Too many sessions."});
+        continue;
+      }
+      try {
+        auto session = std::make_unique<Session>(id, &connection, this);
+        iter = sessions.emplace(id, std::move(session)).first;
+      } catch (Exception& ex) {
+        connection.Send({id + " error " + ex.what()});
+        continue;
+      }
+    }
+    iter->second->Post(command);
+  }
+  sessions.clear();
+  LOGFILE << "Connection closed.";
+}
+
+#endif
+
+}  // namespace lczero
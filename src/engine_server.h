@@ -0,0 +1,80 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "neural/memcache.h"
+#include "search/search.h"
+#include "utils/optionsdict.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+
+// Serves many independent UCI sessions over TCP from one process, so that they
+// share one backend and NN cache instead of loading the network once each.
+// Every session has its own engine, search tree and UCI options.
+//
+// The protocol is UCI with every line prefixed by a session id, which is any
+// token without whitespace chosen by the client:
+//   client: "<id> <uci command>"
+//   server: "<id> <uci response>"
+// The first line with a new id opens a session, "<id> quit" closes it.
+// Sessions belong to the connection they were opened on and are closed with
+// it. The backend is configured from the server's command line, setting its
+// options in a session has no effect.
+class EngineServer {
+ public:
+  // Adds all options known to a session, except the UCI responder ones.
+  using PopulateOptionsFunc = std::function<void(OptionsParser*)>;
+
+  EngineServer(const SearchFactory& factory, const OptionsDict& options,
+               PopulateOptionsFunc populate_options);
+
+  static void PopulateOptions(OptionsParser* options);
+
+  // Accepts connections until the process is terminated.
+  void Run();
+
+ private:
+  class Connection;
+  class Session;
+
+  void ServeConnection(int fd);
+
+  const SearchFactory& factory_;
+  const OptionsDict& options_;
+  const PopulateOptionsFunc populate_options_;
+  std::unique_ptr<CachingBackend> backend_;
+  std::atomic<int> session_count_ = 0;
+};
+
+}  // namespace lczero
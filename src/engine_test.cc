@@ -132,6 +132,26 @@ TEST_F(EngineTest, BackendReloadByUpdateBackendConfig) {
   EXPECT_NE(backend_, prev_backend);  // Backend recreated.
 }
 
+TEST_F(EngineTest, PonderHitContinuesSearch) {
+  WaitingUciResponder uci_responder;
+  Engine engine(search_factory_, *options_);
+  engine.RegisterUciResponder(&uci_responder);
+  testing::InSequence seq;
+  EXPECT_CALL(*search_, StartClock());
+  EXPECT_CALL(*search_, StartSearch(_)).WillOnce([&](const GoParams& params) {
+    EXPECT_TRUE(params.ponder);
+  });
+  EXPECT_CALL(*search_, StartClock());
+  // The search is not restarted at ponderhit.
+  EXPECT_CALL(*search_, PonderHit()).WillOnce([&]() {
+    static BestMoveInfo bestmove_info(Move::White(kSquareE1, kSquareA1));
+    search_->GetUciResponder()->OutputBestMove(&bestmove_info);
+  });
+  engine.Go(GoParams{.ponder = true});
+  engine.PonderHit();
+  uci_responder.Wait();
+}
+
 }  // namespace
 }  // namespace lczero
 
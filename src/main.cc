@@ -30,11 +30,17 @@
 #include "engine_classic.h"
 #include "search/register.h"
 #include "selfplay/loop.h"
+#include "tools/analyse.h"
 #include "tools/backendbench.h"
+#include "tools/backendcompare.h"
 #include "tools/benchmark.h"
+#include "tools/buildbook.h"
 #include "tools/describenet.h"
+#include "tools/label.h"
 #include "tools/leela2onnx.h"
 #include "tools/onnx2leela.h"
+#include "tools/perftbench.h"
+#include "tools/unpacknet.h"
 #include "utils/commandline.h"
 #include "utils/esc_codes.h"
 #include "utils/logging.h"
@@ -55,15 +61,41 @@ int main(int argc, const char** argv) {
     CommandLine::Init(argc, argv);
     CommandLine::RegisterMode("uci", "(default) Act as UCI engine");
     CommandLine::RegisterMode("selfplay", "Play games with itself");
+    CommandLine::RegisterMode("selfplaycoordinator",
+                              "Hand out selfplay games to workers on other "
+                              "hosts and collect their training data");
+    CommandLine::RegisterMode("server",
+                              "Serve many UCI sessions over TCP with one "
+                              "shared backend");
+    CommandLine::RegisterMode("backendserver",
+                              "Serve the backend over TCP to the \"remote\" "
+                              "backend of other hosts");
     CommandLine::RegisterMode("benchmark", "Quick benchmark");
+    CommandLine::RegisterMode("analyse",
+                              "Search many positions, e.g. of a PGN, at "
+                              "the same time");
+    CommandLine::RegisterMode("label",
+                              "Label a stream of EPD positions with the "
+                              "policy or value head move");
     CommandLine::RegisterMode("bench", "Very quick benchmark");
     CommandLine::RegisterMode("backendbench",
                               "Quick benchmark of backend only");
+    CommandLine::RegisterMode("backendcompare",
+                              "Compare accuracy and speed of backend "
+                              "configurations");
+    CommandLine::RegisterMode("perftbench",
+                              "Benchmark of move generation, no backend");
     CommandLine::RegisterMode("leela2onnx", "Convert Leela network to ONNX.");
     CommandLine::RegisterMode("onnx2leela",
                               "Convert ONNX network to Leela net.");
     CommandLine::RegisterMode("describenet",
                               "Shows details about the Leela network.");
+    CommandLine::RegisterMode("unpacknet",
+                              "Writes the network uncompressed, for faster "
+                              "loading.");
+    CommandLine::RegisterMode("buildbook",
+                              "Converts a PGN opening book to an index for "
+                              "fast loading in selfplay.");
 
     for (const std::string_view search_name :
          SearchManager::Get()->GetSearchNames()) {
@@ -77,6 +109,25 @@ int main(int argc, const char** argv) {
       StdoutUciResponder uci_responder;
       SelfPlayLoop loop(&uci_responder);
       loop.Run();
+    } else if (CommandLine::ConsumeCommand("selfplaycoordinator")) {
+      // Central game assignment and training data writer for selfplay nodes.
+      StdoutUciResponder uci_responder;
+      SelfPlayLoop loop(&uci_responder);
+      loop.RunCoordinator();
+    } else if (CommandLine::ConsumeCommand("server")) {
+      // Multi-session UCI server, with the classic search.
+      RunEngineServer(SearchManager::Get()->GetFactoryByName("classic"));
+    } else if (CommandLine::ConsumeCommand("backendserver")) {
+      // Backend evaluation server for remote search hosts.
+      RunBackendServer();
+    } else if (CommandLine::ConsumeCommand("analyse")) {
+      // Analysis of many positions at once.
+      Analyse analyse;
+      analyse.Run();
+    } else if (CommandLine::ConsumeCommand("label")) {
+      // Bulk labelling with the instamove searches.
+      Label label;
+      label.Run();
     } else if (CommandLine::ConsumeCommand("benchmark")) {
       // Benchmark mode, longer version.
       Benchmark benchmark;
@@ -89,12 +140,24 @@ int main(int argc, const char** argv) {
       // Backend Benchmark mode.
       BackendBenchmark benchmark;
       benchmark.Run();
+    } else if (CommandLine::ConsumeCommand("backendcompare")) {
+      // Backend accuracy and speed comparison mode.
+      BackendCompare compare;
+      compare.Run();
+    } else if (CommandLine::ConsumeCommand("perftbench")) {
+      // Move generation benchmark mode.
+      PerftBenchmark benchmark;
+      benchmark.Run();
     } else if (CommandLine::ConsumeCommand("leela2onnx")) {
       lczero::ConvertLeelaToOnnx();
     } else if (CommandLine::ConsumeCommand("onnx2leela")) {
       lczero::ConvertOnnxToLeela();
     } else if (CommandLine::ConsumeCommand("describenet")) {
       lczero::DescribeNetworkCmd();
+    } else if (CommandLine::ConsumeCommand("unpacknet")) {
+      lczero::UnpackNetworkCmd();
+    } else if (CommandLine::ConsumeCommand("buildbook")) {
+      lczero::BuildOpeningBookCmd();
     } else {
       auto options_parser = std::make_unique<OptionsParser>();
 
@@ -27,7 +27,100 @@
 
 #include "neural/backend.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include "utils/hashcat.h"
+#include "utils/mutex.h"
+
 namespace lczero {
+namespace {
+// Below that, the rule50 counter has little effect on the evaluation, and
+// keeping it out of the key lets transpositions share entries.
+const int kRule50KeyPly = 80;
+
+// Worker threads that run blocking computations for ComputeAsync(). A thread
+// is added whenever none is idle, so a task never waits for another one to
+// finish. Idle threads are kept for the next tasks.
+class ComputeThreadPool {
+ public:
+  static ComputeThreadPool& Get() {
+    static ComputeThreadPool pool;
+    return pool;
+  }
+
+  ~ComputeThreadPool() {
+    std::vector<std::thread> threads;
+    {
+      Mutex::Lock lock(mutex_);
+      stop_ = true;
+      threads.swap(threads_);
+    }
+    task_added_.notify_all();
+    for (auto& thread : threads) thread.join();
+  }
+
+  void Run(std::function<void()> task) {
+    {
+      Mutex::Lock lock(mutex_);
+      tasks_.push_back(std::move(task));
+      if (idle_threads_ < tasks_.size()) {
+        threads_.emplace_back([this]() { Worker(); });
+      }
+    }
+    task_added_.notify_one();
+  }
+
+ private:
+  void Worker() {
+    Mutex::Lock lock(mutex_);
+    while (true) {
+      ++idle_threads_;
+      task_added_.wait(lock.get_raw(),
+                       [&]() { return stop_ || !tasks_.empty(); });
+      --idle_threads_;
+      if (tasks_.empty()) return;
+      auto task = std::move(tasks_.front());
+      tasks_.pop_front();
+      lock.get_raw().unlock();
+      task();
+      lock.get_raw().lock();
+    }
+  }
+
+  Mutex mutex_;
+  std::condition_variable task_added_;
+  std::deque<std::function<void()>> tasks_ GUARDED_BY(mutex_);
+  size_t idle_threads_ GUARDED_BY(mutex_) = 0;
+  bool stop_ GUARDED_BY(mutex_) = false;
+  std::vector<std::thread> threads_ GUARDED_BY(mutex_);
+};
+}  // namespace
+
+uint64_t ComputeEvalPositionKey(std::span<const Position> pos,
+                                int history_length) {
+  const int rule50 = pos.back().GetRule50Ply();
+  uint64_t hash =
+      HashCat(pos.back().Hash(), rule50 >= kRule50KeyPly ? rule50 : 0);
+  if (history_length == 0) return hash;
+  hash = HashCat(hash, history_length);
+  const size_t count =
+      std::min(pos.size() - 1, static_cast<size_t>(history_length));
+  for (size_t i = 1; i <= count; ++i) {
+    hash = HashCat(hash, pos[pos.size() - 1 - i].Hash());
+  }
+  return hash;
+}
+
+void BackendComputation::ComputeAsync(std::function<void()> done) {
+  ComputeThreadPool::Get().Run([this, done = std::move(done)]() {
+    ComputeBlocking();
+    done();
+  });
+}
 
 std::vector<EvalResult> Backend::EvaluateBatch(
     std::span<const EvalPosition> positions) {
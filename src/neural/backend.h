@@ -28,6 +28,7 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <optional>
 #include <span>
@@ -72,6 +73,13 @@ struct EvalPosition {
   std::span<const Move> legal_moves;
 };
 
+// Computes the key under which the evaluation of the last of @pos is cached.
+// Besides that position (with its repetition count), the key covers up to
+// @history_length positions before it, as the network sees them in its history
+// planes. The rule50 counter is only included once it's high enough to matter.
+uint64_t ComputeEvalPositionKey(std::span<const Position> pos,
+                                int history_length);
+
 class BackendComputation {
  public:
   virtual ~BackendComputation() = default;
@@ -84,6 +92,11 @@ class BackendComputation {
       const EvalPosition& pos,    // Input position.
       EvalResultPtr result) = 0;  // Where to fetch data into.
   virtual void ComputeBlocking() = 0;
+  // Starts the computation and returns without waiting for it. @done is
+  // called from an unspecified thread once all results are filled in. The
+  // computation must be kept alive until then. The default implementation
+  // runs ComputeBlocking() on a shared pool of worker threads.
+  virtual void ComputeAsync(std::function<void()> done);
 };
 
 class Backend {
@@ -18,6 +18,7 @@
 
 #include "neural/backends/blas/convolution1.h"
 #include "neural/backends/blas/blas.h"
+#include "neural/backends/blas/packed_gemm.h"
 
 #include <Eigen/Dense>
 
@@ -56,18 +57,15 @@ void Convolution1<false>::Forward(const size_t batch_size,
 
     const float* batch_input = input + i * kSquares * input_channels;
     float* batch_output = output + i * kSquares * output_channels;
-    cblas_sgemm(CblasRowMajor,         // Row major formar
-                CblasNoTrans,          // A not transposed
-                CblasNoTrans,          // B not transposed
+    WeightsGemm(true,                  // Row major formar
+                false,                 // A not transposed
                 (int)output_channels,  // M
                 kSquares,              // N
                 (int)input_channels,   // K
-                1.0f,                  // Alpha
                 weights,               // A
                 (int)input_channels,   // lda, leading rank of A
                 batch_input,           // B
                 kSquares,              // ldb, leading rank of B
-                0.0f,                  // beta
                 batch_output,          // C
                 kSquares);             // ldc, leading rank of B
   }
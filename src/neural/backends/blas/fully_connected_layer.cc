@@ -18,6 +18,7 @@
 
 #include "neural/backends/blas/fully_connected_layer.h"
 #include "neural/backends/blas/blas.h"
+#include "neural/backends/blas/packed_gemm.h"
 
 #include <algorithm>
 #include <cassert>
@@ -89,16 +90,15 @@ void FullyConnectedLayer<false>::Forward1D(
     // passing a matrix A[m][n], the value should be m.
     //    cblas_sgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, B,
     //                ldb, beta, C, N);
-    cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans,
+    WeightsGemm(false,              // column major
+                true,               // A transposed
                 (int)output_size,   // M
                 (int)batch_size,    // N
                 (int)input_size,    // K
-                1.0f,               // alpha
                 weights,            // A
                 (int)input_size,    // lda, leading rank of A
                 inputs,             // B
                 (int)input_size,    // ldb, leading rank of B
-                0.0f,               // beta
                 outputs,            // C
                 (int)output_size);  // ldc, leading rank of C
   }
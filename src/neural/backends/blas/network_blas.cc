@@ -18,14 +18,17 @@
 
 #include <Eigen/Core>
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cmath>
 #include <iostream>
+#include <thread>
 
 #include "neural/backends/blas/blas.h"
 #include "neural/backends/blas/convolution1.h"
 #include "neural/backends/blas/encoder.h"
 #include "neural/backends/blas/fully_connected_layer.h"
+#include "neural/backends/blas/packed_gemm.h"
 #include "neural/backends/blas/se_unit.h"
 #include "neural/backends/blas/winograd_convolution3.h"
 #include "neural/backends/shared/activation.h"
@@ -33,21 +36,34 @@
 #include "neural/factory.h"
 #include "neural/network.h"
 #include "neural/network_legacy.h"
-#include "neural/tables/attention_policy_map.h"
-#include "neural/tables/policy_map.h"
+#include "neural/tables/policy_gather.h"
 #include "utils/numa.h"
 
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
 #ifdef USE_DNNL
 #include <omp.h>
 #endif
 
 #ifdef USE_ISPC
 #include "activation_ispc.h"
+#include "policy_gather_ispc.h"
 #endif
 
 namespace lczero {
 namespace {
 
+// Reads the policy from the raw head output through a gather table.
+void GatherPolicy(const float* head, const short* gather, float* policy) {
+#ifndef USE_ISPC
+  for (size_t i = 0; i < kPolicyGatherOutputs; i++) policy[i] = head[gather[i]];
+#else
+  ispc::PolicyGather(kPolicyGatherOutputs, head, gather, policy);
+#endif
+}
+
 struct Buffers {
   std::vector<float> buffer1;
   std::vector<float> buffer2;
@@ -80,6 +96,8 @@ class BlasComputation : public NetworkComputation {
   // Do the computation.
   void ComputeBlocking() override;
 
+  void SetOutputHeads(OutputHeads heads) override { heads_ = heads; }
+
   // Returns how many times AddInput() was called.
   int GetBatchSize() const override { return static_cast<int>(planes_.size()); }
 
@@ -116,6 +134,10 @@ class BlasComputation : public NetworkComputation {
     return policies_[sample][move_id];
   }
 
+  std::span<const float> GetPolicyView(int sample) const override {
+    return policies_[sample];
+  }
+
  private:
   void EncodePlanes(const InputPlanes& sample, float* buffer);
   void ForwardEncoderLayer(
@@ -139,6 +161,7 @@ class BlasComputation : public NetworkComputation {
   std::vector<std::vector<float>> policies_;
   std::vector<float> q_values_;
   std::vector<float> m_values_;
+  OutputHeads heads_;
   bool wdl_;
   bool moves_left_;
   bool conv_policy_;
@@ -157,11 +180,14 @@ template <bool use_eigen>
 class BlasNetwork : public Network {
  public:
   BlasNetwork(const WeightsFile& weights, const OptionsDict& options);
-  virtual ~BlasNetwork(){};
+  virtual ~BlasNetwork() {
+    // Packs point into weights_.
+    if (!use_eigen) ClearPackedGemm();
+  }
 
   std::unique_ptr<NetworkComputation> NewComputation() override {
     return std::make_unique<BlasComputation<use_eigen>>(
-        this, weights_, policy_head_, value_head_, max_batch_size_, wdl_,
+        this, weights_, policy_head_, value_head_, block_size_, wdl_,
         moves_left_, conv_policy_, default_activation_, smolgen_activation_,
         ffn_activation_, attn_policy_, attn_body_, is_pe_dense_embedding_);
   }
@@ -176,6 +202,9 @@ class BlasNetwork : public Network {
 
   void InitThread(int id) override { Numa::BindThread(id); }
 
+  // Number of threads a computation runs its blocks of positions on.
+  size_t GetBlockThreads() const { return block_threads_; }
+
   std::unique_ptr<Buffers> GetBuffers() {
     std::lock_guard<std::mutex> lock(buffers_lock_);
     if (free_buffers_.empty()) {
@@ -199,6 +228,9 @@ class BlasNetwork : public Network {
   const NetworkCapabilities capabilities_;
   MultiHeadWeights weights_;
   size_t max_batch_size_;
+  // Positions that go through the whole network together.
+  size_t block_size_;
+  size_t block_threads_;
   bool wdl_;
   bool moves_left_;
   bool conv_policy_;
@@ -259,6 +291,15 @@ using ConstEigenStridedMatrixMap =
     Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>, 0,
                Eigen::OuterStride<>>;
 
+// Per core L2 cache size in bytes, or a typical one when it can't be queried.
+size_t L2CacheSize() {
+#if defined(__linux__) && defined(_SC_LEVEL2_CACHE_SIZE)
+  const long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  if (size > 0) return size;
+#endif
+  return size_t{1} << 20;
+}
+
 void vec_adjust(std::vector<float>& vec, size_t size) {
   if (vec.size() < size) {
     vec.clear();
@@ -292,8 +333,10 @@ void BlasComputation<use_eigen>::ForwardEncoderLayer(
                           gen_sz_outputs));
   vec_adjust(encoder_buffer3,
              largest_batch_size * std::max(d_model * kSquares, hidden_sz));
+  // Holds the attention scores followed by V, or the FFN hidden layer.
   vec_adjust(encoder_buffer4,
-             batch_size * kSquares * std::max(kSquares * heads, dff_size));
+             batch_size * kSquares *
+                 std::max(kSquares * heads + d_model, dff_size));
 
   // Smolgen.
   if (layer.mha.has_smolgen) {
@@ -347,11 +390,19 @@ void BlasComputation<use_eigen>::ForwardEncoderLayer(
       layer.mha.k_w.data(), layer.mha.k_b.data(), ACTIVATION_NONE,
       encoder_buffer3.data());
 
+  // V
+  float* V_all = &encoder_buffer4[batch_size * kSquares * kSquares * heads];
+  FullyConnectedLayer<use_eigen>::Forward1D(
+      batch_size * kSquares, embedding_size, d_model, encoder_buffer.data(),
+      layer.mha.v_w.data(), layer.mha.v_b.data(), ACTIVATION_NONE, V_all);
+
   // MHA (Q, K, V)
   const int depth = d_model / heads;
   const float scaling = 1.0f / sqrtf(depth);
 
-  // MHA is done per batch since there's a fourth dimension introduced.
+  // MHA is done per batch since there's a fourth dimension introduced. The
+  // scores of each head go through softmax and the product with V right
+  // away, while they are still in cache.
   for (auto batch = size_t{0}; batch < batch_size; batch++) {
     auto batchStart = batch * kSquares * d_model;
 
@@ -359,10 +410,13 @@ void BlasComputation<use_eigen>::ForwardEncoderLayer(
 
     const float* Q = &encoder_buffer2[batchStart];
     const float* K = &encoder_buffer3[batchStart];
-
-    // matmul(Q, K) for all heads per batch.
+    const float* V = &V_all[batchStart];
+    // Each head's columns of Q are used up before its output is written, so
+    // the output overwrites Q.
+    float* attn = &encoder_buffer2[batchStart];
 
     for (auto h = 0; h < heads; h++) {
+      // matmul(Q, K).
       const float* A = &Q[h * depth];
       const float* B = &K[h * depth];
       float* C = &QK[h * kSquares * kSquares];
@@ -387,50 +441,33 @@ void BlasComputation<use_eigen>::ForwardEncoderLayer(
         throw Exception("Blas backend internal error");
 #endif
       }
-    }
-  }
 
-  // Apply Softmax.
-  float* QK = &encoder_buffer4[0];
-  for (size_t h = 0; h < batch_size * heads * kSquares * kSquares;
-       h += kSquares) {
+      // Apply Softmax.
+      for (int i = 0; i < kSquares * kSquares; i += kSquares) {
 #if defined(USE_ISPC)
-    if (!use_eigen) {
-      ispc::SoftmaxActivation(kSquares, QK + h, QK + h);
-      continue;
-    }
+        if (!use_eigen) {
+          ispc::SoftmaxActivation(kSquares, C + i, C + i);
+          continue;
+        }
 #endif
-    SoftmaxActivation(kSquares, QK + h, QK + h);
-  }
-
-  // V
-  FullyConnectedLayer<use_eigen>::Forward1D(
-      batch_size * kSquares, embedding_size, d_model, encoder_buffer.data(),
-      layer.mha.v_w.data(), layer.mha.v_b.data(), ACTIVATION_NONE,
-      encoder_buffer3.data());
+        SoftmaxActivation(kSquares, C + i, C + i);
+      }
 
-  for (auto batch = size_t{0}; batch < batch_size; batch++) {
-    auto batchStart = batch * kSquares * d_model;
-    // matmul(softmax(QK), V) for all heads per batch.
-    float* attn = &encoder_buffer2[batchStart];
-    const float* V = &encoder_buffer3[batchStart];
-    const float* QK = &encoder_buffer4[batch * kSquares * kSquares * heads];
-    for (auto h = 0; h < heads; h++) {
-      const float* A = &QK[h * kSquares * kSquares];
-      const float* B = &V[h * depth];
-      float* C = &attn[h * depth];
+      // matmul(softmax(QK), V).
+      const float* V_h = &V[h * depth];
+      float* attn_h = &attn[h * depth];
       if (use_eigen) {
-        auto C_mat = EigenStridedMatrixMap<float>(
-            C, depth, kSquares, Eigen::OuterStride<>(heads * depth));
-        C_mat.noalias() =
+        auto attn_mat = EigenStridedMatrixMap<float>(
+            attn_h, depth, kSquares, Eigen::OuterStride<>(heads * depth));
+        attn_mat.noalias() =
             ConstEigenStridedMatrixMap<float>(
-                B, depth, kSquares, Eigen::OuterStride<>(heads * depth)) *
-            ConstEigenMatrixMap<float>(A, kSquares, kSquares);
+                V_h, depth, kSquares, Eigen::OuterStride<>(heads * depth)) *
+            ConstEigenMatrixMap<float>(C, kSquares, kSquares);
       } else {
 #ifdef USE_BLAS
         cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, kSquares, depth,
-                    kSquares, 1.0f, A, kSquares, B, heads * depth, 0.0f, C,
-                    heads * depth);
+                    kSquares, 1.0f, C, kSquares, V_h, heads * depth, 0.0f,
+                    attn_h, heads * depth);
 #endif
       }
     }
@@ -510,6 +547,7 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
   // Determine the largest batch for allocations.
   const auto total_batches = planes_.size();
   const auto largest_batch_size = std::min(max_batch_size_, total_batches);
+  if (total_batches == 0) return;
 
   /* Typically
    input_channels = 112
@@ -532,29 +570,19 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
                                policy_head.ip_pol_b.size());
   }
 
-  std::unique_ptr<Buffers> buffers = network_->GetBuffers();
-
-  // Allocate data for the whole batch.
-  std::vector<float>& buffer1 = buffers->buffer1;
-  vec_adjust(buffer1, largest_batch_size * max_channels * kSquares);
-  std::vector<float>& buffer2 = buffers->buffer2;
-  vec_adjust(buffer2, largest_batch_size * max_channels * kSquares);
-  std::vector<float>& buffer3 = buffers->buffer3;
-  vec_adjust(buffer3, largest_batch_size *
-                          std::max(max_channels * kSquares, max_fc_channels));
-  std::vector<float>& head_buffer = buffers->buffer4;
-  vec_adjust(head_buffer, largest_batch_size * max_head_planes * kSquares);
-
-  // Output values.
-  q_values_.reserve(wdl_ ? 3 * total_batches : total_batches);
-  policies_.reserve(total_batches);
+  // Output values, written by position so that blocks can finish in any
+  // order.
+  q_values_.resize(wdl_ ? 3 * total_batches : total_batches);
+  policies_.resize(total_batches);
   if (moves_left_) m_values_.resize(total_batches);
 
-  WinogradConvolution3<use_eigen> convolve3(largest_batch_size, max_channels,
-                                            max_output_channels);
-
-  for (size_t start = 0; start < total_batches; start += largest_batch_size) {
-    const auto batch_size = std::min(total_batches - start, largest_batch_size);
+  // Runs positions [start, start + batch_size) through the whole network.
+  auto forward_block = [&](size_t start, size_t batch_size, Buffers& buffers,
+                           WinogradConvolution3<use_eigen>& convolve3) {
+    std::vector<float>& buffer1 = buffers.buffer1;
+    std::vector<float>& buffer2 = buffers.buffer2;
+    std::vector<float>& buffer3 = buffers.buffer3;
+    std::vector<float>& head_buffer = buffers.buffer4;
     for (size_t j = 0; j < batch_size; j++) {
       EncodePlanes(planes_[start + j], &buffer1[j * kSquares * kInputPlanes]);
     }
@@ -754,9 +782,9 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
         std::vector<float> wdl_softmax(3);
         SoftmaxActivation(3, &wdl[j * 3], wdl_softmax.data());
 
-        q_values_.emplace_back(wdl_softmax[0]);
-        q_values_.emplace_back(wdl_softmax[1]);
-        q_values_.emplace_back(wdl_softmax[2]);
+        q_values_[3 * (start + j) + 0] = wdl_softmax[0];
+        q_values_[3 * (start + j) + 1] = wdl_softmax[1];
+        q_values_[3 * (start + j) + 2] = wdl_softmax[2];
       }
     } else {
       for (size_t j = 0; j < batch_size; j++) {
@@ -765,12 +793,12 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
                              &buffer3[j * num_value_channels]) +
                          value_head.ip2_val_b[0];
 
-        q_values_.emplace_back(std::tanh(winrate));
+        q_values_[start + j] = std::tanh(winrate);
       }
     }
 
     // Moves left head.
-    if (moves_left_) {
+    if (moves_left_ && heads_.moves_left) {
       if (attn_body_) {
         FullyConnectedLayer<use_eigen>::Forward1D(
             batch_size * kSquares, weights_.ip_emb_b.size(),
@@ -801,7 +829,9 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
     }
 
     // Policy head.
-    if (attn_policy_) {
+    if (!heads_.policy) {
+      // Not read by the caller.
+    } else if (attn_policy_) {
       if (!attn_body_) {
         // NCHW to NHWC conversion.
         for (auto batch = size_t{0}; batch < batch_size; batch++) {
@@ -902,13 +932,9 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
       // Mapping from attention policy to lc0 policy
       for (auto batch = size_t{0}; batch < batch_size; batch++) {
         std::vector<float> policy(num_output_policy);
-        for (auto i = 0; i < 64 * 64 + 8 * 24; i++) {
-          auto j = kAttnPolicyMap[i];
-          if (j >= 0) {
-            policy[j] = head_buffer[batch * (64 * 64 + 8 * 24) + i];
-          }
-        }
-        policies_.emplace_back(std::move(policy));
+        GatherPolicy(&head_buffer[batch * (64 * 64 + 8 * 24)],
+                     kAttnPolicyGather.data(), policy.data());
+        policies_[start + batch] = std::move(policy);
       }
     } else if (conv_policy_) {
       assert(!attn_body_);  // not supported with attention body
@@ -929,14 +955,9 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
       // Mapping from convolutional policy to lc0 policy
       for (auto batch = size_t{0}; batch < batch_size; batch++) {
         std::vector<float> policy(num_output_policy);
-        for (auto i = 0; i < kPolicyUsedPlanes * kSquares; i++) {
-          auto j = kConvPolicyMap[i];
-          if (j >= 0) {
-            policy[j] =
-                head_buffer[batch * num_policy_input_planes * kSquares + i];
-          }
-        }
-        policies_.emplace_back(std::move(policy));
+        GatherPolicy(&head_buffer[batch * num_policy_input_planes * kSquares],
+                     kConvPolicyGather.data(), policy.data());
+        policies_[start + batch] = std::move(policy);
       }
 
     } else {
@@ -961,11 +982,43 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
         // Get the moves
         policy.assign(buffer3.begin() + j * num_output_policy,
                       buffer3.begin() + (j + 1) * num_output_policy);
-        policies_.emplace_back(std::move(policy));
+        policies_[start + j] = std::move(policy);
       }
     }
-  }
-  network_->ReleaseBuffers(std::move(buffers));
+  };
+
+  // Blocks are handed out to the workers one at a time, each of them with its
+  // own buffers.
+  const size_t num_blocks =
+      (total_batches + largest_batch_size - 1) / largest_batch_size;
+  std::atomic<size_t> next_block{0};
+  auto worker = [&]() {
+#ifdef USE_DNNL
+    omp_set_num_threads(1);
+#endif
+    std::unique_ptr<Buffers> buffers = network_->GetBuffers();
+    vec_adjust(buffers->buffer1, largest_batch_size * max_channels * kSquares);
+    vec_adjust(buffers->buffer2, largest_batch_size * max_channels * kSquares);
+    vec_adjust(buffers->buffer3,
+               largest_batch_size *
+                   std::max(max_channels * kSquares, max_fc_channels));
+    vec_adjust(buffers->buffer4,
+               largest_batch_size * max_head_planes * kSquares);
+    WinogradConvolution3<use_eigen> convolve3(largest_batch_size, max_channels,
+                                              max_output_channels);
+    for (size_t block; (block = next_block++) < num_blocks;) {
+      const size_t start = block * largest_batch_size;
+      forward_block(start, std::min(total_batches - start, largest_batch_size),
+                    *buffers, convolve3);
+    }
+    network_->ReleaseBuffers(std::move(buffers));
+  };
+
+  const size_t num_threads = std::min(network_->GetBlockThreads(), num_blocks);
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; i++) threads.emplace_back(worker);
+  worker();
+  for (auto& thread : threads) thread.join();
 }
 
 template <bool use_eigen>
@@ -1045,6 +1098,43 @@ BlasNetwork<use_eigen>::BlasNetwork(const WeightsFile& file,
     conv2.weights = WinogradFilterTransformF(conv2.weights, channels, channels);
   }
 
+  // Batches are split in blocks of block_size positions (batch_size by
+  // default), each going through the whole network before the next one
+  // starts. With cache_blocking the blocks are sized for their activations,
+  // and the Winograd transforms of residual nets, to stay in the L2 cache.
+  // The blocks of a batch run on up to `threads` threads (0 for one per
+  // core).
+  block_size_ = max_batch_size_;
+  if (options.GetOrDefault<bool>("cache_blocking", false)) {
+    const size_t max_channels = std::max(
+        {static_cast<size_t>(channels), weights_.ip_emb_b.size(),
+         static_cast<size_t>(kInputPlanes)});
+    // Three activation buffers, plus the Winograd input and output tiles
+    // (16 tiles of 4x4 per channel each).
+    const size_t bytes_per_position =
+        sizeof(float) * max_channels *
+        (3 * 64 + (residual_blocks > 0 ? 2 * 16 * 16 : 0));
+    block_size_ = std::clamp(L2CacheSize() / bytes_per_position, size_t{1},
+                             max_batch_size_);
+  }
+  const auto block_size = options.GetOrDefault<int>("block_size", 0);
+  if (block_size > 0) {
+    block_size_ = std::min(static_cast<size_t>(block_size), max_batch_size_);
+  }
+  // With pack_weights, GEMM weights are packed once for the BLAS microkernels
+  // rather than on every call (MKL only).
+  if (!use_eigen) {
+    const bool pack_weights = options.GetOrDefault<bool>("pack_weights", false);
+    if (pack_weights && !PackedGemmSupported()) {
+      CERR << "Weights packing is only supported with MKL, ignoring.";
+    }
+    SetPackedGemm(pack_weights);
+  }
+  const auto threads = options.GetOrDefault<int>("threads", 1);
+  block_threads_ = threads > 0
+                       ? threads
+                       : std::max(1u, std::thread::hardware_concurrency());
+
   policy_head_ = options.GetOrDefault<std::string>("policy_head", "vanilla");
   // Check that selected policy head exists.
   if (weights_.policy_heads.count(policy_head_) == 0) {
@@ -1107,6 +1197,10 @@ BlasNetwork<use_eigen>::BlasNetwork(const WeightsFile& file,
 #endif
     CERR << "BLAS max batch size is " << max_batch_size_ << ".";
   }
+  if (block_size_ != max_batch_size_ || block_threads_ > 1) {
+    CERR << "Blocks of " << block_size_ << " positions on " << block_threads_
+         << " thread(s).";
+  }
 }
 
 template <bool use_eigen>
@@ -0,0 +1,148 @@
+/*
+ This file is part of Leela Chess Zero.
+ Copyright (C) 2025 The LCZero Authors
+
+ Leela Chess is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ Leela Chess is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "neural/backends/blas/packed_gemm.h"
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <tuple>
+
+#include "neural/backends/blas/blas.h"
+#include "utils/mutex.h"
+
+namespace lczero {
+
+#ifdef USE_MKL
+namespace {
+
+// Weights are packed for the exact shape of the call, so a layer gets a pack
+// per batch size. Only the most recently used few are kept, enough for the
+// full and the last partial block of a batch.
+constexpr int kMaxPacksPerWeights = 2;
+
+struct PackKey {
+  const float* a;
+  int m, n, k, lda;
+  bool row_major, transpose_a;
+
+  auto operator<=>(const PackKey&) const = default;
+};
+
+struct Pack {
+  std::shared_ptr<float> data;
+  std::atomic<uint64_t> last_use;
+};
+
+std::atomic<bool> packing_enabled{false};
+std::atomic<uint64_t> pack_clock{0};
+SharedMutex packs_mutex;
+std::map<PackKey, Pack> packs GUARDED_BY(packs_mutex);
+
+std::shared_ptr<float> GetPack(const PackKey& key) {
+  const uint64_t now = ++pack_clock;
+  {
+    SharedMutex::SharedLock lock(packs_mutex);
+    auto iter = packs.find(key);
+    if (iter != packs.end()) {
+      iter->second.last_use.store(now, std::memory_order_relaxed);
+      return iter->second.data;
+    }
+  }
+
+  const CBLAS_LAYOUT layout = key.row_major ? CblasRowMajor : CblasColMajor;
+  const CBLAS_TRANSPOSE trans = key.transpose_a ? CblasTrans : CblasNoTrans;
+  const size_t bytes =
+      cblas_sgemm_pack_get_size(CblasAMatrix, key.m, key.n, key.k);
+  std::shared_ptr<float> data(static_cast<float*>(mkl_malloc(bytes, 64)),
+                              mkl_free);
+  if (!data) return nullptr;
+  cblas_sgemm_pack(layout, CblasAMatrix, trans, key.m, key.n, key.k, 1.0f,
+                   key.a, key.lda, data.get());
+
+  SharedMutex::Lock lock(packs_mutex);
+  // Evict the least recently used pack of the same weights if needed.
+  const auto first = packs.lower_bound(PackKey{key.a, 0, 0, 0, 0, false,
+                                               false});
+  auto last = first;
+  auto oldest = packs.end();
+  int count = 0;
+  for (; last != packs.end() && last->first.a == key.a; ++last, ++count) {
+    if (oldest == packs.end() || last->second.last_use.load() <
+                                     oldest->second.last_use.load()) {
+      oldest = last;
+    }
+  }
+  if (count >= kMaxPacksPerWeights) packs.erase(oldest);
+  auto [iter, inserted] = packs.try_emplace(key);
+  if (inserted) iter->second.data = std::move(data);
+  iter->second.last_use.store(now, std::memory_order_relaxed);
+  return iter->second.data;
+}
+
+}  // namespace
+
+bool PackedGemmSupported() { return true; }
+
+void SetPackedGemm(bool enabled) { packing_enabled = enabled; }
+
+void ClearPackedGemm() {
+  SharedMutex::Lock lock(packs_mutex);
+  // Calls in flight keep their packs alive through the shared pointers.
+  packs.clear();
+}
+
+void WeightsGemm(bool row_major, bool transpose_a, int m, int n, int k,
+                 const float* a, int lda, const float* b, int ldb, float* c,
+                 int ldc) {
+  const CBLAS_LAYOUT layout = row_major ? CblasRowMajor : CblasColMajor;
+  if (packing_enabled.load(std::memory_order_relaxed)) {
+    const auto pack =
+        GetPack(PackKey{a, m, n, k, lda, row_major, transpose_a});
+    if (pack) {
+      cblas_sgemm_compute(layout, CblasPacked, CblasNoTrans, m, n, k,
+                          pack.get(), lda, b, ldb, 0.0f, c, ldc);
+      return;
+    }
+  }
+  cblas_sgemm(layout, transpose_a ? CblasTrans : CblasNoTrans, CblasNoTrans,
+              m, n, k, 1.0f, a, lda, b, ldb, 0.0f, c, ldc);
+}
+
+#else
+
+bool PackedGemmSupported() { return false; }
+
+void SetPackedGemm(bool) {}
+
+void ClearPackedGemm() {}
+
+#ifdef USE_BLAS
+void WeightsGemm(bool row_major, bool transpose_a, int m, int n, int k,
+                 const float* a, int lda, const float* b, int ldb, float* c,
+                 int ldc) {
+  cblas_sgemm(row_major ? CblasRowMajor : CblasColMajor,
+              transpose_a ? CblasTrans : CblasNoTrans, CblasNoTrans, m, n, k,
+              1.0f, a, lda, b, ldb, 0.0f, c, ldc);
+}
+#endif
+
+#endif
+
+}  // namespace lczero
@@ -0,0 +1,44 @@
+/*
+ This file is part of Leela Chess Zero.
+ Copyright (C) 2025 The LCZero Authors
+
+ Leela Chess is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ Leela Chess is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+namespace lczero {
+
+// Weights of GEMMs can be packed once into the microkernel layout of the BLAS
+// library, instead of the library packing them again on every call. Only MKL
+// offers this; with other libraries enabling it has no effect.
+
+// Returns whether the BLAS library in use supports packing.
+bool PackedGemmSupported();
+// Enables or disables packing, for all networks.
+void SetPackedGemm(bool enabled);
+// Frees all packed weights. Must be called before the weights they were
+// packed from are freed.
+void ClearPackedGemm();
+
+#ifdef USE_BLAS
+// C := op(A) * B, where A is a weights matrix that stays the same between
+// calls, packed when enabled. Arguments are the same as for cblas_sgemm with
+// alpha = 1, beta = 0 and B not transposed.
+void WeightsGemm(bool row_major, bool transpose_a, int m, int n, int k,
+                 const float* a, int lda, const float* b, int ldb, float* c,
+                 int ldc);
+#endif
+
+}  // namespace lczero
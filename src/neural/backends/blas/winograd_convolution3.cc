@@ -24,6 +24,7 @@
 #include <cmath>
 
 #include <array>
+#include <type_traits>
 
 #ifdef USE_ISPC
 #include "winograd_transform_ispc.h"
@@ -32,6 +33,33 @@
 #include <Eigen/Dense>
 
 namespace lczero {
+namespace {
+// Calls @func with the channel count as a compile time constant for the
+// common tower widths, so that the transforms get constant loop counts and
+// strides, and with 0 for other widths.
+template <typename F>
+void DispatchChannels(size_t channels, F&& func) {
+  switch (channels) {
+    case 64:
+      return func(std::integral_constant<size_t, 64>());
+    case 128:
+      return func(std::integral_constant<size_t, 128>());
+    case 192:
+      return func(std::integral_constant<size_t, 192>());
+    case 256:
+      return func(std::integral_constant<size_t, 256>());
+    case 320:
+      return func(std::integral_constant<size_t, 320>());
+    case 384:
+      return func(std::integral_constant<size_t, 384>());
+    case 512:
+      return func(std::integral_constant<size_t, 512>());
+    default:
+      return func(std::integral_constant<size_t, 0>());
+  }
+}
+}  // namespace
+
 template <typename T>
 using EigenMatrixMap =
     Eigen::Map<Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>;
@@ -64,6 +92,23 @@ void WinogradConvolution3<use_eigen>::TransformIn(const size_t batch_size,
                                                   const size_t channels) {
 #ifndef USE_ISPC
 
+  DispatchChannels(channels, [&](auto fixed_channels) {
+    TransformInImpl<fixed_channels()>(batch_size, input, channels);
+  });
+
+#else  // USE_ISPC
+
+  ispc::winograd_TransformIn_ispc(batch_size, input, channels, &V_[0]);
+
+#endif  // USE_ISPC
+}
+
+template <bool use_eigen>
+template <size_t kChannels>
+void WinogradConvolution3<use_eigen>::TransformInImpl(
+    const size_t batch_size, const float* input,
+    const size_t runtime_channels) {
+  const size_t channels = kChannels ? kChannels : runtime_channels;
   static const size_t kCacheSize = 128;
   float x[kWinogradAlpha][kWinogradAlpha];
   float T1[kWinogradAlpha][kWinogradAlpha];
@@ -82,6 +127,16 @@ void WinogradConvolution3<use_eigen>::TransformIn(const size_t batch_size,
           // Tiles overlap by 2
           const int yin = 2 * block_y - 1;
           const int xin = 2 * block_x - 1;
+          // Which tile elements are on the board is the same for all
+          // channels.
+          int offset[kWinogradAlpha][kWinogradAlpha];
+          for (int i = 0; i < kWinogradAlpha; i++) {
+            for (int j = 0; j < kWinogradAlpha; j++) {
+              const bool inside = (yin + i) >= 0 && (xin + j) >= 0 &&
+                                  (yin + i) < kHeight && (xin + j) < kWidth;
+              offset[i][j] = inside ? (yin + i) * kWidth + (xin + j) : -1;
+            }
+          }
 
           for (size_t ch = 0; ch < channel_step; ++ch) {
             const size_t channel = channel_long + ch;
@@ -90,12 +145,8 @@ void WinogradConvolution3<use_eigen>::TransformIn(const size_t batch_size,
                 input_batch + channel * (kWidth * kHeight);
             for (int i = 0; i < kWinogradAlpha; i++) {
               for (int j = 0; j < kWinogradAlpha; j++) {
-                if ((yin + i) >= 0 && (xin + j) >= 0 && (yin + i) < kHeight &&
-                    (xin + j) < kWidth) {
-                  x[i][j] = input_channel[(yin + i) * kWidth + (xin + j)];
-                } else {
-                  x[i][j] = 0.0f;
-                }
+                x[i][j] =
+                    offset[i][j] >= 0 ? input_channel[offset[i][j]] : 0.0f;
               }
             }
 
@@ -152,12 +203,6 @@ void WinogradConvolution3<use_eigen>::TransformIn(const size_t batch_size,
       }
     }
   }
-
-#else  // USE_ISPC
-
-  ispc::winograd_TransformIn_ispc(batch_size, input, channels, &V_[0]);
-
-#endif  // USE_ISPC
 }
 
 #ifdef USE_BLAS
@@ -263,6 +308,22 @@ void WinogradConvolution3<use_eigen>::TransformOut(const size_t batch_size,
                                                    const size_t channels) {
 #ifndef USE_ISPC
 
+  DispatchChannels(channels, [&](auto fixed_channels) {
+    TransformOutImpl<fixed_channels()>(batch_size, output, channels);
+  });
+
+#else  // USE_ISPC
+
+  ispc::winograd_TransformOut_ispc(batch_size, &M_[0], channels, output);
+
+#endif  // USE_ISPC
+}
+
+template <bool use_eigen>
+template <size_t kChannels>
+void WinogradConvolution3<use_eigen>::TransformOutImpl(
+    const size_t batch_size, float* output, const size_t runtime_channels) {
+  const size_t channels = kChannels ? kChannels : runtime_channels;
   float m[kWinogradTile];
 
   for (size_t batch_index = 0; batch_index < batch_size; batch_index++) {
@@ -317,12 +378,6 @@ void WinogradConvolution3<use_eigen>::TransformOut(const size_t batch_size,
       }
     }
   }
-
-#else  // USE_ISPC
-
-  ispc::winograd_TransformOut_ispc(batch_size, &M_[0], channels, output);
-
-#endif  // USE_ISPC
 }
 
 template class WinogradConvolution3<true>;
@@ -59,6 +59,15 @@ class WinogradConvolution3 {
   void TransformOut(const size_t batch_size, float* output,
                     const size_t channels);
 
+  // The transforms for a channel count fixed at compile time, or given at
+  // runtime when kChannels is 0.
+  template <size_t kChannels>
+  void TransformInImpl(const size_t batch_size, const float* input,
+                       const size_t runtime_channels);
+  template <size_t kChannels>
+  void TransformOutImpl(const size_t batch_size, float* output,
+                        const size_t runtime_channels);
+
   static constexpr auto kWidth = 8;
   static constexpr auto kHeight = 8;
   static constexpr auto kSquares = kWidth * kHeight;
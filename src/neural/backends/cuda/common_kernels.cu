@@ -751,33 +751,27 @@ void globalScale(int N, int C, T* output, const T* input, const T* scaleBias,
 template <typename T>
 __global__ void policyMap_kernel(T* output, const T* input,
                                  const short* indices, int N, int inputSize,
-                                 int usedSize, int outputSize) {
+                                 int outputSize) {
   int tid = blockIdx.x * blockDim.x + threadIdx.x;
 
-  int n = tid / usedSize;
-  int i = tid % usedSize;
+  int n = tid / outputSize;
+  int j = tid % outputSize;
 
   if (n >= N) return;
 
-  int j = indices[i];
-
-  if (j >= 0) {
-    output[n * outputSize + j] = input[n * inputSize + i];
-  }
+  output[tid] = input[n * inputSize + indices[j]];
 }
 
 template <typename T>
 void PolicyMap(int N, T* output, const T* input, const short* indices,
-               int inputSize, int usedSize, int outputSize,
-               cudaStream_t stream) {
-  // Each thread processes one input element
-  // Only some of the threads (with valid mapping) write output
+               int inputSize, int outputSize, cudaStream_t stream) {
+  // Each thread gathers one output element, so writes are coalesced and every
+  // thread does useful work.
   const int kBlockSize = 256;
-  const int kBlocks = DivUp(N * usedSize, kBlockSize);
+  const int kBlocks = DivUp(N * outputSize, kBlockSize);
 
   policyMap_kernel<T><<<kBlocks, kBlockSize, 0, stream>>>(
-      (T*)output, (T*)input, (short*)indices, N, inputSize, usedSize,
-      outputSize);
+      (T*)output, (T*)input, (short*)indices, N, inputSize, outputSize);
   ReportCUDAErrors(cudaGetLastError());
 }
 
@@ -795,9 +789,11 @@ void OutputInputTransform(int N, int C, int se_K, T* output, const T* input,
         <<<grid_dim, kOpInpTransformBlockSize, 0, stream>>>(N, C, output, input,
                                                             (float*)skip, bias);
   } else if (C > kMaxResBlockFusingChannels) {
-    throw Exception(
-        "res block fusing opt not supported for the given data type and no "
-        "of filters\n");
+    OutputTransform_SE_relu_InputTransform_large_kernel<float, activation,
+                                                        use_bias, use_skip>
+        <<<N, kOpSeInpTransformBlockSize, (C + se_K) * sizeof(float),
+           stream>>>(N, C, se_K, output, input, (float*)skip, bias, w1, b1, w2,
+                     b2);
   } else {
     OutputTransform_SE_relu_InputTransform_kernel<float, activation, use_bias,
                                                   use_skip>
@@ -1136,6 +1132,100 @@ void LayerNorm(int N, int C, T* output, const T* input, const T* bias,
   ReportCUDAErrors(cudaGetLastError());
 }
 
+// Dense layer of one sample, from and to shared memory, followed by the bias
+// and activation. Each warp computes one output at a time, so that the reads
+// of the (row major) weights are coalesced.
+template <typename T>
+__device__ void smolgen_dense(float* output, const float* input, const T* w,
+                              const T* b, int num_inputs, int num_outputs,
+                              ActivationFunction act) {
+  for (int o = threadIdx.y; o < num_outputs; o += blockDim.y) {
+    float s = 0;
+    for (int k = threadIdx.x; k < num_inputs; k += 32) {
+      s += input[k] * (float)w[o * num_inputs + k];
+    }
+    s = warpReduce(s);
+    if (threadIdx.x == 0) output[o] = activate(s + (float)b[o], act);
+  }
+  __syncthreads();
+}
+
+// Layer normalization of C values in shared memory, in place.
+template <typename T>
+__device__ void smolgen_layer_norm(float* data, int C, const T* gammas,
+                                   const T* betas, float ep) {
+  const int tid = threadIdx.y * 32 + threadIdx.x;
+  const int threads = blockDim.y * 32;
+  float s = 0;
+  for (int c = tid; c < C; c += threads) s += data[c];
+  const float mean = shared_sum_for_layer_norm(s) / C;
+  __syncthreads();
+  s = 0;
+  for (int c = tid; c < C; c += threads) {
+    float d = data[c] - mean;
+    s += d * d;
+  }
+  const float var = shared_sum_for_layer_norm(s) / C;
+  for (int c = tid; c < C; c += threads) {
+    data[c] =
+        (data[c] - mean) / sqrt(var + ep) * (float)gammas[c] + (float)betas[c];
+  }
+  __syncthreads();
+}
+
+// Both hidden dense layers of smolgen (with their layer norms) for one sample
+// per block, keeping the intermediate activations in shared memory.
+// Block is 32 x warps threads, as expected by shared_sum_for_layer_norm().
+template <typename T>
+__global__ void smolgen_hidden_kernel(T* output, const T* input, int in_size,
+                                      int hidden_size, int gen_size,
+                                      const T* w1, const T* b1,
+                                      const T* gammas1, const T* betas1,
+                                      const T* w2, const T* b2,
+                                      const T* gammas2, const T* betas2,
+                                      float ep, ActivationFunction act) {
+  extern __shared__ float smolgen_data[];
+  float* x = smolgen_data;
+  float* hidden = x + in_size;
+  float* gen = hidden + hidden_size;
+  const int n = blockIdx.x;
+  const int tid = threadIdx.y * 32 + threadIdx.x;
+  const int threads = blockDim.y * 32;
+
+  for (int i = tid; i < in_size; i += threads) {
+    x[i] = (float)input[n * in_size + i];
+  }
+  __syncthreads();
+
+  smolgen_dense(hidden, x, w1, b1, in_size, hidden_size, act);
+  smolgen_layer_norm(hidden, hidden_size, gammas1, betas1, ep);
+  smolgen_dense(gen, hidden, w2, b2, hidden_size, gen_size, act);
+  smolgen_layer_norm(gen, gen_size, gammas2, betas2, ep);
+
+  for (int i = tid; i < gen_size; i += threads) {
+    output[n * gen_size + i] = (T)gen[i];
+  }
+}
+
+bool CanFuseSmolgenHidden(int in_size, int hidden_size, int gen_size) {
+  return (in_size + hidden_size + gen_size) * sizeof(float) <=
+         kMaxSmolgenHiddenSmem;
+}
+
+template <typename T>
+void SmolgenHidden(int N, T* output, const T* input, int in_size,
+                   int hidden_size, int gen_size, const T* w1, const T* b1,
+                   const T* gammas1, const T* betas1, const T* w2, const T* b2,
+                   const T* gammas2, const T* betas2, float ep,
+                   ActivationFunction act, cudaStream_t stream) {
+  const size_t smem = (in_size + hidden_size + gen_size) * sizeof(float);
+  smolgen_hidden_kernel<T><<<N, dim3(32, 8), smem, stream>>>(
+      output, input, in_size, hidden_size, gen_size, w1, b1, gammas1, betas1,
+      w2, b2, gammas2, betas2, ep, act);
+
+  ReportCUDAErrors(cudaGetLastError());
+}
+
 // Compute promotion logits in a single kernel
 // keys matrix is of N * 64 * C (but we use only last 8 from the 'rows'
 // dimension, so N * 8 * C)
@@ -1309,6 +1399,20 @@ void applyInputGating(T* output, const T* input, const T* mult, const T* add,
   ReportCUDAErrors(cudaGetLastError());
 }
 
+__global__ void signal_completion_kernel(volatile unsigned int* flag,
+                                         unsigned int value) {
+  // Everything before this kernel in the stream is complete, make sure the
+  // mapped outputs are visible to the host before the flag is.
+  __threadfence_system();
+  *flag = value;
+}
+
+void signalCompletion(unsigned int* flag, unsigned int value,
+                      cudaStream_t stream) {
+  signal_completion_kernel<<<1, 1, 0, stream>>>(flag, value);
+  ReportCUDAErrors(cudaGetLastError());
+}
+
 // Template instantiation.
 template void copyTypeConverted<half, float>(half* op, float* ip, int N,
                                              cudaStream_t stream);
@@ -1383,11 +1487,10 @@ template void globalScale<half>(int N, int C, half* output, const half* input,
 
 template void PolicyMap<float>(int N, float* output, const float* input,
                                const short* indices, int inputSize,
-                               int usedSize, int outputSize,
-                               cudaStream_t stream);
+                               int outputSize, cudaStream_t stream);
 
 template void PolicyMap<half>(int N, half* output, const half* input,
-                              const short* indices, int inputSize, int usedSize,
+                              const short* indices, int inputSize,
                               int outputSize, cudaStream_t stream);
 
 template void FilterTransform<float>(int N, int C, float* transformedFilter,
@@ -1554,6 +1657,23 @@ template void LayerNorm<float>(int N, int C, float* output, const float* input,
                                float ep, float alpha, ActivationFunction act,
                                cudaStream_t stream);
 
+template void SmolgenHidden<half>(int N, half* output, const half* input,
+                                  int in_size, int hidden_size, int gen_size,
+                                  const half* w1, const half* b1,
+                                  const half* gammas1, const half* betas1,
+                                  const half* w2, const half* b2,
+                                  const half* gammas2, const half* betas2,
+                                  float ep, ActivationFunction act,
+                                  cudaStream_t stream);
+template void SmolgenHidden<float>(int N, float* output, const float* input,
+                                   int in_size, int hidden_size, int gen_size,
+                                   const float* w1, const float* b1,
+                                   const float* gammas1, const float* betas1,
+                                   const float* w2, const float* b2,
+                                   const float* gammas2, const float* betas2,
+                                   float ep, ActivationFunction act,
+                                   cudaStream_t stream);
+
 template void ComputePromotionLogits<half>(int N, int C, half* output,
                                            const half* keys, const half* ppo,
                                            const half* policy_attn_logits,
@@ -38,6 +38,10 @@
 typedef void* cudnnHandle_t;
 #endif
 
+#ifdef USE_NCCL
+#include <nccl.h>
+#endif
+
 #if CUBLAS_VER_MAJOR < 11
 #define CUBLAS_PEDANTIC_MATH CUBLAS_DEFAULT_MATH
 #endif
@@ -47,8 +51,8 @@ namespace cudnn_backend {
 
 static constexpr int kNumOutputPolicy = 1858;
 
-// max supported filter count for fast path
-// TODO: extend it to cover bigger networks!
+// max supported filter count for fast path, bigger networks use a kernel that
+// loops over channels
 // (We are limited by no of registers per thread)
 static constexpr int kMaxResBlockFusingChannels = 384;  // limit on num_filters
 static constexpr int kMaxResBlockFusingSeKFp16Ampere =
@@ -60,15 +64,30 @@ static constexpr int kMaxResBlockFusingSeFp16AmpereSmem =
     sizeof(half);  // shared memory used by the special
                    // kernel
 
+// Shared memory of the fused smolgen hidden layers kernel, and the largest
+// batch it is used for (above it the GEMMs read the weights fewer times).
+static constexpr size_t kMaxSmolgenHiddenSmem = 48 * 1024;
+static constexpr int kMaxSmolgenHiddenBatch = 16;
+
 #ifdef USE_CUDNN
 void CudnnError(cudnnStatus_t status, const char* file, const int& line);
 #endif
 void CublasError(cublasStatus_t status, const char* file, const int& line);
 void CudaError(cudaError_t status, const char* file, const int& line);
+#ifdef USE_NCCL
+void NcclError(ncclResult_t status, const char* file, const int& line);
+#endif
+
+// Number of visible CUDA devices, 0 if there is no usable driver. Each MIG
+// instance made visible to the process counts as a device.
+int GetDeviceCount();
 
 #ifdef USE_CUDNN
 #define ReportCUDNNErrors(status) CudnnError(status, __FILE__, __LINE__)
 #endif
+#ifdef USE_NCCL
+#define ReportNCCLErrors(status) NcclError(status, __FILE__, __LINE__)
+#endif
 #define ReportCUBLASErrors(status) CublasError(status, __FILE__, __LINE__)
 #define ReportCUDAErrors(status) CudaError(status, __FILE__, __LINE__)
 
@@ -25,6 +25,8 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include <algorithm>
+
 #include "cuda_common.h"
 #include "neural/tables/activation_function.h"
 
@@ -34,6 +36,10 @@
 #endif
 #include "winograd_helper.inc"
 
+#if CUDART_VERSION >= 11080
+#include <cuda_fp8.h>
+#endif
+
 namespace lczero {
 namespace cudnn_backend {
 
@@ -449,7 +455,12 @@ void OutputInputTransform(int N, int C, int se_K, T* output, const T* input,
   } else if (C > kMaxResBlockFusingChannels) {
     // Use special kernel with reduced register pressure - only works on Ampere,
     // and only for fp16.
-    if (C <= kMaxResBlockFusingSeKFp16Ampere) {
+    int device, shared_mem_size;
+    ReportCUDAErrors(cudaGetDevice(&device));
+    ReportCUDAErrors(cudaDeviceGetAttribute(
+        &shared_mem_size, cudaDevAttrMaxSharedMemoryPerBlockOptin, device));
+    if (C <= kMaxResBlockFusingSeKFp16Ampere &&
+        shared_mem_size >= kMaxResBlockFusingSeFp16AmpereSmem) {
       cudaFuncSetAttribute(
           OutputInputTransformKernel_fp16_shmem_board<activation, use_bias,
                                                       use_skip>,
@@ -460,9 +471,11 @@ void OutputInputTransform(int N, int C, int se_K, T* output, const T* input,
               N, C, se_K, (half*)output, (const half*)input, (half*)skip,
               (half*)bias, (half*)w1, (half*)b1, (half*)w2, (half*)b2);
     } else {
-      throw Exception(
-          "res block fusing opt not supported for the given data type and no "
-          "of filters\n");
+      OutputTransform_SE_relu_InputTransform_large_kernel<half, activation,
+                                                          use_bias, use_skip>
+          <<<N, kOpSeInpTransformBlockSize, (C + se_K) * sizeof(float),
+             stream>>>(N, C, se_K, output, input, (half*)skip, bias, w1, b1,
+                       w2, b2);
     }
   } else {
     OutputTransform_SE_relu_InputTransform_kernel<half, activation, use_bias,
@@ -618,5 +631,51 @@ template void OutputInputTransform<half, false, ACTIVATION_MISH, true, false>(
     const half* bias, const half* w1, const half* b1, const half* w2,
     const half* b2, cudaStream_t stream);
 
+#if CUDART_VERSION >= 11080
+// Largest finite value of the E4M3 format.
+constexpr float kFp8E4M3Max = 448.0f;
+
+// Per-tensor absolute maximum. Non-negative floats order the same as their
+// bit patterns, so an integer atomicMax does the job.
+__global__ void absMax_kernel(float* amax, const half* input, int size) {
+  float m = 0.0f;
+  for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < size;
+       i += blockDim.x * gridDim.x) {
+    m = fmaxf(m, fabsf(__half2float(input[i])));
+  }
+  for (int offset = 16; offset > 0; offset /= 2) {
+    m = fmaxf(m, __shfl_xor_sync(0xFFFFFFFF, m, offset));
+  }
+  if ((threadIdx.x & 31) == 0) atomicMax((int*)amax, __float_as_int(m));
+}
+
+__global__ void quantizeFp8_kernel(__nv_fp8_e4m3* output, float* scale,
+                                   const half* input, int size,
+                                   const float* amax) {
+  const float a = *amax;
+  const float s = a > 0.0f ? kFp8E4M3Max / a : 1.0f;
+  const int tid = blockIdx.x * blockDim.x + threadIdx.x;
+  if (tid == 0) *scale = 1.0f / s;
+  for (int i = tid; i < size; i += blockDim.x * gridDim.x) {
+    output[i] = __nv_fp8_e4m3(__half2float(input[i]) * s);
+  }
+}
+#endif
+
+void quantizeFp8(void* output, float* scales, const half* input, int size,
+                 cudaStream_t stream) {
+#if CUDART_VERSION >= 11080
+  const int kBlockSize = 256;
+  const int blocks = std::min(DivUp(size, kBlockSize), 1024);
+  ReportCUDAErrors(cudaMemsetAsync(scales, 0, sizeof(float), stream));
+  absMax_kernel<<<blocks, kBlockSize, 0, stream>>>(scales, input, size);
+  quantizeFp8_kernel<<<blocks, kBlockSize, 0, stream>>>(
+      (__nv_fp8_e4m3*)output, scales + 1, input, size, scales);
+  ReportCUDAErrors(cudaGetLastError());
+#else
+  throw Exception("fp8 quantization needs CUDA 11.8 or later");
+#endif
+}
+
 }  // namespace cudnn_backend
 }  // namespace lczero
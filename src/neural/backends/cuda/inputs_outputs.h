@@ -27,6 +27,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include "neural/network.h"
 
 namespace lczero {
@@ -35,7 +37,8 @@ namespace cudnn_backend {
 struct InputsOutputs {
   InputsOutputs(int maxBatchSize, bool wdl, bool moves_left,
                 size_t tensor_mem_size = 0, size_t scratch_size = 0,
-                bool cublasDisableTensorCores = false) {
+                bool cublasDisableTensorCores = false)
+      : max_batch_size_(maxBatchSize) {
     ReportCUDAErrors(cudaHostAlloc(
         &input_masks_mem_, maxBatchSize * kInputPlanes * sizeof(uint64_t),
         cudaHostAllocMapped));
@@ -70,6 +73,12 @@ struct InputsOutputs {
                                                 op_moves_left_mem_, 0));
     }
 
+    ReportCUDAErrors(cudaHostAlloc(&done_flag_, sizeof(unsigned int),
+                                   cudaHostAllocMapped));
+    *done_flag_ = 0;
+    ReportCUDAErrors(cudaHostGetDevicePointer(
+        (void**)&done_flag_gpu_, (void*)done_flag_, 0));
+
     // memory for network execution managed inside this structure
     if (tensor_mem_size) {
       multi_stream_ = true;
@@ -96,6 +105,10 @@ struct InputsOutputs {
     ReportCUDAErrors(cudaFreeHost(op_value_mem_));
     if (op_moves_left_mem_ != nullptr)
       ReportCUDAErrors(cudaFreeHost(op_moves_left_mem_));
+    ReportCUDAErrors(cudaFreeHost((void*)done_flag_));
+    for (auto graph_exec : graphs_) {
+      if (graph_exec) cudaGraphExecDestroy(graph_exec);
+    }
 
     if (multi_stream_) {
       for (auto mem : tensor_mem_) {
@@ -110,6 +123,8 @@ struct InputsOutputs {
       cublasDestroy(cublas_);
     }
   }
+  // Number of samples the input and output buffers have room for.
+  const int max_batch_size_;
   uint64_t* input_masks_mem_;
   float* input_val_mem_;
   float* op_policy_mem_;
@@ -125,6 +140,12 @@ struct InputsOutputs {
   // This is a seperate copy.
   float* op_policy_mem_gpu_;
 
+  // Completion flag written by the GPU at the end of a batch, polled by the
+  // host with spin_wait, and the value it gets for the latest batch.
+  volatile unsigned int* done_flag_;
+  unsigned int* done_flag_gpu_;
+  unsigned int done_seq_ = 0;
+
   // memory needed to run the network owned by InputsOutputs when multi_stream
   // is enabled
   bool multi_stream_;
@@ -138,6 +159,13 @@ struct InputsOutputs {
 
   // cublas handle used to run the network
   cublasHandle_t cublas_;
+
+  // Forward pass graphs captured with these buffers, by padded batch size.
+  std::vector<cudaGraphExec_t> graphs_;
+  // Whether the network ran eagerly once, which the graph capture needs.
+  bool graphs_warm_ = false;
+  // Weights generation of the network the graphs were captured with.
+  int graphs_generation_ = 0;
 };
 
 }  // namespace cudnn_backend
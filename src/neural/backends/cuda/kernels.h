@@ -107,10 +107,11 @@ bool Se_Fp16_NHWC(int N, int C, int numFc1Out, half* output, const half* skip,
                   const half* w2, const half* b2, const half* bPrev,
                   ActivationFunction activation);
 
+// Gathers the policy through @indices, which holds the input index of each
+// output element.
 template <typename T>
 void PolicyMap(int N, T* output, const T* input, const short* indices,
-               int inputSize, int usedSize, int outputSize,
-               cudaStream_t stream);
+               int inputSize, int outputSize, cudaStream_t stream);
 
 // Custom winograd helper functions
 template <typename T>
@@ -142,6 +143,19 @@ void LayerNorm(int N, int C, T* output, const T* input, const T* bias,
                const T* skip, const T* gammas, const T* betas, float ep,
                float alpha, ActivationFunction act, cudaStream_t stream);
 
+// Whether SmolgenHidden() can handle the given layer sizes.
+bool CanFuseSmolgenHidden(int in_size, int hidden_size, int gen_size);
+
+// Both smolgen hidden dense layers with their layer norms in one kernel, one
+// sample per block: output = LN2(act(LN1(act(input * w1 + b1)) * w2 + b2)).
+// Reads all weights once per sample, so it only pays off at small batch.
+template <typename T>
+void SmolgenHidden(int N, T* output, const T* input, int in_size,
+                   int hidden_size, int gen_size, const T* w1, const T* b1,
+                   const T* gammas1, const T* betas1, const T* w2, const T* b2,
+                   const T* gammas2, const T* betas2, float ep,
+                   ActivationFunction act, cudaStream_t stream);
+
 template <typename T>
 void ComputePromotionLogits(int N, int C, T* output, const T* keys,
                             const T* ppo, const T* policy_attn_logits,
@@ -157,5 +171,17 @@ void inputPreprocessForAttentionBody(T* output, const T* input,
 template <typename T>
 void applyInputGating(T* output, const T* input, const T* mult, const T* add,
                       int N, int HW, int C, cudaStream_t stream);
+
+// Quantizes @size fp16 values to fp8 (E4M3) with a per-tensor scale. scales[0]
+// receives the absolute maximum of the input and scales[1] the factor that
+// dequantizes the output.
+void quantizeFp8(void* output, float* scales, const half* input, int size,
+                 cudaStream_t stream);
+
+// Writes @value to @flag (device pointer of mapped host memory) once the work
+// queued before it on @stream is done, so that the host can poll for the
+// completion of a batch instead of synchronizing with the stream.
+void signalCompletion(unsigned int* flag, unsigned int value,
+                      cudaStream_t stream);
 }  // namespace cudnn_backend
 }  // namespace lczero
@@ -26,15 +26,25 @@
 */
 #include "layers.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstring>
+#include <iomanip>
 #include <vector>
 
 #include "cuda_common.h"
 #include "kernels.h"
 #include "neural/network.h"
 #include "neural/tables/attention_policy_map.h"
+#include "tensor_parallel.h"
 #include "utils/fp16_utils.h"
+#include "utils/logging.h"
+
+#if defined(USE_CUBLASLT) && CUDART_VERSION >= 11080
+#include <cublasLt.h>
+#define USE_FP8_GEMM
+#endif
 
 namespace lczero {
 
@@ -679,15 +689,13 @@ PolicyMapLayer<DataType>::PolicyMapLayer(BaseLayer<DataType>* ip, int C, int H,
     : BaseLayer<DataType>(C, H, W, ip),
       used_size_(usedSize),
       attention_map_(attention) {
-  size_t weight_size = sizeof(short) * this->input_->GetC() * 64;
-  if (attention) weight_size = sizeof(short) * usedSize;
-  ReportCUDAErrors(cudaMalloc(&weights_, weight_size));
+  ReportCUDAErrors(cudaMalloc(&weights_, sizeof(short) * C * H * W));
 }
 
 template <typename DataType>
 void PolicyMapLayer<DataType>::LoadWeights(const short* cpuWeight,
                                            void* /*scratch*/) {
-  size_t weight_size = sizeof(short) * used_size_;
+  std::vector<short> map(cpuWeight, cpuWeight + used_size_);
 
   if (nhwc_ && !attention_map_) {
     // convert CHW to HWC
@@ -750,13 +758,18 @@ void PolicyMapLayer<DataType>::LoadWeights(const short* cpuWeight,
         else
           convertedWeights[hw * Cin + c] = -1;
       }
-    ReportCUDAErrors(cudaMemcpy(weights_, convertedWeights.data(),
-                                used_size_ * sizeof(short),
-                                cudaMemcpyHostToDevice));
-  } else {
-    ReportCUDAErrors(
-        cudaMemcpy(weights_, cpuWeight, weight_size, cudaMemcpyHostToDevice));
+    map = std::move(convertedWeights);
+  }
+
+  // The kernel gathers, so upload the inverse mapping: for every policy output
+  // the input element it is read from.
+  std::vector<short> gather(this->C * this->H * this->W, 0);
+  for (int i = 0; i < used_size_; i++) {
+    if (map[i] >= 0) gather[map[i]] = i;
   }
+  ReportCUDAErrors(cudaMemcpy(weights_, gather.data(),
+                              gather.size() * sizeof(short),
+                              cudaMemcpyHostToDevice));
 }
 
 template <typename DataType>
@@ -771,8 +784,8 @@ void PolicyMapLayer<DataType>::Eval(int N, DataType* output_tensor,
       this->input_->GetC() * this->input_->GetH() * this->input_->GetW();
   if (attention_map_) inputSize = used_size_;
   int outputSize = this->C * this->H * this->W;
-  PolicyMap(N, output_tensor, input_tensor, weights_, inputSize, used_size_,
-            outputSize, stream);
+  PolicyMap(N, output_tensor, input_tensor, weights_, inputSize, outputSize,
+            stream);
 }
 
 template <typename DataType>
@@ -1134,15 +1147,13 @@ template <typename DataType>
 ResidualBlock<DataType>::ResidualBlock(BaseLayer<DataType>* ip, int C, bool se,
                                        int se_k, bool use_gemm_ex, bool first,
 
-                                       bool last, ActivationFunction activation,
-                                       int shared_mem_size)
+                                       bool last, ActivationFunction activation)
     : BaseLayer<DataType>(C, 8, 8, ip, ip->isNHWC(), use_gemm_ex),
       has_se_(se),
       se_k_(se_k),
       c_input_(C),
       first_block_(first),
       last_block_(last),
-      shared_mem_size_(shared_mem_size),
       act_(activation) {
   if (act_ != ACTIVATION_RELU && act_ != ACTIVATION_MISH) {
     throw Exception("Unsupported activation for residual block.");
@@ -1319,12 +1330,6 @@ void ResidualBlock<DataType>::Eval(int N, DataType* output,
       transformed_input, transformed_weights1_, transformed_output, N * 4, C, C,
       36, cublas);
 
-  const bool fp16 = std::is_same<half, DataType>::value;
-  bool allowFusing =
-      (C <= kMaxResBlockFusingChannels) ||
-      (fp16 && (shared_mem_size_ >= kMaxResBlockFusingSeFp16AmpereSmem) &&
-       (C <= kMaxResBlockFusingSeKFp16Ampere));
-
   if (act_ == ACTIVATION_RELU) {
     if (last_block_) {
       if (has_se_)
@@ -1336,20 +1341,11 @@ void ResidualBlock<DataType>::Eval(int N, DataType* output,
                         false>(N, C, se_k_, output, transformed_output, input,
                                biases1_, w1_, b1_, w2_, b2_, stream);
     } else {
-      if (has_se_) {
-        if (allowFusing) {
-          OutputInputTransform<DataType, true, ACTIVATION_RELU, true, true>(
-              N, C, se_k_, output, transformed_output, input, biases1_, w1_,
-              b1_, w2_, b2_, stream);
-        } else {
-          OutputTransform<DataType, true, ACTIVATION_RELU, true, true, true,
-                          true>(N, C, se_k_, (DataType*)input,
-                                transformed_output, input, biases1_, w1_, b1_,
-                                w2_, b2_, stream);
-          InputTransform<DataType, true>(N, C, output, (DataType*)input,
-                                         stream);
-        }
-      } else
+      if (has_se_)
+        OutputInputTransform<DataType, true, ACTIVATION_RELU, true, true>(
+            N, C, se_k_, output, transformed_output, input, biases1_, w1_, b1_,
+            w2_, b2_, stream);
+      else
         OutputInputTransform<DataType, false, ACTIVATION_RELU, true, true>(
             N, C, se_k_, output, transformed_output, input, biases1_, w1_, b1_,
             w2_, b2_, stream);
@@ -1365,20 +1361,11 @@ void ResidualBlock<DataType>::Eval(int N, DataType* output,
                         false>(N, C, se_k_, output, transformed_output, input,
                                biases1_, w1_, b1_, w2_, b2_, stream);
     } else {
-      if (has_se_) {
-        if (allowFusing) {
-          OutputInputTransform<DataType, true, ACTIVATION_MISH, true, true>(
-              N, C, se_k_, output, transformed_output, input, biases1_, w1_,
-              b1_, w2_, b2_, stream);
-        } else {
-          OutputTransform<DataType, true, ACTIVATION_MISH, true, true, true,
-                          true>(N, C, se_k_, (DataType*)input,
-                                transformed_output, input, biases1_, w1_, b1_,
-                                w2_, b2_, stream);
-          InputTransform<DataType, true>(N, C, output, (DataType*)input,
-                                         stream);
-        }
-      } else
+      if (has_se_)
+        OutputInputTransform<DataType, true, ACTIVATION_MISH, true, true>(
+            N, C, se_k_, output, transformed_output, input, biases1_, w1_, b1_,
+            w2_, b2_, stream);
+      else
         OutputInputTransform<DataType, false, ACTIVATION_MISH, true, true>(
             N, C, se_k_, output, transformed_output, input, biases1_, w1_, b1_,
             w2_, b2_, stream);
@@ -1418,11 +1405,219 @@ void allocAndUpload(DataType** gpu_dest, std::vector<float> cpu_src,
                     (int)cpu_src.size(), 0);
 }
 
+namespace {
+// Quantized buffers start with their absolute maximum and scale, padded to
+// keep the fp8 data aligned for cuBLASLt.
+constexpr size_t kFp8ScalesSize = 256;
+// Only the first position of a batch is compared against fp16 in check mode.
+constexpr int kFp8CheckRows = 64;
+constexpr int kFp8CheckReportInterval = 1000;
+}  // namespace
+
+bool Fp8Gemm::Supported(int num_outputs, int num_inputs) {
+#ifdef USE_FP8_GEMM
+  // fp8 cuBLASLt gemms need all dimensions to be multiples of 16. The batch
+  // dimension always is, being a multiple of 64.
+  return num_outputs % 16 == 0 && num_inputs % 16 == 0;
+#else
+  (void)num_outputs;
+  (void)num_inputs;
+  return false;
+#endif
+}
+
+size_t Fp8Gemm::QuantizedSize(int size) { return kFp8ScalesSize + size; }
+
+void Fp8Gemm::Quantize(void* output, const half* input, int size,
+                       cudaStream_t stream) {
+  quantizeFp8((char*)output + kFp8ScalesSize, (float*)output, input, size,
+              stream);
+}
+
+Fp8Gemm::Fp8Gemm(const half* weights, int num_outputs, int num_inputs,
+                 const std::string& name, bool check)
+    : num_outputs_(num_outputs),
+      num_inputs_(num_inputs),
+      name_(name),
+      check_(check),
+      fp16_weights_(weights) {
+  if (!Supported(num_outputs, num_inputs)) {
+    throw Exception("fp8 gemm not supported for " + name_);
+  }
+  const int size = num_outputs * num_inputs;
+  ReportCUDAErrors(cudaMalloc(&weights_, QuantizedSize(size)));
+  Quantize(weights_, weights, size, 0);
+  ReportCUDAErrors(cudaDeviceSynchronize());
+  if (check_) {
+    ReportCUDAErrors(cudaMalloc(
+        &check_output_, kFp8CheckRows * num_outputs * sizeof(half)));
+  }
+}
+
+Fp8Gemm::~Fp8Gemm() {
+  ReportCUDAErrors(cudaFree(weights_));
+  if (check_output_) ReportCUDAErrors(cudaFree(check_output_));
+}
+
+void Fp8Gemm::Eval(int batch, half* output, const void* quantized,
+                   const half* input, cublasHandle_t cublas,
+                   cudaStream_t stream) const {
+#ifdef USE_FP8_GEMM
+  // A cuBLAS handle wraps a cuBLASLt one and can be used as such.
+  cublasLtHandle_t lt = (cublasLtHandle_t)cublas;
+  const float* a_scale = (const float*)weights_ + 1;
+  const float* b_scale = (const float*)quantized + 1;
+  const cublasOperation_t transa = CUBLAS_OP_T;
+  const cublasOperation_t transb = CUBLAS_OP_N;
+
+  cublasLtMatmulDesc_t desc;
+  ReportCUBLASErrors(
+      cublasLtMatmulDescCreate(&desc, CUBLAS_COMPUTE_32F, CUDA_R_32F));
+  ReportCUBLASErrors(cublasLtMatmulDescSetAttribute(
+      desc, CUBLASLT_MATMUL_DESC_TRANSA, &transa, sizeof(transa)));
+  ReportCUBLASErrors(cublasLtMatmulDescSetAttribute(
+      desc, CUBLASLT_MATMUL_DESC_TRANSB, &transb, sizeof(transb)));
+  ReportCUBLASErrors(cublasLtMatmulDescSetAttribute(
+      desc, CUBLASLT_MATMUL_DESC_A_SCALE_POINTER, &a_scale, sizeof(a_scale)));
+  ReportCUBLASErrors(cublasLtMatmulDescSetAttribute(
+      desc, CUBLASLT_MATMUL_DESC_B_SCALE_POINTER, &b_scale, sizeof(b_scale)));
+
+  // Same layout as the fp16 gemms: weights are num_inputs x num_outputs
+  // column major, used transposed.
+  cublasLtMatrixLayout_t a_layout, b_layout, c_layout;
+  ReportCUBLASErrors(cublasLtMatrixLayoutCreate(
+      &a_layout, CUDA_R_8F_E4M3, num_inputs_, num_outputs_, num_inputs_));
+  ReportCUBLASErrors(cublasLtMatrixLayoutCreate(
+      &b_layout, CUDA_R_8F_E4M3, num_inputs_, batch, num_inputs_));
+  ReportCUBLASErrors(cublasLtMatrixLayoutCreate(&c_layout, CUDA_R_16F,
+                                                num_outputs_, batch,
+                                                num_outputs_));
+
+  const float alpha = 1.0f;
+  const float beta = 0.0f;
+  ReportCUBLASErrors(cublasLtMatmul(
+      lt, desc, &alpha, (const char*)weights_ + kFp8ScalesSize, a_layout,
+      (const char*)quantized + kFp8ScalesSize, b_layout, &beta, output,
+      c_layout, output, c_layout, nullptr, nullptr, 0, stream));
+
+  ReportCUBLASErrors(cublasLtMatrixLayoutDestroy(c_layout));
+  ReportCUBLASErrors(cublasLtMatrixLayoutDestroy(b_layout));
+  ReportCUBLASErrors(cublasLtMatrixLayoutDestroy(a_layout));
+  ReportCUBLASErrors(cublasLtMatmulDescDestroy(desc));
+
+  if (check_) Check(batch, output, input, cublas, stream);
+#else
+  (void)batch;
+  (void)output;
+  (void)quantized;
+  (void)input;
+  (void)cublas;
+  (void)stream;
+  throw Exception("fp8 gemms are not available in this build");
+#endif
+}
+
+void Fp8Gemm::Check(int batch, const half* output, const half* input,
+                    cublasHandle_t cublas, cudaStream_t stream) const {
+  const int rows = std::min(batch, kFp8CheckRows);
+  const int size = rows * num_outputs_;
+  std::vector<uint16_t> got(size);
+  std::vector<uint16_t> want(size);
+
+  Mutex::Lock lock(check_mutex_);
+  const uint16_t alpha = FP32toFP16(1.0f);
+  const uint16_t beta = FP32toFP16(0.0f);
+  ReportCUBLASErrors(cublasHgemm(
+      cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs_, rows, num_inputs_,
+      (const half*)&alpha, fp16_weights_, num_inputs_, input, num_inputs_,
+      (const half*)&beta, check_output_, num_outputs_));
+  ReportCUDAErrors(cudaMemcpyAsync(got.data(), output, size * sizeof(half),
+                                   cudaMemcpyDeviceToHost, stream));
+  ReportCUDAErrors(cudaMemcpyAsync(want.data(), check_output_,
+                                   size * sizeof(half), cudaMemcpyDeviceToHost,
+                                   stream));
+  ReportCUDAErrors(cudaStreamSynchronize(stream));
+
+  // The relative error is taken against the largest reference output, as
+  // individual outputs close to zero make per element ratios meaningless.
+  float max_abs_error = 0.0f;
+  float max_ref = 0.0f;
+  for (int i = 0; i < size; i++) {
+    const float ref = FP16toFP32(want[i]);
+    max_abs_error =
+        std::max(max_abs_error, std::abs(FP16toFP32(got[i]) - ref));
+    max_ref = std::max(max_ref, std::abs(ref));
+  }
+  max_abs_error_ = std::max(max_abs_error_, max_abs_error);
+  if (max_ref > 0.0f) {
+    max_rel_error_ = std::max(max_rel_error_, max_abs_error / max_ref);
+  }
+  if (check_count_++ % kFp8CheckReportInterval == 0) {
+    CERR << std::scientific << std::setprecision(1) << "fp8 check " << name_
+         << ": maximum absolute error " << max_abs_error_ << ", relative "
+         << max_rel_error_ << " over " << check_count_ << " evaluations.";
+  }
+}
+
+// Uploads weights to the current device converting them on the host, for
+// GPUs other than the one with the scratch memory that allocAndUpload uses.
+template <typename DataType>
+static DataType* uploadConverted(const std::vector<float>& cpu_src) {
+  DataType* gpu_dest;
+  const size_t size = cpu_src.size() * sizeof(DataType);
+  ReportCUDAErrors(cudaMalloc(&gpu_dest, size));
+  if constexpr (std::is_same<half, DataType>::value) {
+    std::vector<uint16_t> converted(cpu_src.size());
+    std::transform(cpu_src.begin(), cpu_src.end(), converted.begin(),
+                   [](float f) { return FP32toFP16(f); });
+    ReportCUDAErrors(
+        cudaMemcpy(gpu_dest, converted.data(), size, cudaMemcpyHostToDevice));
+  } else {
+    ReportCUDAErrors(
+        cudaMemcpy(gpu_dest, cpu_src.data(), size, cudaMemcpyHostToDevice));
+  }
+  return gpu_dest;
+}
+
+// Returns the fp8 version of a fully connected layer, or null when fp8 is off
+// or not available for the data type or layer shape.
+template <typename DataType>
+static std::unique_ptr<Fp8Gemm> MakeFp8Gemm(Fp8Mode mode,
+                                            const DataType* weights,
+                                            int num_outputs, int num_inputs,
+                                            const std::string& name) {
+  if constexpr (std::is_same<half, DataType>::value) {
+    if (mode != Fp8Mode::kOff && Fp8Gemm::Supported(num_outputs, num_inputs)) {
+      return std::make_unique<Fp8Gemm>(weights, num_outputs, num_inputs, name,
+                                       mode == Fp8Mode::kCheck);
+    }
+  }
+  return nullptr;
+}
+
+// fp8 gemms only exist for fp16, these are no-ops otherwise.
+template <typename DataType>
+static void fp8Quantize(void* output, const DataType* input, int size,
+                        cudaStream_t stream) {
+  if constexpr (std::is_same<half, DataType>::value) {
+    Fp8Gemm::Quantize(output, input, size, stream);
+  }
+}
+
+template <typename DataType>
+static void fp8Gemm(const Fp8Gemm& gemm, int batch, DataType* output,
+                    const void* quantized, const DataType* input,
+                    cublasHandle_t cublas, cudaStream_t stream) {
+  if constexpr (std::is_same<half, DataType>::value) {
+    gemm.Eval(batch, output, quantized, input, cublas, stream);
+  }
+}
+
 template <typename DataType>
 AttentionPolicyHead<DataType>::AttentionPolicyHead(
     BaseLayer<DataType>* ip, const MultiHeadWeights::PolicyHead& weights,
     void* scratch, bool attention_body, ActivationFunction act,
-    int max_batch_size)
+    int max_batch_size, Fp8Mode fp8_mode)
     : BaseLayer<DataType>(64 * 64 + 24 * 8, 1, 1, ip),
       attention_body_(attention_body),
       // Old networks without attention body (e.g. T79) use hardcoded SELU
@@ -1437,6 +1632,10 @@ AttentionPolicyHead<DataType>::AttentionPolicyHead(
 
   allocAndUpload<DataType>(&ip_pol_w_, weights.ip_pol_w, scratch);
   allocAndUpload<DataType>(&ip_pol_b_, weights.ip_pol_b, scratch);
+  fp8_embedding_ = MakeFp8Gemm(fp8_mode, ip_pol_w_, embedding_op_size_,
+                               (int)(weights.ip_pol_w.size() /
+                                     weights.ip_pol_b.size()),
+                               "policy embedding");
 
   allocAndUpload<DataType>(&ip2_pol_w_, weights.ip2_pol_w, scratch);
   allocAndUpload<DataType>(&ip2_pol_b_, weights.ip2_pol_b, scratch);
@@ -1474,8 +1673,10 @@ AttentionPolicyHead<DataType>::AttentionPolicyHead(
         nullptr, 0,  // smolgen weights not implemented in
                      // policy encoder heads yet.
         max_batch_size, ACTIVATION_SWISH, act_,
-        1e-6);  // attentionbody nets don't have policy encoders, so using old
-                // epsilon for backward compatibility with T78.
+        1e-6,  // attentionbody nets don't have policy encoders, so using old
+               // epsilon for backward compatibility with T78.
+        fp8_mode,
+        "policy encoder " + std::to_string(encoder_weights_.size()), nullptr);
     encoder_weights_.emplace_back(pW);
   }
 }
@@ -1485,7 +1686,8 @@ EncoderBlock<DataType>::EncoderBlock(
     const MultiHeadWeights::EncoderLayer& cpu_weights, void* scratch, int heads,
     int size, float alpha, DataType* smolgen_global_scratch,
     int smolgen_global_size, int max_batch_size, ActivationFunction smolgen_act,
-    ActivationFunction ffn_act, float default_eps)
+    ActivationFunction ffn_act, float default_eps, Fp8Mode fp8_mode,
+    const std::string& name, TensorParallelGroup<DataType>* tp)
     : embedding_op_size_(size),
       encoder_heads_(heads),
       alpha_(alpha),
@@ -1493,7 +1695,8 @@ EncoderBlock<DataType>::EncoderBlock(
       has_smolgen_(cpu_weights.mha.has_smolgen),
       smolgen_activation_(smolgen_act),
       ffn_activation_(ffn_act),
-      max_batch_size_(max_batch_size) {
+      max_batch_size_(max_batch_size),
+      tp_(tp) {
   mha_q_size_ = cpu_weights.mha.q_b.size();
   mha_k_size_ = cpu_weights.mha.k_b.size();
   mha_v_size_ = cpu_weights.mha.v_b.size();
@@ -1578,6 +1781,51 @@ EncoderBlock<DataType>::EncoderBlock(
     // GPU memory already allocated in AttentionBody.
     smol_global = smolgen_global_scratch;
   }
+
+  if (Fp8Gemm::Supported(mha_q_size_, embedding_op_size_) &&
+      Fp8Gemm::Supported(embedding_op_size_, mha_q_size_) &&
+      Fp8Gemm::Supported(ffn_dense1_size_, embedding_op_size_) &&
+      Fp8Gemm::Supported(embedding_op_size_, ffn_dense1_size_)) {
+    fp8_q_ = MakeFp8Gemm(fp8_mode, mha_q_w, mha_q_size_, embedding_op_size_,
+                         name + " q");
+    fp8_k_ = MakeFp8Gemm(fp8_mode, mha_k_w, mha_k_size_, embedding_op_size_,
+                         name + " k");
+    fp8_v_ = MakeFp8Gemm(fp8_mode, mha_v_w, mha_v_size_, embedding_op_size_,
+                         name + " v");
+    fp8_dense_ = MakeFp8Gemm(fp8_mode, mha_dense_w, embedding_op_size_,
+                             mha_q_size_, name + " mha dense");
+    fp8_ffn1_ = MakeFp8Gemm(fp8_mode, ffn_dense1_w, ffn_dense1_size_,
+                            embedding_op_size_, name + " ffn dense1");
+    fp8_ffn2_ = MakeFp8Gemm(fp8_mode, ffn_dense2_w, embedding_op_size_,
+                            ffn_dense1_size_, name + " ffn dense2");
+  }
+
+  if (tp_) {
+    // The peers' shards: columns of dense1 (contiguous, one row of weights
+    // per hidden unit) and the matching rows of dense2.
+    const int d = embedding_op_size_;
+    const int dff = ffn_dense1_size_;
+    const auto& w1 = cpu_weights.ffn.dense1_w;
+    const auto& b1 = cpu_weights.ffn.dense1_b;
+    const auto& w2 = cpu_weights.ffn.dense2_w;
+    for (int i = 1; i < tp_->size(); i++) {
+      const int begin = tp_->ShardBegin(i, dff);
+      const int end = tp_->ShardBegin(i + 1, dff);
+      std::vector<float> dense2;
+      dense2.reserve((size_t)d * (end - begin));
+      for (int o = 0; o < d; o++) {
+        dense2.insert(dense2.end(), w2.begin() + (size_t)o * dff + begin,
+                      w2.begin() + (size_t)o * dff + end);
+      }
+      ReportCUDAErrors(cudaSetDevice(tp_->peers()[i - 1].gpu));
+      tp_dense1_w_.push_back(uploadConverted<DataType>(std::vector<float>(
+          w1.begin() + (size_t)begin * d, w1.begin() + (size_t)end * d)));
+      tp_dense1_b_.push_back(uploadConverted<DataType>(
+          std::vector<float>(b1.begin() + begin, b1.begin() + end)));
+      tp_dense2_w_.push_back(uploadConverted<DataType>(dense2));
+    }
+    ReportCUDAErrors(cudaSetDevice(tp_->gpu()));
+  }
 }
 
 template <typename DataType>
@@ -1642,6 +1890,47 @@ static void cublasXGemmBatched(cublasHandle_t handle, cublasOperation_t transa,
   }
 }
 
+template <typename DataType>
+void EncoderBlock<DataType>::TensorParallelFFN(int N, DataType* input,
+                                               DataType* hidden,
+                                               DataType* output,
+                                               cublasHandle_t cublas,
+                                               cudaStream_t stream) const {
+  const int d = embedding_op_size_;
+  const int dff = ffn_dense1_size_;
+  const int batch = N * 64;
+  tp_->Broadcast(input, (size_t)batch * d, stream);
+
+  // Peers first, so that they run while this GPU computes its own shard.
+  for (int i = 1; i < tp_->size(); i++) {
+    const auto& peer = tp_->peers()[i - 1];
+    const int size = tp_->ShardBegin(i + 1, dff) - tp_->ShardBegin(i, dff);
+    ReportCUDAErrors(cudaSetDevice(peer.gpu));
+    cublasXgemm(peer.cublas, CUBLAS_OP_T, CUBLAS_OP_N, size, batch, d, 1.0f,
+                (const DataType*)tp_dense1_w_[i - 1], d, peer.input, d, 0.0f,
+                peer.hidden, size);
+    addBiasBatched(peer.hidden, peer.hidden, tp_dense1_b_[i - 1], 1, batch,
+                   size, ffn_activation_, peer.stream);
+    cublasXgemm(peer.cublas, CUBLAS_OP_T, CUBLAS_OP_N, d, batch, size, 1.0f,
+                (const DataType*)tp_dense2_w_[i - 1], size, peer.hidden, size,
+                0.0f, peer.output, d);
+  }
+  ReportCUDAErrors(cudaSetDevice(tp_->gpu()));
+
+  // Shard 0 uses the leading part of the full weights; dense2 keeps its
+  // leading dimension to only read the first rows.
+  const int size = tp_->ShardBegin(1, dff);
+  cublasXgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, size, batch, d, 1.0f,
+              (const DataType*)ffn_dense1_w, d, input, d, 0.0f, hidden, size);
+  addBiasBatched(hidden, hidden, ffn_dense1_b, 1, batch, size, ffn_activation_,
+                 stream);
+  cublasXgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, d, batch, size, 1.0f,
+              (const DataType*)ffn_dense2_w, dff, hidden, size, 0.0f, output,
+              d);
+
+  tp_->Reduce(output, (size_t)batch * d, stream);
+}
+
 // input/output tensor is in_out_tensor, others are used as scratch.
 template <typename DataType>
 void EncoderBlock<DataType>::Eval(int N, DataType* in_out_tensor,
@@ -1668,7 +1957,20 @@ void EncoderBlock<DataType>::Eval(int N, DataType* in_out_tensor,
           num_inputs, 0.0f, scratch, num_outputs);
     }
 
-    {
+    // At small batch both hidden layers run in one kernel, which leaves
+    // gen_from in buffer1 instead of scratch.
+    const bool fused_hidden = N <= kMaxSmolgenHiddenBatch &&
+                              CanFuseSmolgenHidden(64 * smol_compress_size_,
+                                                   smol_dense_1_size_,
+                                                   smol_dense_2_size_);
+    if (fused_hidden) {
+      SmolgenHidden<DataType>(N, buffer1, scratch, 64 * smol_compress_size_,
+                              smol_dense_1_size_, smol_dense_2_size_,
+                              smol_dense1_w, smol_dense1_b, smol_ln1_gammas,
+                              smol_ln1_betas, smol_dense2_w, smol_dense2_b,
+                              smol_ln2_gammas, smol_ln2_betas, 1e-3,
+                              smolgen_activation_, stream);
+    } else {
       // Hidden 1 dense.
       // input shape: N, 64 * hidden_channels
       // output shape: N, hidden_sz
@@ -1685,7 +1987,7 @@ void EncoderBlock<DataType>::Eval(int N, DataType* in_out_tensor,
                           1e-3, 1.0, smolgen_activation_, stream);
     }
 
-    {
+    if (!fused_hidden) {
       // Hidden 2 dense (gen_from)
       // input shape: N, hidden_sz
       // output shape: N, heads * gen_sz
@@ -1714,8 +2016,9 @@ void EncoderBlock<DataType>::Eval(int N, DataType* in_out_tensor,
       const int batch = N * encoder_heads_;
       cublasXgemm<DataType>(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs,
                             batch, num_inputs, 1.0f,
-                            (const DataType*)smol_global, num_inputs, scratch,
-                            num_inputs, 0.0f, buffer2, num_outputs);
+                            (const DataType*)smol_global, num_inputs,
+                            fused_hidden ? buffer1 : scratch, num_inputs, 0.0f,
+                            buffer2, num_outputs);
     }
   }
 
@@ -1733,10 +2036,18 @@ void EncoderBlock<DataType>::Eval(int N, DataType* in_out_tensor,
     mha_k = mha_q + num_outputs * max_batch;
     mha_v = mha_k + num_outputs * max_batch;
 
-    cublasXGemmStridedBatched<DataType>(
-        cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch, num_inputs, 1.0f,
-        mha_qkv_w, num_inputs, num_inputs * num_outputs, in_out_tensor,
-        num_inputs, 0, 0.0f, mha_q, num_outputs, num_outputs * max_batch, 3);
+    if (fp8_q_) {
+      // buffer1 is free until the attention logits.
+      fp8Quantize(buffer1, in_out_tensor, batch * num_inputs, stream);
+      fp8Gemm(*fp8_q_, batch, mha_q, buffer1, in_out_tensor, cublas, stream);
+      fp8Gemm(*fp8_k_, batch, mha_k, buffer1, in_out_tensor, cublas, stream);
+      fp8Gemm(*fp8_v_, batch, mha_v, buffer1, in_out_tensor, cublas, stream);
+    } else {
+      cublasXGemmStridedBatched<DataType>(
+          cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch, num_inputs,
+          1.0f, mha_qkv_w, num_inputs, num_inputs * num_outputs, in_out_tensor,
+          num_inputs, 0, 0.0f, mha_q, num_outputs, num_outputs * max_batch, 3);
+    }
     addBiasBatched<DataType>(mha_q, mha_q, mha_qkv_b, 3, batch, num_outputs,
                              max_batch, ACTIVATION_NONE, stream);
   }
@@ -1842,9 +2153,15 @@ void EncoderBlock<DataType>::Eval(int N, DataType* in_out_tensor,
     const int num_inputs = d_model;
     const int num_outputs = embedding_op_size_;
     const int batch = N * 64;
-    cublasXgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch,
-                num_inputs, 1.0f, (const DataType*)mha_dense_w, num_inputs,
-                buffer2, num_inputs, 0.0f, buffer1, num_outputs);
+    if (fp8_dense_) {
+      // q, k and v in scratch are no longer needed.
+      fp8Quantize(scratch, buffer2, batch * num_inputs, stream);
+      fp8Gemm(*fp8_dense_, batch, buffer1, scratch, buffer2, cublas, stream);
+    } else {
+      cublasXgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch,
+                  num_inputs, 1.0f, (const DataType*)mha_dense_w, num_inputs,
+                  buffer2, num_inputs, 0.0f, buffer1, num_outputs);
+    }
   }
 
   // LN1: skip connection and layer normalization (also bias add of prev gemm)
@@ -1853,26 +2170,43 @@ void EncoderBlock<DataType>::Eval(int N, DataType* in_out_tensor,
                       in_out_tensor, ln1_gammas, ln1_betas, default_eps_,
                       alpha_, ACTIVATION_NONE, stream);
 
-  // #FFN dense 1, scratch -> in_out_tensor
-  {
-    const int num_inputs = embedding_op_size_;
-    const int num_outputs = ffn_dense1_size_;  // encoder_dff
-    const int batch = N * 64;
-    cublasXgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch,
-                num_inputs, 1.0f, (const DataType*)ffn_dense1_w, num_inputs,
-                scratch, num_inputs, 0.0f, in_out_tensor, num_outputs);
-    addBiasBatched(in_out_tensor, in_out_tensor, ffn_dense1_b, 1, batch,
-                   num_outputs, ffn_activation_, stream);
-  }
+  if (tp_) {
+    // #FFN sharded over the tensor parallel group, scratch -> buffer1
+    TensorParallelFFN(N, scratch, in_out_tensor, buffer1, cublas, stream);
+  } else {
+    // #FFN dense 1, scratch -> in_out_tensor
+    {
+      const int num_inputs = embedding_op_size_;
+      const int num_outputs = ffn_dense1_size_;  // encoder_dff
+      const int batch = N * 64;
+      if (fp8_ffn1_) {
+        fp8Quantize(buffer2, scratch, batch * num_inputs, stream);
+        fp8Gemm(*fp8_ffn1_, batch, in_out_tensor, buffer2, scratch, cublas,
+                stream);
+      } else {
+        cublasXgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch,
+                    num_inputs, 1.0f, (const DataType*)ffn_dense1_w, num_inputs,
+                    scratch, num_inputs, 0.0f, in_out_tensor, num_outputs);
+      }
+      addBiasBatched(in_out_tensor, in_out_tensor, ffn_dense1_b, 1, batch,
+                     num_outputs, ffn_activation_, stream);
+    }
 
-  // #FFN dense 2, in_out_tensor -> buffer1
-  {
-    const int num_inputs = ffn_dense1_size_;  // encoder_dff
-    const int num_outputs = embedding_op_size_;
-    const int batch = N * 64;
-    cublasXgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch,
-                num_inputs, 1.0f, (const DataType*)ffn_dense2_w, num_inputs,
-                in_out_tensor, num_inputs, 0.0f, buffer1, num_outputs);
+    // #FFN dense 2, in_out_tensor -> buffer1
+    {
+      const int num_inputs = ffn_dense1_size_;  // encoder_dff
+      const int num_outputs = embedding_op_size_;
+      const int batch = N * 64;
+      if (fp8_ffn2_) {
+        fp8Quantize(buffer2, in_out_tensor, batch * num_inputs, stream);
+        fp8Gemm(*fp8_ffn2_, batch, buffer1, buffer2, in_out_tensor, cublas,
+                stream);
+      } else {
+        cublasXgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch,
+                    num_inputs, 1.0f, (const DataType*)ffn_dense2_w, num_inputs,
+                    in_out_tensor, num_inputs, 0.0f, buffer1, num_outputs);
+      }
+    }
   }
 
   // LN2: skip connection and layer normilization (also bias add of prev gemm)
@@ -1902,11 +2236,20 @@ void AttentionPolicyHead<DataType>::Eval(
     const int num_outputs = embedding_op_size_;
     const int num_inputs = inputC;
     const int batch = N * 64;
-    cublasXgemm<DataType>(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch,
-                          num_inputs, 1.0f, (const DataType*)ip_pol_w_,
-                          num_inputs,
-                          attention_body_ ? input : (DataType*)scratch,
-                          num_inputs, 0.0f, pol_embedding, num_outputs);
+    const DataType* embedding_input =
+        attention_body_ ? input : (DataType*)scratch;
+    if (fp8_embedding_) {
+      // buffer2 is only used by the encoder layers.
+      fp8Quantize(buffer2, embedding_input, batch * num_inputs, stream);
+      fp8Gemm(*fp8_embedding_, batch, pol_embedding, buffer2, embedding_input,
+              cublas, stream);
+    } else {
+      cublasXgemm<DataType>(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs,
+                            batch, num_inputs, 1.0f,
+                            (const DataType*)ip_pol_w_, num_inputs,
+                            embedding_input, num_inputs, 0.0f, pol_embedding,
+                            num_outputs);
+    }
     addBiasBatched(pol_embedding, pol_embedding, ip_pol_b_, 1, batch,
                    num_outputs, act_, stream);
   }
@@ -2008,6 +2351,9 @@ EncoderBlock<DataType>::~EncoderBlock() {
     ReportCUDAErrors(cudaFree(smol_ln2_gammas));
     ReportCUDAErrors(cudaFree(smol_ln2_betas));
   }
+  for (auto mem : tp_dense1_w_) ReportCUDAErrors(cudaFree(mem));
+  for (auto mem : tp_dense1_b_) ReportCUDAErrors(cudaFree(mem));
+  for (auto mem : tp_dense2_w_) ReportCUDAErrors(cudaFree(mem));
 }
 
 template <typename DataType>
@@ -2045,7 +2391,9 @@ AttentionBody<DataType>::AttentionBody(const MultiHeadWeights& weights,
                                        void* scratch, Activations activations,
                                        int num_res_blocks, int input_c,
                                        int max_batch_size,
-                                       bool is_pe_dense_embedding)
+                                       bool is_pe_dense_embedding,
+                                       Fp8Mode fp8_mode,
+                                       TensorParallelGroup<DataType>* tp)
     : BaseLayer<DataType>(weights.ip_emb_b.size(), 8, 8, nullptr),
       embedding_op_size_(weights.ip_emb_b.size()),
       encoder_head_count_(weights.encoder_head_count),
@@ -2110,7 +2458,8 @@ AttentionBody<DataType>::AttentionBody(const MultiHeadWeights& weights,
         enc, scratch, encoder_head_count_, embedding_op_size_, alpha,
         smolgen_global_, smolgen_global_size_, max_batch_size,
         activations_.smolgen_activation, activations_.ffn_activation,
-        is_pe_dense_embedding_ ? 1e-3 : 1e-6);
+        is_pe_dense_embedding_ ? 1e-3 : 1e-6, fp8_mode,
+        "encoder " + std::to_string(encoder_weights_.size()), tp);
     encoder_weights_.emplace_back(pW);
   }
 }
@@ -2488,5 +2837,22 @@ void CudaError(cudaError_t status, const char* file, const int& line) {
   }
 }
 
+int GetDeviceCount() {
+  int count = 0;
+  if (cudaGetDeviceCount(&count) != cudaSuccess) return 0;
+  return count;
+}
+
+#ifdef USE_NCCL
+void NcclError(ncclResult_t status, const char* file, const int& line) {
+  if (status != ncclSuccess) {
+    char message[128];
+    sprintf(message, "NCCL error: %s (%s:%d) ", ncclGetErrorString(status),
+            file, line);
+    throw Exception(message);
+  }
+}
+#endif
+
 }  // namespace cudnn_backend
 }  // namespace lczero
@@ -29,10 +29,14 @@
 #include <cublas_v2.h>
 
 #include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include "cuda_common.h"
 #include "neural/network_legacy.h"
 #include "neural/tables/activation_function.h"
+#include "utils/mutex.h"
 
 #ifdef USE_CUDNN
 #include <cudnn.h>
@@ -43,6 +47,9 @@ typedef void* cudnnHandle_t;
 namespace lczero {
 namespace cudnn_backend {
 
+template <typename DataType>
+class TensorParallelGroup;
+
 // The Layer objects only hold memory for weights, biases, etc
 // memory for input and output tensors is provided by caller of Eval.
 
@@ -300,7 +307,7 @@ class ResidualBlock : public BaseLayer<DataType> {
  public:
   ResidualBlock(BaseLayer<DataType>* ip, int C, bool se, int se_k,
                 bool use_gemm_ex, bool first, bool last,
-                ActivationFunction activation, int shared_mem_size);
+                ActivationFunction activation);
 
   ~ResidualBlock();
   void LoadWeights0(float* pfilter, float* pBias, void* scratch);
@@ -318,7 +325,6 @@ class ResidualBlock : public BaseLayer<DataType> {
   const int c_input_;
   const bool first_block_;
   const bool last_block_;
-  const int shared_mem_size_;
   const ActivationFunction act_;
 
   DataType* biases0_ = nullptr;
@@ -333,6 +339,55 @@ class ResidualBlock : public BaseLayer<DataType> {
   DataType* b2_;
 };
 
+// Precision of the fully connected gemms of the encoder blocks in fp16 mode.
+enum class Fp8Mode {
+  kOff,    // Plain fp16 gemms.
+  kOn,     // fp8 (E4M3) weights and activations, fp16 outputs.
+  kCheck,  // fp8, and every gemm is compared against the fp16 one.
+};
+
+// A fully connected layer with its weights quantized to fp8 (E4M3) with a
+// single per-tensor scale, evaluated by cuBLASLt on the fp8 tensor cores.
+// Activations are quantized on the fly, also with a per-tensor scale.
+class Fp8Gemm {
+ public:
+  // Whether fp8 gemms are compiled in and usable for a layer of this shape.
+  static bool Supported(int num_outputs, int num_inputs);
+  // Bytes of scratch needed to hold @size quantized values and their scales.
+  static size_t QuantizedSize(int size);
+  // Quantizes @size values of @input into @output (of QuantizedSize(size)).
+  static void Quantize(void* output, const half* input, int size,
+                       cudaStream_t stream);
+
+  Fp8Gemm(const half* weights, int num_outputs, int num_inputs,
+          const std::string& name, bool check);
+  ~Fp8Gemm();
+
+  // output (batch x num_outputs) = input (batch x num_inputs) * weights, with
+  // input already quantized into @quantized. The fp16 @input is only used for
+  // the reference gemm in check mode.
+  void Eval(int batch, half* output, const void* quantized, const half* input,
+            cublasHandle_t cublas, cudaStream_t stream) const;
+
+ private:
+  void Check(int batch, const half* output, const half* input,
+             cublasHandle_t cublas, cudaStream_t stream) const;
+
+  const int num_outputs_;
+  const int num_inputs_;
+  const std::string name_;
+  const bool check_;
+  void* weights_ = nullptr;  // Scales followed by the fp8 weights.
+  const half* fp16_weights_;
+
+  // Check mode state, shared by all the streams using the layer.
+  mutable Mutex check_mutex_;
+  half* check_output_ GUARDED_BY(check_mutex_) = nullptr;
+  mutable int check_count_ GUARDED_BY(check_mutex_) = 0;
+  mutable float max_abs_error_ GUARDED_BY(check_mutex_) = 0.0f;
+  mutable float max_rel_error_ GUARDED_BY(check_mutex_) = 0.0f;
+};
+
 template <typename DataType>
 class EncoderBlock {
  public:
@@ -340,13 +395,21 @@ class EncoderBlock {
                int heads, int size, float alpha,
                DataType* smolgen_global_scratch, int smolgen_global_size,
                int max_batch_size, ActivationFunction smolgen_act,
-               ActivationFunction ffn_act, float default_eps);
+               ActivationFunction ffn_act, float default_eps,
+               Fp8Mode fp8_mode, const std::string& name,
+               TensorParallelGroup<DataType>* tp);
   ~EncoderBlock();
 
   void Eval(int N, DataType* inpop, DataType* scratch0, DataType* scratch1,
             DataType* scratch2, cublasHandle_t cublas, cudaStream_t stream,
             DataType*** offset_pointers) const;
 
+  // FFN (without the final bias) of input into output, split over the tensor
+  // parallel group. hidden holds this GPU's slice of the hidden layer.
+  void TensorParallelFFN(int N, DataType* input, DataType* hidden,
+                         DataType* output, cublasHandle_t cublas,
+                         cudaStream_t stream) const;
+
   // all GPU side pointers
   DataType *mha_q_w, *mha_q_b;
   DataType *mha_k_w, *mha_k_b;
@@ -393,6 +456,16 @@ class EncoderBlock {
   int smol_global_size_;
 
   const int max_batch_size_;
+
+  // fp8 copies of the q/k/v, mha dense and ffn weights, null when disabled
+  // (all of them are, or none).
+  std::unique_ptr<Fp8Gemm> fp8_q_, fp8_k_, fp8_v_;
+  std::unique_ptr<Fp8Gemm> fp8_dense_;
+  std::unique_ptr<Fp8Gemm> fp8_ffn1_, fp8_ffn2_;
+
+  // FFN shards of the tensor parallel peers, one per peer on its GPU.
+  TensorParallelGroup<DataType>* const tp_;
+  std::vector<DataType*> tp_dense1_w_, tp_dense1_b_, tp_dense2_w_;
 };
 
 // The Attention policy head implementation
@@ -411,7 +484,8 @@ class AttentionPolicyHead : public BaseLayer<DataType> {
   AttentionPolicyHead(BaseLayer<DataType>* ip,
                       const MultiHeadWeights::PolicyHead& weights,
                       void* scratch, bool attention_body,
-                      ActivationFunction act, int max_batch_size);
+                      ActivationFunction act, int max_batch_size,
+                      Fp8Mode fp8_mode);
   ~AttentionPolicyHead();
   void Eval(int N, DataType* output, const DataType* input,
             const DataType* input2, void* scratch, size_t scratch_size,
@@ -437,6 +511,7 @@ class AttentionPolicyHead : public BaseLayer<DataType> {
   ActivationFunction act_;
 
   std::vector<EncoderBlock<DataType>*> encoder_weights_;
+  std::unique_ptr<Fp8Gemm> fp8_embedding_;
 };
 
 template <typename DataType>
@@ -476,7 +551,8 @@ class AttentionBody : public BaseLayer<DataType> {
  public:
   AttentionBody(const MultiHeadWeights& weights, void* scratch,
                 Activations activations, int num_res_blocks, int input_c,
-                int max_batch_size, bool is_pe_dense_embedding);
+                int max_batch_size, bool is_pe_dense_embedding,
+                Fp8Mode fp8_mode, TensorParallelGroup<DataType>* tp);
   ~AttentionBody();
   void Eval(int N, DataType* output, const DataType* input,
             const DataType* input2, void* scratch, size_t scratch_size,
@@ -26,10 +26,12 @@
 */
 #include <algorithm>
 #include <cassert>
+#include <cstdio>
 #include <functional>
 #include <list>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 
 #include "cuda_common.h"
 #include "inputs_outputs.h"
@@ -39,8 +41,11 @@
 #include "neural/network_legacy.h"
 #include "neural/tables/attention_policy_map.h"
 #include "neural/tables/policy_map.h"
+#include "tensor_parallel.h"
 #include "utils/bititer.h"
 #include "utils/exception.h"
+#include "utils/mutex.h"
+#include "utils/numa.h"
 
 namespace lczero {
 using namespace cudnn_backend;
@@ -140,6 +145,14 @@ class CudaNetworkComputation : public NetworkComputation {
     batch_size_++;
   }
 
+  InputPlanesView GetInputBuffer(int sample) override {
+    if (sample >= inputs_outputs_->max_batch_size_) return {};
+    return {&inputs_outputs_->input_masks_mem_[sample * kInputPlanes],
+            &inputs_outputs_->input_val_mem_[sample * kInputPlanes]};
+  }
+
+  void AddWrittenInput() override { batch_size_++; }
+
   void ComputeBlocking() override;
 
   int GetBatchSize() const override { return batch_size_; }
@@ -164,6 +177,11 @@ class CudaNetworkComputation : public NetworkComputation {
     return inputs_outputs_->op_policy_mem_[sample * kNumOutputPolicy + move_id];
   }
 
+  std::span<const float> GetPolicyView(int sample) const override {
+    return {&inputs_outputs_->op_policy_mem_[sample * kNumOutputPolicy],
+            static_cast<size_t>(kNumOutputPolicy)};
+  }
+
   float GetMVal(int sample) const override {
     if (moves_left_) {
       return inputs_outputs_->op_moves_left_mem_[sample];
@@ -171,12 +189,15 @@ class CudaNetworkComputation : public NetworkComputation {
     return 0.0f;
   }
 
+  void SetOutputHeads(OutputHeads heads) override { heads_ = heads; }
+
  private:
   // Memory holding inputs, outputs.
   std::unique_ptr<InputsOutputs> inputs_outputs_;
   int batch_size_;
   bool wdl_;
   bool moves_left_;
+  OutputHeads heads_;
 
   CudaNetwork<DataType>* network_;
 };
@@ -219,6 +240,11 @@ class CudaNetwork : public Network {
     cudaDeviceProp deviceProp = {};
     cudaGetDeviceProperties(&deviceProp, gpu_id_);
     showDeviceInfo(deviceProp);
+    char pci_address[16];
+    snprintf(pci_address, sizeof(pci_address), "%04x:%02x:%02x.0",
+             deviceProp.pciDomainID, deviceProp.pciBusID,
+             deviceProp.pciDeviceID);
+    Numa::SetGpuPciDevice(pci_address);
 
     l2_cache_size_ = deviceProp.l2CacheSize;
     sm_count_ = deviceProp.multiProcessorCount;
@@ -230,6 +256,47 @@ class CudaNetwork : public Network {
 
     multi_stream_ = options.GetOrDefault<bool>("multi_stream", false);
 
+    // Polls a flag the GPU writes to mapped memory at the end of each batch,
+    // instead of a blocking stream/device synchronization. Trades a busy
+    // search thread for lower latency.
+    spin_wait_ = options.GetOrDefault<bool>("spin_wait", false);
+
+    // Captures the forward pass into a CUDA graph per batch size bucket and
+    // replays it, to save the launch overhead of the individual kernels.
+    use_graphs_ = options.GetOrDefault<bool>("cuda_graphs", false);
+#if CUDART_VERSION < 11040
+    if (use_graphs_) {
+      CERR << "WARNING: cuda_graphs needs CUDA 11.4 or later, disabled.";
+      use_graphs_ = false;
+    }
+#endif
+    if (use_graphs_ && allow_cache_opt_) {
+      CERR << "WARNING: cuda_graphs can't be used with cache_opt, disabled.";
+      use_graphs_ = false;
+    }
+
+    // Shards the encoder FFNs of attention body nets over this and the next
+    // tensor_parallel - 1 GPUs, to cut the latency of a batch.
+    tensor_parallel_size_ = options.GetOrDefault<int>("tensor_parallel", 1);
+    if (tensor_parallel_size_ < 1 || tensor_parallel_size_ > 8) {
+      throw Exception("tensor_parallel must be between 1 and 8.");
+    }
+    if (gpu_id_ + tensor_parallel_size_ > total_gpus) {
+      throw Exception("Not enough GPUs for tensor_parallel=" +
+                      std::to_string(tensor_parallel_size_) + " from GPU " +
+                      std::to_string(gpu_id_) + ".");
+    }
+    if (!attn_body_) tensor_parallel_size_ = 1;
+    const bool use_tensor_parallel = tensor_parallel_size_ > 1;
+    if (use_tensor_parallel && multi_stream_) {
+      throw Exception("tensor_parallel can't be used with multi_stream.");
+    }
+    if (use_tensor_parallel && use_graphs_) {
+      CERR << "WARNING: cuda_graphs can't be used with tensor_parallel, "
+              "disabled.";
+      use_graphs_ = false;
+    }
+
     // layout used by cuda backend is nchw.
     has_tensor_cores_ = false;
     constexpr bool fp16 = std::is_same<half, DataType>::value;
@@ -254,6 +321,34 @@ class CudaNetwork : public Network {
       }
     }
 
+    // fp8 (E4M3) gemms in the encoder blocks, on the fp8 tensor cores of Ada
+    // and Hopper. fp8_check also compares every such gemm against fp16 and
+    // reports the largest errors.
+    fp8_mode_ = Fp8Mode::kOff;
+    if (options.GetOrDefault<bool>("fp8_check", false)) {
+      fp8_mode_ = Fp8Mode::kCheck;
+    } else if (options.GetOrDefault<bool>("fp8", false)) {
+      fp8_mode_ = Fp8Mode::kOn;
+    }
+    if (fp8_mode_ != Fp8Mode::kOff) {
+      if (!fp16 || deviceProp.major * 10 + deviceProp.minor < 89) {
+        CERR << "WARNING: fp8 needs fp16 and a GPU with compute capability "
+                "8.9 or later, disabled.";
+        fp8_mode_ = Fp8Mode::kOff;
+      } else if (!Fp8Gemm::Supported(16, 16)) {
+        CERR << "WARNING: fp8 is not available in this build, disabled.";
+        fp8_mode_ = Fp8Mode::kOff;
+      }
+    }
+    if (fp8_mode_ != Fp8Mode::kOff && use_tensor_parallel) {
+      CERR << "WARNING: fp8 can't be used with tensor_parallel, disabled.";
+      fp8_mode_ = Fp8Mode::kOff;
+    }
+    if (fp8_mode_ == Fp8Mode::kCheck && use_graphs_) {
+      CERR << "WARNING: cuda_graphs can't be used with fp8_check, disabled.";
+      use_graphs_ = false;
+    }
+
     if (!multi_stream_) {
       ReportCUBLASErrors(cublasCreate(&cublas_));
       if (has_tensor_cores_)
@@ -267,6 +362,11 @@ class CudaNetwork : public Network {
                                      // avoid cublas bug of making use of tensor
                                      // core math on TU11x GPUs that don't
                                      // support it.
+      if (use_graphs_) {
+        // The legacy default stream can't be captured.
+        ReportCUDAErrors(cudaStreamCreate(&stream_));
+        ReportCUBLASErrors(cublasSetStream(cublas_, stream_));
+      }
     }
 
     const int kNumInputPlanes = kInputPlanes;
@@ -278,6 +378,8 @@ class CudaNetwork : public Network {
     if (attn_body_) {
       assert(weights.ip_emb_b.size() > 0);
     }
+    network_format_ = nf.OutputAsString();
+    embedding_size_ = attn_body_ ? (int)weights.ip_emb_b.size() : kNumFilters;
 
     // Warn if the memory required for storing transformed weights is
     // going to exceed 40% of total video memory, force custom_winograd off
@@ -295,11 +397,9 @@ class CudaNetwork : public Network {
 
     // Disable res block fusing for fp32 for now (not worth it)
     // TODO: make it work for filters not a multiple of 32.
-    // Note that when used with SE, the optimization
-    // works only when filter count is <= 384 (pre-Ampere), or less than 512
-    // (Ampere)
-    // It turns dynamically off based on filter count (see
-    // ResidualBlock<DataType>::Eval)
+    // Note that when used with SE, filter counts above 384 (pre-Ampere) or 512
+    // (Ampere) use a slower fused kernel that recomputes the output transform
+    // (see OutputInputTransform).
     if (kNumFilters % 32 == 0 && std::is_same<half, DataType>::value) {
       use_res_block_winograd_fuse_opt_ = true;
     } else {
@@ -310,7 +410,7 @@ class CudaNetwork : public Network {
       use_res_block_winograd_fuse_opt_ = options.Get<bool>("res_block_fusing");
     }
 
-    const bool use_gemm_ex = deviceProp.major >= 5;
+    use_gemm_ex_ = deviceProp.major >= 5;
 
     // 0. Check for SE.
     has_se_ = false;
@@ -339,24 +439,22 @@ class CudaNetwork : public Network {
       scratch_size_ = std::max(scratch_size_, 2 * transformed_tensor_size);
     }
 
-    std::string policy_head =
-        options.GetOrDefault<std::string>("policy_head", "vanilla");
+    policy_head_ = options.GetOrDefault<std::string>("policy_head", "vanilla");
     // Check that selected policy head exists.
-    if (weights.policy_heads.count(policy_head) == 0) {
-      throw Exception("The policy head you specified '" + policy_head +
+    if (weights.policy_heads.count(policy_head_) == 0) {
+      throw Exception("The policy head you specified '" + policy_head_ +
                       "' does not exist in this net.");
     }
-    std::string value_head =
-        options.GetOrDefault<std::string>("value_head", "winner");
+    value_head_ = options.GetOrDefault<std::string>("value_head", "winner");
     // Check that selected value head exists.
-    if (weights.value_heads.count(value_head) == 0) {
-      throw Exception("The value head you specified '" + value_head +
+    if (weights.value_heads.count(value_head_) == 0) {
+      throw Exception("The value head you specified '" + value_head_ +
                       "' does not exist in this net.");
     }
 
     // Attention policy head or body may need more memory
     const size_t attentionPolicySize =
-        getMaxAttentionHeadSize(weights.policy_heads.at(policy_head),
+        getMaxAttentionHeadSize(weights.policy_heads.at(policy_head_),
                                 max_batch_size_) *
         sizeof(DataType);
 
@@ -370,20 +468,74 @@ class CudaNetwork : public Network {
     const bool mish_net = file.format().network_format().default_activation() ==
                           pblczero::NetworkFormat::DEFAULT_ACTIVATION_MISH;
 
-    ActivationFunction act = mish_net ? ACTIVATION_MISH : ACTIVATION_RELU;
+    act_ = mish_net ? ACTIVATION_MISH : ACTIVATION_RELU;
+
+    wdl_ = file.format().network_format().value() ==
+           pblczero::NetworkFormat::VALUE_WDL;
+    moves_left_ = (file.format().network_format().moves_left() ==
+                   pblczero::NetworkFormat::MOVES_LEFT_V1) &&
+                  options.GetOrDefault<bool>("mlh", true);
 
     // 2. Build the network, and copy the weights to GPU memory.
+    Layers layers = BuildLayers(file, weights, scratch_mem_);
+    network_ = std::move(layers.network);
+    resi_last_ = layers.resi_last;
+    encoder_last_ = layers.encoder_last;
+
+    // 3. Allocate GPU memory for running the network:
+    //    - three buffers of max size are enough (one to hold input, second to
+    //      hold output and third to hold skip connection's input).
+
+    // size of input to the network
+    size_t maxSize = max_batch_size_ * kNumInputPlanes * 64 * sizeof(DataType);
+
+    // take max size of all layers
+    for (auto& layer : network_) {
+      maxSize = std::max(maxSize, layer->GetOutputSize(max_batch_size_));
+    }
+
+    if ((attn_policy_ || use_res_block_winograd_fuse_opt_ || attn_body_) &&
+        (scratch_size_ > maxSize)) {
+      maxSize = scratch_size_;
+    }
+
+    if (!multi_stream_) {
+      for (auto& mem : tensor_mem_) {
+        ReportCUDAErrors(cudaMalloc(&mem, maxSize));
+        ReportCUDAErrors(cudaMemset(mem, 0, maxSize));
+      }
+    }
+
+    tensor_mem_size_ = multi_stream_ ? maxSize : 0;
+
+    // pre-allocate one InputsOutputs object
+    // The first call to allocate memory, create cublas,
+    // strem, etc takes really long (600 ms)
+    std::unique_ptr<InputsOutputs> io = GetInputsOutputs();
+  }
 
+  // Layers of the network, with their weights in GPU memory.
+  struct Layers {
+    std::vector<std::unique_ptr<BaseLayer<DataType>>> network;
+    BaseLayer<DataType>* resi_last = nullptr;
+    BaseLayer<DataType>* encoder_last = nullptr;
+    BaseLayer<DataType>* last() { return network.back().get(); }
+  };
+
+  // Creates the layers of @weights, using @scratch to transform the weights.
+  Layers BuildLayers(const WeightsFile& file, MultiHeadWeights& weights,
+                     void* scratch) {
+    Layers layers;
     // Input conv only used if there are residual blocks in the network
     if (numBlocks_ > 0) {
       // Input.
       {
         auto inputConv = std::make_unique<FusedWinogradConvSELayer<DataType>>(
-            nullptr, kNumFilters, 8, 8, kNumInputPlanes, act, true, false,
-            false, 0, use_gemm_ex, use_res_block_winograd_fuse_opt_);
+            nullptr, numFilters_, 8, 8, kInputPlanes, act_, true, false,
+            false, 0, use_gemm_ex_, use_res_block_winograd_fuse_opt_);
         inputConv->LoadWeights(&weights.input.weights[0],
-                               &weights.input.biases[0], scratch_mem_);
-        network_.emplace_back(std::move(inputConv));
+                               &weights.input.biases[0], scratch);
+        layers.network.emplace_back(std::move(inputConv));
       }
 
       // Residual block.
@@ -393,47 +545,46 @@ class CudaNetwork : public Network {
 
         if (use_res_block_winograd_fuse_opt_) {
           auto layer = std::make_unique<ResidualBlock<DataType>>(
-              getLastLayer(), kNumFilters, has_se, se_k, use_gemm_ex,
-              block == 0, block == (numBlocks_ - 1), act,
-              deviceProp.sharedMemPerBlockOptin);
+              layers.last(), numFilters_, has_se, se_k, use_gemm_ex_,
+              block == 0, block == (numBlocks_ - 1), act_);
           layer->LoadWeights0(&weights.residual[block].conv1.weights[0],
                               &weights.residual[block].conv1.biases[0],
-                              scratch_mem_);
+                              scratch);
           layer->LoadWeights1(&weights.residual[block].conv2.weights[0],
                               &weights.residual[block].conv2.biases[0],
-                              scratch_mem_);
+                              scratch);
           if (has_se)
             layer->LoadSEWeights(&weights.residual[block].se.w1[0],
                                  &weights.residual[block].se.b1[0],
                                  &weights.residual[block].se.w2[0],
                                  &weights.residual[block].se.b2[0],
-                                 scratch_mem_);
-          network_.emplace_back(std::move(layer));
+                                 scratch);
+          layers.network.emplace_back(std::move(layer));
         } else {
           auto conv1 = std::make_unique<FusedWinogradConvSELayer<DataType>>(
-              getLastLayer(), kNumFilters, 8, 8, kNumFilters, act, true, false,
-              false, 0, use_gemm_ex);
+              layers.last(), numFilters_, 8, 8, numFilters_, act_, true, false,
+              false, 0, use_gemm_ex_);
           conv1->LoadWeights(&weights.residual[block].conv1.weights[0],
                              &weights.residual[block].conv1.biases[0],
-                             scratch_mem_);
-          network_.emplace_back(std::move(conv1));
+                             scratch);
+          layers.network.emplace_back(std::move(conv1));
 
           auto conv2 = std::make_unique<FusedWinogradConvSELayer<DataType>>(
-              getLastLayer(), kNumFilters, 8, 8, kNumFilters, act, true, true,
-              has_se, se_k, use_gemm_ex);
+              layers.last(), numFilters_, 8, 8, numFilters_, act_, true, true,
+              has_se, se_k, use_gemm_ex_);
           conv2->LoadWeights(&weights.residual[block].conv2.weights[0],
                              &weights.residual[block].conv2.biases[0],
-                             scratch_mem_);
+                             scratch);
           if (has_se)
             conv2->LoadSEWeights(&weights.residual[block].se.w1[0],
                                  &weights.residual[block].se.b1[0],
                                  &weights.residual[block].se.w2[0],
                                  &weights.residual[block].se.b2[0],
-                                 scratch_mem_);
-          network_.emplace_back(std::move(conv2));
+                                 scratch);
+          layers.network.emplace_back(std::move(conv2));
         }
       }
-      resi_last_ = getLastLayer();
+      layers.resi_last = layers.last();
     }
 
     if (attn_body_) {
@@ -442,81 +593,95 @@ class CudaNetwork : public Network {
           file.format().network_format().smolgen_activation();
       activations.smolgen_activation =
           smolgen_activation == pblczero::NetworkFormat::ACTIVATION_DEFAULT
-              ? act
+              ? act_
               : static_cast<ActivationFunction>(smolgen_activation);
       const auto ffn_activation =
           file.format().network_format().ffn_activation();
       activations.ffn_activation =
           ffn_activation == pblczero::NetworkFormat::ACTIVATION_DEFAULT
-              ? act
+              ? act_
               : static_cast<ActivationFunction>(ffn_activation);
-      activations.default_activation = act;
+      activations.default_activation = act_;
+
+      if (tensor_parallel_size_ > 1 && !tensor_parallel_) {
+        int max_dff = 0;
+        for (const auto& enc : weights.encoder) {
+          max_dff = std::max(max_dff, (int)enc.ffn.dense1_b.size());
+        }
+        tensor_parallel_ = std::make_unique<TensorParallelGroup<DataType>>(
+            gpu_id_, tensor_parallel_size_, max_batch_size_ * 64,
+            (int)weights.ip_emb_b.size(), max_dff, has_tensor_cores_);
+        CERR << "Encoder FFNs split over GPUs " << gpu_id_ << " to "
+             << gpu_id_ + tensor_parallel_size_ - 1 << ".";
+      }
 
       auto attention_body = std::make_unique<AttentionBody<DataType>>(
-          weights, scratch_mem_, activations, numBlocks_,
-          numBlocks_ > 0 ? kNumFilters : kInputPlanes, max_batch_size_,
+          weights, scratch, activations, numBlocks_,
+          numBlocks_ > 0 ? numFilters_ : kInputPlanes, max_batch_size_,
           static_cast<InputEmbedding>(
               file.format().network_format().input_embedding()) ==
-              InputEmbedding::INPUT_EMBEDDING_PE_DENSE);
-      network_.emplace_back(std::move(attention_body));
+              InputEmbedding::INPUT_EMBEDDING_PE_DENSE,
+          fp8_mode_, tensor_parallel_.get());
+      layers.network.emplace_back(std::move(attention_body));
 
-      encoder_last_ = getLastLayer();
+      layers.encoder_last = layers.last();
     }
 
     // Policy head.
     {
-      MultiHeadWeights::PolicyHead& head = weights.policy_heads.at(policy_head);
+      MultiHeadWeights::PolicyHead& head =
+          weights.policy_heads.at(policy_head_);
       if (attn_policy_) {
         auto AttentionPolicy = std::make_unique<AttentionPolicyHead<DataType>>(
-            getLastLayer(), head, scratch_mem_, attn_body_, act,
-            max_batch_size_);
-        network_.emplace_back(std::move(AttentionPolicy));
+            layers.last(), head, scratch, attn_body_, act_,
+            max_batch_size_, fp8_mode_);
+        layers.network.emplace_back(std::move(AttentionPolicy));
 
         auto policymap = std::make_unique<PolicyMapLayer<DataType>>(
-            getLastLayer(), kNumOutputPolicy, 1, 1, 64 * 64 + 8 * 24, true);
-        policymap->LoadWeights(kAttnPolicyMap, scratch_mem_);
-        network_.emplace_back(std::move(policymap));
+            layers.last(), kNumOutputPolicy, 1, 1, 64 * 64 + 8 * 24, true);
+        policymap->LoadWeights(kAttnPolicyMap, scratch);
+        layers.network.emplace_back(std::move(policymap));
 
       } else {
         if (conv_policy_) {
           assert(!attn_body_);  // not supported with attention body
           auto conv1 = std::make_unique<FusedWinogradConvSELayer<DataType>>(
-              resi_last_, kNumFilters, 8, 8, kNumFilters, act, true, false,
-              false, 0, use_gemm_ex);
+              layers.resi_last, numFilters_, 8, 8, numFilters_, act_, true,
+              false, false, 0, use_gemm_ex_);
           conv1->LoadWeights(&head.policy1.weights[0], &head.policy1.biases[0],
-                             scratch_mem_);
-          network_.emplace_back(std::move(conv1));
+                             scratch);
+          layers.network.emplace_back(std::move(conv1));
 
           auto pol_channels = head.policy.biases.size();
 
           // No relu
           auto conv2 = std::make_unique<FusedWinogradConvSELayer<DataType>>(
-              getLastLayer(), pol_channels, 8, 8, kNumFilters, ACTIVATION_NONE,
-              true, false, false, 0, use_gemm_ex);
+              layers.last(), pol_channels, 8, 8, numFilters_, ACTIVATION_NONE,
+              true, false, false, 0, use_gemm_ex_);
           conv2->LoadWeights(&head.policy.weights[0], &head.policy.biases[0],
-                             scratch_mem_);
-          network_.emplace_back(std::move(conv2));
+                             scratch);
+          layers.network.emplace_back(std::move(conv2));
 
           auto policymap = std::make_unique<PolicyMapLayer<DataType>>(
-              getLastLayer(), kNumOutputPolicy, 1, 1, 73 * 8 * 8, false);
-          policymap->LoadWeights(kConvPolicyMap, scratch_mem_);
+              layers.last(), kNumOutputPolicy, 1, 1, 73 * 8 * 8, false);
+          policymap->LoadWeights(kConvPolicyMap, scratch);
 
-          network_.emplace_back(std::move(policymap));
+          layers.network.emplace_back(std::move(policymap));
         } else {
           assert(!attn_body_);  // not supported with attention body
           auto convPol = std::make_unique<Conv1Layer<DataType>>(
-              resi_last_, head.policy.biases.size(), 8, 8, kNumFilters, act,
-              true, use_gemm_ex);
+              layers.resi_last, head.policy.biases.size(), 8, 8, numFilters_,
+              act_, true, use_gemm_ex_);
           convPol->LoadWeights(&head.policy.weights[0], &head.policy.biases[0],
-                               scratch_mem_);
-          network_.emplace_back(std::move(convPol));
+                               scratch);
+          layers.network.emplace_back(std::move(convPol));
 
           auto FCPol = std::make_unique<FCLayer<DataType>>(
-              getLastLayer(), head.ip_pol_b.size(), 1, 1, true,
+              layers.last(), head.ip_pol_b.size(), 1, 1, true,
               ACTIVATION_NONE);
           FCPol->LoadWeights(&head.ip_pol_w[0], &head.ip_pol_b[0],
-                             scratch_mem_);
-          network_.emplace_back(std::move(FCPol));
+                             scratch);
+          layers.network.emplace_back(std::move(FCPol));
         }
       }
     }
@@ -524,94 +689,127 @@ class CudaNetwork : public Network {
     // Value heads.
     {
       const MultiHeadWeights::ValueHead& head =
-          weights.value_heads.at(value_head);
-      wdl_ = file.format().network_format().value() ==
-             pblczero::NetworkFormat::VALUE_WDL;
-      BaseLayer<DataType>* lastlayer = attn_body_ ? encoder_last_ : resi_last_;
+          weights.value_heads.at(value_head_);
+      BaseLayer<DataType>* lastlayer =
+          attn_body_ ? layers.encoder_last : layers.resi_last;
       auto value_main = std::make_unique<ValueHead<DataType>>(
-          lastlayer, head, scratch_mem_, attn_body_, wdl_, act,
-          max_batch_size_, use_gemm_ex);
-      network_.emplace_back(std::move(value_main));
+          lastlayer, head, scratch, attn_body_, wdl_, act_,
+          max_batch_size_, use_gemm_ex_);
+      layers.network.emplace_back(std::move(value_main));
     }
 
     // Moves left head
-    moves_left_ = (file.format().network_format().moves_left() ==
-                   pblczero::NetworkFormat::MOVES_LEFT_V1) &&
-                  options.GetOrDefault<bool>("mlh", true);
     if (moves_left_) {
       if (attn_body_) {
         auto embedded_mov = std::make_unique<EmbeddingLayer<DataType>>(
-            encoder_last_, weights.ip_mov_w, weights.ip_mov_b, scratch_mem_,
-            act);
-        network_.emplace_back(std::move(embedded_mov));
+            layers.encoder_last, weights.ip_mov_w, weights.ip_mov_b, scratch,
+            act_);
+        layers.network.emplace_back(std::move(embedded_mov));
       } else {
         auto convMov = std::make_unique<Conv1Layer<DataType>>(
-            resi_last_, weights.moves_left.biases.size(), 8, 8, kNumFilters,
-            act, true, use_gemm_ex);
+            layers.resi_last, weights.moves_left.biases.size(), 8, 8,
+            numFilters_, act_, true, use_gemm_ex_);
         convMov->LoadWeights(&weights.moves_left.weights[0],
-                             &weights.moves_left.biases[0], scratch_mem_);
-        network_.emplace_back(std::move(convMov));
+                             &weights.moves_left.biases[0], scratch);
+        layers.network.emplace_back(std::move(convMov));
       }
       auto FCMov1 = std::make_unique<FCLayer<DataType>>(
-          getLastLayer(), weights.ip1_mov_b.size(), 1, 1, true, act);
+          layers.last(), weights.ip1_mov_b.size(), 1, 1, true, act_);
       FCMov1->LoadWeights(&weights.ip1_mov_w[0], &weights.ip1_mov_b[0],
-                          scratch_mem_);
-      network_.emplace_back(std::move(FCMov1));
+                          scratch);
+      layers.network.emplace_back(std::move(FCMov1));
 
-      auto FCMov2 = std::make_unique<FCLayer<DataType>>(getLastLayer(), 1, 1, 1,
+      auto FCMov2 = std::make_unique<FCLayer<DataType>>(layers.last(), 1, 1, 1,
                                                         true, ACTIVATION_RELU);
       FCMov2->LoadWeights(&weights.ip2_mov_w[0], &weights.ip2_mov_b[0],
-                          scratch_mem_);
-      network_.emplace_back(std::move(FCMov2));
+                          scratch);
+      layers.network.emplace_back(std::move(FCMov2));
     }
+    return layers;
+  }
 
-    // 3. Allocate GPU memory for running the network:
-    //    - three buffers of max size are enough (one to hold input, second to
-    //      hold output and third to hold skip connection's input).
-
-    // size of input to the network
-    size_t maxSize = max_batch_size_ * kNumInputPlanes * 64 * sizeof(DataType);
-
-    // take max size of all layers
-    for (auto& layer : network_) {
-      maxSize = std::max(maxSize, layer->GetOutputSize(max_batch_size_));
+  bool ReloadWeights(const WeightsFile& file) override {
+    const auto& nf = file.format().network_format();
+    if (nf.OutputAsString() != network_format_) return false;
+    MultiHeadWeights weights(file.weights());
+    if ((int)weights.residual.size() != numBlocks_ ||
+        (int)weights.encoder.size() != num_encoder_blocks_ ||
+        (attn_body_ ? weights.ip_emb_b.size() : weights.input.biases.size()) !=
+            (size_t)embedding_size_ ||
+        weights.policy_heads.count(policy_head_) == 0 ||
+        weights.value_heads.count(value_head_) == 0) {
+      return false;
     }
-
-    if ((attn_policy_ || use_res_block_winograd_fuse_opt_ || attn_body_) &&
-        (scratch_size_ > maxSize)) {
-      maxSize = scratch_size_;
+    if (getMaxAttentionHeadSize(weights.policy_heads.at(policy_head_),
+                                max_batch_size_) *
+                sizeof(DataType) >
+            scratch_size_ ||
+        getMaxAttentionBodySize(weights, max_batch_size_) * sizeof(DataType) >
+            scratch_size_) {
+      return false;
     }
 
-    if (!multi_stream_) {
-      for (auto& mem : tensor_mem_) {
-        ReportCUDAErrors(cudaMalloc(&mem, maxSize));
-        ReportCUDAErrors(cudaMemset(mem, 0, maxSize));
+    ReportCUDAErrors(cudaSetDevice(gpu_id_));
+    // Not scratch_mem_, which batches in flight may be using.
+    void* scratch;
+    ReportCUDAErrors(cudaMalloc(&scratch, scratch_size_));
+    Layers layers;
+    try {
+      layers = BuildLayers(file, weights, scratch);
+    } catch (...) {
+      cudaFree(scratch);
+      throw;
+    }
+    ReportCUDAErrors(cudaDeviceSynchronize());
+    ReportCUDAErrors(cudaFree(scratch));
+
+    // The activation buffers were sized for the old layers.
+    if (layers.network.size() != network_.size()) return false;
+    for (size_t i = 0; i < network_.size(); i++) {
+      if (layers.network[i]->GetOutputSize(max_batch_size_) !=
+          network_[i]->GetOutputSize(max_batch_size_)) {
+        return false;
       }
     }
 
-    tensor_mem_size_ = multi_stream_ ? maxSize : 0;
+    {
+      // Waits for the batches in flight, which use the old layers.
+      std::unique_lock<std::shared_mutex> lock(weights_mutex_);
+      std::swap(network_, layers.network);
+      resi_last_ = layers.resi_last;
+      encoder_last_ = layers.encoder_last;
+      // Captured graphs have the pointers of the old weights baked in.
+      ++weights_generation_;
+    }
+    return true;
+  }
 
-    // pre-allocate one InputsOutputs object
-    // The first call to allocate memory, create cublas,
-    // strem, etc takes really long (600 ms)
-    std::unique_ptr<InputsOutputs> io = GetInputsOutputs();
+  // Waits for the completion flag of the latest batch of @io. The stream is
+  // queried now and then, so that a failed kernel doesn't leave the thread
+  // spinning forever.
+  static void spinWait(InputsOutputs* io, cudaStream_t stream) {
+    for (int spins = 1; *io->done_flag_ != io->done_seq_; spins++) {
+      if (spins % 4096 == 0) {
+        const cudaError_t status = cudaStreamQuery(stream);
+        if (status != cudaErrorNotReady) ReportCUDAErrors(status);
+      }
+      SpinloopPause();
+    }
   }
 
-  void forwardEval(InputsOutputs* io, int batchSize) {
+  void forwardEval(InputsOutputs* io, int batchSize, OutputHeads heads = {}) {
     // It is safe to evaluate larger than the batchSize
     // as all buffers are designed to handle max_batch_size
     // and the extra invalid results are never read.
     if (batchSize < min_batch_size_) batchSize = min_batch_size_;
+    // Keeps ReloadWeights() from swapping the layers under this batch.
+    std::shared_lock<std::shared_mutex> weights_lock(weights_mutex_);
     if (!multi_stream_) lock_.lock();
 
 #ifdef DEBUG_RAW_NPS
     auto t_start = std::chrono::high_resolution_clock::now();
 #endif
 
-    // Expand packed planes to full planes.
-    uint64_t* ipDataMasks = io->input_masks_mem_gpu_;
-    float* ipDataValues = io->input_val_mem_gpu_;
-
     DataType* tensor_mem[3];
     void* scratch_mem;
     DataType*** offset_pointers;
@@ -632,10 +830,113 @@ class CudaNetwork : public Network {
       scratch_mem = scratch_mem_;
       offset_pointers = (DataType***)&offset_pointers_;
       head_offset_pointers = (DataType***)&head_offset_pointers_;
-      stream = 0;  // default stream
+      stream = stream_;  // default stream, unless graphs are used
       cublas = cublas_;
     }
 
+    // Graphs are only captured with all the heads, batches skipping some are
+    // run directly.
+    if (use_graphs_ && heads.policy && heads.moves_left) {
+      runGraph(io, batchSize, tensor_mem, scratch_mem, offset_pointers,
+               head_offset_pointers, stream, cublas);
+    } else {
+      enqueueForward(io, batchSize, tensor_mem, scratch_mem, offset_pointers,
+                     head_offset_pointers, stream, cublas, heads);
+    }
+
+    if (spin_wait_) {
+      signalCompletion(io->done_flag_gpu_, ++io->done_seq_, stream);
+      spinWait(io, stream);
+      if (!multi_stream_) lock_.unlock();
+    } else if (multi_stream_) {
+      ReportCUDAErrors(cudaStreamSynchronize(stream));
+    } else {
+      ReportCUDAErrors(cudaDeviceSynchronize());
+      // The next thread can start using the GPU now.
+      lock_.unlock();
+    }
+
+    if (wdl_) {
+      // Value softmax done cpu side.
+      for (int i = 0; i < batchSize; i++) {
+        float w = io->op_value_mem_[3 * i + 0];
+        float d = io->op_value_mem_[3 * i + 1];
+        float l = io->op_value_mem_[3 * i + 2];
+        float m = std::max({w, d, l});
+        w = std::exp(w - m);
+        d = std::exp(d - m);
+        l = std::exp(l - m);
+        float sum = w + d + l;
+        w /= sum;
+        l /= sum;
+        d = 1.0f - w - l;
+        io->op_value_mem_[3 * i + 0] = w;
+        io->op_value_mem_[3 * i + 1] = d;
+        io->op_value_mem_[3 * i + 2] = l;
+      }
+    }
+  }
+
+  // Batch size of the graph used for @batch_size. Powers of two up to 32 and
+  // multiples of 32 above, to keep the number of graphs to capture low.
+  int getGraphBatchSize(int batch_size) const {
+    int size = 1;
+    while (size < batch_size && size < 32) size *= 2;
+    if (size < batch_size) size = (batch_size + 31) / 32 * 32;
+    return std::min(size, max_batch_size_);
+  }
+
+  // Replays the graph of the batch size bucket, capturing it on its first use
+  // with @io (the graph has the buffers of @io baked in). The padding samples
+  // are computed from whatever is in the buffers, and never read.
+  void runGraph(InputsOutputs* io, int batchSize, DataType* tensor_mem[3],
+                void* scratch_mem, DataType*** offset_pointers,
+                DataType*** head_offset_pointers, cudaStream_t stream,
+                cublasHandle_t cublas) {
+#if CUDART_VERSION >= 11040
+    const int graph_batch_size = getGraphBatchSize(batchSize);
+    if (io->graphs_generation_ != weights_generation_) {
+      // Captured with the layers of before the last ReloadWeights().
+      for (auto& graph_exec : io->graphs_) {
+        if (graph_exec) ReportCUDAErrors(cudaGraphExecDestroy(graph_exec));
+        graph_exec = nullptr;
+      }
+      io->graphs_warm_ = false;
+      io->graphs_generation_ = weights_generation_;
+    }
+    if (io->graphs_.empty()) io->graphs_.resize(max_batch_size_ + 1, nullptr);
+    cudaGraphExec_t& graph_exec = io->graphs_[graph_batch_size];
+    if (!graph_exec) {
+      if (!io->graphs_warm_) {
+        // Some layers allocate and upload memory on their first run, which
+        // can't be captured.
+        enqueueForward(io, graph_batch_size, tensor_mem, scratch_mem,
+                       offset_pointers, head_offset_pointers, stream, cublas);
+        io->graphs_warm_ = true;
+        return;
+      }
+      cudaGraph_t graph;
+      ReportCUDAErrors(
+          cudaStreamBeginCapture(stream, cudaStreamCaptureModeThreadLocal));
+      enqueueForward(io, graph_batch_size, tensor_mem, scratch_mem,
+                     offset_pointers, head_offset_pointers, stream, cublas);
+      ReportCUDAErrors(cudaStreamEndCapture(stream, &graph));
+      ReportCUDAErrors(cudaGraphInstantiateWithFlags(&graph_exec, graph, 0));
+      ReportCUDAErrors(cudaGraphDestroy(graph));
+    }
+    ReportCUDAErrors(cudaGraphLaunch(graph_exec, stream));
+#endif
+  }
+
+  // Queues the whole forward pass of @batchSize samples on @stream.
+  void enqueueForward(InputsOutputs* io, int batchSize, DataType* tensor_mem[3],
+                      void* scratch_mem, DataType*** offset_pointers,
+                      DataType*** head_offset_pointers, cudaStream_t stream,
+                      cublasHandle_t cublas, OutputHeads heads = {}) {
+    // Expand packed planes to full planes.
+    uint64_t* ipDataMasks = io->input_masks_mem_gpu_;
+    float* ipDataValues = io->input_val_mem_gpu_;
+
     bool fp16 = std::is_same<half, DataType>::value;
     if (fp16) {
       expandPlanes_Fp16_NCHW((half*)(tensor_mem[0]), ipDataMasks, ipDataValues,
@@ -742,7 +1043,10 @@ class CudaNetwork : public Network {
 #endif
 
     // Policy head.
-    if (attn_policy_) {
+    if (!heads.policy) {
+      // Not read by the caller, step over its layers.
+      l += conv_policy_ ? 3 : 2;
+    } else if (attn_policy_) {
       network_[l++]->Eval(
           batchSize, spare1, flow, spare2, scratch_mem, scratch_size_, nullptr,
           cublas, stream,
@@ -800,10 +1104,12 @@ class CudaNetwork : public Network {
     }
 
     // Copy policy output from device memory to host memory.
-    ReportCUDAErrors(
-        cudaMemcpyAsync(io->op_policy_mem_, io->op_policy_mem_gpu_,
-                        sizeof(float) * kNumOutputPolicy * batchSize,
-                        cudaMemcpyDeviceToHost, stream));
+    if (heads.policy) {
+      ReportCUDAErrors(
+          cudaMemcpyAsync(io->op_policy_mem_, io->op_policy_mem_gpu_,
+                          sizeof(float) * kNumOutputPolicy * batchSize,
+                          cudaMemcpyDeviceToHost, stream));
+    }
 
     // value head
     if (fp16) {
@@ -818,7 +1124,7 @@ class CudaNetwork : public Network {
                           stream);  // value head
     }
 
-    if (moves_left_) {
+    if (moves_left_ && heads.moves_left) {
       // Moves left head
       network_[l++]->Eval(batchSize, spare1, flow, nullptr, scratch_mem,
                           scratch_size_, nullptr, cublas,
@@ -840,34 +1146,6 @@ class CudaNetwork : public Network {
                             stream);
       }
     }
-
-    if (multi_stream_) {
-      ReportCUDAErrors(cudaStreamSynchronize(stream));
-    } else {
-      ReportCUDAErrors(cudaDeviceSynchronize());
-      // The next thread can start using the GPU now.
-      lock_.unlock();
-    }
-
-    if (wdl_) {
-      // Value softmax done cpu side.
-      for (int i = 0; i < batchSize; i++) {
-        float w = io->op_value_mem_[3 * i + 0];
-        float d = io->op_value_mem_[3 * i + 1];
-        float l = io->op_value_mem_[3 * i + 2];
-        float m = std::max({w, d, l});
-        w = std::exp(w - m);
-        d = std::exp(d - m);
-        l = std::exp(l - m);
-        float sum = w + d + l;
-        w /= sum;
-        l /= sum;
-        d = 1.0f - w - l;
-        io->op_value_mem_[3 * i + 0] = w;
-        io->op_value_mem_[3 * i + 1] = d;
-        io->op_value_mem_[3 * i + 2] = l;
-      }
-    }
   }
 
   ~CudaNetwork() {
@@ -880,6 +1158,7 @@ class CudaNetwork : public Network {
       if (head_offset_pointers_)
         ReportCUDAErrors(cudaFree(head_offset_pointers_));
       cublasDestroy(cublas_);
+      if (stream_) cudaStreamDestroy(stream_);
     }
   }
 
@@ -940,11 +1219,18 @@ class CudaNetwork : public Network {
   bool use_res_block_winograd_fuse_opt_;  // fuse operations inside the residual
                                           // tower
   bool multi_stream_;                     // run multiple parallel network evals
+  bool spin_wait_;                        // poll a flag for batch completion
   bool allow_cache_opt_;  // try to fit residual block activations in L2 cache
+  bool use_graphs_;       // replay the forward pass from captured CUDA graphs
 
   // Currently only one NN Eval can happen a time (we can fix this if needed
   // by allocating more memory).
   mutable std::mutex lock_;
+  // Held shared by each batch, and exclusively by ReloadWeights() to swap
+  // the layers.
+  mutable std::shared_mutex weights_mutex_;
+  // Bumped by each ReloadWeights(), to invalidate the captured graphs.
+  int weights_generation_ = 0;
 
   int numBlocks_;
   int numFilters_;
@@ -953,8 +1239,18 @@ class CudaNetwork : public Network {
   bool attn_policy_;
   bool attn_body_;
   int num_encoder_blocks_;
+  // Network format and width a reload must match.
+  std::string network_format_;
+  int embedding_size_;
+  std::string policy_head_;
+  std::string value_head_;
+  ActivationFunction act_;
+  bool use_gemm_ex_;
+  Fp8Mode fp8_mode_;
+  int tensor_parallel_size_;
+  // Declared before network_, whose encoder blocks use it.
+  std::unique_ptr<TensorParallelGroup<DataType>> tensor_parallel_;
   std::vector<std::unique_ptr<BaseLayer<DataType>>> network_;
-  BaseLayer<DataType>* getLastLayer() { return network_.back().get(); }
 
   BaseLayer<DataType>* resi_last_;
   BaseLayer<DataType>* encoder_last_;
@@ -972,6 +1268,7 @@ class CudaNetwork : public Network {
 
   // not used when multi-steam is enabled
   cublasHandle_t cublas_;
+  cudaStream_t stream_ = 0;
   DataType* tensor_mem_[3];
 
   mutable std::mutex inputs_outputs_lock_;
@@ -1041,7 +1338,7 @@ CudaNetworkComputation<DataType>::~CudaNetworkComputation() {
 
 template <typename DataType>
 void CudaNetworkComputation<DataType>::ComputeBlocking() {
-  network_->forwardEval(inputs_outputs_.get(), GetBatchSize());
+  network_->forwardEval(inputs_outputs_.get(), GetBatchSize(), heads_);
 }
 
 template <typename DataType>
@@ -1133,8 +1430,13 @@ std::unique_ptr<Network> MakeCudaNetworkAuto(
   return MakeCudaNetwork<float>(weights, options);
 }
 
+int CudaDeviceCount(const OptionsDict&) { return GetDeviceCount(); }
+
 REGISTER_NETWORK("cuda-auto", MakeCudaNetworkAuto, 104)
 REGISTER_NETWORK("cuda", MakeCudaNetwork<float>, 103)
 REGISTER_NETWORK("cuda-fp16", MakeCudaNetwork<half>, 102)
+REGISTER_NETWORK_DEVICES("cuda-auto", CudaDeviceCount)
+REGISTER_NETWORK_DEVICES("cuda", CudaDeviceCount)
+REGISTER_NETWORK_DEVICES("cuda-fp16", CudaDeviceCount)
 
 }  // namespace lczero
@@ -109,6 +109,14 @@ class CudnnNetworkComputation : public NetworkComputation {
     batch_size_++;
   }
 
+  InputPlanesView GetInputBuffer(int sample) override {
+    if (sample >= inputs_outputs_->max_batch_size_) return {};
+    return {&inputs_outputs_->input_masks_mem_[sample * kInputPlanes],
+            &inputs_outputs_->input_val_mem_[sample * kInputPlanes]};
+  }
+
+  void AddWrittenInput() override { batch_size_++; }
+
   void ComputeBlocking() override;
 
   int GetBatchSize() const override { return batch_size_; }
@@ -136,6 +144,11 @@ class CudnnNetworkComputation : public NetworkComputation {
     return inputs_outputs_->op_policy_mem_[sample * kNumOutputPolicy + move_id];
   }
 
+  std::span<const float> GetPolicyView(int sample) const override {
+    return {&inputs_outputs_->op_policy_mem_[sample * kNumOutputPolicy],
+            static_cast<size_t>(kNumOutputPolicy)};
+  }
+
   float GetMVal(int sample) const override {
     if (moves_left_) {
       return inputs_outputs_->op_moves_left_mem_[sample];
@@ -439,8 +452,7 @@ class CudnnNetwork : public Network {
           auto layer = std::make_unique<ResidualBlock<DataType>>(
               getLastLayer(), kNumFilters, has_se, se_k, use_gemm_ex,
               block == 0, block == (numBlocks_ - 1),
-              mish_net ? ACTIVATION_MISH : ACTIVATION_RELU,
-              deviceProp.sharedMemPerBlockOptin);
+              mish_net ? ACTIVATION_MISH : ACTIVATION_RELU);
           layer->LoadWeights0(&weights.residual[block].conv1.weights[0],
                               &weights.residual[block].conv1.biases[0],
                               scratch_mem_);
@@ -1171,8 +1183,13 @@ std::unique_ptr<Network> MakeCudnnNetworkAuto(
   return MakeCudnnNetwork<float>(weights, options);
 }
 
+int CudnnDeviceCount(const OptionsDict&) { return GetDeviceCount(); }
+
 REGISTER_NETWORK("cudnn-auto", MakeCudnnNetworkAuto, 120)
 REGISTER_NETWORK("cudnn", MakeCudnnNetwork<float>, 110)
 REGISTER_NETWORK("cudnn-fp16", MakeCudnnNetwork<half>, 105)
+REGISTER_NETWORK_DEVICES("cudnn-auto", CudnnDeviceCount)
+REGISTER_NETWORK_DEVICES("cudnn", CudnnDeviceCount)
+REGISTER_NETWORK_DEVICES("cudnn-fp16", CudnnDeviceCount)
 
 }  // namespace lczero
@@ -0,0 +1,166 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <type_traits>
+#include <vector>
+
+#include "cuda_common.h"
+
+namespace lczero {
+namespace cudnn_backend {
+
+// Extra GPUs that the encoder FFNs are sharded over for tensor parallel
+// evaluation of a single network. The first dense layer is split by output
+// columns and the second one by input rows, so each device computes a partial
+// FFN output from the whole input; NCCL broadcasts the input from the network
+// GPU and sums the partial outputs back into it. The network GPU computes the
+// first shard itself, the peers the others. Shared by all encoder blocks,
+// which own their shards of the weights.
+template <typename DataType>
+class TensorParallelGroup {
+ public:
+  struct Peer {
+    int gpu;
+    cudaStream_t stream;
+    cublasHandle_t cublas;
+    DataType* input;   // Broadcast copy of the FFN input.
+    DataType* hidden;  // This peer's slice of the FFN hidden layer.
+    DataType* output;  // Partial FFN output.
+  };
+
+  // @max_rows is the largest batch times 64, @embedding_size the width of the
+  // FFN input and output, and @max_dff the largest FFN hidden layer.
+  TensorParallelGroup(int gpu, int num_gpus, int max_rows, int embedding_size,
+                      int max_dff, bool tensor_cores)
+      : gpu_(gpu), size_(num_gpus) {
+#ifdef USE_NCCL
+    std::vector<int> devices;
+    for (int i = 0; i < size_; i++) devices.push_back(gpu_ + i);
+    comms_.resize(size_);
+    ReportNCCLErrors(ncclCommInitAll(comms_.data(), size_, devices.data()));
+
+    for (int i = 1; i < size_; i++) {
+      Peer peer;
+      peer.gpu = gpu_ + i;
+      ReportCUDAErrors(cudaSetDevice(peer.gpu));
+      ReportCUDAErrors(cudaStreamCreate(&peer.stream));
+      ReportCUBLASErrors(cublasCreate(&peer.cublas));
+      ReportCUBLASErrors(cublasSetStream(peer.cublas, peer.stream));
+      if (tensor_cores) {
+        ReportCUBLASErrors(
+            cublasSetMathMode(peer.cublas, CUBLAS_TENSOR_OP_MATH));
+      }
+      const size_t activations = (size_t)max_rows * embedding_size;
+      ReportCUDAErrors(
+          cudaMalloc(&peer.input, activations * sizeof(DataType)));
+      ReportCUDAErrors(
+          cudaMalloc(&peer.output, activations * sizeof(DataType)));
+      ReportCUDAErrors(cudaMalloc(
+          &peer.hidden,
+          (size_t)max_rows * DivUp(max_dff, size_) * sizeof(DataType)));
+      peers_.push_back(peer);
+    }
+    ReportCUDAErrors(cudaSetDevice(gpu_));
+#else
+    (void)max_rows;
+    (void)embedding_size;
+    (void)max_dff;
+    (void)tensor_cores;
+    throw Exception("Tensor parallel evaluation needs a build with NCCL.");
+#endif
+  }
+
+  ~TensorParallelGroup() {
+#ifdef USE_NCCL
+    for (auto& peer : peers_) {
+      ReportCUDAErrors(cudaSetDevice(peer.gpu));
+      ReportCUDAErrors(cudaFree(peer.input));
+      ReportCUDAErrors(cudaFree(peer.output));
+      ReportCUDAErrors(cudaFree(peer.hidden));
+      cublasDestroy(peer.cublas);
+      cudaStreamDestroy(peer.stream);
+    }
+    for (auto comm : comms_) ncclCommDestroy(comm);
+    ReportCUDAErrors(cudaSetDevice(gpu_));
+#endif
+  }
+
+  int gpu() const { return gpu_; }
+  // Number of shards, including the network GPU.
+  int size() const { return size_; }
+  const std::vector<Peer>& peers() const { return peers_; }
+
+  // First hidden unit of shard @i out of a hidden layer of @dff units.
+  int ShardBegin(int i, int dff) const { return (int)((long)dff * i / size_); }
+
+  // Copies @count elements of @input on the network GPU to all peers.
+  void Broadcast(DataType* input, size_t count, cudaStream_t stream) const {
+#ifdef USE_NCCL
+    ReportNCCLErrors(ncclGroupStart());
+    ReportNCCLErrors(ncclBroadcast(input, input, count, NcclType(), 0,
+                                   comms_[0], stream));
+    for (int i = 1; i < size_; i++) {
+      const auto& peer = peers_[i - 1];
+      ReportNCCLErrors(ncclBroadcast(peer.input, peer.input, count,
+                                     NcclType(), 0, comms_[i], peer.stream));
+    }
+    ReportNCCLErrors(ncclGroupEnd());
+#endif
+  }
+
+  // Adds the peers' partial outputs to @output on the network GPU.
+  void Reduce(DataType* output, size_t count, cudaStream_t stream) const {
+#ifdef USE_NCCL
+    ReportNCCLErrors(ncclGroupStart());
+    ReportNCCLErrors(ncclReduce(output, output, count, NcclType(), ncclSum, 0,
+                                comms_[0], stream));
+    for (int i = 1; i < size_; i++) {
+      const auto& peer = peers_[i - 1];
+      ReportNCCLErrors(ncclReduce(peer.output, peer.output, count, NcclType(),
+                                  ncclSum, 0, comms_[i], peer.stream));
+    }
+    ReportNCCLErrors(ncclGroupEnd());
+#endif
+  }
+
+ private:
+#ifdef USE_NCCL
+  static ncclDataType_t NcclType() {
+    return std::is_same<half, DataType>::value ? ncclHalf : ncclFloat;
+  }
+
+  std::vector<ncclComm_t> comms_;
+#endif
+  const int gpu_;
+  const int size_;
+  std::vector<Peer> peers_;
+};
+
+}  // namespace cudnn_backend
+}  // namespace lczero
@@ -29,13 +29,16 @@
 
 #include <comdef.h>
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstring>
 #include <vector>
 
 #include "MetaCommand.h"
 #include "network_dx.h"
 #include "utils/exception.h"
+#include "utils/fp_convert.h"
 
 namespace lczero {
 namespace dx_backend {
@@ -44,9 +47,7 @@ namespace dx_backend {
 namespace {
 
 static void CopyFloatToHalf(dx_half* out, const float* in, size_t elements) {
-  for (int i = 0; i < elements; i++) {
-    out[i] = FP32toFP16(in[i]);
-  }
+  FP32toFP16({in, elements}, {out, elements});
 }
 
 static void CpuTranspose(float* op, float* ip, size_t rows, size_t cols) {
@@ -163,10 +164,12 @@ static void GetConvTensorDesc(TensorDesc* out_desc, int N, int C, int H, int W,
 
 GemmMetaCommand::GemmMetaCommand(DxContext* dx_context, int rows, int cols,
                                  int K, int gemm_batch, bool fp16,
-                                 bool a_transpose, bool b_transpose) {
+                                 bool a_transpose, bool b_transpose)
+    : cols_(cols), k_(K), gemm_batch_(gemm_batch), fp16_(fp16) {
   memset(scratch_data_persistent_, 0, sizeof(scratch_data_persistent_));
   memset(scratch_data_temporary_, 0, sizeof(scratch_data_temporary_));
   memset(meta_commands_, 0, sizeof(meta_commands_));
+  memset(prefer_shader_, 0, sizeof(prefer_shader_));
 
   // Note: the way GEMM is used, the 'rows'/M - dimension is a function of
   // batch size. gemm_batch is different and unrelated (either 36 for Winograd,
@@ -248,11 +251,7 @@ void GemmMetaCommand::PerformGemm(int rows, DXAlloc A, DXAlloc B,
                                   ID3D12GraphicsCommandList4* command_list) {
   if (!create_succeeded_) throw Exception("Metacommand not created");
 
-  int index = 0;
-  if (!rows_known_) {
-    index = DivUp(rows, 8) - 1;
-  }
-
+  const int index = GetIndex(rows);
   ID3D12MetaCommand* meta_command = meta_commands_[index];
   DXAlloc& scratch_persistent = scratch_data_persistent_[index];
   DXAlloc& scratch_temporary = scratch_data_temporary_[index];
@@ -267,6 +266,64 @@ void GemmMetaCommand::PerformGemm(int rows, DXAlloc A, DXAlloc B,
   command_list->ExecuteMetaCommand(meta_command, &exec_desc, sizeof(exec_desc));
 }
 
+void GemmMetaCommand::SelectByBenchmark(DxContext* dx_context, int max_rows) {
+  // Metacommands with a fixed row count are always used.
+  if (!create_succeeded_ || rows_known_) return;
+  constexpr int kRuns = 4;
+  max_rows = std::min(
+      DivUp(max_rows, kMetacommandGranulity) * kMetacommandGranulity,
+      kMaxMetacommands * kMetacommandGranulity);
+  const size_t element_size = fp16_ ? sizeof(dx_half) : sizeof(float);
+  DXAlloc a, b, out;
+  dx_context->CreateAlloc(element_size * gemm_batch_ * max_rows * k_,
+                          D3D12_HEAP_TYPE_DEFAULT, a, fp16_);
+  dx_context->CreateAlloc(element_size * gemm_batch_ * k_ * cols_,
+                          D3D12_HEAP_TYPE_DEFAULT, b, fp16_);
+  dx_context->CreateAlloc(element_size * gemm_batch_ * max_rows * cols_,
+                          D3D12_HEAP_TYPE_DEFAULT, out, fp16_);
+
+  auto time_gemm = [&](int rows, bool metacommand) {
+    auto* command_list = dx_context->getCommandList();
+    // The first run is a warm-up.
+    for (int run = 0; run <= kRuns; run++) {
+      if (run == 1) {
+        dx_context->FlushAndWait();
+        command_list = dx_context->getCommandList();
+      }
+      if (metacommand) {
+        PerformGemm(rows, a, b, out, command_list);
+      } else {
+        dx_context->getShaderWrapper()->MatrixMultiply(
+            command_list, out, a, b, rows, cols_, k_, gemm_batch_, fp16_);
+      }
+      dx_context->UavBarrier(command_list);
+    }
+    const auto start = std::chrono::steady_clock::now();
+    dx_context->FlushAndWait();
+    return std::chrono::steady_clock::now() - start;
+  };
+
+  // Row counts of a power of two granules are timed, the ones in between use
+  // the result of the next smaller one.
+  const int num_indices = std::min(GetIndex(max_rows) + 1, kMaxMetacommands);
+  bool prefer_shader = false;
+  for (int index = 0; index < num_indices; index++) {
+    const int granules = index + 1;
+    if ((granules & (granules - 1)) == 0) {
+      const int rows = granules * kMetacommandGranulity;
+      prefer_shader = time_gemm(rows, false) < time_gemm(rows, true);
+    }
+    prefer_shader_[index] = prefer_shader;
+  }
+  for (int index = num_indices; index < kMaxMetacommands; index++) {
+    prefer_shader_[index] = prefer_shader;
+  }
+
+  a.resource->Release();
+  b.resource->Release();
+  out.resource->Release();
+}
+
 GemmMetaCommand::~GemmMetaCommand() {
   for (int i = 0; i < kMaxMetacommands; i++) {
     if (scratch_data_temporary_[i].resource)
@@ -570,7 +627,7 @@ void ConvLayer::Eval(int N, DXAlloc output, DXAlloc input, DXAlloc input2,
     dx_context_->UavBarrier(command_list);
 
     // 2. Gemm (scratch -> scratch2)
-    if (meta_command_gemm_ && meta_command_gemm_->IsAvailable())
+    if (meta_command_gemm_ && meta_command_gemm_->UseFor(N * 4))
       meta_command_gemm_->PerformGemm(N * 4, scratch, transformed_weights_,
                                       scratch2, command_list);
     else
@@ -690,7 +747,7 @@ void FCLayer::Eval(int N, DXAlloc output, DXAlloc input, DXAlloc /*input2*/,
   int num_outputs = C * H * W;
   int num_inputs = input_->GetC() * input_->GetH() * input_->GetW();
 
-  if (meta_command_->IsAvailable())
+  if (meta_command_->UseFor(N))
     meta_command_->PerformGemm(N, input, weights_, output, command_list);
   else
     shader_wrapper_->MatrixMultiply(command_list, output, input, weights_,
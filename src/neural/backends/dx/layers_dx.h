@@ -88,9 +88,23 @@ class GemmMetaCommand {
   DXAlloc scratch_data_persistent_[kMaxMetacommands];
   DXAlloc scratch_data_temporary_[kMaxMetacommands];
 
+  // Set by SelectByBenchmark() for the row counts where our compute shader
+  // is faster than the metacommand.
+  bool prefer_shader_[kMaxMetacommands];
+
   bool rows_known_;
   bool create_succeeded_;
 
+  // Shape of the GEMM, for the compute shader it's timed against.
+  int cols_;
+  int k_;
+  int gemm_batch_;
+  bool fp16_;
+
+  int GetIndex(int rows) const {
+    return rows_known_ ? 0 : DivUp(rows, kMetacommandGranulity) - 1;
+  }
+
  public:
   GemmMetaCommand(DxContext* dx_context, int M, int N, int K, int gemm_batch,
                   bool fp16, bool a_transpose, bool b_transpose);
@@ -100,6 +114,15 @@ class GemmMetaCommand {
                    ID3D12GraphicsCommandList4* command_list);
 
   bool IsAvailable() { return create_succeeded_; }
+  // Whether a GEMM of @rows rows should use the metacommand rather than the
+  // compute shader.
+  bool UseFor(int rows) const {
+    return create_succeeded_ && !prefer_shader_[GetIndex(rows)];
+  }
+  // Times the metacommand against the compute shader for a few row counts up
+  // to @max_rows, and uses the faster one for each row count from then on.
+  // Only for GEMMs that are not transposed, as the shader doesn't do that.
+  void SelectByBenchmark(DxContext* dx_context, int max_rows);
 };
 
 class ConvMetaCommand {
@@ -183,6 +206,7 @@ class FCLayer : public BaseLayer {
   void Eval(int N, DXAlloc output, DXAlloc input, DXAlloc input2,
             DXAlloc scratch, DXAlloc scratch2,
             ID3D12GraphicsCommandList4* command_list) override;
+  GemmMetaCommand* GetMetaCommand() { return meta_command_.get(); }
 
  private:
   const bool use_bias_;
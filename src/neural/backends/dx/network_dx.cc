@@ -46,6 +46,10 @@ namespace dx_backend {
 uint64_t DxContext::FlushCL(ID3D12GraphicsCommandList4* cl) {
   if (!cl) cl = command_list_;
   cl->Close();
+  return ExecuteCL(cl);
+}
+
+uint64_t DxContext::ExecuteCL(ID3D12GraphicsCommandList4* cl) {
   command_queue_->ExecuteCommandLists(1, (ID3D12CommandList**)&cl);
   command_queue_->Signal(fence_, ++fence_val_);
   return fence_val_;
@@ -391,11 +395,19 @@ DxNetwork::DxNetwork(const WeightsFile& file, const OptionsDict& options)
   // directly (whatever algorithm HW vendor is providing), and if neither is
   // available use winograd algorithm with our own GEMM compute shader.
   // The below backend options can be used to override this for testing.
+  // Where the GEMM metacommand is used, it's timed against our own shader at
+  // startup and only kept for the row counts where it's faster, unless
+  // --backend-opts=gemm-autoselect=false.
   bool enable_gemm_metacommand =
       options.GetOrDefault<bool>("enable-gemm-metacommand", true);
+  const bool gemm_autoselect =
+      options.GetOrDefault<bool>("gemm-autoselect", true);
   bool enable_conv_metacommand =
       options.GetOrDefault<bool>("enable-conv-metacommand", true);
 
+  // Re-execute recorded command lists when the batch size doesn't change.
+  replay_ = options.GetOrDefault<bool>("replay", true);
+
   const int kNumFilters = (int)weights.input.biases.size();
 
   num_blocks_ = (int)weights.residual.size();
@@ -629,6 +641,21 @@ DxNetwork::DxNetwork(const WeightsFile& file, const OptionsDict& options)
 
   dx_context_.FlushAndWait();
 
+  if (enable_gemm_metacommand && gemm_autoselect) {
+    // Winograd GEMMs have 4 rows (tiles) per sample.
+    for (auto* gemm : {input_conv_gemm_metacommand_.get(),
+                       residual_block_gemm_metacommand_.get(),
+                       policy_conv_gemm_metacommand_.get()}) {
+      if (gemm) gemm->SelectByBenchmark(&dx_context_, max_batch_size_ * 4);
+    }
+    for (auto& layer : network_) {
+      auto* fc = dynamic_cast<FCLayer*>(layer.get());
+      if (fc && fc->GetMetaCommand()) {
+        fc->GetMetaCommand()->SelectByBenchmark(&dx_context_, max_batch_size_);
+      }
+    }
+  }
+
   // Allocate GPU memory for running the network
   // 4 buffers of max size are enough:
   //   * one to hold input,
@@ -644,21 +671,20 @@ DxNetwork::DxNetwork(const WeightsFile& file, const OptionsDict& options)
   for (auto& mem : tensor_mem_) {
     dx_context_.CreateAlloc(max_size, D3D12_HEAP_TYPE_DEFAULT, mem, fp16_);
   }
-}
 
-void DxNetwork::Eval(InputsOutputsDx* io, int batch_size) {
-  if (batch_size > kMaxSupportedBatchSize)
-    throw Exception("Unsupported batch size: " + std::to_string(batch_size));
-
-#ifdef DEBUG_DUMP_PER_LAYER_DATA
-  lock_.lock();
-  ID3D12GraphicsCommandList4* cl = dx_context_.getCommandList();
-#else
-  ID3D12GraphicsCommandList4* cl = io->command_list_;
-  dx_context_.ResetCL(cl, io->command_allocator_, io->needs_reset_);
-#endif
+  // Create the upload/readback heaps and command lists for the computations
+  // expected to be in flight up front, instead of on the first evaluations.
+  const int inflight = options.GetOrDefault<int>("inflight", 2);
+  for (int i = 0; i < inflight; i++) {
+    free_inputs_outputs_.push_back(std::make_unique<InputsOutputsDx>(
+        max_batch_size_, &dx_context_, has_wdl_, moves_left_, has_conv_policy_,
+        fp16_));
+  }
+}
 
-// Expand packed board representation into full planes.
+void DxNetwork::RecordEval(InputsOutputsDx* io, int batch_size,
+                           ID3D12GraphicsCommandList4* cl) {
+  // Expand packed board representation into full planes.
 
 #ifdef COPY_BEFORE_SHADER_READ
   // First copy from upload heap to scratch mem
@@ -822,22 +848,40 @@ void DxNetwork::Eval(InputsOutputsDx* io, int batch_size) {
     dx_context_.DumpTensor("After moves left fc2", io->op_moves_left_mem_gpu_,
                            8, fp16_);
   }
+}
+
+void DxNetwork::Eval(InputsOutputsDx* io, int batch_size) {
+  if (batch_size > kMaxSupportedBatchSize)
+    throw Exception("Unsupported batch size: " + std::to_string(batch_size));
 
-//-----------------------------------///---------------------------------------
 #ifdef DEBUG_DUMP_PER_LAYER_DATA
+  lock_.lock();
+  ID3D12GraphicsCommandList4* cl = dx_context_.getCommandList();
+  RecordEval(io, batch_size, cl);
   dx_context_.FlushAndWait();
   lock_.unlock();
 #else
+  ID3D12GraphicsCommandList4* cl = io->command_list_;
+  // A closed command list can be executed again as long as its allocator isn't
+  // reset. It only refers to this io's heaps and the shared tensors, so for an
+  // unchanged batch size the recording is skipped.
+  const bool replay = replay_ && io->recorded_batch_size_ == batch_size;
+  if (!replay) {
+    dx_context_.ResetCL(cl, io->command_allocator_, io->needs_reset_);
+    RecordEval(io, batch_size, cl);
+  }
+
   // TODO: Get rid of this lock once we move the Command Queue also to
   // InputsOutputs structure This isn't a bottleneck anyway (for CPU side perf).
   // The hope is that we will get some GPU side parallelism with multiple async
   // compute queues.
   lock_.lock();
-  uint64_t fence = dx_context_.FlushCL(cl);
+  uint64_t fence = replay ? dx_context_.ExecuteCL(cl) : dx_context_.FlushCL(cl);
   lock_.unlock();
 
   dx_context_.WaitForGpu(fence);
   io->needs_reset_ = true;
+  io->recorded_batch_size_ = batch_size;
 #endif
 
   // Do some simple post-processing operations on CPU:
@@ -937,9 +981,11 @@ std::unique_ptr<InputsOutputsDx> DxNetwork::GetInputsOutputs() {
                                              has_wdl_, moves_left_,
                                              has_conv_policy_, fp16_);
   } else {
+    // Most recently used first, its command list is the most likely to have
+    // been recorded for the same batch size.
     std::unique_ptr<InputsOutputsDx> resource =
-        std::move(free_inputs_outputs_.front());
-    free_inputs_outputs_.pop_front();
+        std::move(free_inputs_outputs_.back());
+    free_inputs_outputs_.pop_back();
     return resource;
   }
 }
@@ -985,6 +1031,7 @@ InputsOutputsDx::InputsOutputsDx(int maxBatchSize, DxContext* dx_context,
                                  bool fp16)
     : uses_policy_map_(policy_map),
       needs_reset_(false),
+      recorded_batch_size_(0),
       moves_left_(moves_left) {
   // CPU accesses on Default heap doesn't work.
   // GPU accesses on Upload heap works.
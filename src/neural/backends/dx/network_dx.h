@@ -88,6 +88,9 @@ struct InputsOutputsDx {
   // Always need to reset command list / allocator after first time.
   bool needs_reset_;
 
+  // Batch size the closed command list was recorded for, 0 if none.
+  int recorded_batch_size_;
+
   const bool uses_policy_map_;
   const bool moves_left_;
 };
@@ -127,6 +130,11 @@ class DxNetworkComputation : public NetworkComputation {
         ->op_policy_mem_final_[sample * kNumOutputPolicy + move_id];
   }
 
+  std::span<const float> GetPolicyView(int sample) const override {
+    return {&inputs_outputs_->op_policy_mem_final_[sample * kNumOutputPolicy],
+            static_cast<size_t>(kNumOutputPolicy)};
+  }
+
   float GetMVal(int sample) const override {
     if (moves_left_) {
       return inputs_outputs_->op_moves_left_mem_final_[sample];
@@ -182,6 +190,8 @@ class DxContext {
                    bool fp16);
   void UavBarrier(ID3D12GraphicsCommandList4* cl = nullptr);
   uint64_t FlushCL(ID3D12GraphicsCommandList4* cl = nullptr);
+  // Executes an already closed command list again.
+  uint64_t ExecuteCL(ID3D12GraphicsCommandList4* cl);
   void WaitForGpu(uint64_t fence_val = 0);
   void ResetCL(ID3D12GraphicsCommandList4* cl = nullptr,
                ID3D12CommandAllocator* ca = nullptr, bool reset = true);
@@ -228,10 +238,15 @@ class DxNetwork : public Network {
   bool has_conv_policy_;
   bool fp16_;
   bool moves_left_;
+  bool replay_;
 
   std::vector<std::unique_ptr<BaseLayer>> network_;
   BaseLayer* getLastLayer() { return network_.back().get(); }
 
+  // Records the commands evaluating the network into cl.
+  void RecordEval(InputsOutputsDx* io, int batch_size,
+                  ID3D12GraphicsCommandList4* cl);
+
   // Unique Metacommands used multiple times in the network.
 
   // GEMM metacommands needed by winograd algorithm.
@@ -0,0 +1,134 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "neural/backends/latency.h"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "utils/exception.h"
+#include "utils/logging.h"
+#include "utils/random.h"
+#include "utils/string.h"
+
+namespace lczero {
+namespace {
+
+// Accepts both "300" and "300.0".
+float GetMicroseconds(const OptionsDict& options, const std::string& key) {
+  if (options.Exists<int>(key)) return options.Get<int>(key);
+  return options.GetOrDefault<float>(key, 0.0f);
+}
+
+}  // namespace
+
+LatencyEmulator::LatencyEmulator(const OptionsDict& options)
+    : base_us_(GetMicroseconds(options, "latency_base_us")),
+      sample_us_(GetMicroseconds(options, "latency_sample_us")),
+      jitter_(options.GetOrDefault<float>("latency_jitter", 0.0f)),
+      max_streams_(options.GetOrDefault<int>("max_streams", 0)) {
+  const auto curve = options.GetOrDefault<std::string>("latency_curve", "");
+  for (const auto& point : StrSplit(curve, ",")) {
+    if (Trim(point).empty()) continue;
+    const auto parts = StrSplit(point, ":");
+    try {
+      if (parts.size() != 2) throw std::invalid_argument(point);
+      curve_.emplace_back(std::stoi(parts[0]), std::stof(parts[1]));
+    } catch (const std::exception&) {
+      throw Exception("Bad latency_curve point \"" + point +
+                      "\", expected batch:us");
+    }
+  }
+  std::sort(curve_.begin(), curve_.end());
+  if (base_us_ < 0.0f || sample_us_ < 0.0f || jitter_ < 0.0f ||
+      jitter_ >= 1.0f || max_streams_ < 0) {
+    throw Exception("Bad latency emulation options");
+  }
+  enabled_ = base_us_ > 0.0f || sample_us_ > 0.0f || !curve_.empty() ||
+             max_streams_ > 0;
+  if (!enabled_) return;
+  if (curve_.empty()) {
+    CERR << "Emulating batch latency of " << base_us_ << "us + " << sample_us_
+         << "us per position.";
+  } else {
+    CERR << "Emulating batch latency from a curve of " << curve_.size()
+         << " points.";
+  }
+  if (max_streams_ > 0) {
+    CERR << "At most " << max_streams_ << " batches computed at once.";
+  }
+}
+
+std::chrono::duration<float, std::micro> LatencyEmulator::GetLatency(
+    int batch_size) const {
+  float us;
+  if (curve_.empty()) {
+    us = base_us_ + sample_us_ * batch_size;
+  } else if (curve_.size() == 1 || batch_size <= curve_.front().first) {
+    us = curve_.front().second;
+  } else {
+    auto hi = std::lower_bound(
+        curve_.begin(), curve_.end(), batch_size,
+        [](const auto& point, int size) { return point.first < size; });
+    if (hi == curve_.end()) --hi;
+    const auto lo = std::prev(hi);
+    const float slope =
+        (hi->second - lo->second) / std::max(hi->first - lo->first, 1);
+    us = std::max(lo->second + slope * (batch_size - lo->first), 0.0f);
+  }
+  if (jitter_ > 0.0f) {
+    us *= 1.0f - jitter_ + Random::Get().GetFloat(2.0f * jitter_);
+  }
+  return std::chrono::duration<float, std::micro>(us);
+}
+
+void LatencyEmulator::Wait(int batch_size) {
+  if (!enabled_) return;
+  if (max_streams_ > 0) {
+    Mutex::Lock lock(mutex_);
+    while (active_streams_ >= max_streams_) cv_.wait(lock.get_raw());
+    ++active_streams_;
+  }
+  const auto latency = GetLatency(batch_size);
+  if (latency.count() > 0) {
+    std::this_thread::sleep_for(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            latency));
+  }
+  if (max_streams_ > 0) {
+    {
+      Mutex::Lock lock(mutex_);
+      --active_streams_;
+    }
+    cv_.notify_one();
+  }
+}
+
+}  // namespace lczero
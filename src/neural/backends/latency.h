@@ -0,0 +1,73 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <utility>
+#include <vector>
+
+#include "utils/mutex.h"
+#include "utils/optionsdict.h"
+
+namespace lczero {
+
+// Makes synthetic backends (trivial, random) take as long as a real one would,
+// so that search scaling (collisions, pipelining) can be studied without a GPU.
+// Backend options:
+//   latency_base_us, latency_sample_us: batch takes base + sample * batch size.
+//   latency_curve: "batch:us,batch:us,..." measured points, interpolated
+//     linearly and extrapolated with the last segment. Overrides the above.
+//   latency_jitter: each batch takes up to this fraction longer or shorter.
+//   max_streams: how many batches may be computed at once, the others queue.
+class LatencyEmulator {
+ public:
+  explicit LatencyEmulator(const OptionsDict& options);
+
+  bool IsEnabled() const { return enabled_; }
+  // Blocks for as long as a batch of @batch_size takes, including the wait
+  // for a free stream.
+  void Wait(int batch_size);
+
+ private:
+  std::chrono::duration<float, std::micro> GetLatency(int batch_size) const;
+
+  float base_us_ = 0.0f;
+  float sample_us_ = 0.0f;
+  // (batch size, microseconds), sorted by batch size.
+  std::vector<std::pair<int, float>> curve_;
+  float jitter_ = 0.0f;
+  int max_streams_ = 0;
+  bool enabled_ = false;
+
+  Mutex mutex_;
+  std::condition_variable cv_;
+  int active_streams_ GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace lczero
@@ -54,9 +54,14 @@ static MPSImageFeatureChannelFormat fcFormat = MPSImageFeatureChannelFormatFloat
     // Variables to track results of graph inference.
     NSArray<MPSGraphTensor *> * _resultTensors;
     NSArray<MPSGraphTensor *> * _targetTensors;
-    NSMutableDictionary<NSNumber *, MPSGraphTensorDataDictionary *> * _resultDataDicts;
     NSMutableDictionary<NSString *, NSObject *> * _readVariables;
 
+    // Compiled executables, keyed by padded sub-batch size.
+    NSMutableDictionary<NSNumber *, MPSGraphExecutable *> * _executables;
+
+    // Free shared-storage input buffers, reused across sub-batches.
+    NSMutableArray<id<MTLBuffer>> * _inputBuffers;
+
     // Variables for triple buffering
     dispatch_semaphore_t _doubleBufferingSemaphore;
 
@@ -201,11 +206,17 @@ static MPSImageFeatureChannelFormat fcFormat = MPSImageFeatureChannelFormatFloat
                                                           inputs:(float * __nonnull)inputs
                                                          outputs:(float * __nonnull * __nonnull)outputBuffers;
 
+-(nonnull MPSGraphExecutable *) executableForBatchSize:(NSUInteger)batchSize;
+
+-(nonnull id<MTLBuffer>) inputBufferWithLength:(NSUInteger)length;
+
 -(nonnull MPSCommandBuffer *) runCommandSubBatchWithInputs:(float * __nonnull)inputs
-                                                  subBatch:(NSUInteger)subBatch
-                                              subBatchSize:(NSUInteger)subBatchSize;
+                                              subBatchSize:(NSUInteger)subBatchSize
+                                                   results:(NSMutableArray<NSArray<MPSGraphTensorData *> *> * __nonnull)results;
 
--(void) copyResultsToBuffers:(float * __nonnull * __nonnull)outputBuffers
-                subBatchSize:(NSUInteger)subBatchSize;
+-(void) copyResults:(NSArray<NSArray<MPSGraphTensorData *> *> * __nonnull)results
+          toBuffers:(float * __nonnull * __nonnull)outputBuffers
+       subBatchSize:(NSUInteger)subBatchSize
+   lastSubBatchSize:(NSUInteger)lastSubBatchSize;
 
 @end
@@ -27,6 +27,7 @@
 
 #import "neural/network_legacy.h"
 #import "NetworkGraph.h"
+#import <cstring>
 #import <vector>
 
 static MPSGraphConvolution2DOpDescriptor * __nonnull convolution2DDescriptor = [MPSGraphConvolution2DOpDescriptor descriptorWithStrideInX:1
@@ -47,9 +48,17 @@ static MPSGraphPooling2DOpDescriptor * __nonnull averagePoolingDescriptor = [MPS
 
 static const NSUInteger kNumPolicyOutputs = 1858;
 
-// Maximum number of metal command buffers that can run simultaneously.
+// Maximum number of sub-batches a single inference call is split into.
 static const NSUInteger kMaxInflightBuffers = 2;
 
+// Maximum number of metal command buffers that can run simultaneously, across
+// all threads evaluating on this graph.
+static const NSUInteger kMaxInflightCommandBuffers = 2 * kMaxInflightBuffers;
+
+// Sub-batch sizes are rounded up to a multiple of this, so only a handful of
+// executables have to be compiled.
+static const NSUInteger kExecutableBatchStep = 8;
+
 // Minimum batch size below which parallel command buffers will not be used.
 static const NSInteger kMinSubBatchSize = 20;
 
@@ -129,8 +138,9 @@ static const NSInteger kMinSubBatchSize = 20;
     _queue = [device newCommandQueue];
     _resultTensors = @[];
     _readVariables = [[NSMutableDictionary alloc] init];
-    _doubleBufferingSemaphore = dispatch_semaphore_create(kMaxInflightBuffers);
-    _resultDataDicts = [NSMutableDictionary dictionaryWithCapacity:kMaxInflightBuffers];
+    _doubleBufferingSemaphore = dispatch_semaphore_create(kMaxInflightCommandBuffers);
+    _executables = [[NSMutableDictionary alloc] init];
+    _inputBuffers = [[NSMutableArray alloc] init];
 
     return self;
 }
@@ -146,79 +156,138 @@ static const NSInteger kMinSubBatchSize = 20;
     NSUInteger subBatchSize = batchSize / splits;
     NSUInteger inputDataLength = subBatchSize * [_inputTensor sizeOfDimensions:@[@1, @2, @3]];
 
+    // Results are kept per call, so several threads can run inference on the graph at once.
+    NSMutableArray<NSArray<MPSGraphTensorData *> *> * results = [NSMutableArray arrayWithCapacity:splits];
+
     // Split batchSize into smaller sub-batches and run using double-buffering.
     NSUInteger subBatch = 0;
     MPSCommandBuffer * commandBuffer;
     for (subBatch = 0; subBatch < splits - 1; subBatch++) {
         commandBuffer = [self runCommandSubBatchWithInputs:inputs + subBatch * inputDataLength
-                                                  subBatch:subBatch
-                                              subBatchSize:subBatchSize];
+                                              subBatchSize:subBatchSize
+                                                   results:results];
     }
     // Last sub-batch may be smaller or larger than others.
+    NSUInteger lastSubBatchSize = batchSize - subBatch * subBatchSize;
     MPSCommandBuffer * latestCommandBuffer = [self runCommandSubBatchWithInputs:inputs + subBatch * inputDataLength
-                                                                       subBatch:subBatch
-                                                                   subBatchSize:batchSize - subBatch * subBatchSize];
+                                                                   subBatchSize:lastSubBatchSize
+                                                                        results:results];
 
     // Wait for the last batch to be processed.
     [latestCommandBuffer waitUntilCompleted];
     [commandBuffer waitUntilCompleted];
 
-    [self copyResultsToBuffers:outputBuffers subBatchSize:subBatchSize];
+    [self copyResults:results
+            toBuffers:outputBuffers
+         subBatchSize:subBatchSize
+     lastSubBatchSize:lastSubBatchSize];
 
     return _resultTensors;
 }
 
+-(nonnull MPSGraphExecutable *) executableForBatchSize:(NSUInteger)batchSize
+{
+    // Caller holds the lock on self.
+    MPSGraphExecutable * executable = _executables[@(batchSize)];
+    if (executable != nil) return executable;
+
+    MPSShape * shape = @[@(batchSize), _inputTensor.shape[1], _inputTensor.shape[2], _inputTensor.shape[3]];
+    MPSGraphShapedType * inputType = [[MPSGraphShapedType alloc] initWithShape:shape
+                                                                      dataType:_inputTensor.dataType];
+    executable = [self compileWithDevice:_device
+                                   feeds:@{_inputTensor : inputType}
+                           targetTensors:_targetTensors
+                        targetOperations:nil
+                   compilationDescriptor:nil];
+    _executables[@(batchSize)] = executable;
+    return executable;
+}
+
+-(nonnull id<MTLBuffer>) inputBufferWithLength:(NSUInteger)length
+{
+    // Caller holds the lock on self.
+    for (NSUInteger i = 0; i < [_inputBuffers count]; i++) {
+        if ([_inputBuffers[i] length] >= length) {
+            id<MTLBuffer> buffer = _inputBuffers[i];
+            [_inputBuffers removeObjectAtIndex:i];
+            return buffer;
+        }
+    }
+    // Shared storage lives in unified memory, so the CPU fills it in place.
+    return [_device.metalDevice newBufferWithLength:length
+                                            options:MTLResourceStorageModeShared];
+}
+
 -(nonnull MPSCommandBuffer *) runCommandSubBatchWithInputs:(float * __nonnull)inputs
-                                                  subBatch:(NSUInteger)subBatch
                                               subBatchSize:(NSUInteger)subBatchSize
+                                                   results:(NSMutableArray<NSArray<MPSGraphTensorData *> *> * __nonnull)results
 {
+    // Pad the sub-batch to the size of a cached executable.
+    NSUInteger paddedSize = (subBatchSize + kExecutableBatchStep - 1) / kExecutableBatchStep * kExecutableBatchStep;
+    NSUInteger inputBytes = subBatchSize * [_inputTensor sizeOfDimensions:@[@1, @2, @3]] * sizeof(float);
+    NSUInteger paddedBytes = paddedSize * [_inputTensor sizeOfDimensions:@[@1, @2, @3]] * sizeof(float);
+
+    MPSGraphExecutable * executable;
+    id<MTLBuffer> inputBuffer;
+    @synchronized (self) {
+        executable = [self executableForBatchSize:paddedSize];
+        inputBuffer = [self inputBufferWithLength:paddedBytes];
+    }
+    memcpy(inputBuffer.contents, inputs, inputBytes);
+    memset((char *)inputBuffer.contents + inputBytes, 0, paddedBytes - inputBytes);
+
+    MPSShape * shape = @[@(paddedSize), _inputTensor.shape[1], _inputTensor.shape[2], _inputTensor.shape[3]];
+    MPSGraphTensorData * inputTensorData = [[MPSGraphTensorData alloc] initWithMTLBuffer:inputBuffer
+                                                                                   shape:shape
+                                                                                dataType:_inputTensor.dataType];
+
     // Double buffering semaphore to correctly double buffer iterations.
     dispatch_semaphore_wait(_doubleBufferingSemaphore, DISPATCH_TIME_FOREVER);
 
     // Create command buffer for this sub-batch.
     MPSCommandBuffer * commandBuffer = [MPSCommandBuffer commandBufferFromCommandQueue:_queue];
 
-    MPSShape * shape = @[@(subBatchSize), _inputTensor.shape[1], _inputTensor.shape[2], _inputTensor.shape[3]];
-
-    NSData * inputData = [NSData dataWithBytesNoCopy:inputs
-                                              length:subBatchSize * sizeof(float)
-                                        freeWhenDone:NO];
-
-    MPSGraphTensorData * inputTensorData = [[MPSGraphTensorData alloc] initWithDevice:_device
-                                                                                 data:inputData
-                                                                                shape:shape
-                                                                             dataType:_inputTensor.dataType];
-
-    // Create execution descriptor with block to update results for each iteration.
-    MPSGraphExecutionDescriptor * executionDescriptor = [[MPSGraphExecutionDescriptor alloc] init];
-    executionDescriptor.completionHandler = ^(MPSGraphTensorDataDictionary * resultDictionary, NSError * error) {
-        _resultDataDicts[@(subBatch)] = resultDictionary;
-
-        // Release double buffering semaphore for the next training iteration to be encoded.
+    // Return the input buffer to the pool and release the semaphore once the GPU is done.
+    MPSGraphExecutableExecutionDescriptor * executionDescriptor = [[MPSGraphExecutableExecutionDescriptor alloc] init];
+    executionDescriptor.completionHandler = ^(NSArray<MPSGraphTensorData *> * resultArray, NSError * error) {
+        @synchronized (self) {
+            [_inputBuffers addObject:inputBuffer];
+        }
         dispatch_semaphore_signal(_doubleBufferingSemaphore);
     };
 
-    [self encodeToCommandBuffer:commandBuffer
-                          feeds:@{_inputTensor : inputTensorData}
-                  targetTensors:_targetTensors
-               targetOperations:nil
-            executionDescriptor:executionDescriptor];
+    // Result tensor data is ordered like _targetTensors, which starts with _resultTensors.
+    NSArray<MPSGraphTensorData *> * resultArray = [executable encodeToCommandBuffer:commandBuffer
+                                                                        inputsArray:@[inputTensorData]
+                                                                       resultsArray:nil
+                                                                executionDescriptor:executionDescriptor];
+    [results addObject:resultArray];
 
     // Commit the command buffer
     [commandBuffer commit];
     return commandBuffer;
 }
 
-
--(void) copyResultsToBuffers:(float * __nonnull * __nonnull)outputBuffers
-                subBatchSize:(NSUInteger)subBatchSize
+-(void) copyResults:(NSArray<NSArray<MPSGraphTensorData *> *> * __nonnull)results
+          toBuffers:(float * __nonnull * __nonnull)outputBuffers
+       subBatchSize:(NSUInteger)subBatchSize
+   lastSubBatchSize:(NSUInteger)lastSubBatchSize
 {
-    // Copy results for batch back into the output buffers.
+    // Copy results for batch back into the output buffers, dropping the padding rows.
+    std::vector<float> padded;
     for (NSUInteger rsIdx = 0; rsIdx < [_resultTensors count]; rsIdx++) {
-        NSUInteger outputDataLength = [_resultTensors[rsIdx] sizeOfDimensions:@[@1, @2, @3]] * subBatchSize;
-        for (NSUInteger subBatch = 0; subBatch < [_resultDataDicts count]; subBatch++) {
-            [[_resultDataDicts[@(subBatch)][_resultTensors[rsIdx]] mpsndarray] readBytes:outputBuffers[rsIdx] + subBatch * outputDataLength
-                                                                             strideBytes:nil];
+        NSUInteger sampleLength = [_resultTensors[rsIdx] sizeOfDimensions:@[@1, @2, @3]];
+        for (NSUInteger subBatch = 0; subBatch < [results count]; subBatch++) {
+            NSUInteger size = subBatch + 1 == [results count] ? lastSubBatchSize : subBatchSize;
+            float * output = outputBuffers[rsIdx] + subBatch * subBatchSize * sampleLength;
+            MPSNDArray * ndarray = [results[subBatch][rsIdx] mpsndarray];
+            if ([ndarray lengthOfDimension:0] == size) {
+                [ndarray readBytes:output strideBytes:nil];
+            } else {
+                padded.resize([ndarray lengthOfDimension:0] * sampleLength);
+                [ndarray readBytes:padded.data() strideBytes:nil];
+                memcpy(output, padded.data(), size * sampleLength * sizeof(float));
+            }
         }
     }
 }
@@ -232,6 +301,9 @@ static const NSInteger kMinSubBatchSize = 20;
     // Set the results we're interested in.
     _resultTensors = results;
 
+    // Executables compiled for the old targets are stale.
+    [_executables removeAllObjects];
+
     // Target tensor for graph is combination of both.
     _targetTensors = [NSArray arrayWithArray:_resultTensors];
     _targetTensors = [_targetTensors arrayByAddingObjectsFromArray:[_readVariables allValues]];
@@ -37,8 +37,7 @@
 #include "mps/MetalNetworkBuilder.h"
 #include "neural/factory.h"
 #include "neural/network_legacy.h"
-#include "neural/tables/attention_policy_map.h"
-#include "neural/tables/policy_map.h"
+#include "neural/tables/policy_gather.h"
 #include "utils/bititer.h"
 #include "utils/exception.h"
 
@@ -178,9 +177,8 @@ void MetalNetwork::forwardEval(InputsOutputs* io, int batchSize) {
     }
   }
 
-  // Metal is not thread-safe, so lock is needed.
-  lock_.lock();
-
+  // The graph runs each call on its own command buffers, so evaluations from
+  // several threads overlap on the GPU without a lock here.
   if (attn_policy_ || conv_policy_) {
     /**
      * @todo policy map implementation has bug in MPSGraph (GatherND not working
@@ -198,8 +196,6 @@ void MetalNetwork::forwardEval(InputsOutputs* io, int batchSize) {
           &io->input_val_mem_expanded_[0], batchSize,
           {&io->op_policy_raw_mem_[0], &io->op_value_mem_[0]});
     }
-    // The next thread can start using the GPU now.
-    lock_.unlock();
 
     if (attn_policy_) {
       // Promotion offset calculation.
@@ -219,23 +215,18 @@ void MetalNetwork::forwardEval(InputsOutputs* io, int batchSize) {
       }
       // Mapping from attention policy to lc0 policy
       for (size_t batch = 0; batch < batchSize; batch++) {
-        for (size_t i = 0; i < 64 * 64 + 8 * 24; i++) {
-          size_t j = kAttnPolicyMap[i];
-          if (j >= 0) {
-            io->op_policy_mem_[batch * 1858 + j] =
-                io->op_policy_raw_mem_[batch * (64 * 64 + 8 * 24) + i];
-          }
+        for (size_t j = 0; j < kPolicyGatherOutputs; j++) {
+          io->op_policy_mem_[batch * 1858 + j] =
+              io->op_policy_raw_mem_[batch * (64 * 64 + 8 * 24) +
+                                     kAttnPolicyGather[j]];
         }
       }
     } else if (conv_policy_) {
       // Mapping from convolutional policy to lc0 policy
       for (size_t batch = 0; batch < batchSize; batch++) {
-        for (size_t i = 0; i < 73 * 64; i++) {
-          short j = kConvPolicyMap[i];
-          if (j >= 0) {
-            io->op_policy_mem_[batch * 1858 + j] =
-                io->op_policy_raw_mem_[batch * 80 * 64 + i];
-          }
+        for (size_t j = 0; j < kPolicyGatherOutputs; j++) {
+          io->op_policy_mem_[batch * 1858 + j] =
+              io->op_policy_raw_mem_[batch * 80 * 64 + kConvPolicyGather[j]];
         }
       }
     }
@@ -249,9 +240,6 @@ void MetalNetwork::forwardEval(InputsOutputs* io, int batchSize) {
       builder_->forwardEval(&io->input_val_mem_expanded_[0], batchSize,
                             {&io->op_policy_mem_[0], &io->op_value_mem_[0]});
     }
-
-    // The next thread can start using the GPU now.
-    lock_.unlock();
   }
 }
 
@@ -86,6 +86,11 @@ class MetalNetworkComputation : public NetworkComputation {
     return inputs_outputs_->op_policy_mem_[sample * kNumOutputPolicy + move_id];
   }
 
+  std::span<const float> GetPolicyView(int sample) const override {
+    return {&inputs_outputs_->op_policy_mem_[sample * kNumOutputPolicy],
+            static_cast<size_t>(kNumOutputPolicy)};
+  }
+
   float GetMVal(int sample) const override {
     if (moves_left_) {
       return inputs_outputs_->op_moves_left_mem_[sample];
@@ -153,10 +158,6 @@ class MetalNetwork : public Network {
   std::mutex inputs_outputs_lock_;
   std::list<std::unique_ptr<InputsOutputs>> free_inputs_outputs_;
   std::unique_ptr<MetalNetworkBuilder> builder_;
-
-  // Metal not really good at multi-threading, so we need to do one NN eval at a
-  // time.
-  mutable std::mutex lock_;
 };
 
 }  // namespace metal_backend
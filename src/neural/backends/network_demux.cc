@@ -25,12 +25,19 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <memory>
+#include <numeric>
 #include <queue>
 #include <thread>
 
 #include "neural/factory.h"
 #include "utils/exception.h"
+#include "utils/mutex.h"
+#include "utils/parking.h"
 
 namespace lczero {
 namespace {
@@ -42,62 +49,132 @@ class DemuxingComputation : public NetworkComputation {
 
   void AddInput(InputPlanes&& input) override { planes_.emplace_back(input); }
 
+  void SetOutputHeads(OutputHeads heads) override { heads_ = heads; }
+
   void ComputeBlocking() override;
 
   int GetBatchSize() const override { return planes_.size(); }
 
-  float GetQVal(int sample) const override {
-    const int idx = sample / partial_size_;
-    const int offset = sample % partial_size_;
-    return parents_[idx]->GetQVal(offset);
+  float GetQVal(int sample) const override { return values_[sample].q; }
+
+  float GetDVal(int sample) const override { return values_[sample].d; }
+
+  float GetMVal(int sample) const override { return values_[sample].m; }
+
+  float GetPVal(int sample, int move_id) const override {
+    const int idx = GetSplit(sample);
+    return parents_[idx]->GetPVal(sample - split_begin_[idx], move_id);
   }
 
-  float GetDVal(int sample) const override {
-    int idx = sample / partial_size_;
-    int offset = sample % partial_size_;
-    return parents_[idx]->GetDVal(offset);
+  std::span<const float> GetPolicyView(int sample) const override {
+    const int idx = GetSplit(sample);
+    return parents_[idx]->GetPolicyView(sample - split_begin_[idx]);
   }
 
-  float GetMVal(int sample) const override {
-    int idx = sample / partial_size_;
-    int offset = sample % partial_size_;
-    return parents_[idx]->GetMVal(offset);
+  void GetPolicy(int sample, std::span<const uint16_t> move_ids,
+                 std::span<float> dst) const override {
+    const int idx = GetSplit(sample);
+    parents_[idx]->GetPolicy(sample - split_begin_[idx], move_ids, dst);
   }
 
-  float GetPVal(int sample, int move_id) const override {
-    const int idx = sample / partial_size_;
-    const int offset = sample % partial_size_;
-    return parents_[idx]->GetPVal(offset, move_id);
+  // Called from the worker of split @idx once its parent is computed. The
+  // value heads are copied out, the policy is still read from the parent as
+  // most of it is never looked at.
+  void ScatterOutputs(int idx) {
+    const NetworkComputation& parent = *parents_[idx];
+    for (int i = 0; i < parent.GetBatchSize(); ++i) {
+      values_[split_begin_[idx] + i] = {parent.GetQVal(i), parent.GetDVal(i),
+                                        parent.GetMVal(i)};
+    }
   }
 
+  // The last split to complete wakes the waiting ComputeBlocking().
   void NotifyComplete() {
-    std::unique_lock<std::mutex> lock(mutex_);
-    dataready_--;
-    if (dataready_ == 0) {
-      dataready_cv_.notify_one();
+    if (dataready_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      completion_.Notify();
     }
   }
 
-  NetworkComputation* AddParentFromNetwork(Network* network) {
-    std::unique_lock<std::mutex> lock(mutex_);
-    parents_.emplace_back(network->NewComputation());
-    const int cur_idx = (parents_.size() - 1) * partial_size_;
-    for (int i = cur_idx; i < std::min(GetBatchSize(), cur_idx + partial_size_);
-         i++) {
-      parents_.back()->AddInput(std::move(planes_[i]));
+  // Called from the worker of the network that computes split @idx.
+  NetworkComputation* AddParentFromNetwork(int idx, Network* network) {
+    auto parent = network->NewComputation();
+    const int end = idx + 1 < static_cast<int>(split_begin_.size())
+                        ? split_begin_[idx + 1]
+                        : GetBatchSize();
+    for (int i = split_begin_[idx]; i < end; i++) {
+      parent->AddInput(std::move(planes_[i]));
     }
-    return parents_.back().get();
+    parent->SetOutputHeads(heads_);
+    // Each worker only writes its own slot, published by NotifyComplete().
+    parents_[idx] = std::move(parent);
+    return parents_[idx].get();
   }
 
  private:
+  int GetSplit(int sample) const {
+    return std::upper_bound(split_begin_.begin(), split_begin_.end(), sample) -
+           split_begin_.begin() - 1;
+  }
+
+  struct Values {
+    float q;
+    float d;
+    float m;
+  };
+
   std::vector<InputPlanes> planes_;
+  std::vector<Values> values_;
+  OutputHeads heads_;
   DemuxingNetwork* network_;
   std::vector<std::unique_ptr<NetworkComputation>> parents_;
+  // First sample of each split.
+  std::vector<int> split_begin_;
+
+  std::atomic<int> dataready_ = 0;
+  CompletionFlag completion_;
+};
+
+// Fits the time a network takes for a batch as a + b * batch_size, by least
+// squares over the recent batches (older ones are gradually forgotten).
+class ThroughputModel {
+ public:
+  void Record(int batch_size, double seconds) {
+    SpinMutex::Lock lock(mutex_);
+    w_ = kDecay * w_ + 1.0;
+    x_ = kDecay * x_ + batch_size;
+    y_ = kDecay * y_ + seconds;
+    xx_ = kDecay * xx_ + double(batch_size) * batch_size;
+    xy_ = kDecay * xy_ + batch_size * seconds;
+  }
+
+  bool IsMeasured() const {
+    SpinMutex::Lock lock(mutex_);
+    return w_ > 0.0;
+  }
 
-  std::mutex mutex_;
-  std::condition_variable dataready_cv_;
-  int dataready_ = 0;
-  int partial_size_ = 0;
+  // Returns the fixed cost of a batch and the cost per position, in seconds.
+  std::pair<double, double> GetCosts() const {
+    SpinMutex::Lock lock(mutex_);
+    const double var = xx_ / w_ - (x_ / w_) * (x_ / w_);
+    const double cov = xy_ / w_ - (x_ / w_) * (y_ / w_);
+    const double average = std::max(y_ / x_, kMinCost);
+    // Too few distinct batch sizes for a slope, assume there's no fixed cost.
+    if (var < 1.0 || cov <= 0.0) return {0.0, average};
+    const double per_position = std::max(cov / var, kMinCost);
+    const double fixed = y_ / w_ - per_position * x_ / w_;
+    if (fixed < 0.0) return {0.0, average};
+    return {fixed, per_position};
+  }
+
+ private:
+  static constexpr double kDecay = 0.98;
+  static constexpr double kMinCost = 1e-9;
+  mutable SpinMutex mutex_;
+  double w_ GUARDED_BY(mutex_) = 0.0;
+  double x_ GUARDED_BY(mutex_) = 0.0;
+  double y_ GUARDED_BY(mutex_) = 0.0;
+  double xx_ GUARDED_BY(mutex_) = 0.0;
+  double xy_ GUARDED_BY(mutex_) = 0.0;
 };
 
 class DemuxingNetwork : public Network {
@@ -122,27 +199,42 @@ class DemuxingNetwork : public Network {
                   const std::optional<WeightsFile>& weights,
                   const OptionsDict& opts) {
     const std::string backend = opts.GetOrDefault<std::string>("backend", name);
+    // With gpu=all, one child per device of the backend.
+    auto devices = NetworkFactory::Get()->ExpandDevices(backend, opts);
+    if (!devices.empty()) {
+      for (auto& device : devices) {
+        AddBackend(backend, weights, *device);
+        device_options_.push_back(std::move(device));
+      }
+      return;
+    }
 
-    networks_.emplace_back(
-        NetworkFactory::Get()->Create(backend, weights, opts));
+    children_.emplace_back(std::make_unique<Child>());
+    Child* child = children_.back().get();
+    child->network = NetworkFactory::Get()->Create(backend, weights, opts);
+    Network* network = child->network.get();
+    // CPU backends are helpers, only given a small share until measured.
+    child->weight = std::max(
+        0.001f,
+        opts.GetOrDefault<float>("weight", network->IsCpu() ? 0.1f : 1.0f));
 
     int nn_threads = opts.GetOrDefault<int>("threads", 0);
     if (nn_threads == 0) {
-      nn_threads = networks_.back()->GetThreads();
+      nn_threads = network->GetThreads();
     }
+    child->threads = nn_threads;
 
-    min_batch_size_ =
-        std::min(min_batch_size_, networks_.back()->GetMiniBatchSize());
-    is_cpu_ &= networks_.back()->IsCpu();
+    min_batch_size_ = std::min(min_batch_size_, network->GetMiniBatchSize());
+    is_cpu_ &= network->IsCpu();
 
-    if (networks_.size() == 1) {
-      capabilities_ = networks_.back()->GetCapabilities();
+    if (children_.size() == 1) {
+      capabilities_ = network->GetCapabilities();
     } else {
-      capabilities_.Merge(networks_.back()->GetCapabilities());
+      capabilities_.Merge(network->GetCapabilities());
     }
 
     for (int i = 0; i < nn_threads; ++i) {
-      threads_.emplace_back([this]() { Worker(); });
+      threads_.emplace_back([this, child]() { Worker(child); });
     }
   }
 
@@ -160,58 +252,104 @@ class DemuxingNetwork : public Network {
 
   bool IsCpu() const override { return is_cpu_; }
 
-  void Enqueue(DemuxingComputation* computation) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    queue_.push(computation);
-    cv_.notify_one();
+  // Splits a batch between the child networks so that they all finish at about
+  // the same time. Returns the number of positions for each child. The share
+  // of a child is in turn split evenly between its threads.
+  std::vector<int> PlanSplit(int batch_size) const {
+    const size_t num_children = children_.size();
+    std::vector<double> fixed(num_children, 0.0);
+    std::vector<double> per_position(num_children);
+    const bool measured =
+        std::all_of(children_.begin(), children_.end(),
+                    [](const auto& child) { return child->model.IsMeasured(); });
+    for (size_t i = 0; i < num_children; ++i) {
+      // Until every child has run a batch, the shares follow the weights.
+      if (measured) {
+        std::tie(fixed[i], per_position[i]) = children_[i]->model.GetCosts();
+      } else {
+        per_position[i] = 1.0 / children_[i]->weight;
+      }
+      per_position[i] /= std::max(1, children_[i]->threads);
+    }
+    std::vector<bool> active(num_children, true);
+    std::vector<int> sizes(num_children);
+    while (true) {
+      // With a common finish time t, child i gets (t - fixed) / per_position
+      // positions. Children with a fixed cost above t are dropped.
+      double t = 0.0;
+      while (true) {
+        double inv_sum = 0.0;
+        double fixed_sum = 0.0;
+        for (size_t i = 0; i < num_children; ++i) {
+          if (!active[i]) continue;
+          inv_sum += 1.0 / per_position[i];
+          fixed_sum += fixed[i] / per_position[i];
+        }
+        t = (batch_size + fixed_sum) / inv_sum;
+        size_t slowest = num_children;
+        for (size_t i = 0; i < num_children; ++i) {
+          if (active[i] && fixed[i] >= t &&
+              (slowest == num_children || fixed[i] > fixed[slowest])) {
+            slowest = i;
+          }
+        }
+        if (slowest == num_children) break;
+        active[slowest] = false;
+      }
+      // Round down, then hand out the rest by the largest remainders.
+      std::vector<std::pair<double, size_t>> remainders;
+      int assigned = 0;
+      for (size_t i = 0; i < num_children; ++i) {
+        const double share =
+            active[i] ? (t - fixed[i]) / per_position[i] : 0.0;
+        sizes[i] = static_cast<int>(share);
+        assigned += sizes[i];
+        if (active[i]) remainders.emplace_back(share - sizes[i], i);
+      }
+      std::sort(remainders.rbegin(), remainders.rend());
+      for (size_t i = 0; assigned < batch_size; ++i, ++assigned) {
+        ++sizes[remainders[i % remainders.size()].second];
+      }
+      // Splits too small to be worth it are given to the other children.
+      size_t smallest = num_children;
+      for (size_t i = 0; i < num_children; ++i) {
+        if (active[i] && sizes[i] < std::max(1, minimum_split_size_) &&
+            sizes[i] < batch_size &&
+            (smallest == num_children || sizes[i] < sizes[smallest])) {
+          smallest = i;
+        }
+      }
+      if (smallest == num_children) break;
+      active[smallest] = false;
+    }
+    return sizes;
+  }
+
+  void Enqueue(DemuxingComputation* computation, int split, int child) {
+    Child& c = *children_[child];
+    std::lock_guard<std::mutex> lock(c.mutex);
+    c.queue.push({computation, split});
+    c.cv.notify_one();
   }
 
   ~DemuxingNetwork() {
     Abort();
     Wait();
     // Unstuck waiting computations.
-    while (!queue_.empty()) {
-      queue_.front()->NotifyComplete();
-      queue_.pop();
-    }
-  }
-
-  void Worker() {
-    // While Abort() is not called (and it can only be called from destructor).
-    while (!abort_) {
-      {
-        {
-          std::unique_lock<std::mutex> lock(mutex_);
-          // Wait until there's come work to compute.
-          cv_.wait(lock, [&] { return abort_ || !queue_.empty(); });
-          if (abort_) break;
-        }
-
-        // While there is a work in queue, process it.
-        while (true) {
-          DemuxingComputation* to_notify;
-          {
-            std::unique_lock<std::mutex> lock(mutex_);
-            if (queue_.empty()) break;
-            to_notify = queue_.front();
-            queue_.pop();
-          }
-          long long net_idx = ++(counter_) % networks_.size();
-          NetworkComputation* to_compute =
-              to_notify->AddParentFromNetwork(networks_[net_idx].get());
-          to_compute->ComputeBlocking();
-          to_notify->NotifyComplete();
-        }
+    for (auto& child : children_) {
+      while (!child->queue.empty()) {
+        child->queue.front().computation->NotifyComplete();
+        child->queue.pop();
       }
     }
   }
 
   void Abort() {
-    {
-      std::lock_guard<std::mutex> lock(mutex_);
-      abort_ = true;
+    abort_ = true;
+    for (auto& child : children_) {
+      std::lock_guard<std::mutex> lock(child->mutex);
+      child->cv.notify_all();
     }
-    cv_.notify_all();
   }
 
   void Wait() {
@@ -221,36 +359,85 @@ class DemuxingNetwork : public Network {
     }
   }
 
-  std::vector<std::unique_ptr<Network>> networks_;
+ private:
+  struct Job {
+    DemuxingComputation* computation;
+    int split;
+  };
+
+  struct Child {
+    std::unique_ptr<Network> network;
+    int threads;
+    float weight;
+    ThroughputModel model;
+    std::queue<Job> queue;
+    std::mutex mutex;
+    std::condition_variable cv;
+  };
+
+  void Worker(Child* child) {
+    // While Abort() is not called (and it can only be called from destructor).
+    while (!abort_) {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(child->mutex);
+        // Wait until there's come work to compute.
+        child->cv.wait(lock, [&] { return abort_ || !child->queue.empty(); });
+        if (abort_) break;
+        job = child->queue.front();
+        child->queue.pop();
+      }
+      NetworkComputation* to_compute = job.computation->AddParentFromNetwork(
+          job.split, child->network.get());
+      const auto start = std::chrono::steady_clock::now();
+      to_compute->ComputeBlocking();
+      child->model.Record(
+          to_compute->GetBatchSize(),
+          std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                        start)
+              .count());
+      job.computation->ScatterOutputs(job.split);
+      job.computation->NotifyComplete();
+    }
+  }
+
+  // Options of the children created for gpu=all.
+  std::vector<std::unique_ptr<OptionsDict>> device_options_;
+  std::vector<std::unique_ptr<Child>> children_;
   NetworkCapabilities capabilities_;
   int min_batch_size_ = std::numeric_limits<int>::max();
   bool is_cpu_ = true;
-  std::queue<DemuxingComputation*> queue_;
   int minimum_split_size_ = 0;
-  std::atomic<long long> counter_;
-  bool abort_ = false;
-
-  std::mutex mutex_;
-  std::condition_variable cv_;
+  std::atomic<bool> abort_ = false;
 
   std::vector<std::thread> threads_;
+  friend class DemuxingComputation;
 };
 
 void DemuxingComputation::ComputeBlocking() {
   if (GetBatchSize() == 0) return;
-  partial_size_ = (GetBatchSize() + network_->threads_.size() - 1) /
-                  network_->threads_.size();
-  if (partial_size_ < network_->minimum_split_size_) {
-    partial_size_ = std::min(GetBatchSize(), network_->minimum_split_size_);
+  const std::vector<int> sizes = network_->PlanSplit(GetBatchSize());
+  std::vector<int> children;
+  int begin = 0;
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    if (sizes[i] == 0) continue;
+    const int splits = std::clamp(
+        sizes[i] / std::max(1, network_->minimum_split_size_), 1,
+        std::max(1, network_->children_[i]->threads));
+    for (int j = 0; j < splits; ++j) {
+      split_begin_.push_back(begin);
+      children.push_back(i);
+      begin += sizes[i] / splits + (j < sizes[i] % splits);
+    }
   }
-  const int splits = (GetBatchSize() + partial_size_ - 1) / partial_size_;
+  parents_.resize(children.size());
+  values_.resize(GetBatchSize());
 
-  std::unique_lock<std::mutex> lock(mutex_);
-  dataready_ = splits;
-  for (int j = 0; j < splits; j++) {
-    network_->Enqueue(this);
+  dataready_.store(children.size(), std::memory_order_relaxed);
+  for (size_t j = 0; j < children.size(); j++) {
+    network_->Enqueue(this, j, children[j]);
   }
-  dataready_cv_.wait(lock, [this]() { return dataready_ == 0; });
+  completion_.Wait();
 }
 
 std::unique_ptr<Network> MakeDemuxingNetwork(
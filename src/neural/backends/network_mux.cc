@@ -25,16 +25,26 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
 #include <condition_variable>
-#include <queue>
+#include <deque>
+#include <optional>
 #include <thread>
 
 #include "neural/factory.h"
 #include "utils/exception.h"
+#include "utils/mutex.h"
+#include "utils/parking.h"
+#include "utils/trace.h"
 
 namespace lczero {
 namespace {
 
+using Clock = std::chrono::steady_clock;
+
 class MuxingNetwork;
 class MuxingComputation : public NetworkComputation {
  public:
@@ -46,22 +56,28 @@ class MuxingComputation : public NetworkComputation {
 
   int GetBatchSize() const override { return planes_.size(); }
 
-  float GetQVal(int sample) const override {
-    return parent_->GetQVal(sample + idx_in_parent_);
-  }
+  float GetQVal(int sample) const override { return values_[sample].q; }
 
-  float GetDVal(int sample) const override {
-    return parent_->GetDVal(sample + idx_in_parent_);
-  }
+  float GetDVal(int sample) const override { return values_[sample].d; }
 
-  float GetMVal(int sample) const override {
-    return parent_->GetMVal(sample + idx_in_parent_);
-  }
+  float GetMVal(int sample) const override { return values_[sample].m; }
 
   float GetPVal(int sample, int move_id) const override {
     return parent_->GetPVal(sample + idx_in_parent_, move_id);
   }
 
+  std::span<const float> GetPolicyView(int sample) const override {
+    return parent_->GetPolicyView(sample + idx_in_parent_);
+  }
+
+  void GetPolicy(int sample, std::span<const uint16_t> move_ids,
+                 std::span<float> dst) const override {
+    parent_->GetPolicy(sample + idx_in_parent_, move_ids, dst);
+  }
+
+  void SetOutputHeads(OutputHeads heads) override { heads_ = heads; }
+  OutputHeads GetOutputHeads() const { return heads_; }
+
   void PopulateToParent(std::shared_ptr<NetworkComputation> parent) {
     // Populate our batch into batch of batches.
     parent_ = parent;
@@ -69,21 +85,89 @@ class MuxingComputation : public NetworkComputation {
     for (auto& x : planes_) parent_->AddInput(std::move(x));
   }
 
-  void NotifyReady() {
-    std::unique_lock<std::mutex> lock(mutex_);
-    dataready_ = true;
-    dataready_cv_.notify_one();
+  // Called from the worker once the parent is computed. The value heads are
+  // copied out, the policy is still read from the parent as most of it is
+  // never looked at.
+  void ScatterOutputs() {
+    values_.resize(planes_.size());
+    for (size_t i = 0; i < values_.size(); ++i) {
+      const int sample = idx_in_parent_ + i;
+      values_[i] = {parent_->GetQVal(sample), parent_->GetDVal(sample),
+                    parent_->GetMVal(sample)};
+    }
   }
 
+  void NotifyReady() { dataready_.Notify(); }
+
  private:
+  struct Values {
+    float q;
+    float d;
+    float m;
+  };
+
   std::vector<InputPlanes> planes_;
+  std::vector<Values> values_;
+  OutputHeads heads_;
   MuxingNetwork* network_;
   std::shared_ptr<NetworkComputation> parent_;
   int idx_in_parent_ = 0;
 
-  std::mutex mutex_;
-  std::condition_variable dataready_cv_;
-  bool dataready_ = false;
+  // Link in the network's queue, and the time when it was put there.
+  MuxingComputation* next_ = nullptr;
+  Clock::time_point enqueue_time_;
+  friend class MuxingNetwork;
+
+  CompletionFlag dataready_;
+};
+
+// Measures how long the network takes per position at different batch sizes,
+// to find the smallest batch that is about as efficient as the larger ones.
+class BatchTimings {
+ public:
+  void Record(int batch_size, Clock::duration elapsed) {
+    const double seconds_per_position =
+        std::chrono::duration<double>(elapsed).count() / batch_size;
+    SpinMutex::Lock lock(mutex_);
+    double& average = seconds_per_position_[Bucket(batch_size)];
+    average = average == 0.0 ? seconds_per_position
+                             : 0.9 * average + 0.1 * seconds_per_position;
+  }
+
+  // Returns @target, or a smaller batch size if batches of @target's size were
+  // measured to be not noticeably more efficient than smaller ones.
+  int EffectiveTarget(int target) const {
+    SpinMutex::Lock lock(mutex_);
+    const int target_bucket = Bucket(target);
+    if (seconds_per_position_[target_bucket] == 0.0) return target;
+    double best = seconds_per_position_[target_bucket];
+    for (int i = 0; i < target_bucket; ++i) {
+      if (seconds_per_position_[i] != 0.0) {
+        best = std::min(best, seconds_per_position_[i]);
+      }
+    }
+    for (int i = 0; i < target_bucket; ++i) {
+      if (seconds_per_position_[i] != 0.0 &&
+          seconds_per_position_[i] <= best * kTolerance) {
+        return std::min(target, 1 << i);
+      }
+    }
+    return target;
+  }
+
+ private:
+  static constexpr int kNumBuckets = 16;
+  static constexpr double kTolerance = 1.1;
+
+  // Bucket i holds batch sizes from 2^i to 2^(i+1)-1.
+  static int Bucket(int batch_size) {
+    return std::min(kNumBuckets - 1,
+                    static_cast<int>(std::bit_width(unsigned(batch_size))) - 1);
+  }
+
+  mutable SpinMutex mutex_;
+  // Moving average, 0 if there was no batch of that size yet.
+  double seconds_per_position_[kNumBuckets] GUARDED_BY(mutex_) = {};
 };
 
 class MuxingNetwork : public Network {
@@ -93,28 +177,57 @@ class MuxingNetwork : public Network {
     // int threads, int max_batch)
     //: network_(std::move(network)), max_batch_(max_batch) {
 
+    // Backend name and options of each child.
+    std::vector<std::pair<std::string, const OptionsDict*>> children;
+    const auto add_child = [&](const std::string& name,
+                               const OptionsDict& opts) {
+      children.emplace_back(opts.GetOrDefault<std::string>("backend", name),
+                            &opts);
+    };
     const auto parents = options.ListSubdicts();
     if (parents.empty()) {
       // If options are empty, or multiplexer configured in root object,
       // initialize on root object and default backend.
       auto backends = NetworkFactory::Get()->GetBackendsList();
-      AddBackend(backends[0], weights, options);
+      add_child(backends[0], options);
     }
 
     for (const auto& name : parents) {
-      AddBackend(name, weights, options.GetSubdict(name));
+      add_child(name, options.GetSubdict(name));
+    }
+
+    // Children are created in parallel, then added in order.
+    auto networks = NetworkFactory::Get()->CreateMany(children, weights);
+    for (size_t i = 0; i < children.size(); ++i) {
+      AddBackend(std::move(networks[i]), *children[i].second);
     }
   }
 
-  void AddBackend(const std::string& name,
-                  const std::optional<WeightsFile>& weights,
-                  const OptionsDict& opts) {
+  // Batching parameters of one of the underlying networks.
+  struct BatchConfig {
+    Network* network;
+    // Batches are never larger than that, unless a single computation is.
+    int max_batch;
+    // Number of positions to wait for before sending a batch.
+    int target_batch;
+    // How long a computation may wait for the batch to fill up.
+    Clock::duration max_latency;
+    BatchTimings* timings;
+  };
+
+  void AddBackend(std::unique_ptr<Network> network, const OptionsDict& opts) {
     const int max_batch = opts.GetOrDefault<int>("max_batch", 256);
-    const std::string backend = opts.GetOrDefault<std::string>("backend", name);
 
-    networks_.emplace_back(
-        NetworkFactory::Get()->Create(backend, weights, opts));
+    networks_.emplace_back(std::move(network));
     Network* net = networks_.back().get();
+    timings_.emplace_back(std::make_unique<BatchTimings>());
+    const BatchConfig config{
+        .network = net,
+        .max_batch = max_batch,
+        .target_batch = opts.GetOrDefault<int>("target_batch", max_batch),
+        .max_latency = std::chrono::microseconds(
+            opts.GetOrDefault<int>("max_latency_us", 0)),
+        .timings = timings_.back().get()};
 
     int nn_threads = opts.GetOrDefault<int>("threads", 0);
     if (nn_threads == 0) {
@@ -131,8 +244,7 @@ class MuxingNetwork : public Network {
     }
 
     for (int i = 0; i < nn_threads; ++i) {
-      threads_.emplace_back(
-          [this, net, max_batch]() { Worker(net, max_batch); });
+      threads_.emplace_back([this, config]() { Worker(config); });
     }
   }
 
@@ -150,66 +262,82 @@ class MuxingNetwork : public Network {
 
   bool IsCpu() const override { return is_cpu_; }
 
+  bool ReloadWeights(const WeightsFile& weights) override {
+    // All or nothing is not guaranteed, but on failure the whole network gets
+    // recreated anyway.
+    bool reloaded = true;
+    for (auto& network : networks_) {
+      reloaded = reloaded && network->ReloadWeights(weights);
+    }
+    return reloaded;
+  }
+
+  // Lock free, computations are pushed to an intrusive stack which the worker
+  // gathering the next batch takes over as a whole.
   void Enqueue(MuxingComputation* computation) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    queue_.push(computation);
-    cv_.notify_one();
+    computation->enqueue_time_ = Clock::now();
+    computation->next_ = queue_head_.load(std::memory_order_relaxed);
+    while (!queue_head_.compare_exchange_weak(computation->next_,
+                                              computation)) {
+    }
+    // Pairs with the check in WaitForWork(), both are sequentially consistent
+    // so that either the push or the waiting flag is seen.
+    if (gatherer_waiting_.load()) {
+      std::lock_guard<std::mutex> lock(wait_mutex_);
+      work_added_cv_.notify_one();
+    }
   }
 
   ~MuxingNetwork() {
     Abort();
     Wait();
     // Unstuck waiting computations.
-    while (!queue_.empty()) {
-      queue_.front()->NotifyReady();
-      queue_.pop();
-    }
+    Mutex::Lock lock(gather_mutex_);
+    TakeQueued();
+    for (auto* computation : pending_) computation->NotifyReady();
   }
 
-  void Worker(Network* network, const int max_batch) {
+  void Worker(const BatchConfig& config) {
     // While Abort() is not called (and it can only be called from destructor).
     while (!abort_) {
-      std::vector<MuxingComputation*> children;
       // Create new computation in "upstream" network, to gather batch into
       // there.
-      std::shared_ptr<NetworkComputation> parent(network->NewComputation());
+      std::shared_ptr<NetworkComputation> parent(
+          config.network->NewComputation());
+      std::vector<MuxingComputation*> children;
       {
-        std::unique_lock<std::mutex> lock(mutex_);
-        // Wait until there's come work to compute.
-        cv_.wait(lock, [&] { return abort_ || !queue_.empty(); });
-        if (abort_) break;
-
-        // While there is a work in queue, add it.
-        while (!queue_.empty()) {
-          // If we are reaching batch size limit, stop adding.
-          // However, if a single input batch is larger than output batch limit,
-          // we still have to add it.
-          if (parent->GetBatchSize() != 0 &&
-              parent->GetBatchSize() + queue_.front()->GetBatchSize() >
-                  max_batch) {
-            break;
-          }
-          // Remember which of "input" computations we serve.
-          children.push_back(queue_.front());
-          queue_.pop();
-          // Make "input" computation populate data into output batch.
-          children.back()->PopulateToParent(parent);
-        }
+        TraceScope trace("Mux::GatherBatch");
+        // One worker gathers at a time, the others are computing meanwhile or
+        // wait for their turn.
+        Mutex::Lock lock(gather_mutex_);
+        children = GatherBatch(parent, config);
       }
+      if (children.empty()) continue;
+      // The batch computes what any of the children reads.
+      OutputHeads heads{.policy = false, .moves_left = false};
+      for (auto* child : children) heads |= child->GetOutputHeads();
+      parent->SetOutputHeads(heads);
 
       // Compute.
-      parent->ComputeBlocking();
+      const auto start = Clock::now();
+      {
+        TraceScope trace("Mux::ComputeBlocking");
+        trace.SetArg("batch_size", parent->GetBatchSize());
+        parent->ComputeBlocking();
+      }
+      config.timings->Record(parent->GetBatchSize(), Clock::now() - start);
       // Notify children that data is ready!
-      for (auto child : children) child->NotifyReady();
+      for (auto child : children) {
+        child->ScatterOutputs();
+        child->NotifyReady();
+      }
     }
   }
 
   void Abort() {
-    {
-      std::lock_guard<std::mutex> lock(mutex_);
-      abort_ = true;
-    }
-    cv_.notify_all();
+    abort_ = true;
+    std::lock_guard<std::mutex> lock(wait_mutex_);
+    work_added_cv_.notify_all();
   }
 
   void Wait() {
@@ -220,23 +348,88 @@ class MuxingNetwork : public Network {
   }
 
  private:
+  // Moves the pushed computations to the end of pending_, oldest first.
+  void TakeQueued() REQUIRES(gather_mutex_) {
+    MuxingComputation* head = queue_head_.exchange(nullptr);
+    const size_t old_size = pending_.size();
+    for (; head; head = head->next_) pending_.push_back(head);
+    std::reverse(pending_.begin() + old_size, pending_.end());
+  }
+
+  // Populates @parent with queued computations until the batch reaches the
+  // target size, or the oldest of them has waited for the latency budget.
+  std::vector<MuxingComputation*> GatherBatch(
+      std::shared_ptr<NetworkComputation> parent, const BatchConfig& config)
+      REQUIRES(gather_mutex_) {
+    std::vector<MuxingComputation*> children;
+    const int target_batch =
+        config.timings->EffectiveTarget(config.target_batch);
+    std::optional<Clock::time_point> deadline;
+    while (!abort_) {
+      TakeQueued();
+      while (!pending_.empty()) {
+        // If we are reaching batch size limit, stop adding.
+        // However, if a single input batch is larger than output batch limit,
+        // we still have to add it.
+        MuxingComputation* computation = pending_.front();
+        if (parent->GetBatchSize() != 0 &&
+            parent->GetBatchSize() + computation->GetBatchSize() >
+                config.max_batch) {
+          return children;
+        }
+        if (!deadline) {
+          deadline = computation->enqueue_time_ + config.max_latency;
+        }
+        // Remember which of "input" computations we serve.
+        children.push_back(computation);
+        pending_.pop_front();
+        // Make "input" computation populate data into output batch.
+        computation->PopulateToParent(parent);
+      }
+      if (parent->GetBatchSize() >= target_batch) break;
+      if (deadline && Clock::now() >= *deadline) break;
+      WaitForWork(deadline);
+    }
+    return children;
+  }
+
+  // Sleeps until there's something in the queue, the deadline passes or the
+  // network is aborted.
+  void WaitForWork(std::optional<Clock::time_point> deadline) {
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    gatherer_waiting_ = true;
+    const auto ready = [&]() { return abort_ || queue_head_.load(); };
+    if (deadline) {
+      work_added_cv_.wait_until(lock, *deadline, ready);
+    } else {
+      work_added_cv_.wait(lock, ready);
+    }
+    gatherer_waiting_ = false;
+  }
+
   std::vector<std::unique_ptr<Network>> networks_;
-  std::queue<MuxingComputation*> queue_;
-  bool abort_ = false;
+  std::vector<std::unique_ptr<BatchTimings>> timings_;
+  std::atomic<MuxingComputation*> queue_head_ = nullptr;
+  std::atomic<bool> abort_ = false;
   NetworkCapabilities capabilities_;
   int min_batch_size_ = std::numeric_limits<int>::max();
   bool is_cpu_ = true;
 
-  std::mutex mutex_;
-  std::condition_variable cv_;
+  // Computations taken from the queue but not added to a batch yet.
+  std::deque<MuxingComputation*> pending_ GUARDED_BY(gather_mutex_);
+  Mutex gather_mutex_;
+
+  // Only used to sleep while the queue is empty.
+  std::atomic<bool> gatherer_waiting_ = false;
+  std::mutex wait_mutex_;
+  std::condition_variable work_added_cv_;
 
   std::vector<std::thread> threads_;
 };
 
 void MuxingComputation::ComputeBlocking() {
   network_->Enqueue(this);
-  std::unique_lock<std::mutex> lock(mutex_);
-  dataready_cv_.wait(lock, [this]() { return dataready_; });
+  dataready_.Wait();
 }
 
 std::unique_ptr<Network> MakeMuxingNetwork(
@@ -0,0 +1,145 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include "neural/factory.h"
+#include "utils/exception.h"
+#include "utils/logging.h"
+#include "utils/numa.h"
+
+namespace lczero {
+namespace {
+
+// Node of the calling thread once it has been bound by a NumaNetwork, -1
+// before that. Shared by all instances, as the node ids are global.
+thread_local int tls_numa_node = -1;
+
+// Creates one replica of a CPU backend per NUMA node. Each replica is built
+// on a thread bound to its node, so that its weights are allocated there, and
+// a thread requesting a computation is bound to a node (spreading threads
+// around) and then always served by the replica local to it.
+class NumaNetwork : public Network {
+ public:
+  NumaNetwork(const std::optional<WeightsFile>& weights,
+              const OptionsDict& options) {
+    const std::string backend = options.GetOrDefault<std::string>(
+        "backend", NetworkFactory::Get()->GetBackendsList()[0]);
+    if (backend == "numa") {
+      throw Exception("The numa backend can't replicate itself.");
+    }
+    int nodes = options.GetOrDefault<int>("nodes", 0);
+    if (nodes <= 0) nodes = Numa::GetNodeCount();
+
+    for (int node = 0; node < nodes; node++) {
+      std::unique_ptr<Network> network;
+      std::exception_ptr error;
+      bool bound = false;
+      std::thread([&]() {
+        try {
+          bound = Numa::BindThreadToNode(node);
+          if (bound) {
+            network = NetworkFactory::Get()->Create(backend, weights, options);
+          }
+        } catch (...) {
+          error = std::current_exception();
+        }
+      }).join();
+      if (error) std::rethrow_exception(error);
+      if (!bound) continue;
+      AddReplica(node, std::move(network));
+    }
+
+    // No usable NUMA information, a single unbound replica.
+    if (networks_.empty()) {
+      AddReplica(-1, NetworkFactory::Get()->Create(backend, weights, options));
+    }
+    CERR << "Created " << networks_.size() << " " << backend
+         << " replica(s), one per NUMA node.";
+  }
+
+  std::unique_ptr<NetworkComputation> NewComputation() override {
+    return networks_[GetReplica()]->NewComputation();
+  }
+
+  const NetworkCapabilities& GetCapabilities() const override {
+    return capabilities_;
+  }
+
+  int GetMiniBatchSize() const override { return min_batch_size_; }
+
+  int GetThreads() const override { return threads_; }
+
+  bool IsCpu() const override { return is_cpu_; }
+
+ private:
+  void AddReplica(int node, std::unique_ptr<Network> network) {
+    min_batch_size_ = std::min(min_batch_size_, network->GetMiniBatchSize());
+    is_cpu_ &= network->IsCpu();
+    threads_ += network->GetThreads();
+    if (networks_.empty()) capabilities_ = network->GetCapabilities();
+    nodes_.push_back(node);
+    networks_.push_back(std::move(network));
+  }
+
+  size_t GetReplica() {
+    if (nodes_[0] < 0) return 0;
+    if (tls_numa_node < 0) {
+      // First computation of this thread, pin it to the next node.
+      const int node = nodes_[next_node_++ % nodes_.size()];
+      if (Numa::BindThreadToNode(node)) tls_numa_node = node;
+    }
+    for (size_t i = 0; i < nodes_.size(); i++) {
+      if (nodes_[i] == tls_numa_node) return i;
+    }
+    // Bound by another instance to a node this one has no replica on.
+    return next_node_++ % nodes_.size();
+  }
+
+  std::vector<std::unique_ptr<Network>> networks_;
+  std::vector<int> nodes_;
+  std::atomic<size_t> next_node_ = 0;
+  NetworkCapabilities capabilities_;
+  int min_batch_size_ = std::numeric_limits<int>::max();
+  int threads_ = 0;
+  bool is_cpu_ = true;
+};
+
+std::unique_ptr<Network> MakeNumaNetwork(
+    const std::optional<WeightsFile>& weights, const OptionsDict& options) {
+  return std::make_unique<NumaNetwork>(weights, options);
+}
+
+REGISTER_NETWORK("numa", MakeNumaNetwork, -999)
+
+}  // namespace
+}  // namespace lczero
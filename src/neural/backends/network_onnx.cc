@@ -26,11 +26,18 @@
 */
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdio>
 #include <fstream>
+#include <functional>
 #include <iterator>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #if __has_include("dml_provider_factory.h")
@@ -58,22 +65,51 @@ enum class OnnxProvider { CPU, CUDA, DML, ROCM, TRT };
 
 class OnnxNetwork;
 
+// Pinned host buffers bound to the sessions through Ort::IoBinding, so the
+// provider copies straight between them and the device.
+class OnnxIoBuffers {
+ public:
+  OnnxIoBuffers(OnnxNetwork* network);
+  ~OnnxIoBuffers();
+  // Binds the buffers to the session of the given replica and step, if not
+  // already bound with this batch size.
+  Ort::IoBinding& Bind(int replica, int step, int batch_size);
+  void* input() const { return input_; }
+  const void* output(size_t idx) const { return outputs_[idx]; }
+  // Drops the bindings, before the sessions they are bound to go away.
+  void ClearBindings();
+
+ private:
+  void CreateBindings();
+
+  OnnxNetwork* network_;
+  void* input_;
+  std::vector<void*> outputs_;
+  std::vector<Ort::IoBinding> bindings_;
+  std::vector<int> bound_batch_size_;
+};
+
 template <typename DataType>
 class OnnxComputation : public NetworkComputation {
  public:
   OnnxComputation(OnnxNetwork* network);
+  ~OnnxComputation();
   void AddInput(InputPlanes&& input) override;
   int GetBatchSize() const override { return raw_input_.size(); }
   void ComputeBlocking() override;
   float GetQVal(int sample) const override;
   float GetDVal(int sample) const override;
   float GetPVal(int sample, int move_id) const override;
+  void GetPolicy(int sample, std::span<const uint16_t> move_ids,
+                 std::span<float> dst) const override;
   float GetMVal(int sample) const override;
 
  private:
+  void FillInputs(int start, int batch_size, DataType* dst);
   Ort::Value PrepareInputs(int start, int batch_size);
 
   OnnxNetwork* network_;
+  std::unique_ptr<OnnxIoBuffers> io_buffers_;
   std::vector<InputPlanes> raw_input_;
   std::vector<DataType> input_tensor_data_;
   std::vector<Ort::Value> output_tensors_;
@@ -84,7 +120,8 @@ class OnnxComputation : public NetworkComputation {
 class OnnxNetwork : public Network {
  public:
   OnnxNetwork(const WeightsFile& file, const OptionsDict& options,
-              OnnxProvider provider);
+              OnnxProvider provider,
+              std::optional<WeightsToOnnxConverterOptions> converter_options);
   std::unique_ptr<NetworkComputation> NewComputation() override {
     if (fp16_) {
       return std::make_unique<OnnxComputation<Ort::Float16_t>>(this);
@@ -102,13 +139,36 @@ class OnnxNetwork : public Network {
                              : batch_size_ * steps_;
   }
   bool IsCpu() const override { return provider_ == OnnxProvider::CPU; }
+  bool ReloadWeights(const WeightsFile& weights) override;
 
   Ort::SessionOptions GetOptions(int gpu, int threads, int batch_size);
+  // Creates @replicas replicas of the sessions of @md.
+  std::vector<std::vector<Ort::Session>> CreateSessions(
+      const pblczero::OnnxModel& md, int replicas);
+  // Whether @md has the inputs and outputs the computations expect.
+  bool HasSameInterface(const pblczero::OnnxModel& md) const;
+  // The session of a replica to run a batch of this many steps with.
+  Ort::Session& GetSession(int replica, int step) {
+    auto& sessions = session_[replica];
+    return sessions[std::min<size_t>(step, sessions.size()) - 1];
+  }
+  // Picks the replica to run on, preferring an idle one. The replica stays
+  // locked until released if the provider needs exclusive_run_.
+  int AcquireReplica();
+  void ReleaseReplica(int replica);
+  std::unique_ptr<OnnxIoBuffers> AcquireIoBuffers();
+  void ReleaseIoBuffers(std::unique_ptr<OnnxIoBuffers> buffers);
 
   Ort::Env onnx_env_;
   // Prepare sessions for this many multiples of the batch size;
   int steps_;
-  std::vector<Ort::Session> session_;
+  // Replicas of the sessions, so several batches can run at once. Each has one
+  // session per step, except for TensorRT where a single session has an
+  // optimization profile covering all of them.
+  std::vector<std::vector<Ort::Session>> session_;
+  // Held shared by the computations using session_, and exclusively by
+  // ReloadWeights() to replace them.
+  std::shared_mutex session_mutex_;
   std::vector<std::string> inputs_;
   // Points to strings in inputs_.
   std::vector<const char*> inputs_cstr_;
@@ -120,6 +180,8 @@ class OnnxNetwork : public Network {
   int wdl_head_ = -1;
   int value_head_ = -1;
   int mlh_head_ = -1;
+  // Number of values per sample, for each output.
+  std::vector<int> output_sizes_;
   NetworkCapabilities capabilities_;
   bool fp16_;
   bool bf16_;
@@ -127,12 +189,136 @@ class OnnxNetwork : public Network {
   int batch_size_;
   // The lower limit for variable batch size.
   int min_batch_size_;
+  int gpu_;
+  int threads_;
+  // Used to convert the weights of a reload, unless they come as ONNX.
+  std::optional<WeightsToOnnxConverterOptions> converter_options_;
+  std::string network_format_;
+  // TensorRT engine settings.
+  std::string trt_cache_dir_;
+  std::string trt_cache_prefix_;
+  bool trt_fp16_ = false;
+  std::string trt_int8_calibration_;
   static constexpr int max_batch_size_ = 1024;
-  // For conditional locking if running the DML/ROCM/TRT provider.
   OnnxProvider provider_;
-  std::mutex lock_;
+  // Whether Run has to be serialized on each session.
+  bool exclusive_run_;
+  std::unique_ptr<std::mutex[]> replica_lock_;
+  std::atomic<size_t> next_replica_ = 0;
+  // Run through Ort::IoBinding with pinned host buffers.
+  bool io_binding_ = false;
+  Ort::MemoryInfo pinned_memory_info_{nullptr};
+  std::unique_ptr<Ort::Allocator> pinned_allocator_;
+  // The session pinned_allocator_ was created from, once session_ has been
+  // replaced by ReloadWeights().
+  std::optional<Ort::Session> pinned_allocator_session_;
+  std::mutex io_buffers_lock_;
+  std::vector<std::unique_ptr<OnnxIoBuffers>> free_io_buffers_;
+  // All the buffers ever created, they live as long as the network.
+  std::vector<OnnxIoBuffers*> all_io_buffers_;
 };
 
+OnnxIoBuffers::OnnxIoBuffers(OnnxNetwork* network) : network_(network) {
+  const size_t element_size = network_->fp16_ || network_->bf16_ ? 2 : 4;
+  const size_t max_batch = network_->batch_size_ > 0
+                               ? network_->batch_size_ * network_->steps_
+                               : network_->max_batch_size_;
+  input_ = network_->pinned_allocator_->Alloc(max_batch * kInputPlanes * 64 *
+                                              element_size);
+  for (int size : network_->output_sizes_) {
+    outputs_.push_back(
+        network_->pinned_allocator_->Alloc(max_batch * size * element_size));
+  }
+  CreateBindings();
+}
+
+void OnnxIoBuffers::CreateBindings() {
+  for (size_t replica = 0; replica < network_->session_.size(); replica++) {
+    for (int step = 1; step <= network_->steps_; step++) {
+      bindings_.emplace_back(network_->GetSession(replica, step));
+    }
+  }
+  bound_batch_size_.assign(bindings_.size(), 0);
+}
+
+void OnnxIoBuffers::ClearBindings() {
+  bindings_.clear();
+  bound_batch_size_.clear();
+}
+
+OnnxIoBuffers::~OnnxIoBuffers() {
+  // Drop the bound values before the memory they point to.
+  bindings_.clear();
+  network_->pinned_allocator_->Free(input_);
+  for (void* output : outputs_) network_->pinned_allocator_->Free(output);
+}
+
+Ort::IoBinding& OnnxIoBuffers::Bind(int replica, int step, int batch_size) {
+  if (bindings_.empty()) CreateBindings();
+  const size_t idx = replica * network_->steps_ + step - 1;
+  auto& binding = bindings_[idx];
+  if (bound_batch_size_[idx] == batch_size) return binding;
+  const size_t element_size = network_->fp16_ || network_->bf16_ ? 2 : 4;
+  const auto type = network_->fp16_   ? ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16
+                    : network_->bf16_ ? ONNX_TENSOR_ELEMENT_DATA_TYPE_BFLOAT16
+                                      : ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT;
+  binding.ClearBoundInputs();
+  binding.ClearBoundOutputs();
+  int64_t input_dims[] = {batch_size, kInputPlanes, 8, 8};
+  binding.BindInput(network_->inputs_cstr_[0],
+                    Ort::Value::CreateTensor(
+                        network_->pinned_memory_info_, input_,
+                        batch_size * kInputPlanes * 64 * element_size,
+                        input_dims, 4, type));
+  for (size_t i = 0; i < outputs_.size(); i++) {
+    int size = network_->output_sizes_[i];
+    int64_t dims[] = {batch_size, size};
+    binding.BindOutput(
+        network_->outputs_cstr_[i],
+        Ort::Value::CreateTensor(network_->pinned_memory_info_, outputs_[i],
+                                 batch_size * size * element_size, dims, 2,
+                                 type));
+  }
+  bound_batch_size_[idx] = batch_size;
+  return binding;
+}
+
+std::unique_ptr<OnnxIoBuffers> OnnxNetwork::AcquireIoBuffers() {
+  {
+    std::lock_guard<std::mutex> lock(io_buffers_lock_);
+    if (!free_io_buffers_.empty()) {
+      auto buffers = std::move(free_io_buffers_.back());
+      free_io_buffers_.pop_back();
+      return buffers;
+    }
+  }
+  auto buffers = std::make_unique<OnnxIoBuffers>(this);
+  std::lock_guard<std::mutex> lock(io_buffers_lock_);
+  all_io_buffers_.push_back(buffers.get());
+  return buffers;
+}
+
+void OnnxNetwork::ReleaseIoBuffers(std::unique_ptr<OnnxIoBuffers> buffers) {
+  std::lock_guard<std::mutex> lock(io_buffers_lock_);
+  free_io_buffers_.push_back(std::move(buffers));
+}
+
+int OnnxNetwork::AcquireReplica() {
+  const int count = session_.size();
+  const int first = next_replica_++ % count;
+  if (!exclusive_run_) return first;
+  for (int i = 0; i < count; i++) {
+    const int replica = (first + i) % count;
+    if (replica_lock_[replica].try_lock()) return replica;
+  }
+  replica_lock_[first].lock();
+  return first;
+}
+
+void OnnxNetwork::ReleaseReplica(int replica) {
+  if (exclusive_run_) replica_lock_[replica].unlock();
+}
+
 template <typename DataType>
 OnnxComputation<DataType>::OnnxComputation(OnnxNetwork* network)
     : network_(network) {
@@ -158,6 +344,11 @@ OnnxComputation<DataType>::OnnxComputation(OnnxNetwork* network)
   }
 }
 
+template <typename DataType>
+OnnxComputation<DataType>::~OnnxComputation() {
+  if (io_buffers_) network_->ReleaseIoBuffers(std::move(io_buffers_));
+}
+
 template <typename DataType>
 void OnnxComputation<DataType>::AddInput(InputPlanes&& input) {
   raw_input_.emplace_back(input);
@@ -203,6 +394,17 @@ float OnnxComputation<DataType>::GetPVal(int sample, int move_id) const {
   return AsFloat(data[sample * 1858 + move_id]);
 }
 
+template <typename DataType>
+void OnnxComputation<DataType>::GetPolicy(int sample,
+                                          std::span<const uint16_t> move_ids,
+                                          std::span<float> dst) const {
+  const DataType* data =
+      output_tensors_data_[network_->policy_head_].data() + sample * 1858;
+  for (size_t i = 0; i < move_ids.size(); ++i) {
+    dst[i] = AsFloat(data[move_ids[i]]);
+  }
+}
+
 template <typename DataType>
 float OnnxComputation<DataType>::GetMVal(int sample) const {
   if (network_->mlh_head_ == -1) return 0.0f;
@@ -221,10 +423,9 @@ void AsDataType(float x, Ort::BFloat16_t* y) {
 }
 
 template <typename DataType>
-Ort::Value OnnxComputation<DataType>::PrepareInputs(int start, int batch_size) {
-  input_tensor_data_.clear();
-  input_tensor_data_.resize(batch_size * kInputPlanes * 8 * 8);
-  auto iter = input_tensor_data_.data();
+void OnnxComputation<DataType>::FillInputs(int start, int batch_size,
+                                           DataType* iter) {
+  std::fill(iter, iter + batch_size * kInputPlanes * 64, DataType());
   int end = std::min(start + batch_size, static_cast<int>(raw_input_.size()));
   for (int i = start; i < end; i++) {
     for (const auto& plane : raw_input_[i]) {
@@ -236,11 +437,13 @@ Ort::Value OnnxComputation<DataType>::PrepareInputs(int start, int batch_size) {
       iter += 64;
     }
   }
-  for (int i = end; i < start + batch_size; i++) {
-    for (int j = 0; j < kInputPlanes * 64; j++) {
-      *iter++ = DataType();
-    }
-  }
+}
+
+template <typename DataType>
+Ort::Value OnnxComputation<DataType>::PrepareInputs(int start, int batch_size) {
+  input_tensor_data_.clear();
+  input_tensor_data_.resize(batch_size * kInputPlanes * 8 * 8);
+  FillInputs(start, batch_size, input_tensor_data_.data());
 
   auto memory_info =
       Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
@@ -267,29 +470,39 @@ void OnnxComputation<DataType>::ComputeBlocking() {
     batch_size = std::max(static_cast<int>(raw_input_.size()),
                           network_->min_batch_size_);
   }
+  std::shared_lock<std::shared_mutex> session_lock(network_->session_mutex_);
   for (size_t i = 0; i < raw_input_.size();) {
     int step = (raw_input_.size() - i + batch_size - 1) / batch_size;
     if (step > network_->steps_) step = network_->steps_;
     int batch = batch_size * step;
 
-    auto input_tensor = PrepareInputs(i, batch);
-    // The DML onnxruntime execution provider is documented as not supporting
-    // multi-threaded calls to Run on the same inference session. We found the
-    // same to be true for the ROCm execution provider (at least for CNNs).
-    // TODO: This may be a onnxruntime/ROCm bug, check onnxruntime 1.16 release.
-    if (network_->provider_ == OnnxProvider::DML ||
-        network_->provider_ == OnnxProvider::ROCM ||
-        network_->provider_ == OnnxProvider::TRT) {
-      network_->lock_.lock();
+    Ort::Value input_tensor{nullptr};
+    if (network_->io_binding_) {
+      if (!io_buffers_) io_buffers_ = network_->AcquireIoBuffers();
+      FillInputs(i, batch, static_cast<DataType*>(io_buffers_->input()));
+    } else {
+      input_tensor = PrepareInputs(i, batch);
     }
-    network_->session_[step - 1].Run(
-        {}, network_->inputs_cstr_.data(), &input_tensor, 1,
-        network_->outputs_cstr_.data(), output_tensors_.data(),
-        output_tensors_.size());
-    if (network_->provider_ == OnnxProvider::DML ||
-        network_->provider_ == OnnxProvider::ROCM ||
-        network_->provider_ == OnnxProvider::TRT) {
-      network_->lock_.unlock();
+    const int replica = network_->AcquireReplica();
+    if (io_buffers_) {
+      auto& binding = io_buffers_->Bind(replica, step, batch);
+      network_->GetSession(replica, step).Run({}, binding);
+      binding.SynchronizeOutputs();
+    } else {
+      network_->GetSession(replica, step).Run(
+          {}, network_->inputs_cstr_.data(), &input_tensor, 1,
+          network_->outputs_cstr_.data(), output_tensors_.data(),
+          output_tensors_.size());
+    }
+    network_->ReleaseReplica(replica);
+    if (io_buffers_) {
+      const size_t count =
+          std::min(static_cast<size_t>(batch), raw_input_.size() - i);
+      for (size_t j = 0; j < output_tensors_step_.size(); j++) {
+        const size_t size = output_tensors_step_[j];
+        std::memcpy(output_tensors_data_[j].data() + i * size,
+                    io_buffers_->output(j), count * size * sizeof(DataType));
+      }
     }
     i += batch;
   }
@@ -323,24 +536,28 @@ Ort::SessionOptions OnnxNetwork::GetOptions(int gpu, int threads,
     case OnnxProvider::TRT: {
       options.SetExecutionMode(ExecutionMode::ORT_SEQUENTIAL);
 
-      std::string cache_dir = CommandLine::BinaryDirectory() + "/trt_cache";
       std::map<std::string, std::string> trt_options;
       trt_options["device_id"] = std::to_string(gpu);
-      trt_options["trt_fp16_enable"] = fp16_ ? "1" : "0";
-      trt_options["trt_int8_enable"] = "0";
+      trt_options["trt_fp16_enable"] = trt_fp16_ ? "1" : "0";
+      if (trt_int8_calibration_.empty()) {
+        trt_options["trt_int8_enable"] = "0";
+      } else {
+        trt_options["trt_int8_enable"] = "1";
+        trt_options["trt_int8_calibration_table_name"] = trt_int8_calibration_;
+      }
       trt_options["trt_max_partition_iterations"] = "1000";
       trt_options["trt_min_subgraph_size"] = "1";
       trt_options["trt_engine_cache_enable"] = "1";
-      trt_options["trt_engine_cache_prefix"] =
-          "Lc0_ONNX_TRT_batch_" + std::to_string(batch_size) + "_";
-      trt_options["trt_engine_cache_path"] = cache_dir;
+      trt_options["trt_engine_cache_prefix"] = trt_cache_prefix_;
+      trt_options["trt_engine_cache_path"] = trt_cache_dir_;
       trt_options["trt_timing_cache_enable"] = "1";
-      trt_options["trt_timing_cache_path"] = cache_dir;
+      trt_options["trt_timing_cache_path"] = trt_cache_dir_;
       trt_options["trt_layer_norm_fp32_fallback"] = "1";
       trt_options["trt_force_sequential_engine_build"] = "1";
       // Looks like we need I/O binding to enable this.
       // trt_options["trt_cuda_graph_enable"] = "1";
-      if (batch_size < 0) {
+      // A single profile covers every step, see the constructor.
+      if (batch_size_ < 0) {
         trt_options["trt_profile_min_shapes"] =
             inputs_[0] + ":" + std::to_string(min_batch_size_) + "x112x8x8";
         trt_options["trt_profile_max_shapes"] =
@@ -399,14 +616,17 @@ Ort::SessionOptions OnnxNetwork::GetOptions(int gpu, int threads,
   return options;
 }
 
-OnnxNetwork::OnnxNetwork(const WeightsFile& file, const OptionsDict& opts,
-                         OnnxProvider provider)
+OnnxNetwork::OnnxNetwork(
+    const WeightsFile& file, const OptionsDict& opts, OnnxProvider provider,
+    std::optional<WeightsToOnnxConverterOptions> converter_options)
     : onnx_env_(ORT_LOGGING_LEVEL_WARNING, "lc0"),
       capabilities_{file.format().network_format().input(),
                     file.format().network_format().output(),
                     file.format().network_format().moves_left()},
       fp16_(file.onnx_model().data_type() == pblczero::OnnxModel::FLOAT16),
       bf16_(file.onnx_model().data_type() == pblczero::OnnxModel::BFLOAT16),
+      converter_options_(std::move(converter_options)),
+      network_format_(file.format().network_format().OutputAsString()),
       provider_(provider) {
   batch_size_ =
       opts.GetOrDefault<int>("batch", provider == OnnxProvider::DML ? 16 : -1);
@@ -414,8 +634,8 @@ OnnxNetwork::OnnxNetwork(const WeightsFile& file, const OptionsDict& opts,
       opts.GetOrDefault<int>("steps", provider == OnnxProvider::DML ? 4 : 1);
   min_batch_size_ = opts.GetOrDefault<int>(
       "min_batch", provider == OnnxProvider::TRT ? 4 : 1);
-  int gpu = opts.GetOrDefault<int>("gpu", 0);
-  int threads =
+  gpu_ = opts.GetOrDefault<int>("gpu", 0);
+  threads_ =
       opts.GetOrDefault<int>("threads", provider == OnnxProvider::CPU ? 1 : 0);
 
   // Sanity checks.
@@ -450,6 +670,9 @@ OnnxNetwork::OnnxNetwork(const WeightsFile& file, const OptionsDict& opts,
     mlh_head_ = outputs_.size();
     outputs_.emplace_back(md.output_mlh());
   }
+  output_sizes_.resize(outputs_.size(), 1);
+  output_sizes_[policy_head_] = 1858;
+  if (wdl_head_ != -1) output_sizes_[wdl_head_] = 3;
   std::transform(inputs_.begin(), inputs_.end(),
                  std::back_inserter(inputs_cstr_),
                  [](const auto& x) { return x.c_str(); });
@@ -457,10 +680,124 @@ OnnxNetwork::OnnxNetwork(const WeightsFile& file, const OptionsDict& opts,
                  std::back_inserter(outputs_cstr_),
                  [](const auto& x) { return x.c_str(); });
 
-  for (int step = 1; step <= steps_; step++)
-    session_.emplace_back(onnx_env_, file.onnx_model().model().data(),
-                          file.onnx_model().model().size(),
-                          GetOptions(gpu, threads, batch_size_ * step));
+  // Each replica is a full set of sessions, with its own stream on the GPU
+  // providers, so batches from different search threads overlap.
+  int replicas = opts.GetOrDefault<int>(
+      "sessions", provider == OnnxProvider::CPU ? 1 : 2);
+  if (replicas < 1) throw Exception("Need at least one session.");
+  // The DML onnxruntime execution provider is documented as not supporting
+  // multi-threaded calls to Run on the same inference session. We found the
+  // same to be true for the ROCm execution provider (at least for CNNs).
+  // TODO: This may be a onnxruntime/ROCm bug, check onnxruntime 1.16 release.
+  exclusive_run_ = provider == OnnxProvider::DML ||
+                   provider == OnnxProvider::ROCM ||
+                   provider == OnnxProvider::TRT;
+  replica_lock_ = std::make_unique<std::mutex[]>(replicas);
+
+  if (provider == OnnxProvider::TRT) {
+    trt_fp16_ = opts.GetOrDefault<bool>("trt_fp16", fp16_);
+    trt_int8_calibration_ =
+        opts.GetOrDefault<std::string>("int8_calibration", "");
+    trt_cache_dir_ = opts.GetOrDefault<std::string>(
+        "trt_cache", CommandLine::BinaryDirectory() + "/trt_cache");
+  }
+  session_ = CreateSessions(file.onnx_model(), replicas);
+
+  // Inputs and outputs go through pinned host memory bound once per session,
+  // instead of pageable buffers staged by the provider on every run.
+  io_binding_ = opts.GetOrDefault<bool>(
+      "io_binding",
+      provider == OnnxProvider::CUDA || provider == OnnxProvider::TRT);
+  if (io_binding_) {
+    if (provider != OnnxProvider::CUDA && provider != OnnxProvider::TRT) {
+      throw Exception(
+          "I/O binding is only supported with the CUDA and TensorRT "
+          "providers.");
+    }
+    pinned_memory_info_ = Ort::MemoryInfo("CudaPinned", OrtDeviceAllocator,
+                                          gpu_, OrtMemTypeCPUOutput);
+    pinned_allocator_ =
+        std::make_unique<Ort::Allocator>(session_[0][0], pinned_memory_info_);
+  }
+}
+
+std::vector<std::vector<Ort::Session>> OnnxNetwork::CreateSessions(
+    const pblczero::OnnxModel& md, int replicas) {
+  const auto& model = md.model();
+  std::vector<std::vector<Ort::Session>> sessions(replicas);
+  if (provider_ == OnnxProvider::TRT) {
+    // Name cached engines after the network, GPU and precision, so different
+    // nets or settings never pick up each other's engines.
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx",
+             static_cast<unsigned long long>(std::hash<std::string_view>{}(
+                 std::string_view(model.data(), model.size()))));
+    trt_cache_prefix_ = "Lc0_ONNX_TRT_" + std::string(hash) + "_gpu" +
+                        std::to_string(gpu_) +
+                        (trt_int8_calibration_.empty()
+                             ? (trt_fp16_ ? "_fp16_" : "_fp32_")
+                             : "_int8_") +
+                        (batch_size_ < 0 ? std::string("var")
+                                         : std::to_string(batch_size_) + "x" +
+                                               std::to_string(steps_)) +
+                        "_";
+    // TensorRT handles dynamic shapes itself, so one engine with a profile
+    // over the whole batch range serves all steps.
+    for (auto& replica : sessions) {
+      replica.emplace_back(onnx_env_, model.data(), model.size(),
+                           GetOptions(gpu_, threads_, -1));
+    }
+  } else {
+    for (auto& replica : sessions) {
+      for (int step = 1; step <= steps_; step++)
+        replica.emplace_back(onnx_env_, model.data(), model.size(),
+                             GetOptions(gpu_, threads_, batch_size_ * step));
+    }
+  }
+  return sessions;
+}
+
+bool OnnxNetwork::HasSameInterface(const pblczero::OnnxModel& md) const {
+  if ((md.data_type() == pblczero::OnnxModel::FLOAT16) != fp16_ ||
+      (md.data_type() == pblczero::OnnxModel::BFLOAT16) != bf16_) {
+    return false;
+  }
+  auto same_output = [&](int head, bool has, std::string_view name) {
+    return head == -1 ? !has : has && outputs_[head] == name;
+  };
+  return md.input_planes() == inputs_[0] &&
+         same_output(policy_head_, md.has_output_policy(),
+                     md.output_policy()) &&
+         same_output(wdl_head_, md.has_output_wdl(), md.output_wdl()) &&
+         (wdl_head_ != -1 || same_output(value_head_, md.has_output_value(),
+                                         md.output_value())) &&
+         same_output(mlh_head_, md.has_output_mlh(), md.output_mlh());
+}
+
+bool OnnxNetwork::ReloadWeights(const WeightsFile& weights) {
+  if (weights.has_onnx_model() == converter_options_.has_value()) return false;
+  std::optional<WeightsFile> converted;
+  if (converter_options_) {
+    converted = ConvertWeightsToOnnx(weights, *converter_options_);
+  }
+  const WeightsFile& file = converted ? *converted : weights;
+  if (file.format().network_format().OutputAsString() != network_format_ ||
+      !HasSameInterface(file.onnx_model())) {
+    return false;
+  }
+  // Built before taking the lock, so that batches keep running meanwhile.
+  auto sessions = CreateSessions(file.onnx_model(), session_.size());
+
+  std::unique_lock<std::shared_mutex> session_lock(session_mutex_);
+  if (pinned_allocator_ && !pinned_allocator_session_) {
+    pinned_allocator_session_ = std::move(session_[0][0]);
+  }
+  {
+    std::lock_guard<std::mutex> lock(io_buffers_lock_);
+    for (OnnxIoBuffers* buffers : all_io_buffers_) buffers->ClearBindings();
+  }
+  session_ = std::move(sessions);
+  return true;
 }
 
 template <OnnxProvider kProvider>
@@ -469,7 +806,7 @@ std::unique_ptr<Network> MakeOnnxNetwork(const std::optional<WeightsFile>& w,
   if (!w) throw Exception("The ONNX backend requires a network file.");
 
   if (w->has_onnx_model()) {
-    return std::make_unique<OnnxNetwork>(*w, opts, kProvider);
+    return std::make_unique<OnnxNetwork>(*w, opts, kProvider, std::nullopt);
   } else {
     WeightsToOnnxConverterOptions converter_options;
     converter_options.opset = opts.GetOrDefault<int>("opset", 17);
@@ -478,10 +815,13 @@ std::unique_ptr<Network> MakeOnnxNetwork(const std::optional<WeightsFile>& w,
     converter_options.alt_layernorm = opts.GetOrDefault<bool>(
         "alt_layernorm", kProvider == OnnxProvider::DML ? true : false);
     converter_options.no_shape = opts.GetOrDefault<bool>("no_shape", false);
+    converter_options.optimize = opts.GetOrDefault<bool>("optimize", true);
     converter_options.policy_head =
         opts.GetOrDefault<std::string>("policy_head", "vanilla");
     converter_options.value_head =
         opts.GetOrDefault<std::string>("value_head", "winner");
+    converter_options.fp32_layers =
+        opts.GetOrDefault<std::string>("fp32_layers", "");
 
     std::string datatype;
     if (opts.IsDefault<std::string>("datatype")) {
@@ -495,7 +835,8 @@ std::unique_ptr<Network> MakeOnnxNetwork(const std::optional<WeightsFile>& w,
         WeightsToOnnxConverterOptions::StringToDataType(datatype);
 
     auto converted = ConvertWeightsToOnnx(*w, converter_options);
-    return std::make_unique<OnnxNetwork>(converted, opts, kProvider);
+    return std::make_unique<OnnxNetwork>(converted, opts, kProvider,
+                                         converter_options);
   }
 }
 
@@ -32,6 +32,7 @@
 #include <memory>
 #include <thread>
 
+#include "neural/backends/latency.h"
 #include "neural/factory.h"
 #include "utils/hashcat.h"
 
@@ -40,8 +41,12 @@ namespace {
 
 class RandomNetworkComputation : public NetworkComputation {
  public:
-  RandomNetworkComputation(int delay, int seed, bool uniform_mode)
-      : delay_ms_(delay), seed_(seed), uniform_mode_(uniform_mode) {}
+  RandomNetworkComputation(int delay, int seed, bool uniform_mode,
+                           LatencyEmulator* latency)
+      : delay_ms_(delay),
+        seed_(seed),
+        uniform_mode_(uniform_mode),
+        latency_(latency) {}
 
   void AddInput(InputPlanes&& input) override {
     std::uint64_t hash = seed_;
@@ -59,6 +64,7 @@ class RandomNetworkComputation : public NetworkComputation {
     if (delay_ms_) {
       std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms_));
     }
+    latency_->Wait(GetBatchSize());
   }
 
   int GetBatchSize() const override { return inputs_.size(); }
@@ -99,6 +105,7 @@ class RandomNetworkComputation : public NetworkComputation {
   int delay_ms_ = 0;
   int seed_ = 0;
   bool uniform_mode_ = false;
+  LatencyEmulator* latency_;
 };
 
 class RandomNetwork : public Network {
@@ -107,6 +114,7 @@ class RandomNetwork : public Network {
       : delay_ms_(options.GetOrDefault<int>("delay", 0)),
         seed_(options.GetOrDefault<int>("seed", 0)),
         uniform_mode_(options.GetOrDefault<bool>("uniform", false)),
+        latency_(options),
         capabilities_{
             static_cast<pblczero::NetworkFormat::InputFormat>(
                 options.GetOrDefault<int>(
@@ -116,7 +124,7 @@ class RandomNetwork : public Network {
             pblczero::NetworkFormat::MOVES_LEFT_NONE} {}
   std::unique_ptr<NetworkComputation> NewComputation() override {
     return std::make_unique<RandomNetworkComputation>(delay_ms_, seed_,
-                                                      uniform_mode_);
+                                                      uniform_mode_, &latency_);
   }
   const NetworkCapabilities& GetCapabilities() const override {
     return capabilities_;
@@ -126,6 +134,7 @@ class RandomNetwork : public Network {
   int delay_ms_ = 0;
   int seed_ = 0;
   bool uniform_mode_ = false;
+  LatencyEmulator latency_;
   NetworkCapabilities capabilities_{
       pblczero::NetworkFormat::INPUT_CLASSICAL_112_PLANE,
       pblczero::NetworkFormat::OUTPUT_WDL,
@@ -25,14 +25,34 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <thread>
+#include <unordered_set>
 
 #include "neural/factory.h"
+#include "utils/exception.h"
 #include "utils/hashcat.h"
+#include "utils/logging.h"
 
 namespace lczero {
 namespace {
 
+// A record with this hash marks the start of a batch. Its length field holds
+// minus the batch size, and it is followed by the batch compute time in
+// microseconds as a float. The batch's samples follow.
+const uint64_t kBatchMarker = 0;
+
+// Identifies a batch by its positions, regardless of their order.
+uint64_t BatchHash(std::vector<uint64_t> hashes) {
+  std::sort(hashes.begin(), hashes.end());
+  uint64_t hash = 0x45A3B7E1C2ULL;
+  for (const uint64_t sample : hashes) hash = HashCat({hash, sample});
+  return hash;
+}
+
 class RecordComputation : public NetworkComputation {
  public:
   RecordComputation(std::unique_ptr<NetworkComputation>&& inner,
@@ -57,7 +77,11 @@ class RecordComputation : public NetworkComputation {
     inner_->AddInput(std::move(input));
   }
   // Do the computation.
-  void ComputeBlocking() override { inner_->ComputeBlocking(); }
+  void ComputeBlocking() override {
+    const auto start = std::chrono::steady_clock::now();
+    inner_->ComputeBlocking();
+    compute_time_ = std::chrono::steady_clock::now() - start;
+  }
   // Returns how many times AddInput() was called.
   int GetBatchSize() const override { return inner_->GetBatchSize(); }
   float Capture(float value, int index) const {
@@ -85,6 +109,15 @@ class RecordComputation : public NetworkComputation {
   virtual ~RecordComputation() {
     Mutex::Lock lock(mutex_);
     std::fstream output(record_file_, std::ios::app | std::ios_base::binary);
+    const uint64_t marker = kBatchMarker;
+    output.write(reinterpret_cast<const char*>(&marker), sizeof(marker));
+    const int32_t batch_size = -static_cast<int32_t>(hashes_.size());
+    output.write(reinterpret_cast<const char*>(&batch_size),
+                 sizeof(batch_size));
+    const float compute_us =
+        std::chrono::duration<float, std::micro>(compute_time_).count();
+    output.write(reinterpret_cast<const char*>(&compute_us),
+                 sizeof(compute_us));
     for (size_t i = 0; i < hashes_.size(); i++) {
       uint64_t value = hashes_[i];
       output.write(reinterpret_cast<const char*>(&value), sizeof(value));
@@ -100,6 +133,7 @@ class RecordComputation : public NetworkComputation {
   std::unique_ptr<NetworkComputation> inner_;
   std::string record_file_;
   std::vector<uint64_t> hashes_;
+  std::chrono::steady_clock::duration compute_time_{0};
   mutable std::vector<int> q_count_;
   mutable std::vector<std::vector<float>> requests_;
   static Mutex mutex_;
@@ -107,22 +141,53 @@ class RecordComputation : public NetworkComputation {
 
 Mutex RecordComputation::mutex_;
 
+// Everything read from the recording, and how replaying it went so far.
+struct ReplayData {
+  std::unordered_map<uint64_t, std::vector<float>> lookup;
+  // Batch compositions of the recording, by BatchHash().
+  std::unordered_set<uint64_t> batches;
+  // Timing model, a batch takes base + batch size * per_position.
+  std::chrono::duration<float, std::micro> base{0};
+  std::chrono::duration<float, std::micro> per_position{0};
+
+  std::atomic<int64_t> replayed_batches{0};
+  std::atomic<int64_t> matched_batches{0};
+  std::atomic<int64_t> missing_positions{0};
+};
+
 class ReplayComputation : public NetworkComputation {
  public:
-  ReplayComputation(std::unordered_map<uint64_t, std::vector<float>>* lookup)
-      : lookup_(lookup) {}
+  ReplayComputation(ReplayData* data) : data_(data) {}
   // Adds a sample to the batch.
   void AddInput(InputPlanes&& input) override {
     hashes_.push_back(RecordComputation::make_hash(input));
     replay_counter_.push_back(0);
   }
   // Do the computation.
-  void ComputeBlocking() override {}
+  void ComputeBlocking() override {
+    const auto start = std::chrono::steady_clock::now();
+    data_->replayed_batches.fetch_add(1, std::memory_order_relaxed);
+    if (data_->batches.count(BatchHash(hashes_))) {
+      data_->matched_batches.fetch_add(1, std::memory_order_relaxed);
+    }
+    for (const uint64_t hash : hashes_) {
+      if (!data_->lookup.count(hash)) {
+        data_->missing_positions.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    const auto delay = data_->base + data_->per_position * hashes_.size();
+    if (delay.count() > 0) {
+      std::this_thread::sleep_until(
+          start +
+          std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+              delay));
+    }
+  }
   // Returns how many times AddInput() was called.
   int GetBatchSize() const override { return static_cast<int>(hashes_.size()); }
   float Replay(int index) const {
-    const auto& entry_ptr = lookup_->find(hashes_[index]);
-    if (entry_ptr == lookup_->end()) {
+    const auto& entry_ptr = data_->lookup.find(hashes_[index]);
+    if (entry_ptr == data_->lookup.end()) {
       return 0.0f;
     }
     const auto& entry = entry_ptr->second;
@@ -149,12 +214,18 @@ class ReplayComputation : public NetworkComputation {
   float GetMVal(int sample) const override { return Replay(sample); }
   virtual ~ReplayComputation() {}
 
-  std::unique_ptr<NetworkComputation> inner_;
   std::vector<uint64_t> hashes_;
   mutable std::vector<size_t> replay_counter_;
-  std::unordered_map<uint64_t, std::vector<float>>* lookup_;
+  ReplayData* data_;
 };
 
+// Records network outputs and batch compute times to record_file, or replays
+// them from replay_file. When replaying, replay_timing=recorded makes batches
+// take as long as a linear model fitted to the recorded times predicts, and
+// replay_timing=fixed uses replay_base_us + replay_position_us * batch size.
+// With a deterministic search (one thread, no noise or temperature), replays
+// build the same tree, which allows to benchmark search changes without the
+// noise of the real backend.
 class RecordReplayNetwork : public Network {
  public:
   RecordReplayNetwork(const std::optional<WeightsFile>& weights,
@@ -173,8 +244,10 @@ class RecordReplayNetwork : public Network {
     replay_file_ = options.GetOrDefault<std::string>("replay_file", "");
     record_file_ = options.GetOrDefault<std::string>("record_file", "");
     if (replay_file_.size() > 0) {
-      lookup_ =
-          std::make_unique<std::unordered_map<uint64_t, std::vector<float>>>();
+      replay_ = std::make_unique<ReplayData>();
+      std::vector<std::pair<int, float>> batch_timings;
+      std::vector<uint64_t> batch;
+      size_t batch_size = 0;
       std::ifstream input(replay_file_, std::ios_base::binary);
       input.seekg(0, input.end);
       auto file_length = input.tellg();
@@ -184,7 +257,19 @@ class RecordReplayNetwork : public Network {
         input.read(reinterpret_cast<char*>(&value), sizeof(value));
         int32_t length = 0;
         input.read(reinterpret_cast<char*>(&length), sizeof(length));
-        auto& entry = (*lookup_)[value];
+        if (value == kBatchMarker && length < 0) {
+          float compute_us = 0.0f;
+          input.read(reinterpret_cast<char*>(&compute_us), sizeof(compute_us));
+          batch_size = -length;
+          batch.clear();
+          batch_timings.emplace_back(batch_size, compute_us);
+          continue;
+        }
+        batch.push_back(value);
+        if (batch.size() == batch_size) {
+          replay_->batches.insert(BatchHash(batch));
+        }
+        auto& entry = replay_->lookup[value];
         // Only use the first recorded value for any hash collisions.
         bool fill = entry.size() == 0;
         for (int j = 0; j < length; j++) {
@@ -195,9 +280,58 @@ class RecordReplayNetwork : public Network {
           }
         }
       }
+      SetTimingModel(options, batch_timings);
     }
   }
 
+  // Sets how long replayed batches take: no time at all, a linear model
+  // fitted to the recorded compute times, or a given linear model.
+  void SetTimingModel(const OptionsDict& options,
+                      const std::vector<std::pair<int, float>>& timings) {
+    const std::string timing =
+        options.GetOrDefault<std::string>("replay_timing", "none");
+    if (timing == "none") return;
+    if (timing == "fixed") {
+      replay_->base = std::chrono::duration<float, std::micro>(
+          options.GetOrDefault<float>("replay_base_us", 0.0f));
+      replay_->per_position = std::chrono::duration<float, std::micro>(
+          options.GetOrDefault<float>("replay_position_us", 0.0f));
+      return;
+    }
+    if (timing != "recorded") {
+      throw Exception("Unknown replay_timing: " + timing);
+    }
+    if (timings.empty()) {
+      throw Exception("Replay file " + replay_file_ +
+                      " has no batch timings, record it again.");
+    }
+    // Least squares fit of time = base + size * per_position.
+    double mean_size = 0.0;
+    double mean_time = 0.0;
+    for (const auto& [size, time] : timings) {
+      mean_size += size;
+      mean_time += time;
+    }
+    mean_size /= timings.size();
+    mean_time /= timings.size();
+    double covariance = 0.0;
+    double variance = 0.0;
+    for (const auto& [size, time] : timings) {
+      covariance += (size - mean_size) * (time - mean_time);
+      variance += (size - mean_size) * (size - mean_size);
+    }
+    double per_position = variance > 0.0 ? covariance / variance
+                                         : mean_time / std::max(mean_size, 1.0);
+    per_position = std::max(per_position, 0.0);
+    const double base = std::max(mean_time - per_position * mean_size, 0.0);
+    replay_->base = std::chrono::duration<float, std::micro>(base);
+    replay_->per_position =
+        std::chrono::duration<float, std::micro>(per_position);
+    CERR << "Replaying batches in " << base << "us + " << per_position
+         << "us per position, fitted to " << timings.size()
+         << " recorded batches.";
+  }
+
   void AddBackend(const std::string& name,
                   const std::optional<WeightsFile>& weights,
                   const OptionsDict& opts) {
@@ -214,19 +348,25 @@ class RecordReplayNetwork : public Network {
   }
 
   std::unique_ptr<NetworkComputation> NewComputation() override {
-    if (!lookup_) {
+    if (!replay_) {
       const long long val = ++counter_;
       return std::make_unique<RecordComputation>(
           networks_[val % networks_.size()]->NewComputation(), record_file_);
     }
-    return std::make_unique<ReplayComputation>(lookup_.get());
+    return std::make_unique<ReplayComputation>(replay_.get());
   }
 
   const NetworkCapabilities& GetCapabilities() const override {
     return capabilities_;
   }
 
-  ~RecordReplayNetwork() {}
+  ~RecordReplayNetwork() {
+    if (!replay_) return;
+    CERR << "Replayed " << replay_->replayed_batches << " batches, "
+         << replay_->matched_batches
+         << " of them with a recorded composition; "
+         << replay_->missing_positions << " positions were not recorded.";
+  }
 
  private:
   std::vector<std::unique_ptr<Network>> networks_;
@@ -234,7 +374,7 @@ class RecordReplayNetwork : public Network {
   NetworkCapabilities capabilities_;
   std::string replay_file_;
   std::string record_file_;
-  std::unique_ptr<std::unordered_map<uint64_t, std::vector<float>>> lookup_;
+  std::unique_ptr<ReplayData> replay_;
 };
 
 std::unique_ptr<Network> MakeRecordReplayNetwork(
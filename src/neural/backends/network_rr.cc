@@ -26,6 +26,7 @@
 */
 
 #include <condition_variable>
+#include <memory>
 #include <queue>
 #include <thread>
 
@@ -39,26 +40,43 @@ class RoundRobinNetwork : public Network {
  public:
   RoundRobinNetwork(const std::optional<WeightsFile>& weights,
                     const OptionsDict& options) {
+    // Backend name and options of each child.
+    std::vector<std::pair<std::string, const OptionsDict*>> children;
+    // Per device options of children set to gpu=all.
+    std::vector<std::unique_ptr<OptionsDict>> device_options;
+    const auto add_child = [&](const std::string& name,
+                               const OptionsDict& opts) {
+      const std::string backend =
+          opts.GetOrDefault<std::string>("backend", name);
+      auto devices = NetworkFactory::Get()->ExpandDevices(backend, opts);
+      if (devices.empty()) {
+        children.emplace_back(backend, &opts);
+        return;
+      }
+      for (auto& device : devices) {
+        children.emplace_back(backend, device.get());
+        device_options.push_back(std::move(device));
+      }
+    };
     const auto parents = options.ListSubdicts();
     if (parents.empty()) {
       // If options are empty, or multiplexer configured in root object,
       // initialize on root object and default backend.
       auto backends = NetworkFactory::Get()->GetBackendsList();
-      AddBackend(backends[0], weights, options);
+      add_child(backends[0], options);
     }
 
     for (const auto& name : parents) {
-      AddBackend(name, weights, options.GetSubdict(name));
+      add_child(name, options.GetSubdict(name));
     }
-  }
 
-  void AddBackend(const std::string& name,
-                  const std::optional<WeightsFile>& weights,
-                  const OptionsDict& opts) {
-    const std::string backend = opts.GetOrDefault<std::string>("backend", name);
+    // Children are created in parallel, then added in order.
+    auto networks = NetworkFactory::Get()->CreateMany(children, weights);
+    for (auto& network : networks) AddBackend(std::move(network));
+  }
 
-    networks_.emplace_back(
-        NetworkFactory::Get()->Create(backend, weights, opts));
+  void AddBackend(std::unique_ptr<Network> network) {
+    networks_.emplace_back(std::move(network));
 
     min_batch_size_ =
         std::min(min_batch_size_, networks_.back()->GetMiniBatchSize());
@@ -86,6 +104,16 @@ class RoundRobinNetwork : public Network {
 
   bool IsCpu() const override { return is_cpu_; }
 
+  bool ReloadWeights(const WeightsFile& weights) override {
+    // All or nothing is not guaranteed, but on failure the whole network gets
+    // recreated anyway.
+    bool reloaded = true;
+    for (auto& network : networks_) {
+      reloaded = reloaded && network->ReloadWeights(weights);
+    }
+    return reloaded;
+  }
+
   ~RoundRobinNetwork() {}
 
  private:
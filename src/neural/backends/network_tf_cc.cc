@@ -28,8 +28,10 @@
 // Hack around c++ version incompatibility.
 #include <absl/base/config.h>
 
+#include <algorithm>
 #include <cstddef>
 #include <string>
+#include <unordered_map>
 #undef ABSL_HAVE_STD_STRING_VIEW
 
 #include <tensorflow/cc/client/client_session.h>
@@ -40,6 +42,7 @@
 #include "neural/network_legacy.h"
 #include "neural/tables/policy_map.h"
 #include "utils/bititer.h"
+#include "utils/mutex.h"
 #include "utils/optionsdict.h"
 #include "utils/transpose.h"
 
@@ -313,6 +316,13 @@ class TFNetwork : public Network {
   tensorflow::Status Compute(tensorflow::Tensor& input,
                              std::vector<tensorflow::Tensor>* outputs) const;
 
+  // Batches are padded to the next of a fixed set of sizes, so that XLA
+  // doesn't compile the graph again for every new batch size. The input
+  // tensors of these sizes are reused between computations.
+  int GetPaddedBatchSize(int batch_size) const;
+  tensorflow::Tensor AcquireInput(int padded_batch_size) const;
+  void ReleaseInput(tensorflow::Tensor tensor) const;
+
   const NetworkCapabilities& GetCapabilities() const override {
     return capabilities_;
   }
@@ -331,8 +341,14 @@ class TFNetwork : public Network {
   std::unique_ptr<tensorflow::Output> policy_head_;
   std::unique_ptr<tensorflow::Output> value_head_;
   std::unique_ptr<tensorflow::Output> moves_left_head_;
+  std::vector<tensorflow::Output> fetch_outputs_;
   const NetworkCapabilities capabilities_;
   const bool wdl_;
+
+  std::vector<int> batch_buckets_;
+  mutable Mutex inputs_mutex_;
+  mutable std::unordered_map<int, std::vector<tensorflow::Tensor>> free_inputs_
+      GUARDED_BY(inputs_mutex_);
 };
 
 template <bool CPU>
@@ -343,8 +359,11 @@ class TFNetworkComputation : public NetworkComputation {
     raw_input_.emplace_back(input);
   }
   void ComputeBlocking() override {
+    input_ = network_->AcquireInput(
+        network_->GetPaddedBatchSize(static_cast<int>(raw_input_.size())));
     PrepareInput();
     status_ = network_->Compute(input_, &output_);
+    network_->ReleaseInput(std::move(input_));
     CHECK(status_.ok()) << status_.ToString();
   }
 
@@ -391,10 +410,6 @@ class TFNetworkComputation : public NetworkComputation {
 // Version for GPU.
 template <>
 void TFNetworkComputation<false>::PrepareInput() {
-  input_ = tensorflow::Tensor(
-      tensorflow::DataType::DT_FLOAT,
-      {static_cast<int>(raw_input_.size()), kInputPlanes, 8, 8});
-
   auto flat = input_.flat<float>();
   memset(flat.data(), 0, flat.size() * sizeof(*flat.data()));
   auto iter = flat.data();
@@ -412,10 +427,6 @@ void TFNetworkComputation<false>::PrepareInput() {
 // Version for CPU.
 template <>
 void TFNetworkComputation<true>::PrepareInput() {
-  input_ = tensorflow::Tensor(
-      tensorflow::DataType::DT_FLOAT,
-      {static_cast<int>(raw_input_.size()), 8, 8, kInputPlanes});
-
   auto flat = input_.flat<float>();
   memset(flat.data(), 0, flat.size() * sizeof(*flat.data()));
   auto* data = flat.data();
@@ -444,6 +455,12 @@ TFNetwork<CPU>::TFNetwork(const WeightsFile& file, const OptionsDict& options,
   const LegacyWeights weights(file.weights());
   tensorflow::SessionOptions session_options;
   if (CPU) (*session_options.config.mutable_device_count())["GPU"] = 0;
+  if (options.GetOrDefault<bool>("xla", true)) {
+    // Let XLA auto-cluster and fuse the graph.
+    session_options.config.mutable_graph_options()
+        ->mutable_optimizer_options()
+        ->set_global_jit_level(OptimizerOptions::ON_1);
+  }
   session_ =
       std::make_unique<tensorflow::ClientSession>(scope_, session_options);
 
@@ -463,6 +480,8 @@ TFNetwork<CPU>::TFNetwork(const WeightsFile& file, const OptionsDict& options,
   policy_head_ = std::make_unique<Output>(std::get<0>(output));
   value_head_ = std::make_unique<Output>(std::get<1>(output));
   moves_left_head_ = std::make_unique<Output>(std::get<2>(output));
+  fetch_outputs_ = {*value_head_, *policy_head_};
+  if (IsMlh()) fetch_outputs_.push_back(*moves_left_head_);
 
   if (options.Exists<std::string>("dump-graphdef") ||
       options.Exists<std::string>("dump-graphdef-txt")) {
@@ -480,19 +499,65 @@ TFNetwork<CPU>::TFNetwork(const WeightsFile& file, const OptionsDict& options,
     }
   }
 
-  // First request to tensorflow is slow (0.6s), so doing an empty request for
-  // preheating.
-  auto fake_request = NewComputation();
-  fake_request->AddInput(InputPlanes(kInputPlanes));
-  fake_request->ComputeBlocking();
+  const int max_batch = options.GetOrDefault<int>("max_batch", 256);
+  for (int size = 1; size < max_batch; size *= 2) {
+    batch_buckets_.push_back(size);
+  }
+  batch_buckets_.push_back(max_batch);
+
+  // First request of every batch size to tensorflow is slow (0.6s, and more
+  // when XLA compiles the graph), so doing an empty request of each padded
+  // size for preheating.
+  for (int size : batch_buckets_) {
+    auto fake_request = NewComputation();
+    for (int i = 0; i < size; i++) {
+      fake_request->AddInput(InputPlanes(kInputPlanes));
+    }
+    fake_request->ComputeBlocking();
+  }
 }
 
 template <bool CPU>
 tensorflow::Status TFNetwork<CPU>::Compute(tensorflow::Tensor& input,
                                            std::vector<Tensor>* outputs) const {
-  std::vector<Output> fetch_outputs = {*value_head_, *policy_head_};
-  if (IsMlh()) fetch_outputs.push_back(*moves_left_head_);
-  return session_->Run({{*input_, input}}, fetch_outputs, outputs);
+  return session_->Run({{*input_, input}}, fetch_outputs_, outputs);
+}
+
+template <bool CPU>
+int TFNetwork<CPU>::GetPaddedBatchSize(int batch_size) const {
+  const auto iter = std::lower_bound(batch_buckets_.begin(),
+                                     batch_buckets_.end(), batch_size);
+  return iter == batch_buckets_.end() ? batch_size : *iter;
+}
+
+template <bool CPU>
+tensorflow::Tensor TFNetwork<CPU>::AcquireInput(int padded_batch_size) const {
+  {
+    Mutex::Lock lock(inputs_mutex_);
+    auto& free_inputs = free_inputs_[padded_batch_size];
+    if (!free_inputs.empty()) {
+      auto tensor = std::move(free_inputs.back());
+      free_inputs.pop_back();
+      return tensor;
+    }
+  }
+  if (CPU) {
+    return tensorflow::Tensor(tensorflow::DataType::DT_FLOAT,
+                              {padded_batch_size, 8, 8, kInputPlanes});
+  }
+  return tensorflow::Tensor(tensorflow::DataType::DT_FLOAT,
+                            {padded_batch_size, kInputPlanes, 8, 8});
+}
+
+template <bool CPU>
+void TFNetwork<CPU>::ReleaseInput(tensorflow::Tensor tensor) const {
+  const int batch_size = tensor.dim_size(0);
+  if (!std::binary_search(batch_buckets_.begin(), batch_buckets_.end(),
+                          batch_size)) {
+    return;
+  }
+  Mutex::Lock lock(inputs_mutex_);
+  free_inputs_[batch_size].push_back(std::move(tensor));
 }
 
 template <bool CPU>
@@ -38,6 +38,7 @@
 #include <iterator>
 #include <memory>
 
+#include "neural/backends/latency.h"
 #include "neural/factory.h"
 #include "utils/bititer.h"
 #include "utils/logging.h"
@@ -409,6 +410,8 @@ int NumBits(uint64_t x) {
 
 class TrivialNetworkComputation : public NetworkComputation {
  public:
+  TrivialNetworkComputation(LatencyEmulator* latency) : latency_(latency) {}
+
   void AddInput(InputPlanes&& input) override {
     float q = 0.0f;
     q += DotProduct(input[0].mask, kPawns);
@@ -437,7 +440,7 @@ class TrivialNetworkComputation : public NetworkComputation {
     q_.push_back(2.0f / (1.0f + std::exp(q * -10.0f)) - 1.0f);
   }
 
-  void ComputeBlocking() override {}
+  void ComputeBlocking() override { latency_->Wait(GetBatchSize()); }
 
   int GetBatchSize() const override { return q_.size(); }
 
@@ -451,8 +454,13 @@ class TrivialNetworkComputation : public NetworkComputation {
     return kLogPolicy[move_id];
   }
 
+  std::span<const float> GetPolicyView(int /* sample */) const override {
+    return kLogPolicy;
+  }
+
  private:
   std::vector<float> q_;
+  LatencyEmulator* latency_;
 };
 
 class TrivialNetwork : public Network {
@@ -464,9 +472,10 @@ class TrivialNetwork : public Network {
                     "input_mode",
                     pblczero::NetworkFormat::INPUT_CLASSICAL_112_PLANE)),
             pblczero::NetworkFormat::OUTPUT_CLASSICAL,
-            pblczero::NetworkFormat::MOVES_LEFT_NONE} {}
+            pblczero::NetworkFormat::MOVES_LEFT_NONE},
+        latency_(options) {}
   std::unique_ptr<NetworkComputation> NewComputation() override {
-    return std::make_unique<TrivialNetworkComputation>();
+    return std::make_unique<TrivialNetworkComputation>(&latency_);
   }
   const NetworkCapabilities& GetCapabilities() const override {
     return capabilities_;
@@ -477,6 +486,7 @@ class TrivialNetwork : public Network {
       pblczero::NetworkFormat::INPUT_CLASSICAL_112_PLANE,
       pblczero::NetworkFormat::OUTPUT_CLASSICAL,
       pblczero::NetworkFormat::MOVES_LEFT_NONE};
+  LatencyEmulator latency_;
 };
 }  // namespace
 
@@ -26,6 +26,7 @@
 */
 
 #include "layers.h"
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <cstring>
@@ -66,30 +67,65 @@ void ConvLayer::LoadWeights(dnnl::memory& w1, dnnl::memory& b1,
       dnnl::memory::desc({C}, data_type_, dnnl::memory::format_tag::a);
   bias_mem = dnnl::memory(bias_md, eng);
   dnnl::reorder(b1, bias_mem).execute(stream, b1, bias_mem);
+
+  if (int8_) {
+    // Symmetric per output channel scales, the weights are quantized when the
+    // convolution primitive picks their layout.
+    stream.wait();
+    const int filter_elements = c_input_ * filter_size_ * filter_size_;
+    auto w = static_cast<const float*>(filter_mem.get_data_handle());
+    weight_scales_.resize(C);
+    for (int c = 0; c < C; c++) {
+      float max = 0.0f;
+      for (int i = 0; i < filter_elements; i++) {
+        max = std::max(max, std::abs(w[c * filter_elements + i]));
+      }
+      weight_scales_[c] = max > 0.0f ? max / 127.0f : 1.0f;
+    }
+    in_scale_mem_ = dnnl::memory(
+        {{1}, dnnl::memory::data_type::f32, dnnl::memory::format_tag::a}, eng);
+    out_scales_mem_ = dnnl::memory(
+        {{C}, dnnl::memory::data_type::f32, dnnl::memory::format_tag::a}, eng);
+  }
 }
 
 void ConvLayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
                      dnnl::engine& eng, dnnl::stream& stream) {
   std::lock_guard<std::mutex> lock(lock_);
+  // The bias as a {1, C, 1, 1} tensor, for the int8 bias post op.
+  auto bias4_md = dnnl::memory::desc({1, C, 1, 1}, data_type_,
+                                     dnnl::memory::format_tag::nchw);
   if (last_batch_ != N) {
-    auto t_in_md = dnnl::memory::desc({N, c_input_, H, W}, data_type_,
+    // For int8 the input and weights are s8, the output stays in data_type_.
+    const auto conv_type = int8_ ? dnnl::memory::data_type::s8 : data_type_;
+    auto t_in_md = dnnl::memory::desc({N, c_input_, H, W}, conv_type,
                                       dnnl::memory::format_tag::any);
 
     auto t_filter_md =
         dnnl::memory::desc({C, c_input_, filter_size_, filter_size_},
-                           data_type_, dnnl::memory::format_tag::any);
+                           conv_type, dnnl::memory::format_tag::any);
 
     auto t_out_md = dnnl::memory::desc({N, C, H, W}, data_type_,
                                        dnnl::memory::format_tag::any);
 
     const int padding = filter_size_ / 2;
-    auto conv_d = dnnl::convolution_forward::desc(
-        dnnl::prop_kind::forward_inference,
-        filter_size_ == 3 ? convolution_type_
-                          : dnnl::algorithm::convolution_auto,
-        t_in_md, t_filter_md, bias_mem.get_desc(), t_out_md, {1, 1},
-        {padding, padding}, {padding, padding});
+    // No int8 Winograd, and the bias must not be scaled with the output, so
+    // it is added by a post op instead.
+    auto conv_d =
+        int8_ ? dnnl::convolution_forward::desc(
+                    dnnl::prop_kind::forward_inference,
+                    dnnl::algorithm::convolution_direct, t_in_md, t_filter_md,
+                    t_out_md, {1, 1}, {padding, padding}, {padding, padding})
+              : dnnl::convolution_forward::desc(
+                    dnnl::prop_kind::forward_inference,
+                    filter_size_ == 3 ? convolution_type_
+                                      : dnnl::algorithm::convolution_auto,
+                    t_in_md, t_filter_md, bias_mem.get_desc(), t_out_md,
+                    {1, 1}, {padding, padding}, {padding, padding});
     dnnl::post_ops conv_ops;
+    if (int8_) {
+      conv_ops.append_binary(dnnl::algorithm::binary_add, bias4_md);
+    }
     if (use_skip_) {
       conv_ops.append_sum();
     }
@@ -101,6 +137,10 @@ void ConvLayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     dnnl::primitive_attr conv_attr;
     conv_attr.set_scratchpad_mode(dnnl::scratchpad_mode::user);
     conv_attr.set_post_ops(conv_ops);
+    if (int8_) {
+      // Per output channel input scale times weight scale.
+      conv_attr.set_output_scales(1 << 1, {DNNL_RUNTIME_F32_VAL});
+    }
     auto conv_pd =
         dnnl::convolution_forward::primitive_desc(conv_d, conv_attr, eng);
     auto scratchpad_md = conv_pd.scratchpad_desc();
@@ -129,14 +169,24 @@ void ConvLayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
       // This may be a transformation for Winograd convolution, so keep the
       // original weights.
       conv_filter_mem = dnnl::memory(conv_pd.weights_desc(), eng);
-      dnnl::reorder(filter_mem, conv_filter_mem)
+      dnnl::primitive_attr filter_attr;
+      if (int8_) {
+        std::vector<float> inv_scales(C);
+        for (int c = 0; c < C; c++) inv_scales[c] = 1.0f / weight_scales_[c];
+        filter_attr.set_output_scales(1 << 0, inv_scales);
+      }
+      dnnl::reorder(filter_mem, conv_filter_mem, filter_attr)
           .execute(stream, filter_mem, conv_filter_mem);
     }
 
     dnnl::primitive_attr reorder_attr;
     reorder_attr.set_scratchpad_mode(dnnl::scratchpad_mode::user);
+    dnnl::primitive_attr in_reorder_attr = reorder_attr;
+    if (int8_) {
+      in_reorder_attr.set_output_scales(0, {DNNL_RUNTIME_F32_VAL});
+    }
     auto in_reorder_pd = dnnl::reorder::primitive_desc(
-        eng, input.get_desc(), eng, in_md, reorder_attr);
+        eng, input.get_desc(), eng, in_md, in_reorder_attr);
     in_reorder_ = dnnl::reorder(in_reorder_pd);
     if (scratchpad_md.get_size() < in_reorder_pd.scratchpad_desc().get_size()) {
       scratchpad_md = in_reorder_pd.scratchpad_desc();
@@ -157,7 +207,26 @@ void ConvLayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     last_batch_ = N;
   }
 
-  if (in_md != input.get_desc()) {
+  if (int8_) {
+    // Dynamic symmetric quantization of the input, padding is zero so the
+    // whole buffer can be scanned irrespective of its layout.
+    stream.wait();
+    auto x = static_cast<const float*>(input.get_data_handle());
+    const size_t size = input.get_desc().get_size() / sizeof(float);
+    float max = 0.0f;
+    for (size_t i = 0; i < size; i++) max = std::max(max, std::abs(x[i]));
+    const float in_scale = max > 0.0f ? max / 127.0f : 1.0f;
+    *static_cast<float*>(in_scale_mem_.get_data_handle()) = 1.0f / in_scale;
+    auto out_scales = static_cast<float*>(out_scales_mem_.get_data_handle());
+    for (int c = 0; c < C; c++) out_scales[c] = in_scale * weight_scales_[c];
+
+    auto tmp = dnnl::memory(in_md, eng);
+    in_reorder_.execute(stream, {{DNNL_ARG_SRC, input},
+                                 {DNNL_ARG_DST, tmp},
+                                 {DNNL_ARG_ATTR_OUTPUT_SCALES, in_scale_mem_},
+                                 {DNNL_ARG_SCRATCHPAD, scratchpad_mem}});
+    input = tmp;
+  } else if (in_md != input.get_desc()) {
     auto tmp = dnnl::memory(in_md, eng);
     in_reorder_.execute(stream, {{DNNL_ARG_SRC, input},
                                  {DNNL_ARG_DST, tmp},
@@ -177,11 +246,23 @@ void ConvLayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     }
   }
 
-  conv_.execute(stream, {{DNNL_ARG_SRC, input},
-                         {DNNL_ARG_WEIGHTS, conv_filter_mem},
-                         {DNNL_ARG_BIAS, bias_mem},
-                         {DNNL_ARG_DST, output},
-                         {DNNL_ARG_SCRATCHPAD, scratchpad_mem}});
+  if (int8_) {
+    auto bias4_mem = dnnl::memory(bias4_md, eng, bias_mem.get_data_handle());
+    conv_.execute(
+        stream,
+        {{DNNL_ARG_SRC, input},
+         {DNNL_ARG_WEIGHTS, conv_filter_mem},
+         {DNNL_ARG_ATTR_MULTIPLE_POST_OP(0) | DNNL_ARG_SRC_1, bias4_mem},
+         {DNNL_ARG_ATTR_OUTPUT_SCALES, out_scales_mem_},
+         {DNNL_ARG_DST, output},
+         {DNNL_ARG_SCRATCHPAD, scratchpad_mem}});
+  } else {
+    conv_.execute(stream, {{DNNL_ARG_SRC, input},
+                           {DNNL_ARG_WEIGHTS, conv_filter_mem},
+                           {DNNL_ARG_BIAS, bias_mem},
+                           {DNNL_ARG_DST, output},
+                           {DNNL_ARG_SCRATCHPAD, scratchpad_mem}});
+  }
 
   if (activation_ == ACTIVATION_MISH) {
     mish_.execute(stream, {{DNNL_ARG_SRC, output},
@@ -613,9 +694,15 @@ void AttentionPolicyHead::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     fc_out_mem = dnnl::memory(fc_out_md, eng);
     auto foo_md = dnnl::memory::desc({N, H, W, C}, data_type_,
                                      dnnl::memory::format_tag::nchw);
+    // Let oneDNN pick the weight layouts, so that blocked (e.g. AMX bf16)
+    // formats can be used. The weights are reordered only when the chosen
+    // layout changes.
+    auto fc_filter_md =
+        dnnl::memory::desc(fc_filter_mem.get_desc().dims(), data_type_,
+                           dnnl::memory::format_tag::any);
     auto fc_d = dnnl::inner_product_forward::desc(
         dnnl::prop_kind::forward_inference, foo_md.reshape({N * H * W, C}),
-        fc_filter_mem.get_desc(), fc_bias_mem.get_desc(), fc_out_md);
+        fc_filter_md, fc_bias_mem.get_desc(), fc_out_md);
     dnnl::post_ops fc_ops;
     // SELU activation.
     fc_ops.append_eltwise(1.0f, dnnl::algorithm::eltwise_elu, 1.67326324f,
@@ -629,15 +716,23 @@ void AttentionPolicyHead::Eval(int N, dnnl::memory& output, dnnl::memory& input,
         dnnl::inner_product_forward::primitive_desc(fc_d, fc_attr, eng);
     fc_ = dnnl::inner_product_forward(fc_pd);
     auto scratchpad_md = fc_pd.scratchpad_desc();
+    if (fc_pd.weights_desc() != fc_filter_mem.get_desc()) {
+      auto tmp = dnnl::memory(fc_pd.weights_desc(), eng);
+      dnnl::reorder(fc_filter_mem, tmp).execute(stream, fc_filter_mem, tmp);
+      fc_filter_mem = tmp;
+    }
 
     // Q
     auto fcQK_out_md = dnnl::memory::desc({N * 64, policy_d_model_}, data_type_,
                                           dnnl::memory::format_tag::ab);
     fcQ_out_mem = dnnl::memory(fcQK_out_md, eng);
 
+    auto fcQK_filter_md =
+        dnnl::memory::desc(fcQ_filter_mem.get_desc().dims(), data_type_,
+                           dnnl::memory::format_tag::any);
     auto fcQK_d = dnnl::inner_product_forward::desc(
-        dnnl::prop_kind::forward_inference, fc_out_md,
-        fcQ_filter_mem.get_desc(), fcQ_bias_mem.get_desc(), fcQK_out_md);
+        dnnl::prop_kind::forward_inference, fc_out_md, fcQK_filter_md,
+        fcQ_bias_mem.get_desc(), fcQK_out_md);
     dnnl::primitive_attr common_attr;
     common_attr.set_scratchpad_mode(dnnl::scratchpad_mode::user);
     auto fcQK_pd =
@@ -646,6 +741,17 @@ void AttentionPolicyHead::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     if (scratchpad_md.get_size() < fcQK_pd.scratchpad_desc().get_size()) {
       scratchpad_md = fcQK_pd.scratchpad_desc();
     }
+    // Q and K share the primitive, so both get the same weight layout.
+    if (fcQK_pd.weights_desc() != fcQ_filter_mem.get_desc()) {
+      auto tmp = dnnl::memory(fcQK_pd.weights_desc(), eng);
+      dnnl::reorder(fcQ_filter_mem, tmp).execute(stream, fcQ_filter_mem, tmp);
+      fcQ_filter_mem = tmp;
+    }
+    if (fcQK_pd.weights_desc() != fcK_filter_mem.get_desc()) {
+      auto tmp = dnnl::memory(fcQK_pd.weights_desc(), eng);
+      dnnl::reorder(fcK_filter_mem, tmp).execute(stream, fcK_filter_mem, tmp);
+      fcK_filter_mem = tmp;
+    }
 
     // K
     fcK_out_mem = dnnl::memory(fcQK_out_md, eng);
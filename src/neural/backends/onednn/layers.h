@@ -26,6 +26,8 @@
 */
 #pragma once
 
+#include <vector>
+
 #include "neural/tables/activation_function.h"
 #include "utils/exception.h"
 
@@ -70,6 +72,11 @@ class ConvLayer : public BaseLayer {
   void LoadWeights(dnnl::memory& w1, dnnl::memory& b1, dnnl::engine& eng,
                    dnnl::stream& stream);
 
+  // Runs the convolution in int8, with symmetric per output channel weight
+  // scales and an input scale taken from each input's largest magnitude.
+  // Must be called before LoadWeights(), for f32 on cpu only.
+  void SetInt8(bool int8) { int8_ = int8; }
+
   // If there is a skip connection the output doubles as an input.
   void Eval(int N, dnnl::memory& output, dnnl::memory& input, dnnl::engine& eng,
             dnnl::stream& stream) override;
@@ -79,10 +86,16 @@ class ConvLayer : public BaseLayer {
   const int filter_size_;
   const ActivationFunction activation_;
   const bool use_skip_;
+  bool int8_ = false;
 
   dnnl::memory filter_mem;       // The original weights.
   dnnl::memory conv_filter_mem;  // Transformed weights (maybe for Winograd).
   dnnl::memory bias_mem;
+  // For int8, the scale of each output channel's weights, and the runtime
+  // scales of the input quantization and of the convolution output.
+  std::vector<float> weight_scales_;
+  dnnl::memory in_scale_mem_;
+  dnnl::memory out_scales_mem_;
 
   // Cache previous convolution primitive in case the batch size is the same.
   int last_batch_ = 0;
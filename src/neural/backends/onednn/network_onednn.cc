@@ -36,6 +36,7 @@
 #include "neural/factory.h"
 #include "neural/network_legacy.h"
 #include "neural/tables/attention_policy_map.h"
+#include "neural/tables/policy_gather.h"
 #include "neural/tables/policy_map.h"
 #include "utils/bititer.h"
 #include "utils/exception.h"
@@ -132,6 +133,11 @@ class OnednnNetworkComputation : public NetworkComputation {
     return inputs_outputs_->op_policy_mem_[sample * kNumOutputPolicy + move_id];
   }
 
+  std::span<const float> GetPolicyView(int sample) const override {
+    return {&inputs_outputs_->op_policy_mem_[sample * kNumOutputPolicy],
+            static_cast<size_t>(kNumOutputPolicy)};
+  }
+
   float GetMVal(int sample) const override {
     if (moves_left_) {
       return inputs_outputs_->op_moves_left_mem_[sample];
@@ -217,6 +223,13 @@ class OnednnNetwork : public Network {
       }
     }
 
+    // Quantize the residual tower convolutions to int8, cpu and f32 only.
+    const bool int8 = options.GetOrDefault<bool>("int8", false);
+    if (int8 && (eng_.get_kind() != dnnl::engine::kind::cpu ||
+                 data_type != dnnl::memory::data_type::f32)) {
+      throw Exception("The int8 option requires f32 on cpu.");
+    }
+
     max_batch_size_ = options.GetOrDefault<int>("max_batch", 1024);
 
     batch_size_ = options.GetOrDefault<int>(
@@ -279,6 +292,7 @@ class OnednnNetwork : public Network {
                                dnnl::memory::format_tag::a);
         auto b_mem = dnnl::memory(b_md, cpu_eng_,
                                   &weights.residual[block].conv1.biases[0]);
+        conv1->SetInt8(int8);
         conv1->LoadWeights(w_mem, b_mem, eng_, eng_stream_);
         layers_[idx].emplace_back(std::move(conv1));
 
@@ -293,6 +307,7 @@ class OnednnNetwork : public Network {
                              &weights.residual[block].conv2.weights[0]);
         b_mem = dnnl::memory(b_md, cpu_eng_,
                              &weights.residual[block].conv2.biases[0]);
+        conv2->SetInt8(int8);
         conv2->LoadWeights(w_mem, b_mem, eng_, eng_stream_);
         layers_[idx].emplace_back(std::move(conv2));
 
@@ -777,12 +792,9 @@ class OnednnNetwork : public Network {
       } else if (conv_policy_) {
         float* opPol = (float*)opPol_mem.get_data_handle();
         for (int batch = 0; batch < currentBatchSize; batch++) {
-          for (int i = 0; i < 73 * 8 * 8; i++) {
-            auto j = kConvPolicyMap[i];
-            if (j >= 0) {
-              io->op_policy_mem_[(batch + start) * kNumOutputPolicy + j] =
-                  opPol[batch * pol_channels_ * 64 + i];
-            }
+          for (int j = 0; j < kNumOutputPolicy; j++) {
+            io->op_policy_mem_[(batch + start) * kNumOutputPolicy + j] =
+                opPol[batch * pol_channels_ * 64 + kConvPolicyGather[j]];
           }
         }
       } else {
@@ -25,7 +25,10 @@
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstdint>
+#include <cstdio>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <memory>
 #include <sstream>
@@ -35,6 +38,7 @@
 #include "neural/backends/opencl/OpenCL.h"
 #include "neural/backends/opencl/OpenCLParams.h"
 #include "neural/backends/opencl/OpenCLTuner.h"
+#include "utils/fp_convert.h"
 #include "utils/logging.h"
 
 static std::string cl_args =
@@ -91,12 +95,31 @@ const std::string sourceCode_sgemv =
 #include "clblast_level3/xgemv.opencl"
     ;
 
+void OpenCL_Network::push_weights(size_t layer,
+                                  const std::vector<float>& weights) {
+  add_weights(layer, weights.size(), weights.data(), m_opencl.m_fp16_storage);
+}
+
+void OpenCL_Network::push_gemm_weights(size_t layer,
+                                       const std::vector<float>& weights) {
+  add_weights(layer, weights.size(), weights.data(), m_opencl.m_fp16_gemm);
+}
+
 void OpenCL_Network::add_weights(size_t layer, size_t size,
-                                 const float* weights) {
+                                 const float* weights, bool half) {
   if (layer >= m_layers.size()) {
     m_layers.push_back(Layer());
   }
 
+  if (half) {
+    auto converted_weights = std::vector<uint16_t>(size);
+    FP32toFP16({weights, size}, converted_weights);
+    m_layers.back().weights.emplace_back(
+        m_opencl.m_context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY,
+        size * sizeof(uint16_t), converted_weights.data());
+    return;
+  }
+
   auto converted_weights = std::vector<net_t>();
   for (auto i = size_t{0}; i < size; i++) {
     converted_weights.emplace_back(weights[i]);
@@ -336,32 +359,76 @@ void OpenCL::initialize(const int channels, const OpenCLParams& params) {
   m_context = context;
   m_device = best_device;
 
-  // Make program of the source code in the context.
-  try {
-    m_program = cl::Program(
-        m_context, sourceCode_config + sourceCode_convolve1 +
-                       sourceCode_convolve3 + sourceCode_se + sourceCode_sgemm +
-                       sourceCode_sgemv + sourceCode_policymap);
-  } catch (const cl::Error& e) {
-    CERR << "Error getting kernels: " << e.what() << ": " << e.err();
-    throw std::runtime_error("Error getting OpenCL kernels.");
-  }
-
   m_cl_args = cl_args;
 
+  m_fp16_storage = params.fp16 || params.fp16_compute;
+  m_fp16_gemm = false;
+  if (params.fp16_compute) {
+    const std::string extensions = best_device.getInfo<CL_DEVICE_EXTENSIONS>();
+    if (extensions.find("cl_khr_fp16") == std::string::npos) {
+      CERR << "Device doesn't support cl_khr_fp16, using fp16 storage only.";
+    } else {
+      m_fp16_gemm = true;
+    }
+  }
+  // The tuner still runs the gemm in single precision, so these only go into
+  // the network program.
+  std::string precision_args;
+  if (m_fp16_storage) precision_args += " -DUSE_HALF";
+  if (m_fp16_gemm) precision_args += " -DUSE_HALF_GEMM -DPRECISION=16";
+  if (m_fp16_storage) {
+    CERR << "Using fp16 storage with "
+         << (m_fp16_gemm ? "fp16" : "fp32") << " gemm.";
+  }
+
   auto t = Tuner(*this, params, m_context, m_device);
   auto sgemm_tuners = t.load_sgemm_tuners(
       channels, params.tune_batch_size * WINOGRAD_P, channels, WINOGRAD_TILE);
 
-  // Build program for these specific devices.
-  try {
-    std::string args = cl_args;
-    args += sgemm_tuners;
-    m_program.build(args.c_str());
-  } catch (const cl::Error&) {
-    CERR << "Error building kernels: "
-         << m_program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(m_device) << ".";
-    throw std::runtime_error("Error building OpenCL kernels.");
+  const std::string source = sourceCode_config + sourceCode_convolve1 +
+                             sourceCode_convolve3 + sourceCode_se +
+                             sourceCode_sgemm + sourceCode_sgemv +
+                             sourceCode_policymap;
+  const std::string args = cl_args + precision_args + sgemm_tuners;
+
+  // Compiled programs are cached per device, driver, source and build options
+  // (which include the tuned parameters).
+  std::string cache_file;
+  std::string cache_key;
+  if (!params.kernel_cache.empty()) {
+    std::ostringstream key;
+    key << best_platform.getInfo<CL_PLATFORM_VERSION>() << '\n'
+        << best_device.getInfo<CL_DEVICE_NAME>() << '\n'
+        << best_device.getInfo<CL_DEVICE_VENDOR>() << '\n'
+        << best_device.getInfo<CL_DRIVER_VERSION>() << '\n'
+        << args << '\n'
+        << std::hex << std::hash<std::string>{}(source);
+    cache_key = key.str();
+    std::ostringstream file;
+    file << params.kernel_cache << std::hex
+         << std::hash<std::string>{}(cache_key);
+    cache_file = file.str();
+  }
+
+  if (cache_file.empty() || !load_program_binary(cache_file, cache_key, args)) {
+    // Make program of the source code in the context.
+    try {
+      m_program = cl::Program(m_context, source);
+    } catch (const cl::Error& e) {
+      CERR << "Error getting kernels: " << e.what() << ": " << e.err();
+      throw std::runtime_error("Error getting OpenCL kernels.");
+    }
+
+    // Build program for these specific devices.
+    try {
+      m_program.build(args.c_str());
+    } catch (const cl::Error&) {
+      CERR << "Error building kernels: "
+           << m_program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(m_device) << ".";
+      throw std::runtime_error("Error building OpenCL kernels.");
+    }
+
+    if (!cache_file.empty()) save_program_binary(cache_file, cache_key);
   }
 
   process_tuners(sgemm_tuners);
@@ -384,6 +451,68 @@ void OpenCL::initialize(const int channels, const OpenCLParams& params) {
   m_init_ok = true;
 }
 
+bool OpenCL::load_program_binary(const std::string& file,
+                                 const std::string& key,
+                                 const std::string& args) {
+  std::ifstream in(file, std::ios::binary);
+  if (!in) return false;
+  uint64_t key_size = 0;
+  uint64_t binary_size = 0;
+  in.read(reinterpret_cast<char*>(&key_size), sizeof(key_size));
+  if (!in || key_size != key.size()) return false;
+  std::string stored_key(key_size, '\0');
+  in.read(stored_key.data(), key_size);
+  in.read(reinterpret_cast<char*>(&binary_size), sizeof(binary_size));
+  if (!in || stored_key != key || binary_size == 0) return false;
+  std::vector<unsigned char> binary(binary_size);
+  in.read(reinterpret_cast<char*>(binary.data()), binary_size);
+  if (!in) return false;
+
+  try {
+    std::vector<cl_int> status;
+    m_program = cl::Program(m_context, {m_device}, {binary}, &status);
+    if (status.empty() || status[0] != CL_SUCCESS) return false;
+    m_program.build(args.c_str());
+  } catch (const cl::Error& e) {
+    CERR << "Ignoring cached OpenCL kernels: " << e.what() << ": " << e.err();
+    return false;
+  }
+  CERR << "Loaded cached OpenCL kernels from " << file << ".";
+  return true;
+}
+
+void OpenCL::save_program_binary(const std::string& file,
+                                 const std::string& key) {
+  std::vector<std::vector<unsigned char>> binaries;
+  try {
+    binaries = m_program.getInfo<CL_PROGRAM_BINARIES>();
+  } catch (const cl::Error& e) {
+    CERR << "Can't get OpenCL program binary: " << e.what() << ": " << e.err();
+    return;
+  }
+  if (binaries.size() != 1 || binaries[0].empty()) return;
+  // Write to a temporary file first, so that concurrent starts never see a
+  // partial cache file.
+  const std::string tmp = file + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    const uint64_t key_size = key.size();
+    const uint64_t binary_size = binaries[0].size();
+    out.write(reinterpret_cast<const char*>(&key_size), sizeof(key_size));
+    out.write(key.data(), key_size);
+    out.write(reinterpret_cast<const char*>(&binary_size),
+              sizeof(binary_size));
+    out.write(reinterpret_cast<const char*>(binaries[0].data()), binary_size);
+    if (!out) {
+      CERR << "Can't write OpenCL kernel cache " << file << ".";
+      std::remove(tmp.c_str());
+      return;
+    }
+  }
+  std::remove(file.c_str());
+  if (std::rename(tmp.c_str(), file.c_str()) != 0) std::remove(tmp.c_str());
+}
+
 std::unique_ptr<OpenCLBuffers> OpenCL_Network::acquire_buffers() const {
   std::lock_guard<std::mutex> lock(m_pool_mutex);
   if (m_buffers_pool.empty()) return std::make_unique<OpenCLBuffers>(*this);
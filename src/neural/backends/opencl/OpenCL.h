@@ -31,6 +31,7 @@ using net_t = float;
 #endif
 #define CL_HPP_ENABLE_EXCEPTIONS
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -93,7 +94,7 @@ class OpenCL_Network {
                               const std::vector<float>& weights,
                               const std::vector<float>& biases) {
     size_t layer = get_layer_count();
-    push_weights(layer, weights);
+    push_gemm_weights(layer, weights);
     push_weights(layer, biases);
     m_layers[layer].is_input_convolution = true;
     m_layers[layer].outputs = outputs;
@@ -107,9 +108,9 @@ class OpenCL_Network {
                      const std::vector<float>& weights_2,
                      const std::vector<float>& biases_2) {
     size_t layer = get_layer_count();
-    push_weights(layer, weights_1);
+    push_gemm_weights(layer, weights_1);
     push_weights(layer, biases_1);
-    push_weights(layer, weights_2);
+    push_gemm_weights(layer, weights_2);
     push_weights(layer, biases_2);
     m_layers[layer].is_residual_block = true;
     m_layers[layer].outputs = outputs;
@@ -159,9 +160,9 @@ class OpenCL_Network {
                         const std::vector<float>& biases_2,
                         const std::vector<short>& indices) {
     size_t layer = get_layer_count();
-    push_weights(layer, weights_1);
+    push_gemm_weights(layer, weights_1);
     push_weights(layer, biases_1);
-    push_weights(layer, weights_2);
+    push_gemm_weights(layer, weights_2);
     push_weights(layer, biases_2);
     push_weights_short(layer, indices);
     m_layers[layer].is_conv_policy = true;
@@ -210,10 +211,11 @@ class OpenCL_Network {
   size_t get_layer_count() const { return m_layers.size(); }
 
  private:
-  void push_weights(size_t layer, const std::vector<float>& weights) {
-    add_weights(layer, weights.size(), weights.data());
-  }
-  void add_weights(size_t layer, size_t size, const float* weights);
+  void push_weights(size_t layer, const std::vector<float>& weights);
+  // Weights used as an operand of the batched gemm (Winograd filters).
+  void push_gemm_weights(size_t layer, const std::vector<float>& weights);
+  void add_weights(size_t layer, size_t size, const float* weights,
+                   bool half);
 
   void push_weights_short(size_t layer, const std::vector<short>& weights) {
     add_weights_short(layer, weights.size(), weights.data());
@@ -240,12 +242,26 @@ class OpenCL {
 
   std::vector<size_t> get_sgemm_tuners(void);
 
+  // Size in bytes of an activation/weight element (net_t in the kernels).
+  size_t net_size() const {
+    return m_fp16_storage ? sizeof(uint16_t) : sizeof(float);
+  }
+  // Size in bytes of a batched gemm operand element (gemm_t in the kernels).
+  size_t gemm_size() const {
+    return m_fp16_gemm ? sizeof(uint16_t) : sizeof(float);
+  }
+  bool is_fp16() const { return m_fp16_storage; }
+
   cl::Device m_device;
   cl::Context m_context;
 
  private:
   void tune_sgemm(void);
   void process_tuners(std::string tuners);
+  // Loads and builds m_program from a cached binary, if one exists for key.
+  bool load_program_binary(const std::string& file, const std::string& key,
+                           const std::string& args);
+  void save_program_binary(const std::string& file, const std::string& key);
 
   cl::Program m_program;
   std::string m_cl_args;
@@ -260,6 +276,8 @@ class OpenCL {
   size_t m_max_workgroup_size{0};
   std::vector<size_t> m_max_workgroup_dims;
   bool m_init_ok{false};
+  bool m_fp16_storage{false};
+  bool m_fp16_gemm{false};
 };
 
 extern const std::string sourceCode_sgemm;
@@ -21,6 +21,22 @@
 
 #include "neural/backends/opencl/OpenCLBuffers.h"
 
+#include <cstring>
+
+#include "utils/fp_convert.h"
+
+namespace {
+// Copies count outputs from device storage (half or float) to the host.
+void CopyOutputs(float* out, const void* in, size_t count, bool half) {
+  if (!half) {
+    std::memcpy(out, in, count * sizeof(float));
+    return;
+  }
+  const auto* in_half = static_cast<const uint16_t*>(in);
+  FP16toFP32({in_half, count}, {out, count});
+}
+}  // namespace
+
 OpenCLBuffers::OpenCLBuffers(const OpenCL_Network& opencl_net)
     : m_opencl_net(opencl_net), m_opencl(opencl_net.getOpenCL()) {
   auto& program = m_opencl.m_program;
@@ -50,18 +66,21 @@ OpenCLBuffers::OpenCLBuffers(const OpenCL_Network& opencl_net)
   m_finalSize_val = 0;
   m_finalSize_mov = 0;
 
+  // Sizes below are in bytes of the device storage type.
+  const auto net_size = m_opencl.net_size();
+
   auto max_channels = unsigned{0};
   for (const auto& layer : layers) {
     max_channels =
         std::max(max_channels, std::max(layer.channels, layer.outputs));
     if (layer.is_policy || layer.is_conv_policy) {
-      m_finalSize_pol = layer.ip_out_size * sizeof(net_t);
+      m_finalSize_pol = layer.ip_out_size * net_size;
     }
     if (layer.is_value) {
-      m_finalSize_val = layer.ip_out_size * sizeof(net_t);
+      m_finalSize_val = layer.ip_out_size * net_size;
     }
     if (layer.is_moves_left) {
-      m_finalSize_mov = layer.ip_out_size * sizeof(net_t);
+      m_finalSize_mov = layer.ip_out_size * net_size;
     }
   }
 
@@ -75,11 +94,12 @@ OpenCLBuffers::OpenCLBuffers(const OpenCL_Network& opencl_net)
 
   const auto max_batch_size = m_opencl_net.getMaxMatchSize();
   const auto alloc_inSize =
-      max_batch_size * width * height * max_channels * sizeof(net_t);
-  const auto alloc_vm_size =
-      max_batch_size * WINOGRAD_TILE * m_ceil * n_ceil * sizeof(net_t);
-  const auto alloc_pool_size =
-      max_batch_size * 2 * max_channels * sizeof(net_t);
+      max_batch_size * width * height * max_channels * net_size;
+  // V and M are also used as temporaries by the 1x1 convolution and SE.
+  const auto alloc_vm_size = max_batch_size * WINOGRAD_TILE * m_ceil *
+                             n_ceil *
+                             std::max(net_size, m_opencl.gemm_size());
+  const auto alloc_pool_size = max_batch_size * 2 * max_channels * net_size;
 
   auto v_zeros = std::vector<float>(alloc_vm_size);
 
@@ -137,9 +157,19 @@ void OpenCLBuffers::forward(const std::vector<net_t>& input,
                             const int batch_size) {
   auto& layers = m_opencl_net.m_layers;
 
-  const auto inSize = sizeof(net_t) * input.size();
-  m_commandqueue.enqueueWriteBuffer(m_inBuffer, CL_FALSE, 0, inSize,
-                                    input.data());
+  const bool half = m_opencl.is_fp16();
+  if (half) {
+    // Kept in a member, the write completes before the next forward().
+    m_half_input.resize(input.size());
+    FP32toFP16(input, m_half_input);
+    m_commandqueue.enqueueWriteBuffer(m_inBuffer, CL_FALSE, 0,
+                                      m_half_input.size() * sizeof(uint16_t),
+                                      m_half_input.data());
+  } else {
+    const auto inSize = sizeof(net_t) * input.size();
+    m_commandqueue.enqueueWriteBuffer(m_inBuffer, CL_FALSE, 0, inSize,
+                                      input.data());
+  }
 
   auto skip_in_trans = false;
   for (auto iter = cbegin(layers); iter != cend(layers); iter++) {
@@ -307,13 +337,14 @@ void OpenCLBuffers::forward(const std::vector<net_t>& input,
 
   m_commandqueue.finish();
 
-  std::memcpy(output_pol.data(), pinnedOutBufferHost_pol,
-              batch_size * m_finalSize_pol);
-  std::memcpy(output_val.data(), pinnedOutBufferHost_val,
-              batch_size * m_finalSize_val);
+  const auto net_size = m_opencl.net_size();
+  CopyOutputs(output_pol.data(), pinnedOutBufferHost_pol,
+              batch_size * m_finalSize_pol / net_size, half);
+  CopyOutputs(output_val.data(), pinnedOutBufferHost_val,
+              batch_size * m_finalSize_val / net_size, half);
   if (m_finalSize_mov > 0) {
-    std::memcpy(output_mov.data(), pinnedOutBufferHost_mov,
-                batch_size * m_finalSize_mov);
+    CopyOutputs(output_mov.data(), pinnedOutBufferHost_mov,
+                batch_size * m_finalSize_mov / net_size, half);
   }
 
   m_commandqueue.enqueueUnmapMemObject(m_pinnedOutBuffer_pol,
@@ -517,7 +548,7 @@ void OpenCLBuffers::convolve1(int channels, int outputs,
 
 #ifndef NDEBUG
   // Total output size after reducing.
-  size_t outSize = width * height * outputs * sizeof(net_t);
+  size_t outSize = width * height * outputs * m_opencl.net_size();
 
   // Produce channel * output planes and merge them at the end.
   size_t mergeSize = (channels >> channelShift) * outSize;
@@ -105,4 +105,6 @@ class OpenCLBuffers {
   size_t m_finalSize_pol;
   size_t m_finalSize_val;
   size_t m_finalSize_mov;
+  // Input converted to half when the network is stored in fp16.
+  std::vector<uint16_t> m_half_input;
 };
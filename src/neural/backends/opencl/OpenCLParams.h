@@ -28,5 +28,11 @@ struct OpenCLParams {
   bool force_tune = false;
   bool tune_exhaustive = false;
   int tune_batch_size = 1;
+  // Store activations and weights as half, computing in float.
+  bool fp16 = false;
+  // Also run the Winograd gemm in half precision (needs cl_khr_fp16).
+  bool fp16_compute = false;
   std::string tuner_file;
+  // Prefix of the compiled kernel cache files, empty to disable the cache.
+  std::string kernel_cache;
 };
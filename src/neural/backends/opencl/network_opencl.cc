@@ -199,6 +199,10 @@ class OpenCLComputation : public NetworkComputation {
     return policies_[sample][move_id];
   }
 
+  std::span<const float> GetPolicyView(int sample) const override {
+    return policies_[sample];
+  }
+
  private:
   static constexpr auto kWidth = 8;
   static constexpr auto kHeight = 8;
@@ -247,6 +251,8 @@ class OpenCLNetwork : public Network {
     params_.tune_only = options.GetOrDefault<bool>("tune_only", false);
     params_.tune_exhaustive =
         options.GetOrDefault<bool>("tune_exhaustive", false);
+    params_.fp16 = options.GetOrDefault<bool>("fp16", false);
+    params_.fp16_compute = options.GetOrDefault<bool>("fp16_compute", false);
     if (options.IsDefault<std::string>("tuner_file")) {
       std::string user_cache_path = GetUserCacheDirectory();
       if (!user_cache_path.empty()) {
@@ -257,6 +263,9 @@ class OpenCLNetwork : public Network {
     } else {
       params_.tuner_file = options.Get<std::string>("tuner_file");
     }
+    if (options.GetOrDefault<bool>("kernel_cache", true)) {
+      params_.kernel_cache = params_.tuner_file + "_kernels_";
+    }
 
     wdl_ = file.format().network_format().output() ==
            pblczero::NetworkFormat::OUTPUT_WDL;
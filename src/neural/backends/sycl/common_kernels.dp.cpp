@@ -20,9 +20,10 @@
 */
 
 #include <sycl/sycl.hpp>
-#include "dpct/dpct.hpp"
 #include <algorithm>
 #include <cassert>
+#include <limits>
+#include <type_traits>
 
 #include "sycl_common.h"
 #include "neural/backends/shared/activation.h"
@@ -34,6 +35,16 @@ namespace lczero {
 namespace sycldnn_backend {
 namespace {
 constexpr int kInputPlanes = 112;
+
+// Network dimensions of the hot kernels, passed as specialization constants.
+// With JIT compilation the runtime builds (and caches) a kernel for each set
+// of values, so divisions and loop bounds become compile time constants. AOT
+// builds fall back to reading them from an implicit buffer.
+constexpr sycl::specialization_id<int> kLayerNormChannels(0);
+constexpr sycl::specialization_id<int> kLayerNormActivation(0);
+constexpr sycl::specialization_id<int> kAvgPoolChannels(0);
+constexpr sycl::specialization_id<int> kPolicyMapInputSize(0);
+constexpr sycl::specialization_id<int> kPolicyMapUsedSize(0);
 }  // namespace
 
 /////////////////////////////////////////////////////////////////////////////
@@ -875,13 +886,7 @@ void globalAvgPool_kernel(T* output, const T* input,
 // Compute warp wide sum (for entire plane - elementsPerWarp elements).
 #pragma unroll
   for (int offset = 1; offset < 32; offset *= 2) {
-    /*
-    DPCT1023:10: The SYCL sub-group does not support mask options for
-    dpct::shift_sub_group_left. You can specify
-    "--use-experimental-features=masked-sub-group-operation" to use the
-    experimental helper function to migrate __shfl_down_sync.
-    */
-    S += dpct::shift_sub_group_left(item_ct1.get_sub_group(), S, offset);
+    S += sycl::shift_group_left(item_ct1.get_sub_group(), S, offset);
   }
 
   float avg = S / elementsPerWarp;
@@ -932,14 +937,20 @@ void globalAvgPool(int N, int C, T* output, const T* input,
     const int kBlockSize = kWarpsPerBlock * 32;
 
     int blocks = DivUp(kTotalWarps, kWarpsPerBlock);
-    sycl_queue.parallel_for(
-        sycl::nd_range<3>(
-            sycl::range<3>(1, 1, blocks) * sycl::range<3>(1, 1, kBlockSize),
-            sycl::range<3>(1, 1, kBlockSize)),
-        [=](sycl::nd_item<3> item_ct1) [[intel::reqd_sub_group_size(32)]] {
-          globalAvgPool_kernel(output, input, prevLayerBias, N * C * kPlaneSize,
-                               N * C, C, item_ct1);
-        });
+    sycl_queue.submit([&](sycl::handler& cgh) {
+      cgh.set_specialization_constant<kAvgPoolChannels>(C);
+      cgh.parallel_for(
+          sycl::nd_range<3>(
+              sycl::range<3>(1, 1, blocks) * sycl::range<3>(1, 1, kBlockSize),
+              sycl::range<3>(1, 1, kBlockSize)),
+          [=](sycl::nd_item<3> item_ct1, sycl::kernel_handler kh)
+              [[intel::reqd_sub_group_size(32)]] {
+                const int C =
+                    kh.get_specialization_constant<kAvgPoolChannels>();
+                globalAvgPool_kernel(output, input, prevLayerBias,
+                                     N * C * kPlaneSize, N * C, C, item_ct1);
+              });
+    });
   }
 }
 
@@ -1000,17 +1011,24 @@ void PolicyMap(int N, T* output, const T* input, const short* indices,
                int inputSize, int usedSize, int outputSize, sycl::queue &sycl_queue) {
   // Each thread processes one input element
   // Only some of the threads (with valid mapping) write output
-  const int kBlockSize = 256;
+  const int kBlockSize = GetKernelLocalSizes().policy_map;
   const int kBlocks = DivUp(N * usedSize, kBlockSize);
 
-  sycl_queue.parallel_for(sycl::nd_range<3>(sycl::range<3>(1, 1, kBlocks) *
-                                             sycl::range<3>(1, 1, kBlockSize),
-                                         sycl::range<3>(1, 1, kBlockSize)),
-                       [=](sycl::nd_item<3> item_ct1) {
-                         policyMap_kernel<T>((T*)output, (T*)input,
-                                             (short*)indices, N, inputSize,
-                                             usedSize, outputSize, item_ct1);
-                       });
+  sycl_queue.submit([&](sycl::handler& cgh) {
+    cgh.set_specialization_constant<kPolicyMapInputSize>(inputSize);
+    cgh.set_specialization_constant<kPolicyMapUsedSize>(usedSize);
+    cgh.parallel_for(
+        sycl::nd_range<3>(sycl::range<3>(1, 1, kBlocks) *
+                              sycl::range<3>(1, 1, kBlockSize),
+                          sycl::range<3>(1, 1, kBlockSize)),
+        [=](sycl::nd_item<3> item_ct1, sycl::kernel_handler kh) {
+          policyMap_kernel<T>(
+              (T*)output, (T*)input, (short*)indices, N,
+              kh.get_specialization_constant<kPolicyMapInputSize>(),
+              kh.get_specialization_constant<kPolicyMapUsedSize>(), outputSize,
+              item_ct1);
+        });
+  });
 }
 
 template <typename T = float, bool use_se, ActivationFunction activation,
@@ -1081,212 +1099,197 @@ void OutputInputTransform(int N, int C, int se_K, T* output, const T* input,
   }
 }
 
-// softmax along C dimension which is assumed to be 64
-// each thread processes two elements. Each warp computes a sum (over 64
-// elements)
-template <typename T>
-void softmax_opt_64_kernel(T* output, const T* input,
-                                      const T* input2, int N,
-                                      const sycl::nd_item<3> &item_ct1) {
-  int index = item_ct1.get_local_range(2) * item_ct1.get_group(2) +
-              item_ct1.get_local_id(2);
-  if (index >= N) return;
-
-  float x[4];
-  float ex[2];
+// Loads @K consecutive elements as floats, with the widest accesses (up to
+// 16 bytes) that evenly divide them.
+template <int K, typename T>
+LC0_SYCL_INLINE void loadAsFloat(float* dst, const T* src) {
+  constexpr int kBytes = K * sizeof(T);
+  constexpr int kChunk = kBytes % 16 == 0 ? 16 : kBytes % 8 == 0 ? 8 : 4;
+  using Chunk = std::conditional_t<
+      kChunk == 16, sycl::uint4,
+      std::conditional_t<kChunk == 8, sycl::uint2, unsigned int>>;
+  constexpr int kPerChunk = kChunk / sizeof(T);
+#pragma unroll
+  for (int i = 0; i < K; i += kPerChunk) {
+    T tmp[kPerChunk];
+    copyAs<Chunk>(&tmp[0], &src[i]);
+#pragma unroll
+    for (int j = 0; j < kPerChunk; j++) dst[i + j] = (float)tmp[j];
+  }
+}
 
-  // Load from memory
-  const bool fp16 = std::is_same<sycl::half, T>::value;
-  if (fp16) {
-    sycl::half inp[2];
-    copyAs<int>(&inp[0], &input[index * 2]);
-    x[0] = (float)inp[0];
-    x[1] = (float)inp[1];
-    if (input2 != nullptr) {
-      copyAs<int>(&inp[0], &input2[index * 2]);
-      x[2] = (float)inp[0];
-      x[3] = (float)inp[1];
-    }
-  } else {
-    copyAs<sycl::uint2>(&x[0], &input[index * 2]);
-    if (input2 != nullptr) {
-      copyAs<sycl::uint2>(&x[2], &input2[index * 2]);
-    }
+template <int K, typename T>
+LC0_SYCL_INLINE void storeFromFloat(T* dst, const float* src) {
+  constexpr int kBytes = K * sizeof(T);
+  constexpr int kChunk = kBytes % 16 == 0 ? 16 : kBytes % 8 == 0 ? 8 : 4;
+  using Chunk = std::conditional_t<
+      kChunk == 16, sycl::uint4,
+      std::conditional_t<kChunk == 8, sycl::uint2, unsigned int>>;
+  constexpr int kPerChunk = kChunk / sizeof(T);
+#pragma unroll
+  for (int i = 0; i < K; i += kPerChunk) {
+    T tmp[kPerChunk];
+#pragma unroll
+    for (int j = 0; j < kPerChunk; j++) tmp[j] = (T)src[i + j];
+    copyAs<Chunk>(&dst[i], &tmp[0]);
   }
+}
 
+// softmax along C dimension which is assumed to be 64, one row per sub-group
+// of W lanes, each lane processing 64 / W consecutive elements. input2 (the
+// smolgen weights) is added to the logits first.
+template <typename T, int W>
+void softmax_opt_64_kernel(T* output, const T* input, const T* input2, int N,
+                           const sycl::nd_item<1>& item_ct1) {
+  constexpr int K = 64 / W;
+  const auto sg = item_ct1.get_sub_group();
+  const int row = item_ct1.get_group(0) * (item_ct1.get_local_range(0) / W) +
+                  sg.get_group_linear_id();
+  if (row >= N) return;
+  const int index = row * 64 + sg.get_local_linear_id() * K;
+
+  float x[K];
+  loadAsFloat<K>(x, &input[index]);
   if (input2 != nullptr) {
-    x[0] += x[2];
-    x[1] += x[3];
+    float y[K];
+    loadAsFloat<K>(y, &input2[index]);
+#pragma unroll
+    for (int i = 0; i < K; i++) x[i] += y[i];
   }
-  float threadMax = sycl::max(x[0], x[1]);
-  float maxval = warpMax(threadMax, item_ct1);
-  /*
-  DPCT1023:13: The SYCL sub-group does not support mask options for
-  dpct::select_from_sub_group. You can specify
-  "--use-experimental-features=masked-sub-group-operation" to use the
-  experimental helper function to migrate __shfl_sync.
-  */
-  maxval = dpct::select_from_sub_group(item_ct1.get_sub_group(), maxval, 0);
 
-  ex[0] = sycl::exp(x[0] - maxval);
-  ex[1] = sycl::exp(x[1] - maxval);
+  float maxval = x[0];
+#pragma unroll
+  for (int i = 1; i < K; i++) maxval = sycl::max(maxval, x[i]);
+  maxval = sycl::reduce_over_group(sg, maxval, sycl::maximum<float>());
 
-  float threadSum = ex[0] + ex[1];
-  float Sum = warpReduce(threadSum, item_ct1);
-  /*
-  DPCT1023:14: The SYCL sub-group does not support mask options for
-  dpct::select_from_sub_group. You can specify
-  "--use-experimental-features=masked-sub-group-operation" to use the
-  experimental helper function to migrate __shfl_sync.
-  */
-  Sum = dpct::select_from_sub_group(item_ct1.get_sub_group(), Sum, 0);
+  float sum = 0;
+#pragma unroll
+  for (int i = 0; i < K; i++) {
+    x[i] = sycl::exp(x[i] - maxval);
+    sum += x[i];
+  }
+  sum = sycl::reduce_over_group(sg, sum, sycl::plus<float>());
 
-  ex[0] = ex[0] / Sum;
-  ex[1] = ex[1] / Sum;
+  const float scale = 1.0f / sum;
+#pragma unroll
+  for (int i = 0; i < K; i++) x[i] *= scale;
+  storeFromFloat<K>(&output[index], x);
+}
 
-  // Store to memory
-  if (fp16) {
-    sycl::half op[2];
-    op[0] = (sycl::half)ex[0];
-    op[1] = (sycl::half)ex[1];
-    copyAs<int>(&output[index * 2], &op[0]);
-  } else {
-    copyAs<sycl::uint2>(&output[index * 2], &ex[0]);
-  }
+template <typename T, int W>
+void Softmax64(int N, T* output, const T* input, const T* input2,
+               sycl::queue& sycl_queue) {
+  const int kBlockSize = std::max(GetKernelLocalSizes().softmax, W);
+  const int blocks = DivUp(N * W, kBlockSize);
+  sycl_queue.parallel_for(
+      sycl::nd_range<1>(blocks * kBlockSize, kBlockSize),
+      [=](sycl::nd_item<1> item_ct1) [[intel::reqd_sub_group_size(W)]] {
+        softmax_opt_64_kernel<T, W>(output, input, input2, N, item_ct1);
+      });
 }
 
 // N * C Tensors
-// performs softmax along the C dimension
-// Each thread processes one element
-// Sums are computed in shared memory
-// C threads per block, N blocks
-template <typename T>
-void softmax_kernel(T* output, const T* input, const T* input2,
-                    const sycl::nd_item<3> &item_ct1, float &sum, float &maxval) {
-  int n = item_ct1.get_group(2);
-  int c = item_ct1.get_local_id(2);
-  int C = item_ct1.get_local_range(2);
-  int index = n * C + c;
+// performs softmax along the C dimension, one row per sub-group. The row is
+// read twice: once for the max and the sum (rescaled whenever the max of the
+// lane grows), once to write the output.
+template <typename T, int W>
+void softmax_kernel(T* output, const T* input, const T* input2, int N, int C,
+                    const sycl::nd_item<1>& item_ct1) {
+  const auto sg = item_ct1.get_sub_group();
+  const int row = item_ct1.get_group(0) * (item_ct1.get_local_range(0) / W) +
+                  sg.get_group_linear_id();
+  if (row >= N) return;
+  const int lane = sg.get_local_linear_id();
+  input += row * C;
+  if (input2 != nullptr) input2 += row * C;
+  output += row * C;
 
   // softmax = tf.exp(logits) / tf.reduce_sum(tf.exp(logits), axis)
-
-  float x = (float)input[index];
-  if (input2 != nullptr) x += (float)input2[index];
-
-  if (c == 0) {
-    sum = 0;
-    maxval = x;
+  float maxval = -std::numeric_limits<float>::infinity();
+  float sum = 0;
+  for (int c = lane; c < C; c += W) {
+    float x = (float)input[c];
+    if (input2 != nullptr) x += (float)input2[c];
+    if (x > maxval) {
+      sum *= sycl::exp(maxval - x);
+      maxval = x;
+    }
+    sum += sycl::exp(x - maxval);
+  }
+  const float rowmax =
+      sycl::reduce_over_group(sg, maxval, sycl::maximum<float>());
+  // Lanes without elements have maxval -inf and contribute 0.
+  sum = sycl::reduce_over_group(sg, sum * sycl::exp(maxval - rowmax),
+                                sycl::plus<float>());
+
+  for (int c = lane; c < C; c += W) {
+    float x = (float)input[c];
+    if (input2 != nullptr) x += (float)input2[c];
+    output[c] = (T)(sycl::exp(x - rowmax) / sum);
   }
-
-  
-  item_ct1.barrier(sycl::access::fence_space::local_space);
-
-  // Get max across warp first, and then update across C dimension
-  float warpmax = warpMax(x, item_ct1);
-  if ((c & 0x1F) == 0) atomicMaxFloat(&maxval, warpmax);
-
-  
-  item_ct1.barrier(sycl::access::fence_space::local_space);
-
-  float ex = sycl::exp(x - maxval);
-
-  // compute warp wide sums first
-  float val = warpReduce(ex, item_ct1);
-
-  // update shared memory sum across C dimension
-  if ((c & 0x1F) == 0)
-      dpct::atomic_fetch_add<sycl::access::address_space::generic_space>(&sum,
-                                                                         val);
-
-  
-  item_ct1.barrier(sycl::access::fence_space::local_space);
-
-  float op = ex / sum;
-
-  output[index] = (T)op;
 }
 
 template <typename T>
 void Softmax(int N, int C, T* output, const T* input, const T* input2, sycl::queue &sycl_queue) {
   if (C == 64) {
-    int size = N * 32;  // Total no of threads needed
-    const int kBlockSize = 256;
-    int blocks = DivUp(size, kBlockSize);
-    {
-      
-      sycl_queue.parallel_for(
-          sycl::nd_range<3>(
-              sycl::range<3>(1, 1, blocks) * sycl::range<3>(1, 1, kBlockSize),
-              sycl::range<3>(1, 1, kBlockSize)),
-          [=](sycl::nd_item<3> item_ct1) [[intel::reqd_sub_group_size(32)]] {
-            softmax_opt_64_kernel<T>(output, input, input2, size, item_ct1);
-          });
+    switch (GetKernelLocalSizes().sub_group) {
+#if LC0_SYCL_NARROW_SUB_GROUPS
+      case 8:
+        Softmax64<T, 8>(N, output, input, input2, sycl_queue);
+        break;
+      case 16:
+        Softmax64<T, 16>(N, output, input, input2, sycl_queue);
+        break;
+#endif
+      default:
+        Softmax64<T, 32>(N, output, input, input2, sycl_queue);
     }
   } else {
-    /*
-    DPCT1049:15: The work-group size passed to the SYCL kernel may exceed the
-    limit. To get the device limit, query info::device::max_work_group_size.
-    Adjust the work-group size if needed.
-    */
-    sycl_queue.submit([&](sycl::handler& cgh) {
-      sycl::local_accessor<float, 0> sum_acc_ct1(cgh);
-      sycl::local_accessor<float, 0> maxval_acc_ct1(cgh);
-
-      cgh.parallel_for(
-          sycl::nd_range<3>(sycl::range<3>(1, 1, N) * sycl::range<3>(1, 1, C),
-                            sycl::range<3>(1, 1, C)),
-          [=](sycl::nd_item<3> item_ct1) [[intel::reqd_sub_group_size(32)]] {
-            softmax_kernel<T>(output, input, input2, item_ct1, sum_acc_ct1,
-                              maxval_acc_ct1);
-          });
-    });
+    const int kBlockSize = 256;
+    const int blocks = DivUp(N * 32, kBlockSize);
+    sycl_queue.parallel_for(
+        sycl::nd_range<1>(blocks * kBlockSize, kBlockSize),
+        [=](sycl::nd_item<1> item_ct1) [[intel::reqd_sub_group_size(32)]] {
+          softmax_kernel<T, 32>(output, input, input2, N, C, item_ct1);
+        });
   }
 }
 
-__dpct_inline__ float shared_sum_for_layer_norm(
+// Sum of @x over the lanes of a LayerNorm row. A row that fits in one
+// sub-group (C <= 16 * sub-group width) needs no local memory. Otherwise the
+// sub-groups of the row exchange their partial sums through @partial, with a
+// single barrier, so each call uses its own @slot.
+LC0_SYCL_INLINE float row_sum_for_layer_norm(
     float x, const sycl::nd_item<3>& item_ct1,
-    sycl::local_accessor<float, 2> sum) {
-  // compute warp-wide sum
-  float s = warpReduce(x, item_ct1);
-
-  // warp-wide sums
-  // Max product of the two dimension for the below array is 16 (512/32), but
-  // we make each dimension 16 for simplicity. if shared memory capacity is the
-  // bottleneck (it's not), we can convert these to single dim array and
-  // dynamically index
+    sycl::local_accessor<float, 3> partial, int slot) {
+  float s = sycl::reduce_over_group(item_ct1.get_sub_group(), x,
+                                    sycl::plus<float>());
+  const int sub_groups = item_ct1.get_local_range(1);
+  if (sub_groups == 1) return s;
 
-  // compute sum across C dimension using the warp wide partial sums
+  const int row = item_ct1.get_local_id(0);
   if (item_ct1.get_local_id(2) == 0)
-      sum[item_ct1.get_local_id(0)][item_ct1.get_local_id(1)] = s;
-  
+    partial[slot][row][item_ct1.get_local_id(1)] = s;
   item_ct1.barrier(sycl::access::fence_space::local_space);
 
-  if (item_ct1.get_local_id(2) == 0 && item_ct1.get_local_id(1) == 0) {
-    float cSum = 0;
-    for (int j = 0; j < item_ct1.get_local_range(1); j++) cSum +=
-        sum[item_ct1.get_local_id(0)][j];
-    sum[item_ct1.get_local_id(0)][0] = cSum;
-  }
-  
-  item_ct1.barrier(sycl::access::fence_space::local_space);
-
-  // s now contains the sum across C dimension
-  return sum[item_ct1.get_local_id(0)][0];
+  s = 0;
+  for (int j = 0; j < sub_groups; j++) s += partial[slot][row][j];
+  return s;
 }
 
 // Each thread processes 4 elements
 // 1. Perform Bias add, and skip add
 // 2. Perform layer norm (normalize across C dimension)
-template <typename T>
+template <typename T, int W>
 void layer_norm_kernel(int N, int C, T* output, const T* input, const T* bias,
                        const T* skip, const T* gammas, const T* betas, float ep,
                        float alpha, ActivationFunction act,
                        const sycl::nd_item<3>& item_ct1,
-                       sycl::local_accessor<float, 2> sum) {
+                       sycl::local_accessor<float, 3> partial) {
   int n = item_ct1.get_group(2) * item_ct1.get_local_range(0) +
           item_ct1.get_local_id(0);
   if (n >= N) return;
-  int c = (item_ct1.get_local_id(1) * 32 + item_ct1.get_local_id(2)) * 16;
+  int c = (item_ct1.get_local_id(1) * W + item_ct1.get_local_id(2)) * 16;
   bool oobThread = c >= C;
 
   int biasIndex = c;
@@ -1355,7 +1358,7 @@ void layer_norm_kernel(int N, int C, T* output, const T* input, const T* bias,
       }
     }
 
-  s = shared_sum_for_layer_norm(s, item_ct1, sum);
+  s = row_sum_for_layer_norm(s, item_ct1, partial, 0);
   float mean = s / C;
 
   // 2. Compute varience
@@ -1366,7 +1369,7 @@ void layer_norm_kernel(int N, int C, T* output, const T* input, const T* bias,
       float d_sq = d * d;
       s += d_sq;
     }
-  s = shared_sum_for_layer_norm(s, item_ct1, sum);
+  s = row_sum_for_layer_norm(s, item_ct1, partial, 1);
   float var = s / C;
 
   if (!oobThread) {
@@ -1430,6 +1433,40 @@ void layer_norm_kernel(int N, int C, T* output, const T* input, const T* bias,
   }
 }
 
+template <typename T, int W>
+void LayerNormWithWidth(int N, int C, int rows, T* output, const T* input,
+                        const T* bias, const T* skip, const T* gammas,
+                        const T* betas, float ep, float alpha,
+                        ActivationFunction act, sycl::queue& sycl_queue) {
+  sycl::range<3> blockDim(1, 1, 1), gridDim(1, 1, 1);
+  blockDim[2] = W;
+  blockDim[1] = DivUp(C / 16, W);
+  blockDim[0] = rows;
+  gridDim[2] = N / rows;
+  gridDim[1] = 1;
+  gridDim[0] = 1;
+
+  sycl_queue.submit([&](sycl::handler& cgh) {
+    sycl::local_accessor<float, 3> partial_acc_ct1(sycl::range<3>(2, 16, 16),
+                                                   cgh);
+    cgh.set_specialization_constant<kLayerNormChannels>(C);
+    cgh.set_specialization_constant<kLayerNormActivation>(
+        static_cast<int>(act));
+
+    cgh.parallel_for(
+        sycl::nd_range<3>(gridDim * blockDim, blockDim),
+        [=](sycl::nd_item<3> item_ct1, sycl::kernel_handler kh)
+            [[intel::reqd_sub_group_size(W)]] {
+              layer_norm_kernel<T, W>(
+                  N, kh.get_specialization_constant<kLayerNormChannels>(),
+                  output, input, bias, skip, gammas, betas, ep, alpha,
+                  static_cast<ActivationFunction>(
+                      kh.get_specialization_constant<kLayerNormActivation>()),
+                  item_ct1, partial_acc_ct1);
+            });
+  });
+}
+
 // add (optional) skip connection to input, and then perform Layer normalization
 // normalization is done across C dimension (i.e, sums and std deviations taken
 // over elements in C dim)
@@ -1437,35 +1474,33 @@ template <typename T>
 void LayerNorm(int N, int C, T* output, const T* input, const T* bias,
                const T* skip, const T* gammas, const T* betas, float ep,
                float alpha, ActivationFunction act, sycl::queue &sycl_queue) {
-  // process 4 elements per thread to achieve close to peak memory bandwidth
+  // process 16 elements per thread to achieve close to peak memory bandwidth
   if (C % 16 != 0) throw Exception("unsupported filter size");
   if (C > 8192) throw Exception("unsupported filter size");
 
-  sycl::range<3> blockDim(1, 1, 1), gridDim(1, 1, 1);
-  blockDim[2] = 32;
-  blockDim[1] = DivUp(C / 16, 32);
-  blockDim[0] = 1;
-  gridDim[2] = N;
-  gridDim[1] = 1;
-  gridDim[0] = 1;
+  // Several rows can share a work-group (the kernel supports up to 16), as
+  // long as no work-group is partial.
+  int rows = GetKernelLocalSizes().layer_norm_rows;
+  if (rows < 1 || rows > 16 || N % rows != 0) rows = 1;
 
-  /*
-  DPCT1049:17: The work-group size passed to the SYCL kernel may exceed the
-  limit. To get the device limit, query info::device::max_work_group_size.
-  Adjust the work-group size if needed.
-  */
-  {
-    
-    sycl_queue.submit([&](sycl::handler& cgh) {
-      sycl::local_accessor<float, 2> sum_acc_ct1(sycl::range<2>(16, 16), cgh);
+  // A row has at most 16 sub-groups, wider ones are used for large C.
+  int width = GetKernelLocalSizes().sub_group;
+  while (width < 32 && DivUp(C / 16, width) > 16) width *= 2;
 
-      cgh.parallel_for(
-          sycl::nd_range<3>(gridDim * blockDim, blockDim),
-          [=](sycl::nd_item<3> item_ct1) [[intel::reqd_sub_group_size(32)]] {
-            layer_norm_kernel<T>(N, C, output, input, bias, skip, gammas, betas,
-                                 ep, alpha, act, item_ct1, sum_acc_ct1);
-          });
-    });
+  switch (width) {
+#if LC0_SYCL_NARROW_SUB_GROUPS
+    case 8:
+      LayerNormWithWidth<T, 8>(N, C, rows, output, input, bias, skip, gammas,
+                               betas, ep, alpha, act, sycl_queue);
+      break;
+    case 16:
+      LayerNormWithWidth<T, 16>(N, C, rows, output, input, bias, skip, gammas,
+                                betas, ep, alpha, act, sycl_queue);
+      break;
+#endif
+    default:
+      LayerNormWithWidth<T, 32>(N, C, rows, output, input, bias, skip, gammas,
+                                betas, ep, alpha, act, sycl_queue);
   }
 }
 
@@ -1632,6 +1667,75 @@ void inputPreprocessForAttentionBody(T* output, const T* input,
       });
 }
 
+// One work-item per position and channel, for all 64 squares, so that each
+// mask is read once.
+template <typename T>
+void preprocess_planes_for_attention_body_kernel(
+    T* output, const uint64_t* masks, const float* values, const T* encoding,
+    int input_size, int encoding_size, bool is_pe_dense_embedding,
+    const sycl::nd_item<3>& item_ct1) {
+  int n = item_ct1.get_group(2);
+  int c = item_ct1.get_local_id(2) +
+          item_ct1.get_local_range(2) * item_ct1.get_group(0);
+  int outputC = input_size + encoding_size;
+  if (c >= outputC) return;
+
+  output += n * 64 * outputC + c;
+  if (c >= input_size) {
+    // concatenate from position encoding array
+    for (int hw = 0; hw < 64; hw++) {
+      output[hw * outputC] =
+          is_pe_dense_embedding
+              ? encoding[n * 64 * encoding_size + hw * encoding_size +
+                         (c - input_size)]
+              : encoding[64 * hw + (c - input_size)];
+    }
+  } else {
+    const uint64_t mask = masks[n * input_size + c];
+    const T value = (T)values[n * input_size + c];
+    for (int hw = 0; hw < 64; hw++) {
+      output[hw * outputC] = (mask >> hw) & 1 ? value : (T)0;
+    }
+  }
+}
+
+template <typename T>
+void inputPreprocessPlanesForAttentionBody(T* output, const uint64_t* masks,
+                                           const float* values,
+                                           const T* encoding, int N,
+                                           int input_size, int encoding_size,
+                                           bool is_pe_dense_embedding,
+                                           sycl::queue& sycl_queue) {
+  const int outputC = input_size + encoding_size;
+  const int block = sycl::min(outputC, 256);
+  sycl::range<3> gridSize(DivUp(outputC, block), 1, N);
+  sycl::range<3> blockSize(1, 1, block);
+  sycl_queue.parallel_for(
+      sycl::nd_range<3>(gridSize * blockSize, blockSize),
+      [=](sycl::nd_item<3> item_ct1) {
+        preprocess_planes_for_attention_body_kernel<T>(
+            output, masks, values, encoding, input_size, encoding_size,
+            is_pe_dense_embedding, item_ct1);
+      });
+}
+
+template <typename T>
+void expandPlanesNHWC(T* output, const uint64_t* masks, const float* values,
+                      int N, int C, sycl::queue& sycl_queue) {
+  sycl_queue.parallel_for(
+      sycl::nd_range<3>(sycl::range<3>(1, N, C), sycl::range<3>(1, 1, C)),
+      [=](sycl::nd_item<3> item_ct1) {
+        const int n = item_ct1.get_group(1);
+        const int c = item_ct1.get_local_id(2);
+        const uint64_t mask = masks[n * kInputPlanes + c];
+        const T value = (T)values[n * kInputPlanes + c];
+        T* op = output + n * 64 * C + c;
+        for (int hw = 0; hw < 64; hw++) {
+          op[hw * C] = (mask >> hw) & 1 ? value : (T)0;
+        }
+      });
+}
+
 template <typename T>
 void input_gating_kernel(T* output, const T* input, const T* mult,
                                     const T* add, int HW, int C,
@@ -1676,6 +1780,189 @@ void applyInputGating(T* output, const T* input, const T* mult, const T* add,
                        });
 }
 
+// Symmetric per-row int8 quantisation of a rows x cols activation matrix.
+// One work-group per row: the row's absmax gives the scale, which is kept for
+// dequantising the gemm output.
+template <typename T>
+void quantizeRowsInt8(int8_t* output, float* scales, const T* input, int rows,
+                      int cols, sycl::queue& sycl_queue) {
+  constexpr int kBlockSize = 256;
+  sycl_queue.parallel_for(
+      sycl::nd_range<1>(rows * kBlockSize, kBlockSize),
+      [=](sycl::nd_item<1> item_ct1) {
+        const int row = item_ct1.get_group(0);
+        const T* in = input + (size_t)row * cols;
+        float max_abs = 0.0f;
+        for (int c = item_ct1.get_local_id(0); c < cols; c += kBlockSize) {
+          max_abs = sycl::fmax(max_abs, sycl::fabs((float)in[c]));
+        }
+        max_abs = sycl::reduce_over_group(item_ct1.get_group(), max_abs,
+                                          sycl::maximum<float>());
+        const float scale = max_abs > 0.0f ? max_abs / 127.0f : 1.0f;
+        const float inv_scale = 1.0f / scale;
+        int8_t* out = output + (size_t)row * cols;
+        for (int c = item_ct1.get_local_id(0); c < cols; c += kBlockSize) {
+          out[c] = (int8_t)sycl::clamp(sycl::rint((float)in[c] * inv_scale),
+                                       -127.0f, 127.0f);
+        }
+        if (item_ct1.get_local_id(0) == 0) scales[row] = scale;
+      });
+}
+
+// Converts the int32 result of an int8 gemm (rows x cols, row major) back to
+// T using the per-row activation and per-column weight scales, with optional
+// bias add and activation.
+template <typename T>
+void dequantizeInt8Gemm(T* output, const int32_t* input,
+                        const float* row_scales, const float* col_scales,
+                        const T* bias, int rows, int cols,
+                        ActivationFunction activation,
+                        sycl::queue& sycl_queue) {
+  const int total = rows * cols;
+  constexpr int kBlockSize = 256;
+  sycl_queue.parallel_for(
+      sycl::nd_range<1>(DivUp(total, kBlockSize) * kBlockSize, kBlockSize),
+      [=](sycl::nd_item<1> item_ct1) {
+        const int i = item_ct1.get_global_id(0);
+        if (i >= total) return;
+        const int row = i / cols;
+        const int col = i % cols;
+        float x = (float)input[i] * row_scales[row] * col_scales[col];
+        if (bias) x += (float)bias[col];
+        output[i] = (T)activate(x, activation);
+      });
+}
+
+// Scaled dot product attention for one (batch, head) pair per work-group.
+// K and V of the head are staged in local memory and every work-item owns one
+// query row, keeping its 64 logits in registers, so the attention matrix is
+// never written out. q, k, v and output are N x 64 x d_model with head h at
+// columns [h * depth, (h + 1) * depth), the optional smolgen logits are
+// N x heads x 64 x 64.
+template <typename T, int kDepth>
+void fusedMHA_kernel(T* output, const T* q, const T* k, const T* v,
+                     const T* smolgen, int heads, float factor,
+                     const sycl::nd_item<1>& item_ct1, T* kv) {
+  const int d_model = heads * kDepth;
+  const int n = item_ct1.get_group(0) / heads;
+  const int h = item_ct1.get_group(0) % heads;
+  const int row = item_ct1.get_local_id(0);
+  const size_t row_offset = ((size_t)n * 64 + row) * d_model + h * kDepth;
+
+  float query[kDepth];
+#pragma unroll
+  for (int d = 0; d < kDepth; d++) {
+    kv[row * kDepth + d] = k[row_offset + d];
+    kv[(64 + row) * kDepth + d] = v[row_offset + d];
+    query[d] = (float)q[row_offset + d];
+  }
+  item_ct1.barrier(sycl::access::fence_space::local_space);
+
+  const T* bias =
+      smolgen ? smolgen + ((size_t)item_ct1.get_group(0) * 64 + row) * 64
+              : nullptr;
+  float logits[64];
+  float maxval = -std::numeric_limits<float>::infinity();
+#pragma unroll
+  for (int j = 0; j < 64; j++) {
+    float x = 0.0f;
+#pragma unroll
+    for (int d = 0; d < kDepth; d++) x += query[d] * (float)kv[j * kDepth + d];
+    x *= factor;
+    if (bias) x += (float)bias[j];
+    logits[j] = x;
+    maxval = sycl::fmax(maxval, x);
+  }
+
+  float sum = 0.0f;
+  float acc[kDepth] = {};
+#pragma unroll
+  for (int j = 0; j < 64; j++) {
+    const float p = sycl::exp(logits[j] - maxval);
+    sum += p;
+#pragma unroll
+    for (int d = 0; d < kDepth; d++) {
+      acc[d] += p * (float)kv[(64 + j) * kDepth + d];
+    }
+  }
+
+  const float inv_sum = 1.0f / sum;
+#pragma unroll
+  for (int d = 0; d < kDepth; d++) {
+    output[row_offset + d] = (T)(acc[d] * inv_sum);
+  }
+}
+
+template <typename T, int kDepth>
+static void launchFusedMHA(T* output, const T* q, const T* k, const T* v,
+                           const T* smolgen, int N, int heads, float factor,
+                           sycl::queue& sycl_queue) {
+  sycl_queue.submit([&](sycl::handler& cgh) {
+    sycl::local_accessor<T, 1> kv(sycl::range<1>(2 * 64 * kDepth), cgh);
+    cgh.parallel_for(sycl::nd_range<1>(N * heads * 64, 64),
+                     [=](sycl::nd_item<1> item_ct1) {
+                       fusedMHA_kernel<T, kDepth>(
+                           output, q, k, v, smolgen, heads, factor, item_ct1,
+                           kv.get_multi_ptr<sycl::access::decorated::no>()
+                               .get());
+                     });
+  });
+}
+
+// One work-group per sample, one work-item per legal move.
+void softmaxLegalMoves(float* output, const float* policy,
+                       const uint16_t* indices, const int* counts,
+                       const float* inv_temperatures, int N,
+                       sycl::queue& sycl_queue) {
+  sycl_queue.parallel_for(
+      sycl::nd_range<1>(N * kMaxLegalMoves, kMaxLegalMoves),
+      [=](sycl::nd_item<1> item_ct1) {
+        const int n = item_ct1.get_group(0);
+        const int i = item_ct1.get_local_id(0);
+        const int count = counts[n];
+        const bool active = i < count;
+        float x = -std::numeric_limits<float>::infinity();
+        if (active) {
+          x = policy[n * kNumOutputPolicy + indices[n * kMaxLegalMoves + i]] *
+              inv_temperatures[n];
+        }
+        const float maxval = sycl::reduce_over_group(
+            item_ct1.get_group(), x, sycl::maximum<float>());
+        const float ex = active ? sycl::exp(x - maxval) : 0.0f;
+        const float sum =
+            sycl::reduce_over_group(item_ct1.get_group(), ex, sycl::plus<float>());
+        if (active) {
+          output[n * kMaxLegalMoves + i] = sum > 0.0f ? ex / sum : ex;
+        }
+      });
+}
+
+bool FusedMHASupported(int depth) {
+  return depth == 16 || depth == 32 || depth == 64;
+}
+
+template <typename T>
+void fusedMHA(T* output, const T* q, const T* k, const T* v, const T* smolgen,
+              int N, int heads, int depth, float factor,
+              sycl::queue& sycl_queue) {
+  switch (depth) {
+    case 16:
+      launchFusedMHA<T, 16>(output, q, k, v, smolgen, N, heads, factor,
+                            sycl_queue);
+      break;
+    case 32:
+      launchFusedMHA<T, 32>(output, q, k, v, smolgen, N, heads, factor,
+                            sycl_queue);
+      break;
+    case 64:
+      launchFusedMHA<T, 64>(output, q, k, v, smolgen, N, heads, factor,
+                            sycl_queue);
+      break;
+    default:
+      throw Exception("unsupported head depth for fused attention");
+  }
+}
+
 // Template instantiation.
 template void copyTypeConverted<sycl::half, float>(sycl::half* op, float* ip, int N, sycl::queue &sycl_queue);
 template void copyTypeConverted<float, sycl::half>(float* op, sycl::half* ip, int N, sycl::queue &sycl_queue);
@@ -1759,6 +2046,12 @@ template void InputTransform<float, false>(int N, int C,
                                            float* transformed_input,
                                            const float* input, sycl::queue &sycl_queue);
 
+template void InputTransformFromPlanes<float>(int N, int C,
+                                              float* transformed_input,
+                                              const uint64_t* masks,
+                                              const float* values,
+                                              sycl::queue& sycl_queue);
+
 template void OutputTransform<float, true, ACTIVATION_RELU, true, true, false,
                               false>(int N, int C, int se_K, float* output,
                                      const float* input, const float* skip,
@@ -1943,6 +2236,25 @@ template void inputPreprocessForAttentionBody<float>(
     int input_size, int encoding_size, bool is_pe_dense_embedding,
     sycl::queue &sycl_queue);
 
+template void inputPreprocessPlanesForAttentionBody<sycl::half>(
+    sycl::half* output, const uint64_t* masks, const float* values,
+    const sycl::half* encoding, int N, int input_size, int encoding_size,
+    bool is_pe_dense_embedding, sycl::queue& sycl_queue);
+
+template void inputPreprocessPlanesForAttentionBody<float>(
+    float* output, const uint64_t* masks, const float* values,
+    const float* encoding, int N, int input_size, int encoding_size,
+    bool is_pe_dense_embedding, sycl::queue& sycl_queue);
+
+template void expandPlanesNHWC<sycl::half>(sycl::half* output,
+                                           const uint64_t* masks,
+                                           const float* values, int N, int C,
+                                           sycl::queue& sycl_queue);
+
+template void expandPlanesNHWC<float>(float* output, const uint64_t* masks,
+                                      const float* values, int N, int C,
+                                      sycl::queue& sycl_queue);
+
 template void applyInputGating<sycl::half>(sycl::half* output, const sycl::half* input,
                                      const sycl::half* mult, const sycl::half* add, int N,
                                      int C, int output_size, sycl::queue &sycl_queue);
@@ -1950,5 +2262,31 @@ template void applyInputGating<sycl::half>(sycl::half* output, const sycl::half*
 template void applyInputGating<float>(float* output, const float* input,
                                       const float* mult, const float* add,
                                       int N, int C, int output_size, sycl::queue &sycl_queue);
+
+template void quantizeRowsInt8<sycl::half>(int8_t* output, float* scales,
+                                           const sycl::half* input, int rows,
+                                           int cols, sycl::queue& sycl_queue);
+template void quantizeRowsInt8<float>(int8_t* output, float* scales,
+                                      const float* input, int rows, int cols,
+                                      sycl::queue& sycl_queue);
+
+template void dequantizeInt8Gemm<sycl::half>(
+    sycl::half* output, const int32_t* input, const float* row_scales,
+    const float* col_scales, const sycl::half* bias, int rows, int cols,
+    ActivationFunction activation, sycl::queue& sycl_queue);
+template void dequantizeInt8Gemm<float>(
+    float* output, const int32_t* input, const float* row_scales,
+    const float* col_scales, const float* bias, int rows, int cols,
+    ActivationFunction activation, sycl::queue& sycl_queue);
+
+template void fusedMHA<sycl::half>(sycl::half* output, const sycl::half* q,
+                                   const sycl::half* k, const sycl::half* v,
+                                   const sycl::half* smolgen, int N, int heads,
+                                   int depth, float factor,
+                                   sycl::queue& sycl_queue);
+template void fusedMHA<float>(float* output, const float* q, const float* k,
+                              const float* v, const float* smolgen, int N,
+                              int heads, int depth, float factor,
+                              sycl::queue& sycl_queue);
 }  // namespace cudnn_backend
 }  // namespace lczero
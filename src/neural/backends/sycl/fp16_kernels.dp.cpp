@@ -20,14 +20,8 @@
 */
 
 #include <sycl/sycl.hpp>
-#include "dpct/dpct.hpp"
 #include "sycl_common.h"
 #include "neural/backends/shared/activation.h"
-
-// Allow building on an old architecture.
-#if DPCT_COMPATIBILITY_TEMP < 530
-#define SKIP_FP16_BITS 1
-#endif
 #include "winograd_helper.h"
 
 namespace lczero {
@@ -60,7 +54,6 @@ void SE_Layer_NHWC(sycl::half* output, const sycl::half* skip,
                    const sycl::half* b2, const sycl::half* bPrev,
                    ActivationFunction activation,
                    const sycl::nd_item<3>& item_ct1, sycl::half* sharedData) {
-#if DPCT_COMPATIBILITY_TEMP >= 530
   const int elementsPerThread = 64;  // 8x8 board
   const int se_K = K;
 
@@ -133,7 +126,6 @@ void SE_Layer_NHWC(sycl::half* output, const sycl::half* skip,
 
     output[inputIndex] = val;
   }
-#endif
 }
 
 bool Se_Fp16_NHWC(int N, int C, int numFc1Out, sycl::half* output,
@@ -469,7 +461,6 @@ void OutputInputTransformKernel_fp16_shmem_board(
     const sycl::half* b1, const sycl::half* w2, const sycl::half* b2,
     const sycl::nd_item<3>& item_ct1, uint8_t* dpct_local, float* shared_data,
     sycl::local_accessor<float, 2> shared_sums) {
-#if DPCT_COMPATIBILITY_TEMP >= 530
   int k = item_ct1.get_local_id(2);
   int n = item_ct1.get_group(2);
 
@@ -674,7 +665,6 @@ void OutputInputTransformKernel_fp16_shmem_board(
       for (int x = 0; x < 6; x++)
         output[TEMP_INDEX_HWNC(y, x, n * 4 + 3, c)] = inEl[y][x];
   }
-#endif
 }
 
 template <typename T = sycl::half, bool use_se, ActivationFunction activation,
@@ -818,6 +808,10 @@ template void InputTransform<sycl::half, true>(int N, int C, sycl::half* transfo
 template void InputTransform<sycl::half, false>(int N, int C, sycl::half* transformed_input,
                                           const sycl::half* input, sycl::queue &sycl_queue);
 
+template void InputTransformFromPlanes<sycl::half>(
+    int N, int C, sycl::half* transformed_input, const uint64_t* masks,
+    const float* values, sycl::queue& sycl_queue);
+
 template void OutputTransform<sycl::half, true, ACTIVATION_RELU, true, true, false,
                               false>(int N, int C, int se_K, sycl::half* output,
                                      const sycl::half* input, const sycl::half* skip,
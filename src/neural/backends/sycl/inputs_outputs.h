@@ -19,40 +19,79 @@
   SPDX-License-Identifier:GNU General Public License v3.0 or later
 */
 
+#include <map>
 #include <sycl/sycl.hpp>
 #include "neural/network.h"
 #include "cuBlasContext.h"
+#include "memory_pool.h"
 
 namespace lczero {
 namespace sycldnn_backend {
 
 struct InputsOutputs {
-  InputsOutputs(int maxBatchSize, bool wdl, bool moves_left, sycl::queue& m_ct1,
+  InputsOutputs(UsmMemoryPool& pool, int maxBatchSize, bool wdl,
+                bool moves_left, sycl::queue& m_ct1,
                 size_t tensor_mem_size = 0, size_t scratch_size = 0,
-                bool cublasDisableTensorCores = false): q_ct1(m_ct1) {
+                bool cublasDisableTensorCores = false,
+                sycl::queue* copy_queue = nullptr, bool zero_copy = false,
+                bool legal_moves_policy = false)
+      : max_batch_size_(maxBatchSize),
+        pool_(pool),
+        copy_queue_(copy_queue),
+        zero_copy_(zero_copy),
+        // With multi_stream every computation runs on its own in-order queue,
+        // so that independent batches can execute concurrently on the device.
+        q_ct1(tensor_mem_size
+                  ? sycl::queue(m_ct1.get_context(), m_ct1.get_device(),
+                                sycl::property_list{
+                                    sycl::property::queue::in_order{}})
+                  : m_ct1) {
   #ifdef USE_CUBLAS
     cublasHandle_t h= cuBlasContextManager::getcuBlasHandle_t();
   #endif                
-    input_masks_mem_shared_ = malloc_host<uint64_t>(maxBatchSize * kInputPlanes, q_ct1);
-    input_val_mem_shared_ = malloc_host<float>(maxBatchSize * kInputPlanes, q_ct1);
+    input_masks_mem_shared_ = Host<uint64_t>(maxBatchSize * kInputPlanes);
+    input_val_mem_shared_ = Host<float>(maxBatchSize * kInputPlanes);
     // Seperate device memory copy for policy output.
     // It's faster to write to device memory and then copy to host memory
-    // than having the kernel write directly to it.
-    op_policy_mem_ = malloc_host<float>(maxBatchSize * kNumOutputPolicy, q_ct1);
-    op_policy_mem_gpu_ = malloc_device<float>(maxBatchSize * kNumOutputPolicy, q_ct1);
-    op_value_mem_shared_ = malloc_host<float>(maxBatchSize * (wdl ? 3 : 1), q_ct1);
+    // than having the kernel write directly to it. Not so when the device
+    // shares physical memory with the host: there the copy is pure overhead.
+    op_policy_mem_ = Host<float>(maxBatchSize * kNumOutputPolicy);
+    op_policy_mem_gpu_ =
+        zero_copy_ ? op_policy_mem_
+                   : Device<float>(maxBatchSize * kNumOutputPolicy);
+    op_value_mem_shared_ = Host<float>(maxBatchSize * (wdl ? 3 : 1));
+
+    // With a dedicated copy queue the inputs are uploaded explicitly, so that
+    // the expand planes kernel doesn't read from host memory.
+    if (copy_queue_) {
+      input_masks_mem_gpu_ = Device<uint64_t>(maxBatchSize * kInputPlanes);
+      input_val_mem_gpu_ = Device<float>(maxBatchSize * kInputPlanes);
+    }
 
     if (moves_left) {
-      op_moves_left_mem_shared_ = malloc_host<float>(maxBatchSize, q_ct1);
+      op_moves_left_mem_shared_ = Host<float>(maxBatchSize);
+    }
+
+    // The legal move indices are small, the softmax kernel reads them and
+    // writes its results in host memory directly.
+    if (legal_moves_policy) {
+      policy_indices_ = Host<uint16_t>(maxBatchSize * kMaxLegalMoves);
+      policy_counts_ = Host<int>(maxBatchSize);
+      policy_inv_temperatures_ = Host<float>(maxBatchSize);
+      op_legal_policy_mem_ = Host<float>(maxBatchSize * kMaxLegalMoves);
     }
 
     // memory for network execution managed inside this structure
     if (tensor_mem_size) {
       multi_stream_ = true;
-      scratch_mem_ = (void*)sycl::malloc_device( scratch_size, q_ct1);
+      scratch_mem_ =
+          pool_.AllocateBytes(sycl::usm::alloc::device, scratch_size);
       for (auto& mem : tensor_mem_) {
-        mem = (void*)sycl::malloc_device(tensor_mem_size, q_ct1);
-        q_ct1.memset(mem, 0, tensor_mem_size);
+        // Reused buffers only hold activations of earlier batches.
+        bool fresh;
+        mem = pool_.AllocateBytes(sycl::usm::alloc::device, tensor_mem_size,
+                                  &fresh);
+        if (fresh) q_ct1.memset(mem, 0, tensor_mem_size);
       }
     } else {
       multi_stream_ = false;
@@ -61,38 +100,47 @@ struct InputsOutputs {
 
 
   ~InputsOutputs() {
-    /*
-    sycl::free(input_masks_mem_shared_, q_ct1);
-    sycl::free(input_val_mem_shared_, q_ct1);
-    sycl::free(op_value_mem_shared_, q_ct1);
-    if (op_moves_left_mem_shared_ != nullptr)
-        sycl::free(op_moves_left_mem_shared_, q_ct1);
-    sycl::free(op_policy_mem_gpu_, q_ct1);
-
+    q_ct1.wait();
+    for (void* mem :
+         {(void*)input_masks_mem_shared_, (void*)input_val_mem_shared_,
+          (void*)op_value_mem_shared_, (void*)op_moves_left_mem_shared_,
+          (void*)input_masks_mem_gpu_, (void*)input_val_mem_gpu_,
+          (void*)op_policy_mem_, (void*)policy_indices_,
+          (void*)policy_counts_, (void*)policy_inv_temperatures_,
+          (void*)op_legal_policy_mem_}) {
+      pool_.Free(mem);
+    }
+    if (!zero_copy_) pool_.Free(op_policy_mem_gpu_);
     if (multi_stream_) {
-      for (auto mem : tensor_mem_) {
-        if (mem) 
-            sycl::free(mem, q_ct1);
-      }
-      if (scratch_mem_) 
-          sycl::free(scratch_mem_, q_ct1);
-      if (offset_pointers_) 
-          sycl::free(offset_pointers_, q_ct1);
-      if (head_offset_pointers_) {
-          sycl::free(head_offset_pointers_, q_ct1);
-      } 
-      //dpct::get_current_device().destroy_queue(stream_);
-      //cublas_ = nullptr;
-    } */
+      for (void* mem : tensor_mem_) pool_.Free(mem);
+      pool_.Free(scratch_mem_);
+      // Allocated by the layers on their first run.
+      if (offset_pointers_) sycl::free(offset_pointers_, q_ct1);
+      if (head_offset_pointers_) sycl::free(head_offset_pointers_, q_ct1);
+    }
+  }
+
+  template <typename T>
+  T* Host(size_t count) {
+    return pool_.Allocate<T>(sycl::usm::alloc::host, count);
   }
+  template <typename T>
+  T* Device(size_t count) {
+    return pool_.Allocate<T>(sycl::usm::alloc::device, count);
+  }
+
+  // Number of samples the input and output buffers have room for.
+  const int max_batch_size_;
+  // All the buffers below come from (and go back to) the pool of the network.
+  UsmMemoryPool& pool_;
   uint64_t* input_masks_mem_shared_;
   float* input_val_mem_shared_;
   float* op_value_mem_shared_;
   float* op_moves_left_mem_shared_ = nullptr;
 
-  // GPU pointers for the above allocations.
-  //uint64_t* input_masks_mem_gpu_;
-  //float* input_val_mem_gpu_;
+  // GPU pointers for the above allocations (only with a copy queue).
+  uint64_t* input_masks_mem_gpu_ = nullptr;
+  float* input_val_mem_gpu_ = nullptr;
   //float* op_value_mem_gpu_;
   //float* op_moves_left_mem_gpu_;
 
@@ -100,6 +148,14 @@ struct InputsOutputs {
   float* op_policy_mem_gpu_;
   float* op_policy_mem_;
 
+  // Inputs and output of the legal moves policy softmax, kMaxLegalMoves
+  // entries per sample. Used for the current batch if legal_moves_batch_.
+  uint16_t* policy_indices_ = nullptr;
+  int* policy_counts_ = nullptr;
+  float* policy_inv_temperatures_ = nullptr;
+  float* op_legal_policy_mem_ = nullptr;
+  bool legal_moves_batch_ = false;
+
   // memory needed to run the network owned by InputsOutputs when multi_stream
   // is enabled
   bool multi_stream_;
@@ -108,8 +164,27 @@ struct InputsOutputs {
   void** offset_pointers_ = nullptr;
   void** head_offset_pointers_ = nullptr;
 
-  // cuda stream used to run the network
-  sycl::queue& q_ct1;
+#ifdef SYCL_EXT_ONEAPI_GRAPH
+  // Recorded forward passes, keyed by batch size bucket. They capture the
+  // buffer pointers above, so they can only be replayed with this object.
+  std::map<int, sycl::ext::oneapi::experimental::command_graph<
+                    sycl::ext::oneapi::experimental::graph_state::executable>>
+      graphs_;
+  // Weights generation of the network the graphs were recorded with.
+  int graphs_generation_ = 0;
+#endif
+
+  // Queue for host<->device transfers, nullptr to do them on q_ct1.
+  sycl::queue* copy_queue_;
+  // Kernels write the policy straight into host memory (op_policy_mem_gpu_
+  // aliases op_policy_mem_).
+  bool zero_copy_;
+  // Completion of the last input upload on copy_queue_.
+  sycl::event upload_done_;
+
+  // queue used to run the network (shared with the network unless
+  // multi_stream is enabled)
+  sycl::queue q_ct1;
 };
 
 }  // namespace cudnn_backend
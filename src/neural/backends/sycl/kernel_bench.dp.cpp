@@ -0,0 +1,395 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+  SPDX-License-Identifier:GNU General Public License v3.0 or later
+*/
+
+// Times the kernels and layers of the SYCL backend one by one, on synthetic
+// data, for several batch sizes and channel counts. The JSON output records
+// the BLAS vendor branch and the device, so that files from different vendors
+// can be compared line by line.
+
+#include <sycl/sycl.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "kernels.h"
+#include "layers.h"
+#include "sycl_common.h"
+#include "utils/commandline.h"
+#include "utils/exception.h"
+#include "utils/optionsparser.h"
+#include "utils/string.h"
+#include "version.h"
+
+namespace lczero {
+namespace sycldnn_backend {
+namespace {
+
+const OptionId kGpuId{"gpu", "", "Index of the SYCL device to benchmark."};
+const OptionId kBatchesId{"batches", "",
+                          "Comma separated batch sizes (positions)."};
+const OptionId kFiltersId{"filters", "",
+                          "Comma separated filter counts of the residual "
+                          "tower (Winograd convolution)."};
+const OptionId kEmbeddingsId{"embeddings", "",
+                             "Comma separated embedding sizes of the "
+                             "attention body (FC, attention, LayerNorm, "
+                             "softmax)."};
+const OptionId kPrecisionId{"precision", "",
+                            "Data type of the kernels: fp32, fp16 or both."};
+const OptionId kTimeId{"time", "", "Seconds to measure each kernel for."};
+const OptionId kJsonFileId{"json", "",
+                           "Writes the results as JSON to that file."};
+
+// Per-head depth of the attention benchmarks, the one of the BT networks.
+constexpr int kHeadDepth = 32;
+
+#if defined(USE_CUBLAS)
+const char* kBlasVendor = "cublas";
+#elif defined(USE_HIPBLAS)
+const char* kBlasVendor = "hipblas";
+#else
+const char* kBlasVendor = "onemkl";
+#endif
+
+struct KernelResult {
+  std::string kernel;
+  std::string precision;
+  int batch;
+  int channels;
+  double seconds;
+  // Useful work of one run, either one may be 0.
+  double flops;
+  double bytes;
+};
+
+// Input of the layers under test, only its dimensions are used.
+template <typename DataType>
+class BenchInputLayer : public BaseLayer<DataType> {
+ public:
+  BenchInputLayer(int c, int h, int w, sycl::queue& sycl_queue)
+      : BaseLayer<DataType>(c, h, w, nullptr, false, sycl_queue) {}
+  void Eval(int, DataType*, const DataType*, const DataType*, void*, size_t,
+            sycl::queue&, DataType***) override {}
+};
+
+// Runs @fn once to warm up, then for at least @min_time seconds (and at least
+// three times). Returns the average time of a run.
+template <typename F>
+double TimeKernel(sycl::queue& queue, double min_time, F fn) {
+  fn();
+  queue.wait();
+  int runs = 0;
+  const auto start = std::chrono::steady_clock::now();
+  std::chrono::duration<double> elapsed{0};
+  do {
+    fn();
+    queue.wait();
+    ++runs;
+    elapsed = std::chrono::steady_clock::now() - start;
+  } while (runs < 3 || elapsed.count() < min_time);
+  return elapsed.count() / runs;
+}
+
+template <typename DataType>
+class KernelBench {
+ public:
+  KernelBench(sycl::queue& queue, double min_time, int max_batch,
+              int max_channels)
+      : queue_(queue), min_time_(min_time) {
+    // Large enough for the Winograd transformed tensors (with 36 / 16 times
+    // the elements of a board) and the 80 x 64 policy planes.
+    elements_ = (size_t)max_batch * std::max(max_channels, 80) * 64 * 36 / 16;
+    for (auto& buffer : buffers_) {
+      buffer = sycl::malloc_device<DataType>(elements_, queue_);
+      queue_.memset(buffer, 0, elements_ * sizeof(DataType));
+    }
+    scratch_size_ = std::max<size_t>(
+        2 * elements_ * sizeof(DataType),
+        3 * sizeof(float) * max_channels * max_channels * 9);
+    scratch_ = sycl::malloc_device(scratch_size_, queue_);
+    params_ = sycl::malloc_device<DataType>(4 * max_channels, queue_);
+    queue_.memset(params_, 0, 4 * max_channels * sizeof(DataType));
+    indices_ = sycl::malloc_device<short>(73 * 64, queue_);
+    std::vector<short> host_indices(73 * 64);
+    for (size_t i = 0; i < host_indices.size(); i++) {
+      host_indices[i] = static_cast<short>(i % kNumOutputPolicy);
+    }
+    queue_.memcpy(indices_, host_indices.data(),
+                  host_indices.size() * sizeof(short));
+    queue_.wait();
+  }
+
+  ~KernelBench() {
+    queue_.wait();
+    for (auto buffer : buffers_) sycl::free(buffer, queue_);
+    sycl::free(scratch_, queue_);
+    sycl::free(params_, queue_);
+    sycl::free(indices_, queue_);
+  }
+
+  // Square FC layer over the 64 tokens of each position, through the gemm
+  // vendor branch of FCLayer.
+  KernelResult FullyConnected(int N, int C) {
+    BenchInputLayer<DataType> input(C, 1, 1, queue_);
+    FCLayer<DataType> fc(&input, C, 1, 1, true, ACTIVATION_RELU, queue_);
+    std::vector<float> weights((size_t)C * C, 0.01f);
+    std::vector<float> biases(C, 0.01f);
+    fc.LoadWeights(weights.data(), biases.data(), scratch_);
+    const double seconds = Time([&]() {
+      fc.Eval(N * 64, buffers_[1], buffers_[0], nullptr, scratch_,
+              scratch_size_, queue_);
+    });
+    return Result("fc", N, C, seconds, 2.0 * N * 64 * C * C, 0);
+  }
+
+  // 3x3 convolution of the residual tower (input transform, gemm, output
+  // transform), counted as the flops of the direct convolution.
+  KernelResult WinogradConv(int N, int C) {
+    BenchInputLayer<DataType> input(C, 8, 8, queue_);
+    FusedWinogradConvSELayer<DataType> conv(&input, C, 8, 8, C,
+                                            ACTIVATION_RELU, true, false,
+                                            false, 0, queue_);
+    std::vector<float> filter((size_t)C * C * 9, 0.01f);
+    std::vector<float> biases(C, 0.01f);
+    conv.LoadWeights(filter.data(), biases.data(), scratch_);
+    const double seconds = Time([&]() {
+      conv.Eval(N, buffers_[1], buffers_[0], nullptr, scratch_,
+                scratch_size_, queue_);
+    });
+    return Result("winograd_conv", N, C, seconds, 2.0 * N * 64 * C * C * 9,
+                  0);
+  }
+
+  // softmax(q * k^T) * v of all heads, C / kHeadDepth heads.
+  KernelResult Attention(int N, int C) {
+    const int heads = C / kHeadDepth;
+    const double seconds = Time([&]() {
+      fusedMHA<DataType>(buffers_[3], buffers_[0], buffers_[1], buffers_[2],
+                         nullptr, N, heads, kHeadDepth, 1.0f, queue_);
+    });
+    return Result("attention", N, C, seconds,
+                  4.0 * N * heads * 64 * 64 * kHeadDepth,
+                  4.0 * N * 64 * C * sizeof(DataType));
+  }
+
+  // Bias add, skip add and layer normalization of all tokens.
+  KernelResult LayerNormalization(int N, int C) {
+    const double seconds = Time([&]() {
+      LayerNorm<DataType>(N * 64, C, buffers_[1], buffers_[0], params_,
+                          buffers_[2], params_ + C, params_ + 2 * C, 1e-6f,
+                          1.0f, ACTIVATION_NONE, queue_);
+    });
+    return Result("layernorm", N, C, seconds, 0,
+                  3.0 * N * 64 * C * sizeof(DataType));
+  }
+
+  // Softmax of the 64 x 64 attention logits of C / kHeadDepth heads.
+  KernelResult AttentionSoftmax(int N, int C) {
+    const int rows = N * (C / kHeadDepth) * 64;
+    const double seconds = Time([&]() {
+      Softmax<DataType>(rows, 64, buffers_[1], buffers_[0], nullptr, queue_);
+    });
+    return Result("softmax", N, C, seconds, 0,
+                  2.0 * rows * 64 * sizeof(DataType));
+  }
+
+  // Gather of the 1858 policy outputs from the 73 x 64 convolution planes.
+  KernelResult PolicyMapping(int N) {
+    const double seconds = Time([&]() {
+      PolicyMap<DataType>(N, buffers_[1], buffers_[0], indices_, 73 * 64,
+                          73 * 64, kNumOutputPolicy, queue_);
+    });
+    return Result("policy_map", N, 73, seconds, 0,
+                  (73.0 * 64 + kNumOutputPolicy) * N * sizeof(DataType));
+  }
+
+ private:
+  template <typename F>
+  double Time(F fn) {
+    return TimeKernel(queue_, min_time_, fn);
+  }
+
+  KernelResult Result(const char* kernel, int N, int C, double seconds,
+                      double flops, double bytes) const {
+    return {kernel, std::is_same<sycl::half, DataType>::value ? "fp16" : "fp32",
+            N, C, seconds, flops, bytes};
+  }
+
+  sycl::queue& queue_;
+  const double min_time_;
+  size_t elements_;
+  DataType* buffers_[4];
+  size_t scratch_size_;
+  void* scratch_;
+  DataType* params_;
+  short* indices_;
+};
+
+template <typename DataType>
+void RunKernelBench(sycl::queue& queue, double min_time,
+                    const std::vector<int>& batches,
+                    const std::vector<int>& filters,
+                    const std::vector<int>& embeddings,
+                    std::vector<KernelResult>* results) {
+  const int max_batch = *std::max_element(batches.begin(), batches.end());
+  int max_channels = 0;
+  for (int c : filters) max_channels = std::max(max_channels, c);
+  for (int c : embeddings) max_channels = std::max(max_channels, c);
+  KernelBench<DataType> bench(queue, min_time, max_batch, max_channels);
+
+  const auto add = [&](const KernelResult& result) {
+    results->push_back(result);
+    std::cout << result.kernel << " " << result.precision
+              << " batch=" << result.batch << " channels=" << result.channels
+              << " " << result.seconds * 1e6 << " us";
+    if (result.flops > 0) {
+      std::cout << " " << result.flops / result.seconds / 1e9 << " GFLOP/s";
+    }
+    if (result.bytes > 0) {
+      std::cout << " " << result.bytes / result.seconds / 1e9 << " GB/s";
+    }
+    std::cout << std::endl;
+  };
+
+  for (int N : batches) {
+    for (int C : filters) add(bench.WinogradConv(N, C));
+    for (int C : embeddings) {
+      add(bench.FullyConnected(N, C));
+      if (C % kHeadDepth == 0 && FusedMHASupported(kHeadDepth)) {
+        add(bench.Attention(N, C));
+      }
+      if (C % 16 == 0) add(bench.LayerNormalization(N, C));
+      if (C % kHeadDepth == 0) add(bench.AttentionSoftmax(N, C));
+    }
+    add(bench.PolicyMapping(N));
+  }
+}
+
+std::string JsonString(const std::string& str) {
+  std::string result = "\"";
+  for (char c : str) {
+    if (c == '"' || c == '\\') result += '\\';
+    result += c;
+  }
+  return result + "\"";
+}
+
+void WriteJson(std::ostream& os, const sycl::device& device,
+               const std::vector<KernelResult>& results) {
+  os << "{\n  \"version\": " << JsonString(GetVersionStr())
+     << ",\n  \"blas\": " << JsonString(kBlasVendor) << ",\n  \"platform\": "
+     << JsonString(
+            device.get_platform().get_info<sycl::info::platform::name>())
+     << ",\n  \"device\": "
+     << JsonString(device.get_info<sycl::info::device::name>())
+     << ",\n  \"driver\": "
+     << JsonString(device.get_info<sycl::info::device::driver_version>())
+     << ",\n  \"kernels\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto& result = results[i];
+    os << (i ? "," : "") << "\n    {\"kernel\": " << JsonString(result.kernel)
+       << ", \"precision\": " << JsonString(result.precision)
+       << ", \"batch\": " << result.batch
+       << ", \"channels\": " << result.channels
+       << ", \"us\": " << result.seconds * 1e6
+       << ", \"gflops\": " << result.flops / result.seconds / 1e9
+       << ", \"gbytes_per_second\": " << result.bytes / result.seconds / 1e9
+       << "}";
+  }
+  os << "\n  ]\n}\n";
+}
+
+void Run() {
+  OptionsParser options;
+  options.Add<IntOption>(kGpuId, 0, 64) = 0;
+  options.Add<StringOption>(kBatchesId) = "1,64,256";
+  options.Add<StringOption>(kFiltersId) = "128,256,384";
+  options.Add<StringOption>(kEmbeddingsId) = "256,768,1024";
+  std::vector<std::string> precisions = {"fp32", "fp16", "both"};
+  options.Add<ChoiceOption>(kPrecisionId, precisions) = "both";
+  options.Add<FloatOption>(kTimeId, 0.0f, 100.0f) = 0.2f;
+  options.Add<StringOption>(kJsonFileId);
+  if (!options.ProcessAllFlags()) return;
+
+  const auto option_dict = options.GetOptionsDict();
+  const auto get_list = [&](const OptionId& id) {
+    const std::string list = option_dict.Get<std::string>(id);
+    return list.empty() ? std::vector<int>() : ParseIntList(list);
+  };
+  const auto batches = get_list(kBatchesId);
+  const auto filters = get_list(kFiltersId);
+  const auto embeddings = get_list(kEmbeddingsId);
+  if (batches.empty()) throw Exception("No batch sizes to benchmark.");
+  const std::string precision = option_dict.Get<std::string>(kPrecisionId);
+  const double min_time = option_dict.Get<float>(kTimeId);
+
+  const auto devices = sycl::device::get_devices();
+  const int gpu = option_dict.Get<int>(kGpuId);
+  if (gpu >= static_cast<int>(devices.size())) {
+    throw Exception("Invalid GPU Id: " + std::to_string(gpu));
+  }
+  const sycl::device& device = devices[gpu];
+  sycl::queue queue{device, sycl::property::queue::in_order{}};
+  std::cout << "Device: " << device.get_info<sycl::info::device::name>()
+            << ", BLAS: " << kBlasVendor << std::endl;
+
+  std::vector<KernelResult> results;
+  if (precision != "fp16") {
+    RunKernelBench<float>(queue, min_time, batches, filters, embeddings,
+                          &results);
+  }
+  if (precision != "fp32") {
+    if (device.has(sycl::aspect::fp16)) {
+      RunKernelBench<sycl::half>(queue, min_time, batches, filters,
+                                 embeddings, &results);
+    } else {
+      std::cout << "The device doesn't support fp16." << std::endl;
+    }
+  }
+
+  const std::string json_file = option_dict.Get<std::string>(kJsonFileId);
+  if (!json_file.empty()) {
+    std::ofstream file(json_file);
+    if (!file) throw Exception("Unable to write " + json_file);
+    WriteJson(file, device, results);
+  }
+}
+
+}  // namespace
+}  // namespace sycldnn_backend
+}  // namespace lczero
+
+int main(int argc, const char** argv) {
+  using namespace lczero;
+  try {
+    CommandLine::Init(argc, argv);
+    sycldnn_backend::Run();
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
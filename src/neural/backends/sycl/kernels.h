@@ -20,7 +20,6 @@
 */
 
 #include <sycl/sycl.hpp>
-#include "dpct/dpct.hpp"
 #include "sycl_common.h"
 #include "neural/backends/shared/activation.h"
 
@@ -112,6 +111,13 @@ void FilterTransform(int N, int C, T* transformedFilter, const T* filter, sycl::
 template <typename T, bool nhcw>
 void InputTransform(int N, int C, T* transformedInput, const T* input, sycl::queue &sycl_queue);
 
+// InputTransform() of the NCHW tensor that the C packed input planes of each
+// position (a mask and a value per plane) expand to, without writing it.
+template <typename T>
+void InputTransformFromPlanes(int N, int C, T* transformedInput,
+                              const uint64_t* masks, const float* values,
+                              sycl::queue& sycl_queue);
+
 template <typename T, bool use_se, ActivationFunction activation, bool use_bias,
           bool use_skip, bool skipInput_nhcw, bool output_nhcw>
 void OutputTransform(int N, int C, int se_K, T* output, const T* input,
@@ -143,8 +149,54 @@ void inputPreprocessForAttentionBody(T* output, const T* input,
                                      bool is_pe_dense_embedding,
                                      sycl::queue &sycl_queue);
 
+// Same as inputPreprocessForAttentionBody() for the expanded input planes,
+// reading the packed ones (input_size planes per position) instead.
+template <typename T>
+void inputPreprocessPlanesForAttentionBody(T* output, const uint64_t* masks,
+                                           const float* values,
+                                           const T* encoding, int N,
+                                           int input_size, int encoding_size,
+                                           bool is_pe_dense_embedding,
+                                           sycl::queue& sycl_queue);
+
+// Expands the first C of the kInputPlanes packed planes of each position into
+// an NHWC tensor (N x 64 x C).
+template <typename T>
+void expandPlanesNHWC(T* output, const uint64_t* masks, const float* values,
+                      int N, int C, sycl::queue& sycl_queue);
+
 template <typename T>
 void applyInputGating(T* output, const T* input, const T* mult, const T* add,
                       int N, int HW, int C, sycl::queue &sycl_queue);
+
+// Quantizes each row of a rows x cols matrix to int8 with its own scale.
+template <typename T>
+void quantizeRowsInt8(int8_t* output, float* scales, const T* input, int rows,
+                      int cols, sycl::queue& sycl_queue);
+
+// Rescales the int32 output of an int8 gemm and applies bias and activation.
+template <typename T>
+void dequantizeInt8Gemm(T* output, const int32_t* input,
+                        const float* row_scales, const float* col_scales,
+                        const T* bias, int rows, int cols,
+                        ActivationFunction activation, sycl::queue& sycl_queue);
+
+// Softmax over the legal move entries of each sample's policy logits.
+// policy is N x kNumOutputPolicy, indices and output are N x kMaxLegalMoves
+// with counts[n] entries used.
+void softmaxLegalMoves(float* output, const float* policy,
+                       const uint16_t* indices, const int* counts,
+                       const float* inv_temperatures, int N,
+                       sycl::queue& sycl_queue);
+
+// Whether fusedMHA handles this per-head depth.
+bool FusedMHASupported(int depth);
+
+// softmax(q * k^T * factor + smolgen) * v over all heads in one kernel; the
+// layouts match EncoderBlock (N x 64 x heads * depth for q, k, v and output).
+template <typename T>
+void fusedMHA(T* output, const T* q, const T* k, const T* v, const T* smolgen,
+              int N, int heads, int depth, float factor,
+              sycl::queue& sycl_queue);
 }  // namespace cudnn_backend
 }  // namespace lczero
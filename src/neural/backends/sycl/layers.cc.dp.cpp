@@ -20,9 +20,9 @@
 */
 
 #include <sycl/sycl.hpp>
-#include "dpct/dpct.hpp"
 #include "layers.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <vector>
@@ -46,7 +46,6 @@
 #include "neural/network.h"
 #include "neural/tables/attention_policy_map.h"
 #include "utils/fp16_utils.h"
-#include "dpct/lib_common_utils.hpp"
 
 #include <cmath>
 
@@ -412,7 +411,7 @@ void SELayer<sycl::half>::Eval(int N, sycl::half* output, const sycl::half* inpu
 
     #ifdef USE_CUBLAS
 
-    sycl_queue_.submit([&](sycl::handler &cgh) {
+    sycl_queue.submit([&](sycl::handler &cgh) {
         
         cgh.host_task([=](sycl::interop_handle ih) {
 
@@ -1052,6 +1051,29 @@ void FusedWinogradConvSELayer<DataType>::Eval(
       transformed_input + scratch_size / (2 * sizeof(DataType));
 
   InputTransform<DataType, false>(N, c_input_, transformed_input, input, sycl_queue);
+  EvalTransformed(N, output, transformed_input, transformed_output, input2,
+                  sycl_queue);
+}
+
+template <typename DataType>
+void FusedWinogradConvSELayer<DataType>::EvalFromPlanes(
+    int N, DataType* output, const uint64_t* masks, const float* values,
+    void* scratch, size_t scratch_size, sycl::queue& sycl_queue) {
+  DataType* transformed_input = (DataType*)scratch;
+  DataType* transformed_output =
+      transformed_input + scratch_size / (2 * sizeof(DataType));
+
+  InputTransformFromPlanes<DataType>(N, c_input_, transformed_input, masks,
+                                     values, sycl_queue);
+  EvalTransformed(N, output, transformed_input, transformed_output, nullptr,
+                  sycl_queue);
+}
+
+template <typename DataType>
+void FusedWinogradConvSELayer<DataType>::EvalTransformed(
+    int N, DataType* output, DataType* transformed_input,
+    DataType* transformed_output, const DataType* input2,
+    sycl::queue& sycl_queue) {
   BaseLayer<DataType>::cublasRowMajorMatrixMul(
       transformed_input, transformed_weights_, transformed_output, N * 4, C, c_input_, 36, sycl_queue);
 
@@ -1296,24 +1318,13 @@ void Conv1Layer<DataType>::Eval(int N, DataType* output, const DataType* input,
                                 const DataType* /*input2*/, void* /*scratch*/,
                                 size_t /*scratch_size*/,
                                 sycl::queue &sycl_queue, DataType***) {
-
-  sycl_queue.wait();
-  
-  //CERR << "Conv1Layer<DataType>::Eval. ";
-
   cublasSpecialMatrixMul(weights_, input, output, C, H * W, c_input_, N, sycl_queue);
- // CERR << "cublasSpecialMatrixMul. ";
 
-  sycl_queue.wait();
   if (use_bias_){
-  // CERR << "addBias. " << N << " " << C << " " << H << " " << W;
     addBias_NCHW(output, output, biases_, N, C, H, W, act_, sycl_queue);
   } else if (act_ != ACTIVATION_NONE) {
     addVectors(output, output, (DataType*)nullptr, N * C * H * W, N * C * H * W, 0, act_, sycl_queue);
-  //  CERR << "addVectors. ";
   }
-
-  sycl_queue.wait();
 }
 
 template <typename DataType>
@@ -1484,7 +1495,7 @@ void ResidualBlock<DataType>::Eval(int N, DataType* output,
   }
 
   if (first_block_) {
-    InputTransform<DataType, true>(N, c_input_, transformed_input, input, sycl_queue_);
+    InputTransform<DataType, true>(N, c_input_, transformed_input, input, sycl_queue);
     BaseLayer<DataType>::cublasRowMajorMatrixMul(
         transformed_input, transformed_weights0_, transformed_output, N * 4, C,
         c_input_, 36, sycl_queue);
@@ -1611,6 +1622,30 @@ void allocAndUpload(DataType** gpu_dest, std::vector<float> cpu_src,
    copyTypeConverted((DataType*)(*gpu_dest), (float*)scratch, (int)cpu_src.size(), sycl_queue);
 }
 
+// Quantizes a row major rows x cols weight matrix to int8 with one symmetric
+// scale per row (i.e. per output channel) and uploads both.
+static void quantizeAndUploadInt8(int8_t** gpu_dest, float** gpu_scales,
+                                  const std::vector<float>& cpu_src, int rows,
+                                  sycl::queue& sycl_queue) {
+  const int cols = cpu_src.size() / rows;
+  std::vector<int8_t> quantized(cpu_src.size());
+  std::vector<float> scales(rows);
+  for (int r = 0; r < rows; r++) {
+    const float* row = &cpu_src[(size_t)r * cols];
+    float max_abs = 0.0f;
+    for (int c = 0; c < cols; c++) max_abs = std::max(max_abs, std::abs(row[c]));
+    scales[r] = max_abs > 0.0f ? max_abs / 127.0f : 1.0f;
+    for (int c = 0; c < cols; c++) {
+      quantized[(size_t)r * cols + c] = (int8_t)std::clamp(
+          std::nearbyint(row[c] / scales[r]), -127.0f, 127.0f);
+    }
+  }
+  *gpu_dest = sycl::malloc_device<int8_t>(quantized.size(), sycl_queue);
+  *gpu_scales = sycl::malloc_device<float>(rows, sycl_queue);
+  sycl_queue.memcpy(*gpu_dest, quantized.data(), quantized.size()).wait();
+  sycl_queue.memcpy(*gpu_scales, scales.data(), rows * sizeof(float)).wait();
+}
+
 template <typename DataType>
 AttentionPolicyHead<DataType>::AttentionPolicyHead(
     BaseLayer<DataType>* ip, const MultiHeadWeights::PolicyHead& weights,
@@ -1675,7 +1710,8 @@ EncoderBlock<DataType>::EncoderBlock(
     const MultiHeadWeights::EncoderLayer& cpu_weights, void* scratch, int heads,
     int size, float alpha, DataType* smolgen_global_scratch,
     int smolgen_global_size, int max_batch_size, ActivationFunction smolgen_act,
-    ActivationFunction ffn_act, float default_eps, sycl::queue &sycl_queue)
+    ActivationFunction ffn_act, float default_eps, sycl::queue &sycl_queue,
+    Int8FfnScratch* int8_scratch)
     : embedding_op_size_(size),
       encoder_heads_(heads),
       alpha_(alpha),
@@ -1684,8 +1720,11 @@ EncoderBlock<DataType>::EncoderBlock(
       ffn_activation_(ffn_act),
       max_batch_size_(max_batch_size),
       default_eps_(default_eps),
+      int8_scratch_(int8_scratch),
+      use_int8_ffn_(int8_scratch != nullptr),
       sycl_queue_(sycl_queue) {
   mha_q_size_ = cpu_weights.mha.q_b.size();
+  use_fused_mha_ = FusedMHASupported(mha_q_size_ / encoder_heads_);
   mha_k_size_ = cpu_weights.mha.k_b.size();
   mha_v_size_ = cpu_weights.mha.v_b.size();
   mha_dense_size_ = cpu_weights.mha.dense_b.size();
@@ -1735,6 +1774,15 @@ EncoderBlock<DataType>::EncoderBlock(
   allocAndUpload<DataType>(&ln2_gammas, cpu_weights.ln2_gammas, scratch, sycl_queue_);
   allocAndUpload<DataType>(&ln2_betas, cpu_weights.ln2_betas, scratch, sycl_queue_);
 
+  if (int8_scratch_) {
+    quantizeAndUploadInt8(&ffn_dense1_w_int8, &ffn_dense1_scales,
+                          cpu_weights.ffn.dense1_w, ffn_dense1_size_,
+                          sycl_queue_);
+    quantizeAndUploadInt8(&ffn_dense2_w_int8, &ffn_dense2_scales,
+                          cpu_weights.ffn.dense2_w, ffn_dense2_size_,
+                          sycl_queue_);
+  }
+
   // Smolgen weights.
   if (has_smolgen_) {
     smol_compress_size_ = cpu_weights.mha.smolgen.compress.size() / mha_q_size_;
@@ -1808,6 +1856,20 @@ static void cublasXgemm(transpose_type transa,
   }
   #elif defined(USE_HIPBLAS)
     hipblasHandle_t handle = hipBlasContextManager::gethipBlasHandle_t();
+  if (fp16) {
+    unsigned short alpha_h = FP32toFP16(alpha);
+    unsigned short beta_h = FP32toFP16(beta);
+    sycl_queue.submit([&](sycl::handler &cgh) {
+      cgh.host_task([=](sycl::interop_handle ih) {
+        auto hipStreamHandle = sycl::get_native<sycl::backend::ext_oneapi_hip>(sycl_queue);
+        hipblasSetStream(handle, hipStreamHandle);
+        hipblasHgemm(handle, transa, transb, m, n, k, (const half*)&alpha_h,
+                     (const half*)A, lda, (const half*)B, ldb,
+                     (const half*)&beta_h, (half*)C, ldc);
+        hipStreamSynchronize(hipStreamHandle);
+        });
+      });
+  } else {
     sycl_queue.submit([&](sycl::handler &cgh) {
       cgh.host_task([=](sycl::interop_handle ih) {  
         auto hipStreamHandle = sycl::get_native<sycl::backend::ext_oneapi_hip>(sycl_queue);
@@ -1816,6 +1878,7 @@ static void cublasXgemm(transpose_type transa,
         hipStreamSynchronize(hipStreamHandle);
         });
       });
+  }
   #else
     oneapi::mkl::blas::column_major::gemm(sycl_queue, transa, transb, m, n, k, alpha, (const DataType *)A, lda,
         (const DataType *)B, ldb, beta, (DataType *)C, ldc);
@@ -1823,6 +1886,33 @@ static void cublasXgemm(transpose_type transa,
 
 }
 
+#if !defined(USE_CUBLAS) && !defined(USE_HIPBLAS)
+// Fully connected layer with int8 weights: output = act(input * W^T + bias)
+// for row major input (batch x num_inputs) and output (batch x num_outputs).
+// Activations are quantized per row on the fly, in chunks that fit |scratch|.
+template <typename DataType>
+static void int8FullyConnected(DataType* output, const DataType* input,
+                               const int8_t* weights, const float* w_scales,
+                               const DataType* bias, int batch, int num_inputs,
+                               int num_outputs, ActivationFunction act,
+                               const Int8FfnScratch& scratch,
+                               sycl::queue& sycl_queue) {
+  for (int row = 0; row < batch; row += scratch.rows) {
+    const int rows = std::min(scratch.rows, batch - row);
+    quantizeRowsInt8(scratch.input, scratch.row_scales,
+                     input + (size_t)row * num_inputs, rows, num_inputs,
+                     sycl_queue);
+    oneapi::mkl::blas::column_major::gemm(
+        sycl_queue, transpose_type_transpose, transpose_type_notranspose,
+        num_outputs, rows, num_inputs, 1.0f, weights, num_inputs,
+        scratch.input, num_inputs, 0.0f, scratch.accum, num_outputs);
+    dequantizeInt8Gemm(output + (size_t)row * num_outputs, scratch.accum,
+                       scratch.row_scales, w_scales, bias, rows, num_outputs,
+                       act, sycl_queue);
+  }
+}
+#endif
+
 template <typename DataType>
 static void cublasXGemmStridedBatched(transpose_type transa, transpose_type transb,
     int m, int n, int k, float alpha, const void* A, int lda,
@@ -1874,6 +1964,10 @@ static void cublasXGemmStridedBatched(transpose_type transa, transpose_type tran
   }
   #elif defined(USE_HIPBLAS)
     hipblasHandle_t handle = hipBlasContextManager::gethipBlasHandle_t();
+    // Like the cuBLAS branch, fp16 data is also accumulated in fp16.
+    const hipblasDatatype_t data_type = fp16 ? HIPBLAS_R_16F : HIPBLAS_R_32F;
+    unsigned short alpha_h = FP32toFP16(alpha);
+    unsigned short beta_h = FP32toFP16(beta);
 
      sycl_queue.submit([&](sycl::handler &cgh) {
 
@@ -1883,16 +1977,22 @@ static void cublasXGemmStridedBatched(transpose_type transa, transpose_type tran
         hipblasSetStream(handle, hipStreamHandle);    
     
         hipblasGemmStridedBatchedEx(
-        handle, transa, transb, m, n, k, &alpha, A, HIPBLAS_R_32F, lda, strideA, B,
-        HIPBLAS_R_32F, ldb, strideB, &beta, C, HIPBLAS_R_32F, ldc, strideC,
-        batchCount, HIPBLAS_R_32F, HIPBLAS_GEMM_DEFAULT);
+        handle, transa, transb, m, n, k,
+        fp16 ? (const void*)&alpha_h : (const void*)&alpha, A, data_type, lda,
+        strideA, B, data_type, ldb, strideB,
+        fp16 ? (const void*)&beta_h : (const void*)&beta, C, data_type, ldc,
+        strideC, batchCount, data_type, HIPBLAS_GEMM_DEFAULT);
   
         hipStreamSynchronize(hipStreamHandle);
   
       });
     });
     #else
-      oneapi::mkl::blas::column_major::gemm_batch(sycl_queue, transa, transb, m, n, k,  alpha, (const DataType *)A, lda, strideA, (const DataType *)B, ldb, strideB, beta, (DataType *)C, ldc, strideC, batchCount);
+      // alpha and beta in the data type, as in the pointer array version.
+      oneapi::mkl::blas::column_major::gemm_batch(
+          sycl_queue, transa, transb, m, n, k, (DataType)alpha,
+          (const DataType*)A, lda, strideA, (const DataType*)B, ldb, strideB,
+          (DataType)beta, (DataType*)C, ldc, strideC, batchCount);
     #endif
 }
 
@@ -2133,84 +2233,95 @@ void EncoderBlock<DataType>::Eval(int N, DataType* in_out_tensor,
   // shape(k)[-1] = depth
   float factor = 1.0f / sqrt((float)depth);
 
-  // matmul_qk = tf.matmul(q, k, transpose_b=True)
-  {
-    if (*offset_pointers == nullptr) {
-      std::vector<DataType*> offsets(encoder_heads_ * max_batch_size_ * 5);
-      for (int i = 0; i < encoder_heads_ * max_batch_size_; i++) {
-        int h = i % encoder_heads_;
-        int n = i / encoder_heads_;
-        offsets[i] = mha_k + h * depth + 64 * d_model * n;
-        offsets[i + encoder_heads_ * max_batch_size_] =
-            mha_q + h * depth + 64 * d_model * n;
-        offsets[i + 2 * encoder_heads_ * max_batch_size_] =
-            buffer1 + i * 64 * 64;
-        offsets[i + 3 * encoder_heads_ * max_batch_size_] =
-            mha_v + h * depth + 64 * d_model * n;
-        offsets[i + 4 * encoder_heads_ * max_batch_size_] =
-            buffer2 + h * depth + 64 * d_model * n;
+  // Attention output goes to buffer2 (or buffer1 with the fused kernel, as
+  // buffer2 still holds the smolgen logits while it runs).
+  DataType* mha_out = use_fused_mha_ ? buffer1 : buffer2;
+  DataType* mha_dense_out = use_fused_mha_ ? buffer2 : buffer1;
+
+  if (use_fused_mha_) {
+    fusedMHA<DataType>(mha_out, mha_q, mha_k, mha_v,
+                       has_smolgen_ ? buffer2 : (const DataType*)nullptr, N,
+                       encoder_heads_, depth, factor, sycl_queue);
+  } else {
+    // matmul_qk = tf.matmul(q, k, transpose_b=True)
+    {
+      if (*offset_pointers == nullptr) {
+        std::vector<DataType*> offsets(encoder_heads_ * max_batch_size_ * 5);
+        for (int i = 0; i < encoder_heads_ * max_batch_size_; i++) {
+          int h = i % encoder_heads_;
+          int n = i / encoder_heads_;
+          offsets[i] = mha_k + h * depth + 64 * d_model * n;
+          offsets[i + encoder_heads_ * max_batch_size_] =
+              mha_q + h * depth + 64 * d_model * n;
+          offsets[i + 2 * encoder_heads_ * max_batch_size_] =
+              buffer1 + i * 64 * 64;
+          offsets[i + 3 * encoder_heads_ * max_batch_size_] =
+              mha_v + h * depth + 64 * d_model * n;
+          offsets[i + 4 * encoder_heads_ * max_batch_size_] =
+              buffer2 + h * depth + 64 * d_model * n;
+        }
+        
+        *offset_pointers = sycl::malloc_device<DataType*>(
+                                 encoder_heads_ * max_batch_size_ * 5,
+                                 sycl_queue_);
+
+        sycl_queue.memcpy(*offset_pointers, offsets.data(),
+                        encoder_heads_ * max_batch_size_ * 5 * sizeof(DataType*)).wait();
       }
-      
-      *offset_pointers = sycl::malloc_device<DataType*>(
-                               encoder_heads_ * max_batch_size_ * 5,
-                               sycl_queue_);
 
-      sycl_queue.memcpy(*offset_pointers, offsets.data(),
-                      encoder_heads_ * max_batch_size_ * 5 * sizeof(DataType*)).wait();
+      cublasXGemmBatched<DataType>(transpose_type_transpose, transpose_type_notranspose,
+          64 /*M*/, 64 /*N*/, depth /*K*/,  // A/B, and M/N are swapped for
+                                            // row-major to col-major transform
+          factor,            // to handle "/ tf.math.sqrt(dk)"
+          *offset_pointers,  // mha_k + offset /*A*/,
+          d_model /*LDA*/,   // (d_model = depth * encoder_heads_) to skip over
+                             // other "depth" slices / heads
+          // 64 * d_model,     /*strideA*/
+          *offset_pointers +
+              encoder_heads_ * max_batch_size_,  // mha_q + offset /*B*/,
+          d_model /*LDB*/,  // to skip over other other "depth" slices / heads
+          // 64 * d_model,     /*strideB*/
+          0.0f,
+          *offset_pointers + encoder_heads_ * max_batch_size_ *
+                                 2,  // buffer1 + outOffset /*C*/,  // output
+                                     // (matmul_qk) goes to buffer1
+          64 /*LDC*/,
+          // 64 * 64 /*strideC*/,
+          N * encoder_heads_, sycl_queue);
     }
 
-    cublasXGemmBatched<DataType>(transpose_type_transpose, transpose_type_notranspose,
-        64 /*M*/, 64 /*N*/, depth /*K*/,  // A/B, and M/N are swapped for
-                                          // row-major to col-major transform
-        factor,            // to handle "/ tf.math.sqrt(dk)"
-        *offset_pointers,  // mha_k + offset /*A*/,
-        d_model /*LDA*/,   // (d_model = depth * encoder_heads_) to skip over
-                           // other "depth" slices / heads
-        // 64 * d_model,     /*strideA*/
-        *offset_pointers +
-            encoder_heads_ * max_batch_size_,  // mha_q + offset /*B*/,
-        d_model /*LDB*/,  // to skip over other other "depth" slices / heads
-        // 64 * d_model,     /*strideB*/
-        0.0f,
-        *offset_pointers + encoder_heads_ * max_batch_size_ *
-                               2,  // buffer1 + outOffset /*C*/,  // output
-                                   // (matmul_qk) goes to buffer1
-        64 /*LDC*/,
-        // 64 * 64 /*strideC*/,
-        N * encoder_heads_, sycl_queue_);
-  }
-
-  // attention_weights = tf.nn.softmax(scaled_attention_logits, axis = -1)
-  // attention_weights -> buffer1
-  if (has_smolgen_) {
-    // Add smolgen weights to the scaled matmul_qk attention logits before
-    // softmax.
-    Softmax(encoder_heads_ * N * 64, 64, buffer1, buffer1, buffer2, sycl_queue_);
-  } else {
-    Softmax(encoder_heads_ * N * 64, 64, buffer1, buffer1,
-            (const DataType*)nullptr, sycl_queue_);
+    // attention_weights = tf.nn.softmax(scaled_attention_logits, axis = -1)
+    // attention_weights -> buffer1
+    if (has_smolgen_) {
+      // Add smolgen weights to the scaled matmul_qk attention logits before
+      // softmax.
+      Softmax(encoder_heads_ * N * 64, 64, buffer1, buffer1, buffer2, sycl_queue);
+    } else {
+      Softmax(encoder_heads_ * N * 64, 64, buffer1, buffer1,
+              (const DataType*)nullptr, sycl_queue);
+    }
+
+    {
+      cublasXGemmBatched<DataType>(transpose_type_notranspose,
+          transpose_type_notranspose, depth /*M*/, 64 /*N*/, 64 /*K*/, 1.0f,
+          *offset_pointers + encoder_heads_ * max_batch_size_ *
+                                 3,  // mha_v + offset /*A*/,  // "v" matrix
+          d_model /*LDA*/,           // to skip over other "depth" slices / heads
+          // 64 * d_model,          /*strideA*/
+          *offset_pointers + encoder_heads_ * max_batch_size_ *
+                                 2,  // buffer1 + weightsOffset /*B*/,
+          64 /*LDB*/,                // 64 * 64, /*strideB*/
+          0.0f,
+          *offset_pointers +
+              encoder_heads_ * max_batch_size_ *
+                  4,  // buffer2 + offset /*C*/,  // output goes to buffer2
+          d_model /*LDC*/,
+          // 64 * d_model /*strideC*/,
+          N * encoder_heads_, sycl_queue);
+    }
   }
 
-  {
-    cublasXGemmBatched<DataType>(transpose_type_notranspose,
-        transpose_type_notranspose, depth /*M*/, 64 /*N*/, 64 /*K*/, 1.0f,
-        *offset_pointers + encoder_heads_ * max_batch_size_ *
-                               3,  // mha_v + offset /*A*/,  // "v" matrix
-        d_model /*LDA*/,           // to skip over other "depth" slices / heads
-        // 64 * d_model,          /*strideA*/
-        *offset_pointers + encoder_heads_ * max_batch_size_ *
-                               2,  // buffer1 + weightsOffset /*B*/,
-        64 /*LDB*/,                // 64 * 64, /*strideB*/
-        0.0f,
-        *offset_pointers +
-            encoder_heads_ * max_batch_size_ *
-                4,  // buffer2 + offset /*C*/,  // output goes to buffer2
-        d_model /*LDC*/,
-        // 64 * d_model /*strideC*/,
-        N * encoder_heads_, sycl_queue_);
-  }
-
-  // #final dense layer (mha_dense), buffer2 -> buffer1
+  // #final dense layer (mha_dense), mha_out -> mha_dense_out
   {
     const int num_inputs = d_model;
     const int num_outputs = embedding_op_size_;
@@ -2218,44 +2329,59 @@ void EncoderBlock<DataType>::Eval(int N, DataType* in_out_tensor,
     cublasXgemm(transpose_type_transpose,
                 transpose_type_notranspose, num_outputs, batch,
                 num_inputs, 1.0f, (const DataType*)mha_dense_w, num_inputs,
-                buffer2, num_inputs, 0.0f, buffer1, num_outputs, sycl_queue_);
+                mha_out, num_inputs, 0.0f, mha_dense_out, num_outputs, sycl_queue);
   }
 
   // LN1: skip connection and layer normalization (also bias add of prev gemm)
-  // buffer1/in_out_tensor -> scratch
-  LayerNorm<DataType>(N * 64, embedding_op_size_, scratch, buffer1, mha_dense_b,
+  // mha_dense_out/in_out_tensor -> scratch
+  LayerNorm<DataType>(N * 64, embedding_op_size_, scratch, mha_dense_out, mha_dense_b,
                       in_out_tensor, ln1_gammas, ln1_betas, default_eps_,
-                      alpha_, ACTIVATION_NONE, sycl_queue_);
+                      alpha_, ACTIVATION_NONE, sycl_queue);
 
   // #FFN dense 1, scratch -> in_out_tensor
+  // #FFN dense 2, in_out_tensor -> buffer1 (bias is added in LN2)
+#if !defined(USE_CUBLAS) && !defined(USE_HIPBLAS)
+  if (use_int8_ffn_) {
+    int8FullyConnected(in_out_tensor, scratch, ffn_dense1_w_int8,
+                       ffn_dense1_scales, ffn_dense1_b, N * 64,
+                       embedding_op_size_, ffn_dense1_size_, ffn_activation_,
+                       *int8_scratch_, sycl_queue);
+    int8FullyConnected(buffer1, in_out_tensor, ffn_dense2_w_int8,
+                       ffn_dense2_scales, (const DataType*)nullptr, N * 64,
+                       ffn_dense1_size_, embedding_op_size_, ACTIVATION_NONE,
+                       *int8_scratch_, sycl_queue);
+  } else
+#endif
   {
-    const int num_inputs = embedding_op_size_;
-    const int num_outputs = ffn_dense1_size_;  // encoder_dff
-    const int batch = N * 64;
-    cublasXgemm(transpose_type_transpose,
-                transpose_type_notranspose, num_outputs, batch,
-                num_inputs, 1.0f, (const DataType*)ffn_dense1_w, num_inputs,
-                scratch, num_inputs, 0.0f, in_out_tensor, num_outputs, sycl_queue_);
-    addBiasBatched(in_out_tensor, in_out_tensor, ffn_dense1_b, 1, batch,
-                   num_outputs, ffn_activation_, sycl_queue_);
-  }
+    {
+      const int num_inputs = embedding_op_size_;
+      const int num_outputs = ffn_dense1_size_;  // encoder_dff
+      const int batch = N * 64;
+      cublasXgemm(transpose_type_transpose,
+                  transpose_type_notranspose, num_outputs, batch,
+                  num_inputs, 1.0f, (const DataType*)ffn_dense1_w, num_inputs,
+                  scratch, num_inputs, 0.0f, in_out_tensor, num_outputs, sycl_queue);
+      addBiasBatched(in_out_tensor, in_out_tensor, ffn_dense1_b, 1, batch,
+                     num_outputs, ffn_activation_, sycl_queue);
+    }
 
-  // #FFN dense 2, in_out_tensor -> buffer1
-  {
-    const int num_inputs = ffn_dense1_size_;  // encoder_dff
-    const int num_outputs = embedding_op_size_;
-    const int batch = N * 64;
-    cublasXgemm(transpose_type_transpose,
-                transpose_type_notranspose, num_outputs, batch,
-                num_inputs, 1.0f, (const DataType*)ffn_dense2_w, num_inputs,
-                in_out_tensor, num_inputs, 0.0f, buffer1, num_outputs, sycl_queue_);
+    // #FFN dense 2, in_out_tensor -> buffer1
+    {
+      const int num_inputs = ffn_dense1_size_;  // encoder_dff
+      const int num_outputs = embedding_op_size_;
+      const int batch = N * 64;
+      cublasXgemm(transpose_type_transpose,
+                  transpose_type_notranspose, num_outputs, batch,
+                  num_inputs, 1.0f, (const DataType*)ffn_dense2_w, num_inputs,
+                  in_out_tensor, num_inputs, 0.0f, buffer1, num_outputs, sycl_queue);
+    }
   }
 
   // LN2: skip connection and layer normilization (also bias add of prev gemm)
   // buffer1/scratch -> in_out_tensor
   LayerNorm<DataType>(N * 64, embedding_op_size_, in_out_tensor, buffer1,
                       ffn_dense2_b, scratch, ln2_gammas, ln2_betas,
-                      default_eps_, alpha_, ACTIVATION_NONE, sycl_queue_);
+                      default_eps_, alpha_, ACTIVATION_NONE, sycl_queue);
 }
 
 template <typename DataType>
@@ -2376,6 +2502,12 @@ EncoderBlock<DataType>::~EncoderBlock() {
       sycl::free(ffn_dense2_b, sycl_queue_);
       sycl::free(ln2_gammas, sycl_queue_);
       sycl::free(ln2_betas, sycl_queue_);
+  if (int8_scratch_) {
+      sycl::free(ffn_dense1_w_int8, sycl_queue_);
+      sycl::free(ffn_dense1_scales, sycl_queue_);
+      sycl::free(ffn_dense2_w_int8, sycl_queue_);
+      sycl::free(ffn_dense2_scales, sycl_queue_);
+  }
   if (has_smolgen_) {
       sycl::free(smol_compress, sycl_queue_);
       sycl::free(smol_dense1_w, sycl_queue_);
@@ -2429,7 +2561,7 @@ AttentionBody<DataType>::AttentionBody(const MultiHeadWeights& weights,
                                        int num_res_blocks, int input_c,
                                        int max_batch_size,
                                        bool is_pe_dense_embedding,
-                                       sycl::queue &sycl_queue)
+                                       sycl::queue &sycl_queue, bool int8_ffn)
     : BaseLayer<DataType>(weights.ip_emb_b.size(), 8, 8, nullptr, sycl_queue),
       embedding_op_size_(weights.ip_emb_b.size()),
       encoder_head_count_(weights.encoder_head_count),
@@ -2491,13 +2623,27 @@ AttentionBody<DataType>::AttentionBody(const MultiHeadWeights& weights,
   }
 
   int num_encoders = weights.encoder.size();
+  if (int8_ffn && num_encoders > 0) {
+    // Bounded chunk so the int32 accumulator stays small for big batches.
+    int8_scratch_.rows = std::min(max_batch_size * 64, 4096);
+    size_t max_width = embedding_op_size_;
+    for (const auto& enc : weights.encoder) {
+      max_width = std::max(max_width, enc.ffn.dense1_b.size());
+    }
+    const size_t elements = int8_scratch_.rows * max_width;
+    int8_scratch_.input = sycl::malloc_device<int8_t>(elements, sycl_queue_);
+    int8_scratch_.row_scales =
+        sycl::malloc_device<float>(int8_scratch_.rows, sycl_queue_);
+    int8_scratch_.accum = sycl::malloc_device<int32_t>(elements, sycl_queue_);
+  }
   float alpha = (float)pow(2.0 * num_encoders, -0.25);
   for (const auto& enc : weights.encoder) {
     EncoderBlock<DataType>* pW = new EncoderBlock<DataType>(
         enc, scratch, encoder_head_count_, embedding_op_size_, alpha,
         smolgen_global_, smolgen_global_size_, max_batch_size,
         activations_.smolgen_activation, activations_.ffn_activation,
-        is_pe_dense_embedding_ ? 1e-3 : 1e-6, sycl_queue_);
+        is_pe_dense_embedding_ ? 1e-3 : 1e-6, sycl_queue_,
+        int8_scratch_.input ? &int8_scratch_ : nullptr);
 
     encoder_weights_.emplace_back(pW);
   }
@@ -2531,6 +2677,16 @@ AttentionBody<DataType>::~AttentionBody() {
     sycl::free(smolgen_global_, sycl_queue_);
   }
   for (const auto pEnc : encoder_weights_) delete pEnc;
+  if (int8_scratch_.input) {
+    sycl::free(int8_scratch_.input, sycl_queue_);
+    sycl::free(int8_scratch_.row_scales, sycl_queue_);
+    sycl::free(int8_scratch_.accum, sycl_queue_);
+  }
+}
+
+template <typename DataType>
+void AttentionBody<DataType>::SetInt8Ffn(bool enable) {
+  for (const auto pEnc : encoder_weights_) pEnc->SetInt8Ffn(enable);
 }
 
 template <typename DataType>
@@ -2543,9 +2699,7 @@ void AttentionBody<DataType>::Eval(int N, DataType* output,
 
   //CERR << "AttentionBody<DataType>::Eval. ";
 
-  DataType* output_tensor = (DataType*)output;
   DataType* buffer1 = (DataType*)input2;
-  DataType* buffer2 = buffer1 + scratch_size / (2 * sizeof(DataType));
 
   int inputC = input_c_;
   if (num_resi_blocks_ == 0) {
@@ -2580,7 +2734,6 @@ void AttentionBody<DataType>::Eval(int N, DataType* output,
       inputPreprocessForAttentionBody((DataType*)scratch, input, buffer1, N,
                                       kInputPlanes, embedding_dense_size_, true,
                                       sycl_queue);
-      inputC += embedding_dense_size_;
     } else {
       /*
       flow = tf.transpose(inputs, perm=[0, 2, 3, 1])
@@ -2594,7 +2747,6 @@ void AttentionBody<DataType>::Eval(int N, DataType* output,
       inputPreprocessForAttentionBody((DataType*)scratch, input, pos_encoding_,
                                       N, kInputPlanes, kNumPosEncodingChannels,
                                       false, sycl_queue);
-      inputC += kNumPosEncodingChannels;
     }
   } else {
     // #redirect flow through encoder blocks
@@ -2602,6 +2754,63 @@ void AttentionBody<DataType>::Eval(int N, DataType* output,
     // flow = tf.reshape(flow, [ -1, 64, self.RESIDUAL_FILTERS ])
     convertNCHWtoNHWC((DataType*)scratch, input, N, inputC, N, inputC, 8, 8, sycl_queue);
   }
+  EvalPreprocessed(N, output, input2, scratch, scratch_size, sycl_queue,
+                   offset_pointers);
+}
+
+template <typename DataType>
+void AttentionBody<DataType>::EvalFromPlanes(
+    int N, DataType* output, const uint64_t* masks, const float* values,
+    const DataType* input2, void* scratch, size_t scratch_size,
+    sycl::queue& sycl_queue, DataType*** offset_pointers) {
+  assert(num_resi_blocks_ == 0 && input_c_ == kInputPlanes);
+  DataType* buffer1 = (DataType*)input2;
+
+  if (is_pe_dense_embedding_) {
+    // The same as in Eval(), with the 12 channel slice expanded straight into
+    // the NHWC layout.
+    const int num_outputs = 64 * embedding_dense_size_;
+    const int num_inputs = 64 * 12;
+    const int batch = N;
+
+    expandPlanesNHWC((DataType*)scratch, masks, values, N, 12, sycl_queue);
+    cublasXgemm<DataType>(
+        transpose_type_transpose, transpose_type_notranspose, num_outputs,
+        batch, num_inputs, 1.0f, (const DataType*)ip_emb_pre_w_, num_inputs,
+        (const DataType*)scratch, num_inputs, 0.0f, buffer1, num_outputs,
+        sycl_queue);
+    const int size = num_outputs * N;
+    addVectors(buffer1, buffer1, ip_emb_pre_b_, size, size, num_outputs,
+               ACTIVATION_NONE, sycl_queue);
+    inputPreprocessPlanesForAttentionBody((DataType*)scratch, masks, values,
+                                          (const DataType*)buffer1, N,
+                                          kInputPlanes, embedding_dense_size_,
+                                          true, sycl_queue);
+  } else {
+    inputPreprocessPlanesForAttentionBody(
+        (DataType*)scratch, masks, values, (const DataType*)pos_encoding_, N,
+        kInputPlanes, kNumPosEncodingChannels, false, sycl_queue);
+  }
+  EvalPreprocessed(N, output, input2, scratch, scratch_size, sycl_queue,
+                   offset_pointers);
+}
+
+template <typename DataType>
+void AttentionBody<DataType>::EvalPreprocessed(int N, DataType* output,
+                                               const DataType* input2,
+                                               void* scratch,
+                                               size_t scratch_size,
+                                               sycl::queue& sycl_queue,
+                                               DataType*** offset_pointers) {
+  DataType* output_tensor = (DataType*)output;
+  DataType* buffer1 = (DataType*)input2;
+  DataType* buffer2 = buffer1 + scratch_size / (2 * sizeof(DataType));
+
+  int inputC = input_c_;
+  if (num_resi_blocks_ == 0) {
+    inputC += is_pe_dense_embedding_ ? embedding_dense_size_
+                                     : kNumPosEncodingChannels;
+  }
 
   if (is_pe_dense_embedding_) {
     // 1. square embedding (fully connected layer)
@@ -22,8 +22,6 @@
 #pragma once
 
 #include <sycl/sycl.hpp>
-#include "dpct/dpct.hpp"
-#include "dpct/blas_utils.hpp"
 
 #include <cstddef>
 
@@ -186,8 +184,18 @@ class FusedWinogradConvSELayer : public BaseLayer<DataType> {
   void Eval(int N, DataType* output, const DataType* input,
             const DataType* input2, void* scratch, size_t scratch_size,
             sycl::queue &sycl_queue, DataType*** = nullptr) override;
+  // Same as Eval() with the input being the expanded input planes, which are
+  // read packed (c_input_ masks and values per position) instead.
+  void EvalFromPlanes(int N, DataType* output, const uint64_t* masks,
+                      const float* values, void* scratch, size_t scratch_size,
+                      sycl::queue& sycl_queue);
 
  private:
+  // The gemm and the output transform, after the input transform.
+  void EvalTransformed(int N, DataType* output, DataType* transformed_input,
+                       DataType* transformed_output, const DataType* input2,
+                       sycl::queue& sycl_queue);
+
   const int c_input_;
   const ActivationFunction act_;
   const bool use_bias_;
@@ -286,6 +294,15 @@ class ResidualBlock : public BaseLayer<DataType> {
   DataType* b2_;
 };
 
+// Device scratch for the int8 FFN gemms, shared by all encoder blocks of an
+// attention body. The gemms are done in chunks of at most |rows| rows.
+struct Int8FfnScratch {
+  int8_t* input = nullptr;      // quantized activations
+  float* row_scales = nullptr;  // activation scale per row
+  int32_t* accum = nullptr;     // raw gemm output
+  int rows = 0;
+};
+
 template <typename DataType>
 class EncoderBlock {
  public:
@@ -293,9 +310,13 @@ class EncoderBlock {
                int heads, int size, float alpha,
                DataType* smolgen_global_scratch, int smolgen_global_size,
                int max_batch_size, ActivationFunction smolgen_act,
-               ActivationFunction ffn_act, float default_eps, sycl::queue &sycl_queue);
+               ActivationFunction ffn_act, float default_eps, sycl::queue &sycl_queue,
+               Int8FfnScratch* int8_scratch = nullptr);
   ~EncoderBlock();
 
+  // Only has an effect if the block was created with int8 scratch.
+  void SetInt8Ffn(bool enable) { use_int8_ffn_ = enable && int8_scratch_; }
+
   void Eval(int N, DataType* inpop, DataType* scratch0, DataType* scratch1,
             DataType* scratch2, sycl::queue &sycl_queue,
             DataType*** offset_pointers);
@@ -314,6 +335,10 @@ class EncoderBlock {
 
   DataType *ln2_gammas, *ln2_betas;
 
+  // int8 copies of the FFN weights with one scale per output channel.
+  int8_t *ffn_dense1_w_int8 = nullptr, *ffn_dense2_w_int8 = nullptr;
+  float *ffn_dense1_scales = nullptr, *ffn_dense2_scales = nullptr;
+
   DataType *smol_compress;
   DataType *smol_dense1_w, *smol_dense1_b;
   DataType *smol_dense2_w, *smol_dense2_b;
@@ -347,6 +372,12 @@ class EncoderBlock {
 
   const int max_batch_size_;
 
+  // Attention in one kernel, without the heads x 64 x 64 logits in memory.
+  bool use_fused_mha_;
+
+  Int8FfnScratch* int8_scratch_;
+  bool use_int8_ffn_;
+
   sycl::queue sycl_queue_;
 };
 
@@ -439,8 +470,11 @@ class AttentionBody : public BaseLayer<DataType> {
   AttentionBody(const MultiHeadWeights& weights, void* scratch,
                 Activations activations, int num_res_blocks, int input_c,
                 int max_batch_size, bool is_pe_dense_embedding,
-                sycl::queue &sycl_queue);
+                sycl::queue &sycl_queue, bool int8_ffn = false);
   ~AttentionBody();
+
+  // Switches the encoder FFNs between int8 and full precision gemms.
+  void SetInt8Ffn(bool enable);
   //void Eval(int N, DataType* output, const DataType* input,
   //          const DataType* input2, void* scratch, size_t scratch_size,
   //          cudnnHandle_t cudnn, dpct::queue_ptr cublas, dpct::queue_ptr stream,
@@ -449,8 +483,20 @@ class AttentionBody : public BaseLayer<DataType> {
   void Eval(int N, DataType* output, const DataType* input,
             const DataType* input2, void* scratch, size_t scratch_size,
             sycl::queue &sycl_queue, DataType*** = nullptr) override;
+  // Same as Eval() for a net without residual blocks, with the input planes
+  // read packed (a mask and a value per plane) instead of expanded.
+  void EvalFromPlanes(int N, DataType* output, const uint64_t* masks,
+                      const float* values, const DataType* input2,
+                      void* scratch, size_t scratch_size,
+                      sycl::queue& sycl_queue, DataType*** = nullptr);
 
  private:
+  // Eval() after the input preprocessing, with the embedding input in
+  // @scratch.
+  void EvalPreprocessed(int N, DataType* output, const DataType* input2,
+                        void* scratch, size_t scratch_size,
+                        sycl::queue& sycl_queue, DataType*** offset_pointers);
+
   // GPU allocations to hold various weights used by the attention net body.
   DataType *ip_emb_pre_w_, *ip_emb_pre_b_;  // input position preprocessing weights.
   DataType *ip_emb_w_, *ip_emb_b_;          // "embedding" layer in net body
@@ -468,6 +514,7 @@ class AttentionBody : public BaseLayer<DataType> {
   int embedding_ffn_dff_;
   int encoder_head_count_;
   std::vector<EncoderBlock<DataType>*> encoder_weights_;
+  Int8FfnScratch int8_scratch_;
   Activations activations_;
   int num_resi_blocks_;
   int input_c_;
@@ -0,0 +1,148 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+   
+  SPDX-License-Identifier:GNU General Public License v3.0 or later
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sycl/sycl.hpp>
+
+#include "utils/exception.h"
+
+namespace lczero {
+namespace sycldnn_backend {
+
+// USM allocations of a network and its InputsOutputs. Freed blocks are kept
+// on a free list of their size class and handed out again, so that they are
+// neither allocated nor zeroed again. Everything is released when the pool
+// is destroyed.
+class UsmMemoryPool {
+ public:
+  // @device_limit is the most device memory the pool may hold, 0 for no limit.
+  UsmMemoryPool(const sycl::queue& queue, size_t device_limit)
+      : device_(queue.get_device()),
+        context_(queue.get_context()),
+        device_limit_(device_limit) {}
+
+  ~UsmMemoryPool() {
+    for (const auto& [ptr, block] : blocks_) sycl::free(ptr, context_);
+  }
+
+  UsmMemoryPool(const UsmMemoryPool&) = delete;
+  UsmMemoryPool& operator=(const UsmMemoryPool&) = delete;
+
+  // Returns a block of at least @count elements. Sets @fresh (if not null) to
+  // whether the block was just allocated, rather than reused.
+  template <typename T>
+  T* Allocate(sycl::usm::alloc kind, size_t count, bool* fresh = nullptr) {
+    return static_cast<T*>(AllocateBytes(kind, count * sizeof(T), fresh));
+  }
+
+  void* AllocateBytes(sycl::usm::alloc kind, size_t bytes,
+                      bool* fresh = nullptr) {
+    const size_t size = SizeClass(bytes);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& free_list = free_[{kind, size}];
+    if (fresh) *fresh = free_list.empty();
+    void* ptr;
+    if (!free_list.empty()) {
+      ptr = free_list.back();
+      free_list.pop_back();
+    } else {
+      if (kind == sycl::usm::alloc::device && device_limit_ &&
+          reserved_[kind] + size > device_limit_) {
+        throw Exception("SYCL device memory limit of " +
+                        std::to_string(device_limit_ >> 20) +
+                        " MiB exceeded.");
+      }
+      ptr = sycl::malloc(size, device_, context_, kind);
+      if (!ptr) {
+        throw Exception("Unable to allocate " + std::to_string(size >> 20) +
+                        " MiB of SYCL memory.");
+      }
+      blocks_[ptr] = {kind, size};
+      reserved_[kind] += size;
+    }
+    in_use_[kind] += size;
+    peak_[kind] = std::max(peak_[kind], in_use_[kind]);
+    return ptr;
+  }
+
+  // Returns a block to its free list. Null is ignored.
+  void Free(void* ptr) {
+    if (!ptr) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto iter = blocks_.find(ptr);
+    if (iter == blocks_.end()) {
+      throw Exception("Freeing memory not allocated by the pool.");
+    }
+    const Block& block = iter->second;
+    in_use_[block.kind] -= block.size;
+    free_[{block.kind, block.size}].push_back(ptr);
+  }
+
+  // Bytes allocated from the driver (in use or on a free list).
+  size_t reserved(sycl::usm::alloc kind) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto iter = reserved_.find(kind);
+    return iter == reserved_.end() ? 0 : iter->second;
+  }
+  // Most bytes in use at the same time.
+  size_t peak(sycl::usm::alloc kind) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto iter = peak_.find(kind);
+    return iter == peak_.end() ? 0 : iter->second;
+  }
+
+ private:
+  struct Block {
+    sycl::usm::alloc kind;
+    size_t size;
+  };
+
+  // Sizes are rounded up to 4 KiB, and above that to an eighth of their
+  // power of two, which wastes at most 12.5% on the big activation buffers.
+  static size_t SizeClass(size_t bytes) {
+    constexpr size_t kMinSize = 4096;
+    if (bytes <= kMinSize) return kMinSize;
+    const size_t step = std::bit_floor(bytes) / 8;
+    return (bytes + step - 1) / step * step;
+  }
+
+  const sycl::device device_;
+  const sycl::context context_;
+  const size_t device_limit_;
+
+  mutable std::mutex mutex_;
+  std::unordered_map<void*, Block> blocks_;
+  std::map<std::pair<sycl::usm::alloc, size_t>, std::vector<void*>> free_;
+  std::map<sycl::usm::alloc, size_t> reserved_;
+  std::map<sycl::usm::alloc, size_t> in_use_;
+  std::map<sycl::usm::alloc, size_t> peak_;
+};
+
+}  // namespace sycldnn_backend
+}  // namespace lczero
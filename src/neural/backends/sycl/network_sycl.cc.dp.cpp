@@ -19,36 +19,82 @@
   SPDX-License-Identifier:GNU General Public License v3.0 or later
 */
 
-#define DPCT_COMPAT_RT_VERSION 12020
-
 #include <sycl/sycl.hpp>
-#include "dpct/dpct.hpp"
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <functional>
 #include <list>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <thread>
+#include <vector>
 
 #include "sycl_common.h"
 #include "inputs_outputs.h"
 #include "kernels.h"
 #include "layers.h"
+#include "memory_pool.h"
+#include "tuner.h"
+#include "chess/position.h"
 #include "neural/backends/shared/activation.h"
+#include "neural/encoder.h"
 #include "neural/factory.h"
 #include "neural/network_legacy.h"
 #include "neural/tables/attention_policy_map.h"
 #include "neural/tables/policy_map.h"
 #include "utils/bititer.h"
 #include "utils/exception.h"
+#include "utils/filesystem.h"
+#include "utils/string.h"
 #include <cmath>
 
+#ifdef LC0_SYCL_LEVEL_ZERO
+#include <level_zero/ze_api.h>
+
+#include <sycl/ext/oneapi/backend/level_zero.hpp>
+#endif
+
 namespace lczero {
 using namespace sycldnn_backend;
 
 template <typename DataType>
 class SyclNetwork;
 
+// The devices the "gpu" option indexes: the default device first, then the
+// others in platform order (the order the DPCT device manager used to have).
+// With @tiles, partitionable devices (e.g. the stacks of a Data Center GPU Max)
+// are replaced by their sub-devices, so that each tile is a separate GPU.
+static std::vector<sycl::device> GetSyclDevices(bool tiles) {
+  std::vector<sycl::device> all_devices{sycl::device(sycl::default_selector_v)};
+  for (const auto& device : sycl::device::get_devices()) {
+    if (device != all_devices[0]) all_devices.push_back(device);
+  }
+  std::vector<sycl::device> devices;
+  for (const auto& device : all_devices) {
+    if (tiles &&
+        device.get_info<sycl::info::device::partition_max_sub_devices>() > 1) {
+      try {
+        for (const auto& sub_device : device.create_sub_devices<
+                 sycl::info::partition_property::partition_by_affinity_domain>(
+                 sycl::info::partition_affinity_domain::next_partitionable)) {
+          devices.push_back(sub_device);
+        }
+        continue;
+      } catch (const sycl::exception&) {
+        // Not partitionable by affinity domain, use the whole device.
+      }
+    }
+    devices.push_back(device);
+  }
+  return devices;
+}
+
 static size_t getMaxAttentionHeadSize(
     const MultiHeadWeights::PolicyHead& weights, int N) {
   const size_t embedding_op_size = weights.ip_pol_b.size();
@@ -85,6 +131,49 @@ static size_t getMaxAttentionHeadSize(
   return size;
 }
 
+// Bytes the fused residual blocks work on: the transformed input and output
+// and the untransformed skip connection.
+static size_t getResBlockMemSize(int N, int C, size_t data_size) {
+  const size_t pre_transform_tensor_size = (size_t)N * C * 8 * 8 * data_size;
+  const size_t transformed_tensor_size = pre_transform_tensor_size * 36 / 16;
+  return transformed_tensor_size * 2 + pre_transform_tensor_size;
+}
+
+// Reserves @bytes of the last level cache of the device of @queue. Only
+// possible through Level Zero with the cache reservation extension.
+static bool ReserveL2Cache(sycl::queue& queue, size_t bytes) {
+#ifdef LC0_SYCL_LEVEL_ZERO
+  if (queue.get_device().get_backend() !=
+      sycl::backend::ext_oneapi_level_zero) {
+    return false;
+  }
+  auto device = sycl::get_native<sycl::backend::ext_oneapi_level_zero>(
+      queue.get_device());
+  return zeDeviceReserveCacheExt(device, 0, bytes) == ZE_RESULT_SUCCESS;
+#else
+  (void)queue;
+  (void)bytes;
+  return false;
+#endif
+}
+
+// Marks [@ptr, @ptr + @bytes) to be kept in the reserved part of the cache.
+static void AdviseL2Resident(sycl::queue& queue, void* ptr, size_t bytes) {
+#ifdef LC0_SYCL_LEVEL_ZERO
+  auto device = sycl::get_native<sycl::backend::ext_oneapi_level_zero>(
+      queue.get_device());
+  if (zeDeviceSetCacheAdviceExt(device, ptr, bytes,
+                                ZE_CACHE_EXT_REGION_ZE_CACHE_RESERVE_REGION) !=
+      ZE_RESULT_SUCCESS) {
+    CERR << "WARNING: Unable to keep the residual block activations in L2.";
+  }
+#else
+  (void)queue;
+  (void)ptr;
+  (void)bytes;
+#endif
+}
+
 static size_t getMaxAttentionBodySize(const MultiHeadWeights& weights, int N) {
   const size_t embedding_op_size = weights.ip_emb_b.size();
 
@@ -126,21 +215,55 @@ class SyclNetworkComputation : public NetworkComputation {
   ~SyclNetworkComputation();
 
   void AddInput(InputPlanes&& input) override {
-    const auto iter_mask =
-        &inputs_outputs_->input_masks_mem_shared_[batch_size_ * kInputPlanes];
-    const auto iter_val =
-        &inputs_outputs_->input_val_mem_shared_[batch_size_ * kInputPlanes];
+    CopyInput(input);
+    AddWrittenInput();
+  }
 
-    int i = 0;
-    for (const auto& plane : input) {
-      iter_mask[i] = plane.mask;
-      iter_val[i] = plane.value;
-      i++;
+  InputPlanesView GetInputBuffer(int sample) override {
+    if (sample >= inputs_outputs_->max_batch_size_) return {};
+    return {&inputs_outputs_->input_masks_mem_shared_[sample * kInputPlanes],
+            &inputs_outputs_->input_val_mem_shared_[sample * kInputPlanes]};
+  }
+
+  void AddWrittenInput() override {
+    if (inputs_outputs_->policy_counts_) {
+      inputs_outputs_->policy_counts_[batch_size_] = 0;
     }
 
     batch_size_++;
   }
 
+  bool SupportsLegalMovesPolicy() const override {
+    return inputs_outputs_->policy_counts_ != nullptr;
+  }
+
+  void AddInputWithLegalMoves(InputPlanes&& input,
+                              std::span<const uint16_t> policy_indices,
+                              float inv_temperature) override {
+    CopyInput(input);
+    AddWrittenInputWithLegalMoves(policy_indices, inv_temperature);
+  }
+
+  void AddWrittenInputWithLegalMoves(std::span<const uint16_t> policy_indices,
+                                     float inv_temperature) override {
+    if (policy_indices.size() > kMaxLegalMoves) {
+      throw Exception("Too many legal moves for the policy softmax");
+    }
+    AddWrittenInput();
+    const int sample = batch_size_ - 1;
+    std::copy(policy_indices.begin(), policy_indices.end(),
+              &inputs_outputs_->policy_indices_[sample * kMaxLegalMoves]);
+    inputs_outputs_->policy_counts_[sample] = policy_indices.size();
+    inputs_outputs_->policy_inv_temperatures_[sample] = inv_temperature;
+    inputs_outputs_->legal_moves_batch_ = true;
+  }
+
+  void GetLegalMovesPolicy(int sample, std::span<float> dst) const override {
+    const float* priors =
+        &inputs_outputs_->op_legal_policy_mem_[sample * kMaxLegalMoves];
+    std::copy(priors, priors + dst.size(), dst.begin());
+  }
+
   void ComputeBlocking() override;
 
   int GetBatchSize() const override { return batch_size_; }
@@ -174,6 +297,21 @@ class SyclNetworkComputation : public NetworkComputation {
   }
 
  private:
+  // Writes @input to the input buffer of the next sample.
+  void CopyInput(const InputPlanes& input) {
+    const auto iter_mask =
+        &inputs_outputs_->input_masks_mem_shared_[batch_size_ * kInputPlanes];
+    const auto iter_val =
+        &inputs_outputs_->input_val_mem_shared_[batch_size_ * kInputPlanes];
+
+    int i = 0;
+    for (const auto& plane : input) {
+      iter_mask[i] = plane.mask;
+      iter_val[i] = plane.value;
+      i++;
+    }
+  }
+
   // Memory holding inputs, outputs.
   std::unique_ptr<InputsOutputs> inputs_outputs_;
   int batch_size_;
@@ -186,12 +324,15 @@ class SyclNetworkComputation : public NetworkComputation {
 template <typename DataType>
 class SyclNetwork : public Network {
  public:
-  SyclNetwork(const WeightsFile& file, const OptionsDict& options)
+  // @gpu_id overrides the "gpu" option when not negative. With @context, the
+  // queue is created in that (shared) context instead of a context of its own.
+  SyclNetwork(const WeightsFile& file, const OptionsDict& options,
+              int gpu_id = -1, const sycl::context* context = nullptr)
       : capabilities_{file.format().network_format().input(),
                       file.format().network_format().output(),
                       file.format().network_format().moves_left()} {
     MultiHeadWeights weights(file.weights());
-    gpu_id_ = options.GetOrDefault<int>("gpu", 0);
+    gpu_id_ = gpu_id >= 0 ? gpu_id : options.GetOrDefault<int>("gpu", 0);
 
     const auto nf = file.format().network_format();
     using NF = pblczero::NetworkFormat;
@@ -204,15 +345,15 @@ class SyclNetwork : public Network {
 
     
 
-    int total_gpus = dpct::dev_mgr::instance().device_count();
+    const auto devices =
+        GetSyclDevices(options.GetOrDefault<bool>("tiles", false));
 
-    if (gpu_id_ >= total_gpus)
+    if (gpu_id_ < 0 || gpu_id_ >= static_cast<int>(devices.size()))
       throw Exception("Invalid GPU Id: " + std::to_string(gpu_id_));
 
     
-    //dpct::dev_mgr::instance().get_device(gpu_id_).get_device_info(deviceProp);
 
-    sycl_queue_ = new sycl::queue{dpct::dev_mgr::instance().get_device(gpu_id_), [] (sycl::exception_list exceptions) {
+    const auto exception_handler = [] (sycl::exception_list exceptions) {
 
         for (std::exception_ptr const& e : exceptions) {
                     try {
@@ -223,27 +364,105 @@ class SyclNetwork : public Network {
                         }
              
                  }
-    },  sycl::property_list{sycl::property::queue::in_order{}}};
+    };
+    const sycl::property_list queue_properties{
+        sycl::property::queue::in_order{}};
+    sycl_queue_ =
+        context ? new sycl::queue{*context, devices[gpu_id_],
+                                  exception_handler, queue_properties}
+                : new sycl::queue{devices[gpu_id_], exception_handler,
+                                  queue_properties};
+    compute_units_ = std::max<int>(
+        1, devices[gpu_id_].get_info<sycl::info::device::max_compute_units>());
+
+    // Activation and input/output buffers of the network and of all its
+    // computations (not the weights). max_memory (in MiB) caps the device part.
+    memory_pool_ = std::make_unique<UsmMemoryPool>(
+        *sycl_queue_, (size_t)options.GetOrDefault<int>("max_memory", 0) << 20);
 
     showDeviceInfo(*sycl_queue_);
 
-    l2_cache_size_ =  sycl_queue_->get_device().get_info<sycl::info::device::local_mem_size>();
+    // Integrated GPUs share physical memory with the host, so the kernels
+    // can read the inputs and write the outputs in host USM directly.
+    zero_copy_ = options.GetOrDefault<bool>("zero_copy", true) &&
+                 sycl_queue_->get_device()
+                     .get_info<sycl::info::device::host_unified_memory>();
+    if (zero_copy_) CERR << "Using zero-copy host memory for inputs/outputs.";
+
+    // Softmax the policy of the legal moves on the device, so only those
+    // priors are returned (for callers using AddInputWithLegalMoves).
+    legal_moves_policy_ = options.GetOrDefault<bool>("device_policy", false);
+
+    // Separate in-order queues for host<->device transfers. Each
+    // InputsOutputs gets one of them (round robin), so the upload of the next
+    // batch and the readback of the previous one overlap with the compute.
+    int num_copy_queues = options.GetOrDefault<int>("copy_queues", 0);
+    if (num_copy_queues > 0 && zero_copy_) {
+      CERR << "WARNING: copy_queues has no effect with zero_copy.";
+      num_copy_queues = 0;
+    }
+    for (int i = 0; i < num_copy_queues; i++) {
+      copy_queues_.push_back(std::make_unique<sycl::queue>(
+          sycl_queue_->get_context(), sycl_queue_->get_device(),
+          sycl::property_list{sycl::property::queue::in_order{}}));
+    }
+
+    // local_mem_size is the SLM of a work-group (shared memory in CUDA terms),
+    // the last level cache is reported as the global memory cache.
+    shared_mem_size_ =
+        sycl_queue_->get_device().get_info<sycl::info::device::local_mem_size>();
+    l2_cache_size_ = sycl_queue_->get_device()
+                         .get_info<sycl::info::device::global_mem_cache_size>();
 
     allow_cache_opt_ = options.GetOrDefault<bool>("cache_opt", false);
 
     // Select GPU to run on (for *the current* thread).
     multi_stream_ = options.GetOrDefault<bool>("multi_stream", false);
 
+    // Wait for the queue after every head layer (old behaviour, for
+    // debugging). By default the forward pass is one dependency chain.
+    sync_layers_ = options.GetOrDefault<bool>("sync_layers", false);
+
+    // Record the forward pass into a command graph per batch size bucket and
+    // replay it, to save the launch overhead of the many small kernels.
+    use_graphs_ = options.GetOrDefault<bool>("graphs", false);
+#ifdef SYCL_EXT_ONEAPI_GRAPH
+    if (use_graphs_ && sync_layers_) {
+      CERR << "WARNING: sync_layers has no effect with graphs.";
+      sync_layers_ = false;
+    }
+#else
+    if (use_graphs_) {
+      CERR << "WARNING: SYCL command graphs are not supported by this "
+              "compiler, disabling.";
+      use_graphs_ = false;
+    }
+#endif
+
+    // Run the encoder FFN gemms with int8 weights and activations. Checked
+    // against full precision at startup and dropped if the outputs drift.
+    use_int8_ = options.GetOrDefault<bool>("int8", false);
+#if defined(USE_CUBLAS) || defined(USE_HIPBLAS)
+    if (use_int8_) {
+      CERR << "WARNING: int8 is only supported with oneMKL, disabling.";
+      use_int8_ = false;
+    }
+#endif
+    if (use_int8_ && multi_stream_) {
+      CERR << "WARNING: int8 is not supported with multi_stream, disabling.";
+      use_int8_ = false;
+    }
+
     // layout used by cuda backend is nchw.
     has_tensor_cores_ = false;
     constexpr bool fp16 = std::is_same<sycl::half, DataType>::value;
 
-    //dpct::device_info deviceProp = {};
-    //sycl_queue_->get_device().get_device_info(deviceProp);
 
 
     if (fp16) {
-      dpct::has_capability_or_fail(sycl_queue_->get_device(), {sycl::aspect::fp16});
+      if (!sycl_queue_->get_device().has(sycl::aspect::fp16)) {
+        throw Exception("The device doesn't support fp16.");
+      }
         CERR << "Using Fp16 "; 
     } else {
         CERR << "Using Fp32 ";
@@ -258,6 +477,28 @@ class SyclNetwork : public Network {
     if (attn_body_) {
       assert(weights.ip_emb_b.size() > 0);
     }
+    network_format_ = nf.OutputAsString();
+    embedding_size_ = attn_body_ ? (int)weights.ip_emb_b.size() : kNumFilters;
+
+    // Pick work-group sizes for this device and network shape, benchmarking
+    // them on first use (results are kept in the tuner file).
+    if (options.GetOrDefault<bool>("tune", true)) {
+      std::string tuner_file;
+      if (options.IsDefault<std::string>("tuner_file")) {
+        std::string user_cache_path = GetUserCacheDirectory();
+        if (!user_cache_path.empty()) {
+          user_cache_path += "lc0/";
+          CreateDirectory(user_cache_path);
+        }
+        tuner_file = user_cache_path + "lc0_sycl_tuning";
+      } else {
+        tuner_file = options.Get<std::string>("tuner_file");
+      }
+      LoadOrTuneKernelLocalSizes<DataType>(
+          *sycl_queue_, std::min(max_batch_size_, 256), numBlocks_ ? kNumFilters : 0,
+          attn_body_ ? (int)weights.ip_emb_b.size() : 0, tuner_file,
+          options.GetOrDefault<bool>("force_tune", false));
+    }
 
     // Warn if the memory required for storing transformed weights is
     // going to exceed 40% of total video memory, force custom_winograd off
@@ -275,25 +516,6 @@ class SyclNetwork : public Network {
               "using a smaller network.";
     }
 
-    // Disable res block fusing for fp32 for now (not worth it)
-    // TODO: make it work for filters not a multiple of 32.
-    // Note that when used with SE, the optimization
-    // works only when filter count is <= 384 (pre-Ampere), or less than 512
-    // (Ampere)
-    // It turns dynamically off based on filter count (see
-    // ResidualBlock<DataType>::Eval)
-    // TODO: fix res_block_fusing.
-    if (kNumFilters % 32 == 0 && std::is_same<sycl::half, DataType>::value) {
-      use_res_block_winograd_fuse_opt_ = false;
-    } else {
-      use_res_block_winograd_fuse_opt_ = false;
-    }
-    // Override if set in backend-opts.
-#if  0
-    if (!options.IsDefault<bool>("res_block_fusing")) {
-      use_res_block_winograd_fuse_opt_ = options.Get<bool>("res_block_fusing");
-    }
-#endif
     /*
     DPCT1005:86: The SYCL device version is different from CUDA Compute
     Compatibility. You may need to rewrite this code.
@@ -305,6 +527,21 @@ class SyclNetwork : public Network {
       has_se_ = true;
     }
 
+    // Fuse the output transform of each convolution with the input transform
+    // of the next one, so the untransformed activations only go to memory
+    // for the skip connection. The kernel handles any filter count that is a
+    // multiple of 16, in fp16 and fp32.
+    // Nets with SE are not fused: the fused SE kernels still assume CUDA
+    // shared memory limits, so their residual blocks run as separate
+    // convolution layers.
+    use_res_block_winograd_fuse_opt_ =
+        numBlocks_ > 0 && !has_se_ && kNumFilters % 16 == 0;
+    // Allow turning it off in backend-opts.
+    if (use_res_block_winograd_fuse_opt_) {
+      use_res_block_winograd_fuse_opt_ =
+          options.GetOrDefault<bool>("res_block_fusing", true);
+    }
+
     // Have some minumum as we also use this for transforming weights.
     size_t max_weight_size = 128 * 1024 * 1024;
 
@@ -325,24 +562,22 @@ class SyclNetwork : public Network {
       scratch_size_ = std::max(scratch_size_, 2 * transformed_tensor_size);
     }
 
-    std::string policy_head =
-        options.GetOrDefault<std::string>("policy_head", "vanilla");
+    policy_head_ = options.GetOrDefault<std::string>("policy_head", "vanilla");
     // Check that selected policy head exists.
-    if (weights.policy_heads.count(policy_head) == 0) {
-      throw Exception("The policy head you specified '" + policy_head +
+    if (weights.policy_heads.count(policy_head_) == 0) {
+      throw Exception("The policy head you specified '" + policy_head_ +
                       "' does not exist in this net.");
     }
-    std::string value_head =
-        options.GetOrDefault<std::string>("value_head", "winner");
+    value_head_ = options.GetOrDefault<std::string>("value_head", "winner");
     // Check that selected value head exists.
-    if (weights.value_heads.count(value_head) == 0) {
-      throw Exception("The value head you specified '" + value_head +
+    if (weights.value_heads.count(value_head_) == 0) {
+      throw Exception("The value head you specified '" + value_head_ +
                       "' does not exist in this net.");
     }
 
     // Attention policy head or body may need more memory
     const size_t attentionPolicySize =
-        getMaxAttentionHeadSize(weights.policy_heads.at(policy_head),
+        getMaxAttentionHeadSize(weights.policy_heads.at(policy_head_),
                                 max_batch_size_) *
         sizeof(DataType);
 
@@ -351,26 +586,143 @@ class SyclNetwork : public Network {
     scratch_size_ = std::max(scratch_size_,
                              std::max(attentionPolicySize, attentionBodySize));
 
-    scratch_mem_ = (void*)sycl::malloc_device(scratch_size_, *sycl_queue_);
+    scratch_mem_ = memory_pool_->AllocateBytes(sycl::usm::alloc::device,
+                                               scratch_size_);
 
     const bool mish_net = file.format().network_format().default_activation() ==
                           pblczero::NetworkFormat::DEFAULT_ACTIVATION_MISH;
 
-    ActivationFunction act = mish_net ? ACTIVATION_MISH : ACTIVATION_RELU;
+    act_ = mish_net ? ACTIVATION_MISH : ACTIVATION_RELU;
+
+    wdl_ = file.format().network_format().value() ==
+           pblczero::NetworkFormat::VALUE_WDL;
+    moves_left_ = (file.format().network_format().moves_left() ==
+                   pblczero::NetworkFormat::MOVES_LEFT_V1) &&
+                  options.GetOrDefault<bool>("mlh", true);
 
     // 2. Build the network, and copy the weights to GPU memory.
+    Layers layers = BuildLayers(file, weights, scratch_mem_);
+    network_ = std::move(layers.network);
+    resi_last_ = layers.resi_last;
+    encoder_last_ = layers.encoder_last;
+    attention_body_ = layers.attention_body;
 
+    // 3. Allocate GPU memory for running the network:
+    //    - three buffers of max size are enough (one to hold input, second to
+    //      hold output and third to hold skip connection's input).
+
+    // size of input to the network
+    size_t maxSize = max_batch_size_ * kNumInputPlanes * 64 * sizeof(DataType);
+
+    // take max size of all layers
+    for (auto& layer : network_) {
+      maxSize = std::max(maxSize, layer->GetOutputSize(max_batch_size_));
+    }
+
+    if ((attn_policy_ || use_res_block_winograd_fuse_opt_ || attn_body_) &&
+        (scratch_size_ > maxSize)) {
+      maxSize = scratch_size_;
+    }
+
+    if (!multi_stream_) {
+      for (auto& mem : tensor_mem_) {
+            mem = memory_pool_->Allocate<DataType>(sycl::usm::alloc::device,
+                                                   maxSize / sizeof(DataType));
+            sycl_queue_->memset(mem, 0, maxSize).wait();
+      }
+    }
+
+    tensor_mem_size_ = multi_stream_ ? maxSize : 0;
+
+    // The residual block activations of a batch live at the start of
+    // tensor_mem[2] (see forwardEval()), so that region of each buffer is
+    // what is kept in the reserved cache.
+    if (allow_cache_opt_ && use_res_block_winograd_fuse_opt_) {
+      const size_t res_block_mem = std::min(
+          getResBlockMemSize(max_batch_size_, numFilters_, sizeof(DataType)),
+          l2_cache_size_);
+      l2_reserved_ = ReserveL2Cache(*sycl_queue_, res_block_mem)
+                         ? res_block_mem
+                         : 0;
+      if (l2_reserved_ && !multi_stream_) {
+        AdviseL2Resident(*sycl_queue_, tensor_mem_[2], l2_reserved_);
+      }
+    }
+
+    // pre-allocate InputsOutputs objects (two when copy queues are used, so
+    // that consecutive batches are double-buffered from the start). With
+    // multi_stream, set preallocate to the number of concurrent computations
+    // so that no buffers are allocated and zeroed during search.
+    // The first call to allocate memory, create cublas,
+    // strem, etc takes really long (600 ms)
+    {
+      std::vector<std::unique_ptr<InputsOutputs>> ios;
+      const int preallocate = std::max(
+          1, options.GetOrDefault<int>("preallocate",
+                                       copy_queues_.empty() ? 1 : 2));
+      for (int i = 0; i < preallocate; i++) {
+        ios.push_back(GetInputsOutputs());
+      }
+      // Run each batch size bucket once, so that all the kernels are built
+      // (and specialized to the dimensions of this network) at load time,
+      // not during the first moves. Graphs are recorded per InputsOutputs.
+      if (options.GetOrDefault<bool>("init", true)) {
+        const auto start = std::chrono::steady_clock::now();
+        int runs = 0;
+        for (auto& io : ios) {
+          std::memset(io->input_masks_mem_shared_, 0,
+                      sizeof(uint64_t) * max_batch_size_ * kInputPlanes);
+          std::memset(io->input_val_mem_shared_, 0,
+                      sizeof(float) * max_batch_size_ * kInputPlanes);
+          for (int bucket = 1;; bucket *= 2) {
+            forwardEval(io.get(), std::min(bucket, max_batch_size_));
+            runs++;
+            if (bucket >= max_batch_size_) break;
+          }
+          if (!use_graphs_) break;
+        }
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        CERR << "Warmed up with " << runs << " batches in "
+             << static_cast<int>(elapsed.count() * 1000) << " ms.";
+      }
+      for (auto& io : ios) ReleaseInputsOutputs(std::move(io));
+    }
+    CERR << "Allocated "
+         << memory_pool_->reserved(sycl::usm::alloc::device) / (1 << 20)
+         << " MiB of device and "
+         << memory_pool_->reserved(sycl::usm::alloc::host) / (1 << 20)
+         << " MiB of host memory for activations and inputs/outputs.";
+
+    if (use_int8_ && attention_body_) {
+      CheckInt8Accuracy(options.GetOrDefault<float>("int8_tolerance", 0.1f));
+    }
+  }
+
+  // Layers of the network, with their weights in device memory.
+  struct Layers {
+    std::vector<std::unique_ptr<BaseLayer<DataType>>> network;
+    BaseLayer<DataType>* resi_last = nullptr;
+    BaseLayer<DataType>* encoder_last = nullptr;
+    AttentionBody<DataType>* attention_body = nullptr;
+    BaseLayer<DataType>* last() { return network.back().get(); }
+  };
+
+  // Creates the layers of @weights, using @scratch to transform the weights.
+  Layers BuildLayers(const WeightsFile& file, MultiHeadWeights& weights,
+                     void* scratch) {
+    Layers layers;
     // Input conv only used if there are residual blocks in the network
     if (numBlocks_ > 0) {
       // Input.
       {
         auto inputConv = std::make_unique<FusedWinogradConvSELayer<DataType>>(
-            nullptr, kNumFilters, 8, 8, kNumInputPlanes, act, true, false,
+            nullptr, numFilters_, 8, 8, kInputPlanes, act_, true, false,
             false, 0,  *sycl_queue_, use_res_block_winograd_fuse_opt_);
 
         inputConv->LoadWeights(&weights.input.weights[0],
-                               &weights.input.biases[0], scratch_mem_);
-        network_.emplace_back(std::move(inputConv));
+                               &weights.input.biases[0], scratch);
+        layers.network.emplace_back(std::move(inputConv));
       }
 
       // Residual block.
@@ -378,51 +730,50 @@ class SyclNetwork : public Network {
         bool has_se = weights.residual[block].has_se;
         int se_k = (int)weights.residual[block].se.b1.size();
 
-        /*   
         if (use_res_block_winograd_fuse_opt_) {
           auto layer = std::make_unique<ResidualBlock<DataType>>(
-              getLastLayer(), kNumFilters, has_se, se_k,
-              block == 0, block == (numBlocks_ - 1), act,
-              deviceProp.sharedMemPerBlockOptin);
+              layers.last(), numFilters_, has_se, se_k,
+              block == 0, block == (numBlocks_ - 1), act_,
+              shared_mem_size_, *sycl_queue_);
           layer->LoadWeights0(&weights.residual[block].conv1.weights[0],
                               &weights.residual[block].conv1.biases[0],
-                              scratch_mem_);
+                              scratch);
           layer->LoadWeights1(&weights.residual[block].conv2.weights[0],
                               &weights.residual[block].conv2.biases[0],
-                              scratch_mem_);
+                              scratch);
           if (has_se)
             layer->LoadSEWeights(&weights.residual[block].se.w1[0],
                                  &weights.residual[block].se.b1[0],
                                  &weights.residual[block].se.w2[0],
                                  &weights.residual[block].se.b2[0],
-                                 scratch_mem_);
-          network_.emplace_back(std::move(layer));
-        } else { */
+                                 scratch);
+          layers.network.emplace_back(std::move(layer));
+        } else {
           auto conv1 = std::make_unique<FusedWinogradConvSELayer<DataType>>(
-              getLastLayer(), kNumFilters, 8, 8, kNumFilters, act, true, false,
+              layers.last(), numFilters_, 8, 8, numFilters_, act_, true, false,
               false, 0, *sycl_queue_);
 
           conv1->LoadWeights(&weights.residual[block].conv1.weights[0],
                              &weights.residual[block].conv1.biases[0],
-                             scratch_mem_);
-          network_.emplace_back(std::move(conv1));
+                             scratch);
+          layers.network.emplace_back(std::move(conv1));
 
           auto conv2 = std::make_unique<FusedWinogradConvSELayer<DataType>>(
-              getLastLayer(), kNumFilters, 8, 8, kNumFilters, act, true, true,
+              layers.last(), numFilters_, 8, 8, numFilters_, act_, true, true,
               has_se, se_k, *sycl_queue_);
           conv2->LoadWeights(&weights.residual[block].conv2.weights[0],
                              &weights.residual[block].conv2.biases[0],
-                             scratch_mem_);
+                             scratch);
           if (has_se)
             conv2->LoadSEWeights(&weights.residual[block].se.w1[0],
                                  &weights.residual[block].se.b1[0],
                                  &weights.residual[block].se.w2[0],
                                  &weights.residual[block].se.b2[0],
-                                 scratch_mem_);
-          network_.emplace_back(std::move(conv2));
-        //}
+                                 scratch);
+          layers.network.emplace_back(std::move(conv2));
+        }
       }
-      resi_last_ = getLastLayer();
+      layers.resi_last = layers.last();
     }
 
     if (attn_body_) {
@@ -431,82 +782,83 @@ class SyclNetwork : public Network {
           file.format().network_format().smolgen_activation();
       activations.smolgen_activation =
           smolgen_activation == pblczero::NetworkFormat::ACTIVATION_DEFAULT
-              ? act
+              ? act_
               : static_cast<ActivationFunction>(smolgen_activation);
       const auto ffn_activation =
           file.format().network_format().ffn_activation();
       activations.ffn_activation =
           ffn_activation == pblczero::NetworkFormat::ACTIVATION_DEFAULT
-              ? act
+              ? act_
               : static_cast<ActivationFunction>(ffn_activation);
-      activations.default_activation = act;
+      activations.default_activation = act_;
 
       auto attention_body = std::make_unique<AttentionBody<DataType>>(
-          weights, scratch_mem_, activations, numBlocks_,
-          numBlocks_ > 0 ? kNumFilters : kInputPlanes, max_batch_size_,
+          weights, scratch, activations, numBlocks_,
+          numBlocks_ > 0 ? numFilters_ : kInputPlanes, max_batch_size_,
           static_cast<InputEmbedding>(
               file.format().network_format().input_embedding()) ==
               InputEmbedding::INPUT_EMBEDDING_PE_DENSE,
-          *sycl_queue_);
-      network_.emplace_back(std::move(attention_body));
+          *sycl_queue_, use_int8_);
+      layers.attention_body = attention_body.get();
+      layers.network.emplace_back(std::move(attention_body));
 
-      encoder_last_ = getLastLayer();
+      layers.encoder_last = layers.last();
     }
 
     // Policy head.
     {
-      MultiHeadWeights::PolicyHead& head = weights.policy_heads.at(policy_head);
+      MultiHeadWeights::PolicyHead& head = weights.policy_heads.at(policy_head_);
       if (attn_policy_) {
         auto AttentionPolicy = std::make_unique<AttentionPolicyHead<DataType>>(
-            getLastLayer(), head, scratch_mem_, attn_body_, act,
+            layers.last(), head, scratch, attn_body_, act_,
             max_batch_size_, *sycl_queue_);
-        network_.emplace_back(std::move(AttentionPolicy));
+        layers.network.emplace_back(std::move(AttentionPolicy));
 
         auto policymap = std::make_unique<PolicyMapLayer<DataType>>(
-            getLastLayer(), kNumOutputPolicy, 1, 1, 64 * 64 + 8 * 24, true, *sycl_queue_);
-        policymap->LoadWeights(kAttnPolicyMap, scratch_mem_);
-        network_.emplace_back(std::move(policymap));
+            layers.last(), kNumOutputPolicy, 1, 1, 64 * 64 + 8 * 24, true, *sycl_queue_);
+        policymap->LoadWeights(kAttnPolicyMap, scratch);
+        layers.network.emplace_back(std::move(policymap));
 
       } else {
         if (conv_policy_) {
           assert(!attn_body_);  // not supported with attention body
           auto conv1 = std::make_unique<FusedWinogradConvSELayer<DataType>>(
-              resi_last_, kNumFilters, 8, 8, kNumFilters, act, true, false,
+              layers.resi_last, numFilters_, 8, 8, numFilters_, act_, true, false,
               false, 0, *sycl_queue_);
           conv1->LoadWeights(&head.policy1.weights[0], &head.policy1.biases[0],
-                             scratch_mem_);
-          network_.emplace_back(std::move(conv1));
+                             scratch);
+          layers.network.emplace_back(std::move(conv1));
 
           auto pol_channels = head.policy.biases.size();
 
           // No relu
           auto conv2 = std::make_unique<FusedWinogradConvSELayer<DataType>>(
-              getLastLayer(), pol_channels, 8, 8, kNumFilters, ACTIVATION_NONE,
+              layers.last(), pol_channels, 8, 8, numFilters_, ACTIVATION_NONE,
               true, false, false, 0, *sycl_queue_);
           conv2->LoadWeights(&head.policy.weights[0], &head.policy.biases[0],
-                             scratch_mem_);
-          network_.emplace_back(std::move(conv2));
+                             scratch);
+          layers.network.emplace_back(std::move(conv2));
 
           auto policymap = std::make_unique<PolicyMapLayer<DataType>>(
-              getLastLayer(), kNumOutputPolicy, 1, 1, 73 * 8 * 8, false, *sycl_queue_);
-          policymap->LoadWeights(kConvPolicyMap, scratch_mem_);
+              layers.last(), kNumOutputPolicy, 1, 1, 73 * 8 * 8, false, *sycl_queue_);
+          policymap->LoadWeights(kConvPolicyMap, scratch);
 
-          network_.emplace_back(std::move(policymap));
+          layers.network.emplace_back(std::move(policymap));
         } else {
           assert(!attn_body_);  // not supported with attention body
           auto convPol = std::make_unique<Conv1Layer<DataType>>(
-              resi_last_, head.policy.biases.size(), 8, 8, kNumFilters, act,
+              layers.resi_last, head.policy.biases.size(), 8, 8, numFilters_, act_,
               true, *sycl_queue_);
           convPol->LoadWeights(&head.policy.weights[0], &head.policy.biases[0],
-                               scratch_mem_);
-          network_.emplace_back(std::move(convPol));
+                               scratch);
+          layers.network.emplace_back(std::move(convPol));
 
           auto FCPol = std::make_unique<FCLayer<DataType>>(
-              getLastLayer(), head.ip_pol_b.size(), 1, 1, true,
+              layers.last(), head.ip_pol_b.size(), 1, 1, true,
               ACTIVATION_NONE, *sycl_queue_);
           FCPol->LoadWeights(&head.ip_pol_w[0], &head.ip_pol_b[0],
-                             scratch_mem_);
-          network_.emplace_back(std::move(FCPol));
+                             scratch);
+          layers.network.emplace_back(std::move(FCPol));
         }
       }
     }
@@ -514,96 +866,225 @@ class SyclNetwork : public Network {
     // Value heads.
     {
       const MultiHeadWeights::ValueHead& head =
-          weights.value_heads.at(value_head);
-      wdl_ = file.format().network_format().value() ==
-             pblczero::NetworkFormat::VALUE_WDL;
+          weights.value_heads.at(value_head_);
 
-      BaseLayer<DataType>* lastlayer = attn_body_ ? encoder_last_ : resi_last_;
+      BaseLayer<DataType>* lastlayer = attn_body_ ? layers.encoder_last : layers.resi_last;
       auto value_main = std::make_unique<ValueHead<DataType>>(
-          lastlayer, head, scratch_mem_, attn_body_, wdl_, act,
+          lastlayer, head, scratch, attn_body_, wdl_, act_,
           max_batch_size_, *sycl_queue_);
-      network_.emplace_back(std::move(value_main));
+      layers.network.emplace_back(std::move(value_main));
     }
 
     // Moves left head
-    moves_left_ = (file.format().network_format().moves_left() ==
-                   pblczero::NetworkFormat::MOVES_LEFT_V1) &&
-                  options.GetOrDefault<bool>("mlh", true);
     if (moves_left_) {
       if (attn_body_) {
         auto embedded_mov = std::make_unique<EmbeddingLayer<DataType>>(
-            encoder_last_, weights.ip_mov_w, weights.ip_mov_b, scratch_mem_,
-            act, *sycl_queue_);
-        network_.emplace_back(std::move(embedded_mov));
+            layers.encoder_last, weights.ip_mov_w, weights.ip_mov_b, scratch,
+            act_, *sycl_queue_);
+        layers.network.emplace_back(std::move(embedded_mov));
       } else {
         auto convMov = std::make_unique<Conv1Layer<DataType>>(
-            resi_last_, weights.moves_left.biases.size(), 8, 8, kNumFilters,
-            act, true, *sycl_queue_);
+            layers.resi_last, weights.moves_left.biases.size(), 8, 8, numFilters_,
+            act_, true, *sycl_queue_);
         convMov->LoadWeights(&weights.moves_left.weights[0],
-                             &weights.moves_left.biases[0], scratch_mem_);
-        network_.emplace_back(std::move(convMov));
+                             &weights.moves_left.biases[0], scratch);
+        layers.network.emplace_back(std::move(convMov));
       }
       auto FCMov1 = std::make_unique<FCLayer<DataType>>(
-          getLastLayer(), weights.ip1_mov_b.size(), 1, 1, true, act, *sycl_queue_);
+          layers.last(), weights.ip1_mov_b.size(), 1, 1, true, act_, *sycl_queue_);
       FCMov1->LoadWeights(&weights.ip1_mov_w[0], &weights.ip1_mov_b[0],
-                          scratch_mem_);
-      network_.emplace_back(std::move(FCMov1));
+                          scratch);
+      layers.network.emplace_back(std::move(FCMov1));
 
-      auto FCMov2 = std::make_unique<FCLayer<DataType>>(getLastLayer(), 1, 1, 1,
+      auto FCMov2 = std::make_unique<FCLayer<DataType>>(layers.last(), 1, 1, 1,
                                                         true, ACTIVATION_RELU, *sycl_queue_);
       FCMov2->LoadWeights(&weights.ip2_mov_w[0], &weights.ip2_mov_b[0],
-                          scratch_mem_);
-      network_.emplace_back(std::move(FCMov2));
+                          scratch);
+      layers.network.emplace_back(std::move(FCMov2));
     }
+    return layers;
+  }
 
-    // 3. Allocate GPU memory for running the network:
-    //    - three buffers of max size are enough (one to hold input, second to
-    //      hold output and third to hold skip connection's input).
-
-    // size of input to the network
-    size_t maxSize = max_batch_size_ * kNumInputPlanes * 64 * sizeof(DataType);
-
-    // take max size of all layers
-    for (auto& layer : network_) {
-      maxSize = std::max(maxSize, layer->GetOutputSize(max_batch_size_));
+  bool ReloadWeights(const WeightsFile& file) override {
+    // The int8 FFNs are only checked against full precision at startup.
+    if (use_int8_) return false;
+    const auto& nf = file.format().network_format();
+    if (nf.OutputAsString() != network_format_) return false;
+    MultiHeadWeights weights(file.weights());
+    if ((int)weights.residual.size() != numBlocks_ ||
+        (int)weights.encoder.size() != num_encoder_blocks_ ||
+        (attn_body_ ? weights.ip_emb_b.size() : weights.input.biases.size()) !=
+            (size_t)embedding_size_ ||
+        weights.policy_heads.count(policy_head_) == 0 ||
+        weights.value_heads.count(value_head_) == 0) {
+      return false;
     }
-
-    if ((attn_policy_ || use_res_block_winograd_fuse_opt_ || attn_body_) &&
-        (scratch_size_ > maxSize)) {
-      maxSize = scratch_size_;
+    if (getMaxAttentionHeadSize(weights.policy_heads.at(policy_head_),
+                                max_batch_size_) *
+                sizeof(DataType) >
+            scratch_size_ ||
+        getMaxAttentionBodySize(weights, max_batch_size_) * sizeof(DataType) >
+            scratch_size_) {
+      return false;
     }
 
-    if (!multi_stream_) {
-      for (auto& mem : tensor_mem_) {
-            //mem = (typename std::remove_reference<decltype(mem)>::type)
-            mem = (DataType *)sycl::malloc_device(maxSize, *sycl_queue_);
-            sycl_queue_->memset(mem, 0, maxSize).wait();
+    // Not scratch_mem_, which batches in flight may be using.
+    void* scratch =
+        memory_pool_->AllocateBytes(sycl::usm::alloc::device, scratch_size_);
+    Layers layers;
+    try {
+      layers = BuildLayers(file, weights, scratch);
+    } catch (...) {
+      sycl_queue_->wait();
+      memory_pool_->Free(scratch);
+      throw;
+    }
+    sycl_queue_->wait();
+    memory_pool_->Free(scratch);
+
+    // The activation buffers were sized for the old layers.
+    if (layers.network.size() != network_.size()) return false;
+    for (size_t i = 0; i < network_.size(); i++) {
+      if (layers.network[i]->GetOutputSize(max_batch_size_) !=
+          network_[i]->GetOutputSize(max_batch_size_)) {
+        return false;
       }
     }
 
-    tensor_mem_size_ = multi_stream_ ? maxSize : 0;
-
-    // pre-allocate one InputsOutputs object
-    // The first call to allocate memory, create cublas,
-    // strem, etc takes really long (600 ms)
-    //CERR << "Creating Inputs Outputs. ";
-    std::unique_ptr<InputsOutputs> io = GetInputsOutputs();
-    //CERR << "Done loading network. ";
+    {
+      // Waits for the batches in flight, which use the old layers.
+      std::unique_lock<std::shared_mutex> lock(weights_mutex_);
+      std::swap(network_, layers.network);
+      resi_last_ = layers.resi_last;
+      encoder_last_ = layers.encoder_last;
+      attention_body_ = layers.attention_body;
+      // Recorded graphs have the pointers of the old weights baked in.
+      ++weights_generation_;
+    }
+    return true;
   }
 
   void forwardEval(InputsOutputs* io, int batchSize) {
-    
-    
+    sycl::queue io_sycl_queue_ = io->q_ct1;
+
+    if (io->copy_queue_) {
+      // Upload the inputs before taking the lock, so this overlaps with
+      // whatever batch currently owns the compute queue.
+      io->copy_queue_->memcpy(io->input_masks_mem_gpu_,
+                              io->input_masks_mem_shared_,
+                              sizeof(uint64_t) * batchSize * kInputPlanes);
+      io->upload_done_ = io->copy_queue_->memcpy(
+          io->input_val_mem_gpu_, io->input_val_mem_shared_,
+          sizeof(float) * batchSize * kInputPlanes);
+    }
+
+    // Keeps ReloadWeights() from swapping the layers under this batch.
+    std::shared_lock<std::shared_mutex> weights_lock(weights_mutex_);
     if (!multi_stream_) lock_.lock();
 
-#ifdef DEBUG_RAW_NPS
-    auto t_start = std::chrono::high_resolution_clock::now();
+    if (io->copy_queue_) {
+      io_sycl_queue_.ext_oneapi_submit_barrier({io->upload_done_});
+    }
+
+#ifdef SYCL_EXT_ONEAPI_GRAPH
+    if (use_graphs_) {
+      if (io->graphs_generation_ != weights_generation_) {
+        // Recorded with the layers of before the last ReloadWeights().
+        io->graphs_.clear();
+        io->graphs_generation_ = weights_generation_;
+      }
+      // Replay the recorded layer sequence for the smallest bucket that fits
+      // the batch. Padding entries compute garbage that is never read back.
+      const int bucket = GetGraphBucket(batchSize);
+      auto it = io->graphs_.find(bucket);
+      if (it == io->graphs_.end()) {
+        // One eager run first: it lazily allocates per-layer device tables
+        // (which is not allowed while recording).
+        enqueueForward(io, bucket, io_sycl_queue_);
+        io_sycl_queue_.wait();
+        namespace sycl_exp = sycl::ext::oneapi::experimental;
+        sycl_exp::command_graph graph(io_sycl_queue_.get_context(),
+                                      io_sycl_queue_.get_device());
+        graph.begin_recording(io_sycl_queue_);
+        enqueueForward(io, bucket, io_sycl_queue_);
+        graph.end_recording();
+        it = io->graphs_.emplace(bucket, graph.finalize()).first;
+      }
+      io_sycl_queue_.ext_oneapi_graph(it->second);
+    } else
 #endif
+    {
+      enqueueForward(io, batchSize, io_sycl_queue_);
+    }
+
+    // Only the priors of the legal moves are needed, and they are written
+    // straight to host memory.
+    const bool copy_policy = !io->legal_moves_batch_;
+    if (io->legal_moves_batch_) {
+      softmaxLegalMoves(io->op_legal_policy_mem_, io->op_policy_mem_gpu_,
+                        io->policy_indices_, io->policy_counts_,
+                        io->policy_inv_temperatures_, batchSize,
+                        io_sycl_queue_);
+    }
 
+    // Copy policy output from device memory to host memory. Being the last
+    // command in the in-order queue, its event completes the whole forward
+    // pass, so this is the only point where the host blocks. With zero copy
+    // there is nothing to copy and a barrier marks the end instead.
+    sycl::event done;
+    if (io->copy_queue_) {
+      sycl::event compute_done = io_sycl_queue_.ext_oneapi_submit_barrier();
+      // All later users of the shared tensor memory are enqueued behind us
+      // on the same in-order queue, so the lock can go before the readback.
+      if (!multi_stream_) lock_.unlock();
+      done = copy_policy
+                 ? io->copy_queue_->memcpy(
+                       io->op_policy_mem_, io->op_policy_mem_gpu_,
+                       sizeof(float) * kNumOutputPolicy * batchSize,
+                       compute_done)
+                 : compute_done;
+      done.wait();
+    } else {
+      done = (io->zero_copy_ || !copy_policy)
+                 ? io_sycl_queue_.ext_oneapi_submit_barrier()
+                 : io_sycl_queue_.memcpy(
+                       io->op_policy_mem_, io->op_policy_mem_gpu_,
+                       sizeof(float) * kNumOutputPolicy * batchSize);
+      done.wait();
+      // The next thread can start using the GPU now.
+      if (!multi_stream_) lock_.unlock();
+    }
+
+    if (wdl_) {
+      // Value softmax done cpu side.
+      for (int i = 0; i < batchSize; i++) {
+        float w = io->op_value_mem_shared_[3 * i + 0];
+        float d = io->op_value_mem_shared_[3 * i + 1];
+        float l = io->op_value_mem_shared_[3 * i + 2];
+        float m = std::max({w, d, l});
+        w = std::exp(w - m);
+        d = std::exp(d - m);
+        l = std::exp(l - m);
+        float sum = w + d + l;
+        w /= sum;
+        l /= sum;
+        d = 1.0f - w - l;
+        io->op_value_mem_shared_[3 * i + 0] = w;
+        io->op_value_mem_shared_[3 * i + 1] = d;
+        io->op_value_mem_shared_[3 * i + 2] = l;
+      }
+    }
+  }
+
+  // Enqueues the whole forward pass, from plane expansion to the last head,
+  // without any host-side synchronisation (unless sync_layers is set).
+  void enqueueForward(InputsOutputs* io, int batchSize,
+                      sycl::queue& io_sycl_queue_) {
     // Expand packed planes to full planes.
-    uint64_t* ipDataMasks = io->input_masks_mem_shared_;
-    float* ipDataValues = io->input_val_mem_shared_;
-    sycl::queue io_sycl_queue_ = io->q_ct1;
+    uint64_t* ipDataMasks = io->copy_queue_ ? io->input_masks_mem_gpu_
+                                            : io->input_masks_mem_shared_;
+    float* ipDataValues = io->copy_queue_ ? io->input_val_mem_gpu_
+                                          : io->input_val_mem_shared_;
 
     DataType* tensor_mem[3];
     void* scratch_mem;
@@ -626,16 +1107,18 @@ class SyclNetwork : public Network {
       scratch_mem = scratch_mem_;
       offset_pointers = (DataType***)&offset_pointers_;
       head_offset_pointers = (DataType***)&head_offset_pointers_;
-      //stream = &dpct::get_default_queue();  // default stream
       //cublas = cublas_;
     }
 
     
+    // The first layer of the body expands the input planes itself, the
+    // expanded input tensor is only needed otherwise.
+    const bool planes_input = numBlocks_ > 0 || attn_body_;
     bool fp16 = std::is_same<sycl::half, DataType>::value;
-    if (fp16) {
+    if (!planes_input && fp16) {
       expandPlanes_Fp16_NCHW((sycl::half*)(tensor_mem[0]), ipDataMasks, ipDataValues,
                              batchSize * kInputPlanes, io_sycl_queue_);
-    } else {
+    } else if (!planes_input) {
       expandPlanes_Fp32_NCHW((float*)(tensor_mem[0]), ipDataMasks, ipDataValues,
                              batchSize * kInputPlanes, io_sycl_queue_);
     }
@@ -653,35 +1136,20 @@ class SyclNetwork : public Network {
     DataType* skip_connection =
         use_res_block_winograd_fuse_opt_ ? tensor_mem[1] : tensor_mem[2];
 
-    
-//#if DPCT_COMPAT_RT_VERSION >= 11000
-    const int pre_transform_tensor_size =
-        batchSize * numFilters_ * 8 * 8 * sizeof(DataType);
-    const int transformed_tensor_size = pre_transform_tensor_size * 36 / 16;
-    const int res_block_mem =
-        transformed_tensor_size * 2 + pre_transform_tensor_size;
-
-    //cudaStreamAttrValue stream_attribute = {};
-    //stream_attribute.accessPolicyWindow.base_ptr = tensor_mem[2];
-    //stream_attribute.accessPolicyWindow.num_bytes = res_block_mem;
-    //stream_attribute.accessPolicyWindow.hitRatio = 1.0f;
-    //stream_attribute.accessPolicyWindow.hitProp = cudaAccessPropertyPersisting;
-    //stream_attribute.accessPolicyWindow.missProp = cudaAccessPropertyStreaming;
-
-    //if (allow_cache_opt_ && use_res_block_winograd_fuse_opt_ &&
-    //    (res_block_mem <= scratch_size_) && (res_block_mem <= l2_cache_size_)) {
-      // we can use a single alloc to hold all the required tensors, and enable
-      // persistent L2 caching on it
-      /*
-      DPCT1007:87: Migration of cudaStreamSetAttribute is not supported.
-      */
-      //cudaStreamSetAttribute(stream, cudaStreamAttributeAccessPolicyWindow, &stream_attribute);
-
-     // enableCacheOpt = true;
-    //  skip_connection =
-    //      tensor_mem[2] + 2 * transformed_tensor_size / sizeof(DataType);
-   // }
-//#endif
+
+    // Run the residual tower with all its tensors in a single buffer that fits
+    // the cache, so that the intermediates don't go back to device memory
+    // between the blocks. Where the driver supports it, that region is also
+    // reserved in the L2 (see the constructor).
+    const size_t res_block_mem =
+        getResBlockMemSize(batchSize, numFilters_, sizeof(DataType));
+    if (allow_cache_opt_ && use_res_block_winograd_fuse_opt_ &&
+        (res_block_mem <= scratch_size_) && (res_block_mem <= l2_cache_size_)) {
+      const size_t transformed_tensor_size =
+          (size_t)batchSize * numFilters_ * 8 * 8 * 36 / 16;
+      enableCacheOpt = true;
+      skip_connection = tensor_mem[2] + 2 * transformed_tensor_size;
+    }
 
     int l = 0;
 
@@ -692,8 +1160,10 @@ class SyclNetwork : public Network {
 
     if (numBlocks_ > 0) {
       // Input.
-      network_[l++]->Eval(batchSize, skip_connection, tensor_mem[0], nullptr,
-                          scratch_mem, scratch_size_, io_sycl_queue_, nullptr);  // input conv
+      static_cast<FusedWinogradConvSELayer<DataType>*>(network_[l++].get())
+          ->EvalFromPlanes(batchSize, skip_connection, ipDataMasks,
+                           ipDataValues, scratch_mem, scratch_size_,
+                           io_sycl_queue_);  // input conv
       
 
       // Residual block.
@@ -720,7 +1190,17 @@ class SyclNetwork : public Network {
     }
 
     
-    if (attn_body_) {
+    if (attn_body_ && numBlocks_ == 0) {
+      static_cast<AttentionBody<DataType>*>(network_[l++].get())
+          ->EvalFromPlanes(batchSize, tensor_mem[1], ipDataMasks,
+                           ipDataValues, tensor_mem[2], scratch_mem,
+                           scratch_size_, io_sycl_queue_,
+                           offset_pointers);  // Entire attention body
+
+      flow = tensor_mem[1];
+      spare1 = tensor_mem[0];
+      spare2 = tensor_mem[2];
+    } else if (attn_body_) {
       network_[l++]->Eval(
           batchSize, tensor_mem[1],
           (numBlocks_ > 0) ? tensor_mem[2] : tensor_mem[0],
@@ -734,176 +1214,113 @@ class SyclNetwork : public Network {
     }
 
     // Policy head.
-   
+    // The queue is in-order, so every layer below depends on the previous one
+    // implicitly. Only wait per layer when explicitly asked to (debugging).
     if (attn_policy_) {
-      
       network_[l++]->Eval(
           batchSize, spare1, flow, spare2, scratch_mem, scratch_size_, io_sycl_queue_,
           head_offset_pointers);  // Entire Attention policy head except for the
                                   // policy map
-          io_sycl_queue_.wait();
+      SyncLayer(io_sycl_queue_);
       if (fp16) {
         network_[l++]->Eval(batchSize, spare2, spare1, nullptr, scratch_mem,
                             scratch_size_, io_sycl_queue_, nullptr);  // policy map layer
-
-        io_sycl_queue_.wait();
+        SyncLayer(io_sycl_queue_);
 
         copyTypeConverted(opPol, (sycl::half*)spare2,
                           batchSize * kNumOutputPolicy,
                           io_sycl_queue_);  // POLICY output
-        io_sycl_queue_.wait();
       } else {
         network_[l++]->Eval(batchSize, (DataType*)opPol, spare1, nullptr,
                             scratch_mem, scratch_size_, io_sycl_queue_, nullptr);  // policy map layer  // POLICY output
-        
-        io_sycl_queue_.wait();
       }
- 
+      SyncLayer(io_sycl_queue_);
     } else if (conv_policy_) {
-
       network_[l++]->Eval(batchSize, spare1, flow, nullptr, scratch_mem,
                           scratch_size_, io_sycl_queue_, nullptr);  // policy conv1
-      io_sycl_queue_.wait();
+      SyncLayer(io_sycl_queue_);
 
       network_[l++]->Eval(batchSize, spare2, spare1, nullptr, scratch_mem,
                           scratch_size_, io_sycl_queue_, nullptr);  // policy conv2
-      io_sycl_queue_.wait();
+      SyncLayer(io_sycl_queue_);
 
       if (fp16) {
         network_[l++]->Eval(batchSize, spare1, spare2, nullptr, scratch_mem,
                             scratch_size_, io_sycl_queue_, nullptr);  // policy map layer
+        SyncLayer(io_sycl_queue_);
 
-        io_sycl_queue_.wait();
         copyTypeConverted(opPol, (sycl::half*)(spare1),
                           batchSize * kNumOutputPolicy,
                           io_sycl_queue_);  // POLICY output
-
-        io_sycl_queue_.wait();
-
       } else {
         network_[l++]->Eval(batchSize, (DataType*)opPol, spare2, nullptr,
                             scratch_mem, scratch_size_, io_sycl_queue_, nullptr);  
                             // policy map layer  // POLICY output
-        io_sycl_queue_.wait();
       }
-
+      SyncLayer(io_sycl_queue_);
     } else {
-      
       network_[l++]->Eval(batchSize, spare1, flow, nullptr, scratch_mem,
                           scratch_size_, io_sycl_queue_, nullptr);  // pol conv
-      io_sycl_queue_.wait();
+      SyncLayer(io_sycl_queue_);
 
       if (fp16) {
         network_[l++]->Eval(batchSize, spare2, spare1, nullptr, scratch_mem,
                             scratch_size_, io_sycl_queue_, nullptr);  // pol FC
-        io_sycl_queue_.wait();
+        SyncLayer(io_sycl_queue_);
 
         copyTypeConverted(opPol, (sycl::half*)(spare2),
                           batchSize * kNumOutputPolicy,
                           io_sycl_queue_);  // POLICY
-        io_sycl_queue_.wait();
       } else {
         network_[l++]->Eval(batchSize, (DataType*)opPol, spare1, nullptr,
                             scratch_mem, scratch_size_, io_sycl_queue_, nullptr);  // pol FC  // POLICY
-        io_sycl_queue_.wait();
       }
+      SyncLayer(io_sycl_queue_);
     }
 
-    // Copy policy output from device memory to host memory.
-
-    io_sycl_queue_.memcpy(io->op_policy_mem_, io->op_policy_mem_gpu_, sizeof(float) * kNumOutputPolicy * batchSize);
-    io_sycl_queue_.wait();
-
-
     // value head
     if (fp16) {
       network_[l++]->Eval(batchSize, spare1, flow, spare2, scratch_mem,
                           scratch_size_, io_sycl_queue_, nullptr);  // value head
-      io_sycl_queue_.wait();
+      SyncLayer(io_sycl_queue_);
 
       copyTypeConverted(opVal, (sycl::half*)spare1, wdl_ ? 3 * batchSize : batchSize,
                         io_sycl_queue_);
-      io_sycl_queue_.wait();
     } else {
       network_[l++]->Eval(batchSize, (DataType*)opVal, flow, spare2,
                           scratch_mem, scratch_size_, io_sycl_queue_, nullptr);  // value head
-      io_sycl_queue_.wait();
     }
+    SyncLayer(io_sycl_queue_);
 
     if (moves_left_) {
-
       // Moves left head
       network_[l++]->Eval(batchSize, spare1, flow, nullptr, scratch_mem,
                           scratch_size_, io_sycl_queue_, nullptr);  // moves conv or embedding
-
-      io_sycl_queue_.wait();
+      SyncLayer(io_sycl_queue_);
 
       network_[l++]->Eval(batchSize, spare2, spare1, nullptr, scratch_mem,
                           scratch_size_, io_sycl_queue_, nullptr);  // moves FC1
-
-      io_sycl_queue_.wait();
+      SyncLayer(io_sycl_queue_);
 
       // Moves left FC2
       if (fp16) {
         // TODO: consider fusing the bias-add of FC2 with format conversion.
-        
-        
         network_[l++]->Eval(batchSize, spare1, spare2, nullptr, scratch_mem,
                             scratch_size_, io_sycl_queue_, nullptr);
-        
-        io_sycl_queue_.wait();
+        SyncLayer(io_sycl_queue_);
 
         copyTypeConverted(opMov, (sycl::half*)(spare1), batchSize, io_sycl_queue_);
-        io_sycl_queue_.wait();
-      
       } else {
-
         network_[l++]->Eval(batchSize, (DataType*)opMov, spare2, nullptr,
                             scratch_mem, scratch_size_, io_sycl_queue_, nullptr);
-        io_sycl_queue_.wait();
-
-      }
-    }
-
-    if (multi_stream_) {
-        io_sycl_queue_.wait();
-    } else {
-        io_sycl_queue_.wait();
-      //ReportCUDAErrors(
-        //  DPCT_CHECK_ERROR(dpct::get_current_device().queues_wait_and_throw()));
-      // The next thread can start using the GPU now.
-      lock_.unlock();
-    }
-
-    if (wdl_) {
-      // Value softmax done cpu side.
-      for (int i = 0; i < batchSize; i++) {
-        float w = io->op_value_mem_shared_[3 * i + 0];
-        float d = io->op_value_mem_shared_[3 * i + 1];
-        float l = io->op_value_mem_shared_[3 * i + 2];
-        float m = std::max({w, d, l});
-        w = std::exp(w - m);
-        d = std::exp(d - m);
-        l = std::exp(l - m);
-        float sum = w + d + l;
-        w /= sum;
-        l /= sum;
-        d = 1.0f - w - l;
-        io->op_value_mem_shared_[3 * i + 0] = w;
-        io->op_value_mem_shared_[3 * i + 1] = d;
-        io->op_value_mem_shared_[3 * i + 2] = l;
       }
     }
   }
 
   ~SyclNetwork() {
-    if (scratch_mem_) 
-        sycl::free(scratch_mem_, *sycl_queue_);
+    // The pool releases the scratch and tensor memory.
+    sycl_queue_->wait();
     if (!multi_stream_) {
-      for (auto mem : tensor_mem_) {
-        if (mem) 
-          sycl::free(mem, *sycl_queue_);
-      }
       if (offset_pointers_) 
           sycl::free(offset_pointers_, *sycl_queue_);
       if (head_offset_pointers_)
@@ -917,23 +1334,35 @@ class SyclNetwork : public Network {
   }
 
   std::unique_ptr<NetworkComputation> NewComputation() override {
-    // Set correct gpu id for this computation (as it might have been called
-    // from a different thread).
-    /*
-    DPCT1093:90: The "gpu_id_" device may be not the one intended for use.
-    Adjust the selected device if needed.
-    */
-    dpct::select_device(gpu_id_);
     return std::make_unique<SyclNetworkComputation<DataType>>(this, wdl_,
                                                               moves_left_);
   }
 
+  // Computations holding InputsOutputs, i.e. created and not destroyed yet.
+  int GetActiveComputations() const {
+    return active_computations_.load(std::memory_order_relaxed);
+  }
+  int GetComputeUnits() const { return compute_units_; }
+
   std::unique_ptr<InputsOutputs> GetInputsOutputs() {
     std::lock_guard<std::mutex> lock(inputs_outputs_lock_);
+    active_computations_.fetch_add(1, std::memory_order_relaxed);
     if (free_inputs_outputs_.empty()) {
-      return std::make_unique<InputsOutputs>(
-          max_batch_size_, wdl_, moves_left_, *sycl_queue_, tensor_mem_size_, scratch_size_,
-          !has_tensor_cores_ && std::is_same<sycl::half, DataType>::value);
+      sycl::queue* copy_queue = nullptr;
+      if (!copy_queues_.empty()) {
+        copy_queue =
+            copy_queues_[num_inputs_outputs_ % copy_queues_.size()].get();
+      }
+      num_inputs_outputs_++;
+      auto io = std::make_unique<InputsOutputs>(
+          *memory_pool_, max_batch_size_, wdl_, moves_left_, *sycl_queue_,
+          tensor_mem_size_, scratch_size_,
+          !has_tensor_cores_ && std::is_same<sycl::half, DataType>::value,
+          copy_queue, zero_copy_, legal_moves_policy_);
+      if (l2_reserved_ && multi_stream_) {
+        AdviseL2Resident(*sycl_queue_, io->tensor_mem_[2], l2_reserved_);
+      }
+      return io;
     } else {
       std::unique_ptr<InputsOutputs> resource =
           std::move(free_inputs_outputs_.front());
@@ -944,6 +1373,7 @@ class SyclNetwork : public Network {
 
   void ReleaseInputsOutputs(std::unique_ptr<InputsOutputs> resource) {
     std::lock_guard<std::mutex> lock(inputs_outputs_lock_);
+    active_computations_.fetch_sub(1, std::memory_order_relaxed);
     free_inputs_outputs_.push_back(std::move(resource));
   }
 
@@ -951,7 +1381,12 @@ class SyclNetwork : public Network {
  private:
   const NetworkCapabilities capabilities_;
   int gpu_id_;
-  int l2_cache_size_;
+  int compute_units_;
+  std::atomic<int> active_computations_{0};
+  size_t l2_cache_size_;
+  int shared_mem_size_;
+  // Bytes of L2 reserved for the residual block activations, 0 if none.
+  size_t l2_reserved_ = 0;
   int max_batch_size_;
   bool wdl_;
   bool moves_left_;
@@ -959,10 +1394,82 @@ class SyclNetwork : public Network {
                                           // tower
   bool multi_stream_;                     // run multiple parallel network evals
   bool allow_cache_opt_;  // try to fit residual block activations in L2 cache
+  bool sync_layers_;      // wait for the queue after each head layer
+  bool use_graphs_;       // replay recorded command graphs per batch bucket
+  bool use_int8_;         // int8 gemms for the encoder FFNs
+  bool zero_copy_;        // kernels use host USM directly (integrated GPUs)
+  bool legal_moves_policy_;  // policy softmax over legal moves on the device
+
+  // Graphs are recorded for powers of two (capped by max_batch), so at most
+  // log2(max_batch) + 2 graphs per InputsOutputs are ever built.
+  int GetGraphBucket(int batchSize) const {
+    int bucket = 1;
+    while (bucket < batchSize) bucket *= 2;
+    return std::min(bucket, max_batch_size_);
+  }
+
+  void SyncLayer(sycl::queue& queue) const {
+    if (sync_layers_) queue.wait();
+  }
+
+  // Evaluates a few positions with and without int8 encoder FFNs and keeps
+  // int8 only if no value or policy output differs by more than |tolerance|.
+  void CheckInt8Accuracy(float tolerance) {
+    static constexpr const char* kFens[] = {
+        ChessBoard::kStartposFen,
+        "r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    };
+    auto evaluate = [&](bool int8) {
+      attention_body_->SetInt8Ffn(int8);
+      auto computation = NewComputation();
+      for (const char* fen : kFens) {
+        const Position position = Position::FromFen(fen);
+        computation->AddInput(EncodePositionForNN(
+            capabilities_.input_format, std::span<const Position>(&position, 1),
+            kMoveHistory, FillEmptyHistory::FEN_ONLY, nullptr));
+      }
+      computation->ComputeBlocking();
+      std::vector<float> outputs;
+      for (int i = 0; i < computation->GetBatchSize(); i++) {
+        outputs.push_back(computation->GetQVal(i));
+        for (int move = 0; move < kNumOutputPolicy; move++) {
+          outputs.push_back(computation->GetPVal(i, move));
+        }
+      }
+      return outputs;
+    };
+
+    // Graphs recorded here would bake in the int8 setting of the first run.
+    const bool use_graphs = use_graphs_;
+    use_graphs_ = false;
+    const auto reference = evaluate(false);
+    const auto quantized = evaluate(true);
+    use_graphs_ = use_graphs;
+
+    float max_error = 0.0f;
+    for (size_t i = 0; i < reference.size(); i++) {
+      max_error = std::max(max_error, std::abs(reference[i] - quantized[i]));
+    }
+    if (max_error > tolerance) {
+      CERR << "WARNING: int8 max error " << max_error << " exceeds "
+           << tolerance << ", using full precision.";
+      attention_body_->SetInt8Ffn(false);
+      use_int8_ = false;
+    } else {
+      CERR << "Using int8 encoder FFNs, max error " << max_error << ".";
+    }
+  }
 
   // Currently only one NN Eval can happen a time (we can fix this if needed
   // by allocating more memory).
   mutable std::mutex lock_;
+  // Held shared by each batch, and exclusively by ReloadWeights() to swap
+  // the layers.
+  mutable std::shared_mutex weights_mutex_;
+  // Bumped by each ReloadWeights(), to invalidate the recorded graphs.
+  int weights_generation_ = 0;
   sycl::queue * sycl_queue_;
 
 
@@ -972,9 +1479,15 @@ class SyclNetwork : public Network {
   bool conv_policy_;
   bool attn_policy_;
   bool attn_body_;
+  AttentionBody<DataType>* attention_body_ = nullptr;
   int num_encoder_blocks_;
+  // Network format and width a reload must match.
+  std::string network_format_;
+  int embedding_size_;
+  std::string policy_head_;
+  std::string value_head_;
+  ActivationFunction act_;
   std::vector<std::unique_ptr<BaseLayer<DataType>>> network_;
-  BaseLayer<DataType>* getLastLayer() { return network_.back().get(); }
 
   BaseLayer<DataType>* resi_last_;
   BaseLayer<DataType>* encoder_last_;
@@ -991,11 +1504,16 @@ class SyclNetwork : public Network {
   bool has_tensor_cores_;
 
   // not used when multi-steam is enabled
-  //dpct::queue_ptr cublas_;
   DataType* tensor_mem_[3];
 
+  // Declared before the InputsOutputs, which return their buffers to it.
+  std::unique_ptr<UsmMemoryPool> memory_pool_;
   mutable std::mutex inputs_outputs_lock_;
   std::list<std::unique_ptr<InputsOutputs>> free_inputs_outputs_;
+  size_t num_inputs_outputs_ = 0;
+
+  // Transfer queues handed out to InputsOutputs, empty if not used.
+  std::vector<std::unique_ptr<sycl::queue>> copy_queues_;
 
   void showDeviceInfo(const sycl::queue & mqueue) const {
     CERR << "PLATFORM: " << mqueue.get_device().get_platform().get_info<sycl::info::platform::name>();
@@ -1014,6 +1532,7 @@ SyclNetworkComputation<DataType>::SyclNetworkComputation(
     : wdl_(wdl), moves_left_(moves_left), network_(network) {
   batch_size_ = 0;
   inputs_outputs_ = network_->GetInputsOutputs();
+  inputs_outputs_->legal_moves_batch_ = false;
 }
 
 template <typename DataType>
@@ -1026,6 +1545,137 @@ void SyclNetworkComputation<DataType>::ComputeBlocking() {
   network_->forwardEval(inputs_outputs_.get(), GetBatchSize());
 }
 
+// Runs batches on several devices (or tiles, with the tiles option) as one
+// backend. The devices share a SYCL context, the weights are converted once
+// and uploaded to all devices in parallel, and each computation goes to the
+// device with the fewest computations in flight per compute unit.
+template <typename DataType>
+class MultiDeviceSyclNetwork : public Network {
+ public:
+  MultiDeviceSyclNetwork(const WeightsFile& file, const OptionsDict& options,
+                         const std::vector<int>& gpu_ids) {
+    const auto devices =
+        GetSyclDevices(options.GetOrDefault<bool>("tiles", false));
+    std::vector<sycl::device> selected;
+    for (int gpu_id : gpu_ids) selected.push_back(devices[gpu_id]);
+    try {
+      context_ = std::make_unique<sycl::context>(selected);
+    } catch (const sycl::exception& e) {
+      throw Exception("The selected SYCL devices can't share a context: " +
+                      std::string(e.what()));
+    }
+
+    MultiHeadWeightsSharingScope sharing_scope;
+    networks_.resize(gpu_ids.size());
+    std::vector<std::exception_ptr> errors(gpu_ids.size());
+    std::vector<std::thread> threads;
+    threads.reserve(gpu_ids.size());
+    for (size_t i = 0; i < gpu_ids.size(); ++i) {
+      threads.emplace_back([&, i]() {
+        try {
+          networks_[i] = std::make_unique<SyclNetwork<DataType>>(
+              file, options, gpu_ids[i], context_.get());
+        } catch (...) {
+          errors[i] = std::current_exception();
+        }
+      });
+    }
+    for (auto& thread : threads) thread.join();
+    for (const auto& error : errors) {
+      if (error) std::rethrow_exception(error);
+    }
+    CERR << "Using " << networks_.size()
+         << " SYCL devices in a shared context.";
+  }
+
+  const NetworkCapabilities& GetCapabilities() const override {
+    return networks_[0]->GetCapabilities();
+  }
+
+  std::unique_ptr<NetworkComputation> NewComputation() override {
+    // Ties go round robin. The counts may be stale by the time the
+    // computation starts, which only makes the choice less even.
+    const size_t start = counter_.fetch_add(1, std::memory_order_relaxed);
+    size_t best = start % networks_.size();
+    for (size_t k = 1; k < networks_.size(); ++k) {
+      const size_t i = (start + k) % networks_.size();
+      const int64_t load = int64_t{networks_[i]->GetActiveComputations()} *
+                           networks_[best]->GetComputeUnits();
+      const int64_t best_load =
+          int64_t{networks_[best]->GetActiveComputations()} *
+          networks_[i]->GetComputeUnits();
+      if (load < best_load) best = i;
+    }
+    return networks_[best]->NewComputation();
+  }
+
+  int GetThreads() const override { return networks_.size(); }
+
+  int GetMiniBatchSize() const override {
+    return networks_[0]->GetMiniBatchSize();
+  }
+
+  bool ReloadWeights(const WeightsFile& file) override {
+    // All or nothing is not guaranteed, but on failure the whole network gets
+    // recreated anyway.
+    for (auto& network : networks_) {
+      if (!network->ReloadWeights(file)) return false;
+    }
+    return true;
+  }
+
+ private:
+  // Outlives the networks, whose queues are in it.
+  std::unique_ptr<sycl::context> context_;
+  std::vector<std::unique_ptr<SyclNetwork<DataType>>> networks_;
+  std::atomic<size_t> counter_{0};
+};
+
+// The devices selected by the "gpu" option: an index, "all", or a quoted
+// list of indices such as gpu="0,2".
+static std::vector<int> GetSyclGpuIds(const OptionsDict& options,
+                                      int device_count) {
+  std::vector<int> gpu_ids;
+  if (options.Exists<std::string>("gpu")) {
+    const auto gpu = options.Get<std::string>("gpu");
+    if (gpu == "all") {
+      for (int i = 0; i < device_count; ++i) gpu_ids.push_back(i);
+    } else {
+      try {
+        gpu_ids = ParseIntList(gpu);
+      } catch (const std::exception&) {
+        throw Exception("Invalid gpu option: " + gpu);
+      }
+    }
+  } else {
+    gpu_ids.push_back(options.GetOrDefault<int>("gpu", 0));
+  }
+  for (size_t i = 0; i < gpu_ids.size(); ++i) {
+    if (gpu_ids[i] < 0 || gpu_ids[i] >= device_count ||
+        std::find(gpu_ids.begin(), gpu_ids.begin() + i, gpu_ids[i]) !=
+            gpu_ids.begin() + i) {
+      throw Exception("Invalid GPU Id: " + std::to_string(gpu_ids[i]));
+    }
+  }
+  return gpu_ids;
+}
+
+// With the jit_cache option, the runtime keeps the JIT compiled kernels in
+// that directory across runs. Doesn't override SYCL_CACHE_DIR from the
+// environment, and has no effect once a kernel has been built.
+static void SetupPersistentJitCache(const OptionsDict& options) {
+  const auto dir = options.GetOrDefault<std::string>("jit_cache", "");
+  if (dir.empty() || std::getenv("SYCL_CACHE_DIR")) return;
+#ifdef _WIN32
+  _putenv_s("SYCL_CACHE_PERSISTENT", "1");
+  _putenv_s("SYCL_CACHE_DIR", dir.c_str());
+#else
+  setenv("SYCL_CACHE_PERSISTENT", "1", 1);
+  setenv("SYCL_CACHE_DIR", dir.c_str(), 1);
+#endif
+  CERR << "Caching the SYCL kernels in " << dir;
+}
+
 template <typename DataType>
 std::unique_ptr<Network> MakeSyclNetwork(const std::optional<WeightsFile>& w,
                                          const OptionsDict& options) {
@@ -1094,17 +1744,31 @@ std::unique_ptr<Network> MakeSyclNetwork(const std::optional<WeightsFile>& w,
                       NF::InputEmbeddingFormat_Name(nf.input_embedding()) +
                       " is not supported by the SYCL backend.");
   }
-  return std::make_unique<SyclNetwork<DataType>>(weights, options);
+  SetupPersistentJitCache(options);
+  const auto gpu_ids = GetSyclGpuIds(
+      options,
+      GetSyclDevices(options.GetOrDefault<bool>("tiles", false)).size());
+  if (gpu_ids.size() > 1) {
+    return std::make_unique<MultiDeviceSyclNetwork<DataType>>(weights, options,
+                                                              gpu_ids);
+  }
+  return std::make_unique<SyclNetwork<DataType>>(weights, options, gpu_ids[0],
+                                                 nullptr);
 }
 
 std::unique_ptr<Network> MakeSyclNetworkAuto(
     const std::optional<WeightsFile>& weights, const OptionsDict& options) {
-  int gpu_id = options.GetOrDefault<int>("gpu", 0);
+  const auto devices =
+      GetSyclDevices(options.GetOrDefault<bool>("tiles", false));
+  const auto gpu_ids = GetSyclGpuIds(options, devices.size());
 
   try {
     CERR << "Trying to switch to [sycl-fp16]...";
-    dpct::has_capability_or_fail(dpct::dev_mgr::instance().get_device(gpu_id),
-                                 {sycl::aspect::fp16});
+    for (int gpu_id : gpu_ids) {
+      if (!devices[gpu_id].has(sycl::aspect::fp16)) {
+        throw Exception("The device doesn't support fp16.");
+      }
+    }
     CERR << "Switched to [sycl-fp16]...";
     return MakeSyclNetwork<sycl::half>(weights, options);
   } catch (std::exception& e) {
@@ -1115,8 +1779,15 @@ std::unique_ptr<Network> MakeSyclNetworkAuto(
   return MakeSyclNetwork<float>(weights, options);
 }
 
+int SyclDeviceCount(const OptionsDict& options) {
+  return GetSyclDevices(options.GetOrDefault<bool>("tiles", false)).size();
+}
+
 REGISTER_NETWORK("sycl-auto", MakeSyclNetworkAuto, 132)
 REGISTER_NETWORK("sycl", MakeSyclNetwork<float>, 131)
 REGISTER_NETWORK("sycl-fp16", MakeSyclNetwork<sycl::half>, 130)
+REGISTER_NETWORK_DEVICES("sycl-auto", SyclDeviceCount)
+REGISTER_NETWORK_DEVICES("sycl", SyclDeviceCount)
+REGISTER_NETWORK_DEVICES("sycl-fp16", SyclDeviceCount)
 
 }  // namespace lczero
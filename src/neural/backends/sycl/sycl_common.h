@@ -22,8 +22,6 @@
 #pragma once
 
 #include <sycl/sycl.hpp>
-#include "dpct/dpct.hpp"
-#include "dpct/blas_utils.hpp"
 
 #include "utils/exception.h"
 
@@ -32,6 +30,10 @@ namespace sycldnn_backend {
 
 static constexpr int kNumOutputPolicy = 1858;
 
+// Policy slots per sample for the device side legal moves softmax (no chess
+// position has more than 218 legal moves).
+static constexpr int kMaxLegalMoves = 256;
+
 // max supported filter count for fast path
 // TODO: extend it to cover bigger networks!
 // (We are limited by no of registers per thread)
@@ -53,5 +55,21 @@ void CublasError(int status, const char* file, const int& line);
 
 inline int DivUp(int a, int b) { return (a + b - 1) / b; }
 
+#define LC0_SYCL_INLINE __inline__ __attribute__((always_inline))
+
+// Relaxed device scope atomic, what CUDA's atomicAdd() and friends are.
+template <typename T>
+using DeviceAtomicRef =
+    sycl::atomic_ref<T, sycl::memory_order::relaxed, sycl::memory_scope::device,
+                     sycl::access::address_space::generic_space>;
+
+// Besides 32, the softmax and LayerNorm kernels are built for sub-groups of 8
+// and 16 lanes, except for NVIDIA and AMD devices.
+#if defined(USE_CUBLAS) || defined(USE_HIPBLAS)
+#define LC0_SYCL_NARROW_SUB_GROUPS 0
+#else
+#define LC0_SYCL_NARROW_SUB_GROUPS 1
+#endif
+
 }  // namespace cudnn_backend
 }  // namespace lczero
@@ -0,0 +1,274 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+   
+  SPDX-License-Identifier:GNU General Public License v3.0 or later
+*/
+
+#include "tuner.h"
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include "kernels.h"
+#include "sycl_common.h"
+#include "utils/logging.h"
+
+namespace lczero {
+namespace sycldnn_backend {
+namespace {
+
+constexpr int kTunerVersion = 1;
+constexpr int kTuneRuns = 5;
+
+// Returns an identifier of the tuned shape, used to find the line in the
+// tuner file (together with the device name).
+std::string TuningLinePrefix(int batch_size, int filters, int embedding_size,
+                             bool fp16) {
+  std::ostringstream oss;
+  oss << kTunerVersion << ";SyclLocalSizes;" << (fp16 ? "fp16" : "fp32")
+      << ";" << batch_size << ";" << filters << ";" << embedding_size << ";";
+  return oss.str();
+}
+
+std::string SizesToString(const KernelLocalSizes& sizes) {
+  std::ostringstream oss;
+  oss << sizes.input_transform << "," << sizes.output_transform << ","
+      << sizes.layer_norm_rows << "," << sizes.softmax << ","
+      << sizes.policy_map << "," << sizes.sub_group;
+  return oss.str();
+}
+
+bool SizesFromString(const std::string& str, KernelLocalSizes* sizes) {
+  std::istringstream iss(str);
+  char c1, c2, c3, c4, c5;
+  iss >> sizes->input_transform >> c1 >> sizes->output_transform >> c2 >>
+      sizes->layer_norm_rows >> c3 >> sizes->softmax >> c4 >>
+      sizes->policy_map >> c5 >> sizes->sub_group;
+  return !iss.fail() && c1 == ',' && c2 == ',' && c3 == ',' && c4 == ',' &&
+         c5 == ',';
+}
+
+bool LoadSizes(const std::string& tuner_file, const std::string& prefix,
+               const std::string& device_name, KernelLocalSizes* sizes) {
+  std::ifstream file(tuner_file);
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.compare(0, prefix.size(), prefix) != 0) continue;
+    const auto sep = line.find(';', prefix.size());
+    if (sep == std::string::npos) continue;
+    if (line.substr(sep + 1) != device_name) continue;
+    if (SizesFromString(line.substr(prefix.size(), sep - prefix.size()),
+                        sizes)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void StoreSizes(const std::string& tuner_file, const std::string& prefix,
+                const std::string& device_name,
+                const KernelLocalSizes& sizes) {
+  // Keep all other entries, replace the one for this shape and device.
+  std::vector<std::string> lines;
+  {
+    std::ifstream file(tuner_file);
+    std::string line;
+    while (std::getline(file, line)) {
+      if (line.compare(0, prefix.size(), prefix) == 0 &&
+          line.size() > device_name.size() &&
+          line.compare(line.size() - device_name.size(), device_name.size(),
+                       device_name) == 0) {
+        continue;
+      }
+      lines.push_back(line);
+    }
+  }
+  std::ofstream file(tuner_file);
+  for (const auto& line : lines) file << line << std::endl;
+  file << prefix << SizesToString(sizes) << ";" << device_name << std::endl;
+  if (file.fail()) {
+    CERR << "Could not save the SYCL tuning result.";
+    CERR << "Do I have write permissions on " << tuner_file << "?";
+  }
+}
+
+// Runs |fn| once to warm up, then returns the average time of kTuneRuns runs.
+template <typename F>
+double TimeKernel(sycl::queue& queue, F fn) {
+  fn();
+  queue.wait();
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kTuneRuns; i++) fn();
+  queue.wait();
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / kTuneRuns;
+}
+
+// Sets |*field| to each candidate in turn and keeps the fastest one.
+template <typename F>
+void TuneField(sycl::queue& queue, int* field,
+               const std::vector<int>& candidates, F fn) {
+  int best = *field;
+  double best_time = TimeKernel(queue, fn);
+  for (int candidate : candidates) {
+    if (candidate == best) continue;
+    *field = candidate;
+    const double time = TimeKernel(queue, fn);
+    if (time < best_time) {
+      best_time = time;
+      best = candidate;
+    }
+  }
+  *field = best;
+}
+
+template <typename DataType>
+KernelLocalSizes TuneSizes(sycl::queue& queue, int N, int filters,
+                           int embedding_size) {
+  KernelLocalSizes& sizes = GetKernelLocalSizes();
+  sizes = KernelLocalSizes();
+  const int max_wg = static_cast<int>(
+      queue.get_device().get_info<sycl::info::device::max_work_group_size>());
+
+  // Scratch buffers large enough for every benchmarked kernel. Contents don't
+  // matter for timing, but are zeroed to avoid denormals and NaNs.
+  const int C = std::max(filters, embedding_size);
+  const size_t elements = std::max<size_t>(
+      (size_t)N * std::max(C, 73) * 64 * 36 / 16, (size_t)N * kNumOutputPolicy);
+  DataType* buf0 = sycl::malloc_device<DataType>(elements, queue);
+  DataType* buf1 = sycl::malloc_device<DataType>(elements, queue);
+  DataType* small = sycl::malloc_device<DataType>(4 * std::max(C, 64), queue);
+  short* indices = sycl::malloc_device<short>(73 * 64, queue);
+  queue.memset(buf0, 0, elements * sizeof(DataType));
+  queue.memset(buf1, 0, elements * sizeof(DataType));
+  queue.memset(small, 0, 4 * std::max(C, 64) * sizeof(DataType));
+  {
+    std::vector<short> host_indices(73 * 64);
+    for (size_t i = 0; i < host_indices.size(); i++) {
+      host_indices[i] = static_cast<short>(i % kNumOutputPolicy);
+    }
+    queue.memcpy(indices, host_indices.data(), 73 * 64 * sizeof(short))
+        .wait();
+  }
+
+  if (filters > 0) {
+    std::vector<int> candidates;
+    for (int wg : {16, 32, 64, 128, 256}) {
+      if (wg < filters && filters % wg == 0) candidates.push_back(wg);
+    }
+    TuneField(queue, &sizes.input_transform, candidates, [&]() {
+      InputTransform<DataType, true>(N, filters, buf1, buf0, queue);
+    });
+    TuneField(queue, &sizes.output_transform, candidates, [&]() {
+      OutputTransform<DataType, false, ACTIVATION_RELU, true, true, true,
+                      false>(N, filters, 0, buf1, buf0, buf1, small, nullptr,
+                             nullptr, nullptr, nullptr, queue);
+    });
+  }
+
+  if (embedding_size > 0 && embedding_size % 16 == 0) {
+    std::vector<int> sub_group_candidates;
+    for (size_t width : queue.get_device()
+                            .get_info<sycl::info::device::sub_group_sizes>()) {
+      if ((LC0_SYCL_NARROW_SUB_GROUPS && (width == 8 || width == 16)) ||
+          width == 32) {
+        sub_group_candidates.push_back(width);
+      }
+    }
+    TuneField(queue, &sizes.sub_group, sub_group_candidates, [&]() {
+      LayerNorm<DataType>(N * 64, embedding_size, buf1, buf0, small, buf0,
+                          small, small, 1e-6f, 1.0f, ACTIVATION_NONE, queue);
+      Softmax<DataType>(N * 64, 64, buf1, buf0, nullptr, queue);
+    });
+    const int row_threads = DivUp(embedding_size / 16, 32) * 32;
+    std::vector<int> candidates;
+    for (int rows : {2, 4, 8, 16}) {
+      if (rows * row_threads <= max_wg) candidates.push_back(rows);
+    }
+    TuneField(queue, &sizes.layer_norm_rows, candidates, [&]() {
+      LayerNorm<DataType>(N * 64, embedding_size, buf1, buf0, small, buf0,
+                          small, small, 1e-6f, 1.0f, ACTIVATION_NONE, queue);
+    });
+    std::vector<int> softmax_candidates;
+    for (int wg : {64, 128, 512, 1024}) {
+      if (wg <= max_wg) softmax_candidates.push_back(wg);
+    }
+    TuneField(queue, &sizes.softmax, softmax_candidates, [&]() {
+      Softmax<DataType>(N * 64, 64, buf1, buf0, nullptr, queue);
+    });
+  }
+
+  std::vector<int> policy_candidates;
+  for (int wg : {64, 128, 512, 1024}) {
+    if (wg <= max_wg) policy_candidates.push_back(wg);
+  }
+  TuneField(queue, &sizes.policy_map, policy_candidates, [&]() {
+    PolicyMap<DataType>(N, buf1, buf0, indices, 73 * 64, 73 * 64,
+                        kNumOutputPolicy, queue);
+  });
+
+  sycl::free(buf0, queue);
+  sycl::free(buf1, queue);
+  sycl::free(small, queue);
+  sycl::free(indices, queue);
+  return sizes;
+}
+
+}  // namespace
+
+KernelLocalSizes& GetKernelLocalSizes() {
+  static KernelLocalSizes sizes;
+  return sizes;
+}
+
+template <typename DataType>
+KernelLocalSizes LoadOrTuneKernelLocalSizes(sycl::queue& queue, int batch_size,
+                                            int filters, int embedding_size,
+                                            const std::string& tuner_file,
+                                            bool force_tune) {
+  constexpr bool fp16 = std::is_same<sycl::half, DataType>::value;
+  const std::string prefix =
+      TuningLinePrefix(batch_size, filters, embedding_size, fp16);
+  const std::string device_name =
+      queue.get_device().get_info<sycl::info::device::name>();
+
+  KernelLocalSizes sizes;
+  if (!force_tune &&
+      LoadSizes(tuner_file, prefix, device_name, &sizes)) {
+    CERR << "Loaded SYCL kernel tuning: " << SizesToString(sizes);
+  } else {
+    CERR << "Tuning SYCL kernel work-group sizes...";
+    sizes = TuneSizes<DataType>(queue, batch_size, filters, embedding_size);
+    CERR << "Tuned SYCL kernel work-group sizes: " << SizesToString(sizes);
+    StoreSizes(tuner_file, prefix, device_name, sizes);
+  }
+  GetKernelLocalSizes() = sizes;
+  return sizes;
+}
+
+template KernelLocalSizes LoadOrTuneKernelLocalSizes<float>(
+    sycl::queue& queue, int batch_size, int filters, int embedding_size,
+    const std::string& tuner_file, bool force_tune);
+template KernelLocalSizes LoadOrTuneKernelLocalSizes<sycl::half>(
+    sycl::queue& queue, int batch_size, int filters, int embedding_size,
+    const std::string& tuner_file, bool force_tune);
+
+}  // namespace sycldnn_backend
+}  // namespace lczero
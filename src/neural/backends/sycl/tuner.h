@@ -0,0 +1,67 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+   
+  SPDX-License-Identifier:GNU General Public License v3.0 or later
+*/
+
+#pragma once
+
+#include <sycl/sycl.hpp>
+
+#include <string>
+
+namespace lczero {
+namespace sycldnn_backend {
+
+// Work-group sizes of the kernels whose local size is not fixed by the
+// algorithm. The defaults are the values that used to be hard-coded.
+struct KernelLocalSizes {
+  // Channels per work-group in the winograd transforms, 0 for all channels
+  // of a board (the output transform always uses all channels with SE).
+  int input_transform = 0;
+  int output_transform = 0;
+  // Rows (tokens) normalised per LayerNorm work-group.
+  int layer_norm_rows = 1;
+  // Work-group size of the C == 64 softmax (multiple of the sub-group size).
+  int softmax = 256;
+  int policy_map = 256;
+  // Sub-group width of the softmax and LayerNorm kernels, one of the widths
+  // the device supports out of 8, 16 and 32.
+  int sub_group = 32;
+};
+
+// Sizes used by the kernel launchers. They are process wide and set when a
+// network is created, before any computation runs.
+KernelLocalSizes& GetKernelLocalSizes();
+
+// Falls back to a full board of channels when |wg| doesn't divide |C|.
+inline int LocalSizeForChannels(int wg, int C) {
+  return (wg <= 0 || C % wg != 0) ? C : wg;
+}
+
+// Loads the local sizes for this device and network shape from |tuner_file|,
+// or benchmarks the candidates and stores the winners there if there is no
+// entry yet (or |force_tune| is set). |filters| is 0 for nets without a
+// residual tower and |embedding_size| is 0 for nets without attention body.
+template <typename DataType>
+KernelLocalSizes LoadOrTuneKernelLocalSizes(sycl::queue& queue, int batch_size,
+                                            int filters, int embedding_size,
+                                            const std::string& tuner_file,
+                                            bool force_tune);
+
+}  // namespace sycldnn_backend
+}  // namespace lczero
@@ -20,12 +20,13 @@
 */
 
 #include <sycl/sycl.hpp>
-#include "dpct/dpct.hpp"
+#include "sycl_common.h"
+#include "tuner.h"
 
 namespace lczero {
 namespace sycldnn_backend {
 
-__dpct_inline__ float mishActivate(float el) {
+LC0_SYCL_INLINE float mishActivate(float el) {
   auto e = sycl::native::exp(el);
   auto n = e * e + 2.0f * e;
   auto d = el / (n + 2.0f);
@@ -35,7 +36,7 @@ __dpct_inline__ float mishActivate(float el) {
     return el - 2.0f * d;
   }
 }
-__dpct_inline__ float activate(float cVal, ActivationFunction activation) {
+LC0_SYCL_INLINE float activate(float cVal, ActivationFunction activation) {
   switch (activation) {
     case ACTIVATION_RELU:
       if (cVal < 0) cVal = 0;
@@ -69,7 +70,7 @@ __dpct_inline__ float activate(float cVal, ActivationFunction activation) {
 }
 
 template <typename T, int M, int N, int K>
-__dpct_inline__ void matrixMul_gpu_serial(T* c, const T* a, const T* b) {
+LC0_SYCL_INLINE void matrixMul_gpu_serial(T* c, const T* a, const T* b) {
 #ifndef SKIP_FP16_BITS
 #pragma unroll
   for (int i = 0; i < M; ++i)
@@ -84,7 +85,7 @@ __dpct_inline__ void matrixMul_gpu_serial(T* c, const T* a, const T* b) {
 }
 
 template <typename T>
-__dpct_inline__ void FilterTransform4x4(T* transformed_filter,
+LC0_SYCL_INLINE void FilterTransform4x4(T* transformed_filter,
                                         const T* filter) {
   // transform applied to filter (of size 3x3)
   T G[6 * 3] = {1.0f / 4,  0,         0,         -1.0f / 6,  -1.0f / 6,
@@ -102,7 +103,7 @@ __dpct_inline__ void FilterTransform4x4(T* transformed_filter,
 }
 
 template <typename T>
-__dpct_inline__ void InputTransform4x4(T* transformedInput, const T* input) {
+LC0_SYCL_INLINE void InputTransform4x4(T* transformedInput, const T* input) {
   // transform applied to input tile (of size 4x4)
   const T Bt[6 * 6] = {4, 0, -5, 0,  1, 0, 0, -4, -4, 1,  1, 0,
                        0, 4, -4, -1, 1, 0, 0, -2, -1, 2,  1, 0,
@@ -118,7 +119,7 @@ __dpct_inline__ void InputTransform4x4(T* transformedInput, const T* input) {
 }
 
 template <typename T>
-__dpct_inline__ void OutputTransform4x4(T* output, const T* transformedOutput) {
+LC0_SYCL_INLINE void OutputTransform4x4(T* output, const T* transformedOutput) {
   // transform applied to result
   const T At[4 * 6] = {1, 1, 1, 1, 1, 0, 0, 1, -1, 2, -2, 0,
                        0, 1, 1, 4, 4, 0, 0, 1, -1, 8, -8, 1};
@@ -180,31 +181,45 @@ void filterTransform_kernel(int K, int C, int elements,
 // 'N' blocks
 // every thread transforms an entire board/plane (8x8 elements)
 // - producing 4 x 6x6 elements
-template <typename T, bool nhcw>
+// With from_planes, the boards are expanded from the packed input planes
+// (@masks and @values) instead of being read from @input.
+template <typename T, bool nhcw, bool from_planes = false>
 void InputTransform_kernel(int N, int C, const T* input, T* output,
-                           const sycl::nd_item<3> &item_ct1) {
-  int c = item_ct1.get_local_id(2);
-  int n = item_ct1.get_group(2);
+                           const sycl::nd_item<3> &item_ct1,
+                           const uint64_t* masks = nullptr,
+                           const float* values = nullptr) {
+  int c = item_ct1.get_global_id(2);
+  int n = item_ct1.get_group(1);
 
   T board[8][8];
 
   const bool fp16 = std::is_same<sycl::half, T>::value;
 
+  if constexpr (from_planes) {
+    const uint64_t mask = masks[n * C + c];
+    const T value = (T)values[n * C + c];
+#pragma unroll
+    for (int y = 0; y < 8; y++)
+#pragma unroll
+      for (int x = 0; x < 8; x++)
+        board[y][x] = (mask >> (y * 8 + x)) & 1 ? value : (T)0;
+  } else {
 // read the board (a row at a time for fp16)
 #pragma unroll
-  for (int y = 0; y < 8; y++) {
-    if (nhcw) {
-      *((sycl::uint4*)(&board[y][0])) =
-          *((sycl::uint4*)(&input[INDEX_NHCW(n, c, y, 0)]));
-      if (!fp16)
-        *((sycl::uint4*)(&board[y][4])) =
-            *((sycl::uint4*)(&input[INDEX_NHCW(n, c, y, 4)]));
-    } else {
-      *((sycl::uint4*)(&board[y][0])) =
-          *((sycl::uint4*)(&input[INDEX_NCHW(n, c, y, 0)]));
-      if (!fp16)
-        *((sycl::uint4*)(&board[y][4])) =
-            *((sycl::uint4*)(&input[INDEX_NCHW(n, c, y, 4)]));
+    for (int y = 0; y < 8; y++) {
+      if (nhcw) {
+        *((sycl::uint4*)(&board[y][0])) =
+            *((sycl::uint4*)(&input[INDEX_NHCW(n, c, y, 0)]));
+        if (!fp16)
+          *((sycl::uint4*)(&board[y][4])) =
+              *((sycl::uint4*)(&input[INDEX_NHCW(n, c, y, 4)]));
+      } else {
+        *((sycl::uint4*)(&board[y][0])) =
+            *((sycl::uint4*)(&input[INDEX_NCHW(n, c, y, 0)]));
+        if (!fp16)
+          *((sycl::uint4*)(&board[y][4])) =
+              *((sycl::uint4*)(&input[INDEX_NCHW(n, c, y, 4)]));
+      }
     }
   }
 
@@ -304,8 +319,8 @@ void OutputTransform_kernel(int N, int C, int se_K, T* output,
 #ifndef SKIP_FP16_BITS
   const bool fp16 = std::is_same<sycl::half, T>::value;
 
-  int k = item_ct1.get_local_id(2);
-  int n = item_ct1.get_group(2);
+  int k = item_ct1.get_global_id(2);
+  int n = item_ct1.get_group(1);
 
   T board[8][8];
   T b = bias[k];
@@ -446,67 +461,40 @@ void OutputTransform_kernel(int N, int C, int se_K, T* output,
 }
 
 // fast reduction for the warp
-__dpct_inline__ float warpReduce(float x, const sycl::nd_item<3>& item_ct1) {
+LC0_SYCL_INLINE float warpReduce(float x, const sycl::nd_item<3>& item_ct1) {
 #pragma unroll
   for (int mask = 16; mask > 0; mask >>= 1)
-    /*
-    DPCT1023:4: The SYCL sub-group does not support mask options for
-    dpct::permute_sub_group_by_xor. You can specify
-    "--use-experimental-features=masked-sub-group-operation" to use the
-    experimental helper function to migrate __shfl_xor_sync.
-    */
-    /*
-    DPCT1096:122: The right-most dimension of the work-group used in the SYCL
-    kernel that calls this function may be less than "32". The function
-    "dpct::permute_sub_group_by_xor" may return an unexpected result on the CPU
-    device. Modify the size of the work-group to ensure that the value of the
-    right-most dimension is a multiple of "32".
-    */
-    x += dpct::permute_sub_group_by_xor(item_ct1.get_sub_group(), x, mask);
+    x += sycl::permute_group_by_xor(item_ct1.get_sub_group(), x, mask);
 
   return x;
 }
 
 // fast max reduction for the warp
-__dpct_inline__ float warpMax(float x, const sycl::nd_item<3>& item_ct1) {
+LC0_SYCL_INLINE float warpMax(float x, const sycl::nd_item<3>& item_ct1) {
 #pragma unroll
   for (int mask = 16; mask > 0; mask >>= 1)
-    /*
-    DPCT1023:5: The SYCL sub-group does not support mask options for
-    dpct::permute_sub_group_by_xor. You can specify
-    "--use-experimental-features=masked-sub-group-operation" to use the
-    experimental helper function to migrate __shfl_xor_sync.
-    */
-    /*
-    DPCT1096:123: The right-most dimension of the work-group used in the SYCL
-    kernel that calls this function may be less than "32". The function
-    "dpct::permute_sub_group_by_xor" may return an unexpected result on the CPU
-    device. Modify the size of the work-group to ensure that the value of the
-    right-most dimension is a multiple of "32".
-    */
-    x = sycl::max(x, (float)(dpct::permute_sub_group_by_xor(
+    x = sycl::max(x, (float)(sycl::permute_group_by_xor(
                          item_ct1.get_sub_group(), x, mask)));
 
   return x;
 }
 
 // atomic max implementation for floats
-__dpct_inline__ float atomicMaxFloat(float* addr, float val) {
+LC0_SYCL_INLINE float atomicMaxFloat(float* addr, float val) {
   float max;
   max = !sycl::signbit(val)
-            ? sycl::bit_cast<float>(dpct::atomic_fetch_max<
-                                    sycl::access::address_space::generic_space>(
-                  (int*)addr, sycl::bit_cast<int>(val)))
-            : sycl::bit_cast<float>(dpct::atomic_fetch_min<
-                                    sycl::access::address_space::generic_space>(
-                  (unsigned int*)addr, sycl::bit_cast<unsigned int>(val)));
+            ? sycl::bit_cast<float>(DeviceAtomicRef<int>(*(int*)addr)
+                                        .fetch_max(sycl::bit_cast<int>(val)))
+            : sycl::bit_cast<float>(
+                  DeviceAtomicRef<unsigned int>(*(unsigned int*)addr)
+                      .fetch_min(sycl::bit_cast<unsigned int>(val)));
 
   return max;
 }
 
 // Helper fuction to do vector loads/stores
 template <typename T>
-__dpct_inline__ void copyAs(void* dst, const void* src) {
+LC0_SYCL_INLINE void copyAs(void* dst, const void* src) {
   *((T*)(dst)) = *((const T*)(src));
 }
 
@@ -943,9 +931,11 @@ void InputTransform(int N, int C, T* transformed_input, const T* input,
   */
   {
     
+    // One board per work-group row, channels split in groups of |wg|.
+    const int wg =
+        LocalSizeForChannels(GetKernelLocalSizes().input_transform, C);
     mqueue.parallel_for(
-        sycl::nd_range<3>(sycl::range<3>(1, 1, N) * sycl::range<3>(1, 1, C),
-                          sycl::range<3>(1, 1, C)),
+        sycl::nd_range<3>(sycl::range<3>(1, N, C), sycl::range<3>(1, 1, wg)),
         [=](sycl::nd_item<3> item_ct1) {
           InputTransform_kernel<T, nhcw>(N, C, input, transformed_input,
                                          item_ct1);
@@ -953,6 +943,20 @@ void InputTransform(int N, int C, T* transformed_input, const T* input,
   }
 }
 
+template <typename T>
+void InputTransformFromPlanes(int N, int C, T* transformed_input,
+                              const uint64_t* masks, const float* values,
+                              sycl::queue& mqueue) {
+  const int wg =
+      LocalSizeForChannels(GetKernelLocalSizes().input_transform, C);
+  mqueue.parallel_for(
+      sycl::nd_range<3>(sycl::range<3>(1, N, C), sycl::range<3>(1, 1, wg)),
+      [=](sycl::nd_item<3> item_ct1) {
+        InputTransform_kernel<T, false, true>(N, C, nullptr, transformed_input,
+                                              item_ct1, masks, values);
+      });
+}
+
 template <typename T, bool use_se, ActivationFunction activation, bool use_bias,
           bool use_skip, bool skipInput_nhcw, bool output_nhcw>
 void OutputTransform(int N, int C, int se_K, T* output, const T* input,
@@ -966,13 +970,16 @@ void OutputTransform(int N, int C, int se_K, T* output, const T* input,
   */
   {
     
+    // SE needs all channels of a board in one work-group.
+    const int wg =
+        use_se ? C
+               : LocalSizeForChannels(GetKernelLocalSizes().output_transform, C);
     mqueue.submit([&](sycl::handler& cgh) {
       sycl::local_accessor<float, 1> shared_data_acc_ct1(sycl::range<1>(1024),
                                                          cgh);
 
       cgh.parallel_for(
-          sycl::nd_range<3>(sycl::range<3>(1, 1, N) * sycl::range<3>(1, 1, C),
-                            sycl::range<3>(1, 1, C)),
+          sycl::nd_range<3>(sycl::range<3>(1, N, C), sycl::range<3>(1, 1, wg)),
           [=](sycl::nd_item<3> item_ct1) {
             OutputTransform_kernel<T, use_se, activation, use_bias, use_skip,
                                    skipInput_nhcw, output_nhcw>(
@@ -33,6 +33,7 @@
 #include "neural/onnx/converter.h"
 #include "neural/xla/onnx2hlo.h"
 #include "utils/bititer.h"
+#include "utils/commandline.h"
 
 namespace lczero {
 namespace {
@@ -47,6 +48,7 @@ class XlaComputation : public NetworkComputation {
   float GetQVal(int sample) const override;
   float GetDVal(int sample) const override;
   float GetPVal(int sample, int move_id) const override;
+  std::span<const float> GetPolicyView(int sample) const override;
   float GetMVal(int sample) const override;
 
  private:
@@ -86,6 +88,8 @@ class XlaNetwork : public Network {
     // TODO make it better when we have a proper way to query the batch size.
     return runner_->GetMaxBatchSize() - 32;
   }
+  // One search thread per device keeps them all busy.
+  int GetThreads() const override { return runner_->GetNumDevices(); }
 
  private:
   std::unique_ptr<XlaRunner> runner_;
@@ -146,6 +150,12 @@ float XlaComputation::GetPVal(int sample, int move_id) const {
   return data[sample * 1858 + move_id];
 }
 
+std::span<const float> XlaComputation::GetPolicyView(int sample) const {
+  const float* data = reinterpret_cast<const float*>(
+      outputs_[network_->options_.output_policy->idx]->data());
+  return {data + sample * 1858, 1858};
+}
+
 float XlaComputation::GetMVal(int sample) const {
   if (network_->options_.output_mlh) {
     const float* data = reinterpret_cast<const float*>(
@@ -229,6 +239,7 @@ XlaNetworkOptions FillXlaRunnerFromOnnx(
     add_tensors(conversion.outputs, output_to_parameter_idx);
     runner->AddModule(batch_size, conversion.hlo_module);
   }
+  runner->Compile();
 
   std::vector<std::unique_ptr<XlaTensor>> constants;
   constants.resize(constant_to_parameter_idx.size() +
@@ -276,7 +287,9 @@ XlaNetworkOptions FillXlaRunnerFromOnnx(
 std::unique_ptr<Network> MakeXlaNetwork(const std::optional<WeightsFile>& w,
                                         const OptionsDict& opts) {
   if (!w) throw Exception("The XLA backend requires a network file.");
-  int device = opts.GetOrDefault<int>("device", 0);
+  // All addressable devices are used, unless device pins it to one.
+  std::vector<int> devices;
+  if (opts.Exists<int>("device")) devices.push_back(opts.Get<int>("device"));
   // Note: if the plugin_path does NOT contain a slash, it's looked up in the
   // LD_LIBRARY_PATH (and a few other system defined places). If it does
   // contain a slash, it's looked up at the exact relative or absolute path.
@@ -284,7 +297,9 @@ std::unique_ptr<Network> MakeXlaNetwork(const std::optional<WeightsFile>& w,
       opts.GetOrDefault<std::string>("plugin_path",
                                      "./pjrt_c_api_gpu_plugin.so")
           .c_str(),
-      device);
+      devices,
+      opts.GetOrDefault<std::string>(
+          "cache_prefix", CommandLine::BinaryDirectory() + "/xla_cache_"));
   int max_batch_size = opts.GetOrDefault<int>("max_batch", 512);
   int steps = opts.GetOrDefault<int>("steps", 16);
 
@@ -305,6 +320,7 @@ std::unique_ptr<Network> MakeXlaNetwork(const std::optional<WeightsFile>& w,
     onnx_converter_options.opset = 22;  // For full onnx bfloat16 support.
     onnx_converter_options.alt_mish =
         opts.GetOrDefault<bool>("alt_mish", false);
+    onnx_converter_options.optimize = opts.GetOrDefault<bool>("optimize", true);
     auto converted = ConvertWeightsToOnnx(*w, onnx_converter_options);
     options = FillXlaRunnerFromOnnx(converted.onnx_model(), runner.get(),
                                     max_batch_size, steps, io_type);
@@ -147,8 +147,40 @@ PjrtExecutable::~PjrtExecutable() {
 
 size_t PjrtExecutable::GetNumOutputs() const { return num_outputs_; }
 
+std::string PjrtExecutable::Serialize() const {
+  auto args = MakeStruct<PJRT_LoadedExecutable_GetExecutable_Args>();
+  args.loaded_executable = executable_;
+  CheckError(api_->PJRT_LoadedExecutable_GetExecutable(&args));
+
+  auto args2 = MakeStruct<PJRT_Executable_Serialize_Args>();
+  args2.executable = args.executable;
+  PJRT_Error* error = api_->PJRT_Executable_Serialize(&args2);
+  std::string result;
+  if (!error) {
+    result.assign(args2.serialized_bytes, args2.serialized_bytes_size);
+    args2.serialized_executable_deleter(args2.serialized_executable);
+  }
+
+  auto args3 = MakeStruct<PJRT_Executable_Destroy_Args>();
+  args3.executable = args.executable;
+  api_->PJRT_Executable_Destroy(&args3);
+  CheckError(error);
+  return result;
+}
+
 std::vector<std::unique_ptr<PjrtDeviceBuffer>> PjrtExecutable::ExecuteBlocking(
     const std::vector<PjrtDeviceBuffer*>& inputs) {
+  return Execute(inputs, nullptr, true);
+}
+
+std::vector<std::unique_ptr<PjrtDeviceBuffer>> PjrtExecutable::ExecuteAsync(
+    const std::vector<PjrtDeviceBuffer*>& inputs, const PjrtDevice* device) {
+  return Execute(inputs, device, false);
+}
+
+std::vector<std::unique_ptr<PjrtDeviceBuffer>> PjrtExecutable::Execute(
+    const std::vector<PjrtDeviceBuffer*>& inputs, const PjrtDevice* device,
+    bool wait) {
   auto options = MakeStruct<PJRT_ExecuteOptions>();
   options.num_non_donatable_input_indices = inputs.size();
   std::vector<int64_t> non_donatable_indices(inputs.size());
@@ -165,16 +197,19 @@ std::vector<std::unique_ptr<PjrtDeviceBuffer>> PjrtExecutable::ExecuteBlocking(
   PJRT_Buffer* const* buffers_ptr = buffers.data();
   args.num_args = inputs.size();
   args.argument_lists = &buffers_ptr;
+  if (device) args.execute_device = device->device_;
 
   std::vector<PJRT_Buffer*> outputs(num_outputs_);
   PJRT_Buffer** outputs_ptr = outputs.data();
   PJRT_Event* event_ptr;
   args.output_lists = &outputs_ptr;
-  args.device_complete_events = &event_ptr;
+  if (wait) args.device_complete_events = &event_ptr;
   CheckError(api_->PJRT_LoadedExecutable_Execute(&args));
 
-  PjrtEvent event(api_, event_ptr);
-  event.Await();
+  if (wait) {
+    PjrtEvent event(api_, event_ptr);
+    event.Await();
+  }
 
   std::vector<std::unique_ptr<PjrtDeviceBuffer>> output_buffers;
   output_buffers.reserve(num_outputs_);
@@ -200,6 +235,13 @@ std::string PjrtDevice::ToString() const {
   return {args.to_string, args.to_string_size};
 }
 
+int PjrtDevice::GetId() const {
+  auto args = MakeStruct<PJRT_DeviceDescription_Id_Args>();
+  args.device_description = description_;
+  CheckError(api_->PJRT_DeviceDescription_Id(&args));
+  return args.id;
+}
+
 PjrtClient::PjrtClient(const PJRT_Api* api, PJRT_Client* client)
     : PjrtCommon(api), client_(client) {}
 
@@ -227,6 +269,16 @@ std::unique_ptr<PjrtExecutable> PjrtClient::CompileHlo(
   return std::make_unique<PjrtExecutable>(api_, args.executable);
 }
 
+std::unique_ptr<PjrtExecutable> PjrtClient::DeserializeAndLoad(
+    std::string_view serialized) {
+  auto args = MakeStruct<PJRT_Executable_DeserializeAndLoad_Args>();
+  args.client = client_;
+  args.serialized_executable = serialized.data();
+  args.serialized_executable_size = serialized.size();
+  CheckError(api_->PJRT_Executable_DeserializeAndLoad(&args));
+  return std::make_unique<PjrtExecutable>(api_, args.loaded_executable);
+}
+
 std::vector<std::unique_ptr<PjrtDevice>> PjrtClient::GetDevices() {
   auto args = MakeStruct<PJRT_Client_Devices_Args>();
   args.client = client_;
@@ -239,6 +291,19 @@ std::vector<std::unique_ptr<PjrtDevice>> PjrtClient::GetDevices() {
   return result;
 }
 
+std::vector<std::unique_ptr<PjrtDevice>> PjrtClient::GetAddressableDevices() {
+  auto args = MakeStruct<PJRT_Client_AddressableDevices_Args>();
+  args.client = client_;
+  CheckError(api_->PJRT_Client_AddressableDevices(&args));
+  std::vector<std::unique_ptr<PjrtDevice>> result;
+  result.reserve(args.num_addressable_devices);
+  for (size_t i = 0; i < args.num_addressable_devices; ++i) {
+    result.push_back(
+        std::make_unique<PjrtDevice>(api_, args.addressable_devices[i]));
+  }
+  return result;
+}
+
 PjrtEvent::PjrtEvent(const PJRT_Api* api, PJRT_Event* event)
     : PjrtCommon(api), event_(event) {}
 
@@ -312,6 +377,16 @@ PjrtHostToDeviceTransfer::AwaitAndReleaseBuffer() {
   return res;
 }
 
+std::unique_ptr<PjrtDeviceBuffer> PjrtHostToDeviceTransfer::ReleaseBuffer() {
+  if (!buffer_) {
+    throw PjrtException(PjrtErrorCode::INVALID_ARGUMENT,
+                        "Buffer already released");
+  }
+  auto res = std::make_unique<PjrtDeviceBuffer>(api_, buffer_);
+  buffer_ = nullptr;
+  return res;
+}
+
 PjrtHostToDeviceTransfer::~PjrtHostToDeviceTransfer() {
   Await();
   if (buffer_) {
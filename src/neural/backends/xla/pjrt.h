@@ -152,6 +152,8 @@ class PjrtDevice : protected PjrtCommon {
  public:
   PjrtDevice(const PJRT_Api* api, PJRT_Device* device);
   std::string ToString() const;
+  // The global device id, as used in device assignments.
+  int GetId() const;
 
  private:
   PJRT_Device* device_;
@@ -197,9 +199,22 @@ class PjrtExecutable : protected PjrtCommon {
   // modified. The function allocates the output buffers and returns them.
   std::vector<std::unique_ptr<PjrtDeviceBuffer>> ExecuteBlocking(
       const std::vector<PjrtDeviceBuffer*>& inputs);
+  // Same, but returns as soon as the execution is enqueued. The inputs must
+  // stay alive until the outputs are ready, and transfers from the outputs
+  // wait for that. With a @device, runs a portable executable on it.
+  std::vector<std::unique_ptr<PjrtDeviceBuffer>> ExecuteAsync(
+      const std::vector<PjrtDeviceBuffer*>& inputs,
+      const PjrtDevice* device = nullptr);
   size_t GetNumOutputs() const;
+  // Returns a platform-specific serialization of the executable, that can be
+  // loaded back with PjrtClient::DeserializeAndLoad().
+  std::string Serialize() const;
 
  private:
+  std::vector<std::unique_ptr<PjrtDeviceBuffer>> Execute(
+      const std::vector<PjrtDeviceBuffer*>& inputs, const PjrtDevice* device,
+      bool wait);
+
   PJRT_LoadedExecutable* executable_;
   size_t num_outputs_;
 };
@@ -217,6 +232,10 @@ class PjrtHostToDeviceTransfer : protected PjrtCommon {
   // Waits for the transfer to complete and releases the ownership of the
   // buffer.
   std::unique_ptr<PjrtDeviceBuffer> AwaitAndReleaseBuffer();
+  // Releases the ownership of the buffer without waiting. The buffer can be
+  // passed to an execution right away, but the host memory must stay intact
+  // until this object is destroyed.
+  std::unique_ptr<PjrtDeviceBuffer> ReleaseBuffer();
 
  private:
   PJRT_Buffer* buffer_;
@@ -229,7 +248,11 @@ class PjrtClient : protected PjrtCommon {
   ~PjrtClient();
   std::unique_ptr<PjrtExecutable> CompileHlo(std::string_view hlo,
                                              std::string_view config);
+  std::unique_ptr<PjrtExecutable> DeserializeAndLoad(
+      std::string_view serialized);
   std::vector<std::unique_ptr<PjrtDevice>> GetDevices();
+  // Devices that this client can issue commands to.
+  std::vector<std::unique_ptr<PjrtDevice>> GetAddressableDevices();
   std::unique_ptr<PjrtHostToDeviceTransfer> HostToDevice(
       std::string_view buffer, PjrtType type, const std::vector<int64_t>& dims,
       const PjrtDevice* device);
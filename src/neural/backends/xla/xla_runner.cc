@@ -28,6 +28,9 @@
 #include "neural/backends/xla/xla_runner.h"
 
 #include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
 #include <numeric>
 
 #include "utils/exception.h"
@@ -107,104 +110,241 @@ PjrtType XlaTypeToPjrtType(pblczero::XlaShapeProto::Type type) {
 }
 }  // namespace
 
-XlaRunner::XlaRunner(const char* library_path, int device)
-    : pjrt_client_(Pjrt(library_path).CreateClient()), device_(device) {
+XlaRunner::XlaRunner(const char* library_path,
+                     const std::vector<int>& devices,
+                     const std::string& cache_prefix)
+    : pjrt_client_(Pjrt(library_path).CreateClient()),
+      cache_prefix_(cache_prefix) {
   CERR << "Devices:";
-  devices_ = pjrt_client_->GetDevices();
+  devices_ = pjrt_client_->GetAddressableDevices();
   for (const auto& device : devices_) {
     CERR << "  " << device->ToString();
   }
   if (devices_.empty()) {
     throw Exception("No devices available");
   }
+  std::vector<PjrtDevice*> used;
+  if (devices.empty()) {
+    for (const auto& device : devices_) used.push_back(device.get());
+  } else {
+    for (int idx : devices) {
+      if (idx < 0 || static_cast<size_t>(idx) >= devices_.size()) {
+        throw Exception("Device " + std::to_string(idx) + " not available");
+      }
+      used.push_back(devices_[idx].get());
+    }
+  }
+  replicas_ = std::vector<Replica>(used.size());
+  for (size_t i = 0; i < used.size(); ++i) replicas_[i].device = used[i];
+  portable_ = replicas_.size() > 1;
+  if (portable_) {
+    CERR << "Running on " << replicas_.size() << " devices.";
+  }
+  pblczero::CompileOptionsProto options;
+  options.mutable_executable_build_options()->set_num_replicas(1);
+  options.mutable_executable_build_options()->set_num_partitions(1);
+  if (portable_) {
+    options.set_compile_portable_executable(true);
+  } else {
+    options.mutable_executable_build_options()
+        ->mutable_device_assignment()
+        ->set_replica_count(1);
+    options.mutable_executable_build_options()
+        ->mutable_device_assignment()
+        ->set_computation_count(1);
+    options.mutable_executable_build_options()
+        ->mutable_device_assignment()
+        ->add_computation_devices()
+        ->add_replica_device_ids(replicas_[0].device->GetId());
+  }
+  compile_options_ = options.OutputAsString();
+}
+
+XlaRunner::~XlaRunner() {
+  stop_compiling_ = true;
+  if (compile_thread_.joinable()) compile_thread_.join();
 }
 
 void XlaRunner::AddModule(size_t minibatch_size,
                           const pblczero::HloModuleProto& module) {
-  pblczero::CompileOptionsProto options;
-  options.mutable_executable_build_options()->set_num_replicas(1);
-  options.mutable_executable_build_options()->set_num_partitions(1);
-  options.mutable_executable_build_options()
-      ->mutable_device_assignment()
-      ->set_replica_count(1);
-  options.mutable_executable_build_options()
-      ->mutable_device_assignment()
-      ->set_computation_count(1);
-  options.mutable_executable_build_options()
-      ->mutable_device_assignment()
-      ->add_computation_devices()
-      ->add_replica_device_ids(device_);
-  auto executable = pjrt_client_->CompileHlo(module.OutputAsString(),
-                                             options.OutputAsString());
-  executables_.push_back({minibatch_size, std::move(executable)});
-  std::sort(executables_.begin(), executables_.end());
+  buckets_.push_back({minibatch_size, module.OutputAsString(), nullptr});
+  std::sort(buckets_.begin(), buckets_.end(),
+            [](const Bucket& a, const Bucket& b) {
+              return a.batch_size < b.batch_size;
+            });
+}
+
+std::unique_ptr<PjrtExecutable> XlaRunner::CompileOrLoad(
+    const std::string& hlo) {
+  if (cache_prefix_.empty()) {
+    return pjrt_client_->CompileHlo(hlo, compile_options_);
+  }
+  // Serialized executables are only valid for the same device and plugin, so
+  // those are part of the key along with the module.
+  const std::string device = replicas_[0].device->ToString();
+  char hash[17];
+  snprintf(hash, sizeof(hash), "%016zx",
+           std::hash<std::string>{}(device + '\0' + compile_options_ + hlo));
+  const std::string filename = cache_prefix_ + hash + ".bin";
+
+  std::ifstream in(filename, std::ios::binary);
+  if (in) {
+    std::string serialized((std::istreambuf_iterator<char>(in)),
+                           std::istreambuf_iterator<char>());
+    try {
+      return pjrt_client_->DeserializeAndLoad(serialized);
+    } catch (const PjrtException& e) {
+      CERR << "Ignoring cached executable " << filename << ": " << e.what();
+    }
+  }
+
+  auto executable = pjrt_client_->CompileHlo(hlo, compile_options_);
+  try {
+    const std::string serialized = executable->Serialize();
+    // Write to a temporary file first, concurrent instances may be racing.
+    const std::string tmp_filename = filename + ".tmp";
+    std::ofstream out(tmp_filename, std::ios::binary);
+    out.write(serialized.data(), serialized.size());
+    out.close();
+    if (!out || std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+      std::remove(tmp_filename.c_str());
+      CERR << "Unable to write executable cache " << filename;
+    }
+  } catch (const PjrtException& e) {
+    CERR << "Unable to serialize executable: " << e.what();
+  }
+  return executable;
+}
+
+void XlaRunner::CompileBucket(size_t idx) {
+  CERR << "Compiling executable for batch size " << buckets_[idx].batch_size
+       << "...";
+  auto executable = CompileOrLoad(buckets_[idx].hlo);
+  {
+    std::lock_guard<std::mutex> lock(buckets_mutex_);
+    buckets_[idx].executable = std::move(executable);
+    buckets_[idx].hlo.clear();
+  }
+  bucket_ready_.notify_all();
+}
+
+void XlaRunner::Compile() {
+  if (buckets_.empty()) throw Exception("No modules to compile.");
+  CompileBucket(0);
+  if (buckets_.size() == 1) return;
+  // The largest bucket goes first, so that from then on every batch fits one
+  // that's ready, even if with extra padding. Then the rest from the smallest.
+  std::vector<size_t> order = {buckets_.size() - 1};
+  for (size_t i = 1; i + 1 < buckets_.size(); ++i) order.push_back(i);
+  compile_thread_ = std::thread([this, order]() {
+    try {
+      for (size_t idx : order) {
+        if (stop_compiling_) break;
+        CompileBucket(idx);
+      }
+    } catch (...) {
+      {
+        std::lock_guard<std::mutex> lock(buckets_mutex_);
+        compile_error_ = std::current_exception();
+      }
+      bucket_ready_.notify_all();
+    }
+  });
+}
+
+const XlaRunner::Bucket& XlaRunner::GetBucket(size_t batch_size) {
+  if (buckets_.empty() || buckets_.back().batch_size < batch_size) {
+    throw Exception("No executable found for batch size " +
+                    std::to_string(batch_size));
+  }
+  std::unique_lock<std::mutex> lock(buckets_mutex_);
+  while (true) {
+    for (const auto& bucket : buckets_) {
+      if (bucket.batch_size >= batch_size && bucket.executable) return bucket;
+    }
+    if (compile_error_) std::rethrow_exception(compile_error_);
+    bucket_ready_.wait(lock);
+  }
 }
 
 void XlaRunner::SetFrozenInputs(
     const std::vector<std::unique_ptr<XlaTensor>> inputs) {
   param_idxs_.clear();
-  std::vector<std::unique_ptr<PjrtHostToDeviceTransfer>> transfers_;
   for (size_t i = 0; i < inputs.size(); ++i) {
-    const auto* input = inputs[i].get();
-    if (!input) {
-      param_idxs_.push_back(i);
-      continue;
+    if (!inputs[i]) param_idxs_.push_back(i);
+  }
+  // Start the transfers to all devices before waiting for any of them.
+  std::vector<std::unique_ptr<PjrtHostToDeviceTransfer>> transfers_;
+  for (const auto& replica : replicas_) {
+    for (const auto& input : inputs) {
+      if (!input) continue;
+      transfers_.push_back(pjrt_client_->HostToDevice(
+          {static_cast<const char*>(input->data()), input->size()},
+          XlaTypeToPjrtType(input->type()), input->shape(), replica.device));
     }
-    transfers_.push_back(pjrt_client_->HostToDevice(
-        {static_cast<const char*>(input->data()), input->size()},
-        XlaTypeToPjrtType(input->type()), input->shape(),
-        devices_.at(device_).get()));
   }
 
-  owned_buffers_.clear();
-  buffers_.clear();
-  buffers_.resize(inputs.size());
   size_t transfer_idx = 0;
-  for (size_t i = 0; i < inputs.size(); ++i) {
-    if (inputs[i]) {
-      owned_buffers_.push_back(
-          transfers_[transfer_idx++]->AwaitAndReleaseBuffer());
-      buffers_[i] = owned_buffers_.back().get();
+  for (auto& replica : replicas_) {
+    replica.owned_buffers.clear();
+    replica.buffers.clear();
+    replica.buffers.resize(inputs.size());
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      if (inputs[i]) {
+        replica.owned_buffers.push_back(
+            transfers_[transfer_idx++]->AwaitAndReleaseBuffer());
+        replica.buffers[i] = replica.owned_buffers.back().get();
+      }
+    }
+  }
+}
+
+XlaRunner::Replica& XlaRunner::AcquireReplica() {
+  Replica* best = &replicas_[0];
+  for (auto& replica : replicas_) {
+    if (replica.in_flight.load(std::memory_order_relaxed) <
+        best->in_flight.load(std::memory_order_relaxed)) {
+      best = &replica;
     }
   }
+  best->in_flight.fetch_add(1, std::memory_order_relaxed);
+  return *best;
 }
 
-size_t XlaRunner::GetMaxBatchSize() const { return executables_.back().first; }
+size_t XlaRunner::GetMaxBatchSize() const { return buckets_.back().batch_size; }
 
 std::vector<std::unique_ptr<XlaMutableTensor>> XlaRunner::ExecuteBlocking(
     const std::vector<XlaMutableTensor*>& inputs) {
   if (inputs.size() != 1) {
     throw Exception("Only one input is kinda supported.");
   }
-  // Find the smallest batch size that fits the input.
-  auto iter = std::find_if(
-      executables_.begin(), executables_.end(), [&](const auto& e) {
-        return e.first >= static_cast<size_t>(inputs[0]->shape()[0]);
-      });
-  if (iter == executables_.end()) {
-    throw Exception("No executable found for batch size " +
-                    std::to_string(inputs[0]->shape()[0]));
-  }
-  const size_t batch_size = iter->first;
+  // Find the smallest compiled batch size that fits the input.
+  const auto& bucket = GetBucket(inputs[0]->shape()[0]);
+  const size_t batch_size = bucket.batch_size;
   // Update the shape to match the rounded up batch size. After growing, the
   // batch size must fit within tensor buffer capacity (it's fine to have
   // garbage in the tail of that buffer).
   std::vector<int64_t> new_shape = inputs[0]->shape();
   new_shape[0] = batch_size;
   inputs[0]->Reshape(new_shape);
-  // Transfer the input to the device.
-  auto input_buffer =
-      pjrt_client_
-          ->HostToDevice(
-              {static_cast<const char*>(inputs[0]->data()), inputs[0]->size()},
-              XlaTypeToPjrtType(inputs[0]->type()), new_shape,
-              devices_.at(device_).get())
-          ->AwaitAndReleaseBuffer();
-  // Make a copy to support multiple concurrent calls, not sure if it's needed.
-  auto input_buffers = buffers_;
+  Replica& replica = AcquireReplica();
+  struct Release {
+    ~Release() { replica.in_flight.fetch_sub(1, std::memory_order_relaxed); }
+    Replica& replica;
+  } release{replica};
+  // Transfer the input to the device. The execution is enqueued right away,
+  // PJRT starts it when the transfer completes; the host data stays intact
+  // until the transfer is destroyed at the end of the call.
+  auto transfer = pjrt_client_->HostToDevice(
+      {static_cast<const char*>(inputs[0]->data()), inputs[0]->size()},
+      XlaTypeToPjrtType(inputs[0]->type()), new_shape, replica.device);
+  auto input_buffer = transfer->ReleaseBuffer();
+  // Make a copy to support multiple concurrent calls.
+  auto input_buffers = replica.buffers;
   input_buffers[param_idxs_[0]] = input_buffer.get();
   // Execute!
-  auto outputs = iter->second->ExecuteBlocking(input_buffers);
+  auto outputs = bucket.executable->ExecuteAsync(
+      input_buffers, portable_ ? replica.device : nullptr);
 
   // Now we need to transfer the outputs back to the host.
   std::vector<std::unique_ptr<XlaMutableTensor>> result;
@@ -220,7 +360,7 @@ std::vector<std::unique_ptr<XlaMutableTensor>> XlaRunner::ExecuteBlocking(
         output->DeviceToHost(new_tensor->mutable_data(), new_tensor->size()));
     result.push_back(std::move(new_tensor));
   }
-  // Wait for the transfers to complete.
+  // Wait for the transfers to complete, which also waits for the execution.
   for (size_t i = 0; i < outputs.size(); ++i) done_events[i]->Await();
   return result;
 }
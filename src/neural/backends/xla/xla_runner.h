@@ -27,9 +27,14 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <exception>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -41,16 +46,30 @@ namespace lczero {
 
 // A class that keeps several XLA executables (for different batch sizes),
 // manages common buffers among them, and chooses the right executable for a
-// batch size.
+// batch size. With several devices, the executables are compiled as portable
+// ones, the frozen inputs are replicated on every device, and each batch runs
+// on the least busy device.
 class XlaRunner {
  public:
-  // The library_path is the path to the PJRT library, and device indx.
-  XlaRunner(const char* library_path, int device);
-  // Compiles and adds a module for the given batch size.
+  // The library_path is the path to the PJRT library, and devices are indices
+  // of the addressable devices to use (all of them if empty).
+  // Compiled executables are cached in files starting with cache_prefix, or
+  // not cached if it's empty.
+  XlaRunner(const char* library_path, const std::vector<int>& devices,
+            const std::string& cache_prefix);
+  ~XlaRunner();
+  // Adds a module for the given batch size, to be compiled by Compile().
   void AddModule(size_t minibatch_size, const pblczero::HloModuleProto& module);
+  // Compiles the smallest module before returning, and the rest on a
+  // background thread. Until the executable for a batch size is ready, batches
+  // are padded up to the nearest ready one.
+  void Compile();
   // Transfers inputs to the device and execute the executable corresponding to
   // the batch size. Only non-frozen inputs are passed as arguments.
   // Currnetly only single input is supported (just because we don't need more).
+  // The transfers and the execution are enqueued without waiting for each
+  // other, only the transfer of the outputs back to the host is waited for.
+  // Concurrent calls are spread over the devices.
   std::vector<std::unique_ptr<XlaMutableTensor>> ExecuteBlocking(
       const std::vector<XlaMutableTensor*>& inputs);
   // Inputs that are shared between all calls (i.e. network weights passed as
@@ -60,20 +79,57 @@ class XlaRunner {
   // Maximum supported batch size. It's expected that the capacity (not size) of
   // the input tensors would be able to fit this size.
   size_t GetMaxBatchSize() const;
+  size_t GetNumDevices() const { return replicas_.size(); }
 
  private:
+  struct Bucket {
+    size_t batch_size;
+    std::string hlo;
+    // Null until compiled.
+    std::unique_ptr<PjrtExecutable> executable;
+  };
+  // Loads the executable from the cache, or compiles (and caches) it.
+  std::unique_ptr<PjrtExecutable> CompileOrLoad(const std::string& hlo);
+  void CompileBucket(size_t idx);
+  // Returns the smallest ready bucket that fits batch_size, waiting for one if
+  // needed.
+  const Bucket& GetBucket(size_t batch_size);
+
+  // A device with its own copy of the frozen inputs.
+  struct Replica {
+    PjrtDevice* device = nullptr;
+    // Frozen inputs, in no particular order, kept for ownership.
+    std::vector<std::unique_ptr<PjrtDeviceBuffer>> owned_buffers;
+    // Vector of pointers to all input buffers, that is passed to PJRT. Frozen
+    // parameters (constants) are pre-filled in SetFrozenInputs(), and
+    // non-frozen inputs (input planes) are created and filled in every
+    // request.
+    std::vector<PjrtDeviceBuffer*> buffers;
+    // Batches being computed on the device.
+    std::atomic<int> in_flight = 0;
+  };
+  // Returns the replica with the fewest batches in flight and counts one more
+  // there.
+  Replica& AcquireReplica();
+
   std::unique_ptr<PjrtClient> pjrt_client_;
   std::vector<std::unique_ptr<PjrtDevice>> devices_;
-  // Compiled executables per batch size.
-  std::vector<std::pair<size_t, std::unique_ptr<PjrtExecutable>>> executables_;
-  // Frozen inputs, in no particular order, kept for ownership.
-  std::vector<std::unique_ptr<PjrtDeviceBuffer>> owned_buffers_;
-  // Vector of pointers to all input buffers, that is passed to PJRT. Frozen
-  // parameters (constants) are pre-filled in SetFrozenInputs(), and non-frozen
-  // inputs (input planes) are created and filled in every request.
-  std::vector<PjrtDeviceBuffer*> buffers_;
+  std::string compile_options_;
+  std::string cache_prefix_;
+  // Modules per batch size, sorted by batch size. The vector itself doesn't
+  // change after Compile(), executables are filled in under buckets_mutex_.
+  std::vector<Bucket> buckets_;
+  std::mutex buckets_mutex_;
+  std::condition_variable bucket_ready_;
+  std::exception_ptr compile_error_;
+  std::thread compile_thread_;
+  std::atomic<bool> stop_compiling_ = false;
+  // Created once in the constructor, never resized.
+  std::vector<Replica> replicas_;
+  // Executables are portable and run on the device passed to them, when there
+  // is more than one replica.
+  bool portable_ = false;
   std::vector<size_t> param_idxs_;
-  int device_;
 };
 
 }  // namespace lczero
@@ -27,12 +27,24 @@
 
 #include "neural/batchsplit.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <vector>
+
+#include "utils/mutex.h"
+
 namespace lczero {
 namespace {
 
 class BatchSplittingBackend : public Backend {
  public:
-  BatchSplittingBackend(Backend* wrapped) : wrapped_backend_(wrapped) {}
+  BatchSplittingBackend(Backend* wrapped)
+      : wrapped_backend_(wrapped),
+        max_batch_size_(wrapped->GetAttributes().maximum_batch_size),
+        split_size_(max_batch_size_),
+        seconds_per_position_(max_batch_size_ + 1) {}
 
   BackendAttributes GetAttributes() const override {
     return wrapped_backend_->GetAttributes();
@@ -48,44 +60,131 @@ class BatchSplittingBackend : public Backend {
     return wrapped_backend_->UpdateConfiguration(options);
   }
 
+  Backend* wrapped_backend() const { return wrapped_backend_; }
+
+  // Size of the parts that computations are split into.
+  size_t GetSplitSize() const {
+    return split_size_.load(std::memory_order_relaxed);
+  }
+
+  void RecordTiming(size_t batch_size, std::chrono::duration<double> elapsed) {
+    if (batch_size == 0 || batch_size > max_batch_size_) return;
+    SpinMutex::Lock lock(mutex_);
+    double& average = seconds_per_position_[batch_size];
+    const double value = elapsed.count() / batch_size;
+    average = average == 0.0 ? value : 0.8 * average + 0.2 * value;
+    if (++timings_since_plan_ >= kPlanInterval) UpdateSplitSize();
+  }
+
  private:
+  // The split size is replanned after that many timed computations.
+  static constexpr size_t kPlanInterval = 64;
+  // Smaller splits are preferred unless they are slower than that, relative to
+  // the best measured size.
+  static constexpr double kTolerance = 1.05;
+
+  // Picks the smallest batch size that is about as fast per position as the
+  // best one. Parts of a split batch are computed concurrently, so the timings
+  // already account for the overlap. Sizes just past a tile or graph boundary
+  // of the backend show up as slower and aren't picked.
+  void UpdateSplitSize() REQUIRES(mutex_) {
+    timings_since_plan_ = 0;
+    double best = 0.0;
+    for (double value : seconds_per_position_) {
+      if (value != 0.0 && (best == 0.0 || value < best)) best = value;
+    }
+    if (best == 0.0) return;
+    for (size_t size = 1; size <= max_batch_size_; ++size) {
+      const double value = seconds_per_position_[size];
+      if (value != 0.0 && value <= best * kTolerance) {
+        split_size_.store(size, std::memory_order_relaxed);
+        return;
+      }
+    }
+  }
+
   Backend* wrapped_backend_;
+  const size_t max_batch_size_;
+  std::atomic<size_t> split_size_;
+  SpinMutex mutex_;
+  // Moving average of time per position, by batch size. 0 if not measured.
+  std::vector<double> seconds_per_position_ GUARDED_BY(mutex_);
+  size_t timings_since_plan_ GUARDED_BY(mutex_) = 0;
 };
 
 class BatchSplittingComputation : public BackendComputation {
  public:
-  BatchSplittingComputation(Backend* wrapped_backend)
-      : wrapped_backend_(wrapped_backend),
-        max_batch_size_(wrapped_backend->GetAttributes().maximum_batch_size) {
+  BatchSplittingComputation(BatchSplittingBackend* backend)
+      : backend_(backend),
+        split_size_(std::max<size_t>(1, backend->GetSplitSize())) {
     MakeComputation();
   }
 
+  ~BatchSplittingComputation() { WaitForParts(); }
+
   size_t UsedBatchSize() const override {
-    return wrapped_computation_->UsedBatchSize();
+    return used_batch_size_ + wrapped_computation_->UsedBatchSize();
   }
   AddInputResult AddInput(const EvalPosition& pos,
                           EvalResultPtr result) override {
-    if (wrapped_computation_->UsedBatchSize() >= max_batch_size_) {
-      ComputeBlocking();
+    if (wrapped_computation_->UsedBatchSize() >= split_size_) {
+      StartPart();
       MakeComputation();
     }
     return wrapped_computation_->AddInput(pos, result);
   }
 
-  void ComputeBlocking() override { wrapped_computation_->ComputeBlocking(); }
+  void ComputeBlocking() override {
+    const size_t batch_size = wrapped_computation_->UsedBatchSize();
+    const auto start = std::chrono::steady_clock::now();
+    wrapped_computation_->ComputeBlocking();
+    backend_->RecordTiming(batch_size, std::chrono::steady_clock::now() - start);
+    WaitForParts();
+  }
 
  private:
   void MakeComputation() {
-    wrapped_computation_ = wrapped_backend_->CreateComputation();
+    wrapped_computation_ = backend_->wrapped_backend()->CreateComputation();
   }
 
-  Backend* wrapped_backend_;
-  size_t max_batch_size_;
+  // Starts computing the filled part while the next one is being added.
+  void StartPart() {
+    const size_t batch_size = wrapped_computation_->UsedBatchSize();
+    used_batch_size_ += batch_size;
+    {
+      Mutex::Lock lock(mutex_);
+      ++parts_in_flight_;
+    }
+    BackendComputation* part = wrapped_computation_.get();
+    parts_.push_back(std::move(wrapped_computation_));
+    part->ComputeAsync(
+        [this, batch_size, start = std::chrono::steady_clock::now()]() {
+          backend_->RecordTiming(batch_size,
+                                 std::chrono::steady_clock::now() - start);
+          Mutex::Lock lock(mutex_);
+          if (--parts_in_flight_ == 0) part_done_.notify_all();
+        });
+  }
+
+  void WaitForParts() {
+    Mutex::Lock lock(mutex_);
+    part_done_.wait(lock.get_raw(), [&]() { return parts_in_flight_ == 0; });
+  }
+
+  BatchSplittingBackend* backend_;
+  const size_t split_size_;
   std::unique_ptr<BackendComputation> wrapped_computation_;
+  // Parts that were started already, and their total batch size.
+  std::vector<std::unique_ptr<BackendComputation>> parts_;
+  size_t used_batch_size_ = 0;
+
+  Mutex mutex_;
+  std::condition_variable part_done_;
+  int parts_in_flight_ GUARDED_BY(mutex_) = 0;
 };
 
 std::unique_ptr<BackendComputation> BatchSplittingBackend::CreateComputation() {
-  return std::make_unique<BatchSplittingComputation>(wrapped_backend_);
+  return std::make_unique<BatchSplittingComputation>(this);
 }
 
 }  // namespace
@@ -94,4 +193,4 @@ std::unique_ptr<Backend> CreateBatchSplitingBackend(Backend* parent) {
   return std::make_unique<BatchSplittingBackend>(parent);
 }
 
-}  // namespace lczero
\ No newline at end of file
+}  // namespace lczero
@@ -27,6 +27,8 @@
 
 #include "neural/decoder.h"
 
+#include <array>
+
 #include "neural/encoder.h"
 
 namespace lczero {
@@ -56,20 +58,8 @@ Square OldPosition(const InputPlane& prev, BitBoard mask_diff) {
 }  // namespace
 
 void PopulateBoard(pblczero::NetworkFormat::InputFormat input_format,
-                   InputPlanes planes, ChessBoard* board, int* rule50,
+                   const InputPlanes& planes, ChessBoard* board, int* rule50,
                    int* gameply) {
-  auto pawnsOurs = BitBoard(planes[0].mask);
-  auto knightsOurs = BitBoard(planes[1].mask);
-  auto bishopOurs = BitBoard(planes[2].mask);
-  auto rookOurs = BitBoard(planes[3].mask);
-  auto queenOurs = BitBoard(planes[4].mask);
-  auto kingOurs = BitBoard(planes[5].mask);
-  auto pawnsTheirs = BitBoard(planes[6].mask);
-  auto knightsTheirs = BitBoard(planes[7].mask);
-  auto bishopTheirs = BitBoard(planes[8].mask);
-  auto rookTheirs = BitBoard(planes[9].mask);
-  auto queenTheirs = BitBoard(planes[10].mask);
-  auto kingTheirs = BitBoard(planes[11].mask);
   ChessBoard::Castlings castlings;
   switch (input_format) {
     case pblczero::NetworkFormat::INPUT_CLASSICAL_112_PLANE: {
@@ -132,89 +122,24 @@ void PopulateBoard(pblczero::NetworkFormat::InputFormat input_format,
       throw Exception("Unsupported input plane encoding " +
                       std::to_string(input_format));
   }
-  std::string fen;
   // Canonical input has no sense of side to move, so we should simply assume
   // the starting position is always white.
-  bool black_to_move =
+  const bool black_to_move =
       !IsCanonicalFormat(input_format) && planes[kAuxPlaneBase + 4].mask != 0;
-  if (black_to_move) {
-    // Flip to white perspective rather than side to move perspective.
-    std::swap(pawnsOurs, pawnsTheirs);
-    std::swap(knightsOurs, knightsTheirs);
-    std::swap(bishopOurs, bishopTheirs);
-    std::swap(rookOurs, rookTheirs);
-    std::swap(queenOurs, queenTheirs);
-    std::swap(kingOurs, kingTheirs);
-    pawnsOurs.Mirror();
-    pawnsTheirs.Mirror();
-    knightsOurs.Mirror();
-    knightsTheirs.Mirror();
-    bishopOurs.Mirror();
-    bishopTheirs.Mirror();
-    rookOurs.Mirror();
-    rookTheirs.Mirror();
-    queenOurs.Mirror();
-    queenTheirs.Mirror();
-    kingOurs.Mirror();
-    kingTheirs.Mirror();
-    castlings.Mirror();
+  // The planes are from the side to move's point of view, same as the board.
+  std::array<BitBoard, 6> ours;
+  std::array<BitBoard, 6> theirs;
+  for (int i = 0; i < 6; ++i) {
+    ours[i] = BitBoard(planes[i].mask);
+    theirs[i] = BitBoard(planes[i + 6].mask);
   }
-  for (int row = 7; row >= 0; --row) {
-    int emptycounter = 0;
-    for (int col = 0; col < 8; ++col) {
-      char piece = '\0';
-      Square square(File::FromIdx(col), Rank::FromIdx(row));
-      if (pawnsOurs.get(square)) {
-        piece = 'P';
-      } else if (pawnsTheirs.get(square)) {
-        piece = 'p';
-      } else if (knightsOurs.get(square)) {
-        piece = 'N';
-      } else if (knightsTheirs.get(square)) {
-        piece = 'n';
-      } else if (bishopOurs.get(square)) {
-        piece = 'B';
-      } else if (bishopTheirs.get(square)) {
-        piece = 'b';
-      } else if (rookOurs.get(square)) {
-        piece = 'R';
-      } else if (rookTheirs.get(square)) {
-        piece = 'r';
-      } else if (queenOurs.get(square)) {
-        piece = 'Q';
-      } else if (queenTheirs.get(square)) {
-        piece = 'q';
-      } else if (kingOurs.get(square)) {
-        piece = 'K';
-      } else if (kingTheirs.get(square)) {
-        piece = 'k';
-      }
-      if (emptycounter > 0 && piece) {
-        fen += std::to_string(emptycounter);
-        emptycounter = 0;
-      }
-      if (piece) {
-        fen += piece;
-      } else {
-        emptycounter++;
-      }
-    }
-    if (emptycounter > 0) fen += std::to_string(emptycounter);
-    if (row > 0) fen += "/";
-  }
-  fen += " ";
-  fen += black_to_move ? "b" : "w";
-  fen += " ";
-  fen += castlings.as_string();
-  fen += " ";
+  BitBoard en_passant;
   if (IsCanonicalFormat(input_format)) {
     // Canonical format helpfully has the en passant details ready for us.
-    if (planes[kAuxPlaneBase + 4].mask == 0) {
-      fen += "-";
-    } else {
+    if (planes[kAuxPlaneBase + 4].mask != 0) {
       File file =
           File::FromIdx(GetLowestBit(planes[kAuxPlaneBase + 4].mask >> 56));
-      fen += Square(file, kRank6).ToString();
+      en_passant.set(Square(file, kRank6));
     }
   } else {
     auto pawndiff = BitBoard(planes[6].mask ^ planes[kPlanesPerBoard + 6].mask);
@@ -224,30 +149,33 @@ void PopulateBoard(pblczero::NetworkFormat::InputFormat input_format,
       auto from =
           SingleSquare(planes[kPlanesPerBoard + 6].mask & pawndiff.as_int());
       auto to = SingleSquare(planes[6].mask & pawndiff.as_int());
-      if (from.file() != to.file() || std::abs(from.rank() - to.rank()) != 2) {
-        fen += "-";
-      } else {
-        // TODO: Ensure enpassant is legal rather than setting it blindly?
-        // Doesn't matter for rescoring use case as only legal moves will be
-        // performed afterwards.
-        fen += Square(to.file(),
-                      (planes[kAuxPlaneBase + 4].mask != 0) ? kRank3 : kRank6)
-                   .ToString();
+      // TODO: Ensure enpassant is legal rather than setting it blindly?
+      // Doesn't matter for rescoring use case as only legal moves will be
+      // performed afterwards.
+      if (from.file() == to.file() && from.rank() == kRank7 &&
+          to.rank() == kRank5) {
+        en_passant.set(Square(to.file(), kRank6));
       }
-    } else {
-      fen += "-";
     }
   }
-  fen += " ";
   int rule50plane = (int)planes[kAuxPlaneBase + 5].value;
   if (IsHectopliesFormat(input_format)) {
     rule50plane = (int)(100.0f * planes[kAuxPlaneBase + 5].value);
   }
-  fen += std::to_string(rule50plane);
+  board->SetFromPieces(ours, theirs, castlings, en_passant, black_to_move);
+  if (rule50) *rule50 = rule50plane;
   // Reuse the 50 move rule as gameply since we don't know better.
-  fen += " ";
-  fen += std::to_string(rule50plane);
-  board->SetFromFen(fen, rule50, gameply);
+  if (gameply) *gameply = rule50plane;
+}
+
+void PopulateBoards(pblczero::NetworkFormat::InputFormat input_format,
+                    std::span<const InputPlanes> planes, ChessBoard* boards,
+                    int* rule50s, int* gameplies) {
+  for (size_t i = 0; i < planes.size(); ++i) {
+    PopulateBoard(input_format, planes[i], &boards[i],
+                  rule50s ? &rule50s[i] : nullptr,
+                  gameplies ? &gameplies[i] : nullptr);
+  }
 }
 
 Move DecodeMoveFromInput(const InputPlanes& planes, const InputPlanes& prior) {
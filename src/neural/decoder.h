@@ -27,6 +27,8 @@
 
 #pragma once
 
+#include <span>
+
 #include "chess/position.h"
 #include "neural/network.h"
 #include "proto/net.pb.h"
@@ -41,11 +43,18 @@ namespace lczero {
 // have already been reverted.
 Move DecodeMoveFromInput(const InputPlanes& planes, const InputPlanes& prev);
 
-// Decodes the current position into a board, rule50 and gameply.
+// Decodes the current position into a board, rule50 and gameply. The board is
+// built from the plane masks directly.
 //
 // NOTE: Assumes InputPlanes are not transformed, regardless of input_format.
 void PopulateBoard(pblczero::NetworkFormat::InputFormat input_format,
-                   InputPlanes planes, ChessBoard* board, int* rule50,
+                   const InputPlanes& planes, ChessBoard* board, int* rule50,
                    int* gameply);
 
+// Same as above for many positions, @boards and, unless null, @rule50s and
+// @gameplies have an entry per element of @planes.
+void PopulateBoards(pblczero::NetworkFormat::InputFormat input_format,
+                    std::span<const InputPlanes> planes, ChessBoard* boards,
+                    int* rule50s, int* gameplies);
+
 }  // namespace lczero
\ No newline at end of file
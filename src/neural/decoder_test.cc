@@ -0,0 +1,111 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "neural/decoder.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+
+#include "neural/encoder.h"
+
+namespace lczero {
+
+TEST(PopulateBoard, RoundTripsEncodedPositions) {
+  const pblczero::NetworkFormat::InputFormat kFormats[] = {
+      pblczero::NetworkFormat::INPUT_CLASSICAL_112_PLANE,
+      pblczero::NetworkFormat::INPUT_112_WITH_CASTLING_PLANE,
+  };
+  const char* kFens[] = {
+      ChessBoard::kStartposFen,
+      "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+      "rnbqkbnr/pp1ppppp/8/8/2pP4/8/PPP1PPPP/RNBQKBNR b KQkq d3 0 1",
+  };
+  auto sorted_moves = [](const ChessBoard& board) {
+    std::vector<uint16_t> moves;
+    for (const Move move : board.GenerateLegalMoves()) {
+      moves.push_back(move.raw_data());
+    }
+    std::sort(moves.begin(), moves.end());
+    return moves;
+  };
+  for (const auto format : kFormats) {
+    for (const char* fen : kFens) {
+      PositionHistory history;
+      history.Reset(ChessBoard(fen), 0, 1);
+      for (int ply = 0; ply < 60; ++ply) {
+        const ChessBoard& expected = history.Last().GetBoard();
+        const InputPlanes planes = EncodePositionForNN(
+            format, history, 8, FillEmptyHistory::NO, nullptr);
+        ChessBoard board;
+        int rule50;
+        int gameply;
+        PopulateBoard(format, planes, &board, &rule50, &gameply);
+        EXPECT_EQ(board.ours(), expected.ours()) << fen << " ply " << ply;
+        EXPECT_EQ(board.theirs(), expected.theirs()) << fen << " ply " << ply;
+        EXPECT_EQ(board.pawns(), expected.pawns());
+        EXPECT_EQ(board.knights(), expected.knights());
+        EXPECT_EQ(board.bishops(), expected.bishops());
+        EXPECT_EQ(board.rooks(), expected.rooks());
+        EXPECT_EQ(board.queens(), expected.queens());
+        EXPECT_EQ(board.kings(), expected.kings());
+        EXPECT_EQ(board.castlings().as_int(), expected.castlings().as_int());
+        EXPECT_EQ(board.flipped(), expected.flipped());
+        EXPECT_EQ(rule50, history.Last().GetRule50Ply());
+        // The decoder sets en passant flags that may not be capturable.
+        EXPECT_EQ(sorted_moves(board), sorted_moves(expected))
+            << fen << " ply " << ply;
+
+        const auto moves = expected.GenerateLegalMoves();
+        if (moves.empty()) break;
+        history.Append(moves[(ply * 11 + 5) % moves.size()]);
+      }
+    }
+  }
+}
+
+TEST(PopulateBoard, BatchMatchesSinglePositions) {
+  const auto format = pblczero::NetworkFormat::INPUT_112_WITH_CASTLING_PLANE;
+  PositionHistory history;
+  history.Reset(ChessBoard(ChessBoard::kStartposFen), 0, 1);
+  std::vector<InputPlanes> planes;
+  for (int ply = 0; ply < 20; ++ply) {
+    planes.push_back(EncodePositionForNN(format, history, 8,
+                                         FillEmptyHistory::NO, nullptr));
+    const auto moves = history.Last().GetBoard().GenerateLegalMoves();
+    history.Append(moves[(ply * 7 + 3) % moves.size()]);
+  }
+  std::vector<ChessBoard> boards(planes.size());
+  std::vector<int> rule50s(planes.size());
+  PopulateBoards(format, planes, boards.data(), rule50s.data(), nullptr);
+  for (size_t i = 0; i < planes.size(); ++i) {
+    ChessBoard board;
+    int rule50;
+    PopulateBoard(format, planes[i], &board, &rule50, nullptr);
+    EXPECT_EQ(board, boards[i]) << "position " << i;
+    EXPECT_EQ(rule50, rule50s[i]) << "position " << i;
+  }
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  lczero::InitializeMagicBitboards();
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,569 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "neural/diskcache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "neural/shared_params.h"
+#include "utils/atomic_vector.h"
+#include "utils/commandline.h"
+#include "utils/exception.h"
+#include "utils/fp16_utils.h"
+#include "utils/hashcat.h"
+#include "utils/logging.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+namespace lczero {
+namespace {
+
+uint64_t HashBytes(uint64_t hash, std::string_view bytes) {
+  size_t i = 0;
+  for (; i + 8 <= bytes.size(); i += 8) {
+    uint64_t word;
+    std::memcpy(&word, bytes.data() + i, 8);
+    hash = HashCat(hash, word);
+  }
+  uint64_t tail = 0;
+  std::memcpy(&tail, bytes.data() + i, bytes.size() - i);
+  return HashCat({hash, tail, bytes.size()});
+}
+
+uint64_t HashFileContents(uint64_t hash, const std::string& filename) {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) throw Exception("Cannot read weights file: " + filename);
+  std::vector<char> buffer(1 << 20);
+  while (file) {
+    file.read(buffer.data(), buffer.size());
+    hash = HashBytes(hash, {buffer.data(), static_cast<size_t>(file.gcount())});
+  }
+  return hash;
+}
+
+// Identifies everything besides the position that the evaluation depends on.
+// The weights are hashed by content, so that renamed or re-downloaded files
+// still share entries.
+uint64_t ComputeNetworkHash(const OptionsDict& options) {
+  std::string weights =
+      options.Get<std::string>(SharedBackendParams::kWeightsId);
+  if (weights == SharedBackendParams::kAutoDiscover) {
+    weights = DiscoverWeightsFile();
+  } else if (weights == SharedBackendParams::kEmbed) {
+    weights = CommandLine::BinaryName();
+  }
+  uint64_t hash = HashBytes(
+      0, options.Get<std::string>(SharedBackendParams::kBackendId));
+  hash = HashBytes(
+      hash, options.Get<std::string>(SharedBackendParams::kBackendOptionsId));
+  if (!weights.empty()) hash = HashFileContents(hash, weights);
+  return hash;
+}
+
+// The file starts with a header page, followed by the slots. All fields are
+// little endian words; the file is only meant to be shared between processes
+// on the same machine.
+constexpr uint64_t kMagic = 0x6568636143304c4cULL;  // "LL0Cache".
+constexpr uint32_t kVersion = 1;
+constexpr size_t kHeaderSize = 4096;
+constexpr size_t kWays = 4;
+
+struct FileHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t slot_size;
+  uint64_t num_slots;
+};
+
+// A slot is an array of words that are only accessed atomically, as other
+// processes may write them at the same time. Writers make the sequence odd
+// while they update the slot, so that readers can detect torn reads and
+// retry or give up (a seqlock).
+struct DiskSlot {
+  static constexpr size_t kSequence = 0;
+  static constexpr size_t kKey = 1;
+  // q and d floats.
+  static constexpr size_t kQD = 2;
+  // m float, number of moves and flags.
+  static constexpr size_t kMMovesFlags = 3;
+  static constexpr size_t kPriors = 4;
+  static constexpr size_t kNumWords = 64;
+  // Four fp16 priors per word, enough for any chess position.
+  static constexpr size_t kMaxPriors = (kNumWords - kPriors) * 4;
+
+  static constexpr uint16_t kHasPolicy = 1;
+
+  uint64_t words[kNumWords];
+};
+static_assert(sizeof(DiskSlot) == 512);
+static_assert(std::atomic_ref<uint64_t>::is_always_lock_free);
+
+uint64_t PackFloats(float lo, float hi) {
+  return std::bit_cast<uint32_t>(lo) |
+         (uint64_t{std::bit_cast<uint32_t>(hi)} << 32);
+}
+float LowFloat(uint64_t word) {
+  return std::bit_cast<float>(static_cast<uint32_t>(word));
+}
+float HighFloat(uint64_t word) {
+  return std::bit_cast<float>(static_cast<uint32_t>(word >> 32));
+}
+
+// A file mapped read-write into memory, shared with other processes. Creates
+// and formats the file if it doesn't exist or is empty.
+class MappedCacheFile {
+ public:
+  MappedCacheFile(const std::string& filename, uint64_t num_slots) {
+#ifndef _WIN32
+    const int fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd == -1) throw Exception("Cannot open disk cache file " + filename);
+    // Serializes formatting the file between processes.
+    flock(fd, LOCK_EX);
+    struct stat statbuf;
+    fstat(fd, &statbuf);
+    FileHeader header{};
+    if (statbuf.st_size == 0) {
+      header = FileHeader{kMagic, kVersion, sizeof(DiskSlot), num_slots};
+      if (ftruncate(fd, kHeaderSize + num_slots * sizeof(DiskSlot)) != 0 ||
+          pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        ::close(fd);
+        throw Exception("Cannot create disk cache file " + filename);
+      }
+    } else if (pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+      header.magic = 0;
+    }
+    size_ = statbuf.st_size == 0 ? kHeaderSize + num_slots * sizeof(DiskSlot)
+                                 : statbuf.st_size;
+    if (!CheckHeader(filename, header)) {
+      ::close(fd);
+      throw Exception(filename + " is not a compatible disk cache file");
+    }
+    base_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+#if defined(MADV_RANDOM)
+    if (base_ != MAP_FAILED) madvise(base_, size_, MADV_RANDOM);
+#endif
+    flock(fd, LOCK_UN);
+    ::close(fd);
+    if (base_ == MAP_FAILED) {
+      throw Exception("Could not mmap() " + filename);
+    }
+#else
+    const HANDLE fd =
+        CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE,
+                    FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS,
+                    FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (fd == INVALID_HANDLE_VALUE) {
+      throw Exception("Cannot open disk cache file " + filename);
+    }
+    OVERLAPPED overlapped{};
+    LockFileEx(fd, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped);
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(fd, &file_size);
+    FileHeader header{};
+    DWORD bytes = 0;
+    if (file_size.QuadPart == 0) {
+      header = FileHeader{kMagic, kVersion, sizeof(DiskSlot), num_slots};
+      file_size.QuadPart = kHeaderSize + num_slots * sizeof(DiskSlot);
+      if (!SetFilePointerEx(fd, file_size, nullptr, FILE_BEGIN) ||
+          !SetEndOfFile(fd) ||
+          !SetFilePointerEx(fd, LARGE_INTEGER{}, nullptr, FILE_BEGIN) ||
+          !WriteFile(fd, &header, sizeof(header), &bytes, nullptr)) {
+        CloseHandle(fd);
+        throw Exception("Cannot create disk cache file " + filename);
+      }
+    } else if (!ReadFile(fd, &header, sizeof(header), &bytes, nullptr) ||
+               bytes != sizeof(header)) {
+      header.magic = 0;
+    }
+    size_ = file_size.QuadPart;
+    if (!CheckHeader(filename, header)) {
+      CloseHandle(fd);
+      throw Exception(filename + " is not a compatible disk cache file");
+    }
+    mapping_ = CreateFileMapping(fd, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+    UnlockFileEx(fd, 0, MAXDWORD, MAXDWORD, &overlapped);
+    CloseHandle(fd);
+    if (!mapping_) throw Exception("CreateFileMapping() failed");
+    base_ = MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (!base_) {
+      CloseHandle(mapping_);
+      throw Exception("MapViewOfFile() failed, name = " + filename +
+                      ", error = " + std::to_string(GetLastError()));
+    }
+#endif
+  }
+
+  ~MappedCacheFile() {
+#ifndef _WIN32
+    munmap(base_, size_);
+#else
+    UnmapViewOfFile(base_);
+    CloseHandle(mapping_);
+#endif
+  }
+
+  DiskSlot* slots() const {
+    return reinterpret_cast<DiskSlot*>(static_cast<char*>(base_) +
+                                       kHeaderSize);
+  }
+  uint64_t num_slots() const { return num_slots_; }
+
+ private:
+  // Validates the header of an existing file. The slot count of the file wins
+  // over the requested one, as other processes may have it mapped.
+  bool CheckHeader(const std::string& filename, const FileHeader& header) {
+    if (header.magic != kMagic || header.version != kVersion ||
+        header.slot_size != sizeof(DiskSlot) || header.num_slots < kWays ||
+        size_ != kHeaderSize + header.num_slots * sizeof(DiskSlot)) {
+      return false;
+    }
+    num_slots_ = header.num_slots;
+    CERR << "Using disk cache " << filename << " with " << num_slots_
+         << " slots.";
+    return true;
+  }
+
+  void* base_ = nullptr;
+  size_t size_ = 0;
+  uint64_t num_slots_ = 0;
+#ifdef _WIN32
+  HANDLE mapping_ = nullptr;
+#endif
+};
+
+// Set associative cache over the mapped file, each key may be in one of
+// kWays consecutive slots. There are no locks: concurrent writers of the same
+// slot give up instead of waiting.
+class DiskCacheTable {
+ public:
+  DiskCacheTable(const std::string& filename, uint64_t num_slots)
+      : file_(filename, num_slots),
+        num_buckets_(file_.num_slots() / kWays) {}
+
+  // Looks up the evaluation of a position with @num_moves legal moves and
+  // writes it to @result. Returns false if it's not in the cache, or if the
+  // priors are needed but weren't stored.
+  bool Lookup(uint64_t key, size_t num_moves, bool need_policy,
+              const EvalResultPtr& result) const {
+    DiskSlot* bucket = GetBucket(key);
+    for (size_t way = 0; way < kWays; ++way) {
+      if (TryRead(bucket[way], key, num_moves, need_policy, result)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Stores the evaluation, unless it's already there with the priors.
+  void Insert(uint64_t key, float q, float d, float m,
+              std::span<const float> priors, size_t num_moves) {
+    if (num_moves > DiskSlot::kMaxPriors) return;
+    DiskSlot* bucket = GetBucket(key);
+    size_t victim = kWays;
+    for (size_t way = 0; way < kWays; ++way) {
+      const uint64_t word = Load(bucket[way], DiskSlot::kMMovesFlags);
+      const uint64_t slot_key = Load(bucket[way], DiskSlot::kKey);
+      if (slot_key == key) {
+        if (priors.empty() || (word >> 48) & DiskSlot::kHasPolicy) return;
+        victim = way;
+        break;
+      }
+      if (slot_key == 0 && victim == kWays) victim = way;
+    }
+    if (victim == kWays) {
+      victim = next_victim_.fetch_add(1, std::memory_order_relaxed) % kWays;
+    }
+    Write(bucket[victim], key, q, d, m, priors, num_moves);
+  }
+
+ private:
+  static std::atomic_ref<uint64_t> Word(DiskSlot& slot, size_t idx) {
+    return std::atomic_ref<uint64_t>(slot.words[idx]);
+  }
+  static uint64_t Load(DiskSlot& slot, size_t idx) {
+    return Word(slot, idx).load(std::memory_order_relaxed);
+  }
+  static void Store(DiskSlot& slot, size_t idx, uint64_t value) {
+    Word(slot, idx).store(value, std::memory_order_relaxed);
+  }
+
+  DiskSlot* GetBucket(uint64_t key) const {
+    return file_.slots() + (key % num_buckets_) * kWays;
+  }
+
+  static bool TryRead(DiskSlot& slot, uint64_t key, size_t num_moves,
+                      bool need_policy, const EvalResultPtr& result) {
+    const uint64_t sequence =
+        Word(slot, DiskSlot::kSequence).load(std::memory_order_acquire);
+    if (sequence & 1) return false;
+    if (Load(slot, DiskSlot::kKey) != key) return false;
+    const uint64_t qd = Load(slot, DiskSlot::kQD);
+    const uint64_t m_moves_flags = Load(slot, DiskSlot::kMMovesFlags);
+    const size_t slot_moves = (m_moves_flags >> 32) & 0xffff;
+    const bool has_policy = (m_moves_flags >> 48) & DiskSlot::kHasPolicy;
+    const bool copy_policy = has_policy && slot_moves == result.p.size() &&
+                             slot_moves <= DiskSlot::kMaxPriors;
+    if (need_policy && (!has_policy || slot_moves != num_moves)) return false;
+    // Priors are decoded straight into the result, which is only valid when
+    // the sequence check below passes.
+    if (copy_policy) {
+      for (size_t i = 0; i < slot_moves; i += 4) {
+        const uint64_t word = Load(slot, DiskSlot::kPriors + i / 4);
+        for (size_t j = i; j < std::min(i + 4, slot_moves); ++j) {
+          result.p[j] = FP16toFP32(word >> (16 * (j - i)));
+        }
+      }
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (Load(slot, DiskSlot::kSequence) != sequence) return false;
+    if (result.q) *result.q = LowFloat(qd);
+    if (result.d) *result.d = HighFloat(qd);
+    if (result.m) *result.m = LowFloat(m_moves_flags);
+    return true;
+  }
+
+  static void Write(DiskSlot& slot, uint64_t key, float q, float d, float m,
+                    std::span<const float> priors, size_t num_moves) {
+    uint64_t sequence = Load(slot, DiskSlot::kSequence);
+    // Another writer is there. A process that died mid-write leaves the slot
+    // locked, which only costs that one slot.
+    if (sequence & 1) return;
+    if (!Word(slot, DiskSlot::kSequence)
+             .compare_exchange_strong(sequence, sequence + 1,
+                                      std::memory_order_relaxed)) {
+      return;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    Store(slot, DiskSlot::kKey, key);
+    Store(slot, DiskSlot::kQD, PackFloats(q, d));
+    const uint64_t flags = priors.empty() ? 0 : DiskSlot::kHasPolicy;
+    Store(slot, DiskSlot::kMMovesFlags,
+          std::bit_cast<uint32_t>(m) | (uint64_t{num_moves} << 32) |
+              (flags << 48));
+    for (size_t i = 0; i < priors.size(); i += 4) {
+      uint64_t word = 0;
+      for (size_t j = i; j < std::min(i + 4, priors.size()); ++j) {
+        word |= uint64_t{FP32toFP16(priors[j])} << (16 * (j - i));
+      }
+      Store(slot, DiskSlot::kPriors + i / 4, word);
+    }
+    Word(slot, DiskSlot::kSequence)
+        .store(sequence + 2, std::memory_order_release);
+  }
+
+  MappedCacheFile file_;
+  const uint64_t num_buckets_;
+  std::atomic<size_t> next_victim_ = 0;
+};
+
+class DiskCache : public Backend {
+ public:
+  DiskCache(std::unique_ptr<Backend> wrapped, const OptionsDict& options)
+      : wrapped_backend_(std::move(wrapped)),
+        filename_(options.Get<std::string>(
+            SharedBackendParams::kDiskCacheFileId)),
+        table_(filename_,
+               (uint64_t{static_cast<uint32_t>(options.Get<int>(
+                    SharedBackendParams::kDiskCacheSizeId))}
+                << 20) /
+                   sizeof(DiskSlot) / kWays * kWays),
+        weights_path_(
+            options.Get<std::string>(SharedBackendParams::kWeightsId)),
+        network_hash_(ComputeNetworkHash(options)),
+        max_batch_size_(wrapped_backend_->GetAttributes().maximum_batch_size) {
+    UpdateKey(options);
+  }
+
+  BackendAttributes GetAttributes() const override {
+    return wrapped_backend_->GetAttributes();
+  }
+  std::unique_ptr<BackendComputation> CreateComputation() override;
+  std::optional<EvalResult> GetCachedEvaluation(
+      const EvalPosition& pos) override {
+    EvalResult result;
+    result.p.resize(pos.legal_moves.size());
+    if (table_.Lookup(ComputeKey(pos), pos.legal_moves.size(),
+                      !pos.legal_moves.empty(), result.AsPtr())) {
+      return result;
+    }
+    return wrapped_backend_->GetCachedEvaluation(pos);
+  }
+
+  UpdateConfigurationResult UpdateConfiguration(
+      const OptionsDict& options) override {
+    // The size only matters when the file is created, so it's not checked.
+    if (filename_ !=
+        options.Get<std::string>(SharedBackendParams::kDiskCacheFileId)) {
+      return NEED_RESTART;
+    }
+    const UpdateConfigurationResult result =
+        wrapped_backend_->UpdateConfiguration(options);
+    if (result != UPDATE_OK) return result;
+    // The backend may have swapped the weights in place.
+    const std::string weights_path =
+        options.Get<std::string>(SharedBackendParams::kWeightsId);
+    if (weights_path != weights_path_) {
+      weights_path_ = weights_path;
+      network_hash_ = ComputeNetworkHash(options);
+    }
+    UpdateKey(options);
+    return result;
+  }
+
+ private:
+  // The policy temperature is applied by the backend, so the stored priors
+  // depend on it too.
+  void UpdateKey(const OptionsDict& options) {
+    key_salt_ = HashCat(
+        network_hash_,
+        std::bit_cast<uint32_t>(
+            options.Get<float>(SharedBackendParams::kPolicySoftmaxTemp)));
+    history_length_ =
+        options.Get<int>(SharedBackendParams::kCacheHistoryLengthId);
+  }
+  uint64_t ComputeKey(const EvalPosition& pos) const {
+    const uint64_t key =
+        HashCat(key_salt_, ComputeEvalPositionKey(pos.pos, history_length_));
+    return key == 0 ? 1 : key;
+  }
+
+  std::unique_ptr<Backend> wrapped_backend_;
+  const std::string filename_;
+  DiskCacheTable table_;
+  std::string weights_path_;
+  uint64_t network_hash_;
+  uint64_t key_salt_;
+  int history_length_;
+  const size_t max_batch_size_;
+  friend class DiskCacheComputation;
+};
+
+class DiskCacheComputation : public BackendComputation {
+ public:
+  DiskCacheComputation(std::unique_ptr<BackendComputation> wrapped_computation,
+                       DiskCache* cache)
+      : wrapped_computation_(std::move(wrapped_computation)),
+        cache_(cache),
+        entries_(cache->max_batch_size_) {}
+
+ private:
+  size_t UsedBatchSize() const override {
+    return wrapped_computation_->UsedBatchSize();
+  }
+  AddInputResult AddInput(const EvalPosition& pos,
+                          EvalResultPtr result) override {
+    const uint64_t key = cache_->ComputeKey(pos);
+    if (cache_->table_.Lookup(key, pos.legal_moves.size(),
+                              !pos.legal_moves.empty(), result)) {
+      return AddInputResult::FETCHED_IMMEDIATELY;
+    }
+    size_t entry_idx = entries_.emplace_back(Entry{key, {}, result, false});
+    auto& value = entries_[entry_idx].value;
+    value.p.resize(pos.legal_moves.size());
+    const AddInputResult res = wrapped_computation_->AddInput(
+        pos, EvalResultPtr{&value.q, &value.d, &value.m, value.p});
+    // A lower level cache had it, no need to write it to the disk.
+    if (res == AddInputResult::FETCHED_IMMEDIATELY) {
+      entries_[entry_idx].fetched = true;
+      CopyResult(value, result);
+    }
+    return res;
+  }
+
+  void ComputeBlocking() override {
+    wrapped_computation_->ComputeBlocking();
+    StoreResults();
+  }
+
+  void ComputeAsync(std::function<void()> done) override {
+    wrapped_computation_->ComputeAsync([this, done = std::move(done)]() {
+      StoreResults();
+      done();
+    });
+  }
+
+  void StoreResults() {
+    for (auto& entry : entries_) {
+      if (entry.fetched) continue;
+      CopyResult(entry.value, entry.result_ptr);
+      cache_->table_.Insert(entry.key, entry.value.q, entry.value.d,
+                            entry.value.m, entry.value.p, entry.value.p.size());
+    }
+  }
+
+  static void CopyResult(const EvalResult& value, const EvalResultPtr& ptr) {
+    if (ptr.q) *ptr.q = value.q;
+    if (ptr.d) *ptr.d = value.d;
+    if (ptr.m) *ptr.m = value.m;
+    std::copy(value.p.begin(), value.p.begin() + ptr.p.size(), ptr.p.begin());
+  }
+
+  struct Entry {
+    uint64_t key;
+    EvalResult value;
+    EvalResultPtr result_ptr;
+    bool fetched;
+  };
+
+  std::unique_ptr<BackendComputation> wrapped_computation_;
+  DiskCache* cache_;
+  AtomicVector<Entry> entries_;
+};
+
+std::unique_ptr<BackendComputation> DiskCache::CreateComputation() {
+  return std::make_unique<DiskCacheComputation>(
+      wrapped_backend_->CreateComputation(), this);
+}
+
+}  // namespace
+
+std::unique_ptr<Backend> MaybeCreateDiskCache(std::unique_ptr<Backend> wrapped,
+                                              const OptionsDict& options) {
+  if (options.Get<std::string>(SharedBackendParams::kDiskCacheFileId).empty()) {
+    return wrapped;
+  }
+  return std::make_unique<DiskCache>(std::move(wrapped), options);
+}
+
+}  // namespace lczero
@@ -100,6 +100,53 @@ int ChooseTransform(const ChessBoard& board) {
   }
   return transform;
 }
+
+uint64_t TransformMask(uint64_t v, int transform) {
+  if ((transform & FlipTransform) != 0) v = ReverseBitsInBytes(v);
+  if ((transform & MirrorTransform) != 0) v = ReverseBytesInBytes(v);
+  if ((transform & TransposeTransform) != 0) v = TransposeBitsInBytes(v);
+  return v;
+}
+
+// The individual transforms are involutions, so applying them in the reverse
+// order undoes TransformMask().
+uint64_t UntransformMask(uint64_t v, int transform) {
+  if ((transform & TransposeTransform) != 0) v = TransposeBitsInBytes(v);
+  if ((transform & MirrorTransform) != 0) v = ReverseBytesInBytes(v);
+  if ((transform & FlipTransform) != 0) v = ReverseBitsInBytes(v);
+  return v;
+}
+
+template <int kTransform>
+void TransformMasksWith(uint64_t* masks, int count) {
+  for (int i = 0; i < count; ++i) {
+    masks[i] = TransformMask(masks[i], kTransform);
+  }
+}
+
+// Transforms @count contiguous masks. The transform is picked once and the
+// loops have no branches (0 and ~0 don't change anyway), so that the compiler
+// vectorizes them.
+void TransformMasks(uint64_t* masks, int count, int transform) {
+  switch (transform) {
+    case 0:
+      return;
+    case 1:
+      return TransformMasksWith<1>(masks, count);
+    case 2:
+      return TransformMasksWith<2>(masks, count);
+    case 3:
+      return TransformMasksWith<3>(masks, count);
+    case 4:
+      return TransformMasksWith<4>(masks, count);
+    case 5:
+      return TransformMasksWith<5>(masks, count);
+    case 6:
+      return TransformMasksWith<6>(masks, count);
+    case 7:
+      return TransformMasksWith<7>(masks, count);
+  }
+}
 }  // namespace
 
 bool IsCanonicalFormat(pblczero::NetworkFormat::InputFormat input_format) {
@@ -131,12 +178,48 @@ int TransformForPosition(pblczero::NetworkFormat::InputFormat input_format,
   return ChooseTransform(board);
 }
 
-InputPlanes EncodePositionForNN(
-    pblczero::NetworkFormat::InputFormat input_format,
-    std::span<const Position> history, int history_planes,
-    FillEmptyHistory fill_empty_history, int* transform_out) {
-  InputPlanes result(kAuxPlaneBase + 8);
+namespace {
+// Lets the encoder write to an InputPlanesView the same way as to InputPlanes.
+struct PlaneRef {
+  uint64_t& mask;
+  float& value;
+  void SetAll() { mask = ~0ull; }
+  void Fill(float val) {
+    SetAll();
+    value = val;
+  }
+};
 
+struct ViewPlanes {
+  InputPlanesView view;
+  PlaneRef operator[](int i) const { return {view.masks[i], view.values[i]}; }
+};
+
+ViewPlanes ClearedPlanes(InputPlanesView view) {
+  std::fill_n(view.masks, kInputPlanes, 0ull);
+  std::fill_n(view.values, kInputPlanes, 1.0f);
+  return {view};
+}
+
+void TransformPlanes(InputPlanes& planes, int transform) {
+  for (int i = 0; i <= kAuxPlaneBase + 4; i++) {
+    auto v = planes[i].mask;
+    if (v == 0 || v == ~0ULL) continue;
+    planes[i].mask = TransformMask(v, transform);
+  }
+}
+
+void TransformPlanes(ViewPlanes& planes, int transform) {
+  TransformMasks(planes.view.masks, kAuxPlaneBase + 5, transform);
+}
+
+// Encodes into @result, which must be all zero masks and unit values. Returns
+// the transform.
+template <typename Planes>
+int EncodeInto(Planes& result,
+               pblczero::NetworkFormat::InputFormat input_format,
+               std::span<const Position> history, int history_planes,
+               FillEmptyHistory fill_empty_history) {
   int transform = 0;
   // Canonicalization format needs to stop early to avoid applying transform in
   // history across incompatible transitions.  It is also more canonical since
@@ -306,27 +389,112 @@ InputPlanes EncodePositionForNN(
     // pawn push, so no need to go back further if stopping early.
     if (stop_early && position.GetRule50Ply() == 0) break;
   }
-  if (transform != NoTransform) {
-    // Transform all masks.
-    for (int i = 0; i <= kAuxPlaneBase + 4; i++) {
-      auto v = result[i].mask;
-      if (v == 0 || v == ~0ULL) continue;
-      if ((transform & FlipTransform) != 0) {
-        v = ReverseBitsInBytes(v);
-      }
-      if ((transform & MirrorTransform) != 0) {
-        v = ReverseBytesInBytes(v);
-      }
-      if ((transform & TransposeTransform) != 0) {
-        v = TransposeBitsInBytes(v);
+  // Transform all masks.
+  if (transform != NoTransform) TransformPlanes(result, transform);
+  return transform;
+}
+
+// Encodes using the older history frames of @relative, see encoder.h. Returns
+// the transform.
+template <typename Planes, typename RelativePlanes>
+int EncodeUsingRelative(Planes& result,
+                        pblczero::NetworkFormat::InputFormat input_format,
+                        std::span<const Position> history, int history_planes,
+                        FillEmptyHistory fill_empty_history,
+                        EncodedRelative relation, const RelativePlanes& relative,
+                        int relative_transform) {
+  const int frames = std::min(history_planes, kMoveHistory);
+  auto encode_fully = [&]() {
+    return EncodeInto(result, input_format, history, history_planes,
+                      fill_empty_history);
+  };
+  // Canonical v2 skips non-repeated positions, so frames don't simply shift.
+  if (history.size() < 2 || frames < 2 ||
+      input_format ==
+          pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_V2 ||
+      input_format == pblczero::NetworkFormat::
+                          INPUT_112_WITH_CANONICALIZATION_V2_ARMAGEDDON) {
+    return encode_fully();
+  }
+  if (IsCanonicalFormat(input_format)) {
+    // Canonical formats stop right after the newest board in these cases, then
+    // there's nothing to reuse anyway.
+    const Position& last = history.back();
+    const ChessBoard& parent = history[history.size() - 2].GetBoard();
+    auto parent_castlings = parent.castlings();
+    parent_castlings.Mirror();
+    if (last.GetRule50Ply() == 0 || !parent.en_passant().empty() ||
+        parent_castlings.as_int() != last.GetBoard().castlings().as_int()) {
+      return encode_fully();
+    }
+  }
+  // A sibling may have stopped early where this position doesn't. The parent
+  // board always has a king, so look for it.
+  if (relation == EncodedRelative::kSibling &&
+      relative[kPlanesPerBoard + 5].mask == 0) {
+    return encode_fully();
+  }
+
+  const int transform =
+      EncodeInto(result, input_format, history, 1, fill_empty_history);
+  const bool is_parent = relation == EncodedRelative::kParent;
+  for (int i = 1; i < frames; ++i) {
+    const int base = i * kPlanesPerBoard;
+    const int relative_base = is_parent ? base - kPlanesPerBoard : base;
+    for (int j = 0; j < kPlanesPerBoard; ++j) {
+      // The parent was encoded from the other side's point of view, so swap
+      // ours and theirs and mirror the ranks.
+      const int src = relative_base + (is_parent && j < 12 ? (j + 6) % 12 : j);
+      uint64_t v = relative[src].mask;
+      if (v == 0 || v == ~0ULL) {
+        result[base + j].mask = v;
+        continue;
       }
-      result[i].mask = v;
+      v = UntransformMask(v, relative_transform);
+      if (is_parent) v = ReverseBytesInBytes(v);
+      result[base + j].mask = TransformMask(v, transform);
     }
   }
+  return transform;
+}
+}  // namespace
+
+InputPlanes EncodePositionForNN(
+    pblczero::NetworkFormat::InputFormat input_format,
+    std::span<const Position> history, int history_planes,
+    FillEmptyHistory fill_empty_history, int* transform_out) {
+  InputPlanes result(kAuxPlaneBase + 8);
+  const int transform = EncodeInto(result, input_format, history,
+                                   history_planes, fill_empty_history);
   if (transform_out) *transform_out = transform;
   return result;
 }
 
+void EncodePositionForNN(pblczero::NetworkFormat::InputFormat input_format,
+                         std::span<const Position> history, int history_planes,
+                         FillEmptyHistory fill_empty_history,
+                         int* transform_out, InputPlanesView out) {
+  ViewPlanes result = ClearedPlanes(out);
+  const int transform = EncodeInto(result, input_format, history,
+                                   history_planes, fill_empty_history);
+  if (transform_out) *transform_out = transform;
+}
+
+void EncodePositionsForNN(
+    pblczero::NetworkFormat::InputFormat input_format,
+    std::span<const std::span<const Position>> histories, int history_planes,
+    FillEmptyHistory fill_empty_history, int* transforms_out, uint64_t* masks,
+    float* values) {
+  std::fill_n(masks, histories.size() * kInputPlanes, 0ull);
+  std::fill_n(values, histories.size() * kInputPlanes, 1.0f);
+  for (size_t i = 0; i < histories.size(); ++i) {
+    ViewPlanes result{{masks + i * kInputPlanes, values + i * kInputPlanes}};
+    const int transform = EncodeInto(result, input_format, histories[i],
+                                     history_planes, fill_empty_history);
+    if (transforms_out) transforms_out[i] = transform;
+  }
+}
+
 InputPlanes EncodePositionForNN(
     pblczero::NetworkFormat::InputFormat input_format,
     const PositionHistory& history, int history_planes,
@@ -335,6 +503,37 @@ InputPlanes EncodePositionForNN(
                              history_planes, fill_empty_history, transform_out);
 }
 
+InputPlanes EncodePositionForNN(
+    pblczero::NetworkFormat::InputFormat input_format,
+    std::span<const Position> history, int history_planes,
+    FillEmptyHistory fill_empty_history, int* transform_out,
+    EncodedRelative relation, const InputPlanes& relative,
+    int relative_transform) {
+  if (relative.size() != static_cast<size_t>(kAuxPlaneBase + 8)) {
+    return EncodePositionForNN(input_format, history, history_planes,
+                               fill_empty_history, transform_out);
+  }
+  InputPlanes result(kAuxPlaneBase + 8);
+  const int transform = EncodeUsingRelative(
+      result, input_format, history, history_planes, fill_empty_history,
+      relation, relative, relative_transform);
+  if (transform_out) *transform_out = transform;
+  return result;
+}
+
+void EncodePositionForNN(pblczero::NetworkFormat::InputFormat input_format,
+                         std::span<const Position> history, int history_planes,
+                         FillEmptyHistory fill_empty_history,
+                         int* transform_out, EncodedRelative relation,
+                         InputPlanesView relative, int relative_transform,
+                         InputPlanesView out) {
+  ViewPlanes result = ClearedPlanes(out);
+  const int transform = EncodeUsingRelative(
+      result, input_format, history, history_planes, fill_empty_history,
+      relation, ViewPlanes{relative}, relative_transform);
+  if (transform_out) *transform_out = transform;
+}
+
 namespace {
 const char* kMoveStrs[] = {
     "a1b1",  "a1c1",  "a1d1",  "a1e1",  "a1f1",  "a1g1",  "a1h1",  "a1a2",
@@ -56,6 +56,49 @@ InputPlanes EncodePositionForNN(
     std::span<const Position> positions, int history_planes,
     FillEmptyHistory fill_empty_history, int* transform_out);
 
+// How an already encoded position relates to the one being encoded.
+enum class EncodedRelative {
+  // The position before the last one.
+  kParent,
+  // Another position that follows the same history.
+  kSibling,
+};
+
+// Same as above, but takes the older history frames from @relative, which was
+// encoded with the same parameters and returned @relative_transform. Only the
+// newest board and the auxiliary planes are computed. Falls back to the full
+// encoding when the input format or position doesn't allow the reuse.
+InputPlanes EncodePositionForNN(
+    pblczero::NetworkFormat::InputFormat input_format,
+    std::span<const Position> positions, int history_planes,
+    FillEmptyHistory fill_empty_history, int* transform_out,
+    EncodedRelative relation, const InputPlanes& relative,
+    int relative_transform);
+
+// Same as the two above, but write the planes to @out, e.g. a backend's input
+// buffer, instead of allocating InputPlanes.
+void EncodePositionForNN(pblczero::NetworkFormat::InputFormat input_format,
+                         std::span<const Position> positions,
+                         int history_planes,
+                         FillEmptyHistory fill_empty_history,
+                         int* transform_out, InputPlanesView out);
+void EncodePositionForNN(pblczero::NetworkFormat::InputFormat input_format,
+                         std::span<const Position> positions,
+                         int history_planes,
+                         FillEmptyHistory fill_empty_history,
+                         int* transform_out, EncodedRelative relation,
+                         InputPlanesView relative, int relative_transform,
+                         InputPlanesView out);
+
+// Encodes the last position of each of @histories into contiguous arrays of
+// histories.size() * kInputPlanes @masks and @values, one position after
+// another. When not null, @transforms_out receives a transform per position.
+void EncodePositionsForNN(
+    pblczero::NetworkFormat::InputFormat input_format,
+    std::span<const std::span<const Position>> histories, int history_planes,
+    FillEmptyHistory fill_empty_history, int* transforms_out, uint64_t* masks,
+    float* values);
+
 bool IsCanonicalFormat(pblczero::NetworkFormat::InputFormat input_format);
 bool IsCanonicalArmageddonFormat(
     pblczero::NetworkFormat::InputFormat input_format);
@@ -18,6 +18,8 @@
 
 #include "src/neural/encoder.h"
 
+#include <array>
+
 #include <gtest/gtest.h>
 
 namespace lczero {
@@ -531,6 +533,163 @@ TEST(EncodePositionForNN, EncodeEarlyGameFlipFormat3) {
   EXPECT_EQ(their_king_plane.value, 1.0f);
 }
 
+TEST(EncodePositionForNN, EncodeFromRelativeMatchesFullEncoding) {
+  const pblczero::NetworkFormat::InputFormat kFormats[] = {
+      pblczero::NetworkFormat::INPUT_CLASSICAL_112_PLANE,
+      pblczero::NetworkFormat::INPUT_112_WITH_CASTLING_PLANE,
+      pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION,
+      pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_HECTOPLIES,
+      pblczero::NetworkFormat::
+          INPUT_112_WITH_CANONICALIZATION_HECTOPLIES_ARMAGEDDON,
+      pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_V2,
+  };
+  const FillEmptyHistory kFills[] = {
+      FillEmptyHistory::NO, FillEmptyHistory::FEN_ONLY,
+      FillEmptyHistory::ALWAYS};
+  // Pawnless endgames to get all transforms and repetitions.
+  const char* kFens[] = {
+      ChessBoard::kStartposFen,
+      "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+      "8/8/3k4/8/8/2K5/8/4R3 w - - 0 1",
+      "8/2n5/3k4/8/4Q3/2K5/8/8 b - - 0 40",
+  };
+  auto expect_same = [](const InputPlanes& a, const InputPlanes& b) {
+    ASSERT_EQ(a.size(), b.size());
+    for (size_t i = 0; i < a.size(); ++i) {
+      EXPECT_EQ(a[i].mask, b[i].mask) << "plane " << i;
+      EXPECT_EQ(a[i].value, b[i].value) << "plane " << i;
+    }
+  };
+  // An input buffer with stale contents, as a backend would hand out.
+  struct PlanesBuffer {
+    PlanesBuffer() {
+      masks.fill(0xabababababababab);
+      values.fill(-7.0f);
+    }
+    InputPlanesView View() { return {masks.data(), values.data()}; }
+    std::array<uint64_t, kInputPlanes> masks;
+    std::array<float, kInputPlanes> values;
+  };
+  auto expect_same_buffer = [](const InputPlanes& a, const PlanesBuffer& b) {
+    ASSERT_EQ(a.size(), b.masks.size());
+    for (size_t i = 0; i < a.size(); ++i) {
+      EXPECT_EQ(a[i].mask, b.masks[i]) << "plane " << i;
+      EXPECT_EQ(a[i].value, b.values[i]) << "plane " << i;
+    }
+  };
+  for (const char* fen : kFens) {
+    ChessBoard board;
+    int rule50;
+    int moves;
+    board.SetFromFen(fen, &rule50, &moves);
+    PositionHistory history;
+    history.Reset(board, rule50, moves);
+    for (int ply = 0; ply < 40; ++ply) {
+      const auto legal_moves = history.Last().GetBoard().GenerateLegalMoves();
+      if (legal_moves.size() < 2) break;
+      const Move move = legal_moves[(ply * 7 + 3) % legal_moves.size()];
+      const Move sibling_move = legal_moves[(ply * 7 + 4) % legal_moves.size()];
+      const PositionHistory parent = history;
+      PositionHistory sibling = history;
+      sibling.Append(sibling_move);
+      history.Append(move);
+      const PositionHistory& child = history;
+      for (const auto format : kFormats) {
+        for (const auto fill : kFills) {
+          int transform;
+          const InputPlanes expected =
+              EncodePositionForNN(format, child, 8, fill, &transform);
+          int relative_transform;
+          const InputPlanes parent_planes = EncodePositionForNN(
+              format, parent, 8, fill, &relative_transform);
+          int incremental_transform;
+          expect_same(expected,
+                      EncodePositionForNN(format, child.GetPositions(), 8,
+                                          fill, &incremental_transform,
+                                          EncodedRelative::kParent,
+                                          parent_planes, relative_transform));
+          EXPECT_EQ(transform, incremental_transform);
+          const InputPlanes sibling_planes = EncodePositionForNN(
+              format, sibling, 8, fill, &relative_transform);
+          expect_same(expected,
+                      EncodePositionForNN(format, child.GetPositions(), 8,
+                                          fill, &incremental_transform,
+                                          EncodedRelative::kSibling,
+                                          sibling_planes, relative_transform));
+          EXPECT_EQ(transform, incremental_transform);
+
+          PlanesBuffer buffer;
+          EncodePositionForNN(format, child.GetPositions(), 8, fill,
+                              &incremental_transform, buffer.View());
+          expect_same_buffer(expected, buffer);
+          EXPECT_EQ(transform, incremental_transform);
+          PlanesBuffer parent_buffer;
+          EncodePositionForNN(format, parent.GetPositions(), 8, fill,
+                              &relative_transform, parent_buffer.View());
+          PlanesBuffer relative_buffer;
+          EncodePositionForNN(format, child.GetPositions(), 8, fill,
+                              &incremental_transform, EncodedRelative::kParent,
+                              parent_buffer.View(), relative_transform,
+                              relative_buffer.View());
+          expect_same_buffer(expected, relative_buffer);
+          EXPECT_EQ(transform, incremental_transform);
+        }
+      }
+    }
+  }
+}
+
+TEST(EncodePositionForNN, EncodeBatchMatchesSinglePositions) {
+  const pblczero::NetworkFormat::InputFormat kFormats[] = {
+      pblczero::NetworkFormat::INPUT_CLASSICAL_112_PLANE,
+      pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION,
+      pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_V2,
+  };
+  // Both pawnless positions to get the transposing transforms.
+  const char* kFens[] = {
+      ChessBoard::kStartposFen,
+      "8/8/3k4/8/8/2K5/8/4R3 w - - 0 1",
+      "8/2n5/3k4/8/4Q3/2K5/8/8 b - - 0 40",
+  };
+  std::vector<PositionHistory> histories;
+  for (const char* fen : kFens) {
+    ChessBoard board;
+    int rule50;
+    int moves;
+    board.SetFromFen(fen, &rule50, &moves);
+    PositionHistory history;
+    history.Reset(board, rule50, moves);
+    for (int ply = 0; ply < 12; ++ply) {
+      const auto legal_moves = history.Last().GetBoard().GenerateLegalMoves();
+      if (legal_moves.empty()) break;
+      history.Append(legal_moves[(ply * 5 + 1) % legal_moves.size()]);
+      histories.push_back(history);
+    }
+  }
+  std::vector<std::span<const Position>> spans;
+  for (const auto& history : histories) spans.push_back(history.GetPositions());
+
+  for (const auto format : kFormats) {
+    std::vector<uint64_t> masks(spans.size() * kInputPlanes, 0x1234);
+    std::vector<float> values(spans.size() * kInputPlanes, -3.0f);
+    std::vector<int> transforms(spans.size());
+    EncodePositionsForNN(format, spans, 8, FillEmptyHistory::FEN_ONLY,
+                         transforms.data(), masks.data(), values.data());
+    for (size_t i = 0; i < histories.size(); ++i) {
+      int transform;
+      const InputPlanes expected = EncodePositionForNN(
+          format, histories[i], 8, FillEmptyHistory::FEN_ONLY, &transform);
+      EXPECT_EQ(transform, transforms[i]) << "position " << i;
+      for (int j = 0; j < kInputPlanes; ++j) {
+        EXPECT_EQ(expected[j].mask, masks[i * kInputPlanes + j])
+            << "position " << i << " plane " << j;
+        EXPECT_EQ(expected[j].value, values[i * kInputPlanes + j])
+            << "position " << i << " plane " << j;
+      }
+    }
+  }
+}
+
 }  // namespace lczero
 
 int main(int argc, char** argv) {
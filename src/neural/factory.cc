@@ -28,8 +28,11 @@
 #include "neural/factory.h"
 
 #include <algorithm>
+#include <exception>
+#include <thread>
 
 #include "neural/loader.h"
+#include "neural/network_legacy.h"
 #include "neural/shared_params.h"
 #include "utils/commandline.h"
 #include "utils/logging.h"
@@ -52,6 +55,38 @@ void NetworkFactory::RegisterNetwork(const std::string& name,
   std::sort(factories_.begin(), factories_.end());
 }
 
+NetworkFactory::RegisterDevices::RegisterDevices(const std::string& name,
+                                                 DeviceCountFunc func) {
+  NetworkFactory::Get()->device_counts_.emplace_back(name, func);
+}
+
+int NetworkFactory::GetDeviceCount(const std::string& network,
+                                   const OptionsDict& options) const {
+  for (const auto& [name, func] : device_counts_) {
+    if (name == network) return func(options);
+  }
+  return 0;
+}
+
+std::vector<std::unique_ptr<OptionsDict>> NetworkFactory::ExpandDevices(
+    const std::string& network, const OptionsDict& options) const {
+  std::vector<std::unique_ptr<OptionsDict>> result;
+  if (!options.OwnExists<std::string>("gpu")) return result;
+  if (options.Get<std::string>("gpu") != "all") {
+    throw Exception("Invalid gpu option, expected a number or \"all\".");
+  }
+  const int devices = GetDeviceCount(network, options);
+  if (devices <= 0) {
+    throw Exception("Backend " + network + " can't enumerate its devices.");
+  }
+  CERR << "Using " << devices << " device(s) of backend [" << network << "].";
+  for (int i = 0; i < devices; i++) {
+    result.emplace_back(std::make_unique<OptionsDict>(&options));
+    result.back()->Set<int>("gpu", i);
+  }
+  return result;
+}
+
 std::vector<std::string> NetworkFactory::GetBackendsList() const {
   std::vector<std::string> result;
   for (const auto& x : factories_) result.emplace_back(x.name);
@@ -70,6 +105,34 @@ std::unique_ptr<Network> NetworkFactory::Create(
   throw Exception("Unknown backend: " + network);
 }
 
+std::vector<std::unique_ptr<Network>> NetworkFactory::CreateMany(
+    const std::vector<std::pair<std::string, const OptionsDict*>>& backends,
+    const std::optional<WeightsFile>& weights) {
+  MultiHeadWeightsSharingScope sharing_scope;
+  std::vector<std::unique_ptr<Network>> networks(backends.size());
+  if (backends.size() == 1) {
+    networks[0] = Create(backends[0].first, weights, *backends[0].second);
+    return networks;
+  }
+  std::vector<std::exception_ptr> errors(backends.size());
+  std::vector<std::thread> threads;
+  threads.reserve(backends.size());
+  for (size_t i = 0; i < backends.size(); ++i) {
+    threads.emplace_back([&, i]() {
+      try {
+        networks[i] = Create(backends[i].first, weights, *backends[i].second);
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  for (const auto& error : errors) {
+    if (error) std::rethrow_exception(error);
+  }
+  return networks;
+}
+
 NetworkFactory::BackendConfiguration::BackendConfiguration(
     const OptionsDict& options)
     : weights_path(options.Get<std::string>(SharedBackendParams::kWeightsId)),
@@ -28,8 +28,11 @@
 #pragma once
 
 #include <functional>
+#include <memory>
 #include <optional>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "neural/loader.h"
 #include "neural/network.h"
@@ -43,6 +46,9 @@ class NetworkFactory {
  public:
   using FactoryFunc = std::function<std::unique_ptr<Network>(
       const std::optional<WeightsFile>&, const OptionsDict&)>;
+  // Returns the number of devices a backend can address with its "gpu"
+  // option, given the backend options.
+  using DeviceCountFunc = std::function<int(const OptionsDict&)>;
 
   static NetworkFactory* Get();
 
@@ -56,14 +62,40 @@ class NetworkFactory {
     Register(const std::string& name, FactoryFunc factory, int priority = 0);
   };
 
+  // Registers how many devices the network named @name can use.
+  class RegisterDevices {
+   public:
+    RegisterDevices(const std::string& name, DeviceCountFunc func);
+  };
+
   // Returns list of backend names, sorted by priority (higher priority first).
   std::vector<std::string> GetBackendsList() const;
 
+  // Returns the number of devices of the backend, 0 if it doesn't enumerate
+  // them.
+  int GetDeviceCount(const std::string& network,
+                     const OptionsDict& options) const;
+
+  // If @options sets gpu=all, returns one set of options per device of the
+  // backend, each a child of @options with "gpu" set to the device index.
+  // Otherwise returns an empty list. Used by the multiplexing backends, so
+  // that e.g. every MIG instance or GPU tile becomes a separate child.
+  std::vector<std::unique_ptr<OptionsDict>> ExpandDevices(
+      const std::string& network, const OptionsDict& options) const;
+
   // Creates a backend given name and config.
   std::unique_ptr<Network> Create(const std::string& network,
                                   const std::optional<WeightsFile>&,
                                   const OptionsDict& options);
 
+  // Creates several backends in parallel, so that their weight uploads and
+  // engine builds overlap. Each element of @backends is a backend name and its
+  // options; the networks are returned in the same order. Weights conversions
+  // are shared between the backends where supported.
+  std::vector<std::unique_ptr<Network>> CreateMany(
+      const std::vector<std::pair<std::string, const OptionsDict*>>& backends,
+      const std::optional<WeightsFile>& weights);
+
   // Helper function to load the network from the options. Returns nullptr
   // if no network options changed since the previous call.
   static std::unique_ptr<Network> LoadNetwork(const OptionsDict& options);
@@ -105,7 +137,9 @@ class NetworkFactory {
   };
 
   std::vector<Factory> factories_;
+  std::vector<std::pair<std::string, DeviceCountFunc>> device_counts_;
   friend class Register;
+  friend class RegisterDevices;
 };
 
 #define REGISTER_NETWORK_WITH_COUNTER2(name, func, priority, counter)     \
@@ -130,6 +164,20 @@ class NetworkFactory {
 #define REGISTER_NETWORK_WITH_COUNTER(name, func, priority, counter) \
   REGISTER_NETWORK_WITH_COUNTER2(name, func, priority, counter)
 
+#define REGISTER_NETWORK_DEVICES_WITH_COUNTER2(name, func, counter)    \
+  namespace {                                                           \
+  namespace nsd##counter {                                              \
+  static NetworkFactory::RegisterDevices regD52mq##counter(name, func); \
+  }                                                                     \
+  }
+
+#define REGISTER_NETWORK_DEVICES_WITH_COUNTER(name, func, counter) \
+  REGISTER_NETWORK_DEVICES_WITH_COUNTER2(name, func, counter)
+
+// Registers the device count function of a Network, see DeviceCountFunc.
+#define REGISTER_NETWORK_DEVICES(name, func) \
+  REGISTER_NETWORK_DEVICES_WITH_COUNTER(name, func, __LINE__)
+
 // Registers a Network.
 // Constructor of a network class must have parameters:
 // (const Weights& w, const OptionsDict& o)
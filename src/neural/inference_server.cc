@@ -0,0 +1,248 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "neural/inference_server.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include "utils/mutex.h"
+
+namespace lczero {
+namespace {
+
+class InferenceServer : public Backend {
+ public:
+  // Inputs from several client computations, evaluated together.
+  struct Batch {
+    std::unique_ptr<BackendComputation> computation;
+    size_t size = 0;
+    std::chrono::steady_clock::time_point first_input;
+    // Set by the server thread once the results are filled in. Guarded by the
+    // server mutex.
+    bool done = false;
+  };
+  using BatchList = std::vector<std::shared_ptr<Batch>>;
+
+  InferenceServer(std::unique_ptr<Backend> wrapped, int threads,
+                  std::chrono::microseconds max_wait)
+      : wrapped_backend_(std::move(wrapped)),
+        max_batch_size_(std::max(
+            1, wrapped_backend_->GetAttributes().maximum_batch_size)),
+        max_wait_(max_wait) {
+    open_batch_ = MakeBatch();
+    for (int i = 0; i < std::max(1, threads); ++i) {
+      threads_.emplace_back([this]() { Worker(); });
+    }
+  }
+
+  ~InferenceServer() {
+    {
+      Mutex::Lock lock(mutex_);
+      stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& thread : threads_) thread.join();
+  }
+
+  BackendAttributes GetAttributes() const override {
+    return wrapped_backend_->GetAttributes();
+  }
+  std::optional<EvalResult> GetCachedEvaluation(
+      const EvalPosition& pos) override {
+    return wrapped_backend_->GetCachedEvaluation(pos);
+  }
+  std::unique_ptr<BackendComputation> CreateComputation() override;
+
+  UpdateConfigurationResult UpdateConfiguration(
+      const OptionsDict& options) override {
+    return wrapped_backend_->UpdateConfiguration(options);
+  }
+
+  // Adds the input to the batch being gathered, and remembers that batch in
+  // @batches.
+  BackendComputation::AddInputResult AddInput(const EvalPosition& pos,
+                                              EvalResultPtr result,
+                                              BatchList* batches) {
+    bool notify = false;
+    BackendComputation::AddInputResult res;
+    {
+      Mutex::Lock lock(mutex_);
+      if (open_batch_->size >= max_batch_size_) {
+        full_batches_.push_back(std::move(open_batch_));
+        open_batch_ = MakeBatch();
+      }
+      res = open_batch_->computation->AddInput(pos, result);
+      if (res == BackendComputation::FETCHED_IMMEDIATELY) return res;
+      if (open_batch_->size++ == 0) {
+        open_batch_->first_input = std::chrono::steady_clock::now();
+        notify = true;
+      }
+      if (open_batch_->size >= max_batch_size_) notify = true;
+      if (batches->empty() || batches->back() != open_batch_) {
+        batches->push_back(open_batch_);
+      }
+    }
+    if (notify) work_cv_.notify_one();
+    return res;
+  }
+
+  // Blocks until all @batches are computed, and retires the calling
+  // computation.
+  void Wait(const BatchList& batches) {
+    {
+      Mutex::Lock lock(mutex_);
+      ++waiting_;
+    }
+    work_cv_.notify_all();
+    {
+      Mutex::Lock lock(mutex_);
+      for (const auto& batch : batches) {
+        while (!batch->done) done_cv_.wait(lock.get_raw());
+      }
+      --waiting_;
+      --active_;
+    }
+    work_cv_.notify_all();
+  }
+
+ private:
+  std::shared_ptr<Batch> MakeBatch() {
+    auto batch = std::make_shared<Batch>();
+    batch->computation = wrapped_backend_->CreateComputation();
+    return batch;
+  }
+
+  // The open batch is computed early when nobody can add to it anymore.
+  bool ShouldCompute() REQUIRES(mutex_) {
+    return open_batch_->size >= max_batch_size_ || waiting_ >= active_ ||
+           std::chrono::steady_clock::now() >=
+               open_batch_->first_input + max_wait_;
+  }
+
+  void Worker() {
+    while (true) {
+      std::shared_ptr<Batch> batch;
+      {
+        Mutex::Lock lock(mutex_);
+        while (true) {
+          if (stop_) return;
+          if (!full_batches_.empty()) {
+            batch = std::move(full_batches_.front());
+            full_batches_.pop_front();
+            break;
+          }
+          if (open_batch_->size == 0) {
+            work_cv_.wait(lock.get_raw());
+          } else if (!ShouldCompute()) {
+            work_cv_.wait_until(lock.get_raw(),
+                                open_batch_->first_input + max_wait_);
+          } else {
+            batch = std::move(open_batch_);
+            open_batch_ = MakeBatch();
+            break;
+          }
+        }
+      }
+      batch->computation->ComputeBlocking();
+      {
+        Mutex::Lock lock(mutex_);
+        batch->done = true;
+      }
+      done_cv_.notify_all();
+    }
+  }
+
+  const std::unique_ptr<Backend> wrapped_backend_;
+  const size_t max_batch_size_;
+  const std::chrono::microseconds max_wait_;
+
+  Mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  std::shared_ptr<Batch> open_batch_ GUARDED_BY(mutex_);
+  // Batches that reached the maximum size before a server thread took them.
+  std::deque<std::shared_ptr<Batch>> full_batches_ GUARDED_BY(mutex_);
+  // Client computations that are alive, and those of them that are blocked.
+  int active_ GUARDED_BY(mutex_) = 0;
+  int waiting_ GUARDED_BY(mutex_) = 0;
+  bool stop_ GUARDED_BY(mutex_) = false;
+  std::vector<std::thread> threads_;
+};
+
+class InferenceServerComputation : public BackendComputation {
+ public:
+  InferenceServerComputation(InferenceServer* server) : server_(server) {}
+
+  // Results may still be written to the inputs' buffers until the batches are
+  // computed.
+  ~InferenceServerComputation() {
+    if (!computed_) server_->Wait(batches_);
+  }
+
+  size_t UsedBatchSize() const override { return used_batch_size_; }
+  AddInputResult AddInput(const EvalPosition& pos,
+                          EvalResultPtr result) override {
+    const AddInputResult res = server_->AddInput(pos, result, &batches_);
+    if (res == ENQUEUED_FOR_EVAL) ++used_batch_size_;
+    return res;
+  }
+
+  void ComputeBlocking() override {
+    if (computed_) return;
+    computed_ = true;
+    server_->Wait(batches_);
+  }
+
+ private:
+  InferenceServer* const server_;
+  InferenceServer::BatchList batches_;
+  size_t used_batch_size_ = 0;
+  bool computed_ = false;
+};
+
+std::unique_ptr<BackendComputation> InferenceServer::CreateComputation() {
+  {
+    Mutex::Lock lock(mutex_);
+    ++active_;
+  }
+  return std::make_unique<InferenceServerComputation>(this);
+}
+
+}  // namespace
+
+std::unique_ptr<Backend> CreateInferenceServer(
+    std::unique_ptr<Backend> parent, int threads,
+    std::chrono::microseconds max_wait) {
+  return std::make_unique<InferenceServer>(std::move(parent), threads,
+                                           max_wait);
+}
+
+}  // namespace lczero
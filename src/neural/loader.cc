@@ -34,8 +34,10 @@
 #include <cctype>
 #include <cstdio>
 #include <fstream>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <string_view>
 
 #include "neural/shared_params.h"
 #include "proto/net.pb.h"
@@ -47,7 +49,11 @@
 
 #ifdef _WIN32
 #include <io.h>
+#include <windows.h>
 #else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #endif
 
@@ -56,10 +62,125 @@ namespace lczero {
 namespace {
 const std::uint32_t kWeightMagic = 0x1c0;
 
+// Read-only mapping of a file, or of @size bytes of it from @offset.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& filename, size_t offset = 0,
+                      size_t size = 0) {
+#ifndef _WIN32
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1) throw Exception("Cannot read weights from " + filename);
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) != 0 || statbuf.st_size == 0) {
+      close(fd);
+      throw Exception("Cannot read weights from " + filename);
+    }
+    if (size == 0) size = statbuf.st_size - offset;
+    // The mapping has to start at a page boundary.
+    const size_t page_offset = offset % sysconf(_SC_PAGESIZE);
+    map_size_ = size + page_offset;
+    base_ = mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd,
+                 offset - page_offset);
+    close(fd);
+    if (base_ == MAP_FAILED) throw Exception("Could not mmap() " + filename);
+#if defined(MADV_SEQUENTIAL)
+    madvise(base_, map_size_, MADV_SEQUENTIAL);
+#endif
+#else
+    const HANDLE fd =
+        CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (fd == INVALID_HANDLE_VALUE) {
+      throw Exception("Cannot read weights from " + filename);
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(fd, &file_size) || file_size.QuadPart == 0) {
+      CloseHandle(fd);
+      throw Exception("Cannot read weights from " + filename);
+    }
+    if (size == 0) size = file_size.QuadPart - offset;
+    mapping_ = CreateFileMapping(fd, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(fd);
+    if (!mapping_) throw Exception("CreateFileMapping() failed");
+    // Views have to start at a multiple of the allocation granularity.
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    const size_t page_offset = offset % info.dwAllocationGranularity;
+    const uint64_t map_offset = offset - page_offset;
+    map_size_ = size + page_offset;
+    base_ = MapViewOfFile(mapping_, FILE_MAP_READ, map_offset >> 32,
+                          map_offset & 0xffffffff, map_size_);
+    if (!base_) {
+      CloseHandle(mapping_);
+      throw Exception("MapViewOfFile() failed, name = " + filename);
+    }
+#endif
+    data_ = static_cast<const char*>(base_) + page_offset;
+    size_ = size;
+  }
+
+  ~MappedFile() {
+#ifndef _WIN32
+    munmap(base_, map_size_);
+#else
+    UnmapViewOfFile(base_);
+    CloseHandle(mapping_);
+#endif
+  }
+
+  std::string_view data() const { return {data_, size_}; }
+
+ private:
+  void* base_;
+  size_t map_size_;
+  const char* data_;
+  size_t size_;
+#ifdef _WIN32
+  HANDLE mapping_;
+#endif
+};
+
+// Whether the file starts with the gzip magic.
+bool IsGzipFile(const std::string& filename) {
+  FILE* fp = fopen(filename.c_str(), "rb");
+  if (!fp) throw Exception("Cannot read weights from " + filename);
+  unsigned char magic[2] = {};
+  const bool is_gzip = fread(magic, 1, 2, fp) == 2 && magic[0] == 0x1f &&
+                       magic[1] == 0x8b;
+  fclose(fp);
+  return is_gzip;
+}
+
+// The network file is appended at the end of the lc0 executable, followed by
+// the network file size and a "Lc0!" (0x2130634c) magic. It is either gzipped,
+// or uncompressed and page aligned so that it can be mapped straight from the
+// executable (see OpenBench/Makefile).
+struct EmbeddedNet {
+  size_t offset;
+  size_t size;
+  bool gzipped;
+};
+
+EmbeddedNet FindEmbeddedNet(const std::string& filename) {
+  FILE* fp = fopen(filename.c_str(), "rb");
+  if (!fp) throw Exception("Cannot read weights from " + filename);
+  int32_t size, magic;
+  unsigned char start[2] = {};
+  if (fseek(fp, -8, SEEK_END) || fread(&size, 4, 1, fp) != 1 ||
+      fread(&magic, 4, 1, fp) != 1 || magic != 0x2130634c || size < 2 ||
+      fseek(fp, -size - 8, SEEK_END) || fread(start, 1, 2, fp) != 2) {
+    fclose(fp);
+    throw Exception("No embedded file detected.");
+  }
+  const long offset = ftell(fp) - 2;
+  fclose(fp);
+  return {static_cast<size_t>(offset), static_cast<size_t>(size),
+          start[0] == 0x1f && start[1] == 0x8b};
+}
+
 std::string DecompressGzip(const std::string& filename) {
   const int kStartingSize = 8 * 1024 * 1024;  // 8M
   std::string buffer;
-  buffer.resize(kStartingSize);
   int bytes_read = 0;
 
   // Read whole file into a buffer.
@@ -68,16 +189,20 @@ std::string DecompressGzip(const std::string& filename) {
     throw Exception("Cannot read weights from " + filename);
   }
   if (filename == CommandLine::BinaryName()) {
-    // The network file should be appended at the end of the lc0 executable,
-    // followed by the network file size and a "Lc0!" (0x2130634c) magic.
-    int32_t size, magic;
-    if (fseek(fp, -8, SEEK_END) || fread(&size, 4, 1, fp) != 1 ||
-        fread(&magic, 4, 1, fp) != 1 || magic != 0x2130634c) {
-      fclose(fp);
-      throw Exception("No embedded file detected.");
-    }
-    fseek(fp, -size - 8, SEEK_END);
+    fseek(fp, FindEmbeddedNet(filename).offset, SEEK_SET);
+  }
+  // The gzip trailer has the uncompressed size (mod 4G). Starting with a
+  // buffer just over it saves growing and copying the buffer while reading.
+  const long start = ftell(fp);
+  uint32_t uncompressed_size = 0;
+  if (filename == CommandLine::BinaryName()) {
+    fseek(fp, -12, SEEK_END);
+  } else {
+    fseek(fp, -4, SEEK_END);
   }
+  if (fread(&uncompressed_size, 4, 1, fp) != 1) uncompressed_size = 0;
+  fseek(fp, start, SEEK_SET);
+  buffer.resize(std::max<size_t>(kStartingSize, uncompressed_size + 1));
   fflush(fp);
   gzFile file = gzdopen(dup(fileno(fp)), "rb");
   fclose(fp);
@@ -157,9 +282,24 @@ void FixOlderWeightsFile(WeightsFile* file) {
   }
 }
 
-WeightsFile ParseWeightsProto(const std::string& buffer) {
+// The layer weights are views into the buffer, which @owner keeps alive as
+// long as any of them is used.
+WeightsFile ParseWeightsProto(std::string_view buffer,
+                              std::shared_ptr<const void> owner) {
+  if (buffer.size() < 2) {
+    throw Exception("Invalid weight file: too small.");
+  }
+  if (buffer[0] == '1' && buffer[1] == '\n') {
+    throw Exception("Invalid weight file: no longer supported.");
+  }
+  if (buffer[0] == '2' && buffer[1] == '\n') {
+    throw Exception(
+        "Text format weights files are no longer supported. Use a command line "
+        "tool to convert it to the new format.");
+  }
+
   WeightsFile net;
-  net.ParseFromString(buffer);
+  net.ParseFromRetainedBuffer(buffer, std::move(owner));
 
   if (net.magic() != kWeightMagic) {
     throw Exception("Invalid weight file: bad header.");
@@ -192,22 +332,25 @@ WeightsFile ParseWeightsProto(const std::string& buffer) {
 }  // namespace
 
 WeightsFile LoadWeightsFromFile(const std::string& filename) {
-  FloatVectors vecs;
-  auto buffer = DecompressGzip(filename);
-
-  if (buffer.size() < 2) {
-    throw Exception("Invalid weight file: too small.");
-  }
-  if (buffer[0] == '1' && buffer[1] == '\n') {
-    throw Exception("Invalid weight file: no longer supported.");
-  }
-  if (buffer[0] == '2' && buffer[1] == '\n') {
-    throw Exception(
-        "Text format weights files are no longer supported. Use a command line "
-        "tool to convert it to the new format.");
+  // Uncompressed protobuf files (see the unpacknet tool) are parsed straight
+  // from a mapping of the file, without first being read into memory. The
+  // page cache then also shares it between processes, e.g. many engines
+  // started from the same executable with an embedded net.
+  // The weights are not copied out of the mapping or the decompressed buffer,
+  // so that the net is only in memory once while it's being loaded.
+  if (filename == CommandLine::BinaryName()) {
+    const EmbeddedNet net = FindEmbeddedNet(filename);
+    if (!net.gzipped) {
+      auto file = std::make_shared<const MappedFile>(filename, net.offset,
+                                                     net.size);
+      return ParseWeightsProto(file->data(), file);
+    }
+  } else if (GetFileSize(filename) >= 2 && !IsGzipFile(filename)) {
+    auto file = std::make_shared<const MappedFile>(filename);
+    return ParseWeightsProto(file->data(), file);
   }
-
-  return ParseWeightsProto(buffer);
+  auto buffer = std::make_shared<const std::string>(DecompressGzip(filename));
+  return ParseWeightsProto(*buffer, buffer);
 }
 
 WeightsFile LoadWeights(std::string_view location) {
@@ -27,20 +27,26 @@
 
 #include "neural/memcache.h"
 
-#include "neural/cache.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <string>
+
 #include "neural/shared_params.h"
 #include "utils/atomic_vector.h"
-#include "utils/smallarray.h"
+#include "utils/memory_accountant.h"
+#include "utils/metrics.h"
+#include "utils/mutex.h"
+#include "utils/trace.h"
 
 namespace lczero {
 namespace {
 
-// TODO For now it uses the hash of the current position, ignoring repetitions
-// and history. We'll likely need to have configurable hash function that we'll
-// also reuse as a tree hash key.
-uint64_t ComputeEvalPositionHash(const EvalPosition& pos) {
-  return pos.pos.back().Hash();
-}
+MetricCounter* const kHitsMetric = Metrics::Get().AddCounter(
+    "memcache_hits", "Positions answered from the NN cache.");
+MetricCounter* const kMissesMetric = Metrics::Get().AddCounter(
+    "memcache_misses", "Positions looked up in the NN cache and not found.");
 
 struct CachedValue {
   float q;
@@ -56,12 +62,274 @@ void CachedValueToEvalResult(const CachedValue& cv, const EvalResultPtr& ptr) {
   std::copy(cv.p.get(), cv.p.get() + ptr.p.size(), ptr.p.begin());
 }
 
+// Priors are stored as 8-bit codes on a log scale, code 255 being 1.0 and each
+// step down 1/16 of a neper (about 6%). Code 0 is an exact zero.
+constexpr float kPriorCodesPerNeper = 16.0f;
+
+uint8_t QuantizePrior(float p) {
+  if (!(p > 0.0f)) return 0;
+  const long code = 255 + std::lround(std::log(p) * kPriorCodesPerNeper);
+  return std::clamp(code, 1L, 255L);
+}
+
+const std::array<float, 256> kPriorCodes = [] {
+  std::array<float, 256> codes;
+  codes[0] = 0.0f;
+  for (int i = 1; i < 256; ++i) {
+    codes[i] = std::exp((i - 255) / kPriorCodesPerNeper);
+  }
+  return codes;
+}();
+
+// Fixed size cache slot. A position is stored in as many consecutive slots as
+// its priors need, only the first of them has the header.
+struct alignas(64) CacheSlot {
+  // 0 for a free slot.
+  uint64_t key;
+  float q;
+  float d;
+  float m;
+  uint8_t num_moves;
+  uint8_t flags;
+  // Number of slots the position takes.
+  uint8_t span;
+  // Shard generation when the position was stored, the position is dropped
+  // when it differs.
+  uint8_t generation;
+  uint8_t priors[40];
+
+  static constexpr uint8_t kReferenced = 1;
+  static constexpr uint8_t kHasPolicy = 2;
+
+  // Priors continue into the following slots.
+  uint8_t* priors_begin() {
+    return reinterpret_cast<uint8_t*>(this) + offsetof(CacheSlot, priors);
+  }
+};
+static_assert(sizeof(CacheSlot) == 64);
+
+// Holds evaluations in a flat preallocated array of slots, with the priors
+// quantised to a byte each. Slots are reused in CLOCK order: recently looked
+// up positions get a second chance before they are evicted. The table is split
+// into shards with a lock each. Thread safe.
+// Clearing only advances the shard generations, the slots of older ones are
+// invisible to lookups and are reclaimed when the clock hand passes them.
+class CompactCache {
+  static constexpr int kNumShards = 32;
+
+ public:
+  explicit CompactCache(size_t capacity) { SetCapacity(capacity); }
+
+  // Drops all entries and resizes to @capacity slots.
+  void SetCapacity(size_t capacity) {
+    capacity_.store(capacity, std::memory_order_relaxed);
+    for (int i = 0; i < kNumShards; ++i) {
+      SpinMutex::Lock lock(shards_[i].mutex_);
+      shards_[i].Resize(capacity / kNumShards +
+                        (static_cast<size_t>(i) < capacity % kNumShards));
+    }
+  }
+
+  size_t GetCapacity() const {
+    return capacity_.load(std::memory_order_relaxed);
+  }
+
+  void Clear() {
+    for (auto& shard : shards_) {
+      SpinMutex::Lock lock(shard.mutex_);
+      // Once in a while the generation wraps around, the slots from its last
+      // use could become visible again then.
+      if (++shard.generation_ == 0) shard.Resize(shard.slots_.size());
+    }
+  }
+
+  // Stores the evaluation, unless the key is already in the cache.
+  void Insert(uint64_t key, const CachedValue& value, size_t num_moves) {
+    if (capacity_.load(std::memory_order_relaxed) == 0) return;
+    if (key == 0) key = 1;
+    Shard& shard = GetShard(key);
+    SpinMutex::Lock lock(shard.mutex_);
+    if (shard.Find(key) != Shard::kNone) return;
+    const size_t prior_bytes = value.p ? num_moves : 0;
+    const size_t span = (offsetof(CacheSlot, priors) + prior_bytes +
+                         sizeof(CacheSlot) - 1) /
+                        sizeof(CacheSlot);
+    const uint32_t idx = shard.Allocate(span);
+    if (idx == Shard::kNone) return;
+    CacheSlot& slot = shard.slots_[idx];
+    slot.key = key;
+    slot.q = value.q;
+    slot.d = value.d;
+    slot.m = value.m;
+    slot.num_moves = num_moves;
+    slot.flags = value.p ? CacheSlot::kHasPolicy : 0;
+    slot.span = span;
+    slot.generation = shard.generation_;
+    uint8_t* priors = slot.priors_begin();
+    for (size_t i = 0; i < prior_bytes; ++i) {
+      priors[i] = QuantizePrior(value.p[i]);
+    }
+    shard.AddToIndex(idx);
+  }
+
+  // Looks up the evaluation of a position with @num_moves legal moves and
+  // writes it to @result. Returns false if it's not in the cache, or if the
+  // priors are needed but weren't stored.
+  bool Lookup(uint64_t key, size_t num_moves, bool need_policy,
+              const EvalResultPtr& result) {
+    if (capacity_.load(std::memory_order_relaxed) == 0) return false;
+    if (key == 0) key = 1;
+    Shard& shard = GetShard(key);
+    SpinMutex::Lock lock(shard.mutex_);
+    const uint32_t idx = shard.Find(key);
+    if (idx == Shard::kNone) return false;
+    CacheSlot& slot = shard.slots_[idx];
+    const bool has_policy = slot.flags & CacheSlot::kHasPolicy;
+    if (need_policy && (!has_policy || slot.num_moves != num_moves)) {
+      return false;
+    }
+    slot.flags |= CacheSlot::kReferenced;
+    if (result.q) *result.q = slot.q;
+    if (result.d) *result.d = slot.d;
+    if (result.m) *result.m = slot.m;
+    if (has_policy && slot.num_moves == result.p.size()) {
+      const uint8_t* priors = slot.priors_begin();
+      for (size_t i = 0; i < result.p.size(); ++i) {
+        result.p[i] = kPriorCodes[priors[i]];
+      }
+    }
+    return true;
+  }
+
+ private:
+  struct alignas(64) Shard {
+    static constexpr uint32_t kNone = ~0u;
+
+    void Resize(size_t num_slots) REQUIRES(mutex_) {
+      slots_.assign(num_slots, CacheSlot{});
+      // Even with every position in a single slot the index stays half empty.
+      index_.assign(num_slots * 2 + 1, kNone);
+      hand_ = 0;
+      generation_ = 0;
+    }
+
+    uint32_t Find(uint64_t key) const REQUIRES(mutex_) {
+      size_t idx = key % index_.size();
+      while (index_[idx] != kNone) {
+        const CacheSlot& slot = slots_[index_[idx]];
+        if (slot.key == key && slot.generation == generation_) {
+          return index_[idx];
+        }
+        if (++idx == index_.size()) idx = 0;
+      }
+      return kNone;
+    }
+
+    void AddToIndex(uint32_t slot) REQUIRES(mutex_) {
+      size_t idx = slots_[slot].key % index_.size();
+      while (index_[idx] != kNone) {
+        if (++idx == index_.size()) idx = 0;
+      }
+      index_[idx] = slot;
+    }
+
+    void RemoveFromIndex(uint32_t slot) REQUIRES(mutex_) {
+      size_t idx = slots_[slot].key % index_.size();
+      while (index_[idx] != slot) {
+        if (++idx == index_.size()) idx = 0;
+      }
+      index_[idx] = kNone;
+      // Move back the entries that could not be found anymore otherwise.
+      size_t next = idx;
+      while (true) {
+        if (++next == index_.size()) next = 0;
+        if (index_[next] == kNone) break;
+        const size_t target = slots_[index_[next]].key % index_.size();
+        const bool in_range = idx <= next ? target > idx && target <= next
+                                          : target > idx || target <= next;
+        if (!in_range) {
+          std::swap(index_[next], index_[idx]);
+          idx = next;
+        }
+      }
+    }
+
+    // Returns the first of @span consecutive free slots, evicting the
+    // positions under the clock hand that weren't looked up since it last
+    // passed them, or are from an older generation.
+    uint32_t Allocate(size_t span) REQUIRES(mutex_) {
+      if (span > slots_.size()) return kNone;
+      size_t run = 0;
+      // The first pass over the slots may only clear the referenced flags.
+      for (size_t scanned = 0; run < span; ) {
+        if (scanned > 3 * slots_.size()) return kNone;
+        if (hand_ == slots_.size()) {
+          // Positions don't wrap around.
+          hand_ = 0;
+          run = 0;
+        }
+        CacheSlot& slot = slots_[hand_];
+        if (slot.key == 0) {
+          ++run;
+          ++hand_;
+          ++scanned;
+          continue;
+        }
+        const size_t slot_span = slot.span;
+        if ((slot.flags & CacheSlot::kReferenced) != 0 &&
+            slot.generation == generation_) {
+          slot.flags &= ~CacheSlot::kReferenced;
+          run = 0;
+        } else {
+          RemoveFromIndex(hand_);
+          for (size_t i = 0; i < slot_span; ++i) slots_[hand_ + i].key = 0;
+          run += slot_span;
+        }
+        hand_ += slot_span;
+        scanned += slot_span;
+      }
+      // Free slots left over past the position are taken next time.
+      const size_t start = hand_ - run;
+      hand_ = start + span;
+      return start;
+    }
+
+    std::vector<CacheSlot> slots_ GUARDED_BY(mutex_);
+    // Open addressed, slot indices by key.
+    std::vector<uint32_t> index_ GUARDED_BY(mutex_);
+    size_t hand_ GUARDED_BY(mutex_) = 0;
+    uint8_t generation_ GUARDED_BY(mutex_) = 0;
+    SpinMutex mutex_;
+  };
+
+  // The low bits of the key pick the place in the shard's index.
+  Shard& GetShard(uint64_t key) { return shards_[(key >> 40) % kNumShards]; }
+
+  std::atomic<size_t> capacity_;
+  Shard shards_[kNumShards];
+};
+
 class MemCache : public CachingBackend {
  public:
-  MemCache(std::unique_ptr<Backend> wrapped, size_t cache_size)
+  MemCache(std::unique_ptr<Backend> wrapped, const OptionsDict& options)
+      : MemCache(std::move(wrapped), options,
+                 options.Get<int>(SharedBackendParams::kNNCacheSizeId), -1) {}
+  // Only positions up to game ply @max_ply are cached, unless it's negative.
+  MemCache(std::unique_ptr<Backend> wrapped, const OptionsDict& options,
+           size_t size, int max_ply)
       : wrapped_backend_(std::move(wrapped)),
-        cache_(cache_size),
-        max_batch_size_(wrapped_backend_->GetAttributes().maximum_batch_size) {}
+        cache_(size),
+        history_length_(
+            options.Get<int>(SharedBackendParams::kCacheHistoryLengthId)),
+        weights_path_(
+            options.Get<std::string>(SharedBackendParams::kWeightsId)),
+        max_batch_size_(wrapped_backend_->GetAttributes().maximum_batch_size),
+        max_ply_(max_ply),
+        memory_source_(MemoryAccountant::Get().AddSource(
+            MemoryKind::kCache, [this]() {
+              return cache_.GetCapacity() * GetMemCacheItemSize();
+            })) {}
+  ~MemCache() { MemoryAccountant::Get().RemoveSource(memory_source_); }
 
   BackendAttributes GetAttributes() const override {
     return wrapped_backend_->GetAttributes();
@@ -73,15 +341,45 @@ class MemCache : public CachingBackend {
 
   UpdateConfigurationResult UpdateConfiguration(
       const OptionsDict& options) override {
-    return wrapped_backend_->UpdateConfiguration(options);
+    const int history_length =
+        options.Get<int>(SharedBackendParams::kCacheHistoryLengthId);
+    if (history_length != history_length_) {
+      history_length_ = history_length;
+      cache_.Clear();
+    }
+    const UpdateConfigurationResult result =
+        wrapped_backend_->UpdateConfiguration(options);
+    // The backend may have swapped the weights in place.
+    const std::string weights_path =
+        options.Get<std::string>(SharedBackendParams::kWeightsId);
+    if (result == UPDATE_OK && weights_path != weights_path_) {
+      weights_path_ = weights_path;
+      cache_.Clear();
+    }
+    return result;
   }
 
-  void SetCacheSize(size_t size) override { cache_.SetCapacity(size); }
+  // Resizing drops the entries, so it's skipped when the size is the same.
+  void SetCacheSize(size_t size) override {
+    if (size != cache_.GetCapacity()) cache_.SetCapacity(size);
+  }
 
  private:
+  uint64_t ComputeKey(const EvalPosition& pos) const {
+    return ComputeEvalPositionKey(pos.pos, history_length_);
+  }
+  bool IsCached(const EvalPosition& pos) const {
+    return max_ply_ < 0 || pos.pos.back().GetGamePly() <= max_ply_;
+  }
+
   std::unique_ptr<Backend> wrapped_backend_;
-  HashKeyedCache<CachedValue> cache_;
+  CompactCache cache_;
+  // Changes only between searches.
+  int history_length_;
+  std::string weights_path_;
   const size_t max_batch_size_;
+  const int max_ply_;
+  const int memory_source_;
   friend class MemCacheComputation;
 };
 
@@ -92,6 +390,11 @@ class MemCacheComputation : public BackendComputation {
       : wrapped_computation_(std::move(wrapped_computation)),
         memcache_(memcache),
         entries_(memcache->max_batch_size_) {}
+  ~MemCacheComputation() {
+    // Every miss adds an entry.
+    kHitsMetric->Add(hits_.load(std::memory_order_relaxed));
+    kMissesMetric->Add(entries_.size());
+  }
 
  private:
   size_t UsedBatchSize() const override {
@@ -100,19 +403,23 @@ class MemCacheComputation : public BackendComputation {
   virtual AddInputResult AddInput(const EvalPosition& pos,
                                   EvalResultPtr result) override {
     assert(pos.legal_moves.size() == result.p.size() || result.p.empty());
-    const uint64_t hash = ComputeEvalPositionHash(pos);
-    {
-      HashKeyedCacheLock<CachedValue> lock(&memcache_->cache_, hash);
-      // Sometimes search queries NN without passing the legal moves. It is
-      // still cached in this case, but in subsequent queries we only return it
-      // legal moves are not passed again.
-      if (lock.holds_value() && (pos.legal_moves.empty() || lock->p)) {
-        CachedValueToEvalResult(**lock, result);
-        return AddInputResult::FETCHED_IMMEDIATELY;
-      }
+    if (!memcache_->IsCached(pos)) {
+      return wrapped_computation_->AddInput(pos, result);
+    }
+    TraceScope trace("MemCache::Lookup");
+    const uint64_t hash = memcache_->ComputeKey(pos);
+    // Sometimes search queries NN without passing the legal moves. It is still
+    // cached in this case, but in subsequent queries we only return it legal
+    // moves are not passed again.
+    const bool hit = memcache_->cache_.Lookup(hash, pos.legal_moves.size(),
+                                              !pos.legal_moves.empty(), result);
+    trace.SetArg("hit", hit);
+    if (hit) {
+      hits_.fetch_add(1, std::memory_order_relaxed);
+      return AddInputResult::FETCHED_IMMEDIATELY;
     }
-    size_t entry_idx = entries_.emplace_back(
-        Entry{hash, std::make_unique<CachedValue>(), result});
+    size_t entry_idx = entries_.emplace_back(Entry{
+        hash, std::make_unique<CachedValue>(), pos.legal_moves.size(), result});
     auto& value = entries_[entry_idx].value;
     value->p.reset(pos.legal_moves.empty() ? nullptr
                                            : new float[pos.legal_moves.size()]);
@@ -125,21 +432,34 @@ class MemCacheComputation : public BackendComputation {
 
   virtual void ComputeBlocking() override {
     wrapped_computation_->ComputeBlocking();
+    StoreResults();
+  }
+
+  void ComputeAsync(std::function<void()> done) override {
+    wrapped_computation_->ComputeAsync([this, done = std::move(done)]() {
+      StoreResults();
+      done();
+    });
+  }
+
+  void StoreResults() {
     for (auto& entry : entries_) {
       CachedValueToEvalResult(*entry.value, entry.result_ptr);
-      memcache_->cache_.Insert(entry.key, std::move(entry.value));
+      memcache_->cache_.Insert(entry.key, *entry.value, entry.num_moves);
     }
   }
 
   struct Entry {
     uint64_t key;
     std::unique_ptr<CachedValue> value;
+    size_t num_moves;
     EvalResultPtr result_ptr;
   };
 
   std::unique_ptr<BackendComputation> wrapped_computation_;
   MemCache* memcache_;
   AtomicVector<Entry> entries_;
+  std::atomic<size_t> hits_ = 0;
 };
 
 std::unique_ptr<BackendComputation> MemCache::CreateComputation() {
@@ -148,19 +468,13 @@ std::unique_ptr<BackendComputation> MemCache::CreateComputation() {
 }
 std::optional<EvalResult> MemCache::GetCachedEvaluation(
     const EvalPosition& pos) {
-  const uint64_t hash = ComputeEvalPositionHash(pos);
-  HashKeyedCacheLock<CachedValue> lock(&cache_, hash);
-  if (!lock.holds_value() || (!pos.legal_moves.empty() && !lock->p)) {
-    return std::nullopt;
-  }
+  if (!IsCached(pos)) return wrapped_backend_->GetCachedEvaluation(pos);
+  const uint64_t hash = ComputeKey(pos);
   EvalResult result;
-  result.d = lock->d;
-  result.q = lock->q;
-  result.m = lock->m;
-  if (lock->p) {
-    result.p.reserve(pos.legal_moves.size());
-    std::copy(lock->p.get(), lock->p.get() + pos.legal_moves.size(),
-              std::back_inserter(result.p));
+  result.p.resize(pos.legal_moves.size());
+  if (!cache_.Lookup(hash, pos.legal_moves.size(), !pos.legal_moves.empty(),
+                     result.AsPtr())) {
+    return std::nullopt;
   }
   return result;
 }
@@ -168,8 +482,19 @@ std::optional<EvalResult> MemCache::GetCachedEvaluation(
 }  // namespace
 
 std::unique_ptr<CachingBackend> CreateMemCache(std::unique_ptr<Backend> wrapped,
-                                               size_t cache_size) {
-  return std::make_unique<MemCache>(std::move(wrapped), cache_size);
+                                               const OptionsDict& options) {
+  return std::make_unique<MemCache>(std::move(wrapped), options);
+}
+
+std::unique_ptr<CachingBackend> CreateOpeningCache(
+    std::unique_ptr<Backend> wrapped, const OptionsDict& options, size_t size,
+    int max_ply) {
+  return std::make_unique<MemCache>(std::move(wrapped), options, size,
+                                    max_ply);
+}
+
+size_t GetMemCacheItemSize() {
+  return sizeof(CacheSlot) + 2 * sizeof(uint32_t);
 }
 
 }  // namespace lczero
\ No newline at end of file
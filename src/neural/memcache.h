@@ -40,8 +40,21 @@ class CachingBackend : public Backend {
 
 // Creates a caching backend wrapper, which returns values immediately if they
 // are found, and forwards the request to the wrapped backend otherwise (and
-// caches the result).
+// caches the result). The cache size and the history length of the cache key
+// are taken from @options.
 std::unique_ptr<CachingBackend> CreateMemCache(std::unique_ptr<Backend> parent,
-                                               size_t cache_size);
+                                               const OptionsDict& options);
+
+// Creates a caching backend wrapper like CreateMemCache(), which holds @size
+// positions and only caches those up to game ply @max_ply. Wrapped by the main
+// cache, it keeps the evaluations around the openings that many games share
+// from being evicted by positions of later game phases.
+std::unique_ptr<CachingBackend> CreateOpeningCache(
+    std::unique_ptr<Backend> parent, const OptionsDict& options, size_t size,
+    int max_ply);
+
+// Memory the cache takes per position, for positions with few enough legal
+// moves to fit in one slot.
+size_t GetMemCacheItemSize();
 
 }  // namespace lczero
\ No newline at end of file
@@ -27,7 +27,9 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
+#include <span>
 #include <vector>
 
 #include "proto/net.pb.h"
@@ -52,6 +54,26 @@ struct InputPlane {
 };
 using InputPlanes = std::vector<InputPlane>;
 
+// Input planes of one sample laid out as two arrays of kInputPlanes entries
+// (masks and values), the way backends keep them in their input buffers.
+struct InputPlanesView {
+  uint64_t* masks = nullptr;
+  float* values = nullptr;
+  bool empty() const { return masks == nullptr; }
+};
+
+// Output heads that the caller of a computation is going to read. The value
+// head is always computed.
+struct OutputHeads {
+  bool policy = true;
+  bool moves_left = true;
+  OutputHeads& operator|=(const OutputHeads& other) {
+    policy |= other.policy;
+    moves_left |= other.moves_left;
+    return *this;
+  }
+};
+
 // An interface to implement by computing backends.
 class NetworkComputation {
  public:
@@ -67,6 +89,68 @@ class NetworkComputation {
   // Returns P value @move_id of @sample.
   virtual float GetPVal(int sample, int move_id) const = 0;
   virtual float GetMVal(int sample) const = 0;
+
+  // Optional: returns the whole raw policy of @sample (1858 values), if the
+  // backend keeps it in a contiguous float buffer. Empty view otherwise.
+  virtual std::span<const float> GetPolicyView(int /*sample*/) const {
+    return {};
+  }
+  // Writes the raw policy values @move_ids of @sample into @dst, in the same
+  // order. Same as calling GetPVal() for each, but with one virtual call.
+  virtual void GetPolicy(int sample, std::span<const uint16_t> move_ids,
+                         std::span<float> dst) const {
+    const std::span<const float> policy = GetPolicyView(sample);
+    if (policy.empty()) {
+      for (size_t i = 0; i < move_ids.size(); ++i) {
+        dst[i] = GetPVal(sample, move_ids[i]);
+      }
+      return;
+    }
+    for (size_t i = 0; i < move_ids.size(); ++i) dst[i] = policy[move_ids[i]];
+  }
+
+  // Optional: the backend computes the policy softmax on the device, only
+  // over the given NN policy indices (the legal moves) with the logits
+  // multiplied by @inv_temperature, and doesn't copy the full policy back.
+  // Once a sample is added this way GetPVal() is not available for the batch,
+  // use GetLegalMovesPolicy() instead.
+  virtual bool SupportsLegalMovesPolicy() const { return false; }
+  virtual void AddInputWithLegalMoves(InputPlanes&& input,
+                                      std::span<const uint16_t> policy_indices,
+                                      float inv_temperature) {
+    (void)policy_indices;
+    (void)inv_temperature;
+    AddInput(std::move(input));
+  }
+  // Writes the softmaxed priors of the moves passed to
+  // AddInputWithLegalMoves() into @dst, in the same order.
+  virtual void GetLegalMovesPolicy(int /*sample*/,
+                                   std::span<float> /*dst*/) const {
+    throw Exception("Legal moves policy is not supported by this backend");
+  }
+
+  // Optional: lets the caller encode a sample straight into the backend's
+  // input buffer instead of building InputPlanes for AddInput(). Returns the
+  // buffer for @sample (which is GetBatchSize() plus the number of samples
+  // written but not added yet), or an empty view if the backend doesn't
+  // support it or the buffer is full. Must be safe to call concurrently.
+  virtual InputPlanesView GetInputBuffer(int /*sample*/) { return {}; }
+  // Adds the next sample, which was written through GetInputBuffer().
+  virtual void AddWrittenInput() {
+    throw Exception("Input buffers are not supported by this backend");
+  }
+  virtual void AddWrittenInputWithLegalMoves(
+      std::span<const uint16_t> policy_indices, float inv_temperature) {
+    (void)policy_indices;
+    (void)inv_temperature;
+    AddWrittenInput();
+  }
+
+  // Optional: called before ComputeBlocking() with the heads that will be
+  // read. Backends may skip computing and copying back the others, their
+  // outputs are undefined then.
+  virtual void SetOutputHeads(OutputHeads /*heads*/) {}
+
   virtual ~NetworkComputation() = default;
 };
 
@@ -121,6 +205,12 @@ class Network {
   virtual void InitThread(int /*id*/) {}
   virtual bool IsCpu() const { return false; }
   virtual int GetMiniBatchSize() const { return 256; }
+  // Replaces the weights of the network with @weights without recreating it,
+  // when @weights have the same architecture. Computations may run
+  // concurrently. Returns false if the network has to be recreated instead.
+  virtual bool ReloadWeights(const pblczero::Net& /*weights*/) {
+    return false;
+  }
   virtual ~Network() = default;
 };
 
@@ -19,15 +19,52 @@
 #include "neural/network_legacy.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <exception>
+#include <map>
+#include <optional>
+#include <thread>
 #include <utility>
 
 #include "utils/exception.h"
+#include "utils/mutex.h"
 #include "utils/weights_adapter.h"
 
 namespace lczero {
 namespace {
 static constexpr float kEpsilon = 1e-5f;
+
+// Converts the blocks of a tower, which are most of the net, on all cores.
+template <typename T, typename Proto>
+std::vector<T> ConvertBlocks(const std::vector<Proto>& blocks) {
+  std::vector<std::optional<T>> converted(blocks.size());
+  const size_t num_threads = std::min<size_t>(
+      blocks.size(), std::max(1u, std::thread::hardware_concurrency()));
+  std::atomic<size_t> next_block{0};
+  std::vector<std::exception_ptr> errors(num_threads);
+  auto convert = [&](size_t thread_idx) {
+    try {
+      for (size_t i; (i = next_block.fetch_add(1)) < blocks.size();) {
+        converted[i].emplace(blocks[i]);
+      }
+    } catch (...) {
+      errors[thread_idx] = std::current_exception();
+    }
+  };
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads);
+  for (size_t i = 1; i < num_threads; ++i) threads.emplace_back(convert, i);
+  convert(0);
+  for (auto& thread : threads) thread.join();
+  for (const auto& error : errors) {
+    if (error) std::rethrow_exception(error);
+  }
+  std::vector<T> result;
+  result.reserve(blocks.size());
+  for (auto& block : converted) result.push_back(std::move(*block));
+  return result;
+}
 }  // namespace
 
 BaseWeights::BaseWeights(const pblczero::Weights& weights)
@@ -54,13 +91,9 @@ BaseWeights::BaseWeights(const pblczero::Weights& weights)
       ip2_mov_b(LayerAdapter(weights.ip2_mov_b()).as_vector()),
       smolgen_w(LayerAdapter(weights.smolgen_w()).as_vector()),
       has_smolgen(weights.has_smolgen_w()) {
-  for (const auto& res : weights.residual()) {
-    residual.emplace_back(res);
-  }
+  residual = ConvertBlocks<Residual>(weights.residual());
   encoder_head_count = weights.headcount();
-  for (const auto& enc : weights.encoder()) {
-    encoder.emplace_back(enc);
-  }
+  encoder = ConvertBlocks<EncoderLayer>(weights.encoder());
 }
 
 BaseWeights::SEunit::SEunit(const pblczero::Weights::SEunit& se)
@@ -184,9 +217,7 @@ MultiHeadWeights::PolicyHead::PolicyHead(
       ip3_pol_b(LayerAdapter(policyhead.ip3_pol_b()).as_vector()),
       ip4_pol_w(LayerAdapter(policyhead.ip4_pol_w()).as_vector()) {
   pol_encoder_head_count = policyhead.pol_headcount();
-  for (const auto& enc : policyhead.pol_encoder()) {
-    pol_encoder.emplace_back(enc);
-  }
+  pol_encoder = ConvertBlocks<EncoderLayer>(policyhead.pol_encoder());
 }
 
 MultiHeadWeights::ValueHead::ValueHead(
@@ -220,9 +251,7 @@ LegacyWeights::LegacyWeights(const pblczero::Weights& weights)
       ip2_val_w(LayerAdapter(weights.ip2_val_w()).as_vector()),
       ip2_val_b(LayerAdapter(weights.ip2_val_b()).as_vector()) {
   pol_encoder_head_count = weights.pol_headcount();
-  for (const auto& enc : weights.pol_encoder()) {
-    pol_encoder.emplace_back(enc);
-  }
+  pol_encoder = ConvertBlocks<EncoderLayer>(weights.pol_encoder());
 }
 
 MultiHeadWeights::MultiHeadWeights(const pblczero::Weights& weights)
@@ -270,9 +299,7 @@ MultiHeadWeights::MultiHeadWeights(const pblczero::Weights& weights)
       vanilla.ip3_pol_b = LayerAdapter(weights.ip3_pol_b()).as_vector();
       vanilla.ip4_pol_w = LayerAdapter(weights.ip4_pol_w()).as_vector();
       vanilla.pol_encoder_head_count = weights.pol_headcount();
-      for (const auto& enc : weights.pol_encoder()) {
-        vanilla.pol_encoder.emplace_back(enc);
-      }
+      vanilla.pol_encoder = ConvertBlocks<EncoderLayer>(weights.pol_encoder());
     } else {
       throw Exception("Could not find valid policy head weights.");
     }
@@ -302,4 +329,36 @@ MultiHeadWeights::MultiHeadWeights(const pblczero::Weights& weights)
   }
 }
 
+namespace {
+// Conversions shared while at least one MultiHeadWeightsSharingScope is alive.
+// Keyed by proto address, which is only stable within a scope.
+Mutex shared_weights_mutex;
+int shared_weights_scopes GUARDED_BY(shared_weights_mutex) = 0;
+std::map<const pblczero::Weights*, std::shared_ptr<const MultiHeadWeights>>
+    shared_weights GUARDED_BY(shared_weights_mutex);
+}  // namespace
+
+std::shared_ptr<const MultiHeadWeights> GetSharedMultiHeadWeights(
+    const pblczero::Weights& weights) {
+  Mutex::Lock lock(shared_weights_mutex);
+  if (shared_weights_scopes == 0) {
+    return std::make_shared<const MultiHeadWeights>(weights);
+  }
+  // Converting under the lock makes concurrent callers wait for the first
+  // conversion rather than doing their own.
+  auto& entry = shared_weights[&weights];
+  if (!entry) entry = std::make_shared<const MultiHeadWeights>(weights);
+  return entry;
+}
+
+MultiHeadWeightsSharingScope::MultiHeadWeightsSharingScope() {
+  Mutex::Lock lock(shared_weights_mutex);
+  ++shared_weights_scopes;
+}
+
+MultiHeadWeightsSharingScope::~MultiHeadWeightsSharingScope() {
+  Mutex::Lock lock(shared_weights_mutex);
+  if (--shared_weights_scopes == 0) shared_weights.clear();
+}
+
 }  // namespace lczero
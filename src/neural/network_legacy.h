@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <memory>
 #include <unordered_map>
 #include <vector>
 
@@ -228,6 +229,25 @@ struct MultiHeadWeights : public BaseWeights {
   std::unordered_map<std::string, PolicyHead> policy_heads;
 };
 
+// Returns the MultiHeadWeights conversion of @weights. While a
+// MultiHeadWeightsSharingScope is alive, backends converting the same weights
+// proto (e.g. children of roundrobin or multiplexing) get one shared copy
+// instead of converting them again each.
+std::shared_ptr<const MultiHeadWeights> GetSharedMultiHeadWeights(
+    const pblczero::Weights& weights);
+
+// Enables sharing in GetSharedMultiHeadWeights() for its lifetime. The weights
+// proto must outlive the scope, which is then the case for wrapper backends
+// creating their children.
+class MultiHeadWeightsSharingScope {
+ public:
+  MultiHeadWeightsSharingScope();
+  ~MultiHeadWeightsSharingScope();
+  MultiHeadWeightsSharingScope(const MultiHeadWeightsSharingScope&) = delete;
+  MultiHeadWeightsSharingScope& operator=(const MultiHeadWeightsSharingScope&) =
+      delete;
+};
+
 enum InputEmbedding {
   INPUT_EMBEDDING_NONE = 0,
   INPUT_EMBEDDING_PE_MAP = 1,
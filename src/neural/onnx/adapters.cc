@@ -28,9 +28,7 @@ Program grant you additional permission to convey the resulting work.
 #include "neural/onnx/adapters.h"
 #include <algorithm>
 
-#include "utils/bf16_utils.h"
-#include "utils/fp16_utils.h"
-#include "utils/fp8_utils.h"
+#include "utils/fp_convert.h"
 #include "utils/transpose.h"
 
 namespace lczero {
@@ -76,7 +74,7 @@ pblczero::TensorProto::DataType Float16OnnxWeightsAdapter::GetDataType() const {
 
 std::string Float16OnnxWeightsAdapter::GetRawData() const {
   std::vector<uint16_t> fp16(weights_.size());
-  std::transform(weights_.begin(), weights_.end(), fp16.begin(), FP32toFP16);
+  FP32toFP16(weights_, fp16);
   return TransposeAndReturnRaw<uint16_t>(dims_, order_, fp16);
 }
 
@@ -87,7 +85,7 @@ pblczero::TensorProto::DataType BFloat16OnnxWeightsAdapter::GetDataType()
 
 std::string BFloat16OnnxWeightsAdapter::GetRawData() const {
   std::vector<uint16_t> bf16(weights_.size());
-  std::transform(weights_.begin(), weights_.end(), bf16.begin(), FP32toBF16);
+  FP32toBF16(weights_, bf16);
   return TransposeAndReturnRaw<uint16_t>(dims_, order_, bf16);
 }
 
@@ -98,8 +96,7 @@ pblczero::TensorProto::DataType Float8E5M2OnnxWeightsAdapter::GetDataType()
 
 std::string Float8E5M2OnnxWeightsAdapter::GetRawData() const {
   std::vector<uint8_t> f8(weights_.size());
-  std::transform(weights_.begin(), weights_.end(), f8.begin(),
-                 [](float x) { return FP32toFP8E5M2(x); });
+  FP32toFP8E5M2(weights_, f8);
   return TransposeAndReturnRaw<uint8_t>(dims_, order_, f8);
 }
 
@@ -31,6 +31,7 @@
 
 #include "neural/onnx/adapters.h"
 #include "neural/onnx/onnx.pb.h"
+#include "neural/onnx/optimizer.h"
 #include "utils/exception.h"
 #include "utils/random.h"
 #include "version.h"
@@ -478,4 +479,6 @@ std::string OnnxBuilder::ReduceMean(const std::string& name,
   return out;
 }
 
+void OnnxBuilder::Optimize() { OptimizeOnnxGraph(model_.mutable_graph()); }
+
 }  // namespace lczero
@@ -27,11 +27,16 @@
 
 #include "neural/onnx/converter.h"
 
+#include <algorithm>
+#include <array>
 #include <climits>
 #include <cmath>
 #include <cstddef>
 #include <initializer_list>
 #include <memory>
+#include <set>
+#include <sstream>
+#include <string>
 
 #include "neural/loader.h"
 #include "neural/network.h"
@@ -39,8 +44,7 @@
 #include "neural/onnx/adapters.h"
 #include "neural/onnx/builder.h"
 #include "neural/tables/activation_function.h"
-#include "neural/tables/attention_policy_map.h"
-#include "neural/tables/policy_map.h"
+#include "neural/tables/policy_gather.h"
 #include "proto/net.pb.h"
 #include "utils/bf16_utils.h"
 #include "utils/exception.h"
@@ -64,7 +68,10 @@ class Converter {
         default_eps_(net.format().network_format().input_embedding() ==
                              pblczero::NetworkFormat::INPUT_EMBEDDING_PE_DENSE
                          ? 1e-3
-                         : 1e-6) {}
+                         : 1e-6),
+        data_type_(options.data_type) {
+    ParseFp32Layers();
+  }
 
   void Convert(pblczero::Net* dst);
 
@@ -127,8 +134,8 @@ class Converter {
 
   std::string MakeLayerNorm(OnnxBuilder* builder, const std::string& input,
                             const std::string& name,
-                            const lczero::OnnxConst& gammas,
-                            const lczero::OnnxConst& betas, float eps = 1e-6);
+                            const std::vector<float>& gammas,
+                            const std::vector<float>& betas, float eps = 1e-6);
 
   std::string MakeFFN(OnnxBuilder* builder, const MultiHeadWeights::FFN& ffn,
                       int embedding_size, const std::string& ffn_in,
@@ -146,7 +153,8 @@ class Converter {
   std::string MakeAttentionPolicy(OnnxBuilder* builder,
                                   const std::string& input,
                                   const MultiHeadWeights& weights,
-                                  const MultiHeadWeights::PolicyHead& head);
+                                  const MultiHeadWeights::PolicyHead& head,
+                                  const std::string& output_name);
 
   void MakePolicyHead(pblczero::OnnxModel* onnx, OnnxBuilder* builder,
                       const std::string& input,
@@ -174,15 +182,30 @@ class Converter {
   std::string EndOptionalBf16Fix(OnnxBuilder* builder, std::string flow,
                                  std::string name);
 
+  void ParseFp32Layers();
+  // Whether `part` should be computed in fp32 while the model data type is
+  // lower precision. False when already inside an fp32 part.
+  bool UseFp32(const std::string& part) const;
+  // Casts `input` to float and generates subsequent nodes in fp32.
+  std::string SwitchToFp32(OnnxBuilder* builder, const std::string& input,
+                           const std::string& name);
+  // Resumes the model data type, casting `input` into a node named `name`.
+  std::string SwitchFromFp32(OnnxBuilder* builder, const std::string& input,
+                             const std::string& name);
+
   const pblczero::Net& src_;
   const WeightsToOnnxConverterOptions& options_;
   const ActivationFunction default_activation_;
   const float default_eps_;
   bool se_reshape_init_ = false;
+  // Data type nodes are currently generated in, differs from
+  // options_.data_type inside of fp32 parts.
+  WeightsToOnnxConverterOptions::DataType data_type_;
+  std::set<std::string> fp32_layers_;
 };
 
 pblczero::TensorProto::DataType Converter::GetDataType() const {
-  switch (options_.data_type) {
+  switch (data_type_) {
     case WeightsToOnnxConverterOptions::DataType::kFloat32:
       return pblczero::TensorProto::FLOAT;
     case WeightsToOnnxConverterOptions::DataType::kFloat16:
@@ -197,7 +220,7 @@ pblczero::TensorProto::DataType Converter::GetDataType() const {
 std::unique_ptr<OnnxConst> Converter::GetWeghtsConverter(
     const std::vector<float>& weights, std::initializer_list<int> dims,
     std::initializer_list<int> order) {
-  switch (options_.data_type) {
+  switch (data_type_) {
     case WeightsToOnnxConverterOptions::DataType::kFloat32:
       return std::make_unique<FloatOnnxWeightsAdapter>(weights, dims, order);
     case WeightsToOnnxConverterOptions::DataType::kFloat16:
@@ -206,12 +229,12 @@ std::unique_ptr<OnnxConst> Converter::GetWeghtsConverter(
       return std::make_unique<BFloat16OnnxWeightsAdapter>(weights, dims, order);
   }
   throw Exception("Data type " +
-                  std::to_string(static_cast<int>(options_.data_type)) +
+                  std::to_string(static_cast<int>(data_type_)) +
                   " is not supported in weights converter");
 }
 
 std::unique_ptr<OnnxConst> Converter::GetScalarConverter(float in) {
-  switch (options_.data_type) {
+  switch (data_type_) {
     case WeightsToOnnxConverterOptions::DataType::kFloat32:
       return std::make_unique<FloatOnnxConst>(FloatOnnxConst({in}, {1}));
     case WeightsToOnnxConverterOptions::DataType::kFloat16:
@@ -222,7 +245,7 @@ std::unique_ptr<OnnxConst> Converter::GetScalarConverter(float in) {
           BFloat16OnnxConst({FP32toBF16(in)}, {1}));
   }
   throw Exception("Data type " +
-                  std::to_string(static_cast<int>(options_.data_type)) +
+                  std::to_string(static_cast<int>(data_type_)) +
                   " is not supported in scalar converter");
 }
 
@@ -230,7 +253,7 @@ std::string Converter::StartOptionalBf16Fix(OnnxBuilder* builder,
                                             std::string flow,
                                             std::string name) {
   if (options_.opset >= 22 ||
-      options_.data_type !=
+      data_type_ !=
           WeightsToOnnxConverterOptions::DataType::kBFloat16) {
     return flow;
   }
@@ -240,7 +263,7 @@ std::string Converter::StartOptionalBf16Fix(OnnxBuilder* builder,
 std::string Converter::EndOptionalBf16Fix(OnnxBuilder* builder,
                                           std::string flow, std::string name) {
   if (options_.opset >= 22 ||
-      options_.data_type !=
+      data_type_ !=
           WeightsToOnnxConverterOptions::DataType::kBFloat16) {
     return flow;
   }
@@ -248,6 +271,42 @@ std::string Converter::EndOptionalBf16Fix(OnnxBuilder* builder,
                        pblczero::TensorProto::BFLOAT16);
 }
 
+void Converter::ParseFp32Layers() {
+  static const std::set<std::string> kParts = {"policy", "value", "mlh",
+                                              "layernorm", "smolgen"};
+  std::stringstream ss(options_.fp32_layers);
+  std::string part;
+  while (std::getline(ss, part, ',')) {
+    if (part.empty()) continue;
+    if (kParts.count(part) == 0) {
+      throw Exception("Unknown fp32 layer '" + part +
+                      "', supported are policy, value, mlh, layernorm and "
+                      "smolgen.");
+    }
+    fp32_layers_.insert(part);
+  }
+}
+
+bool Converter::UseFp32(const std::string& part) const {
+  return data_type_ != WeightsToOnnxConverterOptions::DataType::kFloat32 &&
+         fp32_layers_.count(part) > 0;
+}
+
+std::string Converter::SwitchToFp32(OnnxBuilder* builder,
+                                    const std::string& input,
+                                    const std::string& name) {
+  data_type_ = WeightsToOnnxConverterOptions::DataType::kFloat32;
+  return builder->Cast(name + "/to_float", input,
+                       pblczero::TensorProto::FLOAT);
+}
+
+std::string Converter::SwitchFromFp32(OnnxBuilder* builder,
+                                      const std::string& input,
+                                      const std::string& name) {
+  data_type_ = options_.data_type;
+  return builder->Cast(name, input, GetDataType());
+}
+
 std::string Converter::MakeMish(OnnxBuilder* builder, const std::string& input,
                                 const std::string& name) {
   if (!options_.alt_mish || options_.opset < 9) {
@@ -263,7 +322,7 @@ std::string Converter::MakeMish(OnnxBuilder* builder, const std::string& input,
     return builder->Mul(name, flow, input);
   } else {
     auto in = input;
-    if (options_.data_type !=
+    if (data_type_ !=
         WeightsToOnnxConverterOptions::DataType::kFloat32) {
       in = builder->Cast(name + "/to_float", in,
                          pblczero::TensorProto::FLOAT);
@@ -282,7 +341,7 @@ std::string Converter::MakeMish(OnnxBuilder* builder, const std::string& input,
     auto t = builder->Sub(name + "/in-2*d", in, flow);
     flow = builder->Greater(name + "/compare", in, zero);
     flow = builder->Where(name, flow, t, f);
-    if (options_.data_type !=
+    if (data_type_ !=
         WeightsToOnnxConverterOptions::DataType::kFloat32) {
       flow = builder->Cast(name + "/to_data_type", flow, GetDataType());
     }
@@ -363,7 +422,7 @@ std::string Converter::MakeConvBlock(
     const std::string& mixin, bool activation, int filters) {
   auto flow = input;
   if (options_.opset < 22 &&
-      options_.data_type ==
+      data_type_ ==
           WeightsToOnnxConverterOptions::DataType::kBFloat16) {
     flow =
         builder->Cast(name + "/to_float", flow, pblczero::TensorProto::FLOAT);
@@ -417,8 +476,12 @@ std::string Converter::MakeSmolgen(OnnxBuilder* builder,
       layer.mha.smolgen.compress.size() / embedding_size;
   const int smolgen_hidden_sz = layer.mha.smolgen.dense1_b.size();
   const int smolgen_gen_sz = layer.mha.smolgen.dense2_b.size() / heads;
-  auto flow = builder->MatMul(
-      name + "/smolgen/compress", encoder_in,
+  // The shared weight generation matmul stays in the model data type.
+  const bool fp32 = UseFp32("smolgen");
+  auto flow = fp32 ? SwitchToFp32(builder, encoder_in, name + "/smolgen")
+                   : encoder_in;
+  flow = builder->MatMul(
+      name + "/smolgen/compress", flow,
       *GetWeghtsConverter(layer.mha.smolgen.compress,
                           {embedding_size, smolgen_hidden_channels}, {1, 0}));
   flow = builder->Reshape(
@@ -435,11 +498,9 @@ std::string Converter::MakeSmolgen(OnnxBuilder* builder,
       name + "/smolgen/dense1/b", flow,
       *GetWeghtsConverter(layer.mha.smolgen.dense1_b, {smolgen_hidden_sz}));
   flow = MakeActivation(builder, flow, name + "/smolgen/dense1", activation);
-  flow = MakeLayerNorm(
-      builder, flow, name + "/smolgen/ln1",
-      *GetWeghtsConverter(layer.mha.smolgen.ln1_gammas, {smolgen_hidden_sz}),
-      *GetWeghtsConverter(layer.mha.smolgen.ln1_betas, {smolgen_hidden_sz}),
-      1e-3);
+  flow = MakeLayerNorm(builder, flow, name + "/smolgen/ln1",
+                       layer.mha.smolgen.ln1_gammas,
+                       layer.mha.smolgen.ln1_betas, 1e-3);
   flow = builder->MatMul(
       name + "/smolgen/dense2/w", flow,
       *GetWeghtsConverter(layer.mha.smolgen.dense2_w,
@@ -449,11 +510,11 @@ std::string Converter::MakeSmolgen(OnnxBuilder* builder,
                                           {smolgen_gen_sz * heads}));
   flow = MakeActivation(builder, flow, name + "/smolgen/dense2", activation);
   flow = MakeLayerNorm(builder, flow, name + "/smolgen/ln2",
-                       *GetWeghtsConverter(layer.mha.smolgen.ln2_gammas,
-                                           {smolgen_gen_sz * heads}),
-                       *GetWeghtsConverter(layer.mha.smolgen.ln2_betas,
-                                           {smolgen_gen_sz * heads}),
-                       1e-3);
+                       layer.mha.smolgen.ln2_gammas,
+                       layer.mha.smolgen.ln2_betas, 1e-3);
+  if (fp32) {
+    flow = SwitchFromFp32(builder, flow, name + "/smolgen/to_data_type");
+  }
   flow =
       builder->Reshape(name + "/smolgen/gen_from/reshape", flow,
                        builder->AddInitializer(
@@ -471,17 +532,24 @@ std::string Converter::MakeSmolgen(OnnxBuilder* builder,
 std::string Converter::MakeLayerNorm(OnnxBuilder* builder,
                                      const std::string& input,
                                      const std::string& name,
-                                     const lczero::OnnxConst& gammas,
-                                     const lczero::OnnxConst& betas,
+                                     const std::vector<float>& gammas,
+                                     const std::vector<float>& betas,
                                      float eps) {
+  const int size = static_cast<int>(gammas.size());
+  const bool fp32 = UseFp32("layernorm");
+  auto in = fp32 ? SwitchToFp32(builder, input, name) : input;
+  std::string flow;
   if (!options_.alt_layernorm) {
-    return builder->LayerNormalization(name, input, gammas, betas, 1, eps);
+    flow = builder->LayerNormalization(name, in,
+                                       *GetWeghtsConverter(gammas, {size}),
+                                       *GetWeghtsConverter(betas, {size}), 1,
+                                       eps);
+    return fp32 ? SwitchFromFp32(builder, flow, name + "/to_data_type") : flow;
   }
-  auto in = input;
   if (GetDataType() != pblczero::TensorProto::FLOAT) {
     in = builder->Cast(name + "/to_float", in, pblczero::TensorProto::FLOAT);
   }
-  auto flow = builder->ReduceMean(name + "/mean", in, {1});
+  flow = builder->ReduceMean(name + "/mean", in, {1});
   in = builder->Sub(name + "/centered", in, flow);
   flow = builder->Mul(name + "/squared", in, in);
   flow = builder->ReduceMean(name + "/var", flow, {1});
@@ -494,9 +562,11 @@ std::string Converter::MakeLayerNorm(OnnxBuilder* builder,
   if (GetDataType() != pblczero::TensorProto::FLOAT) {
     flow = builder->Cast(name + "/to_data_type", flow, GetDataType());
   }
-  flow = builder->Mul(name + "/gammas", flow, gammas);
-  flow = builder->Add(name + "/betas", flow, betas);
-  return flow;
+  flow = builder->Mul(name + "/gammas", flow,
+                      *GetWeghtsConverter(gammas, {size}));
+  flow = builder->Add(name + "/betas", flow,
+                      *GetWeghtsConverter(betas, {size}));
+  return fp32 ? SwitchFromFp32(builder, flow, name + "/to_data_type") : flow;
 }
 
 std::string Converter::MakeFFN(OnnxBuilder* builder,
@@ -582,20 +652,16 @@ std::string Converter::MakeEncoderLayer(
         builder->Mul(name + "/alpha*input", flow, *GetScalarConverter(alpha));
   }
   flow = builder->Add(name + "/mha/out/skip", flow, encoder_in);
-  flow = MakeLayerNorm(builder, flow, name + "/ln1",
-                       *GetWeghtsConverter(layer.ln1_gammas, {embedding_size}),
-                       *GetWeghtsConverter(layer.ln1_betas, {embedding_size}),
-                       default_eps_);
+  flow = MakeLayerNorm(builder, flow, name + "/ln1", layer.ln1_gammas,
+                       layer.ln1_betas, default_eps_);
   const auto ffn_activation = static_cast<ActivationFunction>(
       src_.format().network_format().ffn_activation());
   flow = MakeFFN(
       builder, layer.ffn, embedding_size, flow, name,
       ffn_activation == ACTIVATION_DEFAULT ? activation : ffn_activation,
       alpha);
-  flow = MakeLayerNorm(builder, flow, name + "/ln2",
-                       *GetWeghtsConverter(layer.ln2_gammas, {embedding_size}),
-                       *GetWeghtsConverter(layer.ln2_betas, {embedding_size}),
-                       default_eps_);
+  flow = MakeLayerNorm(builder, flow, name + "/ln2", layer.ln2_gammas,
+                       layer.ln2_betas, default_eps_);
   return flow;
 }
 
@@ -750,10 +816,9 @@ std::string Converter::MakeAttentionBody(OnnxBuilder* builder,
   flow = MakeActivation(builder, flow, "/attn_body", default_activation_);
 
   if (input_embedding == network_format::INPUT_EMBEDDING_PE_DENSE) {
-    flow = MakeLayerNorm(
-        builder, flow, "/attn_body/ln",
-        *GetWeghtsConverter(weights.ip_emb_ln_gammas, {embedding_size}),
-        *GetWeghtsConverter(weights.ip_emb_ln_betas, {embedding_size}), 1e-3);
+    flow = MakeLayerNorm(builder, flow, "/attn_body/ln",
+                         weights.ip_emb_ln_gammas, weights.ip_emb_ln_betas,
+                         1e-3);
   }
 
   if (weights.ip_mult_gate.size() > 0 || weights.ip_add_gate.size() > 0) {
@@ -782,11 +847,9 @@ std::string Converter::MakeAttentionBody(OnnxBuilder* builder,
   if (input_embedding == network_format::INPUT_EMBEDDING_PE_DENSE) {
     flow = MakeFFN(builder, weights.ip_emb_ffn, embedding_size, flow,
                    "/attn_body", default_activation_, alpha);
-    flow = MakeLayerNorm(
-        builder, flow, "/attn_body/ln2",
-        *GetWeghtsConverter(weights.ip_emb_ffn_ln_gammas, {embedding_size}),
-        *GetWeghtsConverter(weights.ip_emb_ffn_ln_betas, {embedding_size}),
-        1e-3);
+    flow = MakeLayerNorm(builder, flow, "/attn_body/ln2",
+                         weights.ip_emb_ffn_ln_gammas,
+                         weights.ip_emb_ffn_ln_betas, 1e-3);
   }
 
   for (size_t i = 0; i < NumEncBlocks(); i++) {
@@ -798,20 +861,16 @@ std::string Converter::MakeAttentionBody(OnnxBuilder* builder,
 }
 
 namespace {
-std::vector<int> MakePolicyMap(const short* map, int size) {
-  std::vector<int> policy_map(1858);
-  int idx = 0;
-  for (int i = 0; i < size; i++) {
-    if (map[i] > -1) policy_map[map[i]] = idx;
-    idx++;
-  }
-  return policy_map;
+template <size_t N>
+std::vector<int> MakePolicyMap(const std::array<short, N>& gather) {
+  return std::vector<int>(gather.begin(), gather.end());
 }
 }  // namespace
 
 std::string Converter::MakeAttentionPolicy(
     OnnxBuilder* builder, const std::string& input,
-    const MultiHeadWeights& weights, const MultiHeadWeights::PolicyHead& head) {
+    const MultiHeadWeights& weights, const MultiHeadWeights::PolicyHead& head,
+    const std::string& output_name) {
   if (head.ip2_pol_b.empty()) {
     throw Exception("The policy head selected '" + options_.policy_head + "'" +
                     " is empty.");
@@ -908,12 +967,10 @@ std::string Converter::MakeAttentionPolicy(
       builder->AddInitializer("/const/policy_out_shape",
                               Int64OnnxConst({-1, 67 * 64}, {2})));
   return builder->Gather(
-      options_.output_policy_head, flow,
+      output_name, flow,
       builder->AddInitializer(
           "/const/mapping_table",
-          Int32OnnxConst(
-              MakePolicyMap(kAttnPolicyMap, std::size(kAttnPolicyMap)),
-              {1858})),
+          Int32OnnxConst(MakePolicyMap(kAttnPolicyGather), {1858})),
       1);
 }
 
@@ -927,12 +984,18 @@ void Converter::MakePolicyHead(pblczero::OnnxModel* onnx, OnnxBuilder* builder,
   }
   const MultiHeadWeights::PolicyHead& head =
       weights.policy_heads.at(options_.policy_head);
+  const bool fp32 = UseFp32("policy");
+  const std::string output_name =
+      fp32 ? "/policy/output" : options_.output_policy_head;
+  const auto policy_in =
+      fp32 ? SwitchToFp32(builder, input, "/policy") : input;
+  std::string output;
+  int batch_size = options_.batch_size;
   if (src_.format().network_format().policy() ==
       pblczero::NetworkFormat::POLICY_ATTENTION) {
-    auto output = MakeAttentionPolicy(builder, input, weights, head);
-    builder->AddOutput(output, {-1, 1858}, GetDataType());
-    onnx->set_output_policy(output);
-    return;
+    output =
+        MakeAttentionPolicy(builder, policy_in, weights, head, output_name);
+    batch_size = -1;
   } else if (head.policy.weights.empty()) {
     throw Exception("The policy head selected '" + options_.policy_head + "'" +
                     " is empty.");
@@ -943,23 +1006,19 @@ void Converter::MakePolicyHead(pblczero::OnnxModel* onnx, OnnxBuilder* builder,
           "Convolutional policy not supported with attention body.");
     }
     auto flow = MakeConvBlock(builder, head.policy1, NumFilters(), NumFilters(),
-                              input, "/policy/conv1");
+                              policy_in, "/policy/conv1");
     flow = MakeConvBlock(builder, head.policy, NumFilters(), 80, flow,
                          "/policy/conv2", nullptr, "", false);
     flow = builder->Reshape(
         "/policy/flatten", flow,
         builder->AddInitializer("/const/policy_shape",
                                 Int64OnnxConst({-1, 80 * 8 * 8}, {2})));
-    auto output = builder->Gather(
-        options_.output_policy_head, flow,
+    output = builder->Gather(
+        output_name, flow,
         builder->AddInitializer(
             "/const/mapping_table",
-            Int32OnnxConst(
-                MakePolicyMap(kConvPolicyMap, std::size(kConvPolicyMap)),
-                {1858})),
+            Int32OnnxConst(MakePolicyMap(kConvPolicyGather), {1858})),
         1);
-    builder->AddOutput(output, {options_.batch_size, 1858}, GetDataType());
-    onnx->set_output_policy(output);
   } else {
     // Dense policy head.
     if (NumEncBlocks() > 0) {
@@ -967,7 +1026,7 @@ void Converter::MakePolicyHead(pblczero::OnnxModel* onnx, OnnxBuilder* builder,
     }
     const int pol_channels = head.policy.biases.size();
     auto flow = MakeConvBlock(builder, head.policy, NumFilters(), pol_channels,
-                              input, "/policy/conv", nullptr, "", true, 1);
+                              policy_in, "/policy/conv", nullptr, "", true, 1);
     flow =
         builder->Reshape("/policy/reshape", flow,
                          builder->AddInitializer(
@@ -977,12 +1036,14 @@ void Converter::MakePolicyHead(pblczero::OnnxModel* onnx, OnnxBuilder* builder,
         "/policy/dense/matmul", flow,
         *GetWeghtsConverter(head.ip_pol_w,
                             {pol_channels * 8 * 8, 1858}, {1, 0}));
-    auto output = builder->Add(
-        options_.output_policy_head, flow,
-        *GetWeghtsConverter(head.ip_pol_b, {1858}));
-    builder->AddOutput(output, {options_.batch_size, 1858}, GetDataType());
-    onnx->set_output_policy(output);
+    output = builder->Add(output_name, flow,
+                          *GetWeghtsConverter(head.ip_pol_b, {1858}));
   }
+  if (fp32) {
+    output = SwitchFromFp32(builder, output, options_.output_policy_head);
+  }
+  builder->AddOutput(output, {batch_size, 1858}, GetDataType());
+  onnx->set_output_policy(output);
 }
 
 void Converter::MakeValueHead(pblczero::OnnxModel* onnx, OnnxBuilder* builder,
@@ -999,19 +1060,20 @@ void Converter::MakeValueHead(pblczero::OnnxModel* onnx, OnnxBuilder* builder,
     throw Exception("The value head selected '" + options_.value_head + "'" +
                     " is empty.");
   }
-  std::string flow;
+  const bool fp32 = UseFp32("value");
+  std::string flow = fp32 ? SwitchToFp32(builder, input, "/value") : input;
   const int val_channels = NumEncBlocks() > 0 ? head.ip_val_b.size() : 32;
   if (NumEncBlocks() > 0) {
     int embedding_size = weights.ip_emb_b.size();
     flow = builder->MatMul(
-        "/value/embed/matmul", input,
+        "/value/embed/matmul", flow,
         *GetWeghtsConverter(head.ip_val_w, {embedding_size, val_channels},
                             {1, 0}));
     flow = builder->Add("/value/embed/add", flow,
                         *GetWeghtsConverter(head.ip_val_b, {val_channels}));
     flow = MakeActivation(builder, flow, "/value/embed", default_activation_);
   } else {
-    flow = MakeConvBlock(builder, head.value, NumFilters(), val_channels, input,
+    flow = MakeConvBlock(builder, head.value, NumFilters(), val_channels, flow,
                          "/value/conv", nullptr, "", true, 1);
   }
   flow = builder->Reshape(
@@ -1033,7 +1095,9 @@ void Converter::MakeValueHead(pblczero::OnnxModel* onnx, OnnxBuilder* builder,
                         *GetWeghtsConverter(head.ip2_val_w, {128, 3}, {1, 0}));
     flow = builder->Add("/value/dense2/add", flow,
                         *GetWeghtsConverter(head.ip2_val_b, {3}));
-    auto output = builder->Softmax(options_.output_wdl, flow);
+    auto output =
+        builder->Softmax(fp32 ? "/value/softmax" : options_.output_wdl, flow);
+    if (fp32) output = SwitchFromFp32(builder, output, options_.output_wdl);
     builder->AddOutput(output, {options_.batch_size, 3}, GetDataType());
     onnx->set_output_wdl(output);
   } else {
@@ -1042,7 +1106,9 @@ void Converter::MakeValueHead(pblczero::OnnxModel* onnx, OnnxBuilder* builder,
                         *GetWeghtsConverter(head.ip2_val_w, {128, 1}, {1, 0}));
     flow = builder->Add("/value/dense2/add", flow,
                         *GetWeghtsConverter(head.ip2_val_b, {1}));
-    auto output = builder->Tanh(options_.output_value, flow);
+    auto output =
+        builder->Tanh(fp32 ? "/value/tanh" : options_.output_value, flow);
+    if (fp32) output = SwitchFromFp32(builder, output, options_.output_value);
     builder->AddOutput(output, {options_.batch_size, 1}, GetDataType());
     onnx->set_output_value(output);
   }
@@ -1060,11 +1126,12 @@ void Converter::MakeMovesLeftHead(pblczero::OnnxModel* onnx,
                                ? weights.ip_mov_b.size()
                                : weights.moves_left.biases.size();
   const int mlh_fc1_outputs = weights.ip1_mov_b.size();
-  std::string flow;
+  const bool fp32 = UseFp32("mlh");
+  std::string flow = fp32 ? SwitchToFp32(builder, input, "/mlh") : input;
   if (NumEncBlocks() > 0) {
     int embedding_size = weights.ip_emb_b.size();
     flow = builder->MatMul(
-        "/mlh/embed/matmul", input,
+        "/mlh/embed/matmul", flow,
         *GetWeghtsConverter(weights.ip_mov_w, {embedding_size, mlh_channels},
                             {1, 0}));
     flow = builder->Add("/mlh/embed/add", flow,
@@ -1073,7 +1140,7 @@ void Converter::MakeMovesLeftHead(pblczero::OnnxModel* onnx,
   } else {
     flow =
         MakeConvBlock(builder, weights.moves_left, NumFilters(), mlh_channels,
-                      input, "/mlh/conv", nullptr, "", true, 1);
+                      flow, "/mlh/conv", nullptr, "", true, 1);
   }
   flow = builder->Reshape(
       "/mlh/reshape", flow,
@@ -1093,13 +1160,15 @@ void Converter::MakeMovesLeftHead(pblczero::OnnxModel* onnx,
   flow = builder->Add("/mlh/dense2/add", flow,
                       *GetWeghtsConverter(weights.ip2_mov_b, {1}));
   flow = MakeActivation(builder, flow, "/mlh/dense2", default_activation_);
-  auto output = builder->Identity(options_.output_mlh, flow);
+  auto output = fp32 ? SwitchFromFp32(builder, flow, options_.output_mlh)
+                     : builder->Identity(options_.output_mlh, flow);
   builder->AddOutput(output, {options_.batch_size, 1}, GetDataType());
   onnx->set_output_mlh(output);
 }
 
 void Converter::GenerateOnnx(pblczero::OnnxModel* onnx) {
-  MultiHeadWeights weights(src_.weights());
+  const auto shared_weights = GetSharedMultiHeadWeights(src_.weights());
+  const MultiHeadWeights& weights = *shared_weights;
   OnnxBuilder builder(options_.opset);
 
   if (GetDataType() == pblczero::TensorProto::FLOAT16) {
@@ -1138,6 +1207,7 @@ void Converter::GenerateOnnx(pblczero::OnnxModel* onnx) {
   // Moves left head.
   MakeMovesLeftHead(onnx, &builder, flow, weights);
 
+  if (options_.optimize) builder.Optimize();
   onnx->set_model(builder.OutputAsString());
 }
 
@@ -1243,6 +1313,37 @@ WeightsToOnnxConverterOptions::StringToDataType(const std::string& s) {
                   "]. Only f32, f16 and bf16 are supported.");
 }
 
+void WeightsToOnnxConverterOptions::ApplyProfile(const std::string& profile) {
+  if (profile == "generic") return;
+  if (profile == "tensorrt") {
+    // TensorRT fuses LayerNormalization (opset 17) into a single kernel and
+    // runs best in fp16.
+    data_type = DataType::kFloat16;
+    opset = std::max(opset, 17);
+    alt_layernorm = false;
+    alt_mish = false;
+    return;
+  }
+  if (profile == "directml") {
+    // DirectML has a native Mish (opset 18), while its LayerNormalization is
+    // slower than the discrete implementation.
+    data_type = DataType::kFloat16;
+    opset = std::max(opset, 18);
+    alt_layernorm = true;
+    alt_mish = false;
+    return;
+  }
+  if (profile == "cpu") {
+    // The CPU execution provider has no fast fp16 kernels, and the Mish
+    // approximation is faster than softplus/tanh there.
+    data_type = DataType::kFloat32;
+    alt_mish = true;
+    return;
+  }
+  throw Exception("Invalid export profile: [" + profile +
+                  "]. Only generic, tensorrt, directml and cpu are supported.");
+}
+
 pblczero::Net ConvertWeightsToOnnx(
     const pblczero::Net& net, const WeightsToOnnxConverterOptions& options) {
   Converter converter(net, options);
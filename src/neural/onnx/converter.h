@@ -48,10 +48,17 @@ struct WeightsToOnnxConverterOptions {
   bool alt_mish = false;       // Use "Mish" approximation (fp32 only).
   bool alt_layernorm = false;  // Discrete "LayerNormalization" implementation.
   bool no_shape = false;       // Avoid use of "Shape" operator.
+  bool optimize = true;        // Fold constants and fuse nodes when done.
   std::string policy_head = "vanilla";
   std::string value_head = "winner";
+  // Comma-separated list of parts kept in fp32 when data_type is f16/bf16.
+  // Valid parts are "policy", "value", "mlh", "layernorm" and "smolgen".
+  std::string fp32_layers;
 
   static DataType StringToDataType(const std::string&);
+  // Sets the options for the runtime the model is exported for: "generic"
+  // (leaves them as they are), "tensorrt", "directml" or "cpu".
+  void ApplyProfile(const std::string& profile);
 };
 
 // Converts "classical" weights file to weights file with embedded ONNX model.
@@ -0,0 +1,620 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "neural/onnx/optimizer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace lczero {
+namespace {
+
+using DataType = pblczero::TensorProto::DataType;
+
+// Each pass is cheap, a few rounds are enough to reach the fixed point for
+// the graphs the converter emits.
+constexpr int kMaxRounds = 8;
+
+size_t ElementSize(DataType type) {
+  switch (type) {
+    case pblczero::TensorProto::UINT8:
+    case pblczero::TensorProto::INT8:
+    case pblczero::TensorProto::BOOL:
+    case pblczero::TensorProto::FLOAT8E4M3FN:
+    case pblczero::TensorProto::FLOAT8E4M3FNUZ:
+    case pblczero::TensorProto::FLOAT8E5M2:
+    case pblczero::TensorProto::FLOAT8E5M2FNUZ:
+      return 1;
+    case pblczero::TensorProto::UINT16:
+    case pblczero::TensorProto::INT16:
+    case pblczero::TensorProto::FLOAT16:
+    case pblczero::TensorProto::BFLOAT16:
+      return 2;
+    case pblczero::TensorProto::FLOAT:
+    case pblczero::TensorProto::INT32:
+    case pblczero::TensorProto::UINT32:
+      return 4;
+    case pblczero::TensorProto::DOUBLE:
+    case pblczero::TensorProto::INT64:
+    case pblczero::TensorProto::UINT64:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+// Whether casting from @from to @to and back gives the original value.
+bool IsLosslessWidening(DataType from, DataType to) {
+  switch (from) {
+    case pblczero::TensorProto::FLOAT16:
+    case pblczero::TensorProto::BFLOAT16:
+      return to == pblczero::TensorProto::FLOAT ||
+             to == pblczero::TensorProto::DOUBLE;
+    case pblczero::TensorProto::FLOAT:
+      return to == pblczero::TensorProto::DOUBLE;
+    default:
+      return false;
+  }
+}
+
+const pblczero::AttributeProto* FindAttribute(const pblczero::NodeProto& node,
+                                              std::string_view name) {
+  for (const auto& attribute : node.attribute()) {
+    if (attribute.name() == name) return &attribute;
+  }
+  return nullptr;
+}
+
+// Returns the "perm" attribute of a Transpose node, or nothing if it's not
+// set explicitly.
+std::optional<std::vector<int64_t>> GetPerm(const pblczero::NodeProto& node) {
+  const auto* perm = FindAttribute(node, "perm");
+  if (!perm || perm->ints_size() == 0) return std::nullopt;
+  return perm->ints();
+}
+
+bool IsIdentityPerm(const std::vector<int64_t>& perm) {
+  for (size_t i = 0; i < perm.size(); ++i) {
+    if (perm[i] != static_cast<int64_t>(i)) return false;
+  }
+  return true;
+}
+
+bool IsValidPerm(const std::vector<int64_t>& perm) {
+  std::vector<bool> seen(perm.size());
+  for (const auto p : perm) {
+    if (p < 0 || p >= static_cast<int64_t>(perm.size()) || seen[p]) {
+      return false;
+    }
+    seen[p] = true;
+  }
+  return true;
+}
+
+// Permutes the dimensions of a raw tensor. Element values are only copied, so
+// any fixed size data type works.
+std::string TransposeRawData(std::string_view src,
+                             const std::vector<int64_t>& dims,
+                             const std::vector<int64_t>& perm,
+                             size_t element_size) {
+  const size_t rank = dims.size();
+  std::vector<int64_t> src_strides(rank, 1);
+  for (size_t i = rank; i-- > 1;) {
+    src_strides[i - 1] = src_strides[i] * dims[i];
+  }
+  std::vector<int64_t> dst_dims(rank);
+  std::vector<int64_t> strides(rank);
+  for (size_t i = 0; i < rank; ++i) {
+    dst_dims[i] = dims[perm[i]];
+    strides[i] = src_strides[perm[i]];
+  }
+  std::string dst(src.size(), '\0');
+  const size_t count = src.size() / element_size;
+  std::vector<int64_t> index(rank, 0);
+  int64_t offset = 0;
+  for (size_t i = 0; i < count; ++i) {
+    std::memcpy(&dst[i * element_size], src.data() + offset * element_size,
+                element_size);
+    // Increment the destination multi-index and track the source offset.
+    for (size_t d = rank; d-- > 0;) {
+      offset += strides[d];
+      if (++index[d] < dst_dims[d]) break;
+      offset -= strides[d] * dst_dims[d];
+      index[d] = 0;
+    }
+  }
+  return dst;
+}
+
+class GraphOptimizer {
+ public:
+  explicit GraphOptimizer(pblczero::GraphProto* graph) : graph_(graph) {
+    for (const auto& output : graph_->output()) {
+      graph_outputs_.emplace(output.name());
+    }
+  }
+
+  void Run() {
+    SortNodes();
+    for (int round = 0; round < kMaxRounds; ++round) {
+      bool changed = false;
+      Reindex();
+      changed |= FoldConstants();
+      changed |= DropRedundantNodes();
+      changed |= MergeTransposes();
+      changed |= MergeReshapes();
+      Reindex();
+      changed |= FuseMatMulAdd();
+      RemoveUnusedNodes();
+      if (!changed) break;
+    }
+  }
+
+ private:
+  pblczero::NodeProto& node(size_t idx) { return *graph_->mutable_node(idx); }
+
+  // Reorders the nodes so that every node comes after the producers of its
+  // inputs, keeping the original order where it's already fine. Models
+  // patched by tools (e.g. onnx2leela) may have nodes appended at the end.
+  // Nodes whose inputs are never produced are left at the end.
+  void SortNodes() {
+    std::unordered_set<std::string> available = {""};
+    for (const auto& input : graph_->input()) available.emplace(input.name());
+    for (const auto& tensor : graph_->initializer()) {
+      available.emplace(tensor.name());
+    }
+    const size_t count = graph_->node_size();
+    std::vector<size_t> order;
+    std::vector<bool> placed(count, false);
+    bool progress = true;
+    while (order.size() < count && progress) {
+      progress = false;
+      for (size_t i = 0; i < count; ++i) {
+        if (placed[i]) continue;
+        const auto& n = node(i);
+        if (!std::all_of(n.input().begin(), n.input().end(),
+                         [&](const auto& input) {
+                           return available.count(std::string(input)) > 0;
+                         })) {
+          continue;
+        }
+        for (const auto& output : n.output()) available.emplace(output);
+        order.push_back(i);
+        placed[i] = progress = true;
+      }
+    }
+    for (size_t i = 0; i < count; ++i) {
+      if (!placed[i]) order.push_back(i);
+    }
+    if (std::is_sorted(order.begin(), order.end())) return;
+    std::vector<pblczero::NodeProto> nodes;
+    nodes.reserve(count);
+    for (const auto i : order) nodes.push_back(std::move(node(i)));
+    *graph_->mutable_node() = std::move(nodes);
+  }
+
+  void Reindex() {
+    initializers_.clear();
+    producers_.clear();
+    uses_.clear();
+    for (size_t i = 0; i < graph_->initializer_size(); ++i) {
+      initializers_[std::string(graph_->initializer(i).name())] = i;
+    }
+    for (size_t i = 0; i < graph_->node_size(); ++i) {
+      for (const auto& output : node(i).output()) producers_[output] = i;
+      if (dead_.count(i)) continue;
+      for (const auto& input : node(i).input()) ++uses_[input];
+    }
+    for (const auto& output : graph_outputs_) ++uses_[output];
+  }
+
+  const pblczero::TensorProto* GetInitializer(std::string_view name) const {
+    auto iter = initializers_.find(std::string(name));
+    if (iter == initializers_.end()) return nullptr;
+    return &graph_->initializer(iter->second);
+  }
+
+  const pblczero::NodeProto* GetProducer(std::string_view name,
+                                         std::string_view op_type) {
+    auto iter = producers_.find(std::string(name));
+    if (iter == producers_.end() || dead_.count(iter->second)) return nullptr;
+    const auto& producer = node(iter->second);
+    if (producer.op_type() != op_type) return nullptr;
+    return &producer;
+  }
+
+  // Node whose only output may be replaced, i.e. it's not a graph output.
+  bool IsReplaceable(const pblczero::NodeProto& node) const {
+    return node.output_size() == 1 &&
+           !graph_outputs_.count(std::string(node.output(0)));
+  }
+
+  void AddInitializer(const std::string& name, DataType type,
+                      const std::vector<int64_t>& dims, std::string raw_data) {
+    auto* tensor = graph_->add_initializer();
+    tensor->set_name(name);
+    tensor->set_data_type(type);
+    for (const auto dim : dims) tensor->add_dims(dim);
+    tensor->set_raw_data(std::move(raw_data));
+    initializers_[name] = graph_->initializer_size() - 1;
+  }
+
+  void ReplaceUses(const std::string& from, std::string_view to) {
+    for (auto& n : *graph_->mutable_node()) {
+      for (auto& input : *n.mutable_input()) {
+        if (input == from) input = to;
+      }
+    }
+  }
+
+  // Statically known element type of a tensor, if any.
+  std::optional<DataType> GetType(std::string_view name) {
+    if (const auto* tensor = GetInitializer(name)) return tensor->data_type();
+    for (const auto& input : graph_->input()) {
+      if (input.name() == name) return input.type().tensor_type().elem_type();
+    }
+    if (const auto* cast = GetProducer(name, "Cast")) {
+      if (const auto* to = FindAttribute(*cast, "to")) {
+        return static_cast<DataType>(to->i());
+      }
+    }
+    return std::nullopt;
+  }
+
+  // Turns Transpose and Reshape nodes with constant inputs into initializers.
+  bool FoldConstants() {
+    bool changed = false;
+    for (size_t i = 0; i < graph_->node_size(); ++i) {
+      const auto& n = node(i);
+      if (dead_.count(i) || !IsReplaceable(n) || n.input_size() == 0) continue;
+      const auto* input = GetInitializer(n.input(0));
+      if (!input || !input->has_raw_data()) continue;
+      const std::string output(n.output(0));
+      if (n.op_type() == "Transpose" && n.input_size() == 1) {
+        std::vector<int64_t> perm;
+        if (auto explicit_perm = GetPerm(n)) {
+          perm = *explicit_perm;
+        } else {
+          for (size_t d = input->dims_size(); d-- > 0;) perm.push_back(d);
+        }
+        const size_t element_size = ElementSize(input->data_type());
+        if (perm.size() != input->dims_size() || !IsValidPerm(perm) ||
+            element_size == 0) {
+          continue;
+        }
+        std::vector<int64_t> dims;
+        for (const auto p : perm) dims.push_back(input->dims(p));
+        AddInitializer(output, input->data_type(), dims,
+                       TransposeRawData(input->raw_data(),
+                                        input->dims(), perm, element_size));
+      } else if (n.op_type() == "Reshape" && n.input_size() == 2 &&
+                 !FindAttribute(n, "allowzero")) {
+        const auto* shape = GetInitializer(n.input(1));
+        if (!shape || !shape->has_raw_data() ||
+            shape->data_type() != pblczero::TensorProto::INT64) {
+          continue;
+        }
+        std::vector<int64_t> dims(shape->raw_data().size() / sizeof(int64_t));
+        std::memcpy(dims.data(), shape->raw_data().data(),
+                    dims.size() * sizeof(int64_t));
+        int64_t known = 1;
+        std::optional<size_t> inferred;
+        bool valid = true;
+        for (size_t d = 0; d < dims.size(); ++d) {
+          if (dims[d] == 0 && d < input->dims_size()) dims[d] = input->dims(d);
+          if (dims[d] == -1 && !inferred) {
+            inferred = d;
+          } else if (dims[d] > 0) {
+            known *= dims[d];
+          } else {
+            valid = false;
+          }
+        }
+        int64_t total = 1;
+        for (const auto dim : input->dims()) total *= dim;
+        if (!valid) continue;
+        if (inferred) dims[*inferred] = total / known;
+        if (known * (inferred ? dims[*inferred] : 1) != total) continue;
+        AddInitializer(output, input->data_type(), dims,
+                       std::string(input->raw_data()));
+      } else {
+        continue;
+      }
+      dead_.insert(i);
+      changed = true;
+    }
+    return changed;
+  }
+
+  // Whether a Dropout node passes its input through, i.e. it's not in
+  // training mode and its mask output is not read.
+  bool IsInferenceDropout(const pblczero::NodeProto& n) {
+    if (n.output_size() == 0 || n.output_size() > 2 ||
+        graph_outputs_.count(std::string(n.output(0)))) {
+      return false;
+    }
+    if (n.output_size() > 1 && !n.output(1).empty() &&
+        (uses_[std::string(n.output(1))] > 0 ||
+         graph_outputs_.count(std::string(n.output(1))))) {
+      return false;
+    }
+    if (n.input_size() < 3 || n.input(2).empty()) return true;
+    const auto* training_mode = GetInitializer(n.input(2));
+    return training_mode &&
+           training_mode->data_type() == pblczero::TensorProto::BOOL &&
+           training_mode->raw_data().size() == 1 &&
+           training_mode->raw_data()[0] == 0;
+  }
+
+  // Drops Identity nodes, Dropouts in inference mode, Casts to the type a
+  // tensor already has, and Cast pairs which widen and then narrow back.
+  bool DropRedundantNodes() {
+    bool changed = false;
+    for (size_t i = 0; i < graph_->node_size(); ++i) {
+      const auto& n = node(i);
+      if (dead_.count(i) || n.input_size() == 0) continue;
+      if (n.op_type() == "Dropout") {
+        if (!IsInferenceDropout(n)) continue;
+        ReplaceUses(std::string(n.output(0)), n.input(0));
+        dead_.insert(i);
+        changed = true;
+        continue;
+      }
+      if (!IsReplaceable(n) || n.input_size() != 1) continue;
+      std::optional<std::string> source;
+      if (n.op_type() == "Identity") {
+        source = n.input(0);
+      } else if (n.op_type() == "Cast") {
+        const auto* to = FindAttribute(n, "to");
+        if (!to) continue;
+        const auto type = static_cast<DataType>(to->i());
+        if (GetType(n.input(0)) == type) {
+          source = n.input(0);
+        } else if (const auto* prev = GetProducer(n.input(0), "Cast")) {
+          const auto* prev_to = FindAttribute(*prev, "to");
+          if (prev_to && GetType(prev->input(0)) == type &&
+              IsLosslessWidening(type, static_cast<DataType>(prev_to->i()))) {
+            source = prev->input(0);
+          }
+        }
+      }
+      if (!source) continue;
+      ReplaceUses(std::string(n.output(0)), *source);
+      dead_.insert(i);
+      changed = true;
+    }
+    return changed;
+  }
+
+  // Merges Transpose(Transpose(x)) into one Transpose, or drops both when the
+  // permutations cancel out.
+  bool MergeTransposes() {
+    bool changed = false;
+    for (size_t i = 0; i < graph_->node_size(); ++i) {
+      auto& n = node(i);
+      if (dead_.count(i) || n.op_type() != "Transpose" || !IsReplaceable(n)) {
+        continue;
+      }
+      const auto* prev = GetProducer(n.input(0), "Transpose");
+      if (!prev) continue;
+      const auto outer = GetPerm(n);
+      const auto inner = GetPerm(*prev);
+      if (!outer || !inner || outer->size() != inner->size()) continue;
+      std::vector<int64_t> perm(outer->size());
+      for (size_t d = 0; d < perm.size(); ++d) perm[d] = (*inner)[(*outer)[d]];
+      const std::string source(prev->input(0));
+      if (IsIdentityPerm(perm)) {
+        ReplaceUses(std::string(n.output(0)), source);
+        dead_.insert(i);
+      } else {
+        (*n.mutable_input())[0] = source;
+        for (auto& attribute : *n.mutable_attribute()) {
+          if (attribute.name() == "perm") *attribute.mutable_ints() = perm;
+        }
+      }
+      changed = true;
+    }
+    return changed;
+  }
+
+  // Replaces Reshape(Reshape(x)) with a single Reshape of x, when the outer
+  // shape is constant and doesn't copy dimensions of the intermediate tensor.
+  bool MergeReshapes() {
+    bool changed = false;
+    for (size_t i = 0; i < graph_->node_size(); ++i) {
+      auto& n = node(i);
+      if (dead_.count(i) || n.op_type() != "Reshape" || n.input_size() != 2 ||
+          FindAttribute(n, "allowzero")) {
+        continue;
+      }
+      const auto* prev = GetProducer(n.input(0), "Reshape");
+      const auto* shape = GetInitializer(n.input(1));
+      if (!prev || !shape || !shape->has_raw_data() ||
+          shape->data_type() != pblczero::TensorProto::INT64) {
+        continue;
+      }
+      std::vector<int64_t> dims(shape->raw_data().size() / sizeof(int64_t));
+      std::memcpy(dims.data(), shape->raw_data().data(),
+                  dims.size() * sizeof(int64_t));
+      if (std::find(dims.begin(), dims.end(), 0) != dims.end()) continue;
+      (*n.mutable_input())[0] = std::string(prev->input(0));
+      changed = true;
+    }
+    return changed;
+  }
+
+  // Ranks of tensors, where they can be determined without full shape
+  // inference.
+  std::unordered_map<std::string, size_t> ComputeRanks() {
+    std::unordered_map<std::string, size_t> ranks;
+    for (const auto& input : graph_->input()) {
+      ranks[std::string(input.name())] =
+          input.type().tensor_type().shape().dim_size();
+    }
+    for (const auto& tensor : graph_->initializer()) {
+      ranks[std::string(tensor.name())] = tensor.dims_size();
+    }
+    static const std::unordered_set<std::string_view> kSameRankOps = {
+        "Cast",       "Concat",     "Conv",        "Exp",
+        "GlobalAveragePool",        "Identity",    "LayerNormalization",
+        "Mish",       "Pad",        "Reciprocal",  "Relu",
+        "Selu",       "Sigmoid",    "Slice",       "Softmax",
+        "Softplus",   "Split",      "Sqrt",        "Tanh",
+        "Transpose"};
+    static const std::unordered_set<std::string_view> kBroadcastOps = {
+        "Add", "Div", "Greater", "MatMul", "Mul", "Sub", "Where"};
+    for (const auto& n : graph_->node()) {
+      std::optional<size_t> rank;
+      auto input_rank = [&](size_t idx) -> std::optional<size_t> {
+        auto iter = ranks.find(std::string(n.input(idx)));
+        if (iter == ranks.end()) return std::nullopt;
+        return iter->second;
+      };
+      if (n.input_size() == 0) continue;
+      if (kSameRankOps.count(n.op_type())) {
+        rank = input_rank(0);
+      } else if (kBroadcastOps.count(n.op_type())) {
+        rank = 0;
+        for (size_t idx = 0; idx < n.input_size(); ++idx) {
+          const auto r = input_rank(idx);
+          rank = r ? std::optional<size_t>(std::max(*rank, *r)) : std::nullopt;
+          if (!rank) break;
+        }
+      } else if (n.op_type() == "Gemm") {
+        rank = 2;
+      } else if (n.op_type() == "Reshape" && n.input_size() == 2) {
+        if (const auto* shape = GetInitializer(n.input(1))) {
+          if (shape->dims_size() == 1) rank = shape->dims(0);
+        }
+      }
+      if (!rank) continue;
+      for (const auto& output : n.output()) ranks[output] = *rank;
+    }
+    return ranks;
+  }
+
+  // Fuses MatMul(a, W) + b into Gemm(a, W, b) when a is 2D and W, b are
+  // constants.
+  bool FuseMatMulAdd() {
+    bool changed = false;
+    const auto ranks = ComputeRanks();
+    for (size_t i = 0; i < graph_->node_size(); ++i) {
+      auto& add = node(i);
+      if (dead_.count(i) || add.op_type() != "Add" || add.input_size() != 2) {
+        continue;
+      }
+      for (size_t side = 0; side < 2; ++side) {
+        const std::string product(add.input(side));
+        const std::string bias_name(add.input(1 - side));
+        const auto* matmul = GetProducer(product, "MatMul");
+        const auto* bias = GetInitializer(bias_name);
+        if (!matmul || !bias || uses_[product] != 1 ||
+            graph_outputs_.count(product)) {
+          continue;
+        }
+        const std::string lhs(matmul->input(0));
+        const std::string rhs(matmul->input(1));
+        const auto* weights = GetInitializer(rhs);
+        auto rank = ranks.find(lhs);
+        if (!weights || rank == ranks.end() || rank->second != 2 ||
+            weights->dims_size() != 2) {
+          continue;
+        }
+        const auto type = weights->data_type();
+        if ((type != pblczero::TensorProto::FLOAT &&
+             type != pblczero::TensorProto::FLOAT16) ||
+            bias->data_type() != type) {
+          continue;
+        }
+        const int64_t n_outputs = weights->dims(1);
+        const bool bias_fits =
+            (bias->dims_size() == 1 && bias->dims(0) == n_outputs) ||
+            (bias->dims_size() == 2 && bias->dims(0) == 1 &&
+             bias->dims(1) == n_outputs);
+        if (!bias_fits) continue;
+        dead_.insert(producers_[product]);
+        add.set_op_type("Gemm");
+        *add.mutable_input() = {lhs, rhs, bias_name};
+        changed = true;
+        break;
+      }
+    }
+    return changed;
+  }
+
+  // Removes nodes marked dead or not contributing to graph outputs, and then
+  // initializers nobody reads.
+  void RemoveUnusedNodes() {
+    std::unordered_set<std::string> needed(graph_outputs_.begin(),
+                                           graph_outputs_.end());
+    std::vector<bool> keep(graph_->node_size(), false);
+    for (size_t i = graph_->node_size(); i-- > 0;) {
+      const auto& n = node(i);
+      if (dead_.count(i)) continue;
+      for (const auto& output : n.output()) {
+        if (needed.count(output)) keep[i] = true;
+      }
+      if (!keep[i]) continue;
+      for (const auto& input : n.input()) needed.emplace(input);
+    }
+    auto* nodes = graph_->mutable_node();
+    size_t idx = 0;
+    nodes->erase(std::remove_if(nodes->begin(), nodes->end(),
+                                [&](const auto&) { return !keep[idx++]; }),
+                 nodes->end());
+    auto* initializers = graph_->mutable_initializer();
+    initializers->erase(
+        std::remove_if(initializers->begin(), initializers->end(),
+                       [&](const pblczero::TensorProto& tensor) {
+                         return !needed.count(std::string(tensor.name()));
+                       }),
+        initializers->end());
+    dead_.clear();
+  }
+
+  pblczero::GraphProto* const graph_;
+  std::unordered_set<std::string> graph_outputs_;
+  std::unordered_map<std::string, size_t> initializers_;
+  std::unordered_map<std::string, size_t> producers_;
+  std::unordered_map<std::string, size_t> uses_;
+  std::unordered_set<size_t> dead_;
+};
+
+}  // namespace
+
+void OptimizeOnnxGraph(pblczero::GraphProto* graph) {
+  GraphOptimizer(graph).Run();
+}
+
+}  // namespace lczero
@@ -0,0 +1,46 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include "neural/onnx/onnx.pb.h"
+
+namespace lczero {
+
+// Simplifies an ONNX graph in place:
+//   - nodes are sorted topologically, if they are not already,
+//   - Transpose and Reshape of initializers are folded into new initializers,
+//   - Identity nodes, inference mode Dropouts, no-op Casts and lossless Cast
+//     round trips are dropped,
+//   - consecutive Transposes are merged, or dropped when they cancel out,
+//   - consecutive Reshapes are merged,
+//   - 2D MatMul followed by a bias Add is fused into Gemm,
+//   - nodes and initializers not contributing to graph outputs are removed.
+// Names of graph inputs and outputs are preserved.
+void OptimizeOnnxGraph(pblczero::GraphProto* graph);
+
+}  // namespace lczero
@@ -0,0 +1,327 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "neural/register.h"
+#include "neural/remote_protocol.h"
+#include "neural/shared_params.h"
+#include "utils/fp16_utils.h"
+#include "utils/logging.h"
+
+namespace lczero {
+namespace {
+
+// A request in flight, completed by the reader thread of its channel.
+struct RemoteRequest {
+  std::vector<EvalResultPtr> results;
+  // Called once the results are filled in, or with the error message.
+  std::function<void(const std::string& error)> done;
+};
+
+// One connection to the server. Requests of any number of computations are
+// sent over it without waiting for each other, a reader thread hands the
+// results back as they arrive.
+class RemoteChannel {
+ public:
+  RemoteChannel(const std::string& host, int port)
+      : connection_(RemoteConnection::Connect(host, port)) {
+    MessageWriter hello;
+    hello.Put<uint32_t>(kRemoteProtocolMagic);
+    hello.Put<uint16_t>(kRemoteProtocolVersion);
+    RemoteMessage type;
+    std::string payload;
+    if (!connection_->Send(RemoteMessage::kHello, hello.data()) ||
+        !connection_->Receive(&type, &payload)) {
+      throw Exception("Remote backend closed the connection.");
+    }
+    MessageReader reader(payload);
+    if (type == RemoteMessage::kError) {
+      reader.Get<uint32_t>();
+      throw Exception("Remote backend: " + reader.GetString());
+    }
+    if (type != RemoteMessage::kAttributes) {
+      throw Exception("Unexpected reply of the remote backend.");
+    }
+    attributes_ = GetAttributes(&reader);
+    reader_ = std::thread([this]() { Reader(); });
+  }
+
+  ~RemoteChannel() {
+    connection_->Shutdown();
+    reader_.join();
+  }
+
+  const BackendAttributes& attributes() const { return attributes_; }
+
+  // Sends the kEvaluate @payload, whose first four bytes are reserved for the
+  // request id. @request must stay alive until its done() is called.
+  void Submit(MessageWriter* payload, RemoteRequest* request) {
+    uint32_t id = 0;
+    bool closed;
+    {
+      Mutex::Lock lock(mutex_);
+      closed = closed_;
+      if (!closed) {
+        id = next_id_++;
+        pending_.emplace(id, request);
+      }
+    }
+    if (closed) {
+      request->done("Connection to the remote backend was lost.");
+      return;
+    }
+    payload->PutAt<uint32_t>(0, id);
+    // On failure, the reader fails all pending requests once it notices.
+    if (!connection_->Send(RemoteMessage::kEvaluate, payload->data())) {
+      connection_->Shutdown();
+    }
+  }
+
+ private:
+  RemoteRequest* Take(uint32_t id) {
+    Mutex::Lock lock(mutex_);
+    auto iter = pending_.find(id);
+    if (iter == pending_.end()) return nullptr;
+    RemoteRequest* request = iter->second;
+    pending_.erase(iter);
+    return request;
+  }
+
+  static void ReadResults(MessageReader* reader, RemoteRequest* request) {
+    if (reader->Get<uint32_t>() != request->results.size()) {
+      throw Exception("Bad reply of the remote backend.");
+    }
+    for (const EvalResultPtr& result : request->results) {
+      const float q = reader->Get<float>();
+      const float d = reader->Get<float>();
+      const float m = reader->Get<float>();
+      if (result.q) *result.q = q;
+      if (result.d) *result.d = d;
+      if (result.m) *result.m = m;
+      if (reader->Get<uint16_t>() != result.p.size()) {
+        throw Exception("Bad reply of the remote backend.");
+      }
+      for (float& p : result.p) p = FP16toFP32(reader->Get<uint16_t>());
+    }
+  }
+
+  void Reader() {
+    std::string error = "Connection to the remote backend was lost.";
+    RemoteMessage type;
+    std::string payload;
+    while (connection_->Receive(&type, &payload)) {
+      MessageReader reader(payload);
+      RemoteRequest* request = nullptr;
+      try {
+        request = Take(reader.Get<uint32_t>());
+        if (!request) {
+          throw Exception("Unexpected message from the remote backend.");
+        }
+        if (type == RemoteMessage::kError) {
+          throw Exception("Remote backend: " + reader.GetString());
+        }
+        if (type != RemoteMessage::kResults) {
+          throw Exception("Unexpected message from the remote backend.");
+        }
+        ReadResults(&reader, request);
+      } catch (Exception& ex) {
+        if (!request) {
+          error = ex.what();
+          break;
+        }
+        request->done(ex.what());
+        continue;
+      }
+      request->done("");
+    }
+    std::unordered_map<uint32_t, RemoteRequest*> pending;
+    {
+      Mutex::Lock lock(mutex_);
+      closed_ = true;
+      pending.swap(pending_);
+    }
+    for (auto& [id, request] : pending) request->done(error);
+  }
+
+  const std::unique_ptr<RemoteConnection> connection_;
+  BackendAttributes attributes_;
+  std::thread reader_;
+
+  Mutex mutex_;
+  std::unordered_map<uint32_t, RemoteRequest*> pending_ GUARDED_BY(mutex_);
+  uint32_t next_id_ GUARDED_BY(mutex_) = 0;
+  bool closed_ GUARDED_BY(mutex_) = false;
+};
+
+class RemoteComputation : public BackendComputation {
+ public:
+  RemoteComputation(RemoteChannel* channel) : channel_(channel) {
+    payload_.Put<uint32_t>(0);  // Request id, set by the channel.
+    payload_.Put<uint32_t>(0);  // Number of entries.
+  }
+
+  size_t UsedBatchSize() const override { return request_.results.size(); }
+
+  AddInputResult AddInput(const EvalPosition& pos,
+                          EvalResultPtr result) override {
+    const size_t history =
+        std::min(pos.pos.size(), static_cast<size_t>(kRemoteHistoryLength));
+    payload_.Put<uint8_t>(history);
+    for (const Position& position : pos.pos.last(history)) {
+      payload_.PutPosition(position);
+    }
+    // The moves are only needed for the policy.
+    const size_t moves = result.p.empty() ? 0 : pos.legal_moves.size();
+    payload_.Put<uint16_t>(moves);
+    for (const Move& move : pos.legal_moves.first(moves)) {
+      payload_.Put<uint16_t>(move.raw_data());
+    }
+    request_.results.push_back(result);
+    return ENQUEUED_FOR_EVAL;
+  }
+
+  void ComputeBlocking() override {
+    if (request_.results.empty()) return;
+    std::promise<std::string> promise;
+    request_.done = [&promise](const std::string& error) {
+      promise.set_value(error);
+    };
+    Submit();
+    const std::string error = promise.get_future().get();
+    if (!error.empty()) throw Exception(error);
+  }
+
+  // Several computations are in flight at the same time this way, over one
+  // connection.
+  void ComputeAsync(std::function<void()> done) override {
+    if (request_.results.empty()) {
+      done();
+      return;
+    }
+    request_.done = [this, done = std::move(done)](const std::string& error) {
+      // There is no way to report the error from here, the search gets even
+      // evaluations with a uniform policy instead.
+      if (!error.empty()) {
+        CERR << "Remote evaluation failed: " << error;
+        FillNeutral();
+      }
+      // The computation may be destroyed by done().
+      auto callback = done;
+      callback();
+    };
+    Submit();
+  }
+
+ private:
+  void Submit() {
+    payload_.PutAt<uint32_t>(sizeof(uint32_t), request_.results.size());
+    channel_->Submit(&payload_, &request_);
+  }
+
+  void FillNeutral() {
+    for (const EvalResultPtr& result : request_.results) {
+      if (result.q) *result.q = 0.0f;
+      if (result.d) *result.d = 0.0f;
+      if (result.m) *result.m = 0.0f;
+      std::fill(result.p.begin(), result.p.end(), 1.0f / result.p.size());
+    }
+  }
+
+  RemoteChannel* const channel_;
+  MessageWriter payload_;
+  RemoteRequest request_;
+};
+
+// Evaluates positions on a backend server (lc0 backendserver). The network,
+// its backend and the NN cache of the server are used, --weights of the client
+// are ignored. Backend options:
+//   host=<name or address>  (default 127.0.0.1)
+//   port=<port>             (default 5556)
+//   connections=<count>     (default 1)
+class RemoteBackend : public Backend {
+ public:
+  RemoteBackend(const OptionsDict& options)
+      : backend_opts_(
+            options.Get<std::string>(SharedBackendParams::kBackendOptionsId)) {
+    OptionsDict opts;
+    opts.AddSubdictFromString(backend_opts_);
+    const std::string host =
+        opts.GetOrDefault<std::string>("host", "127.0.0.1");
+    const int port = opts.GetOrDefault<int>("port", kRemoteDefaultPort);
+    const int connections =
+        std::max(1, opts.GetOrDefault<int>("connections", 1));
+    for (int i = 0; i < connections; ++i) {
+      channels_.push_back(std::make_unique<RemoteChannel>(host, port));
+    }
+    CERR << "Connected to the remote backend at " << host << ":" << port
+         << ".";
+  }
+
+  BackendAttributes GetAttributes() const override {
+    return channels_.front()->attributes();
+  }
+
+  std::unique_ptr<BackendComputation> CreateComputation() override {
+    return std::make_unique<RemoteComputation>(
+        channels_[next_channel_++ % channels_.size()].get());
+  }
+
+  UpdateConfigurationResult UpdateConfiguration(
+      const OptionsDict& options) override {
+    return options.Get<std::string>(SharedBackendParams::kBackendOptionsId) ==
+                   backend_opts_
+               ? UPDATE_OK
+               : NEED_RESTART;
+  }
+
+ private:
+  const std::string backend_opts_;
+  std::vector<std::unique_ptr<RemoteChannel>> channels_;
+  std::atomic<size_t> next_channel_ = 0;
+};
+
+class RemoteBackendFactory : public BackendFactory {
+ public:
+  int GetPriority() const override { return -1002; }
+  std::string_view GetName() const override { return "remote"; }
+  std::unique_ptr<Backend> Create(const OptionsDict& options) override {
+    return std::make_unique<RemoteBackend>(options);
+  }
+};
+
+BackendManager::Register remote_backend_registration(
+    std::make_unique<RemoteBackendFactory>());
+
+}  // namespace
+}  // namespace lczero
@@ -0,0 +1,244 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "neural/remote_protocol.h"
+
+#include <array>
+
+#ifndef _WIN32
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace lczero {
+namespace {
+// Guards against reading garbage as a huge frame.
+const uint32_t kMaxMessageSize = 64 << 20;
+}  // namespace
+
+void MessageWriter::PutString(std::string_view value) {
+  Put<uint32_t>(value.size());
+  data_.append(value);
+}
+
+std::string MessageReader::GetString() {
+  const uint32_t size = Get<uint32_t>();
+  if (data_.size() < size) throw Exception("Truncated remote message.");
+  std::string value(data_.substr(0, size));
+  data_.remove_prefix(size);
+  return value;
+}
+
+// The board is sent as the occupied squares, which of them are ours, and a
+// piece type per occupied square, two to a byte.
+void MessageWriter::PutPosition(const Position& position) {
+  const ChessBoard& board = position.GetBoard();
+  const BitBoard occupied = board.ours() | board.theirs();
+  Put<uint64_t>(occupied.as_int());
+  Put<uint64_t>(board.ours().as_int());
+  const std::array<BitBoard, 6> types = {board.pawns(),   board.knights(),
+                                         board.bishops(), board.rooks(),
+                                         board.queens(),  board.kings()};
+  uint8_t packed = 0;
+  int count = 0;
+  for (auto square : occupied) {
+    uint8_t type = 0;
+    while (!types[type].get(square)) ++type;
+    packed |= type << (4 * (count++ % 2));
+    if (count % 2 == 0) {
+      Put<uint8_t>(packed);
+      packed = 0;
+    }
+  }
+  if (count % 2) Put<uint8_t>(packed);
+  const ChessBoard::Castlings& castlings = board.castlings();
+  Put<uint8_t>(castlings.as_int());
+  Put<uint8_t>(castlings.our_queenside_rook.idx);
+  Put<uint8_t>(castlings.their_queenside_rook.idx);
+  Put<uint8_t>(castlings.our_kingside_rook.idx);
+  Put<uint8_t>(castlings.their_kingside_rook.idx);
+  // The en passant flag is kept on the last rank.
+  Put<uint8_t>(board.en_passant().as_int() >> 56);
+  Put<uint8_t>(board.flipped());
+  Put<uint16_t>(position.GetRule50Ply());
+  Put<uint32_t>(position.GetGamePly());
+  Put<uint8_t>(position.GetRepetitions());
+  Put<uint16_t>(position.GetPliesSincePrevRepetition());
+}
+
+Position MessageReader::GetPosition() {
+  const BitBoard occupied = Get<uint64_t>();
+  const BitBoard ours = Get<uint64_t>();
+  std::array<BitBoard, 6> our_pieces = {};
+  std::array<BitBoard, 6> their_pieces = {};
+  uint8_t packed = 0;
+  int count = 0;
+  for (auto square : occupied) {
+    if (count++ % 2 == 0) packed = Get<uint8_t>();
+    const uint8_t type = (count % 2 ? packed : packed >> 4) & 0xf;
+    if (type >= 6) throw Exception("Bad piece in remote message.");
+    auto& pieces = ours.get(square) ? our_pieces : their_pieces;
+    pieces[type].set(square);
+  }
+  ChessBoard::Castlings castlings;
+  const uint8_t rights = Get<uint8_t>();
+  if (rights & 1) castlings.set_we_can_00();
+  if (rights & 2) castlings.set_we_can_000();
+  if (rights & 4) castlings.set_they_can_00();
+  if (rights & 8) castlings.set_they_can_000();
+  castlings.our_queenside_rook = File::FromIdx(Get<uint8_t>());
+  castlings.their_queenside_rook = File::FromIdx(Get<uint8_t>());
+  castlings.our_kingside_rook = File::FromIdx(Get<uint8_t>());
+  castlings.their_kingside_rook = File::FromIdx(Get<uint8_t>());
+  const BitBoard en_passant = static_cast<uint64_t>(Get<uint8_t>()) << 40;
+  const bool flipped = Get<uint8_t>();
+  ChessBoard board;
+  board.SetFromPieces(our_pieces, their_pieces, castlings, en_passant,
+                      flipped);
+  const int rule50_ply = Get<uint16_t>();
+  const int game_ply = Get<uint32_t>();
+  Position position(board, rule50_ply, game_ply);
+  const int repetitions = Get<uint8_t>();
+  position.SetRepetitions(repetitions, Get<uint16_t>());
+  return position;
+}
+
+void PutAttributes(const BackendAttributes& attributes,
+                   MessageWriter* writer) {
+  writer->Put<uint8_t>(attributes.has_mlh);
+  writer->Put<uint8_t>(attributes.has_wdl);
+  writer->Put<uint8_t>(attributes.runs_on_cpu);
+  writer->Put<int32_t>(attributes.suggested_num_search_threads);
+  writer->Put<int32_t>(attributes.recommended_batch_size);
+  writer->Put<int32_t>(attributes.maximum_batch_size);
+}
+
+BackendAttributes GetAttributes(MessageReader* reader) {
+  BackendAttributes attributes;
+  attributes.has_mlh = reader->Get<uint8_t>();
+  attributes.has_wdl = reader->Get<uint8_t>();
+  attributes.runs_on_cpu = reader->Get<uint8_t>();
+  attributes.suggested_num_search_threads = reader->Get<int32_t>();
+  attributes.recommended_batch_size = reader->Get<int32_t>();
+  attributes.maximum_batch_size = reader->Get<int32_t>();
+  return attributes;
+}
+
+#ifdef _WIN32
+
+RemoteConnection::RemoteConnection(int fd) : fd_(fd) {}
+RemoteConnection::~RemoteConnection() {}
+
+std::unique_ptr<RemoteConnection> RemoteConnection::Connect(
+    const std::string&, int) {
+  throw Exception("Remote backend is not supported on Windows.");
+}
+
+bool RemoteConnection::Send(RemoteMessage, std::string_view) { return false; }
+bool RemoteConnection::Receive(RemoteMessage*, std::string*) { return false; }
+void RemoteConnection::Shutdown() {}
+
+#else
+
+RemoteConnection::RemoteConnection(int fd) : fd_(fd) {
+  // Requests are small and latency bound, they must not wait for more data.
+  const int nodelay = 1;
+  setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+}
+
+RemoteConnection::~RemoteConnection() { close(fd_); }
+
+std::unique_ptr<RemoteConnection> RemoteConnection::Connect(
+    const std::string& host, int port) {
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addresses = nullptr;
+  const std::string port_str = std::to_string(port);
+  if (getaddrinfo(host.c_str(), port_str.c_str(), &hints, &addresses) != 0) {
+    throw Exception("Unable to resolve remote backend host " + host);
+  }
+  int fd = -1;
+  for (addrinfo* address = addresses; address; address = address->ai_next) {
+    fd = socket(address->ai_family, address->ai_socktype,
+                address->ai_protocol);
+    if (fd < 0) continue;
+    if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addresses);
+  if (fd < 0) {
+    throw Exception("Unable to connect to remote backend " + host + ":" +
+                    port_str);
+  }
+  return std::make_unique<RemoteConnection>(fd);
+}
+
+bool RemoteConnection::Send(RemoteMessage type, std::string_view payload) {
+  std::string frame(sizeof(uint32_t) + 1, '\0');
+  const uint32_t size = payload.size();
+  std::memcpy(frame.data(), &size, sizeof(size));
+  frame.back() = static_cast<char>(type);
+  frame.append(payload);
+  Mutex::Lock lock(send_mutex_);
+  for (size_t sent = 0; sent < frame.size();) {
+    const ssize_t size =
+        send(fd_, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+    if (size <= 0) return false;
+    sent += size;
+  }
+  return true;
+}
+
+bool RemoteConnection::Receive(RemoteMessage* type, std::string* payload) {
+  auto receive = [this](char* data, size_t size) {
+    for (size_t received = 0; received < size;) {
+      const ssize_t chunk = recv(fd_, data + received, size - received, 0);
+      if (chunk <= 0) return false;
+      received += chunk;
+    }
+    return true;
+  };
+  char header[sizeof(uint32_t) + 1];
+  if (!receive(header, sizeof(header))) return false;
+  uint32_t size;
+  std::memcpy(&size, header, sizeof(size));
+  if (size > kMaxMessageSize) return false;
+  *type = static_cast<RemoteMessage>(header[sizeof(uint32_t)]);
+  payload->resize(size);
+  return receive(payload->data(), size);
+}
+
+void RemoteConnection::Shutdown() { shutdown(fd_, SHUT_RDWR); }
+
+#endif
+
+}  // namespace lczero
@@ -0,0 +1,155 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "chess/position.h"
+#include "neural/backend.h"
+#include "utils/exception.h"
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// Wire format of the remote backend. Every message is a frame of a uint32
+// payload size, a uint8 MessageType and the payload. Numbers are in host byte
+// order, both ends are expected to run on little-endian machines.
+//
+//   kHello      client -> server: magic, protocol version.
+//   kAttributes server -> client: the BackendAttributes of the server.
+//   kEvaluate   client -> server: request id, number of entries, and for each
+//               entry the last positions of its history and the legal moves
+//               to return the policy of (none when the policy isn't needed).
+//   kResults    server -> client: request id, and for each entry q, d, m and
+//               the policy of the requested moves as fp16.
+//   kError      server -> client: request id, message.
+//
+// Any number of requests may be in flight on a connection, results come back
+// in the order in which their computations complete.
+//
+// The selfplay coordinator uses the same framing with its own messages, see
+// selfplay/coordinator.h.
+enum class RemoteMessage : uint8_t {
+  kHello = 1,
+  kAttributes = 2,
+  kEvaluate = 3,
+  kResults = 4,
+  kError = 5,
+  kWorkerHello = 16,
+  kGameRequest = 17,
+  kGameAssigned = 18,
+  kGameFinished = 19,
+};
+
+inline constexpr uint32_t kRemoteProtocolMagic = 0x52304c43;  // "Cl0R".
+inline constexpr uint16_t kRemoteProtocolVersion = 1;
+inline constexpr int kRemoteDefaultPort = 5556;
+// Only as many positions as the network sees in its history planes are sent.
+inline constexpr int kRemoteHistoryLength = 8;
+
+// Builds a message payload.
+class MessageWriter {
+ public:
+  template <typename T>
+  void Put(T value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    const size_t offset = data_.size();
+    data_.resize(offset + sizeof(T));
+    std::memcpy(data_.data() + offset, &value, sizeof(T));
+  }
+  // Overwrites a value written before at @offset.
+  template <typename T>
+  void PutAt(size_t offset, T value) {
+    std::memcpy(data_.data() + offset, &value, sizeof(T));
+  }
+  void PutString(std::string_view value);
+  // Writes the board and counters of the position.
+  void PutPosition(const Position& position);
+
+  size_t size() const { return data_.size(); }
+  const std::string& data() const { return data_; }
+  std::string Release() { return std::move(data_); }
+
+ private:
+  std::string data_;
+};
+
+// Parses a message payload, throws Exception when it's truncated.
+class MessageReader {
+ public:
+  explicit MessageReader(std::string_view data) : data_(data) {}
+
+  template <typename T>
+  T Get() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    if (data_.size() < sizeof(T)) throw Exception("Truncated remote message.");
+    T value;
+    std::memcpy(&value, data_.data(), sizeof(T));
+    data_.remove_prefix(sizeof(T));
+    return value;
+  }
+  std::string GetString();
+  Position GetPosition();
+
+  bool empty() const { return data_.empty(); }
+
+ private:
+  std::string_view data_;
+};
+
+void PutAttributes(const BackendAttributes& attributes, MessageWriter* writer);
+BackendAttributes GetAttributes(MessageReader* reader);
+
+// A TCP connection exchanging framed messages. Messages may be sent from any
+// thread, they are received by one thread.
+class RemoteConnection {
+ public:
+  explicit RemoteConnection(int fd);
+  ~RemoteConnection();
+
+  // Connects to @host, which is a name or an address, and @port.
+  static std::unique_ptr<RemoteConnection> Connect(const std::string& host,
+                                                   int port);
+
+  // Returns false when the connection is closed.
+  bool Send(RemoteMessage type, std::string_view payload);
+  bool Receive(RemoteMessage* type, std::string* payload);
+  // Makes a blocked Receive() return false.
+  void Shutdown();
+
+ private:
+  const int fd_;
+  Mutex send_mutex_;
+};
+
+}  // namespace lczero
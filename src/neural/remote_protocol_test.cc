@@ -0,0 +1,86 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "neural/remote_protocol.h"
+
+#include <gtest/gtest.h>
+
+namespace lczero {
+
+TEST(RemoteProtocol, RoundTripsPositions) {
+  const char* kFens[] = {
+      ChessBoard::kStartposFen,
+      "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+      "rnbqkbnr/pp1ppppp/8/8/2pP4/8/PPP1PPPP/RNBQKBNR b KQkq d3 0 1",
+      // Chess960, castling rooks on b and g files.
+      "1rkbbqrn/pppppppp/8/8/8/8/PPPPPPPP/1RKBBQRN w GBgb - 0 1",
+  };
+  for (const char* fen : kFens) {
+    PositionHistory history;
+    history.Reset(Position::FromFen(fen));
+    uint64_t seed = 1;
+    for (int ply = 0; ply < 80; ++ply) {
+      MessageWriter writer;
+      writer.PutPosition(history.Last());
+      MessageReader reader(writer.data());
+      const Position position = reader.GetPosition();
+      EXPECT_TRUE(reader.empty());
+      EXPECT_EQ(position, history.Last()) << fen << " ply " << ply;
+      EXPECT_EQ(position.Hash(), history.Last().Hash());
+      const auto moves = history.Last().GetBoard().GenerateLegalMoves();
+      if (moves.empty()) break;
+      seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+      history.Append(moves[(seed >> 33) % moves.size()]);
+    }
+  }
+}
+
+TEST(RemoteProtocol, KeepsRepetitions) {
+  PositionHistory history;
+  history.Reset(Position::FromFen(ChessBoard::kStartposFen));
+  for (int i = 0; i < 2; ++i) {
+    for (const char* move : {"g1f3", "g8f6", "f3g1", "f6g8"}) {
+      history.Append(history.Last().GetBoard().ParseMove(move));
+    }
+  }
+  ASSERT_EQ(history.Last().GetRepetitions(), 2);
+  MessageWriter writer;
+  writer.PutPosition(history.Last());
+  MessageReader reader(writer.data());
+  const Position position = reader.GetPosition();
+  EXPECT_EQ(position.GetRepetitions(), 2);
+  EXPECT_EQ(position.GetPliesSincePrevRepetition(), 4);
+  EXPECT_EQ(position, history.Last());
+}
+
+TEST(RemoteProtocol, ThrowsOnTruncatedMessages) {
+  MessageWriter writer;
+  writer.PutPosition(Position::FromFen(ChessBoard::kStartposFen));
+  const std::string data = writer.data();
+  MessageReader reader(std::string_view(data).substr(0, data.size() - 1));
+  EXPECT_THROW(reader.GetPosition(), Exception);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  lczero::InitializeMagicBitboards();
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,235 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "neural/remote_server.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "neural/diskcache.h"
+#include "neural/inference_server.h"
+#include "neural/memcache.h"
+#include "neural/register.h"
+#include "neural/remote_protocol.h"
+#include "utils/exception.h"
+#include "utils/fp16_utils.h"
+#include "utils/logging.h"
+
+namespace lczero {
+namespace {
+const OptionId kBackendServerAddressId{
+    "backend-server-address", "",
+    "Address to listen on in backendserver mode. The default only accepts "
+    "local connections, use 0.0.0.0 to accept connections from anywhere."};
+const OptionId kBackendServerPortId{
+    "backend-server-port", "", "TCP port to listen on in backendserver mode."};
+const OptionId kBackendServerThreadsId{
+    "backend-server-threads", "",
+    "Number of threads evaluating the batches gathered from all clients."};
+const OptionId kBackendServerMaxWaitId{
+    "backend-server-max-wait-us", "",
+    "Longest time in microseconds a partially filled batch waits for more "
+    "positions before being computed."};
+
+// One kEvaluate request. Owns the positions and results that the
+// computation's inputs point to.
+struct ServerRequest {
+  uint32_t id;
+  std::vector<std::vector<Position>> histories;
+  std::vector<std::vector<Move>> moves;
+  std::vector<EvalResult> results;
+  std::unique_ptr<BackendComputation> computation;
+};
+
+std::shared_ptr<ServerRequest> ParseRequest(MessageReader* reader) {
+  auto request = std::make_shared<ServerRequest>();
+  const uint32_t count = reader->Get<uint32_t>();
+  request->histories.resize(count);
+  request->moves.resize(count);
+  request->results.resize(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    const int history = reader->Get<uint8_t>();
+    if (history == 0) throw Exception("Remote request without a position.");
+    for (int j = 0; j < history; ++j) {
+      request->histories[i].push_back(reader->GetPosition());
+    }
+    const int moves = reader->Get<uint16_t>();
+    for (int j = 0; j < moves; ++j) {
+      request->moves[i].push_back(Move::FromRaw(reader->Get<uint16_t>()));
+    }
+    request->results[i].p.resize(moves);
+  }
+  return request;
+}
+
+std::string SerializeResults(const ServerRequest& request) {
+  MessageWriter writer;
+  writer.Put<uint32_t>(request.id);
+  writer.Put<uint32_t>(request.results.size());
+  for (const EvalResult& result : request.results) {
+    writer.Put<float>(result.q);
+    writer.Put<float>(result.d);
+    writer.Put<float>(result.m);
+    writer.Put<uint16_t>(result.p.size());
+    for (float p : result.p) writer.Put<uint16_t>(FP32toFP16(p));
+  }
+  return writer.Release();
+}
+
+std::string SerializeError(uint32_t id, const std::string& message) {
+  MessageWriter writer;
+  writer.Put<uint32_t>(id);
+  writer.PutString(message);
+  return writer.Release();
+}
+}  // namespace
+
+void BackendServer::PopulateOptions(OptionsParser* options) {
+  options->Add<StringOption>(kBackendServerAddressId) = "127.0.0.1";
+  options->Add<IntOption>(kBackendServerPortId, 1, 65535) =
+      kRemoteDefaultPort;
+  options->Add<IntOption>(kBackendServerThreadsId, 1, 16) = 2;
+  options->Add<IntOption>(kBackendServerMaxWaitId, 0, 1000000) = 1000;
+}
+
+BackendServer::BackendServer(const OptionsDict& options) : options_(options) {
+  backend_ = CreateInferenceServer(
+      CreateMemCache(
+          MaybeCreateDiskCache(
+              BackendManager::Get()->CreateFromParams(options_), options_),
+          options_),
+      options_.Get<int>(kBackendServerThreadsId),
+      std::chrono::microseconds(options_.Get<int>(kBackendServerMaxWaitId)));
+}
+
+#ifdef _WIN32
+
+void BackendServer::Run() {
+  throw Exception("Backend server mode is not supported on Windows.");
+}
+
+void BackendServer::ServeConnection(std::shared_ptr<RemoteConnection>) {}
+
+#else
+
+void BackendServer::Run() {
+  const int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd < 0) throw Exception("Unable to create a socket.");
+  const int reuse = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  const int port = options_.Get<int>(kBackendServerPortId);
+  address.sin_port = htons(port);
+  const std::string host = options_.Get<std::string>(kBackendServerAddressId);
+  if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1) {
+    close(listen_fd);
+    throw Exception("Invalid server address: " + host);
+  }
+  if (bind(listen_fd, reinterpret_cast<sockaddr*>(&address),
+           sizeof(address)) != 0 ||
+      listen(listen_fd, 16) != 0) {
+    close(listen_fd);
+    throw Exception("Unable to listen on " + host + ":" +
+                    std::to_string(port));
+  }
+  CERR << "Serving the backend on " << host << ":" << port << ".";
+
+  while (true) {
+    const int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) continue;
+    auto connection = std::make_shared<RemoteConnection>(fd);
+    std::thread([this, connection]() { ServeConnection(connection); })
+        .detach();
+  }
+}
+
+// Requests are read and started here, their results are sent from the
+// threads that complete the computations. The connection is kept alive until
+// the last of them is sent.
+void BackendServer::ServeConnection(
+    std::shared_ptr<RemoteConnection> connection) {
+  RemoteMessage type;
+  std::string payload;
+  if (!connection->Receive(&type, &payload)) return;
+  {
+    MessageReader reader(payload);
+    if (type != RemoteMessage::kHello || payload.size() < 6 ||
+        reader.Get<uint32_t>() != kRemoteProtocolMagic) {
+      return;
+    }
+    if (reader.Get<uint16_t>() != kRemoteProtocolVersion) {
+      connection->Send(RemoteMessage::kError,
+                       SerializeError(0, "Unsupported protocol version."));
+      return;
+    }
+  }
+  MessageWriter attributes;
+  PutAttributes(backend_->GetAttributes(), &attributes);
+  if (!connection->Send(RemoteMessage::kAttributes, attributes.data())) return;
+  LOGFILE << "Remote backend connection opened.";
+
+  while (connection->Receive(&type, &payload)) {
+    if (type != RemoteMessage::kEvaluate) break;
+    MessageReader reader(payload);
+    std::shared_ptr<ServerRequest> request;
+    uint32_t id = 0;
+    try {
+      id = reader.Get<uint32_t>();
+      request = ParseRequest(&reader);
+      request->id = id;
+      request->computation = backend_->CreateComputation();
+      for (size_t i = 0; i < request->results.size(); ++i) {
+        request->computation->AddInput(
+            EvalPosition{request->histories[i], request->moves[i]},
+            request->results[i].AsPtr());
+      }
+    } catch (Exception& ex) {
+      connection->Send(RemoteMessage::kError, SerializeError(id, ex.what()));
+      continue;
+    }
+    // The computation is destroyed with the request once the callback is
+    // released.
+    BackendComputation* computation = request->computation.get();
+    computation->ComputeAsync([request, connection]() {
+      connection->Send(RemoteMessage::kResults, SerializeResults(*request));
+    });
+  }
+  LOGFILE << "Remote backend connection closed.";
+}
+
+#endif
+
+}  // namespace lczero
@@ -57,6 +57,21 @@ const OptionId SharedBackendParams::kNNCacheSizeId{
     "nncache", "NNCacheSize",
     "Number of positions to store in a memory cache. A large cache can speed "
     "up searching, but takes memory."};
+const OptionId SharedBackendParams::kCacheHistoryLengthId{
+    "cache-history-length", "CacheHistoryLength",
+    "Length of history, in half-moves, to include into the cache key. When "
+    "this value is less than history that NN uses to eval a position, it's "
+    "possible that the search will use eval of the same position with "
+    "different history taken from cache."};
+const OptionId SharedBackendParams::kDiskCacheFileId{
+    "disk-cache-file", "DiskCacheFile",
+    "File in which to keep network evaluations between runs. Several engine "
+    "processes can use the same file at the same time, and each network gets "
+    "its own entries. Empty to disable."};
+const OptionId SharedBackendParams::kDiskCacheSizeId{
+    "disk-cache-size", "DiskCacheSizeMb",
+    "Size of the disk cache file in megabytes, used when the file is created. "
+    "An existing file keeps its size."};
 
 void SharedBackendParams::Populate(OptionsParser* options) {
   options->Add<FloatOption>(kPolicySoftmaxTemp, 0.1f, 10.0f) = 1.359f;
@@ -74,6 +89,11 @@ void SharedBackendParams::Populate(OptionsParser* options) {
   options->Add<StringOption>(SharedBackendParams::kBackendOptionsId);
   options->Add<IntOption>(SharedBackendParams::kNNCacheSizeId, 0, 999999999) =
       2000000;
+  options->Add<IntOption>(SharedBackendParams::kCacheHistoryLengthId, 0, 7) =
+      0;
+  options->Add<StringOption>(SharedBackendParams::kDiskCacheFileId);
+  options->Add<IntOption>(SharedBackendParams::kDiskCacheSizeId, 1, 1048576) =
+      1024;
 }
 
 }  // namespace lczero
\ No newline at end of file
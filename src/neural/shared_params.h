@@ -44,6 +44,9 @@ struct SharedBackendParams {
   static const OptionId kBackendId;
   static const OptionId kBackendOptionsId;
   static const OptionId kNNCacheSizeId;
+  static const OptionId kCacheHistoryLengthId;
+  static const OptionId kDiskCacheFileId;
+  static const OptionId kDiskCacheSizeId;
 
   static void Populate(OptionsParser*);
 
@@ -21,7 +21,7 @@
 namespace lczero {
 
 // 64*64 + 8x24
-const short kAttnPolicyMap[] = {
+constexpr short kAttnPolicyMap[] = {
     -1,   0,    1,    2,    3,    4,    5,    6,    7,    8,    9,    -1,
     -1,   -1,   -1,   -1,   10,   11,   12,   -1,   -1,   -1,   -1,   -1,
     13,   -1,   -1,   14,   -1,   -1,   -1,   -1,   15,   -1,   -1,   -1,
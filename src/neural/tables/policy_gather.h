@@ -0,0 +1,63 @@
+/*
+ This file is part of Leela Chess Zero.
+ Copyright (C) 2025 The LCZero Authors
+
+ Leela Chess is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ Leela Chess is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+#include "neural/tables/attention_policy_map.h"
+#include "neural/tables/policy_map.h"
+
+namespace lczero {
+
+constexpr size_t kPolicyGatherOutputs = 1858;
+
+// Inverts a policy map, which tells for every policy head output which policy
+// index it goes to (or -1), into a gather table telling for every policy index
+// which head output to read. Gathering writes each policy entry exactly once
+// and in order, without checking for unused head outputs.
+template <size_t kInputs>
+constexpr std::array<short, kPolicyGatherOutputs> InvertPolicyMap(
+    const short (&map)[kInputs]) {
+  std::array<short, kPolicyGatherOutputs> gather{};
+  for (auto& x : gather) x = -1;
+  for (size_t i = 0; i < kInputs; ++i) {
+    if (map[i] >= 0) gather[map[i]] = static_cast<short>(i);
+  }
+  return gather;
+}
+
+template <size_t kOutputs>
+constexpr bool IsCompleteGather(const std::array<short, kOutputs>& gather) {
+  for (const auto x : gather) {
+    if (x < 0) return false;
+  }
+  return true;
+}
+
+// Head output index for each policy index, for kConvPolicyMap (73x8x8 head
+// layout) and kAttnPolicyMap (64x64 + 8x24 head layout).
+inline constexpr auto kConvPolicyGather = InvertPolicyMap(kConvPolicyMap);
+inline constexpr auto kAttnPolicyGather = InvertPolicyMap(kAttnPolicyMap);
+
+static_assert(IsCompleteGather(kConvPolicyGather));
+static_assert(IsCompleteGather(kAttnPolicyGather));
+
+}  // namespace lczero
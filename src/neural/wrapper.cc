@@ -29,15 +29,24 @@
 
 #include <algorithm>
 #include <numeric>
+#include <optional>
+#include <unordered_map>
 
 #include "neural/encoder.h"
 #include "neural/shared_params.h"
 #include "utils/atomic_vector.h"
 #include "utils/fastmath.h"
+#include "utils/hashcat.h"
+#include "utils/metrics.h"
+#include "utils/mutex.h"
+#include "utils/trace.h"
 
 namespace lczero {
 namespace {
 
+MetricHistogram* const kBatchSizeMetric = Metrics::Get().AddHistogram(
+    "backend_batch_size", "Positions per batch sent to the network.");
+
 FillEmptyHistory EncodeHistoryFill(std::string history_fill) {
   if (history_fill == "fen_only") return FillEmptyHistory::FEN_ONLY;
   if (history_fill == "always") return FillEmptyHistory::ALWAYS;
@@ -72,9 +81,16 @@ class NetworkAsBackend : public Backend {
         options.Get<std::string>(SharedBackendParams::kBackendOptionsId)) {
       return NEED_RESTART;
     }
-    if (weights_path_ !=
-        options.Get<std::string>(SharedBackendParams::kWeightsId)) {
-      return NEED_RESTART;
+    const std::string weights_path =
+        options.Get<std::string>(SharedBackendParams::kWeightsId);
+    if (weights_path_ != weights_path) {
+      // New weights of the same architecture are swapped into the running
+      // network, which keeps its device context and buffers.
+      if (weights_path.empty() ||
+          !network_->ReloadWeights(LoadWeights(weights_path))) {
+        return NEED_RESTART;
+      }
+      weights_path_ = weights_path;
     }
     softmax_policy_temperature_ =
         1.0f / options.Get<float>(SharedBackendParams::kPolicySoftmaxTemp);
@@ -90,7 +106,7 @@ class NetworkAsBackend : public Backend {
   float softmax_policy_temperature_;
   FillEmptyHistory fill_empty_history_;
   const std::string backend_opts_;
-  const std::string weights_path_;
+  std::string weights_path_;
 
   friend class NetworkAsBackendComputation;
 };
@@ -106,40 +122,133 @@ class NetworkAsBackendComputation : public BackendComputation {
 
   AddInputResult AddInput(const EvalPosition& pos,
                           EvalResultPtr result) override {
-    int transform;
+    // Positions in a batch often share a parent, or one is the parent of
+    // another. Their older history planes are then the same.
+    const uint64_t parent_key =
+        pos.pos.size() > 1 ? HistoryKey(pos.pos.first(pos.pos.size() - 1)) : 0;
+    std::optional<std::pair<EncodedRelative, size_t>> relative;
+    if (pos.pos.size() > 1) {
+      SharedMutex::SharedLock lock(relatives_mutex_);
+      if (auto iter = siblings_.find(parent_key); iter != siblings_.end()) {
+        relative = {EncodedRelative::kSibling, iter->second};
+      } else if (auto iter = parents_.find(parent_key);
+                 iter != parents_.end()) {
+        relative = {EncodedRelative::kParent, iter->second};
+      }
+    }
     const size_t idx = entries_.emplace_back(Entry{
-        .input = EncodePositionForNN(backend_->input_format_, pos.pos, 8,
-                                     backend_->fill_empty_history_, &transform),
         .legal_moves = MoveList(pos.legal_moves.begin(), pos.legal_moves.end()),
-        .result = result,
-        .transform = 0});
-    entries_[idx].transform = transform;
+        .result = result});
+    Entry& entry = entries_[idx];
+    // Encode straight into the backend's input buffer when it has one, that
+    // saves the allocation and the copy in ComputeBlocking().
+    entry.buffer = computation_->GetInputBuffer(idx);
+    const Entry* relative_entry =
+        relative ? &entries_[relative->second] : nullptr;
+    if (relative_entry &&
+        relative_entry->buffer.empty() != entry.buffer.empty()) {
+      relative_entry = nullptr;
+    }
+    if (!entry.buffer.empty()) {
+      if (relative_entry) {
+        EncodePositionForNN(backend_->input_format_, pos.pos, 8,
+                            backend_->fill_empty_history_, &entry.transform,
+                            relative->first, relative_entry->buffer,
+                            relative_entry->transform, entry.buffer);
+      } else {
+        EncodePositionForNN(backend_->input_format_, pos.pos, 8,
+                            backend_->fill_empty_history_, &entry.transform,
+                            entry.buffer);
+      }
+    } else {
+      entry.input =
+          relative_entry
+              ? EncodePositionForNN(backend_->input_format_, pos.pos, 8,
+                                    backend_->fill_empty_history_,
+                                    &entry.transform, relative->first,
+                                    relative_entry->input,
+                                    relative_entry->transform)
+              : EncodePositionForNN(backend_->input_format_, pos.pos, 8,
+                                    backend_->fill_empty_history_,
+                                    &entry.transform);
+    }
+    const uint64_t key = HistoryKey(pos.pos);
+    SharedMutex::Lock lock(relatives_mutex_);
+    if (pos.pos.size() > 1) siblings_.try_emplace(parent_key, idx);
+    parents_.try_emplace(key, idx);
     return ENQUEUED_FOR_EVAL;
   }
 
   void ComputeBlocking() override {
-    for (auto& entry : entries_) computation_->AddInput(std::move(entry.input));
-    computation_->ComputeBlocking();
+    // Let the backend do the policy softmax if it can, then only the legal
+    // move priors have to come back from the device.
+    const bool legal_moves_policy = computation_->SupportsLegalMovesPolicy();
+    std::vector<uint16_t> policy_indices;
+    for (auto& entry : entries_) {
+      const bool written = !entry.buffer.empty();
+      if (!legal_moves_policy) {
+        if (written) {
+          computation_->AddWrittenInput();
+        } else {
+          computation_->AddInput(std::move(entry.input));
+        }
+        continue;
+      }
+      policy_indices.clear();
+      if (!entry.result.p.empty()) {
+        for (const Move& move : entry.legal_moves) {
+          policy_indices.push_back(MoveToNNIndex(move, entry.transform));
+        }
+      }
+      if (written) {
+        computation_->AddWrittenInputWithLegalMoves(
+            policy_indices, backend_->softmax_policy_temperature_);
+      } else {
+        computation_->AddInputWithLegalMoves(
+            std::move(entry.input), policy_indices,
+            backend_->softmax_policy_temperature_);
+      }
+    }
+    // Let the backend skip the heads no entry asked for.
+    OutputHeads heads{.policy = false, .moves_left = false};
+    for (const auto& entry : entries_) {
+      heads.policy |= !entry.result.p.empty();
+      heads.moves_left |= entry.result.m != nullptr;
+    }
+    computation_->SetOutputHeads(heads);
+    {
+      TraceScope trace("Backend::ComputeBlocking");
+      trace.SetArg("batch_size", entries_.size());
+      kBatchSizeMetric->Observe(entries_.size());
+      computation_->ComputeBlocking();
+    }
     for (size_t i = 0; i < entries_.size(); ++i) {
       const EvalResultPtr& result = entries_[i].result;
       if (result.q) *result.q = computation_->GetQVal(i);
       if (result.d) *result.d = computation_->GetDVal(i);
       if (result.m) *result.m = computation_->GetMVal(i);
-      if (!result.p.empty()) SoftmaxPolicy(result.p, computation_.get(), i);
+      if (result.p.empty()) continue;
+      if (legal_moves_policy) {
+        computation_->GetLegalMovesPolicy(i, result.p);
+      } else {
+        SoftmaxPolicy(result.p, computation_.get(), i, &policy_indices);
+      }
     }
   }
 
+  // @policy_indices is scratch space, reused between the calls.
   void SoftmaxPolicy(std::span<float> dst,
-                     const NetworkComputation* computation, int idx) {
+                     const NetworkComputation* computation, int idx,
+                     std::vector<uint16_t>* policy_indices) {
     const std::vector<Move>& moves = entries_[idx].legal_moves;
     const int transform = entries_[idx].transform;
     // Copy the values to the destination array and compute the maximum.
-    const float max_p = std::accumulate(
-        moves.begin(), moves.end(), -std::numeric_limits<float>::infinity(),
-        [&, counter = 0](float max_p, const Move& move) mutable {
-          return std::max(max_p, dst[counter++] = computation->GetPVal(
-                                     idx, MoveToNNIndex(move, transform)));
-        });
+    policy_indices->clear();
+    for (const Move& move : moves) {
+      policy_indices->push_back(MoveToNNIndex(move, transform));
+    }
+    computation->GetPolicy(idx, *policy_indices, dst);
+    const float max_p = *std::max_element(dst.begin(), dst.end());
     // Compute the softmax and compute the total.
     const float temperature = backend_->softmax_policy_temperature_;
     float total = std::accumulate(
@@ -153,15 +262,35 @@ class NetworkAsBackendComputation : public BackendComputation {
 
  private:
   struct Entry {
-    InputPlanes input;
+    // Only used when the backend didn't give an input buffer.
+    InputPlanes input = {};
     MoveList legal_moves;
     EvalResultPtr result;
-    int transform;
+    int transform = 0;
+    InputPlanesView buffer = {};
   };
 
+  // Hashes the positions that the next position's history planes are made
+  // from.
+  static uint64_t HistoryKey(std::span<const Position> positions) {
+    const size_t count =
+        std::min(positions.size(), static_cast<size_t>(kMoveHistory - 1));
+    uint64_t hash = count;
+    for (const Position& position : positions.last(count)) {
+      hash = HashCat(hash, position.Hash());
+    }
+    return hash;
+  }
+
   NetworkAsBackend* backend_;
   std::unique_ptr<NetworkComputation> computation_;
   AtomicVector<Entry> entries_;
+  // Entries by the HistoryKey() of their parent and of their own, only added
+  // once the entry is fully encoded.
+  SharedMutex relatives_mutex_;
+  std::unordered_map<uint64_t, size_t> siblings_
+      GUARDED_BY(relatives_mutex_);
+  std::unordered_map<uint64_t, size_t> parents_ GUARDED_BY(relatives_mutex_);
 };
 
 std::unique_ptr<BackendComputation> NetworkAsBackend::CreateComputation() {
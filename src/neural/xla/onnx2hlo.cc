@@ -477,6 +477,7 @@ class Onnx2HloConverter {
     onnx_op_to_builder_["Greater"] = &Onnx2HloConverter::OpGreater;
     onnx_op_to_builder_["Exp"] = &Onnx2HloConverter::OpExp;
     onnx_op_to_builder_["Expand"] = &Onnx2HloConverter::OpExpand;
+    onnx_op_to_builder_["Gemm"] = &Onnx2HloConverter::OpGemm;
     onnx_op_to_builder_["Identity"] = &Onnx2HloConverter::OpIdentity;
     onnx_op_to_builder_["LayerNormalization"] =
         &Onnx2HloConverter::OpLayerNormalization;
@@ -629,6 +630,18 @@ class Onnx2HloConverter {
     return GetFlowByName(std::string(node.input(idx)));
   }
 
+  // Returns the ONNX node of the given type that produced the named tensor, or
+  // nullptr if the tensor came from elsewhere.
+  const pblczero::NodeProto* GetProducer(std::string_view name,
+                                         std::string_view op_type) const {
+    auto iter = onnx_name_to_producer_.find(std::string(name));
+    if (iter == onnx_name_to_producer_.end() ||
+        iter->second->op_type() != op_type) {
+      return nullptr;
+    }
+    return iter->second;
+  }
+
   std::optional<pblczero::XlaLiteralProto> GetConstantInput(
       const pblczero::NodeProto& node, size_t idx, bool optional = false) {
     if (idx >= node.input_size()) {
@@ -1160,6 +1173,11 @@ class Onnx2HloConverter {
 
   std::vector<HloFlow> OpReciprocal(const pblczero::NodeProto& node) {
     CheckKnownAttributes(node, 1, {});
+    // Sqrt followed by Reciprocal is what decomposed layer normalization uses
+    // for 1/std, emit it as a single rsqrt.
+    if (const auto* sqrt = GetProducer(node.input(0), "Sqrt")) {
+      return {builder_.Rsqrt(GetInput(*sqrt, 0))};
+    }
     auto* input = GetInput(node, 0);
     auto* one = MakeScalar(1, input->shape().element_type());
     return {
@@ -1198,6 +1216,16 @@ class Onnx2HloConverter {
 
   std::vector<HloFlow> OpMul(const pblczero::NodeProto& node) {
     CheckKnownAttributes(node, 2, {});
+    // x * tanh(softplus(x)) is mish written out by converters for opsets
+    // without the Mish op.
+    for (size_t i = 0; i < 2; ++i) {
+      const auto* tanh = GetProducer(node.input(i), "Tanh");
+      if (!tanh) continue;
+      const auto* softplus = GetProducer(tanh->input(0), "Softplus");
+      if (softplus && softplus->input(0) == node.input(1 - i)) {
+        return {DoMish(GetInput(node, 1 - i))};
+      }
+    }
     auto* lhs = GetInput(node, 0);
     auto* rhs = GetInput(node, 1);
 
@@ -1403,6 +1431,31 @@ class Onnx2HloConverter {
     return {builder_.Dot(lhs, rhs, dn)};
   }
 
+  std::vector<HloFlow> OpGemm(const pblczero::NodeProto& node) {
+    CheckKnownAttributes(node, 3, {"alpha", "beta", "transA", "transB"});
+    if (GetOptionalAttributeAs<float>(node, "alpha").value_or(1.0f) != 1.0f ||
+        GetOptionalAttributeAs<float>(node, "beta").value_or(1.0f) != 1.0f) {
+      throw Exception("Gemm with alpha or beta other than 1 not supported yet");
+    }
+    auto* lhs = GetInput(node, 0);
+    auto* rhs = GetInput(node, 1);
+    if (GetOptionalAttributeAs<int>(node, "transA").value_or(0)) {
+      lhs = builder_.Transpose(lhs, {1, 0});
+    }
+    if (GetOptionalAttributeAs<int>(node, "transB").value_or(0)) {
+      rhs = builder_.Transpose(rhs, {1, 0});
+    }
+    pblczero::XlaDotDimensionNumbers dn;
+    dn.add_lhs_contracting_dimensions(1);
+    dn.add_rhs_contracting_dimensions(0);
+    auto* flow = builder_.Dot(lhs, rhs, dn);
+    if (auto* bias = GetInput(node, 2, true)) {
+      std::tie(flow, bias) = EqualizeShape(flow, bias);
+      flow = builder_.Add(flow, bias);
+    }
+    return {flow};
+  }
+
   std::vector<HloFlow> OpGlobalAveragePool(const pblczero::NodeProto& node) {
     CheckKnownAttributes(node, 1, {});
     auto* lhs = GetInput(node, 0);
@@ -1488,11 +1541,27 @@ class Onnx2HloConverter {
 
   std::vector<HloFlow> OpMish(const pblczero::NodeProto& node) {
     CheckKnownAttributes(node, 1, {});
-    auto* input = GetInput(node, 0);
-    auto flow = builder_.Exponential(input);
-    flow = builder_.LogPlusOne(flow);
-    flow = builder_.Tanh(flow);
-    return {builder_.Multiply(flow, input)};
+    return {DoMish(GetInput(node, 0))};
+  }
+
+  // Mish with a single transcendental op, so that it's cheap once XLA fuses it
+  // into the neighbouring ops: with n = e^x * (e^x + 2),
+  // tanh(softplus(x)) = n / (n + 2). Computed in f32 as n overflows early in
+  // 16-bit types. For large x, n overflows in f32 too, where mish(x) == x.
+  HloFlow DoMish(HloFlow input) {
+    constexpr auto kAccType = pblczero::XlaShapeProto::F32;
+    const auto input_type = input->shape().element_type();
+    const bool need_conv = input_type != kAccType;
+    auto* x = need_conv ? builder_.Convert(input, kAccType) : input;
+    const auto& dims = x->shape().dimensions();
+    auto* two = DoBroadcast(MakeScalar(2, kAccType), dims);
+    auto* e = builder_.Exponential(x);
+    auto* n = builder_.Multiply(e, builder_.Add(e, two));
+    auto* flow = builder_.Divide(builder_.Multiply(x, n), builder_.Add(n, two));
+    flow = builder_.Select(
+        builder_.Compare(x, DoBroadcast(MakeScalar(20, kAccType), dims), "GT"),
+        x, flow);
+    return need_conv ? builder_.Convert(flow, input_type) : flow;
   }
 
   std::vector<HloFlow> OpExp(const pblczero::NodeProto& node) {
@@ -1699,6 +1768,7 @@ class Onnx2HloConverter {
       }
       for (size_t i = 0; i < outputs.size(); ++i) {
         onnx_name_to_hlo_flow_[std::string(node.output(i))] = outputs[i];
+        onnx_name_to_producer_[std::string(node.output(i))] = &node;
       }
     } catch (Exception& e) {
       std::string inputs;
@@ -1714,6 +1784,9 @@ class Onnx2HloConverter {
   }
 
   std::unordered_map<std::string, HloFlow> onnx_name_to_hlo_flow_;
+  // ONNX nodes by their outputs, for matching multi-node patterns.
+  std::unordered_map<std::string, const pblczero::NodeProto*>
+      onnx_name_to_producer_;
   std::unordered_map<std::string, std::vector<HloFlow> (Onnx2HloConverter::*)(
                                       const pblczero::NodeProto&)>
       onnx_op_to_builder_;
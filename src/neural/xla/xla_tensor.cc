@@ -27,9 +27,7 @@
 
 #include "neural/xla/xla_tensor.h"
 
-#include "utils/bf16_utils.h"
-#include "utils/fp16_utils.h"
-#include "utils/fp8_utils.h"
+#include "utils/fp_convert.h"
 #include "utils/string.h"
 
 namespace lczero {
@@ -82,16 +80,6 @@ void XlaMutableTensor::Reshape(const std::vector<int64_t>& new_shape) {
   size_ = new_size;
 }
 
-namespace {
-template <typename T>
-struct DeduceType;
-template <typename R, typename A>
-struct DeduceType<R (&)(A)> {
-  using result = R;
-  using arg = A;
-};
-}  // namespace
-
 void XlaMutableTensor::Cast(pblczero::XlaShapeProto::Type new_type) {
   if (new_type == type_) return;
   const size_t new_size = GetBufferSize(new_type, shape_);
@@ -111,14 +99,12 @@ void XlaMutableTensor::Cast(pblczero::XlaShapeProto::Type new_type) {
         pblczero::XlaShapeProto::Type_Name(type_) + " to " +
         pblczero::XlaShapeProto::Type_Name(new_type));
   }
-  auto convert = [&](auto&& func) {
-    using src_t = typename DeduceType<decltype(func)>::arg;
-    using dst_t = typename DeduceType<decltype(func)>::result;
-    const size_t count = std::accumulate(shape_.begin(), shape_.end(), 1,
-                                         std::multiplies<int64_t>());
-    const src_t* src_ptr = static_cast<const src_t*>(src);
-    dst_t* dst_ptr = static_cast<dst_t*>(dst);
-    for (size_t i = 0; i < count; ++i) dst_ptr[i] = func(src_ptr[i]);
+  const size_t count = std::accumulate(shape_.begin(), shape_.end(), 1,
+                                       std::multiplies<int64_t>());
+  // Narrowing casts are done in place, which the bulk conversions allow.
+  auto convert = [&]<typename S, typename D>(
+                     void (*func)(std::span<const S>, std::span<D>)) {
+    func({static_cast<const S*>(src), count}, {static_cast<D*>(dst), count});
   };
   if (type_ == pblczero::XlaShapeProto::F32) {
     switch (new_type) {
@@ -129,7 +115,8 @@ void XlaMutableTensor::Cast(pblczero::XlaShapeProto::Type new_type) {
         convert(FP32toBF16);
         break;
       case pblczero::XlaShapeProto::F8E5M2:
-        convert(FP32toFP8E5M2_Saturate);
+        FP32toFP8E5M2({static_cast<const float*>(src), count},
+                      {static_cast<uint8_t*>(dst), count});
         break;
       default:
         throw Exception("Unsupported cast F32 -> " +
@@ -27,11 +27,20 @@
 
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <span>
 #include <string>
 
+#include "neural/backend.h"
 #include "neural/encoder.h"
 #include "neural/factory.h"
 #include "neural/loader.h"
+#include "neural/memcache.h"
+#include "neural/register.h"
+#include "neural/shared_params.h"
 #include "utils/fastmath.h"
 #include "utils/optionsparser.h"
 
@@ -131,7 +140,12 @@ class Output {
  public:
   // Not exposed.
   Output(const NetworkComputation& computation, int idx) {
-    for (int i = 0; i < 1858; ++i) p_[i] = computation.GetPVal(idx, i);
+    const std::span<const float> policy = computation.GetPolicyView(idx);
+    if (policy.empty()) {
+      for (int i = 0; i < 1858; ++i) p_[i] = computation.GetPVal(idx, i);
+    } else {
+      std::copy(policy.begin(), policy.end(), p_);
+    }
     q_ = computation.GetQVal(idx);
     d_ = computation.GetDVal(idx);
     m_ = computation.GetMVal(idx);
@@ -189,6 +203,29 @@ class BackendCapabilities {
   const NetworkCapabilities caps_;
 };
 
+// Results of Backend::evaluate_async() that may still be being computed.
+class PendingEvaluation {
+ public:
+  // Exported methods.
+  bool done() const {
+    return !result_.valid() || result_.wait_for(std::chrono::seconds(0)) ==
+                                   std::future_status::ready;
+  }
+  // Waits for the computation to finish and returns the outputs. Only can be
+  // called once.
+  std::vector<std::unique_ptr<Output>> wait() {
+    if (!result_.valid()) throw Exception("The outputs were already taken.");
+    return result_.get();
+  }
+
+  // Not exported.
+  PendingEvaluation(std::future<std::vector<std::unique_ptr<Output>>> result)
+      : result_(std::move(result)) {}
+
+ private:
+  std::future<std::vector<std::unique_ptr<Output>>> result_;
+};
+
 class Backend {
  public:
   // Exported methods.
@@ -215,21 +252,108 @@ class Backend {
   std::vector<std::unique_ptr<Output>> evaluate(
       const std::vector<Input*>& inputs) const {
     if (inputs.empty()) return {};
+    auto computation = NewComputation(inputs);
+    computation->ComputeBlocking();
+    return GetOutputs(*computation);
+  }
+
+  // Same as evaluate(), but returns right after taking the inputs, while the
+  // computation runs on its own thread. Lets the caller prepare the next
+  // batches in the meantime.
+  std::unique_ptr<PendingEvaluation> evaluate_async(
+      const std::vector<Input*>& inputs) const {
+    // The computation must not outlive the network, even when the Backend is
+    // gone before the results are fetched.
+    return std::make_unique<PendingEvaluation>(std::async(
+        std::launch::async, [network = network_,
+                             computation = NewComputation(inputs)]() mutable {
+          computation->ComputeBlocking();
+          auto outputs = GetOutputs(*computation);
+          computation.reset();
+          return outputs;
+        }));
+  }
+
+  // Evaluates a batch given as contiguous arrays, e.g. numpy arrays of shape
+  // [N, 112] for @masks and @values. The results go to @policy [N, 1858], @wdl
+  // [N, 3] and, unless empty, @moves_left [N].
+  void evaluate_batch(std::span<const uint64_t> masks,
+                      std::span<const float> values, std::span<float> policy,
+                      std::span<float> wdl, std::span<float> moves_left) const {
+    const size_t batch_size = masks.size() / kInputPlanes;
+    if (masks.size() % kInputPlanes != 0 || values.size() != masks.size()) {
+      throw Exception("Masks and values must have " +
+                      std::to_string(kInputPlanes) + " entries per sample.");
+    }
+    if (policy.size() != batch_size * kPolicySize ||
+        wdl.size() != batch_size * 3 ||
+        (!moves_left.empty() && moves_left.size() != batch_size)) {
+      throw Exception("Output sizes don't match the batch size " +
+                      std::to_string(batch_size) + ".");
+    }
+    if (batch_size == 0) return;
+    auto computation = network_->NewComputation();
+    for (size_t i = 0; i < batch_size; ++i) {
+      const uint64_t* sample_masks = masks.data() + i * kInputPlanes;
+      const float* sample_values = values.data() + i * kInputPlanes;
+      // Write straight into the backend's input buffer when it has one.
+      const InputPlanesView buffer = computation->GetInputBuffer(i);
+      if (!buffer.empty()) {
+        std::copy_n(sample_masks, kInputPlanes, buffer.masks);
+        std::copy_n(sample_values, kInputPlanes, buffer.values);
+        computation->AddWrittenInput();
+        continue;
+      }
+      InputPlanes planes(kInputPlanes);
+      for (int j = 0; j < kInputPlanes; ++j) {
+        planes[j].mask = sample_masks[j];
+        planes[j].value = sample_values[j];
+      }
+      computation->AddInput(std::move(planes));
+    }
+    computation->ComputeBlocking();
+    for (size_t i = 0; i < batch_size; ++i) {
+      float* sample_policy = policy.data() + i * kPolicySize;
+      const std::span<const float> view = computation->GetPolicyView(i);
+      if (view.empty()) {
+        for (int j = 0; j < kPolicySize; ++j) {
+          sample_policy[j] = computation->GetPVal(i, j);
+        }
+      } else {
+        std::copy(view.begin(), view.end(), sample_policy);
+      }
+      const float q = computation->GetQVal(i);
+      const float d = computation->GetDVal(i);
+      wdl[i * 3 + 0] = (1.0f + q - d) / 2.0f;
+      wdl[i * 3 + 1] = d;
+      wdl[i * 3 + 2] = (1.0f - q - d) / 2.0f;
+      if (!moves_left.empty()) moves_left[i] = computation->GetMVal(i);
+    }
+  }
+
+ private:
+  static constexpr int kPolicySize = 1858;
+
+  std::unique_ptr<NetworkComputation> NewComputation(
+      const std::vector<Input*>& inputs) const {
     auto computation = network_->NewComputation();
     for (const auto* input : inputs) {
       InputPlanes input_copy = input->GetPlanes();
       computation->AddInput(std::move(input_copy));
     }
-    computation->ComputeBlocking();
+    return computation;
+  }
+
+  static std::vector<std::unique_ptr<Output>> GetOutputs(
+      const NetworkComputation& computation) {
     std::vector<std::unique_ptr<Output>> result;
-    for (int i = 0; i < computation->GetBatchSize(); ++i) {
-      result.push_back(std::make_unique<Output>(*computation, i));
+    for (int i = 0; i < computation.GetBatchSize(); ++i) {
+      result.push_back(std::make_unique<Output>(computation, i));
     }
     return result;
   }
 
- private:
-  std::unique_ptr<::lczero::Network> network_;
+  std::shared_ptr<::lczero::Network> network_;
 };
 
 class GameState {
@@ -285,9 +409,79 @@ class GameState {
     return board.DebugString();
   }
 
+  // Not exported.
+  const PositionHistory& history() const { return history_; }
+
  private:
   PositionHistory history_;
 };
 
+class Evaluation {
+ public:
+  // Exported methods.
+  float q() const { return result_.q; }
+  float d() const { return result_.d; }
+  float m() const { return result_.m; }
+  // Policy of the legal moves, in the order of GameState.moves().
+  std::vector<float> p() const { return result_.p; }
+
+  // Not exported.
+  Evaluation(EvalResult result) : result_(std::move(result)) {}
+
+ private:
+  EvalResult result_;
+};
+
+// Evaluates game states through the Backend API, which encodes the positions
+// in C++ and answers repeated positions from the cache.
+class Evaluator {
+ public:
+  // Exported methods.
+  Evaluator(const std::optional<std::string>& weights,
+            const std::optional<std::string>& backend,
+            const std::optional<std::string>& options, int cache_size) {
+    OptionsParser parser;
+    SharedBackendParams::Populate(&parser);
+    OptionsDict* dict = parser.GetMutableOptions();
+    if (weights) {
+      dict->Set<std::string>(SharedBackendParams::kWeightsId, *weights);
+    }
+    if (backend) {
+      dict->Set<std::string>(SharedBackendParams::kBackendId, *backend);
+    }
+    if (options) {
+      dict->Set<std::string>(SharedBackendParams::kBackendOptionsId, *options);
+    }
+    dict->Set<int>(SharedBackendParams::kNNCacheSizeId, cache_size);
+    const OptionsDict& params = parser.GetOptionsDict();
+    backend_ = BackendManager::Get()->CreateFromParams(params);
+    if (cache_size > 0) backend_ = CreateMemCache(std::move(backend_), params);
+  }
+
+  std::vector<std::unique_ptr<Evaluation>> evaluate(
+      const std::vector<GameState*>& states) const {
+    std::vector<MoveList> legal_moves;
+    legal_moves.reserve(states.size());
+    for (const auto* state : states) {
+      legal_moves.push_back(
+          state->history().Last().GetBoard().GenerateLegalMoves());
+    }
+    std::vector<EvalPosition> positions;
+    positions.reserve(states.size());
+    for (size_t i = 0; i < states.size(); ++i) {
+      positions.push_back(
+          EvalPosition{states[i]->history().GetPositions(), legal_moves[i]});
+    }
+    std::vector<std::unique_ptr<Evaluation>> result;
+    for (auto& eval : backend_->EvaluateBatch(positions)) {
+      result.push_back(std::make_unique<Evaluation>(std::move(eval)));
+    }
+    return result;
+  }
+
+ private:
+  std::unique_ptr<::lczero::Backend> backend_;
+};
+
 }  // namespace python
 }  // namespace lczero
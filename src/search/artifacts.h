@@ -27,11 +27,48 @@
 
 #pragma once
 
+#include <cstdint>
+#include <vector>
+
+#include "chess/position.h"
+
 namespace lczero {
 
 // Contains the search artifacts that are needed e.g. to build the training
 // data. The selfplay loop would fetch this from search to build training data
 // frames.
-struct SearchArtifacts {};
+// Evals are from the point of view of the side to move at the root, moves are
+// as played (not flipped for black).
+struct SearchArtifacts {
+  struct Eval {
+    float wl = 0.0f;
+    float d = 0.0f;
+    // Plies left.
+    float ml = 0.0f;
+  };
+  struct RootMove {
+    Move move;
+    uint32_t visits = 0;
+    // Eval of the move, the root's one if it has no visits.
+    Eval eval;
+    // Best result the side to move can get with this move.
+    GameResult upper_bound = GameResult::WHITE_WON;
+  };
+
+  uint32_t root_visits = 0;
+  Eval root_eval;
+  // All the legal root moves, in the order of the search.
+  std::vector<RootMove> root_moves;
+  // The best move regardless of temperature, empty when the root has no
+  // children.
+  Move best_move;
+  Eval best_eval;
+  bool best_is_terminal = false;
+  // The NN eval of the root from the backend cache, NaN when it's not there.
+  Eval orig_eval;
+  // Kullback-Leibler divergence in nats between the policy and the visits,
+  // or 0 when the policy is not in the cache.
+  float policy_kld = 0.0f;
+};
 
 }  // namespace lczero
\ No newline at end of file
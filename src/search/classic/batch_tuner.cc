@@ -0,0 +1,110 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "search/classic/batch_tuner.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "utils/logging.h"
+
+namespace lczero {
+namespace classic {
+
+namespace {
+// A window is long enough to average out a few slow batches, and short enough
+// to converge within the first seconds of a search.
+constexpr auto kWindowTime = std::chrono::milliseconds(100);
+constexpr int kMinWindowIterations = 4;
+// Every decision changes the size by this factor, or by at least one.
+constexpr float kStepFactor = 1.25f;
+// Throughput drops smaller than this are taken for noise.
+constexpr double kNoiseMargin = 0.02;
+}  // namespace
+
+MinibatchTuner::MinibatchTuner(const Params& params, int initial_size)
+    : params_(params),
+      size_(std::clamp(initial_size, params.min_size, params.max_size)) {}
+
+int MinibatchTuner::GetMaxOutOfOrder() const {
+  return std::max(1, static_cast<int>(params_.out_of_order_factor * size_));
+}
+
+bool MinibatchTuner::Update(int64_t picked, int64_t collisions,
+                            int64_t nn_evals,
+                            std::chrono::nanoseconds compute_time,
+                            std::chrono::nanoseconds iteration_time) {
+  ++iterations_;
+  picked_ += picked;
+  collisions_ += collisions;
+  nn_evals_ += nn_evals;
+  compute_time_ += compute_time;
+  time_ += iteration_time;
+  if (time_ < kWindowTime || iterations_ < kMinWindowIterations) return false;
+
+  const double seconds = std::chrono::duration<double>(time_).count();
+  const double throughput = (picked_ - collisions_) / seconds;
+  const double collision_rate =
+      picked_ > 0 ? static_cast<double>(collisions_) / picked_ : 0.0;
+  const double latency_ms =
+      std::chrono::duration<double, std::milli>(compute_time_).count() /
+      iterations_;
+
+  const char* reason;
+  if (collision_rate > params_.max_collision_rate) {
+    direction_ = -1;
+    reason = "too many collisions";
+  } else if (throughput < previous_throughput_ * (1.0 - kNoiseMargin)) {
+    direction_ = -direction_;
+    reason = "throughput dropped";
+  } else {
+    reason = "throughput held";
+  }
+  const int step = std::max(
+      1, static_cast<int>(std::lround(size_ * (kStepFactor - 1.0f))));
+  const int new_size = std::clamp(size_ + direction_ * step, params_.min_size,
+                                  params_.max_size);
+  // Bounce off the bounds, so the next window measures the other side.
+  if (new_size == size_) direction_ = -direction_;
+
+  LOGFILE << "Minibatch tuner: " << reason << " (" << std::lround(throughput)
+          << " nodes/s, " << std::lround(collision_rate * 100.0)
+          << "% collisions, " << nn_evals_ / iterations_ << " evals and "
+          << latency_ms << "ms NN latency per batch), size " << size_
+          << " -> " << new_size << ".";
+
+  const bool changed = new_size != size_;
+  size_ = new_size;
+  previous_throughput_ = throughput;
+  iterations_ = 0;
+  picked_ = collisions_ = nn_evals_ = 0;
+  compute_time_ = time_ = std::chrono::nanoseconds(0);
+  return changed;
+}
+
+}  // namespace classic
+}  // namespace lczero
@@ -0,0 +1,80 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace lczero {
+namespace classic {
+
+// Adjusts the minibatch size of a search worker while it searches, by hill
+// climbing on the measured throughput. At the end of every measurement window
+// the size takes a step in its current direction, which is reversed when the
+// throughput dropped since the previous window. A collision rate above the
+// limit always shrinks the batch, as collisions are wasted gathering work and
+// deepen the virtual loss distortion.
+class MinibatchTuner {
+ public:
+  struct Params {
+    int min_size;
+    int max_size;
+    float max_collision_rate;
+    float out_of_order_factor;
+  };
+
+  MinibatchTuner(const Params& params, int initial_size);
+
+  // Records one iteration which picked @picked nodes, @collisions of them
+  // collisions, and sent @nn_evals positions to the backend. Returns true when
+  // the batch size changed.
+  bool Update(int64_t picked, int64_t collisions, int64_t nn_evals,
+              std::chrono::nanoseconds compute_time,
+              std::chrono::nanoseconds iteration_time);
+
+  int GetMinibatchSize() const { return size_; }
+  int GetMaxOutOfOrder() const;
+
+ private:
+  const Params params_;
+  int size_;
+  int direction_ = 1;
+  // Nodes extended per second in the previous window, 0 before the first one.
+  double previous_throughput_ = 0.0;
+
+  // The current window.
+  int iterations_ = 0;
+  int64_t picked_ = 0;
+  int64_t collisions_ = 0;
+  int64_t nn_evals_ = 0;
+  std::chrono::nanoseconds compute_time_{0};
+  std::chrono::nanoseconds time_{0};
+};
+
+}  // namespace classic
+}  // namespace lczero
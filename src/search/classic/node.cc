@@ -29,7 +29,9 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstring>
 #include <iostream>
 #include <sstream>
@@ -39,6 +41,9 @@
 #include "neural/network.h"
 #include "utils/exception.h"
 #include "utils/hashcat.h"
+#include "utils/memory_accountant.h"
+#include "utils/metrics.h"
+#include "utils/numa.h"
 
 namespace lczero {
 namespace classic {
@@ -50,73 +55,229 @@ namespace classic {
 namespace {
 // Periodicity of garbage collection, milliseconds.
 const int kGCIntervalMs = 100;
+// Maximum number of garbage collector threads.
+const unsigned kGCMaxThreads = 4;
+// Subtrees with at least that many visits are split into their children, so
+// that other garbage collector threads can help releasing them.
+const uint32_t kGCMinSplitVisits = 4096;
+// Used to estimate memory held by pending garbage.
+const size_t kGCAvgEdgesPerNode = 30;
+const size_t kGCBytesPerNode = sizeof(Node) + kGCAvgEdgesPerNode * sizeof(Edge);
+}  // namespace
 
-// Every kGCIntervalMs milliseconds release nodes in a separate GC thread.
+// Releases nodes in a pool of background threads. Large subtrees are split
+// into smaller ones as they are released, so that all threads can work on a
+// single huge tree.
 class NodeGarbageCollector {
  public:
-  NodeGarbageCollector() : gc_thread_([this]() { Worker(); }) {}
+  NodeGarbageCollector() {
+    const unsigned num_threads = std::clamp(
+        std::thread::hardware_concurrency() / 4, 1u, kGCMaxThreads);
+    for (unsigned i = 0; i < num_threads; ++i) {
+      gc_threads_.emplace_back([this, i]() { Worker(i); });
+    }
+  }
 
   // Takes ownership of a subtree, to dispose it in a separate thread when
   // it has time.
   void AddToGcQueue(std::unique_ptr<Node> node, size_t solid_size = 0) {
     if (!node) return;
+    const size_t num_nodes = EstimateSubtreeNodes(node.get(), solid_size);
+    Mutex::Lock lock(gc_mutex_);
+    pending_nodes_ += num_nodes;
+    subtrees_to_gc_.push_back({std::move(node), solid_size, num_nodes,
+                               std::chrono::steady_clock::now()});
+  }
+
+  // Blocks until there are less than @max_nodes nodes waiting to be released.
+  void WaitForPendingNodes(size_t max_nodes) {
     Mutex::Lock lock(gc_mutex_);
-    subtrees_to_gc_.emplace_back(std::move(node));
-    subtrees_to_gc_solid_size_.push_back(solid_size);
+    while (pending_nodes_ > max_nodes) {
+      gc_cv_.notify_all();
+      released_cv_.wait(lock.get_raw());
+    }
+  }
+
+  NodeGcStats GetStats(bool reset_max_latency = true) {
+    Mutex::Lock lock(gc_mutex_);
+    NodeGcStats stats;
+    stats.pending_nodes = pending_nodes_;
+    stats.pending_bytes = pending_nodes_ * kGCBytesPerNode;
+    stats.released_nodes = released_nodes_;
+    const auto now = std::chrono::steady_clock::now();
+    auto oldest = now;
+    for (const auto& item : subtrees_to_gc_) {
+      oldest = std::min(oldest, item.enqueue_time);
+    }
+    stats.oldest_pending_ms =
+        std::chrono::duration<float, std::milli>(now - oldest).count();
+    stats.max_latency_ms = max_latency_ms_;
+    if (reset_max_latency) max_latency_ms_ = 0.0f;
+    return stats;
   }
 
   ~NodeGarbageCollector() {
-    // Flips stop flag and waits for a worker thread to stop.
-    stop_.store(true);
-    gc_thread_.join();
+    // Flips stop flag and waits for worker threads to stop.
+    {
+      Mutex::Lock lock(gc_mutex_);
+      stop_ = true;
+    }
+    gc_cv_.notify_all();
+    for (auto& thread : gc_threads_) thread.join();
   }
 
  private:
-  void GarbageCollect() {
-    while (!stop_.load()) {
-      // Node will be released in destructor when mutex is not locked.
-      std::unique_ptr<Node> node_to_gc;
-      size_t solid_size = 0;
-      {
-        // Lock the mutex and move last subtree from subtrees_to_gc_ into
-        // node_to_gc.
-        Mutex::Lock lock(gc_mutex_);
-        if (subtrees_to_gc_.empty()) return;
-        node_to_gc = std::move(subtrees_to_gc_.back());
-        subtrees_to_gc_.pop_back();
-        solid_size = subtrees_to_gc_solid_size_.back();
-        subtrees_to_gc_solid_size_.pop_back();
-      }
-      // Solid is a hack...
-      if (solid_size != 0) {
-        for (size_t i = 0; i < solid_size; i++) {
-          node_to_gc.get()[i].~Node();
-        }
-        std::allocator<Node> alloc;
-        alloc.deallocate(node_to_gc.release(), solid_size);
+  struct Subtree {
+    // Either a linked list of siblings, or an array of solid_size nodes.
+    std::unique_ptr<Node> node;
+    size_t solid_size;
+    // Estimated number of nodes, accounted in pending_nodes_.
+    size_t num_nodes;
+    // When the (whole) subtree this is a part of was queued.
+    std::chrono::steady_clock::time_point enqueue_time;
+  };
+
+  // Number of nodes in a subtree, estimated from visit counts.
+  static size_t EstimateSubtreeNodes(const Node* node, size_t solid_size) {
+    auto estimate = [](const Node& node) -> size_t {
+      return node.child_ ? node.GetN() + 1 : 1;
+    };
+    size_t result = 0;
+    if (solid_size != 0) {
+      for (size_t i = 0; i < solid_size; i++) result += estimate(node[i]);
+    } else {
+      for (; node; node = node->sibling_.get()) result += estimate(*node);
+    }
+    return result;
+  }
+
+  // Moves children of @node to @out if the subtree is big enough to be worth
+  // releasing in parallel.
+  static void MaybeSplit(Node* node,
+                         std::chrono::steady_clock::time_point enqueue_time,
+                         std::vector<Subtree>* out) {
+    if (node->GetN() < kGCMinSplitVisits || !node->child_) return;
+    const size_t solid_size = node->solid_children_ ? node->num_edges_ : 0;
+    const size_t num_nodes =
+        EstimateSubtreeNodes(node->child_.get(), solid_size);
+    out->push_back(
+        {std::move(node->child_), solid_size, num_nodes, enqueue_time});
+    node->solid_children_ = false;
+  }
+
+  static void Release(Subtree subtree, std::vector<Subtree>* split) {
+    if (subtree.solid_size != 0) {
+      Node* nodes = subtree.node.release();
+      for (size_t i = 0; i < subtree.solid_size; i++) {
+        MaybeSplit(&nodes[i], subtree.enqueue_time, split);
+        nodes[i].~Node();
       }
+      DeallocateNodeMemory(nodes, subtree.solid_size * sizeof(Node));
+      return;
+    }
+    // Unlink siblings one by one, so that the list isn't released recursively.
+    std::unique_ptr<Node> node = std::move(subtree.node);
+    while (node) {
+      std::unique_ptr<Node> next = std::move(node->sibling_);
+      MaybeSplit(node.get(), subtree.enqueue_time, split);
+      node = std::move(next);
     }
   }
 
-  void Worker() {
-    while (!stop_.load()) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(kGCIntervalMs));
-      GarbageCollect();
-    };
+  void Worker(int id) {
+    std::vector<Subtree> split;
+    // The threads outlive the searches, so they follow the placement policy
+    // of the latest one.
+    int placement_generation = 0;
+    Mutex::Lock lock(gc_mutex_);
+    while (true) {
+      while (!stop_ && subtrees_to_gc_.empty()) {
+        gc_cv_.wait_for(lock.get_raw(),
+                        std::chrono::milliseconds(kGCIntervalMs));
+      }
+      if (stop_) return;
+      Subtree subtree = std::move(subtrees_to_gc_.back());
+      subtrees_to_gc_.pop_back();
+      const size_t num_nodes = subtree.num_nodes;
+      const auto enqueue_time = subtree.enqueue_time;
+
+      // Nodes are released when mutex is not locked.
+      lock.get_raw().unlock();
+      if (placement_generation != Numa::GetPlacementGeneration()) {
+        placement_generation = Numa::GetPlacementGeneration();
+        Numa::PlaceThread(id);
+      }
+      Release(std::move(subtree), &split);
+      const auto now = std::chrono::steady_clock::now();
+      lock.get_raw().lock();
+
+      // Split parts stay accounted in pending_nodes_ until they are released.
+      size_t split_nodes = 0;
+      for (auto& item : split) {
+        split_nodes += item.num_nodes;
+        subtrees_to_gc_.push_back(std::move(item));
+      }
+      if (split.size() > 1) gc_cv_.notify_all();
+      split.clear();
+      const size_t released = num_nodes - std::min(num_nodes, split_nodes);
+      pending_nodes_ -= std::min(pending_nodes_, released);
+      released_nodes_ += released;
+      max_latency_ms_ = std::max(
+          max_latency_ms_,
+          std::chrono::duration<float, std::milli>(now - enqueue_time).count());
+      released_cv_.notify_all();
+    }
   }
 
-  mutable Mutex gc_mutex_;
-  std::vector<std::unique_ptr<Node>> subtrees_to_gc_ GUARDED_BY(gc_mutex_);
-  std::vector<size_t> subtrees_to_gc_solid_size_ GUARDED_BY(gc_mutex_);
+  Mutex gc_mutex_;
+  std::condition_variable gc_cv_;
+  std::condition_variable released_cv_;
+  std::vector<Subtree> subtrees_to_gc_ GUARDED_BY(gc_mutex_);
+  size_t pending_nodes_ GUARDED_BY(gc_mutex_) = 0;
+  size_t released_nodes_ GUARDED_BY(gc_mutex_) = 0;
+  float max_latency_ms_ GUARDED_BY(gc_mutex_) = 0.0f;
 
   // When true, Worker() should stop and exit.
-  std::atomic<bool> stop_{false};
-  std::thread gc_thread_;
+  bool stop_ GUARDED_BY(gc_mutex_) = false;
+  std::vector<std::thread> gc_threads_;
 };
 
+namespace {
 NodeGarbageCollector gNodeGc;
+
+const bool kNodeGcMetricsRegistered = []() {
+  Metrics::Get().AddGauge(
+      "node_gc_pending_bytes",
+      "Estimated memory of search nodes waiting to be released.",
+      []() { return gNodeGc.GetStats(false).pending_bytes; });
+  Metrics::Get().AddGauge(
+      "node_gc_oldest_pending_ms",
+      "How long the oldest subtree queued for release has been waiting.",
+      []() { return gNodeGc.GetStats(false).oldest_pending_ms; });
+  return true;
+}();
+
+const bool kNodeMemorySourcesRegistered = []() {
+  // Nodes queued for release are still allocated, count them separately.
+  MemoryAccountant::Get().AddSource(MemoryKind::kTree, []() -> size_t {
+    const size_t used =
+        SlabAllocator::GetReservedBytes() - SlabAllocator::GetFreeBytes();
+    const size_t pending = gNodeGc.GetStats(false).pending_bytes;
+    return used > pending ? used - pending : 0;
+  });
+  MemoryAccountant::Get().AddSource(MemoryKind::kGcBacklog, []() -> size_t {
+    return gNodeGc.GetStats(false).pending_bytes;
+  });
+  return true;
+}();
 }  // namespace
 
+NodeGcStats GetNodeGcStats() { return gNodeGc.GetStats(); }
+
+void WaitForNodeGc(size_t max_pending_bytes) {
+  gNodeGc.WaitForPendingNodes(max_pending_bytes / kGCBytesPerNode);
+}
+
 /////////////////////////////////////////////////////////////////////////
 // Edge
 /////////////////////////////////////////////////////////////////////////
@@ -233,9 +394,9 @@ Edge* Node::GetOwnEdge() const { return GetParent()->GetEdgeToNode(this); }
 std::string Node::DebugString() const {
   std::ostringstream oss;
   oss << " Term:" << static_cast<int>(terminal_type_) << " This:" << this
-      << " Parent:" << parent_ << " Index:" << index_
+      << " Parent:" << parent_ << " Index:" << static_cast<int>(index_)
       << " Child:" << child_.get() << " Sibling:" << sibling_.get()
-      << " WL:" << wl_ << " N:" << n_ << " N_:" << n_in_flight_
+      << " WL:" << wl_ << " N:" << n_ << " N_:" << GetNInFlight()
       << " Edges:" << static_cast<int>(num_edges_)
       << " Bounds:" << static_cast<int>(lower_bound_) - 2 << ","
       << static_cast<int>(upper_bound_) - 2 << " Solid:" << solid_children_;
@@ -266,10 +427,10 @@ bool Node::MakeSolid() {
   if (total_in_flight != GetNInFlight()) {
     return false;
   }
-  std::allocator<Node> alloc;
-  auto* new_children = alloc.allocate(num_edges_);
+  auto* new_children = static_cast<Node*>(
+      AllocateNodeMemory(num_edges_ * sizeof(Node)));
   for (int i = 0; i < num_edges_; i++) {
-    new (&(new_children[i])) Node(this, i);
+    ::new (&(new_children[i])) Node(this, i);
   }
   std::unique_ptr<Node> old_child = std::move(child_);
   while (old_child) {
@@ -346,12 +507,21 @@ void Node::SetBounds(GameResult lower, GameResult upper) {
 }
 
 bool Node::TryStartScoreUpdate() {
-  if (n_ == 0 && n_in_flight_ > 0) return false;
-  ++n_in_flight_;
+  auto n_in_flight = NInFlight();
+  if (n_ == 0) {
+    // Unvisited node, only the thread which takes n-in-flight from 0 to 1 gets
+    // to extend it.
+    uint32_t expected = 0;
+    return n_in_flight.compare_exchange_strong(expected, 1,
+                                               std::memory_order_relaxed);
+  }
+  n_in_flight.fetch_add(1, std::memory_order_relaxed);
   return true;
 }
 
-void Node::CancelScoreUpdate(int multivisit) { n_in_flight_ -= multivisit; }
+void Node::CancelScoreUpdate(int multivisit) {
+  NInFlight().fetch_sub(multivisit, std::memory_order_relaxed);
+}
 
 void Node::FinalizeScoreUpdate(float v, float d, float m, int multivisit) {
   // Recompute Q.
@@ -362,7 +532,7 @@ void Node::FinalizeScoreUpdate(float v, float d, float m, int multivisit) {
   // Increment N.
   n_ += multivisit;
   // Decrement virtual loss.
-  n_in_flight_ -= multivisit;
+  NInFlight().fetch_sub(multivisit, std::memory_order_relaxed);
 }
 
 void Node::AdjustForTerminal(float v, float d, float m, int multivisit) {
@@ -408,6 +578,13 @@ void Node::UpdateChildrenParents() {
 
 void Node::ReleaseChildren() {
   gNodeGc.AddToGcQueue(std::move(child_), solid_children_ ? num_edges_ : 0);
+  solid_children_ = false;
+}
+
+void Node::ReleaseEdges() {
+  assert(!child_);
+  edges_.reset();
+  num_edges_ = 0;
 }
 
 void Node::ReleaseChildrenExceptOne(Node* node_to_save) {
@@ -427,7 +604,7 @@ void Node::ReleaseChildrenExceptOne(Node* node_to_save) {
     // Stores node which will have to survive (or nullptr if it's not found).
     std::unique_ptr<Node> saved_node;
     // Pointer to unique_ptr, so that we could move from it.
-    for (std::unique_ptr<Node>* node = &child_; *node;
+    for (OwnedNodePtr* node = &child_; *node;
          node = &(*node)->sibling_) {
       // If current node is the one that we have to save.
       if (node->get() == node_to_save) {
@@ -478,6 +655,7 @@ void NodeTree::MakeMove(Move move) {
   current_head_ =
       new_head ? new_head : current_head_->CreateSingleChildNode(move);
   history_.Append(move);
+  moves_.push_back(move);
 }
 
 void NodeTree::TrimTreeAtHead() {
@@ -491,6 +669,18 @@ void NodeTree::TrimTreeAtHead() {
 }
 
 bool NodeTree::ResetToPosition(const GameState& pos) {
+  // When the new position only adds moves to the current one, which is what
+  // hosts send during a game, the moves already made aren't replayed.
+  if (gamebegin_node_ && history_.Starting() == pos.startpos &&
+      moves_.size() <= pos.moves.size() &&
+      std::equal(moves_.begin(), moves_.end(), pos.moves.begin())) {
+    history_.Reserve(pos.moves.size() + 1);
+    for (size_t i = moves_.size(); i < pos.moves.size(); ++i) {
+      MakeMove(pos.moves[i]);
+    }
+    return true;
+  }
+
   if (gamebegin_node_ && (history_.Starting() != pos.startpos)) {
     // Completely different position.
     DeallocateTree();
@@ -501,6 +691,9 @@ bool NodeTree::ResetToPosition(const GameState& pos) {
   }
 
   history_.Reset(pos.startpos);
+  history_.Reserve(pos.moves.size() + 1);
+  moves_.clear();
+  moves_.reserve(pos.moves.size());
 
   Node* old_head = current_head_;
   current_head_ = gamebegin_node_.get();
@@ -28,6 +28,7 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <iostream>
 #include <memory>
@@ -37,10 +38,11 @@
 #include "chess/callbacks.h"
 #include "chess/gamestate.h"
 #include "chess/position.h"
-#include "neural/cache.h"
 #include "neural/encoder.h"
 #include "proto/net.pb.h"
+#include "utils/compact_ptr.h"
 #include "utils/mutex.h"
+#include "utils/slab_allocator.h"
 
 namespace lczero {
 namespace classic {
@@ -88,6 +90,14 @@ class Edge {
   // Creates array of edges from the list of moves.
   static std::unique_ptr<Edge[]> FromMovelist(const MoveList& moves);
 
+  // Edge arrays are allocated from the slab allocator.
+  static void* operator new[](size_t size) {
+    return SlabAllocator::Allocate(size);
+  }
+  static void operator delete[](void* ptr, size_t size) {
+    SlabAllocator::Deallocate(ptr, size);
+  }
+
   // Returns move from the point of view of the player making it (if as_opponent
   // is false) or as opponent (if as_opponent is true).
   Move GetMove(bool as_opponent = false) const;
@@ -125,6 +135,34 @@ class Edge_Iterator;
 template <bool is_const>
 class VisitedNode_Iterator;
 
+class NodeGarbageCollector;
+class Node;
+
+#ifdef LC0_COMPACT_NODES
+// Nodes refer to each other by 32-bit offsets into the compact region of the
+// slab allocator. That brings Node down to 48 bytes, but limits the total size
+// of all nodes to SlabAllocator::kCompactRegionSize.
+using NodeRef = CompactPtr<Node>;
+using OwnedNodePtr = CompactUniquePtr<Node>;
+
+inline void* AllocateNodeMemory(size_t size) {
+  return SlabAllocator::AllocateCompact(size);
+}
+inline void DeallocateNodeMemory(void* ptr, size_t size) {
+  SlabAllocator::DeallocateCompact(ptr, size);
+}
+#else
+using NodeRef = Node*;
+using OwnedNodePtr = UniqueLinkPtr<Node, PlainPtr<Node>>;
+
+inline void* AllocateNodeMemory(size_t size) {
+  return SlabAllocator::Allocate(size);
+}
+inline void DeallocateNodeMemory(void* ptr, size_t size) {
+  SlabAllocator::Deallocate(ptr, size);
+}
+#endif
+
 class Node {
  public:
   using Iterator = Edge_Iterator<false>;
@@ -135,7 +173,7 @@ class Node {
   // Takes pointer to a parent node and own index in a parent.
   Node(Node* parent, uint16_t index)
       : parent_(parent),
-        index_(index),
+        index_(static_cast<uint8_t>(index)),
         terminal_type_(Terminal::NonTerminal),
         lower_bound_(GameResult::BLACK_WON),
         upper_bound_(GameResult::WHITE_WON),
@@ -146,6 +184,13 @@ class Node {
   Node(Node&& move_from) = default;
   Node& operator=(Node&& move_from) = default;
 
+  // Individually allocated nodes come from the slab allocator, see also
+  // MakeSolid() for arrays.
+  static void* operator new(size_t size) { return AllocateNodeMemory(size); }
+  static void operator delete(void* ptr, size_t size) {
+    DeallocateNodeMemory(ptr, size);
+  }
+
   // Allocates a new edge and a new node. The node has to be no edges before
   // that.
   Node* CreateSingleChildNode(Move m);
@@ -162,10 +207,12 @@ class Node {
   // Returns sum of policy priors which have had at least one playout.
   float GetVisitedPolicy() const;
   uint32_t GetN() const { return n_; }
-  uint32_t GetNInFlight() const { return n_in_flight_; }
+  uint32_t GetNInFlight() const {
+    return NInFlight().load(std::memory_order_relaxed);
+  }
   uint32_t GetChildrenVisits() const { return n_ > 0 ? n_ - 1 : 0; }
   // Returns n = n_if_flight.
-  int GetNStarted() const { return n_ + n_in_flight_; }
+  int GetNStarted() const { return n_ + GetNInFlight(); }
   float GetQ(float draw_score) const { return wl_ + draw_score * d_; }
   // Returns node eval, i.e. average subtree V for non-terminal node and -1/0/1
   // for terminal nodes.
@@ -200,7 +247,8 @@ class Node {
   // If this node is not in the process of being expanded by another thread
   // (which can happen only if n==0 and n-in-flight==1), mark the node as
   // "being updated" by incrementing n-in-flight, and return true.
-  // Otherwise return false.
+  // Otherwise return false. Safe to call concurrently, only one caller can
+  // claim an unvisited node.
   bool TryStartScoreUpdate();
   // Decrements n-in-flight back.
   void CancelScoreUpdate(int multivisit);
@@ -217,7 +265,9 @@ class Node {
   // When search decides to treat one visit as several (in case of collisions
   // or visiting terminal nodes several times), it amplifies the visit by
   // incrementing n_in_flight.
-  void IncrementNInFlight(int multivisit) { n_in_flight_ += multivisit; }
+  void IncrementNInFlight(int multivisit) {
+    NInFlight().fetch_add(multivisit, std::memory_order_relaxed);
+  }
 
   // Updates max depth, if new depth is larger.
   void UpdateMaxDepth(int depth);
@@ -234,9 +284,14 @@ class Node {
   VisitedNode_Iterator<true> VisitedNodes() const;
   VisitedNode_Iterator<false> VisitedNodes();
 
-  // Deletes all children.
+  // Deletes all children. The edges are kept, so the node can be extended
+  // again.
   void ReleaseChildren();
 
+  // Deletes the edges of a node that was never visited through them, when it
+  // turns out to be terminal after all.
+  void ReleaseEdges();
+
   // Deletes all children except one.
   // The node provided may be moved, so should not be relied upon to exist
   // afterwards.
@@ -254,12 +309,27 @@ class Node {
   // Reallocates this nodes children to be in a solid block, if possible and not
   // already done. Returns true if the transformation was performed.
   bool MakeSolid();
+  // Whether the children are in a solid block.
+  bool IsSolid() const { return solid_children_; }
 
   void SortEdges();
 
   // Index in parent edges - useful for correlated ordering.
   uint16_t Index() const { return index_; }
 
+  // Serializes insertion of new nodes into the child list of a node, see
+  // Edge_Iterator::GetOrSpawnNode(). Readers walking the list don't take it.
+  class ChildrenLock {
+   public:
+    explicit ChildrenLock(Node* node) : flag_(node->children_lock_) {
+      while (flag_.exchange(1, std::memory_order_acquire)) SpinloopPause();
+    }
+    ~ChildrenLock() { flag_.store(0, std::memory_order_release); }
+
+   private:
+    std::atomic_ref<uint8_t> flag_;
+  };
+
   ~Node() {
     if (solid_children_ && child_) {
       // As a hack, solid_children is actually storing an array in here, release
@@ -267,8 +337,7 @@ class Node {
       for (int i = 0; i < num_edges_; i++) {
         child_.get()[i].~Node();
       }
-      std::allocator<Node> alloc;
-      alloc.deallocate(child_.release(), num_edges_);
+      DeallocateNodeMemory(child_.release(), num_edges_ * sizeof(Node));
     }
   }
 
@@ -276,6 +345,13 @@ class Node {
   // For each child, ensures that its parent pointer is pointing to this.
   void UpdateChildrenParents();
 
+  // Pickers update n-in-flight concurrently while holding nodes_mutex_ in
+  // shared mode, so it's only accessed atomically. Relaxed ordering is enough,
+  // everything else in the node is ordered by nodes_mutex_.
+  std::atomic_ref<uint32_t> NInFlight() const {
+    return std::atomic_ref<uint32_t>(n_in_flight_);
+  }
+
   // To minimize the number of padding bytes and to avoid having unnecessary
   // padding when new fields are added, we arrange the fields by size, largest
   // to smallest.
@@ -291,14 +367,15 @@ class Node {
   // 8 byte fields on 64-bit platforms, 4 byte on 32-bit.
   // Array of edges.
   std::unique_ptr<Edge[]> edges_;
+  // Same, but 4 byte with LC0_COMPACT_NODES.
   // Pointer to a parent node. nullptr for the root.
-  Node* parent_ = nullptr;
+  NodeRef parent_ = nullptr;
   // Pointer to a first child. nullptr for a leaf node.
   // As a 'hack' actually a unique_ptr to Node[] if solid_children.
-  std::unique_ptr<Node> child_;
+  OwnedNodePtr child_;
   // Pointer to a next sibling. nullptr if there are no further siblings.
   // Also null in the solid case.
-  std::unique_ptr<Node> sibling_;
+  OwnedNodePtr sibling_;
 
   // 4 byte fields.
   // Averaged draw probability. Works similarly to WL, except that D is not
@@ -311,15 +388,17 @@ class Node {
   // (AKA virtual loss.) How many threads currently process this node (started
   // but not finished). This value is added to n during selection which node
   // to pick in MCTS, and also when selecting the best move.
-  uint32_t n_in_flight_ = 0;
-
-  // 2 byte fields.
-  // Index of this node is parent's edge list.
-  uint16_t index_;
+  // Only accessed through NInFlight().
+  mutable uint32_t n_in_flight_ = 0;
 
   // 1 byte fields.
+  // Index of this node is parent's edge list. Fits as there are never more
+  // than 255 edges.
+  uint8_t index_;
   // Number of edges in @edges_.
   uint8_t num_edges_ = 0;
+  // Spin lock flag of ChildrenLock.
+  uint8_t children_lock_ = 0;
 
   // Bit fields using parts of uint8_t fields initialized in the constructor.
   // Whether or not this node end game (with a winning of either sides or draw).
@@ -332,6 +411,7 @@ class Node {
 
   // TODO(mooskagh) Unfriend NodeTree.
   friend class NodeTree;
+  friend class NodeGarbageCollector;
   friend class Edge_Iterator<true>;
   friend class Edge_Iterator<false>;
   friend class Edge;
@@ -350,6 +430,10 @@ class Node {
 // A basic sanity check. This must be adjusted when Node members are adjusted.
 #if defined(__i386__) || (defined(__arm__) && !defined(__aarch64__))
 static_assert(sizeof(Node) == 48, "Unexpected size of Node for 32bit compile");
+#elif defined(LC0_COMPACT_NODES)
+static_assert(sizeof(Node) == 48, "Unexpected size of compact Node");
+static_assert(sizeof(Node) % SlabAllocator::kCompactGranularity == 0,
+              "Solid children arrays must keep nodes aligned");
 #else
 static_assert(sizeof(Node) == 64, "Unexpected size of Node");
 #endif
@@ -433,13 +517,15 @@ class EdgeAndNode {
 //
 // All functions are not thread safe (must be externally synchronized), but
 // it's fine if GetOrSpawnNode is called between calls to functions of the
-// iterator (e.g. advancing the iterator). Other functions that manipulate
-// child_ of parent or the sibling chain are not safe to call while iterating.
+// iterator (e.g. advancing the iterator), from other threads too: it
+// publishes the new node with a release store and the iterator loads the
+// links with acquire. Other functions that manipulate child_ of parent or the
+// sibling chain are not safe to call while iterating.
 template <bool is_const>
 class Edge_Iterator : public EdgeAndNode {
  public:
-  using Ptr = std::conditional_t<is_const, const std::unique_ptr<Node>*,
-                                 std::unique_ptr<Node>*>;
+  using Ptr =
+      std::conditional_t<is_const, const OwnedNodePtr*, OwnedNodePtr*>;
   using value_type = Edge_Iterator;
   using iterator_category = std::forward_iterator_tag;
   using difference_type = std::ptrdiff_t;
@@ -483,10 +569,12 @@ class Edge_Iterator : public EdgeAndNode {
   Edge_Iterator& operator*() { return *this; }
 
   // If there is node, return it. Otherwise spawn a new one and return it.
+  // Concurrent calls for the same parent are serialized by its ChildrenLock.
   Node* GetOrSpawnNode(Node* parent) {
     if (node_) return node_;  // If there is already a node, return it.
     // Should never reach here in solid mode.
     assert(node_ptr_ != nullptr);
+    Node::ChildrenLock lock(parent);
     Actualize();              // But maybe other thread already did that.
     if (node_) return node_;  // If it did, return.
     // Now we are sure we have to create a new node.
@@ -494,19 +582,20 @@ class Edge_Iterator : public EdgeAndNode {
     // idx 5. Here is how it looks like:
     //    node_ptr_ -> &Node(idx_.3).sibling_  ->  Node(idx_.7)
     // Here is how we do that:
-    // 1. Store pointer to a node idx_.7:
-    //    node_ptr_ -> &Node(idx_.3).sibling_  ->  nullptr
-    //    tmp -> Node(idx_.7)
-    std::unique_ptr<Node> tmp = std::move(*node_ptr_);
-    // 2. Create fresh Node(idx_.5):
-    //    node_ptr_ -> &Node(idx_.3).sibling_  ->  Node(idx_.5)
-    //    tmp -> Node(idx_.7)
-    *node_ptr_ = std::make_unique<Node>(parent, current_idx_);
-    // 3. Attach stored pointer back to a list:
+    // 1. Create fresh Node(idx_.5) already pointing to the successor (which is
+    //    briefly owned twice):
+    //    node_ptr_ -> &Node(idx_.3).sibling_  ->  Node(idx_.7)
+    //    node -> Node(idx_.5).sibling_ -> Node(idx_.7)
+    Node* node = new Node(parent, current_idx_);
+    node->sibling_.reset(node_ptr_->get());
+    // 2. Publish it with a release store, which hands over the ownership of
+    //    the successor. Other pickers walk the list concurrently and load the
+    //    links with acquire, so they see the list either without the new node
+    //    or with it fully built and linked, never cut short:
     //    node_ptr_ ->
     //         &Node(idx_.3).sibling_ -> Node(idx_.5).sibling_ -> Node(idx_.7)
-    (*node_ptr_)->sibling_ = std::move(tmp);
-    // 4. Actualize:
+    node_ptr_->publish(node);
+    // 3. Actualize:
     //    node_ -> &Node(idx_.5)
     //    node_ptr_ -> &Node(idx_.5).sibling_ -> Node(idx_.7)
     Actualize();
@@ -521,13 +610,16 @@ class Edge_Iterator : public EdgeAndNode {
     // This is needed (and has to be 'while' rather than 'if') as other threads
     // could spawn new nodes between &node_ptr_ and *node_ptr_ while we didn't
     // see.
-    while (*node_ptr_ && (*node_ptr_)->index_ < current_idx_) {
-      node_ptr_ = &(*node_ptr_)->sibling_;
+    // Each link is loaded once, it may change under us.
+    Node* next = node_ptr_->get();
+    while (next && next->index_ < current_idx_) {
+      node_ptr_ = &next->sibling_;
+      next = node_ptr_->get();
     }
     // If in the end node_ptr_ points to the node that we need, populate node_
     // and advance node_ptr_.
-    if (*node_ptr_ && (*node_ptr_)->index_ == current_idx_) {
-      node_ = (*node_ptr_).get();
+    if (next && next->index_ == current_idx_) {
+      node_ = next;
       node_ptr_ = &node_->sibling_;
     } else {
       node_ = nullptr;
@@ -634,6 +726,24 @@ inline VisitedNode_Iterator<false> Node::VisitedNodes() {
   return {*this, child_.get()};
 }
 
+// Statistics of the background node garbage collector.
+struct NodeGcStats {
+  // Estimated nodes and memory still waiting to be released.
+  size_t pending_nodes = 0;
+  size_t pending_bytes = 0;
+  // Total number of nodes released so far.
+  size_t released_nodes = 0;
+  // How long the oldest queued subtree has been waiting.
+  float oldest_pending_ms = 0.0f;
+  // Longest time from queueing to release, since the previous call.
+  float max_latency_ms = 0.0f;
+};
+NodeGcStats GetNodeGcStats();
+
+// Blocks until the garbage collector has less than @max_pending_bytes
+// (estimated) memory left to release.
+void WaitForNodeGc(size_t max_pending_bytes);
+
 class NodeTree {
  public:
   ~NodeTree() { DeallocateTree(); }
@@ -665,6 +775,8 @@ class NodeTree {
   // Root node of a game tree.
   std::unique_ptr<Node> gamebegin_node_;
   PositionHistory history_;
+  // Moves from the game begin to current_head_, one less than history_.
+  std::vector<Move> moves_;
 };
 
 }  // namespace classic
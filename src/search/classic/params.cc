@@ -188,6 +188,28 @@ const OptionId SearchParams::kMaxPrefetchBatchId{
     "When the engine cannot gather a large enough batch for immediate use, try "
     "to prefetch up to X positions which are likely to be useful soon, and put "
     "them into cache."};
+const OptionId SearchParams::kSpeculativePrefetchId{
+    "speculative-prefetch", "SpeculativePrefetch",
+    "Once the search is done, evaluate up to this many unvisited children of "
+    "the principal variation into the cache while waiting for the next "
+    "command, so that the first batches of the next search are cache hits. 0 "
+    "disables it."};
+const OptionId SearchParams::kMiniBatchAutoTuneId{
+    "minibatch-autotune", "MinibatchAutoTune",
+    "Keep adjusting the minibatch size during the search from the measured "
+    "throughput and collision rate, starting from MinibatchSize. "
+    "MaxOutOfOrderEvalsFactor is applied to the adjusted size."};
+const OptionId SearchParams::kMiniBatchMinSizeId{
+    "minibatch-min-size", "MinibatchMinSize",
+    "Smallest minibatch size MinibatchAutoTune may choose."};
+const OptionId SearchParams::kMiniBatchMaxSizeId{
+    "minibatch-max-size", "MinibatchMaxSize",
+    "Largest minibatch size MinibatchAutoTune may choose. Set to 0 to use the "
+    "maximum batch size of the backend."};
+const OptionId SearchParams::kMiniBatchMaxCollisionsId{
+    "minibatch-max-collisions", "MinibatchMaxCollisions",
+    "MinibatchAutoTune shrinks the minibatch while more than this fraction of "
+    "the picked nodes are collisions."};
 const OptionId SearchParams::kCpuctId{
     "cpuct", "CPuct",
     "cpuct_init constant from \"UCT search\" algorithm. Higher values promote "
@@ -268,6 +290,12 @@ const OptionId SearchParams::kVerboseStatsId{
 const OptionId SearchParams::kLogLiveStatsId{
     "log-live-stats", "LogLiveStats",
     "Do VerboseMoveStats on every info update."};
+#ifdef LC0_SEARCH_PROFILING
+const OptionId SearchParams::kSearchProfileId{
+    "search-profile", "SearchProfile",
+    "Report where the search workers spent their time, by iteration phase, "
+    "as info strings when the search ends."};
+#endif
 const OptionId SearchParams::kFpuStrategyId{
     "fpu-strategy", "FpuStrategy",
     "How is an eval of unvisited node determined. \"First Play Urgency\" "
@@ -291,12 +319,6 @@ const OptionId SearchParams::kFpuValueAtRootId{
     "\"First Play Urgency\" value used to adjust unvisited root children eval "
     "based on --fpu-strategy-at-root. Has no effect if --fpu-strategy-at-root "
     "is \"same\"."};
-const OptionId SearchParams::kCacheHistoryLengthId{
-    "cache-history-length", "CacheHistoryLength",
-    "Length of history, in half-moves, to include into the cache key. When "
-    "this value is less than history that NN uses to eval a position, it's "
-    "possble that the search will use eval of the same position with different "
-    "history taken from cache."};
 const OptionId SearchParams::kMaxCollisionVisitsId{
     "max-collision-visits", "MaxCollisionVisits",
     "Total allowed node collision visits, per batch."};
@@ -324,6 +346,15 @@ const OptionId SearchParams::kSyzygyFastPlayId{
     "syzygy-fast-play", "SyzygyFastPlay",
     "With DTZ tablebase files, only allow the network pick from winning moves "
     "that have shortest DTZ to play faster (but not necessarily optimally)."};
+const OptionId SearchParams::kSyzygyPrefetchId{
+    "syzygy-prefetch", "SyzygyPrefetch",
+    "Start reading the tablebase data for all positions of a minibatch before "
+    "probing them, so that reads from slow disks overlap."};
+const OptionId SearchParams::kSyzygyProbeThreadsId{
+    "syzygy-probe-threads", "SyzygyProbeThreads",
+    "Number of threads probing tablebases for new nodes while their batch is "
+    "being evaluated, so that search threads don't wait for disk reads. 0 "
+    "probes on the search threads."};
 const OptionId SearchParams::kMultiPvId{
     "multipv", "MultiPV",
     "Number of game play lines (principal variations) to show in UCI info "
@@ -426,11 +457,18 @@ const OptionId SearchParams::kNpsLimitId{
 const OptionId SearchParams::kSolidTreeThresholdId{
     "solid-tree-threshold", "SolidTreeThreshold",
     "Only nodes with at least this number of visits will be considered for "
-    "solidification for improved cache locality."};
+    "solidification for improved cache locality. The threshold is raised "
+    "during the search when solidification takes too long."};
 const OptionId SearchParams::kTaskWorkersPerSearchWorkerId{
     "task-workers", "TaskWorkers",
     "The number of task workers to use to help the search worker. Setting to "
     "-1 will use a heuristic value."};
+const OptionId SearchParams::kThreadPlacementId{
+    "thread-placement", "ThreadPlacement",
+    "Binding of the search, task worker, backend and garbage collection "
+    "threads to NUMA nodes: 'compact' fills one node before the next, "
+    "'scatter' spreads the search workers over the nodes (each with its task "
+    "workers), 'gpu' uses the node nearest to the GPU."};
 const OptionId SearchParams::kMinimumWorkSizeForProcessingId{
     "minimum-processing-work", "MinimumProcessingWork",
     "This many visits need to be gathered before tasks will be used to "
@@ -477,12 +515,21 @@ const OptionId SearchParams::kUCIRatingAdvId{
 const OptionId SearchParams::kSearchSpinBackoffId{
     "search-spin-backoff", "SearchSpinBackoff",
     "Enable backoff for the spin lock that acquires available searcher."};
+const OptionId SearchParams::kPipelinedSearchId{
+    "pipelined-search", "PipelinedSearch",
+    "Gather the next minibatch while the previous one is being computed by the "
+    "backend, so that a single search thread can keep the backend busy."};
 
 void SearchParams::Populate(OptionsParser* options) {
   // Here the uci optimized defaults" are set.
   // Many of them are overridden with training specific values in tournament.cc.
   options->Add<IntOption>(kMiniBatchSizeId, 0, 1024) = 0;
   options->Add<IntOption>(kMaxPrefetchBatchId, 0, 1024) = DEFAULT_MAX_PREFETCH;
+  options->Add<IntOption>(kSpeculativePrefetchId, 0, 100000) = 0;
+  options->Add<BoolOption>(kMiniBatchAutoTuneId) = false;
+  options->Add<IntOption>(kMiniBatchMinSizeId, 1, 1024) = 16;
+  options->Add<IntOption>(kMiniBatchMaxSizeId, 0, 1024) = 0;
+  options->Add<FloatOption>(kMiniBatchMaxCollisionsId, 0.0f, 1.0f) = 0.3f;
   options->Add<FloatOption>(kCpuctId, 0.0f, 100.0f) = 1.745f;
   options->Add<FloatOption>(kCpuctAtRootId, 0.0f, 100.0f) = 1.745f;
   options->Add<FloatOption>(kCpuctBaseId, 1.0f, 1000000000.0f) = 38739.0f;
@@ -503,13 +550,15 @@ void SearchParams::Populate(OptionsParser* options) {
   options->Add<FloatOption>(kNoiseAlphaId, 0.0f, 10000000.0f) = 0.3f;
   options->Add<BoolOption>(kVerboseStatsId) = false;
   options->Add<BoolOption>(kLogLiveStatsId) = false;
+#ifdef LC0_SEARCH_PROFILING
+  options->Add<BoolOption>(kSearchProfileId) = false;
+#endif
   std::vector<std::string> fpu_strategy = {"reduction", "absolute"};
   options->Add<ChoiceOption>(kFpuStrategyId, fpu_strategy) = "reduction";
   options->Add<FloatOption>(kFpuValueId, -100.0f, 100.0f) = 0.330f;
   fpu_strategy.push_back("same");
   options->Add<ChoiceOption>(kFpuStrategyAtRootId, fpu_strategy) = "same";
   options->Add<FloatOption>(kFpuValueAtRootId, -100.0f, 100.0f) = 1.0f;
-  options->Add<IntOption>(kCacheHistoryLengthId, 0, 7) = 0;
   options->Add<IntOption>(kMaxCollisionEventsId, 1, 65536) = 917;
   options->Add<IntOption>(kMaxCollisionVisitsId, 1, 100000000) = 80000;
   options->Add<IntOption>(kMaxCollisionVisitsScalingStartId, 1, 100000) = 28;
@@ -521,6 +570,8 @@ void SearchParams::Populate(OptionsParser* options) {
   options->Add<FloatOption>(kMaxOutOfOrderEvalsFactorId, 0.0f, 100.0f) = 2.4f;
   options->Add<BoolOption>(kStickyEndgamesId) = true;
   options->Add<BoolOption>(kSyzygyFastPlayId) = false;
+  options->Add<BoolOption>(kSyzygyPrefetchId) = false;
+  options->Add<IntOption>(kSyzygyProbeThreadsId, 0, 64) = 0;
   options->Add<IntOption>(kMultiPvId, 1, 500) = 1;
   options->Add<BoolOption>(kPerPvCountersId) = false;
   std::vector<std::string> score_type = {"centipawn",
@@ -560,6 +611,9 @@ void SearchParams::Populate(OptionsParser* options) {
   options->Add<FloatOption>(kNpsLimitId, 0.0f, 1e6f) = 0.0f;
   options->Add<IntOption>(kSolidTreeThresholdId, 1, 2000000000) = 100;
   options->Add<IntOption>(kTaskWorkersPerSearchWorkerId, -1, 128) = -1;
+  std::vector<std::string> thread_placement = {"none", "compact", "scatter",
+                                               "gpu"};
+  options->Add<ChoiceOption>(kThreadPlacementId, thread_placement) = "none";
   options->Add<IntOption>(kMinimumWorkSizeForProcessingId, 2, 100000) = 20;
   options->Add<IntOption>(kMinimumWorkSizeForPickingId, 1, 100000) = 1;
   options->Add<IntOption>(kMinimumRemainingWorkSizeForPickingId, 0, 100000) =
@@ -570,6 +624,7 @@ void SearchParams::Populate(OptionsParser* options) {
   options->Add<StringOption>(kUCIOpponentId);
   options->Add<FloatOption>(kUCIRatingAdvId, -10000.0f, 10000.0f) = 0.0f;
   options->Add<BoolOption>(kSearchSpinBackoffId) = false;
+  options->Add<BoolOption>(kPipelinedSearchId) = false;
 
   options->HideOption(kNoiseEpsilonId);
   options->HideOption(kNoiseAlphaId);
@@ -620,7 +675,6 @@ SearchParams::SearchParams(const OptionsDict& options)
       kFpuValueAtRoot(options.Get<std::string>(kFpuStrategyAtRootId) == "same"
                           ? kFpuValue
                           : options.Get<float>(kFpuValueAtRootId)),
-      kCacheHistoryLength(options.Get<int>(kCacheHistoryLengthId)),
       kPolicySoftmaxTemp(
           options.Get<float>(SharedBackendParams::kPolicySoftmaxTemp)),
       kMaxCollisionEvents(options.Get<int>(kMaxCollisionEventsId)),
@@ -628,6 +682,8 @@ SearchParams::SearchParams(const OptionsDict& options)
       kOutOfOrderEval(options.Get<bool>(kOutOfOrderEvalId)),
       kStickyEndgames(options.Get<bool>(kStickyEndgamesId)),
       kSyzygyFastPlay(options.Get<bool>(kSyzygyFastPlayId)),
+      kSyzygyPrefetch(options.Get<bool>(kSyzygyPrefetchId)),
+      kSyzygyProbeThreads(options.Get<int>(kSyzygyProbeThreadsId)),
       kHistoryFill(EncodeHistoryFill(
           options.Get<std::string>(SharedBackendParams::kHistoryFill))),
       kMiniBatchSize(options.Get<int>(kMiniBatchSizeId)),
@@ -664,6 +720,8 @@ SearchParams::SearchParams(const OptionsDict& options)
       kSolidTreeThreshold(options.Get<int>(kSolidTreeThresholdId)),
       kTaskWorkersPerSearchWorker(
           options.Get<int>(kTaskWorkersPerSearchWorkerId)),
+      kThreadPlacement(Numa::ParsePlacement(
+          options.Get<std::string>(kThreadPlacementId))),
       kMinimumWorkSizeForProcessing(
           options.Get<int>(kMinimumWorkSizeForProcessingId)),
       kMinimumWorkSizeForPicking(
@@ -680,7 +738,8 @@ SearchParams::SearchParams(const OptionsDict& options)
           options.Get<int>(kMaxCollisionVisitsScalingEndId)),
       kMaxCollisionVisitsScalingPower(
           options.Get<float>(kMaxCollisionVisitsScalingPowerId)),
-      kSearchSpinBackoff(options_.Get<bool>(kSearchSpinBackoffId)) {}
+      kSearchSpinBackoff(options_.Get<bool>(kSearchSpinBackoffId)),
+      kPipelinedSearch(options_.Get<bool>(kPipelinedSearchId)) {}
 
 }  // namespace classic
 }  // namespace lczero
@@ -28,6 +28,7 @@
 #pragma once
 
 #include "neural/encoder.h"
+#include "utils/numa.h"
 #include "utils/optionsdict.h"
 #include "utils/optionsparser.h"
 
@@ -59,6 +60,21 @@ class SearchParams {
   int GetMaxPrefetchBatch() const {
     return options_.Get<int>(kMaxPrefetchBatchId);
   }
+  int GetSpeculativePrefetch() const {
+    return options_.Get<int>(kSpeculativePrefetchId);
+  }
+  bool GetMiniBatchAutoTune() const {
+    return options_.Get<bool>(kMiniBatchAutoTuneId);
+  }
+  int GetMiniBatchMinSize() const {
+    return options_.Get<int>(kMiniBatchMinSizeId);
+  }
+  int GetMiniBatchMaxSize() const {
+    return options_.Get<int>(kMiniBatchMaxSizeId);
+  }
+  float GetMiniBatchMaxCollisions() const {
+    return options_.Get<float>(kMiniBatchMaxCollisionsId);
+  }
   float GetCpuct(bool at_root) const { return at_root ? kCpuctAtRoot : kCpuct; }
   float GetCpuctBase(bool at_root) const {
     return at_root ? kCpuctBaseAtRoot : kCpuctBase;
@@ -88,19 +104,23 @@ class SearchParams {
   float GetNoiseAlpha() const { return kNoiseAlpha; }
   bool GetVerboseStats() const { return options_.Get<bool>(kVerboseStatsId); }
   bool GetLogLiveStats() const { return options_.Get<bool>(kLogLiveStatsId); }
+#ifdef LC0_SEARCH_PROFILING
+  bool GetSearchProfile() const { return options_.Get<bool>(kSearchProfileId); }
+#endif
   bool GetFpuAbsolute(bool at_root) const {
     return at_root ? kFpuAbsoluteAtRoot : kFpuAbsolute;
   }
   float GetFpuValue(bool at_root) const {
     return at_root ? kFpuValueAtRoot : kFpuValue;
   }
-  int GetCacheHistoryLength() const { return kCacheHistoryLength; }
   float GetPolicySoftmaxTemp() const { return kPolicySoftmaxTemp; }
   int GetMaxCollisionEvents() const { return kMaxCollisionEvents; }
   int GetMaxCollisionVisits() const { return kMaxCollisionVisits; }
   bool GetOutOfOrderEval() const { return kOutOfOrderEval; }
   bool GetStickyEndgames() const { return kStickyEndgames; }
   bool GetSyzygyFastPlay() const { return kSyzygyFastPlay; }
+  bool GetSyzygyPrefetch() const { return kSyzygyPrefetch; }
+  int GetSyzygyProbeThreads() const { return kSyzygyProbeThreads; }
   int GetMultiPv() const { return options_.Get<int>(kMultiPvId); }
   bool GetPerPvCounters() const { return options_.Get<bool>(kPerPvCountersId); }
   std::string GetScoreType() const {
@@ -138,6 +158,7 @@ class SearchParams {
   int GetTaskWorkersPerSearchWorker() const {
     return kTaskWorkersPerSearchWorker;
   }
+  Numa::Placement GetThreadPlacement() const { return kThreadPlacement; }
   int GetMinimumWorkSizeForProcessing() const {
     return kMinimumWorkSizeForProcessing;
   }
@@ -162,10 +183,16 @@ class SearchParams {
     return kMaxCollisionVisitsScalingPower;
   }
   bool GetSearchSpinBackoff() const { return kSearchSpinBackoff; }
+  bool GetPipelinedSearch() const { return kPipelinedSearch; }
 
   // Search parameter IDs.
   static const OptionId kMiniBatchSizeId;
   static const OptionId kMaxPrefetchBatchId;
+  static const OptionId kSpeculativePrefetchId;
+  static const OptionId kMiniBatchAutoTuneId;
+  static const OptionId kMiniBatchMinSizeId;
+  static const OptionId kMiniBatchMaxSizeId;
+  static const OptionId kMiniBatchMaxCollisionsId;
   static const OptionId kCpuctId;
   static const OptionId kCpuctAtRootId;
   static const OptionId kCpuctBaseId;
@@ -185,16 +212,20 @@ class SearchParams {
   static const OptionId kNoiseAlphaId;
   static const OptionId kVerboseStatsId;
   static const OptionId kLogLiveStatsId;
+#ifdef LC0_SEARCH_PROFILING
+  static const OptionId kSearchProfileId;
+#endif
   static const OptionId kFpuStrategyId;
   static const OptionId kFpuValueId;
   static const OptionId kFpuStrategyAtRootId;
   static const OptionId kFpuValueAtRootId;
-  static const OptionId kCacheHistoryLengthId;
   static const OptionId kMaxCollisionEventsId;
   static const OptionId kMaxCollisionVisitsId;
   static const OptionId kOutOfOrderEvalId;
   static const OptionId kStickyEndgamesId;
   static const OptionId kSyzygyFastPlayId;
+  static const OptionId kSyzygyPrefetchId;
+  static const OptionId kSyzygyProbeThreadsId;
   static const OptionId kMultiPvId;
   static const OptionId kPerPvCountersId;
   static const OptionId kScoreTypeId;
@@ -220,6 +251,7 @@ class SearchParams {
   static const OptionId kNpsLimitId;
   static const OptionId kSolidTreeThresholdId;
   static const OptionId kTaskWorkersPerSearchWorkerId;
+  static const OptionId kThreadPlacementId;
   static const OptionId kMinimumWorkSizeForProcessingId;
   static const OptionId kMinimumWorkSizeForPickingId;
   static const OptionId kMinimumRemainingWorkSizeForPickingId;
@@ -232,6 +264,7 @@ class SearchParams {
   static const OptionId kUCIOpponentId;
   static const OptionId kUCIRatingAdvId;
   static const OptionId kSearchSpinBackoffId;
+  static const OptionId kPipelinedSearchId;
 
  private:
   const OptionsDict& options_;
@@ -254,13 +287,14 @@ class SearchParams {
   const float kFpuValue;
   const bool kFpuAbsoluteAtRoot;
   const float kFpuValueAtRoot;
-  const int kCacheHistoryLength;
   const float kPolicySoftmaxTemp;
   const int kMaxCollisionEvents;
   const int kMaxCollisionVisits;
   const bool kOutOfOrderEval;
   const bool kStickyEndgames;
   const bool kSyzygyFastPlay;
+  const bool kSyzygyPrefetch;
+  const int kSyzygyProbeThreads;
   const FillEmptyHistory kHistoryFill;
   const int kMiniBatchSize;
   const float kMovesLeftMaxEffect;
@@ -279,6 +313,7 @@ class SearchParams {
   const float kNpsLimit;
   const int kSolidTreeThreshold;
   const int kTaskWorkersPerSearchWorker;
+  const Numa::Placement kThreadPlacement;
   const int kMinimumWorkSizeForProcessing;
   const int kMinimumWorkSizeForPicking;
   const int kMinimumRemainingWorkSizeForPicking;
@@ -289,6 +324,7 @@ class SearchParams {
   const int kMaxCollisionVisitsScalingEnd;
   const float kMaxCollisionVisitsScalingPower;
   const bool kSearchSpinBackoff;
+  const bool kPipelinedSearch;
 };
 
 }  // namespace classic
@@ -0,0 +1,127 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+#ifdef LC0_SEARCH_PROFILING
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#endif
+#endif
+
+namespace lczero {
+namespace classic {
+
+// Phases of a search worker iteration which are timed when the search is
+// built with -Dsearch_profiling=true.
+enum class SearchPhase {
+  kGather,
+  kCollisions,
+  kPrefetch,
+  kCompute,
+  kFetch,
+  kBackup,
+  // Time spent waiting to acquire nodes_mutex_, also included in the phase
+  // that was waiting.
+  kNodesLockWait,
+  kCount
+};
+
+// Raw clock ticks and number of timed sections per phase. Ticks are TSC
+// cycles on x86 and steady_clock nanoseconds elsewhere; ToSeconds() converts
+// them using a tick rate measured over the whole search.
+struct PhaseProfile {
+  static constexpr size_t kPhases = static_cast<size_t>(SearchPhase::kCount);
+
+  std::array<uint64_t, kPhases> ticks = {};
+  std::array<uint64_t, kPhases> calls = {};
+
+  static uint64_t Now() {
+#ifdef LC0_SEARCH_PROFILING
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+    defined(_M_IX86)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+#else
+    return 0;
+#endif
+  }
+
+  // Accounts the time since @start to @phase.
+  void AddSince([[maybe_unused]] SearchPhase phase,
+                [[maybe_unused]] uint64_t start) {
+#ifdef LC0_SEARCH_PROFILING
+    const size_t idx = static_cast<size_t>(phase);
+    ticks[idx] += Now() - start;
+    ++calls[idx];
+#endif
+  }
+
+  void Add(const PhaseProfile& other) {
+    for (size_t i = 0; i < kPhases; ++i) {
+      ticks[i] += other.ticks[i];
+      calls[i] += other.calls[i];
+    }
+  }
+
+  void Reset() { *this = PhaseProfile(); }
+};
+
+// Times the enclosing scope into a phase of a PhaseProfile. Compiles to
+// nothing unless LC0_SEARCH_PROFILING is defined.
+class ScopedPhaseTimer {
+ public:
+  ScopedPhaseTimer(PhaseProfile* profile, SearchPhase phase)
+#ifdef LC0_SEARCH_PROFILING
+      : profile_(profile), phase_(phase), start_(PhaseProfile::Now()) {
+  }
+  ~ScopedPhaseTimer() { profile_->AddSince(phase_, start_); }
+
+ private:
+  PhaseProfile* const profile_;
+  const SearchPhase phase_;
+  const uint64_t start_;
+#else
+  {
+    (void)profile;
+    (void)phase;
+  }
+#endif
+};
+
+}  // namespace classic
+}  // namespace lczero
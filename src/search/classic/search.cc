@@ -29,6 +29,7 @@
 
 #include <algorithm>
 #include <array>
+#include <bit>
 #include <chrono>
 #include <cmath>
 #include <iomanip>
@@ -37,12 +38,20 @@
 #include <sstream>
 #include <thread>
 
-#include "neural/cache.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 #include "neural/encoder.h"
 #include "search/classic/node.h"
+#include "search/classic/stoppers/common.h"
 #include "utils/fastmath.h"
+#include "utils/metrics.h"
 #include "utils/random.h"
 #include "utils/spinhelper.h"
+#include "utils/trace.h"
 
 namespace lczero {
 namespace classic {
@@ -51,6 +60,13 @@ namespace {
 // Maximum delay between outputting "uci info" when nothing interesting happens.
 const int kUciInfoMinimumFrequencyMs = 5000;
 
+MetricCounter* const kPlayoutsMetric = Metrics::Get().AddCounter(
+    "search_playouts", "Playouts backed up by the search workers.");
+MetricCounter* const kBatchesMetric = Metrics::Get().AddCounter(
+    "search_batches", "Minibatches backed up by the search workers.");
+MetricCounter* const kTbHitsMetric = Metrics::Get().AddCounter(
+    "search_tb_hits", "Search nodes resolved by tablebase probes.");
+
 MoveList MakeRootMoveFilter(const MoveList& searchmoves,
                             SyzygyTablebase* syzygy_tb,
                             const PositionHistory& history, bool fast_play,
@@ -156,13 +172,18 @@ Search::Search(const NodeTree& tree, Backend* backend,
                std::chrono::steady_clock::time_point start_time,
                std::unique_ptr<SearchStopper> stopper, bool infinite,
                bool ponder, const OptionsDict& options,
-               SyzygyTablebase* syzygy_tb)
+               SyzygyTablebase* syzygy_tb,
+               SpeculativePrefetchLog* speculative_log,
+               ProvenBoundsTable* proven_bounds)
     : ok_to_respond_bestmove_(!infinite && !ponder),
       stopper_(std::move(stopper)),
+      move_start_time_(start_time),
       root_node_(tree.GetCurrentHead()),
       syzygy_tb_(syzygy_tb),
       played_history_(tree.GetPositionHistory()),
       backend_(backend),
+      speculative_log_(speculative_log),
+      proven_bounds_(proven_bounds),
       backend_attributes_(backend->GetAttributes()),
       params_(options),
       searchmoves_(searchmoves),
@@ -171,7 +192,15 @@ Search::Search(const NodeTree& tree, Backend* backend,
       root_move_filter_(MakeRootMoveFilter(
           searchmoves_, syzygy_tb_, played_history_,
           params_.GetSyzygyFastPlay(), &tb_hits_, &root_is_in_dtz_)),
+      solid_threshold_(params_.GetSolidTreeThreshold()),
+      compaction_nodes_limit_(
+          infinite || ponder ? GetTreeCompactionNodesLimit(options) : 0),
       uci_responder_(std::move(uci_responder)) {
+  Numa::SetPlacement(params_.GetThreadPlacement());
+  if (syzygy_tb_ && params_.GetSyzygyProbeThreads() > 0) {
+    tb_probe_service_ = std::make_unique<SyzygyProbeService>(
+        syzygy_tb_, params_.GetSyzygyProbeThreads());
+  }
   if (params_.GetMaxConcurrentSearchers() != 0) {
     pending_searchers_.store(params_.GetMaxConcurrentSearchers(),
                              std::memory_order_release);
@@ -259,7 +288,8 @@ inline double WDLRescale(float& v, float& d, float wdl_rescale_ratio,
 }
 }  // namespace
 
-void Search::SendUciInfo() REQUIRES(nodes_mutex_) REQUIRES(counters_mutex_) {
+std::vector<ThinkingInfo> Search::GetUciInfo() REQUIRES(info_mutex_)
+    REQUIRES_SHARED(nodes_mutex_) REQUIRES(counters_mutex_) {
   const auto max_pv = params_.GetMultiPv();
   const auto edges = GetBestChildrenNoTemperature(root_node_, max_pv, 0);
   const auto score_type = params_.GetScoreType();
@@ -273,8 +303,9 @@ void Search::SendUciInfo() REQUIRES(nodes_mutex_) REQUIRES(counters_mutex_) {
   common_info.depth = cum_depth_ / (total_playouts_ ? total_playouts_ : 1);
   common_info.seldepth = max_depth_;
   common_info.time = GetTimeSinceStart();
+  const auto helpers_playouts = GetRootHelpersPlayouts();
   if (!per_pv_counters) {
-    common_info.nodes = total_playouts_ + initial_visits_;
+    common_info.nodes = total_playouts_ + initial_visits_ + helpers_playouts;
   }
   if (nps_start_time_) {
     const auto time_since_first_batch_ms =
@@ -282,7 +313,8 @@ void Search::SendUciInfo() REQUIRES(nodes_mutex_) REQUIRES(counters_mutex_) {
             std::chrono::steady_clock::now() - *nps_start_time_)
             .count();
     if (time_since_first_batch_ms > 0) {
-      common_info.nps = total_playouts_ * 1000 / time_since_first_batch_ms;
+      common_info.nps = (total_playouts_ + helpers_playouts) * 1000 /
+                        time_since_first_batch_ms;
     }
   }
   common_info.tb_hits = tb_hits_.load(std::memory_order_acquire);
@@ -376,33 +408,49 @@ void Search::SendUciInfo() REQUIRES(nodes_mutex_) REQUIRES(counters_mutex_) {
   if (current_best_edge_ && !edges.empty()) {
     last_outputted_info_edge_ = current_best_edge_.edge();
   }
+  return uci_infos;
+}
 
+void Search::SendUciInfo() REQUIRES(info_mutex_) REQUIRES_SHARED(nodes_mutex_)
+    REQUIRES(counters_mutex_) {
+  auto uci_infos = GetUciInfo();
   uci_responder_->OutputThinkingInfo(&uci_infos);
 }
 
 // Decides whether anything important changed in stats and new info should be
-// shown to a user.
+// shown to a user. The info is collected under a shared nodes lock, so that
+// pickers are never blocked by it, and is formatted and sent only after the
+// lock is released. info_mutex_ keeps the output ordered with the bestmove.
 void Search::MaybeOutputInfo() {
-  SharedMutex::Lock lock(nodes_mutex_);
-  Mutex::Lock counters_lock(counters_mutex_);
-  if (!bestmove_is_sent_ && current_best_edge_ &&
-      (current_best_edge_.edge() != last_outputted_info_edge_ ||
-       last_outputted_uci_info_.depth !=
-           static_cast<int>(cum_depth_ /
-                            (total_playouts_ ? total_playouts_ : 1)) ||
-       last_outputted_uci_info_.seldepth != max_depth_ ||
-       last_outputted_uci_info_.time + kUciInfoMinimumFrequencyMs <
-           GetTimeSinceStart())) {
-    SendUciInfo();
-    if (params_.GetLogLiveStats()) {
-      SendMovesStats();
-    }
-    if (stop_.load(std::memory_order_acquire) && !ok_to_respond_bestmove_) {
-      std::vector<ThinkingInfo> info(1);
-      info.back().comment =
-          "WARNING: Search has reached limit and does not make any progress.";
-      uci_responder_->OutputThinkingInfo(&info);
+  Mutex::Lock info_lock(info_mutex_);
+  std::vector<ThinkingInfo> uci_infos;
+  std::vector<std::string> move_stats;
+  bool no_progress = false;
+  {
+    BrSharedMutex::SharedLock lock(nodes_mutex_);
+    Mutex::Lock counters_lock(counters_mutex_);
+    if (bestmove_is_sent_ || !current_best_edge_ ||
+        (current_best_edge_.edge() == last_outputted_info_edge_ &&
+         last_outputted_uci_info_.depth ==
+             static_cast<int>(cum_depth_ /
+                              (total_playouts_ ? total_playouts_ : 1)) &&
+         last_outputted_uci_info_.seldepth == max_depth_ &&
+         last_outputted_uci_info_.time + kUciInfoMinimumFrequencyMs >=
+             GetTimeSinceStart())) {
+      return;
     }
+    uci_infos = GetUciInfo();
+    if (params_.GetLogLiveStats()) move_stats = GetVerboseStats(root_node_);
+    no_progress =
+        stop_.load(std::memory_order_acquire) && !ok_to_respond_bestmove_;
+  }
+  uci_responder_->OutputThinkingInfo(&uci_infos);
+  if (!move_stats.empty()) OutputMovesStats(move_stats);
+  if (no_progress) {
+    std::vector<ThinkingInfo> info(1);
+    info.back().comment =
+        "WARNING: Search has reached limit and does not make any progress.";
+    uci_responder_->OutputThinkingInfo(&info);
   }
 }
 
@@ -452,6 +500,46 @@ inline float ComputeCpuct(const SearchParams& params, uint32_t N,
   const float base = params.GetCpuctBase(is_root_node);
   return init + (k ? k * FastLog((N + base) / base) : 0.0f);
 }
+
+// Returns the largest of scores[0..count), or lowest() if count is 0.
+inline float MaxScore(const float* scores, int count) {
+  float best = std::numeric_limits<float>::lowest();
+  int i = 0;
+#if defined(__AVX2__)
+  if (count >= 8) {
+    __m256 max8 = _mm256_loadu_ps(scores);
+    for (i = 8; i + 8 <= count; i += 8) {
+      max8 = _mm256_max_ps(max8, _mm256_loadu_ps(scores + i));
+    }
+    __m128 max4 = _mm_max_ps(_mm256_castps256_ps128(max8),
+                             _mm256_extractf128_ps(max8, 1));
+    max4 = _mm_max_ps(max4, _mm_movehl_ps(max4, max4));
+    max4 = _mm_max_ss(max4, _mm_shuffle_ps(max4, max4, 1));
+    best = _mm_cvtss_f32(max4);
+  }
+#elif defined(__aarch64__)
+  if (count >= 4) {
+    float32x4_t max4 = vld1q_f32(scores);
+    for (i = 4; i + 4 <= count; i += 4) {
+      max4 = vmaxq_f32(max4, vld1q_f32(scores + i));
+    }
+    best = vmaxvq_f32(max4);
+  }
+#endif
+  for (; i < count; ++i) best = std::max(best, scores[i]);
+  return best;
+}
+
+// Finds the best and second best of scores[0..count), count > 0, the same way
+// as the scalar PUCT loop: the first index wins among equal best scores.
+inline void FindBestScores(const float* scores, int count, int* best_idx,
+                           float* best, float* second_best) {
+  *best = MaxScore(scores, count);
+  *best_idx = std::find(scores, scores + count, *best) - scores;
+  *second_best = std::max(MaxScore(scores, *best_idx),
+                          MaxScore(scores + *best_idx + 1,
+                                   count - *best_idx - 1));
+}
 }  // namespace
 
 std::vector<std::string> Search::GetVerboseStats(Node* node) const {
@@ -569,9 +657,8 @@ std::vector<std::string> Search::GetVerboseStats(Node* node) const {
   return infos;
 }
 
-void Search::SendMovesStats() const REQUIRES(counters_mutex_) {
-  auto move_stats = GetVerboseStats(root_node_);
-
+void Search::OutputMovesStats(
+    const std::vector<std::string>& move_stats) const {
   if (params_.GetVerboseStats()) {
     std::vector<ThinkingInfo> infos;
     std::transform(move_stats.begin(), move_stats.end(),
@@ -585,6 +672,10 @@ void Search::SendMovesStats() const REQUIRES(counters_mutex_) {
     LOGFILE << "=== Move stats:";
     for (const auto& line : move_stats) LOGFILE << line;
   }
+}
+
+void Search::SendMovesStats() const REQUIRES(counters_mutex_) {
+  OutputMovesStats(GetVerboseStats(root_node_));
   for (auto& edge : root_node_->Edges()) {
     if (!(edge.GetMove(played_history_.IsBlackToMove()) == final_bestmove_)) {
       continue;
@@ -640,7 +731,8 @@ void Search::MaybeTriggerStop(const IterationStats& stats,
   if (params_.GetNpsLimit() > 0) {
     hints->UpdateEstimatedNps(params_.GetNpsLimit());
   }
-  SharedMutex::Lock nodes_lock(nodes_mutex_);
+  Mutex::Lock info_lock(info_mutex_);
+  BrSharedMutex::Lock nodes_lock(nodes_mutex_);
   Mutex::Lock lock(counters_mutex_);
   // Already responded bestmove, nothing to do here.
   if (bestmove_is_sent_) return;
@@ -654,9 +746,14 @@ void Search::MaybeTriggerStop(const IterationStats& stats,
   // If we are the first to see that stop is needed.
   if (stop_.load(std::memory_order_acquire) && ok_to_respond_bestmove_ &&
       !bestmove_is_sent_) {
+    for (auto* helper : root_helpers_) helper->Abort();
     SendUciInfo();
     EnsureBestMoveKnown();
     SendMovesStats();
+    FillArtifacts();
+#ifdef LC0_SEARCH_PROFILING
+    if (params_.GetSearchProfile()) SendPhaseProfile();
+#endif
     BestMoveInfo info(final_bestmove_, final_pondermove_);
     uci_responder_->OutputBestMove(&info);
     stopper_->OnSearchDone(stats);
@@ -669,7 +766,7 @@ void Search::MaybeTriggerStop(const IterationStats& stats,
 // settings. This differs from GetBestMove, which does obey any temperature
 // settings. So, somethimes, they may return results of different moves.
 Eval Search::GetBestEval(Move* move, bool* is_terminal) const {
-  SharedMutex::SharedLock lock(nodes_mutex_);
+  BrSharedMutex::SharedLock lock(nodes_mutex_);
   Mutex::Lock counters_lock(counters_mutex_);
   float parent_wl = -root_node_->GetWL();
   float parent_d = root_node_->GetD();
@@ -683,19 +780,158 @@ Eval Search::GetBestEval(Move* move, bool* is_terminal) const {
 }
 
 std::pair<Move, Move> Search::GetBestMove() {
-  SharedMutex::Lock lock(nodes_mutex_);
+  BrSharedMutex::Lock lock(nodes_mutex_);
   Mutex::Lock counters_lock(counters_mutex_);
   EnsureBestMoveKnown();
   return {final_bestmove_, final_pondermove_};
 }
 
+void Search::AddRootHelper(Search* helper) {
+  helper->helped_search_playouts_ = &root_helpers_playouts_;
+  root_helpers_.push_back(helper);
+}
+
+std::vector<std::pair<Move, uint32_t>> Search::GetRootVisits() const {
+  BrSharedMutex::SharedLock lock(nodes_mutex_);
+  std::vector<std::pair<Move, uint32_t>> visits;
+  if (root_node_->GetN() == 0) return visits;
+  for (const auto& edge : root_node_->Edges()) {
+    visits.emplace_back(edge.GetMove(), edge.GetN());
+  }
+  return visits;
+}
+
+SearchArtifacts Search::GetArtifacts() const {
+  Mutex::Lock lock(counters_mutex_);
+  return artifacts_;
+}
+
+void Search::FillArtifacts() {
+  SearchArtifacts& artifacts = artifacts_;
+  const bool is_black = played_history_.IsBlackToMove();
+  const float parent_wl = -root_node_->GetWL();
+  const float parent_d = root_node_->GetD();
+  const float parent_m = root_node_->GetM();
+  artifacts.root_visits = root_node_->GetN();
+  artifacts.root_eval = {parent_wl, parent_d, parent_m};
+  artifacts.best_eval = artifacts.root_eval;
+  if (root_node_->HasChildren()) {
+    EdgeAndNode best_edge = GetBestChildNoTemperature(root_node_, 0);
+    artifacts.best_move = best_edge.GetMove(is_black);
+    artifacts.best_is_terminal = best_edge.IsTerminal();
+    artifacts.best_eval = {best_edge.GetWL(parent_wl), best_edge.GetD(parent_d),
+                           best_edge.GetM(parent_m - 1) + 1};
+  }
+
+  const std::optional<EvalResult> nneval = GetCachedNNEval(root_node_);
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  artifacts.orig_eval = nneval ? SearchArtifacts::Eval{nneval->q, nneval->d,
+                                                       nneval->m}
+                               : SearchArtifacts::Eval{nan, nan, nan};
+  // The cached policy is in the order of the edges, with the softmax
+  // temperature applied.
+  const uint32_t total_n = root_node_->GetChildrenVisits();
+  const float softmax_temp = params_.GetPolicySoftmaxTemp();
+  float kld_sum = 0.0f;
+  float total_p = 0.0f;
+  artifacts.root_moves.clear();
+  artifacts.root_moves.reserve(root_node_->GetNumEdges());
+  int idx = 0;
+  for (const auto& edge : root_node_->Edges()) {
+    artifacts.root_moves.push_back(
+        {edge.GetMove(is_black), edge.GetN(),
+         {edge.GetWL(parent_wl), edge.GetD(parent_d),
+          edge.GetM(parent_m - 1) + 1},
+         edge.GetBounds().second});
+    if (nneval) {
+      const float fracv = total_n > 0 ? edge.GetN() / static_cast<float>(total_n)
+                                      : 1.0f;
+      // Undo any softmax temperature in the cached data.
+      const float p = std::pow(nneval->p[idx], softmax_temp);
+      if (fracv > 0) kld_sum += fracv * std::log(fracv / p);
+      total_p += p;
+    }
+    ++idx;
+  }
+  // Add small epsilon for backward compatibility with earlier value of 0.
+  artifacts.policy_kld =
+      nneval ? std::max(kld_sum + std::log(total_p), 0.0f) +
+                   std::numeric_limits<float>::min()
+             : 0.0f;
+}
+
 std::int64_t Search::GetTotalPlayouts() const {
-  SharedMutex::SharedLock lock(nodes_mutex_);
+  BrSharedMutex::SharedLock lock(nodes_mutex_);
   return total_playouts_;
 }
 
+SearchStats Search::GetStats() const {
+  Mutex::Lock lock(stats_mutex_);
+  return stats_;
+}
+
+void SearchStats::Add(const SearchStats& other) {
+  for (size_t i = 0; i < batch_sizes.size(); ++i) {
+    batch_sizes[i] += other.batch_sizes[i];
+  }
+  batches += other.batches;
+  nn_evals += other.nn_evals;
+  picked_nodes += other.picked_nodes;
+  collisions += other.collisions;
+  cache_hits += other.cache_hits;
+  gather_time += other.gather_time;
+  compute_time += other.compute_time;
+  fetch_time += other.fetch_time;
+  backup_time += other.backup_time;
+}
+
+#ifdef LC0_SEARCH_PROFILING
+void Search::SendPhaseProfile() const {
+  static constexpr const char* kPhaseNames[] = {
+      "gather", "collisions", "prefetch",        "compute",
+      "fetch",  "backup",     "nodes-lock-wait",
+  };
+  static_assert(std::size(kPhaseNames) == PhaseProfile::kPhases);
+  PhaseProfile profile;
+  {
+    Mutex::Lock lock(stats_mutex_);
+    profile = profile_;
+  }
+  // Converts ticks to seconds with the tick rate observed since the search
+  // started, which is exact for the nanosecond fallback and good to a fraction
+  // of a percent for the TSC.
+  const double elapsed_seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                    profile_start_time_)
+          .count();
+  const double ticks_per_second =
+      static_cast<double>(PhaseProfile::Now() - profile_start_ticks_) /
+      std::max(elapsed_seconds, 1e-9);
+  double total_seconds = 0.0;
+  for (size_t i = 0; i < PhaseProfile::kPhases; ++i) {
+    if (i == static_cast<size_t>(SearchPhase::kNodesLockWait)) continue;
+    total_seconds += profile.ticks[i] / ticks_per_second;
+  }
+  std::vector<ThinkingInfo> infos;
+  for (size_t i = 0; i < PhaseProfile::kPhases; ++i) {
+    const double seconds = profile.ticks[i] / ticks_per_second;
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(1) << "profile " << kPhaseNames[i]
+        << ": " << seconds * 1e3 << "ms ("
+        << (total_seconds > 0.0 ? 100.0 * seconds / total_seconds : 0.0)
+        << "%) calls " << profile.calls[i] << " avg "
+        << (profile.calls[i] ? seconds * 1e6 / profile.calls[i] : 0.0)
+        << "us";
+    ThinkingInfo info;
+    info.comment = oss.str();
+    infos.push_back(std::move(info));
+  }
+  uci_responder_->OutputThinkingInfo(&infos);
+}
+#endif
+
 void Search::ResetBestMove() {
-  SharedMutex::Lock nodes_lock(nodes_mutex_);
+  BrSharedMutex::Lock nodes_lock(nodes_mutex_);
   Mutex::Lock lock(counters_mutex_);
   bool old_sent = bestmove_is_sent_;
   bestmove_is_sent_ = false;
@@ -735,6 +971,9 @@ void Search::EnsureBestMoveKnown() REQUIRES(nodes_mutex_)
   auto bestmove_edge = temperature
                            ? GetBestRootChildWithTemperature(temperature)
                            : GetBestChildNoTemperature(root_node_, 0);
+  if (!temperature && !root_helpers_.empty()) {
+    bestmove_edge = GetBestRootChildMerged(bestmove_edge);
+  }
   final_bestmove_ = bestmove_edge.GetMove(played_history_.IsBlackToMove());
 
   if (bestmove_edge.GetN() > 0 && bestmove_edge.node()->HasChildren()) {
@@ -849,6 +1088,51 @@ EdgeAndNode Search::GetBestChildNoTemperature(Node* parent, int depth) const {
   return res.empty() ? EdgeAndNode() : res.front();
 }
 
+EdgeAndNode Search::GetBestRootChildMerged(EdgeAndNode best) const {
+  // Proven wins or losses of this tree are not overruled by visit counts.
+  if (!best || (best.GetN() > 0 && best.IsTerminal() && best.GetWL(0.0f))) {
+    return best;
+  }
+  std::vector<std::pair<Move, uint32_t>> helper_visits;
+  for (const auto* helper : root_helpers_) {
+    for (const auto& [move, n] : helper->GetRootVisits()) {
+      auto iter = std::find_if(
+          helper_visits.begin(), helper_visits.end(),
+          [move](const auto& entry) { return entry.first == move; });
+      if (iter == helper_visits.end()) {
+        helper_visits.emplace_back(move, n);
+      } else {
+        iter->second += n;
+      }
+    }
+  }
+  auto merged_visits = [&](const EdgeAndNode& edge) {
+    uint64_t n = edge.GetN();
+    for (const auto& [move, helper_n] : helper_visits) {
+      if (move == edge.GetMove()) n += helper_n;
+    }
+    return n;
+  };
+  uint64_t best_n = merged_visits(best);
+  for (auto& edge : root_node_->Edges()) {
+    if (!root_move_filter_.empty() &&
+        std::find(root_move_filter_.begin(), root_move_filter_.end(),
+                  edge.GetMove()) == root_move_filter_.end()) {
+      continue;
+    }
+    // Skip proven losses.
+    if (edge.GetN() > 0 && edge.IsTerminal() && edge.GetWL(0.0f) < 0.0f) {
+      continue;
+    }
+    const uint64_t n = merged_visits(edge);
+    if (n > best_n) {
+      best = edge;
+      best_n = n;
+    }
+  }
+  return best;
+}
+
 // Returns a child of a root chosen according to weighted-by-temperature visit
 // count.
 EdgeAndNode Search::GetBestRootChildWithTemperature(float temperature) const {
@@ -925,10 +1209,18 @@ void Search::StartThreads(size_t how_many) {
     threads_.emplace_back([this]() { WatchdogThread(); });
   }
   // Start working threads.
+  running_workers_.fetch_add(how_many, std::memory_order_acq_rel);
   for (size_t i = 0; i < how_many; i++) {
-    threads_.emplace_back([this]() {
-      SearchWorker worker(this, params_);
-      worker.RunBlocking();
+    // The watchdog is the first thread.
+    const int id = threads_.size() - 1;
+    threads_.emplace_back([this, id]() {
+      {
+        SearchWorker worker(this, params_, id);
+        worker.RunBlocking();
+      }
+      running_workers_.fetch_sub(1, std::memory_order_acq_rel);
+      Mutex::Lock lock(counters_mutex_);
+      watchdog_cv_.notify_all();
     });
   }
   LOGFILE << "Search started. "
@@ -948,18 +1240,22 @@ bool Search::IsSearchActive() const {
 }
 
 void Search::PopulateCommonIterationStats(IterationStats* stats) {
-  stats->time_since_movestart = GetTimeSinceStart();
-
-  SharedMutex::SharedLock nodes_lock(nodes_mutex_);
+  BrSharedMutex::SharedLock nodes_lock(nodes_mutex_);
   {
     Mutex::Lock counters_lock(counters_mutex_);
+    stats->time_since_movestart =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - move_start_time_)
+            .count();
     stats->time_since_first_batch = GetTimeSinceFirstBatch();
     if (!nps_start_time_ && total_playouts_ > 0) {
       nps_start_time_ = std::chrono::steady_clock::now();
     }
   }
-  stats->total_nodes = total_playouts_ + initial_visits_;
-  stats->nodes_since_movestart = total_playouts_;
+  // Node limits apply to the playouts of all root parallel trees.
+  const auto helpers_playouts = GetRootHelpersPlayouts();
+  stats->total_nodes = total_playouts_ + initial_visits_ + helpers_playouts;
+  stats->nodes_since_movestart = total_playouts_ + helpers_playouts;
   stats->batches_since_movestart = total_batches_;
   stats->average_depth = cum_depth_ / (total_playouts_ ? total_playouts_ : 1);
   stats->edge_n.clear();
@@ -1025,6 +1321,8 @@ void Search::WatchdogThread() {
   StoppersHints hints;
   IterationStats stats;
   while (true) {
+    MaybeSolidifyTree();
+    MaybeCompactTree();
     PopulateCommonIterationStats(&stats);
     MaybeTriggerStop(stats, &hints);
     MaybeOutputInfo();
@@ -1050,9 +1348,250 @@ void Search::WatchdogThread() {
         lock.get_raw(), std::chrono::milliseconds(remaining_time),
         [this]() { return stop_.load(std::memory_order_acquire); });
   }
+  // The backend is idle until the next search starts, use it for positions
+  // that search will likely need.
+  const int speculative_budget = params_.GetSpeculativePrefetch();
+  if (speculative_budget > 0) SpeculativePrefetch(speculative_budget);
   LOGFILE << "End a watchdog thread.";
 }
 
+void Search::MaybeSolidifyTree() {
+  // Longer passes stall the search workers, shorter ones are not worth
+  // changing the threshold for.
+  constexpr auto kMaxPassTime = std::chrono::milliseconds(2);
+  constexpr uint32_t kMaxThreshold = 1u << 30;
+  BrSharedMutex::Lock lock(nodes_mutex_);
+  if (!solidify_pending_) return;
+  solidify_pending_ = false;
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<Node*> queue = {root_node_};
+  for (size_t i = 0; i < queue.size(); ++i) {
+    Node* node = queue[i];
+    if (node->GetN() >= solid_threshold_ && node->MakeSolid() &&
+        node == root_node_) {
+      // The root children have moved, repopulate current_best_edge_.
+      current_best_edge_ = GetBestChildNoTemperature(root_node_, 0);
+    }
+    for (auto& edge : node->Edges()) {
+      if (edge.GetN() >= solid_threshold_) queue.push_back(edge.node());
+    }
+  }
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  const uint32_t base_threshold = params_.GetSolidTreeThreshold();
+  const uint32_t old_threshold = solid_threshold_;
+  if (elapsed > kMaxPassTime) {
+    if (solid_threshold_ < kMaxThreshold) solid_threshold_ *= 2;
+  } else if (elapsed < kMaxPassTime / 4 && solid_threshold_ > base_threshold) {
+    solid_threshold_ = std::max(base_threshold, solid_threshold_ / 2);
+  }
+  if (solid_threshold_ != old_threshold) {
+    LOGFILE << "Solid tree pass over " << queue.size() << " nodes took "
+            << std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+                   .count()
+            << "us, threshold " << old_threshold << " -> " << solid_threshold_;
+  }
+}
+
+void Search::MaybeCompactTree() {
+  // Nodes with less visits are not walked into, their subtrees are too small
+  // to be worth releasing one by one.
+  constexpr uint32_t kMinReleasedVisits = 64;
+  // Compacts down to that part of the limit, so that passes are rare.
+  constexpr double kTargetFraction = 0.85;
+  if (compaction_nodes_limit_ == 0) return;
+  BrSharedMutex::Lock lock(nodes_mutex_);
+  const int64_t tree_nodes =
+      total_playouts_ + initial_visits_ - compacted_visits_;
+  if (tree_nodes <= compaction_nodes_limit_) return;
+  const auto start = std::chrono::steady_clock::now();
+  const int64_t target =
+      static_cast<int64_t>(compaction_nodes_limit_ * kTargetFraction);
+
+  // Nodes of the walked part of the tree that have no walked children. They
+  // are disjoint subtrees, so releasing one never touches another.
+  struct Candidate {
+    Node* node;
+    float share;
+    int64_t visits;
+  };
+  std::vector<Candidate> candidates;
+  std::vector<Node*> queue = {root_node_};
+  for (size_t i = 0; i < queue.size(); ++i) {
+    Node* node = queue[i];
+    bool has_walked_children = false;
+    int64_t children_visits = 0;
+    for (auto& edge : node->Edges()) {
+      children_visits += edge.GetN();
+      if (edge.GetN() >= kMinReleasedVisits) {
+        queue.push_back(edge.node());
+        has_walked_children = true;
+      }
+    }
+    // Nodes with visits in flight are referenced by the search workers
+    // across the lock, as are the nodes below them.
+    if (has_walked_children || node == root_node_ || children_visits == 0 ||
+        node->IsTerminal() || node->GetNInFlight() > 0) {
+      continue;
+    }
+    candidates.push_back(
+        {node,
+         static_cast<float>(node->GetN()) / node->GetParent()->GetN(),
+         children_visits});
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Candidate& a, const Candidate& b) {
+              return a.share < b.share;
+            });
+
+  int64_t released_visits = 0;
+  size_t released_nodes = 0;
+  for (const auto& candidate : candidates) {
+    if (tree_nodes - released_visits <= target) break;
+    candidate.node->ReleaseChildren();
+    released_visits += candidate.visits;
+    ++released_nodes;
+  }
+  compacted_visits_ += released_visits;
+  LOGFILE << "Tree compaction released the subtrees of " << released_nodes
+          << " nodes, " << released_visits << " visits, in "
+          << std::chrono::duration_cast<std::chrono::milliseconds>(
+                 std::chrono::steady_clock::now() - start)
+                 .count()
+          << "ms. The tree is estimated at " << tree_nodes - released_visits
+          << " nodes, limit " << compaction_nodes_limit_ << ".";
+}
+
+void Search::SpeculativePrefetch(int budget) {
+  {
+    Mutex::Lock lock(counters_mutex_);
+    watchdog_cv_.wait(lock.get_raw(), [this]() {
+      return running_workers_.load(std::memory_order_acquire) == 0 ||
+             abort_prefetch_.load(std::memory_order_acquire);
+    });
+  }
+  if (abort_prefetch_.load(std::memory_order_acquire)) return;
+  // The workers are gone, so this search's cache hits are all counted.
+  if (speculative_log_) speculative_log_->Reset();
+
+  // Walk the PV, and collect the unvisited children of its nodes. The root's
+  // are skipped, the move there is already decided.
+  struct Candidate {
+    float p;
+    size_t pv_index;
+    Move move;
+  };
+  std::vector<Candidate> candidates;
+  std::vector<Move> pv;
+  {
+    BrSharedMutex::SharedLock lock(nodes_mutex_);
+    Node* node = root_node_;
+    for (int depth = 0; node && node->GetN() > 0 && !node->IsTerminal();
+         ++depth) {
+      if (depth > 0) {
+        for (auto& edge : node->Edges()) {
+          if (edge.GetN() > 0 || edge.GetP() == 0.0f) continue;
+          candidates.push_back({edge.GetP(), pv.size(), edge.GetMove()});
+        }
+      }
+      auto best = GetBestChildNoTemperature(node, depth);
+      if (!best) break;
+      pv.push_back(best.GetMove());
+      node = best.node();
+    }
+  }
+  if (static_cast<int>(candidates.size()) > budget) {
+    std::partial_sort(candidates.begin(), candidates.begin() + budget,
+                      candidates.end(), [](const auto& a, const auto& b) {
+                        return a.p > b.p;
+                      });
+    candidates.resize(budget);
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const auto& a, const auto& b) {
+              return a.pv_index < b.pv_index;
+            });
+
+  const int batch_size = std::max(
+      1, params_.GetMiniBatchSize() > 0
+             ? params_.GetMiniBatchSize()
+             : backend_attributes_.recommended_batch_size);
+  PositionHistory history = played_history_;
+  size_t pv_length = 0;
+  int evaluated = 0;
+  int cached = 0;
+  for (size_t i = 0; i < candidates.size();) {
+    if (abort_prefetch_.load(std::memory_order_acquire)) break;
+    auto computation = backend_->CreateComputation();
+    for (; i < candidates.size() &&
+           static_cast<int>(computation->UsedBatchSize()) < batch_size;
+         ++i) {
+      const Candidate& candidate = candidates[i];
+      for (; pv_length < candidate.pv_index; ++pv_length) {
+        history.Append(pv[pv_length]);
+      }
+      history.Append(candidate.move);
+      const auto legal_moves = history.Last().GetBoard().GenerateLegalMoves();
+      if (!legal_moves.empty()) {
+        if (speculative_log_) speculative_log_->Add(history.Last().Hash());
+        if (computation->AddInput(
+                EvalPosition{history.GetPositions(), legal_moves},
+                EvalResultPtr{}) == BackendComputation::FETCHED_IMMEDIATELY) {
+          ++cached;
+        }
+        ++evaluated;
+      }
+      history.Pop();
+    }
+    if (computation->UsedBatchSize() > 0) computation->ComputeBlocking();
+  }
+  LOGFILE << "Speculative prefetch of " << evaluated << " positions, "
+          << cached << " of them were already cached.";
+}
+
+void ProvenBoundsTable::Resize(size_t size) {
+  if (size > 0) size = std::bit_floor(size);
+  if (size == size_) return;
+  size_ = size;
+  slots_ = size_ ? std::make_unique<std::atomic<uint64_t>[]>(size_) : nullptr;
+  Clear();
+}
+
+void ProvenBoundsTable::Clear() {
+  for (size_t i = 0; i < size_; ++i) {
+    slots_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+// A slot holds the upper half of the key, the plies left in bits 16-31, the
+// tablebase flag in bit 2 and the result in bits 0-1 (zero for an empty slot).
+std::optional<ProvenBoundsTable::Entry> ProvenBoundsTable::Lookup(
+    uint64_t key) const {
+  const uint64_t slot =
+      slots_[key & (size_ - 1)].load(std::memory_order_relaxed);
+  if ((slot & 3) == 0 || (slot >> 32) != (key >> 32)) return std::nullopt;
+  return Entry{static_cast<GameResult>(slot & 3),
+               static_cast<float>((slot >> 16) & 0xffff), (slot & 4) != 0};
+}
+
+void ProvenBoundsTable::Store(uint64_t key, const Entry& entry) {
+  const uint64_t m = std::clamp(std::lround(entry.m), 0L, 0xffffL);
+  slots_[key & (size_ - 1)].store(
+      (key & 0xffffffff00000000ULL) | (m << 16) | (entry.tablebase ? 4 : 0) |
+          static_cast<uint64_t>(entry.result),
+      std::memory_order_relaxed);
+}
+
+void SpeculativePrefetchLog::Reset() {
+  if (positions_.empty()) return;
+  const auto used = std::count_if(
+      positions_.begin(), positions_.end(), [](const auto& entry) {
+        return entry.second.load(std::memory_order_relaxed);
+      });
+  LOGFILE << "Speculative prefetch hit rate: " << used << " of "
+          << positions_.size() << " positions were used by the search.";
+  positions_.clear();
+}
+
 void Search::FireStopInternal() {
   stop_.store(true, std::memory_order_release);
   watchdog_cv_.notify_all();
@@ -1067,6 +1606,8 @@ void Search::Stop() {
 
 void Search::Abort() {
   Mutex::Lock lock(counters_mutex_);
+  abort_prefetch_.store(true, std::memory_order_release);
+  watchdog_cv_.notify_all();
   if (!stop_.load(std::memory_order_acquire) ||
       (!bestmove_is_sent_ && !ok_to_respond_bestmove_)) {
     bestmove_is_sent_ = true;
@@ -1075,6 +1616,22 @@ void Search::Abort() {
   LOGFILE << "Aborting search, if it is still active.";
 }
 
+void Search::HoldBestMove() {
+  Mutex::Lock lock(counters_mutex_);
+  ok_to_respond_bestmove_ = false;
+}
+
+void Search::PonderHit(std::unique_ptr<SearchStopper> stopper,
+                       std::chrono::steady_clock::time_point move_start_time) {
+  Mutex::Lock lock(counters_mutex_);
+  stopper_ = std::move(stopper);
+  move_start_time_ = move_start_time;
+  ok_to_respond_bestmove_ = true;
+  // If the search already reached a limit, the watchdog responds bestmove.
+  watchdog_cv_.notify_all();
+  LOGFILE << "Ponder hit, continuing the search with the time limits.";
+}
+
 void Search::Wait() {
   Mutex::Lock lock(threads_mutex_);
   while (!threads_.empty()) {
@@ -1097,8 +1654,13 @@ void Search::CancelSharedCollisions() REQUIRES(nodes_mutex_) {
 Search::~Search() {
   Abort();
   Wait();
+  // The helpers count their playouts here until they finish.
+  for (auto* helper : root_helpers_) {
+    helper->Abort();
+    helper->Wait();
+  }
   {
-    SharedMutex::Lock lock(nodes_mutex_);
+    BrSharedMutex::Lock lock(nodes_mutex_);
     CancelSharedCollisions();
   }
   LOGFILE << "Search destroyed.";
@@ -1108,80 +1670,98 @@ Search::~Search() {
 // SearchWorker
 //////////////////////////////////////////////////////////////////////////////
 
+#define MAX_TASKS 100
+
 void SearchWorker::RunTasks(int tid) {
   while (true) {
-    PickTask* task = nullptr;
-    int id = 0;
+    int id = -1;
     {
-      int spins = 0;
       while (true) {
-        int nta = tasks_taken_.load(std::memory_order_acquire);
+        const uint32_t epoch = task_parking_.Epoch();
         int tc = task_count_.load(std::memory_order_acquire);
-        if (nta < tc) {
-          int val = 0;
-          if (task_taking_started_.compare_exchange_weak(
-                  val, 1, std::memory_order_acq_rel,
-                  std::memory_order_relaxed)) {
-            nta = tasks_taken_.load(std::memory_order_acquire);
-            tc = task_count_.load(std::memory_order_acquire);
-            // We got the spin lock, double check we're still in the clear.
-            if (nta < tc) {
-              id = tasks_taken_.fetch_add(1, std::memory_order_acq_rel);
-              task = &picking_tasks_[id];
-              task_taking_started_.store(0, std::memory_order_release);
-              break;
-            }
-            task_taking_started_.store(0, std::memory_order_release);
-          }
-          SpinloopPause();
-          spins = 0;
-          continue;
-        } else if (tc != -1) {
-          spins++;
-          if (spins >= 512) {
-            std::this_thread::yield();
-            spins = 0;
-          } else {
-            SpinloopPause();
-          }
+        if (tc != -1) {
+          id = TakeTask(tid + 1);
+          if (id >= 0) break;
+          task_parking_.Wait(epoch);
           continue;
         }
-        spins = 0;
         // Looks like sleep time.
         Mutex::Lock lock(picking_tasks_mutex_);
-        // Refresh them now we have the lock.
-        nta = tasks_taken_.load(std::memory_order_acquire);
+        // Refresh it now we have the lock.
         tc = task_count_.load(std::memory_order_acquire);
         if (tc != -1) continue;
-        if (nta >= tc && exiting_) return;
+        if (exiting_) return;
         task_added_.wait(lock.get_raw());
         // And refresh again now we're awake.
-        nta = tasks_taken_.load(std::memory_order_acquire);
         tc = task_count_.load(std::memory_order_acquire);
-        if (nta >= tc && exiting_) return;
+        if (tc == -1 && exiting_) return;
       }
     }
-    if (task != nullptr) {
-      switch (task->task_type) {
-        case PickTask::kGathering: {
-          PickNodesToExtendTask(task->start, task->base_depth,
-                                task->collision_limit, task->moves_to_base,
-                                &(task->results), &(task_workspaces_[tid]));
-          break;
-        }
-        case PickTask::kProcessing: {
-          ProcessPickedTask(task->start_idx, task->end_idx,
-                            &(task_workspaces_[tid]));
-          break;
-        }
-      }
-      picking_tasks_[id].complete = true;
-      completed_tasks_.fetch_add(1, std::memory_order_acq_rel);
+    RunTask(id, &task_workspaces_[tid]);
+  }
+}
+
+void SearchWorker::RunTask(int id, TaskWorkspace* workspace) {
+  PickTask* task = &picking_tasks_[id];
+  switch (task->task_type) {
+    case PickTask::kGathering: {
+      TraceScope trace("Search::PickNodesToExtendTask");
+      PickNodesToExtendTask(task->start, task->base_depth,
+                            task->collision_limit, task->moves_to_base,
+                            &(task->results), workspace);
+      break;
+    }
+    case PickTask::kProcessing: {
+      TraceScope trace("Search::ProcessPickedTask");
+      ProcessPickedTask(task->start_idx, task->end_idx, workspace);
+      break;
     }
   }
+  task->complete = true;
+  completed_tasks_.fetch_add(1, std::memory_order_acq_rel);
+  completion_parking_.Notify();
+}
+
+void SearchWorker::PushTask(int queue, int id) {
+  TaskQueue& q = task_queues_[queue];
+  Mutex::Lock lock(q.mutex);
+  q.ids.push_back(id);
+  q.size.fetch_add(1, std::memory_order_release);
+  task_parking_.Notify();
+}
+
+int SearchWorker::TakeTask(int queue) {
+  const int num_queues = task_workers_ + 1;
+  // The own queue is drained from the back, as the newest task is the one
+  // whose subtree is most likely still in cache. Other queues are robbed from
+  // the front, where the tasks split off closest to the root, and so the
+  // biggest ones, are.
+  for (int i = 0; i < num_queues; i++) {
+    TaskQueue& q = task_queues_[(queue + i) % num_queues];
+    if (q.size.load(std::memory_order_acquire) == 0) continue;
+    Mutex::Lock lock(q.mutex);
+    if (q.head == q.ids.size()) continue;
+    q.size.fetch_sub(1, std::memory_order_relaxed);
+    if (i == 0) {
+      const int id = q.ids.back();
+      q.ids.pop_back();
+      return id;
+    }
+    return q.ids[q.head++];
+  }
+  return -1;
 }
 
 void SearchWorker::ExecuteOneIteration() {
+  SearchStats stats;
+  auto phase_start = std::chrono::steady_clock::now();
+  // Adds the time since the previous phase ended to @time.
+  auto end_phase = [&phase_start](std::chrono::nanoseconds& time) {
+    const auto now = std::chrono::steady_clock::now();
+    time += now - phase_start;
+    phase_start = now;
+  };
+
   // 1. Initialize internal structures.
   InitializeIteration(search_->backend_->CreateComputation());
 
@@ -1205,10 +1785,15 @@ void SearchWorker::ExecuteOneIteration() {
         return;
       }
 
+      const uint32_t epoch = search_->searcher_parking_.Epoch();
       int available =
           search_->pending_searchers_.load(std::memory_order_acquire);
       if (available == 0) {
-        spin_helper->Wait();
+        if (params_.GetSearchSpinBackoff()) {
+          search_->searcher_parking_.Wait(epoch);
+        } else {
+          spin_helper->Wait();
+        }
         continue;
       }
 
@@ -1224,6 +1809,7 @@ void SearchWorker::ExecuteOneIteration() {
   // 2. Gather minibatch.
   GatherMinibatch();
   task_count_.store(-1, std::memory_order_release);
+  task_parking_.Notify();
   search_->backend_waiting_counter_.fetch_add(1, std::memory_order_relaxed);
 
   // 2b. Collect collisions.
@@ -1234,20 +1820,66 @@ void SearchWorker::ExecuteOneIteration() {
 
   if (params_.GetMaxConcurrentSearchers() != 0) {
     search_->pending_searchers_.fetch_add(1, std::memory_order_acq_rel);
+    search_->searcher_parking_.Notify();
   }
 
+  stats.picked_nodes = minibatch_.size();
+  for (const auto& node_to_process : minibatch_) {
+    if (node_to_process.IsCollision()) ++stats.collisions;
+    if (node_to_process.is_cache_hit) ++stats.cache_hits;
+  }
+  if (const size_t batch_size = computation_->UsedBatchSize()) {
+    stats.batches = 1;
+    stats.nn_evals = batch_size;
+    const size_t bucket = std::bit_width(batch_size) - 1;
+    ++stats.batch_sizes[std::min(bucket, stats.batch_sizes.size() - 1)];
+  }
+  end_phase(stats.gather_time);
+
   // 4. Run NN computation.
-  RunNNComputation();
-  search_->backend_waiting_counter_.fetch_add(-1, std::memory_order_relaxed);
+  const uint64_t compute_start = PhaseProfile::Now();
+  std::optional<TraceScope> compute_trace(std::in_place,
+                                          "Search::RunNNComputation");
+  if (params_.GetPipelinedSearch()) {
+    // The rest of the iteration works on the previous minibatch, while this
+    // one is being computed. Virtual loss of the minibatch in flight keeps the
+    // next gather away from its nodes.
+    if (!SwapInPipelinedBatch()) return;
+  } else {
+    RunNNComputation();
+    search_->backend_waiting_counter_.fetch_add(-1, std::memory_order_relaxed);
+  }
+  profile_.AddSince(SearchPhase::kCompute, compute_start);
+  compute_trace.reset();
+  end_phase(stats.compute_time);
 
   // 5. Retrieve NN computations (and terminal values) into nodes.
   FetchMinibatchResults();
+  end_phase(stats.fetch_time);
 
   // 6. Propagate the new nodes' information to all their parents in the tree.
   DoBackupUpdate();
+  StoreProvenBounds();
 
   // 7. Update the Search's status and progress information.
   UpdateCounters();
+  end_phase(stats.backup_time);
+  if (tuner_ &&
+      tuner_->Update(stats.picked_nodes, stats.collisions, stats.nn_evals,
+                     stats.compute_time,
+                     stats.gather_time + stats.compute_time +
+                         stats.fetch_time + stats.backup_time)) {
+    target_minibatch_size_ = tuner_->GetMinibatchSize();
+    max_out_of_order_ = tuner_->GetMaxOutOfOrder();
+  }
+  {
+    Mutex::Lock lock(search_->stats_mutex_);
+    search_->stats_.Add(stats);
+#ifdef LC0_SEARCH_PROFILING
+    search_->profile_.Add(profile_);
+    profile_.Reset();
+#endif
+  }
 
   // If required, waste time to limit nps.
   if (params_.GetNpsLimit() > 0) {
@@ -1305,11 +1937,15 @@ int CalculateCollisionsLeft(int64_t nodes, const SearchParams& params) {
 }  // namespace
 
 void SearchWorker::GatherMinibatch() {
+  ScopedPhaseTimer phase_timer(&profile_, SearchPhase::kGather);
+  TraceScope trace("Search::GatherMinibatch");
   // Total number of nodes to process.
   int minibatch_size = 0;
   int cur_n = 0;
   {
-    SharedMutex::Lock lock(search_->nodes_mutex_);
+    const uint64_t lock_start = PhaseProfile::Now();
+    BrSharedMutex::SharedLock lock(search_->nodes_mutex_);
+    profile_.AddSince(SearchPhase::kNodesLockWait, lock_start);
     cur_n = search_->root_node_->GetN();
   }
   // TODO: GetEstimatedRemainingPlayouts has already had smart pruning factor
@@ -1368,9 +2004,11 @@ void SearchWorker::GatherMinibatch() {
     int ppt_start = new_start;
     if (task_workers_ > 0 &&
         non_collisions >= params_.GetMinimumWorkSizeForProcessing()) {
+      // Up to two tasks per thread, so that threads which are done early can
+      // steal the remaining work of slower ones.
       const int num_tasks = std::clamp(
           non_collisions / params_.GetMinimumWorkPerTaskForProcessing(), 2,
-          task_workers_ + 1);
+          std::min(2 * (task_workers_ + 1), MAX_TASKS));
       // Round down, left overs can go to main thread so it waits less.
       int per_worker = non_collisions / num_tasks;
       needs_wait = true;
@@ -1385,6 +2023,7 @@ void SearchWorker::GatherMinibatch() {
         if (found == per_worker) {
           picking_tasks_.emplace_back(ppt_start, i + 1);
           task_count_.fetch_add(1, std::memory_order_acq_rel);
+          PushTask(main_workspace_.queue, picking_tasks_.size() - 1);
           ppt_start = i + 1;
           found = 0;
           if (picking_tasks_.size() == static_cast<size_t>(num_tasks - 1)) {
@@ -1406,28 +2045,34 @@ void SearchWorker::GatherMinibatch() {
       }
     }
     if (some_ooo) {
-      SharedMutex::Lock lock(search_->nodes_mutex_);
-      for (int i = static_cast<int>(minibatch_.size()) - 1; i >= new_start;
-           i--) {
-        // If there was any OOO, revert 'all' new collisions - it isn't possible
-        // to identify exactly which ones are afterwards and only prune those.
-        // This may remove too many items, but hopefully most of the time they
-        // will just be added back in the same in the next gather.
-        if (minibatch_[i].IsCollision()) {
-          Node* node = minibatch_[i].node;
-          for (node = node->GetParent();
+      // The out of order visits were backed up by ProcessPickedTask(), only
+      // drop them. If there was any, also revert 'all' new collisions - it
+      // isn't possible to identify exactly which ones are afterwards and only
+      // prune those. This may remove too many items, but hopefully most of the
+      // time they will just be added back in the same in the next gather.
+      // Only n-in-flight is touched, which is fine to do concurrently.
+      const uint64_t lock_start = PhaseProfile::Now();
+      BrSharedMutex::SharedLock lock(search_->nodes_mutex_);
+      profile_.AddSince(SearchPhase::kNodesLockWait, lock_start);
+      auto kept = minibatch_.begin() + new_start;
+      for (auto it = kept; it != minibatch_.end(); ++it) {
+        if (it->IsCollision()) {
+          for (Node* node = it->node->GetParent();
                node != search_->root_node_->GetParent();
                node = node->GetParent()) {
-            node->CancelScoreUpdate(minibatch_[i].multivisit);
+            node->CancelScoreUpdate(it->multivisit);
           }
-          minibatch_.erase(minibatch_.begin() + i);
-        } else if (minibatch_[i].ooo_completed) {
-          DoBackupUpdateSingleNode(minibatch_[i]);
-          minibatch_.erase(minibatch_.begin() + i);
+          continue;
+        }
+        if (it->ooo_completed) {
           --minibatch_size;
           ++number_out_of_order_;
+          continue;
         }
+        if (kept != it) *kept = std::move(*it);
+        ++kept;
       }
+      minibatch_.erase(kept, minibatch_.end());
     }
 
     // Check for stop at the end so we have at least one node.
@@ -1438,7 +2083,10 @@ void SearchWorker::GatherMinibatch() {
         // Check to see if we can upsize the collision to exit sooner.
         if (picked_node.maxvisit > 0 &&
             collisions_left > picked_node.multivisit) {
-          SharedMutex::Lock lock(search_->nodes_mutex_);
+          // Only n-in-flight is touched, which is fine to do concurrently.
+          const uint64_t lock_start = PhaseProfile::Now();
+          BrSharedMutex::SharedLock lock(search_->nodes_mutex_);
+          profile_.AddSince(SearchPhase::kNodesLockWait, lock_start);
           int extra = std::min(picked_node.maxvisit, collisions_left) -
                       picked_node.multivisit;
           picked_node.multivisit += extra;
@@ -1459,8 +2107,13 @@ void SearchWorker::GatherMinibatch() {
 void SearchWorker::ProcessPickedTask(int start_idx, int end_idx,
                                      TaskWorkspace* workspace) {
   auto& history = workspace->history;
-  history = search_->played_history_;
 
+  if (search_->syzygy_tb_ && !search_->root_is_in_dtz_ &&
+      params_.GetSyzygyPrefetch()) {
+    PrefetchTablebases(start_idx, end_idx, &history);
+  }
+
+  bool some_ooo = false;
   for (int i = start_idx; i < end_idx; i++) {
     auto& picked_node = minibatch_[i];
     if (picked_node.IsCollision()) continue;
@@ -1470,7 +2123,8 @@ void SearchWorker::ProcessPickedTask(int start_idx, int end_idx,
     // of the game), it means that we already visited this node before.
     if (picked_node.IsExtendable()) {
       // Node was never visited, extend it.
-      ExtendNode(node, picked_node.depth, picked_node.moves_to_visit, &history);
+      ExtendNode(node, picked_node.depth, picked_node.moves_to_visit, &history,
+                 &picked_node.tb_probe);
       if (!node->IsTerminal()) {
         picked_node.nn_queried = true;
         MoveList legal_moves;
@@ -1486,34 +2140,77 @@ void SearchWorker::ProcessPickedTask(int start_idx, int end_idx,
                                        },
                                        picked_node.eval->AsPtr()) ==
                                    BackendComputation::FETCHED_IMMEDIATELY;
+        if (picked_node.is_cache_hit && search_->speculative_log_) {
+          search_->speculative_log_->MarkUsed(history.Last().Hash());
+        }
       }
     }
     if (params_.GetOutOfOrderEval() && picked_node.CanEvalOutOfOrder()) {
       // Perform out of order eval for the last entry in minibatch_.
       FetchSingleNodeResult(&picked_node);
       picked_node.ooo_completed = true;
+      some_ooo = true;
     }
   }
+
+  // The visits that don't wait for the network are backed up right away by the
+  // thread that picked them, so that they don't wait for the batch either.
+  if (!some_ooo) return;
+  BrSharedMutex::Lock lock(search_->nodes_mutex_);
+  for (int i = start_idx; i < end_idx; i++) {
+    if (minibatch_[i].ooo_completed) DoBackupUpdateSingleNode(minibatch_[i]);
+  }
 }
 
-#define MAX_TASKS 100
+// Starts reading the tablebase data of the positions ExtendNode() will probe,
+// so that they don't wait for the disk one at a time.
+void SearchWorker::PrefetchTablebases(int start_idx, int end_idx,
+                                      PositionHistory* history) {
+  for (int i = start_idx; i < end_idx; i++) {
+    const auto& picked_node = minibatch_[i];
+    if (!picked_node.IsExtendable()) continue;
+    history->Trim(search_->played_history_.GetLength());
+    for (Move move : picked_node.moves_to_visit) history->Append(move);
+    const auto& board = history->Last().GetBoard();
+    if (board.castlings().no_legal_castle() &&
+        history->Last().GetRule50Ply() == 0 &&
+        (board.ours() | board.theirs()).count() <=
+            search_->syzygy_tb_->max_cardinality()) {
+      search_->syzygy_tb_->prefetch_wdl(history->Last());
+    }
+  }
+}
 
 void SearchWorker::ResetTasks() {
   task_count_.store(0, std::memory_order_release);
-  tasks_taken_.store(0, std::memory_order_release);
   completed_tasks_.store(0, std::memory_order_release);
+  for (int i = 0; i <= task_workers_; i++) {
+    TaskQueue& q = task_queues_[i];
+    Mutex::Lock lock(q.mutex);
+    q.ids.clear();
+    q.ids.reserve(MAX_TASKS);
+    q.head = 0;
+    q.size.store(0, std::memory_order_relaxed);
+  }
   picking_tasks_.clear();
   // Reserve because resizing breaks pointers held by the task threads.
   picking_tasks_.reserve(MAX_TASKS);
 }
 
 int SearchWorker::WaitForTasks() {
-  // Spin lock, other tasks should be done soon.
   while (true) {
+    const uint32_t epoch = completion_parking_.Epoch();
     int completed = completed_tasks_.load(std::memory_order_acquire);
     int todo = task_count_.load(std::memory_order_acquire);
     if (todo == completed) return completed;
-    SpinloopPause();
+    // Rather than spinning, help with whatever is still queued. Either way the
+    // main workspace isn't in use anymore at this point.
+    const int id = TakeTask(main_workspace_.queue);
+    if (id >= 0) {
+      RunTask(id, &main_workspace_);
+    } else {
+      completion_parking_.Wait(epoch);
+    }
   }
 }
 
@@ -1526,61 +2223,98 @@ void SearchWorker::PickNodesToExtend(int collision_limit) {
     task_added_.notify_all();
   }
   std::vector<Move> empty_movelist;
-  // This lock must be held until after the task_completed_ wait succeeds below.
-  // Since the tasks perform work which assumes they have the lock, even though
-  // actually this thread does.
-  SharedMutex::Lock lock(search_->nodes_mutex_);
-  PickNodesToExtendTask(search_->root_node_, 0, collision_limit, empty_movelist,
-                        &minibatch_, &main_workspace_);
-
-  WaitForTasks();
-  for (int i = 0; i < static_cast<int>(picking_tasks_.size()); i++) {
-    for (int j = 0; j < static_cast<int>(picking_tasks_[i].results.size());
-         j++) {
-      minibatch_.emplace_back(std::move(picking_tasks_[i].results[j]));
-    }
-  }
-}
-
-void SearchWorker::EnsureNodeTwoFoldCorrectForDepth(Node* child_node,
-                                                    int depth) {
-  // Check whether first repetition was before root. If yes, remove
-  // terminal status of node and revert all visits in the tree.
-  // Length of repetition was stored in m_. This code will only do
-  // something when tree is reused and twofold visits need to be
-  // reverted.
-  if (child_node->IsTwoFoldTerminal() && depth < child_node->GetM()) {
-    // Take a mutex - any SearchWorker specific mutex... since this is
-    // not safe to do concurrently between multiple tasks.
-    Mutex::Lock lock(picking_tasks_mutex_);
-    int depth_counter = 0;
-    // Cache node's values as we reset them in the process. We could
-    // manually set wl and d, but if we want to reuse this for reverting
-    // other terminal nodes this is the way to go.
-    const auto wl = child_node->GetWL();
-    const auto d = child_node->GetD();
-    const auto m = child_node->GetM();
-    const auto terminal_visits = child_node->GetN();
-    for (Node* node_to_revert = child_node; node_to_revert != nullptr;
-         node_to_revert = node_to_revert->GetParent()) {
-      // Revert all visits on twofold draw when making it non terminal.
-      node_to_revert->RevertTerminalVisits(wl, d, m + (float)depth_counter,
-                                           terminal_visits);
-      depth_counter++;
-      // Even if original tree still exists, we don't want to revert
-      // more than until new root.
-      if (depth_counter > depth) break;
-      // If wl != 0, we would have to switch signs at each depth.
+  {
+    // This lock must be held until after the task_completed_ wait succeeds
+    // below. Since the tasks perform work which assumes they have the lock,
+    // even though actually this thread does.
+    // Picking only changes n-in-flight and spawns nodes, both of which are safe
+    // to do concurrently, so it's a shared lock and other search workers can
+    // pick at the same time. Only backups need the lock exclusively.
+    const uint64_t lock_start = PhaseProfile::Now();
+    BrSharedMutex::SharedLock lock(search_->nodes_mutex_);
+    profile_.AddSince(SearchPhase::kNodesLockWait, lock_start);
+    PickNodesToExtendTask(search_->root_node_, 0, collision_limit,
+                          empty_movelist, &minibatch_, &main_workspace_);
+
+    WaitForTasks();
+    for (int i = 0; i < static_cast<int>(picking_tasks_.size()); i++) {
+      for (int j = 0; j < static_cast<int>(picking_tasks_[i].results.size());
+           j++) {
+        minibatch_.emplace_back(std::move(picking_tasks_[i].results[j]));
+      }
     }
+  }
+
+  // Visits to twofold draws needing a revert were turned into collisions, so
+  // the next pick will see them as regular nodes.
+  std::vector<std::pair<Node*, int>> twofold_reverts;
+  {
+    Mutex::Lock lock(picking_tasks_mutex_);
+    twofold_reverts.swap(pending_twofold_reverts_);
+  }
+  if (twofold_reverts.empty()) return;
+  const uint64_t lock_start = PhaseProfile::Now();
+  BrSharedMutex::Lock lock(search_->nodes_mutex_);
+  profile_.AddSince(SearchPhase::kNodesLockWait, lock_start);
+  RevertTwoFoldDraws(twofold_reverts);
+}
+
+void SearchWorker::RevertTwoFoldDraws(
+    const std::vector<std::pair<Node*, int>>& nodes) {
+  // A twofold draw whose first repetition was before root is no draw anymore,
+  // when the tree is reused. Its length was stored in m_.
+  // The reverts are summed up per ancestor and applied a level at a time from
+  // the deepest one, so that the shared parts of the paths are only walked
+  // once. Reverting several visits at once gives the same result as one by
+  // one, as long as the reverted values are averaged.
+  struct Revert {
+    int visits = 0;
+    double wl = 0.0;
+    double d = 0.0;
+    double m = 0.0;
+  };
+  // Indexed by depth, root is at 0.
+  std::vector<std::unordered_map<Node*, Revert>> levels;
+  auto add_to_parent = [&levels](Node* node, int depth, const Revert& r) {
+    if (depth == 0 || r.visits == 0) return;
+    if (static_cast<int>(levels.size()) < depth) levels.resize(depth);
+    Revert& parent = levels[depth - 1][node->GetParent()];
+    parent.visits += r.visits;
+    parent.wl += r.wl;
+    parent.d += r.d;
+    // One ply further from the draw.
+    parent.m += r.m + r.visits;
+  };
+  for (const auto& [node, depth] : nodes) {
+    // Another search worker may have done it already, or some node may be
+    // listed twice, so the condition is checked again here under the
+    // exclusive lock.
+    if (!node->IsTwoFoldTerminal() || depth >= node->GetM()) continue;
+    const int visits = node->GetN();
+    const Revert revert{visits, static_cast<double>(node->GetWL()) * visits,
+                        static_cast<double>(node->GetD()) * visits,
+                        static_cast<double>(node->GetM()) * visits};
+    node->RevertTerminalVisits(node->GetWL(), node->GetD(), node->GetM(),
+                               visits);
     // Mark the prior twofold draw as non terminal to extend it again.
-    child_node->MakeNotTerminal();
+    node->MakeNotTerminal();
     // When reverting the visits, we also need to revert the initial
     // visits, as we reused fewer nodes than anticipated.
-    search_->initial_visits_ -= terminal_visits;
-    // Max depth doesn't change when reverting the visits, and
-    // cum_depth_ only counts the average depth of new nodes, not reused
-    // ones.
+    search_->initial_visits_ -= visits;
+    // Draws have wl == 0, so there are no signs to switch at each depth.
+    add_to_parent(node, depth, revert);
   }
+  for (int depth = static_cast<int>(levels.size()) - 1; depth >= 0; --depth) {
+    for (const auto& [node, revert] : levels[depth]) {
+      node->RevertTerminalVisits(revert.wl / revert.visits,
+                                 revert.d / revert.visits,
+                                 revert.m / revert.visits, revert.visits);
+      add_to_parent(node, depth, revert);
+    }
+    levels.pop_back();
+  }
+  // Max depth doesn't change when reverting the visits, and cum_depth_ only
+  // counts the average depth of new nodes, not reused ones.
 }
 
 void SearchWorker::PickNodesToExtendTask(
@@ -1731,6 +2465,8 @@ void SearchWorker::PickNodesToExtendTask(
       const float puct_mult =
           cpuct * std::sqrt(std::max(node->GetChildrenVisits(), 1u));
       int cache_filled_idx = -1;
+      // Only grows, as the visits started only grow.
+      int first_unstarted = 0;
       while (cur_limit > 0) {
         // Perform UCT for current node.
         float best = std::numeric_limits<float>::lowest();
@@ -1739,7 +2475,25 @@ void SearchWorker::PickNodesToExtendTask(
         float second_best = std::numeric_limits<float>::lowest();
         bool can_exit = false;
         best_edge.Reset();
-        for (int idx = 0; idx < max_needed; ++idx) {
+        // The loop below stops one edge after the first unstarted one. Once
+        // the scores up to there are cached there is nothing left to fetch
+        // from the edges, and away from the root nothing to filter either, so
+        // the scan is done over the score array directly.
+        while (first_unstarted <= cache_filled_idx &&
+               current_nstarted[first_unstarted] != 0) {
+          ++first_unstarted;
+        }
+        const int scan_end = std::min(max_needed, first_unstarted + 2);
+        bool scanned = false;
+        if (!is_root_node && scan_end - 1 <= cache_filled_idx) {
+          FindBestScores(current_score.data(), scan_end, &best_idx, &best,
+                         &second_best);
+          best_without_u = current_util[best_idx];
+          best_edge = cur_iters[best_idx];
+          if (scan_end > 1) second_best_edge = cur_iters[best_idx == 0];
+          scanned = true;
+        }
+        for (int idx = 0; !scanned && idx < max_needed; ++idx) {
           if (idx > cache_filled_idx) {
             if (idx == 0) {
               cur_iters[idx] = node->Edges();
@@ -1824,11 +2578,18 @@ void SearchWorker::PickNodesToExtendTask(
 
         // Probably best place to check for two-fold draws consistently.
         // Depth starts with 1 at root, so real depth is depth - 1.
-        EnsureNodeTwoFoldCorrectForDepth(
-            child_node, current_path.size() + base_depth + 1 - 1);
+        // Reverting needs the exclusive lock, so only remember the node for
+        // now and let these visits become a collision.
+        const int child_depth = current_path.size() + base_depth + 1 - 1;
+        const bool needs_twofold_revert = child_node->IsTwoFoldTerminal() &&
+                                          child_depth < child_node->GetM();
+        if (needs_twofold_revert) {
+          Mutex::Lock lock(picking_tasks_mutex_);
+          pending_twofold_reverts_.emplace_back(child_node, child_depth);
+        }
 
         bool decremented = false;
-        if (child_node->TryStartScoreUpdate()) {
+        if (!needs_twofold_revert && child_node->TryStartScoreUpdate()) {
           current_nstarted[best_idx]++;
           new_visits -= 1;
           decremented = true;
@@ -1863,7 +2624,15 @@ void SearchWorker::PickNodesToExtendTask(
       // tree walk to get there.
       for (int i = 0; i <= vtp_last_filled.back(); i++) {
         int child_limit = (*visits_to_perform.back())[i];
+        // Only split while there are threads which would take the task soon,
+        // otherwise it's cheaper to walk the subtree here. Idle threads steal,
+        // so a thread stuck with a big subtree keeps splitting it up as long
+        // as the others run out of work.
+        const int outstanding_tasks =
+            task_count_.load(std::memory_order_relaxed) -
+            completed_tasks_.load(std::memory_order_relaxed);
         if (task_workers_ > 0 &&
+            outstanding_tasks < 2 * (task_workers_ + 1) &&
             child_limit > params_.GetMinimumWorkSizeForPicking() &&
             child_limit <
                 ((collision_limit - passed_off - completed_visits) * 2 / 3) &&
@@ -1886,6 +2655,7 @@ void SearchWorker::PickNodesToExtendTask(
                   moves_to_path, child_limit);
               moves_to_path.pop_back();
               task_count_.fetch_add(1, std::memory_order_acq_rel);
+              PushTask(workspace->queue, picking_tasks_.size() - 1);
               task_added_.notify_all();
               passed = true;
               passed_off += child_limit;
@@ -1930,9 +2700,10 @@ void SearchWorker::PickNodesToExtendTask(
   }
 }
 
-void SearchWorker::ExtendNode(Node* node, int depth,
-                              const std::vector<Move>& moves_to_node,
-                              PositionHistory* history) {
+void SearchWorker::ExtendNode(
+    Node* node, int depth, const std::vector<Move>& moves_to_node,
+    PositionHistory* history,
+    std::future<SyzygyProbeService::Result>* tb_probe) {
   // Initialize position sequence with pre-move position.
   history->Trim(search_->played_history_.GetLength());
   for (size_t i = 0; i < moves_to_node.size(); i++) {
@@ -1942,13 +2713,14 @@ void SearchWorker::ExtendNode(Node* node, int depth,
   // We don't need the mutex because other threads will see that N=0 and
   // N-in-flight=1 and will not touch this node.
   const auto& board = history->Last().GetBoard();
-  auto legal_moves = board.GenerateLegalMoves();
+  KingAttackInfo king_attack_info;
+  auto legal_moves = board.GenerateLegalMoves(&king_attack_info);
 
   // Check whether it's a draw/lose by position. Importantly, we must check
   // these before doing the by-rule checks below.
   if (legal_moves.empty()) {
     // Could be a checkmate or a stalemate
-    if (board.IsUnderCheck()) {
+    if (king_attack_info.in_check()) {
       node->MakeTerminal(GameResult::WHITE_WON);
     } else {
       node->MakeTerminal(GameResult::DRAW);
@@ -1985,40 +2757,33 @@ void SearchWorker::ExtendNode(Node* node, int depth,
       return;
     }
 
+    // Transposition into a position that the search already proved.
+    if (search_->proven_bounds_ && params_.GetStickyEndgames()) {
+      const auto proven = search_->proven_bounds_->Lookup(
+          history->HashLast(history->Last().GetRule50Ply() + 1));
+      if (proven) {
+        node->MakeTerminal(proven->result, proven->m,
+                           proven->tablebase ? Node::Terminal::Tablebase
+                                             : Node::Terminal::EndOfGame);
+        return;
+      }
+    }
+
     // Neither by-position or by-rule termination, but maybe it's a TB position.
     if (search_->syzygy_tb_ && !search_->root_is_in_dtz_ &&
         board.castlings().no_legal_castle() &&
         history->Last().GetRule50Ply() == 0 &&
         (board.ours() | board.theirs()).count() <=
             search_->syzygy_tb_->max_cardinality()) {
-      ProbeState state;
-      const WDLScore wdl =
-          search_->syzygy_tb_->probe_wdl(history->Last(), &state);
-      // Only fail state means the WDL is wrong, probe_wdl may produce correct
-      // result with a stat other than OK.
-      if (state != FAIL) {
-        // TB nodes don't have NN evaluation, assign M from parent node.
-        float m = 0.0f;
-        // Need a lock to access parent, in case MakeSolid is in progress.
-        {
-          SharedMutex::SharedLock lock(search_->nodes_mutex_);
-          auto parent = node->GetParent();
-          if (parent) {
-            m = std::max(0.0f, parent->GetM() - 1.0f);
-          }
-        }
-        // If the colors seem backwards, check the checkmate check above.
-        if (wdl == WDL_WIN) {
-          node->MakeTerminal(GameResult::BLACK_WON, m,
-                             Node::Terminal::Tablebase);
-        } else if (wdl == WDL_LOSS) {
-          node->MakeTerminal(GameResult::WHITE_WON, m,
-                             Node::Terminal::Tablebase);
-        } else {  // Cursed wins and blessed losses count as draws.
-          node->MakeTerminal(GameResult::DRAW, m, Node::Terminal::Tablebase);
-        }
-        search_->tb_hits_.fetch_add(1, std::memory_order_acq_rel);
-        return;
+      if (search_->tb_probe_service_) {
+        // The node is evaluated as usual meanwhile, FetchSingleNodeResult()
+        // makes it terminal if the probe succeeds.
+        *tb_probe = search_->tb_probe_service_->ProbeWdl(history->Last());
+      } else {
+        ProbeState state;
+        const WDLScore wdl =
+            search_->syzygy_tb_->probe_wdl(history->Last(), &state);
+        if (MakeTablebaseTerminal(node, wdl, state)) return;
       }
     }
   }
@@ -2027,6 +2792,36 @@ void SearchWorker::ExtendNode(Node* node, int depth,
   node->CreateEdges(legal_moves);
 }
 
+// Makes the node terminal with the result of its tablebase probe. Returns
+// false if the probe failed.
+bool SearchWorker::MakeTablebaseTerminal(Node* node, WDLScore wdl,
+                                         ProbeState state) {
+  // Only fail state means the WDL is wrong, probe_wdl may produce correct
+  // result with a stat other than OK.
+  if (state == FAIL) return false;
+  // TB nodes don't have NN evaluation, assign M from parent node.
+  float m = 0.0f;
+  // Need a lock to access parent, in case MakeSolid is in progress.
+  {
+    BrSharedMutex::SharedLock lock(search_->nodes_mutex_);
+    auto parent = node->GetParent();
+    if (parent) {
+      m = std::max(0.0f, parent->GetM() - 1.0f);
+    }
+  }
+  // If the colors seem backwards, check the checkmate check above.
+  if (wdl == WDL_WIN) {
+    node->MakeTerminal(GameResult::BLACK_WON, m, Node::Terminal::Tablebase);
+  } else if (wdl == WDL_LOSS) {
+    node->MakeTerminal(GameResult::WHITE_WON, m, Node::Terminal::Tablebase);
+  } else {  // Cursed wins and blessed losses count as draws.
+    node->MakeTerminal(GameResult::DRAW, m, Node::Terminal::Tablebase);
+  }
+  search_->tb_hits_.fetch_add(1, std::memory_order_acq_rel);
+  kTbHitsMetric->Add();
+  return true;
+}
+
 // Returns whether node was already in cache.
 bool SearchWorker::AddNodeToComputation(Node* node) {
   std::vector<Move> moves;
@@ -2043,7 +2838,11 @@ bool SearchWorker::AddNodeToComputation(Node* node) {
 
 // 2b. Copy collisions into shared collisions.
 void SearchWorker::CollectCollisions() {
-  SharedMutex::Lock lock(search_->nodes_mutex_);
+  ScopedPhaseTimer phase_timer(&profile_, SearchPhase::kCollisions);
+  TraceScope trace("Search::CollectCollisions");
+  const uint64_t lock_start = PhaseProfile::Now();
+  BrSharedMutex::Lock lock(search_->nodes_mutex_);
+  profile_.AddSince(SearchPhase::kNodesLockWait, lock_start);
 
   for (const NodeToProcess& node_to_process : minibatch_) {
     if (node_to_process.IsCollision()) {
@@ -2056,6 +2855,8 @@ void SearchWorker::CollectCollisions() {
 // 3. Prefetch into cache.
 // ~~~~~~~~~~~~~~~~~~~~~~~
 void SearchWorker::MaybePrefetchIntoCache() {
+  ScopedPhaseTimer phase_timer(&profile_, SearchPhase::kPrefetch);
+  TraceScope trace("Search::MaybePrefetchIntoCache");
   // TODO(mooskagh) Remove prefetch into cache if node collisions work well.
   // If there are requests to NN, but the batch is not full, try to prefetch
   // nodes which are likely useful in future.
@@ -2064,7 +2865,9 @@ void SearchWorker::MaybePrefetchIntoCache() {
       static_cast<int>(computation_->UsedBatchSize()) <
           params_.GetMaxPrefetchBatch()) {
     history_.Trim(search_->played_history_.GetLength());
-    SharedMutex::SharedLock lock(search_->nodes_mutex_);
+    const uint64_t lock_start = PhaseProfile::Now();
+    BrSharedMutex::SharedLock lock(search_->nodes_mutex_);
+    profile_.AddSince(SearchPhase::kNodesLockWait, lock_start);
     PrefetchIntoCache(
         search_->root_node_,
         params_.GetMaxPrefetchBatch() - computation_->UsedBatchSize(), false);
@@ -2166,9 +2969,74 @@ void SearchWorker::RunNNComputation() {
   if (computation_->UsedBatchSize() > 0) computation_->ComputeBlocking();
 }
 
+bool SearchWorker::SwapInPipelinedBatch() {
+  PipelinedBatch batch;
+  batch.minibatch = std::move(minibatch_);
+  batch.computation = std::move(computation_);
+  batch.number_out_of_order = number_out_of_order_;
+  batch.computed = ComputeInBackground(batch.computation.get());
+  std::swap(batch, pipelined_batch_);
+  return RestorePipelinedBatch(&batch);
+}
+
+std::future<void> SearchWorker::ComputeInBackground(
+    BackendComputation* computation) {
+  std::promise<void> promise;
+  std::future<void> future = promise.get_future();
+  {
+    Mutex::Lock lock(compute_mutex_);
+    compute_queue_.emplace_back(computation, std::move(promise));
+  }
+  compute_added_.notify_one();
+  return future;
+}
+
+void SearchWorker::RunComputations() {
+  Mutex::Lock lock(compute_mutex_);
+  while (true) {
+    compute_added_.wait(lock.get_raw(), [&]() {
+      return compute_exiting_ || !compute_queue_.empty();
+    });
+    if (compute_queue_.empty()) return;
+    auto [computation, promise] = std::move(compute_queue_.front());
+    compute_queue_.pop_front();
+    lock.get_raw().unlock();
+    try {
+      if (computation->UsedBatchSize() > 0) computation->ComputeBlocking();
+      promise.set_value();
+    } catch (...) {
+      promise.set_exception(std::current_exception());
+    }
+    lock.get_raw().lock();
+  }
+}
+
+void SearchWorker::FinishPipelinedBatch() {
+  PipelinedBatch batch;
+  std::swap(batch, pipelined_batch_);
+  if (!RestorePipelinedBatch(&batch)) return;
+  FetchMinibatchResults();
+  DoBackupUpdate();
+  StoreProvenBounds();
+  UpdateCounters();
+}
+
+bool SearchWorker::RestorePipelinedBatch(PipelinedBatch* batch) {
+  if (!batch->computation) return false;
+  // Rethrows if the backend failed.
+  batch->computed.get();
+  search_->backend_waiting_counter_.fetch_add(-1, std::memory_order_relaxed);
+  minibatch_ = std::move(batch->minibatch);
+  computation_ = std::move(batch->computation);
+  number_out_of_order_ = batch->number_out_of_order;
+  return true;
+}
+
 // 5. Retrieve NN computations (and terminal values) into nodes.
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 void SearchWorker::FetchMinibatchResults() {
+  ScopedPhaseTimer phase_timer(&profile_, SearchPhase::kFetch);
+  TraceScope trace("Search::FetchMinibatchResults");
   // Populate NN/cached results, or terminal results, into nodes.
   for (auto& node_to_process : minibatch_) {
     FetchSingleNodeResult(&node_to_process);
@@ -2178,6 +3046,15 @@ void SearchWorker::FetchMinibatchResults() {
 void SearchWorker::FetchSingleNodeResult(NodeToProcess* node_to_process) {
   if (node_to_process->IsCollision()) return;
   Node* node = node_to_process->node;
+  if (node_to_process->tb_probe.valid()) {
+    // Has had the whole NN computation to complete, so rarely waits.
+    const auto result = node_to_process->tb_probe.get();
+    if (MakeTablebaseTerminal(node, result.wdl, result.state)) {
+      // Like nodes probed synchronously, which never get edges.
+      node->ReleaseEdges();
+      node_to_process->nn_queried = false;
+    }
+  }
   if (!node_to_process->nn_queried) {
     // Terminal nodes don't involve the neural NetworkComputation, nor do
     // they require any further processing after value retrieval.
@@ -2217,9 +3094,14 @@ void SearchWorker::FetchSingleNodeResult(NodeToProcess* node_to_process) {
 // 6. Propagate the new nodes' information to all their parents in the tree.
 // ~~~~~~~~~~~~~~
 void SearchWorker::DoBackupUpdate() {
+  ScopedPhaseTimer phase_timer(&profile_, SearchPhase::kBackup);
+  TraceScope trace("Search::DoBackupUpdate");
   // Nodes mutex for doing node updates.
-  SharedMutex::Lock lock(search_->nodes_mutex_);
+  const uint64_t lock_start = PhaseProfile::Now();
+  BrSharedMutex::Lock lock(search_->nodes_mutex_);
+  profile_.AddSince(SearchPhase::kNodesLockWait, lock_start);
 
+  const int64_t playouts_before = search_->total_playouts_;
   bool work_done = number_out_of_order_ > 0;
   for (const NodeToProcess& node_to_process : minibatch_) {
     DoBackupUpdateSingleNode(node_to_process);
@@ -2227,9 +3109,16 @@ void SearchWorker::DoBackupUpdate() {
       work_done = true;
     }
   }
+  const int64_t playouts = search_->total_playouts_ - playouts_before;
+  kPlayoutsMetric->Add(playouts);
+  if (search_->helped_search_playouts_) {
+    search_->helped_search_playouts_->fetch_add(playouts,
+                                                std::memory_order_relaxed);
+  }
   if (!work_done) return;
   search_->CancelSharedCollisions();
   search_->total_batches_ += 1;
+  kBatchesMetric->Add();
 }
 
 void SearchWorker::DoBackupUpdateSingleNode(
@@ -2252,10 +3141,11 @@ void SearchWorker::DoBackupUpdateSingleNode(
   float v_delta = 0.0f;
   float d_delta = 0.0f;
   float m_delta = 0.0f;
-  uint32_t solid_threshold =
-      static_cast<uint32_t>(params_.GetSolidTreeThreshold());
+  // Number of moves from the root to p.
+  size_t p_depth = node_to_process.moves_to_visit.size();
   for (Node *n = node, *p; n != search_->root_node_->GetParent(); n = p) {
     p = n->GetParent();
+    --p_depth;
 
     // Current node might have become terminal from some other descendant, so
     // backup the rest of the way with more accurate values.
@@ -2268,13 +3158,9 @@ void SearchWorker::DoBackupUpdateSingleNode(
     if (n_to_fix > 0 && !n->IsTerminal()) {
       n->AdjustForTerminal(v_delta, d_delta, m_delta, n_to_fix);
     }
-    if (n->GetN() >= solid_threshold) {
-      if (n->MakeSolid() && n == search_->root_node_) {
-        // If we make the root solid, the current_best_edge_ becomes invalid and
-        // we should repopulate it.
-        search_->current_best_edge_ =
-            search_->GetBestChildNoTemperature(search_->root_node_, 0);
-      }
+    // The watchdog makes it solid, moving nodes is too slow for the backup.
+    if (!n->IsSolid() && n->GetN() >= search_->solid_threshold_) {
+      search_->solidify_pending_ = true;
     }
 
     // Nothing left to do without ancestors to update.
@@ -2287,6 +3173,13 @@ void SearchWorker::DoBackupUpdateSingleNode(
     update_parent_bounds =
         update_parent_bounds && p != search_->root_node_ && !p->IsTerminal() &&
         MaybeSetBounds(p, m, &n_to_fix, &v_delta, &d_delta, &m_delta);
+    if (update_parent_bounds && p->IsTerminal() && search_->proven_bounds_) {
+      const auto& moves = node_to_process.moves_to_visit;
+      proven_bounds_.emplace_back(
+          std::vector<Move>(moves.begin(), moves.begin() + p_depth),
+          ProvenBoundsTable::Entry{p->GetBounds().first, p->GetM(),
+                                   p->IsTbTerminal()});
+    }
 
     // Q will be flipped for opponent.
     v = -v;
@@ -2314,6 +3207,17 @@ void SearchWorker::DoBackupUpdateSingleNode(
   search_->max_depth_ = std::max(search_->max_depth_, node_to_process.depth);
 }
 
+void SearchWorker::StoreProvenBounds() {
+  if (proven_bounds_.empty()) return;
+  for (const auto& [moves, entry] : proven_bounds_) {
+    history_.Trim(search_->played_history_.GetLength());
+    for (Move move : moves) history_.Append(move);
+    search_->proven_bounds_->Store(
+        history_.HashLast(history_.Last().GetRule50Ply() + 1), entry);
+  }
+  proven_bounds_.clear();
+}
+
 bool SearchWorker::MaybeSetBounds(Node* p, float m, int* n_to_fix,
                                   float* v_delta, float* d_delta,
                                   float* m_delta) const {
@@ -28,26 +28,104 @@
 #pragma once
 
 #include <array>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <functional>
+#include <future>
 #include <optional>
 #include <shared_mutex>
 #include <thread>
+#include <unordered_map>
 
 #include "chess/callbacks.h"
 #include "chess/uciloop.h"
 #include "neural/backend.h"
-#include "neural/cache.h"
+#include "search/artifacts.h"
+#include "search/classic/batch_tuner.h"
 #include "search/classic/node.h"
 #include "search/classic/params.h"
+#include "search/classic/profiler.h"
 #include "search/classic/stoppers/timemgr.h"
+#include "syzygy/probe_service.h"
 #include "syzygy/syzygy.h"
 #include "utils/logging.h"
 #include "utils/mutex.h"
+#include "utils/numa.h"
+#include "utils/parking.h"
 
 namespace lczero {
 namespace classic {
 
+// Positions that a search evaluated speculatively after it was done. The next
+// search on the same tree marks the ones it got from the cache, which gives
+// the hit rate of the speculation.
+class SpeculativePrefetchLog {
+ public:
+  // Logs the hit rate of the current positions and forgets them.
+  void Reset();
+  void Add(uint64_t hash) { positions_.try_emplace(hash, false); }
+  // Thread safe, as long as no positions are added at the same time.
+  void MarkUsed(uint64_t hash) {
+    if (positions_.empty()) return;
+    auto iter = positions_.find(hash);
+    if (iter != positions_.end()) {
+      iter->second.store(true, std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  std::unordered_map<uint64_t, std::atomic<bool>> positions_;
+};
+
+// Results of positions that the search proved with StickyEndgames, kept
+// across subtrees and moves of a game, so that transpositions into them are
+// terminal right away instead of being searched again. Keyed by the positions
+// since the last irreversible move, which are all that repetitions, and so the
+// proofs, depend on. Entries are single words, a colliding key overwrites.
+class ProvenBoundsTable {
+ public:
+  struct Entry {
+    GameResult result;
+    float m;
+    bool tablebase;
+  };
+  // Sets the number of entries, rounded down to a power of two, and clears
+  // them if it changed. Not thread safe.
+  void Resize(size_t size);
+  // Not thread safe.
+  void Clear();
+  size_t size() const { return size_; }
+  std::optional<Entry> Lookup(uint64_t key) const;
+  void Store(uint64_t key, const Entry& entry);
+
+ private:
+  std::unique_ptr<std::atomic<uint64_t>[]> slots_;
+  size_t size_ = 0;
+};
+
+// Work done by the search workers, summed over all their iterations.
+struct SearchStats {
+  // Minibatches sent to the backend, by size rounded down to a power of two:
+  // batch_sizes[i] counts batches of 2^i to 2^(i+1)-1 positions.
+  std::array<int64_t, 16> batch_sizes = {};
+  int64_t batches = 0;
+  // Positions the backend was asked to compute.
+  int64_t nn_evals = 0;
+  // Nodes picked to extend, how many of them were collisions, and how many
+  // were served from the cache.
+  int64_t picked_nodes = 0;
+  int64_t collisions = 0;
+  int64_t cache_hits = 0;
+  // Time spent in each iteration phase, summed over the search workers.
+  std::chrono::nanoseconds gather_time{0};
+  std::chrono::nanoseconds compute_time{0};
+  std::chrono::nanoseconds fetch_time{0};
+  std::chrono::nanoseconds backup_time{0};
+
+  void Add(const SearchStats& other);
+};
+
 class Search {
  public:
   Search(const NodeTree& tree, Backend* network,
@@ -55,7 +133,9 @@ class Search {
          const MoveList& searchmoves,
          std::chrono::steady_clock::time_point start_time,
          std::unique_ptr<SearchStopper> stopper, bool infinite, bool ponder,
-         const OptionsDict& options, SyzygyTablebase* syzygy_tb);
+         const OptionsDict& options, SyzygyTablebase* syzygy_tb,
+         SpeculativePrefetchLog* speculative_log = nullptr,
+         ProvenBoundsTable* proven_bounds = nullptr);
 
   ~Search();
 
@@ -70,6 +150,23 @@ class Search {
   void Stop();
   // Stops search, but does not return bestmove. The function is not blocking.
   void Abort();
+  // Holds bestmove until PonderHit() or Stop(), like during `go ponder`, but
+  // with the contempt of the side to move at the root. To be called before
+  // StartThreads().
+  void HoldBestMove();
+  // Turns a held search into a normal one limited by @stopper, with the move
+  // time counted from @move_start_time. The search keeps running.
+  void PonderHit(std::unique_ptr<SearchStopper> stopper,
+                 std::chrono::steady_clock::time_point move_start_time);
+  // Adds a search of the same position on a separate tree, whose root visits
+  // are merged into the choice of bestmove. The helper is aborted when this
+  // search responds with bestmove. To be called before StartThreads().
+  void AddRootHelper(Search* helper);
+  // Returns the visits of the root children, by move.
+  std::vector<std::pair<Move, uint32_t>> GetRootVisits() const;
+  // Returns the artifacts of the search, collected when it responded with
+  // bestmove.
+  SearchArtifacts GetArtifacts() const;
   // Blocks until all worker thread finish.
   void Wait();
   // Returns whether search is active. Workers check that to see whether another
@@ -88,6 +185,8 @@ class Search {
   Eval GetBestEval(Move* move = nullptr, bool* is_terminal = nullptr) const;
   // Returns the total number of playouts in the search.
   std::int64_t GetTotalPlayouts() const;
+  // Returns what the search workers did so far.
+  SearchStats GetStats() const;
   // Returns the search parameters.
   const SearchParams& GetParams() const { return params_; }
 
@@ -109,19 +208,39 @@ class Search {
   std::vector<EdgeAndNode> GetBestChildrenNoTemperature(Node* parent, int count,
                                                         int depth) const;
   EdgeAndNode GetBestRootChildWithTemperature(float temperature) const;
+  // Returns the root child with most visits summed over this search and the
+  // root helpers, unless @best (of this tree alone) is a proven result.
+  EdgeAndNode GetBestRootChildMerged(EdgeAndNode best) const;
+  // Returns the playouts of the root helpers so far.
+  int64_t GetRootHelpersPlayouts() const {
+    return root_helpers_playouts_.load(std::memory_order_relaxed);
+  }
 
   int64_t GetTimeSinceStart() const;
   int64_t GetTimeSinceFirstBatch() const;
   void MaybeTriggerStop(const IterationStats& stats, StoppersHints* hints);
   void MaybeOutputInfo();
+  // Collects the uci info for all the multipv lines, without sending it.
+  std::vector<ThinkingInfo> GetUciInfo();
   void SendUciInfo();  // Requires nodes_mutex_ to be held.
   // Sets stop to true and notifies watchdog thread.
   void FireStopInternal();
 
   void SendMovesStats() const;
+  // Collects artifacts_ from the root, when the search is done.
+  void FillArtifacts() REQUIRES(nodes_mutex_) REQUIRES(counters_mutex_);
+  // Sends lines from GetVerboseStats() as info strings or to the log file.
+  void OutputMovesStats(const std::vector<std::string>& move_stats) const;
+#ifdef LC0_SEARCH_PROFILING
+  // Sends the per phase timings of the search workers as info strings.
+  void SendPhaseProfile() const;
+#endif
   // Function which runs in a separate thread and watches for time and
   // uci `stop` command;
   void WatchdogThread();
+  // Once the workers have exited, evaluates up to @budget highest prior
+  // unvisited children of the PV nodes into the cache, until aborted.
+  void SpeculativePrefetch(int budget);
 
   // Fills IterationStats with global (rather than per-thread) portion of search
   // statistics. Currently all stats there (in IterationStats) are global
@@ -137,14 +256,30 @@ class Search {
   // Depth of a root node is 0 (even number).
   float GetDrawScore(bool is_odd_depth) const;
 
+  // Makes solid the nodes past the solid tree threshold, walking the tree
+  // breadth first from the root so that the upper levels are laid out in
+  // that order. Adapts the threshold to the time the pass holds the lock.
+  void MaybeSolidifyTree();
+
+  // When the tree holds more than compaction_nodes_limit_ nodes, releases the
+  // children of the least promising nodes (by their share of the parent's
+  // visits) until it's back under the limit with some room.
+  void MaybeCompactTree();
+
   // Ensure that all shared collisions are cancelled and clear them out.
   void CancelSharedCollisions();
 
   PositionHistory GetPositionHistoryAtNode(const Node* node) const;
 
+  // Serializes info and bestmove output, taken before nodes_mutex_.
+  Mutex info_mutex_ ACQUIRED_BEFORE(nodes_mutex_);
   mutable Mutex counters_mutex_ ACQUIRED_AFTER(nodes_mutex_);
   // Tells all threads to stop.
   std::atomic<bool> stop_{false};
+  // Tells the speculative prefetch to stop, set by Abort().
+  std::atomic<bool> abort_prefetch_{false};
+  // Number of worker threads that haven't exited yet.
+  std::atomic<int> running_workers_{0};
   // Condition variable used to watch stop_ variable.
   std::condition_variable watchdog_cv_;
   // Tells whether it's ok to respond bestmove when limits are reached.
@@ -158,17 +293,32 @@ class Search {
   // consistent results.
   Move final_bestmove_ GUARDED_BY(counters_mutex_);
   Move final_pondermove_ GUARDED_BY(counters_mutex_);
+  SearchArtifacts artifacts_ GUARDED_BY(counters_mutex_);
   std::unique_ptr<SearchStopper> stopper_ GUARDED_BY(counters_mutex_);
+  // What the stopper counts time from, moved forward at ponderhit.
+  std::chrono::steady_clock::time_point move_start_time_
+      GUARDED_BY(counters_mutex_);
 
   Mutex threads_mutex_;
   std::vector<std::thread> threads_ GUARDED_BY(threads_mutex_);
 
   Node* root_node_;
   SyzygyTablebase* syzygy_tb_;
+  // Probes tablebases for new nodes if enabled.
+  std::unique_ptr<SyzygyProbeService> tb_probe_service_;
   // Fixed positions which happened before the search.
   const PositionHistory& played_history_;
 
   Backend* const backend_;
+  SpeculativePrefetchLog* const speculative_log_;
+  // Null unless StickyEndgames results are shared beyond the tree.
+  ProvenBoundsTable* const proven_bounds_;
+  std::vector<Search*> root_helpers_;
+  // The root helpers add their playouts here, so that the node limits of this
+  // search apply to all trees together.
+  std::atomic<int64_t> root_helpers_playouts_{0};
+  // Of the search this one is a root helper of, null otherwise.
+  std::atomic<int64_t>* helped_search_playouts_ = nullptr;
   BackendAttributes backend_attributes_;
   const SearchParams params_;
   const MoveList searchmoves_;
@@ -180,27 +330,48 @@ class Search {
   std::atomic<int> tb_hits_{0};
   const MoveList root_move_filter_;
 
-  mutable SharedMutex nodes_mutex_;
+  mutable BrSharedMutex nodes_mutex_;
   EdgeAndNode current_best_edge_ GUARDED_BY(nodes_mutex_);
-  Edge* last_outputted_info_edge_ GUARDED_BY(nodes_mutex_) = nullptr;
-  ThinkingInfo last_outputted_uci_info_ GUARDED_BY(nodes_mutex_);
+  Edge* last_outputted_info_edge_ GUARDED_BY(info_mutex_) = nullptr;
+  ThinkingInfo last_outputted_uci_info_ GUARDED_BY(info_mutex_);
   int64_t total_playouts_ GUARDED_BY(nodes_mutex_) = 0;
   int64_t total_batches_ GUARDED_BY(nodes_mutex_) = 0;
   // Maximum search depth = length of longest path taken in PickNodetoExtend.
   uint16_t max_depth_ GUARDED_BY(nodes_mutex_) = 0;
   // Cumulative depth of all paths taken in PickNodetoExtend.
   uint64_t cum_depth_ GUARDED_BY(nodes_mutex_) = 0;
+  // Nodes are made solid once they have that many visits.
+  uint32_t solid_threshold_ GUARDED_BY(nodes_mutex_);
+  // Set by backup when a node that is not solid reaches the threshold.
+  bool solidify_pending_ GUARDED_BY(nodes_mutex_) = false;
+  // Tree size that MaybeCompactTree() keeps, 0 when it's off.
+  const int64_t compaction_nodes_limit_;
+  // Visits below the nodes released by MaybeCompactTree(), as an estimate of
+  // nodes that are no longer in the tree.
+  int64_t compacted_visits_ GUARDED_BY(nodes_mutex_) = 0;
 
   std::optional<std::chrono::steady_clock::time_point> nps_start_time_
       GUARDED_BY(counters_mutex_);
 
   std::atomic<int> pending_searchers_{0};
+  // Notified when a searcher slot is released, for the searchers waiting for
+  // one with SearchSpinBackoff.
+  ParkingSpot searcher_parking_;
   std::atomic<int> backend_waiting_counter_{0};
   std::atomic<int> thread_count_{0};
 
   std::vector<std::pair<Node*, int>> shared_collisions_
       GUARDED_BY(nodes_mutex_);
 
+  mutable Mutex stats_mutex_;
+  SearchStats stats_ GUARDED_BY(stats_mutex_);
+  // Per phase timings of the search workers, only filled in when the search
+  // is built with profiling.
+  PhaseProfile profile_ GUARDED_BY(stats_mutex_);
+  const uint64_t profile_start_ticks_ = PhaseProfile::Now();
+  const std::chrono::steady_clock::time_point profile_start_time_ =
+      std::chrono::steady_clock::now();
+
   std::unique_ptr<UciResponder> uci_responder_;
   ContemptMode contempt_mode_;
   friend class SearchWorker;
@@ -211,7 +382,8 @@ class Search {
 // within one thread, have to split into stages.
 class SearchWorker {
  public:
-  SearchWorker(Search* search, const SearchParams& params)
+  // @id numbers the workers of a search, for the thread placement.
+  SearchWorker(Search* search, const SearchParams& params, int id = 0)
       : search_(search),
         history_(search_->played_history_),
         params_(params),
@@ -227,9 +399,27 @@ class SearchWorker {
             std::thread::hardware_concurrency() / working_threads - 1, 4U);
       }
     }
+    // The worker and its task workers share the queues, so keep them on one
+    // node.
+    Numa::PlaceThread(id, task_workers_ + 1);
+    task_queues_ = std::make_unique<TaskQueue[]>(task_workers_ + 1);
+    main_workspace_.history = search_->played_history_;
     for (int i = 0; i < task_workers_; i++) {
       task_workspaces_.emplace_back();
-      task_threads_.emplace_back([this, i]() { this->RunTasks(i); });
+      task_workspaces_.back().queue = i + 1;
+      task_workspaces_.back().history = search_->played_history_;
+    }
+    for (int i = 0; i < task_workers_; i++) {
+      task_threads_.emplace_back([this, id, i]() {
+        Numa::PlaceThread(id, task_workers_ + 1);
+        this->RunTasks(i);
+      });
+    }
+    if (params_.GetPipelinedSearch()) {
+      compute_thread_ = std::thread([this, id]() {
+        Numa::PlaceThread(id, task_workers_ + 1);
+        this->RunComputations();
+      });
     }
     target_minibatch_size_ = params_.GetMiniBatchSize();
     if (target_minibatch_size_ == 0) {
@@ -239,11 +429,27 @@ class SearchWorker {
     max_out_of_order_ =
         std::max(1, static_cast<int>(params_.GetMaxOutOfOrderEvalsFactor() *
                                      target_minibatch_size_));
+    if (params_.GetMiniBatchAutoTune()) {
+      int max_size = params_.GetMiniBatchMaxSize();
+      if (max_size == 0) {
+        max_size = search_->backend_attributes_.maximum_batch_size;
+      }
+      max_size = std::max(max_size, 1);
+      const int min_size = std::min(params_.GetMiniBatchMinSize(), max_size);
+      tuner_.emplace(
+          MinibatchTuner::Params{min_size, max_size,
+                                 params_.GetMiniBatchMaxCollisions(),
+                                 params_.GetMaxOutOfOrderEvalsFactor()},
+          target_minibatch_size_);
+      target_minibatch_size_ = tuner_->GetMinibatchSize();
+      max_out_of_order_ = tuner_->GetMaxOutOfOrder();
+    }
   }
 
   ~SearchWorker() {
     {
       task_count_.store(-1, std::memory_order_release);
+      task_parking_.Notify();
       Mutex::Lock lock(picking_tasks_mutex_);
       exiting_ = true;
       task_added_.notify_all();
@@ -251,6 +457,14 @@ class SearchWorker {
     for (size_t i = 0; i < task_threads_.size(); i++) {
       task_threads_[i].join();
     }
+    if (compute_thread_.joinable()) {
+      {
+        Mutex::Lock lock(compute_mutex_);
+        compute_exiting_ = true;
+      }
+      compute_added_.notify_all();
+      compute_thread_.join();
+    }
   }
 
   // Runs iterations while needed.
@@ -262,6 +476,7 @@ class SearchWorker {
       do {
         ExecuteOneIteration();
       } while (search_->IsSearchActive());
+      FinishPipelinedBatch();
     } catch (std::exception& e) {
       std::cerr << "Unhandled exception in worker thread: " << e.what()
                 << std::endl;
@@ -295,6 +510,18 @@ class SearchWorker {
 
   // 4. Run NN computation.
   void RunNNComputation();
+  // Pipelined alternative: starts computing the gathered minibatch in the
+  // background and makes the minibatch started on the previous iteration
+  // current again once its computation is done. Returns false if there was
+  // none.
+  bool SwapInPipelinedBatch();
+  // Completes steps 5-7 for the batch still in flight when search stops.
+  void FinishPipelinedBatch();
+  // Queues @computation for compute_thread_. The future is ready, or holds
+  // the backend error, once it's computed.
+  std::future<void> ComputeInBackground(BackendComputation* computation);
+  // Body of compute_thread_.
+  void RunComputations();
 
   // 5. Retrieve NN computations (and terminal values) into nodes.
   void FetchMinibatchResults();
@@ -310,7 +537,7 @@ class SearchWorker {
     bool IsExtendable() const { return !is_collision && !node->IsTerminal(); }
     bool IsCollision() const { return is_collision; }
     bool CanEvalOutOfOrder() const {
-      return is_cache_hit || node->IsTerminal();
+      return (is_cache_hit || node->IsTerminal()) && !tb_probe.valid();
     }
 
     // The node to extend.
@@ -327,8 +554,12 @@ class SearchWorker {
     bool is_collision = false;
     // Only populated for visits,
     std::vector<Move> moves_to_visit;
+    // Pending tablebase probe of the node, its result replaces the NN
+    // evaluation.
+    std::future<SyzygyProbeService::Result> tb_probe;
 
     // Details that are filled in as we go.
+    // Evaluated out of order and already backed up.
     bool ooo_completed = false;
 
     static NodeToProcess Collision(Node* node, uint16_t depth,
@@ -362,7 +593,11 @@ class SearchWorker {
     std::vector<int> vtp_last_filled;
     std::vector<int> current_path;
     std::vector<Move> moves_to_path;
+    // Starts with the played history, which stays in place between tasks so
+    // that only the search path is trimmed and appended.
     PositionHistory history;
+    // Index of the task queue of the thread using this workspace.
+    int queue = 0;
     TaskWorkspace() {
       vtp_buffer.reserve(30);
       visits_to_perform.reserve(30);
@@ -401,10 +636,23 @@ class SearchWorker {
         : task_type(kProcessing), start_idx(start_idx), end_idx(end_idx) {}
   };
 
+  struct PipelinedBatch {
+    std::vector<NodeToProcess> minibatch;
+    std::unique_ptr<BackendComputation> computation;
+    int number_out_of_order = 0;
+    std::future<void> computed;
+  };
+
   NodeToProcess PickNodeToExtend(int collision_limit);
   bool AddNodeToComputation(Node* node);
   int PrefetchIntoCache(Node* node, int budget, bool is_odd_depth);
   void DoBackupUpdateSingleNode(const NodeToProcess& node_to_process);
+  // Stores the bounds proven during the backups into search_->proven_bounds_.
+  // Replays the paths, so it's done after the nodes lock is released.
+  void StoreProvenBounds();
+  // Waits for @batch to be computed and makes it the current minibatch.
+  // Returns false if @batch is empty.
+  bool RestorePipelinedBatch(PipelinedBatch* batch);
   // Returns whether a node's bounds were set based on its children.
   bool MaybeSetBounds(Node* p, float m, int* n_to_fix, float* v_delta,
                       float* d_delta, float* m_delta) const;
@@ -414,14 +662,29 @@ class SearchWorker {
                              const std::vector<Move>& moves_to_base,
                              std::vector<NodeToProcess>* receiver,
                              TaskWorkspace* workspace);
-  void EnsureNodeTwoFoldCorrectForDepth(Node* node, int depth);
+  // Makes the twofold draws (node and depth pairs) that were first repeated
+  // before root non terminal again, and reverts their visits in the tree.
+  void RevertTwoFoldDraws(const std::vector<std::pair<Node*, int>>& nodes)
+      REQUIRES(search_->nodes_mutex_);
+  // Extends the picked nodes and queues their evaluations. The ones that can
+  // be evaluated out of order are backed up right away.
   void ProcessPickedTask(int batch_start, int batch_end,
                          TaskWorkspace* workspace);
+  void PrefetchTablebases(int batch_start, int batch_end,
+                          PositionHistory* history);
   void ExtendNode(Node* node, int depth, const std::vector<Move>& moves_to_add,
-                  PositionHistory* history);
+                  PositionHistory* history,
+                  std::future<SyzygyProbeService::Result>* tb_probe);
+  bool MakeTablebaseTerminal(Node* node, WDLScore wdl, ProbeState state);
   void FetchSingleNodeResult(NodeToProcess* node_to_process);
   void RunTasks(int tid);
+  void RunTask(int id, TaskWorkspace* workspace);
   void ResetTasks();
+  // Adds picking_tasks_[id] to the given task queue.
+  void PushTask(int queue, int id);
+  // Takes the newest task from own queue, or steals the oldest one from
+  // another queue. Returns -1 if there is nothing to do.
+  int TakeTask(int queue);
   // Returns how many tasks there were.
   int WaitForTasks();
 
@@ -432,23 +695,61 @@ class SearchWorker {
   int task_workers_;
   int target_minibatch_size_;
   int max_out_of_order_;
+  // Adjusts the two above when MinibatchAutoTune is on.
+  std::optional<MinibatchTuner> tuner_;
   // History is reset and extended by PickNodeToExtend().
   PositionHistory history_;
   int number_out_of_order_ = 0;
+  // Minibatch being computed in the background when search is pipelined.
+  PipelinedBatch pipelined_batch_;
+  // Pipelined search computes its minibatches on this thread, which is kept
+  // for the whole search instead of being started for every minibatch.
+  std::thread compute_thread_;
+  Mutex compute_mutex_;
+  std::condition_variable compute_added_;
+  std::deque<std::pair<BackendComputation*, std::promise<void>>> compute_queue_
+      GUARDED_BY(compute_mutex_);
+  bool compute_exiting_ GUARDED_BY(compute_mutex_) = false;
+  // Nodes that the backups made terminal from their children's bounds, with
+  // the moves from the root to them.
+  std::vector<std::pair<std::vector<Move>, ProvenBoundsTable::Entry>>
+      proven_bounds_;
   const SearchParams& params_;
   std::unique_ptr<Node> precached_node_;
   const bool moves_left_support_;
   IterationStats iteration_stats_;
   StoppersHints latest_time_manager_hints_;
+  // Phase timings of the current iteration, merged into the Search's profile
+  // at its end.
+  PhaseProfile profile_;
 
   // Multigather task related fields.
 
   Mutex picking_tasks_mutex_;
   std::vector<PickTask> picking_tasks_;
+  // Twofold draws met during picking whose visits have to be reverted, which
+  // is done after picking as it needs exclusive nodes_mutex_.
+  std::vector<std::pair<Node*, int>> pending_twofold_reverts_
+      GUARDED_BY(picking_tasks_mutex_);
   std::atomic<int> task_count_ = -1;
-  std::atomic<int> task_taking_started_ = 0;
-  std::atomic<int> tasks_taken_ = 0;
   std::atomic<int> completed_tasks_ = 0;
+  // Per thread queues of indices into picking_tasks_. Queue 0 belongs to the
+  // thread running the search worker, queue i + 1 to task worker i.
+  struct alignas(64) TaskQueue {
+    Mutex mutex;
+    std::vector<int> ids GUARDED_BY(mutex);
+    // Stolen tasks are taken from the front, so ids before head are gone.
+    size_t head GUARDED_BY(mutex) = 0;
+    // Number of tasks in the queue, to check for work without the lock.
+    std::atomic<int> size = 0;
+  };
+  std::unique_ptr<TaskQueue[]> task_queues_;
+  // Task workers park here during a gather when no task is queued, notified
+  // for every new task and at the end of the gather.
+  ParkingSpot task_parking_;
+  // The search worker parks here in WaitForTasks(), notified for every
+  // completed task.
+  ParkingSpot completion_parking_;
   std::condition_variable task_added_;
   std::vector<std::thread> task_threads_;
   std::vector<TaskWorkspace> task_workspaces_;
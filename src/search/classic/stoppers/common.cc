@@ -27,6 +27,8 @@
 
 #include "search/classic/stoppers/common.h"
 
+#include <algorithm>
+
 #include "neural/shared_params.h"
 
 namespace lczero {
@@ -40,6 +42,19 @@ const OptionId kRamLimitMbId{
     "terminal node counted several times, and the estimation assumes that all "
     "positions have 30 possible moves. When set to 0, no RAM limit is "
     "enforced."};
+const OptionId kMemoryBudgetMbId{
+    "memory-budget-mb", "MemoryBudgetMb",
+    "Memory budget for the search tree, the tree garbage collector backlog and "
+    "the NN cache together, in megabytes. Unlike RamLimitMb, the actual usage "
+    "is measured. Before a search, the NN cache is shrunk if it doesn't leave "
+    "room for the tree, and the search stops when the budget is reached. When "
+    "set to 0, no budget is enforced."};
+const OptionId kTreeCompactionId{
+    "tree-compaction", "TreeCompaction",
+    "In infinite analysis, instead of stopping the search when the tree "
+    "reaches RamLimitMb, release the subtrees of the least promising nodes "
+    "and keep searching. The released nodes keep their visits and evaluation "
+    "as a leaf would."};
 const OptionId kMinimumKLDGainPerNodeId{
     "minimum-kldgain-per-node", "MinimumKLDGainPerNode",
     "If greater than 0 search will abort unless the last "
@@ -78,6 +93,8 @@ void PopulateCommonStopperOptions(RunType for_what, OptionsParser* options) {
 
   if (for_what == RunType::kUci || for_what == RunType::kSimpleUci) {
     options->Add<IntOption>(kRamLimitMbId, 0, 100000000) = 0;
+    options->Add<IntOption>(kMemoryBudgetMbId, 0, 100000000) = 0;
+    options->Add<BoolOption>(kTreeCompactionId) = true;
     options->HideOption(kMinimumKLDGainPerNodeId);
     options->HideOption(kKLDGainAverageIntervalId);
     options->HideOption(kNodesAsPlayoutsId);
@@ -88,6 +105,23 @@ void PopulateCommonStopperOptions(RunType for_what, OptionsParser* options) {
   }
 }
 
+size_t GetMemoryBudgetBytes(const OptionsDict& options) {
+  if (!options.Exists<int>(kMemoryBudgetMbId)) return 0;
+  return static_cast<size_t>(options.Get<int>(kMemoryBudgetMbId)) << 20;
+}
+
+int64_t GetTreeCompactionNodesLimit(const OptionsDict& options) {
+  if (!options.Exists<bool>(kTreeCompactionId) ||
+      !options.Get<bool>(kTreeCompactionId)) {
+    return 0;
+  }
+  const int ram_limit = options.Get<int>(kRamLimitMbId);
+  if (ram_limit == 0) return 0;
+  return std::max<int64_t>(
+      1, MemoryWatchingStopper::GetNodesLimit(
+             options.Get<int>(SharedBackendParams::kNNCacheSizeId), ram_limit));
+}
+
 // Parameters needed for selfplay and uci, but not benchmark nor infinite mode.
 void PopulateIntrinsicStoppers(ChainedSearchStopper* stopper,
                                const OptionsDict& options) {
@@ -117,11 +151,17 @@ void PopulateCommonUciStoppers(ChainedSearchStopper* stopper,
   const auto cache_size_mb =
       options.Get<int>(SharedBackendParams::kNNCacheSizeId);
   const int ram_limit = options.Get<int>(kRamLimitMbId);
-  if (ram_limit) {
+  // With tree compaction, infinite analysis keeps the tree in the limit
+  // instead.
+  if (ram_limit && !(infinite && GetTreeCompactionNodesLimit(options) > 0)) {
     stopper->AddStopper(std::make_unique<MemoryWatchingStopper>(
         cache_size_mb, ram_limit,
         options.Get<float>(kSmartPruningFactorId) > 0.0f));
   }
+  const size_t memory_budget = GetMemoryBudgetBytes(options);
+  if (memory_budget > 0) {
+    stopper->AddStopper(std::make_unique<MemoryBudgetStopper>(memory_budget));
+  }
 
   // "go nodes" stopper.
   int64_t node_limit = 0;
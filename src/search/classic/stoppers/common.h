@@ -37,6 +37,13 @@ namespace classic {
 enum class RunType { kUci, kSimpleUci, kSelfplay };
 void PopulateCommonStopperOptions(RunType for_what, OptionsParser* options);
 
+// Returns the memory budget in bytes, or 0 when there is none.
+size_t GetMemoryBudgetBytes(const OptionsDict& options);
+
+// Returns the number of nodes that the tree is compacted to stay under in
+// infinite analysis, or 0 when tree compaction is off.
+int64_t GetTreeCompactionNodesLimit(const OptionsDict& options);
+
 // Populates KLDGain and SmartPruning stoppers.
 void PopulateIntrinsicStoppers(ChainedSearchStopper* stopper,
                                const OptionsDict& options);
@@ -55,6 +55,9 @@ class Params {
   }
   // Number of seconds to update nps estimation.
   float nps_update_seconds() const { return nps_update_seconds_; }
+  // Number of moves needed to update the estimation of the time from the
+  // start of a move to its first finished batch halfway.
+  float startup_halfupdate_moves() const { return startup_halfupdate_moves_; }
   // Fraction of the allocated time the engine uses, initial estimation.
   float initial_smartpruning_timeuse() const {
     return initial_smartpruning_timeuse_;
@@ -111,6 +114,7 @@ class Params {
   const float max_tree_reuse_;
   const float tree_reuse_halfupdate_moves_;
   const float nps_update_seconds_;
+  const float startup_halfupdate_moves_;
   const float initial_smartpruning_timeuse_;
   const float min_smartpruning_timeuse_;
   const float smartpruning_timeuse_halfupdate_moves_;
@@ -147,6 +151,8 @@ Params::Params(const OptionsDict& params, int64_t move_overhead)
           params.GetOrDefault<float>("tree-reuse-update-rate", 3.39f)),
       nps_update_seconds_(
           params.GetOrDefault<float>("nps-update-period", 20.0f)),
+      startup_halfupdate_moves_(
+          params.GetOrDefault<float>("startup-update-rate", 2.0f)),
       initial_smartpruning_timeuse_(
           params.GetOrDefault<float>("init-timeuse", 0.7f)),
       min_smartpruning_timeuse_(
@@ -290,9 +296,20 @@ class SmoothTimeManager : public TimeManager {
     return nps_;
   }
 
+  // @startup_time is the time until the first batch was done, negative when
+  // unknown.
   void UpdateEndOfMoveStats(int64_t total_move_time, bool used_piggybank,
-                            int64_t time_budget, int64_t total_nodes) {
+                            int64_t time_budget, int64_t total_nodes,
+                            int64_t startup_time) {
     Mutex::Lock lock(mutex_);
+    if (startup_time >= 0) {
+      startup_ms_ = startup_is_known_
+                        ? ExponentialDecay(startup_ms_, startup_time,
+                                           params_.startup_halfupdate_moves(),
+                                           1.0f)
+                        : startup_time;
+      startup_is_known_ = true;
+    }
     // Whatever is in nps_ after the first move, is truth now.
     nps_is_reliable_ = true;
     // How different was this move from an average move
@@ -330,7 +347,9 @@ class SmoothTimeManager : public TimeManager {
             << "ms. New time_use=" << timeuse_
             << ", update_rate=" << this_move_time_fraction
             << " (avg_move_time=" << avg_ms_per_move_ << "ms)."
-            << " piggybank_used=" << piggybank_time_used << "ms";
+            << " piggybank_used=" << piggybank_time_used << "ms"
+            << ", startup_time=" << startup_time
+            << "ms (avg=" << startup_ms_ << "ms)";
   }
 
  private:
@@ -389,8 +408,12 @@ class SmoothTimeManager : public TimeManager {
         0.0f, *time - piggybank_time_ + increment * (remaining_moves - 1) -
                   params_.move_overhead_ms());
 
+    // Every move first waits for its first batch, e.g. for backend warm-up and
+    // cache misses, and the nps only counts from there.
+    const float thinking_remaining_ms =
+        std::max(0.0f, total_remaining_ms - startup_ms_ * remaining_moves);
     // Total remaining nodes that we'll have chance to compute in a game.
-    const float remaining_game_nodes = total_remaining_ms * nps_ / 1000.0f;
+    const float remaining_game_nodes = thinking_remaining_ms * nps_ / 1000.0f;
     // Total (fresh) nodes, in average, to processed per move.
     const float avg_nodes_per_move = remaining_game_nodes / remaining_moves;
     // Average time that will be spent per move.
@@ -416,7 +439,7 @@ class SmoothTimeManager : public TimeManager {
         piggybank_time_ * params_.max_piggybank_use();
     // This is what is the actual budget as we hope that the search will be
     // shorter due to smart pruning.
-    move_allocated_time_ms_ = expected_movetime_ms / timeuse_;
+    move_allocated_time_ms_ = expected_movetime_ms / timeuse_ + startup_ms_;
 
     if (move_allocated_time_ms_ >
         *time * params_.max_single_move_time_fraction()) {
@@ -456,7 +479,8 @@ class SmoothTimeManager : public TimeManager {
     LOGFILE << std::fixed << std::setprecision(1)
             << "TMGR: REMAINING GAME: nodes=" << remaining_game_nodes
             << ", moves=" << remaining_moves << ", time=" << total_remaining_ms
-            << "ms, nps=" << nps_;
+            << "ms, thinking_time=" << thinking_remaining_ms
+            << "ms, nps=" << nps_ << ", startup=" << startup_ms_ << "ms";
 
     return std::make_unique<SmoothStopper>(
         move_allocated_time_ms_, allowed_piggybank_time_ms,
@@ -495,6 +519,10 @@ class SmoothTimeManager : public TimeManager {
   float nps_ GUARDED_BY(mutex_) = 20000.0f;
   // NPS is unreliable until the end of the first move.
   bool nps_is_reliable_ GUARDED_BY(mutex_) = false;
+  // Time from the start of a move until its first batch is done, as measured
+  // in the previous moves.
+  float startup_ms_ GUARDED_BY(mutex_) = 0.0f;
+  bool startup_is_known_ GUARDED_BY(mutex_) = false;
   // Fraction of a allocated time usually used.
   float timeuse_ GUARDED_BY(mutex_) = params_.initial_smartpruning_timeuse();
 
@@ -625,9 +653,15 @@ bool SmoothStopper::ShouldStop(const IterationStats& stats,
 }
 
 void SmoothStopper::OnSearchDone(const IterationStats& stats) {
+  // Without a batch, e.g. with the whole tree reused, there was no startup.
+  // After ponderhit, the startup happened before the move started.
+  const int64_t startup_time =
+      stats.time_since_first_batch > 0
+          ? stats.time_since_movestart - stats.time_since_first_batch
+          : -1;
   manager_->UpdateEndOfMoveStats(stats.time_since_movestart,
                                  used_piggybank_.test_and_set(), deadline_ms_,
-                                 stats.total_nodes);
+                                 stats.total_nodes, startup_time);
 }
 
 }  // namespace
@@ -28,7 +28,8 @@
 #include "search/classic/stoppers/stoppers.h"
 
 #include "search/classic/node.h"
-#include "neural/cache.h"
+#include "neural/memcache.h"
+#include "utils/memory_accountant.h"
 
 namespace lczero {
 namespace classic {
@@ -95,24 +96,50 @@ bool PlayoutsStopper::ShouldStop(const IterationStats& stats,
 namespace {
 const size_t kAvgNodeSize =
     sizeof(Node) + MemoryWatchingStopper::kAvgMovesPerPosition * sizeof(Edge);
-const size_t kAvgCacheItemSize =
-    NNCache::GetItemStructSize() + sizeof(CachedNNRequest) +
-    sizeof(CachedNNRequest::IdxAndProb) *
-        MemoryWatchingStopper::kAvgMovesPerPosition;
+const size_t kAvgCacheItemSize = GetMemCacheItemSize();
 }  // namespace
 
 MemoryWatchingStopper::MemoryWatchingStopper(int cache_size, int ram_limit_mb,
                                              bool populate_remaining_playouts)
-    : VisitsStopper(
-          (ram_limit_mb * 1000000LL - cache_size * kAvgCacheItemSize) /
-              kAvgNodeSize,
-          populate_remaining_playouts) {
+    : VisitsStopper(GetNodesLimit(cache_size, ram_limit_mb),
+                    populate_remaining_playouts) {
   LOGFILE << "RAM limit " << ram_limit_mb << "MB. Cache takes "
           << cache_size * kAvgCacheItemSize / 1000000
           << "MB. Remaining memory is enough for " << GetVisitsLimit()
           << " nodes.";
 }
 
+int64_t MemoryWatchingStopper::GetNodesLimit(int cache_size,
+                                             int ram_limit_mb) {
+  return (ram_limit_mb * 1000000LL - cache_size * kAvgCacheItemSize) /
+         kAvgNodeSize;
+}
+
+///////////////////////////
+// MemoryBudgetStopper
+///////////////////////////
+
+namespace {
+// Summing up the sources takes locks, so it's not done on every iteration.
+const int64_t kMemoryCheckIntervalMs = 50;
+}  // namespace
+
+MemoryBudgetStopper::MemoryBudgetStopper(size_t budget_bytes)
+    : budget_bytes_(budget_bytes) {}
+
+bool MemoryBudgetStopper::ShouldStop(const IterationStats& stats,
+                                     StoppersHints*) {
+  if (stats.time_since_movestart < next_check_ms_) return false;
+  next_check_ms_ = stats.time_since_movestart + kMemoryCheckIntervalMs;
+  const auto usage = MemoryAccountant::Get().GetUsage();
+  if (usage.Total() >= budget_bytes_) {
+    LOGFILE << "Stopping search: Memory budget of " << (budget_bytes_ >> 20)
+            << "MB reached: " << usage.ToString() << ".";
+    return true;
+  }
+  return false;
+}
+
 ///////////////////////////
 // TimelimitStopper
 ///////////////////////////
@@ -167,19 +194,68 @@ bool KldGainStopper::ShouldStop(const IterationStats& stats, StoppersHints*) {
   const auto new_child_nodes = stats.total_nodes - 1.0;
   if (new_child_nodes < prev_child_nodes_ + average_interval_) return false;
 
-  const auto new_visits = stats.edge_n;
-  if (!prev_visits_.empty()) {
-    double kldgain = 0.0;
-    for (decltype(new_visits)::size_type i = 0; i < new_visits.size(); i++) {
-      double o_p = prev_visits_[i] / prev_child_nodes_;
-      double n_p = new_visits[i] / new_child_nodes;
-      if (prev_visits_[i] != 0) kldgain += o_p * log(o_p / n_p);
+  new_visits_.assign(stats.edge_n.begin(), stats.edge_n.end());
+  double new_visits_sum = 0.0;
+  for (const uint32_t n : new_visits_) new_visits_sum += n;
+  if (!prev_visits_.empty() && prev_visits_.size() == new_visits_.size()) {
+    // With o_i = p_i / P and n_i = v_i / V, the terms of
+    // sum(o_i * log(o_i / n_i)) split into o_i * log(V / P), summed up at once,
+    // and p_i / P * log(p_i / v_i), which is 0 for the moves that got no
+    // visits since the last check.
+    double kldgain =
+        prev_visits_sum_ / prev_child_nodes_ *
+        std::log(new_child_nodes / prev_child_nodes_);
+    for (size_t i = 0; i < new_visits_.size(); i++) {
+      const uint32_t p = prev_visits_[i];
+      if (p == 0 || p == new_visits_[i]) continue;
+      kldgain += p / prev_child_nodes_ * std::log(p / double(new_visits_[i]));
     }
     if (kldgain / (new_child_nodes - prev_child_nodes_) < min_gain_) {
       LOGFILE << "Stopping search: KLDGain per node too small.";
       return true;
     }
   }
+  std::swap(prev_visits_, new_visits_);
+  prev_visits_sum_ = new_visits_sum;
+  prev_child_nodes_ = new_child_nodes;
+  return false;
+}
+
+///////////////////////////
+// PolicyConvergenceStopper
+///////////////////////////
+
+PolicyConvergenceStopper::PolicyConvergenceStopper(float max_kld,
+                                                   int64_t min_visits,
+                                                   float checkpoint_factor)
+    : max_kld_(max_kld),
+      checkpoint_factor_(checkpoint_factor),
+      next_checkpoint_(std::max<int64_t>(1, min_visits)) {}
+
+bool PolicyConvergenceStopper::ShouldStop(const IterationStats& stats,
+                                          StoppersHints*) {
+  Mutex::Lock lock(mutex_);
+  if (stats.total_nodes < next_checkpoint_) return false;
+  next_checkpoint_ = std::max<int64_t>(
+      stats.total_nodes + 1, stats.total_nodes * checkpoint_factor_);
+  const double new_child_nodes = stats.total_nodes - 1.0;
+  const auto& new_visits = stats.edge_n;
+  if (!prev_visits_.empty() && prev_child_nodes_ > 0.0 &&
+      prev_visits_.size() == new_visits.size()) {
+    // Visits only grow, so the divergence from the earlier distribution is
+    // finite.
+    double kld = 0.0;
+    for (size_t i = 0; i < new_visits.size(); i++) {
+      if (prev_visits_[i] == 0) continue;
+      const double o_p = prev_visits_[i] / prev_child_nodes_;
+      const double n_p = new_visits[i] / new_child_nodes;
+      kld += o_p * log(o_p / n_p);
+    }
+    if (kld < max_kld_) {
+      LOGFILE << "Stopping search: Visit distribution converged.";
+      return true;
+    }
+  }
   prev_visits_ = new_visits;
   prev_child_nodes_ = new_child_nodes;
   return false;
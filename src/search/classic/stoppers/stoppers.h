@@ -87,6 +87,20 @@ class MemoryWatchingStopper : public VisitsStopper {
   static constexpr size_t kAvgMovesPerPosition = 30;
   MemoryWatchingStopper(int cache_size, int ram_limit_mb,
                         bool populate_remaining_playouts);
+
+  // Number of nodes that fit into @ram_limit_mb next to the NN cache.
+  static int64_t GetNodesLimit(int cache_size, int ram_limit_mb);
+};
+
+// Stops when the memory reported to MemoryAccountant reaches the budget.
+class MemoryBudgetStopper : public SearchStopper {
+ public:
+  explicit MemoryBudgetStopper(size_t budget_bytes);
+  bool ShouldStop(const IterationStats&, StoppersHints*) override;
+
+ private:
+  const size_t budget_bytes_;
+  int64_t next_check_ms_ = 0;
 };
 
 // Stops after time budget is gone.
@@ -132,6 +146,30 @@ class KldGainStopper : public SearchStopper {
   const double min_gain_;
   const int average_interval_;
   Mutex mutex_;
+  // Root visits at the previous check and the current one, swapped after
+  // each check so that the buffers are reused.
+  std::vector<uint32_t> prev_visits_ GUARDED_BY(mutex_);
+  std::vector<uint32_t> new_visits_ GUARDED_BY(mutex_);
+  // Sum of prev_visits_.
+  double prev_visits_sum_ GUARDED_BY(mutex_) = 0.0;
+  double prev_child_nodes_ GUARDED_BY(mutex_) = 0.0;
+};
+
+// Stops once the visit distribution at root, the policy training target,
+// has converged: the KL divergence between the distributions at two
+// checkpoints is below @max_kld. The first checkpoint is at @min_visits, each
+// next one @checkpoint_factor times as many visits later.
+class PolicyConvergenceStopper : public SearchStopper {
+ public:
+  PolicyConvergenceStopper(float max_kld, int64_t min_visits,
+                           float checkpoint_factor);
+  bool ShouldStop(const IterationStats&, StoppersHints*) override;
+
+ private:
+  const double max_kld_;
+  const double checkpoint_factor_;
+  Mutex mutex_;
+  int64_t next_checkpoint_ GUARDED_BY(mutex_);
   std::vector<uint32_t> prev_visits_ GUARDED_BY(mutex_);
   double prev_child_nodes_ GUARDED_BY(mutex_) = 0.0;
 };
@@ -0,0 +1,123 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2026 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "search/classic/stoppers/stoppers.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace lczero {
+namespace classic {
+namespace {
+
+// The KLD gain per node as KldGainStopper computed it before it skipped the
+// moves without new visits, from the sum over all root moves.
+double FullKldGain(const std::vector<uint32_t>& prev_visits,
+                   const std::vector<uint32_t>& new_visits) {
+  const double prev_child_nodes =
+      std::accumulate(prev_visits.begin(), prev_visits.end(), 0.0);
+  const double new_child_nodes =
+      std::accumulate(new_visits.begin(), new_visits.end(), 0.0);
+  double kldgain = 0.0;
+  for (size_t i = 0; i < new_visits.size(); i++) {
+    const double o_p = prev_visits[i] / prev_child_nodes;
+    const double n_p = new_visits[i] / new_child_nodes;
+    if (prev_visits[i] != 0) kldgain += o_p * std::log(o_p / n_p);
+  }
+  return kldgain / (new_child_nodes - prev_child_nodes);
+}
+
+IterationStats MakeStats(const std::vector<uint32_t>& visits) {
+  IterationStats stats;
+  stats.edge_n = visits;
+  // The root's own visit comes on top of its children's.
+  stats.total_nodes =
+      std::accumulate(visits.begin(), visits.end(), int64_t{1});
+  return stats;
+}
+
+// Returns whether a fresh stopper with @min_gain stops at @new_visits after
+// seeing @prev_visits.
+bool StopsAt(float min_gain, const std::vector<uint32_t>& prev_visits,
+             const std::vector<uint32_t>& new_visits) {
+  KldGainStopper stopper(min_gain, 1);
+  StoppersHints hints;
+  EXPECT_FALSE(stopper.ShouldStop(MakeStats(prev_visits), &hints));
+  return stopper.ShouldStop(MakeStats(new_visits), &hints);
+}
+
+}  // namespace
+
+TEST(KldGainStopper, MatchesFullSumOnRandomVisits) {
+  std::mt19937 rng(42);
+  for (int trial = 0; trial < 1000; trial++) {
+    const int moves = std::uniform_int_distribution<int>(2, 60)(rng);
+    std::vector<uint32_t> prev_visits(moves);
+    for (auto& n : prev_visits) {
+      // Many moves without visits, as at a real root.
+      n = std::uniform_int_distribution<int>(0, 3)(rng) == 0
+              ? 0
+              : std::uniform_int_distribution<uint32_t>(1, 5000)(rng);
+    }
+    prev_visits[0] += 1;
+    // Only some moves get new visits, the others keep theirs.
+    std::vector<uint32_t> new_visits = prev_visits;
+    const int changed = std::uniform_int_distribution<int>(1, moves)(rng);
+    for (int i = 0; i < changed; i++) {
+      new_visits[std::uniform_int_distribution<int>(0, moves - 1)(rng)] +=
+          std::uniform_int_distribution<uint32_t>(1, 3000)(rng);
+    }
+    const double gain = FullKldGain(prev_visits, new_visits);
+    // The distribution didn't change, e.g. all visits are still on one move.
+    if (gain == 0.0) continue;
+    EXPECT_TRUE(StopsAt(gain * 1.001, prev_visits, new_visits))
+        << "trial " << trial << ", gain " << gain;
+    EXPECT_FALSE(StopsAt(gain * 0.999, prev_visits, new_visits))
+        << "trial " << trial << ", gain " << gain;
+  }
+}
+
+TEST(KldGainStopper, RestartsWhenRootMovesChange) {
+  KldGainStopper stopper(1.0f, 1);
+  StoppersHints hints;
+  EXPECT_FALSE(stopper.ShouldStop(MakeStats({10, 20, 30}), &hints));
+  // A different number of root moves is a new baseline, not a comparison.
+  EXPECT_FALSE(stopper.ShouldStop(MakeStats({10, 20, 30, 40}), &hints));
+  EXPECT_TRUE(stopper.ShouldStop(MakeStats({11, 20, 30, 40}), &hints));
+}
+
+}  // namespace classic
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -28,6 +28,7 @@
 #include "chess/gamestate.h"
 #include "search/classic/search.h"
 #include "search/classic/stoppers/factory.h"
+#include "search/classic/stoppers/stoppers.h"
 #include "search/register.h"
 #include "search/search.h"
 
@@ -39,6 +40,22 @@ const OptionId kThreadsOptionId{
     "threads", "Threads",
     "Number of (CPU) worker threads to use, 0 for the backend default.", 't'};
 
+const OptionId kRootParallelTreesId{
+    "root-parallel-trees", "RootParallelTrees",
+    "Number of independent trees searching the position at the same time, "
+    "each with its own set of threads, sharing the backend and its cache. "
+    "Bestmove is chosen by the root visits summed over all trees, and node "
+    "limits apply to all trees together. Avoids the collisions of many threads "
+    "in one tree on multi-GPU machines, at the cost of memory for every tree. "
+    "Only available with the `classic` search, not in the default `uci` "
+    "engine."};
+
+const OptionId kProvenBoundsCacheSizeId{
+    "proven-bounds-cache-size", "ProvenBoundsCacheSize",
+    "Number of positions whose results were proven with StickyEndgames to "
+    "remember through the game, so that transpositions into them are not "
+    "searched again, in other subtrees and in later moves. 0 to disable."};
+
 const OptionId kClearTree{"", "ClearTree",
                           "Clear the tree before the next search."};
 
@@ -46,6 +63,11 @@ class ClassicSearch : public SearchBase {
  public:
   ClassicSearch(UciResponder* responder, const OptionsDict* options)
       : SearchBase(responder), options_(options) {}
+  ~ClassicSearch() {
+    // The search may still be running, and it uses the tree and the helpers.
+    search_.reset();
+    helpers_.clear();
+  }
 
  private:
   void NewGame() override;
@@ -54,21 +76,38 @@ class ClassicSearch : public SearchBase {
   void StartClock() override {
     move_start_time_ = std::chrono::steady_clock::now();
   }
+  void PonderHit() override;
   void WaitSearch() override {
     if (search_) search_->Wait();
+    for (auto& helper : helpers_) helper->Wait();
   }
   void StopSearch() override {
     if (search_) search_->Stop();
   }
   void AbortSearch() override {
     if (search_) search_->Abort();
+    for (auto& helper : helpers_) helper->Abort();
+  }
+  SearchArtifacts GetArtifacts() const override {
+    if (!search_) throw Exception("No search has been run.");
+    return search_->GetArtifacts();
   }
 
   const OptionsDict* options_;
   std::unique_ptr<classic::TimeManager> time_manager_;
+  // Declared before search_, which may use it until destroyed.
+  classic::SpeculativePrefetchLog speculative_log_;
+  classic::ProvenBoundsTable proven_bounds_;
   std::unique_ptr<classic::Search> search_;
   std::unique_ptr<classic::NodeTree> tree_;
+  // Trees and searches of the other root parallel trees, aborted by search_
+  // when it responds with bestmove.
+  std::vector<std::unique_ptr<classic::NodeTree>> helper_trees_;
+  std::vector<std::unique_ptr<classic::Search>> helpers_;
   std::optional<std::chrono::steady_clock::time_point> move_start_time_;
+  // Parameters of the running `go ponder`, to set up the time control at
+  // `ponderhit`.
+  std::optional<GoParams> ponder_params_;
 };
 
 MoveList StringsToMovelist(const std::vector<std::string>& moves,
@@ -91,7 +130,11 @@ MoveList StringsToMovelist(const std::vector<std::string>& moves,
 
 void ClassicSearch::NewGame() {
   search_.reset();
+  helpers_.clear();
   tree_.reset();
+  helper_trees_.clear();
+  speculative_log_.Reset();
+  proven_bounds_.Clear();
   time_manager_ = classic::MakeTimeManager(*options_);
 }
 
@@ -99,23 +142,72 @@ void ClassicSearch::SetPosition(const GameState& pos) {
   if (!tree_) tree_ = std::make_unique<classic::NodeTree>();
   const bool is_same_game = tree_->ResetToPosition(pos);
   if (!is_same_game) time_manager_ = classic::MakeTimeManager(*options_);
+  // The helper searches use their trees, and search_ uses the helpers.
+  if (!helpers_.empty()) {
+    search_.reset();
+    helpers_.clear();
+  }
+  helper_trees_.resize(options_->Get<int>(kRootParallelTreesId) - 1);
+  for (auto& tree : helper_trees_) {
+    if (!tree) tree = std::make_unique<classic::NodeTree>();
+    tree->ResetToPosition(pos);
+  }
 }
 
 void ClassicSearch::StartSearch(const GoParams& params) {
+  // The previous search may still be prefetching from the tree.
+  search_.reset();
+  helpers_.clear();
   auto forwarder =
       std::make_unique<NonOwningUciRespondForwarder>(uci_responder_);
-  if (options_->Get<Button>(kClearTree).TestAndReset()) tree_->TrimTreeAtHead();
+  if (options_->Get<Button>(kClearTree).TestAndReset()) {
+    tree_->TrimTreeAtHead();
+    for (auto& tree : helper_trees_) tree->TrimTreeAtHead();
+  }
+  const auto searchmoves =
+      StringsToMovelist(params.searchmoves, tree_->HeadPosition().GetBoard());
+  proven_bounds_.Resize(options_->Get<int>(kProvenBoundsCacheSizeId));
+  auto* const proven_bounds =
+      proven_bounds_.size() > 0 ? &proven_bounds_ : nullptr;
 
   auto stopper = time_manager_->GetStopper(params, *tree_.get());
+  // The position after the predicted move is searched as is, only bestmove is
+  // held until `ponderhit` or `stop`.
   search_ = std::make_unique<classic::Search>(
-      *tree_, backend_, std::move(forwarder),
-      StringsToMovelist(params.searchmoves, tree_->HeadPosition().GetBoard()),
-      *move_start_time_, std::move(stopper), params.infinite, params.ponder,
-      *options_, syzygy_tb_);
+      *tree_, backend_, std::move(forwarder), searchmoves, *move_start_time_,
+      std::move(stopper), params.infinite, false, *options_, syzygy_tb_,
+      &speculative_log_, proven_bounds);
+  ponder_params_.reset();
+  if (params.ponder) {
+    search_->HoldBestMove();
+    ponder_params_ = params;
+    ponder_params_->ponder = false;
+  }
+
+  // The helpers hold their bestmove until aborted, and have their output
+  // dropped.
+  for (auto& tree : helper_trees_) {
+    helpers_.push_back(std::make_unique<classic::Search>(
+        *tree, backend_, std::make_unique<UciResponderForwarder>(), searchmoves,
+        *move_start_time_, std::make_unique<ChainedSearchStopper>(),
+        params.infinite, false, *options_, syzygy_tb_, nullptr,
+        proven_bounds));
+    helpers_.back()->HoldBestMove();
+    search_->AddRootHelper(helpers_.back().get());
+  }
 
   LOGFILE << "Timer started at "
           << FormatTime(SteadyClockToSystemClock(*move_start_time_));
-  search_->StartThreads(options_->Get<int>(kThreadsOptionId));
+  const int threads = options_->Get<int>(kThreadsOptionId);
+  for (auto& helper : helpers_) helper->StartThreads(threads);
+  search_->StartThreads(threads);
+}
+
+void ClassicSearch::PonderHit() {
+  if (!search_ || !ponder_params_) return;
+  search_->PonderHit(time_manager_->GetStopper(*ponder_params_, *tree_.get()),
+                     *move_start_time_);
+  ponder_params_.reset();
 }
 
 class ClassicSearchFactory : public SearchFactory {
@@ -127,6 +219,8 @@ class ClassicSearchFactory : public SearchFactory {
 
   void PopulateParams(OptionsParser* parser) const override {
     parser->Add<IntOption>(kThreadsOptionId, 0, 128) = 0;
+    parser->Add<IntOption>(kRootParallelTreesId, 1, 16) = 1;
+    parser->Add<IntOption>(kProvenBoundsCacheSizeId, 0, 1 << 30) = 1 << 18;
     classic::SearchParams::Populate(parser);
     PopulateTimeManagementOptions(classic::RunType::kUci, parser);
 
@@ -0,0 +1,611 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2026 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "chess/gamestate.h"
+#include "chess/position.h"
+#include "chess/uciloop.h"
+#include "neural/backend.h"
+#include "search/register.h"
+#include "search/search.h"
+#include "utils/logging.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+namespace dag {
+namespace {
+
+const OptionId kMiniBatchSizeId{
+    "minibatch-size", "MinibatchSize",
+    "How many positions the engine tries to batch together for parallel NN "
+    "computation. Set to 0 to use a backend suggested value."};
+const OptionId kCpuctId{
+    "cpuct", "CPuct",
+    "cpuct_init constant from \"UCT search\" algorithm. Higher values promote "
+    "more exploration/wider search, lower values promote more "
+    "confidence/deeper search."};
+const OptionId kCpuctBaseId{
+    "cpuct-base", "CPuctBase",
+    "cpuct_base constant from \"UCT search\" algorithm. Lower value means "
+    "higher growth of Cpuct as number of node visits grows."};
+const OptionId kCpuctFactorId{
+    "cpuct-factor", "CPuctFactor", "Multiplier for the cpuct growth formula."};
+const OptionId kFpuValueId{
+    "fpu-value", "FpuValue",
+    "\"First Play Urgency\" reduction, applied to the parent eval for "
+    "unvisited moves."};
+const OptionId kMoveOverheadId{
+    "move-overhead", "MoveOverheadMs",
+    "Amount of time, in milliseconds, that the engine subtracts from its "
+    "total available time (to compensate for slow connection, interprocess "
+    "communication, etc)."};
+
+// Number of positions passed to the backend for each evaluation.
+const int kEvalHistoryLength = 16;
+// Interval between info outputs.
+const int kInfoIntervalMs = 1000;
+// Default number of moves left in the game when it's not specified.
+const int kDefaultMovesToGo = 30;
+
+struct Node;
+
+struct Edge {
+  Move move;
+  float p = 0.0f;
+  // Visits that were backed up through this edge. A child reached through
+  // several transpositions has more visits than any of its incoming edges.
+  uint32_t n = 0;
+  uint32_t n_in_flight = 0;
+  // Node this edge was first expanded to.
+  Node* child = nullptr;
+};
+
+struct Node {
+  enum class State : uint8_t { kNew, kPending, kExpanded, kTerminal };
+
+  std::vector<Edge> edges;
+  // Average value and draw probability, from the point of view of the side to
+  // move. Recomputed from the children on every backup, so that values of
+  // transposed subtrees flow to all their parents.
+  double q = 0.0;
+  double d = 0.0;
+  // Evaluation of the node itself (or the game result for terminals).
+  float own_q = 0.0f;
+  float own_d = 0.0f;
+  // One for the node's own evaluation plus visits of all outgoing edges.
+  uint32_t n = 0;
+  uint32_t n_in_flight = 0;
+  State state = State::kNew;
+};
+
+class DagSearch : public SearchBase {
+ public:
+  DagSearch(UciResponder* responder, const OptionsDict* options)
+      : SearchBase(responder), options_(options) {}
+  ~DagSearch() override {
+    AbortSearch();
+    WaitSearch();
+  }
+
+ private:
+  void NewGame() override {
+    nodes_.clear();
+    root_ = nullptr;
+  }
+  void SetPosition(const GameState& game_state) override;
+  void StartSearch(const GoParams& params) override;
+  void StartClock() override { start_time_ = std::chrono::steady_clock::now(); }
+  void WaitSearch() override {
+    if (search_thread_.joinable()) search_thread_.join();
+  }
+  void StopSearch() override { stop_.store(true); }
+  void AbortSearch() override {
+    responded_bestmove_.store(true);
+    stop_.store(true);
+  }
+
+  struct Visit {
+    // Nodes and edges along the path, edges[i] goes out of nodes[i].
+    std::vector<Node*> nodes;
+    std::vector<Edge*> edges;
+    // Set if the leaf has to be evaluated by the backend.
+    std::vector<Position> positions;
+    MoveList legal_moves;
+    std::vector<float> p;
+    float q = 0.0f;
+    float d = 0.0f;
+    float m = 0.0f;
+  };
+
+  uint64_t ComputeKey(const PositionHistory& history) const;
+  Node* GetOrCreateNode(const PositionHistory& history);
+  void PruneUnreachableNodes();
+  void SearchLoop();
+  // Returns false on collision (leaf is already being evaluated).
+  bool PickVisit(PositionHistory* history, Visit* visit);
+  Edge* SelectEdge(Node* node, bool is_root) const;
+  void ExpandNode(Visit* visit);
+  void Backup(const Visit& visit);
+  void RevertVirtualLoss(const Visit& visit);
+  static void RecomputeValue(Node* node);
+  bool ShouldStop() const;
+  void SendInfo();
+  void RespondBestMove();
+  const Edge* GetBestEdge(const Node* node) const;
+
+  const OptionsDict* options_;
+  PositionHistory root_history_;
+  std::unordered_map<uint64_t, std::unique_ptr<Node>> nodes_;
+  Node* root_ = nullptr;
+  MoveList root_moves_filter_;
+
+  // Parameters of the current search.
+  float cpuct_ = 0.0f;
+  float cpuct_base_ = 0.0f;
+  float cpuct_factor_ = 0.0f;
+  float fpu_value_ = 0.0f;
+  int minibatch_size_ = 0;
+  std::optional<int64_t> time_budget_ms_;
+  std::optional<int64_t> visits_limit_;
+  bool infinite_ = false;
+
+  std::optional<std::chrono::steady_clock::time_point> start_time_;
+  std::chrono::steady_clock::time_point search_start_;
+  std::chrono::steady_clock::time_point last_info_;
+  int64_t initial_visits_ = 0;
+  int64_t total_visits_ = 0;
+  int64_t total_evals_ = 0;
+  int64_t cum_depth_ = 0;
+  int max_depth_ = 0;
+
+  std::atomic<bool> stop_{false};
+  std::atomic<bool> responded_bestmove_{true};
+  std::thread search_thread_;
+};
+
+// Positions are merged when their board and repetition count are equal, so
+// the key is the eval cache one without history.
+uint64_t DagSearch::ComputeKey(const PositionHistory& history) const {
+  return ComputeEvalPositionKey(history.GetPositions(), 0);
+}
+
+Node* DagSearch::GetOrCreateNode(const PositionHistory& history) {
+  auto& node = nodes_[ComputeKey(history)];
+  if (node) return node.get();
+  node = std::make_unique<Node>();
+  // Twofold repetitions within the search are scored as draws. Repetition
+  // count is a part of the key, so this doesn't depend on the path.
+  const GameResult result = history.Last().GetRepetitions() >= 1
+                                ? GameResult::DRAW
+                                : history.ComputeGameResult();
+  if (result != GameResult::UNDECIDED) {
+    node->state = Node::State::kTerminal;
+    // Any decisive result is a loss for the side to move.
+    node->own_q = node->q = result == GameResult::DRAW ? 0.0f : -1.0f;
+    node->own_d = node->d = result == GameResult::DRAW ? 1.0f : 0.0f;
+  }
+  return node.get();
+}
+
+// Drops the nodes that can't be reached from the current root.
+void DagSearch::PruneUnreachableNodes() {
+  std::unordered_set<const Node*> reachable;
+  std::vector<const Node*> stack;
+  if (root_) stack.push_back(root_);
+  while (!stack.empty()) {
+    const Node* node = stack.back();
+    stack.pop_back();
+    if (!reachable.insert(node).second) continue;
+    for (const auto& edge : node->edges) {
+      if (edge.child) stack.push_back(edge.child);
+    }
+  }
+  for (auto iter = nodes_.begin(); iter != nodes_.end();) {
+    if (reachable.count(iter->second.get())) {
+      ++iter;
+    } else {
+      iter = nodes_.erase(iter);
+    }
+  }
+}
+
+void DagSearch::SetPosition(const GameState& game_state) {
+  const std::vector<Position> positions = game_state.GetPositions();
+  root_history_ = PositionHistory(positions);
+  // The root itself is never terminal because of repetitions in the game
+  // history, so it's looked up without the twofold rule.
+  auto& root = nodes_[ComputeKey(root_history_)];
+  if (!root) root = std::make_unique<Node>();
+  if (root->state == Node::State::kTerminal) {
+    // Reset in place, other nodes may still point to it.
+    *root = Node();
+    if (root_history_.ComputeGameResult() != GameResult::UNDECIDED) {
+      root->state = Node::State::kTerminal;
+    }
+  }
+  root_ = root.get();
+  PruneUnreachableNodes();
+}
+
+void DagSearch::StartSearch(const GoParams& params) {
+  AbortSearch();
+  WaitSearch();
+
+  cpuct_ = options_->Get<float>(kCpuctId);
+  cpuct_base_ = options_->Get<float>(kCpuctBaseId);
+  cpuct_factor_ = options_->Get<float>(kCpuctFactorId);
+  fpu_value_ = options_->Get<float>(kFpuValueId);
+  minibatch_size_ = options_->Get<int>(kMiniBatchSizeId);
+  if (minibatch_size_ == 0) {
+    minibatch_size_ = backend_->GetAttributes().recommended_batch_size;
+  }
+  minibatch_size_ = std::max(minibatch_size_, 1);
+
+  search_start_ = start_time_.value_or(std::chrono::steady_clock::now());
+  start_time_.reset();
+  infinite_ = params.infinite || params.ponder;
+  const int64_t move_overhead = options_->Get<int>(kMoveOverheadId);
+  time_budget_ms_.reset();
+  if (params.movetime) {
+    time_budget_ms_ = *params.movetime - move_overhead;
+  } else if (const auto& time = root_history_.IsBlackToMove() ? params.btime
+                                                              : params.wtime) {
+    const auto& inc =
+        root_history_.IsBlackToMove() ? params.binc : params.winc;
+    const int64_t budget =
+        *time / params.movestogo.value_or(kDefaultMovesToGo) +
+        inc.value_or(0) * 9 / 10;
+    time_budget_ms_ = std::min(budget, *time) - move_overhead;
+  }
+  visits_limit_.reset();
+  if (params.nodes) visits_limit_ = *params.nodes;
+
+  root_moves_filter_.clear();
+  const ChessBoard& board = root_history_.Last().GetBoard();
+  if (!params.searchmoves.empty()) {
+    const auto legal_moves = board.GenerateLegalMoves();
+    for (const auto& move_str : params.searchmoves) {
+      const Move move = board.ParseMove(move_str);
+      if (std::find(legal_moves.begin(), legal_moves.end(), move) !=
+          legal_moves.end()) {
+        root_moves_filter_.push_back(move);
+      }
+    }
+    if (root_moves_filter_.empty()) throw Exception("No legal searchmoves.");
+  }
+
+  initial_visits_ = root_->n;
+  total_visits_ = 0;
+  total_evals_ = 0;
+  cum_depth_ = 0;
+  max_depth_ = 0;
+  last_info_ = std::chrono::steady_clock::now();
+  stop_.store(false);
+  responded_bestmove_.store(false);
+  search_thread_ = std::thread([this]() { SearchLoop(); });
+}
+
+Edge* DagSearch::SelectEdge(Node* node, bool is_root) const {
+  const uint32_t parent_n = node->n + node->n_in_flight;
+  const float cpuct =
+      cpuct_ + cpuct_factor_ * std::log((parent_n + cpuct_base_) / cpuct_base_);
+  const float puct_mult = cpuct * std::sqrt(std::max(parent_n, 1u));
+  float visited_policy = 0.0f;
+  for (const auto& edge : node->edges) {
+    if (edge.n > 0) visited_policy += edge.p;
+  }
+  const float fpu = node->q - fpu_value_ * std::sqrt(visited_policy);
+
+  Edge* best = nullptr;
+  float best_score = std::numeric_limits<float>::lowest();
+  for (auto& edge : node->edges) {
+    if (is_root && !root_moves_filter_.empty() &&
+        std::find(root_moves_filter_.begin(), root_moves_filter_.end(),
+                  edge.move) == root_moves_filter_.end()) {
+      continue;
+    }
+    const float q = edge.n > 0 ? -edge.child->q : fpu;
+    // Visits in flight are counted as losses.
+    const uint32_t n = edge.n + edge.n_in_flight;
+    const float q_vl = n > 0 ? (q * edge.n - edge.n_in_flight) / n : q;
+    const float score = q_vl + puct_mult * edge.p / (1 + n);
+    if (score > best_score) {
+      best_score = score;
+      best = &edge;
+    }
+  }
+  return best;
+}
+
+bool DagSearch::PickVisit(PositionHistory* history, Visit* visit) {
+  Node* node = root_;
+  while (true) {
+    visit->nodes.push_back(node);
+    ++node->n_in_flight;
+    if (node->state == Node::State::kTerminal) return true;
+    if (node->state == Node::State::kPending) {
+      RevertVirtualLoss(*visit);
+      return false;
+    }
+    if (node->state == Node::State::kNew) {
+      node->state = Node::State::kPending;
+      const auto positions = history->GetPositions();
+      const size_t length =
+          std::min<size_t>(positions.size(), kEvalHistoryLength);
+      visit->positions.assign(positions.end() - length, positions.end());
+      visit->legal_moves =
+          history->Last().GetBoard().GenerateLegalMoves();
+      visit->p.resize(visit->legal_moves.size());
+      return true;
+    }
+    Edge* edge = SelectEdge(node, visit->nodes.size() == 1);
+    visit->edges.push_back(edge);
+    ++edge->n_in_flight;
+    history->Append(edge->move);
+    Node* child = GetOrCreateNode(*history);
+    if (!edge->child) edge->child = child;
+    // The child has been visited more through other paths than through this
+    // edge. Catch up using its value, without evaluating anything.
+    if (child == edge->child && child->n > edge->n) return true;
+    node = child;
+  }
+}
+
+void DagSearch::RevertVirtualLoss(const Visit& visit) {
+  for (Node* node : visit.nodes) --node->n_in_flight;
+  for (Edge* edge : visit.edges) --edge->n_in_flight;
+}
+
+void DagSearch::ExpandNode(Visit* visit) {
+  Node* node = visit->nodes.back();
+  node->edges.resize(visit->legal_moves.size());
+  for (size_t i = 0; i < visit->legal_moves.size(); ++i) {
+    node->edges[i].move = visit->legal_moves[i];
+    node->edges[i].p = visit->p[i];
+  }
+  // Higher priors first, so that ties in selection go to the likelier move.
+  std::stable_sort(node->edges.begin(), node->edges.end(),
+                   [](const Edge& a, const Edge& b) { return a.p > b.p; });
+  node->own_q = visit->q;
+  node->own_d = visit->d;
+  node->state = Node::State::kExpanded;
+}
+
+void DagSearch::RecomputeValue(Node* node) {
+  if (node->state == Node::State::kTerminal) return;
+  double q = node->own_q;
+  double d = node->own_d;
+  uint32_t n = 1;
+  for (const auto& edge : node->edges) {
+    if (edge.n == 0) continue;
+    q -= edge.n * edge.child->q;
+    d += edge.n * edge.child->d;
+    n += edge.n;
+  }
+  node->q = q / n;
+  node->d = d / n;
+  node->n = n;
+}
+
+void DagSearch::Backup(const Visit& visit) {
+  // Leaf of a catch-up visit already has its value, and is not a part of the
+  // path.
+  if (visit.nodes.size() == visit.edges.size() + 1) {
+    Node* leaf = visit.nodes.back();
+    --leaf->n_in_flight;
+    if (leaf->state == Node::State::kTerminal) {
+      ++leaf->n;
+    } else {
+      RecomputeValue(leaf);
+    }
+  }
+  for (size_t i = visit.edges.size(); i-- > 0;) {
+    Edge* edge = visit.edges[i];
+    --edge->n_in_flight;
+    ++edge->n;
+    Node* node = visit.nodes[i];
+    --node->n_in_flight;
+    RecomputeValue(node);
+  }
+  ++total_visits_;
+  cum_depth_ += visit.edges.size();
+  max_depth_ = std::max<int>(max_depth_, visit.edges.size());
+}
+
+void DagSearch::SearchLoop() {
+  if (root_->state == Node::State::kTerminal) stop_.store(true);
+  PositionHistory history = root_history_;
+  const int root_length = root_history_.GetLength();
+  std::vector<Visit> visits;
+  while (!stop_.load()) {
+    // Gather a minibatch.
+    visits.clear();
+    int collisions = 0;
+    int evals = 0;
+    while (evals < minibatch_size_ && collisions < minibatch_size_) {
+      Visit visit;
+      const bool ok = PickVisit(&history, &visit);
+      history.Trim(root_length);
+      if (!ok) {
+        ++collisions;
+        continue;
+      }
+      if (!visit.legal_moves.empty()) ++evals;
+      visits.push_back(std::move(visit));
+      if (visits.size() > static_cast<size_t>(4 * minibatch_size_)) break;
+    }
+
+    // Evaluate.
+    if (evals > 0) {
+      auto computation = backend_->CreateComputation();
+      for (auto& visit : visits) {
+        if (visit.legal_moves.empty()) continue;
+        computation->AddInput(
+            EvalPosition{visit.positions, visit.legal_moves},
+            EvalResultPtr{
+                .q = &visit.q, .d = &visit.d, .m = &visit.m, .p = visit.p});
+      }
+      computation->ComputeBlocking();
+      total_evals_ += evals;
+    }
+
+    // Backup, nodes first, so that in-batch transpositions see the values.
+    for (auto& visit : visits) {
+      if (!visit.legal_moves.empty()) ExpandNode(&visit);
+    }
+    for (const auto& visit : visits) Backup(visit);
+
+    if (ShouldStop()) stop_.store(true);
+    if (std::chrono::steady_clock::now() - last_info_ >=
+        std::chrono::milliseconds(kInfoIntervalMs)) {
+      SendInfo();
+    }
+  }
+  SendInfo();
+  RespondBestMove();
+}
+
+bool DagSearch::ShouldStop() const {
+  if (root_->edges.size() == 1 && root_moves_filter_.empty() && !infinite_) {
+    return true;
+  }
+  if (visits_limit_ && total_visits_ >= *visits_limit_) return true;
+  if (infinite_) return false;
+  const auto elapsed = std::chrono::steady_clock::now() - search_start_;
+  return time_budget_ms_ &&
+         elapsed >= std::chrono::milliseconds(*time_budget_ms_);
+}
+
+const Edge* DagSearch::GetBestEdge(const Node* node) const {
+  const Edge* best = nullptr;
+  for (const auto& edge : node->edges) {
+    if (node == root_ && !root_moves_filter_.empty() &&
+        std::find(root_moves_filter_.begin(), root_moves_filter_.end(),
+                  edge.move) == root_moves_filter_.end()) {
+      continue;
+    }
+    if (!best || edge.n > best->n ||
+        (edge.n == best->n && edge.n > 0 &&
+         -edge.child->q > -best->child->q)) {
+      best = &edge;
+    }
+  }
+  return best;
+}
+
+void DagSearch::SendInfo() {
+  last_info_ = std::chrono::steady_clock::now();
+  const Edge* best = GetBestEdge(root_);
+  if (!best) return;
+  ThinkingInfo info;
+  const int64_t time_ms =
+      std::chrono::duration_cast<std::chrono::milliseconds>(last_info_ -
+                                                            search_start_)
+          .count();
+  info.depth = total_visits_ ? cum_depth_ / total_visits_ + 1 : 1;
+  info.seldepth = max_depth_ + 1;
+  info.time = time_ms;
+  info.nodes = root_->n;
+  if (time_ms > 0) info.nps = total_visits_ * 1000 / time_ms;
+  const float q = best->n > 0 ? -best->child->q : root_->q;
+  const float d = best->n > 0 ? best->child->d : root_->d;
+  info.score = 90 * std::tan(1.5637541897 * std::clamp(q, -0.99f, 0.99f));
+  info.wdl = ThinkingInfo::WDL{
+      static_cast<int>(std::round(500 * (1 + q - d))),
+      static_cast<int>(std::round(1000 * d)),
+      static_cast<int>(std::round(500 * (1 - q - d)))};
+  bool flip = root_history_.IsBlackToMove();
+  std::unordered_set<const Node*> seen;
+  for (const Node* node = root_; node && seen.insert(node).second;) {
+    const Edge* edge = node == root_ ? best : GetBestEdge(node);
+    if (!edge || edge->n == 0) break;
+    Move move = edge->move;
+    if (flip) move.Flip();
+    info.pv.push_back(move);
+    flip = !flip;
+    node = edge->child;
+  }
+  info.comment = "nodes in dag: " + std::to_string(nodes_.size()) +
+                 ", evals: " + std::to_string(total_evals_);
+  std::vector<ThinkingInfo> infos = {info};
+  uci_responder_->OutputThinkingInfo(&infos);
+}
+
+void DagSearch::RespondBestMove() {
+  if (responded_bestmove_.exchange(true)) return;
+  const Edge* best = GetBestEdge(root_);
+  Move bestmove;
+  Move pondermove;
+  if (best) {
+    bestmove = best->move;
+    if (root_history_.IsBlackToMove()) bestmove.Flip();
+    if (best->child && best->n > 0) {
+      if (const Edge* ponder = GetBestEdge(best->child)) {
+        pondermove = ponder->move;
+        if (!root_history_.IsBlackToMove()) pondermove.Flip();
+      }
+    }
+  }
+  LOGFILE << "DAG search done, " << total_visits_ << " visits, "
+          << total_evals_ << " evals, " << nodes_.size() << " nodes.";
+  BestMoveInfo info(bestmove, pondermove);
+  uci_responder_->OutputBestMove(&info);
+}
+
+class DagSearchFactory : public SearchFactory {
+  std::string_view GetName() const override { return "dag"; }
+  std::unique_ptr<SearchBase> CreateSearch(
+      UciResponder* responder, const OptionsDict* options) const override {
+    return std::make_unique<DagSearch>(responder, options);
+  }
+
+  void PopulateParams(OptionsParser* parser) const override {
+    parser->Add<IntOption>(kMiniBatchSizeId, 0, 1024) = 0;
+    parser->Add<FloatOption>(kCpuctId, 0.0f, 100.0f) = 1.745f;
+    parser->Add<FloatOption>(kCpuctBaseId, 1.0f, 1000000000.0f) = 38739.0f;
+    parser->Add<FloatOption>(kCpuctFactorId, 0.0f, 1000.0f) = 3.894f;
+    parser->Add<FloatOption>(kFpuValueId, -100.0f, 100.0f) = 0.330f;
+    parser->Add<IntOption>(kMoveOverheadId, 0, 100000000) = 200;
+  }
+};
+
+REGISTER_SEARCH(DagSearchFactory)
+
+}  // namespace
+}  // namespace dag
+}  // namespace lczero
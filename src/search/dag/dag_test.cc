@@ -0,0 +1,148 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2026 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include <algorithm>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "chess/gamestate.h"
+#include "chess/uciloop.h"
+#include "gtest/gtest.h"
+#include "neural/mock_backend.h"
+#include "search/register.h"
+#include "search/search.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+namespace {
+
+using testing::_;
+using testing::NiceMock;
+
+class BestMoveResponder : public UciResponder {
+ public:
+  void OutputBestMove(BestMoveInfo* info) override {
+    promise_.set_value(info->bestmove);
+  }
+  void OutputThinkingInfo(std::vector<ThinkingInfo>*) override {}
+
+  Move Wait() { return promise_.get_future().get(); }
+
+ private:
+  std::promise<Move> promise_;
+};
+
+// Builds the game state the way Engine does, with the moves in the frame of
+// the side to move.
+GameState MakeGameState(const std::vector<std::string>& moves) {
+  GameState state{Position::FromFen(ChessBoard::kStartposFen), {}};
+  ChessBoard board = state.startpos.GetBoard();
+  for (const auto& move_str : moves) {
+    const Move move = board.ParseMove(move_str);
+    state.moves.push_back(move);
+    board.ApplyMove(move);
+    board.Mirror();
+  }
+  return state;
+}
+
+class DagSearchTest : public ::testing::Test {
+ protected:
+  DagSearchTest() {
+    factory_ = SearchManager::Get()->GetFactoryByName("dag");
+    factory_->PopulateParams(&options_parser_);
+    options_parser_.GetMutableOptions()->Set<int>("minibatch-size", 16);
+    // Every position is a draw with uniform priors.
+    ON_CALL(backend_, CreateComputation()).WillByDefault([]() {
+      auto computation = std::make_unique<NiceMock<MockBackendComputation>>();
+      ON_CALL(*computation, AddInput(_, _))
+          .WillByDefault([](const EvalPosition&, EvalResultPtr result) {
+            *result.q = 0.0f;
+            *result.d = 1.0f;
+            *result.m = 0.0f;
+            std::fill(result.p.begin(), result.p.end(),
+                      1.0f / result.p.size());
+            return BackendComputation::ENQUEUED_FOR_EVAL;
+          });
+      return computation;
+    });
+  }
+
+  // Searches @nodes visits from the position after @moves and returns the
+  // best move.
+  Move Search(const std::vector<std::string>& moves, int nodes) {
+    BestMoveResponder responder;
+    auto search =
+        factory_->CreateSearch(&responder, &options_parser_.GetOptionsDict());
+    search->SetBackend(&backend_);
+    search->NewGame();
+    search->SetPosition(MakeGameState(moves));
+    search->StartClock();
+    search->StartSearch(GoParams{.nodes = nodes});
+    const Move bestmove = responder.Wait();
+    search->WaitSearch();
+    return bestmove;
+  }
+
+  SearchFactory* factory_ = nullptr;
+  OptionsParser options_parser_;
+  NiceMock<MockBackend> backend_;
+};
+
+TEST_F(DagSearchTest, SearchesFromMultiMovePosition) {
+  // White to move after e2e4 e7e5.
+  const GameState state = MakeGameState({"e2e4", "e7e5"});
+  const MoveList legal_moves =
+      state.CurrentPosition().GetBoard().GenerateLegalMoves();
+  const Move bestmove = Search({"e2e4", "e7e5"}, 200);
+  EXPECT_NE(std::find(legal_moves.begin(), legal_moves.end(), bestmove),
+            legal_moves.end());
+}
+
+TEST_F(DagSearchTest, SearchesWithBlackToMove) {
+  const std::vector<std::string> moves = {"e2e4", "e7e5", "g1f3"};
+  const GameState state = MakeGameState(moves);
+  ASSERT_TRUE(state.CurrentPosition().IsBlackToMove());
+  // The bestmove is reported from white's side, the legal moves are from the
+  // side to move.
+  Move bestmove = Search(moves, 200);
+  bestmove.Flip();
+  const MoveList legal_moves =
+      state.CurrentPosition().GetBoard().GenerateLegalMoves();
+  EXPECT_NE(std::find(legal_moves.begin(), legal_moves.end(), bestmove),
+            legal_moves.end());
+}
+
+}  // namespace
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  lczero::InitializeMagicBitboards();
+  return RUN_ALL_TESTS();
+}
@@ -25,6 +25,8 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include "search/instamove/instamove.h"
+
 #include <algorithm>
 #include <cmath>
 #include <vector>
@@ -37,6 +39,69 @@
 #include "search/search.h"
 
 namespace lczero {
+
+InstamoveBatch::InstamoveBatch(InstamoveHead head, Backend* backend)
+    : head_(head), computation_(backend->CreateComputation()) {}
+
+void InstamoveBatch::Add(const PositionHistory& history) {
+  const MoveList legal_moves = history.Last().GetBoard().GenerateLegalMoves();
+  entries_.push_back({legal_moves, evals_.size()});
+  if (head_ == InstamoveHead::kPolicy) {
+    EvalResult& eval = evals_.emplace_back();
+    eval.p.resize(legal_moves.size());
+    computation_->AddInput(EvalPosition{history.GetPositions(), legal_moves},
+                           EvalResultPtr{&eval.q, &eval.d, &eval.m, eval.p});
+    ++input_count_;
+    return;
+  }
+  PositionHistory child(history);
+  for (Move move : legal_moves) {
+    EvalResult& eval = evals_.emplace_back();
+    child.Append(move);
+    switch (child.ComputeGameResult()) {
+      case GameResult::UNDECIDED:
+        computation_->AddInput(EvalPosition{child.GetPositions(), {}},
+                               EvalResultPtr{.q = &eval.q, .d = &eval.d});
+        ++input_count_;
+        break;
+      case GameResult::DRAW:
+        eval.q = 0;
+        eval.d = 1;
+        break;
+      default:
+        // A legal move to a non-drawn terminal without tablebases must be a
+        // win.
+        eval.q = -1;
+        eval.d = 0;
+    }
+    child.Pop();
+  }
+}
+
+std::vector<InstamoveResult> InstamoveBatch::Compute() {
+  if (input_count_ > 0) computation_->ComputeBlocking();
+  std::vector<InstamoveResult> results;
+  results.reserve(entries_.size());
+  for (const Entry& entry : entries_) {
+    auto evals = evals_.begin() + entry.first_eval;
+    if (head_ == InstamoveHead::kPolicy) {
+      const EvalResult& eval = *evals;
+      const size_t best_idx =
+          std::max_element(eval.p.begin(), eval.p.end()) - eval.p.begin();
+      results.push_back({entry.legal_moves[best_idx], eval.q, eval.d});
+      continue;
+    }
+    // The evals are of the positions after the moves, for the opponent.
+    const auto best =
+        std::min_element(evals, evals + entry.legal_moves.size(),
+                         [](const EvalResult& a, const EvalResult& b) {
+                           return a.q < b.q;
+                         });
+    results.push_back({entry.legal_moves[best - evals], -best->q, best->d});
+  }
+  return results;
+}
+
 namespace {
 
 class InstamoveSearch : public SearchBase {
@@ -85,14 +150,9 @@ class PolicyHeadSearch : public InstamoveSearch {
   using InstamoveSearch::InstamoveSearch;
 
   Move GetBestMove(const GameState& game_state) final {
-    const std::vector<Position> positions = game_state.GetPositions();
-    MoveList legal_moves = positions.back().GetBoard().GenerateLegalMoves();
-    std::vector<EvalResult> res = backend_->EvaluateBatch(
-        std::vector<EvalPosition>{EvalPosition{positions, legal_moves}});
-    const size_t best_move_idx =
-        std::max_element(res[0].p.begin(), res[0].p.end()) - res[0].p.begin();
-    Move best_move = legal_moves[best_move_idx];
-    return best_move;
+    InstamoveBatch batch(InstamoveHead::kPolicy, backend_);
+    batch.Add(PositionHistory(game_state.GetPositions()));
+    return batch.Compute()[0].bestmove;
   }
 };
 
@@ -100,61 +160,28 @@ class ValueHeadSearch : public InstamoveSearch {
  public:
   using InstamoveSearch::InstamoveSearch;
   Move GetBestMove(const GameState& game_state) final {
-    std::unique_ptr<BackendComputation> computation =
-        backend_->CreateComputation();
-
-    PositionHistory history(game_state.GetPositions());
-    const ChessBoard& board = history.Last().GetBoard();
-    const std::vector<Move> legal_moves = board.GenerateLegalMoves();
-    std::vector<EvalResult> results(legal_moves.size());
-
-    for (size_t i = 0; i < legal_moves.size(); i++) {
-      Move move = legal_moves[i];
-      history.Append(move);
-      switch (history.ComputeGameResult()) {
-        case GameResult::UNDECIDED:
-          computation->AddInput(
-              EvalPosition{history.GetPositions(), {}},
-              EvalResultPtr{.q = &results[i].q, .d = &results[i].d});
-          break;
-        case GameResult::DRAW:
-          results[i].q = 0;
-          results[i].d = 1;
-          break;
-        default:
-          // A legal move to a non-drawn terminal without tablebases must be a
-          // win.
-          results[i].q = -1;
-          results[i].d = 0;
-      }
-      history.Pop();
-    }
-
-    computation->ComputeBlocking();
-
-    const size_t best_idx =
-        std::min_element(results.begin(), results.end(),
-                         [](const EvalResult& a, const EvalResult& b) {
-                           return a.q < b.q;
-                         }) -
-        results.begin();
-
+    InstamoveBatch batch(InstamoveHead::kValue, backend_);
+    const PositionHistory history(game_state.GetPositions());
+    batch.Add(history);
+    const InstamoveResult result = batch.Compute()[0];
+
+    // The score is from the point of view of the side to move after bestmove.
+    const float q = -result.q;
+    const float d = result.d;
     std::vector<ThinkingInfo> infos = {{
         .depth = 1,
         .seldepth = 1,
-        .nodes = static_cast<int64_t>(legal_moves.size()),
-        .score = 90 * std::tan(1.5637541897 * results[best_idx].q),
+        .nodes = static_cast<int64_t>(
+            history.Last().GetBoard().GenerateLegalMoves().size()),
+        .score = 90 * std::tan(1.5637541897 * q),
         .wdl =
             ThinkingInfo::WDL{
-                static_cast<int>(std::round(
-                    500 * (1 + results[best_idx].q - results[best_idx].d))),
-                static_cast<int>(std::round(1000 * results[best_idx].d)),
-                static_cast<int>(std::round(
-                    500 * (1 - results[best_idx].q - results[best_idx].d)))},
+                static_cast<int>(std::round(500 * (1 + q - d))),
+                static_cast<int>(std::round(1000 * d)),
+                static_cast<int>(std::round(500 * (1 - q - d)))},
     }};
     uci_responder_->OutputThinkingInfo(&infos);
-    Move best_move = legal_moves[best_idx];
-    return best_move;
+    return result.bestmove;
   }
 };
 
@@ -0,0 +1,79 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "chess/position.h"
+#include "neural/backend.h"
+
+namespace lczero {
+
+// Which network head picks the move: the policy of the position, or the value
+// of the positions after every legal move.
+enum class InstamoveHead { kPolicy, kValue };
+
+// The move picked in a position, and the eval of the position from the point
+// of view of its side to move.
+struct InstamoveResult {
+  Move bestmove;
+  float q = 0.0f;
+  float d = 0.0f;
+};
+
+// Picks the moves of the instamove searches for many positions at once, with
+// all the network inputs they need in one backend computation.
+class InstamoveBatch {
+ public:
+  InstamoveBatch(InstamoveHead head, Backend* backend);
+
+  // Adds the last position of @history, which must have legal moves.
+  void Add(const PositionHistory& history);
+  // Number of network inputs added so far.
+  size_t GetInputCount() const { return input_count_; }
+  // Evaluates the batch, and returns the results in the order of Add() calls.
+  std::vector<InstamoveResult> Compute();
+
+ private:
+  struct Entry {
+    MoveList legal_moves;
+    // Index of the first eval of the entry in evals_.
+    size_t first_eval;
+  };
+
+  const InstamoveHead head_;
+  std::unique_ptr<BackendComputation> computation_;
+  std::vector<Entry> entries_;
+  // The backend writes into these until Compute(), so they must not move.
+  std::deque<EvalResult> evals_;
+  size_t input_count_ = 0;
+};
+
+}  // namespace lczero
@@ -43,6 +43,7 @@ class MockSearch : public SearchBase {
   MOCK_METHOD(void, SetPosition, (const GameState&), (override));
   MOCK_METHOD(void, StartSearch, (const GoParams&), (override));
   MOCK_METHOD(void, StartClock, (), (override));
+  MOCK_METHOD(void, PonderHit, (), (override));
   MOCK_METHOD(void, WaitSearch, (), (override));
   MOCK_METHOD(void, StopSearch, (), (override));
   MOCK_METHOD(void, AbortSearch, (), (override));
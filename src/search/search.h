@@ -64,9 +64,13 @@ class SearchBase {
   // It can be called either after or befor StartSearch(), particularly:
   // - In the "strict timing" mode, it's called before SetPosition().
   // - In normal mode, it's called before StartSearch().
-  // - In Ponder mode, it may potentially be called at `ponderhit` (although
-  // actually we'll stop the search, change the position and start again).
+  // - In Ponder mode, it's called again at `ponderhit`, before PonderHit().
   virtual void StartClock() = 0;
+  // Called at `ponderhit` during a search started with `go ponder` on the
+  // predicted position. The search should go on, now under the time control
+  // of the go command (measured from the last StartClock()), and respond with
+  // bestmove when done. Must not block.
+  virtual void PonderHit() {}
   // Wait for the search to finish. This is blocking.
   virtual void WaitSearch() = 0;
   // Stops the search as soon as possible and responds with bestmove. Doesn't
@@ -0,0 +1,428 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "selfplay/coordinator.h"
+
+#include <algorithm>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "neural/remote_protocol.h"
+#include "trainingdata/packed.h"
+#include "utils/exception.h"
+#include "utils/logging.h"
+
+namespace lczero {
+namespace {
+const OptionId kCoordinatorAddressId{
+    "coordinator-address", "",
+    "Address to listen on for selfplay workers. The default only accepts "
+    "local connections, use 0.0.0.0 to accept connections from anywhere."};
+const OptionId kCoordinatorPortId{
+    "coordinator-port", "", "TCP port to listen on for selfplay workers."};
+const OptionId kTotalGamesId{
+    "games", "", "Number of games to play over all workers, -1 for no limit."};
+const OptionId kTrainingGamesPerFileId{
+    "training-games-per-file", "",
+    "Number of games per training data file. With more than one, games are "
+    "grouped into block containers."};
+const OptionId kTrainingPackingId{
+    "training-packing", "",
+    "Record format in training data containers: \"none\" for plain V6 "
+    "records, \"sparse\" for V7 records without the illegal moves, "
+    "\"sparse-fp16\" for V7 records with fp16 probabilities."};
+
+const int kDefaultCoordinatorPort = 5557;
+
+std::string GetWorkerName() {
+#ifndef _WIN32
+  char name[256];
+  if (gethostname(name, sizeof(name)) == 0) {
+    name[sizeof(name) - 1] = '\0';
+    return name;
+  }
+#endif
+  return "worker";
+}
+}  // namespace
+
+void SelfPlayCoordinator::PopulateOptions(OptionsParser* options) {
+  options->Add<StringOption>(kCoordinatorAddressId) = "127.0.0.1";
+  options->Add<IntOption>(kCoordinatorPortId, 1, 65535) =
+      kDefaultCoordinatorPort;
+  options->Add<IntOption>(kTotalGamesId, -1, 999999999) = -1;
+  options->Add<IntOption>(kTrainingGamesPerFileId, 1, 100000) = 1;
+  std::vector<std::string> packings = {"none", "sparse", "sparse-fp16"};
+  options->Add<ChoiceOption>(kTrainingPackingId, packings) = "none";
+}
+
+SelfPlayCoordinator::SelfPlayCoordinator(
+    const OptionsDict& options, GameInfo::Callback game_info,
+    TournamentInfo::Callback tournament_info)
+    : total_games_(options.Get<int>(kTotalGamesId)),
+      game_callback_(game_info),
+      tournament_callback_(tournament_info),
+      options_(options) {
+  const std::string packing = options.Get<std::string>(kTrainingPackingId);
+  training_writer_ = std::make_unique<AsyncTrainingDataWriter>(
+      options.Get<int>(kTrainingGamesPerFileId), 64,
+      packing == "sparse"        ? RecordPacking::kSparse
+      : packing == "sparse-fp16" ? RecordPacking::kSparseHalf
+                                 : RecordPacking::kNone);
+}
+
+SelfPlayCoordinator::~SelfPlayCoordinator() { training_writer_->Close(); }
+
+bool SelfPlayCoordinator::AllGamesFinished() const {
+  return total_games_ >= 0 && finished_count_ >= total_games_;
+}
+
+void SelfPlayCoordinator::Dispatch() {
+  while (true) {
+    // The request of the least loaded worker is served first.
+    Worker* worker = nullptr;
+    for (auto& candidate : workers_) {
+      if (candidate->waiting == 0) continue;
+      if (!worker || candidate->games.size() * worker->slots <
+                         worker->games.size() * candidate->slots) {
+        worker = candidate.get();
+      }
+    }
+    if (!worker) return;
+    int game;
+    if (!orphaned_games_.empty()) {
+      game = orphaned_games_.front();
+      orphaned_games_.pop_front();
+    } else if (total_games_ < 0 || next_game_ < total_games_) {
+      game = next_game_++;
+    } else if (AllGamesFinished()) {
+      game = -1;
+    } else {
+      // The remaining games are in progress. Requests wait in case a worker
+      // leaves without finishing its games.
+      return;
+    }
+    --worker->waiting;
+    if (game >= 0) worker->games.push_back(game);
+    MessageWriter writer;
+    writer.Put<int32_t>(game);
+    worker->connection->Send(RemoteMessage::kGameAssigned, writer.data());
+  }
+}
+
+void SelfPlayCoordinator::FinishGame(Worker* worker,
+                                     std::string_view payload) {
+  MessageReader reader(payload);
+  GameInfo info;
+  info.game_id = reader.Get<int32_t>();
+  info.game_result = static_cast<GameResult>(reader.Get<uint8_t>());
+  if (const int8_t is_black = reader.Get<int8_t>(); is_black >= 0) {
+    info.is_black = is_black;
+  }
+  info.initial_fen = reader.GetString();
+  info.play_start_ply = reader.Get<int32_t>();
+  const uint32_t move_count = reader.Get<uint32_t>();
+  for (uint32_t i = 0; i < move_count; ++i) {
+    info.moves.push_back(Move::FromRaw(reader.Get<uint16_t>()));
+  }
+  if (reader.Get<uint8_t>()) {
+    info.min_false_positive_threshold = reader.Get<float>();
+  }
+  const int played_moves = reader.Get<int32_t>();
+  const uint64_t nodes = reader.Get<uint64_t>();
+  std::vector<V6TrainingData> chunks(reader.Get<uint32_t>());
+  const std::string packed = reader.GetString();
+  std::string_view in = packed;
+  for (auto& chunk : chunks) in.remove_prefix(UnpackTrainingData(in, &chunk));
+
+  {
+    Mutex::Lock lock(mutex_);
+    auto iter = std::find(worker->games.begin(), worker->games.end(),
+                          info.game_id);
+    if (iter == worker->games.end()) {
+      throw Exception("Game " + std::to_string(info.game_id) +
+                      " isn't assigned to worker " + worker->name);
+    }
+    worker->games.erase(iter);
+    ++finished_count_;
+    int result = info.game_result == GameResult::DRAW        ? 1
+                 : info.game_result == GameResult::WHITE_WON ? 0
+                                                             : 2;
+    const bool player1_black = info.is_black.value_or(false);
+    if (player1_black) result = 2 - result;
+    ++tournament_info_.results[result][player1_black ? 1 : 0];
+    tournament_info_.move_count_ += played_moves;
+    tournament_info_.nodes_total_ += nodes;
+    tournament_callback_(tournament_info_);
+    Dispatch();
+  }
+  if (chunks.empty()) {
+    game_callback_(info);
+    return;
+  }
+  training_writer_->Submit(
+      info.game_id, std::move(chunks),
+      [this, info](const std::string& filename) mutable {
+        info.training_filename = filename;
+        game_callback_(info);
+      });
+}
+
+#ifdef _WIN32
+
+void SelfPlayCoordinator::Run() {
+  throw Exception("Selfplay coordinator is not supported on Windows.");
+}
+
+void SelfPlayCoordinator::ServeConnection(std::shared_ptr<RemoteConnection>) {
+}
+
+#else
+
+void SelfPlayCoordinator::Run() {
+  const int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd < 0) throw Exception("Unable to create a socket.");
+  const int reuse = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  const int port = options_.Get<int>(kCoordinatorPortId);
+  address.sin_port = htons(port);
+  const std::string host = options_.Get<std::string>(kCoordinatorAddressId);
+  if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1) {
+    close(listen_fd);
+    throw Exception("Invalid coordinator address: " + host);
+  }
+  if (bind(listen_fd, reinterpret_cast<sockaddr*>(&address),
+           sizeof(address)) != 0 ||
+      listen(listen_fd, 16) != 0) {
+    close(listen_fd);
+    throw Exception("Unable to listen on " + host + ":" +
+                    std::to_string(port));
+  }
+  CERR << "Coordinating selfplay workers on " << host << ":" << port << ".";
+
+  while (true) {
+    {
+      Mutex::Lock lock(mutex_);
+      if (AllGamesFinished()) break;
+    }
+    // Wakes up now and then to notice that the games are finished.
+    pollfd poll_fd{.fd = listen_fd, .events = POLLIN, .revents = 0};
+    if (poll(&poll_fd, 1, 200) <= 0) continue;
+    const int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) continue;
+    auto connection = std::make_shared<RemoteConnection>(fd);
+    Mutex::Lock lock(mutex_);
+    threads_.emplace_back(
+        [this, connection]() { ServeConnection(connection); });
+  }
+  close(listen_fd);
+
+  // All workers got their -1 replies by now.
+  std::vector<std::thread> threads;
+  {
+    Mutex::Lock lock(mutex_);
+    for (auto& worker : workers_) worker->connection->Shutdown();
+    threads.swap(threads_);
+  }
+  for (auto& thread : threads) thread.join();
+  training_writer_->Close();
+  Mutex::Lock lock(mutex_);
+  tournament_info_.finished = true;
+  tournament_callback_(tournament_info_);
+}
+
+void SelfPlayCoordinator::ServeConnection(
+    std::shared_ptr<RemoteConnection> connection) {
+  RemoteMessage type;
+  std::string payload;
+  if (!connection->Receive(&type, &payload) ||
+      type != RemoteMessage::kWorkerHello) {
+    return;
+  }
+  auto worker = std::make_unique<Worker>();
+  try {
+    MessageReader reader(payload);
+    if (reader.Get<uint32_t>() != kRemoteProtocolMagic ||
+        reader.Get<uint16_t>() != kRemoteProtocolVersion) {
+      CERR << "Rejected a worker with an unsupported protocol.";
+      return;
+    }
+    worker->slots = std::max<int>(1, reader.Get<uint32_t>());
+    worker->name = reader.GetString();
+  } catch (Exception& ex) {
+    CERR << "Rejected a worker: " << ex.what();
+    return;
+  }
+  worker->connection = connection;
+  Worker* const self = worker.get();
+  {
+    Mutex::Lock lock(mutex_);
+    workers_.push_back(std::move(worker));
+  }
+  CERR << "Worker " << self->name << " connected with " << self->slots
+       << " game slots.";
+
+  while (connection->Receive(&type, &payload)) {
+    if (type == RemoteMessage::kGameRequest) {
+      Mutex::Lock lock(mutex_);
+      ++self->waiting;
+      Dispatch();
+    } else if (type == RemoteMessage::kGameFinished) {
+      try {
+        FinishGame(self, payload);
+      } catch (Exception& ex) {
+        CERR << "Dropping worker " << self->name << ": " << ex.what();
+        break;
+      }
+    } else {
+      break;
+    }
+  }
+
+  Mutex::Lock lock(mutex_);
+  const size_t orphaned = self->games.size();
+  orphaned_games_.insert(orphaned_games_.end(), self->games.begin(),
+                         self->games.end());
+  CERR << "Worker " << self->name << " disconnected, " << orphaned
+       << " unfinished games are handed out again.";
+  workers_.erase(std::find_if(
+      workers_.begin(), workers_.end(),
+      [self](const std::unique_ptr<Worker>& w) { return w.get() == self; }));
+  Dispatch();
+}
+
+#endif
+
+SelfPlayCoordinatorClient::SelfPlayCoordinatorClient(
+    const std::string& address, int slots) {
+  const size_t colon = address.rfind(':');
+  int port = 0;
+  try {
+    if (colon != std::string::npos) port = std::stoi(address.substr(colon + 1));
+  } catch (std::exception&) {
+  }
+  if (port <= 0) {
+    throw Exception("Coordinator address must be <host>:<port>, got " +
+                    address);
+  }
+  connection_ = RemoteConnection::Connect(address.substr(0, colon), port);
+  MessageWriter hello;
+  hello.Put<uint32_t>(kRemoteProtocolMagic);
+  hello.Put<uint16_t>(kRemoteProtocolVersion);
+  hello.Put<uint32_t>(slots);
+  hello.PutString(GetWorkerName());
+  if (!connection_->Send(RemoteMessage::kWorkerHello, hello.data())) {
+    throw Exception("Coordinator closed the connection.");
+  }
+  reader_ = std::thread([this]() { Reader(); });
+  CERR << "Taking games from the coordinator at " << address << ".";
+}
+
+SelfPlayCoordinatorClient::~SelfPlayCoordinatorClient() {
+  Close();
+  reader_.join();
+}
+
+void SelfPlayCoordinatorClient::Reader() {
+  RemoteMessage type;
+  std::string payload;
+  while (connection_->Receive(&type, &payload) &&
+         type == RemoteMessage::kGameAssigned) {
+    MessageReader reader(payload);
+    if (payload.size() != sizeof(int32_t)) break;
+    {
+      Mutex::Lock lock(mutex_);
+      assigned_.push_back(reader.Get<int32_t>());
+    }
+    cv_.notify_one();
+  }
+  {
+    Mutex::Lock lock(mutex_);
+    closed_ = true;
+  }
+  cv_.notify_all();
+}
+
+std::optional<int> SelfPlayCoordinatorClient::NextGame() {
+  {
+    Mutex::Lock lock(mutex_);
+    if (closed_) return std::nullopt;
+  }
+  if (!connection_->Send(RemoteMessage::kGameRequest, {})) {
+    Close();
+    return std::nullopt;
+  }
+  // Replies are interchangeable, any thread may take any of them.
+  Mutex::Lock lock(mutex_);
+  cv_.wait(lock.get_raw(), [&]() { return closed_ || !assigned_.empty(); });
+  if (assigned_.empty()) return std::nullopt;
+  const int game = assigned_.front();
+  assigned_.pop_front();
+  if (game < 0) return std::nullopt;
+  return game;
+}
+
+void SelfPlayCoordinatorClient::SubmitGame(
+    const GameInfo& info, int move_count, uint64_t nodes,
+    const std::vector<V6TrainingData>& chunks) {
+  MessageWriter writer;
+  writer.Put<int32_t>(info.game_id);
+  writer.Put<uint8_t>(static_cast<uint8_t>(info.game_result));
+  writer.Put<int8_t>(info.is_black ? *info.is_black : -1);
+  writer.PutString(info.initial_fen);
+  writer.Put<int32_t>(info.play_start_ply);
+  writer.Put<uint32_t>(info.moves.size());
+  for (const Move& move : info.moves) writer.Put<uint16_t>(move.raw_data());
+  writer.Put<uint8_t>(info.min_false_positive_threshold.has_value());
+  if (info.min_false_positive_threshold) {
+    writer.Put<float>(*info.min_false_positive_threshold);
+  }
+  writer.Put<int32_t>(move_count);
+  writer.Put<uint64_t>(nodes);
+  writer.Put<uint32_t>(chunks.size());
+  // Sparse records are lossless and a fraction of the size.
+  std::string packed;
+  for (const auto& chunk : chunks) {
+    PackTrainingData(chunk, RecordPacking::kSparse, &packed);
+  }
+  writer.PutString(packed);
+  if (!connection_->Send(RemoteMessage::kGameFinished, writer.data())) {
+    CERR << "Lost game " << info.game_id << ", the coordinator is gone.";
+  }
+}
+
+void SelfPlayCoordinatorClient::Close() { connection_->Shutdown(); }
+
+}  // namespace lczero
@@ -0,0 +1,143 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chess/callbacks.h"
+#include "trainingdata/async_writer.h"
+#include "trainingdata/trainingdata.h"
+#include "utils/mutex.h"
+#include "utils/optionsdict.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+
+class RemoteConnection;
+
+// Hands out the games of a selfplay run to workers on other hosts, and writes
+// the training data of all of them in one place. Workers are lc0 selfplay
+// with --coordinator=<host>:<port>. They evaluate on whatever backend they are
+// configured with, typically the "remote" backend of shared GPU boxes.
+//
+// A worker asks for a game whenever one of its game slots is free, so faster
+// workers get more games, and none holds more games than it has slots. Games
+// of a worker that disconnects before finishing them are handed out again.
+//
+// Messages, framed as in remote_protocol.h:
+//   kWorkerHello   worker -> coordinator: magic, protocol version, number of
+//                  game slots, worker name.
+//   kGameRequest   worker -> coordinator: asks for one game.
+//   kGameAssigned  coordinator -> worker: game id, -1 once there are no more
+//                  games. Every request gets exactly one reply, which may come
+//                  later when all games are taken for now.
+//   kGameFinished  worker -> coordinator: the GameInfo, move and node counts
+//                  and the packed training data of the game.
+class SelfPlayCoordinator {
+ public:
+  SelfPlayCoordinator(const OptionsDict& options, GameInfo::Callback game_info,
+                      TournamentInfo::Callback tournament_info);
+  ~SelfPlayCoordinator();
+
+  static void PopulateOptions(OptionsParser* options);
+
+  // Serves workers until all games are finished, forever without a game
+  // limit.
+  void Run();
+
+ private:
+  struct Worker {
+    std::string name;
+    int slots;
+    std::shared_ptr<RemoteConnection> connection;
+    // Games assigned to the worker and not finished yet.
+    std::vector<int> games;
+    // Requests that didn't get a game yet.
+    int waiting = 0;
+  };
+
+  void ServeConnection(std::shared_ptr<RemoteConnection> connection);
+  void FinishGame(Worker* worker, std::string_view payload);
+  // Answers waiting requests with available games, or with -1 once all games
+  // are finished.
+  void Dispatch() REQUIRES(mutex_);
+  bool AllGamesFinished() const REQUIRES(mutex_);
+
+  const int total_games_;
+  const GameInfo::Callback game_callback_;
+  const TournamentInfo::Callback tournament_callback_;
+  std::unique_ptr<AsyncTrainingDataWriter> training_writer_;
+  const OptionsDict& options_;
+
+  Mutex mutex_;
+  std::vector<std::unique_ptr<Worker>> workers_ GUARDED_BY(mutex_);
+  int next_game_ GUARDED_BY(mutex_) = 0;
+  // Games of disconnected workers, handed out before new ones.
+  std::deque<int> orphaned_games_ GUARDED_BY(mutex_);
+  int finished_count_ GUARDED_BY(mutex_) = 0;
+  TournamentInfo tournament_info_ GUARDED_BY(mutex_);
+  std::vector<std::thread> threads_ GUARDED_BY(mutex_);
+};
+
+// Worker side of the coordinator protocol, used by SelfPlayTournament.
+class SelfPlayCoordinatorClient {
+ public:
+  // Connects to "<host>:<port>" and offers @slots parallel games.
+  SelfPlayCoordinatorClient(const std::string& address, int slots);
+  ~SelfPlayCoordinatorClient();
+
+  // Blocks until the coordinator assigns a game and returns its id. Returns
+  // std::nullopt once there are no more games or the connection is closed.
+  std::optional<int> NextGame();
+
+  // Sends the finished game with its training data to the coordinator.
+  void SubmitGame(const GameInfo& info, int move_count, uint64_t nodes,
+                  const std::vector<V6TrainingData>& chunks);
+
+  // Makes all waiting and future NextGame() calls return std::nullopt.
+  void Close();
+
+ private:
+  void Reader();
+
+  std::unique_ptr<RemoteConnection> connection_;
+  std::thread reader_;
+
+  Mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<int> assigned_ GUARDED_BY(mutex_);
+  bool closed_ GUARDED_BY(mutex_) = false;
+};
+
+}  // namespace lczero
@@ -65,6 +65,50 @@ const OptionId kOpeningStopProbId{
     "opening-stop-prob", "OpeningStopProb",
     "From each opening move, start a self-play game with probability max(p, "
     "1/n), where p is the value given and n the opening moves remaining."};
+const OptionId kSyzygyAdjudicateId{
+    "syzygy-adjudicate", "SyzygyAdjudicate",
+    "End the game with the tablebase result as soon as it reaches a position "
+    "in the tablebases."};
+const OptionId kAdjudicateStablePliesId{
+    "adjudicate-stable-plies", "AdjudicateStablePlies",
+    "Adjudicate the game once the searches of that many consecutive plies "
+    "predicted the same outcome above --adjudicate-stable-threshold. 0 "
+    "disables it."};
+const OptionId kAdjudicateStableThresholdId{
+    "adjudicate-stable-threshold", "AdjudicateStableThreshold",
+    "Probability in percent of the predicted outcome needed for stable outcome "
+    "adjudication."};
+const OptionId kBookExitDrawThresholdId{
+    "book-exit-draw-threshold", "BookExitDrawThreshold",
+    "Adjudicate a draw when the draw probability after the first search of the "
+    "game is at least that, in percent. 0 disables it."};
+const OptionId kDecidedVisitsFactorId{
+    "decided-visits-factor", "DecidedVisitsFactor",
+    "Games that would have been resigned or adjudicated but are played through "
+    "continue with their search limits scaled by that factor."};
+
+// The tablebase result of the position, if it's in the tablebases.
+std::optional<GameResult> ProbeGameResult(SyzygyTablebase* syzygy_tb,
+                                          const PositionHistory& history) {
+  const auto& board = history.Last().GetBoard();
+  if (!board.castlings().no_legal_castle() ||
+      (board.ours() | board.theirs()).count() > syzygy_tb->max_cardinality()) {
+    return std::nullopt;
+  }
+  ProbeState state;
+  const WDLScore wdl = syzygy_tb->probe_wdl(history.Last(), &state);
+  // Only fail state means the WDL is wrong.
+  if (state == FAIL) return std::nullopt;
+  const bool black_to_move = history.IsBlackToMove();
+  if (wdl == WDL_WIN) {
+    return black_to_move ? GameResult::BLACK_WON : GameResult::WHITE_WON;
+  }
+  if (wdl == WDL_LOSS) {
+    return black_to_move ? GameResult::WHITE_WON : GameResult::BLACK_WON;
+  }
+  // Cursed wins and blessed losses count as draws.
+  return GameResult::DRAW;
+}
 }  // namespace
 
 void SelfPlayGame::PopulateUciParams(OptionsParser* options) {
@@ -77,6 +121,12 @@ void SelfPlayGame::PopulateUciParams(OptionsParser* options) {
   PopulateTimeManagementOptions(classic::RunType::kSelfplay, options);
   options->Add<StringOption>(kSyzygyTablebaseId);
   options->Add<FloatOption>(kOpeningStopProbId, 0.0f, 1.0f) = 0.0f;
+  options->Add<BoolOption>(kSyzygyAdjudicateId) = false;
+  options->Add<IntOption>(kAdjudicateStablePliesId, 0, 1000) = 0;
+  options->Add<FloatOption>(kAdjudicateStableThresholdId, 50.0f, 100.0f) =
+      95.0f;
+  options->Add<FloatOption>(kBookExitDrawThresholdId, 0.0f, 100.0f) = 0.0f;
+  options->Add<FloatOption>(kDecidedVisitsFactorId, 0.0f, 1.0f) = 1.0f;
 }
 
 SelfPlayGame::SelfPlayGame(PlayerOptions white, PlayerOptions black,
@@ -128,8 +178,36 @@ SelfPlayGame::SelfPlayGame(PlayerOptions white, PlayerOptions black,
   start_ply_ = ply;
 }
 
+void SearchThreadBudget::AddGame() {
+  Mutex::Lock lock(mutex_);
+  ++games_;
+}
+
+void SearchThreadBudget::RemoveGame() {
+  Mutex::Lock lock(mutex_);
+  --games_;
+}
+
+int SearchThreadBudget::Acquire() {
+  Mutex::Lock lock(mutex_);
+  while (free_ == 0) released_.wait(lock.get_raw());
+  const int share = (total_ + games_ - 1) / std::max(1, games_);
+  const int threads = std::clamp(share, 1, free_);
+  free_ -= threads;
+  return threads;
+}
+
+void SearchThreadBudget::Release(int threads) {
+  {
+    Mutex::Lock lock(mutex_);
+    free_ += threads;
+  }
+  released_.notify_all();
+}
+
 void SelfPlayGame::Play(int white_threads, int black_threads, bool training,
-                        SyzygyTablebase* syzygy_tb, bool enable_resign) {
+                        SyzygyTablebase* syzygy_tb, bool enable_resign,
+                        SearchThreadBudget* thread_budget) {
   bool blacks_move = tree_[0]->IsBlackToMove();
 
   // Take syzygy tablebases from player1 options.
@@ -155,13 +233,36 @@ void SelfPlayGame::Play(int white_threads, int black_threads, bool training,
     }
     // Initialize search.
     const int idx = blacks_move ? 1 : 0;
+    // Tablebase results are exact, so even played through games stop there.
+    SyzygyTablebase* adjudication_tb = syzygy_tb ? syzygy_tb : syzygy_tb_.get();
+    if (adjudication_tb &&
+        options_[idx].uci_options->Get<bool>(kSyzygyAdjudicateId)) {
+      if (const auto result =
+              ProbeGameResult(adjudication_tb, tree_[0]->GetPositionHistory())) {
+        game_result_ = *result;
+        adjudicated_ = true;
+        break;
+      }
+    }
     if (!options_[idx].uci_options->Get<bool>(kReuseTreeId)) {
       tree_[idx]->TrimTreeAtHead();
     }
     {
       std::lock_guard<std::mutex> lock(mutex_);
       if (abort_) break;
-      auto stoppers = options_[idx].search_limits.MakeSearchStopper();
+      SelfPlayLimits limits = options_[idx].search_limits;
+      if (decided_) {
+        const float factor =
+            options_[idx].uci_options->Get<float>(kDecidedVisitsFactorId);
+        auto scale = [factor](std::int64_t limit) {
+          return limit < 0 ? limit
+                           : std::max<std::int64_t>(1, limit * factor);
+        };
+        limits.visits = scale(limits.visits);
+        limits.playouts = scale(limits.playouts);
+        limits.movetime = scale(limits.movetime);
+      }
+      auto stoppers = limits.MakeSearchStopper();
       classic::PopulateIntrinsicStoppers(stoppers.get(),
                                          *options_[idx].uci_options);
 
@@ -177,14 +278,21 @@ void SelfPlayGame::Play(int white_threads, int black_threads, bool training,
     }
 
     // Do search.
-    search_->RunBlocking(blacks_move ? black_threads : white_threads);
+    if (thread_budget) {
+      const int threads = thread_budget->Acquire();
+      search_->RunBlocking(threads);
+      thread_budget->Release(threads);
+    } else {
+      search_->RunBlocking(blacks_move ? black_threads : white_threads);
+    }
     move_count_++;
     nodes_total_ += search_->GetTotalPlayouts();
     if (abort_) break;
 
-    Move best_move;
-    bool best_is_terminal;
-    const auto best_eval = search_->GetBestEval(&best_move, &best_is_terminal);
+    // Everything about the search that is needed from here on, so that the
+    // tree is not walked again.
+    const SearchArtifacts artifacts = search_->GetArtifacts();
+    const auto& best_eval = artifacts.best_eval;
     float eval = best_eval.wl;
     eval = (eval + 1) / 2;
     if (eval < min_eval_[idx]) min_eval_[idx] = eval;
@@ -195,56 +303,81 @@ void SelfPlayGame::Play(int white_threads, int black_threads, bool training,
     max_eval_[0] = std::max(max_eval_[0], blacks_move ? best_l : best_w);
     max_eval_[1] = std::max(max_eval_[1], best_d);
     max_eval_[2] = std::max(max_eval_[2], blacks_move ? best_w : best_l);
-    if (enable_resign && move_number >= options_[idx].uci_options->Get<int>(
-                                            kResignEarliestMoveId)) {
+    // Outcome the game can be adjudicated with, if any.
+    std::optional<GameResult> decided_result;
+    if (move_number >=
+        options_[idx].uci_options->Get<int>(kResignEarliestMoveId)) {
       const float resignpct =
           options_[idx].uci_options->Get<float>(kResignPercentageId) / 100;
       if (options_[idx].uci_options->Get<bool>(kResignWDLStyleId)) {
         auto threshold = 1.0f - resignpct;
         if (best_w > threshold) {
-          game_result_ =
+          decided_result =
               blacks_move ? GameResult::BLACK_WON : GameResult::WHITE_WON;
-          adjudicated_ = true;
-          break;
-        }
-        if (best_l > threshold) {
-          game_result_ =
+        } else if (best_l > threshold) {
+          decided_result =
               blacks_move ? GameResult::WHITE_WON : GameResult::BLACK_WON;
-          adjudicated_ = true;
-          break;
-        }
-        if (best_d > threshold) {
-          game_result_ = GameResult::DRAW;
-          adjudicated_ = true;
-          break;
+        } else if (best_d > threshold) {
+          decided_result = GameResult::DRAW;
         }
+      } else if (eval < resignpct) {  // always false when resignpct == 0
+        decided_result =
+            blacks_move ? GameResult::WHITE_WON : GameResult::BLACK_WON;
+      }
+    }
+    if (const int stable_plies =
+            options_[idx].uci_options->Get<int>(kAdjudicateStablePliesId)) {
+      const float threshold =
+          options_[idx].uci_options->Get<float>(kAdjudicateStableThresholdId) /
+          100;
+      const GameResult outcome =
+          best_w > threshold
+              ? (blacks_move ? GameResult::BLACK_WON : GameResult::WHITE_WON)
+          : best_l > threshold
+              ? (blacks_move ? GameResult::WHITE_WON : GameResult::BLACK_WON)
+          : best_d > threshold ? GameResult::DRAW
+                               : GameResult::UNDECIDED;
+      if (outcome == GameResult::UNDECIDED) {
+        stable_plies_ = 0;
+      } else if (outcome == stable_outcome_) {
+        ++stable_plies_;
       } else {
-        if (eval < resignpct) {  // always false when resignpct == 0
-          game_result_ =
-              blacks_move ? GameResult::WHITE_WON : GameResult::BLACK_WON;
-          adjudicated_ = true;
-          break;
-        }
+        stable_plies_ = 1;
+      }
+      stable_outcome_ = outcome;
+      if (!decided_result && stable_plies_ >= stable_plies) {
+        decided_result = outcome;
       }
     }
+    // Openings leading to a dead draw aren't worth playing out.
+    if (const float threshold =
+            options_[idx].uci_options->Get<float>(kBookExitDrawThresholdId);
+        !decided_result && move_count_ == 1 && threshold > 0.0f &&
+        best_d * 100 >= threshold) {
+      decided_result = GameResult::DRAW;
+    }
+    if (decided_result) {
+      if (enable_resign) {
+        game_result_ = *decided_result;
+        adjudicated_ = true;
+        break;
+      }
+      // Played through to check the adjudication, but with less effort.
+      decided_ = true;
+    }
 
-    auto node = tree_[idx]->GetCurrentHead();
-    classic::Eval played_eval = best_eval;
+    SearchArtifacts::Eval played_eval = best_eval;
     Move move;
     while (true) {
       move = search_->GetBestMove().first;
       uint32_t max_n = 0;
       uint32_t cur_n = 0;
 
-      for (auto& edge : node->Edges()) {
-        if (edge.GetN() > max_n) {
-          max_n = edge.GetN();
-        }
-        if (edge.GetMove(tree_[idx]->IsBlackToMove()) == move) {
-          cur_n = edge.GetN();
-          played_eval.wl = edge.GetWL(-node->GetWL());
-          played_eval.d = edge.GetD(node->GetD());
-          played_eval.ml = edge.GetM(node->GetM() - 1) + 1;
+      for (const auto& root_move : artifacts.root_moves) {
+        max_n = std::max(max_n, root_move.visits);
+        if (root_move.move == move) {
+          cur_n = root_move.visits;
+          played_eval = root_move.eval;
         }
       }
       // If 'best move' is less than allowed visits and not max visits,
@@ -268,32 +401,22 @@ void SelfPlayGame::Play(int white_threads, int black_threads, bool training,
     }
 
     if (training) {
-      bool best_is_proof = best_is_terminal;  // But check for better moves.
+      // But check for better moves.
+      bool best_is_proof = artifacts.best_is_terminal;
       if (best_is_proof && best_eval.wl < 1) {
         auto best =
             (best_eval.wl == 0) ? GameResult::DRAW : GameResult::BLACK_WON;
         auto upper = best;
-        for (const auto& edge : node->Edges()) {
-          upper = std::max(edge.GetBounds().second, upper);
+        for (const auto& root_move : artifacts.root_moves) {
+          upper = std::max(root_move.upper_bound, upper);
         }
         if (best < upper) {
           best_is_proof = false;
         }
       }
       // Append training data. The GameResult is later overwritten.
-      std::vector<Move> legal_moves = tree_[idx]
-                                          ->GetPositionHistory()
-                                          .Last()
-                                          .GetBoard()
-                                          .GenerateLegalMoves();
-      std::optional<EvalResult> nneval =
-          options_[idx].backend->GetCachedEvaluation(EvalPosition{
-              tree_[idx]->GetPositionHistory().GetPositions(), legal_moves});
-      training_data_.Add(tree_[idx]->GetCurrentHead(),
-                         tree_[idx]->GetPositionHistory(), best_eval,
-                         played_eval, best_is_proof, best_move, move,
-                         legal_moves, nneval,
-                         search_->GetParams().GetPolicySoftmaxTemp());
+      training_data_.Add(artifacts, tree_[idx]->GetPositionHistory(),
+                         played_eval, best_is_proof, move);
     }
     // Must reset the search before mutating the tree.
     search_.reset();
@@ -352,6 +475,10 @@ void SelfPlayGame::WriteTrainingData(TrainingDataWriter* writer) const {
   training_data_.Write(writer, game_result_, adjudicated_);
 }
 
+std::vector<V6TrainingData> SelfPlayGame::GetTrainingData() const {
+  return training_data_.Finalize(game_result_, adjudicated_);
+}
+
 std::unique_ptr<classic::ChainedSearchStopper>
 SelfPlayLimits::MakeSearchStopper() const {
   auto result = std::make_unique<classic::ChainedSearchStopper>();
@@ -366,6 +493,10 @@ SelfPlayLimits::MakeSearchStopper() const {
   if (movetime >= 0) {
     result->AddStopper(std::make_unique<classic::TimeLimitStopper>(movetime));
   }
+  if (target_kld > 0.0f) {
+    result->AddStopper(std::make_unique<classic::PolicyConvergenceStopper>(
+        target_kld, target_kld_min_visits, target_kld_checkpoint_factor));
+  }
   return result;
 }
 
@@ -27,14 +27,16 @@
 
 #pragma once
 
+#include <condition_variable>
+
 #include "chess/pgn.h"
 #include "chess/position.h"
 #include "chess/uciloop.h"
-#include "neural/cache.h"
 #include "neural/backend.h"
 #include "search/classic/search.h"
 #include "search/classic/stoppers/stoppers.h"
 #include "trainingdata/trainingdata.h"
+#include "utils/mutex.h"
 #include "utils/optionsparser.h"
 
 namespace lczero {
@@ -43,10 +45,38 @@ struct SelfPlayLimits {
   std::int64_t visits = -1;
   std::int64_t playouts = -1;
   std::int64_t movetime = -1;
+  // Stop the search once the visit distribution changes by less than that KL
+  // divergence between checkpoints. 0 disables it.
+  float target_kld = 0.0f;
+  std::int64_t target_kld_min_visits = 0;
+  float target_kld_checkpoint_factor = 1.0f;
 
   std::unique_ptr<classic::ChainedSearchStopper> MakeSearchStopper() const;
 };
 
+// Search threads shared by all games running concurrently. Every search takes
+// an equal share of the budget, or whatever is free when it starts, so that the
+// threads of finished games go to the ones still running. Thread safe.
+class SearchThreadBudget {
+ public:
+  explicit SearchThreadBudget(int threads) : total_(threads), free_(threads) {}
+
+  // Games call these when they start and finish.
+  void AddGame();
+  void RemoveGame();
+
+  // Blocks until a thread is free, and returns the number of threads taken.
+  int Acquire();
+  void Release(int threads);
+
+ private:
+  const int total_;
+  Mutex mutex_;
+  std::condition_variable released_;
+  int free_ GUARDED_BY(mutex_);
+  int games_ GUARDED_BY(mutex_) = 0;
+};
+
 struct PlayerOptions {
   using OpeningCallback = std::function<void(const Opening&)>;
   // Backend to use by the player.
@@ -76,9 +106,12 @@ class SelfPlayGame {
   // Populate command line options that it uses.
   static void PopulateUciParams(OptionsParser* options);
 
-  // Starts the game and blocks until the game is finished.
+  // Starts the game and blocks until the game is finished. With
+  // @thread_budget, searches take their threads from it instead of using
+  // @white_threads and @black_threads.
   void Play(int white_threads, int black_threads, bool training,
-            SyzygyTablebase* syzygy_tb, bool enable_resign = true);
+            SyzygyTablebase* syzygy_tb, bool enable_resign = true,
+            SearchThreadBudget* thread_budget = nullptr);
   // Aborts the game currently played, doesn't matter if it's synchronous or
   // not.
   void Abort();
@@ -89,6 +122,9 @@ class SelfPlayGame {
   // Writes training data to a file.
   void WriteTrainingData(TrainingDataWriter* writer) const;
 
+  // Returns the training data chunks of the finished game.
+  std::vector<V6TrainingData> GetTrainingData() const;
+
   GameResult GetGameResult() const { return game_result_; }
   std::vector<Move> GetMoves() const;
   // Gets the eval which required the biggest swing up to get the final outcome.
@@ -112,6 +148,11 @@ class SelfPlayGame {
   bool abort_ = false;
   GameResult game_result_ = GameResult::UNDECIDED;
   bool adjudicated_ = false;
+  // The game would have been adjudicated, but is played through.
+  bool decided_ = false;
+  // Outcome predicted by the searches of the last stable_plies_ plies.
+  GameResult stable_outcome_ = GameResult::UNDECIDED;
+  int stable_plies_ = 0;
   // Track minimum eval for each player so that GetWorstEvalForWinnerOrDraw()
   // can be calculated after end of game.
   float min_eval_[2] = {1.0f, 1.0f};
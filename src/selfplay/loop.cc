@@ -29,8 +29,10 @@
 
 #include <optional>
 
+#include "selfplay/coordinator.h"
 #include "selfplay/tournament.h"
 #include "utils/configfile.h"
+#include "utils/metrics.h"
 #include "utils/optionsparser.h"
 
 namespace lczero {
@@ -50,11 +52,13 @@ void SelfPlayLoop::Run() {
   SelfPlayTournament::PopulateOptions(&options_);
 
   options_.Add<StringOption>(kLogFileId);
+  Metrics::PopulateOptions(&options_);
 
   if (!options_.ProcessAllFlags()) return;
 
   Logging::Get().SetFilename(
       options_.GetOptionsDict().Get<std::string>(kLogFileId));
+  Metrics::Get().ApplyOptions(options_.GetOptionsDict());
 
   // Send id before starting tournament to allow wrapping client to know
   // who we are.
@@ -64,6 +68,28 @@ void SelfPlayLoop::Run() {
       std::bind(&SelfPlayLoop::SendGameInfo, this, std::placeholders::_1),
       std::bind(&SelfPlayLoop::SendTournament, this, std::placeholders::_1));
   tournament.RunBlocking();
+  Metrics::Get().Stop();
+}
+
+void SelfPlayLoop::RunCoordinator() {
+  SelfPlayCoordinator::PopulateOptions(&options_);
+
+  options_.Add<StringOption>(kLogFileId);
+  Metrics::PopulateOptions(&options_);
+
+  if (!options_.ProcessAllFlags()) return;
+
+  Logging::Get().SetFilename(
+      options_.GetOptionsDict().Get<std::string>(kLogFileId));
+  Metrics::Get().ApplyOptions(options_.GetOptionsDict());
+
+  uci_responder_->SendId();
+  SelfPlayCoordinator coordinator(
+      options_.GetOptionsDict(),
+      std::bind(&SelfPlayLoop::SendGameInfo, this, std::placeholders::_1),
+      std::bind(&SelfPlayLoop::SendTournament, this, std::placeholders::_1));
+  coordinator.Run();
+  Metrics::Get().Stop();
 }
 
 void SelfPlayLoop::SendGameInfo(const GameInfo& info) {
@@ -44,6 +44,8 @@ class SelfPlayLoop {
   ~SelfPlayLoop();
 
   void Run();
+  // Hands out games to selfplay workers on other hosts and reports them.
+  void RunCoordinator();
 
  private:
   void SendGameInfo(const GameInfo& move);
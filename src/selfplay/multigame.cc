@@ -27,50 +27,92 @@
 
 #include "selfplay/multigame.h"
 
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <thread>
+
 namespace lczero {
 
+namespace {
+// Fewer trees than that per thread aren't worth starting a thread for.
+constexpr size_t kMinTreesPerThread = 64;
+
+// Runs @func(i) for every i in [0, size), spread over a few threads.
+template <typename F>
+void ParallelFor(size_t size, F func) {
+  const size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  const size_t num_threads =
+      std::clamp<size_t>(size / kMinTreesPerThread, 1, max_threads);
+  if (num_threads == 1) {
+    for (size_t i = 0; i < size; ++i) func(i);
+    return;
+  }
+  std::atomic<size_t> next{0};
+  auto worker = [&]() {
+    for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < size;) {
+      func(i);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; ++i) threads.emplace_back(worker);
+  worker();
+  for (auto& thread : threads) thread.join();
+}
+}  // namespace
+
 class PolicyEvaluator : public Evaluator {
  public:
   void Reset(const PlayerOptions& player) override {
     comp_ = player.backend->CreateComputation();
+    entries_.clear();
+    next_entry_ = 0;
   }
   void Gather(classic::NodeTree* tree) override {
     const auto& history = tree->GetPositionHistory();
-    moves_.clear();
+    auto& entry = entries_.emplace_back();
     for (auto edge : tree->GetCurrentHead()->Edges()) {
-      moves_.push_back(edge.GetMove());
+      entry.moves.push_back(edge.GetMove());
     }
-    p_.resize(moves_.size());
+    entry.p.resize(entry.moves.size());
     comp_->AddInput(
         EvalPosition{
             .pos = history.GetPositions(),
-            .legal_moves = moves_,
+            .legal_moves = entry.moves,
         },
-        EvalResultPtr{.p = p_});
+        EvalResultPtr{.p = entry.p});
   }
   void Run() override { comp_->ComputeBlocking(); }
   void MakeBestMove(classic::NodeTree* tree) override {
-    size_t best_idx = std::max_element(p_.begin(), p_.end()) - p_.begin();
-    tree->MakeMove(moves_[best_idx]);
+    const auto& entry = entries_[next_entry_++];
+    size_t best_idx =
+        std::max_element(entry.p.begin(), entry.p.end()) - entry.p.begin();
+    tree->MakeMove(entry.moves[best_idx]);
   }
 
+  struct Entry {
+    std::vector<Move> moves;
+    std::vector<float> p;
+  };
   std::unique_ptr<BackendComputation> comp_;
-  std::vector<Move> moves_;
-  std::vector<float> p_;
+  // Deque, as the computation keeps pointers into the entries.
+  std::deque<Entry> entries_;
+  size_t next_entry_ = 0;
 };
 
 class ValueEvaluator : public Evaluator {
  public:
   void Reset(const PlayerOptions& player) override {
     comp_ = player.backend->CreateComputation();
+    entries_.clear();
+    next_entry_ = 0;
   }
   void Gather(classic::NodeTree* tree) override {
     PositionHistory history = tree->GetPositionHistory();
-    q_.clear();
-    q_.reserve(tree->GetCurrentHead()->GetNumEdges());
-    moves_.clear();
+    auto& entry = entries_.emplace_back();
+    entry.q.reserve(tree->GetCurrentHead()->GetNumEdges());
     for (auto edge : tree->GetCurrentHead()->Edges()) {
-      moves_.push_back(edge.GetMove());
+      entry.moves.push_back(edge.GetMove());
       history.Append(edge.GetMove());
       auto result = history.ComputeGameResult();
       if (result == GameResult::UNDECIDED) {
@@ -79,26 +121,33 @@ class ValueEvaluator : public Evaluator {
                 .pos = history.GetPositions(),
                 .legal_moves = {},
             },
-            EvalResultPtr{.q = &q_.emplace_back()});
+            EvalResultPtr{.q = &entry.q.emplace_back()});
       } else if (result == GameResult::DRAW) {
-        q_.push_back(0);
+        entry.q.push_back(0);
       } else {
         // A legal move to a non-drawn terminal without tablebases must be a
         // win.
-        q_.push_back(1);
+        entry.q.push_back(1);
       }
       history.Pop();
     }
   }
   void Run() override { comp_->ComputeBlocking(); }
   void MakeBestMove(classic::NodeTree* tree) override {
-    size_t best_idx = std::max_element(q_.begin(), q_.end()) - q_.begin();
-    tree->MakeMove(moves_[best_idx]);
+    const auto& entry = entries_[next_entry_++];
+    size_t best_idx =
+        std::max_element(entry.q.begin(), entry.q.end()) - entry.q.begin();
+    tree->MakeMove(entry.moves[best_idx]);
   }
 
+  struct Entry {
+    std::vector<Move> moves;
+    std::vector<float> q;
+  };
   std::unique_ptr<BackendComputation> comp_;
-  std::vector<Move> moves_;
-  std::vector<float> q_;
+  // Deque, as the computation keeps pointers into the entries.
+  std::deque<Entry> entries_;
+  size_t next_entry_ = 0;
 };
 
 MultiSelfPlayGames::MultiSelfPlayGames(PlayerOptions player1,
@@ -107,9 +156,11 @@ MultiSelfPlayGames::MultiSelfPlayGames(PlayerOptions player1,
                                        SyzygyTablebase* syzygy_tb,
                                        bool use_value)
     : options_{player1, player2}, syzygy_tb_(syzygy_tb) {
-  eval_ = use_value
-              ? std::unique_ptr<Evaluator>(std::make_unique<ValueEvaluator>())
-              : std::unique_ptr<Evaluator>(std::make_unique<PolicyEvaluator>());
+  for (auto& eval : eval_) {
+    eval = use_value
+               ? std::unique_ptr<Evaluator>(std::make_unique<ValueEvaluator>())
+               : std::unique_ptr<Evaluator>(std::make_unique<PolicyEvaluator>());
+  }
   trees_.reserve(openings.size());
   for (auto opening : openings) {
     trees_.push_back(std::make_shared<classic::NodeTree>());
@@ -127,76 +178,79 @@ void MultiSelfPlayGames::Abort() {
   abort_ = true;
 }
 
+void MultiSelfPlayGames::UpdateResult(size_t idx) {
+  const auto& tree = trees_[idx];
+  const auto& history = tree->GetPositionHistory();
+  const GameResult result = history.ComputeGameResult();
+  if (result != GameResult::UNDECIDED) {
+    results_[idx] = result;
+    return;
+  }
+  if (syzygy_tb_ != nullptr) {
+    const auto& board = history.Last().GetBoard();
+    if (board.castlings().no_legal_castle() &&
+        (board.ours() | board.theirs()).count() <=
+            syzygy_tb_->max_cardinality()) {
+      auto tb_side_black = (tree->GetPlyCount() % 2) == 1;
+      ProbeState state;
+      const WDLScore wdl = syzygy_tb_->probe_wdl(history.Last(), &state);
+      // Only fail state means the WDL is wrong, probe_wdl may produce
+      // correct result with a stat other than OK.
+      if (state != FAIL) {
+        if (wdl == WDL_WIN) {
+          results_[idx] =
+              tb_side_black ? GameResult::BLACK_WON : GameResult::WHITE_WON;
+        } else if (wdl == WDL_LOSS) {
+          results_[idx] =
+              tb_side_black ? GameResult::WHITE_WON : GameResult::BLACK_WON;
+        } else {  // Cursed wins and blessed losses count as draws.
+          results_[idx] = GameResult::DRAW;
+        }
+        return;
+      }
+    }
+  }
+  tree->GetCurrentHead()->CreateEdges(
+      history.Last().GetBoard().GenerateLegalMoves());
+}
+
 void MultiSelfPlayGames::Play() {
+  // When both players use the same backend, positions of both colours go into
+  // one batch.
+  const bool shared_backend = options_[0].backend == options_[1].backend;
+  auto eval_idx = [&](const classic::NodeTree& tree) {
+    return shared_backend ? 0 : static_cast<int>(tree.GetPlyCount() % 2);
+  };
   while (true) {
     {
       std::lock_guard<std::mutex> lock(mutex_);
       if (abort_) break;
     }
+    // Game results, tablebase probes and move generation are independent per
+    // tree.
+    ParallelFor(trees_.size(), [&](size_t i) {
+      if (results_[i] == GameResult::UNDECIDED) UpdateResult(i);
+    });
+    const int num_evals = shared_backend ? 1 : 2;
+    for (int idx = 0; idx < num_evals; ++idx) eval_[idx]->Reset(options_[idx]);
     bool all_done = true;
-    bool blacks_move = false;
     for (size_t i = 0; i < trees_.size(); i++) {
-      const auto& tree = trees_[i];
-      if (results_[i] == GameResult::UNDECIDED) {
-        if (tree->GetPositionHistory().ComputeGameResult() !=
-            GameResult::UNDECIDED) {
-          results_[i] = tree->GetPositionHistory().ComputeGameResult();
-          continue;
-        }
-        if (syzygy_tb_ != nullptr) {
-          auto board = tree->GetPositionHistory().Last().GetBoard();
-          if (board.castlings().no_legal_castle() &&
-              (board.ours() | board.theirs()).count() <=
-                  syzygy_tb_->max_cardinality()) {
-            auto tb_side_black = (tree->GetPlyCount() % 2) == 1;
-            ProbeState state;
-            const WDLScore wdl = syzygy_tb_->probe_wdl(
-                tree->GetPositionHistory().Last(), &state);
-            // Only fail state means the WDL is wrong, probe_wdl may produce
-            // correct result with a stat other than OK.
-            if (state != FAIL) {
-              if (wdl == WDL_WIN) {
-                results_[i] = tb_side_black ? GameResult::BLACK_WON
-                                            : GameResult::WHITE_WON;
-              } else if (wdl == WDL_LOSS) {
-                results_[i] = tb_side_black ? GameResult::WHITE_WON
-                                            : GameResult::BLACK_WON;
-              } else {  // Cursed wins and blessed losses count as draws.
-                results_[i] = GameResult::DRAW;
-              }
-              continue;
-            }
-          }
-        }
-        if (all_done) {
-          all_done = false;
-          blacks_move = (tree->GetPlyCount() % 2) == 1;
-          // Don't break as we need to update result state for everything.
-        }
-      }
+      if (results_[i] != GameResult::UNDECIDED) continue;
+      eval_[eval_idx(*trees_[i])]->Gather(trees_[i].get());
+      all_done = false;
     }
     if (all_done) break;
-    const int idx = blacks_move ? 1 : 0;
-    eval_->Reset(options_[idx]);
-    for (size_t i = 0; i < trees_.size(); i++) {
-      const auto& tree = trees_[i];
-      if (results_[i] != GameResult::UNDECIDED) {
-        continue;
-      }
-      if (((tree->GetPlyCount() % 2) == 1) != blacks_move) continue;
-      const auto& board = tree->GetPositionHistory().Last().GetBoard();
-      auto legal_moves = board.GenerateLegalMoves();
-      tree->GetCurrentHead()->CreateEdges(legal_moves);
-      eval_->Gather(tree.get());
+    if (shared_backend) {
+      eval_[0]->Run();
+    } else {
+      // Different backends, compute both colours concurrently.
+      std::thread black_thread([&]() { eval_[1]->Run(); });
+      eval_[0]->Run();
+      black_thread.join();
     }
-    eval_->Run();
     for (size_t i = 0; i < trees_.size(); i++) {
-      const auto& tree = trees_[i];
-      if (results_[i] != GameResult::UNDECIDED) {
-        continue;
-      }
-      if (((tree->GetPlyCount() % 2) == 1) != blacks_move) continue;
-      eval_->MakeBestMove(tree.get());
+      if (results_[i] != GameResult::UNDECIDED) continue;
+      eval_[eval_idx(*trees_[i])]->MakeBestMove(trees_[i].get());
     }
   }
 }
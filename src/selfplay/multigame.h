@@ -40,7 +40,7 @@ class Evaluator {
   virtual void Gather(classic::NodeTree* tree) = 0;
   // Run once between Gather and Move.
   virtual void Run() = 0;
-  // Run for each tree in the same order as Gather.
+  // Run for each gathered tree in the same order as Gather.
   virtual void MakeBestMove(classic::NodeTree* tree) = 0;
 };
 
@@ -73,6 +73,10 @@ class MultiSelfPlayGames {
   }
 
  private:
+  // Sets the result of a finished game, or creates the edges of the current
+  // head to continue it.
+  void UpdateResult(size_t idx);
+
   // options_[0] is for white player, [1] for black.
   PlayerOptions options_[2];
   // Node tree for player1 and player2. If the tree is shared between players,
@@ -82,7 +86,9 @@ class MultiSelfPlayGames {
   bool abort_ = false;
   std::mutex mutex_;
   SyzygyTablebase* syzygy_tb_;
-  std::unique_ptr<Evaluator> eval_;
+  // Evaluators for the white and black player. Only eval_[0] is used when
+  // both players share the backend.
+  std::unique_ptr<Evaluator> eval_[2];
 };
 
 }  // namespace lczero
@@ -0,0 +1,326 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "selfplay/opening_book.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <string_view>
+#include <unordered_map>
+
+#include "chess/board.h"
+#include "utils/exception.h"
+#include "utils/logging.h"
+#include "utils/random.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+namespace lczero {
+namespace {
+
+// The index file is, in native byte order:
+//   IndexHeader
+//   IndexEntry[num_openings]
+//   uint64_t fen_offsets[num_fens + 1], into the fen characters
+//   uint16_t moves[num_moves], Move::raw_data() as stored in Opening
+//   char fens[fen_bytes]
+// All sections stay aligned to their element size.
+constexpr uint64_t kMagic = 0x736b6f6f42304c4cULL;  // "LL0Books".
+constexpr uint32_t kVersion = 1;
+
+struct IndexHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t num_openings;
+  uint64_t num_fens;
+  uint64_t num_moves;
+  uint64_t fen_bytes;
+};
+
+struct IndexEntry {
+  uint64_t first_move;
+  uint32_t fen;
+  uint32_t num_moves;
+};
+
+// Replays the opening the way SelfPlayGame does, returns false if any move
+// is not legal.
+bool IsPlayable(const Opening& opening) {
+  ChessBoard board;
+  try {
+    board.SetFromFen(opening.start_fen);
+  } catch (const Exception&) {
+    return false;
+  }
+  for (Move move : opening.moves) {
+    if (board.flipped()) move.Flip();
+    const auto legal = board.GenerateLegalMoves();
+    if (std::find(legal.begin(), legal.end(), move) == legal.end()) {
+      return false;
+    }
+    board.ApplyMove(move);
+    board.Mirror();
+  }
+  return true;
+}
+
+}  // namespace
+
+// Read-only mapping of an opening index file.
+class MappedOpeningIndex {
+ public:
+  explicit MappedOpeningIndex(const std::string& filename) {
+#ifndef _WIN32
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd == -1) throw Exception("Cannot open opening index " + filename);
+    struct stat statbuf;
+    fstat(fd, &statbuf);
+    size_ = statbuf.st_size;
+    base_ = size_ == 0 ? MAP_FAILED
+                       : mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+#if defined(MADV_RANDOM)
+    if (base_ != MAP_FAILED) madvise(base_, size_, MADV_RANDOM);
+#endif
+    ::close(fd);
+    if (base_ == MAP_FAILED) {
+      base_ = nullptr;
+      throw Exception("Could not mmap() " + filename);
+    }
+#else
+    const HANDLE fd =
+        CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (fd == INVALID_HANDLE_VALUE) {
+      throw Exception("Cannot open opening index " + filename);
+    }
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(fd, &file_size);
+    size_ = file_size.QuadPart;
+    mapping_ = CreateFileMapping(fd, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(fd);
+    if (!mapping_) throw Exception("CreateFileMapping() failed");
+    base_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+    if (!base_) {
+      CloseHandle(mapping_);
+      throw Exception("MapViewOfFile() failed, name = " + filename +
+                      ", error = " + std::to_string(GetLastError()));
+    }
+#endif
+    if (!CheckLayout()) {
+      Unmap();
+      throw Exception(filename + " is not a compatible opening index");
+    }
+  }
+
+  ~MappedOpeningIndex() { Unmap(); }
+
+  size_t size() const { return header_.num_openings; }
+
+  Opening Get(size_t idx) const {
+    IndexEntry entry;
+    std::memcpy(&entry, entries_ + idx * sizeof(IndexEntry), sizeof(entry));
+    if (entry.fen >= header_.num_fens ||
+        entry.first_move + entry.num_moves > header_.num_moves) {
+      throw Exception("Corrupt opening index entry " + std::to_string(idx));
+    }
+    uint64_t fen_range[2];
+    std::memcpy(fen_range, fen_offsets_ + entry.fen * sizeof(uint64_t),
+                sizeof(fen_range));
+    Opening opening;
+    opening.start_fen.assign(fens_ + fen_range[0], fen_range[1] - fen_range[0]);
+    opening.moves.resize(entry.num_moves);
+    for (uint32_t i = 0; i < entry.num_moves; ++i) {
+      uint16_t raw;
+      std::memcpy(&raw, moves_ + (entry.first_move + i) * sizeof(uint16_t),
+                  sizeof(raw));
+      opening.moves[i] = Move::FromRaw(raw);
+    }
+    return opening;
+  }
+
+ private:
+  // Checks that the sections fit the file. The openings were validated when
+  // the index was built, and the entries are checked as they are read, so
+  // that loading doesn't touch them.
+  bool CheckLayout() {
+    if (size_ < sizeof(IndexHeader)) return false;
+    const char* base = static_cast<const char*>(base_);
+    std::memcpy(&header_, base, sizeof(header_));
+    if (header_.magic != kMagic || header_.version != kVersion) return false;
+    const uint64_t expected =
+        sizeof(IndexHeader) + header_.num_openings * sizeof(IndexEntry) +
+        (header_.num_fens + 1) * sizeof(uint64_t) +
+        header_.num_moves * sizeof(uint16_t) + header_.fen_bytes;
+    if (header_.num_fens == 0 || size_ != expected) return false;
+    entries_ = base + sizeof(IndexHeader);
+    fen_offsets_ = entries_ + header_.num_openings * sizeof(IndexEntry);
+    moves_ = fen_offsets_ + (header_.num_fens + 1) * sizeof(uint64_t);
+    fens_ = moves_ + header_.num_moves * sizeof(uint16_t);
+    uint64_t prev = 0;
+    for (uint64_t i = 0; i <= header_.num_fens; ++i) {
+      uint64_t offset;
+      std::memcpy(&offset, fen_offsets_ + i * sizeof(uint64_t), sizeof(offset));
+      if (offset < prev || offset > header_.fen_bytes) return false;
+      prev = offset;
+    }
+    return true;
+  }
+
+  void Unmap() {
+    if (!base_) return;
+#ifndef _WIN32
+    munmap(base_, size_);
+#else
+    UnmapViewOfFile(base_);
+    CloseHandle(mapping_);
+#endif
+    base_ = nullptr;
+  }
+
+  void* base_ = nullptr;
+  size_t size_ = 0;
+  IndexHeader header_{};
+  const char* entries_ = nullptr;
+  const char* fen_offsets_ = nullptr;
+  const char* moves_ = nullptr;
+  const char* fens_ = nullptr;
+#ifdef _WIN32
+  HANDLE mapping_ = nullptr;
+#endif
+};
+
+OpeningBook::OpeningBook() = default;
+OpeningBook::~OpeningBook() = default;
+
+void OpeningBook::Load(const std::string& filename) {
+  openings_.clear();
+  index_.reset();
+  stride_ = 1;
+  offset_ = 0;
+  uint64_t magic = 0;
+  {
+    std::ifstream file(filename, std::ios::binary);
+    file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+  }
+  if (magic == kMagic) {
+    index_ = std::make_unique<MappedOpeningIndex>(filename);
+    CERR << "Mapped " << index_->size() << " openings from " << filename
+         << ".";
+    return;
+  }
+  PgnReader book_reader;
+  book_reader.AddPgnFile(filename);
+  openings_ = book_reader.ReleaseGames();
+}
+
+size_t OpeningBook::size() const {
+  return index_ ? index_->size() : openings_.size();
+}
+
+Opening OpeningBook::Get(size_t idx) const {
+  const uint64_t n = size();
+  const uint64_t real_idx = ((idx % n) * stride_ + offset_) % n;
+  return index_ ? index_->Get(real_idx) : openings_[real_idx];
+}
+
+void OpeningBook::Shuffle() {
+  const uint64_t n = size();
+  if (n < 2) return;
+  const int max_val = static_cast<int>(std::min<uint64_t>(n - 1, INT_MAX));
+  do {
+    stride_ = Random::Get().GetInt(1, max_val);
+  } while (std::gcd(stride_, n) != 1);
+  offset_ = Random::Get().GetInt(0, max_val);
+}
+
+size_t WriteOpeningIndex(const std::string& pgn_filename,
+                         const std::string& index_filename) {
+  std::vector<IndexEntry> entries;
+  std::vector<uint16_t> moves;
+  std::vector<uint64_t> fen_offsets = {0};
+  std::string fens;
+  std::unordered_map<std::string, uint32_t> fen_ids;
+  size_t dropped = 0;
+
+  PgnStream stream(pgn_filename);
+  while (auto opening = stream.Next()) {
+    if (!IsPlayable(*opening)) {
+      ++dropped;
+      continue;
+    }
+    auto [iter, inserted] = fen_ids.emplace(opening->start_fen, 0);
+    if (inserted) {
+      iter->second = fen_offsets.size() - 1;
+      fens += opening->start_fen;
+      fen_offsets.push_back(fens.size());
+    }
+    entries.push_back({moves.size(), iter->second,
+                       static_cast<uint32_t>(opening->moves.size())});
+    for (Move move : opening->moves) moves.push_back(move.raw_data());
+  }
+  if (fen_offsets.size() == 1) {
+    fens = ChessBoard::kStartposFen;
+    fen_offsets.push_back(fens.size());
+  }
+
+  IndexHeader header{};
+  header.magic = kMagic;
+  header.version = kVersion;
+  header.num_openings = entries.size();
+  header.num_fens = fen_offsets.size() - 1;
+  header.num_moves = moves.size();
+  header.fen_bytes = fens.size();
+  std::ofstream out(index_filename, std::ios::binary);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char*>(entries.data()),
+            entries.size() * sizeof(IndexEntry));
+  out.write(reinterpret_cast<const char*>(fen_offsets.data()),
+            fen_offsets.size() * sizeof(uint64_t));
+  out.write(reinterpret_cast<const char*>(moves.data()),
+            moves.size() * sizeof(uint16_t));
+  out.write(fens.data(), fens.size());
+  out.close();
+  if (!out) throw Exception("Cannot write opening index " + index_filename);
+  if (dropped > 0) {
+    CERR << "Dropped " << dropped << " openings with illegal moves.";
+  }
+  return entries.size();
+}
+
+}  // namespace lczero
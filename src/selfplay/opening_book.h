@@ -0,0 +1,75 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "chess/pgn.h"
+
+namespace lczero {
+
+class MappedOpeningIndex;
+
+// Openings for a tournament, either read from a PGN file into memory, or
+// mapped from an opening index built by WriteOpeningIndex(). The index keeps
+// a deduplicated table of start positions and the move lists of all openings,
+// so that million-game books load instantly and are only paged in as games
+// read them.
+class OpeningBook {
+ public:
+  OpeningBook();
+  ~OpeningBook();
+
+  // Loads @filename, detecting an opening index by its header, and reading it
+  // as PGN otherwise.
+  void Load(const std::string& filename);
+
+  size_t size() const;
+  bool empty() const { return size() == 0; }
+  // Returns the @idx-th opening, in the shuffled order after Shuffle().
+  Opening Get(size_t idx) const;
+  // Switches Get() to a random order of the openings. Nothing is moved in
+  // memory, the order is a random affine permutation of the indices.
+  void Shuffle();
+
+ private:
+  std::vector<Opening> openings_;
+  std::unique_ptr<MappedOpeningIndex> index_;
+  uint64_t stride_ = 1;
+  uint64_t offset_ = 0;
+};
+
+// Converts a PGN file to an opening index. Openings with moves that are not
+// legal when replayed are dropped. Returns the number of openings written.
+size_t WriteOpeningIndex(const std::string& pgn_filename,
+                         const std::string& index_filename);
+
+}  // namespace lczero
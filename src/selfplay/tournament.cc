@@ -31,17 +31,27 @@
 
 #include "chess/pgn.h"
 #include "neural/factory.h"
+#include "neural/inference_server.h"
 #include "neural/memcache.h"
 #include "neural/shared_params.h"
 #include "search/classic/search.h"
 #include "search/classic/stoppers/factory.h"
+#include "selfplay/coordinator.h"
 #include "selfplay/game.h"
 #include "selfplay/multigame.h"
+#include "selfplay/opening_book.h"
+#include "trainingdata/async_writer.h"
+#include "utils/metrics.h"
 #include "utils/optionsparser.h"
 #include "utils/random.h"
 
 namespace lczero {
 namespace {
+MetricCounter* const kGamesMetric =
+    Metrics::Get().AddCounter("selfplay_games", "Finished selfplay games.");
+MetricCounter* const kPositionsMetric = Metrics::Get().AddCounter(
+    "selfplay_positions", "Training positions submitted for writing.");
+
 const OptionId kShareTreesId{"share-trees", "ShareTrees",
                              "When on, game tree is shared for two players; "
                              "when off, each side has a separate tree."};
@@ -60,10 +70,31 @@ const OptionId kVisitsId{"visits", "Visits",
                          "Number of visits per move to search."};
 const OptionId kTimeMsId{"movetime", "MoveTime",
                          "Time per move, in milliseconds."};
+const OptionId kTargetKldId{
+    "target-kld", "TargetKLD",
+    "Stop the search of a move once the KL divergence between the root visit "
+    "distributions at two checkpoints is below that. 0 disables it."};
+const OptionId kTargetKldMinVisitsId{
+    "target-kld-min-visits", "TargetKLDMinVisits",
+    "Visits of the first checkpoint for --target-kld."};
+const OptionId kTargetKldCheckpointFactorId{
+    "target-kld-checkpoint-factor", "TargetKLDCheckpointFactor",
+    "Each --target-kld checkpoint is at that many times the visits of the "
+    "previous one."};
 const OptionId kTrainingId{
     "training", "Training",
     "Enables writing training data. The training data is stored into a "
     "temporary subdirectory that the engine creates."};
+const OptionId kTrainingGamesPerFileId{
+    "training-games-per-file", "TrainingGamesPerFile",
+    "Number of games stored in one training data file. With 1, every game "
+    "goes into its own gzip file. Larger values write block containers, and "
+    "only the last game in a container reports its filename."};
+const OptionId kTrainingPackingId{
+    "training-packing", "TrainingPacking",
+    "How records are stored in training data containers: none (V6 records), "
+    "sparse (only legal move probabilities, lossless) or sparse-fp16 (the "
+    "same with fp16 probabilities). Ignored with one game per file."};
 const OptionId kVerboseThinkingId{"verbose-thinking", "VerboseThinking",
                                   "Show verbose thinking messages."};
 const OptionId kPolicyModeSizeId{"policy-mode-size", "PolicyModeSize",
@@ -86,7 +117,8 @@ const OptionId kDiscardedStartChanceId{
     "discarded due to not getting enough visits."};
 const OptionId kOpeningsFileId{
     "openings-pgn", "OpeningsPgnFile",
-    "A path name to a pgn file containing openings to use."};
+    "A path name to a pgn file containing openings to use, or to an opening "
+    "index built from one with the buildbook mode."};
 const OptionId kOpeningsMirroredId{
     "mirror-openings", "MirrorOpenings",
     "If true, each opening will be played in pairs. "
@@ -98,6 +130,32 @@ const OptionId kSyzygyTablebaseId{
     "List of Syzygy tablebase directories, list entries separated by system "
     "separator (\";\" for Windows, \":\" for Linux).",
     's'};
+const OptionId kInferenceServerThreadsId{
+    "inference-server-threads", "InferenceServerThreads",
+    "Number of threads evaluating batches gathered across all concurrent "
+    "games. With 0, every search computes its own batches."};
+const OptionId kInferenceServerMaxWaitId{
+    "inference-server-max-wait-us", "InferenceServerMaxWaitUs",
+    "Longest time in microseconds a partially filled batch of the inference "
+    "server waits for more positions before being computed."};
+const OptionId kOpeningCachePliesId{
+    "opening-cache-plies", "OpeningCachePlies",
+    "Evaluations of positions up to that game ply are kept in a separate "
+    "cache shared by all games, so that games starting from the same opening "
+    "reuse them. 0 disables the opening cache."};
+const OptionId kOpeningCacheSizeId{
+    "opening-cache-size", "OpeningCacheSize",
+    "Number of positions the opening cache holds."};
+const OptionId kSearchThreadBudgetId{
+    "search-thread-budget", "SearchThreadBudget",
+    "Total number of search threads shared by all parallel games. Each search "
+    "takes an equal share of them, and games that finish early leave their "
+    "threads to the rest. 0 gives every search the fixed number of --threads."};
+const OptionId kCoordinatorId{
+    "coordinator", "Coordinator",
+    "<host>:<port> of a selfplay coordinator (lc0 selfplaycoordinator). Games "
+    "are then taken from it and their training data is sent there instead of "
+    "being written locally, --games is up to the coordinator."};
 
 }  // namespace
 
@@ -122,7 +180,13 @@ void SelfPlayTournament::PopulateOptions(OptionsParser* options) {
   options->Add<IntOption>(kPlayoutsId, -1, 999999999) = -1;
   options->Add<IntOption>(kVisitsId, -1, 999999999) = -1;
   options->Add<IntOption>(kTimeMsId, -1, 999999999) = -1;
+  options->Add<FloatOption>(kTargetKldId, 0.0f, 1.0f) = 0.0f;
+  options->Add<IntOption>(kTargetKldMinVisitsId, 1, 999999999) = 100;
+  options->Add<FloatOption>(kTargetKldCheckpointFactorId, 1.05f, 10.0f) = 1.5f;
   options->Add<BoolOption>(kTrainingId) = false;
+  options->Add<IntOption>(kTrainingGamesPerFileId, 1, 100000) = 1;
+  std::vector<std::string> packings = {"none", "sparse", "sparse-fp16"};
+  options->Add<ChoiceOption>(kTrainingPackingId, packings) = "none";
   options->Add<BoolOption>(kVerboseThinkingId) = false;
   options->Add<IntOption>(kPolicyModeSizeId, 0, 1024) = 0;
   options->Add<IntOption>(kValueModeSizeId, 0, 64) = 0;
@@ -137,6 +201,12 @@ void SelfPlayTournament::PopulateOptions(OptionsParser* options) {
   options->Add<ChoiceOption>(kOpeningsModeId, openings_modes) = "sequential";
 
   options->Add<StringOption>(kSyzygyTablebaseId);
+  options->Add<IntOption>(kInferenceServerThreadsId, 0, 16) = 0;
+  options->Add<IntOption>(kInferenceServerMaxWaitId, 0, 1000000) = 10000;
+  options->Add<IntOption>(kOpeningCachePliesId, 0, 999) = 0;
+  options->Add<IntOption>(kSearchThreadBudgetId, 0, 1024) = 0;
+  options->Add<IntOption>(kOpeningCacheSizeId, 0, 999999999) = 1000000;
+  options->Add<StringOption>(kCoordinatorId) = "";
   SelfPlayGame::PopulateUciParams(options);
 
   auto defaults = options->GetMutableDefaultsOptions();
@@ -146,7 +216,7 @@ void SelfPlayTournament::PopulateOptions(OptionsParser* options) {
   defaults->Set<float>(SharedBackendParams::kPolicySoftmaxTemp, 1.0f);
   defaults->Set<int>(classic::SearchParams::kMaxCollisionVisitsId, 1);
   defaults->Set<int>(classic::SearchParams::kMaxCollisionEventsId, 1);
-  defaults->Set<int>(classic::SearchParams::kCacheHistoryLengthId, 7);
+  defaults->Set<int>(SharedBackendParams::kCacheHistoryLengthId, 7);
   defaults->Set<bool>(classic::SearchParams::kOutOfOrderEvalId, false);
   defaults->Set<float>(classic::SearchParams::kTemperatureId, 1.0f);
   defaults->Set<float>(classic::SearchParams::kNoiseEpsilonId, 0.25f);
@@ -182,12 +252,25 @@ SelfPlayTournament::SelfPlayTournament(const OptionsDict& options,
   multi_games_size_ = std::max(kPolicyGamesSize, kValueGamesSize);
   std::string book = options.Get<std::string>(kOpeningsFileId);
   if (!book.empty()) {
-    PgnReader book_reader;
-    book_reader.AddPgnFile(book);
-    openings_ = book_reader.ReleaseGames();
+    openings_.Load(book);
     if (options.Get<std::string>(kOpeningsModeId) == "shuffled") {
-      Random::Get().Shuffle(openings_.begin(), openings_.end());
+      openings_.Shuffle();
+    }
+  }
+  if (const std::string coordinator = options.Get<std::string>(kCoordinatorId);
+      !coordinator.empty()) {
+    if (multi_games_size_ > 0) {
+      throw Exception("Policy/Value games can't be played for a coordinator.");
     }
+    coordinator_ =
+        std::make_unique<SelfPlayCoordinatorClient>(coordinator, kParallelism);
+  } else if (kTraining) {
+    const std::string packing = options.Get<std::string>(kTrainingPackingId);
+    training_writer_ = std::make_unique<AsyncTrainingDataWriter>(
+        options.Get<int>(kTrainingGamesPerFileId), 2 * kParallelism,
+        packing == "sparse"        ? RecordPacking::kSparse
+        : packing == "sparse-fp16" ? RecordPacking::kSparseHalf
+                                   : RecordPacking::kNone);
   }
   if (kPolicyGamesSize > 0 && kValueGamesSize > 0) {
     throw Exception("Can't do both policy and value games at the same time.");
@@ -212,16 +295,28 @@ SelfPlayTournament::SelfPlayTournament(const OptionsDict& options,
   }
 
   // Initializing networks.
+  const int server_threads = options.Get<int>(kInferenceServerThreadsId);
+  const std::chrono::microseconds server_max_wait(
+      options.Get<int>(kInferenceServerMaxWaitId));
+  const int opening_cache_plies = options.Get<int>(kOpeningCachePliesId);
+  const int opening_cache_size = options.Get<int>(kOpeningCacheSizeId);
   for (const auto& name : {"player1", "player2"}) {
     for (const auto& color : {"white", "black"}) {
       const auto& opts = options.GetSubdict(name).GetSubdict(color);
       const auto config = NetworkFactory::BackendConfiguration(opts);
       if (!backends_.contains(config)) {
-        backends_.emplace(
-            config,
-            CreateMemCache(BackendManager::Get()->CreateFromParams(opts),
-                           options.GetSubdict(name).Get<int>(
-                               SharedBackendParams::kNNCacheSizeId)));
+        auto backend = BackendManager::Get()->CreateFromParams(opts);
+        if (server_threads > 0) {
+          backend = CreateInferenceServer(std::move(backend), server_threads,
+                                          server_max_wait);
+        }
+        if (opening_cache_plies > 0) {
+          backend = CreateOpeningCache(std::move(backend),
+                                       options.GetSubdict(name),
+                                       opening_cache_size, opening_cache_plies);
+        }
+        backends_.emplace(config, CreateMemCache(std::move(backend),
+                                                 options.GetSubdict(name)));
       }
     }
   }
@@ -237,6 +332,10 @@ SelfPlayTournament::SelfPlayTournament(const OptionsDict& options,
       limits.playouts = dict.Get<int>(kPlayoutsId);
       limits.visits = dict.Get<int>(kVisitsId);
       limits.movetime = dict.Get<int>(kTimeMsId);
+      limits.target_kld = dict.Get<float>(kTargetKldId);
+      limits.target_kld_min_visits = dict.Get<int>(kTargetKldMinVisitsId);
+      limits.target_kld_checkpoint_factor =
+          dict.Get<float>(kTargetKldCheckpointFactorId);
 
       if (multi_games_size_ == 0 && limits.playouts == -1 &&
           limits.visits == -1 && limits.movetime == -1) {
@@ -253,6 +352,10 @@ SelfPlayTournament::SelfPlayTournament(const OptionsDict& options,
     }
   }
 
+  if (const int threads = options.Get<int>(kSearchThreadBudgetId)) {
+    thread_budget_ = std::make_unique<SearchThreadBudget>(threads);
+  }
+
   // Take syzygy tablebases from options.
   std::string tb_paths = options.Get<std::string>(kSyzygyTablebaseId);
   if (!tb_paths.empty()) {
@@ -273,12 +376,12 @@ void SelfPlayTournament::PlayOneGame(int game_number) {
     player1_black = ((game_number % 2) == 1) != first_game_black_;
     if (!openings_.empty()) {
       if (player_options_[0][0].Get<bool>(kOpeningsMirroredId)) {
-        opening = openings_[(game_number / 2) % openings_.size()];
+        opening = openings_.Get((game_number / 2) % openings_.size());
       } else if (player_options_[0][0].Get<std::string>(kOpeningsModeId) ==
                  "random") {
-        opening = openings_[Random::Get().GetInt(0, openings_.size() - 1)];
+        opening = openings_.Get(Random::Get().GetInt(0, openings_.size() - 1));
       } else {
-        opening = openings_[game_number % openings_.size()];
+        opening = openings_.Get(game_number % openings_.size());
       }
     }
     if (discard_pile_.size() > 0 &&
@@ -385,8 +488,10 @@ void SelfPlayTournament::PlayOneGame(int game_number) {
   // PLAY GAME!
   auto player1_threads = player_options_[0][color_idx[0]].Get<int>(kThreadsId);
   auto player2_threads = player_options_[1][color_idx[1]].Get<int>(kThreadsId);
+  if (thread_budget_) thread_budget_->AddGame();
   game.Play(player1_threads, player2_threads, kTraining, syzygy_tb,
-            enable_resign);
+            enable_resign, thread_budget_.get());
+  if (thread_budget_) thread_budget_->RemoveGame();
 
   // If game was aborted, it's still undecided.
   if (game.GetGameResult() != GameResult::UNDECIDED) {
@@ -402,14 +507,31 @@ void SelfPlayTournament::PlayOneGame(int game_number) {
       game_info.min_false_positive_threshold =
           game.GetWorstEvalForWinnerOrDraw();
     }
-    if (kTraining &&
-        game_info.play_start_ply < static_cast<int>(game_info.moves.size())) {
-      TrainingDataWriter writer(game_number);
-      game.WriteTrainingData(&writer);
-      writer.Finalize();
-      game_info.training_filename = writer.GetFileName();
+    if (coordinator_) {
+      std::vector<V6TrainingData> training_data;
+      if (kTraining &&
+          game_info.play_start_ply < static_cast<int>(game_info.moves.size())) {
+        training_data = game.GetTrainingData();
+        kPositionsMetric->Add(training_data.size());
+      }
+      coordinator_->SubmitGame(game_info, game.move_count_, game.nodes_total_,
+                               training_data);
+      game_callback_(game_info);
+    } else if (kTraining &&
+               game_info.play_start_ply <
+                   static_cast<int>(game_info.moves.size())) {
+      // The game is reported once its training data is written out.
+      auto training_data = game.GetTrainingData();
+      kPositionsMetric->Add(training_data.size());
+      training_writer_->Submit(
+          game_number, std::move(training_data),
+          [this, game_info](const std::string& filename) mutable {
+            game_info.training_filename = filename;
+            game_callback_(game_info);
+          });
+    } else {
+      game_callback_(game_info);
     }
-    game_callback_(game_info);
 
     // Update tournament stats.
     {
@@ -419,6 +541,7 @@ void SelfPlayTournament::PlayOneGame(int game_number) {
                                                                    : 2;
       if (player1_black) result = 2 - result;
       ++tournament_info_.results[result][player1_black ? 1 : 0];
+      kGamesMetric->Add();
       tournament_info_.move_count_ += game.move_count_;
       tournament_info_.nodes_total_ += game.nodes_total_;
       tournament_callback_(tournament_info_);
@@ -439,7 +562,7 @@ void SelfPlayTournament::PlayMultiGames(int game_id, size_t game_count) {
   {
     Mutex::Lock lock(mutex_);
     for (size_t i = 0; i < game_count / 2; i++) {
-      openings.push_back(openings_[(opening_basis + i) % openings_.size()]);
+      openings.push_back(openings_.Get((opening_basis + i) % openings_.size()));
     }
   }
 
@@ -504,6 +627,7 @@ void SelfPlayTournament::PlayMultiGames(int game_id, size_t game_count) {
                      : game1_res == GameResult::WHITE_WON ? 0
                                                           : 2;
         ++tournament_info_.results[result][0];
+        kGamesMetric->Add();
         tournament_callback_(tournament_info_);
       }
     }
@@ -526,6 +650,7 @@ void SelfPlayTournament::PlayMultiGames(int game_id, size_t game_count) {
                      : game2_res == GameResult::WHITE_WON ? 2
                                                           : 0;
         ++tournament_info_.results[result][1];
+        kGamesMetric->Add();
         tournament_callback_(tournament_info_);
       }
     }
@@ -540,6 +665,16 @@ void SelfPlayTournament::PlayMultiGames(int game_id, size_t game_count) {
 void SelfPlayTournament::Worker() {
   // Play games while game limit is not reached (or while not aborted).
   while (true) {
+    if (coordinator_) {
+      {
+        Mutex::Lock lock(mutex_);
+        if (abort_) break;
+      }
+      const std::optional<int> game_id = coordinator_->NextGame();
+      if (!game_id) break;
+      PlayOneGame(*game_id);
+      continue;
+    }
     int game_id;
     int count = 0;
     {
@@ -597,6 +732,7 @@ void SelfPlayTournament::RunBlocking() {
   if (kParallelism == 1) {
     // No need for multiple threads if there is one worker.
     Worker();
+    if (training_writer_) training_writer_->Close();
     Mutex::Lock lock(mutex_);
     if (!abort_) {
       SaveResults();
@@ -617,6 +753,7 @@ void SelfPlayTournament::Wait() {
       threads_.pop_back();
     }
   }
+  if (training_writer_) training_writer_->Close();
   {
     Mutex::Lock lock(mutex_);
     if (!abort_) {
@@ -630,6 +767,7 @@ void SelfPlayTournament::Wait() {
 void SelfPlayTournament::Abort() {
   Mutex::Lock lock(mutex_);
   abort_ = true;
+  if (coordinator_) coordinator_->Close();
   for (auto& game : games_)
     if (game) game->Abort();
   for (auto& game : multigames_)
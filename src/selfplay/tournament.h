@@ -32,8 +32,11 @@
 #include "chess/pgn.h"
 #include "neural/backend.h"
 #include "neural/factory.h"
+#include "selfplay/coordinator.h"
 #include "selfplay/game.h"
 #include "selfplay/multigame.h"
+#include "selfplay/opening_book.h"
+#include "trainingdata/async_writer.h"
 #include "utils/mutex.h"
 #include "utils/optionsdict.h"
 #include "utils/optionsparser.h"
@@ -82,7 +85,7 @@ class SelfPlayTournament {
   // Number of games which already started.
   int games_count_ GUARDED_BY(mutex_) = 0;
   bool abort_ GUARDED_BY(mutex_) = false;
-  std::vector<Opening> openings_ GUARDED_BY(mutex_);
+  OpeningBook openings_ GUARDED_BY(mutex_);
   // Games in progress. Exposed here to be able to abort them in case if
   // Abort(). Stored as list and not vector so that threads can keep iterators
   // to them and not worry that it becomes invalid.
@@ -91,6 +94,14 @@ class SelfPlayTournament {
   // Place to store tournament stats.
   TournamentInfo tournament_info_ GUARDED_BY(mutex_);
 
+  // Search threads shared by the games, if limited tournament-wide.
+  std::unique_ptr<SearchThreadBudget> thread_budget_;
+
+  // Writes training data of finished games in the background.
+  std::unique_ptr<AsyncTrainingDataWriter> training_writer_;
+  // Hands out the games and takes their training data instead, if set.
+  std::unique_ptr<SelfPlayCoordinatorClient> coordinator_;
+
   Mutex threads_mutex_;
   std::vector<std::thread> threads_ GUARDED_BY(threads_mutex_);
 
@@ -0,0 +1,77 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "syzygy/probe_service.h"
+
+namespace lczero {
+
+SyzygyProbeService::SyzygyProbeService(SyzygyTablebase* tablebase,
+                                       int threads)
+    : tablebase_(tablebase) {
+  for (int i = 0; i < threads; i++) {
+    threads_.emplace_back([this]() { Worker(); });
+  }
+}
+
+SyzygyProbeService::~SyzygyProbeService() {
+  {
+    Mutex::Lock lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto& thread : threads_) thread.join();
+}
+
+std::future<SyzygyProbeService::Result> SyzygyProbeService::ProbeWdl(
+    const Position& pos) {
+  std::future<Result> result;
+  {
+    Mutex::Lock lock(mutex_);
+    queue_.push_back({pos, {}});
+    result = queue_.back().result.get_future();
+  }
+  cv_.notify_one();
+  return result;
+}
+
+void SyzygyProbeService::Worker() {
+  while (true) {
+    Request request;
+    {
+      Mutex::Lock lock(mutex_);
+      while (!stop_ && queue_.empty()) cv_.wait(lock.get_raw());
+      if (stop_) return;
+      request = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    Result result;
+    result.wdl = tablebase_->probe_wdl(request.pos, &result.state);
+    request.result.set_value(result);
+  }
+}
+
+}  // namespace lczero
@@ -0,0 +1,74 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "chess/position.h"
+#include "syzygy/syzygy.h"
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// Runs WDL probes on a small pool of threads, so that the threads asking for
+// them can go on with other work while the tables are read from disk.
+class SyzygyProbeService {
+ public:
+  struct Result {
+    WDLScore wdl;
+    ProbeState state;
+  };
+
+  SyzygyProbeService(SyzygyTablebase* tablebase, int threads);
+  // Waits for the probes in progress, queued ones are abandoned.
+  ~SyzygyProbeService();
+
+  // Queues a SyzygyTablebase::probe_wdl() of the position.
+  std::future<Result> ProbeWdl(const Position& pos);
+
+ private:
+  struct Request {
+    Position pos;
+    std::promise<Result> result;
+  };
+
+  void Worker();
+
+  SyzygyTablebase* const tablebase_;
+  Mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Request> queue_ GUARDED_BY(mutex_);
+  bool stop_ GUARDED_BY(mutex_) = false;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace lczero
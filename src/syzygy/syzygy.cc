@@ -51,6 +51,7 @@
 #ifndef _WIN32
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #else
@@ -133,6 +134,9 @@ struct BaseEntry {
   uint8_t* data[3];
   map_t mapping[3];
   std::atomic<bool> ready[3];
+  // Serializes the lazy initialization of the entry's tables, so that tables
+  // of different entries are initialized in parallel.
+  Mutex ready_mutex;
   uint8_t num;
   bool symmetric;
   bool hasPawns;
@@ -780,9 +784,9 @@ PairsData* setup_pairs(uint8_t** ptr, size_t tb_size, size_t* size,
   return d;
 }
 
-uint8_t* decompress_pairs(PairsData* d, size_t idx) {
-  if (!d->idxBits) return d->constValue;
-
+// Finds the compressed block holding @idx and the index of the value within
+// the block.
+uint32_t find_block(PairsData* d, size_t idx, int* lit_idx_out) {
   const uint32_t main_idx = idx >> d->idxBits;
   int lit_idx = (idx & ((static_cast<size_t>(1) << d->idxBits) - 1)) -
                 (static_cast<size_t>(1) << (d->idxBits - 1));
@@ -799,6 +803,15 @@ uint8_t* decompress_pairs(PairsData* d, size_t idx) {
   } else {
     while (lit_idx > d->sizeTable[block]) lit_idx -= d->sizeTable[block++] + 1;
   }
+  *lit_idx_out = lit_idx;
+  return block;
+}
+
+uint8_t* decompress_pairs(PairsData* d, size_t idx) {
+  if (!d->idxBits) return d->constValue;
+
+  int lit_idx;
+  const uint32_t block = find_block(d, idx, &lit_idx);
 
   uint32_t* ptr = reinterpret_cast<uint32_t*>(
       d->data + (static_cast<size_t>(block) << d->blockSize));
@@ -844,6 +857,41 @@ uint8_t* decompress_pairs(PairsData* d, size_t idx) {
   return &symPat[3 * sym];
 }
 
+// Asks the OS to start reading the block decompress_pairs() will need for
+// @idx, without waiting for it.
+void prefetch_pairs(PairsData* d, size_t idx) {
+  if (!d->idxBits) return;
+
+  int lit_idx;
+  const uint32_t block = find_block(d, idx, &lit_idx);
+
+#ifndef _WIN32
+  static const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  const uintptr_t begin =
+      reinterpret_cast<uintptr_t>(d->data + (static_cast<size_t>(block)
+                                             << d->blockSize));
+  const uintptr_t page = begin & ~(page_size - 1);
+  madvise(reinterpret_cast<void*>(page),
+          begin - page + (static_cast<size_t>(1) << d->blockSize),
+          MADV_WILLNEED);
+#elif _WIN32_WINNT >= 0x0602
+  WIN32_MEMORY_RANGE_ENTRY range{
+      d->data + (static_cast<size_t>(block) << d->blockSize),
+      static_cast<size_t>(1) << d->blockSize};
+  PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+}
+
+// Number of major page faults of the calling thread so far, 0 where not
+// available.
+uint64_t thread_major_faults() {
+#ifdef RUSAGE_THREAD
+  struct rusage usage;
+  if (getrusage(RUSAGE_THREAD, &usage) == 0) return usage.ru_majflt;
+#endif
+  return 0;
+}
+
 // p[i] is to contain the square 0-63 (A1-H8) for a piece of type
 // pc[i] ^ flip, where 1 = white pawn, ..., 14 = black king and pc ^ flip
 // flips between white and black if flip == true.
@@ -864,8 +912,12 @@ int fill_squares(const ChessBoard& pos, uint8_t* pc, bool flip, int mirror,
 
 class SyzygyTablebaseImpl {
  public:
-  SyzygyTablebaseImpl(const std::string& paths)
-      : piece_entries_(TB_MAX_PIECE), pawn_entries_(TB_MAX_PAWN) {
+  SyzygyTablebaseImpl(const std::string& paths, SyzygyPreload preload,
+                      int preload_pieces)
+      : preload_(preload),
+        preload_pieces_(preload_pieces),
+        piece_entries_(TB_MAX_PIECE),
+        pawn_entries_(TB_MAX_PAWN) {
     initonce_indicies();
 
     if (paths.size() == 0 || paths == "<empty>") return;
@@ -995,6 +1047,11 @@ class SyzygyTablebaseImpl {
   finished:
     CERR << "Found " << num_wdl_ << " WDL, " << num_dtm_ << " DTM and "
          << num_dtz_ << " DTZ tablebase files.";
+    if (num_preloaded_ > 0) {
+      CERR << (preload_ == SyzygyPreload::kLock ? "Locked " : "Preloading ")
+           << num_preloaded_ << " WDL tablebase files, "
+           << (preloaded_bytes_ >> 20) << " MiB.";
+    }
   }
 
   ~SyzygyTablebaseImpl() {
@@ -1010,18 +1067,44 @@ class SyzygyTablebaseImpl {
   int max_cardinality() const { return max_cardinality_; }
 
   int probe_wdl_table(const ChessBoard& pos, int* success) {
-    return probe_table(pos, 0, success, WDL);
+    return counted_probe_table(pos, 0, success, WDL);
   }
 
   int probe_dtm_table(const ChessBoard& pos, int won, int* success) {
-    return probe_table(pos, won, success, DTM);
+    return counted_probe_table(pos, won, success, DTM);
   }
 
   int probe_dtz_table(const ChessBoard& pos, int wdl, int* success) {
-    return probe_table(pos, wdl, success, DTZ);
+    return counted_probe_table(pos, wdl, success, DTZ);
+  }
+
+  void prefetch_wdl_table(const ChessBoard& pos) {
+    int success = 1;
+    probe_table<true>(pos, 0, &success, WDL);
+  }
+
+  SyzygyProbeStats probe_stats() const {
+    return {probes_.load(std::memory_order_relaxed),
+            stalled_probes_.load(std::memory_order_relaxed),
+            page_faults_.load(std::memory_order_relaxed)};
   }
 
  private:
+  // Probes the table, counting the probes that had to wait for table data to
+  // be read from disk.
+  int counted_probe_table(const ChessBoard& pos, int s, int* success,
+                          const int type) {
+    const uint64_t faults = thread_major_faults();
+    const int result = probe_table(pos, s, success, type);
+    const uint64_t new_faults = thread_major_faults() - faults;
+    probes_.fetch_add(1, std::memory_order_relaxed);
+    if (new_faults > 0) {
+      stalled_probes_.fetch_add(1, std::memory_order_relaxed);
+      page_faults_.fetch_add(new_faults, std::memory_order_relaxed);
+    }
+    return result;
+  }
+
   std::string name_for_tb(const char* str, const char* suffix) {
     std::stringstream path_string_stream(paths_);
     std::string path;
@@ -1167,6 +1250,47 @@ class SyzygyTablebaseImpl {
 
     add_to_hash(be, key);
     if (key != key2) add_to_hash(be, key2);
+
+    if (preload_ != SyzygyPreload::kNone && be->num <= preload_pieces_) {
+      preload_tb(be, str);
+    }
+  }
+
+  // Maps the WDL table of a new entry and brings it into memory.
+  void preload_tb(BaseEntry* be, const char* str) {
+    if (!init_table(be, str, WDL)) return;
+    atomic_store_explicit(&be->ready[WDL], true, std::memory_order_relaxed);
+#ifndef _WIN32
+    void* data = be->data[WDL];
+    const size_t size = be->mapping[WDL];
+    if (preload_ == SyzygyPreload::kLock && mlock(data, size) != 0) {
+      CERR << "Cannot lock tablebase files in memory, check the memlock "
+              "limit. Preloading them instead.";
+      preload_ = SyzygyPreload::kWillNeed;
+    }
+    if (preload_ == SyzygyPreload::kWillNeed) {
+      madvise(data, size, MADV_WILLNEED);
+    }
+    num_preloaded_++;
+    preloaded_bytes_ += size;
+#else
+    MEMORY_BASIC_INFORMATION info;
+    if (!VirtualQuery(be->data[WDL], &info, sizeof(info))) return;
+    WIN32_MEMORY_RANGE_ENTRY range{be->data[WDL], info.RegionSize};
+    if (preload_ == SyzygyPreload::kLock &&
+        !VirtualLock(range.VirtualAddress, range.NumberOfBytes)) {
+      CERR << "Cannot lock tablebase files in memory, preloading them "
+              "instead.";
+      preload_ = SyzygyPreload::kWillNeed;
+    }
+#if _WIN32_WINNT >= 0x0602
+    if (preload_ == SyzygyPreload::kWillNeed) {
+      PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+    }
+#endif
+    num_preloaded_++;
+    preloaded_bytes_ += info.RegionSize;
+#endif
   }
 
   void free_tb_entry(BaseEntry* be) {
@@ -1324,6 +1448,8 @@ class SyzygyTablebaseImpl {
     return true;
   }
 
+  // With Prefetch, only starts reading the data the probe needs.
+  template <bool Prefetch = false>
   int probe_table(const ChessBoard& pos, int s, int* success, const int type) {
     // Obtain the position's material-signature key
     const Key key = calc_key_from_position(pos);
@@ -1348,9 +1474,9 @@ class SyzygyTablebaseImpl {
       return 0;
     }
 
-    // Use double-checked locking to reduce locking overhead
+    // Use double-checked locking, ready tables don't take the lock at all.
     if (!atomic_load_explicit(&be->ready[type], std::memory_order_acquire)) {
-      Mutex::Lock lock(ready_mutex_);
+      Mutex::Lock lock(be->ready_mutex);
       if (!atomic_load_explicit(&be->ready[type], std::memory_order_relaxed)) {
         char str[16];
         prt_str(pos, str, be->key != key);
@@ -1415,6 +1541,10 @@ class SyzygyTablebaseImpl {
       idx = type != DTM ? encode_pawn_f(p, ei, be) : encode_pawn_r(p, ei, be);
     }
 
+    if constexpr (Prefetch) {
+      prefetch_pairs(ei->precomp, idx);
+      return 0;
+    }
     uint8_t* w = decompress_pairs(ei->precomp, idx);
 
     if (type == WDL) return static_cast<int>(w[0]) - 2;
@@ -1455,7 +1585,15 @@ class SyzygyTablebaseImpl {
   int max_cardinality_ = 0;
   int max_cardinality_dtm_ = 0;
 
-  Mutex ready_mutex_;
+  SyzygyPreload preload_;
+  const int preload_pieces_;
+  int num_preloaded_ = 0;
+  size_t preloaded_bytes_ = 0;
+
+  std::atomic<uint64_t> probes_ = 0;
+  std::atomic<uint64_t> stalled_probes_ = 0;
+  std::atomic<uint64_t> page_faults_ = 0;
+
   std::string paths_;
 
   int num_piece_entries_ = 0;
@@ -1471,11 +1609,19 @@ class SyzygyTablebaseImpl {
 
 SyzygyTablebase::SyzygyTablebase() : max_cardinality_(0) {}
 
-SyzygyTablebase::~SyzygyTablebase() = default;
+SyzygyTablebase::~SyzygyTablebase() {
+  const SyzygyProbeStats stats = probe_stats();
+  if (stats.stalled_probes > 0) {
+    CERR << "Syzygy probes: " << stats.probes << ", stalled on reading "
+         << stats.stalled_probes << " times, " << stats.page_faults
+         << " page faults.";
+  }
+}
 
-bool SyzygyTablebase::init(const std::string& paths) {
+bool SyzygyTablebase::init(const std::string& paths, SyzygyPreload preload,
+                           int preload_pieces) {
   paths_ = paths;
-  impl_.reset(new SyzygyTablebaseImpl(paths_));
+  impl_.reset(new SyzygyTablebaseImpl(paths_, preload, preload_pieces));
   max_cardinality_ = impl_->max_cardinality();
   if (max_cardinality_ <= 2) {
     impl_ = nullptr;
@@ -1559,6 +1705,14 @@ WDLScore SyzygyTablebase::probe_wdl(const Position& pos, ProbeState* result) {
   return search(pos, result);
 }
 
+void SyzygyTablebase::prefetch_wdl(const Position& pos) {
+  impl_->prefetch_wdl_table(pos.GetBoard());
+}
+
+SyzygyProbeStats SyzygyTablebase::probe_stats() const {
+  return impl_ ? impl_->probe_stats() : SyzygyProbeStats{};
+}
+
 // Probe the DTZ table for a particular position.
 // If *result != FAIL, the probe was successful.
 // The return value is from the point of view of the side to move:
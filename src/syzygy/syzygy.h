@@ -53,6 +53,21 @@ enum ProbeState {
   ZEROING_BEST_MOVE = 2  // Best move zeroes DTZ (capture or pawn move)
 };
 
+// How tables are brought into memory when the tablebases are initialized.
+enum class SyzygyPreload {
+  kNone,      // Tables are read on demand by the probes.
+  kWillNeed,  // Reading the tables is started in the background.
+  kLock,      // Tables are read and locked in memory.
+};
+
+// Counters of the table probes since init.
+struct SyzygyProbeStats {
+  uint64_t probes = 0;
+  // Probes which waited for table data to be read from disk.
+  uint64_t stalled_probes = 0;
+  uint64_t page_faults = 0;
+};
+
 class SyzygyTablebaseImpl;
 
 // Provides methods to load and probe syzygy tablebases.
@@ -70,12 +85,23 @@ class SyzygyTablebase {
   // thread safe, there must be no concurrent usage while this method is
   // running. All other thread safe method calls must be strictly ordered with
   // respect to this method.
-  bool init(const std::string& paths);
+  // WDL tables with at most preload_pieces pieces are brought into memory
+  // according to preload.
+  bool init(const std::string& paths,
+            SyzygyPreload preload = SyzygyPreload::kNone,
+            int preload_pieces = 0);
   // Probes WDL tables for the given position to determine a WDLScore.
   // Thread safe.
   // Result is only strictly valid for positions with 0 ply 50 move counter.
   // Probe state will return FAIL if the position is not in the tablebase.
   WDLScore probe_wdl(const Position& pos, ProbeState* result);
+  // Starts reading the WDL table data a later probe_wdl() of the position
+  // will need, without waiting for it. Only the position itself is covered,
+  // not the captures probe_wdl() may have to check.
+  // Thread safe.
+  void prefetch_wdl(const Position& pos);
+  // Thread safe.
+  SyzygyProbeStats probe_stats() const;
   // Probes DTZ tables for the given position to determine the number of ply
   // before a zeroing move under optimal play.
   // Thread safe.
@@ -29,6 +29,8 @@
 
 #include <gtest/gtest.h>
 
+#include "src/syzygy/probe_service.h"
+
 #include <iostream>
 
 namespace lczero {
@@ -244,6 +246,35 @@ TEST(Syzygy, Root5PieceProbes) {
                            {"a5a1"}, {}, {"a5d5"}, true);
 }
 
+TEST(Syzygy, ProbeServiceMatchesDirectProbes) {
+  SyzygyTablebase tablebase;
+  tablebase.init(kPaths);
+  if (tablebase.max_cardinality() < 3) {
+    // These probes require 3 piece tablebase.
+    return;
+  }
+  const std::vector<std::string> fens = {
+      "8/8/8/8/8/8/2Rk4/1K6 b - - 0 1", "5Qk1/8/8/8/8/8/8/4K3 b - - 0 1",
+      "6k1/8/8/8/8/5p2/8/2K5 b - - 0 1", "8/2p5/8/8/8/5k2/8/2K5 w - - 0 1"};
+  std::vector<Position> positions;
+  std::vector<std::future<SyzygyProbeService::Result>> results;
+  {
+    SyzygyProbeService service(&tablebase, 2);
+    for (const auto& fen : fens) {
+      ChessBoard board;
+      board.SetFromFen(fen);
+      positions.emplace_back(board, 0, 1);
+      results.push_back(service.ProbeWdl(positions.back()));
+    }
+    for (size_t i = 0; i < fens.size(); i++) {
+      const auto result = results[i].get();
+      ProbeState state;
+      EXPECT_EQ(result.wdl, tablebase.probe_wdl(positions[i], &state));
+      EXPECT_EQ(result.state, state);
+    }
+  }
+}
+
 }  // namespace lczero
 
 int main(int argc, char** argv) {
@@ -0,0 +1,224 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "tools/analyse.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "chess/gamestate.h"
+#include "chess/pgn.h"
+#include "neural/memcache.h"
+#include "neural/register.h"
+#include "neural/shared_params.h"
+#include "search/classic/search.h"
+#include "search/classic/stoppers/stoppers.h"
+#include "utils/exception.h"
+#include "utils/mutex.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+namespace {
+
+const OptionId kInputId{
+    "input", "",
+    "PGN file (by .pgn or .pgn.gz extension) whose positions after every move "
+    "are analysed, or a file with one FEN per line, optionally followed by "
+    "\"moves\" and moves."};
+const OptionId kNodesId{"nodes", "", "Number of nodes to search per position."};
+const OptionId kParallelId{
+    "parallel", "",
+    "Number of positions searched at the same time. Use a batching backend "
+    "such as multiplexing to merge their evaluations into larger batches."};
+const OptionId kThreadsOptionId{
+    "threads", "Threads", "Number of worker threads of every search.", 't'};
+
+std::vector<GameState> LoadPgnGames(const std::string& filename) {
+  PgnStream games(filename);
+  std::vector<GameState> positions;
+  while (const auto game = games.Next()) {
+    GameState state{Position::FromFen(game->start_fen), {}};
+    bool black_to_move = state.startpos.IsBlackToMove();
+    positions.push_back(state);
+    for (Move move : game->moves) {
+      // Game moves are from the side to move's point of view.
+      if (black_to_move) move.Flip();
+      black_to_move = !black_to_move;
+      state.moves.push_back(move);
+      positions.push_back(state);
+    }
+  }
+  return positions;
+}
+
+std::vector<GameState> LoadFenLines(const std::string& filename) {
+  std::ifstream file(filename);
+  if (!file) throw Exception("Unable to open " + filename);
+  std::vector<GameState> positions;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty() || line[0] == '#') continue;
+    const size_t moves_pos = line.find(" moves ");
+    GameState state{Position::FromFen(line.substr(0, moves_pos)), {}};
+    if (moves_pos != std::string::npos) {
+      ChessBoard board = state.startpos.GetBoard();
+      std::istringstream moves(line.substr(moves_pos + 7));
+      std::string move_str;
+      while (moves >> move_str) {
+        const Move move = board.ParseMove(move_str);
+        state.moves.push_back(move);
+        board.ApplyMove(move);
+        board.Mirror();
+      }
+    }
+    positions.push_back(state);
+  }
+  return positions;
+}
+
+std::vector<GameState> LoadPositions(const std::string& filename) {
+  auto positions = filename.ends_with(".pgn") || filename.ends_with(".pgn.gz")
+                       ? LoadPgnGames(filename)
+                       : LoadFenLines(filename);
+  // There is nothing to search after the game is over.
+  std::erase_if(positions, [](const GameState& state) {
+    return state.CurrentPosition().GetBoard().GenerateLegalMoves().empty();
+  });
+  if (positions.empty()) throw Exception("No positions in " + filename);
+  return positions;
+}
+
+// Formats the result line of a finished search.
+std::string FormatResult(size_t index, const GameState& state,
+                         const ThinkingInfo& info, const BestMoveInfo& best,
+                         int64_t time_ms) {
+  std::ostringstream os;
+  os << "position " << index << " fen " << GetFen(state.CurrentPosition())
+     << " bestmove " << best.bestmove.ToString(false);
+  if (info.mate) {
+    os << " score mate " << *info.mate;
+  } else if (info.score) {
+    os << " score cp " << *info.score;
+  }
+  if (info.wdl) {
+    os << " wdl " << info.wdl->w << " " << info.wdl->d << " " << info.wdl->l;
+  }
+  os << " nodes " << info.nodes << " time " << time_ms;
+  if (!info.pv.empty()) {
+    os << " pv";
+    for (const auto& move : info.pv) os << " " << move.ToString(false);
+  }
+  return os.str();
+}
+
+}  // namespace
+
+void Analyse::Run() {
+  OptionsParser options;
+  SharedBackendParams::Populate(&options);
+  options.GetMutableDefaultsOptions()->Set(SharedBackendParams::kNNCacheSizeId,
+                                           200000);
+  classic::SearchParams::Populate(&options);
+  options.Add<StringOption>(kInputId);
+  options.Add<IntOption>(kNodesId, 1, 999999999) = 10000;
+  options.Add<IntOption>(kParallelId, 1, 256) = 8;
+  options.Add<IntOption>(kThreadsOptionId, 1, 128) = 1;
+
+  if (!options.ProcessAllFlags()) return;
+
+  try {
+    const auto option_dict = options.GetOptionsDict();
+    const auto positions =
+        LoadPositions(option_dict.Get<std::string>(kInputId));
+    auto backend = CreateMemCache(
+        BackendManager::Get()->CreateFromParams(option_dict), option_dict);
+    const int nodes = option_dict.Get<int>(kNodesId);
+    const int threads = option_dict.Get<int>(kThreadsOptionId);
+
+    std::atomic<size_t> next_position = 0;
+    std::atomic<int64_t> total_nodes = 0;
+    Mutex output_mutex;
+    auto analyse = [&]() {
+      for (size_t i = next_position++; i < positions.size();
+           i = next_position++) {
+        classic::NodeTree tree;
+        tree.ResetToPosition(positions[i]);
+        ThinkingInfo last_info;
+        BestMoveInfo best_move(Move{});
+        const auto start = std::chrono::steady_clock::now();
+        classic::Search search(
+            tree, backend.get(),
+            std::make_unique<CallbackUciResponder>(
+                [&](const BestMoveInfo& info) { best_move = info; },
+                [&](const std::vector<ThinkingInfo>& infos) {
+                  for (const auto& info : infos) {
+                    if (info.multipv <= 1 && !info.pv.empty()) {
+                      last_info = info;
+                    }
+                  }
+                }),
+            MoveList(), start,
+            std::make_unique<classic::VisitsStopper>(nodes, false), false,
+            false, option_dict, nullptr);
+        search.RunBlocking(threads);
+        const auto time_ms =
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+        total_nodes += search.GetTotalPlayouts();
+        const std::string result =
+            FormatResult(i, positions[i], last_info, best_move, time_ms);
+        Mutex::Lock lock(output_mutex);
+        std::cout << result << std::endl;
+      }
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> searchers;
+    const int parallel = std::min<int>(option_dict.Get<int>(kParallelId),
+                                       positions.size());
+    for (int i = 0; i < parallel; ++i) searchers.emplace_back(analyse);
+    for (auto& searcher : searchers) searcher.join();
+    const auto total_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+    std::cout << "Analysed " << positions.size() << " positions in "
+              << total_ms << " ms, "
+              << std::lround(1000.0 * total_nodes / (total_ms + 1))
+              << " nodes/second." << std::endl;
+  } catch (Exception& ex) {
+    std::cerr << ex.what() << std::endl;
+  }
+}
+
+}  // namespace lczero
@@ -27,10 +27,22 @@
 
 #include "tools/backendbench.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
 #include "chess/board.h"
-#include "neural/factory.h"
+#include "neural/batchsplit.h"
+#include "neural/loader.h"
+#include "neural/memcache.h"
+#include "neural/register.h"
 #include "neural/shared_params.h"
-#include "search/classic/node.h"
+#include "tools/network_cost.h"
+#include "tools/positions.h"
+#include "utils/histogram.h"
 #include "utils/optionsparser.h"
 
 namespace lczero {
@@ -48,6 +60,18 @@ const OptionId kMaxBatchSizeId{"max-batch-size", "",
 const OptionId kBatchStepId{"batch-step", "",
                             "Step of batch size in benchmark."};
 const OptionId kFenId{"fen", "", "Benchmark initial position FEN."};
+const OptionId kPositionsFileId{
+    "positions", "",
+    "PGN or EPD (by .epd extension) file to take the benchmark positions from, "
+    "instead of repeating --fen. They are evaluated through the NN cache, as "
+    "in search."};
+const OptionId kBatchSplitId{
+    "batch-split", "",
+    "Split batches to the maximum batch size of the backend, as search does."};
+const OptionId kDeviceProfileId{
+    "device-profile", "",
+    "Append the measured throughput of the backend to this device profile "
+    "file, for describenet to predict the throughput of other networks."};
 
 const OptionId kClippyId{"clippy", "", "Enable helpful assistant."};
 
@@ -85,6 +109,9 @@ void BackendBenchmark::Run() {
   options.Add<IntOption>(kMaxBatchSizeId, 1, 1024) = 256;
   options.Add<IntOption>(kBatchStepId, 1, 256) = 1;
   options.Add<StringOption>(kFenId) = ChessBoard::kStartposFen;
+  options.Add<StringOption>(kPositionsFileId) = "";
+  options.Add<BoolOption>(kBatchSplitId) = false;
+  options.Add<StringOption>(kDeviceProfileId) = "";
   options.Add<BoolOption>(kClippyId) = false;
 
   if (!options.ProcessAllFlags()) return;
@@ -92,19 +119,62 @@ void BackendBenchmark::Run() {
   try {
     auto option_dict = options.GetOptionsDict();
 
-    auto network = NetworkFactory::LoadNetwork(option_dict);
+    std::vector<BenchPosition> positions;
+    const std::string positions_file =
+        option_dict.Get<std::string>(kPositionsFileId);
+    if (positions_file.empty()) {
+      PositionHistory history;
+      history.Reset(Position::FromFen(option_dict.Get<std::string>(kFenId)));
+      AddBenchPosition(history, &positions);
+    } else {
+      positions = LoadBenchPositions(positions_file);
+      std::cout << "Loaded " << positions.size() << " positions." << std::endl;
+    }
 
-    classic::NodeTree tree;
-    tree.ResetToPosition(option_dict.Get<std::string>(kFenId), {});
+    std::unique_ptr<Backend> backend =
+        BackendManager::Get()->CreateFromParams(option_dict);
+    // A repeated --fen would only be served from the cache.
+    if (!positions_file.empty()) {
+      backend = CreateMemCache(std::move(backend), option_dict);
+    }
+    std::unique_ptr<Backend> batchsplit;
+    Backend* bench_backend = backend.get();
+    if (option_dict.Get<bool>(kBatchSplitId)) {
+      batchsplit = CreateBatchSplitingBackend(backend.get());
+      bench_backend = batchsplit.get();
+    }
 
     // Do any backend initialization outside the loop.
-    auto warmup = network->NewComputation();
-    warmup->AddInput(EncodePositionForNN(
-        network->GetCapabilities().input_format, tree.GetPositionHistory(), 8,
-        FillEmptyHistory::ALWAYS, nullptr));
-    warmup->ComputeBlocking();
+    {
+      auto warmup = bench_backend->CreateComputation();
+      std::vector<float> p(positions[0].legal_moves.size());
+      warmup->AddInput(EvalPosition{positions[0].history,
+                                    positions[0].legal_moves},
+                       EvalResultPtr{.p = p});
+      warmup->ComputeBlocking();
+    }
 
     const int batches = option_dict.Get<int>(kBatchesId);
+    const int threads = option_dict.Get<int>(kThreadsOptionId);
+
+    const std::string profile_file =
+        option_dict.Get<std::string>(kDeviceProfileId);
+    std::string profile_backend;
+    double net_flops = 0.0;
+    std::vector<DeviceProfileEntry> profile;
+    if (!profile_file.empty()) {
+      net_flops =
+          TotalFlops(EstimateNetworkCost(LoadWeightsFromOptions(option_dict)));
+      if (net_flops == 0.0) {
+        throw Exception("Unable to estimate the cost of the network.");
+      }
+      profile_backend =
+          option_dict.Get<std::string>(SharedBackendParams::kBackendId);
+      const std::string backend_options =
+          option_dict.Get<std::string>(SharedBackendParams::kBackendOptionsId);
+      if (!backend_options.empty()) profile_backend += ":" + backend_options;
+      std::erase_if(profile_backend, [](char c) { return std::isspace(c); });
+    }
 
     int best = 1;
     int best2 = 1;
@@ -113,31 +183,66 @@ void BackendBenchmark::Run() {
     float best_nps2 = 0.0f;
     float best_nps3 = 0.0f;
     std::optional<std::chrono::time_point<std::chrono::steady_clock>> pending;
+    // Positions are taken in order, so that consecutive batches of a thread
+    // differ like in a game.
+    size_t next_position = 0;
 
     for (int i = option_dict.Get<int>(kStartBatchSizeId);
          i <= option_dict.Get<int>(kMaxBatchSizeId);
          i += option_dict.Get<int>(kBatchStepId)) {
-      const auto start = std::chrono::steady_clock::now();
-      // TODO: support threads not equal to 1 to be able to more sensibly test
-      // multiplexing backend.
-      for (int j = 0; j < batches; j++) {
-        // Put i copies of tree root node into computation and compute.
-        auto computation = network->NewComputation();
-        for (int k = 0; k < i; k++) {
-          computation->AddInput(EncodePositionForNN(
-              network->GetCapabilities().input_format,
-              tree.GetPositionHistory(), 8, FillEmptyHistory::ALWAYS, nullptr));
+      std::atomic<int> batches_left = batches;
+      std::vector<std::vector<double>> latencies(threads);
+      auto client = [&](int thread_idx, size_t position_idx) {
+        struct Result {
+          float q, d, m;
+          std::vector<float> p;
+        };
+        std::vector<Result> results(i);
+        while (batches_left.fetch_sub(1, std::memory_order_relaxed) > 0) {
+          const auto batch_start = std::chrono::steady_clock::now();
+          auto computation = bench_backend->CreateComputation();
+          for (auto& result : results) {
+            const auto& pos = positions[position_idx++ % positions.size()];
+            result.p.resize(pos.legal_moves.size());
+            computation->AddInput(
+                EvalPosition{pos.history, pos.legal_moves},
+                EvalResultPtr{&result.q, &result.d, &result.m, result.p});
+          }
+          computation->ComputeBlocking();
+          const std::chrono::duration<double> latency =
+              std::chrono::steady_clock::now() - batch_start;
+          latencies[thread_idx].push_back(latency.count());
         }
-        computation->ComputeBlocking();
-      }
+      };
 
+      const auto start = std::chrono::steady_clock::now();
+      std::vector<std::thread> client_threads;
+      for (int t = 0; t < threads; ++t) {
+        // Spread the threads over the position set.
+        client_threads.emplace_back(
+            client, t, next_position + t * positions.size() / threads);
+      }
+      for (auto& thread : client_threads) thread.join();
       const auto end = std::chrono::steady_clock::now();
+      next_position += i * batches / threads;
+
+      // From a microsecond to 1000 seconds, in 2% steps.
+      Histogram histogram(-6, 3, 100);
+      for (const auto& thread_latencies : latencies) {
+        for (double latency : thread_latencies) histogram.Add(latency);
+      }
       std::chrono::duration<double> time = end - start;
       const auto nps = i * batches / time.count();
       std::cout << "Benchmark batch size " << i
                 << " with inference average time "
                 << time.count() / batches * 1000 << "ms - throughput " << nps
-                << " nps." << std::endl;
+                << " nps - latency p50 " << histogram.Percentile(0.5) * 1000
+                << "ms p95 " << histogram.Percentile(0.95) * 1000
+                << "ms p99 " << histogram.Percentile(0.99) * 1000 << "ms."
+                << std::endl;
+      if (!profile_file.empty()) {
+        profile.push_back({profile_backend, i, nps * net_flops});
+      }
 
       if (option_dict.Get<bool>(kClippyId)) {
         float nps_ingame = std::pow((nps + best_nps) / 2, 1.085);
@@ -177,6 +282,7 @@ void BackendBenchmark::Run() {
         }
       }
     }
+    if (!profile_file.empty()) AppendDeviceProfile(profile_file, profile);
     if (option_dict.Get<bool>(kClippyId)) {
       Clippy("Recommended minibatch-size for this net:",
              "1s/move   (Bullet):     ", std::to_string(best3),
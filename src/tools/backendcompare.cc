@@ -0,0 +1,229 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "tools/backendcompare.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+#include "neural/register.h"
+#include "neural/shared_params.h"
+#include "tools/positions.h"
+#include "utils/exception.h"
+#include "utils/optionsparser.h"
+#include "utils/string.h"
+
+namespace lczero {
+namespace {
+
+const OptionId kConfigsId{
+    "configs", "",
+    "Backend configurations to compare with the reference one given by "
+    "--backend and --backend-opts, separated by ';'. Each is a backend name, "
+    "optionally followed by ':' and its backend options, e.g. "
+    "\"cuda-fp16;cuda-fp32;onnx-trt:fp16=true\"."};
+const OptionId kPositionsFileId{
+    "positions", "",
+    "PGN or EPD (by .epd extension) file with the positions to evaluate."};
+const OptionId kBatchSizeId{"batch-size", "",
+                            "Number of positions per backend computation."};
+
+// Below that, a reference probability counts as zero in the KL divergence.
+constexpr float kMinProbability = 1e-9f;
+
+struct Output {
+  float q;
+  float d;
+  float m;
+  std::vector<float> p;
+};
+
+// Evaluates @positions in batches, returns the outputs and sets @nps to the
+// measured throughput.
+std::vector<Output> Evaluate(Backend* backend,
+                             const std::vector<BenchPosition>& positions,
+                             size_t batch_size, double* nps) {
+  std::vector<Output> outputs(positions.size());
+  auto compute = [&](size_t begin, size_t end) {
+    auto computation = backend->CreateComputation();
+    for (size_t i = begin; i < end; ++i) {
+      outputs[i].p.resize(positions[i].legal_moves.size());
+      computation->AddInput(
+          EvalPosition{positions[i].history, positions[i].legal_moves},
+          EvalResultPtr{&outputs[i].q, &outputs[i].d, &outputs[i].m,
+                        outputs[i].p});
+    }
+    computation->ComputeBlocking();
+  };
+  // Backends may initialize on the first computation of a batch size, so
+  // time from the second batch on.
+  compute(0, std::min(batch_size, positions.size()));
+  const auto start = std::chrono::steady_clock::now();
+  size_t timed_positions = 0;
+  for (size_t begin = 0; begin < positions.size(); begin += batch_size) {
+    const size_t end = std::min(begin + batch_size, positions.size());
+    compute(begin, end);
+    if (begin > 0) timed_positions += end - begin;
+  }
+  const std::chrono::duration<double> time =
+      std::chrono::steady_clock::now() - start;
+  // With a single batch, the warmup batch is the timed one.
+  if (timed_positions == 0) timed_positions = positions.size();
+  *nps = timed_positions / time.count();
+  return outputs;
+}
+
+struct Errors {
+  double policy_max = 0.0;
+  double policy_sum = 0.0;
+  size_t policy_count = 0;
+  double kld_sum = 0.0;
+  size_t top1_matches = 0;
+  double wdl_max = 0.0;
+  double wdl_sum = 0.0;
+  double q_max = 0.0;
+  double q_sum = 0.0;
+  size_t positions = 0;
+
+  void Add(const Output& reference, const Output& output) {
+    ++positions;
+    for (size_t i = 0; i < reference.p.size(); ++i) {
+      const double error = std::abs(output.p[i] - reference.p[i]);
+      policy_max = std::max(policy_max, error);
+      policy_sum += error;
+      if (reference.p[i] > kMinProbability) {
+        kld_sum += reference.p[i] *
+                   std::log(reference.p[i] /
+                            std::max(output.p[i], kMinProbability));
+      }
+    }
+    policy_count += reference.p.size();
+    const auto argmax = [](const std::vector<float>& p) {
+      return std::max_element(p.begin(), p.end()) - p.begin();
+    };
+    if (argmax(reference.p) == argmax(output.p)) ++top1_matches;
+    // Win and loss probabilities from Q = W - L and D.
+    const auto wdl = [](const Output& o) -> std::array<double, 3> {
+      return {(1.0 + o.q - o.d) / 2, o.d, (1.0 - o.q - o.d) / 2};
+    };
+    const auto reference_wdl = wdl(reference);
+    const auto output_wdl = wdl(output);
+    for (size_t i = 0; i < 3; ++i) {
+      const double error = std::abs(output_wdl[i] - reference_wdl[i]);
+      wdl_max = std::max(wdl_max, error);
+      wdl_sum += error / 3;
+    }
+    const double q_error = std::abs(output.q - reference.q);
+    q_max = std::max(q_max, q_error);
+    q_sum += q_error;
+  }
+};
+
+void PrintHeader() {
+  std::cout << std::left << std::setw(32) << "config" << std::right
+            << std::setw(10) << "nps" << std::setw(11) << "p max"
+            << std::setw(11) << "p mean" << std::setw(11) << "p kld"
+            << std::setw(8) << "top1%" << std::setw(11) << "wdl max"
+            << std::setw(11) << "wdl mean" << std::setw(11) << "q max"
+            << std::setw(11) << "q mean" << std::endl;
+}
+
+void PrintRow(const std::string& config, double nps, const Errors& errors) {
+  const size_t positions = std::max<size_t>(errors.positions, 1);
+  std::cout << std::left << std::setw(32) << config << std::right
+            << std::fixed << std::setprecision(0) << std::setw(10) << nps
+            << std::scientific << std::setprecision(3) << std::setw(11)
+            << errors.policy_max << std::setw(11)
+            << errors.policy_sum / std::max<size_t>(errors.policy_count, 1)
+            << std::setw(11) << errors.kld_sum / positions << std::fixed
+            << std::setprecision(2) << std::setw(8)
+            << 100.0 * errors.top1_matches / positions << std::scientific
+            << std::setprecision(3) << std::setw(11) << errors.wdl_max
+            << std::setw(11) << errors.wdl_sum / positions << std::setw(11)
+            << errors.q_max << std::setw(11) << errors.q_sum / positions
+            << std::defaultfloat << std::endl;
+}
+
+}  // namespace
+
+void BackendCompare::Run() {
+  OptionsParser options;
+  SharedBackendParams::Populate(&options);
+  options.Add<StringOption>(kConfigsId);
+  options.Add<StringOption>(kPositionsFileId);
+  options.Add<IntOption>(kBatchSizeId, 1, 4096) = 256;
+  if (!options.ProcessAllFlags()) return;
+
+  try {
+    const auto& option_dict = options.GetOptionsDict();
+    const std::string positions_file =
+        option_dict.Get<std::string>(kPositionsFileId);
+    if (positions_file.empty()) throw Exception("--positions is required.");
+    const auto positions = LoadBenchPositions(positions_file);
+    std::cout << "Loaded " << positions.size() << " positions." << std::endl;
+    const size_t batch_size = option_dict.Get<int>(kBatchSizeId);
+
+    double nps;
+    const std::vector<Output> reference = Evaluate(
+        BackendManager::Get()->CreateFromParams(option_dict).get(), positions,
+        batch_size, &nps);
+    PrintHeader();
+    std::string reference_name =
+        option_dict.Get<std::string>(SharedBackendParams::kBackendId);
+    PrintRow(reference_name + " (reference)", nps, Errors());
+
+    for (const std::string& config :
+         StrSplit(option_dict.Get<std::string>(kConfigsId), ";")) {
+      if (Trim(config).empty()) continue;
+      const auto colon = config.find(':');
+      const std::string backend = Trim(config.substr(0, colon));
+      const std::string backend_opts =
+          colon == std::string::npos ? "" : config.substr(colon + 1);
+      OptionsDict config_dict = option_dict;
+      config_dict.Set<std::string>(SharedBackendParams::kBackendId, backend);
+      config_dict.Set<std::string>(SharedBackendParams::kBackendOptionsId,
+                                   backend_opts);
+      // One backend at a time, so that they don't compete for the device.
+      const std::vector<Output> outputs = Evaluate(
+          BackendManager::Get()->CreateFromParams(config_dict).get(),
+          positions, batch_size, &nps);
+      Errors errors;
+      for (size_t i = 0; i < positions.size(); ++i) {
+        errors.Add(reference[i], outputs[i]);
+      }
+      PrintRow(Trim(config), nps, errors);
+    }
+  } catch (Exception& ex) {
+    std::cerr << ex.what() << std::endl;
+  }
+}
+
+}  // namespace lczero
@@ -27,13 +27,24 @@
 
 #include "tools/benchmark.h"
 
+#include <fstream>
 #include <numeric>
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
 
 #include "neural/memcache.h"
 #include "neural/shared_params.h"
 #include "search/classic/search.h"
 #include "search/classic/stoppers/factory.h"
 #include "search/classic/stoppers/stoppers.h"
+#include "utils/random.h"
+#include "version.h"
 
 namespace lczero {
 namespace {
@@ -47,6 +58,120 @@ const OptionId kMovetimeId{"movetime", "",
 const OptionId kFenId{"fen", "", "Benchmark position FEN."};
 const OptionId kNumPositionsId{"num-positions", "",
                                "The number of benchmark positions to test."};
+const OptionId kPositionsFileId{
+    "positions-file", "",
+    "File with the benchmark positions, one FEN per line, optionally followed "
+    "by \"moves\" and moves. Replaces the built-in positions."};
+const OptionId kSeedId{
+    "seed", "",
+    "Seed of the random generator, reset before every position. -1 keeps the "
+    "random seed."};
+const OptionId kJsonFileId{
+    "json", "",
+    "Writes the results, with search statistics, as JSON to that file."};
+
+// Statistics of the search of one benchmark position.
+struct PositionResult {
+  std::string fen;
+  int64_t time_ms;
+  int64_t playouts;
+  classic::SearchStats stats;
+};
+
+// Peak resident memory of the process in bytes, 0 if unknown.
+size_t GetPeakMemory() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                            sizeof(counters))) {
+    return 0;
+  }
+  return counters.PeakWorkingSetSize;
+#else
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+  return usage.ru_maxrss;
+#else
+  return usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+std::string JsonString(const std::string& str) {
+  std::string result = "\"";
+  for (char c : str) {
+    if (c == '"' || c == '\\') result += '\\';
+    result += c;
+  }
+  return result + "\"";
+}
+
+// Writes the fields of a position result or of the totals.
+void WriteJsonStats(std::ostream& os, int64_t time_ms, int64_t playouts,
+                    const classic::SearchStats& stats) {
+  auto ratio = [](int64_t num, int64_t den) {
+    return den ? static_cast<double>(num) / den : 0.0;
+  };
+  auto ms = [](std::chrono::nanoseconds time) {
+    return std::chrono::duration<double, std::milli>(time).count();
+  };
+  os << "\"time_ms\": " << time_ms << ", \"nodes\": " << playouts
+     << ", \"nps\": " << std::lround(1000.0 * playouts / (time_ms + 1))
+     << ", \"batches\": " << stats.batches
+     << ", \"nn_evals\": " << stats.nn_evals
+     << ", \"average_batch_size\": " << ratio(stats.nn_evals, stats.batches)
+     << ", \"batch_sizes_log2\": [";
+  for (size_t i = 0; i < stats.batch_sizes.size(); ++i) {
+    os << (i ? ", " : "") << stats.batch_sizes[i];
+  }
+  os << "], \"collision_rate\": "
+     << ratio(stats.collisions, stats.picked_nodes)
+     << ", \"cache_hit_rate\": " << ratio(stats.cache_hits, stats.picked_nodes)
+     << ", \"phase_ms\": {\"gather\": " << ms(stats.gather_time)
+     << ", \"compute\": " << ms(stats.compute_time)
+     << ", \"fetch\": " << ms(stats.fetch_time)
+     << ", \"backup\": " << ms(stats.backup_time) << "}";
+}
+
+void WriteJson(std::ostream& os, const OptionsDict& options,
+               const std::vector<PositionResult>& results) {
+  os << "{\n  \"version\": " << JsonString(GetVersionStr())
+     << ",\n  \"threads\": " << options.Get<int>(kThreadsOptionId)
+     << ",\n  \"nodes\": " << options.Get<int>(kNodesId)
+     << ",\n  \"movetime\": " << options.Get<int>(kMovetimeId)
+     << ",\n  \"seed\": " << options.Get<int>(kSeedId)
+     << ",\n  \"positions\": [";
+  int64_t total_time = 0;
+  int64_t total_playouts = 0;
+  classic::SearchStats total_stats;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto& result = results[i];
+    os << (i ? "," : "") << "\n    {\"fen\": " << JsonString(result.fen)
+       << ", ";
+    WriteJsonStats(os, result.time_ms, result.playouts, result.stats);
+    os << "}";
+    total_time += result.time_ms;
+    total_playouts += result.playouts;
+    total_stats.Add(result.stats);
+  }
+  os << "\n  ],\n  \"total\": {";
+  WriteJsonStats(os, total_time, total_playouts, total_stats);
+  os << "},\n  \"peak_memory_bytes\": " << GetPeakMemory() << "\n}\n";
+}
+
+std::vector<std::string> LoadPositions(const std::string& filename) {
+  std::ifstream file(filename);
+  if (!file) throw Exception("Unable to open " + filename);
+  std::vector<std::string> positions;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty() || line[0] == '#') continue;
+    positions.push_back(line);
+  }
+  return positions;
+}
 }  // namespace
 
 void Benchmark::Run(bool run_shorter_benchmark) {
@@ -59,6 +184,9 @@ void Benchmark::Run(bool run_shorter_benchmark) {
 
   options.Add<IntOption>(kNodesId, -1, 999999999) = -1;
   options.Add<StringOption>(kFenId) = "";
+  options.Add<StringOption>(kPositionsFileId) = "";
+  options.Add<IntOption>(kSeedId, -1, 999999999) = -1;
+  options.Add<StringOption>(kJsonFileId) = "";
   if (run_shorter_benchmark) {
     options.Add<IntOption>(kMovetimeId, -1, 999999999) = 500;
     options.Add<IntOption>(kNumPositionsId, 1, 34) = 10;
@@ -73,8 +201,7 @@ void Benchmark::Run(bool run_shorter_benchmark) {
     auto option_dict = options.GetOptionsDict();
 
     auto backend = CreateMemCache(
-        BackendManager::Get()->CreateFromParams(option_dict),
-        option_dict.Get<int>(SharedBackendParams::kNNCacheSizeId));
+        BackendManager::Get()->CreateFromParams(option_dict), option_dict);
 
     const int visits = option_dict.Get<int>(kNodesId);
     const int movetime = option_dict.Get<int>(kMovetimeId);
@@ -85,14 +212,22 @@ void Benchmark::Run(bool run_shorter_benchmark) {
     std::vector<std::int64_t> playouts;
     std::uint64_t cnt = 1;
 
+    const std::string positions_file =
+        option_dict.Get<std::string>(kPositionsFileId);
     if (fen.length() > 0) {
       positions = {fen};
       num_positions = 1;
+    } else if (!positions_file.empty()) {
+      positions = LoadPositions(positions_file);
+      num_positions = positions.size();
     }
     std::vector<std::string> testing_positions(
         positions.cbegin(), positions.cbegin() + num_positions);
+    const int seed = option_dict.Get<int>(kSeedId);
+    std::vector<PositionResult> results;
 
     for (std::string position : testing_positions) {
+      if (seed >= 0) Random::Get().Seed(seed);
       std::cout << "\nPosition: " << cnt++ << "/" << testing_positions.size()
                 << " " << position << std::endl;
 
@@ -106,10 +241,6 @@ void Benchmark::Run(bool run_shorter_benchmark) {
             std::make_unique<classic::VisitsStopper>(visits, false));
       }
 
-      NNCache cache;
-      cache.SetCapacity(
-          option_dict.Get<int>(SharedBackendParams::kNNCacheSizeId));
-
       classic::NodeTree tree;
       tree.ResetToPosition(position, {});
 
@@ -129,6 +260,8 @@ void Benchmark::Run(bool run_shorter_benchmark) {
           std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
       times.push_back(time.count());
       playouts.push_back(search->GetTotalPlayouts());
+      results.push_back(
+          {position, time.count(), playouts.back(), search->GetStats()});
     }
 
     const auto total_playouts =
@@ -140,6 +273,13 @@ void Benchmark::Run(bool run_shorter_benchmark) {
               << "\nNodes/second    : "
               << std::lround(1000.0 * total_playouts / (total_time + 1))
               << std::endl;
+
+    const std::string json_file = option_dict.Get<std::string>(kJsonFileId);
+    if (!json_file.empty()) {
+      std::ofstream json(json_file);
+      if (!json) throw Exception("Unable to write " + json_file);
+      WriteJson(json, option_dict, results);
+    }
   } catch (Exception& ex) {
     std::cerr << ex.what() << std::endl;
   }
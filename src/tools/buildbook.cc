@@ -0,0 +1,65 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "tools/buildbook.h"
+
+#include "selfplay/opening_book.h"
+#include "utils/logging.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+namespace {
+
+const OptionId kInputFilenameId{"input", "InputFile",
+                                "Path of the input PGN opening book."};
+const OptionId kOutputFilenameId{"output", "OutputFile",
+                                 "Path of the output opening index."};
+
+bool ProcessParameters(OptionsParser* options) {
+  options->Add<StringOption>(kInputFilenameId);
+  options->Add<StringOption>(kOutputFilenameId);
+  if (!options->ProcessAllFlags()) return false;
+  const OptionsDict& dict = options->GetOptionsDict();
+  dict.EnsureExists<std::string>(kInputFilenameId);
+  dict.EnsureExists<std::string>(kOutputFilenameId);
+  return true;
+}
+
+}  // namespace
+
+void BuildOpeningBookCmd() {
+  OptionsParser options_parser;
+  if (!ProcessParameters(&options_parser)) return;
+
+  const OptionsDict& dict = options_parser.GetOptionsDict();
+  const size_t count =
+      WriteOpeningIndex(dict.Get<std::string>(kInputFilenameId),
+                        dict.Get<std::string>(kOutputFilenameId));
+  COUT << "Wrote " << count << " openings.";
+}
+
+}  // namespace lczero
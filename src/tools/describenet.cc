@@ -27,8 +27,13 @@
 
 #include "tools/describenet.h"
 
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
 #include "neural/loader.h"
 #include "neural/onnx/onnx.pb.h"
+#include "tools/network_cost.h"
 #include "utils/optionsparser.h"
 
 namespace lczero {
@@ -36,9 +41,14 @@ namespace {
 
 const OptionId kWeightsFilenameId{"weights", "WeightsFile",
                                   "Path of the input Lc0 weights file.", 'w'};
+const OptionId kDeviceProfileId{
+    "device-profile", "",
+    "Device profile written by backendbench --device-profile, to predict the "
+    "throughput of the network from."};
 
 bool ProcessParameters(OptionsParser* options) {
   options->Add<StringOption>(kWeightsFilenameId);
+  options->Add<StringOption>(kDeviceProfileId) = "";
   if (!options->ProcessAllFlags()) return false;
   const OptionsDict& dict = options->GetOptionsDict();
   dict.EnsureExists<std::string>(kWeightsFilenameId);
@@ -54,6 +64,12 @@ std::string Justify(std::string str, size_t length = 30) {
   return str;
 }
 
+std::string FormatNumber(double value, int precision) {
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(precision) << value;
+  return oss.str();
+}
+
 }  // namespace
 
 void ShowNetworkGenericInfo(const pblczero::Net& weights) {
@@ -218,6 +234,39 @@ void ShowNetworkWeightsInfo(const pblczero::Net& weights) {
   COUT << Justify("MLH") << (w.has_ip2_mov_w() ? "Present" : "Absent");
 }
 
+void ShowNetworkCostInfo(const pblczero::Net& weights) {
+  const auto costs = EstimateNetworkCost(weights);
+  if (costs.empty()) return;
+  COUT << "\nCost per position";
+  COUT << "~~~~~~~~~~~~~~~~~";
+  double max_activations = 0.0;
+  for (const auto& cost : costs) {
+    std::string name = cost.name;
+    if (cost.count > 1) name += " (" + std::to_string(cost.count) + ")";
+    // Activations are counted at fp16, which most GPU backends use.
+    COUT << Justify(name) << FormatNumber(cost.flops / 1e6, 2) << " MFLOP, "
+         << FormatNumber(cost.activations * 2 / 1024, 1)
+         << " KiB activations";
+    max_activations = std::max(max_activations, cost.activations);
+  }
+  COUT << Justify("Total") << FormatNumber(TotalFlops(costs) / 1e6, 2)
+       << " MFLOP, " << FormatNumber(max_activations * 2 / 1024, 1)
+       << " KiB peak activations";
+}
+
+void ShowNetworkThroughputPrediction(const pblczero::Net& weights,
+                                     const std::string& profile_file) {
+  const double flops = TotalFlops(EstimateNetworkCost(weights));
+  if (flops == 0.0) return;
+  COUT << "\nPredicted throughput";
+  COUT << "~~~~~~~~~~~~~~~~~~~~";
+  for (const auto& entry : LoadDeviceProfile(profile_file)) {
+    COUT << Justify(entry.backend + " batch " +
+                    std::to_string(entry.batch_size))
+         << FormatNumber(entry.flops_per_second / flops, 0) << " nps";
+  }
+}
+
 void ShowNetworkOnnxInfo(const pblczero::Net& weights,
                          bool show_onnx_internals) {
   if (!weights.has_onnx_model()) return;
@@ -296,6 +345,7 @@ void ShowAllNetworkInfo(const pblczero::Net& weights) {
   ShowNetworkFormatInfo(weights);
   ShowNetworkTrainingInfo(weights);
   ShowNetworkWeightsInfo(weights);
+  ShowNetworkCostInfo(weights);
   ShowNetworkOnnxInfo(weights, true);
 }
 
@@ -307,5 +357,7 @@ void DescribeNetworkCmd() {
   auto weights_file =
       LoadWeightsFromFile(dict.Get<std::string>(kWeightsFilenameId));
   ShowAllNetworkInfo(weights_file);
+  const std::string profile = dict.Get<std::string>(kDeviceProfileId);
+  if (!profile.empty()) ShowNetworkThroughputPrediction(weights_file, profile);
 }
 }  // namespace lczero
@@ -27,6 +27,8 @@
 
 #pragma once
 
+#include <string>
+
 #include "proto/net.pb.h"
 
 namespace lczero {
@@ -36,6 +38,9 @@ void ShowNetworkGenericInfo(const pblczero::Net& weights);
 void ShowNetworkFormatInfo(const pblczero::Net& weights);
 void ShowNetworkTrainingInfo(const pblczero::Net& weights);
 void ShowNetworkWeightsInfo(const pblczero::Net& weights);
+void ShowNetworkCostInfo(const pblczero::Net& weights);
+void ShowNetworkThroughputPrediction(const pblczero::Net& weights,
+                                     const std::string& profile_file);
 void ShowNetworkOnnxInfo(const pblczero::Net& weights,
                          bool show_onnx_internals);
 void ShowAllNetworkInfo(const pblczero::Net& weights);
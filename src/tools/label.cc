@@ -0,0 +1,199 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "tools/label.h"
+
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "neural/batchsplit.h"
+#include "neural/register.h"
+#include "neural/shared_params.h"
+#include "search/instamove/instamove.h"
+#include "tools/positions.h"
+#include "utils/exception.h"
+#include "utils/mutex.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+namespace {
+
+const OptionId kInputId{"input", "",
+                        "EPD file to label, or - to read the positions from "
+                        "the standard input."};
+const OptionId kHeadId{
+    "head", "",
+    "Network head picking the move: \"policy\" takes the move with the "
+    "highest prior, \"value\" the move to the position with the best value."};
+const OptionId kBatchSizeId{
+    "batch-size", "",
+    "Number of network inputs per backend computation, 0 for the recommended "
+    "batch size of the backend. Larger batches are split to the maximum batch "
+    "size of the backend."};
+const OptionId kParallelId{
+    "parallel", "",
+    "Number of backend computations in flight. Use a backend such as "
+    "roundrobin or multiplexing to spread them over several GPUs."};
+
+// A chunk of input lines, and the index of the batch result of each, or -1 for
+// lines without a position to label.
+struct Chunk {
+  std::vector<std::string> lines;
+  std::vector<int> result_idx;
+};
+
+std::string FormatLabel(const InstamoveResult& result) {
+  std::ostringstream os;
+  os << std::fixed << std::setprecision(4)
+     << "bestmove " << result.bestmove.ToString(false) << " q " << result.q
+     << " d " << result.d;
+  return os.str();
+}
+
+}  // namespace
+
+void Label::Run() {
+  OptionsParser options;
+  SharedBackendParams::Populate(&options);
+  options.Add<StringOption>(kInputId) = "-";
+  options.Add<ChoiceOption>(kHeadId, std::vector<std::string>{
+                                         "policy", "value"}) = "policy";
+  options.Add<IntOption>(kBatchSizeId, 0, 65536) = 0;
+  options.Add<IntOption>(kParallelId, 1, 64) = 2;
+
+  if (!options.ProcessAllFlags()) return;
+
+  try {
+    const auto option_dict = options.GetOptionsDict();
+    const std::string input_name = option_dict.Get<std::string>(kInputId);
+    std::ifstream file;
+    if (input_name != "-") {
+      file.open(input_name);
+      if (!file) throw Exception("Unable to open " + input_name);
+    }
+    std::istream& input = input_name == "-" ? std::cin : file;
+
+    // Straight to the backend, the positions are all different.
+    auto backend = BackendManager::Get()->CreateFromParams(option_dict);
+    auto batchsplit = CreateBatchSplitingBackend(backend.get());
+    const InstamoveHead head = option_dict.Get<std::string>(kHeadId) == "value"
+                                   ? InstamoveHead::kValue
+                                   : InstamoveHead::kPolicy;
+    size_t batch_size = option_dict.Get<int>(kBatchSizeId);
+    if (batch_size == 0) {
+      batch_size = backend->GetAttributes().recommended_batch_size;
+    }
+
+    Mutex input_mutex;
+    uint64_t next_chunk = 0;
+    Mutex output_mutex;
+    std::condition_variable output_cv;
+    uint64_t next_output_chunk = 0;
+    std::atomic<int64_t> labelled = 0;
+    std::atomic<int64_t> evals = 0;
+
+    auto labeller = [&]() {
+      while (true) {
+        Chunk chunk;
+        InstamoveBatch batch(head, batchsplit.get());
+        uint64_t chunk_idx;
+        int batch_positions = 0;
+        {
+          Mutex::Lock lock(input_mutex);
+          chunk_idx = next_chunk++;
+          std::string line;
+          while (batch.GetInputCount() < batch_size &&
+                 std::getline(input, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            int result_idx = -1;
+            try {
+              const std::string fen = EpdToFen(line);
+              if (!fen.empty()) {
+                PositionHistory history;
+                history.Reset(Position::FromFen(fen));
+                if (!history.Last().GetBoard().GenerateLegalMoves().empty()) {
+                  batch.Add(history);
+                  result_idx = batch_positions++;
+                }
+              }
+            } catch (const Exception&) {
+              // Not a position, passed through without a label.
+            }
+            chunk.lines.push_back(std::move(line));
+            chunk.result_idx.push_back(result_idx);
+          }
+        }
+        evals += batch.GetInputCount();
+        const auto results = batch.Compute();
+        labelled += results.size();
+
+        std::ostringstream out;
+        for (size_t i = 0; i < chunk.lines.size(); ++i) {
+          out << chunk.lines[i] << "\t"
+              << (chunk.result_idx[i] < 0
+                      ? "none"
+                      : FormatLabel(results[chunk.result_idx[i]]))
+              << "\n";
+        }
+        Mutex::Lock lock(output_mutex);
+        output_cv.wait(lock.get_raw(),
+                       [&]() { return next_output_chunk == chunk_idx; });
+        std::cout << out.str() << std::flush;
+        ++next_output_chunk;
+        output_cv.notify_all();
+        // Chunks after the end of input are all empty.
+        if (chunk.lines.empty()) break;
+      }
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> labellers;
+    for (int i = 0; i < option_dict.Get<int>(kParallelId); ++i) {
+      labellers.emplace_back(labeller);
+    }
+    for (auto& labeller_thread : labellers) labeller_thread.join();
+    const auto total_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+    // The standard output is for the labels only.
+    std::cerr << "Labelled " << labelled << " positions with " << evals
+              << " evals in " << total_ms << " ms, "
+              << std::lround(1000.0 * evals / (total_ms + 1))
+              << " evals/second." << std::endl;
+  } catch (Exception& ex) {
+    std::cerr << ex.what() << std::endl;
+  }
+}
+
+}  // namespace lczero
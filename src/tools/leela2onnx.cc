@@ -52,8 +52,20 @@ const OptionId kHloBatchSizeId{"hlo-batch-size", "",
                                "Batch size to use for HLO conversion."};
 const OptionId kOnnxDataTypeId{"onnx-data-type", "",
                                "Data type to use in the ONNX model."};
+const OptionId kOnnxFp32LayersId{
+    "onnx-fp32-layers", "",
+    "Comma-separated list of parts to keep in fp32 when the data type is f16 "
+    "or bf16: policy, value, mlh, layernorm, smolgen."};
 const OptionId kOnnxOpsetId{"onnx-opset", "",
                             "Opset to use in the ONNX model."};
+const OptionId kOnnxProfileId{
+    "onnx-profile", "",
+    "Runtime to tune the ONNX model for: generic, tensorrt (fp16, fused "
+    "LayerNormalization), directml (fp16, fused Mish) or cpu (fp32, Mish "
+    "approximation). Explicitly given data type and opset take precedence."};
+const OptionId kOnnxOptimizeId{
+    "onnx-optimize", "",
+    "Fold constants and fuse nodes of the generated ONNX model."};
 const OptionId kHloAllowPartialResultId = {
     "hlo-allow-partial-result", "",
     "Allow partial result in case of HLO conversion failure (DEBUG ONLY!)."};
@@ -93,6 +105,11 @@ bool ProcessParameters(OptionsParser* options) {
   options->Add<IntOption>(kHloBatchSizeId, 1, 2048) = 333;
   options->Add<ChoiceOption>(
       kOnnxDataTypeId, std::vector<std::string>{"f32", "f16", "bf16"}) = "f32";
+  options->Add<StringOption>(kOnnxFp32LayersId) = "";
+  options->Add<ChoiceOption>(
+      kOnnxProfileId, std::vector<std::string>{"generic", "tensorrt",
+                                               "directml", "cpu"}) = "generic";
+  options->Add<BoolOption>(kOnnxOptimizeId) = true;
   options->Add<BoolOption>(kHloAllowPartialResultId);
   options->HideOption(kOnnxBatchSizeId);
   options->HideOption(kHloAllowPartialResultId);
@@ -140,13 +157,23 @@ void ConvertLeelaToOnnx() {
     onnx_options.output_policy_head = dict.Get<std::string>(kOutputPolicyHead);
     onnx_options.output_wdl = dict.Get<std::string>(kOutputWdl);
     onnx_options.output_value = dict.Get<std::string>(kOutputValue);
-    onnx_options.opset = dict.Get<int>(kOnnxOpsetId);
     onnx_options.batch_size = dict.Get<int>(kOnnxBatchSizeId);
-    onnx_options.data_type = WeightsToOnnxConverterOptions::StringToDataType(
-        dict.Get<std::string>(kOnnxDataTypeId));
+    onnx_options.fp32_layers = dict.Get<std::string>(kOnnxFp32LayersId);
+    // The defaults of the opset and data type options are the same as the
+    // converter's, so the profile only overrides them if they are not given.
+    onnx_options.ApplyProfile(dict.Get<std::string>(kOnnxProfileId));
+    if (dict.OwnExists<int>(kOnnxOpsetId)) {
+      onnx_options.opset = dict.Get<int>(kOnnxOpsetId);
+    }
+    if (dict.OwnExists<std::string>(kOnnxDataTypeId)) {
+      onnx_options.data_type =
+          WeightsToOnnxConverterOptions::StringToDataType(
+              dict.Get<std::string>(kOnnxDataTypeId));
+    }
     // onnx2pytorch only needs an alternate layernorm-implementation, so it's
     // currently only enables that. Might need to be extended in the future.
-    onnx_options.alt_layernorm = dict.Get<bool>(kOnnxToPytorch);
+    if (dict.Get<bool>(kOnnxToPytorch)) onnx_options.alt_layernorm = true;
+    onnx_options.optimize = dict.Get<bool>(kOnnxOptimizeId);
     onnx_options.value_head = dict.Get<std::string>(kValueHead);
     onnx_options.policy_head = dict.Get<std::string>(kPolicyHead);
     weights_file = ConvertWeightsToOnnx(weights_file, onnx_options);
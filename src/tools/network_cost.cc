@@ -0,0 +1,232 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "tools/network_cost.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <utility>
+
+#include "neural/network_legacy.h"
+#include "utils/exception.h"
+
+namespace lczero {
+namespace {
+
+using Vec = BaseWeights::Vec;
+
+constexpr double kSquares = 64;
+
+// Dense layer applied to every square (or a 3x3 convolution, which has 9
+// weights per input/output channel pair).
+double PerSquareMacs(const Vec& w) { return kSquares * w.size(); }
+
+double EncoderMacs(const BaseWeights::EncoderLayer& layer, int heads,
+                   const Vec& smolgen_w) {
+  const auto& mha = layer.mha;
+  const double dmodel = mha.q_b.size();
+  double macs = PerSquareMacs(mha.q_w) + PerSquareMacs(mha.k_w) +
+                PerSquareMacs(mha.v_w) + PerSquareMacs(mha.dense_w);
+  // Q*K^T and the attention weights times V.
+  macs += 2 * kSquares * kSquares * dmodel;
+  if (mha.has_smolgen) {
+    const auto& smolgen = mha.smolgen;
+    macs += PerSquareMacs(smolgen.compress) + smolgen.dense1_w.size() +
+            smolgen.dense2_w.size() +
+            static_cast<double>(heads) * smolgen_w.size();
+  }
+  macs += PerSquareMacs(layer.ffn.dense1_w) + PerSquareMacs(layer.ffn.dense2_w);
+  return macs;
+}
+
+double EncoderActivations(const BaseWeights::EncoderLayer& layer, int heads) {
+  return std::max({kSquares * 3 * layer.mha.q_b.size(),
+                   kSquares * kSquares * heads,
+                   kSquares * layer.ffn.dense1_b.size()});
+}
+
+double ConvChannels(const BaseWeights::ConvBlock& conv) {
+  return std::max(conv.biases.size(), conv.bn_means.size());
+}
+
+void AddBody(const MultiHeadWeights& w, std::vector<LayerCost>* costs) {
+  if (!w.encoder.empty()) {
+    double macs = w.ip_emb_preproc_w.size() + PerSquareMacs(w.ip_emb_w) +
+                  PerSquareMacs(w.ip_emb_ffn.dense1_w) +
+                  PerSquareMacs(w.ip_emb_ffn.dense2_w);
+    costs->push_back(
+        {"Embedding", 1, 2 * macs,
+         kSquares * std::max(w.ip_emb_b.size(), w.ip_emb_ffn.dense1_b.size())});
+    LayerCost encoders{"Encoders", static_cast<int>(w.encoder.size())};
+    for (const auto& layer : w.encoder) {
+      encoders.flops +=
+          2 * EncoderMacs(layer, w.encoder_head_count, w.smolgen_w);
+      encoders.activations =
+          std::max(encoders.activations,
+                   EncoderActivations(layer, w.encoder_head_count));
+    }
+    costs->push_back(encoders);
+    return;
+  }
+  const double filters = ConvChannels(w.input);
+  costs->push_back(
+      {"Input convolution", 1, 2 * PerSquareMacs(w.input.weights),
+       kSquares * filters});
+  if (w.residual.empty()) return;
+  LayerCost blocks{"Residual blocks", static_cast<int>(w.residual.size())};
+  for (const auto& block : w.residual) {
+    double macs =
+        PerSquareMacs(block.conv1.weights) + PerSquareMacs(block.conv2.weights);
+    if (block.has_se) macs += block.se.w1.size() + block.se.w2.size();
+    blocks.flops += 2 * macs;
+  }
+  blocks.activations = kSquares * filters;
+  costs->push_back(blocks);
+}
+
+LayerCost PolicyCost(const MultiHeadWeights::PolicyHead& head,
+                     const Vec& smolgen_w) {
+  LayerCost cost{"Policy head"};
+  double macs = 0.0;
+  if (!head.ip2_pol_w.empty()) {
+    // Attention policy.
+    macs += PerSquareMacs(head.ip_pol_w);
+    for (const auto& layer : head.pol_encoder) {
+      macs += EncoderMacs(layer, head.pol_encoder_head_count, smolgen_w);
+      cost.activations = std::max(
+          cost.activations,
+          EncoderActivations(layer, head.pol_encoder_head_count));
+    }
+    macs += PerSquareMacs(head.ip2_pol_w) + PerSquareMacs(head.ip3_pol_w);
+    macs += kSquares * kSquares * head.ip2_pol_b.size();
+    macs += 8 * head.ip4_pol_w.size();
+    cost.activations = std::max(cost.activations, kSquares * kSquares);
+  } else if (!head.policy1.weights.empty()) {
+    // Convolutional policy.
+    macs += PerSquareMacs(head.policy1.weights) +
+            PerSquareMacs(head.policy.weights);
+    cost.activations = kSquares * ConvChannels(head.policy1);
+  } else {
+    // Classical policy: 1x1 convolution and a dense layer.
+    macs += PerSquareMacs(head.policy.weights) + head.ip_pol_w.size();
+    cost.activations = std::max(kSquares * ConvChannels(head.policy),
+                                static_cast<double>(head.ip_pol_b.size()));
+  }
+  cost.flops = 2 * macs;
+  return cost;
+}
+
+LayerCost ValueCost(const MultiHeadWeights::ValueHead& head) {
+  const double macs = PerSquareMacs(head.value.weights) +
+                      PerSquareMacs(head.ip_val_w) + head.ip1_val_w.size() +
+                      head.ip2_val_w.size();
+  return {"Value head", 1, 2 * macs,
+          kSquares * std::max(ConvChannels(head.value),
+                              static_cast<double>(head.ip_val_b.size()))};
+}
+
+LayerCost MovesLeftCost(const BaseWeights& w) {
+  const double macs = PerSquareMacs(w.moves_left.weights) +
+                      PerSquareMacs(w.ip_mov_w) + w.ip1_mov_w.size() +
+                      w.ip2_mov_w.size();
+  return {"Moves left head", 1, 2 * macs,
+          kSquares * std::max(ConvChannels(w.moves_left),
+                              static_cast<double>(w.ip_mov_b.size()))};
+}
+
+// Search only uses the "vanilla" policy and "winner" value heads.
+template <typename Map>
+const typename Map::mapped_type* FindHead(const Map& heads,
+                                          const std::string& name) {
+  auto iter = heads.find(name);
+  if (iter == heads.end()) iter = heads.begin();
+  return iter == heads.end() ? nullptr : &iter->second;
+}
+
+}  // namespace
+
+std::vector<LayerCost> EstimateNetworkCost(const pblczero::Net& net) {
+  std::vector<LayerCost> costs;
+  if (!net.has_weights()) return costs;
+  const MultiHeadWeights w(net.weights());
+  AddBody(w, &costs);
+  if (const auto* head = FindHead(w.policy_heads, "vanilla")) {
+    costs.push_back(PolicyCost(*head, w.smolgen_w));
+  }
+  if (const auto* head = FindHead(w.value_heads, "winner")) {
+    costs.push_back(ValueCost(*head));
+  }
+  if (!w.ip2_mov_w.empty()) costs.push_back(MovesLeftCost(w));
+  return costs;
+}
+
+double TotalFlops(const std::vector<LayerCost>& costs) {
+  double total = 0.0;
+  for (const auto& cost : costs) total += cost.flops;
+  return total;
+}
+
+std::vector<DeviceProfileEntry> LoadDeviceProfile(
+    const std::string& filename) {
+  std::ifstream file(filename);
+  if (!file) throw Exception("Unable to open device profile " + filename);
+  std::map<std::pair<std::string, int>, double> rates;
+  std::string line;
+  int line_number = 0;
+  while (std::getline(file, line)) {
+    ++line_number;
+    line = line.substr(0, line.find('#'));
+    std::istringstream iss(line);
+    DeviceProfileEntry entry;
+    if (!(iss >> entry.backend)) continue;
+    if (!(iss >> entry.batch_size >> entry.flops_per_second) ||
+        entry.batch_size <= 0 || entry.flops_per_second <= 0) {
+      throw Exception("Bad line " + std::to_string(line_number) +
+                      " in device profile " + filename);
+    }
+    rates[{entry.backend, entry.batch_size}] = entry.flops_per_second;
+  }
+  std::vector<DeviceProfileEntry> entries;
+  for (const auto& [key, rate] : rates) {
+    entries.push_back({key.first, key.second, rate});
+  }
+  return entries;
+}
+
+void AppendDeviceProfile(const std::string& filename,
+                         const std::vector<DeviceProfileEntry>& entries) {
+  std::ofstream file(filename, std::ios::app);
+  if (!file) throw Exception("Unable to write device profile " + filename);
+  for (const auto& entry : entries) {
+    file << entry.backend << ' ' << entry.batch_size << ' '
+         << entry.flops_per_second << '\n';
+  }
+}
+
+}  // namespace lczero
@@ -0,0 +1,69 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "proto/net.pb.h"
+
+namespace lczero {
+
+// Rough cost of evaluating one position with a network. Multiply-adds of the
+// matrix products count as two FLOPs, the elementwise work (activations,
+// normalizations, biases) is ignored.
+struct LayerCost {
+  std::string name;
+  // How many times the layer repeats, the costs are the total of all of them.
+  int count = 1;
+  double flops = 0.0;
+  // Number of values in the largest activation tensor of the layer.
+  double activations = 0.0;
+};
+
+// Returns empty vector if the network has no weights (e.g. ONNX only).
+std::vector<LayerCost> EstimateNetworkCost(const pblczero::Net& net);
+double TotalFlops(const std::vector<LayerCost>& costs);
+
+// Throughput of a backend at a batch size, as measured by backendbench. It is
+// kept in FLOP/s rather than nps, so that it carries over to other networks
+// of similar shape.
+struct DeviceProfileEntry {
+  std::string backend;
+  int batch_size = 0;
+  double flops_per_second = 0.0;
+};
+
+// The device profile is a text file of "<backend> <batch size> <FLOP/s>"
+// lines, '#' starts a comment. Later lines override earlier ones with the
+// same backend and batch size.
+std::vector<DeviceProfileEntry> LoadDeviceProfile(const std::string& filename);
+void AppendDeviceProfile(const std::string& filename,
+                         const std::vector<DeviceProfileEntry>& entries);
+
+}  // namespace lczero
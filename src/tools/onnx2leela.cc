@@ -32,6 +32,7 @@
 #include <set>
 
 #include "neural/onnx/onnx.pb.h"
+#include "neural/onnx/optimizer.h"
 #include "proto/net.pb.h"
 #include "tools/describenet.h"
 #include "utils/files.h"
@@ -102,6 +103,14 @@ const OptionId kFixRule50Id{
 const OptionId kFixWdlSoftmaxId{
     "fix-wdl-softmax", "",
     "Fix tensorflow exported onnx that is missing wdl output softmax."};
+const OptionId kOnnxOptimizeId{
+    "onnx-optimize", "",
+    "Simplify the ONNX graph: fold constants, drop Identity and Dropout nodes, "
+    "merge redundant Transposes and Reshapes."};
+const OptionId kOnnxBatchSizeId{
+    "onnx-batch-size", "",
+    "Fix the batch dimension of the ONNX inputs and outputs to this size, for "
+    "backends run with the same fixed batch size. 0 keeps it as it is."};
 
 bool ProcessParameters(OptionsParser* options) {
   using pblczero::NetworkFormat;
@@ -136,6 +145,8 @@ bool ProcessParameters(OptionsParser* options) {
   options->Add<BoolOption>(kValidateModelId) = true;
   options->Add<BoolOption>(kFixRule50Id) = false;
   options->Add<BoolOption>(kFixWdlSoftmaxId) = false;
+  options->Add<BoolOption>(kOnnxOptimizeId) = true;
+  options->Add<IntOption>(kOnnxBatchSizeId, 0, 2048) = 0;
 
   if (!options->ProcessAllFlags()) return false;
 
@@ -373,6 +384,26 @@ bool EnsureOutDataType(pblczero::ModelProto& model, const std::string& name,
   return true;
 }
 
+void FixBatchSize(pblczero::ModelProto& model, int batch_size) {
+  std::set<std::string> initializers;
+  for (const auto& tensor : model.graph().initializer()) {
+    initializers.emplace(tensor.name());
+  }
+  auto fix = [&](pblczero::ValueInfoProto* value) {
+    if (initializers.count(std::string(value->name())) ||
+        !value->type().tensor_type().has_shape() ||
+        value->type().tensor_type().shape().dim_size() == 0) {
+      return;
+    }
+    auto* shape = value->mutable_type()->mutable_tensor_type()->mutable_shape();
+    auto* dim = shape->mutable_dim(0);
+    dim->Clear();
+    dim->set_dim_value(batch_size);
+  };
+  for (auto& input : *model.mutable_graph()->mutable_input()) fix(&input);
+  for (auto& output : *model.mutable_graph()->mutable_output()) fix(&output);
+}
+
 bool MaybeFixOnnx(pblczero::ModelProto& model, const OptionsDict& dict,
                   pblczero::OnnxModel_DataType data_type) {
   bool updated = false;
@@ -412,6 +443,17 @@ bool MaybeFixOnnx(pblczero::ModelProto& model, const OptionsDict& dict,
                                  data_type);
   }
 
+  if (dict.Get<int>(kOnnxBatchSizeId) > 0) {
+    FixBatchSize(model, dict.Get<int>(kOnnxBatchSizeId));
+    updated = true;
+  }
+  // Runs last, so that the nodes inserted by the fixes above are simplified
+  // and sorted into place too.
+  if (dict.Get<bool>(kOnnxOptimizeId)) {
+    OptimizeOnnxGraph(model.mutable_graph());
+    updated = true;
+  }
+
   return updated;
 }
 
@@ -0,0 +1,320 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2026 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "tools/perftbench.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "chess/board.h"
+#include "utils/exception.h"
+#include "utils/optionsparser.h"
+#include "version.h"
+
+namespace lczero {
+namespace {
+const OptionId kFenId{"fen", "",
+                      "Perft initial position FEN. Empty runs the standard "
+                      "perft position suite."};
+const OptionId kDepthId{"depth", "",
+                        "Depth of the perft tree to count, 0 for the depth "
+                        "of the suite (5 with --fen)."};
+const OptionId kRepeatsId{"repeats", "",
+                          "Number of times to repeat the count."};
+const OptionId kThreadsId{"threads", "",
+                          "Threads of the multi-threaded runs, 0 for one per "
+                          "core. With 1 only the single-threaded run is done."};
+const OptionId kTimeId{"time", "",
+                       "Seconds to measure each of GenerateLegalMoves(), "
+                       "ApplyMove() and IsLegalMove() for."};
+const OptionId kJsonFileId{"json", "",
+                           "Writes the results as JSON to that file."};
+
+// The usual perft test positions with depths of a few million nodes.
+struct SuitePosition {
+  const char* fen;
+  int depth;
+};
+const SuitePosition kSuite[] = {
+    {ChessBoard::kStartposFen, 5},
+    {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 4},
+    {"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 6},
+    {"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 4},
+    {"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 4},
+    {"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+     4},
+};
+
+// The per function measurements use the boards of the first plies of the
+// tree.
+constexpr int kSampleDepth = 2;
+
+uint64_t Perft(const ChessBoard& board, int depth) {
+  const auto moves = board.GenerateLegalMoves();
+  // Leaves don't need to be applied, legal move count is enough.
+  if (depth == 1) return moves.size();
+  uint64_t total = 0;
+  for (const auto& move : moves) {
+    ChessBoard new_board = board;
+    new_board.ApplyMove(move);
+    new_board.Mirror();
+    total += Perft(new_board, depth - 1);
+  }
+  return total;
+}
+
+void CollectBoards(const ChessBoard& board, int depth,
+                   std::vector<ChessBoard>* boards) {
+  boards->push_back(board);
+  if (depth == 0) return;
+  for (const auto& move : board.GenerateLegalMoves()) {
+    ChessBoard new_board = board;
+    new_board.ApplyMove(move);
+    new_board.Mirror();
+    CollectBoards(new_board, depth - 1, boards);
+  }
+}
+
+// Keeps the compiler from dropping the measured calls.
+std::atomic<uint64_t> sink{0};
+
+// Runs @pass, which returns the number of operations it did, in a loop on
+// @threads threads. Every thread does at least @min_passes passes and
+// continues for @seconds. Returns the operations per second.
+template <typename Pass>
+double MeasureRate(int threads, int min_passes, double seconds,
+                   const Pass& pass) {
+  std::atomic<uint64_t> total_ops{0};
+  const auto start = std::chrono::steady_clock::now();
+  const auto deadline =
+      start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                  std::chrono::duration<double>(seconds));
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; ++i) {
+    workers.emplace_back([&]() {
+      uint64_t ops = 0;
+      for (int passes = 0;
+           passes < min_passes || std::chrono::steady_clock::now() < deadline;
+           ++passes) {
+        ops += pass();
+      }
+      total_ops += ops;
+    });
+  }
+  for (auto& worker : workers) worker.join();
+  const std::chrono::duration<double> time =
+      std::chrono::steady_clock::now() - start;
+  return total_ops / time.count();
+}
+
+struct RunResult {
+  int threads;
+  double perft_nps;
+  double generate_legal_moves_per_second;
+  double apply_move_per_second;
+  double is_legal_move_per_second;
+};
+
+struct PositionResult {
+  std::string fen;
+  int depth;
+  uint64_t perft_nodes;
+  std::vector<RunResult> runs;
+};
+
+PositionResult BenchmarkPosition(const std::string& fen, int depth,
+                                 int repeats, const std::vector<int>& threads,
+                                 double seconds) {
+  const ChessBoard root(fen);
+  PositionResult result{fen, depth, Perft(root, depth), {}};
+
+  std::vector<ChessBoard> boards;
+  CollectBoards(root, kSampleDepth, &boards);
+  std::vector<MoveList> legal_moves;
+  std::vector<MoveList> pseudolegal_moves;
+  std::vector<KingAttackInfo> king_attack_infos;
+  for (const auto& board : boards) {
+    legal_moves.push_back(board.GenerateLegalMoves());
+    pseudolegal_moves.push_back(board.GeneratePseudolegalMoves());
+    king_attack_infos.push_back(board.GenerateKingAttackInfo());
+  }
+
+  for (const int thread_count : threads) {
+    RunResult run{thread_count, 0.0, 0.0, 0.0, 0.0};
+    run.perft_nps = MeasureRate(thread_count, repeats, 0.0, [&]() {
+      return Perft(root, depth);
+    });
+    run.generate_legal_moves_per_second =
+        MeasureRate(thread_count, 1, seconds, [&]() {
+          uint64_t moves = 0;
+          for (const auto& board : boards) {
+            moves += board.GenerateLegalMoves().size();
+          }
+          sink += moves;
+          return boards.size();
+        });
+    // Includes the incremental update of the hash, which is folded in.
+    run.apply_move_per_second = MeasureRate(thread_count, 1, seconds, [&]() {
+      uint64_t ops = 0;
+      uint64_t hash = 0;
+      for (size_t i = 0; i < boards.size(); ++i) {
+        for (const auto& move : legal_moves[i]) {
+          ChessBoard new_board = boards[i];
+          new_board.ApplyMove(move);
+          new_board.Mirror();
+          hash ^= new_board.Hash();
+        }
+        ops += legal_moves[i].size();
+      }
+      sink += hash;
+      return ops;
+    });
+    run.is_legal_move_per_second =
+        MeasureRate(thread_count, 1, seconds, [&]() {
+          uint64_t ops = 0;
+          uint64_t legal = 0;
+          for (size_t i = 0; i < boards.size(); ++i) {
+            for (const auto& move : pseudolegal_moves[i]) {
+              legal += boards[i].IsLegalMove(move, king_attack_infos[i]);
+            }
+            ops += pseudolegal_moves[i].size();
+          }
+          sink += legal;
+          return ops;
+        });
+    result.runs.push_back(run);
+  }
+  return result;
+}
+
+void PrintResult(const PositionResult& result) {
+  std::cout << "Position: " << result.fen << std::endl;
+  std::cout << "  Perft depth " << result.depth << ": " << result.perft_nodes
+            << " nodes." << std::endl;
+  for (const auto& run : result.runs) {
+    std::cout << "  " << run.threads << " thread(s): perft "
+              << static_cast<uint64_t>(run.perft_nps)
+              << " nps, GenerateLegalMoves "
+              << static_cast<uint64_t>(run.generate_legal_moves_per_second)
+              << "/s, ApplyMove "
+              << static_cast<uint64_t>(run.apply_move_per_second)
+              << "/s, IsLegalMove "
+              << static_cast<uint64_t>(run.is_legal_move_per_second) << "/s."
+              << std::endl;
+  }
+}
+
+std::string JsonString(const std::string& str) {
+  std::string result = "\"";
+  for (char c : str) {
+    if (c == '"' || c == '\\') result += '\\';
+    result += c;
+  }
+  return result + "\"";
+}
+
+void WriteJson(std::ostream& os, const std::vector<PositionResult>& results) {
+  os << "{\n  \"version\": " << JsonString(GetVersionStr())
+     << ",\n  \"positions\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto& result = results[i];
+    os << (i ? "," : "") << "\n    {\"fen\": " << JsonString(result.fen)
+       << ", \"depth\": " << result.depth
+       << ", \"perft_nodes\": " << result.perft_nodes << ", \"runs\": [";
+    for (size_t j = 0; j < result.runs.size(); ++j) {
+      const auto& run = result.runs[j];
+      os << (j ? ", " : "") << "{\"threads\": " << run.threads
+         << ", \"perft_nps\": " << std::llround(run.perft_nps)
+         << ", \"generate_legal_moves_per_second\": "
+         << std::llround(run.generate_legal_moves_per_second)
+         << ", \"apply_move_per_second\": "
+         << std::llround(run.apply_move_per_second)
+         << ", \"is_legal_move_per_second\": "
+         << std::llround(run.is_legal_move_per_second) << "}";
+    }
+    os << "]}";
+  }
+  os << "\n  ]\n}\n";
+}
+}  // namespace
+
+void PerftBenchmark::Run() {
+  OptionsParser options;
+  options.Add<StringOption>(kFenId) = "";
+  options.Add<IntOption>(kDepthId, 0, 10) = 0;
+  options.Add<IntOption>(kRepeatsId, 1, 1000) = 3;
+  options.Add<IntOption>(kThreadsId, 0, 256) = 0;
+  options.Add<FloatOption>(kTimeId, 0.0f, 100.0f) = 1.0f;
+  options.Add<StringOption>(kJsonFileId);
+
+  if (!options.ProcessAllFlags()) return;
+
+  try {
+    auto option_dict = options.GetOptionsDict();
+    const std::string fen = option_dict.Get<std::string>(kFenId);
+    const int depth = option_dict.Get<int>(kDepthId);
+    const int repeats = option_dict.Get<int>(kRepeatsId);
+    const double seconds = option_dict.Get<float>(kTimeId);
+    int max_threads = option_dict.Get<int>(kThreadsId);
+    if (max_threads == 0) {
+      max_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::vector<int> threads = {1};
+    if (max_threads > 1) threads.push_back(max_threads);
+
+    std::vector<SuitePosition> positions;
+    if (fen.empty()) {
+      positions.assign(std::begin(kSuite), std::end(kSuite));
+    } else {
+      positions.push_back({fen.c_str(), 5});
+    }
+    std::vector<PositionResult> results;
+    for (const auto& position : positions) {
+      results.push_back(BenchmarkPosition(position.fen,
+                                          depth ? depth : position.depth,
+                                          repeats, threads, seconds));
+      PrintResult(results.back());
+    }
+
+    const std::string json_file = option_dict.Get<std::string>(kJsonFileId);
+    if (!json_file.empty()) {
+      std::ofstream file(json_file);
+      if (!file) throw Exception("Unable to open " + json_file);
+      WriteJson(file, results);
+    }
+  } catch (Exception& ex) {
+    std::cerr << ex.what() << std::endl;
+  }
+}
+
+}  // namespace lczero
@@ -0,0 +1,91 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "tools/positions.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "chess/pgn.h"
+#include "utils/exception.h"
+
+namespace lczero {
+namespace {
+// Positions the network sees in its history planes.
+constexpr int kHistoryLength = 8;
+}  // namespace
+
+void AddBenchPosition(const PositionHistory& history,
+                      std::vector<BenchPosition>* positions) {
+  auto legal_moves = history.Last().GetBoard().GenerateLegalMoves();
+  if (legal_moves.empty()) return;
+  const auto all = history.GetPositions();
+  const size_t length = std::min<size_t>(all.size(), kHistoryLength);
+  positions->push_back(
+      {{all.end() - length, all.end()},
+       std::vector<Move>(legal_moves.begin(), legal_moves.end())});
+}
+
+std::string EpdToFen(const std::string& line) {
+  // EPD has the first four FEN fields followed by operations.
+  std::istringstream fields(line);
+  std::string fen, field;
+  for (int i = 0; i < 4 && fields >> field; ++i) fen += field + " ";
+  return fen.empty() ? fen : fen + "0 1";
+}
+
+std::vector<BenchPosition> LoadBenchPositions(const std::string& filename) {
+  std::vector<BenchPosition> positions;
+  PositionHistory history;
+  if (filename.ends_with(".epd")) {
+    std::ifstream file(filename);
+    if (!file) throw Exception("Unable to open " + filename);
+    std::string line;
+    while (std::getline(file, line)) {
+      const std::string fen = EpdToFen(line);
+      if (fen.empty()) continue;
+      history.Reset(Position::FromFen(fen));
+      AddBenchPosition(history, &positions);
+    }
+  } else {
+    PgnStream games(filename);
+    while (const auto game = games.Next()) {
+      history.Reset(Position::FromFen(game->start_fen));
+      AddBenchPosition(history, &positions);
+      for (Move move : game->moves) {
+        if (history.IsBlackToMove()) move.Flip();
+        history.Append(move);
+        AddBenchPosition(history, &positions);
+      }
+    }
+  }
+  if (positions.empty()) throw Exception("No positions in " + filename);
+  return positions;
+}
+
+}  // namespace lczero
@@ -0,0 +1,55 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "chess/position.h"
+
+namespace lczero {
+
+// A position with the history and legal moves a backend is queried with.
+struct BenchPosition {
+  std::vector<Position> history;
+  std::vector<Move> legal_moves;
+};
+
+// Appends the last position of @history, unless it has no legal moves.
+void AddBenchPosition(const PositionHistory& history,
+                      std::vector<BenchPosition>* positions);
+
+// Returns the FEN of the position of an EPD line: its first four fields, with
+// zero halfmove clock and move number one. Empty if the line has no fields.
+std::string EpdToFen(const std::string& line);
+
+// Loads all positions of the games in a PGN file, or of an EPD file (by .epd
+// extension). Throws if there are none.
+std::vector<BenchPosition> LoadBenchPositions(const std::string& filename);
+
+}  // namespace lczero
@@ -0,0 +1,154 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "trainingdata/async_writer.h"
+
+#include <iomanip>
+#include <sstream>
+
+#include "trainingdata/writer.h"
+#include "utils/exception.h"
+#include "utils/logging.h"
+
+namespace lczero {
+
+AsyncTrainingDataWriter::AsyncTrainingDataWriter(size_t games_per_file,
+                                                 size_t queue_size,
+                                                 RecordPacking packing,
+                                                 std::string directory)
+    : games_per_file_(std::max<size_t>(games_per_file, 1)),
+      queue_size_(std::max<size_t>(queue_size, 1)),
+      packing_(packing),
+      directory_(std::move(directory)) {
+  thread_ = std::thread([this]() { Worker(); });
+}
+
+AsyncTrainingDataWriter::~AsyncTrainingDataWriter() {
+  try {
+    Close();
+  } catch (const std::exception& e) {
+    CERR << "Failed to write training data: " << e.what();
+  }
+}
+
+void AsyncTrainingDataWriter::RethrowError() {
+  if (!error_) return;
+  auto error = error_;
+  error_ = nullptr;
+  std::rethrow_exception(error);
+}
+
+void AsyncTrainingDataWriter::Submit(int game_id,
+                                     std::vector<V6TrainingData> chunks,
+                                     Callback done) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [&]() { return closed_ || queue_.size() < queue_size_; });
+  RethrowError();
+  if (closed_) throw Exception("Training data writer is closed.");
+  queue_.push_back({game_id, std::move(chunks), std::move(done)});
+  cv_.notify_all();
+}
+
+void AsyncTrainingDataWriter::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    cv_.notify_all();
+  }
+  if (thread_.joinable()) thread_.join();
+  std::lock_guard<std::mutex> lock(mutex_);
+  RethrowError();
+}
+
+void AsyncTrainingDataWriter::Worker() {
+  while (true) {
+    Game game;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [&]() { return closed_ || !queue_.empty(); });
+      if (queue_.empty()) break;
+      game = std::move(queue_.front());
+      queue_.pop_front();
+      // Wakes up a game thread waiting for room in the queue.
+      cv_.notify_all();
+    }
+    try {
+      Write(game);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!error_) error_ = std::current_exception();
+    }
+  }
+  try {
+    FinishFile();
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!error_) error_ = std::current_exception();
+  }
+}
+
+std::string AsyncTrainingDataWriter::MakeFileName(const char* prefix,
+                                                  int game_id,
+                                                  const char* extension) const {
+  std::ostringstream oss;
+  oss << (directory_.empty() ? TrainingDataWriter::GetDataDirectory()
+                             : directory_)
+      << '/' << prefix << std::setfill('0') << std::setw(6) << game_id
+      << extension;
+  return oss.str();
+}
+
+void AsyncTrainingDataWriter::Write(Game& game) {
+  if (games_per_file_ == 1) {
+    TrainingDataWriter writer(MakeFileName("game_", game.game_id, ".gz"));
+    for (const auto& chunk : game.chunks) writer.WriteChunk(chunk);
+    writer.Finalize();
+    game.done(writer.GetFileName());
+    return;
+  }
+  if (!container_) {
+    container_ = std::make_unique<TrainingDataContainerWriter>(
+        MakeFileName("games_", game.game_id, ".lcz"),
+        TrainingDataContainerWriter::kDefaultBlockChunks, packing_);
+  }
+  container_->WriteGame(game.chunks);
+  file_callbacks_.push_back(std::move(game.done));
+  if (file_callbacks_.size() == games_per_file_) FinishFile();
+}
+
+void AsyncTrainingDataWriter::FinishFile() {
+  if (!container_) return;
+  auto callbacks = std::move(file_callbacks_);
+  file_callbacks_.clear();
+  std::string filename = container_->GetFileName();
+  container_->Finalize();
+  container_.reset();
+  for (size_t i = 0; i + 1 < callbacks.size(); i++) callbacks[i]("");
+  if (!callbacks.empty()) callbacks.back()(filename);
+}
+
+}  // namespace lczero
@@ -0,0 +1,106 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "trainingdata/container.h"
+#include "trainingdata/trainingdata.h"
+
+namespace lczero {
+
+// Writes training data of finished games on a background thread, so that game
+// threads only pay for handing over the chunks. With one game per file every
+// game goes into its own gzip file as with TrainingDataWriter, otherwise
+// games are grouped into block containers.
+class AsyncTrainingDataWriter {
+ public:
+  // Called on the writer thread once the game has been written. Receives the
+  // name of the file if this game completed it, and an empty string if the
+  // file still has room for more games.
+  using Callback = std::function<void(const std::string& filename)>;
+
+  // At most @queue_size games wait to be written; Submit() blocks beyond
+  // that. Containers store records as @packing says. Files go to
+  // @directory, or to TrainingDataWriter::GetDataDirectory() if it's empty.
+  AsyncTrainingDataWriter(size_t games_per_file, size_t queue_size,
+                          RecordPacking packing = RecordPacking::kNone,
+                          std::string directory = {});
+  ~AsyncTrainingDataWriter();
+
+  // Queues a game for writing. Rethrows the first error hit on the writer
+  // thread, if any.
+  void Submit(int game_id, std::vector<V6TrainingData> chunks, Callback done);
+
+  // Writes out everything queued, closes the current file and stops the
+  // writer thread. Idempotent.
+  void Close();
+
+ private:
+  struct Game {
+    int game_id;
+    std::vector<V6TrainingData> chunks;
+    Callback done;
+  };
+
+  void Worker();
+  void Write(Game& game);
+  // Closes the current container and runs callbacks of the games in it.
+  void FinishFile();
+  void RethrowError();
+  // Name of a new file for @game_id in the output directory.
+  std::string MakeFileName(const char* prefix, int game_id,
+                           const char* extension) const;
+
+  const size_t games_per_file_;
+  const size_t queue_size_;
+  const RecordPacking packing_;
+  const std::string directory_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Game> queue_;
+  bool closed_ = false;
+  std::exception_ptr error_;
+
+  // Only touched by the writer thread.
+  std::unique_ptr<TrainingDataContainerWriter> container_;
+  std::vector<Callback> file_callbacks_;
+
+  std::thread thread_;
+};
+
+}  // namespace lczero
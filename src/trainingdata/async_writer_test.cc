@@ -0,0 +1,134 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2026 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "trainingdata/async_writer.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+
+#include "trainingdata/reader.h"
+
+namespace lczero {
+namespace {
+
+std::vector<V6TrainingData> MakeGame(int game_id) {
+  std::vector<V6TrainingData> chunks(1 + game_id * 7);
+  for (size_t i = 0; i < chunks.size(); i++) {
+    std::memset(&chunks[i], 0, sizeof(chunks[i]));
+    chunks[i].version = 6;
+    chunks[i].plies_left = i;
+    chunks[i].played_idx = game_id;
+  }
+  return chunks;
+}
+
+// Writes into a fresh temporary directory, which is removed afterwards.
+class AsyncWriterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = (std::filesystem::temp_directory_path() /
+                  ("lc0_async_writer_test_" +
+                   std::to_string(reinterpret_cast<uintptr_t>(this))))
+                     .string();
+    std::filesystem::create_directories(directory_);
+  }
+  void TearDown() override { std::filesystem::remove_all(directory_); }
+
+  // Writes @count games and returns the file names passed to the callbacks
+  // in game order.
+  std::vector<std::string> WriteGames(size_t games_per_file, int count) {
+    std::vector<std::string> filenames(count);
+    std::mutex mutex;
+    AsyncTrainingDataWriter writer(games_per_file, 2, RecordPacking::kNone,
+                                   directory_);
+    for (int g = 0; g < count; g++) {
+      writer.Submit(g, MakeGame(g), [&, g](const std::string& filename) {
+        std::lock_guard<std::mutex> lock(mutex);
+        filenames[g] = filename;
+      });
+    }
+    writer.Close();
+    return filenames;
+  }
+
+  size_t CountFiles() const {
+    return std::distance(std::filesystem::directory_iterator(directory_),
+                         std::filesystem::directory_iterator());
+  }
+
+  std::string directory_;
+};
+
+}  // namespace
+
+TEST_F(AsyncWriterTest, OneGamePerFile) {
+  const auto filenames = WriteGames(1, 3);
+  EXPECT_EQ(CountFiles(), 3u);
+  for (int g = 0; g < 3; g++) {
+    ASSERT_EQ(std::filesystem::path(filenames[g]).parent_path(), directory_);
+    TrainingDataReader reader(filenames[g]);
+    V6TrainingData chunk;
+    size_t count = 0;
+    while (reader.ReadChunk(&chunk)) {
+      EXPECT_EQ(chunk.played_idx, g);
+      count++;
+    }
+    EXPECT_EQ(count, MakeGame(g).size());
+  }
+}
+
+TEST_F(AsyncWriterTest, GroupsGamesIntoContainers) {
+  // The last game of each file gets its name, the file of the last two games
+  // is only completed by Close().
+  const auto filenames = WriteGames(3, 5);
+  EXPECT_EQ(CountFiles(), 2u);
+  EXPECT_EQ(filenames[0], "");
+  EXPECT_EQ(filenames[1], "");
+  EXPECT_EQ(filenames[3], "");
+  ASSERT_NE(filenames[2], "");
+  ASSERT_NE(filenames[4], "");
+  size_t chunks = 0;
+  for (const int g : {2, 4}) {
+    EXPECT_EQ(std::filesystem::path(filenames[g]).parent_path(), directory_);
+    TrainingDataReader reader(filenames[g]);
+    V6TrainingData chunk;
+    while (reader.ReadChunk(&chunk)) chunks++;
+  }
+  size_t expected = 0;
+  for (int g = 0; g < 5; g++) expected += MakeGame(g).size();
+  EXPECT_EQ(chunks, expected);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,382 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "trainingdata/container.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <string_view>
+#include <thread>
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "trainingdata/trainingdata.h"
+#include "utils/exception.h"
+#include "utils/logging.h"
+
+namespace lczero {
+namespace {
+
+constexpr char kMagic[8] = {'L', 'C', '0', 'C', 'H', 'U', 'N', 'K'};
+constexpr uint32_t kVersion = 1;
+
+enum Codec : uint32_t { kCodecDeflate = 1, kCodecZstd = 2 };
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t chunk_size;
+};
+static_assert(sizeof(Header) == 16);
+
+struct Footer {
+  uint64_t index_offset;
+  uint32_t blocks;
+  uint32_t games;
+  char magic[8];
+};
+static_assert(sizeof(Footer) == 24);
+
+std::string Compress(const void* data, size_t size, uint32_t* codec) {
+  std::string out;
+#ifdef USE_ZSTD
+  out.resize(ZSTD_compressBound(size));
+  size_t res = ZSTD_compress(out.data(), out.size(), data, size, 3);
+  if (ZSTD_isError(res)) {
+    throw Exception(std::string("zstd compression failed: ") +
+                    ZSTD_getErrorName(res));
+  }
+  out.resize(res);
+  *codec = kCodecZstd;
+#else
+  uLongf out_size = compressBound(size);
+  out.resize(out_size);
+  if (compress2(reinterpret_cast<Bytef*>(out.data()), &out_size,
+                static_cast<const Bytef*>(data), size,
+                Z_BEST_SPEED) != Z_OK) {
+    throw Exception("deflate compression failed");
+  }
+  out.resize(out_size);
+  *codec = kCodecDeflate;
+#endif
+  return out;
+}
+
+void Decompress(uint32_t codec, std::string_view in, void* out,
+                size_t out_size) {
+  switch (codec) {
+    case kCodecDeflate: {
+      uLongf size = out_size;
+      if (uncompress(static_cast<Bytef*>(out), &size,
+                     reinterpret_cast<const Bytef*>(in.data()),
+                     in.size()) != Z_OK ||
+          size != out_size) {
+        throw Exception("Corrupt deflate block.");
+      }
+      return;
+    }
+    case kCodecZstd: {
+#ifdef USE_ZSTD
+      size_t res = ZSTD_decompress(out, out_size, in.data(), in.size());
+      if (ZSTD_isError(res) || res != out_size) {
+        throw Exception("Corrupt zstd block.");
+      }
+      return;
+#else
+      throw Exception("Training data block is zstd compressed, but lc0 was "
+                      "built without zstd support.");
+#endif
+    }
+    default:
+      throw Exception("Unknown training data block codec " +
+                      std::to_string(codec));
+  }
+}
+
+}  // namespace
+
+TrainingDataContainerWriter::TrainingDataContainerWriter(std::string filename,
+                                                         size_t block_chunks,
+                                                         RecordPacking packing)
+    : filename_(filename),
+      block_chunks_(std::max<size_t>(block_chunks, 1)),
+      packing_(packing) {
+  fout_.open(filename_, std::ios::binary | std::ios::trunc);
+  if (!fout_) throw Exception("Cannot create training data file " + filename_);
+  Header header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.chunk_size = sizeof(V6TrainingData);
+  fout_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  offset_ = sizeof(header);
+  pending_.reserve(block_chunks_);
+}
+
+TrainingDataContainerWriter::~TrainingDataContainerWriter() {
+  if (!fout_.is_open()) return;
+  try {
+    Finalize();
+  } catch (const std::exception& e) {
+    CERR << e.what();
+  }
+}
+
+void TrainingDataContainerWriter::WriteGame(
+    std::span<const V6TrainingData> chunks) {
+  if (chunks.empty()) return;
+  game_starts_.push_back(total_chunks_);
+  pending_.insert(pending_.end(), chunks.begin(), chunks.end());
+  total_chunks_ += chunks.size();
+  if (pending_.size() >= block_chunks_) FlushBlock();
+}
+
+void TrainingDataContainerWriter::FlushBlock() {
+  if (pending_.empty()) return;
+  TrainingDataContainerBlock block;
+  std::string compressed;
+  if (packing_ == RecordPacking::kNone) {
+    const size_t size = pending_.size() * sizeof(V6TrainingData);
+    compressed = Compress(pending_.data(), size, &block.codec);
+    block.crc =
+        crc32(0L, reinterpret_cast<const Bytef*>(pending_.data()), size);
+  } else {
+    // Packed records vary in size, so the payload size goes in front.
+    std::string payload;
+    for (const auto& chunk : pending_) {
+      PackTrainingData(chunk, packing_, &payload);
+    }
+    const uint32_t size = payload.size();
+    compressed.assign(reinterpret_cast<const char*>(&size), sizeof(size));
+    compressed += Compress(payload.data(), size, &block.codec);
+    block.codec |= static_cast<uint32_t>(packing_) << 8;
+    block.crc = crc32(0L, reinterpret_cast<const Bytef*>(payload.data()), size);
+  }
+  block.offset = offset_;
+  block.compressed_size = compressed.size();
+  block.chunks = pending_.size();
+  fout_.write(compressed.data(), compressed.size());
+  if (!fout_) throw Exception("Unable to write into " + filename_);
+  offset_ += compressed.size();
+  blocks_.push_back(block);
+  pending_.clear();
+}
+
+void TrainingDataContainerWriter::Finalize() {
+  FlushBlock();
+  Footer footer;
+  footer.index_offset = offset_;
+  footer.blocks = blocks_.size();
+  footer.games = game_starts_.size();
+  std::memcpy(footer.magic, kMagic, sizeof(kMagic));
+  fout_.write(reinterpret_cast<const char*>(blocks_.data()),
+              blocks_.size() * sizeof(blocks_[0]));
+  fout_.write(reinterpret_cast<const char*>(game_starts_.data()),
+              game_starts_.size() * sizeof(game_starts_[0]));
+  fout_.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+  fout_.close();
+  if (!fout_) throw Exception("Unable to write into " + filename_);
+}
+
+bool TrainingDataContainerReader::IsContainer(const std::string& filename) {
+  std::ifstream f(filename, std::ios::binary);
+  char magic[sizeof(kMagic)];
+  if (!f.read(magic, sizeof(magic))) return false;
+  return std::memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+TrainingDataContainerReader::TrainingDataContainerReader(std::string filename)
+    : filename_(filename) {
+  Mutex::Lock lock(file_mutex_);
+  fin_.open(filename_, std::ios::binary);
+  if (!fin_) throw Exception("Cannot open training data file " + filename_);
+  Header header;
+  if (!fin_.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+    throw Exception("Not a training data container: " + filename_);
+  }
+  if (header.version != kVersion ||
+      header.chunk_size != sizeof(V6TrainingData)) {
+    throw Exception("Unsupported training data container version in " +
+                    filename_);
+  }
+  fin_.seekg(0, std::ios::end);
+  const uint64_t file_size = fin_.tellg();
+  Footer footer;
+  if (file_size < sizeof(header) + sizeof(footer) ||
+      !fin_.seekg(file_size - sizeof(footer)) ||
+      !fin_.read(reinterpret_cast<char*>(&footer), sizeof(footer)) ||
+      std::memcmp(footer.magic, kMagic, sizeof(kMagic)) != 0) {
+    throw Exception("Truncated training data container " + filename_);
+  }
+  const uint64_t index_size = uint64_t{footer.blocks} * sizeof(blocks_[0]) +
+                              uint64_t{footer.games} * sizeof(uint32_t);
+  if (footer.index_offset < sizeof(header) ||
+      footer.index_offset + index_size + sizeof(footer) != file_size) {
+    throw Exception("Corrupt index in training data container " + filename_);
+  }
+  blocks_.resize(footer.blocks);
+  game_starts_.resize(footer.games);
+  fin_.seekg(footer.index_offset);
+  fin_.read(reinterpret_cast<char*>(blocks_.data()),
+            blocks_.size() * sizeof(blocks_[0]));
+  fin_.read(reinterpret_cast<char*>(game_starts_.data()),
+            game_starts_.size() * sizeof(game_starts_[0]));
+  if (!fin_) throw Exception("Cannot read index of " + filename_);
+
+  block_starts_.reserve(blocks_.size() + 1);
+  for (const auto& block : blocks_) {
+    if (block.offset < sizeof(header) ||
+        block.offset + block.compressed_size > footer.index_offset) {
+      throw Exception("Corrupt index in training data container " +
+                      filename_);
+    }
+    block_starts_.push_back(total_chunks_);
+    total_chunks_ += block.chunks;
+  }
+  block_starts_.push_back(total_chunks_);
+  if (!std::is_sorted(game_starts_.begin(), game_starts_.end()) ||
+      (!game_starts_.empty() && game_starts_.back() >= total_chunks_)) {
+    throw Exception("Corrupt index in training data container " + filename_);
+  }
+}
+
+TrainingDataContainerReader::~TrainingDataContainerReader() = default;
+
+void TrainingDataContainerReader::DecodeBlock(size_t block,
+                                              V6TrainingData* out) {
+  const auto& info = blocks_.at(block);
+  std::string compressed(info.compressed_size, '\0');
+  {
+    Mutex::Lock lock(file_mutex_);
+    fin_.seekg(info.offset);
+    fin_.read(compressed.data(), compressed.size());
+    if (!fin_) {
+      fin_.clear();
+      throw Exception("Cannot read block from " + filename_);
+    }
+  }
+  const uint32_t codec = info.codec & 0xff;
+  if ((info.codec >> 8) == static_cast<uint32_t>(RecordPacking::kNone)) {
+    const size_t size = info.chunks * sizeof(V6TrainingData);
+    Decompress(codec, compressed, out, size);
+    if (crc32(0L, reinterpret_cast<const Bytef*>(out), size) != info.crc) {
+      throw Exception("Checksum mismatch in " + filename_);
+    }
+    return;
+  }
+  uint32_t size;
+  if (compressed.size() < sizeof(size)) {
+    throw Exception("Corrupt block in " + filename_);
+  }
+  std::memcpy(&size, compressed.data(), sizeof(size));
+  std::string payload(size, '\0');
+  Decompress(codec, std::string_view(compressed).substr(sizeof(size)),
+             payload.data(), size);
+  if (crc32(0L, reinterpret_cast<const Bytef*>(payload.data()), size) !=
+      info.crc) {
+    throw Exception("Checksum mismatch in " + filename_);
+  }
+  std::string_view rest = payload;
+  for (uint32_t i = 0; i < info.chunks; i++) {
+    rest.remove_prefix(UnpackTrainingData(rest, out + i));
+  }
+  if (!rest.empty()) throw Exception("Corrupt block in " + filename_);
+}
+
+std::vector<V6TrainingData> TrainingDataContainerReader::ReadBlock(
+    size_t block) {
+  std::vector<V6TrainingData> result(blocks_.at(block).chunks);
+  DecodeBlock(block, result.data());
+  return result;
+}
+
+std::vector<V6TrainingData> TrainingDataContainerReader::ReadBlocks(
+    size_t first, size_t count, int threads) {
+  if (first + count > blocks_.size()) {
+    throw Exception("Block range out of bounds in " + filename_);
+  }
+  const uint32_t base = block_starts_[first];
+  std::vector<V6TrainingData> result(block_starts_[first + count] - base);
+  std::atomic<size_t> next{first};
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  auto worker = [&]() {
+    for (size_t i = next++; i < first + count; i = next++) {
+      try {
+        DecodeBlock(i, result.data() + (block_starts_[i] - base));
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) error = std::current_exception();
+        next = first + count;
+      }
+    }
+  };
+  const size_t thread_count =
+      std::clamp<size_t>(threads, 1, std::max<size_t>(count, 1));
+  std::vector<std::thread> pool;
+  for (size_t i = 1; i < thread_count; i++) pool.emplace_back(worker);
+  worker();
+  for (auto& thread : pool) thread.join();
+  if (error) std::rethrow_exception(error);
+  return result;
+}
+
+std::vector<V6TrainingData> TrainingDataContainerReader::ReadGame(
+    size_t game) {
+  const uint32_t begin = game_starts_.at(game);
+  const uint32_t end =
+      game + 1 < game_starts_.size() ? game_starts_[game + 1] : total_chunks_;
+  std::vector<V6TrainingData> result;
+  result.reserve(end - begin);
+  // Last block whose first record is not after the start of the game.
+  size_t block = std::upper_bound(block_starts_.begin(),
+                                  block_starts_.end() - 1, begin) -
+                 block_starts_.begin() - 1;
+  Mutex::Lock lock(cache_mutex_);
+  for (; result.size() < end - begin; block++) {
+    if (cached_block_ != block) {
+      cached_chunks_.resize(blocks_[block].chunks);
+      cached_block_ = SIZE_MAX;
+      DecodeBlock(block, cached_chunks_.data());
+      cached_block_ = block;
+    }
+    const uint32_t from = std::max(begin, block_starts_[block]);
+    const uint32_t to = std::min(end, block_starts_[block + 1]);
+    result.insert(result.end(),
+                  cached_chunks_.begin() + (from - block_starts_[block]),
+                  cached_chunks_.begin() + (to - block_starts_[block]));
+  }
+  return result;
+}
+
+}  // namespace lczero
@@ -0,0 +1,147 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "trainingdata/packed.h"
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// Container holding many games of V6TrainingData in one file. Records,
+// optionally packed (see packed.h), are grouped into independently
+// compressed blocks (zstd when built with it, deflate otherwise), and a
+// trailing index locates every block and game, so that any game can be read
+// without decompressing the rest of the file and blocks can be decoded in
+// parallel.
+//
+// Layout: header, compressed blocks, block index, game index, footer.
+// Games never start in the middle of a block; a block normally holds several
+// whole games, but a long game may span more than one block.
+
+// Block index entry, stored as is in the file.
+struct TrainingDataContainerBlock {
+  uint64_t offset;
+  uint32_t compressed_size;
+  uint32_t chunks;
+  // Compression codec in the low byte, RecordPacking in the next one.
+  uint32_t codec;
+  // crc32 of the uncompressed block payload.
+  uint32_t crc;
+};
+static_assert(sizeof(TrainingDataContainerBlock) == 24);
+
+class TrainingDataContainerWriter {
+ public:
+  static constexpr size_t kDefaultBlockChunks = 256;
+
+  // Creates the file. Blocks are flushed once they reach @block_chunks
+  // records at a game boundary. Records are stored packed as @packing says.
+  TrainingDataContainerWriter(std::string filename,
+                              size_t block_chunks = kDefaultBlockChunks,
+                              RecordPacking packing = RecordPacking::kNone);
+
+  ~TrainingDataContainerWriter();
+
+  // Appends all chunks of one game.
+  void WriteGame(std::span<const V6TrainingData> chunks);
+
+  // Flushes the last block, writes the index and closes the file.
+  void Finalize();
+
+  // Gets full filename of the file written.
+  std::string GetFileName() const { return filename_; }
+
+ private:
+  void FlushBlock();
+
+  std::string filename_;
+  std::ofstream fout_;
+  size_t block_chunks_;
+  RecordPacking packing_;
+  uint64_t offset_ = 0;
+  uint32_t total_chunks_ = 0;
+  std::vector<V6TrainingData> pending_;
+  std::vector<TrainingDataContainerBlock> blocks_;
+  std::vector<uint32_t> game_starts_;
+};
+
+class TrainingDataContainerReader {
+ public:
+  // Opens the container and loads its index.
+  TrainingDataContainerReader(std::string filename);
+  ~TrainingDataContainerReader();
+
+  // Returns whether the file starts with the container magic. Anything else
+  // is expected to be a gzipped stream of records.
+  static bool IsContainer(const std::string& filename);
+
+  size_t GetGameCount() const { return game_starts_.size(); }
+  size_t GetBlockCount() const { return blocks_.size(); }
+  size_t GetChunkCount() const { return total_chunks_; }
+
+  // Decodes one block. Safe to call from several threads; only the file
+  // read is serialized.
+  std::vector<V6TrainingData> ReadBlock(size_t block);
+
+  // Decodes blocks [@first, @first + @count) using up to @threads threads
+  // and returns their records in file order.
+  std::vector<V6TrainingData> ReadBlocks(size_t first, size_t count,
+                                         int threads);
+
+  // Returns all chunks of one game. The last decoded block is cached, so
+  // reading games in order decompresses each block once.
+  std::vector<V6TrainingData> ReadGame(size_t game);
+
+  // Gets full filename of the file being read.
+  std::string GetFileName() const { return filename_; }
+
+ private:
+  // Decodes @block into @out, which must have room for all its chunks.
+  void DecodeBlock(size_t block, V6TrainingData* out);
+
+  std::string filename_;
+  Mutex file_mutex_;
+  std::ifstream fin_ GUARDED_BY(file_mutex_);
+  std::vector<TrainingDataContainerBlock> blocks_;
+  // Index of the first record of each block, plus the total at the end.
+  std::vector<uint32_t> block_starts_;
+  std::vector<uint32_t> game_starts_;
+  uint32_t total_chunks_ = 0;
+
+  Mutex cache_mutex_;
+  size_t cached_block_ GUARDED_BY(cache_mutex_) = SIZE_MAX;
+  std::vector<V6TrainingData> cached_chunks_ GUARDED_BY(cache_mutex_);
+};
+
+}  // namespace lczero
@@ -0,0 +1,181 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "trainingdata/container.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+
+#include "trainingdata/reader.h"
+#include "trainingdata/trainingdata.h"
+
+namespace lczero {
+namespace {
+
+std::vector<std::vector<V6TrainingData>> MakeGames(int count) {
+  std::vector<std::vector<V6TrainingData>> games(count);
+  for (int g = 0; g < count; g++) {
+    games[g].resize(1 + (g * 37) % 300);
+    for (size_t i = 0; i < games[g].size(); i++) {
+      auto& chunk = games[g][i];
+      std::memset(&chunk, 0, sizeof(chunk));
+      chunk.version = 6;
+      chunk.plies_left = i;
+      std::fill(std::begin(chunk.probabilities),
+                std::end(chunk.probabilities), -1.0f);
+      for (int m = 0; m < 30; m++) {
+        chunk.probabilities[(g + i + m * 61) % 1858] = (m + 1) / 465.0f;
+      }
+      chunk.played_idx = g;
+      chunk.planes[i % 104] = 0x0123456789abcdefULL + i;
+    }
+  }
+  return games;
+}
+
+// Chunks are compared bitwise, except that with fp16 packing the
+// probabilities only have to be close.
+bool SameChunk(const V6TrainingData& a, const V6TrainingData& b,
+               RecordPacking packing = RecordPacking::kNone) {
+  if (packing != RecordPacking::kSparseHalf) {
+    return std::memcmp(&a, &b, sizeof(a)) == 0;
+  }
+  for (size_t i = 0; i < std::size(a.probabilities); i++) {
+    if (std::abs(a.probabilities[i] - b.probabilities[i]) >
+        1e-3f * std::abs(b.probabilities[i])) {
+      return false;
+    }
+  }
+  constexpr size_t kTail = offsetof(V6TrainingData, planes);
+  return a.version == b.version && a.input_format == b.input_format &&
+         std::memcmp(reinterpret_cast<const char*>(&a) + kTail,
+                     reinterpret_cast<const char*>(&b) + kTail,
+                     sizeof(a) - kTail) == 0;
+}
+
+class ContainerTest : public ::testing::TestWithParam<RecordPacking> {
+ protected:
+  void SetUp() override {
+    filename_ = (std::filesystem::temp_directory_path() /
+                 ("lc0_container_test_" +
+                  std::to_string(reinterpret_cast<uintptr_t>(this))))
+                    .string();
+    games_ = MakeGames(50);
+    TrainingDataContainerWriter writer(filename_, 100, GetParam());
+    for (const auto& game : games_) writer.WriteGame(game);
+  }
+  void TearDown() override { std::filesystem::remove(filename_); }
+
+  std::string filename_;
+  std::vector<std::vector<V6TrainingData>> games_;
+};
+
+}  // namespace
+
+TEST_P(ContainerTest, RandomAccessGames) {
+  ASSERT_TRUE(TrainingDataContainerReader::IsContainer(filename_));
+  TrainingDataContainerReader reader(filename_);
+  ASSERT_EQ(reader.GetGameCount(), games_.size());
+  for (size_t g = games_.size(); g-- > 0;) {
+    auto chunks = reader.ReadGame(g);
+    ASSERT_EQ(chunks.size(), games_[g].size());
+    for (size_t i = 0; i < chunks.size(); i++) {
+      EXPECT_TRUE(SameChunk(chunks[i], games_[g][i], GetParam()));
+    }
+  }
+}
+
+TEST_P(ContainerTest, ParallelDecodeKeepsOrder) {
+  TrainingDataContainerReader reader(filename_);
+  EXPECT_GT(reader.GetBlockCount(), 1u);
+  auto chunks = reader.ReadBlocks(0, reader.GetBlockCount(), 4);
+  ASSERT_EQ(chunks.size(), reader.GetChunkCount());
+  size_t i = 0;
+  for (const auto& game : games_) {
+    for (const auto& chunk : game) EXPECT_TRUE(SameChunk(chunks[i++], chunk, GetParam()));
+  }
+}
+
+TEST_P(ContainerTest, TrainingDataReaderReadsContainer) {
+  TrainingDataReader reader(filename_);
+  V6TrainingData chunk;
+  size_t count = 0;
+  for (const auto& game : games_) {
+    for (const auto& expected : game) {
+      ASSERT_TRUE(reader.ReadChunk(&chunk));
+      EXPECT_TRUE(SameChunk(chunk, expected, GetParam()));
+      count++;
+    }
+  }
+  EXPECT_FALSE(reader.ReadChunk(&chunk));
+  EXPECT_GT(count, 0u);
+}
+
+TEST_P(ContainerTest, GzipIsNotContainer) {
+  const std::string gz_name = filename_ + ".gz";
+  {
+    TrainingDataWriter writer(gz_name);
+    for (const auto& chunk : games_[3]) writer.WriteChunk(chunk);
+  }
+  EXPECT_FALSE(TrainingDataContainerReader::IsContainer(gz_name));
+  TrainingDataReader reader(gz_name);
+  V6TrainingData chunk;
+  for (const auto& expected : games_[3]) {
+    ASSERT_TRUE(reader.ReadChunk(&chunk));
+    EXPECT_TRUE(SameChunk(chunk, expected));
+  }
+  EXPECT_FALSE(reader.ReadChunk(&chunk));
+  std::filesystem::remove(gz_name);
+}
+
+TEST(PackedTrainingData, SparseRoundTripIsLossless) {
+  const auto games = MakeGames(3);
+  for (const auto& chunk : games[2]) {
+    std::string packed;
+    PackTrainingData(chunk, RecordPacking::kSparse, &packed);
+    EXPECT_LT(packed.size() * 5, sizeof(V6TrainingData));
+    V6TrainingData unpacked;
+    EXPECT_EQ(UnpackTrainingData(packed, &unpacked), packed.size());
+    EXPECT_TRUE(SameChunk(unpacked, chunk));
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(Packings, ContainerTest,
+                         ::testing::Values(RecordPacking::kNone,
+                                           RecordPacking::kSparse,
+                                           RecordPacking::kSparseHalf));
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
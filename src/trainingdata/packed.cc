@@ -0,0 +1,148 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "trainingdata/packed.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+
+#include "utils/exception.h"
+#include "utils/fp16_utils.h"
+
+namespace lczero {
+namespace {
+
+constexpr uint32_t kPackedVersion = 7;
+constexpr size_t kPolicySize = std::size(V6TrainingData{}.probabilities);
+// Fields from planes to the end of the record are copied verbatim.
+constexpr size_t kTailOffset = offsetof(V6TrainingData, planes);
+constexpr size_t kTailSize = sizeof(V6TrainingData) - kTailOffset;
+
+struct PackedHeader {
+  uint32_t version;
+  uint32_t input_format;
+  uint16_t flags;
+  uint16_t count;
+};
+static_assert(sizeof(PackedHeader) == 12);
+
+constexpr uint16_t kHalfFlag = 1;
+
+bool IsIllegal(float p) {
+  constexpr float kIllegal = -1.0f;
+  // Bitwise, so that -0.0 and NaNs survive the round trip.
+  return std::memcmp(&p, &kIllegal, sizeof(p)) == 0;
+}
+
+}  // namespace
+
+void PackTrainingData(const V6TrainingData& chunk, RecordPacking packing,
+                      std::string* out) {
+  if (packing == RecordPacking::kNone) {
+    out->append(reinterpret_cast<const char*>(&chunk), sizeof(chunk));
+    return;
+  }
+  const bool half = packing == RecordPacking::kSparseHalf;
+  uint16_t indices[kPolicySize];
+  uint16_t count = 0;
+  for (size_t i = 0; i < kPolicySize; i++) {
+    if (!IsIllegal(chunk.probabilities[i])) indices[count++] = i;
+  }
+  PackedHeader header{kPackedVersion, chunk.input_format,
+                      half ? kHalfFlag : uint16_t{0}, count};
+  const size_t value_size = half ? sizeof(uint16_t) : sizeof(float);
+  const size_t start = out->size();
+  out->resize(start + sizeof(header) + kTailSize +
+              count * (sizeof(uint16_t) + value_size));
+  char* ptr = out->data() + start;
+  std::memcpy(ptr, &header, sizeof(header));
+  ptr += sizeof(header);
+  std::memcpy(ptr, reinterpret_cast<const char*>(&chunk) + kTailOffset,
+              kTailSize);
+  ptr += kTailSize;
+  std::memcpy(ptr, indices, count * sizeof(uint16_t));
+  ptr += count * sizeof(uint16_t);
+  for (uint16_t i = 0; i < count; i++) {
+    const float p = chunk.probabilities[indices[i]];
+    if (half) {
+      const uint16_t h = FP32toFP16(p);
+      std::memcpy(ptr, &h, sizeof(h));
+    } else {
+      std::memcpy(ptr, &p, sizeof(p));
+    }
+    ptr += value_size;
+  }
+}
+
+size_t UnpackTrainingData(std::string_view in, V6TrainingData* chunk) {
+  uint32_t version;
+  if (in.size() < sizeof(version)) throw Exception("Truncated record.");
+  std::memcpy(&version, in.data(), sizeof(version));
+  if (version != kPackedVersion) {
+    if (in.size() < sizeof(*chunk)) throw Exception("Truncated record.");
+    std::memcpy(chunk, in.data(), sizeof(*chunk));
+    return sizeof(*chunk);
+  }
+  PackedHeader header;
+  if (in.size() < sizeof(header) + kTailSize) {
+    throw Exception("Truncated packed record.");
+  }
+  std::memcpy(&header, in.data(), sizeof(header));
+  const bool half = (header.flags & kHalfFlag) != 0;
+  const size_t value_size = half ? sizeof(uint16_t) : sizeof(float);
+  const size_t size = sizeof(header) + kTailSize +
+                      header.count * (sizeof(uint16_t) + value_size);
+  if (header.count > kPolicySize || in.size() < size) {
+    throw Exception("Truncated packed record.");
+  }
+  const char* ptr = in.data() + sizeof(header);
+  chunk->version = 6;
+  chunk->input_format = header.input_format;
+  std::fill(std::begin(chunk->probabilities), std::end(chunk->probabilities),
+            -1.0f);
+  std::memcpy(reinterpret_cast<char*>(chunk) + kTailOffset, ptr, kTailSize);
+  ptr += kTailSize;
+  const char* values = ptr + header.count * sizeof(uint16_t);
+  for (uint16_t i = 0; i < header.count; i++) {
+    uint16_t index;
+    std::memcpy(&index, ptr + i * sizeof(uint16_t), sizeof(index));
+    if (index >= kPolicySize) throw Exception("Bad policy index in record.");
+    if (half) {
+      uint16_t h;
+      std::memcpy(&h, values + i * value_size, sizeof(h));
+      chunk->probabilities[index] = FP16toFP32(h);
+    } else {
+      std::memcpy(&chunk->probabilities[index], values + i * value_size,
+                  sizeof(float));
+    }
+  }
+  return size;
+}
+
+}  // namespace lczero
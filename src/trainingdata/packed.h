@@ -0,0 +1,63 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "trainingdata/trainingdata.h"
+
+namespace lczero {
+
+// Compact (V7) form of V6TrainingData. Illegal moves, which V6 marks with a
+// probability of -1, are dropped, and only the remaining probabilities are
+// stored together with their policy indices. Everything else is kept as is,
+// so input planes stay masks.
+//
+// Record layout: version (7), input_format, flags, entry count, the V6
+// fields following the probabilities, the uint16 indices and then the
+// probabilities, as float or fp16 depending on the flags.
+enum class RecordPacking : uint32_t {
+  // Plain V6 records.
+  kNone = 0,
+  // Sparse float probabilities, converts back to the identical V6 record.
+  kSparse = 1,
+  // Sparse fp16 probabilities, about 1e-3 relative error.
+  kSparseHalf = 2,
+};
+
+// Appends the packed form of @chunk to @out.
+void PackTrainingData(const V6TrainingData& chunk, RecordPacking packing,
+                      std::string* out);
+
+// Unpacks the record at the start of @in into @chunk and returns the number
+// of bytes it took. Throws on malformed input.
+size_t UnpackTrainingData(std::string_view in, V6TrainingData* chunk);
+
+}  // namespace lczero
@@ -27,24 +27,53 @@
 
 #include "trainingdata/reader.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include "trainingdata/container.h"
+
 namespace lczero {
 
-InputPlanes PlanesFromTrainingData(const V6TrainingData& data) {
-  InputPlanes result;
-  for (int i = 0; i < 104; i++) {
-    result.emplace_back();
-    result.back().mask = ReverseBitsInBytes(data.planes[i]);
+namespace {
+
+// Undoes the canonicalization transform on all planes of a sample. Each pass
+// runs over the whole array without branches so that it can be vectorized;
+// all-zero and all-one planes are invariant under every transform.
+void UndoTransform(uint64_t* masks, int transform) {
+  if ((transform & TransposeTransform) != 0) {
+    for (int i = 0; i < kInputPlanes; i++) {
+      masks[i] = TransposeBitsInBytes(masks[i]);
+    }
   }
+  if ((transform & MirrorTransform) != 0) {
+    for (int i = 0; i < kInputPlanes; i++) {
+      masks[i] = ReverseBytesInBytes(masks[i]);
+    }
+  }
+  if ((transform & FlipTransform) != 0) {
+    for (int i = 0; i < kInputPlanes; i++) {
+      masks[i] = ReverseBitsInBytes(masks[i]);
+    }
+  }
+}
+
+}  // namespace
+
+void PlanesFromTrainingData(const V6TrainingData& data, InputPlanesView out) {
+  uint64_t* masks = out.masks;
+  float* values = out.values;
+  for (int i = 0; i < 104; i++) masks[i] = ReverseBitsInBytes(data.planes[i]);
+  std::fill(values, values + kInputPlanes, 1.0f);
   switch (data.input_format) {
     case pblczero::NetworkFormat::INPUT_CLASSICAL_112_PLANE: {
-      result.emplace_back();
-      result.back().mask = data.castling_us_ooo != 0 ? ~0LL : 0LL;
-      result.emplace_back();
-      result.back().mask = data.castling_us_oo != 0 ? ~0LL : 0LL;
-      result.emplace_back();
-      result.back().mask = data.castling_them_ooo != 0 ? ~0LL : 0LL;
-      result.emplace_back();
-      result.back().mask = data.castling_them_oo != 0 ? ~0LL : 0LL;
+      masks[104] = data.castling_us_ooo != 0 ? ~0LL : 0LL;
+      masks[105] = data.castling_us_oo != 0 ? ~0LL : 0LL;
+      masks[106] = data.castling_them_ooo != 0 ? ~0LL : 0LL;
+      masks[107] = data.castling_them_oo != 0 ? ~0LL : 0LL;
       break;
     }
     case pblczero::NetworkFormat::INPUT_112_WITH_CASTLING_PLANE:
@@ -55,16 +84,13 @@ InputPlanes PlanesFromTrainingData(const V6TrainingData& data) {
     case pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_V2:
     case pblczero::NetworkFormat::
         INPUT_112_WITH_CANONICALIZATION_V2_ARMAGEDDON: {
-      result.emplace_back();
-      result.back().mask =
-          data.castling_us_ooo |
-          (static_cast<uint64_t>(data.castling_them_ooo) << 56);
-      result.emplace_back();
-      result.back().mask = data.castling_us_oo |
-                           (static_cast<uint64_t>(data.castling_them_oo) << 56);
+      masks[104] = data.castling_us_ooo |
+                   (static_cast<uint64_t>(data.castling_them_ooo) << 56);
+      masks[105] = data.castling_us_oo |
+                   (static_cast<uint64_t>(data.castling_them_oo) << 56);
       // 2 empty planes in this format.
-      result.emplace_back();
-      result.emplace_back();
+      masks[106] = 0;
+      masks[107] = 0;
       break;
     }
 
@@ -72,64 +98,134 @@ InputPlanes PlanesFromTrainingData(const V6TrainingData& data) {
       throw Exception("Unsupported input plane encoding " +
                       std::to_string(data.input_format));
   }
-  result.emplace_back();
   auto typed_format =
       static_cast<pblczero::NetworkFormat::InputFormat>(data.input_format);
   if (IsCanonicalFormat(typed_format)) {
-    result.back().mask = static_cast<uint64_t>(data.side_to_move_or_enpassant)
-                         << 56;
+    masks[108] = static_cast<uint64_t>(data.side_to_move_or_enpassant) << 56;
   } else {
-    result.back().mask = data.side_to_move_or_enpassant != 0 ? ~0LL : 0LL;
+    masks[108] = data.side_to_move_or_enpassant != 0 ? ~0LL : 0LL;
   }
-  result.emplace_back();
+  masks[109] = ~0ULL;
   if (IsHectopliesFormat(typed_format)) {
-    result.back().Fill(data.rule50_count / 100.0f);
+    values[109] = data.rule50_count / 100.0f;
   } else {
-    result.back().Fill(data.rule50_count);
+    values[109] = data.rule50_count;
   }
-  result.emplace_back();
   // Empty plane, except for canonical armageddon.
-  if (IsCanonicalArmageddonFormat(typed_format) &&
-      data.invariance_info >= 128) {
-    result.back().SetAll();
-  }
-  result.emplace_back();
+  masks[110] = IsCanonicalArmageddonFormat(typed_format) &&
+                       data.invariance_info >= 128
+                   ? ~0ULL
+                   : 0ULL;
   // All ones plane.
-  result.back().SetAll();
+  masks[111] = ~0ULL;
   if (IsCanonicalFormat(typed_format) && data.invariance_info != 0) {
     // Undo transformation here as it makes the calling code simpler.
-    int transform = data.invariance_info;
-    for (size_t i = 0; i <= result.size(); i++) {
-      auto v = result[i].mask;
-      if (v == 0 || v == ~0ULL) continue;
-      if ((transform & TransposeTransform) != 0) {
-        v = TransposeBitsInBytes(v);
-      }
-      if ((transform & MirrorTransform) != 0) {
-        v = ReverseBytesInBytes(v);
-      }
-      if ((transform & FlipTransform) != 0) {
-        v = ReverseBitsInBytes(v);
-      }
-      result[i].mask = v;
-    }
+    UndoTransform(masks, data.invariance_info);
+  }
+}
+
+void PlanesFromTrainingData(std::span<const V6TrainingData> data,
+                            uint64_t* masks, float* values) {
+  for (size_t i = 0; i < data.size(); i++) {
+    PlanesFromTrainingData(
+        data[i], {masks + i * kInputPlanes, values + i * kInputPlanes});
+  }
+}
+
+InputPlanes PlanesFromTrainingData(const V6TrainingData& data) {
+  uint64_t masks[kInputPlanes];
+  float values[kInputPlanes];
+  PlanesFromTrainingData(data, {masks, values});
+  InputPlanes result(kInputPlanes);
+  for (int i = 0; i < kInputPlanes; i++) {
+    result[i].mask = masks[i];
+    result[i].value = values[i];
   }
   return result;
 }
 
 TrainingDataReader::TrainingDataReader(std::string filename)
     : filename_(filename) {
+  if (TrainingDataContainerReader::IsContainer(filename_)) {
+    container_ = std::make_unique<TrainingDataContainerReader>(filename_);
+    return;
+  }
   fin_ = gzopen(filename_.c_str(), "rb");
   if (!fin_) {
     throw Exception("Cannot open gzip file " + filename_);
   }
+  gzbuffer(fin_, kBufferSize);
 }
 
-TrainingDataReader::~TrainingDataReader() { gzclose(fin_); }
+TrainingDataReader::~TrainingDataReader() {
+  if (fin_) gzclose(fin_);
+}
+
+int TrainingDataReader::ReadBytes(void* dst, int size) {
+  char* out = static_cast<char*>(dst);
+  int copied = 0;
+  while (copied < size) {
+    if (buffer_pos_ == buffer_.size()) {
+      // Records are small, so decompress many of them at once and serve
+      // the rest from the buffer.
+      buffer_.resize(kBufferSize);
+      int read_size = gzread(fin_, buffer_.data(), buffer_.size());
+      if (read_size < 0) return read_size;
+      buffer_.resize(read_size);
+      buffer_pos_ = 0;
+      if (read_size == 0) break;
+    }
+    const int n = std::min<int>(size - copied, buffer_.size() - buffer_pos_);
+    std::memcpy(out + copied, buffer_.data() + buffer_pos_, n);
+    buffer_pos_ += n;
+    copied += n;
+  }
+  return copied;
+}
+
+std::vector<V6TrainingData> TrainingDataReader::ReadAll() {
+  std::vector<V6TrainingData> result;
+  if (container_) {
+    result.assign(block_.begin() + block_pos_, block_.end());
+    block_pos_ = block_.size();
+    auto rest = container_->ReadBlocks(
+        next_block_, container_->GetBlockCount() - next_block_, 1);
+    next_block_ = container_->GetBlockCount();
+    result.insert(result.end(), rest.begin(), rest.end());
+    return result;
+  }
+  V6TrainingData data;
+  while (ReadChunk(&data)) {
+    result.push_back(data);
+    if (!format_v6) continue;
+    // V6 records need no upgrade, so the rest is read in bulk.
+    constexpr int kBulkChunks = 64;
+    constexpr int kBulkSize = kBulkChunks * sizeof(V6TrainingData);
+    while (true) {
+      const size_t size = result.size();
+      result.resize(size + kBulkChunks);
+      int read_size = ReadBytes(result.data() + size, kBulkSize);
+      if (read_size < 0) throw Exception("Corrupt read.");
+      result.resize(size + read_size / sizeof(V6TrainingData));
+      if (read_size != kBulkSize) break;
+    }
+    break;
+  }
+  return result;
+}
 
 bool TrainingDataReader::ReadChunk(V6TrainingData* data) {
+  if (container_) {
+    while (block_pos_ == block_.size()) {
+      if (next_block_ == container_->GetBlockCount()) return false;
+      block_ = container_->ReadBlock(next_block_++);
+      block_pos_ = 0;
+    }
+    *data = block_[block_pos_++];
+    return true;
+  }
   if (format_v6) {
-    int read_size = gzread(fin_, reinterpret_cast<void*>(data), sizeof(*data));
+    int read_size = ReadBytes(data, sizeof(*data));
     if (read_size < 0) throw Exception("Corrupt read.");
     return read_size == sizeof(*data);
   } else {
@@ -137,7 +233,7 @@ bool TrainingDataReader::ReadChunk(V6TrainingData* data) {
     int v5_extra = 16;
     int v4_extra = 16;
     int v3_size = sizeof(*data) - v4_extra - v5_extra - v6_extra;
-    int read_size = gzread(fin_, reinterpret_cast<void*>(data), v3_size);
+    int read_size = ReadBytes(data, v3_size);
     if (read_size < 0) throw Exception("Corrupt read.");
     if (read_size != v3_size) return false;
     auto orig_version = data->version;
@@ -155,10 +251,8 @@ bool TrainingDataReader::ReadChunk(V6TrainingData* data) {
       case 4: {
         // If actually 4, we need to read the additional data first.
         if (orig_version == 4) {
-          read_size = gzread(
-              fin_,
-              reinterpret_cast<void*>(reinterpret_cast<char*>(data) + v3_size),
-              v4_extra);
+          read_size =
+              ReadBytes(reinterpret_cast<char*>(data) + v3_size, v4_extra);
           if (read_size < 0) throw Exception("Corrupt read.");
           if (read_size != v4_extra) return false;
         }
@@ -176,10 +270,8 @@ bool TrainingDataReader::ReadChunk(V6TrainingData* data) {
       case 5: {
         // If actually 5, we need to read the additional data first.
         if (orig_version == 5) {
-          read_size = gzread(
-              fin_,
-              reinterpret_cast<void*>(reinterpret_cast<char*>(data) + v3_size),
-              v4_extra + v5_extra);
+          read_size = ReadBytes(reinterpret_cast<char*>(data) + v3_size,
+                                v4_extra + v5_extra);
           if (read_size < 0) throw Exception("Corrupt read.");
           if (read_size != v4_extra + v5_extra) return false;
         }
@@ -210,10 +302,8 @@ bool TrainingDataReader::ReadChunk(V6TrainingData* data) {
       }
       case 6: {
         format_v6 = true;
-        read_size = gzread(
-            fin_,
-            reinterpret_cast<void*>(reinterpret_cast<char*>(data) + v3_size),
-            v4_extra + v5_extra + v6_extra);
+        read_size = ReadBytes(reinterpret_cast<char*>(data) + v3_size,
+                              v4_extra + v5_extra + v6_extra);
         if (read_size < 0) throw Exception("Corrupt read.");
         return read_size == v4_extra + v5_extra + v6_extra;
       }
@@ -223,4 +313,31 @@ bool TrainingDataReader::ReadChunk(V6TrainingData* data) {
   }
 }
 
+std::vector<std::vector<V6TrainingData>> ReadTrainingDataFiles(
+    std::span<const std::string> files, int threads) {
+  std::vector<std::vector<V6TrainingData>> result(files.size());
+  std::atomic<size_t> next{0};
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  auto worker = [&]() {
+    for (size_t i = next++; i < files.size(); i = next++) {
+      try {
+        result[i] = TrainingDataReader(files[i]).ReadAll();
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) error = std::current_exception();
+        next = files.size();
+      }
+    }
+  };
+  const size_t thread_count = std::clamp<size_t>(
+      threads, 1, std::max<size_t>(files.size(), 1));
+  std::vector<std::thread> pool;
+  for (size_t i = 1; i < thread_count; i++) pool.emplace_back(worker);
+  worker();
+  for (auto& thread : pool) thread.join();
+  if (error) std::rethrow_exception(error);
+  return result;
+}
+
 }  // namespace lczero
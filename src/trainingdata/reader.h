@@ -27,6 +27,11 @@
 
 #pragma once
 
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
 #include "trainingdata/trainingdata.h"
 
 namespace lczero {
@@ -39,9 +44,22 @@ namespace lczero {
 // InputPlanes are not transformed.
 InputPlanes PlanesFromTrainingData(const V6TrainingData& data);
 
+// Same as above, but writes the planes straight into @out, e.g. a buffer
+// returned by NetworkComputation::GetInputBuffer().
+void PlanesFromTrainingData(const V6TrainingData& data, InputPlanesView out);
+
+// Decodes a batch of records into contiguous [N, kInputPlanes] @masks and
+// @values arrays.
+void PlanesFromTrainingData(std::span<const V6TrainingData> data,
+                            uint64_t* masks, float* values);
+
+class TrainingDataContainerReader;
+
 class TrainingDataReader {
  public:
-  // Opens the given file to read chunk data from.
+  // Opens the given file to read chunk data from. Both gzipped record streams
+  // and block containers (see container.h) are accepted; for the latter the
+  // chunks of all games are returned in order.
   TrainingDataReader(std::string filename);
 
   ~TrainingDataReader();
@@ -49,13 +67,32 @@ class TrainingDataReader {
   // Reads a chunk. Returns true if a chunk was read.
   bool ReadChunk(V6TrainingData* data);
 
+  // Reads all remaining chunks.
+  std::vector<V6TrainingData> ReadAll();
+
   // Gets full filename of the file being read.
   std::string GetFileName() const { return filename_; }
 
  private:
+  static constexpr int kBufferSize = 1 << 20;
+
+  // gzread() replacement serving reads from a large decompressed buffer.
+  int ReadBytes(void* dst, int size);
+
   std::string filename_;
-  gzFile fin_;
+  gzFile fin_ = nullptr;
+  std::vector<char> buffer_;
+  size_t buffer_pos_ = 0;
   bool format_v6 = false;
+  std::unique_ptr<TrainingDataContainerReader> container_;
+  std::vector<V6TrainingData> block_;
+  size_t block_pos_ = 0;
+  size_t next_block_ = 0;
 };
 
+// Reads all chunks of each of @files using up to @threads threads. Rethrows
+// the first error encountered.
+std::vector<std::vector<V6TrainingData>> ReadTrainingDataFiles(
+    std::span<const std::string> files, int threads);
+
 }  // namespace lczero
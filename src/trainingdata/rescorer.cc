@@ -27,16 +27,44 @@
 
 #include "trainingdata/rescorer.h"
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <span>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
 
 #include "gtb-probe.h"
+#include "neural/backend.h"
 #include "neural/decoder.h"
+#include "neural/encoder.h"
+#include "neural/register.h"
+#include "neural/shared_params.h"
 #include "syzygy/syzygy.h"
 #include "trainingdata/reader.h"
 #include "utils/filesystem.h"
+#include "utils/hashcat.h"
 #include "utils/optionsparser.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace lczero {
 
 namespace {
@@ -49,9 +77,22 @@ const OptionId kInputDirId{
 const OptionId kPolicySubsDirId{"policy-substitutions", "",
                                 "Directory with gzipped files are to use to "
                                 "replace policy for some of the data."};
+const OptionId kPolicySubsIndexId{
+    "policy-substitutions-index", "",
+    "Prebuilt policy substitution index file. Written from "
+    "--policy-substitutions when both are given, otherwise mapped read-only "
+    "and shared by all rescorer processes."};
 const OptionId kOutputDirId{"output", "", "Directory to write rescored files."};
 const OptionId kThreadsId{"threads", "",
                           "Number of concurrent threads to rescore with.", 't'};
+const OptionId kReadThreadsId{
+    "read-threads", "",
+    "Number of threads reading and inflating input files, 0 for a quarter of "
+    "--threads."};
+const OptionId kWriteThreadsId{
+    "write-threads", "",
+    "Number of threads compressing and writing output files, 0 for half of "
+    "--threads."};
 const OptionId kTempId{"temperature", "",
                        "Additional temperature to apply to policy target."};
 const OptionId kDistributionOffsetId{
@@ -78,6 +119,10 @@ const OptionId kDeblunderQBlunderWidth{
 const OptionId kNnuePlainFileId{"nnue-plain-file", "",
                                 "Append SF plain format training data to this "
                                 "file. Will be generated if not there."};
+const OptionId kNnueBinFileId{
+    "nnue-bin-file", "",
+    "Append SF binary (.bin, PackedSfenValue) training data to this file. Will "
+    "be generated if not there."};
 const OptionId kNnueBestScoreId{"nnue-best-score", "",
                                 "For the SF training data use the score of the "
                                 "best move instead of the played one."};
@@ -87,15 +132,102 @@ const OptionId kNnueBestMoveId{
     "If set to true the generated files do not compress well."};
 const OptionId kDeleteFilesId{"delete-files", "",
                               "Delete the input files after processing."};
+const OptionId kProbeCacheSizeId{
+    "tb-cache-size", "",
+    "Size in MiB of the cache of Syzygy probe results shared by all threads, "
+    "0 to disable."};
+const OptionId kNnRescoreId{
+    "nn-rescore", "",
+    "Evaluate every position with the network given by --weights and "
+    "--backend, and store the results as new training targets."};
+const OptionId kNnPolicyId{"nn-policy", "",
+                           "With --nn-rescore, replace the policy target by "
+                           "the network policy over legal moves."};
+const OptionId kNnValueId{"nn-value", "",
+                          "With --nn-rescore, replace root and orig "
+                          "value/draw/moves left by the network evaluation."};
+const OptionId kNnBatchSizeId{
+    "nn-batch-size", "",
+    "Positions per network computation, collected across files. 0 to use the "
+    "backend's recommended batch size."};
+const OptionId kNnThreadsId{
+    "nn-threads", "",
+    "Threads feeding the network. With more than one, batches are prepared "
+    "while another one is computed."};
 
-class PolicySubNode {
+// Substituted policies of positions from the substitution games. A position
+// is keyed by the hash of the game's first position and rule50 ply, chained
+// with the policy index of every move played to reach it. Positions on the
+// paths of the games without a policy of their own are stored too, so that
+// lookups can stop as soon as a game leaves all of them.
+// The sorted keys are either built in memory or mapped read-only from an
+// index file, which makes the startup immediate and shares the pages between
+// all processes using it.
+class PolicySubIndex {
  public:
-  PolicySubNode() {
-    for (int i = 0; i < 1858; i++) children[i] = nullptr;
+  PolicySubIndex() = default;
+  ~PolicySubIndex() { Unmap(); }
+  PolicySubIndex(const PolicySubIndex&) = delete;
+  PolicySubIndex& operator=(const PolicySubIndex&) = delete;
+
+  static uint64_t RootKey(const ChessBoard& board, int rule50ply) {
+    return HashCat(board.Hash(), rule50ply);
   }
-  bool active = false;
-  float policy[1858];
-  PolicySubNode* children[1858];
+  static uint64_t ChildKey(uint64_t key, int idx) { return HashCat(key, idx); }
+
+  // Builds the index from the games in @files.
+  void Build(const std::vector<std::string>& files);
+  // Writes the index to be mapped later.
+  void Save(const std::string& filename) const;
+  // Maps an index written by Save().
+  void Map(const std::string& filename);
+
+  bool empty() const { return keys_.empty(); }
+  size_t size() const { return keys_.size(); }
+
+  // Returns false if no substitution game reaches the position. Otherwise
+  // sets @policy to the substituted policy, or to nullptr if there is none.
+  bool Find(uint64_t key, const float** policy) const {
+    auto iter = std::lower_bound(keys_.begin(), keys_.end(), key);
+    if (iter == keys_.end() || *iter != key) return false;
+    const uint32_t slot = slots_[iter - keys_.begin()];
+    *policy = slot == kNoPolicy ? nullptr : &policies_[size_t{slot} * 1858];
+    return true;
+  }
+
+ private:
+  static constexpr uint32_t kNoPolicy = ~0u;
+  static constexpr uint64_t kMagic = 0x4255535059434c50;  // "PLCYPSUB"
+  static constexpr uint32_t kVersion = 1;
+  struct FileHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t policy_size;
+    uint64_t num_keys;
+    uint64_t num_policies;
+  };
+  // Keys, then slots padded to 8 bytes, then policies.
+  static size_t SlotsOffset(uint64_t num_keys) {
+    return sizeof(FileHeader) + num_keys * sizeof(uint64_t);
+  }
+  static size_t PoliciesOffset(uint64_t num_keys) {
+    return SlotsOffset(num_keys) + (num_keys * sizeof(uint32_t) + 7) / 8 * 8;
+  }
+  void Unmap();
+
+  std::span<const uint64_t> keys_;
+  std::span<const uint32_t> slots_;
+  std::span<const float> policies_;
+  // Storage of a built index.
+  std::vector<uint64_t> key_storage_;
+  std::vector<uint32_t> slot_storage_;
+  std::vector<float> policy_storage_;
+  // Mapping of an index file.
+  void* base_ = nullptr;
+  size_t size_ = 0;
+#ifdef _WIN32
+  HANDLE mapping_ = nullptr;
+#endif
 };
 
 std::atomic<int> games(0);
@@ -112,12 +244,117 @@ std::atomic<int> policy_nobump_total_hist[11];
 std::atomic<int> policy_bump_total_hist[11];
 std::atomic<int> policy_dtm_bump(0);
 std::atomic<int> gaviota_dtm_rescores(0);
-std::map<uint64_t, PolicySubNode> policy_subs;
+PolicySubIndex policy_subs;
 bool gaviotaEnabled = false;
 bool deblunderEnabled = false;
 float deblunderQBlunderThreshold = 2.0f;
 float deblunderQBlunderWidth = 0.0f;
 
+// Syzygy tablebase with the WDL and DTZ probe results memoised, as the
+// endgames of different games run into the same positions over and over.
+// Each slot of the direct mapped tables is one atomic word holding the key
+// bits not used for the index plus the result, so the threads share them
+// without locking. A colliding position just replaces the slot.
+class CachedTablebase {
+ public:
+  CachedTablebase(SyzygyTablebase* tablebase, size_t cache_bytes)
+      : tablebase_(tablebase) {
+    // Half of the memory for each table, in a power of two number of slots.
+    size_t slots = 0;
+    if (cache_bytes >= 2 * sizeof(uint64_t) << kMinIndexBits) {
+      slots = std::bit_floor(cache_bytes / 2 / sizeof(uint64_t));
+    }
+    wdl_.Resize(slots);
+    dtz_.Resize(slots);
+  }
+
+  int max_cardinality() { return tablebase_->max_cardinality(); }
+  bool root_probe(const Position& pos, bool has_repeated, bool win_only,
+                  std::vector<Move>* safe_moves) {
+    return tablebase_->root_probe(pos, has_repeated, win_only, safe_moves);
+  }
+
+  // The results only depend on the board, not on the rule50 counter (the
+  // board hash includes the en passant square and the castling rights).
+  WDLScore probe_wdl(const Position& pos, ProbeState* result) {
+    return static_cast<WDLScore>(
+        wdl_.Probe(pos.GetBoard().Hash(), result, [&](ProbeState* state) {
+          return tablebase_->probe_wdl(pos, state);
+        }));
+  }
+  int probe_dtz(const Position& pos, ProbeState* result) {
+    return dtz_.Probe(pos.GetBoard().Hash(), result, [&](ProbeState* state) {
+      return tablebase_->probe_dtz(pos, state);
+    });
+  }
+
+  void PrintStats() const {
+    wdl_.PrintStats("WDL");
+    dtz_.PrintStats("DTZ");
+  }
+
+ private:
+  // The slot stores the key's upper 45 bits, so there must be at least 19
+  // index bits for the two to cover the whole key.
+  static constexpr int kMinIndexBits = 19;
+  static constexpr uint64_t kKeyMask = ~uint64_t{0} << kMinIndexBits;
+  static constexpr uint64_t kValid = uint64_t{1} << 18;
+
+  class Table {
+   public:
+    void Resize(size_t slots) {
+      slots_ = std::make_unique<std::atomic<uint64_t>[]>(slots);
+      mask_ = slots - 1;
+      enabled_ = slots > 0;
+    }
+
+    template <typename ProbeFunc>
+    int Probe(uint64_t key, ProbeState* result, ProbeFunc probe) {
+      if (!enabled_) return probe(result);
+      std::atomic<uint64_t>& slot = slots_[key & mask_];
+      const uint64_t entry = slot.load(std::memory_order_relaxed);
+      if ((entry & kValid) && (entry & kKeyMask) == (key & kKeyMask)) {
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        *result = static_cast<ProbeState>(static_cast<int>((entry >> 16) & 3) -
+                                          1);
+        return static_cast<int16_t>(entry & 0xFFFF);
+      }
+      misses_.fetch_add(1, std::memory_order_relaxed);
+      const int value = probe(result);
+      slot.store((key & kKeyMask) | kValid |
+                     (static_cast<uint64_t>(*result + 1) << 16) |
+                     static_cast<uint16_t>(value),
+                 std::memory_order_relaxed);
+      return value;
+    }
+
+    void PrintStats(const char* name) const {
+      if (!enabled_) return;
+      const uint64_t hits = hits_.load(std::memory_order_relaxed);
+      const uint64_t total = hits + misses_.load(std::memory_order_relaxed);
+      std::cout << "Tablebase " << name << " probe cache hits: " << hits
+                << " of " << total << " probes";
+      if (total > 0) {
+        std::cout << " (" << std::setprecision(4) << 100.0 * hits / total
+                  << "%)";
+      }
+      std::cout << std::endl;
+    }
+
+   private:
+    std::unique_ptr<std::atomic<uint64_t>[]> slots_;
+    uint64_t mask_ = 0;
+    bool enabled_ = false;
+    // Each on its own cache line, as all the threads update them.
+    alignas(64) std::atomic<uint64_t> hits_ = 0;
+    alignas(64) std::atomic<uint64_t> misses_ = 0;
+  };
+
+  SyzygyTablebase* const tablebase_;
+  Table wdl_;
+  Table dtz_;
+};
+
 void DataAssert(bool check_result) {
   if (!check_result) throw Exception("Range Violation");
 }
@@ -433,430 +670,670 @@ int ResultForData(const V6TrainingData& data) {
   return static_cast<int>(data.result_q);
 }
 
+// Formula from PR1477 adjusted for SF PawnValueEg.
+int NnueScore(float q) {
+  return round(660.6 * q / (1 - 0.9751875 * std::pow(q, 10)));
+}
+
 std::string AsNnueString(const Position& p, Move m, float q, int result) {
   std::ostringstream out;
   out << "fen " << GetFen(p) << std::endl;
   if (p.IsBlackToMove()) m.Flip();
   out << "move " << m.ToString(false) << std::endl;
-  // Formula from PR1477 adjusted for SF PawnValueEg.
-  out << "score " << round(660.6 * q / (1 - 0.9751875 * std::pow(q, 10)))
-      << std::endl;
+  out << "score " << NnueScore(q) << std::endl;
   out << "ply " << p.GetGamePly() << std::endl;
   out << "result " << result << std::endl;
   out << "e" << std::endl;
   return out.str();
 }
 
+// Record of the SF .bin training data format.
+struct PackedSfenValue {
+  uint8_t sfen[32];
+  int16_t score;
+  uint16_t move;
+  uint16_t game_ply;
+  int8_t game_result;
+  uint8_t padding;
+};
+static_assert(sizeof(PackedSfenValue) == 40);
+
+// Writes bits into the packed sfen, lowest bit of each value first.
+class SfenBitWriter {
+ public:
+  explicit SfenBitWriter(uint8_t* data) : data_(data) {}
+  void Write(uint32_t value, int bits) {
+    for (int i = 0; i < bits; i++, cursor_++) {
+      if (value & (1u << i)) data_[cursor_ / 8] |= 1 << (cursor_ % 8);
+    }
+  }
+
+ private:
+  uint8_t* data_;
+  int cursor_ = 0;
+};
+
+// Same huffman coded layout as SF's sfen_packer: side to move, king squares,
+// the remaining pieces from a8 to h1, castling rights, en passant square,
+// rule50 and the fullmove number.
+PackedSfenValue AsPackedSfen(const Position& p, Move m, float q, int result) {
+  PackedSfenValue value{};
+  ChessBoard board = p.GetBoard();
+  // White to move perspective, ours are white pieces afterwards.
+  if (board.flipped()) board.Mirror();
+  SfenBitWriter writer(value.sfen);
+  writer.Write(p.IsBlackToMove(), 1);
+  writer.Write((*(board.kings() & board.ours()).begin()).as_idx(), 6);
+  writer.Write((*(board.kings() & board.theirs()).begin()).as_idx(), 6);
+  for (int rank = 7; rank >= 0; rank--) {
+    for (int file = 0; file < 8; file++) {
+      const Square square(File::FromIdx(file), Rank::FromIdx(rank));
+      if (board.kings().get(square)) continue;
+      const bool ours = board.ours().get(square);
+      if (!ours && !board.theirs().get(square)) {
+        writer.Write(0, 1);
+        continue;
+      }
+      if (board.pawns().get(square)) {
+        writer.Write(0b0001, 4);
+      } else if (board.knights().get(square)) {
+        writer.Write(0b0011, 4);
+      } else if (board.bishops().get(square)) {
+        writer.Write(0b0101, 4);
+      } else if (board.rooks().get(square)) {
+        writer.Write(0b0111, 4);
+      } else {
+        writer.Write(0b1001, 4);
+      }
+      writer.Write(!ours, 1);
+    }
+  }
+  const auto& castlings = board.castlings();
+  writer.Write(castlings.we_can_00(), 1);
+  writer.Write(castlings.we_can_000(), 1);
+  writer.Write(castlings.they_can_00(), 1);
+  writer.Write(castlings.they_can_000(), 1);
+  if (board.en_passant().empty()) {
+    writer.Write(0, 1);
+  } else {
+    writer.Write(1, 1);
+    const auto file = (*board.en_passant().begin()).file();
+    writer.Write(
+        Square(file, p.IsBlackToMove() ? kRank3 : kRank6).as_idx(), 6);
+  }
+  const int rule50 = p.GetRule50Ply();
+  const int fullmove = (p.GetGamePly() + (p.IsBlackToMove() ? 1 : 2)) / 2;
+  writer.Write(rule50, 6);
+  writer.Write(fullmove, 8);
+  writer.Write(fullmove >> 8, 8);
+  writer.Write(rule50 >> 6, 1);
+
+  if (p.IsBlackToMove()) m.Flip();
+  // SF move: to, from, promotion piece (knight to queen), type.
+  uint16_t move = m.to().as_idx() | (m.from().as_idx() << 6);
+  if (m.is_promotion()) {
+    const PieceType promotion = m.promotion();
+    const int piece = promotion == kKnight   ? 0
+                      : promotion == kBishop ? 1
+                      : promotion == kRook   ? 2
+                                             : 3;
+    move |= (piece << 12) | (1 << 14);
+  } else if (m.is_en_passant()) {
+    move |= 2 << 14;
+  } else if (m.is_castling()) {
+    move |= 3 << 14;
+  }
+  value.move = move;
+  value.score = std::clamp(NnueScore(q), -32000, 32000);
+  value.game_ply = p.GetGamePly();
+  value.game_result = result;
+  return value;
+}
+
+// Appends PackedSfenValue records to a file. Each rescoring thread collects
+// records in its own Buffer, which hands them over in large pieces, so the
+// file lock is only taken once per thousands of positions.
+class NnueBinWriter {
+ public:
+  explicit NnueBinWriter(const std::string& filename)
+      : file_(filename, std::ios_base::app | std::ios_base::binary) {
+    if (!file_) throw Exception("Cannot open " + filename);
+  }
+
+  class Buffer {
+   public:
+    explicit Buffer(NnueBinWriter* writer) : writer_(writer) {
+      records_.reserve(kRecords);
+    }
+    ~Buffer() { Flush(); }
+
+    void Add(const PackedSfenValue& record) {
+      records_.push_back(record);
+      if (records_.size() == kRecords) Flush();
+    }
+
+    void Flush() {
+      if (records_.empty()) return;
+      writer_->Write(records_);
+      records_.clear();
+    }
+
+   private:
+    // About 1 MiB.
+    static constexpr size_t kRecords = 1 << 15;
+    NnueBinWriter* const writer_;
+    std::vector<PackedSfenValue> records_;
+  };
+
+ private:
+  void Write(std::span<const PackedSfenValue> records) {
+    Mutex::Lock lock(mutex_);
+    file_.write(reinterpret_cast<const char*>(records.data()),
+                records.size() * sizeof(records[0]));
+  }
+
+  Mutex mutex_;
+  std::ofstream file_;
+};
+
 struct ProcessFileFlags {
   bool delete_files : 1;
   bool nnue_best_score : 1;
   bool nnue_best_move : 1;
+  // Positions of the game are kept for network rescoring.
+  bool keep_history : 1;
 };
 
-void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
-                 std::string outputDir, float distTemp, float distOffset,
-                 float dtzBoost, int newInputFormat,
-                 std::string nnue_plain_file, ProcessFileFlags flags) {
-  // Scope to ensure reader and writer are closed before deleting source file.
-  {
-    try {
-      TrainingDataReader reader(file);
-      std::vector<V6TrainingData> fileContents;
-      V6TrainingData data;
-      while (reader.ReadChunk(&data)) {
-        fileContents.push_back(data);
-      }
-      Validate(fileContents);
-      MoveList moves;
-      for (size_t i = 1; i < fileContents.size(); i++) {
-        moves.push_back(
-            DecodeMoveFromInput(PlanesFromTrainingData(fileContents[i]),
-                                PlanesFromTrainingData(fileContents[i - 1])));
-        // All moves decoded are from the point of view of the side after the
-        // move so need to mirror them all to be applicable to apply to the
-        // position before.
-        moves.back().Flip();
-      }
-      Validate(fileContents, moves);
-      games += 1;
-      positions += fileContents.size();
-      PositionHistory history;
-      int rule50ply;
-      int gameply;
-      ChessBoard board;
-      auto input_format = static_cast<pblczero::NetworkFormat::InputFormat>(
-          fileContents[0].input_format);
-      PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
-                    &board, &rule50ply, &gameply);
-      history.Reset(board, rule50ply, gameply);
-      uint64_t rootHash = HashCat(board.Hash(), rule50ply);
-      if (policy_subs.find(rootHash) != policy_subs.end()) {
-        PolicySubNode* rootNode = &policy_subs[rootHash];
-        for (size_t i = 0; i < fileContents.size(); i++) {
-          if (rootNode->active) {
-            /* Some logic for choosing a softmax to apply to better align the
-            new policy with the old policy...
-            double bestkld =
-              std::numeric_limits<double>::max(); float besttemp = 1.0f;
-            // Minima is usually in this range for 'better' data.
-            for (float temp = 1.0f; temp < 3.0f; temp += 0.1f) {
-              float soft[1858];
-              float sum = 0.0f;
-              for (int j = 0; j < 1858; j++) {
-                if (rootNode->policy[j] >= 0.0) {
-                  soft[j] = std::pow(rootNode->policy[j], 1.0f / temp);
-                  sum += soft[j];
-                } else {
-                  soft[j] = -1.0f;
-                }
-              }
-              double kld = 0.0;
-              for (int j = 0; j < 1858; j++) {
-                if (soft[j] >= 0.0) soft[j] /= sum;
-                if (rootNode->policy[j] > 0.0 &&
-                    fileContents[i].probabilities[j] > 0) {
-                  kld += -1.0f * soft[j] *
-                    std::log(fileContents[i].probabilities[j] / soft[j]);
-                }
-              }
-              if (kld < bestkld) {
-                bestkld = kld;
-                besttemp = temp;
+void ReportError(const std::string& file, const Exception& ex,
+                 ProcessFileFlags flags) {
+  std::cerr << "While processing: " << file
+            << " - Exception thrown: " << ex.what() << std::endl;
+  if (flags.delete_files) {
+    std::cerr << "It will be deleted." << std::endl;
+  }
+}
+
+// A game file travelling through the read, rescore and write stages.
+struct GameFile {
+  std::string file;
+  std::vector<V6TrainingData> chunks;
+  // Positions of all chunks, filled by RescoreFile() with keep_history.
+  PositionHistory history;
+  // Cleared when reading or rescoring fails, then nothing is written.
+  bool ok = true;
+};
+
+void ReadFile(GameFile* game, ProcessFileFlags flags) {
+  try {
+    game->chunks = TrainingDataReader(game->file).ReadAll();
+  } catch (Exception& ex) {
+    ReportError(game->file, ex, flags);
+    game->ok = false;
+  }
+}
+
+void RescoreFile(GameFile* game, CachedTablebase* tablebase, float distTemp,
+                 float distOffset, float dtzBoost, int newInputFormat,
+                 const std::string& nnue_plain_file,
+                 NnueBinWriter::Buffer* nnue_bin, ProcessFileFlags flags) {
+  std::vector<V6TrainingData>& fileContents = game->chunks;
+  try {
+    Validate(fileContents);
+    MoveList moves;
+    for (size_t i = 1; i < fileContents.size(); i++) {
+      moves.push_back(
+          DecodeMoveFromInput(PlanesFromTrainingData(fileContents[i]),
+                              PlanesFromTrainingData(fileContents[i - 1])));
+      // All moves decoded are from the point of view of the side after the
+      // move so need to mirror them all to be applicable to apply to the
+      // position before.
+      moves.back().Flip();
+    }
+    Validate(fileContents, moves);
+    games += 1;
+    positions += fileContents.size();
+    PositionHistory history;
+    int rule50ply;
+    int gameply;
+    ChessBoard board;
+    auto input_format = static_cast<pblczero::NetworkFormat::InputFormat>(
+        fileContents[0].input_format);
+    PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
+                  &board, &rule50ply, &gameply);
+    history.Reset(board, rule50ply, gameply);
+    if (flags.keep_history) {
+      game->history = history;
+      for (Move move : moves) game->history.Append(move);
+    }
+    uint64_t key = PolicySubIndex::RootKey(board, rule50ply);
+    const float* policy;
+    if (!policy_subs.empty() && policy_subs.Find(key, &policy)) {
+      for (size_t i = 0; i < fileContents.size(); i++) {
+        if (policy) {
+          /* Some logic for choosing a softmax to apply to better align the
+          new policy with the old policy...
+          double bestkld =
+            std::numeric_limits<double>::max(); float besttemp = 1.0f;
+          // Minima is usually in this range for 'better' data.
+          for (float temp = 1.0f; temp < 3.0f; temp += 0.1f) {
+            float soft[1858];
+            float sum = 0.0f;
+            for (int j = 0; j < 1858; j++) {
+              if (policy[j] >= 0.0) {
+                soft[j] = std::pow(policy[j], 1.0f / temp);
+                sum += soft[j];
+              } else {
+                soft[j] = -1.0f;
               }
             }
-            std::cerr << i << " " << besttemp << " " << bestkld << std::endl;
-            */
+            double kld = 0.0;
             for (int j = 0; j < 1858; j++) {
-              /*
-              if (rootNode->policy[j] >= 0.0) {
-                std::cerr << i << " " << j << " " << rootNode->policy[j] << " "
-                          << fileContents[i].probabilities[j] << std::endl;
+              if (soft[j] >= 0.0) soft[j] /= sum;
+              if (policy[j] > 0.0 &&
+                  fileContents[i].probabilities[j] > 0) {
+                kld += -1.0f * soft[j] *
+                  std::log(fileContents[i].probabilities[j] / soft[j]);
               }
-              */
-              fileContents[i].probabilities[j] = rootNode->policy[j];
+            }
+            if (kld < bestkld) {
+              bestkld = kld;
+              besttemp = temp;
             }
           }
-          if (i + 1 < fileContents.size()) {
-            int transform = TransformForPosition(input_format, history);
-            int idx = MoveToNNIndex(moves[i], transform);
-            if (rootNode->children[idx] == nullptr) {
-              break;
+          std::cerr << i << " " << besttemp << " " << bestkld << std::endl;
+          */
+          for (int j = 0; j < 1858; j++) {
+            /*
+            if (policy[j] >= 0.0) {
+              std::cerr << i << " " << j << " " << policy[j] << " "
+                        << fileContents[i].probabilities[j] << std::endl;
             }
-            rootNode = rootNode->children[idx];
-            history.Append(moves[i]);
+            */
+            fileContents[i].probabilities[j] = policy[j];
           }
         }
+        if (i + 1 < fileContents.size()) {
+          int transform = TransformForPosition(input_format, history);
+          int idx = MoveToNNIndex(moves[i], transform);
+          key = PolicySubIndex::ChildKey(key, idx);
+          if (!policy_subs.Find(key, &policy)) break;
+          history.Append(moves[i]);
+        }
       }
+    }
 
-      PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
-                    &board, &rule50ply, &gameply);
-      history.Reset(board, rule50ply, gameply);
-      int last_rescore = -1;
-      orig_counts[ResultForData(fileContents[0]) + 1]++;
-      fixed_counts[ResultForData(fileContents[0]) + 1]++;
-      for (int i = 0; i < static_cast<int>(moves.size()); i++) {
-        history.Append(moves[i]);
-        const auto& board = history.Last().GetBoard();
-        if (board.castlings().no_legal_castle() &&
-            history.Last().GetRule50Ply() == 0 &&
-            (board.ours() | board.theirs()).count() <=
-                tablebase->max_cardinality()) {
-          ProbeState state;
-          WDLScore wdl = tablebase->probe_wdl(history.Last(), &state);
-          // Only fail state means the WDL is wrong, probe_wdl may produce
-          // correct result with a stat other than OK.
-          if (state != FAIL) {
-            int8_t score_to_apply = 0;
-            if (wdl == WDL_WIN) {
-              score_to_apply = 1;
-            } else if (wdl == WDL_LOSS) {
-              score_to_apply = -1;
-            }
-            for (int j = i + 1; j > last_rescore; j--) {
-              if (ResultForData(fileContents[j]) != score_to_apply) {
-                if (j == i + 1 && last_rescore == -1) {
-                  fixed_counts[ResultForData(fileContents[0]) + 1]--;
-                  bool flip = (i % 2) == 0;
-                  fixed_counts[(flip ? -score_to_apply : score_to_apply) + 1]++;
-                  /*
-                  std::cerr << "Rescoring: " << file << " "  <<
-                  (int)fileContents[j].result << " -> "
-                            << (int)score_to_apply
-                            << std::endl;
-                            */
-                }
-                rescored += 1;
-                delta += abs(ResultForData(fileContents[j]) - score_to_apply);
+    PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
+                  &board, &rule50ply, &gameply);
+    history.Reset(board, rule50ply, gameply);
+    int last_rescore = -1;
+    orig_counts[ResultForData(fileContents[0]) + 1]++;
+    fixed_counts[ResultForData(fileContents[0]) + 1]++;
+    for (int i = 0; i < static_cast<int>(moves.size()); i++) {
+      history.Append(moves[i]);
+      const auto& board = history.Last().GetBoard();
+      if (board.castlings().no_legal_castle() &&
+          history.Last().GetRule50Ply() == 0 &&
+          (board.ours() | board.theirs()).count() <=
+              tablebase->max_cardinality()) {
+        ProbeState state;
+        WDLScore wdl = tablebase->probe_wdl(history.Last(), &state);
+        // Only fail state means the WDL is wrong, probe_wdl may produce
+        // correct result with a stat other than OK.
+        if (state != FAIL) {
+          int8_t score_to_apply = 0;
+          if (wdl == WDL_WIN) {
+            score_to_apply = 1;
+          } else if (wdl == WDL_LOSS) {
+            score_to_apply = -1;
+          }
+          for (int j = i + 1; j > last_rescore; j--) {
+            if (ResultForData(fileContents[j]) != score_to_apply) {
+              if (j == i + 1 && last_rescore == -1) {
+                fixed_counts[ResultForData(fileContents[0]) + 1]--;
+                bool flip = (i % 2) == 0;
+                fixed_counts[(flip ? -score_to_apply : score_to_apply) + 1]++;
                 /*
-              std::cerr << "Rescoring: " << (int)fileContents[j].result << " ->
-              "
-                        << (int)score_to_apply
-                        << std::endl;
-                        */
+                std::cerr << "Rescoring: " << file << " "  <<
+                (int)fileContents[j].result << " -> "
+                          << (int)score_to_apply
+                          << std::endl;
+                          */
               }
+              rescored += 1;
+              delta += abs(ResultForData(fileContents[j]) - score_to_apply);
+              /*
+            std::cerr << "Rescoring: " << (int)fileContents[j].result << " ->
+            "
+                      << (int)score_to_apply
+                      << std::endl;
+                      */
+            }
 
-              if (score_to_apply == 0) {
-                fileContents[j].result_d = 1.0f;
-              } else {
-                fileContents[j].result_d = 0.0f;
-              }
-              fileContents[j].result_q = static_cast<float>(score_to_apply);
-              score_to_apply = -score_to_apply;
+            if (score_to_apply == 0) {
+              fileContents[j].result_d = 1.0f;
+            } else {
+              fileContents[j].result_d = 0.0f;
             }
-            last_rescore = i + 1;
+            fileContents[j].result_q = static_cast<float>(score_to_apply);
+            score_to_apply = -score_to_apply;
           }
+          last_rescore = i + 1;
         }
       }
-      PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
-                    &board, &rule50ply, &gameply);
-      history.Reset(board, rule50ply, gameply);
-      for (size_t i = 0; i < moves.size(); i++) {
-        history.Append(moves[i]);
-        const auto& board = history.Last().GetBoard();
-        if (board.castlings().no_legal_castle() &&
-            history.Last().GetRule50Ply() != 0 &&
-            (board.ours() | board.theirs()).count() <=
-                tablebase->max_cardinality()) {
-          ProbeState state;
-          WDLScore wdl = tablebase->probe_wdl(history.Last(), &state);
-          // Only fail state means the WDL is wrong, probe_wdl may produce
-          // correct result with a stat other than OK.
-          if (state != FAIL) {
-            int8_t score_to_apply = 0;
-            if (wdl == WDL_WIN) {
-              score_to_apply = 1;
-            } else if (wdl == WDL_LOSS) {
-              score_to_apply = -1;
-            }
-            // If the WDL result disagrees with the game outcome, make it a
-            // draw. WDL draw is always draw regardless of prior moves since
-            // zero, so that clearly works. Otherwise, the WDL result could be
-            // correct or draw, so best we can do is change scores that don't
-            // agree, to be a draw. If score was a draw this is a no-op, if it
-            // was opposite it becomes a draw.
-            int8_t new_score =
-                ResultForData(fileContents[i + 1]) != score_to_apply
-                    ? 0
-                    : ResultForData(fileContents[i + 1]);
-            bool dtz_rescored = false;
-            // if score is not already right, and the score to apply isn't 0,
-            // dtz can let us know its definitely correct.
-            if (ResultForData(fileContents[i + 1]) != score_to_apply &&
-                score_to_apply != 0) {
-              // Any repetitions in the history since last 50 ply makes it risky
-              // to assume dtz is still correct.
-              int steps = history.Last().GetRule50Ply();
-              bool no_reps = true;
-              for (int i = 0; i < steps; i++) {
-                // If game started from non-zero 50 move rule, this could
-                // underflow. Only safe option is to assume there were
-                // repetitions before this point.
-                if (history.GetLength() - i - 1 < 0) {
-                  no_reps = false;
-                  break;
-                }
-                if (history.GetPositionAt(history.GetLength() - i - 1)
-                        .GetRepetitions() != 0) {
-                  no_reps = false;
-                  break;
-                }
+    }
+    PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
+                  &board, &rule50ply, &gameply);
+    history.Reset(board, rule50ply, gameply);
+    for (size_t i = 0; i < moves.size(); i++) {
+      history.Append(moves[i]);
+      const auto& board = history.Last().GetBoard();
+      if (board.castlings().no_legal_castle() &&
+          history.Last().GetRule50Ply() != 0 &&
+          (board.ours() | board.theirs()).count() <=
+              tablebase->max_cardinality()) {
+        ProbeState state;
+        WDLScore wdl = tablebase->probe_wdl(history.Last(), &state);
+        // Only fail state means the WDL is wrong, probe_wdl may produce
+        // correct result with a stat other than OK.
+        if (state != FAIL) {
+          int8_t score_to_apply = 0;
+          if (wdl == WDL_WIN) {
+            score_to_apply = 1;
+          } else if (wdl == WDL_LOSS) {
+            score_to_apply = -1;
+          }
+          // If the WDL result disagrees with the game outcome, make it a
+          // draw. WDL draw is always draw regardless of prior moves since
+          // zero, so that clearly works. Otherwise, the WDL result could be
+          // correct or draw, so best we can do is change scores that don't
+          // agree, to be a draw. If score was a draw this is a no-op, if it
+          // was opposite it becomes a draw.
+          int8_t new_score =
+              ResultForData(fileContents[i + 1]) != score_to_apply
+                  ? 0
+                  : ResultForData(fileContents[i + 1]);
+          bool dtz_rescored = false;
+          // if score is not already right, and the score to apply isn't 0,
+          // dtz can let us know its definitely correct.
+          if (ResultForData(fileContents[i + 1]) != score_to_apply &&
+              score_to_apply != 0) {
+            // Any repetitions in the history since last 50 ply makes it risky
+            // to assume dtz is still correct.
+            int steps = history.Last().GetRule50Ply();
+            bool no_reps = true;
+            for (int i = 0; i < steps; i++) {
+              // If game started from non-zero 50 move rule, this could
+              // underflow. Only safe option is to assume there were
+              // repetitions before this point.
+              if (history.GetLength() - i - 1 < 0) {
+                no_reps = false;
+                break;
               }
-              if (no_reps) {
-                int depth = tablebase->probe_dtz(history.Last(), &state);
-                if (state != FAIL) {
-                  // This should be able to be <= 99 safely, but I've not
-                  // convinced myself thats true.
-                  if (steps + std::abs(depth) < 99) {
-                    rescored3++;
-                    new_score = score_to_apply;
-                    dtz_rescored = true;
-                  }
-                }
+              if (history.GetPositionAt(history.GetLength() - i - 1)
+                      .GetRepetitions() != 0) {
+                no_reps = false;
+                break;
               }
             }
-
-            // If score is not already a draw, and its not obviously a draw,
-            // check if 50 move rule has advanced so far its obviously a draw.
-            // Obviously not needed if we've already proven with dtz that its a
-            // win/loss.
-            if (ResultForData(fileContents[i + 1]) != 0 &&
-                score_to_apply != 0 && !dtz_rescored) {
+            if (no_reps) {
               int depth = tablebase->probe_dtz(history.Last(), &state);
               if (state != FAIL) {
-                int steps = history.Last().GetRule50Ply();
-                // This should be able to be >= 101 safely, but I've not
+                // This should be able to be <= 99 safely, but I've not
                 // convinced myself thats true.
-                if (steps + std::abs(depth) > 101) {
+                if (steps + std::abs(depth) < 99) {
                   rescored3++;
-                  new_score = 0;
+                  new_score = score_to_apply;
                   dtz_rescored = true;
                 }
               }
             }
-            if (new_score != ResultForData(fileContents[i + 1])) {
-              rescored2 += 1;
-              /*
-            std::cerr << "Rescoring: " << (int)fileContents[j].result << " -> "
-                      << (int)score_to_apply
-                      << std::endl;
-                      */
-            }
+          }
 
-            if (new_score == 0) {
-              fileContents[i + 1].result_d = 1.0f;
-            } else {
-              fileContents[i + 1].result_d = 0.0f;
+          // If score is not already a draw, and its not obviously a draw,
+          // check if 50 move rule has advanced so far its obviously a draw.
+          // Obviously not needed if we've already proven with dtz that its a
+          // win/loss.
+          if (ResultForData(fileContents[i + 1]) != 0 &&
+              score_to_apply != 0 && !dtz_rescored) {
+            int depth = tablebase->probe_dtz(history.Last(), &state);
+            if (state != FAIL) {
+              int steps = history.Last().GetRule50Ply();
+              // This should be able to be >= 101 safely, but I've not
+              // convinced myself thats true.
+              if (steps + std::abs(depth) > 101) {
+                rescored3++;
+                new_score = 0;
+                dtz_rescored = true;
+              }
             }
-            fileContents[i + 1].result_q = static_cast<float>(new_score);
           }
+          if (new_score != ResultForData(fileContents[i + 1])) {
+            rescored2 += 1;
+            /*
+          std::cerr << "Rescoring: " << (int)fileContents[j].result << " -> "
+                    << (int)score_to_apply
+                    << std::endl;
+                    */
+          }
+
+          if (new_score == 0) {
+            fileContents[i + 1].result_d = 1.0f;
+          } else {
+            fileContents[i + 1].result_d = 0.0f;
+          }
+          fileContents[i + 1].result_q = static_cast<float>(new_score);
         }
       }
+    }
 
-      if (distTemp != 1.0f || distOffset != 0.0f || dtzBoost != 0.0f) {
-        PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
-                      &board, &rule50ply, &gameply);
-        history.Reset(board, rule50ply, gameply);
-        int move_index = 0;
-        for (auto& chunk : fileContents) {
-          const auto& board = history.Last().GetBoard();
-          std::vector<bool> boost_probs(1858, false);
-          int boost_count = 0;
-
-          if (dtzBoost != 0.0f && board.castlings().no_legal_castle() &&
-              (board.ours() | board.theirs()).count() <=
-                  tablebase->max_cardinality()) {
-            MoveList to_boost;
-            MoveList maybe_boost;
-            tablebase->root_probe(history.Last(), true, true, &to_boost);
-            if (history.DidRepeatSinceLastZeroingMove()) {
-              maybe_boost = to_boost;
-            } else {
-              tablebase->root_probe(history.Last(), false, true, &maybe_boost);
+    if (distTemp != 1.0f || distOffset != 0.0f || dtzBoost != 0.0f) {
+      PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
+                    &board, &rule50ply, &gameply);
+      history.Reset(board, rule50ply, gameply);
+      int move_index = 0;
+      for (auto& chunk : fileContents) {
+        const auto& board = history.Last().GetBoard();
+        std::vector<bool> boost_probs(1858, false);
+        int boost_count = 0;
+
+        if (dtzBoost != 0.0f && board.castlings().no_legal_castle() &&
+            (board.ours() | board.theirs()).count() <=
+                tablebase->max_cardinality()) {
+          MoveList to_boost;
+          MoveList maybe_boost;
+          tablebase->root_probe(history.Last(), true, true, &to_boost);
+          if (history.DidRepeatSinceLastZeroingMove()) {
+            maybe_boost = to_boost;
+          } else {
+            tablebase->root_probe(history.Last(), false, true, &maybe_boost);
+          }
+          // If there is only one move, dtm fixup is not helpful.
+          // This code assumes all gaviota 3-4-5 tbs are present, as checked
+          // at startup.
+          if (gaviotaEnabled && maybe_boost.size() > 1 &&
+              (board.ours() | board.theirs()).count() <= 5) {
+            std::vector<unsigned int> dtms;
+            dtms.resize(maybe_boost.size());
+            unsigned int mininum_dtm = 1000;
+            // Only safe moves being considered, boost the smallest dtm
+            // amongst them.
+            for (auto& move : maybe_boost) {
+              Position next_pos = Position(history.Last(), move);
+              unsigned int info;
+              unsigned int dtm;
+              gaviota_tb_probe_hard(next_pos, info, dtm);
+              dtms.push_back(dtm);
+              if (dtm < mininum_dtm) mininum_dtm = dtm;
             }
-            // If there is only one move, dtm fixup is not helpful.
-            // This code assumes all gaviota 3-4-5 tbs are present, as checked
-            // at startup.
-            if (gaviotaEnabled && maybe_boost.size() > 1 &&
-                (board.ours() | board.theirs()).count() <= 5) {
-              std::vector<unsigned int> dtms;
-              dtms.resize(maybe_boost.size());
-              unsigned int mininum_dtm = 1000;
-              // Only safe moves being considered, boost the smallest dtm
-              // amongst them.
+            if (mininum_dtm < 1000) {
+              to_boost.clear();
+              int dtm_idx = 0;
               for (auto& move : maybe_boost) {
-                Position next_pos = Position(history.Last(), move);
-                unsigned int info;
-                unsigned int dtm;
-                gaviota_tb_probe_hard(next_pos, info, dtm);
-                dtms.push_back(dtm);
-                if (dtm < mininum_dtm) mininum_dtm = dtm;
-              }
-              if (mininum_dtm < 1000) {
-                to_boost.clear();
-                int dtm_idx = 0;
-                for (auto& move : maybe_boost) {
-                  if (dtms[dtm_idx] == mininum_dtm) {
-                    to_boost.push_back(move);
-                  }
-                  dtm_idx++;
+                if (dtms[dtm_idx] == mininum_dtm) {
+                  to_boost.push_back(move);
                 }
-                policy_dtm_bump++;
+                dtm_idx++;
               }
+              policy_dtm_bump++;
             }
-            int transform = TransformForPosition(input_format, history);
-            for (auto& move : to_boost) {
-              boost_probs[MoveToNNIndex(move, transform)] = true;
-            }
-            boost_count = to_boost.size();
           }
-          float sum = 0.0;
-          int prob_index = 0;
-          float preboost_sum = 0.0f;
-          for (auto& prob : chunk.probabilities) {
-            float offset =
-                distOffset +
-                (boost_probs[prob_index] ? (dtzBoost / boost_count) : 0.0f);
-            if (dtzBoost != 0.0f && boost_probs[prob_index]) {
-              preboost_sum += prob;
-              if (prob < 0 || std::isnan(prob))
-                std::cerr << "Bump for move that is illegal????" << std::endl;
-              policy_bump++;
-            }
-            prob_index++;
-            if (prob < 0 || std::isnan(prob)) continue;
-            prob = std::max(0.0f, prob + offset);
-            prob = std::pow(prob, 1.0f / distTemp);
-            sum += prob;
+          int transform = TransformForPosition(input_format, history);
+          for (auto& move : to_boost) {
+            boost_probs[MoveToNNIndex(move, transform)] = true;
           }
-          prob_index = 0;
-          float boost_sum = 0.0f;
-          for (auto& prob : chunk.probabilities) {
-            if (dtzBoost != 0.0f && boost_probs[prob_index]) {
-              boost_sum += prob / sum;
-            }
-            prob_index++;
-            if (prob < 0 || std::isnan(prob)) continue;
-            prob /= sum;
+          boost_count = to_boost.size();
+        }
+        float sum = 0.0;
+        int prob_index = 0;
+        float preboost_sum = 0.0f;
+        for (auto& prob : chunk.probabilities) {
+          float offset =
+              distOffset +
+              (boost_probs[prob_index] ? (dtzBoost / boost_count) : 0.0f);
+          if (dtzBoost != 0.0f && boost_probs[prob_index]) {
+            preboost_sum += prob;
+            if (prob < 0 || std::isnan(prob))
+              std::cerr << "Bump for move that is illegal????" << std::endl;
+            policy_bump++;
           }
-          if (boost_count > 0) {
-            policy_nobump_total_hist[(int)(preboost_sum * 10)]++;
-            policy_bump_total_hist[(int)(boost_sum * 10)]++;
+          prob_index++;
+          if (prob < 0 || std::isnan(prob)) continue;
+          prob = std::max(0.0f, prob + offset);
+          prob = std::pow(prob, 1.0f / distTemp);
+          sum += prob;
+        }
+        prob_index = 0;
+        float boost_sum = 0.0f;
+        for (auto& prob : chunk.probabilities) {
+          if (dtzBoost != 0.0f && boost_probs[prob_index]) {
+            boost_sum += prob / sum;
           }
-          history.Append(moves[move_index]);
-          move_index++;
+          prob_index++;
+          if (prob < 0 || std::isnan(prob)) continue;
+          prob /= sum;
+        }
+        if (boost_count > 0) {
+          policy_nobump_total_hist[(int)(preboost_sum * 10)]++;
+          policy_bump_total_hist[(int)(boost_sum * 10)]++;
         }
+        history.Append(moves[move_index]);
+        move_index++;
       }
+    }
 
-      // Make move_count field plies_left for moves left head.
-      int offset = 0;
-      bool all_draws = true;
-      for (auto& chunk : fileContents) {
-        // plies_left can't be 0 for real v5 data, so if it is 0 it must be a v4
-        // conversion, and we should populate it ourselves with a better
-        // starting estimate.
-        if (chunk.plies_left == 0.0f) {
-          chunk.plies_left = (int)(fileContents.size() - offset);
-        }
-        offset++;
-        all_draws = all_draws && (ResultForData(chunk) == 0);
+    // Make move_count field plies_left for moves left head.
+    int offset = 0;
+    bool all_draws = true;
+    for (auto& chunk : fileContents) {
+      // plies_left can't be 0 for real v5 data, so if it is 0 it must be a v4
+      // conversion, and we should populate it ourselves with a better
+      // starting estimate.
+      if (chunk.plies_left == 0.0f) {
+        chunk.plies_left = (int)(fileContents.size() - offset);
       }
+      offset++;
+      all_draws = all_draws && (ResultForData(chunk) == 0);
+    }
 
-      // Correct plies_left using Gaviota TBs for 5 piece and less positions.
-      if (gaviotaEnabled && !all_draws) {
-        PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
-                      &board, &rule50ply, &gameply);
-        history.Reset(board, rule50ply, gameply);
-        int last_rescore = 0;
-        for (size_t i = 0; i < moves.size(); i++) {
-          history.Append(moves[i]);
-          const auto& board = history.Last().GetBoard();
+    // Correct plies_left using Gaviota TBs for 5 piece and less positions.
+    if (gaviotaEnabled && !all_draws) {
+      PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
+                    &board, &rule50ply, &gameply);
+      history.Reset(board, rule50ply, gameply);
+      int last_rescore = 0;
+      for (size_t i = 0; i < moves.size(); i++) {
+        history.Append(moves[i]);
+        const auto& board = history.Last().GetBoard();
 
-          // Gaviota TBs don't have 50 move rule.
-          // Only consider positions that are not draw after rescoring.
-          if ((ResultForData(fileContents[i + 1]) != 0) &&
-              board.castlings().no_legal_castle() &&
-              (board.ours() | board.theirs()).count() <= 5) {
-            std::vector<int> dtms;
-            unsigned int info;
-            unsigned int dtm;
-            gaviota_tb_probe_hard(history.Last(), info, dtm);
-            if (info != tb_WMATE && info != tb_BMATE) {
-              // Not a win for either player.
-              continue;
+        // Gaviota TBs don't have 50 move rule.
+        // Only consider positions that are not draw after rescoring.
+        if ((ResultForData(fileContents[i + 1]) != 0) &&
+            board.castlings().no_legal_castle() &&
+            (board.ours() | board.theirs()).count() <= 5) {
+          std::vector<int> dtms;
+          unsigned int info;
+          unsigned int dtm;
+          gaviota_tb_probe_hard(history.Last(), info, dtm);
+          if (info != tb_WMATE && info != tb_BMATE) {
+            // Not a win for either player.
+            continue;
+          }
+          int steps = history.Last().GetRule50Ply();
+          if ((dtm + steps > 99) && (dtm <= fileContents[i + 1].plies_left)) {
+            // Following DTM could trigger 50 move rule and the current
+            // move_count is more than DTM.
+            // If DTM is more than the current move_count then we can rescore
+            // using it since DTM50 is not shorter than DTM.
+            continue;
+          }
+          bool no_reps = true;
+          for (int i = 0; i < steps; i++) {
+            // If game started from non-zero 50 move rule, this could
+            // underflow. Only safe option is to assume there were repetitions
+            // before this point.
+            if (history.GetLength() - i - 1 < 0) {
+              no_reps = false;
+              break;
             }
-            int steps = history.Last().GetRule50Ply();
-            if ((dtm + steps > 99) && (dtm <= fileContents[i + 1].plies_left)) {
-              // Following DTM could trigger 50 move rule and the current
-              // move_count is more than DTM.
-              // If DTM is more than the current move_count then we can rescore
-              // using it since DTM50 is not shorter than DTM.
-              continue;
+            if (history.GetPositionAt(history.GetLength() - i - 1)
+                    .GetRepetitions() != 0) {
+              no_reps = false;
+              break;
+            }
+          }
+          if (!no_reps) {
+            // There were repetitions. Do nothing since DTM path
+            // could trigger draw by repetition.
+            continue;
+          }
+          gaviota_dtm_rescores++;
+          int j;
+          for (j = i; j >= -1; j--) {
+            if (j <= last_rescore) {
+              break;
+            }
+            // std::cerr << j << " " << int(fileContents[j + 1].move_count) <<
+            // " -> " << int(dtm + (i - j)) << std::endl;
+            fileContents[j + 1].plies_left = int(dtm + (i - j));
+          }
+          last_rescore = i;
+        }
+      }
+    }
+
+    // Correct move_count using DTZ for 3 piece no-pawn positions only.
+    // If Gaviota TBs are enabled no need to use syzygy.
+    if (!gaviotaEnabled && !all_draws) {
+      PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
+                    &board, &rule50ply, &gameply);
+      history.Reset(board, rule50ply, gameply);
+      for (size_t i = 0; i < moves.size(); i++) {
+        history.Append(moves[i]);
+        const auto& board = history.Last().GetBoard();
+        if (board.castlings().no_legal_castle() &&
+            (board.ours() | board.theirs()).count() <= 3 &&
+            board.pawns().empty()) {
+          ProbeState state;
+          WDLScore wdl = tablebase->probe_wdl(history.Last(), &state);
+          // Only fail state means the WDL is wrong, probe_wdl may produce
+          // correct result with a stat other than OK.
+          if (state != FAIL) {
+            int8_t score_to_apply = 0;
+            if (wdl == WDL_WIN) {
+              score_to_apply = 1;
+            } else if (wdl == WDL_LOSS) {
+              score_to_apply = -1;
             }
+            // No point updating for draws.
+            if (score_to_apply == 0) continue;
+            // Any repetitions in the history since last 50 ply makes it risky
+            // to assume dtz is still correct.
+            int steps = history.Last().GetRule50Ply();
             bool no_reps = true;
             for (int i = 0; i < steps; i++) {
               // If game started from non-zero 50 move rule, this could
-              // underflow. Only safe option is to assume there were repetitions
-              // before this point.
+              // underflow. Only safe option is to assume there were
+              // repetitions before this point.
               if (history.GetLength() - i - 1 < 0) {
                 no_reps = false;
                 break;
@@ -867,86 +1344,22 @@ void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
                 break;
               }
             }
-            if (!no_reps) {
-              // There were repetitions. Do nothing since DTM path
-              // could trigger draw by repetition.
-              continue;
-            }
-            gaviota_dtm_rescores++;
-            int j;
-            for (j = i; j >= -1; j--) {
-              if (j <= last_rescore) {
-                break;
-              }
-              // std::cerr << j << " " << int(fileContents[j + 1].move_count) <<
-              // " -> " << int(dtm + (i - j)) << std::endl;
-              fileContents[j + 1].plies_left = int(dtm + (i - j));
-            }
-            last_rescore = i;
-          }
-        }
-      }
-
-      // Correct move_count using DTZ for 3 piece no-pawn positions only.
-      // If Gaviota TBs are enabled no need to use syzygy.
-      if (!gaviotaEnabled && !all_draws) {
-        PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
-                      &board, &rule50ply, &gameply);
-        history.Reset(board, rule50ply, gameply);
-        for (size_t i = 0; i < moves.size(); i++) {
-          history.Append(moves[i]);
-          const auto& board = history.Last().GetBoard();
-          if (board.castlings().no_legal_castle() &&
-              (board.ours() | board.theirs()).count() <= 3 &&
-              board.pawns().empty()) {
-            ProbeState state;
-            WDLScore wdl = tablebase->probe_wdl(history.Last(), &state);
-            // Only fail state means the WDL is wrong, probe_wdl may produce
-            // correct result with a stat other than OK.
-            if (state != FAIL) {
-              int8_t score_to_apply = 0;
-              if (wdl == WDL_WIN) {
-                score_to_apply = 1;
-              } else if (wdl == WDL_LOSS) {
-                score_to_apply = -1;
-              }
-              // No point updating for draws.
-              if (score_to_apply == 0) continue;
-              // Any repetitions in the history since last 50 ply makes it risky
-              // to assume dtz is still correct.
-              int steps = history.Last().GetRule50Ply();
-              bool no_reps = true;
-              for (int i = 0; i < steps; i++) {
-                // If game started from non-zero 50 move rule, this could
-                // underflow. Only safe option is to assume there were
-                // repetitions before this point.
-                if (history.GetLength() - i - 1 < 0) {
-                  no_reps = false;
-                  break;
-                }
-                if (history.GetPositionAt(history.GetLength() - i - 1)
-                        .GetRepetitions() != 0) {
-                  no_reps = false;
-                  break;
+            if (no_reps) {
+              int depth = tablebase->probe_dtz(history.Last(), &state);
+              if (state != FAIL) {
+                // if depth == -1 this is wrong, since that is mate and the
+                // answer should be 0, but the move before depth is -2. Since
+                // data never contains mate position, ignore that discrepency.
+                int converted_ply_remaining = std::abs(depth);
+                // This should be able to be <= 99 safely, but I've not
+                // convinced myself thats true.
+                if (steps + std::abs(depth) < 99) {
+                  fileContents[i + 1].plies_left = converted_ply_remaining;
                 }
-              }
-              if (no_reps) {
-                int depth = tablebase->probe_dtz(history.Last(), &state);
-                if (state != FAIL) {
-                  // if depth == -1 this is wrong, since that is mate and the
-                  // answer should be 0, but the move before depth is -2. Since
-                  // data never contains mate position, ignore that discrepency.
-                  int converted_ply_remaining = std::abs(depth);
-                  // This should be able to be <= 99 safely, but I've not
-                  // convinced myself thats true.
-                  if (steps + std::abs(depth) < 99) {
-                    fileContents[i + 1].plies_left = converted_ply_remaining;
-                  }
-                  if (steps == 0) {
-                    for (int j = i; j >= 0; j--) {
-                      fileContents[j].plies_left =
-                          converted_ply_remaining + (i + 1 - j);
-                    }
+                if (steps == 0) {
+                  for (int j = i; j >= 0; j--) {
+                    fileContents[j].plies_left =
+                        converted_ply_remaining + (i + 1 - j);
                   }
                 }
               }
@@ -954,178 +1367,393 @@ void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
           }
         }
       }
-      // Deblunder only works from v6 data onwards. We therefore check
-      // the visits field which is 0 if we're dealing with upgraded data.
-      if (deblunderEnabled && fileContents.back().visits > 0) {
-        PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
-                      &board, &rule50ply, &gameply);
-        history.Reset(board, rule50ply, gameply);
-        for (size_t i = 0; i < moves.size(); i++) {
-          history.Append(moves[i]);
-          const auto& board = history.Last().GetBoard();
-          if (board.castlings().no_legal_castle() &&
-              (board.ours() | board.theirs()).count() <=
-                  tablebase->max_cardinality()) {
-            history.Pop();
-            break;
-          }
+    }
+    // Deblunder only works from v6 data onwards. We therefore check
+    // the visits field which is 0 if we're dealing with upgraded data.
+    if (deblunderEnabled && fileContents.back().visits > 0) {
+      PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
+                    &board, &rule50ply, &gameply);
+      history.Reset(board, rule50ply, gameply);
+      for (size_t i = 0; i < moves.size(); i++) {
+        history.Append(moves[i]);
+        const auto& board = history.Last().GetBoard();
+        if (board.castlings().no_legal_castle() &&
+            (board.ours() | board.theirs()).count() <=
+                tablebase->max_cardinality()) {
+          history.Pop();
+          break;
         }
-        float activeZ[3] = {fileContents.back().result_q,
-                            fileContents.back().result_d,
-                            fileContents.back().plies_left};
-        bool deblunderingStarted = false;
-        while (true) {
-          auto& cur = fileContents[history.GetLength() - 1];
-          // A blunder is defined by the played move being worse than the
-          // best move by a defined threshold, missing a forced win, or
-          // playing into a proven loss without being forced.
-          bool deblunderTriggerThreshold =
-              (cur.best_q - cur.played_q >
-               deblunderQBlunderThreshold - deblunderQBlunderWidth / 2.0);
-          bool deblunderTriggerTerminal =
-              (cur.best_q > -1 && cur.played_q < 1 &&
-               ((cur.best_q == 1 && ((cur.invariance_info & 8) != 0)) ||
-                cur.played_q == -1));
-          if (deblunderTriggerThreshold || deblunderTriggerTerminal) {
-            float newZRatio = 1.0f;
-            // If width > 0 and the deblunder didn't involve a terminal
-            // position, we apply a soft threshold by averaging old and new Z.
-            if (deblunderQBlunderWidth > 0 && !deblunderTriggerTerminal) {
-              newZRatio = std::min(1.0f, (cur.best_q - cur.played_q -
-                                          deblunderQBlunderThreshold) /
-                                                 deblunderQBlunderWidth +
-                                             0.5f);
-            }
-            // Instead of averaging, a randomization can be applied here with
-            // newZRatio = newZRatio > rand( [0, 1) ) ? 1.0f : 0.0f;
-            activeZ[0] = (1 - newZRatio) * activeZ[0] + newZRatio * cur.best_q;
-            activeZ[1] = (1 - newZRatio) * activeZ[1] + newZRatio * cur.best_d;
-            activeZ[2] = (1 - newZRatio) * activeZ[2] + newZRatio * cur.best_m;
-            deblunderingStarted = true;
-            blunders += 1;
-            /* std::cout << "Blunder detected. Best move q=" << cur.best_q <<
-             " played move q=" << cur.played_q; */
-          }
-          if (deblunderingStarted) {
-            /*
-            std::cerr << "Deblundering: "
-                      << fileContents[history.GetLength() - 1].best_q << " "
-                      << fileContents[history.GetLength() - 1].best_d << " "
-                      << (int)fileContents[history.GetLength() - 1].result << "
-            "
-                      << (int)activeZ << std::endl;
-                      */
-            fileContents[history.GetLength() - 1].result_q = activeZ[0];
-            fileContents[history.GetLength() - 1].result_d = activeZ[1];
-            fileContents[history.GetLength() - 1].plies_left = activeZ[2];
+      }
+      float activeZ[3] = {fileContents.back().result_q,
+                          fileContents.back().result_d,
+                          fileContents.back().plies_left};
+      bool deblunderingStarted = false;
+      while (true) {
+        auto& cur = fileContents[history.GetLength() - 1];
+        // A blunder is defined by the played move being worse than the
+        // best move by a defined threshold, missing a forced win, or
+        // playing into a proven loss without being forced.
+        bool deblunderTriggerThreshold =
+            (cur.best_q - cur.played_q >
+             deblunderQBlunderThreshold - deblunderQBlunderWidth / 2.0);
+        bool deblunderTriggerTerminal =
+            (cur.best_q > -1 && cur.played_q < 1 &&
+             ((cur.best_q == 1 && ((cur.invariance_info & 8) != 0)) ||
+              cur.played_q == -1));
+        if (deblunderTriggerThreshold || deblunderTriggerTerminal) {
+          float newZRatio = 1.0f;
+          // If width > 0 and the deblunder didn't involve a terminal
+          // position, we apply a soft threshold by averaging old and new Z.
+          if (deblunderQBlunderWidth > 0 && !deblunderTriggerTerminal) {
+            newZRatio = std::min(1.0f, (cur.best_q - cur.played_q -
+                                        deblunderQBlunderThreshold) /
+                                               deblunderQBlunderWidth +
+                                           0.5f);
           }
-          if (history.GetLength() == 1) break;
-          // Q values are always from the player to move.
-          activeZ[0] = -activeZ[0];
-          // Estimated remaining plies left has to be increased.
-          activeZ[2] += 1.0f;
-          history.Pop();
+          // Instead of averaging, a randomization can be applied here with
+          // newZRatio = newZRatio > rand( [0, 1) ) ? 1.0f : 0.0f;
+          activeZ[0] = (1 - newZRatio) * activeZ[0] + newZRatio * cur.best_q;
+          activeZ[1] = (1 - newZRatio) * activeZ[1] + newZRatio * cur.best_d;
+          activeZ[2] = (1 - newZRatio) * activeZ[2] + newZRatio * cur.best_m;
+          deblunderingStarted = true;
+          blunders += 1;
+          /* std::cout << "Blunder detected. Best move q=" << cur.best_q <<
+           " played move q=" << cur.played_q; */
+        }
+        if (deblunderingStarted) {
+          /*
+          std::cerr << "Deblundering: "
+                    << fileContents[history.GetLength() - 1].best_q << " "
+                    << fileContents[history.GetLength() - 1].best_d << " "
+                    << (int)fileContents[history.GetLength() - 1].result << "
+          "
+                    << (int)activeZ << std::endl;
+                    */
+          fileContents[history.GetLength() - 1].result_q = activeZ[0];
+          fileContents[history.GetLength() - 1].result_d = activeZ[1];
+          fileContents[history.GetLength() - 1].plies_left = activeZ[2];
         }
+        if (history.GetLength() == 1) break;
+        // Q values are always from the player to move.
+        activeZ[0] = -activeZ[0];
+        // Estimated remaining plies left has to be increased.
+        activeZ[2] += 1.0f;
+        history.Pop();
+      }
+    }
+    if (newInputFormat != -1) {
+      PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
+                    &board, &rule50ply, &gameply);
+      history.Reset(board, rule50ply, gameply);
+      ChangeInputFormat(newInputFormat, &fileContents[0], history);
+      for (size_t i = 0; i < moves.size(); i++) {
+        history.Append(moves[i]);
+        ChangeInputFormat(newInputFormat, &fileContents[i + 1], history);
       }
+    }
+
+    // Output data in Stockfish plain and binary formats.
+    std::ostringstream out;
+    if (!nnue_plain_file.empty() || nnue_bin) {
+      auto add = [&](const Position& p, Move m, float q, int result) {
+        if (!nnue_plain_file.empty()) out << AsNnueString(p, m, q, result);
+        if (nnue_bin) nnue_bin->Add(AsPackedSfen(p, m, q, result));
+      };
+      pblczero::NetworkFormat::InputFormat format;
       if (newInputFormat != -1) {
-        PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
-                      &board, &rule50ply, &gameply);
-        history.Reset(board, rule50ply, gameply);
-        ChangeInputFormat(newInputFormat, &fileContents[0], history);
-        for (size_t i = 0; i < moves.size(); i++) {
+        format =
+            static_cast<pblczero::NetworkFormat::InputFormat>(newInputFormat);
+      } else {
+        format = input_format;
+      }
+      PopulateBoard(format, PlanesFromTrainingData(fileContents[0]), &board,
+                    &rule50ply, &gameply);
+      history.Reset(board, rule50ply, gameply);
+      for (size_t i = 0; i < fileContents.size(); i++) {
+        auto chunk = fileContents[i];
+        Position p = history.Last();
+        if (chunk.visits > 0) {
+          // Format is v6 and position is evaluated.
+          Move m = MoveFromNNIndex(
+              flags.nnue_best_move ? chunk.best_idx : chunk.played_idx,
+              TransformForPosition(format, history));
+          float q = flags.nnue_best_score ? chunk.best_q : chunk.played_q;
+          add(p, m, q, round(chunk.result_q));
+        } else if (i < moves.size()) {
+          add(p, moves[i], chunk.best_q, round(chunk.result_q));
+        }
+        if (i < moves.size()) {
           history.Append(moves[i]);
-          ChangeInputFormat(newInputFormat, &fileContents[i + 1], history);
         }
       }
-
-      if (!outputDir.empty()) {
-        std::string fileName = file.substr(file.find_last_of("/\\") + 1);
-        TrainingDataWriter writer(outputDir + "/" + fileName);
-        for (auto chunk : fileContents) {
-          // Don't save chunks that just provide move history.
-          if ((chunk.invariance_info & 64) == 0) {
-            writer.WriteChunk(chunk);
-          }
-        }
+    }
+    if (!nnue_plain_file.empty()) {
+      static Mutex mutex;
+      std::ofstream file;
+      Mutex::Lock lock(mutex);
+      file.open(nnue_plain_file, std::ios_base::app);
+      if (file.is_open()) {
+        file << out.str();
+        file.close();
       }
+    }
+  } catch (Exception& ex) {
+    ReportError(game->file, ex, flags);
+    game->ok = false;
+  }
+}
 
-      // Output data in Stockfish plain format.
-      if (!nnue_plain_file.empty()) {
-        static Mutex mutex;
-        std::ostringstream out;
-        pblczero::NetworkFormat::InputFormat format;
-        if (newInputFormat != -1) {
-          format =
-              static_cast<pblczero::NetworkFormat::InputFormat>(newInputFormat);
-        } else {
-          format = input_format;
-        }
-        PopulateBoard(format, PlanesFromTrainingData(fileContents[0]), &board,
-                      &rule50ply, &gameply);
-        history.Reset(board, rule50ply, gameply);
-        for (size_t i = 0; i < fileContents.size(); i++) {
-          auto chunk = fileContents[i];
-          Position p = history.Last();
-          if (chunk.visits > 0) {
-            // Format is v6 and position is evaluated.
-            Move m = MoveFromNNIndex(
-                flags.nnue_best_move ? chunk.best_idx : chunk.played_idx,
-                TransformForPosition(format, history));
-            float q = flags.nnue_best_score ? chunk.best_q : chunk.played_q;
-            out << AsNnueString(p, m, q, round(chunk.result_q));
-          } else if (i < moves.size()) {
-            out << AsNnueString(p, moves[i], chunk.best_q,
-                                round(chunk.result_q));
-          }
-          if (i < moves.size()) {
-            history.Append(moves[i]);
-          }
-        }
-        std::ofstream file;
-        Mutex::Lock lock(mutex);
-        file.open(nnue_plain_file, std::ios_base::app);
-        if (file.is_open()) {
-          file << out.str();
-          file.close();
+void WriteFile(const GameFile& game, const std::string& outputDir,
+               ProcessFileFlags flags) {
+  // Scope to ensure the writer is closed before deleting source file.
+  if (game.ok && !outputDir.empty()) {
+    try {
+      std::string fileName =
+          game.file.substr(game.file.find_last_of("/\\") + 1);
+      TrainingDataWriter writer(outputDir + "/" + fileName);
+      for (const auto& chunk : game.chunks) {
+        // Don't save chunks that just provide move history.
+        if ((chunk.invariance_info & 64) == 0) {
+          writer.WriteChunk(chunk);
         }
       }
     } catch (Exception& ex) {
-      std::cerr << "While processing: " << file
-                << " - Exception thrown: " << ex.what() << std::endl;
-      if (flags.delete_files) {
-        std::cerr << "It will be deleted." << std::endl;
-      }
+      ReportError(game.file, ex, flags);
     }
   }
   if (flags.delete_files) {
-    remove(file.c_str());
+    remove(game.file.c_str());
   }
 }
 
-void ProcessFiles(const std::vector<std::string>& files,
-                  SyzygyTablebase* tablebase, std::string outputDir,
-                  float distTemp, float distOffset, float dtzBoost,
-                  int newInputFormat, int offset, int mod,
-                  std::string nnue_plain_file, ProcessFileFlags flags) {
-  std::cerr << "Thread: " << offset << " starting" << std::endl;
-  for (size_t i = offset; i < files.size(); i += mod) {
-    if (files[i].rfind(".gz") != files[i].size() - 3) {
-      std::cerr << "Skipping: " << files[i] << std::endl;
-      continue;
+// Bounded queue between two stages of the pipeline. Pop() returns nullopt
+// once the queue is closed and drained.
+template <typename T>
+class WorkQueue {
+ public:
+  explicit WorkQueue(size_t capacity) : capacity_(capacity) {}
+
+  void Push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [&] { return items_.size() < capacity_; });
+    items_.push_back(std::move(item));
+    not_empty_.notify_one();
+  }
+
+  std::optional<T> Pop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [&] { return !items_.empty() || closed_; });
+    if (items_.empty()) return std::nullopt;
+    T item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return item;
+  }
+
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+  }
+
+ private:
+  const size_t capacity_;
+  std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::deque<T> items_;
+  bool closed_ = false;
+};
+
+// Replaces training targets by evaluations of a network. Positions of many
+// games are collected into large computations.
+class NetworkRescorer {
+ public:
+  NetworkRescorer(Backend* backend, size_t batch_size, float softmax_temp,
+                  bool policy, bool value)
+      : backend_(backend),
+        batch_size_(batch_size),
+        softmax_temp_(softmax_temp),
+        policy_(policy),
+        value_(value) {}
+
+  size_t batch_size() const { return batch_size_; }
+
+  // Evaluates all positions of the games that are ok and updates their
+  // chunks.
+  void Rescore(std::span<GameFile> games) {
+    std::vector<Evaluation> pending;
+    // Inputs point into the elements, so the vector must not reallocate.
+    pending.reserve(batch_size_);
+    std::unique_ptr<BackendComputation> computation;
+    auto flush = [&]() {
+      if (pending.empty()) return;
+      computation->ComputeBlocking();
+      for (auto& evaluation : pending) Apply(&evaluation);
+      evaluated_ += pending.size();
+      pending.clear();
+      computation.reset();
+    };
+    for (auto& game : games) {
+      if (!game.ok) continue;
+      const auto positions = game.history.GetPositions();
+      for (size_t i = 0; i < game.chunks.size(); i++) {
+        if (!computation) computation = backend_->CreateComputation();
+        auto& evaluation = pending.emplace_back();
+        evaluation.chunk = &game.chunks[i];
+        evaluation.legal_moves = positions[i].GetBoard().GenerateLegalMoves();
+        evaluation.result.p.resize(evaluation.legal_moves.size());
+        computation->AddInput(
+            EvalPosition{positions.first(i + 1), evaluation.legal_moves},
+            evaluation.result.AsPtr());
+        if (pending.size() == batch_size_) flush();
+      }
+    }
+    flush();
+  }
+
+  void PrintStats() const {
+    std::cout << "Positions evaluated by network: " << evaluated_
+              << std::endl;
+  }
+
+ private:
+  struct Evaluation {
+    V6TrainingData* chunk;
+    MoveList legal_moves;
+    EvalResult result;
+  };
+
+  void Apply(Evaluation* evaluation) const {
+    V6TrainingData* chunk = evaluation->chunk;
+    const auto& result = evaluation->result;
+    if (policy_) {
+      const auto format = static_cast<pblczero::NetworkFormat::InputFormat>(
+          chunk->input_format);
+      const int transform =
+          IsCanonicalFormat(format) ? chunk->invariance_info & 7 : 0;
+      // Undo the softmax temperature the backend applied.
+      std::vector<float> p(result.p.size());
+      float sum = 0.0f;
+      for (size_t i = 0; i < p.size(); i++) {
+        p[i] = std::pow(result.p[i], softmax_temp_);
+        sum += p[i];
+      }
+      std::fill(std::begin(chunk->probabilities),
+                std::end(chunk->probabilities), -1.0f);
+      for (size_t i = 0; i < p.size(); i++) {
+        chunk->probabilities[MoveToNNIndex(evaluation->legal_moves[i],
+                                           transform)] = p[i] / sum;
+      }
+    }
+    if (value_) {
+      chunk->root_q = chunk->orig_q = result.q;
+      chunk->root_d = chunk->orig_d = result.d;
+      chunk->root_m = chunk->orig_m = result.m;
     }
-    ProcessFile(files[i], tablebase, outputDir, distTemp, distOffset, dtzBoost,
-                newInputFormat, nnue_plain_file, flags);
   }
+
+  Backend* const backend_;
+  const size_t batch_size_;
+  const float softmax_temp_;
+  const bool policy_;
+  const bool value_;
+  std::atomic<uint64_t> evaluated_ = 0;
+};
+
+// Runs the files through three stages, each with its own threads: readers
+// inflating whole files, rescorers, and writers compressing the output. The
+// files are handed out one at a time, so that large files don't leave the
+// other threads idle. With @network, a fourth stage between rescoring and
+// writing evaluates the positions of several games at once.
+void ProcessFiles(const std::vector<std::string>& files,
+                  CachedTablebase* tablebase, NetworkRescorer* network,
+                  int network_threads, std::string outputDir, float distTemp,
+                  float distOffset, float dtzBoost, int newInputFormat,
+                  int threads, int read_threads, int write_threads,
+                  std::string nnue_plain_file, NnueBinWriter* nnue_bin,
+                  ProcessFileFlags flags) {
+  std::cerr << "Rescoring with " << threads << " threads, " << read_threads
+            << " readers and " << write_threads << " writers." << std::endl;
+  // A few files waiting per consumer is enough to keep it busy, more would
+  // only hold more games in memory.
+  WorkQueue<GameFile> read_queue(2 * threads);
+  WorkQueue<GameFile> write_queue(2 * write_threads);
+  WorkQueue<GameFile> network_queue(2 * threads);
+  WorkQueue<GameFile>& rescored_queue = network ? network_queue : write_queue;
+  std::atomic<size_t> next_file = 0;
+  std::atomic<int> readers_left = read_threads;
+  std::atomic<int> rescorers_left = threads;
+  std::atomic<int> network_threads_left = network_threads;
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < read_threads; i++) {
+    workers.emplace_back([&]() {
+      for (size_t idx; (idx = next_file++) < files.size();) {
+        const std::string& file = files[idx];
+        if (file.rfind(".gz") != file.size() - 3) {
+          std::cerr << "Skipping: " << file << std::endl;
+          continue;
+        }
+        GameFile game{.file = file};
+        ReadFile(&game, flags);
+        read_queue.Push(std::move(game));
+      }
+      if (--readers_left == 0) read_queue.Close();
+    });
+  }
+  for (int i = 0; i < threads; i++) {
+    workers.emplace_back([&]() {
+      std::optional<NnueBinWriter::Buffer> nnue_bin_buffer;
+      if (nnue_bin) nnue_bin_buffer.emplace(nnue_bin);
+      while (auto game = read_queue.Pop()) {
+        if (game->ok) {
+          RescoreFile(&*game, tablebase, distTemp, distOffset, dtzBoost,
+                      newInputFormat, nnue_plain_file,
+                      nnue_bin_buffer ? &*nnue_bin_buffer : nullptr, flags);
+        }
+        rescored_queue.Push(std::move(*game));
+      }
+      nnue_bin_buffer.reset();
+      if (--rescorers_left == 0) rescored_queue.Close();
+    });
+  }
+  for (int i = 0; network && i < network_threads; i++) {
+    workers.emplace_back([&]() {
+      while (true) {
+        // Whole games are taken until the batch is full, the computations
+        // are split by NetworkRescorer.
+        std::vector<GameFile> batch;
+        size_t batch_positions = 0;
+        while (batch_positions < network->batch_size()) {
+          auto game = network_queue.Pop();
+          if (!game) break;
+          if (game->ok) batch_positions += game->chunks.size();
+          batch.push_back(std::move(*game));
+        }
+        if (batch.empty()) break;
+        network->Rescore(batch);
+        for (auto& game : batch) write_queue.Push(std::move(game));
+      }
+      if (--network_threads_left == 0) write_queue.Close();
+    });
+  }
+  for (int i = 0; i < write_threads; i++) {
+    workers.emplace_back([&]() {
+      while (auto game = write_queue.Pop()) {
+        WriteFile(*game, outputDir, flags);
+      }
+    });
+  }
+  for (auto& worker : workers) worker.join();
 }
 
-void BuildSubs(const std::vector<std::string>& files) {
+void PolicySubIndex::Build(const std::vector<std::string>& files) {
+  std::unordered_map<uint64_t, uint32_t> slot_of;
+  std::vector<float> policies;
   for (auto& file : files) {
-    TrainingDataReader reader(file);
-    std::vector<V6TrainingData> fileContents;
-    V6TrainingData data;
-    while (reader.ReadChunk(&data)) {
-      fileContents.push_back(data);
-    }
+    std::vector<V6TrainingData> fileContents =
+        TrainingDataReader(file).ReadAll();
     Validate(fileContents);
     MoveList moves;
     for (size_t i = 1; i < fileContents.size(); i++) {
@@ -1149,26 +1777,136 @@ void BuildSubs(const std::vector<std::string>& files) {
     PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]), &board,
                   &rule50ply, &gameply);
     history.Reset(board, rule50ply, gameply);
-    uint64_t rootHash = HashCat(board.Hash(), rule50ply);
-    PolicySubNode* rootNode = &policy_subs[rootHash];
+    uint64_t key = RootKey(board, rule50ply);
     for (size_t i = 0; i < fileContents.size(); i++) {
+      uint32_t& slot = slot_of.try_emplace(key, kNoPolicy).first->second;
       if ((fileContents[i].invariance_info & 64) == 0) {
-        rootNode->active = true;
-        for (int j = 0; j < 1858; j++) {
-          rootNode->policy[j] = fileContents[i].probabilities[j];
+        if (slot == kNoPolicy) {
+          slot = policies.size() / 1858;
+          policies.resize(policies.size() + 1858);
         }
+        std::copy(std::begin(fileContents[i].probabilities),
+                  std::end(fileContents[i].probabilities),
+                  policies.begin() + size_t{slot} * 1858);
       }
       if (i < fileContents.size() - 1) {
         int transform = TransformForPosition(input_format, history);
         int idx = MoveToNNIndex(moves[i], transform);
-        if (rootNode->children[idx] == nullptr) {
-          rootNode->children[idx] = new PolicySubNode();
-        }
-        rootNode = rootNode->children[idx];
+        key = ChildKey(key, idx);
         history.Append(moves[i]);
       }
     }
   }
+
+  std::vector<std::pair<uint64_t, uint32_t>> entries(slot_of.begin(),
+                                                     slot_of.end());
+  std::sort(entries.begin(), entries.end());
+  Unmap();
+  key_storage_.resize(entries.size());
+  slot_storage_.resize(entries.size());
+  for (size_t i = 0; i < entries.size(); i++) {
+    key_storage_[i] = entries[i].first;
+    slot_storage_[i] = entries[i].second;
+  }
+  policy_storage_ = std::move(policies);
+  keys_ = key_storage_;
+  slots_ = slot_storage_;
+  policies_ = policy_storage_;
+}
+
+void PolicySubIndex::Save(const std::string& filename) const {
+  std::ofstream file(filename, std::ios_base::binary | std::ios_base::trunc);
+  if (!file) throw Exception("Cannot create " + filename);
+  const FileHeader header{kMagic, kVersion, 1858, keys_.size(),
+                          policies_.size() / 1858};
+  const char padding[8] = {};
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(keys_.data()), keys_.size_bytes());
+  file.write(reinterpret_cast<const char*>(slots_.data()), slots_.size_bytes());
+  file.write(padding, PoliciesOffset(keys_.size()) - SlotsOffset(keys_.size()) -
+                          slots_.size_bytes());
+  file.write(reinterpret_cast<const char*>(policies_.data()),
+             policies_.size_bytes());
+  if (!file.flush()) throw Exception("Cannot write " + filename);
+}
+
+void PolicySubIndex::Map(const std::string& filename) {
+  Unmap();
+#ifndef _WIN32
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd == -1) throw Exception("Cannot open " + filename);
+  struct stat statbuf;
+  if (fstat(fd, &statbuf) != 0) {
+    ::close(fd);
+    throw Exception("Cannot read " + filename);
+  }
+  size_ = statbuf.st_size;
+  base_ = size_ < sizeof(FileHeader)
+              ? MAP_FAILED
+              : mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (base_ == MAP_FAILED) {
+    base_ = nullptr;
+    throw Exception(filename + " is not a policy substitution index");
+  }
+#if defined(MADV_RANDOM)
+  madvise(base_, size_, MADV_RANDOM);
+#endif
+#else
+  const HANDLE fd =
+      CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (fd == INVALID_HANDLE_VALUE) throw Exception("Cannot open " + filename);
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(fd, &file_size) ||
+      file_size.QuadPart < static_cast<LONGLONG>(sizeof(FileHeader))) {
+    CloseHandle(fd);
+    throw Exception(filename + " is not a policy substitution index");
+  }
+  size_ = file_size.QuadPart;
+  mapping_ = CreateFileMapping(fd, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(fd);
+  if (!mapping_) throw Exception("CreateFileMapping() failed");
+  base_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+  if (!base_) {
+    CloseHandle(mapping_);
+    mapping_ = nullptr;
+    throw Exception("MapViewOfFile() failed, name = " + filename);
+  }
+#endif
+  const char* data = static_cast<const char*>(base_);
+  FileHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  if (header.magic != kMagic || header.version != kVersion ||
+      header.policy_size != 1858 ||
+      size_ != PoliciesOffset(header.num_keys) +
+                   header.num_policies * 1858 * sizeof(float)) {
+    Unmap();
+    throw Exception(filename + " is not a policy substitution index");
+  }
+  keys_ = {reinterpret_cast<const uint64_t*>(data + sizeof(FileHeader)),
+           header.num_keys};
+  slots_ = {reinterpret_cast<const uint32_t*>(
+                data + SlotsOffset(header.num_keys)),
+            header.num_keys};
+  policies_ = {reinterpret_cast<const float*>(
+                   data + PoliciesOffset(header.num_keys)),
+               header.num_policies * 1858};
+}
+
+void PolicySubIndex::Unmap() {
+  keys_ = {};
+  slots_ = {};
+  policies_ = {};
+  if (!base_) return;
+#ifndef _WIN32
+  munmap(base_, size_);
+#else
+  UnmapViewOfFile(base_);
+  CloseHandle(mapping_);
+  mapping_ = nullptr;
+#endif
+  base_ = nullptr;
 }
 
 }  // namespace
@@ -1194,7 +1932,10 @@ void RunRescorer() {
   options.Add<StringOption>(kInputDirId);
   options.Add<StringOption>(kOutputDirId);
   options.Add<StringOption>(kPolicySubsDirId);
-  options.Add<IntOption>(kThreadsId, 1, 20) = 1;
+  options.Add<StringOption>(kPolicySubsIndexId);
+  options.Add<IntOption>(kThreadsId, 1, 256) = 1;
+  options.Add<IntOption>(kReadThreadsId, 0, 256) = 0;
+  options.Add<IntOption>(kWriteThreadsId, 0, 256) = 0;
   options.Add<FloatOption>(kTempId, 0.001, 100) = 1;
   // Positive dist offset requires knowing the legal move set, so not supported
   // for now.
@@ -1205,15 +1946,25 @@ void RunRescorer() {
   options.Add<FloatOption>(kDeblunderQBlunderThreshold, 0.0f, 2.0f) = 2.0f;
   options.Add<FloatOption>(kDeblunderQBlunderWidth, 0.0f, 2.0f) = 0.0f;
   options.Add<StringOption>(kNnuePlainFileId);
+  options.Add<StringOption>(kNnueBinFileId);
   options.Add<BoolOption>(kNnueBestScoreId) = true;
   options.Add<BoolOption>(kNnueBestMoveId) = false;
   options.Add<BoolOption>(kDeleteFilesId) = true;
+  options.Add<IntOption>(kProbeCacheSizeId, 0, 1 << 20) = 1024;
+  options.Add<BoolOption>(kNnRescoreId) = false;
+  options.Add<BoolOption>(kNnPolicyId) = true;
+  options.Add<BoolOption>(kNnValueId) = true;
+  options.Add<IntOption>(kNnBatchSizeId, 0, 65536) = 0;
+  options.Add<IntOption>(kNnThreadsId, 1, 64) = 2;
+  SharedBackendParams::Populate(&options);
 
   if (!options.ProcessAllFlags()) return;
 
   if (options.GetOptionsDict().IsDefault<std::string>(kOutputDirId) &&
-      options.GetOptionsDict().IsDefault<std::string>(kNnuePlainFileId)) {
-    std::cerr << "Must provide an output dir or NNUE plain file." << std::endl;
+      options.GetOptionsDict().IsDefault<std::string>(kNnuePlainFileId) &&
+      options.GetOptionsDict().IsDefault<std::string>(kNnueBinFileId)) {
+    std::cerr << "Must provide an output dir or NNUE plain or bin file."
+              << std::endl;
     return;
   }
 
@@ -1256,7 +2007,17 @@ void RunRescorer() {
     for (size_t i = 0; i < policySubFiles.size(); i++) {
       policySubFiles[i] = policySubsDir + "/" + policySubFiles[i];
     }
-    BuildSubs(policySubFiles);
+    policy_subs.Build(policySubFiles);
+  }
+  auto policySubsIndex =
+      options.GetOptionsDict().Get<std::string>(kPolicySubsIndexId);
+  if (policySubsIndex.size() != 0) {
+    if (policySubsDir.size() != 0) policy_subs.Save(policySubsIndex);
+    policy_subs.Map(policySubsIndex);
+  }
+  if (!policy_subs.empty()) {
+    std::cerr << "Policy substitution positions: " << policy_subs.size()
+              << std::endl;
   }
 
   auto inputDir = options.GetOptionsDict().Get<std::string>(kInputDirId);
@@ -1278,37 +2039,46 @@ void RunRescorer() {
   flags.delete_files = options.GetOptionsDict().Get<bool>(kDeleteFilesId);
   flags.nnue_best_score = options.GetOptionsDict().Get<bool>(kNnueBestScoreId);
   flags.nnue_best_move = options.GetOptionsDict().Get<bool>(kNnueBestMoveId);
-  if (threads > 1) {
-    std::vector<std::thread> threads_;
-    int offset = 0;
-    while (threads_.size() < threads) {
-      int offset_val = offset;
-      offset++;
-      threads_.emplace_back([&options, offset_val, files, &tablebase, threads,
-                             dtz_boost, flags]() {
-        ProcessFiles(
-            files, &tablebase,
-            options.GetOptionsDict().Get<std::string>(kOutputDirId),
-            options.GetOptionsDict().Get<float>(kTempId),
-            options.GetOptionsDict().Get<float>(kDistributionOffsetId),
-            dtz_boost, options.GetOptionsDict().Get<int>(kNewInputFormatId),
-            offset_val, threads,
-            options.GetOptionsDict().Get<std::string>(kNnuePlainFileId), flags);
-      });
-    }
-    for (size_t i = 0; i < threads_.size(); i++) {
-      threads_[i].join();
-    }
-
+  int read_threads = options.GetOptionsDict().Get<int>(kReadThreadsId);
+  if (read_threads == 0) read_threads = std::max(1u, threads / 4);
+  int write_threads = options.GetOptionsDict().Get<int>(kWriteThreadsId);
+  if (write_threads == 0) write_threads = std::max(1u, threads / 2);
+  std::unique_ptr<Backend> backend;
+  std::optional<NetworkRescorer> network;
+  if (options.GetOptionsDict().Get<bool>(kNnRescoreId)) {
+    backend = BackendManager::Get()->CreateFromParams(options.GetOptionsDict());
+    const auto attributes = backend->GetAttributes();
+    int batch_size = options.GetOptionsDict().Get<int>(kNnBatchSizeId);
+    if (batch_size == 0) batch_size = attributes.recommended_batch_size;
+    batch_size = std::clamp(batch_size, 1, attributes.maximum_batch_size);
+    network.emplace(
+        backend.get(), batch_size,
+        options.GetOptionsDict().Get<float>(
+            SharedBackendParams::kPolicySoftmaxTemp),
+        options.GetOptionsDict().Get<bool>(kNnPolicyId),
+        options.GetOptionsDict().Get<bool>(kNnValueId));
+    flags.keep_history = true;
   } else {
-    ProcessFiles(
-        files, &tablebase,
-        options.GetOptionsDict().Get<std::string>(kOutputDirId),
-        options.GetOptionsDict().Get<float>(kTempId),
-        options.GetOptionsDict().Get<float>(kDistributionOffsetId), dtz_boost,
-        options.GetOptionsDict().Get<int>(kNewInputFormatId), 0, 1,
-        options.GetOptionsDict().Get<std::string>(kNnuePlainFileId), flags);
+    flags.keep_history = false;
+  }
+  CachedTablebase cached_tablebase(
+      &tablebase,
+      size_t{static_cast<uint32_t>(
+          options.GetOptionsDict().Get<int>(kProbeCacheSizeId))}
+          << 20);
+  std::optional<NnueBinWriter> nnue_bin;
+  if (!options.GetOptionsDict().IsDefault<std::string>(kNnueBinFileId)) {
+    nnue_bin.emplace(options.GetOptionsDict().Get<std::string>(kNnueBinFileId));
   }
+  ProcessFiles(files, &cached_tablebase, network ? &*network : nullptr,
+               options.GetOptionsDict().Get<int>(kNnThreadsId),
+               options.GetOptionsDict().Get<std::string>(kOutputDirId),
+               options.GetOptionsDict().Get<float>(kTempId),
+               options.GetOptionsDict().Get<float>(kDistributionOffsetId),
+               dtz_boost, options.GetOptionsDict().Get<int>(kNewInputFormatId),
+               threads, read_threads, write_threads,
+               options.GetOptionsDict().Get<std::string>(kNnuePlainFileId),
+               nnue_bin ? &*nnue_bin : nullptr, flags);
   std::cout << "Games processed: " << games << std::endl;
   std::cout << "Positions processed: " << positions << std::endl;
   std::cout << "Rescores performed: " << rescored << std::endl;
@@ -1344,6 +2114,8 @@ void RunRescorer() {
             << " W: " << fixed_counts[2] << std::endl;
   std::cout << "Gaviota DTM move_count rescores: " << gaviota_dtm_rescores
             << std::endl;
+  cached_tablebase.PrintStats();
+  if (network) network->PrintStats();
 }
 
 }  // namespace lczero
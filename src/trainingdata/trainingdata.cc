@@ -27,6 +27,12 @@
 
 #include "trainingdata/trainingdata.h"
 
+#include <algorithm>
+#include <tuple>
+
+#include "utils/exception.h"
+#include "utils/logging.h"
+
 namespace lczero {
 
 namespace {
@@ -79,7 +85,16 @@ std::tuple<float, float> DriftCorrect(float q, float d) {
 
 void V6TrainingDataArray::Write(TrainingDataWriter* writer, GameResult result,
                                 bool adjudicated) const {
-  if (training_data_.empty()) return;
+  for (const auto& chunk : Finalize(result, adjudicated)) {
+    writer->WriteChunk(chunk);
+  }
+}
+
+std::vector<V6TrainingData> V6TrainingDataArray::Finalize(
+    GameResult result, bool adjudicated) const {
+  std::vector<V6TrainingData> chunks;
+  if (training_data_.empty()) return chunks;
+  chunks.reserve(training_data_.size());
   // Base estimate off of best_m.  If needed external processing can use a
   // different approach.
   float m_estimate = training_data_.back().best_m + training_data_.size() - 1;
@@ -107,18 +122,15 @@ void V6TrainingDataArray::Write(TrainingDataWriter* writer, GameResult result,
     }
     chunk.plies_left = m_estimate;
     m_estimate -= 1.0f;
-    writer->WriteChunk(chunk);
+    chunks.push_back(chunk);
   }
+  return chunks;
 }
 
-void V6TrainingDataArray::Add(const classic::Node* node,
+void V6TrainingDataArray::Add(const SearchArtifacts& artifacts,
                               const PositionHistory& history,
-                              classic::Eval best_eval,
-                              classic::Eval played_eval, bool best_is_proven,
-                              Move best_move, Move played_move,
-                              std::span<Move> legal_moves,
-                              const std::optional<EvalResult>& nneval,
-                              float policy_softmax_temp) {
+                              SearchArtifacts::Eval played_eval,
+                              bool best_is_proven, Move played_move) {
   V6TrainingData result;
   const auto& position = history.Last();
 
@@ -137,42 +149,26 @@ void V6TrainingDataArray::Add(const classic::Node* node,
   }
 
   // Populate probabilities.
-  auto total_n = node->GetChildrenVisits();
+  const uint32_t total_n =
+      artifacts.root_visits > 0 ? artifacts.root_visits - 1 : 0;
   // Prevent garbage/invalid training data from being uploaded to server.
   // It's possible to have N=0 when there is only one legal move in position
   // (due to smart pruning).
-  if (total_n == 0 && node->GetNumEdges() != 1) {
+  if (total_n == 0 && artifacts.root_moves.size() != 1) {
     throw Exception("Search generated invalid data!");
   }
   // Set illegal moves to have -1 probability.
   std::fill(std::begin(result.probabilities), std::end(result.probabilities),
             -1);
   // Set moves probabilities according to their relative amount of visits.
-  // Compute Kullback-Leibler divergence in nats (between policy and visits).
-  float kld_sum = 0;
-  float total = 0.0;
-  for (const auto& child : node->Edges()) {
-    const Move move = child.GetMove();
-    float fracv = total_n > 0 ? child.GetN() / static_cast<float>(total_n) : 1;
-    if (nneval) {
-      size_t move_idx =
-          std::find(legal_moves.begin(), legal_moves.end(), move) -
-          legal_moves.begin();
-      // Undo any softmax temperature in the cached data.
-      float P = std::pow(nneval->p[move_idx], policy_softmax_temp);
-      if (fracv > 0) {
-        kld_sum += fracv * std::log(fracv / P);
-      }
-      total += P;
-    }
+  for (const auto& root_move : artifacts.root_moves) {
+    Move move = root_move.move;
+    if (position.IsBlackToMove()) move.Flip();
+    const float fracv =
+        total_n > 0 ? root_move.visits / static_cast<float>(total_n) : 1;
     result.probabilities[MoveToNNIndex(move, transform)] = fracv;
   }
-  if (nneval) {
-    // Add small epsilon for backward compatibility with earlier value of 0.
-    auto epsilon = std::numeric_limits<float>::min();
-    kld_sum = std::max(kld_sum + std::log(total), 0.0f) + epsilon;
-  }
-  result.policy_kld = kld_sum;
+  result.policy_kld = artifacts.policy_kld;
 
   const auto& castlings = position.GetBoard().castlings();
   // Populate castlings.
@@ -220,28 +216,17 @@ void V6TrainingDataArray::Add(const classic::Node* node,
   result.result_q = 0;
   result.result_d = 1;
 
-  classic::Eval orig_eval;
-  if (nneval) {
-    orig_eval.wl = nneval->q;
-    orig_eval.d = nneval->d;
-    orig_eval.ml = nneval->m;
-  } else {
-    orig_eval.wl = std::numeric_limits<float>::quiet_NaN();
-    orig_eval.d = std::numeric_limits<float>::quiet_NaN();
-    orig_eval.ml = std::numeric_limits<float>::quiet_NaN();
-  }
-
   // Aggregate evaluation WL.
-  result.root_q = -node->GetWL();
-  result.best_q = best_eval.wl;
+  result.root_q = artifacts.root_eval.wl;
+  result.best_q = artifacts.best_eval.wl;
   result.played_q = played_eval.wl;
-  result.orig_q = orig_eval.wl;
+  result.orig_q = artifacts.orig_eval.wl;
 
   // Draw probability of WDL head.
-  result.root_d = node->GetD();
-  result.best_d = best_eval.d;
+  result.root_d = artifacts.root_eval.d;
+  result.best_d = artifacts.best_eval.d;
   result.played_d = played_eval.d;
-  result.orig_d = orig_eval.d;
+  result.orig_d = artifacts.orig_eval.d;
 
   std::tie(result.best_q, result.best_d) =
       DriftCorrect(result.best_q, result.best_d);
@@ -250,12 +235,13 @@ void V6TrainingDataArray::Add(const classic::Node* node,
   std::tie(result.played_q, result.played_d) =
       DriftCorrect(result.played_q, result.played_d);
 
-  result.root_m = node->GetM();
-  result.best_m = best_eval.ml;
+  result.root_m = artifacts.root_eval.ml;
+  result.best_m = artifacts.best_eval.ml;
   result.played_m = played_eval.ml;
-  result.orig_m = orig_eval.ml;
+  result.orig_m = artifacts.orig_eval.ml;
 
-  result.visits = node->GetN();
+  result.visits = artifacts.root_visits;
+  Move best_move = artifacts.best_move;
   if (position.IsBlackToMove()) {
     best_move.Flip();
     played_move.Flip();
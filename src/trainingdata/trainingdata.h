@@ -27,8 +27,9 @@
 
 #pragma once
 
-#include "neural/backend.h"
-#include "search/classic/node.h"
+#include "chess/position.h"
+#include "neural/encoder.h"
+#include "search/artifacts.h"
 #include "trainingdata/writer.h"
 
 namespace lczero {
@@ -96,17 +97,20 @@ class V6TrainingDataArray {
       : fill_empty_history_{white_fill_empty_history, black_fill_empty_history},
         input_format_(input_format) {}
 
-  // Add a chunk.
-  void Add(const classic::Node* node, const PositionHistory& history,
-           classic::Eval best_eval, classic::Eval played_eval,
-           bool best_is_proven, Move best_move, Move played_move,
-           std::span<Move> legal_moves,
-           const std::optional<EvalResult>& nneval, float policy_softmax_temp);
+  // Add a chunk for the search of the last position of @history.
+  void Add(const SearchArtifacts& artifacts, const PositionHistory& history,
+           SearchArtifacts::Eval played_eval, bool best_is_proven,
+           Move played_move);
 
   // Writes training data to a file.
   void Write(TrainingDataWriter* writer, GameResult result,
              bool adjudicated) const;
 
+  // Returns the chunks with game result and plies left filled in, as Write()
+  // would store them.
+  std::vector<V6TrainingData> Finalize(GameResult result,
+                                       bool adjudicated) const;
+
  private:
   std::vector<V6TrainingData> training_data_;
   FillEmptyHistory fill_empty_history_[2];
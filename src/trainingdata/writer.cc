@@ -45,14 +45,17 @@ std::string GetLc0CacheDirectory() {
 
 }  // namespace
 
-TrainingDataWriter::TrainingDataWriter(int game_id) {
+std::string TrainingDataWriter::GetDataDirectory() {
   static std::string directory =
       GetLc0CacheDirectory() + "data-" + Random::Get().GetString(12);
   // It's fine if it already exists.
   CreateDirectory(directory.c_str());
+  return directory;
+}
 
+TrainingDataWriter::TrainingDataWriter(int game_id) {
   std::ostringstream oss;
-  oss << directory << '/' << "game_" << std::setfill('0') << std::setw(6)
+  oss << GetDataDirectory() << '/' << "game_" << std::setfill('0') << std::setw(6)
       << game_id << ".gz";
 
   filename_ = oss.str();
@@ -45,6 +45,10 @@ class TrainingDataWriter {
     if (fout_) Finalize();
   }
 
+  // Returns the directory that files created by game id go to, creating it
+  // on first use.
+  static std::string GetDataDirectory();
+
   // Writes a chunk.
   void WriteChunk(const V6TrainingData& data);
 
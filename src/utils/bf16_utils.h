@@ -25,6 +25,10 @@
   Program grant you additional permission to convey the resulting work.
 */
 #pragma once
+
+#include <cstdint>
+#include <cstring>
+
 namespace lczero {
 
 static inline uint16_t FP32toBF16(float f32) {
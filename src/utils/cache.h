@@ -29,8 +29,10 @@
 
 #include <cassert>
 #include <cstring>
+#include <deque>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "utils/mutex.h"
 
@@ -43,22 +45,31 @@ namespace lczero {
 // Unlike LRUCache, doesn't even consider trying to support LRU order.
 // Does not support delete.
 // Does not support replace! Inserts to existing elements are silently ignored.
-// FIFO eviction.
+// FIFO eviction, within each shard.
 // Assumes that eviction while pinned is rare enough to not need to optimize
 // unpin for that case.
+// The table is split into shards with a lock each, chosen by the high bits of
+// the key, so that threads rarely contend for the same lock.
 template <class V>
 class HashKeyedCache {
   static const double constexpr kLoadFactor = 1.9;
+  static constexpr int kNumShards = 32;
 
  public:
-  HashKeyedCache(int capacity = 128)
-      : capacity_(capacity),
-        hash_(static_cast<size_t>(capacity * kLoadFactor + 1)) {}
+  HashKeyedCache(int capacity = 128) : capacity_(capacity) {
+    for (int i = 0; i < kNumShards; ++i) {
+      SpinMutex::Lock lock(shards_[i].mutex_);
+      shards_[i].SetCapacity(ShardCapacity(capacity, i));
+    }
+  }
 
   ~HashKeyedCache() {
-    EvictToCapacity(0);
-    assert(size_ == 0);
-    assert(allocated_ == 0);
+    for (auto& shard : shards_) {
+      SpinMutex::Lock lock(shard.mutex_);
+      shard.EvictToCapacity(0);
+      assert(shard.size_ == 0);
+      assert(shard.allocated_ == 0);
+    }
   }
 
   // Inserts the element under key @key with value @val. Unless the key is
@@ -66,27 +77,29 @@ class HashKeyedCache {
   void Insert(uint64_t key, std::unique_ptr<V> val) {
     if (capacity_.load(std::memory_order_relaxed) == 0) return;
 
-    SpinMutex::Lock lock(mutex_);
+    Shard& shard = GetShard(key);
+    SpinMutex::Lock lock(shard.mutex_);
+    if (shard.capacity_ == 0) return;
 
-    size_t idx = key % hash_.size();
+    size_t idx = key % shard.hash_.size();
     while (true) {
-      if (!hash_[idx].in_use) break;
-      if (hash_[idx].key == key) {
+      if (!shard.hash_[idx].in_use) break;
+      if (shard.hash_[idx].key == key) {
         // Already exists.
         return;
       }
       ++idx;
-      if (idx >= hash_.size()) idx -= hash_.size();
+      if (idx >= shard.hash_.size()) idx -= shard.hash_.size();
     }
-    hash_[idx].key = key;
-    hash_[idx].value = std::move(val);
-    hash_[idx].pins = 0;
-    hash_[idx].in_use = true;
-    insertion_order_.push_back(key);
-    ++size_;
-    ++allocated_;
-
-    EvictToCapacity(capacity_);
+    shard.hash_[idx].key = key;
+    shard.hash_[idx].value = std::move(val);
+    shard.hash_[idx].pins = 0;
+    shard.hash_[idx].in_use = true;
+    shard.insertion_order_.push_back(key);
+    ++shard.size_;
+    ++shard.allocated_;
+
+    shard.EvictToCapacity(shard.capacity_);
   }
 
   // Checks whether a key exists. Doesn't pin. Of course the next moment the
@@ -94,17 +107,9 @@ class HashKeyedCache {
   bool ContainsKey(uint64_t key) {
     if (capacity_.load(std::memory_order_relaxed) == 0) return false;
 
-    SpinMutex::Lock lock(mutex_);
-    size_t idx = key % hash_.size();
-    while (true) {
-      if (!hash_[idx].in_use) break;
-      if (hash_[idx].key == key) {
-        return true;
-      }
-      ++idx;
-      if (idx >= hash_.size()) idx -= hash_.size();
-    }
-    return false;
+    Shard& shard = GetShard(key);
+    SpinMutex::Lock lock(shard.mutex_);
+    return shard.Find(key) != nullptr;
   }
 
   // Looks up and pins the element by key. Returns nullptr if not found.
@@ -113,33 +118,27 @@ class HashKeyedCache {
   V* LookupAndPin(uint64_t key) {
     if (capacity_.load(std::memory_order_relaxed) == 0) return nullptr;
 
-    SpinMutex::Lock lock(mutex_);
-
-    size_t idx = key % hash_.size();
-    while (true) {
-      if (!hash_[idx].in_use) break;
-      if (hash_[idx].key == key) {
-        ++hash_[idx].pins;
-        return hash_[idx].value.get();
-      }
-      ++idx;
-      if (idx >= hash_.size()) idx -= hash_.size();
-    }
-    return nullptr;
+    Shard& shard = GetShard(key);
+    SpinMutex::Lock lock(shard.mutex_);
+    Entry* entry = shard.Find(key);
+    if (!entry) return nullptr;
+    ++entry->pins;
+    return entry->value.get();
   }
 
   // Unpins the element given key and value. Use of HashedKeyCacheLock is
   // recommended to automate this pin management.
   void Unpin(uint64_t key, V* value) {
-    SpinMutex::Lock lock(mutex_);
+    Shard& shard = GetShard(key);
+    SpinMutex::Lock lock(shard.mutex_);
 
     // Checking evicted list first.
-    for (auto it = evicted_.begin(); it != evicted_.end(); ++it) {
+    for (auto it = shard.evicted_.begin(); it != shard.evicted_.end(); ++it) {
       auto& entry = *it;
       if (key == entry.key && value == entry.value.get()) {
         if (--entry.pins == 0) {
-          --allocated_;
-          evicted_.erase(it);
+          --shard.allocated_;
+          shard.evicted_.erase(it);
           return;
         } else {
           return;
@@ -147,15 +146,10 @@ class HashKeyedCache {
       }
     }
     // Now the main list.
-    size_t idx = key % hash_.size();
-    while (true) {
-      if (!hash_[idx].in_use) break;
-      if (hash_[idx].key == key && hash_[idx].value.get() == value) {
-        --hash_[idx].pins;
-        return;
-      }
-      ++idx;
-      if (idx >= hash_.size()) idx -= hash_.size();
+    Entry* entry = shard.Find(key);
+    if (entry && entry->value.get() == value) {
+      --entry->pins;
+      return;
     }
     assert(false);
   }
@@ -169,42 +163,29 @@ class HashKeyedCache {
     // very rarely have any contention on the lock while this function is
     // running, since its called very rarely and almost always before things
     // start happening.
-    SpinMutex::Lock lock(mutex_);
-
     if (capacity_.load(std::memory_order_relaxed) == capacity) return;
-    EvictToCapacity(capacity);
     capacity_.store(capacity);
-
-    std::vector<Entry> new_hash(
-        static_cast<size_t>(capacity * kLoadFactor + 1));
-
-    if (size_ != 0) {
-      for (Entry& item : hash_) {
-        if (!item.in_use) continue;
-        size_t idx = item.key % new_hash.size();
-        while (true) {
-          if (!new_hash[idx].in_use) break;
-          ++idx;
-          if (idx >= new_hash.size()) idx -= new_hash.size();
-        }
-        new_hash[idx].key = item.key;
-        new_hash[idx].value = std::move(item.value);
-        new_hash[idx].pins = item.pins;
-        new_hash[idx].in_use = true;
-      }
+    for (int i = 0; i < kNumShards; ++i) {
+      SpinMutex::Lock lock(shards_[i].mutex_);
+      shards_[i].SetCapacity(ShardCapacity(capacity, i));
     }
-    hash_.swap(new_hash);
   }
 
   // Clears the cache;
   void Clear() {
-    SpinMutex::Lock lock(mutex_);
-    EvictToCapacity(0);
+    for (auto& shard : shards_) {
+      SpinMutex::Lock lock(shard.mutex_);
+      shard.EvictToCapacity(0);
+    }
   }
 
   int GetSize() const {
-    SpinMutex::Lock lock(mutex_);
-    return size_;
+    int size = 0;
+    for (auto& shard : shards_) {
+      SpinMutex::Lock lock(shard.mutex_);
+      size += shard.size_;
+    }
+    return size;
   }
   int GetCapacity() const { return capacity_.load(std::memory_order_relaxed); }
   static constexpr size_t GetItemStructSize() { return sizeof(Entry); }
@@ -220,68 +201,118 @@ class HashKeyedCache {
     bool in_use = false;
   };
 
-  void EvictItem() REQUIRES(mutex_) {
-    --size_;
-    uint64_t key = insertion_order_.front();
-    insertion_order_.pop_front();
-    size_t idx = key % hash_.size();
-    while (true) {
-      if (hash_[idx].in_use && hash_[idx].key == key) {
-        break;
+  struct alignas(64) Shard {
+    Entry* Find(uint64_t key) REQUIRES(mutex_) {
+      size_t idx = key % hash_.size();
+      while (true) {
+        if (!hash_[idx].in_use) return nullptr;
+        if (hash_[idx].key == key) return &hash_[idx];
+        ++idx;
+        if (idx >= hash_.size()) idx -= hash_.size();
       }
-      ++idx;
-      if (idx >= hash_.size()) idx -= hash_.size();
     }
-    if (hash_[idx].pins == 0) {
-      --allocated_;
-      hash_[idx].value.reset();
-      hash_[idx].in_use = false;
-    } else {
-      evicted_.emplace_back(hash_[idx].key, std::move(hash_[idx].value));
-      evicted_.back().pins = hash_[idx].pins;
-      hash_[idx].pins = 0;
-      hash_[idx].in_use = false;
+
+    void SetCapacity(int capacity) REQUIRES(mutex_) {
+      if (capacity_ == capacity && !hash_.empty()) return;
+      EvictToCapacity(capacity);
+      capacity_ = capacity;
+
+      std::vector<Entry> new_hash(
+          static_cast<size_t>(capacity * kLoadFactor + 1));
+
+      if (size_ != 0) {
+        for (Entry& item : hash_) {
+          if (!item.in_use) continue;
+          size_t idx = item.key % new_hash.size();
+          while (true) {
+            if (!new_hash[idx].in_use) break;
+            ++idx;
+            if (idx >= new_hash.size()) idx -= new_hash.size();
+          }
+          new_hash[idx].key = item.key;
+          new_hash[idx].value = std::move(item.value);
+          new_hash[idx].pins = item.pins;
+          new_hash[idx].in_use = true;
+        }
+      }
+      hash_.swap(new_hash);
     }
-    size_t next = idx + 1;
-    if (next >= hash_.size()) next -= hash_.size();
-    while (true) {
-      if (!hash_[next].in_use) {
-        break;
+
+    void EvictItem() REQUIRES(mutex_) {
+      --size_;
+      uint64_t key = insertion_order_.front();
+      insertion_order_.pop_front();
+      size_t idx = key % hash_.size();
+      while (true) {
+        if (hash_[idx].in_use && hash_[idx].key == key) {
+          break;
+        }
+        ++idx;
+        if (idx >= hash_.size()) idx -= hash_.size();
       }
-      size_t target = hash_[next].key % hash_.size();
-      if (!InRange(target, idx + 1, next)) {
-        std::swap(hash_[next], hash_[idx]);
-        idx = next;
+      if (hash_[idx].pins == 0) {
+        --allocated_;
+        hash_[idx].value.reset();
+        hash_[idx].in_use = false;
+      } else {
+        evicted_.emplace_back(hash_[idx].key, std::move(hash_[idx].value));
+        evicted_.back().pins = hash_[idx].pins;
+        hash_[idx].pins = 0;
+        hash_[idx].in_use = false;
       }
-      ++next;
+      size_t next = idx + 1;
       if (next >= hash_.size()) next -= hash_.size();
+      while (true) {
+        if (!hash_[next].in_use) {
+          break;
+        }
+        size_t target = hash_[next].key % hash_.size();
+        if (!InRange(target, idx + 1, next)) {
+          std::swap(hash_[next], hash_[idx]);
+          idx = next;
+        }
+        ++next;
+        if (next >= hash_.size()) next -= hash_.size();
+      }
     }
-  }
 
-  bool InRange(size_t target, size_t start, size_t end) {
-    if (start <= end) {
-      return target >= start && target <= end;
-    } else {
-      return target >= start || target <= end;
+    static bool InRange(size_t target, size_t start, size_t end) {
+      if (start <= end) {
+        return target >= start && target <= end;
+      } else {
+        return target >= start || target <= end;
+      }
     }
-  }
 
-  void EvictToCapacity(int capacity) REQUIRES(mutex_) {
-    if (capacity < 0) capacity = 0;
-    while (size_ > capacity) {
-      EvictItem();
+    void EvictToCapacity(int capacity) REQUIRES(mutex_) {
+      if (capacity < 0) capacity = 0;
+      while (size_ > capacity) {
+        EvictItem();
+      }
     }
+
+    int capacity_ GUARDED_BY(mutex_) = 0;
+    int size_ GUARDED_BY(mutex_) = 0;
+    int allocated_ GUARDED_BY(mutex_) = 0;
+    // Fresh in back, stale at front.
+    std::deque<uint64_t> GUARDED_BY(mutex_) insertion_order_;
+    std::vector<Entry> GUARDED_BY(mutex_) evicted_;
+    std::vector<Entry> GUARDED_BY(mutex_) hash_;
+
+    mutable SpinMutex mutex_;
+  };
+
+  // Spreads the capacity over the shards, the first ones get the remainder.
+  static int ShardCapacity(int capacity, int shard) {
+    if (capacity < 0) capacity = 0;
+    return capacity / kNumShards + (shard < capacity % kNumShards ? 1 : 0);
   }
 
+  // The low bits of the key pick the slot within the shard.
+  Shard& GetShard(uint64_t key) { return shards_[(key >> 40) % kNumShards]; }
+
   std::atomic<int> capacity_;
-  int size_ GUARDED_BY(mutex_) = 0;
-  int allocated_ GUARDED_BY(mutex_) = 0;
-  // Fresh in back, stale at front.
-  std::deque<uint64_t> GUARDED_BY(mutex_) insertion_order_;
-  std::vector<Entry> GUARDED_BY(mutex_) evicted_;
-  std::vector<Entry> GUARDED_BY(mutex_) hash_;
-
-  mutable SpinMutex mutex_;
+  Shard shards_[kNumShards];
 };
 
 // Convenience class for pinning cache items.
@@ -0,0 +1,167 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "utils/slab_allocator.h"
+
+namespace lczero {
+
+// 32-bit non-owning pointer to an object allocated with
+// SlabAllocator::AllocateCompact(). Converts implicitly to and from T*.
+template <typename T>
+class CompactPtr {
+ public:
+  CompactPtr() = default;
+  CompactPtr(T* ptr) : offset_(ToOffset(ptr)) {}
+  CompactPtr& operator=(T* ptr) {
+    offset_ = ToOffset(ptr);
+    return *this;
+  }
+
+  T* get() const {
+    return static_cast<T*>(SlabAllocator::FromCompactOffset(offset_));
+  }
+  operator T*() const { return get(); }
+  T* operator->() const { return get(); }
+
+  // Atomic accesses, for pointers that other threads read concurrently.
+  T* load(std::memory_order order) const {
+    return static_cast<T*>(SlabAllocator::FromCompactOffset(
+        std::atomic_ref<uint32_t>(const_cast<uint32_t&>(offset_))
+            .load(order)));
+  }
+  void store(T* ptr, std::memory_order order) {
+    std::atomic_ref<uint32_t>(offset_).store(ToOffset(ptr), order);
+  }
+
+  static uint32_t ToOffset(const T* ptr) {
+    assert(reinterpret_cast<uintptr_t>(ptr) %
+               SlabAllocator::kCompactGranularity ==
+           0);
+    return SlabAllocator::ToCompactOffset(ptr);
+  }
+
+ private:
+  uint32_t offset_ = 0;
+};
+
+// Full size pointer with the same interface as CompactPtr<T>.
+template <typename T>
+class PlainPtr {
+ public:
+  PlainPtr() = default;
+  PlainPtr(T* ptr) : ptr_(ptr) {}
+
+  T* get() const { return ptr_; }
+  T* load(std::memory_order order) const {
+    return std::atomic_ref<T*>(const_cast<T*&>(ptr_)).load(order);
+  }
+  void store(T* ptr, std::memory_order order) {
+    std::atomic_ref<T*>(ptr_).store(ptr, order);
+  }
+
+ private:
+  T* ptr_ = nullptr;
+};
+
+// Counterpart of std::unique_ptr<T>, with the pointer stored as @Ptr
+// (CompactPtr<T> or PlainPtr<T>). Can exchange ownership with
+// std::unique_ptr<T>, which is how it's passed around outside of the objects
+// that store it.
+// get() is an acquire load and publish() a release store, so that a thread may
+// follow the pointer while another one publishes a new object through it.
+// Everything else needs exclusive access.
+template <typename T, typename Ptr>
+class UniqueLinkPtr {
+ public:
+  UniqueLinkPtr() = default;
+  UniqueLinkPtr(std::nullptr_t) {}
+  explicit UniqueLinkPtr(T* ptr) : ptr_(ptr) {}
+  UniqueLinkPtr(std::unique_ptr<T>&& other) : ptr_(other.release()) {}
+  UniqueLinkPtr(UniqueLinkPtr&& other) : ptr_(other.release()) {}
+  UniqueLinkPtr(const UniqueLinkPtr&) = delete;
+  ~UniqueLinkPtr() { reset(); }
+
+  UniqueLinkPtr& operator=(UniqueLinkPtr&& other) {
+    reset(other.release());
+    return *this;
+  }
+  UniqueLinkPtr& operator=(std::unique_ptr<T>&& other) {
+    reset(other.release());
+    return *this;
+  }
+  UniqueLinkPtr& operator=(std::nullptr_t) {
+    reset();
+    return *this;
+  }
+  UniqueLinkPtr& operator=(const UniqueLinkPtr&) = delete;
+
+  // Transfers ownership to a std::unique_ptr.
+  operator std::unique_ptr<T>() && { return std::unique_ptr<T>(release()); }
+
+  T* get() const { return ptr_.load(std::memory_order_acquire); }
+  T& operator*() const { return *get(); }
+  T* operator->() const { return get(); }
+  explicit operator bool() const { return get() != nullptr; }
+
+  T* release() {
+    T* ptr = ptr_.get();
+    ptr_ = nullptr;
+    return ptr;
+  }
+  void reset(T* ptr = nullptr) {
+    T* old = ptr_.get();
+    ptr_ = ptr;
+    delete old;
+  }
+  void swap(UniqueLinkPtr& other) {
+    Ptr tmp = ptr_;
+    ptr_ = other.ptr_;
+    other.ptr_ = tmp;
+  }
+  // Takes ownership of @ptr, which becomes visible to get() in other threads
+  // only once it is fully built. The old object is not deleted, the caller
+  // must have passed its ownership on before.
+  void publish(T* ptr) { ptr_.store(ptr, std::memory_order_release); }
+
+ private:
+  Ptr ptr_;
+};
+
+// 32-bit counterpart of std::unique_ptr<T> for objects allocated with
+// SlabAllocator::AllocateCompact() (usually through T::operator new).
+template <typename T>
+using CompactUniquePtr = UniqueLinkPtr<T, CompactPtr<T>>;
+
+}  // namespace lczero
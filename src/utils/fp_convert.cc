@@ -0,0 +1,248 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/fp_convert.h"
+
+#include <cassert>
+#include <cstddef>
+
+#include "utils/bf16_utils.h"
+#include "utils/fp16_utils.h"
+#include "utils/fp8_utils.h"
+
+#if !defined(NO_F16C) && !defined(NO_POPCNT) && \
+    (defined(__GNUC__) || defined(_MSC_VER))
+#define LC0_FP_CONVERT_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC allows intrinsics of any instruction set without flags.
+#define LC0_TARGET(x)
+#else
+#define LC0_TARGET(x) __attribute__((target(x)))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define LC0_FP_CONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+namespace lczero {
+namespace {
+
+#ifdef LC0_FP_CONVERT_X86
+bool CpuSupports(bool avx2) {
+#ifdef _MSC_VER
+  int regs[4];
+  __cpuid(regs, 1);
+  const bool osxsave = regs[2] & (1 << 27);
+  const bool avx = regs[2] & (1 << 28);
+  const bool f16c = regs[2] & (1 << 29);
+  // The OS must save the AVX registers.
+  if (!osxsave || !avx || !f16c || (_xgetbv(0) & 6) != 6) return false;
+  if (!avx2) return true;
+  __cpuidex(regs, 7, 0);
+  return regs[1] & (1 << 5);
+#else
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("avx") || !__builtin_cpu_supports("f16c")) {
+    return false;
+  }
+  return !avx2 || __builtin_cpu_supports("avx2");
+#endif
+}
+
+bool HasF16C() {
+  static const bool result = CpuSupports(false);
+  return result;
+}
+
+bool HasAVX2() {
+  static const bool result = CpuSupports(true);
+  return result;
+}
+
+// Each block is loaded before it's stored, which keeps narrowing conversions
+// correct in place.
+LC0_TARGET("avx,f16c")
+size_t FP32toFP16F16C(const float* src, uint16_t* dst, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256 x = _mm256_loadu_ps(src + i);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                     _mm256_cvtps_ph(x, _MM_FROUND_TO_NEAREST_INT));
+  }
+  return i;
+}
+
+LC0_TARGET("avx,f16c")
+size_t FP16toFP32F16C(const uint16_t* src, float* dst, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m128i x =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(x));
+  }
+  return i;
+}
+
+LC0_TARGET("avx,f16c")
+size_t FP8E5M2toFP32F16C(const uint8_t* src, float* dst, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    // E5M2 is the high byte of a half.
+    const __m128i x =
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+    const __m128i h = _mm_unpacklo_epi8(_mm_setzero_si128(), x);
+    _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+  }
+  return i;
+}
+
+LC0_TARGET("avx2")
+size_t FP32toBF16AVX2(const float* src, uint16_t* dst, size_t count) {
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256i x[2];
+    for (int j = 0; j < 2; ++j) {
+      x[j] =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i) + j);
+#ifndef BF16_TRUNC
+      const __m256i abs =
+          _mm256_and_si256(x[j], _mm256_set1_epi32(0x7fffffff));
+      const __m256i nan =
+          _mm256_cmpgt_epi32(abs, _mm256_set1_epi32(0x7f800000));
+      // Round to nearest even, unless all the bits checked by the scalar
+      // version are zero.
+      const __m256i tie = _mm256_cmpeq_epi32(
+          _mm256_and_si256(x[j], _mm256_set1_epi32(0x17fff)),
+          _mm256_setzero_si256());
+      const __m256i rounded = _mm256_add_epi32(
+          x[j], _mm256_andnot_si256(tie, _mm256_set1_epi32(0x8000)));
+      const __m256i quiet =
+          _mm256_or_si256(x[j], _mm256_set1_epi32(0x400000));
+      x[j] = _mm256_blendv_epi8(rounded, quiet, nan);
+#endif
+      x[j] = _mm256_srli_epi32(x[j], 16);
+    }
+    // Packing works within 128-bit lanes, so restore the order after it.
+    const __m256i packed = _mm256_permute4x64_epi64(
+        _mm256_packus_epi32(x[0], x[1]), 0xd8);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), packed);
+  }
+  return i;
+}
+#endif
+
+#ifdef LC0_FP_CONVERT_NEON
+size_t FP32toFP16NEON(const float* src, uint16_t* dst, size_t count) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const float16x4_t h = vcvt_f16_f32(vld1q_f32(src + i));
+    vst1_u16(dst + i, vreinterpret_u16_f16(h));
+  }
+  return i;
+}
+
+size_t FP16toFP32NEON(const uint16_t* src, float* dst, size_t count) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const float16x4_t h = vreinterpret_f16_u16(vld1_u16(src + i));
+    vst1q_f32(dst + i, vcvt_f32_f16(h));
+  }
+  return i;
+}
+#endif
+
+}  // namespace
+
+void FP32toFP16(std::span<const float> src, std::span<uint16_t> dst) {
+  assert(dst.size() >= src.size());
+  size_t i = 0;
+#ifdef LC0_FP_CONVERT_X86
+  if (HasF16C()) i = FP32toFP16F16C(src.data(), dst.data(), src.size());
+#elif defined(LC0_FP_CONVERT_NEON)
+  i = FP32toFP16NEON(src.data(), dst.data(), src.size());
+#endif
+  for (; i < src.size(); ++i) dst[i] = FP32toFP16(src[i]);
+}
+
+void FP16toFP32(std::span<const uint16_t> src, std::span<float> dst) {
+  assert(dst.size() >= src.size());
+  size_t i = 0;
+#ifdef LC0_FP_CONVERT_X86
+  if (HasF16C()) i = FP16toFP32F16C(src.data(), dst.data(), src.size());
+#elif defined(LC0_FP_CONVERT_NEON)
+  i = FP16toFP32NEON(src.data(), dst.data(), src.size());
+#endif
+  for (; i < src.size(); ++i) dst[i] = FP16toFP32(src[i]);
+}
+
+void FP32toBF16(std::span<const float> src, std::span<uint16_t> dst) {
+  assert(dst.size() >= src.size());
+  size_t i = 0;
+#ifdef LC0_FP_CONVERT_X86
+  if (HasAVX2()) i = FP32toBF16AVX2(src.data(), dst.data(), src.size());
+#endif
+  for (; i < src.size(); ++i) dst[i] = FP32toBF16(src[i]);
+}
+
+void BF16toFP32(std::span<const uint16_t> src, std::span<float> dst) {
+  assert(dst.size() >= src.size());
+  // Just a shift, which compilers vectorize well.
+  for (size_t i = 0; i < src.size(); ++i) dst[i] = BF16toFP32(src[i]);
+}
+
+void FP32toFP8E5M2(std::span<const float> src, std::span<uint8_t> dst,
+                   bool saturate) {
+  assert(dst.size() >= src.size());
+  for (size_t i = 0; i < src.size(); ++i) {
+    dst[i] = FP32toFP8E5M2(src[i], saturate);
+  }
+}
+
+void FP8E5M2toFP32(std::span<const uint8_t> src, std::span<float> dst) {
+  assert(dst.size() >= src.size());
+  size_t i = 0;
+#ifdef LC0_FP_CONVERT_X86
+  if (HasF16C()) i = FP8E5M2toFP32F16C(src.data(), dst.data(), src.size());
+#endif
+  for (; i < src.size(); ++i) dst[i] = FP8E5M2toFP32(src[i]);
+}
+
+void FP32toFP8E4M3FN(std::span<const float> src, std::span<uint8_t> dst,
+                     bool saturate) {
+  assert(dst.size() >= src.size());
+  for (size_t i = 0; i < src.size(); ++i) {
+    dst[i] = FP32toFP8E4M3FN(src[i], saturate);
+  }
+}
+
+void FP8E4M3FNtoFP32(std::span<const uint8_t> src, std::span<float> dst) {
+  assert(dst.size() >= src.size());
+  for (size_t i = 0; i < src.size(); ++i) dst[i] = FP8E4M3FNtoFP32(src[i]);
+}
+
+}  // namespace lczero
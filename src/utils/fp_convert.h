@@ -0,0 +1,51 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+namespace lczero {
+
+// Bulk versions of the conversions in fp16_utils.h, bf16_utils.h and
+// fp8_utils.h. They give the same results as the per element functions, using
+// F16C, AVX2 or NEON instructions when the CPU has them (checked at runtime on
+// x86). @dst must be at least as large as @src. Narrowing conversions may be
+// done in place, with @dst at the start of @src's storage.
+void FP32toFP16(std::span<const float> src, std::span<uint16_t> dst);
+void FP16toFP32(std::span<const uint16_t> src, std::span<float> dst);
+void FP32toBF16(std::span<const float> src, std::span<uint16_t> dst);
+void BF16toFP32(std::span<const uint16_t> src, std::span<float> dst);
+void FP32toFP8E5M2(std::span<const float> src, std::span<uint8_t> dst,
+                   bool saturate = true);
+void FP8E5M2toFP32(std::span<const uint8_t> src, std::span<float> dst);
+void FP32toFP8E4M3FN(std::span<const float> src, std::span<uint8_t> dst,
+                     bool saturate = true);
+void FP8E4M3FNtoFP32(std::span<const uint8_t> src, std::span<float> dst);
+
+}  // namespace lczero
@@ -0,0 +1,148 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/fp_convert.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "utils/bf16_utils.h"
+#include "utils/fp16_utils.h"
+#include "utils/fp8_utils.h"
+
+namespace lczero {
+namespace {
+
+uint32_t Bits(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  return x;
+}
+
+void ExpectSameFloat(float expected, float actual) {
+  if (std::isnan(expected)) {
+    EXPECT_TRUE(std::isnan(actual));
+  } else {
+    EXPECT_EQ(Bits(expected), Bits(actual));
+  }
+}
+
+// Floats around the interesting ranges of all the formats, including
+// subnormals, overflows, infinities and NaNs. The odd count also exercises
+// the scalar tails.
+std::vector<float> TestFloats() {
+  std::vector<float> result = {0.0f,     -0.0f,     INFINITY, -INFINITY,
+                               NAN,      65504.0f,  65520.0f, 57344.0f,
+                               448.0f,   464.0f,    1e-8f,    6e-8f,
+                               3e-5f,    -1.0f / 3, 1e30f,    1e-30f};
+  for (int exp = -30; exp <= 20; ++exp) {
+    for (int mantissa = 0; mantissa < 203; ++mantissa) {
+      const float f = std::ldexp(1.0f + mantissa / 202.0f, exp);
+      result.push_back(f);
+      result.push_back(-f);
+      // Exact ties of the narrower formats.
+      result.push_back(std::ldexp(1.0f + mantissa / 1024.0f + 1.0f / 2048,
+                                  exp));
+    }
+  }
+  return result;
+}
+
+}  // namespace
+
+TEST(FpConvert, FP32toFP16) {
+  const std::vector<float> src = TestFloats();
+  std::vector<uint16_t> dst(src.size());
+  FP32toFP16(src, dst);
+  for (size_t i = 0; i < src.size(); ++i) {
+    EXPECT_EQ(FP32toFP16(src[i]), dst[i]) << src[i];
+  }
+}
+
+TEST(FpConvert, FP32toFP16InPlace) {
+  const std::vector<float> expected = TestFloats();
+  std::vector<float> buf = expected;
+  uint16_t* dst = reinterpret_cast<uint16_t*>(buf.data());
+  FP32toFP16(buf, {dst, buf.size()});
+  for (size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_EQ(FP32toFP16(expected[i]), dst[i]) << expected[i];
+  }
+}
+
+TEST(FpConvert, FP16toFP32) {
+  std::vector<uint16_t> src(65536 + 3);
+  for (size_t i = 0; i < src.size(); ++i) src[i] = i;
+  std::vector<float> dst(src.size());
+  FP16toFP32(src, dst);
+  for (size_t i = 0; i < src.size(); ++i) {
+    ExpectSameFloat(FP16toFP32(src[i]), dst[i]);
+  }
+}
+
+TEST(FpConvert, FP32toBF16) {
+  const std::vector<float> src = TestFloats();
+  std::vector<uint16_t> dst(src.size());
+  FP32toBF16(src, dst);
+  for (size_t i = 0; i < src.size(); ++i) {
+    EXPECT_EQ(FP32toBF16(src[i]), dst[i]) << src[i];
+  }
+}
+
+TEST(FpConvert, FP8) {
+  const std::vector<float> src = TestFloats();
+  std::vector<uint8_t> dst(src.size());
+  FP32toFP8E5M2(src, dst);
+  for (size_t i = 0; i < src.size(); ++i) {
+    EXPECT_EQ(FP32toFP8E5M2(src[i]), dst[i]) << src[i];
+  }
+  FP32toFP8E4M3FN(src, dst, false);
+  for (size_t i = 0; i < src.size(); ++i) {
+    EXPECT_EQ(FP32toFP8E4M3FN(src[i], false), dst[i]) << src[i];
+  }
+
+  std::vector<uint8_t> all(256 + 3);
+  for (size_t i = 0; i < all.size(); ++i) all[i] = i;
+  std::vector<float> result(all.size());
+  FP8E5M2toFP32(all, result);
+  for (size_t i = 0; i < all.size(); ++i) {
+    ExpectSameFloat(FP8E5M2toFP32(all[i]), result[i]);
+  }
+  FP8E4M3FNtoFP32(all, result);
+  for (size_t i = 0; i < all.size(); ++i) {
+    ExpectSameFloat(FP8E4M3FNtoFP32(all[i]), result[i]);
+  }
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -32,6 +32,7 @@
 #include <cmath>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 
 namespace lczero {
 
@@ -122,6 +123,23 @@ void Histogram::Dump() const {
   Print(" \n");
 }
 
+double Histogram::Percentile(double fraction) const {
+  if (total_ == 0) return 0.0;
+  const double target = fraction * total_;
+  double count = 0;
+  size_t idx = 0;
+  for (; idx + 1 < buckets_.size(); ++idx) {
+    count += buckets_[idx];
+    if (count >= target && buckets_[idx] > 0) break;
+  }
+  if (idx < 2) return 0.0;
+  if (idx >= static_cast<size_t>(total_scales_) + 2) {
+    return std::numeric_limits<double>::infinity();
+  }
+  // Inverse of GetIndex() for the bucket middle.
+  return std::pow(10.0, min_exp_ + (idx - 4.0) / minor_scales_);
+}
+
 int Histogram::GetIndex(double val) const {
   if (val <= 0) return 0;
   const double log10 = std::log10(val);
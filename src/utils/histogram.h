@@ -70,6 +70,11 @@ class Histogram {
   // Dumps the histogram to stderr.
   void Dump() const;
 
+  // Returns the value below which the @fraction of samples fall, rounded to
+  // the middle of its bucket. Samples below the scale count as 0, those above
+  // as infinity.
+  double Percentile(double fraction) const;
+
  private:
   int GetIndex(double val) const;
 
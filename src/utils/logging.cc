@@ -27,35 +27,181 @@
 
 #include "utils/logging.h"
 
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
 #include <iomanip>
 #include <iostream>
 #include <thread>
+#include <vector>
 
 namespace lczero {
 
 namespace {
 const size_t kBufferSizeLines = 200;
 const char* const kStderrFilename = "<stderr>";
+// How many lines the writer thread may lag behind before new ones are dropped.
+const size_t kQueueSizeLines = 8192;
+// The writer may miss a wakeup, it then picks the lines up after this long.
+const auto kWriterIdleWait = std::chrono::milliseconds(50);
 }  // namespace
 
+// Bounded multi-producer multi-consumer queue of log lines, after
+// Dmitry Vyukov's design: every cell carries a sequence number telling whether
+// it is free for the producer or filled for the consumer at that position.
+class LogQueue {
+ public:
+  // @capacity has to be a power of two.
+  explicit LogQueue(size_t capacity) : cells_(capacity), mask_(capacity - 1) {
+    for (size_t i = 0; i < capacity; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // Returns false if the queue is full.
+  bool TryPush(std::string&& line) {
+    size_t pos = push_pos_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      const auto diff = static_cast<std::ptrdiff_t>(sequence) -
+                        static_cast<std::ptrdiff_t>(pos);
+      if (diff == 0) {
+        if (push_pos_.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = push_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->line = std::move(line);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Returns false if the queue is empty.
+  bool TryPop(std::string* line) {
+    size_t pos = pop_pos_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      const auto diff = static_cast<std::ptrdiff_t>(sequence) -
+                        static_cast<std::ptrdiff_t>(pos + 1);
+      if (diff == 0) {
+        if (pop_pos_.compare_exchange_weak(pos, pos + 1,
+                                           std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = pop_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    *line = std::move(cell->line);
+    cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    std::string line;
+  };
+  std::vector<Cell> cells_;
+  const size_t mask_;
+  alignas(64) std::atomic<size_t> push_pos_{0};
+  alignas(64) std::atomic<size_t> pop_pos_{0};
+};
+
+Logging::Logging() : queue_(std::make_unique<LogQueue>(kQueueSizeLines)) {
+  writer_ = std::thread([this]() { WriterThread(); });
+}
+
 Logging& Logging::Get() {
-  static Logging logging;
-  return logging;
+  // Never destroyed, so that logging keeps working during static destruction.
+  // The writer thread is stopped at exit instead.
+  static Logging* logging = []() {
+    Logging* logging = new Logging();
+    std::atexit(&Logging::StopWriter);
+    return logging;
+  }();
+  return *logging;
 }
 
-void Logging::WriteLineRaw(const std::string& line) {
+void Logging::WriteLineRaw(std::string line) {
+  if (synchronous_.load(std::memory_order_acquire)) {
+    Mutex::Lock lock_(mutex_);
+    Drain();
+    WriteLine(line);
+    return;
+  }
+  if (!queue_->TryPush(std::move(line))) {
+    dropped_lines_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  if (writer_sleeping_.load()) cv_.notify_one();
+}
+
+void Logging::WriterThread() {
   Mutex::Lock lock_(mutex_);
+  while (!stop_) {
+    writer_sleeping_.store(true);
+    Drain();
+    cv_.wait_for(lock_.get_raw(), kWriterIdleWait);
+    writer_sleeping_.store(false);
+  }
+  Drain();
+}
+
+void Logging::StopWriter() {
+  Logging& logging = Get();
+  logging.synchronous_.store(true, std::memory_order_release);
+  {
+    Mutex::Lock lock_(logging.mutex_);
+    logging.stop_ = true;
+  }
+  logging.cv_.notify_one();
+  logging.writer_.join();
+}
+
+void Logging::Drain() {
+  std::string line;
+  bool written = false;
+  while (queue_->TryPop(&line)) {
+    WriteLine(line);
+    written = true;
+  }
+  if (const size_t dropped =
+          dropped_lines_.exchange(0, std::memory_order_relaxed)) {
+    WriteLine("Dropped " + std::to_string(dropped) +
+              " log lines, the log writer could not keep up.");
+    written = true;
+  }
+  if (written && !filename_.empty() && filename_ != kStderrFilename) {
+    file_.flush();
+  }
+}
+
+void Logging::WriteLine(const std::string& line) {
   if (filename_.empty()) {
     buffer_.push_back(line);
     if (buffer_.size() > kBufferSizeLines) buffer_.pop_front();
   } else {
     auto& file = (filename_ == kStderrFilename) ? std::cerr : file_;
-    file << line << std::endl;
+    file << line << '\n';
   }
 }
 
 void Logging::SetFilename(const std::string& filename) {
   Mutex::Lock lock_(mutex_);
+  // Lines logged so far go to the old file, or to the buffer.
+  Drain();
   if (filename_ == filename) return;
   filename_ = filename;
   if (filename.empty() || filename == kStderrFilename) {
@@ -102,25 +248,29 @@ std::chrono::time_point<std::chrono::system_clock> SteadyClockToSystemClock(
 
 std::string FormatTime(
     std::chrono::time_point<std::chrono::system_clock> time) {
-  static Mutex mutex;
-
-  std::ostringstream ss;
   using std::chrono::duration_cast;
   using std::chrono::microseconds;
   const auto us =
       duration_cast<microseconds>(time.time_since_epoch()).count() % 1000000;
-  auto timer = std::chrono::system_clock::to_time_t(time);
-  // std::localtime is not thread safe. Since this is the only place
-  // std::localtime is used in the program, guard by mutex.
-  // TODO: replace with std::localtime_r or s once they are properly
-  // standardised. Or some other more c++ like time component thing, whichever
-  // comes first...
-  {
-    Mutex::Lock lock(mutex);
-    ss << std::put_time(std::localtime(&timer), "%m%d %T") << '.'
-       << std::setfill('0') << std::setw(6) << us;
+  const auto timer = std::chrono::system_clock::to_time_t(time);
+  // Formatting the date is slow, so every thread keeps the one of the second
+  // it last logged in.
+  thread_local time_t cached_timer = -1;
+  thread_local char cached_date[16];
+  if (timer != cached_timer) {
+    std::tm tm;
+#ifdef _WIN32
+    localtime_s(&tm, &timer);
+#else
+    localtime_r(&timer, &tm);
+#endif
+    std::strftime(cached_date, sizeof(cached_date), "%m%d %H:%M:%S", &tm);
+    cached_timer = timer;
   }
-  return ss.str();
+  char result[32];
+  std::snprintf(result, sizeof(result), "%s.%06d", cached_date,
+                static_cast<int>(us));
+  return result;
 }
 
 }  // namespace lczero
\ No newline at end of file
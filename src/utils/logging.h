@@ -27,17 +27,26 @@
 
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <deque>
 #include <fstream>
 #include <iomanip>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include "utils/mutex.h"
 
 namespace lczero {
 
+class LogQueue;
+
+// Log lines are handed to a background thread through a bounded lock-free
+// queue, so logging threads never wait for each other or for the file. When
+// the queue is full, lines are dropped and their number is logged instead.
 class Logging {
  public:
   static Logging& Get();
@@ -46,15 +55,30 @@ class Logging {
   void SetFilename(const std::string& filename);
 
  private:
-  // Writes line to the log, and appends new line character.
-  void WriteLineRaw(const std::string& line);
+  // Queues line to be written to the log with a new line character appended.
+  void WriteLineRaw(std::string line);
+
+  // Writes out the queued lines.
+  void Drain() REQUIRES(mutex_);
+  void WriteLine(const std::string& line) REQUIRES(mutex_);
+  void WriterThread();
+  // Stops the writer thread, after which lines are written synchronously.
+  static void StopWriter();
+
+  const std::unique_ptr<LogQueue> queue_;
+  std::atomic<size_t> dropped_lines_{0};
+  std::atomic<bool> writer_sleeping_{false};
+  std::atomic<bool> synchronous_{false};
 
   Mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ GUARDED_BY(mutex_) = false;
   std::string filename_ GUARDED_BY(mutex_);
   std::ofstream file_ GUARDED_BY(mutex_);
   std::deque<std::string> buffer_ GUARDED_BY(mutex_);
+  std::thread writer_;
 
-  Logging() = default;
+  Logging();
   friend class LogMessage;
 };
 
@@ -0,0 +1,81 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/memory_accountant.h"
+
+#include <iterator>
+#include <numeric>
+#include <sstream>
+
+namespace lczero {
+
+namespace {
+const char* const kKindNames[] = {"tree", "gc", "cache"};
+static_assert(std::size(kKindNames) ==
+              static_cast<size_t>(MemoryKind::kCount));
+}  // namespace
+
+size_t MemoryAccountant::Usage::Total() const {
+  return std::accumulate(bytes.begin(), bytes.end(), size_t{0});
+}
+
+std::string MemoryAccountant::Usage::ToString() const {
+  std::ostringstream os;
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    os << kKindNames[i] << ' ' << (bytes[i] >> 20) << "MB, ";
+  }
+  os << "total " << (Total() >> 20) << "MB";
+  return os.str();
+}
+
+MemoryAccountant& MemoryAccountant::Get() {
+  static MemoryAccountant accountant;
+  return accountant;
+}
+
+int MemoryAccountant::AddSource(MemoryKind kind,
+                                std::function<size_t()> bytes) {
+  Mutex::Lock lock(mutex_);
+  sources_.push_back({next_id_, kind, std::move(bytes)});
+  return next_id_++;
+}
+
+void MemoryAccountant::RemoveSource(int id) {
+  Mutex::Lock lock(mutex_);
+  std::erase_if(sources_, [id](const Source& s) { return s.id == id; });
+}
+
+MemoryAccountant::Usage MemoryAccountant::GetUsage() {
+  Usage usage;
+  Mutex::Lock lock(mutex_);
+  for (const auto& source : sources_) {
+    usage.bytes[static_cast<size_t>(source.kind)] += source.bytes();
+  }
+  return usage;
+}
+
+}  // namespace lczero
@@ -0,0 +1,82 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// Subsystems whose memory use grows with search length.
+enum class MemoryKind { kTree, kGcBacklog, kCache, kCount };
+
+// Process-wide record of how much memory the large subsystems hold, so that
+// the engine can keep their sum within a budget. Every subsystem registers a
+// callback returning its current usage in bytes.
+class MemoryAccountant {
+ public:
+  struct Usage {
+    std::array<size_t, static_cast<size_t>(MemoryKind::kCount)> bytes = {};
+
+    size_t operator[](MemoryKind kind) const {
+      return bytes[static_cast<size_t>(kind)];
+    }
+    size_t Total() const;
+    // E.g. "tree 512MB, gc 3MB, cache 120MB, total 635MB".
+    std::string ToString() const;
+  };
+
+  static MemoryAccountant& Get();
+
+  // Returns an id to be passed to RemoveSource() before @bytes becomes
+  // invalid. The callback is called from arbitrary threads.
+  int AddSource(MemoryKind kind, std::function<size_t()> bytes);
+  void RemoveSource(int id);
+
+  Usage GetUsage();
+
+ private:
+  struct Source {
+    int id;
+    MemoryKind kind;
+    std::function<size_t()> bytes;
+  };
+
+  MemoryAccountant() = default;
+
+  Mutex mutex_;
+  std::vector<Source> sources_ GUARDED_BY(mutex_);
+  int next_id_ GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace lczero
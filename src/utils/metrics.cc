@@ -0,0 +1,200 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/metrics.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "utils/logging.h"
+
+namespace lczero {
+
+namespace {
+const OptionId kMetricsFileId{
+    "metrics-file", "MetricsFile",
+    "Periodically write playouts, batch sizes, cache hits and other "
+    "statistics to that file in the OpenMetrics (Prometheus) text format."};
+const OptionId kMetricsIntervalId{
+    "metrics-interval", "MetricsInterval",
+    "How often the metrics file is rewritten, in seconds."};
+
+const std::string kPrefix = "lc0_";
+
+void WriteHeader(std::ostream& os, const std::string& name,
+                 const std::string& type, const std::string& help) {
+  os << "# TYPE " << kPrefix << name << ' ' << type << '\n'
+     << "# HELP " << kPrefix << name << ' ' << help << '\n';
+}
+}  // namespace
+
+void MetricHistogram::Observe(int64_t value) {
+  const size_t bucket =
+      value <= 1 ? 0 : std::bit_width(static_cast<uint64_t>(value - 1));
+  buckets_[std::min(bucket, kBuckets)].fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+Metrics& Metrics::Get() {
+  static Metrics metrics;
+  return metrics;
+}
+
+Metrics::~Metrics() { Stop(); }
+
+void Metrics::PopulateOptions(OptionsParser* options) {
+  options->Add<StringOption>(kMetricsFileId);
+  options->Add<IntOption>(kMetricsIntervalId, 1, 3600) = 10;
+}
+
+void Metrics::ApplyOptions(const OptionsDict& options) {
+  const std::string filename = options.Get<std::string>(kMetricsFileId);
+  const std::chrono::milliseconds interval =
+      std::chrono::seconds(options.Get<int>(kMetricsIntervalId));
+  {
+    Mutex::Lock lock(writer_mutex_);
+    if (filename == filename_ && interval == interval_) return;
+  }
+  Stop();
+  if (filename.empty()) return;
+  Mutex::Lock lock(writer_mutex_);
+  filename_ = filename;
+  interval_ = interval;
+  stop_ = false;
+  writer_ = std::thread([this]() { WriterThread(); });
+}
+
+void Metrics::Stop() {
+  {
+    Mutex::Lock lock(writer_mutex_);
+    stop_ = true;
+  }
+  writer_cv_.notify_all();
+  if (writer_.joinable()) writer_.join();
+  Mutex::Lock lock(writer_mutex_);
+  filename_.clear();
+}
+
+MetricCounter* Metrics::AddCounter(const std::string& name,
+                                   const std::string& help) {
+  Mutex::Lock lock(mutex_);
+  counters_.push_back({name, help, std::make_unique<MetricCounter>()});
+  return counters_.back().counter.get();
+}
+
+MetricHistogram* Metrics::AddHistogram(const std::string& name,
+                                       const std::string& help) {
+  Mutex::Lock lock(mutex_);
+  histograms_.push_back({name, help, std::make_unique<MetricHistogram>()});
+  return histograms_.back().histogram.get();
+}
+
+void Metrics::AddGauge(const std::string& name, const std::string& help,
+                       std::function<double()> getter) {
+  Mutex::Lock lock(mutex_);
+  gauges_.push_back({name, help, std::move(getter)});
+}
+
+std::string Metrics::Format() {
+  std::ostringstream os;
+  Mutex::Lock lock(mutex_);
+  for (const auto& counter : counters_) {
+    WriteHeader(os, counter.name, "counter", counter.help);
+    os << kPrefix << counter.name << "_total " << counter.counter->Get()
+       << '\n';
+  }
+  for (const auto& gauge : gauges_) {
+    WriteHeader(os, gauge.name, "gauge", gauge.help);
+    os << kPrefix << gauge.name << ' ' << gauge.getter() << '\n';
+  }
+  for (const auto& histogram : histograms_) {
+    WriteHeader(os, histogram.name, "histogram", histogram.help);
+    auto& buckets = histogram.histogram->buckets_;
+    int64_t count = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+      count += buckets[i].load(std::memory_order_relaxed);
+      os << kPrefix << histogram.name << "_bucket{le=\"";
+      if (i == MetricHistogram::kBuckets) {
+        os << "+Inf";
+      } else {
+        os << (int64_t{1} << i);
+      }
+      os << "\"} " << count << '\n';
+    }
+    os << kPrefix << histogram.name << "_sum "
+       << histogram.histogram->sum_.load(std::memory_order_relaxed) << '\n'
+       << kPrefix << histogram.name << "_count " << count << '\n';
+  }
+  os << "# EOF\n";
+  return os.str();
+}
+
+void Metrics::WriterThread() {
+  std::string filename;
+  std::chrono::milliseconds interval;
+  {
+    Mutex::Lock lock(writer_mutex_);
+    filename = filename_;
+    interval = interval_;
+  }
+  while (true) {
+    WriteFile(filename);
+    Mutex::Lock lock(writer_mutex_);
+    if (writer_cv_.wait_for(lock.get_raw(), interval,
+                            [this]() { return stop_; })) {
+      break;
+    }
+  }
+  // Leave the final values behind.
+  WriteFile(filename);
+}
+
+void Metrics::WriteFile(const std::string& filename) {
+  // Written to a temporary file first, so that readers never see a partially
+  // written one.
+  const std::string tmp_filename = filename + ".tmp";
+  {
+    std::ofstream file(tmp_filename);
+    file << Format();
+    if (!file) {
+      CERR << "Unable to write metrics to " << tmp_filename;
+      return;
+    }
+  }
+#ifdef _WIN32
+  // Unlike POSIX, rename() doesn't replace an existing file on Windows.
+  std::remove(filename.c_str());
+#endif
+  if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+    CERR << "Unable to rename " << tmp_filename << " to " << filename;
+  }
+}
+
+}  // namespace lczero
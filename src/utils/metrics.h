@@ -0,0 +1,135 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils/mutex.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+
+// Monotonically increasing value, e.g. playouts or cache hits. Exported with a
+// _total suffix, rates are left to the monitoring system.
+class alignas(64) MetricCounter {
+ public:
+  void Add(int64_t value = 1) {
+    value_.fetch_add(value, std::memory_order_relaxed);
+  }
+  int64_t Get() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_{0};
+};
+
+// Distribution of non-negative values in power of two buckets: bucket i counts
+// values up to 2^i.
+class alignas(64) MetricHistogram {
+ public:
+  static constexpr size_t kBuckets = 16;
+
+  void Observe(int64_t value);
+
+ private:
+  friend class Metrics;
+  std::array<std::atomic<int64_t>, kBuckets + 1> buckets_ = {};
+  std::atomic<int64_t> sum_{0};
+};
+
+// Process-wide registry of metrics, periodically written to a file in the
+// OpenMetrics text format, e.g. for the node_exporter textfile collector.
+// Metrics are registered once, usually during static initialization, and
+// live until the process exits.
+class Metrics {
+ public:
+  static Metrics& Get();
+  ~Metrics();
+
+  // Adds the metrics options (file name and interval) to @options.
+  static void PopulateOptions(OptionsParser* options);
+  // Starts, restarts or stops the exporter according to the options.
+  void ApplyOptions(const OptionsDict& options);
+  // Writes the metrics a last time and stops the exporter. To be called before
+  // exiting, while the gauge sources are still alive.
+  void Stop();
+
+  // Metric names are prefixed with "lc0_".
+  MetricCounter* AddCounter(const std::string& name, const std::string& help);
+  MetricHistogram* AddHistogram(const std::string& name,
+                                const std::string& help);
+  // The value is read from @getter every time the metrics are written.
+  void AddGauge(const std::string& name, const std::string& help,
+                std::function<double()> getter);
+
+  // Returns all metrics in the OpenMetrics text format.
+  std::string Format();
+
+ private:
+  struct Counter {
+    std::string name;
+    std::string help;
+    std::unique_ptr<MetricCounter> counter;
+  };
+  struct Histogram {
+    std::string name;
+    std::string help;
+    std::unique_ptr<MetricHistogram> histogram;
+  };
+  struct Gauge {
+    std::string name;
+    std::string help;
+    std::function<double()> getter;
+  };
+
+  Metrics() = default;
+  void WriterThread();
+  void WriteFile(const std::string& filename);
+
+  Mutex mutex_;
+  std::vector<Counter> counters_ GUARDED_BY(mutex_);
+  std::vector<Histogram> histograms_ GUARDED_BY(mutex_);
+  std::vector<Gauge> gauges_ GUARDED_BY(mutex_);
+
+  Mutex writer_mutex_;
+  std::condition_variable writer_cv_;
+  std::string filename_ GUARDED_BY(writer_mutex_);
+  std::chrono::milliseconds interval_ GUARDED_BY(writer_mutex_){0};
+  bool stop_ GUARDED_BY(writer_mutex_) = false;
+  std::thread writer_;
+};
+
+}  // namespace lczero
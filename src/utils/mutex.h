@@ -170,4 +170,96 @@ class CAPABILITY("mutex") SpinMutex {
   std::atomic<int> mutex_{0};
 };
 
+// Reader-preferenced "big reader" shared mutex. Readers only touch a reader
+// counter on their own cache line, so taking a shared lock from many threads
+// doesn't bounce a single line between cores. Writers are expected to be rare
+// and pay for it by scanning all the counters.
+// A writer that finds readers present backs off and retries, so a thread may
+// take a shared lock while another thread holding one waits for it.
+class CAPABILITY("mutex") BrSharedMutex {
+ public:
+  // std::unique_lock<BrSharedMutex> wrapper.
+  class SCOPED_CAPABILITY Lock {
+   public:
+    Lock(BrSharedMutex& m) ACQUIRE(m) : lock_(m) {}
+    ~Lock() RELEASE() {}
+
+   private:
+    std::unique_lock<BrSharedMutex> lock_;
+  };
+
+  // std::shared_lock<BrSharedMutex> wrapper.
+  class SCOPED_CAPABILITY SharedLock {
+   public:
+    SharedLock(BrSharedMutex& m) ACQUIRE_SHARED(m) : lock_(m) {}
+    ~SharedLock() RELEASE() {}
+
+   private:
+    std::shared_lock<BrSharedMutex> lock_;
+  };
+
+  void lock() ACQUIRE() {
+    writer_mutex_.lock();
+    int spins = 0;
+    while (true) {
+      writer_.store(true, std::memory_order_seq_cst);
+      if (NoReaders()) return;
+      // Let the readers in, they may be needed to release the ones inside.
+      writer_.store(false, std::memory_order_seq_cst);
+      writer_.notify_all();
+      do {
+        if (++spins % 512 == 0) {
+          std::this_thread::yield();
+        } else {
+          SpinloopPause();
+        }
+      } while (!NoReaders());
+    }
+  }
+  void unlock() RELEASE() {
+    writer_.store(false, std::memory_order_release);
+    writer_.notify_all();
+    writer_mutex_.unlock();
+  }
+  void lock_shared() ACQUIRE_SHARED() {
+    auto& readers = readers_[ReaderSlot()].count;
+    while (true) {
+      readers.fetch_add(1, std::memory_order_seq_cst);
+      if (!writer_.load(std::memory_order_seq_cst)) return;
+      readers.fetch_sub(1, std::memory_order_relaxed);
+      writer_.wait(true, std::memory_order_acquire);
+    }
+  }
+  void unlock_shared() RELEASE_SHARED() {
+    readers_[ReaderSlot()].count.fetch_sub(1, std::memory_order_release);
+  }
+
+ private:
+  static constexpr int kReaderSlots = 64;
+
+  // Threads are spread over the slots round-robin on their first use, threads
+  // sharing a slot are still correct, only slower.
+  static int ReaderSlot() {
+    static std::atomic<int> next_slot{0};
+    thread_local const int slot =
+        next_slot.fetch_add(1, std::memory_order_relaxed) % kReaderSlots;
+    return slot;
+  }
+
+  bool NoReaders() const {
+    for (const auto& slot : readers_) {
+      if (slot.count.load(std::memory_order_seq_cst) != 0) return false;
+    }
+    return true;
+  }
+
+  struct alignas(64) ReaderSlotCount {
+    std::atomic<int> count{0};
+  };
+
+  ReaderSlotCount readers_[kReaderSlots];
+  alignas(64) std::atomic<bool> writer_{false};
+  std::mutex writer_mutex_;
+};
+
 }  // namespace lczero
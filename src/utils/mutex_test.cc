@@ -0,0 +1,84 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "utils/mutex.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace lczero {
+
+TEST(BrSharedMutex, WritersExcludeReadersAndWriters) {
+  BrSharedMutex mutex;
+  std::atomic<int> readers = 0;
+  std::atomic<int> writers = 0;
+  std::atomic<bool> overlap = false;
+  int64_t counter = 0;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([&, i]() {
+      for (int j = 0; j < 2000; ++j) {
+        if ((i + j) % 4 == 0) {
+          BrSharedMutex::Lock lock(mutex);
+          if (writers++ || readers) overlap = true;
+          ++counter;
+          --writers;
+        } else {
+          BrSharedMutex::SharedLock lock(mutex);
+          ++readers;
+          if (writers) overlap = true;
+          --readers;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  EXPECT_FALSE(overlap);
+  EXPECT_EQ(counter, 8 * 2000 / 4);
+}
+
+// The search takes a shared lock on behalf of its task workers and waits for
+// them, while they may take shared locks of their own.
+TEST(BrSharedMutex, ReaderEntersWhileWriterWaits) {
+  BrSharedMutex mutex;
+  std::atomic<bool> write_done = false;
+  mutex.lock_shared();
+  std::thread writer([&]() {
+    BrSharedMutex::Lock lock(mutex);
+    write_done = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  std::thread reader([&]() { BrSharedMutex::SharedLock lock(mutex); });
+  reader.join();
+  EXPECT_FALSE(write_done);
+  mutex.unlock_shared();
+  writer.join();
+  EXPECT_TRUE(write_done);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -27,15 +27,126 @@
 
 #include "utils/numa.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+
 #include "chess/bitboard.h"
+#include "utils/exception.h"
 #include "utils/logging.h"
+#include "utils/mutex.h"
 
 #ifdef _WIN32
 #include <windows.h>
 #endif
 
+#ifdef __linux__
+#include <sched.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+#endif
+
 namespace lczero {
 
+namespace {
+std::atomic<Numa::Placement> placement{Numa::Placement::kNone};
+std::atomic<int> placement_generation{0};
+std::atomic<int> gpu_node{-1};
+
+const char* PlacementName(Numa::Placement placement) {
+  switch (placement) {
+    case Numa::Placement::kNone:
+      return "none";
+    case Numa::Placement::kCompact:
+      return "compact";
+    case Numa::Placement::kScatter:
+      return "scatter";
+    case Numa::Placement::kGpu:
+      return "gpu";
+  }
+  return "";
+}
+}  // namespace
+
+#ifdef __linux__
+namespace {
+// Affinity of the process before any thread was placed, to return to when
+// the placement is switched off.
+cpu_set_t initial_affinity;
+std::atomic<bool> initial_affinity_valid{false};
+
+// Parses a sysfs cpu/node list like "0-7,16-23".
+std::vector<int> ReadSysfsList(const std::string& path) {
+  std::vector<int> result;
+  std::ifstream file(path);
+  std::string list;
+  if (!std::getline(file, list)) return result;
+  size_t pos = 0;
+  while (pos < list.size()) {
+    size_t end = list.find(',', pos);
+    if (end == std::string::npos) end = list.size();
+    const std::string range = list.substr(pos, end - pos);
+    pos = end + 1;
+    if (range.empty()) continue;
+    const size_t dash = range.find('-');
+    try {
+      const int first = std::stoi(range.substr(0, dash));
+      const int last =
+          dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+      for (int i = first; i <= last; i++) result.push_back(i);
+    } catch (const std::exception&) {
+      return {};
+    }
+  }
+  return result;
+}
+}  // namespace
+#endif
+
+namespace {
+// Number of processors of the NUMA node, 0 if unknown.
+int GetNodeProcessorCount([[maybe_unused]] int node) {
+#if defined(_WIN64) && _WIN32_WINNT >= 0x0601
+  GROUP_AFFINITY affinity = {};
+  if (!GetNumaNodeProcessorMaskEx(node, &affinity)) return 0;
+  return BitBoard(affinity.Mask).count();
+#elif defined(__linux__)
+  return ReadSysfsList("/sys/devices/system/node/node" +
+                       std::to_string(node) + "/cpulist")
+      .size();
+#else
+  return 0;
+#endif
+}
+
+// Returns the node for the @cpu-th processor when filling node by node.
+int GetCompactNode(int cpu) {
+  std::vector<int> counts;
+  for (int node = 0; node < Numa::GetNodeCount(); node++) {
+    counts.push_back(GetNodeProcessorCount(node));
+  }
+  int total = 0;
+  for (int count : counts) total += count;
+  if (total == 0) return 0;
+  cpu %= total;
+  for (size_t node = 0; node < counts.size(); node++) {
+    if (cpu < counts[node]) return node;
+    cpu -= counts[node];
+  }
+  return 0;
+}
+
+void RestoreInitialAffinity() {
+#ifdef __linux__
+  if (initial_affinity_valid.load(std::memory_order_acquire)) {
+    sched_setaffinity(0, sizeof(initial_affinity), &initial_affinity);
+  }
+#endif
+}
+}  // namespace
+
 int Numa::threads_per_core_ = 1;
 
 void Numa::Init() {
@@ -65,6 +176,10 @@ void Numa::Init() {
 }
 
 void Numa::BindThread(int id) {
+  if (placement.load(std::memory_order_acquire) != Placement::kNone) {
+    PlaceThread(id);
+    return;
+  }
 #if defined(_WIN64) && _WIN32_WINNT >= 0x0601
   int group_count = GetActiveProcessorGroupCount();
   int thread_count = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
@@ -91,4 +206,118 @@ void Numa::BindThread(int id) {
 #endif
 }
 
+int Numa::GetNodeCount() {
+#if defined(_WIN64) && _WIN32_WINNT >= 0x0601
+  ULONG highest = 0;
+  if (!GetNumaHighestNodeNumber(&highest)) return 1;
+  return highest + 1;
+#elif defined(__linux__)
+  const auto nodes = ReadSysfsList("/sys/devices/system/node/online");
+  return nodes.empty() ? 1 : nodes.back() + 1;
+#else
+  return 1;
+#endif
+}
+
+bool Numa::BindThreadToNode(int node) {
+#if defined(_WIN64) && _WIN32_WINNT >= 0x0601
+  GROUP_AFFINITY affinity = {};
+  if (!GetNumaNodeProcessorMaskEx(node, &affinity) || affinity.Mask == 0) {
+    return false;
+  }
+  return SetThreadGroupAffinity(GetCurrentThread(), &affinity, NULL);
+#elif defined(__linux__)
+  const auto cpus = ReadSysfsList("/sys/devices/system/node/node" +
+                                  std::to_string(node) + "/cpulist");
+  if (cpus.empty()) return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+  }
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+  (void)node;
+  return false;
+#endif
+}
+
+Numa::Placement Numa::ParsePlacement(const std::string& name) {
+  for (Placement p : {Placement::kNone, Placement::kCompact,
+                      Placement::kScatter, Placement::kGpu}) {
+    if (name == PlacementName(p)) return p;
+  }
+  throw Exception("Unknown thread placement: " + name);
+}
+
+void Numa::SetPlacement(Placement new_placement) {
+  static Mutex mutex;
+  Mutex::Lock lock(mutex);
+  if (placement.load(std::memory_order_relaxed) == new_placement) return;
+#ifdef __linux__
+  if (!initial_affinity_valid.load(std::memory_order_relaxed) &&
+      sched_getaffinity(0, sizeof(initial_affinity), &initial_affinity) == 0) {
+    initial_affinity_valid.store(true, std::memory_order_release);
+  }
+#endif
+  placement.store(new_placement, std::memory_order_release);
+  placement_generation.fetch_add(1, std::memory_order_acq_rel);
+  if (new_placement == Placement::kNone) return;
+
+  const int nodes = GetNodeCount();
+  CERR << "Thread placement " << PlacementName(new_placement) << " over "
+       << nodes << " NUMA node(s).";
+  for (int node = 0; node < nodes; node++) {
+    CERR << "Node " << node << " has " << GetNodeProcessorCount(node)
+         << " processor(s).";
+  }
+  if (new_placement == Placement::kGpu) {
+    const int node = gpu_node.load(std::memory_order_acquire);
+    if (node < 0) {
+      CERR << "The NUMA node of the GPU is not known, threads stay unbound.";
+    } else {
+      CERR << "The GPU is attached to node " << node << ".";
+    }
+  }
+}
+
+int Numa::GetPlacementGeneration() {
+  return placement_generation.load(std::memory_order_acquire);
+}
+
+void Numa::PlaceThread(int id, int threads_per_id) {
+  int node = -1;
+  switch (placement.load(std::memory_order_acquire)) {
+    case Placement::kNone:
+      RestoreInitialAffinity();
+      return;
+    case Placement::kCompact:
+      node = GetCompactNode(id * threads_per_id);
+      break;
+    case Placement::kScatter:
+      node = id % GetNodeCount();
+      break;
+    case Placement::kGpu:
+      node = gpu_node.load(std::memory_order_acquire);
+      break;
+  }
+  if (node < 0) return;
+  if (BindThreadToNode(node)) {
+    LOGFILE << "Thread " << id << " placed on NUMA node " << node << ".";
+  }
+}
+
+void Numa::SetGpuPciDevice([[maybe_unused]] const std::string& pci_address) {
+#ifdef __linux__
+  std::string address = pci_address;
+  std::transform(address.begin(), address.end(), address.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  std::ifstream file("/sys/bus/pci/devices/" + address + "/numa_node");
+  int node = -1;
+  if (!(file >> node) || node < 0) return;
+  gpu_node.store(node, std::memory_order_release);
+  LOGFILE << "GPU " << address << " is attached to NUMA node " << node << ".";
+#endif
+}
+
 }  // namespace lczero
@@ -27,6 +27,8 @@
 
 #pragma once
 
+#include <string>
+
 namespace lczero {
 
 class Numa {
@@ -39,6 +41,38 @@ class Numa {
   // Bind thread to processor group.
   static void BindThread(int id);
 
+  // Number of NUMA nodes, 1 if unknown.
+  static int GetNodeCount();
+
+  // Restrict the calling thread to the processors of the given NUMA node.
+  // Memory the thread touches first is then allocated on that node. Returns
+  // false if not supported or the node has no processors.
+  static bool BindThreadToNode(int node);
+
+  // How PlaceThread() distributes threads over the NUMA nodes.
+  enum class Placement {
+    kNone,     // Threads are not bound.
+    kCompact,  // Fill the processors of one node before using the next.
+    kScatter,  // Round robin over the nodes.
+    kGpu,      // The node nearest to the GPU, see SetGpuPciDevice().
+  };
+  static Placement ParsePlacement(const std::string& name);
+
+  // Sets the policy, and reports the topology and the policy when it changes.
+  static void SetPlacement(Placement placement);
+  // Changes whenever the policy does, so that long-lived threads (e.g. the
+  // garbage collector) know to place themselves again.
+  static int GetPlacementGeneration();
+
+  // Binds the calling thread, one of @threads_per_id that share @id (e.g. a
+  // search worker and its task workers), to a node by the placement policy.
+  // Memory that the thread touches first is then allocated on that node.
+  static void PlaceThread(int id, int threads_per_id = 1);
+
+  // Records the PCI address (e.g. "0000:3b:00.0") of the GPU in use, for the
+  // GPU-affine placement.
+  static void SetGpuPciDevice(const std::string& pci_address);
+
  private:
   static int threads_per_core_;
 };
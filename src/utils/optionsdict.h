@@ -27,6 +27,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <map>
 #include <memory>
 #include <optional>
@@ -42,22 +43,35 @@ template <typename T>
 class TypeDict {
  protected:
   struct V {
+    V() = default;
+    V(const V& other)
+        : was_read_since_last_set_(other.WasReadSinceLastSet()),
+          value_(other.value_) {}
+    V& operator=(const V& other) {
+      was_read_since_last_set_.store(other.WasReadSinceLastSet(),
+                                     std::memory_order_relaxed);
+      value_ = other.value_;
+      return *this;
+    }
     const T& Get() const {
-      was_read_since_last_set_ = true;
+      was_read_since_last_set_.store(true, std::memory_order_relaxed);
       return value_;
     }
     T& Get() {
-      was_read_since_last_set_ = true;
+      was_read_since_last_set_.store(true, std::memory_order_relaxed);
       return value_;
     }
     void Set(const T& v) {
-      was_read_since_last_set_ = false;
+      was_read_since_last_set_.store(false, std::memory_order_relaxed);
       value_ = v;
     }
-    bool WasReadSinceLastSet() const { return was_read_since_last_set_; }
+    bool WasReadSinceLastSet() const {
+      return was_read_since_last_set_.load(std::memory_order_relaxed);
+    }
 
    private:
-    mutable bool was_read_since_last_set_ = false;
+    // Atomic as backends created in parallel read the same parent dict.
+    mutable std::atomic<bool> was_read_since_last_set_ = false;
     T value_;
   };
   void EnsureNoUnusedOptions(const std::string& type_name,
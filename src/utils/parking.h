@@ -0,0 +1,127 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// Lets threads wait for an epoch counter to advance: first by spinning, then
+// by parking in the kernel with std::atomic::wait (a futex on Linux,
+// WaitOnAddress on Windows). The spin budget adapts to the measured wake
+// latency. When the parked threads are woken soon after they park, a bit more
+// spinning would have saved the round trip through the kernel; when they sleep
+// long, the spinning only took cycles from sibling hyperthreads and the
+// backend threads.
+class ParkingSpot {
+ public:
+  // Returns the epoch to pass to Wait(). Read it before checking for work, so
+  // that a Notify() in between is not lost.
+  uint32_t Epoch() const { return epoch_.load(std::memory_order_acquire); }
+
+  // Blocks until the epoch is different from @epoch.
+  void Wait(uint32_t epoch) {
+    const uint32_t budget = spin_budget_.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < budget; ++i) {
+      if (epoch_.load(std::memory_order_acquire) != epoch) return;
+      SpinloopPause();
+    }
+    const auto start = std::chrono::steady_clock::now();
+    parked_.fetch_add(1, std::memory_order_seq_cst);
+    while (epoch_.load(std::memory_order_seq_cst) == epoch) {
+      epoch_.wait(epoch, std::memory_order_acquire);
+    }
+    parked_.fetch_sub(1, std::memory_order_relaxed);
+    const auto slept = std::chrono::steady_clock::now() - start;
+    if (slept < kShortPark) {
+      spin_budget_.store(std::min(budget * 2, kMaxSpins),
+                         std::memory_order_relaxed);
+    } else if (slept > kLongPark) {
+      spin_budget_.store(std::max(budget / 2, kMinSpins),
+                         std::memory_order_relaxed);
+    }
+  }
+
+  // Advances the epoch and wakes the parked threads. Only makes a system call
+  // when some thread is parked.
+  void Notify() {
+    epoch_.fetch_add(1, std::memory_order_seq_cst);
+    if (parked_.load(std::memory_order_seq_cst) > 0) epoch_.notify_all();
+  }
+
+  uint32_t GetSpinBudget() const {
+    return spin_budget_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static constexpr uint32_t kMinSpins = 16;
+  static constexpr uint32_t kMaxSpins = 1 << 16;
+  static constexpr std::chrono::microseconds kShortPark{50};
+  static constexpr std::chrono::microseconds kLongPark{2000};
+
+  alignas(64) std::atomic<uint32_t> epoch_{0};
+  std::atomic<int> parked_{0};
+  std::atomic<uint32_t> spin_budget_{1024};
+};
+
+// One-shot signal for handing a result to a single waiting thread, without a
+// mutex. The object may be destroyed as soon as Wait() returns: Wait() doesn't
+// return until Notify() has stopped touching it.
+class CompletionFlag {
+ public:
+  void Wait() {
+    int state;
+    while ((state = state_.load(std::memory_order_acquire)) != kDone) {
+      if (state == kPending) {
+        state_.wait(kPending, std::memory_order_acquire);
+      } else {
+        SpinloopPause();
+      }
+    }
+  }
+
+  void Notify() {
+    state_.store(kWaking, std::memory_order_release);
+    state_.notify_one();
+    state_.store(kDone, std::memory_order_release);
+  }
+
+ private:
+  static constexpr int kPending = 0;
+  static constexpr int kWaking = 1;
+  static constexpr int kDone = 2;
+
+  std::atomic<int> state_{kPending};
+};
+
+}  // namespace lczero
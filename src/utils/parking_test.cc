@@ -0,0 +1,92 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "utils/parking.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace lczero {
+
+TEST(ParkingSpot, ReturnsAtOnceWhenEpochAdvanced) {
+  ParkingSpot spot;
+  const uint32_t epoch = spot.Epoch();
+  spot.Notify();
+  EXPECT_NE(spot.Epoch(), epoch);
+  spot.Wait(epoch);
+}
+
+TEST(ParkingSpot, WakesParkedThreads) {
+  ParkingSpot spot;
+  std::atomic<int> woken = 0;
+  const uint32_t epoch = spot.Epoch();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&]() {
+      spot.Wait(epoch);
+      ++woken;
+    });
+  }
+  // Long enough for the waiters to run out of spins and park.
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(woken, 0);
+  spot.Notify();
+  for (auto& thread : threads) thread.join();
+  EXPECT_EQ(woken, 4);
+}
+
+TEST(ParkingSpot, LongParksShrinkSpinBudget) {
+  ParkingSpot spot;
+  const uint32_t initial_budget = spot.GetSpinBudget();
+  for (int i = 0; i < 3; ++i) {
+    const uint32_t epoch = spot.Epoch();
+    std::thread waiter([&]() { spot.Wait(epoch); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    spot.Notify();
+    waiter.join();
+  }
+  EXPECT_LT(spot.GetSpinBudget(), initial_budget);
+}
+
+TEST(CompletionFlag, WaitReturnsAfterNotify) {
+  // Destroying the flag right after Wait() returns must be safe.
+  for (int i = 0; i < 1000; ++i) {
+    auto flag = std::make_unique<CompletionFlag>();
+    int result = 0;
+    std::thread notifier([&, raw = flag.get()]() {
+      result = i;
+      raw->Notify();
+    });
+    flag->Wait();
+    flag.reset();
+    EXPECT_EQ(result, i);
+    notifier.join();
+  }
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
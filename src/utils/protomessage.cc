@@ -58,13 +58,63 @@ std::string EncodeVarInt(std::uint64_t val) {
   }
 }
 
+// Buffer of the running ParseFromRetainedBuffer() call on this thread.
+struct RetainedBuffer {
+  std::string_view data;
+  const std::shared_ptr<const void>* owner = nullptr;
+};
+thread_local RetainedBuffer retained_buffer;
+
 }  // namespace
 
+ProtoBytes& ProtoBytes::operator=(std::string_view val) {
+  const auto& [data, owner] = retained_buffer;
+  if (owner && val.data() >= data.data() &&
+      val.data() + val.size() <= data.data() + data.size()) {
+    view_ = val;
+    buffer_ = *owner;
+    owned_.clear();
+  } else {
+    owned_.assign(val);
+    view_ = {};
+    buffer_.reset();
+  }
+  return *this;
+}
+
+std::string* ProtoBytes::mutable_string() {
+  if (buffer_) {
+    owned_.assign(view_);
+    view_ = {};
+    buffer_.reset();
+  }
+  return &owned_;
+}
+
+void ProtoBytes::clear() {
+  owned_.clear();
+  view_ = {};
+  buffer_.reset();
+}
+
 void ProtoMessage::ParseFromString(std::string_view str) {
   Clear();
   return MergeFromString(str);
 }
 
+void ProtoMessage::ParseFromRetainedBuffer(std::string_view buffer,
+                                           std::shared_ptr<const void> owner) {
+  const RetainedBuffer previous = retained_buffer;
+  retained_buffer = {buffer, &owner};
+  try {
+    ParseFromString(buffer);
+  } catch (...) {
+    retained_buffer = previous;
+    throw;
+  }
+  retained_buffer = previous;
+}
+
 void ProtoMessage::MergeFromString(std::string_view str) {
   const std::uint8_t* iter = reinterpret_cast<const std::uint8_t*>(str.data());
   const std::uint8_t* const end = iter + str.size();
@@ -158,6 +208,9 @@ void ProtoMessage::AppendJsonValue(const std::string& val, std::string* out) {
   out->append(EscapeJsonString(val));
   out->append("\"");
 }
+void ProtoMessage::AppendJsonValue(const ProtoBytes& val, std::string* out) {
+  AppendJsonValue(std::string(std::string_view(val)), out);
+}
 void ProtoMessage::AppendJsonValue(bool val, std::string* out) {
   out->append(val ? "true" : "false");
 }
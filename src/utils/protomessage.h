@@ -5,6 +5,7 @@
 #include <cstring>
 #include <functional>
 #include <map>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -19,6 +20,22 @@
 
 namespace lczero {
 
+// Storage of a singular bytes or string field. Owns its data, except for the
+// fields parsed by ProtoMessage::ParseFromRetainedBuffer(), which are views
+// into the buffer and keep it alive. Modifying the field makes it own a copy.
+class ProtoBytes {
+ public:
+  ProtoBytes& operator=(std::string_view val);
+  operator std::string_view() const { return buffer_ ? view_ : owned_; }
+  std::string* mutable_string();
+  void clear();
+
+ private:
+  std::string owned_;
+  std::string_view view_;
+  std::shared_ptr<const void> buffer_;
+};
+
 class ProtoMessage {
  public:
   virtual ~ProtoMessage() {}
@@ -26,6 +43,11 @@ class ProtoMessage {
 
   void ParseFromString(std::string_view);
   void MergeFromString(std::string_view);
+  // Like ParseFromString(), but the singular bytes and string fields are views
+  // into @buffer instead of copies, and share the ownership of @owner, which
+  // keeps the buffer alive.
+  void ParseFromRetainedBuffer(std::string_view buffer,
+                               std::shared_ptr<const void> owner);
   virtual std::string OutputAsString() const = 0;
   virtual std::string OutputAsJson() const = 0;
 
@@ -74,6 +96,7 @@ class ProtoMessage {
   static void AppendJsonFieldPrefix(const std::string& name, bool* is_first,
                                     std::string* out);
   static void AppendJsonValue(const std::string& val, std::string* out);
+  static void AppendJsonValue(const ProtoBytes& val, std::string* out);
   static void AppendJsonValue(bool val, std::string* out);
   static void AppendJsonValue(double val, std::string* out);
   static void AppendJsonValue(uint64_t val, std::string* out);
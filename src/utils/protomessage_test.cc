@@ -0,0 +1,106 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "utils/protomessage.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+namespace lczero {
+namespace {
+
+// What the proto compiler generates for `optional bytes params = 1;`.
+class TestMessage final : public ProtoMessage {
+ public:
+  std::string_view params() const { return params_; }
+  std::string* mutable_params() { return params_.mutable_string(); }
+  void Clear() final { params_.clear(); }
+  std::string OutputAsString() const final {
+    std::string out;
+    AppendString(1, params_, &out);
+    return out;
+  }
+  std::string OutputAsJson() const final { return {}; }
+
+ private:
+  void SetString(int field_id, std::string_view val) final {
+    if (field_id == 1) params_ = val;
+  }
+
+  ProtoBytes params_;
+};
+
+std::string Serialize(std::string_view params) {
+  TestMessage message;
+  *message.mutable_params() = params;
+  return message.OutputAsString();
+}
+
+bool IsInside(std::string_view view, std::string_view buffer) {
+  return view.data() >= buffer.data() &&
+         view.data() + view.size() <= buffer.data() + buffer.size();
+}
+
+}  // namespace
+
+TEST(ProtoMessage, ParseFromStringCopies) {
+  const std::string buffer = Serialize("weights");
+  TestMessage message;
+  message.ParseFromString(buffer);
+  EXPECT_EQ(message.params(), "weights");
+  EXPECT_FALSE(IsInside(message.params(), buffer));
+}
+
+TEST(ProtoMessage, RetainedBufferIsNotCopied) {
+  auto buffer = std::make_shared<const std::string>(Serialize("weights"));
+  const std::weak_ptr<const std::string> weak = buffer;
+  TestMessage message;
+  message.ParseFromRetainedBuffer(*buffer, buffer);
+  EXPECT_EQ(message.params(), "weights");
+  EXPECT_TRUE(IsInside(message.params(), *buffer));
+
+  // The copy shares the view, and the buffer lives as long as either does.
+  TestMessage copy = message;
+  buffer.reset();
+  message.Clear();
+  EXPECT_FALSE(weak.expired());
+  EXPECT_EQ(copy.params(), "weights");
+  copy.Clear();
+  EXPECT_TRUE(weak.expired());
+}
+
+TEST(ProtoMessage, ModifiedRetainedFieldOwnsCopy) {
+  auto buffer = std::make_shared<const std::string>(Serialize("weights"));
+  const std::weak_ptr<const std::string> weak = buffer;
+  TestMessage message;
+  message.ParseFromRetainedBuffer(*buffer, buffer);
+  buffer.reset();
+  message.mutable_params()->append("2");
+  EXPECT_TRUE(weak.expired());
+  EXPECT_EQ(message.params(), "weights2");
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -37,6 +37,11 @@ Random& Random::Get() {
   return rand;
 }
 
+void Random::Seed(uint64_t seed) {
+  Mutex::Lock lock(mutex_);
+  gen_.seed(seed);
+}
+
 int Random::GetInt(int min, int max) {
   Mutex::Lock lock(mutex_);
   std::uniform_int_distribution<> dist(min, max);
@@ -0,0 +1,323 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/slab_allocator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "utils/mutex.h"
+
+namespace lczero {
+namespace {
+
+// Size classes have 16 byte granularity up to 1KiB, and 256 byte granularity
+// from there up to kMaxSize.
+constexpr size_t kSmallLimit = 1024;
+constexpr size_t kSmallStep = 16;
+constexpr size_t kLargeStep = 256;
+constexpr int kNumSmallClasses = kSmallLimit / kSmallStep;
+constexpr int kNumClasses =
+    kNumSmallClasses +
+    (SlabAllocator::kMaxSize - kSmallLimit) / kLargeStep;
+
+// Memory is requested from the system in chunks of this size (aligned to it,
+// so that transparent huge pages can back them).
+constexpr size_t kChunkSize = 2 * 1024 * 1024;
+// Number of bytes handed out to a thread cache in a single refill.
+constexpr size_t kBatchBytes = 64 * 1024;
+
+constexpr int SizeClass(size_t size) {
+  if (size == 0) size = 1;
+  if (size <= kSmallLimit) return (size + kSmallStep - 1) / kSmallStep - 1;
+  return kNumSmallClasses +
+         (size - kSmallLimit + kLargeStep - 1) / kLargeStep - 1;
+}
+
+constexpr size_t ClassSize(int cls) {
+  if (cls < kNumSmallClasses) return (cls + 1) * kSmallStep;
+  return kSmallLimit + (cls - kNumSmallClasses + 1) * kLargeStep;
+}
+
+constexpr size_t BatchCount(int cls) {
+  return std::clamp<size_t>(kBatchBytes / ClassSize(cls), 4, 64);
+}
+
+static_assert(SizeClass(SlabAllocator::kMaxSize) == kNumClasses - 1);
+static_assert(ClassSize(kNumClasses - 1) == SlabAllocator::kMaxSize);
+static_assert(kSmallStep % SlabAllocator::kCompactGranularity == 0);
+
+void AdviseHugePages([[maybe_unused]] void* chunk) {
+#ifdef MADV_HUGEPAGE
+  madvise(chunk, kChunkSize, MADV_HUGEPAGE);
+#endif
+}
+
+void* AllocateHeapChunk() {
+#ifdef __linux__
+  void* chunk = std::aligned_alloc(kChunkSize, kChunkSize);
+  if (!chunk) throw std::bad_alloc();
+  AdviseHugePages(chunk);
+  return chunk;
+#else
+  return ::operator new(kChunkSize);
+#endif
+}
+
+}  // namespace
+
+// Address range that backs compact allocations. Reserved on first use, and
+// committed chunk by chunk.
+class CompactRegion {
+ public:
+  // Must be called with the depot mutex locked.
+  static void* AllocateChunk() {
+    static char* next = nullptr;
+    static char* end = nullptr;
+    if (!SlabAllocator::compact_base_) {
+      auto* base = static_cast<char*>(Reserve());
+      // The first chunk is never used, so that offset 0 can mean nullptr.
+      next = base + kChunkSize;
+      end = base + SlabAllocator::kCompactRegionSize;
+      SlabAllocator::compact_base_ = base;
+    }
+    if (next == end) throw std::bad_alloc();
+    void* chunk = next;
+    next += kChunkSize;
+#ifdef _WIN32
+    if (!VirtualAlloc(chunk, kChunkSize, MEM_COMMIT, PAGE_READWRITE)) {
+      throw std::bad_alloc();
+    }
+#else
+    AdviseHugePages(chunk);
+#endif
+    return chunk;
+  }
+
+ private:
+  static void* Reserve() {
+    // The region doesn't fit into a 32-bit address space.
+    if constexpr (sizeof(void*) < 8) throw std::bad_alloc();
+    const auto size = static_cast<size_t>(SlabAllocator::kCompactRegionSize);
+#ifdef _WIN32
+    void* base = VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+    if (!base) throw std::bad_alloc();
+#else
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) throw std::bad_alloc();
+#endif
+    return base;
+  }
+};
+
+namespace {
+
+// Process-wide store of free blocks, shared between threads.
+class Depot {
+ public:
+  explicit Depot(void* (*allocate_chunk)()) : allocate_chunk_(allocate_chunk) {}
+
+  // Appends up to @count blocks of class @cls to @out.
+  void Fetch(int cls, size_t count, std::vector<void*>* out) {
+    Mutex::Lock lock(mutex_);
+    auto& free_list = free_[cls];
+    const size_t block_size = ClassSize(cls);
+    const size_t reused = std::min(count, free_list.size());
+    out->insert(out->end(), free_list.end() - reused, free_list.end());
+    free_list.resize(free_list.size() - reused);
+    free_bytes_ -= reused * block_size;
+    count -= reused;
+    while (count > 0) {
+      if (static_cast<size_t>(chunk_end_ - chunk_ptr_) < block_size) {
+        chunk_ptr_ = static_cast<char*>(allocate_chunk_());
+        chunk_end_ = chunk_ptr_ + kChunkSize;
+        reserved_bytes_ += kChunkSize;
+      }
+      out->push_back(chunk_ptr_);
+      chunk_ptr_ += block_size;
+      --count;
+    }
+  }
+
+  // Takes ownership of blocks [begin, end) of class @cls.
+  void Return(int cls, void* const* begin, void* const* end) {
+    Mutex::Lock lock(mutex_);
+    free_[cls].insert(free_[cls].end(), begin, end);
+    free_bytes_ += (end - begin) * ClassSize(cls);
+  }
+
+  size_t GetReservedBytes() const { return reserved_bytes_.load(); }
+  size_t GetFreeBytes() const { return free_bytes_.load(); }
+
+ private:
+  void* (*const allocate_chunk_)();
+  Mutex mutex_;
+  std::vector<void*> free_[kNumClasses] GUARDED_BY(mutex_);
+  // Unused tail of the most recently allocated chunk.
+  char* chunk_ptr_ GUARDED_BY(mutex_) = nullptr;
+  char* chunk_end_ GUARDED_BY(mutex_) = nullptr;
+  std::atomic<size_t> reserved_bytes_{0};
+  std::atomic<size_t> free_bytes_{0};
+};
+
+enum Arena { kHeapArena, kCompactArena, kNumArenas };
+
+// Never destroyed, as thread caches and nodes of static trees may outlive any
+// other static object.
+Depot* GetDepot(Arena arena) {
+  static Depot* depots[kNumArenas] = {
+      new Depot(&AllocateHeapChunk),
+      new Depot(&CompactRegion::AllocateChunk),
+  };
+  return depots[arena];
+}
+
+class ThreadCache {
+ public:
+  explicit ThreadCache(Depot* depot) : depot_(depot) {}
+
+  ~ThreadCache() {
+    for (int cls = 0; cls < kNumClasses; ++cls) {
+      auto& blocks = blocks_[cls];
+      if (blocks.empty()) continue;
+      depot_->Return(cls, blocks.data(), blocks.data() + blocks.size());
+    }
+  }
+
+  void* Allocate(int cls) {
+    auto& blocks = blocks_[cls];
+    if (blocks.empty()) depot_->Fetch(cls, BatchCount(cls), &blocks);
+    void* ptr = blocks.back();
+    blocks.pop_back();
+    return ptr;
+  }
+
+  void Deallocate(int cls, void* ptr) {
+    auto& blocks = blocks_[cls];
+    const size_t batch = BatchCount(cls);
+    if (blocks.size() >= 2 * batch) {
+      // Hand the older half back so that other threads can reuse it.
+      depot_->Return(cls, blocks.data(), blocks.data() + batch);
+      blocks.erase(blocks.begin(), blocks.begin() + batch);
+    }
+    blocks.push_back(ptr);
+  }
+
+ private:
+  Depot* const depot_;
+  std::vector<void*> blocks_[kNumClasses];
+};
+
+// Plain pointers rather than a thread_local object, so that deallocations
+// which happen after the thread's cache has been torn down (e.g. from static
+// destructors) still have a valid, if slower, path.
+thread_local ThreadCache* tls_caches[kNumArenas] = {};
+thread_local bool tls_caches_destroyed = false;
+
+struct ThreadCacheHolder {
+  ~ThreadCacheHolder() {
+    for (auto*& cache : tls_caches) {
+      delete cache;
+      cache = nullptr;
+    }
+    tls_caches_destroyed = true;
+  }
+};
+
+// Returns nullptr if the calling thread is already shutting down.
+ThreadCache* GetThreadCache(Arena arena) {
+  ThreadCache* cache = tls_caches[arena];
+  if (cache || tls_caches_destroyed) return cache;
+  thread_local ThreadCacheHolder holder;
+  cache = new ThreadCache(GetDepot(arena));
+  tls_caches[arena] = cache;
+  return cache;
+}
+
+void* AllocateBlock(Arena arena, int cls) {
+  if (auto* cache = GetThreadCache(arena)) return cache->Allocate(cls);
+  std::vector<void*> block;
+  GetDepot(arena)->Fetch(cls, 1, &block);
+  return block.front();
+}
+
+void DeallocateBlock(Arena arena, int cls, void* ptr) {
+  if (auto* cache = GetThreadCache(arena)) {
+    cache->Deallocate(cls, ptr);
+  } else {
+    GetDepot(arena)->Return(cls, &ptr, &ptr + 1);
+  }
+}
+
+}  // namespace
+
+void* SlabAllocator::Allocate(size_t size) {
+  if (size > kMaxSize) return ::operator new(size);
+  return AllocateBlock(kHeapArena, SizeClass(size));
+}
+
+void SlabAllocator::Deallocate(void* ptr, size_t size) {
+  if (!ptr) return;
+  if (size > kMaxSize) {
+    ::operator delete(ptr);
+    return;
+  }
+  DeallocateBlock(kHeapArena, SizeClass(size), ptr);
+}
+
+void* SlabAllocator::AllocateCompact(size_t size) {
+  if (size > kMaxSize) throw std::bad_alloc();
+  return AllocateBlock(kCompactArena, SizeClass(size));
+}
+
+void SlabAllocator::DeallocateCompact(void* ptr, size_t size) {
+  if (!ptr) return;
+  DeallocateBlock(kCompactArena, SizeClass(size), ptr);
+}
+
+size_t SlabAllocator::GetReservedBytes() {
+  return GetDepot(kHeapArena)->GetReservedBytes() +
+         GetDepot(kCompactArena)->GetReservedBytes();
+}
+
+size_t SlabAllocator::GetFreeBytes() {
+  return GetDepot(kHeapArena)->GetFreeBytes() +
+         GetDepot(kCompactArena)->GetFreeBytes();
+}
+
+}  // namespace lczero
@@ -0,0 +1,86 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace lczero {
+
+// Size-classed slab allocator for small, frequently allocated and freed
+// objects (search tree nodes and edge arrays). Memory is carved from large
+// (huge page backed where available) chunks, and every thread keeps a small
+// cache of free blocks per size class so that the hot path doesn't take any
+// locks. Freed blocks are recycled within their size class rather than
+// returned to the system, which keeps fragmentation of long analysis sessions
+// bounded by the peak live size.
+//
+// Allocations larger than kMaxSize are passed through to ::operator new.
+class SlabAllocator {
+ public:
+  static constexpr size_t kMaxSize = 16384;
+
+  static void* Allocate(size_t size);
+  // @size must be the same value that was passed to Allocate().
+  static void Deallocate(void* ptr, size_t size);
+
+  // Same as above, but the blocks come from a single reserved address range,
+  // so that they can be referred to by 32-bit offsets (see
+  // utils/compact_ptr.h). @size must not exceed kMaxSize, and throws
+  // std::bad_alloc when the range is exhausted.
+  static void* AllocateCompact(size_t size);
+  static void DeallocateCompact(void* ptr, size_t size);
+
+  // Offsets are in units of kCompactGranularity bytes, 0 is nullptr.
+  static constexpr size_t kCompactGranularity = 16;
+  static constexpr uint64_t kCompactRegionSize = uint64_t{kCompactGranularity}
+                                                 << 32;
+  static uint32_t ToCompactOffset(const void* ptr) {
+    if (!ptr) return 0;
+    return (static_cast<const char*>(ptr) - compact_base_) /
+           kCompactGranularity;
+  }
+  static void* FromCompactOffset(uint32_t offset) {
+    if (!offset) return nullptr;
+    return compact_base_ + static_cast<size_t>(offset) * kCompactGranularity;
+  }
+
+  // Total amount of memory reserved from the system, in bytes.
+  static size_t GetReservedBytes();
+  // Memory of freed blocks waiting to be reused, not counting the few blocks
+  // every thread keeps to itself.
+  static size_t GetFreeBytes();
+
+ private:
+  // Start of the compact region, set before the first compact block is
+  // handed out.
+  static inline char* compact_base_ = nullptr;
+  friend class CompactRegion;
+};
+
+}  // namespace lczero
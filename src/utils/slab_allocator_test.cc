@@ -0,0 +1,108 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/slab_allocator.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace lczero {
+
+TEST(SlabAllocator, BlocksDontOverlap) {
+  std::vector<std::pair<char*, size_t>> blocks;
+  for (size_t size = 1; size <= SlabAllocator::kMaxSize + 100; size += 37) {
+    auto* ptr = static_cast<char*>(SlabAllocator::Allocate(size));
+    std::memset(ptr, static_cast<int>(size & 0xff), size);
+    blocks.emplace_back(ptr, size);
+  }
+  for (const auto& [ptr, size] : blocks) {
+    for (size_t i = 0; i < size; ++i) {
+      ASSERT_EQ(static_cast<unsigned char>(ptr[i]), size & 0xff);
+    }
+  }
+  for (const auto& [ptr, size] : blocks) SlabAllocator::Deallocate(ptr, size);
+}
+
+TEST(SlabAllocator, Alignment) {
+  for (size_t size : {1, 8, 16, 24, 64, 1000, 1100, 16384}) {
+    void* ptr = SlabAllocator::Allocate(size);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % 16, 0u);
+    SlabAllocator::Deallocate(ptr, size);
+  }
+}
+
+TEST(SlabAllocator, ReusesFreedBlocks) {
+  std::vector<void*> blocks;
+  for (int i = 0; i < 10000; ++i) blocks.push_back(SlabAllocator::Allocate(64));
+  const size_t reserved = SlabAllocator::GetReservedBytes();
+  for (void* ptr : blocks) SlabAllocator::Deallocate(ptr, 64);
+  blocks.clear();
+  for (int i = 0; i < 10000; ++i) blocks.push_back(SlabAllocator::Allocate(64));
+  EXPECT_EQ(reserved, SlabAllocator::GetReservedBytes());
+  EXPECT_EQ(std::set<void*>(blocks.begin(), blocks.end()).size(),
+            blocks.size());
+  for (void* ptr : blocks) SlabAllocator::Deallocate(ptr, 64);
+}
+
+TEST(SlabAllocator, FreeOnAnotherThread) {
+  std::vector<void*> blocks;
+  for (int i = 0; i < 5000; ++i) blocks.push_back(SlabAllocator::Allocate(48));
+  std::thread([&blocks]() {
+    for (void* ptr : blocks) SlabAllocator::Deallocate(ptr, 48);
+  }).join();
+  // Blocks returned by the exited thread are available again.
+  const size_t reserved = SlabAllocator::GetReservedBytes();
+  blocks.clear();
+  for (int i = 0; i < 5000; ++i) blocks.push_back(SlabAllocator::Allocate(48));
+  EXPECT_EQ(reserved, SlabAllocator::GetReservedBytes());
+  for (void* ptr : blocks) SlabAllocator::Deallocate(ptr, 48);
+}
+
+TEST(SlabAllocator, CompactOffsets) {
+  EXPECT_EQ(SlabAllocator::ToCompactOffset(nullptr), 0u);
+  EXPECT_EQ(SlabAllocator::FromCompactOffset(0), nullptr);
+  for (size_t size : {16, 48, 4800, 16384}) {
+    void* ptr = SlabAllocator::AllocateCompact(size);
+    const uint32_t offset = SlabAllocator::ToCompactOffset(ptr);
+    EXPECT_NE(offset, 0u);
+    EXPECT_EQ(SlabAllocator::FromCompactOffset(offset), ptr);
+    std::memset(ptr, 0, size);
+    SlabAllocator::DeallocateCompact(ptr, size);
+  }
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -52,6 +52,28 @@ std::vector<std::string> StrSplitAtWhitespace(const std::string& str) {
   return result;
 }
 
+void StrSplitAtWhitespace(std::string_view str,
+                          std::vector<std::string>* result) {
+  size_t count = 0;
+  for (auto token = StrNextToken(&str); !token.empty();
+       token = StrNextToken(&str)) {
+    if (count == result->size()) result->emplace_back();
+    (*result)[count++].assign(token);
+  }
+  result->resize(count);
+}
+
+std::string_view StrNextToken(std::string_view* str) {
+  auto is_space = [](char ch) {
+    return std::isspace(static_cast<unsigned char>(ch));
+  };
+  const auto begin = std::find_if_not(str->begin(), str->end(), is_space);
+  const auto end = std::find_if(begin, str->end(), is_space);
+  const std::string_view token(begin, end);
+  str->remove_prefix(end - str->begin());
+  return token;
+}
+
 std::vector<std::string> StrSplit(const std::string& str,
                                   const std::string& delim) {
   std::vector<std::string> result;
@@ -28,6 +28,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace lczero {
@@ -39,6 +40,14 @@ std::string StrJoin(const std::vector<std::string>& strings,
 // Splits strings at whitespace.
 std::vector<std::string> StrSplitAtWhitespace(const std::string& str);
 
+// Splits @str at whitespace into @result, reusing the storage of its strings.
+void StrSplitAtWhitespace(std::string_view str,
+                          std::vector<std::string>* result);
+
+// Removes the next whitespace separated token from the front of @str and
+// returns it. Returns an empty view when there are no tokens left.
+std::string_view StrNextToken(std::string_view* str);
+
 // Split string by delimiter.
 std::vector<std::string> StrSplit(const std::string& str,
                                   const std::string& delim);
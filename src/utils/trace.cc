@@ -0,0 +1,131 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+#include "utils/logging.h"
+
+namespace lczero {
+
+namespace {
+// Oldest events of a wrapped buffer which are not written out, as the owning
+// thread may be overwriting them while the trace is written.
+const uint64_t kWrapMargin = 256;
+}  // namespace
+
+// Owns the calling thread's buffer and gives it back when the thread exits.
+class ThreadBufferHolder {
+ public:
+  ThreadBufferHolder() : buffer(Tracer::Get().AcquireBuffer()) {}
+  ~ThreadBufferHolder() { Tracer::Get().ReleaseBuffer(buffer); }
+
+  Tracer::ThreadBuffer* const buffer;
+};
+
+Tracer& Tracer::Get() {
+  static Tracer tracer;
+  return tracer;
+}
+
+void Tracer::SetFilename(const std::string& filename) {
+  Mutex::Lock lock(mutex_);
+  if (filename_ == filename) return;
+  enabled_.store(false, std::memory_order_relaxed);
+  if (!filename_.empty()) WriteTrace();
+  filename_ = filename;
+  if (filename_.empty()) return;
+  for (auto& buffer : buffers_) {
+    buffer->first = buffer->head.load(std::memory_order_acquire);
+  }
+  enabled_.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::Record(const char* name, uint64_t start, uint64_t end,
+                    const char* arg_name, int64_t arg) {
+  thread_local ThreadBufferHolder holder;
+  ThreadBuffer* buffer = holder.buffer;
+  const uint64_t head = buffer->head.load(std::memory_order_relaxed);
+  buffer->events[head % kEventsPerThread] = {name, arg_name, start, end, arg};
+  buffer->head.store(head + 1, std::memory_order_release);
+}
+
+Tracer::ThreadBuffer* Tracer::AcquireBuffer() {
+  Mutex::Lock lock(mutex_);
+  if (!free_buffers_.empty()) {
+    ThreadBuffer* buffer = free_buffers_.back();
+    free_buffers_.pop_back();
+    return buffer;
+  }
+  buffers_.push_back(std::make_unique<ThreadBuffer>());
+  buffers_.back()->tid = static_cast<int>(buffers_.size());
+  return buffers_.back().get();
+}
+
+void Tracer::ReleaseBuffer(ThreadBuffer* buffer) {
+  Mutex::Lock lock(mutex_);
+  free_buffers_.push_back(buffer);
+}
+
+void Tracer::WriteTrace() {
+  std::ofstream file(filename_);
+  if (!file) {
+    CERR << "Unable to write trace to " << filename_;
+    return;
+  }
+  file << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+  bool first_event = true;
+  for (const auto& buffer : buffers_) {
+    file << (first_event ? "" : ",") << "\n{\"name\":\"thread_name\","
+         << "\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+         << ",\"args\":{\"name\":\"thread " << buffer->tid << "\"}}";
+    first_event = false;
+    const uint64_t head = buffer->head.load(std::memory_order_acquire);
+    uint64_t idx = buffer->first;
+    if (head - idx > kEventsPerThread) {
+      idx = head - kEventsPerThread + kWrapMargin;
+    }
+    for (; idx < head; ++idx) {
+      const Event& event = buffer->events[idx % kEventsPerThread];
+      file << ",\n{\"name\":\"" << event.name
+           << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+           << ",\"ts\":" << event.start / 1000.0
+           << ",\"dur\":" << (event.end - event.start) / 1000.0;
+      if (event.arg_name) {
+        file << ",\"args\":{\"" << event.arg_name << "\":" << event.arg << "}";
+      }
+      file << "}";
+    }
+  }
+  file << "\n]}\n";
+  LOGFILE << "Trace written to " << filename_;
+}
+
+}  // namespace lczero
@@ -0,0 +1,133 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2025 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// Records timeline events (search phases, backend computations, cache
+// lookups) from all threads and writes them in the Chrome trace event format,
+// which chrome://tracing and ui.perfetto.dev open.
+//
+// Every thread appends to its own ring buffer without taking locks, so only
+// the newest kEventsPerThread events of each thread are kept. Events still
+// being recorded while the trace is written out may be dropped.
+class Tracer {
+ public:
+  static constexpr size_t kEventsPerThread = 1 << 16;
+
+  static Tracer& Get();
+
+  // Starts recording to be written to @filename. If a recording was already
+  // in progress, it is written to its file first. Empty name stops recording.
+  void SetFilename(const std::string& filename);
+
+  bool IsEnabled() const { return enabled_.load(std::memory_order_relaxed); }
+  // Nanoseconds since the tracer was created.
+  uint64_t Now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - epoch_)
+        .count();
+  }
+  // Adds an event spanning from @start to @end to the calling thread's
+  // buffer. @name and @arg_name must be string literals, or otherwise outlive
+  // the tracer. @arg_name may be nullptr when there is no argument.
+  void Record(const char* name, uint64_t start, uint64_t end,
+              const char* arg_name, int64_t arg);
+
+ private:
+  struct Event {
+    const char* name;
+    const char* arg_name;
+    uint64_t start;
+    uint64_t end;
+    int64_t arg;
+  };
+  struct ThreadBuffer {
+    int tid;
+    // Total number of events recorded, the last one at
+    // events[(head - 1) % kEventsPerThread]. Written by the owning thread only.
+    std::atomic<uint64_t> head{0};
+    // Value of head when the current recording started, guarded by mutex_.
+    uint64_t first = 0;
+    Event events[kEventsPerThread];
+  };
+  friend class ThreadBufferHolder;
+
+  Tracer() = default;
+  ThreadBuffer* AcquireBuffer();
+  void ReleaseBuffer(ThreadBuffer* buffer);
+  void WriteTrace() REQUIRES(mutex_);
+
+  std::atomic<bool> enabled_{false};
+  const std::chrono::steady_clock::time_point epoch_ =
+      std::chrono::steady_clock::now();
+
+  Mutex mutex_;
+  std::string filename_ GUARDED_BY(mutex_);
+  // Buffers are never freed; the ones of finished threads are handed to new
+  // threads, which then show up on the same timeline row.
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers_ GUARDED_BY(mutex_);
+  std::vector<ThreadBuffer*> free_buffers_ GUARDED_BY(mutex_);
+};
+
+// Records the lifetime of the scope as an event, when the tracer is enabled
+// at its start. Costs one relaxed atomic load when it is not.
+class TraceScope {
+ public:
+  explicit TraceScope(const char* name)
+      : name_(Tracer::Get().IsEnabled() ? name : nullptr),
+        start_(name_ ? Tracer::Get().Now() : 0) {}
+  ~TraceScope() {
+    if (name_) {
+      Tracer::Get().Record(name_, start_, Tracer::Get().Now(), arg_name_, arg_);
+    }
+  }
+
+  // Attaches a value to the event, e.g. the batch size.
+  void SetArg(const char* arg_name, int64_t arg) {
+    arg_name_ = arg_name;
+    arg_ = arg;
+  }
+
+ private:
+  const char* const name_;
+  const uint64_t start_;
+  const char* arg_name_ = nullptr;
+  int64_t arg_ = 0;
+};
+
+}  // namespace lczero
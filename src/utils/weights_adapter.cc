@@ -27,10 +27,35 @@
 
 #include "src/utils/weights_adapter.h"
 
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include "utils/fp16_utils.h"
+
 namespace lczero {
+namespace {
+// The params are not necessarily aligned, when they are a view into the
+// weights file.
+uint16_t LoadUnaligned(const uint16_t* ptr) {
+  uint16_t val;
+  std::memcpy(&val, ptr, sizeof(val));
+  return val;
+}
+
+// Written to be vectorized, and to produce the same values as ExtractValue().
+void Decode(const uint16_t* data, size_t size, float min, float range,
+            float* dst) {
+  for (size_t i = 0; i < size; ++i) {
+    dst[i] = LoadUnaligned(data + i) / static_cast<float>(0xffff) * range + min;
+  }
+}
+}  // namespace
+
 float LayerAdapter::Iterator::ExtractValue(const uint16_t* ptr,
                                            const LayerAdapter* adapter) {
-  return *ptr / static_cast<float>(0xffff) * adapter->range_ + adapter->min_;
+  return LoadUnaligned(ptr) / static_cast<float>(0xffff) * adapter->range_ +
+         adapter->min_;
 }
 
 LayerAdapter::LayerAdapter(const pblczero::Weights::Layer& layer)
@@ -40,8 +65,25 @@ LayerAdapter::LayerAdapter(const pblczero::Weights::Layer& layer)
       range_(layer.max_val() - min_) {}
 
 std::vector<float> LayerAdapter::as_vector() const {
-  return std::vector<float>(begin(), end());
+  std::vector<float> result(size_);
+  CopyTo(result);
+  return result;
 }
+
+void LayerAdapter::CopyTo(std::span<float> dst) const {
+  Decode(data_, size_, min_, range_, dst.data());
+}
+
+void LayerAdapter::CopyToFp16(std::span<uint16_t> dst) const {
+  // Decoded a block at a time, which stays in L1.
+  std::array<float, 256> block;
+  for (size_t start = 0; start < size_; start += block.size()) {
+    const size_t count = std::min(block.size(), size_ - start);
+    Decode(data_ + start, count, min_, range_, block.data());
+    for (size_t i = 0; i < count; ++i) dst[start + i] = FP32toFP16(block[i]);
+  }
+}
+
 float LayerAdapter::Iterator::operator*() const {
   return ExtractValue(data_, adapter_);
 }
@@ -28,6 +28,7 @@
 #pragma once
 
 #include <iterator>
+#include <span>
 #include <vector>
 
 #include "proto/net.pb.h"
@@ -81,6 +82,10 @@ class LayerAdapter {
 
   LayerAdapter(const pblczero::Weights::Layer& layer);
   std::vector<float> as_vector() const;
+  // Decodes all the values into @dst, which must have size() elements.
+  void CopyTo(std::span<float> dst) const;
+  // Same, but converted to fp16, for backends that upload half weights.
+  void CopyToFp16(std::span<uint16_t> dst) const;
   size_t size() const { return size_; }
   float operator[](size_t idx) const { return begin()[idx]; }
   Iterator begin() const { return {this, data_}; }